@@ -35,6 +35,10 @@
 #include "strxcpyx.h"
 #include "fileio.h"
 #include "strv.h"
+#include "special.h"
+#include "unit-name.h"
+#include "serialize.h"
+#include "def.h"
 
 #define SCALE_X (0.1 / 1000.0)   /* pixels per us */
 #define SCALE_Y 20.0
@@ -64,6 +68,7 @@ static enum dot {
 } arg_dot = DEP_ALL;
 static char** arg_dot_from_patterns = NULL;
 static char** arg_dot_to_patterns = NULL;
+static const char *arg_offline = NULL;
 
 struct boot_times {
         usec_t firmware_time;
@@ -81,6 +86,7 @@ struct unit_times {
         usec_t axt;
         usec_t aet;
         usec_t time;
+        char **after;
 };
 
 static int bus_get_uint64_property(DBusConnection *bus, const char *path, const char *interface, const char *property, uint64_t *val) {
@@ -148,43 +154,257 @@ static int get_os_name(char **_n) {
 static void free_unit_times(struct unit_times *t, unsigned n) {
         struct unit_times *p;
 
-        for (p = t; p < t + n; p++)
+        for (p = t; p < t + n; p++) {
                 free(p->name);
+                strv_free(p->after);
+        }
 
         free(t);
 }
 
+static int load_boot_timing(struct boot_times *bt, char **default_target, struct unit_times **out) {
+        _cleanup_free_ char *buffer = NULL;
+        struct unit_times *unit_times = NULL;
+        size_t allocated = 0, allocated_units = 0;
+        char *k, *v;
+        FILE *f;
+        int r, c = 0;
+
+        /* Reads the snapshot the system manager wrote when bootup
+         * finished, see manager_write_boot_timing() */
+        f = fopen(arg_offline, "re");
+        if (!f) {
+                r = -errno;
+
+                if (r == -ENOENT)
+                        log_error("No boot timing data in %s, bootup is not yet finished or the data came from an older manager.", arg_offline);
+                else
+                        log_error("Failed to open %s: %s", arg_offline, strerror(-r));
+                return r;
+        }
+
+        while ((r = deserialize_item(f, false, &buffer, &allocated, &k, &v)) > 0) {
+                dual_timestamp ts = {};
+
+                if (streq(k, "default-target")) {
+                        if (default_target) {
+                                free(*default_target);
+                                *default_target = strdup(v);
+                                if (!*default_target) {
+                                        r = log_oom();
+                                        goto fail;
+                                }
+                        }
+
+                        continue;
+                }
+
+                if (!bt)
+                        continue;
+
+                dual_timestamp_deserialize(v, &ts);
+
+                if (streq(k, "firmware-timestamp"))
+                        bt->firmware_time = ts.monotonic;
+                else if (streq(k, "loader-timestamp"))
+                        bt->loader_time = ts.monotonic;
+                else if (streq(k, "kernel-timestamp"))
+                        bt->kernel_time = ts.realtime;
+                else if (streq(k, "initrd-timestamp"))
+                        bt->initrd_time = ts.monotonic;
+                else if (streq(k, "userspace-timestamp"))
+                        bt->userspace_time = ts.monotonic;
+                else if (streq(k, "finish-timestamp"))
+                        bt->finish_time = ts.monotonic;
+        }
+        if (r < 0)
+                goto parse_fail;
+
+        while (out) {
+                struct unit_times *t;
+
+                r = deserialize_item(f, false, &buffer, &allocated, &k, &v);
+                if (r < 0)
+                        goto parse_fail;
+                if (r == 0) {
+                        if (feof(f))
+                                break;
+
+                        continue;
+                }
+
+                if (!GREEDY_REALLOC(unit_times, allocated_units, c + 1)) {
+                        r = log_oom();
+                        goto fail;
+                }
+
+                t = unit_times + c;
+                zero(*t);
+
+                /* The first item of a section names the unit */
+                t->name = strdup(k);
+                if (!t->name) {
+                        r = log_oom();
+                        goto fail;
+                }
+                c++;
+
+                while ((r = deserialize_item(f, false, &buffer, &allocated, &k, &v)) > 0) {
+                        dual_timestamp ts = {};
+
+                        if (streq(k, "after")) {
+                                if (strv_extend(&t->after, v) < 0) {
+                                        r = log_oom();
+                                        goto fail;
+                                }
+
+                                continue;
+                        }
+
+                        dual_timestamp_deserialize(v, &ts);
+
+                        if (streq(k, "inactive-exit-timestamp"))
+                                t->ixt = ts.monotonic;
+                        else if (streq(k, "active-enter-timestamp"))
+                                t->aet = ts.monotonic;
+                        else if (streq(k, "active-exit-timestamp"))
+                                t->axt = ts.monotonic;
+                        else if (streq(k, "inactive-enter-timestamp"))
+                                t->iet = ts.monotonic;
+                }
+                if (r < 0)
+                        goto parse_fail;
+
+                if (t->aet >= t->ixt)
+                        t->time = t->aet - t->ixt;
+                else if (t->iet >= t->ixt)
+                        t->time = t->iet - t->ixt;
+                else
+                        t->time = 0;
+        }
+
+        fclose(f);
+
+        if (out)
+                *out = unit_times;
+
+        return c;
+
+parse_fail:
+        log_error("Failed to parse %s: %s", arg_offline, strerror(-r));
+fail:
+        free_unit_times(unit_times, (unsigned) c);
+        fclose(f);
+        return r;
+}
+
+static int parse_unit_times(DBusMessageIter *iter, struct unit_times *t) {
+        DBusMessageIter sub;
+
+        /* Picks the values we asked for out of the a{sv} of one unit */
+        for (dbus_message_iter_recurse(iter, &sub);
+             dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID;
+             dbus_message_iter_next(&sub)) {
+                DBusMessageIter sub2, sub3;
+                const char *name;
+                usec_t *v = NULL;
+
+                if (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_DICT_ENTRY)
+                        return -EIO;
+
+                dbus_message_iter_recurse(&sub, &sub2);
+
+                if (bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_STRING, &name, true) < 0 ||
+                    dbus_message_iter_get_arg_type(&sub2) != DBUS_TYPE_VARIANT)
+                        return -EIO;
+
+                dbus_message_iter_recurse(&sub2, &sub3);
+
+                if (streq(name, "After")) {
+                        if (bus_parse_strv_iter(&sub3, &t->after) < 0)
+                                return -EIO;
+
+                        continue;
+                }
+
+                if (streq(name, "InactiveExitTimestampMonotonic"))
+                        v = &t->ixt;
+                else if (streq(name, "ActiveEnterTimestampMonotonic"))
+                        v = &t->aet;
+                else if (streq(name, "ActiveExitTimestampMonotonic"))
+                        v = &t->axt;
+                else if (streq(name, "InactiveEnterTimestampMonotonic"))
+                        v = &t->iet;
+                else
+                        continue;
+
+                assert_cc(sizeof(usec_t) == sizeof(uint64_t));
+
+                if (bus_iter_get_basic_and_next(&sub3, DBUS_TYPE_UINT64, v, false) < 0)
+                        return -EIO;
+        }
+
+        return 0;
+}
+
 static int acquire_time_data(DBusConnection *bus, struct unit_times **out) {
-        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
+        _cleanup_dbus_message_unref_ DBusMessage *m = NULL, *reply = NULL;
+        static const char * const properties[] = {
+                "InactiveExitTimestampMonotonic",
+                "ActiveEnterTimestampMonotonic",
+                "ActiveExitTimestampMonotonic",
+                "InactiveEnterTimestampMonotonic",
+                "After",
+                NULL
+        };
+        DBusError error;
         DBusMessageIter iter, sub;
-        int r, c = 0, n_units = 0;
         struct unit_times *unit_times = NULL;
+        size_t allocated = 0;
+        int r, c = 0;
 
-        r = bus_method_call_with_reply(
-                        bus,
+        if (arg_offline)
+                return load_boot_timing(NULL, NULL, out);
+
+        dbus_error_init(&error);
+
+        /* Fetch everything with a single call, instead of four
+         * round trips for each unit */
+        m = dbus_message_new_method_call(
                         "org.freedesktop.systemd1",
                         "/org/freedesktop/systemd1",
                         "org.freedesktop.systemd1.Manager",
-                        "ListUnits",
-                        &reply,
-                        NULL,
-                        DBUS_TYPE_INVALID);
-        if (r < 0)
-                goto fail;
+                        "ListUnitsFiltered");
+        if (!m)
+                return log_oom();
+
+        dbus_message_iter_init_append(m, &iter);
+
+        if (bus_append_strv_iter(&iter, NULL) < 0 ||
+            bus_append_strv_iter(&iter, NULL) < 0 ||
+            bus_append_strv_iter(&iter, (char**) properties) < 0)
+                return log_oom();
+
+        reply = dbus_connection_send_with_reply_and_block(bus, m, -1, &error);
+        if (!reply) {
+                log_error("Failed to issue method call: %s", bus_error_message(&error));
+                dbus_error_free(&error);
+                return -EIO;
+        }
 
         if (!dbus_message_iter_init(reply, &iter) ||
                         dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY ||
                         dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_STRUCT)  {
                 log_error("Failed to parse reply.");
-                r = -EIO;
-                goto fail;
+                return -EIO;
         }
 
         for (dbus_message_iter_recurse(&iter, &sub);
              dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID;
              dbus_message_iter_next(&sub)) {
-                struct unit_info u;
+                DBusMessageIter sub2;
                 struct unit_times *t;
+                const char *id;
 
                 if (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_STRUCT) {
                         log_error("Failed to parse reply.");
@@ -192,44 +412,21 @@ static int acquire_time_data(DBusConnection *bus, struct unit_times **out) {
                         goto fail;
                 }
 
-                if (c >= n_units) {
-                        struct unit_times *w;
-
-                        n_units = MAX(2*c, 16);
-                        w = realloc(unit_times, sizeof(struct unit_times) * n_units);
-
-                        if (!w) {
-                                r = log_oom();
-                                goto fail;
-                        }
-
-                        unit_times = w;
+                if (!GREEDY_REALLOC(unit_times, allocated, c + 1)) {
+                        r = log_oom();
+                        goto fail;
                 }
-                t = unit_times+c;
-                t->name = NULL;
 
-                r = bus_parse_unit_info(&sub, &u);
-                if (r < 0)
-                        goto fail;
+                t = unit_times+c;
+                zero(*t);
 
-                assert_cc(sizeof(usec_t) == sizeof(uint64_t));
+                dbus_message_iter_recurse(&sub, &sub2);
 
-                if (bus_get_uint64_property(bus, u.unit_path,
-                                            "org.freedesktop.systemd1.Unit",
-                                            "InactiveExitTimestampMonotonic",
-                                            &t->ixt) < 0 ||
-                    bus_get_uint64_property(bus, u.unit_path,
-                                            "org.freedesktop.systemd1.Unit",
-                                            "ActiveEnterTimestampMonotonic",
-                                            &t->aet) < 0 ||
-                    bus_get_uint64_property(bus, u.unit_path,
-                                            "org.freedesktop.systemd1.Unit",
-                                            "ActiveExitTimestampMonotonic",
-                                            &t->axt) < 0 ||
-                    bus_get_uint64_property(bus, u.unit_path,
-                                            "org.freedesktop.systemd1.Unit",
-                                            "InactiveEnterTimestampMonotonic",
-                                            &t->iet) < 0) {
+                if (bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_STRING, &id, true) < 0 ||
+                    dbus_message_iter_get_arg_type(&sub2) != DBUS_TYPE_ARRAY ||
+                    parse_unit_times(&sub2, t) < 0) {
+                        strv_free(t->after);
+                        log_error("Failed to parse reply.");
                         r = -EIO;
                         goto fail;
                 }
@@ -241,11 +438,14 @@ static int acquire_time_data(DBusConnection *bus, struct unit_times **out) {
                 else
                         t->time = 0;
 
-                if (t->ixt == 0)
+                if (t->ixt == 0) {
+                        strv_free(t->after);
                         continue;
+                }
 
-                t->name = strdup(u.id);
+                t->name = strdup(id);
                 if (t->name == NULL) {
+                        strv_free(t->after);
                         r = log_oom();
                         goto fail;
                 }
@@ -260,47 +460,59 @@ fail:
         return r;
 }
 
-static int acquire_boot_times(DBusConnection *bus, struct boot_times **bt) {
-        static struct boot_times times;
-        static bool cached = false;
-
-        if (cached)
-                goto finish;
-
-        assert_cc(sizeof(usec_t) == sizeof(uint64_t));
-
+static int bus_get_boot_times(DBusConnection *bus, struct boot_times *times) {
         if (bus_get_uint64_property(bus,
                                     "/org/freedesktop/systemd1",
                                     "org.freedesktop.systemd1.Manager",
                                     "FirmwareTimestampMonotonic",
-                                    &times.firmware_time) < 0 ||
+                                    &times->firmware_time) < 0 ||
             bus_get_uint64_property(bus,
                                     "/org/freedesktop/systemd1",
                                     "org.freedesktop.systemd1.Manager",
                                     "LoaderTimestampMonotonic",
-                                    &times.loader_time) < 0 ||
+                                    &times->loader_time) < 0 ||
             bus_get_uint64_property(bus,
                                     "/org/freedesktop/systemd1",
                                     "org.freedesktop.systemd1.Manager",
                                     "KernelTimestamp",
-                                    &times.kernel_time) < 0 ||
+                                    &times->kernel_time) < 0 ||
             bus_get_uint64_property(bus,
                                     "/org/freedesktop/systemd1",
                                     "org.freedesktop.systemd1.Manager",
                                     "InitRDTimestampMonotonic",
-                                    &times.initrd_time) < 0 ||
+                                    &times->initrd_time) < 0 ||
             bus_get_uint64_property(bus,
                                     "/org/freedesktop/systemd1",
                                     "org.freedesktop.systemd1.Manager",
                                     "UserspaceTimestampMonotonic",
-                                    &times.userspace_time) < 0 ||
+                                    &times->userspace_time) < 0 ||
             bus_get_uint64_property(bus,
                                     "/org/freedesktop/systemd1",
                                     "org.freedesktop.systemd1.Manager",
                                     "FinishTimestampMonotonic",
-                                    &times.finish_time) < 0)
+                                    &times->finish_time) < 0)
                 return -EIO;
 
+        return 0;
+}
+
+static int acquire_boot_times(DBusConnection *bus, struct boot_times **bt) {
+        static struct boot_times times;
+        static bool cached = false;
+        int r;
+
+        if (cached)
+                goto finish;
+
+        assert_cc(sizeof(usec_t) == sizeof(uint64_t));
+
+        if (arg_offline)
+                r = load_boot_timing(&times, NULL, NULL);
+        else
+                r = bus_get_boot_times(bus, &times);
+        if (r < 0)
+                return r;
+
         if (times.finish_time <= 0) {
                 log_error("Bootup is not yet finished. Please try again later.");
                 return -EAGAIN;
@@ -570,6 +782,505 @@ static int analyze_blame(DBusConnection *bus) {
         return 0;
 }
 
+struct generator_times {
+        const char *name;
+        usec_t time;
+        const char *result;
+};
+
+static int compare_generator_time(const void *a, const void *b) {
+        return compare(((struct generator_times *)b)->time,
+                       ((struct generator_times *)a)->time);
+}
+
+static int analyze_generators(DBusConnection *bus) {
+        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
+        _cleanup_free_ struct generator_times *times = NULL;
+        const char *interface = "org.freedesktop.systemd1.Manager", *property = "GeneratorTimings";
+        DBusMessageIter iter, sub, sub2;
+        size_t allocated = 0;
+        unsigned n = 0, i;
+        int r;
+
+        r = bus_method_call_with_reply(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.DBus.Properties",
+                        "Get",
+                        &reply,
+                        NULL,
+                        DBUS_TYPE_STRING, &interface,
+                        DBUS_TYPE_STRING, &property,
+                        DBUS_TYPE_INVALID);
+        if (r < 0)
+                return r;
+
+        if (!dbus_message_iter_init(reply, &iter) ||
+            dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_VARIANT)  {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        dbus_message_iter_recurse(&iter, &sub);
+
+        if (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_ARRAY ||
+            dbus_message_iter_get_element_type(&sub) != DBUS_TYPE_STRUCT)  {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        for (dbus_message_iter_recurse(&sub, &sub2);
+             dbus_message_iter_get_arg_type(&sub2) != DBUS_TYPE_INVALID;
+             dbus_message_iter_next(&sub2)) {
+                DBusMessageIter sub3;
+                struct generator_times *t;
+
+                if (!GREEDY_REALLOC(times, allocated, n + 1))
+                        return log_oom();
+
+                t = times + n;
+
+                dbus_message_iter_recurse(&sub2, &sub3);
+
+                if (bus_iter_get_basic_and_next(&sub3, DBUS_TYPE_STRING, &t->name, true) < 0 ||
+                    bus_iter_get_basic_and_next(&sub3, DBUS_TYPE_UINT64, &t->time, true) < 0 ||
+                    bus_iter_get_basic_and_next(&sub3, DBUS_TYPE_STRING, &t->result, false) < 0) {
+                        log_error("Failed to parse reply.");
+                        return -EIO;
+                }
+
+                n++;
+        }
+
+        if (n > 0)
+                qsort(times, n, sizeof(struct generator_times), compare_generator_time);
+
+        for (i = 0; i < n; i++) {
+                char ts[FORMAT_TIMESPAN_MAX];
+
+                if (streq(times[i].result, "success"))
+                        printf("%16s %s\n", format_timespan(ts, sizeof(ts), times[i].time, USEC_PER_MSEC), times[i].name);
+                else
+                        printf("%16s %s (%s)\n", format_timespan(ts, sizeof(ts), times[i].time, USEC_PER_MSEC), times[i].name, times[i].result);
+        }
+
+        return 0;
+}
+
+static struct unit_times* find_unit_times(struct unit_times *times, unsigned n, const char *name) {
+        unsigned i;
+
+        for (i = 0; i < n; i++)
+                if (streq(times[i].name, name))
+                        return times + i;
+
+        return NULL;
+}
+
+static int get_unit_id(DBusConnection *bus, const char *name, char **id) {
+        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
+        _cleanup_free_ char *path = NULL;
+        const char *interface = "org.freedesktop.systemd1.Unit", *property = "Id", *s;
+        DBusMessageIter iter, sub;
+        int r;
+
+        if (arg_offline) {
+                /* Aliases are only known for the default target */
+                if (!streq(name, SPECIAL_DEFAULT_TARGET)) {
+                        *id = strdup(name);
+                        return *id ? 0 : log_oom();
+                }
+
+                *id = NULL;
+
+                r = load_boot_timing(NULL, id, NULL);
+                if (r < 0)
+                        return r;
+
+                if (!*id) {
+                        log_error("No default target recorded in %s.", arg_offline);
+                        return -ENOENT;
+                }
+
+                return 0;
+        }
+
+        path = unit_dbus_path_from_name(name);
+        if (!path)
+                return log_oom();
+
+        r = bus_method_call_with_reply(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        path,
+                        "org.freedesktop.DBus.Properties",
+                        "Get",
+                        &reply,
+                        NULL,
+                        DBUS_TYPE_STRING, &interface,
+                        DBUS_TYPE_STRING, &property,
+                        DBUS_TYPE_INVALID);
+        if (r < 0)
+                return r;
+
+        if (!dbus_message_iter_init(reply, &iter) ||
+            dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_VARIANT)  {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        dbus_message_iter_recurse(&iter, &sub);
+
+        if (bus_iter_get_basic_and_next(&sub, DBUS_TYPE_STRING, &s, false) < 0) {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        *id = strdup(s);
+        if (!*id)
+                return log_oom();
+
+        return 0;
+}
+
+static int analyze_critical_chain(DBusConnection *bus, char *names[]) {
+        _cleanup_free_ char *id = NULL;
+        struct boot_times *boot;
+        struct unit_times *times, *t;
+        unsigned depth = 0, i;
+        int n, r;
+
+        r = acquire_boot_times(bus, &boot);
+        if (r < 0)
+                return r;
+
+        r = get_unit_id(bus, strv_isempty(names) ? SPECIAL_DEFAULT_TARGET : names[0], &id);
+        if (r < 0)
+                return r;
+
+        n = acquire_time_data(bus, &times);
+        if (n < 0)
+                return n;
+
+        t = find_unit_times(times, (unsigned) n, id);
+        if (!t) {
+                log_error("Unit %s has not been started.", id);
+                free_unit_times(times, (unsigned) n);
+                return -ENOENT;
+        }
+
+        /* Follows the ordering dependency that finished last before
+         * each unit could start, which is what held it back. The
+         * depth is bounded by the number of units, since timestamps
+         * may be equal. */
+        while (t && depth < (unsigned) n) {
+                char ts[FORMAT_TIMESPAN_MAX], ts2[FORMAT_TIMESPAN_MAX];
+                struct unit_times *next = NULL;
+                char **a;
+
+                for (i = 1; i < depth; i++)
+                        printf("%s", draw_special_char(DRAW_TREE_SPACE));
+                if (depth > 0)
+                        printf("%s", draw_special_char(DRAW_TREE_RIGHT));
+
+                if (t->aet > 0 && t->time > 0)
+                        printf("%s @%s +%s\n", t->name,
+                               format_timespan(ts, sizeof(ts), t->aet - boot->userspace_time, USEC_PER_MSEC),
+                               format_timespan(ts2, sizeof(ts2), t->time, USEC_PER_MSEC));
+                else if (t->aet > 0)
+                        printf("%s @%s\n", t->name,
+                               format_timespan(ts, sizeof(ts), t->aet - boot->userspace_time, USEC_PER_MSEC));
+                else
+                        printf("%s\n", t->name);
+
+                STRV_FOREACH(a, t->after) {
+                        struct unit_times *u;
+
+                        u = find_unit_times(times, (unsigned) n, *a);
+                        if (!u || u == t || u->aet == 0 || u->aet > t->ixt)
+                                continue;
+
+                        if (!next || u->aet > next->aet)
+                                next = u;
+                }
+
+                t = next;
+                depth++;
+        }
+
+        free_unit_times(times, (unsigned) n);
+        return 0;
+}
+
+struct profile_times {
+        const char *name;
+        uint64_t n;
+        usec_t total;
+        usec_t max;
+};
+
+static int compare_profile_time(const void *a, const void *b) {
+        return compare(((struct profile_times *)b)->total,
+                       ((struct profile_times *)a)->total);
+}
+
+static int analyze_profile(DBusConnection *bus) {
+        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
+        _cleanup_free_ struct profile_times *times = NULL;
+        DBusMessageIter iter, sub;
+        size_t allocated = 0;
+        unsigned n = 0, i;
+        int r;
+
+        r = bus_method_call_with_reply(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "GetProfile",
+                        &reply,
+                        NULL,
+                        DBUS_TYPE_INVALID);
+        if (r < 0)
+                return r;
+
+        if (!dbus_message_iter_init(reply, &iter) ||
+            dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY ||
+            dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_STRUCT)  {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        for (dbus_message_iter_recurse(&iter, &sub);
+             dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID;
+             dbus_message_iter_next(&sub)) {
+                DBusMessageIter sub2;
+                struct profile_times *t;
+
+                if (!GREEDY_REALLOC(times, allocated, n + 1))
+                        return log_oom();
+
+                t = times + n;
+
+                dbus_message_iter_recurse(&sub, &sub2);
+
+                if (bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_STRING, &t->name, true) < 0 ||
+                    bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_UINT64, &t->n, true) < 0 ||
+                    bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_UINT64, &t->total, true) < 0 ||
+                    bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_UINT64, &t->max, false) < 0) {
+                        log_error("Failed to parse reply.");
+                        return -EIO;
+                }
+
+                n++;
+        }
+
+        if (n > 0)
+                qsort(times, n, sizeof(struct profile_times), compare_profile_time);
+
+        printf("%-14s %10s %16s %16s\n", "POINT", "COUNT", "TOTAL", "MAX");
+
+        for (i = 0; i < n; i++) {
+                char ts[FORMAT_TIMESPAN_MAX], ts2[FORMAT_TIMESPAN_MAX];
+
+                printf("%-14s %10llu %16s %16s\n",
+                       times[i].name,
+                       (unsigned long long) times[i].n,
+                       format_timespan(ts, sizeof(ts), times[i].total, USEC_PER_MSEC),
+                       format_timespan(ts2, sizeof(ts2), times[i].max, USEC_PER_MSEC));
+        }
+
+        return 0;
+}
+
+static int analyze_dump_memory(DBusConnection *bus) {
+        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
+        DBusMessageIter iter, sub;
+        int r;
+
+        r = bus_method_call_with_reply(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "GetMemoryUsage",
+                        &reply,
+                        NULL,
+                        DBUS_TYPE_INVALID);
+        if (r < 0)
+                return r;
+
+        if (!dbus_message_iter_init(reply, &iter) ||
+            dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY ||
+            dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_STRUCT)  {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        printf("%-16s %10s %10s\n", "CATEGORY", "COUNT", "SIZE");
+
+        for (dbus_message_iter_recurse(&iter, &sub);
+             dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID;
+             dbus_message_iter_next(&sub)) {
+                DBusMessageIter sub2;
+                const char *name;
+                uint64_t n, size;
+                char buf[FORMAT_BYTES_MAX];
+
+                dbus_message_iter_recurse(&sub, &sub2);
+
+                if (bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_STRING, &name, true) < 0 ||
+                    bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_UINT64, &n, true) < 0 ||
+                    bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_UINT64, &size, false) < 0) {
+                        log_error("Failed to parse reply.");
+                        return -EIO;
+                }
+
+                printf("%-16s %10llu %10s\n",
+                       name,
+                       (unsigned long long) n,
+                       format_bytes(buf, sizeof(buf), size));
+        }
+
+        return 0;
+}
+
+static int get_unit_array_property(DBusConnection *bus, const char *path, const char *property,
+                                   DBusMessage **reply, DBusMessageIter *sub) {
+        const char *interface = "org.freedesktop.systemd1.Unit";
+        DBusMessageIter iter;
+        int r;
+
+        r = bus_method_call_with_reply(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        path,
+                        "org.freedesktop.DBus.Properties",
+                        "Get",
+                        reply,
+                        NULL,
+                        DBUS_TYPE_STRING, &interface,
+                        DBUS_TYPE_STRING, &property,
+                        DBUS_TYPE_INVALID);
+        if (r < 0)
+                return r;
+
+        if (!dbus_message_iter_init(*reply, &iter) ||
+            dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_VARIANT)  {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        dbus_message_iter_recurse(&iter, &iter);
+
+        if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY ||
+            dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_STRUCT)  {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        dbus_message_iter_recurse(&iter, sub);
+        return 0;
+}
+
+static int start_latency_one(DBusConnection *bus, const char *name) {
+        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL, *reply2 = NULL;
+        _cleanup_free_ char *path = NULL;
+        DBusMessageIter sub, sub2;
+        _cleanup_strv_free_ char **last = NULL;
+        int r;
+
+        path = unit_dbus_path_from_name(name);
+        if (!path)
+                return log_oom();
+
+        /* Durations of the last start, as alternating phase names
+         * and formatted timespans */
+        r = get_unit_array_property(bus, path, "StartLatency", &reply, &sub);
+        if (r < 0)
+                return r;
+
+        for (; dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID; dbus_message_iter_next(&sub)) {
+                char ts[FORMAT_TIMESPAN_MAX];
+                const char *phase;
+                uint64_t usec;
+
+                dbus_message_iter_recurse(&sub, &sub2);
+
+                if (bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_STRING, &phase, true) < 0 ||
+                    bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_UINT64, &usec, false) < 0) {
+                        log_error("Failed to parse reply.");
+                        return -EIO;
+                }
+
+                if (strv_extend(&last, phase) < 0 ||
+                    strv_extend(&last, format_timespan(ts, sizeof(ts), usec, 1)) < 0)
+                        return log_oom();
+        }
+
+        r = get_unit_array_property(bus, path, "StartLatencyHistogram", &reply2, &sub);
+        if (r < 0)
+                return r;
+
+        printf("%s:\n%-10s %10s %7s %7s %7s %7s %7s %7s %7s\n", name,
+               "PHASE", "LAST", "<100us", "<1ms", "<10ms", "<100ms", "<1s", "<10s", "more");
+
+        for (; dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID; dbus_message_iter_next(&sub)) {
+                DBusMessageIter sub3;
+                const char *phase, *l = "-";
+                const uint32_t *buckets;
+                char **i;
+                int n, k;
+
+                dbus_message_iter_recurse(&sub, &sub2);
+
+                if (bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_STRING, &phase, true) < 0 ||
+                    dbus_message_iter_get_arg_type(&sub2) != DBUS_TYPE_ARRAY ||
+                    dbus_message_iter_get_element_type(&sub2) != DBUS_TYPE_UINT32) {
+                        log_error("Failed to parse reply.");
+                        return -EIO;
+                }
+
+                dbus_message_iter_recurse(&sub2, &sub3);
+                dbus_message_iter_get_fixed_array(&sub3, &buckets, &n);
+
+                for (i = last; i && i[0] && i[1]; i += 2)
+                        if (streq(i[0], phase)) {
+                                l = i[1];
+                                break;
+                        }
+
+                printf("%-10s %10s", phase, l);
+                for (k = 0; k < n; k++)
+                        printf(" %7u", buckets[k]);
+                putchar('\n');
+        }
+
+        return 0;
+}
+
+static int analyze_start_latency(DBusConnection *bus, char *names[]) {
+        char **name;
+        int r;
+
+        if (strv_isempty(names)) {
+                log_error("start-latency needs at least one unit name.");
+                return -EINVAL;
+        }
+
+        STRV_FOREACH(name, names) {
+                if (name != names)
+                        putchar('\n');
+
+                r = start_latency_one(bus, *name);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
 static int analyze_time(DBusConnection *bus) {
         _cleanup_free_ char *buf = NULL;
         int r;
@@ -791,6 +1502,8 @@ static void analyze_help(void)
                "     --version        Show package version\n"
                "     --system         Connect to system manager\n"
                "     --user           Connect to user service manager\n"
+               "     --offline[=PATH] Read the boot timing data PID 1 wrote when bootup\n"
+               "                      finished, instead of connecting to the manager\n"
                "     --order          When generating a dependency graph, show only order\n"
                "     --require        When generating a dependency graph, show only requirement\n"
                "     --from-pattern=GLOB, --to-pattern=GLOB\n"
@@ -799,6 +1512,13 @@ static void analyze_help(void)
                "Commands:\n"
                "  time                Print time spent in the kernel before reaching userspace\n"
                "  blame               Print list of running units ordered by time to init\n"
+               "  generators          Print list of generators ordered by time they took\n"
+               "  critical-chain [UNIT]\n"
+               "                      Print the chain of units UNIT waited for to start\n"
+               "  profile             Print where the manager spent its time\n"
+               "  dump-memory         Print what the memory of the manager is used for\n"
+               "  start-latency UNIT...\n"
+               "                      Print where the time went when starting UNITs\n"
                "  plot                Output SVG graphic showing service initialization\n"
                "  dot                 Dump dependency graph (in dot(1) format)\n\n",
                program_invocation_short_name);
@@ -813,7 +1533,8 @@ static int parse_argv(int argc, char *argv[])
                 ARG_USER,
                 ARG_SYSTEM,
                 ARG_DOT_FROM_PATTERN,
-                ARG_DOT_TO_PATTERN
+                ARG_DOT_TO_PATTERN,
+                ARG_OFFLINE
         };
 
         static const struct option options[] = {
@@ -825,6 +1546,7 @@ static int parse_argv(int argc, char *argv[])
                 { "system",    no_argument,       NULL, ARG_SYSTEM    },
                 { "from-pattern", required_argument, NULL, ARG_DOT_FROM_PATTERN},
                 { "to-pattern",   required_argument, NULL, ARG_DOT_TO_PATTERN  },
+                { "offline",      optional_argument, NULL, ARG_OFFLINE         },
                 { NULL,        0,                 NULL, 0             }
         };
 
@@ -870,6 +1592,10 @@ static int parse_argv(int argc, char *argv[])
 
                         break;
 
+                case ARG_OFFLINE:
+                        arg_offline = optarg ? optarg : BOOT_TIMING_PATH;
+                        break;
+
                 case -1:
                         return 1;
 
@@ -897,14 +1623,36 @@ int main(int argc, char *argv[]) {
         else if (r <= 0)
                 return EXIT_SUCCESS;
 
-        bus = dbus_bus_get(arg_scope == UNIT_FILE_SYSTEM ? DBUS_BUS_SYSTEM : DBUS_BUS_SESSION, NULL);
-        if (!bus)
-                return EXIT_FAILURE;
+        if (arg_offline) {
+                if (argv[optind] &&
+                    !streq(argv[optind], "time") &&
+                    !streq(argv[optind], "blame") &&
+                    !streq(argv[optind], "critical-chain") &&
+                    !streq(argv[optind], "plot")) {
+                        log_error("Operation '%s' needs a running manager and is not supported with --offline.", argv[optind]);
+                        r = -EOPNOTSUPP;
+                        goto finish;
+                }
+        } else {
+                bus = dbus_bus_get(arg_scope == UNIT_FILE_SYSTEM ? DBUS_BUS_SYSTEM : DBUS_BUS_SESSION, NULL);
+                if (!bus)
+                        return EXIT_FAILURE;
+        }
 
         if (!argv[optind] || streq(argv[optind], "time"))
                 r = analyze_time(bus);
         else if (streq(argv[optind], "blame"))
                 r = analyze_blame(bus);
+        else if (streq(argv[optind], "generators"))
+                r = analyze_generators(bus);
+        else if (streq(argv[optind], "critical-chain"))
+                r = analyze_critical_chain(bus, argv+optind+1);
+        else if (streq(argv[optind], "profile"))
+                r = analyze_profile(bus);
+        else if (streq(argv[optind], "dump-memory"))
+                r = analyze_dump_memory(bus);
+        else if (streq(argv[optind], "start-latency"))
+                r = analyze_start_latency(bus, argv+optind+1);
         else if (streq(argv[optind], "plot"))
                 r = analyze_plot(bus);
         else if (streq(argv[optind], "dot"))
@@ -912,9 +1660,12 @@ int main(int argc, char *argv[]) {
         else
                 log_error("Unknown operation '%s'.", argv[optind]);
 
+finish:
         strv_free(arg_dot_from_patterns);
         strv_free(arg_dot_to_patterns);
-        dbus_connection_unref(bus);
+
+        if (bus)
+                dbus_connection_unref(bus);
 
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
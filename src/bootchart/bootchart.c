@@ -61,14 +61,15 @@
 
 double graph_start;
 double log_start;
-double sampletime[MAXSAMPLES];
+double *sampletime;
 struct ps_struct *ps_first;
-struct block_stat_struct blockstat[MAXSAMPLES];
-int entropy_avail[MAXSAMPLES];
+struct block_stat_struct *blockstat;
+int *entropy_avail;
 struct cpu_stat_struct cpustat[MAXCPUS];
 int pscount;
 int cpus;
 double interval;
+double sampler_time;
 FILE *of = NULL;
 int overrun = 0;
 static int exiting = 0;
@@ -81,6 +82,7 @@ bool arg_relative = false;
 bool arg_filter = true;
 bool arg_show_cmdline = false;
 bool arg_pss = false;
+bool arg_log = false;
 int samples;
 int arg_samples_len = 500; /* we record len+1 (1 start sample) */
 double arg_hz = 25.0;   /* 20 seconds log time */
@@ -89,6 +91,7 @@ double arg_scale_y = 20.0;  /* 16px = 1 process bar */
 
 char arg_init_path[PATH_MAX] = "/sbin/init";
 char arg_output_path[PATH_MAX] = "/run/log";
+static char arg_convert_path[PATH_MAX] = "";
 
 static void signal_handler(int sig) {
         if (sig++)
@@ -109,6 +112,7 @@ static void parse_conf(void) {
                 { "Bootchart", "Init",             config_parse_path,   0, &init            },
                 { "Bootchart", "PlotMemoryUsage",  config_parse_bool,   0, &arg_pss         },
                 { "Bootchart", "PlotEntropyGraph", config_parse_bool,   0, &arg_entropy     },
+                { "Bootchart", "Log",              config_parse_bool,   0, &arg_log         },
                 { "Bootchart", "ScaleX",           config_parse_double, 0, &arg_scale_x     },
                 { "Bootchart", "ScaleY",           config_parse_double, 0, &arg_scale_y     },
                 { NULL, NULL, NULL, 0, NULL }
@@ -145,11 +149,13 @@ static int parse_args(int argc, char *argv[]) {
                 {"scale-x",   required_argument,  NULL,  'x'},
                 {"scale-y",   required_argument,  NULL,  'y'},
                 {"entropy",   no_argument,        NULL,  'e'},
+                {"log",       no_argument,        NULL,  'l'},
+                {"convert",   required_argument,  NULL,  'c'},
                 {NULL, 0, NULL, 0}
         };
         int c;
 
-        while ((c = getopt_long(argc, argv, "erpf:n:o:i:FChx:y:", options, NULL)) >= 0) {
+        while ((c = getopt_long(argc, argv, "erpf:n:o:i:FChx:y:lc:", options, NULL)) >= 0) {
                 int r;
 
                 switch (c) {
@@ -200,6 +206,12 @@ static int parse_args(int argc, char *argv[]) {
                 case 'e':
                         arg_entropy = true;
                         break;
+                case 'l':
+                        arg_log = true;
+                        break;
+                case 'c':
+                        strscpy(arg_convert_path, sizeof(arg_convert_path), optarg);
+                        break;
                 case 'h':
                         fprintf(stderr, "Usage: %s [OPTIONS]\n", argv[0]);
                         fprintf(stderr, " --rel,       -r          Record time relative to recording\n");
@@ -209,6 +221,9 @@ static int parse_args(int argc, char *argv[]) {
                         fprintf(stderr, " --scale-y,   -y N        Scale the graph vertically [%f] \n", arg_scale_y);
                         fprintf(stderr, " --pss,       -p          Enable PSS graph (CPU intensive)\n");
                         fprintf(stderr, " --entropy,   -e          Enable the entropy_avail graph\n");
+                        fprintf(stderr, " --log,       -l          Stream samples to a log instead of a graph,\n");
+                        fprintf(stderr, "                          for as long as running when -n is 0\n");
+                        fprintf(stderr, " --convert,   -c [PATH]   Graph a log written with --log\n");
                         fprintf(stderr, " --output,    -o [PATH]   Path to output files [%s]\n", arg_output_path);
                         fprintf(stderr, " --init,      -i [PATH]   Path to init executable [%s]\n", arg_init_path);
                         fprintf(stderr, " --no-filter, -F          Disable filtering of processes from the graph\n");
@@ -224,11 +239,6 @@ static int parse_args(int argc, char *argv[]) {
                 }
         }
 
-        if (arg_samples_len > MAXSAMPLES) {
-                fprintf(stderr, "Error: samples exceeds maximum\n");
-                return -EINVAL;
-        }
-
         if (arg_hz <= 0.0) {
                 fprintf(stderr, "Error: Frequency needs to be > 0\n");
                 return -EINVAL;
@@ -237,15 +247,80 @@ static int parse_args(int argc, char *argv[]) {
         return 0;
 }
 
+static void output_name(char *output_file, const char *suffix) {
+        char datestr[200];
+        time_t t;
+
+        t = time(NULL);
+        strftime(datestr, sizeof(datestr), "%Y%m%d-%H%M", localtime(&t));
+        snprintf(output_file, PATH_MAX, "%s/bootchart-%s.%s", arg_output_path, datestr, suffix);
+}
+
+static int convert(const char *path) {
+        _cleanup_free_ char *build = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        char output_file[PATH_MAX];
+        int r;
+
+        f = fopen(path, "re");
+        if (!f) {
+                fprintf(stderr, "opening log '%s': %m\n", path);
+                return -errno;
+        }
+
+        r = sample_log_read(f);
+        if (r < 0) {
+                fprintf(stderr, "reading log '%s': %s\n", path, strerror(-r));
+                return r;
+        }
+
+        /* the graphs look at every sample of every process */
+        if (ps_samples_reserve(samples) < 0) {
+                fprintf(stderr, "Error: out of memory for samples\n");
+                return -ENOMEM;
+        }
+
+        arg_samples_len = samples;
+
+        if (endswith(path, ".log"))
+                snprintf(output_file, PATH_MAX, "%.*s.svg", (int) strlen(path) - 4, path);
+        else
+                snprintf(output_file, PATH_MAX, "%s.svg", path);
+
+        of = fopen(output_file, "we");
+        if (!of) {
+                fprintf(stderr, "opening output file '%s': %m\n", output_file);
+                return -errno;
+        }
+
+        /* the header of the graph describes the system we run on */
+        procfd = open("/proc", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        sysfd = open("/sys", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        parse_env_file("/etc/os-release", NEWLINE,
+                       "PRETTY_NAME", &build,
+                       NULL);
+
+        svg_do(build);
+
+        fprintf(stderr, "systemd-bootchart wrote %s\n", output_file);
+
+        fclose(of);
+        if (procfd >= 0)
+                close(procfd);
+        if (sysfd >= 0)
+                close(sysfd);
+
+        return 0;
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_free_ char *build = NULL;
         struct sigaction sig;
         struct ps_struct *ps;
         char output_file[PATH_MAX];
-        char datestr[200];
-        time_t t = 0;
         int r;
         struct rlimit rlim;
+        bool forever;
 
         parse_conf();
 
@@ -253,6 +328,16 @@ int main(int argc, char *argv[]) {
         if (r < 0)
                 return EXIT_FAILURE;
 
+        if (arg_convert_path[0]) {
+                ps_first = new0(struct ps_struct, 1);
+                if (!ps_first) {
+                        perror("calloc(ps_struct)");
+                        exit(EXIT_FAILURE);
+                }
+
+                return convert(arg_convert_path) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+
         /*
          * If the kernel executed us through init=/usr/lib/systemd/systemd-bootchart, then
          * fork:
@@ -287,8 +372,11 @@ int main(int argc, char *argv[]) {
 
         log_uptime();
 
+        /* a log can be written for as long as we are running */
+        forever = arg_log && arg_samples_len <= 0;
+
         /* main program loop */
-        for (samples = 0; !exiting && samples < arg_samples_len; samples++) {
+        for (samples = 0; !exiting && (forever || samples < arg_samples_len); samples++) {
                 int res;
                 double sample_stop;
                 struct timespec req;
@@ -296,13 +384,20 @@ int main(int argc, char *argv[]) {
                 long newint_ns;
                 double elapsed;
                 double timeleft;
+                int slot;
+
+                /* when streaming, only the current sample is kept in memory */
+                slot = arg_log ? 0 : samples;
 
-                sampletime[samples] = gettime_ns();
+                if (samples_reserve(slot) < 0) {
+                        fprintf(stderr, "Error: out of memory for samples\n");
+                        break;
+                }
+
+                sampletime[slot] = gettime_ns();
 
                 if (!of && (access(arg_output_path, R_OK|W_OK|X_OK) == 0)) {
-                        t = time(NULL);
-                        strftime(datestr, sizeof(datestr), "%Y%m%d-%H%M", localtime(&t));
-                        snprintf(output_file, PATH_MAX, "%s/bootchart-%s.svg", arg_output_path, datestr);
+                        output_name(output_file, arg_log ? "log" : "svg");
                         of = fopen(output_file, "w");
                 }
 
@@ -317,12 +412,19 @@ int main(int argc, char *argv[]) {
                 /* wait for /proc to become available, discarding samples */
                 if (graph_start <= 0.0)
                         log_uptime();
-                else
+                else {
                         log_sample(samples);
 
+                        /* anything sampled before the log is available is lost */
+                        if (arg_log && of)
+                                sample_log_write(of, samples);
+                }
+
                 sample_stop = gettime_ns();
 
-                elapsed = (sample_stop - sampletime[samples]) * 1000000000.0;
+                sampler_time += sample_stop - sampletime[slot];
+
+                elapsed = (sample_stop - sampletime[slot]) * 1000000000.0;
                 timeleft = interval - elapsed;
 
                 newint_s = (time_t)(timeleft / 1000000000.0);
@@ -350,10 +452,17 @@ int main(int argc, char *argv[]) {
                 } else {
                         overrun++;
                         /* calculate how many samples we lost and scrap them */
-                        arg_samples_len -= (int)(newint_ns / interval);
+                        if (!forever)
+                                arg_samples_len -= (int)(newint_ns / interval);
                 }
         }
 
+        /* the graphs look at every sample of every process */
+        if (!arg_log && ps_samples_reserve(samples) < 0) {
+                fprintf(stderr, "Error: out of memory for samples\n");
+                exit (EXIT_FAILURE);
+        }
+
         /* do some cleanup, close fd's */
         ps = ps_first;
         while (ps->next_ps) {
@@ -367,9 +476,7 @@ int main(int argc, char *argv[]) {
         }
 
         if (!of) {
-                t = time(NULL);
-                strftime(datestr, sizeof(datestr), "%Y%m%d-%H%M", localtime(&t));
-                snprintf(output_file, PATH_MAX, "%s/bootchart-%s.svg", arg_output_path, datestr);
+                output_name(output_file, arg_log ? "log" : "svg");
                 of = fopen(output_file, "w");
         }
 
@@ -378,14 +485,16 @@ int main(int argc, char *argv[]) {
                 exit (EXIT_FAILURE);
         }
 
-        svg_do(build);
+        if (!arg_log)
+                svg_do(build);
 
         fprintf(stderr, "systemd-bootchart wrote %s\n", output_file);
 
         if (of)
                 fclose(of);
 
-        closedir(proc);
+        if (proc)
+                closedir(proc);
         if (sysfd >= 0)
                 close(sysfd);
 
@@ -400,6 +509,12 @@ int main(int argc, char *argv[]) {
         free(ps->sample);
         free(ps);
 
+        for (r = 0; r < MAXCPUS; r++)
+                free(cpustat[r].sample);
+        free(sampletime);
+        free(blockstat);
+        free(entropy_avail);
+
         /* don't complain when overrun once, happens most commonly on 1st sample */
         if (overrun > 1)
                 fprintf(stderr, "systemd-boochart: Warning: sample time overrun %i times\n", overrun);
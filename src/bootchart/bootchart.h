@@ -29,7 +29,6 @@
 
 #define MAXCPUS        16
 #define MAXPIDS     65535
-#define MAXSAMPLES   8192
 
 struct block_stat_struct {
         /* /proc/vmstat pgpgin & pgpgout */
@@ -45,7 +44,7 @@ struct cpu_stat_sample_struct {
 
 struct cpu_stat_struct {
         /* per cpu array */
-        struct cpu_stat_sample_struct sample[MAXSAMPLES];
+        struct cpu_stat_sample_struct *sample;
 };
 
 /* per process, per sample data we will log */
@@ -77,6 +76,12 @@ struct ps_struct {
         int first;
         int last;
 
+        /* last sample it was found in /proc at */
+        int seen;
+
+        /* whether its name made it to the sample log yet */
+        bool logged;
+
         /* records actual start time, may be way before bootchart runs */
         double starttime;
 
@@ -91,15 +96,16 @@ struct ps_struct {
         double pos_y;
 
         struct ps_sched_struct *sample;
+        int n_sample;
 };
 
-extern int entropy_avail[];
+extern int *entropy_avail;
 
 extern double graph_start;
 extern double log_start;
-extern double sampletime[];
+extern double *sampletime;
 extern struct ps_struct *ps_first;
-extern struct block_stat_struct blockstat[];
+extern struct block_stat_struct *blockstat;
 extern struct cpu_stat_struct cpustat[];
 extern int pscount;
 extern bool arg_relative;
@@ -107,6 +113,7 @@ extern bool arg_filter;
 extern bool arg_show_cmdline;
 extern bool arg_pss;
 extern bool arg_entropy;
+extern bool arg_log;
 extern bool initcall;
 extern int samples;
 extern int cpus;
@@ -116,6 +123,7 @@ extern double arg_scale_x;
 extern double arg_scale_y;
 extern int overrun;
 extern double interval;
+extern double sampler_time;
 
 extern char arg_output_path[PATH_MAX];
 extern char arg_init_path[PATH_MAX];
@@ -24,6 +24,7 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -47,6 +48,119 @@ static char smaps_buf[4096];
 DIR *proc;
 int procfd = -1;
 
+/* Looking up processes by walking the list of all of them for every
+ * PID in /proc at every sample does not scale */
+static struct ps_struct *ps_by_pid[MAXPIDS];
+static struct ps_struct *ps_last;
+
+/* Sample storage is grown as we go, rather than allocated for the
+ * maximum number of samples upfront */
+#define SAMPLES_MIN 64
+
+static int samples_allocated;
+
+static int grow(void **p, size_t size, int n, int n_new) {
+        void *q;
+
+        q = realloc(*p, size * n_new);
+        if (!q)
+                return -ENOMEM;
+
+        memset((char*) q + size * n, 0, size * (n_new - n));
+        *p = q;
+
+        return 0;
+}
+
+/* Makes room for the sample with index n */
+int samples_reserve(int n) {
+        int n_new, c;
+
+        if (n < samples_allocated)
+                return 0;
+
+        n_new = MAX3(n + 1, samples_allocated * 2, SAMPLES_MIN);
+
+        if (grow((void**) &sampletime, sizeof(sampletime[0]), samples_allocated, n_new) < 0 ||
+            grow((void**) &blockstat, sizeof(blockstat[0]), samples_allocated, n_new) < 0 ||
+            grow((void**) &entropy_avail, sizeof(entropy_avail[0]), samples_allocated, n_new) < 0)
+                return -ENOMEM;
+
+        for (c = 0; c < MAXCPUS; c++)
+                if (grow((void**) &cpustat[c].sample, sizeof(cpustat[c].sample[0]), samples_allocated, n_new) < 0)
+                        return -ENOMEM;
+
+        samples_allocated = n_new;
+
+        return 0;
+}
+
+static int ps_sample_reserve(struct ps_struct *ps, int n) {
+        int n_new;
+
+        if (n < ps->n_sample)
+                return 0;
+
+        n_new = MAX3(n + 1, ps->n_sample * 2, SAMPLES_MIN);
+
+        if (grow((void**) &ps->sample, sizeof(ps->sample[0]), ps->n_sample, n_new) < 0)
+                return -ENOMEM;
+
+        ps->n_sample = n_new;
+
+        return 0;
+}
+
+/* Makes room for n samples for all processes */
+int ps_samples_reserve(int n) {
+        struct ps_struct *ps;
+
+        if (n <= 0)
+                return 0;
+
+        for (ps = ps_first->next_ps; ps; ps = ps->next_ps)
+                if (ps_sample_reserve(ps, n - 1) < 0)
+                        return -ENOMEM;
+
+        return 0;
+}
+
+/*
+ * setup child pointers
+ *
+ * these are used to paint the tree coherently later
+ * each parent has a LL of children, and a LL of siblings
+ */
+static void ps_link(struct ps_struct *ps) {
+        struct ps_struct *parent;
+
+        /* kthreadd has ppid=0, which breaks our tree ordering */
+        if (ps->ppid == 0)
+                ps->ppid = 1;
+
+        parent = ps->ppid < MAXPIDS ? ps_by_pid[ps->ppid] : NULL;
+
+        if (!parent) {
+                /* orphan */
+                ps->ppid = 1;
+                parent = ps_first->next_ps;
+        }
+
+        ps->parent = parent;
+
+        if (!parent->children) {
+                /* it's the first child */
+                parent->children = ps;
+        } else {
+                /* walk all children and append */
+                struct ps_struct *children;
+                children = parent->children;
+                while (children->next)
+                        children = children->next;
+                children->next = ps;
+        }
+}
+
 double gettime_ns(void) {
         struct timespec n;
 
@@ -128,6 +242,10 @@ void log_sample(int sample) {
         ssize_t n;
         struct dirent *ent;
         int fd;
+        int slot;
+
+        /* when streaming, only the current sample is kept in memory */
+        slot = arg_log ? 0 : sample;
 
         /* all the per-process stuff goes here */
         if (!proc) {
@@ -161,9 +279,9 @@ void log_sample(int sample) {
                 if (sscanf(m, "%s %s", key, val) < 2)
                         goto vmstat_next;
                 if (streq(key, "pgpgin"))
-                        blockstat[sample].bi = atoi(val);
+                        blockstat[slot].bi = atoi(val);
                 if (streq(key, "pgpgout")) {
-                        blockstat[sample].bo = atoi(val);
+                        blockstat[slot].bo = atoi(val);
                         break;
                 }
 vmstat_next:
@@ -198,8 +316,8 @@ vmstat_next:
                         if (c > MAXCPUS)
                                 /* Oops, we only have room for MAXCPUS data */
                                 break;
-                        cpustat[c].sample[sample].runtime = atoll(rt);
-                        cpustat[c].sample[sample].waittime = atoll(wt);
+                        cpustat[c].sample[slot].runtime = atoll(rt);
+                        cpustat[c].sample[slot].waittime = atoll(wt);
 
                         if (c == cpus)
                                 cpus = c + 1;
@@ -219,7 +337,7 @@ schedstat_next:
                         n = pread(e_fd, buf, sizeof(buf) - 1, 0);
                         if (n > 0) {
                                 buf[n] = '\0';
-                                entropy_avail[sample] = atoi(buf);
+                                entropy_avail[slot] = atoi(buf);
                         }
                 }
         }
@@ -237,32 +355,29 @@ schedstat_next:
                 if (pid >= MAXPIDS)
                         continue;
 
-                ps = ps_first;
-                while (ps->next_ps) {
-                        ps = ps->next_ps;
-                        if (ps->pid == pid)
-                                break;
-                }
+                ps = ps_by_pid[pid];
+                if (ps)
+                        ps->seen = sample;
 
-                /* end of our LL? then append a new record */
-                if (ps->pid != pid) {
+                /* not seen yet? then append a new record to our LL */
+                if (!ps) {
                         FILE _cleanup_fclose_ *st = NULL;
                         char t[32];
-                        struct ps_struct *parent;
 
-                        ps->next_ps = calloc(1, sizeof(struct ps_struct));
-                        if (!ps->next_ps) {
+                        ps = calloc(1, sizeof(struct ps_struct));
+                        if (!ps) {
                                 perror("calloc(ps_struct)");
                                 exit (EXIT_FAILURE);
                         }
-                        ps = ps->next_ps;
-                        ps->pid = pid;
 
-                        ps->sample = calloc(arg_samples_len + 1, sizeof(struct ps_sched_struct));
-                        if (!ps->sample) {
-                                perror("calloc(ps_struct)");
-                                exit (EXIT_FAILURE);
-                        }
+                        if (!ps_last)
+                                ps_last = ps_first;
+                        ps_last->next_ps = ps;
+                        ps_last = ps;
+
+                        ps_by_pid[pid] = ps;
+                        ps->pid = pid;
+                        ps->seen = sample;
 
                         pscount++;
 
@@ -318,42 +433,12 @@ schedstat_next:
                         }
                         ps->ppid = p;
 
-                        /*
-                         * setup child pointers
-                         *
-                         * these are used to paint the tree coherently later
-                         * each parent has a LL of children, and a LL of siblings
-                         */
                         if (pid == 1)
                                 continue; /* nothing to do for init atm */
 
-                        /* kthreadd has ppid=0, which breaks our tree ordering */
-                        if (ps->ppid == 0)
-                                ps->ppid = 1;
-
-                        parent = ps_first;
-                        while ((parent->next_ps && parent->pid != ps->ppid))
-                                parent = parent->next_ps;
-
-                        if ((!parent) || (parent->pid != ps->ppid)) {
-                                /* orphan */
-                                ps->ppid = 1;
-                                parent = ps_first->next_ps;
-                        }
-
-                        ps->parent = parent;
-
-                        if (!parent->children) {
-                                /* it's the first child */
-                                parent->children = ps;
-                        } else {
-                                /* walk all children and append */
-                                struct ps_struct *children;
-                                children = parent->children;
-                                while (children->next)
-                                        children = children->next;
-                                children->next = ps;
-                        }
+                        /* the tree is only drawn from the log later */
+                        if (!arg_log)
+                                ps_link(ps);
                 }
 
                 /* else -> found pid, append data in ps */
@@ -372,8 +457,11 @@ schedstat_next:
                 if (s <= 0) {
                         /* clean up our file descriptors - assume that the process exited */
                         close(ps->schedstat);
-                        if (ps->sched)
+                        ps->schedstat = 0;
+                        if (ps->sched) {
                                 close(ps->sched);
+                                ps->sched = 0;
+                        }
                         //if (ps->smaps)
                         //        fclose(ps->smaps);
                         continue;
@@ -383,13 +471,20 @@ schedstat_next:
                 if (!sscanf(buf, "%s %s %*s", rt, wt))
                         continue;
 
+                if (ps_sample_reserve(ps, slot) < 0) {
+                        perror("realloc(ps_sched_struct)");
+                        exit (EXIT_FAILURE);
+                }
+
                 ps->last = sample;
-                ps->sample[sample].runtime = atoll(rt);
-                ps->sample[sample].waittime = atoll(wt);
+                ps->sample[slot].runtime = atoll(rt);
+                ps->sample[slot].waittime = atoll(wt);
+                ps->sample[slot].pss = 0;
 
-                ps->total = (ps->sample[ps->last].runtime
-                                 - ps->sample[ps->first].runtime)
-                                 / 1000000000.0;
+                if (!arg_log)
+                        ps->total = (ps->sample[ps->last].runtime
+                                         - ps->sample[ps->first].runtime)
+                                         / 1000000000.0;
 
                 if (!arg_pss)
                         goto catch_rename;
@@ -416,11 +511,11 @@ schedstat_next:
                                 break;
 
                         pss_kb = atoi(&buf[61]);
-                        ps->sample[sample].pss += pss_kb;
+                        ps->sample[slot].pss += pss_kb;
                 }
 
-                if (ps->sample[sample].pss > ps->pss_max)
-                        ps->pss_max = ps->sample[sample].pss;
+                if (ps->sample[slot].pss > ps->pss_max)
+                        ps->pss_max = ps->sample[slot].pss;
 
 catch_rename:
                 /* catch process rename, try to randomize time */
@@ -439,8 +534,11 @@ catch_rename:
                         if (s <= 0) {
                                 /* clean up file descriptors */
                                 close(ps->sched);
-                                if (ps->schedstat)
+                                ps->sched = 0;
+                                if (ps->schedstat) {
                                         close(ps->schedstat);
+                                        ps->schedstat = 0;
+                                }
                                 //if (ps->smaps)
                                 //        fclose(ps->smaps);
                                 continue;
@@ -450,11 +548,233 @@ catch_rename:
                         if (!sscanf(buf, "%s %*s %*s", key))
                                 continue;
 
-                        strscpy(ps->name, sizeof(ps->name), key);
-
                         /* cmdline */
                         if (arg_show_cmdline)
-                                pid_cmdline_strscpy(ps->name, sizeof(ps->name), pid);
+                                pid_cmdline_strscpy(key, sizeof(key), pid);
+
+                        if (!streq(key, ps->name)) {
+                                strscpy(ps->name, sizeof(ps->name), key);
+                                /* tell the log about the new name */
+                                ps->logged = false;
+                        }
                 }
         }
 }
+
+static void ps_free(struct ps_struct *ps) {
+        if (ps->schedstat > 0)
+                close(ps->schedstat);
+        if (ps->sched > 0)
+                close(ps->sched);
+        if (ps->smaps)
+                fclose(ps->smaps);
+
+        if (ps_by_pid[ps->pid] == ps)
+                ps_by_pid[ps->pid] = NULL;
+
+        free(ps->sample);
+        free(ps);
+}
+
+/*
+ * The sample log is plain text, one record per line, with the fields
+ * separated by commas:
+ *
+ *   H,version,hz,log_start,graph_start,relative,pss,entropy
+ *   T,sample,time,bi,bo,entropy_avail
+ *   C,sample,cpu,runtime,waittime
+ *   N,pid,ppid,starttime,name         (new or renamed process)
+ *   P,sample,pid,runtime,waittime,pss
+ *   X,sample,pid                      (process exited)
+ *
+ * Once a process is gone it is dropped, so that a sampler writing the
+ * log keeps a constant amount of memory, no matter how long it runs.
+ */
+void sample_log_write(FILE *f, int sample) {
+        /* samples taken before the log could be opened are not in it,
+         * hence it counts its own */
+        static int n = -1;
+        struct ps_struct **p;
+        int c;
+
+        if (n < 0)
+                fprintf(f, "H,%i,%f,%f,%f,%i,%i,%i\n",
+                        SAMPLE_LOG_VERSION, arg_hz, log_start, graph_start,
+                        arg_relative, arg_pss, arg_entropy);
+        n++;
+
+        fprintf(f, "T,%i,%f,%i,%i,%i\n",
+                n, sampletime[0], blockstat[0].bi, blockstat[0].bo, entropy_avail[0]);
+
+        for (c = 0; c < cpus; c++)
+                fprintf(f, "C,%i,%i,%.0f,%.0f\n",
+                        n, c, cpustat[c].sample[0].runtime, cpustat[c].sample[0].waittime);
+
+        ps_last = ps_first;
+        p = &ps_first->next_ps;
+        while (*p) {
+                struct ps_struct *ps = *p;
+
+                if (ps->seen != sample) {
+                        /* not in /proc anymore */
+                        if (ps->logged)
+                                fprintf(f, "X,%i,%i\n", n, ps->pid);
+
+                        *p = ps->next_ps;
+                        ps_free(ps);
+                        continue;
+                }
+
+                /* in the order of the list, so that parents come first */
+                if (!ps->logged) {
+                        fprintf(f, "N,%i,%i,%f,%s\n",
+                                ps->pid, ps->ppid, ps->starttime, ps->name);
+                        ps->logged = true;
+                }
+
+                /* sampled this time around? */
+                if (ps->n_sample > 0 && ps->last == sample)
+                        fprintf(f, "P,%i,%i,%.0f,%.0f,%i\n",
+                                n, ps->pid, ps->sample[0].runtime,
+                                ps->sample[0].waittime, ps->sample[0].pss);
+
+                ps_last = ps;
+                p = &ps->next_ps;
+        }
+
+        fflush(f);
+}
+
+/* Reads back a sample log, filling in everything the graphs need */
+int sample_log_read(FILE *f) {
+        char line[LINE_MAX];
+        int version = 0, sample = -1;
+
+        FOREACH_LINE(line, f, return -errno) {
+                struct ps_struct *ps;
+                int n, pid, ppid, c, bi, bo, e, pss, k;
+                int relative, plot_pss, plot_entropy;
+                double t, rt, wt;
+
+                truncate_nl(line);
+
+                switch (line[0]) {
+
+                case 'H':
+                        if (sscanf(line, "H,%i,%lf,%lf,%lf,%i,%i,%i",
+                                   &version, &arg_hz, &log_start, &graph_start,
+                                   &relative, &plot_pss, &plot_entropy) != 7 ||
+                            version != SAMPLE_LOG_VERSION ||
+                            arg_hz <= 0.0)
+                                return -EINVAL;
+
+                        arg_relative = relative;
+                        arg_pss = plot_pss;
+                        arg_entropy = plot_entropy;
+                        interval = (1.0 / arg_hz) * 1000000000.0;
+                        break;
+
+                case 'T':
+                        if (sscanf(line, "T,%i,%lf,%i,%i,%i", &n, &t, &bi, &bo, &e) != 5 ||
+                            n != sample + 1)
+                                return -EINVAL;
+
+                        if (samples_reserve(n) < 0)
+                                return -ENOMEM;
+
+                        sample = n;
+                        sampletime[n] = t;
+                        blockstat[n].bi = bi;
+                        blockstat[n].bo = bo;
+                        entropy_avail[n] = e;
+                        break;
+
+                case 'C':
+                        if (sscanf(line, "C,%i,%i,%lf,%lf", &n, &c, &rt, &wt) != 4 ||
+                            n != sample || c < 0 || c >= MAXCPUS)
+                                return -EINVAL;
+
+                        cpustat[c].sample[n].runtime = rt;
+                        cpustat[c].sample[n].waittime = wt;
+
+                        if (c >= cpus)
+                                cpus = c + 1;
+                        break;
+
+                case 'N':
+                        if (sscanf(line, "N,%i,%i,%lf,%n", &pid, &ppid, &t, &k) != 3 ||
+                            pid < 0 || pid >= MAXPIDS || sample < 0)
+                                return -EINVAL;
+
+                        ps = ps_by_pid[pid];
+                        if (!ps) {
+                                ps = new0(struct ps_struct, 1);
+                                if (!ps)
+                                        return -ENOMEM;
+
+                                if (!ps_last)
+                                        ps_last = ps_first;
+                                ps_last->next_ps = ps;
+                                ps_last = ps;
+
+                                ps_by_pid[pid] = ps;
+                                ps->pid = pid;
+                                ps->ppid = ppid;
+                                ps->starttime = t;
+                                ps->first = sample;
+
+                                pscount++;
+
+                                if (pid != 1)
+                                        ps_link(ps);
+                        }
+
+                        strscpy(ps->name, sizeof(ps->name), line + k);
+                        break;
+
+                case 'P':
+                        if (sscanf(line, "P,%i,%i,%lf,%lf,%i", &n, &pid, &rt, &wt, &pss) != 5 ||
+                            n != sample || pid < 0 || pid >= MAXPIDS)
+                                return -EINVAL;
+
+                        ps = ps_by_pid[pid];
+                        if (!ps)
+                                return -EINVAL;
+
+                        if (ps_sample_reserve(ps, n) < 0)
+                                return -ENOMEM;
+
+                        ps->last = n;
+                        ps->sample[n].runtime = rt;
+                        ps->sample[n].waittime = wt;
+                        ps->sample[n].pss = pss;
+
+                        ps->total = (ps->sample[ps->last].runtime
+                                         - ps->sample[ps->first].runtime)
+                                         / 1000000000.0;
+
+                        if (pss > ps->pss_max)
+                                ps->pss_max = pss;
+                        break;
+
+                case 'X':
+                        if (sscanf(line, "X,%i,%i", &n, &pid) != 2 ||
+                            pid < 0 || pid >= MAXPIDS)
+                                return -EINVAL;
+
+                        /* a new process may reuse the PID */
+                        ps_by_pid[pid] = NULL;
+                        break;
+
+                default:
+                        break;
+                }
+        }
+
+        if (version == 0 || sample < 0)
+                return -EINVAL;
+
+        samples = sample + 1;
+
+        return 0;
+}
@@ -25,6 +25,9 @@
 ***/
 
 #include <dirent.h>
+#include <stdio.h>
+
+#define SAMPLE_LOG_VERSION 1
 
 extern DIR *proc;
 extern int procfd;
@@ -32,3 +35,7 @@ extern int procfd;
 double gettime_ns(void);
 void log_uptime(void);
 void log_sample(int sample);
+int samples_reserve(int n);
+int ps_samples_reserve(int n);
+void sample_log_write(FILE *f, int sample);
+int sample_log_read(FILE *f);
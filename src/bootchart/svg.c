@@ -30,6 +30,7 @@
 #include <limits.h>
 #include <unistd.h>
 #include <sys/utsname.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 
@@ -149,6 +150,8 @@ static void svg_title(const char *build) {
         time_t t;
         int fd;
         struct utsname uts;
+        struct rusage ru = {};
+        double cpu_time;
 
         /* grab /proc/cmdline */
         fd = openat(procfd, "cmdline", O_RDONLY);
@@ -218,6 +221,20 @@ static void svg_title(const char *build) {
         svg("</text>\n");
         svg("<text class=\"sec\" x=\"20\" y=\"155\">Graph data: %.03f samples/sec, recorded %i total, dropped %i samples, %i processes, %i filtered</text>\n",
             arg_hz, arg_samples_len, overrun, pscount, pfiltered);
+
+        /* how much we distorted what we measured, unknown when
+         * graphing a sample log */
+        if (sampler_time <= 0.0)
+                return;
+
+        getrusage(RUSAGE_SELF, &ru);
+        cpu_time = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1000000.0 +
+                   ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1000000.0;
+
+        svg("<text class=\"sec\" x=\"20\" y=\"170\">Sampler overhead: %.03fs sampling, %.03fs CPU time, %.01f%% of %.03fs</text>\n",
+            sampler_time, cpu_time,
+            samples > 0 ? 100.0 * sampler_time / (sampletime[samples-1] - sampletime[0] + interval / 1000000000.0) : 0.0,
+            samples > 0 ? sampletime[samples-1] - sampletime[0] : 0.0);
 }
 
 static void svg_graph_box(int height) {
@@ -22,10 +22,38 @@
 #include <dbus/dbus.h>
 
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
 
 #include "log.h"
+#include "util.h"
+#include "def.h"
+#include "socket-util.h"
 #include "dbus-common.h"
 
+static int send_datagram(const char *group) {
+        union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+                .un.sun_path = CGROUPS_AGENT_SOCKET,
+        };
+        int _cleanup_close_ fd = -1;
+        size_t l;
+
+        l = strlen(group);
+        if (l > PATH_MAX)
+                return -E2BIG;
+
+        fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+        if (fd < 0)
+                return -errno;
+
+        if (sendto(fd, group, l, MSG_NOSIGNAL, &sa.sa,
+                   offsetof(struct sockaddr_un, sun_path) + strlen(sa.un.sun_path)) < 0)
+                return -errno;
+
+        return 0;
+}
+
 int main(int argc, char *argv[]) {
         DBusError error;
         DBusConnection *bus = NULL;
@@ -43,6 +71,15 @@ int main(int argc, char *argv[]) {
         log_parse_environment();
         log_open();
 
+        /* A plain datagram is all the system instance needs, and it
+         * is far cheaper than setting up a bus connection. Only if
+         * it is not listening (for example because it is older than
+         * us) we fall back to the bus. */
+        if (send_datagram(argv[1]) >= 0) {
+                r = EXIT_SUCCESS;
+                goto finish;
+        }
+
         /* We send this event to the private D-Bus socket and then the
          * system instance will forward this to the system bus. We do
          * this to avoid an activation loop when we start dbus when we
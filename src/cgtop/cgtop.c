@@ -27,6 +27,9 @@
 #include <unistd.h>
 #include <alloca.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
 
 #include "path-util.h"
 #include "util.h"
@@ -35,8 +38,37 @@
 #include "build.h"
 #include "fileio.h"
 
+typedef enum Controller {
+        CONTROLLER_SYSTEMD,
+        CONTROLLER_CPUACCT,
+        CONTROLLER_MEMORY,
+        CONTROLLER_BLKIO,
+        _CONTROLLER_MAX
+} Controller;
+
+static const struct {
+        const char *name;
+        const char *attribute;
+} controller_table[_CONTROLLER_MAX] = {
+        [CONTROLLER_SYSTEMD] = { "name=systemd", NULL                     },
+        [CONTROLLER_CPUACCT] = { "cpuacct",      "cpuacct.usage"          },
+        [CONTROLLER_MEMORY]  = { "memory",       "memory.usage_in_bytes"  },
+        [CONTROLLER_BLKIO]   = { "blkio",        "blkio.io_service_bytes" },
+};
+
 typedef struct Group {
         char *path;
+        unsigned depth;
+
+        /* Per hierarchy the group exists in we keep the files we
+         * read open, and watch the directory for subgroups coming and
+         * going. The fds are -1 if we ran out of them, in which case
+         * the files are opened on each refresh. */
+        bool present[_CONTROLLER_MAX];
+        bool seen[_CONTROLLER_MAX];
+        int tasks_fd[_CONTROLLER_MAX];
+        int attribute_fd[_CONTROLLER_MAX];
+        int wd[_CONTROLLER_MAX];
 
         bool n_tasks_valid:1;
         bool cpu_valid:1;
@@ -76,72 +108,398 @@ static enum {
         CPU_TIME,
 } arg_cpu_type = CPU_PERCENT;
 
+/* Maps inotify watch descriptors to the groups they watch */
+static Hashmap *watches = NULL;
+static int inotify_fd = -1;
+
+/* Contents of the last attribute read */
+static char *attribute_buffer = NULL;
+static size_t attribute_allocated = 0;
+
+static void group_close(Group *g, Controller c) {
+        assert(g);
+
+        if (g->tasks_fd[c] >= 0)
+                close_nointr_nofail(g->tasks_fd[c]);
+        if (g->attribute_fd[c] >= 0)
+                close_nointr_nofail(g->attribute_fd[c]);
+
+        if (g->wd[c] >= 0) {
+                hashmap_remove(watches, INT_TO_PTR(g->wd[c]));
+                inotify_rm_watch(inotify_fd, g->wd[c]);
+        }
+
+        g->tasks_fd[c] = g->attribute_fd[c] = g->wd[c] = -1;
+        g->present[c] = false;
+}
+
+static bool group_is_present(Group *g) {
+        Controller c;
+
+        for (c = 0; c < _CONTROLLER_MAX; c++)
+                if (g->present[c])
+                        return true;
+
+        return false;
+}
+
 static void group_free(Group *g) {
+        Controller c;
+
         assert(g);
 
+        for (c = 0; c < _CONTROLLER_MAX; c++)
+                group_close(g, c);
+
         free(g->path);
         free(g);
 }
 
-static void group_hashmap_clear(Hashmap *h) {
+static void group_hashmap_free(Hashmap *h) {
         Group *g;
 
         while ((g = hashmap_steal_first(h)))
                 group_free(g);
-}
 
-static void group_hashmap_free(Hashmap *h) {
-        group_hashmap_clear(h);
         hashmap_free(h);
 }
 
-static int process(const char *controller, const char *path, Hashmap *a, Hashmap *b, unsigned iteration) {
+static int open_attribute(Controller c, const char *path, const char *attribute, int *fd) {
+        _cleanup_free_ char *p = NULL;
+        int r;
+
+        r = cg_get_path(controller_table[c].name, path, attribute, &p);
+        if (r < 0)
+                return r;
+
+        *fd = open(p, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (*fd < 0) {
+                /* Too many groups to keep everything open, read
+                 * this one the slow way */
+                if (errno == EMFILE || errno == ENFILE)
+                        return 0;
+
+                return -errno;
+        }
+
+        return 0;
+}
+
+static int group_add(Hashmap *groups, Controller c, const char *path, unsigned depth) {
         Group *g;
+        DIR *d = NULL;
         int r;
-        FILE *f;
-        pid_t pid;
-        unsigned n;
 
-        assert(controller);
+        assert(groups);
         assert(path);
-        assert(a);
 
-        g = hashmap_get(a, path);
+        if (depth > arg_depth)
+                return 0;
+
+        g = hashmap_get(groups, path);
         if (!g) {
-                g = hashmap_get(b, path);
-                if (!g) {
-                        g = new0(Group, 1);
-                        if (!g)
-                                return -ENOMEM;
-
-                        g->path = strdup(path);
-                        if (!g->path) {
-                                group_free(g);
-                                return -ENOMEM;
+                Controller k;
+
+                g = new0(Group, 1);
+                if (!g)
+                        return -ENOMEM;
+
+                for (k = 0; k < _CONTROLLER_MAX; k++)
+                        g->tasks_fd[k] = g->attribute_fd[k] = g->wd[k] = -1;
+
+                g->depth = depth;
+                g->path = strdup(path);
+                if (!g->path) {
+                        group_free(g);
+                        return -ENOMEM;
+                }
+
+                r = hashmap_put(groups, g->path, g);
+                if (r < 0) {
+                        group_free(g);
+                        return r;
+                }
+        }
+
+        g->seen[c] = true;
+
+        if (!g->present[c]) {
+                r = open_attribute(c, path, "tasks", &g->tasks_fd[c]);
+                if (r >= 0 && controller_table[c].attribute)
+                        r = open_attribute(c, path, controller_table[c].attribute, &g->attribute_fd[c]);
+                if (r < 0) {
+                        group_close(g, c);
+                        goto finish;
+                }
+
+                g->present[c] = true;
+
+                /* Subgroups deeper than that are not shown, hence
+                 * there's no need to know about them */
+                if (inotify_fd >= 0 && depth < arg_depth) {
+                        _cleanup_free_ char *p = NULL;
+
+                        r = cg_get_path(controller_table[c].name, path, NULL, &p);
+                        if (r < 0)
+                                goto finish;
+
+                        g->wd[c] = inotify_add_watch(inotify_fd, p, IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR);
+                        if (g->wd[c] >= 0) {
+                                r = hashmap_put(watches, INT_TO_PTR(g->wd[c]), g);
+                                if (r < 0) {
+                                        inotify_rm_watch(inotify_fd, g->wd[c]);
+                                        g->wd[c] = -1;
+                                        goto finish;
+                                }
                         }
+                }
+        }
 
-                        r = hashmap_put(a, g->path, g);
-                        if (r < 0) {
-                                group_free(g);
+        if (depth >= arg_depth) {
+                r = 0;
+                goto finish;
+        }
+
+        /* Also descend into groups we know already, since subgroups
+         * might have been created before we started watching */
+        r = cg_enumerate_subgroups(controller_table[c].name, path, &d);
+        if (r < 0)
+                goto finish;
+
+        for (;;) {
+                char *fn, *p;
+
+                r = cg_read_subgroup(d, &fn);
+                if (r <= 0)
+                        goto finish;
+
+                p = strjoin(path, "/", fn, NULL);
+                free(fn);
+
+                if (!p) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                path_kill_slashes(p);
+
+                r = group_add(groups, c, p, depth + 1);
+                free(p);
+
+                if (r < 0)
+                        goto finish;
+        }
+
+finish:
+        if (!group_is_present(g)) {
+                hashmap_remove(groups, g->path);
+                group_free(g);
+        }
+
+        if (d)
+                closedir(d);
+
+        /* The group went away while we were looking at it */
+        if (r == -ENOENT || r == -ENODEV)
+                return 0;
+
+        return r;
+}
+
+static void group_remove(Hashmap *groups, Controller c, const char *path) {
+        Iterator i;
+        Group *g;
+
+        assert(groups);
+        assert(path);
+
+        /* Drops the group and all its subgroups from one hierarchy */
+        HASHMAP_FOREACH(g, groups, i) {
+                if (!g->present[c] || !path_startswith(g->path, path))
+                        continue;
+
+                group_close(g, c);
+
+                if (!group_is_present(g)) {
+                        hashmap_remove(groups, g->path);
+                        group_free(g);
+                }
+        }
+}
+
+static int rescan(Hashmap *groups) {
+        Controller c;
+        Iterator i;
+        Group *g;
+        int r;
+
+        assert(groups);
+
+        /* Walks the whole tree, keeping the groups we know, and drops
+         * those that disappeared */
+        HASHMAP_FOREACH(g, groups, i)
+                zero(g->seen);
+
+        for (c = 0; c < _CONTROLLER_MAX; c++) {
+                r = group_add(groups, c, "/", 0);
+                if (r < 0)
+                        return r;
+        }
+
+        HASHMAP_FOREACH(g, groups, i) {
+                for (c = 0; c < _CONTROLLER_MAX; c++)
+                        if (g->present[c] && !g->seen[c])
+                                group_close(g, c);
+
+                if (!group_is_present(g)) {
+                        hashmap_remove(groups, g->path);
+                        group_free(g);
+                }
+        }
+
+        return 0;
+}
+
+static int process_inotify_event(Hashmap *groups, struct inotify_event *e) {
+        _cleanup_free_ char *p = NULL;
+        Controller c;
+        Group *g;
+
+        if (e->mask & IN_Q_OVERFLOW)
+                return rescan(groups);
+
+        g = hashmap_get(watches, INT_TO_PTR(e->wd));
+        if (!g)
+                return 0;
+
+        for (c = 0; c < _CONTROLLER_MAX; c++)
+                if (g->wd[c] == e->wd)
+                        break;
+        assert(c < _CONTROLLER_MAX);
+
+        if (e->mask & IN_IGNORED) {
+                /* The directory went away, its parent will tell us */
+                hashmap_remove(watches, INT_TO_PTR(e->wd));
+                g->wd[c] = -1;
+                return 0;
+        }
+
+        if (!(e->mask & IN_ISDIR) || e->len <= 0)
+                return 0;
+
+        p = strjoin(g->path, "/", e->name, NULL);
+        if (!p)
+                return -ENOMEM;
+
+        path_kill_slashes(p);
+
+        if (e->mask & (IN_CREATE|IN_MOVED_TO))
+                return group_add(groups, c, p, g->depth + 1);
+
+        group_remove(groups, c, p);
+        return 0;
+}
+
+static int process_inotify(Hashmap *groups) {
+        uint8_t inotify_buffer[sizeof(struct inotify_event) + FILENAME_MAX] _alignas_(struct inotify_event);
+        int r;
+
+        if (inotify_fd < 0)
+                return rescan(groups);
+
+        for (;;) {
+                struct inotify_event *e;
+                ssize_t l;
+
+                l = read(inotify_fd, inotify_buffer, sizeof(inotify_buffer));
+                if (l < 0) {
+                        if (errno == EAGAIN || errno == EINTR)
+                                return 0;
+
+                        return -errno;
+                }
+
+                e = (struct inotify_event*) inotify_buffer;
+                while (l > 0) {
+                        size_t step;
+
+                        r = process_inotify_event(groups, e);
+                        if (r < 0)
                                 return r;
-                        }
-                } else {
-                        assert_se(hashmap_move_one(a, b, path) == 0);
-                        g->cpu_valid = g->memory_valid = g->io_valid = g->n_tasks_valid = false;
+
+                        step = sizeof(struct inotify_event) + e->len;
+                        assert(step <= (size_t) l);
+
+                        e = (struct inotify_event*) ((uint8_t*) e + step);
+                        l -= step;
+                }
+        }
+}
+
+static int read_attribute(int fd, Controller c, const char *path, const char *attribute) {
+        size_t size = 0;
+        int our_fd = -1, r;
+
+        /* Reads the whole attribute into attribute_buffer, from
+         * the start, so that an fd kept open yields fresh data each
+         * time */
+        if (fd < 0) {
+                r = open_attribute(c, path, attribute, &our_fd);
+                if (r < 0)
+                        return r;
+                if (our_fd < 0)
+                        return -EMFILE;
+
+                fd = our_fd;
+        }
+
+        for (;;) {
+                ssize_t n;
+
+                if (!GREEDY_REALLOC(attribute_buffer, attribute_allocated, size + LINE_MAX)) {
+                        r = -ENOMEM;
+                        break;
                 }
+
+                n = pread(fd, attribute_buffer + size, attribute_allocated - size - 1, size);
+                if (n < 0) {
+                        r = -errno;
+                        break;
+                }
+
+                if (n == 0) {
+                        attribute_buffer[size] = 0;
+                        r = 0;
+                        break;
+                }
+
+                size += n;
         }
 
+        if (our_fd >= 0)
+                close_nointr_nofail(our_fd);
+
+        return r;
+}
+
+static int process(Group *g, Controller c, unsigned iteration) {
+        unsigned n;
+        char *l;
+        int r;
+
+        assert(g);
+
         /* Regardless which controller, let's find the maximum number
          * of processes in any of it */
 
-        r = cg_enumerate_tasks(controller, path, &f);
+        r = read_attribute(g->tasks_fd[c], c, g->path, "tasks");
         if (r < 0)
                 return r;
 
         n = 0;
-        while (cg_read_pid(f, &pid) > 0)
-                n++;
-        fclose(f);
+        for (l = attribute_buffer; *l; l++)
+                if (*l == '\n')
+                        n++;
 
         if (n > 0) {
                 if (g->n_tasks_valid)
@@ -152,22 +510,18 @@ static int process(const char *controller, const char *path, Hashmap *a, Hashmap
                 g->n_tasks_valid = true;
         }
 
-        if (streq(controller, "cpuacct")) {
-                uint64_t new_usage;
-                char *p, *v;
-                struct timespec ts;
+        if (!controller_table[c].attribute)
+                return 0;
 
-                r = cg_get_path(controller, path, "cpuacct.usage", &p);
-                if (r < 0)
-                        return r;
+        r = read_attribute(g->attribute_fd[c], c, g->path, controller_table[c].attribute);
+        if (r < 0)
+                return r;
 
-                r = read_one_line_file(p, &v);
-                free(p);
-                if (r < 0)
-                        return r;
+        if (c == CONTROLLER_CPUACCT) {
+                uint64_t new_usage;
+                struct timespec ts;
 
-                r = safe_atou64(v, &new_usage);
-                free(v);
+                r = safe_atou64(strstrip(attribute_buffer), &new_usage);
                 if (r < 0)
                         return r;
 
@@ -191,49 +545,28 @@ static int process(const char *controller, const char *path, Hashmap *a, Hashmap
                 g->cpu_timestamp = ts;
                 g->cpu_iteration = iteration;
 
-        } else if (streq(controller, "memory")) {
-                char *p, *v;
-
-                r = cg_get_path(controller, path, "memory.usage_in_bytes", &p);
-                if (r < 0)
-                        return r;
-
-                r = read_one_line_file(p, &v);
-                free(p);
-                if (r < 0)
-                        return r;
+        } else if (c == CONTROLLER_MEMORY) {
 
-                r = safe_atou64(v, &g->memory);
-                free(v);
+                r = safe_atou64(strstrip(attribute_buffer), &g->memory);
                 if (r < 0)
                         return r;
 
                 if (g->memory > 0)
                         g->memory_valid = true;
 
-        } else if (streq(controller, "blkio")) {
-                char *p;
+        } else if (c == CONTROLLER_BLKIO) {
                 uint64_t wr = 0, rd = 0;
                 struct timespec ts;
+                char *next;
 
-                r = cg_get_path(controller, path, "blkio.io_service_bytes", &p);
-                if (r < 0)
-                        return r;
-
-                f = fopen(p, "re");
-                free(p);
-
-                if (!f)
-                        return -errno;
-
-                for (;;) {
-                        char line[LINE_MAX], *l;
+                for (l = attribute_buffer; *l; l = next) {
                         uint64_t k, *q;
 
-                        if (!fgets(line, sizeof(line), f))
-                                break;
+                        next = l + strcspn(l, NEWLINE);
+                        if (*next)
+                                *(next++) = 0;
 
-                        l = strstrip(line);
+                        l = strstrip(l);
                         l += strcspn(l, WHITESPACE);
                         l += strspn(l, WHITESPACE);
 
@@ -254,8 +587,6 @@ static int process(const char *controller, const char *path, Hashmap *a, Hashmap
                         *q += k;
                 }
 
-                fclose(f);
-
                 assert_se(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
 
                 if (g->io_iteration == iteration - 1) {
@@ -284,89 +615,41 @@ static int process(const char *controller, const char *path, Hashmap *a, Hashmap
         return 0;
 }
 
-static int refresh_one(
-                const char *controller,
-                const char *path,
-                Hashmap *a,
-                Hashmap *b,
-                unsigned iteration,
-                unsigned depth) {
-
-        DIR *d = NULL;
+static int refresh(Hashmap *groups, unsigned iteration) {
+        Iterator i;
+        Group *g;
         int r;
 
-        assert(controller);
-        assert(path);
-        assert(a);
-
-        if (depth > arg_depth)
-                return 0;
+        assert(groups);
 
-        r = process(controller, path, a, b, iteration);
+        /* Only the groups that were added or removed since the last
+         * refresh need to be looked at in the tree, everything else
+         * is read through the files we keep open */
+        r = process_inotify(groups);
         if (r < 0)
                 return r;
 
-        r = cg_enumerate_subgroups(controller, path, &d);
-        if (r < 0) {
-                if (r == -ENOENT)
-                        return 0;
+        HASHMAP_FOREACH(g, groups, i) {
+                Controller c;
 
-                return r;
-        }
+                g->cpu_valid = g->memory_valid = g->io_valid = g->n_tasks_valid = false;
 
-        for (;;) {
-                char *fn, *p;
-
-                r = cg_read_subgroup(d, &fn);
-                if (r <= 0)
-                        goto finish;
+                for (c = 0; c < _CONTROLLER_MAX; c++) {
+                        if (!g->present[c])
+                                continue;
 
-                p = strjoin(path, "/", fn, NULL);
-                free(fn);
+                        r = process(g, c, iteration);
+                        if (r < 0) {
+                                /* Removed, but we didn't hear of it
+                                 * yet */
+                                if (r == -ENOENT || r == -ENODEV)
+                                        continue;
 
-                if (!p) {
-                        r = -ENOMEM;
-                        goto finish;
+                                return r;
+                        }
                 }
-
-                path_kill_slashes(p);
-
-                r = refresh_one(controller, p, a, b, iteration, depth + 1);
-                free(p);
-
-                if (r < 0)
-                        goto finish;
         }
 
-finish:
-        if (d)
-                closedir(d);
-
-        return r;
-}
-
-static int refresh(Hashmap *a, Hashmap *b, unsigned iteration) {
-        int r;
-
-        assert(a);
-
-        r = refresh_one("name=systemd", "/", a, b, iteration, 0);
-        if (r < 0)
-                if (r != -ENOENT)
-                    return r;
-        r = refresh_one("cpuacct", "/", a, b, iteration, 0);
-        if (r < 0)
-                if (r != -ENOENT)
-                    return r;
-        r = refresh_one("memory", "/", a, b, iteration, 0);
-        if (r < 0)
-                if (r != -ENOENT)
-                    return r;
-
-        r = refresh_one("blkio", "/", a, b, iteration, 0);
-        if (r < 0)
-                if (r != -ENOENT)
-                    return r;
         return 0;
 }
 
@@ -689,7 +972,8 @@ static int parse_argv(int argc, char *argv[]) {
 
 int main(int argc, char *argv[]) {
         int r;
-        Hashmap *a = NULL, *b = NULL;
+        Hashmap *groups = NULL;
+        struct rlimit rl;
         unsigned iteration = 0;
         usec_t last_refresh = 0;
         bool quit = false, immediate_refresh = false;
@@ -701,20 +985,33 @@ int main(int argc, char *argv[]) {
         if (r <= 0)
                 goto finish;
 
-        a = hashmap_new(string_hash_func, string_compare_func);
-        b = hashmap_new(string_hash_func, string_compare_func);
-        if (!a || !b) {
+        groups = hashmap_new(string_hash_func, string_compare_func);
+        watches = hashmap_new(trivial_hash_func, trivial_compare_func);
+        if (!groups || !watches) {
                 r = log_oom();
                 goto finish;
         }
 
+        /* We keep a couple of files open for each group */
+        if (getrlimit(RLIMIT_NOFILE, &rl) >= 0 && rl.rlim_cur < rl.rlim_max) {
+                rl.rlim_cur = rl.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &rl);
+        }
+
+        inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (inotify_fd < 0)
+                log_debug("Failed to allocate inotify fd, walking the cgroup tree on each refresh: %m");
+
+        r = rescan(groups);
+        if (r < 0)
+                goto finish;
+
         signal(SIGWINCH, columns_lines_cache_reset);
 
         if (!on_tty())
                 arg_iterations = 1;
 
         while (!quit) {
-                Hashmap *c;
                 usec_t t;
                 char key;
                 char h[FORMAT_TIMESPAN_MAX];
@@ -723,21 +1020,15 @@ int main(int argc, char *argv[]) {
 
                 if (t >= last_refresh + arg_delay || immediate_refresh) {
 
-                        r = refresh(a, b, iteration++);
+                        r = refresh(groups, iteration++);
                         if (r < 0)
                                 goto finish;
 
-                        group_hashmap_clear(b);
-
-                        c = a;
-                        a = b;
-                        b = c;
-
                         last_refresh = t;
                         immediate_refresh = false;
                 }
 
-                r = display(b);
+                r = display(groups);
                 if (r < 0)
                         goto finish;
 
@@ -842,8 +1133,12 @@ int main(int argc, char *argv[]) {
         r = 0;
 
 finish:
-        group_hashmap_free(a);
-        group_hashmap_free(b);
+        group_hashmap_free(groups);
+        hashmap_free(watches);
+        free(attribute_buffer);
+
+        if (inotify_fd >= 0)
+                close_nointr_nofail(inotify_fd);
 
         if (r < 0) {
                 log_error("Exiting with failure: %s", strerror(-r));
@@ -141,13 +141,27 @@ int automount_add_one_mount_link(Automount *a, Mount *m) {
 }
 
 static int automount_add_mount_links(Automount *a) {
-        Unit *other;
+        _cleanup_set_free_ Set *s = NULL;
+        Iterator i;
+        Mount *m;
         int r;
 
         assert(a);
 
-        LIST_FOREACH(units_by_type, other, UNIT(a)->manager->units_by_type[UNIT_MOUNT]) {
-                r = automount_add_one_mount_link(a, MOUNT(other));
+        r = unit_add_path_index(UNIT(a), a->where);
+        if (r < 0)
+                return r;
+
+        s = set_new(trivial_hash_func, trivial_compare_func);
+        if (!s)
+                return -ENOMEM;
+
+        r = path_trie_find_above(UNIT(a)->manager->units_by_path[UNIT_MOUNT], a->where, s);
+        if (r < 0)
+                return r;
+
+        SET_FOREACH(m, s, i) {
+                r = automount_add_one_mount_link(a, m);
                 if (r < 0)
                         return r;
         }
@@ -902,6 +916,7 @@ const UnitVTable automount_vtable = {
 
         .bus_interface = "org.freedesktop.systemd1.Automount",
         .bus_message_handler = bus_automount_message_handler,
+        .bus_append_properties = bus_automount_append_properties,
         .bus_invalidating_properties = bus_automount_invalidating_properties,
 
         .shutdown = automount_shutdown,
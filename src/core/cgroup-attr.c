@@ -22,10 +22,9 @@
 #include "cgroup-attr.h"
 #include "cgroup-util.h"
 #include "list.h"
-#include "fileio.h"
 
 int cgroup_attribute_apply(CGroupAttribute *a, CGroupBonding *b) {
-        _cleanup_free_ char *path = NULL, *v = NULL;
+        _cleanup_free_ char *v = NULL;
         int r;
 
         assert(a);
@@ -40,13 +39,10 @@ int cgroup_attribute_apply(CGroupAttribute *a, CGroupBonding *b) {
                         return r;
         }
 
-        r = cg_get_path(a->controller, b->path, a->name, &path);
+        r = cgroup_bonding_write(b, a->name, v ? v : a->value);
         if (r < 0)
-                return r;
-
-        r = write_string_file(path, v ? v : a->value);
-        if (r < 0)
-                log_warning("Failed to write '%s' to %s: %s", v ? v : a->value, path, strerror(-r));
+                log_warning("Failed to write '%s' to %s:%s/%s: %s",
+                            v ? v : a->value, b->controller, b->path, a->name, strerror(-r));
 
         return r;
 }
@@ -0,0 +1,318 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cgroup-sample.h"
+#include "cgroup.h"
+#include "profile.h"
+
+/* Above this many kept open, the attribute files are opened for each
+ * sample, relative to the cgroup directory fds kept anyway */
+#define CGROUP_SAMPLE_FDS_MAX 1024
+
+static const struct {
+        const char *controller;
+        /* The controller is usually mounted together with this one */
+        const char *joined;
+        const char *attribute;
+} attribute_table[_CGROUP_SAMPLE_ATTRIBUTE_MAX] = {
+        [CGROUP_SAMPLE_CPU]    = { "cpuacct", "cpu", "cpuacct.usage"          },
+        [CGROUP_SAMPLE_MEMORY] = { "memory",  NULL,  "memory.usage_in_bytes"  },
+        [CGROUP_SAMPLE_IO]     = { "blkio",   NULL,  "blkio.io_service_bytes" },
+};
+
+static char *attribute_buffer = NULL;
+static size_t attribute_allocated = 0;
+
+static CGroupSampler *cgroup_sampler_new(void) {
+        CGroupSampler *s;
+        CGroupSampleAttribute a;
+
+        s = new0(CGroupSampler, 1);
+        if (!s)
+                return NULL;
+
+        for (a = 0; a < _CGROUP_SAMPLE_ATTRIBUTE_MAX; a++)
+                s->fd[a] = -1;
+
+        return s;
+}
+
+void cgroup_sampler_close(Manager *m, CGroupSampler *s) {
+        CGroupSampleAttribute a;
+
+        assert(m);
+
+        if (!s)
+                return;
+
+        for (a = 0; a < _CGROUP_SAMPLE_ATTRIBUTE_MAX; a++) {
+                if (s->fd[a] >= 0) {
+                        close_nointr_nofail(s->fd[a]);
+                        s->fd[a] = -1;
+
+                        assert(m->n_cgroup_sample_fds > 0);
+                        m->n_cgroup_sample_fds--;
+                }
+
+                /* The unit might be in other groups next time */
+                s->missing[a] = false;
+        }
+}
+
+void cgroup_sampler_free(Manager *m, CGroupSampler *s) {
+        if (!s)
+                return;
+
+        cgroup_sampler_close(m, s);
+        free(s);
+}
+
+const CGroupSample *cgroup_sampler_get(const CGroupSampler *s, unsigned i) {
+        assert(s);
+
+        if (i >= s->n_samples)
+                return NULL;
+
+        return s->samples + (s->first + i) % CGROUP_SAMPLES_MAX;
+}
+
+/* Reads the whole attribute into attribute_buffer, from the start,
+ * like systemd-cgtop does it */
+static int read_fd(int fd) {
+        size_t size = 0;
+
+        for (;;) {
+                ssize_t n;
+
+                if (!GREEDY_REALLOC(attribute_buffer, attribute_allocated, size + LINE_MAX))
+                        return -ENOMEM;
+
+                n = pread(fd, attribute_buffer + size, attribute_allocated - size - 1, size);
+                if (n < 0)
+                        return -errno;
+
+                if (n == 0) {
+                        attribute_buffer[size] = 0;
+                        return 0;
+                }
+
+                size += n;
+        }
+}
+
+static int open_attribute(Unit *u, CGroupSampleAttribute a) {
+        CGroupBonding *b;
+
+        b = cgroup_bonding_find_list(u->cgroup_bondings, attribute_table[a].controller);
+        if (!b && attribute_table[a].joined)
+                b = cgroup_bonding_find_list(u->cgroup_bondings, attribute_table[a].joined);
+        if (!b)
+                return -ENOENT;
+
+        return cgroup_bonding_open_file(b, attribute_table[a].attribute, O_RDONLY);
+}
+
+static int read_attribute(Manager *m, Unit *u, CGroupSampler *s, CGroupSampleAttribute a) {
+        bool retry;
+        int r;
+
+        if (s->missing[a])
+                return -ENOENT;
+
+        /* A file kept open stops working when the group is removed
+         * behind our back, in which case we open it once more */
+        for (retry = s->fd[a] >= 0;; retry = false) {
+                int fd;
+
+                fd = s->fd[a];
+                if (fd < 0) {
+                        fd = open_attribute(u, a);
+                        if (fd == -ENOENT)
+                                s->missing[a] = true;
+                        if (fd < 0)
+                                return fd;
+
+                        if (m->n_cgroup_sample_fds >= CGROUP_SAMPLE_FDS_MAX) {
+                                r = read_fd(fd);
+                                close_nointr_nofail(fd);
+                                return r;
+                        }
+
+                        s->fd[a] = fd;
+                        m->n_cgroup_sample_fds++;
+                }
+
+                r = read_fd(fd);
+                if (r >= 0 || r == -ENOMEM)
+                        return r;
+
+                close_nointr_nofail(s->fd[a]);
+                s->fd[a] = -1;
+                m->n_cgroup_sample_fds--;
+
+                if (!retry)
+                        return r;
+        }
+}
+
+static uint64_t read_counter(Manager *m, Unit *u, CGroupSampler *s, CGroupSampleAttribute a) {
+        uint64_t v;
+
+        if (read_attribute(m, u, s, a) < 0)
+                return (uint64_t) -1;
+
+        if (safe_atou64(strstrip(attribute_buffer), &v) < 0)
+                return (uint64_t) -1;
+
+        return v;
+}
+
+static void read_io(Manager *m, Unit *u, CGroupSampler *s, uint64_t *rd, uint64_t *wr) {
+        char *l, *next;
+
+        *rd = *wr = (uint64_t) -1;
+
+        if (read_attribute(m, u, s, CGROUP_SAMPLE_IO) < 0)
+                return;
+
+        *rd = *wr = 0;
+
+        /* One line per device and direction, summed up */
+        for (l = attribute_buffer; *l; l = next) {
+                uint64_t k, *q;
+
+                next = l + strcspn(l, NEWLINE);
+                if (*next)
+                        *(next++) = 0;
+
+                l = strstrip(l);
+                l += strcspn(l, WHITESPACE);
+                l += strspn(l, WHITESPACE);
+
+                if (first_word(l, "Read")) {
+                        l += 4;
+                        q = rd;
+                } else if (first_word(l, "Write")) {
+                        l += 5;
+                        q = wr;
+                } else
+                        continue;
+
+                l += strspn(l, WHITESPACE);
+                if (safe_atou64(l, &k) < 0)
+                        continue;
+
+                *q += k;
+        }
+}
+
+static void unit_sample(Manager *m, Unit *u, const dual_timestamp *ts) {
+        CGroupSampler *s;
+        CGroupSample sample = {
+                .timestamp = *ts,
+        };
+
+        s = u->cgroup_sampler;
+        if (!s) {
+                s = cgroup_sampler_new();
+                if (!s) {
+                        log_oom();
+                        return;
+                }
+
+                u->cgroup_sampler = s;
+        }
+
+        /* The counters start from zero again with each run */
+        if (s->started != u->inactive_exit_timestamp.monotonic) {
+                s->started = u->inactive_exit_timestamp.monotonic;
+                s->first = s->n_samples = 0;
+        }
+
+        sample.cpu_nsec = read_counter(m, u, s, CGROUP_SAMPLE_CPU);
+        sample.memory_bytes = read_counter(m, u, s, CGROUP_SAMPLE_MEMORY);
+        read_io(m, u, s, &sample.io_read_bytes, &sample.io_write_bytes);
+
+        if (s->n_samples < CGROUP_SAMPLES_MAX)
+                s->samples[(s->first + s->n_samples++) % CGROUP_SAMPLES_MAX] = sample;
+        else {
+                s->samples[s->first] = sample;
+                s->first = (s->first + 1) % CGROUP_SAMPLES_MAX;
+        }
+}
+
+int manager_watch_cgroup_sampling(Manager *m) {
+        int r;
+
+        assert(m);
+
+        if (m->resource_sampling_usec <= 0)
+                return 0;
+
+        m->cgroup_sampling_watch.type = WATCH_CGROUP_SAMPLING;
+
+        r = manager_watch_timer(m, &m->cgroup_sampling_watch, CLOCK_MONOTONIC, true,
+                                m->resource_sampling_usec, m->resource_sampling_usec / 10);
+        if (r < 0) {
+                log_error("Failed to set up resource sampling timer: %s", strerror(-r));
+                watch_init(&m->cgroup_sampling_watch);
+                return r;
+        }
+
+        return 0;
+}
+
+void manager_dispatch_cgroup_sampling(Manager *m) {
+        dual_timestamp ts;
+        usec_t begin;
+        Iterator i;
+        const char *k;
+        Unit *u;
+
+        assert(m);
+
+        begin = now(CLOCK_MONOTONIC);
+        dual_timestamp_get(&ts);
+
+        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+
+                if (k != u->id)
+                        continue;
+
+                if (!u->cgroup_bondings)
+                        continue;
+
+                /* Stopped units keep their samples, but not the
+                 * files of their groups, which are gone */
+                if (!UNIT_IS_ACTIVE_OR_RELOADING(unit_active_state(u))) {
+                        cgroup_sampler_close(m, u->cgroup_sampler);
+                        continue;
+                }
+
+                unit_sample(m, u, &ts);
+        }
+
+        profile_add(PROFILE_CGROUP, begin);
+
+        manager_watch_cgroup_sampling(m);
+}
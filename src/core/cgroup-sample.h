@@ -0,0 +1,75 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+typedef struct CGroupSample CGroupSample;
+typedef struct CGroupSampler CGroupSampler;
+
+#include "util.h"
+
+/* Keeps the last couple of readings of the resource counters of each
+ * active unit's cgroups, taken every ResourceSamplingSec=, so that
+ * monitoring may fetch them for all units with one GetResourceSamples()
+ * call instead of walking cgroupfs itself. Counters of controllers the
+ * unit is not in read as (uint64_t) -1. */
+
+#define CGROUP_SAMPLES_MAX 8
+
+typedef enum CGroupSampleAttribute {
+        CGROUP_SAMPLE_CPU,
+        CGROUP_SAMPLE_MEMORY,
+        CGROUP_SAMPLE_IO,
+        _CGROUP_SAMPLE_ATTRIBUTE_MAX
+} CGroupSampleAttribute;
+
+struct CGroupSample {
+        dual_timestamp timestamp;
+        uint64_t cpu_nsec;
+        uint64_t memory_bytes;
+        uint64_t io_read_bytes;
+        uint64_t io_write_bytes;
+};
+
+struct CGroupSampler {
+        /* The attribute files are kept open between samples, as long
+         * as we have fds to spare for that */
+        int fd[_CGROUP_SAMPLE_ATTRIBUTE_MAX];
+        bool missing[_CGROUP_SAMPLE_ATTRIBUTE_MAX];
+
+        /* Ring buffer, oldest first, of the samples since the unit
+         * was started */
+        usec_t started;
+        unsigned first, n_samples;
+        CGroupSample samples[CGROUP_SAMPLES_MAX];
+};
+
+#include "unit.h"
+#include "manager.h"
+
+void cgroup_sampler_free(Manager *m, CGroupSampler *s);
+void cgroup_sampler_close(Manager *m, CGroupSampler *s);
+
+/* Returns the i-th sample, oldest first */
+const CGroupSample *cgroup_sampler_get(const CGroupSampler *s, unsigned i);
+
+int manager_watch_cgroup_sampling(Manager *m);
+void manager_dispatch_cgroup_sampling(Manager *m);
@@ -25,13 +25,21 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
 #include <fcntl.h>
 
 #include "cgroup.h"
 #include "cgroup-util.h"
 #include "log.h"
 #include "strv.h"
+#include "set.h"
 #include "path-util.h"
+#include "socket-util.h"
+#include "def.h"
+#include "mkdir.h"
+#include "pid-cache.h"
+#include "profile.h"
 
 int cgroup_bonding_realize(CGroupBonding *b) {
         int r;
@@ -48,18 +56,32 @@ int cgroup_bonding_realize(CGroupBonding *b) {
 
         b->realized = true;
 
+        /* Keep the directory around, the attributes and the first
+         * process are written right after */
+        r = cgroup_bonding_open(b);
+        if (r < 0)
+                log_debug("Failed to open cgroup %s:%s, writing by path: %s", b->controller, b->path, strerror(-r));
+
         return 0;
 }
 
 int cgroup_bonding_realize_list(CGroupBonding *first) {
         CGroupBonding *b;
-        int r;
+        usec_t begin;
+        int r = 0;
 
-        LIST_FOREACH(by_unit, b, first)
-                if ((r = cgroup_bonding_realize(b)) < 0 && b->essential)
-                        return r;
+        begin = now(CLOCK_MONOTONIC);
 
-        return 0;
+        LIST_FOREACH(by_unit, b, first) {
+                r = cgroup_bonding_realize(b);
+                if (r < 0 && b->essential)
+                        break;
+        }
+
+        profile_add(PROFILE_CGROUP, begin);
+
+        /* We only leave the loop early on essential failures */
+        return b ? r : 0;
 }
 
 void cgroup_bonding_free(CGroupBonding *b, bool trim) {
@@ -71,6 +93,9 @@ void cgroup_bonding_free(CGroupBonding *b, bool trim) {
                 LIST_REMOVE(CGroupBonding, by_unit, b->unit->cgroup_bondings, b);
 
                 if (streq(b->controller, SYSTEMD_CGROUP_CONTROLLER)) {
+                        /* Don't leave references to the unit behind */
+                        pid_cache_flush(b->unit->manager);
+
                         assert_se(f = hashmap_get(b->unit->manager->cgroup_bondings, b->path));
                         LIST_REMOVE(CGroupBonding, by_path, f, b);
 
@@ -84,6 +109,8 @@ void cgroup_bonding_free(CGroupBonding *b, bool trim) {
         if (b->realized && b->ours && trim)
                 cg_trim(b->controller, b->path, false);
 
+        cgroup_bonding_close(b);
+
         free(b->controller);
         free(b->path);
         free(b);
@@ -96,11 +123,106 @@ void cgroup_bonding_free_list(CGroupBonding *first, bool remove_or_trim) {
                 cgroup_bonding_free(b, remove_or_trim);
 }
 
+int cgroup_bonding_open(CGroupBonding *b) {
+        _cleanup_free_ char *fs = NULL;
+        int r;
+
+        assert(b);
+
+        if (b->fd >= 0)
+                return b->fd;
+
+        r = cg_get_path(b->controller, b->path, NULL, &fs);
+        if (r < 0)
+                return r;
+
+        b->fd = open(fs, O_RDONLY|O_DIRECTORY|O_CLOEXEC|O_NOCTTY);
+        if (b->fd < 0)
+                return -errno;
+
+        return b->fd;
+}
+
+void cgroup_bonding_close(CGroupBonding *b) {
+        assert(b);
+
+        if (b->fd >= 0) {
+                close_nointr_nofail(b->fd);
+                b->fd = -1;
+        }
+}
+
+void cgroup_bonding_forget_fds_list(CGroupBonding *first) {
+        CGroupBonding *b;
+
+        /* For forked children, which closed all fds already */
+        LIST_FOREACH(by_unit, b, first)
+                b->fd = -1;
+}
+
+int cgroup_bonding_open_file(CGroupBonding *b, const char *name, int flags) {
+        int dfd, fd;
+
+        dfd = cgroup_bonding_open(b);
+        if (dfd < 0)
+                return dfd;
+
+        fd = openat(dfd, name, flags|O_CLOEXEC|O_NOCTTY);
+        if (fd >= 0 || errno != ENOENT)
+                return fd < 0 ? -errno : fd;
+
+        /* The group might have been removed and created anew
+         * behind our back, hence look it up once more */
+        cgroup_bonding_close(b);
+
+        dfd = cgroup_bonding_open(b);
+        if (dfd < 0)
+                return dfd;
+
+        fd = openat(dfd, name, flags|O_CLOEXEC|O_NOCTTY);
+        return fd < 0 ? -errno : fd;
+}
+
+int cgroup_bonding_write(CGroupBonding *b, const char *name, const char *value) {
+        _cleanup_close_ int fd = -1;
+        _cleanup_free_ char *t = NULL;
+        ssize_t n;
+        size_t l;
+
+        assert(b);
+        assert(name);
+        assert(value);
+
+        /* The kernel takes each write() as one value, hence the
+         * newline must go out together with it */
+        t = strappend(value, "\n");
+        if (!t)
+                return -ENOMEM;
+
+        fd = cgroup_bonding_open_file(b, name, O_WRONLY);
+        if (fd < 0)
+                return fd;
+
+        l = strlen(t);
+        n = write(fd, t, l);
+        if (n < 0)
+                return -errno;
+        if ((size_t) n != l)
+                return -EIO;
+
+        return 0;
+}
+
 void cgroup_bonding_trim(CGroupBonding *b, bool delete_root) {
         assert(b);
 
-        if (b->realized && b->ours)
+        if (b->realized && b->ours) {
                 cg_trim(b->controller, b->path, delete_root);
+
+                /* Stopped units drop their fds, so that we don't
+                 * keep one around for every unit ever started */
+                cgroup_bonding_close(b);
+        }
 }
 
 void cgroup_bonding_trim_list(CGroupBonding *first, bool delete_root) {
@@ -127,6 +249,18 @@ int cgroup_bonding_install(CGroupBonding *b, pid_t pid, const char *cgroup_suffi
         } else
                 path = b->path;
 
+        if (!p && b->realized) {
+                char c[DECIMAL_STR_MAX(pid_t)];
+
+                /* The group exists, so just add the process to it,
+                 * through the directory we opened for that */
+                snprintf(c, sizeof(c), "%lu", (unsigned long) (pid == 0 ? getpid() : pid));
+
+                r = cgroup_bonding_write(b, "tasks", c);
+                if (r != -ENOENT)
+                        return r;
+        }
+
         r = cg_create_and_attach(b->controller, path, pid);
         if (r < 0)
                 return r;
@@ -148,10 +282,20 @@ int cgroup_bonding_install_list(CGroupBonding *first, pid_t pid, const char *cgr
         return 0;
 }
 
+static void cgroup_bonding_flush_pid_cache(CGroupBonding *b) {
+        assert(b);
+
+        /* Processes change their unit when moved */
+        if (b->unit && streq(b->controller, SYSTEMD_CGROUP_CONTROLLER))
+                pid_cache_flush(b->unit->manager);
+}
+
 int cgroup_bonding_migrate(CGroupBonding *b, CGroupBonding *list) {
         CGroupBonding *q;
         int ret = 0;
 
+        cgroup_bonding_flush_pid_cache(b);
+
         LIST_FOREACH(by_unit, q, list) {
                 int r;
 
@@ -173,6 +317,8 @@ int cgroup_bonding_migrate_to(CGroupBonding *b, const char *target, bool rem) {
         assert(b);
         assert(target);
 
+        cgroup_bonding_flush_pid_cache(b);
+
         return cg_migrate_recursive(b->controller, b->path, b->controller, target, true, rem);
 }
 
@@ -250,6 +396,7 @@ int cgroup_bonding_kill(CGroupBonding *b, int sig, bool sigcont, bool rem, Set *
 int cgroup_bonding_kill_list(CGroupBonding *first, int sig, bool sigcont, bool rem, Set *s, const char *cgroup_suffix) {
         CGroupBonding *b;
         Set *allocated_set = NULL;
+        _cleanup_free_ char *frozen = NULL;
         int ret = -EAGAIN, r;
 
         if (!first)
@@ -259,6 +406,25 @@ int cgroup_bonding_kill_list(CGroupBonding *first, int sig, bool sigcont, bool r
                 if (!(s = allocated_set = set_new(trivial_hash_func, trivial_compare_func)))
                         return -ENOMEM;
 
+        /* If the unit has a freezer group, freeze it while we go
+         * through the processes, so that none of them can fork and
+         * one pass over the process lists is enough */
+        b = cgroup_bonding_find_list(first, "freezer");
+        if (b && b->ours && sig != 0) {
+                frozen = cgroup_suffix ? strjoin(b->path, "/", cgroup_suffix, NULL) : strdup(b->path);
+                if (!frozen) {
+                        ret = -ENOMEM;
+                        goto finish;
+                }
+
+                r = cg_freezer_set_state(frozen, true);
+                if (r < 0 && r != -ETIMEDOUT) {
+                        log_debug("Failed to freeze %s, killing without: %s", frozen, strerror(-r));
+                        free(frozen);
+                        frozen = NULL;
+                }
+        }
+
         LIST_FOREACH(by_unit, b, first) {
                 r = cgroup_bonding_kill(b, sig, sigcont, rem, s, cgroup_suffix);
                 if (r < 0) {
@@ -274,6 +440,11 @@ int cgroup_bonding_kill_list(CGroupBonding *first, int sig, bool sigcont, bool r
         }
 
 finish:
+        /* Signals to frozen processes are delivered once they are
+         * thawed */
+        if (frozen)
+                cg_freezer_set_state(frozen, false);
+
         if (allocated_set)
                 set_free(allocated_set);
 
@@ -318,6 +489,121 @@ int cgroup_bonding_is_empty_list(CGroupBonding *first) {
         return -EAGAIN;
 }
 
+#define CGROUPS_AGENT_BATCH_MAX 16
+
+static int manager_setup_cgroups_agent(Manager *m) {
+        union sockaddr_union sa = {
+                .un.sun_family = AF_UNIX,
+                .un.sun_path = CGROUPS_AGENT_SOCKET,
+        };
+        struct epoll_event ev = {
+                .events = EPOLLIN,
+                .data.ptr = &m->cgroups_agent_watch,
+        };
+        int fd;
+
+        assert(m);
+
+        if (m->cgroups_agent_watch.fd >= 0)
+                return 0;
+
+        fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+        if (fd < 0)
+                return -errno;
+
+        /* Only root may write to the socket. Anyway, every
+         * notification is checked against the tasks files, hence a
+         * bogus one costs no more than that check. */
+        mkdir_parents_label(CGROUPS_AGENT_SOCKET, 0755);
+        unlink(CGROUPS_AGENT_SOCKET);
+
+        if (bind(fd, &sa.sa, offsetof(struct sockaddr_un, sun_path) + strlen(sa.un.sun_path)) < 0 ||
+            chmod(CGROUPS_AGENT_SOCKET, 0600) < 0 ||
+            epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                close_nointr_nofail(fd);
+                return -errno;
+        }
+
+        m->cgroups_agent_watch.type = WATCH_CGROUPS_AGENT;
+        m->cgroups_agent_watch.fd = fd;
+
+        return 0;
+}
+
+int manager_dispatch_cgroups_agent(Manager *m) {
+        Set _cleanup_set_free_free_ *groups = NULL;
+        char *g;
+        int i, n;
+
+        assert(m);
+
+        if (m->cgroups_agent_watch.fd < 0)
+                return 0;
+
+        groups = set_new(string_hash_func, string_compare_func);
+        if (!groups)
+                return log_oom();
+
+        /* Collect everything queued first, so that each group is
+         * checked only once, however often it was reported */
+        for (;;) {
+                char buf[CGROUPS_AGENT_BATCH_MAX][PATH_MAX+1];
+                struct iovec iovec[CGROUPS_AGENT_BATCH_MAX];
+                struct mmsghdr msgs[CGROUPS_AGENT_BATCH_MAX];
+
+                for (i = 0; i < CGROUPS_AGENT_BATCH_MAX; i++) {
+                        iovec[i].iov_base = buf[i];
+                        iovec[i].iov_len = sizeof(buf[i])-1;
+
+                        zero(msgs[i]);
+                        msgs[i].msg_hdr.msg_iov = &iovec[i];
+                        msgs[i].msg_hdr.msg_iovlen = 1;
+                }
+
+                n = recvmmsg(m->cgroups_agent_watch.fd, msgs, CGROUPS_AGENT_BATCH_MAX, MSG_DONTWAIT, NULL);
+                if (n < 0) {
+                        if (errno == EAGAIN || errno == EINTR)
+                                break;
+
+                        return -errno;
+                }
+
+                for (i = 0; i < n; i++) {
+                        int r;
+
+                        if (msgs[i].msg_len <= 0 || buf[i][0] != '/')
+                                continue;
+
+                        buf[i][msgs[i].msg_len] = 0;
+
+                        if (set_get(groups, buf[i]))
+                                continue;
+
+                        g = strdup(buf[i]);
+                        if (!g)
+                                return log_oom();
+
+                        r = set_put(groups, g);
+                        if (r < 0) {
+                                free(g);
+                                return r;
+                        }
+                }
+
+                /* Anything short of a full batch drained the socket */
+                if (n < CGROUPS_AGENT_BATCH_MAX)
+                        break;
+        }
+
+        while ((g = set_steal_first(groups))) {
+                log_debug("Got cgroup empty notification for: %s", g);
+                cgroup_notify_empty(m, g);
+                free(g);
+        }
+
+        return 0;
+}
+
 int manager_setup_cgroup(Manager *m) {
         char *current = NULL, *path = NULL;
         int r;
@@ -378,6 +664,14 @@ int manager_setup_cgroup(Manager *m) {
         else
                 log_debug("Release agent already installed.");
 
+        /* The agent tells us about empty groups on this socket,
+         * and falls back to the bus if there is none */
+        if (m->running_as == SYSTEMD_SYSTEM) {
+                r = manager_setup_cgroups_agent(m);
+                if (r < 0)
+                        log_warning("Failed to set up cgroups agent socket, relying on the bus: %s", strerror(-r));
+        }
+
         /* 4. Realize the group */
         r = cg_create_and_attach(SYSTEMD_CGROUP_CONTROLLER, m->cgroup_hierarchy, 0);
         if (r < 0) {
@@ -418,6 +712,11 @@ void manager_shutdown_cgroup(Manager *m, bool delete) {
                 m->pin_cgroupfs_fd = -1;
         }
 
+        if (m->cgroups_agent_watch.fd >= 0)
+                close_nointr_nofail(m->cgroups_agent_watch.fd);
+
+        watch_init(&m->cgroups_agent_watch);
+
         free(m->cgroup_hierarchy);
         m->cgroup_hierarchy = NULL;
 }
@@ -47,6 +47,11 @@ struct CGroupBonding {
 
         /* This cgroup is realized */
         bool realized:1;
+
+        /* The cgroup directory, opened on first use, so that
+         * attributes may be written without resolving the path each
+         * time */
+        int fd;
 };
 
 int cgroup_bonding_realize(CGroupBonding *b);
@@ -55,6 +60,13 @@ int cgroup_bonding_realize_list(CGroupBonding *first);
 void cgroup_bonding_free(CGroupBonding *b, bool trim);
 void cgroup_bonding_free_list(CGroupBonding *first, bool trim);
 
+int cgroup_bonding_open(CGroupBonding *b);
+void cgroup_bonding_close(CGroupBonding *b);
+void cgroup_bonding_forget_fds_list(CGroupBonding *first);
+
+int cgroup_bonding_open_file(CGroupBonding *b, const char *name, int flags);
+int cgroup_bonding_write(CGroupBonding *b, const char *name, const char *value);
+
 int cgroup_bonding_install(CGroupBonding *b, pid_t pid, const char *suffix);
 int cgroup_bonding_install_list(CGroupBonding *first, pid_t pid, const char *suffix);
 
@@ -88,6 +100,8 @@ pid_t cgroup_bonding_search_main_pid_list(CGroupBonding *b);
 int manager_setup_cgroup(Manager *m);
 void manager_shutdown_cgroup(Manager *m, bool delete);
 
+int manager_dispatch_cgroups_agent(Manager *m);
+
 int cgroup_bonding_get(Manager *m, const char *cgroup, CGroupBonding **bonding);
 int cgroup_notify_empty(Manager *m, const char *group);
 
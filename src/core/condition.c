@@ -37,6 +37,7 @@
 #include "virt.h"
 #include "path-util.h"
 #include "fileio.h"
+#include "strv.h"
 
 Condition* condition_new(ConditionType type, const char *parameter, bool trigger, bool negate) {
         Condition *c;
@@ -76,52 +77,109 @@ void condition_free_list(Condition *first) {
                 condition_free(c);
 }
 
-static bool test_kernel_command_line(const char *parameter) {
-        char *line, *w, *state, *word = NULL;
-        bool equal;
+/* Facts about the system that do not change while units are started,
+ * looked up once for all of them and forgotten on reload. Paths may
+ * change anytime, hence are not among them. */
+static char **cached_cmdline = NULL;
+static bool cached_cmdline_valid = false;
+
+static unsigned long long cached_capabilities = 0;
+static bool cached_capabilities_valid = false;
+
+#ifdef HAVE_SELINUX
+static int cached_selinux = -1;
+#endif
+
+void condition_flush_cache(void) {
+        strv_free(cached_cmdline);
+        cached_cmdline = NULL;
+        cached_cmdline_valid = false;
+
+        cached_capabilities_valid = false;
+
+#ifdef HAVE_SELINUX
+        cached_selinux = -1;
+#endif
+}
+
+static char **get_kernel_command_line(void) {
+        _cleanup_free_ char *line = NULL;
+        char *w, *state;
+        size_t l;
         int r;
-        size_t l, pl;
-        bool found = false;
 
-        assert(parameter);
+        if (cached_cmdline_valid)
+                return cached_cmdline;
 
-        if (detect_container(NULL) > 0)
-                return false;
+        /* Containers get the command line of the host, which is not
+         * meant for them */
+        if (detect_virtualization(NULL) == VIRTUALIZATION_CONTAINER) {
+                cached_cmdline_valid = true;
+                return NULL;
+        }
 
         r = read_one_line_file("/proc/cmdline", &line);
         if (r < 0) {
                 log_warning("Failed to read /proc/cmdline, ignoring: %s", strerror(-r));
-                return false;
+                cached_cmdline_valid = true;
+                return NULL;
         }
 
-        equal = !!strchr(parameter, '=');
-        pl = strlen(parameter);
-
         FOREACH_WORD_QUOTED(w, l, line, state) {
+                char *word;
 
-                free(word);
                 word = strndup(w, l);
                 if (!word)
-                        break;
+                        goto fail;
 
-                if (equal) {
-                        if (streq(word, parameter)) {
-                                found = true;
-                                break;
-                        }
-                } else {
-                        if (startswith(word, parameter) && (word[pl] == '=' || word[pl] == 0)) {
-                                found = true;
-                                break;
-                        }
+                if (strv_push(&cached_cmdline, word) < 0) {
+                        free(word);
+                        goto fail;
                 }
+        }
 
+        /* An empty command line is no reason to read it again */
+        if (!cached_cmdline) {
+                cached_cmdline = new0(char*, 1);
+                if (!cached_cmdline)
+                        return NULL;
         }
 
-        free(word);
-        free(line);
+        cached_cmdline_valid = true;
+        return cached_cmdline;
+
+fail:
+        strv_free(cached_cmdline);
+        cached_cmdline = NULL;
+        return NULL;
+}
+
+static bool test_kernel_command_line(const char *parameter) {
+        char **words, **word;
+        bool equal;
+        size_t pl;
+
+        assert(parameter);
+
+        words = get_kernel_command_line();
+        if (!words)
+                return false;
 
-        return found;
+        equal = !!strchr(parameter, '=');
+        pl = strlen(parameter);
+
+        STRV_FOREACH(word, words) {
+
+                if (equal) {
+                        if (streq(*word, parameter))
+                                return true;
+                } else {
+                        if (startswith(*word, parameter) && ((*word)[pl] == '=' || (*word)[pl] == 0))
+                                return true;
+                }
+        }
+
+        return false;
 }
 
 static bool test_virtualization(const char *parameter) {
@@ -159,29 +217,30 @@ static bool test_virtualization(const char *parameter) {
 
 static bool test_security(const char *parameter) {
 #ifdef HAVE_SELINUX
-        if (streq(parameter, "selinux"))
-                return is_selinux_enabled() > 0;
+        if (streq(parameter, "selinux")) {
+                if (cached_selinux < 0)
+                        cached_selinux = is_selinux_enabled() > 0;
+
+                return cached_selinux;
+        }
 #endif
         return false;
 }
 
-static bool test_capability(const char *parameter) {
-        cap_value_t value;
+static unsigned long long get_capability_bounding_set(void) {
         FILE *f;
         char line[LINE_MAX];
         unsigned long long capabilities = (unsigned long long) -1;
 
-        /* If it's an invalid capability, we don't have it */
-
-        if (cap_from_name(parameter, &value) < 0)
-                return false;
+        if (cached_capabilities_valid)
+                return cached_capabilities;
 
-        /* If it's a valid capability we default to assume
-         * that we have it */
+        /* If we cannot find out, we default to assume that we have
+         * them all */
 
         f = fopen("/proc/self/status", "re");
         if (!f)
-                return true;
+                return capabilities;
 
         while (fgets(line, sizeof(line), f)) {
                 truncate_nl(line);
@@ -194,7 +253,21 @@ static bool test_capability(const char *parameter) {
 
         fclose(f);
 
-        return !!(capabilities & (1ULL << value));
+        cached_capabilities = capabilities;
+        cached_capabilities_valid = true;
+
+        return capabilities;
+}
+
+static bool test_capability(const char *parameter) {
+        cap_value_t value;
+
+        /* If it's an invalid capability, we don't have it */
+
+        if (cap_from_name(parameter, &value) < 0)
+                return false;
+
+        return !!(get_capability_bounding_set() & (1ULL << value));
 }
 
 static bool test_host(const char *parameter) {
@@ -63,6 +63,8 @@ void condition_free_list(Condition *c);
 bool condition_test(Condition *c);
 bool condition_test_list(Condition *c);
 
+void condition_flush_cache(void);
+
 void condition_dump(Condition *c, FILE *f, const char *prefix);
 void condition_dump_list(Condition *c, FILE *f, const char *prefix);
 
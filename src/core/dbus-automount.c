@@ -61,15 +61,23 @@ static const BusProperty bus_automount_properties[] = {
         { NULL, }
 };
 
+#define BOUND_PROPERTIES(u)                                                                       \
+        {                                                                                         \
+                { "org.freedesktop.systemd1.Unit",      bus_unit_properties,      u  },           \
+                { "org.freedesktop.systemd1.Automount", bus_automount_properties, AUTOMOUNT(u) }, \
+                { NULL, }                                                                         \
+        }
+
 DBusHandlerResult bus_automount_message_handler(Unit *u, DBusConnection *c, DBusMessage *message) {
-        Automount *am = AUTOMOUNT(u);
-        const BusBoundProperties bps[] = {
-                { "org.freedesktop.systemd1.Unit",      bus_unit_properties,      u  },
-                { "org.freedesktop.systemd1.Automount", bus_automount_properties, am },
-                { NULL, }
-        };
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
 
         SELINUX_UNIT_ACCESS_CHECK(u, c, message, "status");
 
         return bus_default_message_handler(c, message, INTROSPECTION, INTERFACES_LIST, bps);
 }
+
+int bus_automount_append_properties(Unit *u, DBusMessageIter *i, char **properties) {
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
+
+        return bus_append_bound_properties(i, bps, properties);
+}
@@ -54,15 +54,23 @@ static const BusProperty bus_device_properties[] = {
 };
 
 
+#define BOUND_PROPERTIES(u)                                                              \
+        {                                                                                \
+                { "org.freedesktop.systemd1.Unit",   bus_unit_properties,   u },         \
+                { "org.freedesktop.systemd1.Device", bus_device_properties, DEVICE(u) }, \
+                { NULL, }                                                                \
+        }
+
 DBusHandlerResult bus_device_message_handler(Unit *u, DBusConnection *c, DBusMessage *message) {
-        Device *d = DEVICE(u);
-        const BusBoundProperties bps[] = {
-                { "org.freedesktop.systemd1.Unit",   bus_unit_properties,   u },
-                { "org.freedesktop.systemd1.Device", bus_device_properties, d },
-                { NULL, }
-        };
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
 
         SELINUX_UNIT_ACCESS_CHECK(u, c, message, "status");
 
         return bus_default_message_handler(c, message, INTROSPECTION, INTERFACES_LIST, bps);
 }
+
+int bus_device_append_properties(Unit *u, DBusMessageIter *i, char **properties) {
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
+
+        return bus_append_bound_properties(i, bps, properties);
+}
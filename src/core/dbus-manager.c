@@ -21,6 +21,7 @@
 
 #include <errno.h>
 #include <unistd.h>
+#include <fnmatch.h>
 
 #include "dbus.h"
 #include "log.h"
@@ -37,6 +38,8 @@
 #include "dbus-unit.h"
 #include "virt.h"
 #include "env-util.h"
+#include "profile.h"
+#include "memory-usage.h"
 
 #define BUS_MANAGER_INTERFACE_BEGIN                                     \
         " <interface name=\"org.freedesktop.systemd1.Manager\">\n"
@@ -141,6 +144,12 @@
         "  <method name=\"ListUnits\">\n"                               \
         "   <arg name=\"units\" type=\"a(ssssssouso)\" direction=\"out\"/>\n" \
         "  </method>\n"                                                 \
+        "  <method name=\"ListUnitsFiltered\">\n"                       \
+        "   <arg name=\"patterns\" type=\"as\" direction=\"in\"/>\n"      \
+        "   <arg name=\"states\" type=\"as\" direction=\"in\"/>\n"        \
+        "   <arg name=\"properties\" type=\"as\" direction=\"in\"/>\n"    \
+        "   <arg name=\"units\" type=\"a(sa{sv})\" direction=\"out\"/>\n"  \
+        "  </method>\n"                                                 \
         "  <method name=\"ListJobs\">\n"                                \
         "   <arg name=\"jobs\" type=\"a(usssoo)\" direction=\"out\"/>\n" \
         "  </method>\n"                                                 \
@@ -149,6 +158,16 @@
         "  <method name=\"Dump\">\n"                                    \
         "   <arg name=\"dump\" type=\"s\" direction=\"out\"/>\n"        \
         "  </method>\n"                                                 \
+        "  <method name=\"GetProfile\">\n"                              \
+        "   <arg name=\"profile\" type=\"a(sttt)\" direction=\"out\"/>\n" \
+        "  </method>\n"                                                 \
+        "  <method name=\"GetMemoryUsage\">\n"                          \
+        "   <arg name=\"usage\" type=\"a(stt)\" direction=\"out\"/>\n"  \
+        "  </method>\n"                                                 \
+        "  <method name=\"GetResourceSamples\">\n"                      \
+        "   <arg name=\"patterns\" type=\"as\" direction=\"in\"/>\n"      \
+        "   <arg name=\"samples\" type=\"a(sa(tttttt))\" direction=\"out\"/>\n" \
+        "  </method>\n"                                                 \
         "  <method name=\"CreateSnapshot\">\n"                          \
         "   <arg name=\"name\" type=\"s\" direction=\"in\"/>\n"         \
         "   <arg name=\"cleanup\" type=\"b\" direction=\"in\"/>\n"      \
@@ -292,7 +311,10 @@
         "  <property name=\"DefaultStandardError\" type=\"s\" access=\"read\"/>\n" \
         "  <property name=\"RuntimeWatchdogUSec\" type=\"t\" access=\"readwrite\"/>\n" \
         "  <property name=\"ShutdownWatchdogUSec\" type=\"t\" access=\"readwrite\"/>\n" \
-        "  <property name=\"Virtualization\" type=\"s\" access=\"read\"/>\n"
+        "  <property name=\"Virtualization\" type=\"s\" access=\"read\"/>\n" \
+        "  <property name=\"GeneratorTimeoutUSec\" type=\"t\" access=\"read\"/>\n" \
+        "  <property name=\"GeneratorTimings\" type=\"a(sts)\" access=\"read\"/>\n" \
+        "  <property name=\"ResourceSamplingUSec\" type=\"t\" access=\"read\"/>\n"
 
 #define BUS_MANAGER_INTERFACE_END                                       \
         " </interface>\n"
@@ -479,6 +501,44 @@ static int bus_manager_append_virt(DBusMessageIter *i, const char *property, voi
         return 0;
 }
 
+static int bus_manager_append_generator_timings(DBusMessageIter *i, const char *property, void *data) {
+        Manager *m = data;
+        DBusMessageIter sub, sub2;
+        unsigned k;
+
+        assert(i);
+        assert(property);
+        assert(m);
+
+        if (!dbus_message_iter_open_container(i, DBUS_TYPE_ARRAY, "(sts)", &sub))
+                return -ENOMEM;
+
+        for (k = 0; k < m->n_generator_timings; k++) {
+                ExecuteTiming *t = m->generator_timings + k;
+                const char *result;
+                uint64_t u = t->usec;
+
+                if (t->timed_out)
+                        result = "timeout";
+                else if (t->code == CLD_EXITED)
+                        result = t->status == 0 ? "success" : "exit-code";
+                else
+                        result = "signal";
+
+                if (!dbus_message_iter_open_container(&sub, DBUS_TYPE_STRUCT, NULL, &sub2) ||
+                    !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &t->name) ||
+                    !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_UINT64, &u) ||
+                    !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &result) ||
+                    !dbus_message_iter_close_container(&sub, &sub2))
+                        return -ENOMEM;
+        }
+
+        if (!dbus_message_iter_close_container(i, &sub))
+                return -ENOMEM;
+
+        return 0;
+}
+
 static DBusMessage *message_from_file_changes(
                 DBusMessage *m,
                 UnitFileChange *changes,
@@ -598,6 +658,9 @@ static const BusProperty bus_manager_properties[] = {
         { "RuntimeWatchdogUSec",         bus_property_append_usec,       "t",  offsetof(Manager, runtime_watchdog),             false, bus_manager_set_runtime_watchdog_usec },
         { "ShutdownWatchdogUSec",        bus_property_append_usec,       "t",  offsetof(Manager, shutdown_watchdog),            false, bus_property_set_usec },
         { "Virtualization",              bus_manager_append_virt,        "s",  0,                                               },
+        { "GeneratorTimeoutUSec",        bus_property_append_usec,       "t",  offsetof(Manager, generator_timeout_usec)        },
+        { "GeneratorTimings",            bus_manager_append_generator_timings, "a(sts)", 0                                      },
+        { "ResourceSamplingUSec",        bus_property_append_usec,       "t",  offsetof(Manager, resource_sampling_usec)        },
         { NULL, }
 };
 
@@ -1104,6 +1167,81 @@ static DBusHandlerResult bus_manager_message_handler(DBusConnection *connection,
                 if (!dbus_message_iter_close_container(&iter, &sub))
                         goto oom;
 
+        } else if (dbus_message_is_method_call(message, "org.freedesktop.systemd1.Manager", "ListUnitsFiltered")) {
+                _cleanup_strv_free_ char **patterns = NULL, **states = NULL, **properties = NULL;
+                DBusMessageIter iter, sub;
+                Iterator i;
+                Unit *u;
+                const char *k;
+
+                SELINUX_ACCESS_CHECK(connection, message, "status");
+
+                if (!dbus_message_iter_init(message, &iter) ||
+                    bus_parse_strv_iter(&iter, &patterns) < 0 ||
+                    !dbus_message_iter_next(&iter) ||
+                    bus_parse_strv_iter(&iter, &states) < 0 ||
+                    !dbus_message_iter_next(&iter) ||
+                    bus_parse_strv_iter(&iter, &properties) < 0 ||
+                    dbus_message_iter_next(&iter))
+                        return bus_send_error_reply(connection, message, NULL, -EINVAL);
+
+                reply = dbus_message_new_method_return(message);
+                if (!reply)
+                        goto oom;
+
+                dbus_message_iter_init_append(reply, &iter);
+
+                if (!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "(sa{sv})", &sub))
+                        goto oom;
+
+                HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                        DBusMessageIter sub2, sub3;
+                        char **p;
+
+                        if (k != u->id)
+                                continue;
+
+                        if (!strv_isempty(patterns)) {
+                                bool found = false;
+
+                                STRV_FOREACH(p, patterns)
+                                        if (fnmatch(*p, u->id, FNM_NOESCAPE) == 0) {
+                                                found = true;
+                                                break;
+                                        }
+
+                                if (!found)
+                                        continue;
+                        }
+
+                        if (!strv_isempty(states) &&
+                            !strv_contains(states, unit_load_state_to_string(u->load_state)) &&
+                            !strv_contains(states, unit_active_state_to_string(unit_active_state(u))) &&
+                            !strv_contains(states, unit_sub_state_to_string(u)))
+                                continue;
+
+                        if (!UNIT_VTABLE(u)->bus_append_properties)
+                                continue;
+
+                        if (!dbus_message_iter_open_container(&sub, DBUS_TYPE_STRUCT, NULL, &sub2) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &u->id) ||
+                            !dbus_message_iter_open_container(&sub2, DBUS_TYPE_ARRAY, "{sv}", &sub3))
+                                goto oom;
+
+                        r = UNIT_VTABLE(u)->bus_append_properties(u, &sub3, properties);
+                        if (r == -ENOMEM)
+                                goto oom;
+                        if (r < 0)
+                                return bus_send_error_reply(connection, message, NULL, r);
+
+                        if (!dbus_message_iter_close_container(&sub2, &sub3) ||
+                            !dbus_message_iter_close_container(&sub, &sub2))
+                                goto oom;
+                }
+
+                if (!dbus_message_iter_close_container(&iter, &sub))
+                        goto oom;
+
         } else if (dbus_message_is_method_call(message, "org.freedesktop.systemd1.Manager", "ListJobs")) {
                 DBusMessageIter iter, sub;
                 Iterator i;
@@ -1245,6 +1383,167 @@ static DBusHandlerResult bus_manager_message_handler(DBusConnection *connection,
                 }
 
                 free(dump);
+        } else if (dbus_message_is_method_call(message, "org.freedesktop.systemd1.Manager", "GetProfile")) {
+                DBusMessageIter iter, sub;
+                ProfilePoint p;
+
+                SELINUX_ACCESS_CHECK(connection, message, "status");
+
+                reply = dbus_message_new_method_return(message);
+                if (!reply)
+                        goto oom;
+
+                dbus_message_iter_init_append(reply, &iter);
+
+                if (!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "(sttt)", &sub))
+                        goto oom;
+
+                for (p = 0; p < _PROFILE_POINT_MAX; p++) {
+                        const char *name;
+                        DBusMessageIter sub2;
+
+                        name = profile_point_to_string(p);
+
+                        if (!dbus_message_iter_open_container(&sub, DBUS_TYPE_STRUCT, NULL, &sub2) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &name) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_UINT64, &profile_counters[p].n) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_UINT64, &profile_counters[p].total) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_UINT64, &profile_counters[p].max) ||
+                            !dbus_message_iter_close_container(&sub, &sub2))
+                                goto oom;
+                }
+
+                if (!dbus_message_iter_close_container(&iter, &sub))
+                        goto oom;
+
+        } else if (dbus_message_is_method_call(message, "org.freedesktop.systemd1.Manager", "GetMemoryUsage")) {
+                DBusMessageIter iter, sub;
+                MemoryUsage usage;
+                UnitType t;
+                MemoryCategory c;
+
+                SELINUX_ACCESS_CHECK(connection, message, "status");
+
+                manager_get_memory_usage(m, &usage);
+
+                reply = dbus_message_new_method_return(message);
+                if (!reply)
+                        goto oom;
+
+                dbus_message_iter_init_append(reply, &iter);
+
+                if (!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "(stt)", &sub))
+                        goto oom;
+
+                for (t = 0; t < _UNIT_TYPE_MAX; t++) {
+                        char name[sizeof("unit/") + 16];
+                        const char *p = name;
+                        DBusMessageIter sub2;
+
+                        snprintf(name, sizeof(name), "unit/%s", unit_type_to_string(t));
+
+                        if (!dbus_message_iter_open_container(&sub, DBUS_TYPE_STRUCT, NULL, &sub2) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &p) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_UINT64, &usage.units[t].n) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_UINT64, &usage.units[t].size) ||
+                            !dbus_message_iter_close_container(&sub, &sub2))
+                                goto oom;
+                }
+
+                for (c = 0; c < _MEMORY_CATEGORY_MAX; c++) {
+                        const char *name;
+                        DBusMessageIter sub2;
+
+                        name = memory_category_to_string(c);
+
+                        if (!dbus_message_iter_open_container(&sub, DBUS_TYPE_STRUCT, NULL, &sub2) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &name) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_UINT64, &usage.categories[c].n) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_UINT64, &usage.categories[c].size) ||
+                            !dbus_message_iter_close_container(&sub, &sub2))
+                                goto oom;
+                }
+
+                if (!dbus_message_iter_close_container(&iter, &sub))
+                        goto oom;
+
+        } else if (dbus_message_is_method_call(message, "org.freedesktop.systemd1.Manager", "GetResourceSamples")) {
+                _cleanup_strv_free_ char **patterns = NULL;
+                DBusMessageIter iter, sub;
+                Iterator i;
+                Unit *u;
+                const char *k;
+
+                SELINUX_ACCESS_CHECK(connection, message, "status");
+
+                if (!dbus_message_iter_init(message, &iter) ||
+                    bus_parse_strv_iter(&iter, &patterns) < 0 ||
+                    dbus_message_iter_next(&iter))
+                        return bus_send_error_reply(connection, message, NULL, -EINVAL);
+
+                reply = dbus_message_new_method_return(message);
+                if (!reply)
+                        goto oom;
+
+                dbus_message_iter_init_append(reply, &iter);
+
+                if (!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "(sa(tttttt))", &sub))
+                        goto oom;
+
+                HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                        DBusMessageIter sub2, sub3;
+                        unsigned j;
+                        char **p;
+
+                        if (k != u->id)
+                                continue;
+
+                        if (!u->cgroup_sampler || u->cgroup_sampler->n_samples <= 0)
+                                continue;
+
+                        if (!strv_isempty(patterns)) {
+                                bool found = false;
+
+                                STRV_FOREACH(p, patterns)
+                                        if (fnmatch(*p, u->id, FNM_NOESCAPE) == 0) {
+                                                found = true;
+                                                break;
+                                        }
+
+                                if (!found)
+                                        continue;
+                        }
+
+                        if (!dbus_message_iter_open_container(&sub, DBUS_TYPE_STRUCT, NULL, &sub2) ||
+                            !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &u->id) ||
+                            !dbus_message_iter_open_container(&sub2, DBUS_TYPE_ARRAY, "(tttttt)", &sub3))
+                                goto oom;
+
+                        for (j = 0; j < u->cgroup_sampler->n_samples; j++) {
+                                const CGroupSample *c;
+                                DBusMessageIter sub4;
+
+                                c = cgroup_sampler_get(u->cgroup_sampler, j);
+
+                                if (!dbus_message_iter_open_container(&sub3, DBUS_TYPE_STRUCT, NULL, &sub4) ||
+                                    !dbus_message_iter_append_basic(&sub4, DBUS_TYPE_UINT64, &c->timestamp.realtime) ||
+                                    !dbus_message_iter_append_basic(&sub4, DBUS_TYPE_UINT64, &c->timestamp.monotonic) ||
+                                    !dbus_message_iter_append_basic(&sub4, DBUS_TYPE_UINT64, &c->cpu_nsec) ||
+                                    !dbus_message_iter_append_basic(&sub4, DBUS_TYPE_UINT64, &c->memory_bytes) ||
+                                    !dbus_message_iter_append_basic(&sub4, DBUS_TYPE_UINT64, &c->io_read_bytes) ||
+                                    !dbus_message_iter_append_basic(&sub4, DBUS_TYPE_UINT64, &c->io_write_bytes) ||
+                                    !dbus_message_iter_close_container(&sub3, &sub4))
+                                        goto oom;
+                        }
+
+                        if (!dbus_message_iter_close_container(&sub2, &sub3) ||
+                            !dbus_message_iter_close_container(&sub, &sub2))
+                                goto oom;
+                }
+
+                if (!dbus_message_iter_close_container(&iter, &sub))
+                        goto oom;
+
         } else if (dbus_message_is_method_call(message, "org.freedesktop.systemd1.Manager", "CreateSnapshot")) {
                 const char *name;
                 dbus_bool_t cleanup;
@@ -152,19 +152,26 @@ static const BusProperty bus_mount_properties[] = {
         { NULL, }
 };
 
-DBusHandlerResult bus_mount_message_handler(Unit *u, DBusConnection *c, DBusMessage *message) {
-        Mount *m = MOUNT(u);
+#define BOUND_PROPERTIES(u)                                                                                 \
+        {                                                                                                   \
+                { "org.freedesktop.systemd1.Unit",  bus_unit_properties,         u },                       \
+                { "org.freedesktop.systemd1.Mount", bus_mount_properties,        MOUNT(u) },                \
+                { "org.freedesktop.systemd1.Mount", bus_exec_context_properties, &MOUNT(u)->exec_context }, \
+                { "org.freedesktop.systemd1.Mount", bus_kill_context_properties, &MOUNT(u)->kill_context }, \
+                { "org.freedesktop.systemd1.Mount", bus_unit_cgroup_properties,  u },                       \
+                { NULL, }                                                                                   \
+        }
 
-        const BusBoundProperties bps[] = {
-                { "org.freedesktop.systemd1.Unit",  bus_unit_properties,         u },
-                { "org.freedesktop.systemd1.Mount", bus_mount_properties,        m },
-                { "org.freedesktop.systemd1.Mount", bus_exec_context_properties, &m->exec_context },
-                { "org.freedesktop.systemd1.Mount", bus_kill_context_properties, &m->kill_context },
-                { "org.freedesktop.systemd1.Mount", bus_unit_cgroup_properties,  u },
-                { NULL, }
-        };
+DBusHandlerResult bus_mount_message_handler(Unit *u, DBusConnection *c, DBusMessage *message) {
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
 
         SELINUX_UNIT_ACCESS_CHECK(u, c, message, "status");
 
         return bus_default_message_handler(c, message, INTROSPECTION, INTERFACES_LIST, bps );
 }
+
+int bus_mount_append_properties(Unit *u, DBusMessageIter *i, char **properties) {
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
+
+        return bus_append_bound_properties(i, bps, properties);
+}
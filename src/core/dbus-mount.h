@@ -26,6 +26,7 @@
 #include "unit.h"
 
 DBusHandlerResult bus_mount_message_handler(Unit *u, DBusConnection *c, DBusMessage *message);
+int bus_mount_append_properties(Unit *u, DBusMessageIter *i, char **properties);
 
 extern const char bus_mount_interface[];
 extern const char bus_mount_invalidating_properties[];
@@ -108,15 +108,23 @@ static const BusProperty bus_path_properties[] = {
         { NULL, }
 };
 
+#define BOUND_PROPERTIES(u)                                                        \
+        {                                                                          \
+                { "org.freedesktop.systemd1.Unit", bus_unit_properties, u },       \
+                { "org.freedesktop.systemd1.Path", bus_path_properties, PATH(u) }, \
+                { NULL, }                                                          \
+        }
+
 DBusHandlerResult bus_path_message_handler(Unit *u, DBusConnection *c, DBusMessage *message) {
-        Path *p = PATH(u);
-        const BusBoundProperties bps[] = {
-                { "org.freedesktop.systemd1.Unit", bus_unit_properties, u },
-                { "org.freedesktop.systemd1.Path", bus_path_properties, p },
-                { NULL, }
-        };
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
 
         SELINUX_UNIT_ACCESS_CHECK(u, c, message, "status");
 
         return bus_default_message_handler(c, message, INTROSPECTION, INTERFACES_LIST, bps);
 }
+
+int bus_path_append_properties(Unit *u, DBusMessageIter *i, char **properties) {
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
+
+        return bus_append_bound_properties(i, bps, properties);
+}
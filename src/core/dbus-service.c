@@ -144,20 +144,27 @@ static const BusProperty bus_service_properties[] = {
         { NULL, }
 };
 
+#define BOUND_PROPERTIES(u)                                                                                             \
+        {                                                                                                               \
+                { "org.freedesktop.systemd1.Unit",    bus_unit_properties,             u },                             \
+                { "org.freedesktop.systemd1.Service", bus_service_properties,          SERVICE(u) },                    \
+                { "org.freedesktop.systemd1.Service", bus_exec_context_properties,     &SERVICE(u)->exec_context },     \
+                { "org.freedesktop.systemd1.Service", bus_kill_context_properties,     &SERVICE(u)->kill_context },     \
+                { "org.freedesktop.systemd1.Service", bus_exec_main_status_properties, &SERVICE(u)->main_exec_status }, \
+                { "org.freedesktop.systemd1.Service", bus_unit_cgroup_properties,      u },                             \
+                { NULL, }                                                                                               \
+        }
+
 DBusHandlerResult bus_service_message_handler(Unit *u, DBusConnection *connection, DBusMessage *message) {
-        Service *s = SERVICE(u);
-
-        const BusBoundProperties bps[] = {
-                { "org.freedesktop.systemd1.Unit",    bus_unit_properties,             u },
-                { "org.freedesktop.systemd1.Service", bus_service_properties,          s },
-                { "org.freedesktop.systemd1.Service", bus_exec_context_properties,     &s->exec_context },
-                { "org.freedesktop.systemd1.Service", bus_kill_context_properties,     &s->kill_context },
-                { "org.freedesktop.systemd1.Service", bus_exec_main_status_properties, &s->main_exec_status },
-                { "org.freedesktop.systemd1.Service", bus_unit_cgroup_properties,      u },
-                { NULL, }
-        };
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
 
         SELINUX_UNIT_ACCESS_CHECK(u, connection, message, "status");
 
         return bus_default_message_handler(connection, message, INTROSPECTION, INTERFACES_LIST, bps);
 }
+
+int bus_service_append_properties(Unit *u, DBusMessageIter *i, char **properties) {
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
+
+        return bus_append_bound_properties(i, bps, properties);
+}
@@ -26,6 +26,7 @@
 #include "unit.h"
 
 DBusHandlerResult bus_service_message_handler(Unit *u, DBusConnection *c, DBusMessage *message);
+int bus_service_append_properties(Unit *u, DBusMessageIter *i, char **properties);
 
 extern const char bus_service_interface[];
 extern const char bus_service_invalidating_properties[];
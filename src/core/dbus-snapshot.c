@@ -51,8 +51,14 @@ static const BusProperty bus_snapshot_properties[] = {
         { NULL, }
 };
 
+#define BOUND_PROPERTIES(u)                                                                    \
+        {                                                                                      \
+                { "org.freedesktop.systemd1.Unit",     bus_unit_properties,     u },           \
+                { "org.freedesktop.systemd1.Snapshot", bus_snapshot_properties, SNAPSHOT(u) }, \
+                { NULL, }                                                                      \
+        }
+
 DBusHandlerResult bus_snapshot_message_handler(Unit *u, DBusConnection *c, DBusMessage *message) {
-        Snapshot *s = SNAPSHOT(u);
         _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
 
         if (dbus_message_is_method_call(message, "org.freedesktop.systemd1.Snapshot", "Remove")) {
@@ -66,11 +72,7 @@ DBusHandlerResult bus_snapshot_message_handler(Unit *u, DBusConnection *c, DBusM
                 snapshot_remove(SNAPSHOT(u));
 
         } else {
-                const BusBoundProperties bps[] = {
-                        { "org.freedesktop.systemd1.Unit",     bus_unit_properties,     u },
-                        { "org.freedesktop.systemd1.Snapshot", bus_snapshot_properties, s },
-                        { NULL, }
-                };
+                const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
 
                 SELINUX_UNIT_ACCESS_CHECK(u, c, message, "status");
 
@@ -82,3 +84,9 @@ DBusHandlerResult bus_snapshot_message_handler(Unit *u, DBusConnection *c, DBusM
 
         return DBUS_HANDLER_RESULT_HANDLED;
 }
+
+int bus_snapshot_append_properties(Unit *u, DBusMessageIter *i, char **properties) {
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
+
+        return bus_append_bound_properties(i, bps, properties);
+}
@@ -54,6 +54,8 @@
         "  <property name=\"PipeSize\" type=\"t\" access=\"read\"/>\n"  \
         "  <property name=\"FreeBind\" type=\"b\" access=\"read\"/>\n"  \
         "  <property name=\"Transparent\" type=\"b\" access=\"read\"/>\n" \
+        "  <property name=\"ReusePort\" type=\"b\" access=\"read\"/>\n" \
+        "  <property name=\"Listeners\" type=\"u\" access=\"read\"/>\n" \
         "  <property name=\"Broadcast\" type=\"b\" access=\"read\"/>\n" \
         "  <property name=\"PassCredentials\" type=\"b\" access=\"read\"/>\n" \
         "  <property name=\"PassSecurity\" type=\"b\" access=\"read\"/>\n" \
@@ -61,6 +63,9 @@
         "  <property name=\"MaxConnections\" type=\"u\" access=\"read\"/>\n" \
         "  <property name=\"NAccepted\" type=\"u\" access=\"read\"/>\n" \
         "  <property name=\"NConnections\" type=\"u\" access=\"read\"/>\n" \
+        "  <property name=\"AcceptRate\" type=\"u\" access=\"read\"/>\n" \
+        "  <property name=\"AcceptQueueLength\" type=\"u\" access=\"read\"/>\n" \
+        "  <property name=\"SpawnLatencyUSec\" type=\"t\" access=\"read\"/>\n" \
         "  <property name=\"MessageQueueMaxMessages\" type=\"x\" access=\"read\"/>\n" \
         "  <property name=\"MessageQueueMessageSize\" type=\"x\" access=\"read\"/>\n" \
         "  <property name=\"Listen\" type=\"a(ss)\" access=\"read\"/>\n"    \
@@ -94,6 +99,9 @@ const char bus_socket_invalidating_properties[] =
         "ControlPID\0"
         "NAccepted\0"
         "NConnections\0"
+        "AcceptRate\0"
+        "AcceptQueueLength\0"
+        "SpawnLatencyUSec\0"
         "Result\0";
 
 static DEFINE_BUS_PROPERTY_APPEND_ENUM(bus_socket_append_bind_ipv6_only, socket_address_bind_ipv6_only, SocketAddressBindIPv6Only);
@@ -159,6 +167,38 @@ static int bus_socket_append_listen(DBusMessageIter *i, const char *property, vo
         return 0;
 }
 
+static int bus_socket_append_accept_rate(DBusMessageIter *i, const char *property, void *data) {
+        Socket *s = SOCKET(data);
+        uint32_t u;
+
+        assert(i);
+        assert(property);
+        assert(s);
+
+        u = socket_accept_rate(s);
+
+        if (!dbus_message_iter_append_basic(i, DBUS_TYPE_UINT32, &u))
+                return -ENOMEM;
+
+        return 0;
+}
+
+static int bus_socket_append_accept_queue_length(DBusMessageIter *i, const char *property, void *data) {
+        Socket *s = SOCKET(data);
+        uint32_t u;
+
+        assert(i);
+        assert(property);
+        assert(s);
+
+        u = socket_accept_queue_length(s);
+
+        if (!dbus_message_iter_append_basic(i, DBUS_TYPE_UINT32, &u))
+                return -ENOMEM;
+
+        return 0;
+}
+
 static const BusProperty bus_socket_properties[] = {
         { "BindIPv6Only",   bus_socket_append_bind_ipv6_only,  "s", offsetof(Socket, bind_ipv6_only)  },
         { "Backlog",        bus_property_append_unsigned,      "u", offsetof(Socket, backlog)         },
@@ -181,6 +221,8 @@ static const BusProperty bus_socket_properties[] = {
         { "PipeSize",       bus_property_append_size,          "t", offsetof(Socket, pipe_size)       },
         { "FreeBind",       bus_property_append_bool,          "b", offsetof(Socket, free_bind)       },
         { "Transparent",    bus_property_append_bool,          "b", offsetof(Socket, transparent)     },
+        { "ReusePort",      bus_property_append_bool,          "b", offsetof(Socket, reuse_port)      },
+        { "Listeners",      bus_property_append_unsigned,      "u", offsetof(Socket, n_listeners)     },
         { "Broadcast",      bus_property_append_bool,          "b", offsetof(Socket, broadcast)       },
         { "PassCredentials",bus_property_append_bool,          "b", offsetof(Socket, pass_cred)       },
         { "PassSecurity",   bus_property_append_bool,          "b", offsetof(Socket, pass_sec)        },
@@ -189,6 +231,9 @@ static const BusProperty bus_socket_properties[] = {
         { "MaxConnections", bus_property_append_unsigned,      "u", offsetof(Socket, max_connections) },
         { "NConnections",   bus_property_append_unsigned,      "u", offsetof(Socket, n_connections)   },
         { "NAccepted",      bus_property_append_unsigned,      "u", offsetof(Socket, n_accepted)      },
+        { "AcceptRate",     bus_socket_append_accept_rate,     "u", 0                                 },
+        { "AcceptQueueLength", bus_socket_append_accept_queue_length, "u", 0                          },
+        { "SpawnLatencyUSec", bus_property_append_usec,        "t", offsetof(Socket, spawn_latency_usec) },
         { "MessageQueueMaxMessages", bus_property_append_long, "x", offsetof(Socket, mq_maxmsg)       },
         { "MessageQueueMessageSize", bus_property_append_long, "x", offsetof(Socket, mq_msgsize)      },
         { "Result",         bus_socket_append_socket_result,   "s", offsetof(Socket, result)          },
@@ -198,18 +243,26 @@ static const BusProperty bus_socket_properties[] = {
         { NULL, }
 };
 
+#define BOUND_PROPERTIES(u)                                                                                   \
+        {                                                                                                     \
+                { "org.freedesktop.systemd1.Unit",   bus_unit_properties,         u },                        \
+                { "org.freedesktop.systemd1.Socket", bus_socket_properties,       SOCKET(u) },                \
+                { "org.freedesktop.systemd1.Socket", bus_exec_context_properties, &SOCKET(u)->exec_context }, \
+                { "org.freedesktop.systemd1.Socket", bus_kill_context_properties, &SOCKET(u)->kill_context }, \
+                { "org.freedesktop.systemd1.Socket", bus_unit_properties,         u },                        \
+                { NULL, }                                                                                     \
+        }
+
 DBusHandlerResult bus_socket_message_handler(Unit *u, DBusConnection *c, DBusMessage *message) {
-        Socket *s = SOCKET(u);
-        const BusBoundProperties bps[] = {
-                { "org.freedesktop.systemd1.Unit",   bus_unit_properties,         u },
-                { "org.freedesktop.systemd1.Socket", bus_socket_properties,       s },
-                { "org.freedesktop.systemd1.Socket", bus_exec_context_properties, &s->exec_context },
-                { "org.freedesktop.systemd1.Socket", bus_kill_context_properties, &s->kill_context },
-                { "org.freedesktop.systemd1.Socket", bus_unit_properties,         u },
-                { NULL, }
-        };
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
 
         SELINUX_UNIT_ACCESS_CHECK(u, c, message, "status");
 
         return bus_default_message_handler(c, message, INTROSPECTION, INTERFACES_LIST, bps);
 }
+
+int bus_socket_append_properties(Unit *u, DBusMessageIter *i, char **properties) {
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
+
+        return bus_append_bound_properties(i, bps, properties);
+}
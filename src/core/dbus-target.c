@@ -46,13 +46,22 @@
 
 const char bus_target_interface[] _introspect_("Target") = BUS_TARGET_INTERFACE;
 
+#define BOUND_PROPERTIES(u)                                                  \
+        {                                                                    \
+                { "org.freedesktop.systemd1.Unit", bus_unit_properties, u }, \
+                { NULL, }                                                    \
+        }
+
 DBusHandlerResult bus_target_message_handler(Unit *u, DBusConnection *c, DBusMessage *message) {
-        const BusBoundProperties bps[] = {
-                { "org.freedesktop.systemd1.Unit", bus_unit_properties, u },
-                { NULL, }
-        };
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
 
         SELINUX_UNIT_ACCESS_CHECK(u, c, message, "status");
 
         return bus_default_message_handler(c, message, INTROSPECTION, INTERFACES_LIST, bps);
 }
+
+int bus_target_append_properties(Unit *u, DBusMessageIter *i, char **properties) {
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
+
+        return bus_append_bound_properties(i, bps, properties);
+}
@@ -35,6 +35,7 @@
         "  <property name=\"NextElapseUSecRealtime\" type=\"t\" access=\"read\"/>\n" \
         "  <property name=\"NextElapseUSecMonotonic\" type=\"t\" access=\"read\"/>\n" \
         "  <property name=\"Result\" type=\"s\" access=\"read\"/>\n"    \
+        "  <property name=\"AccuracyUSec\" type=\"t\" access=\"read\"/>\n" \
         " </interface>\n"
 
 #define INTROSPECTION                                                   \
@@ -174,18 +175,27 @@ static const BusProperty bus_timer_properties[] = {
         { "NextElapseUSecMonotonic", bus_property_append_usec,          "t",      offsetof(Timer, next_elapse_monotonic) },
         { "NextElapseUSecRealtime",  bus_property_append_usec,          "t",      offsetof(Timer, next_elapse_realtime) },
         { "Result",                  bus_timer_append_timer_result,     "s",      offsetof(Timer, result) },
+        { "AccuracyUSec",            bus_property_append_usec,          "t",      offsetof(Timer, accuracy_usec) },
         { NULL, }
 };
 
+#define BOUND_PROPERTIES(u)                                                           \
+        {                                                                             \
+                { "org.freedesktop.systemd1.Unit",  bus_unit_properties,  u },        \
+                { "org.freedesktop.systemd1.Timer", bus_timer_properties, TIMER(u) }, \
+                { NULL, }                                                             \
+        }
+
 DBusHandlerResult bus_timer_message_handler(Unit *u, DBusConnection *c, DBusMessage *message) {
-        Timer *t = TIMER(u);
-        const BusBoundProperties bps[] = {
-                { "org.freedesktop.systemd1.Unit",  bus_unit_properties,  u },
-                { "org.freedesktop.systemd1.Timer", bus_timer_properties, t },
-                { NULL, }
-        };
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
 
         SELINUX_UNIT_ACCESS_CHECK(u, c, message, "status");
 
         return bus_default_message_handler(c, message, INTROSPECTION, INTERFACES_LIST, bps);
 }
+
+int bus_timer_append_properties(Unit *u, DBusMessageIter *i, char **properties) {
+        const BusBoundProperties bps[] = BOUND_PROPERTIES(u);
+
+        return bus_append_bound_properties(i, bps, properties);
+}
@@ -26,6 +26,7 @@
 #include "unit.h"
 
 DBusHandlerResult bus_timer_message_handler(Unit *u, DBusConnection *c, DBusMessage *message);
+int bus_timer_append_properties(Unit *u, DBusMessageIter *i, char **properties);
 
 extern const char bus_timer_interface[];
 extern const char bus_timer_invalidating_properties[];
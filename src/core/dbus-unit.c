@@ -82,16 +82,20 @@ static int bus_unit_append_following(DBusMessageIter *i, const char *property, v
 }
 
 static int bus_unit_append_dependencies(DBusMessageIter *i, const char *property, void *data) {
-        Unit *u;
-        Iterator j;
+        Unit *u = data, *other;
+        unsigned j;
         DBusMessageIter sub;
-        Set *s = data;
+        UnitDependency d;
+
+        /* The property names are the names of the dependency types */
+        d = unit_dependency_from_string(property);
+        assert(d >= 0);
 
         if (!dbus_message_iter_open_container(i, DBUS_TYPE_ARRAY, "s", &sub))
                 return -ENOMEM;
 
-        SET_FOREACH(u, s, j)
-                if (!dbus_message_iter_append_basic(&sub, DBUS_TYPE_STRING, &u->id))
+        UNIT_FOREACH_DEPENDENCY(other, u, d, j)
+                if (!dbus_message_iter_append_basic(&sub, DBUS_TYPE_STRING, &other->id))
                         return -ENOMEM;
 
         if (!dbus_message_iter_close_container(i, &sub))
@@ -403,6 +407,120 @@ static int bus_unit_append_load_error(DBusMessageIter *i, const char *property,
         return 0;
 }
 
+static int bus_unit_append_start_timestamps(DBusMessageIter *i, const char *property, void *data) {
+        Unit *u = data;
+        DBusMessageIter sub, sub2;
+        StartTimestamp t;
+
+        assert(i);
+        assert(property);
+        assert(u);
+
+        if (!dbus_message_iter_open_container(i, DBUS_TYPE_ARRAY, "(st)", &sub))
+                return -ENOMEM;
+
+        for (t = 0; u->start_latency && t < _START_TIMESTAMP_MAX; t++) {
+                const char *name;
+                uint64_t usec;
+                bool success;
+
+                usec = u->start_latency->timestamps[t];
+                if (usec <= 0)
+                        continue;
+
+                name = start_timestamp_to_string(t);
+
+                success =
+                        dbus_message_iter_open_container(&sub, DBUS_TYPE_STRUCT, NULL, &sub2) &&
+                        dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &name) &&
+                        dbus_message_iter_append_basic(&sub2, DBUS_TYPE_UINT64, &usec) &&
+                        dbus_message_iter_close_container(&sub, &sub2);
+                if (!success)
+                        return -ENOMEM;
+        }
+
+        if (!dbus_message_iter_close_container(i, &sub))
+                return -ENOMEM;
+
+        return 0;
+}
+
+static int bus_unit_append_start_latency(DBusMessageIter *i, const char *property, void *data) {
+        Unit *u = data;
+        DBusMessageIter sub, sub2;
+        StartPhase p;
+
+        assert(i);
+        assert(property);
+        assert(u);
+
+        if (!dbus_message_iter_open_container(i, DBUS_TYPE_ARRAY, "(st)", &sub))
+                return -ENOMEM;
+
+        for (p = 0; u->start_latency && p < _START_PHASE_MAX; p++) {
+                const char *name;
+                uint64_t usec;
+                bool success;
+
+                if (!start_latency_phase(u->start_latency, p, &usec))
+                        continue;
+
+                name = start_phase_to_string(p);
+
+                success =
+                        dbus_message_iter_open_container(&sub, DBUS_TYPE_STRUCT, NULL, &sub2) &&
+                        dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &name) &&
+                        dbus_message_iter_append_basic(&sub2, DBUS_TYPE_UINT64, &usec) &&
+                        dbus_message_iter_close_container(&sub, &sub2);
+                if (!success)
+                        return -ENOMEM;
+        }
+
+        if (!dbus_message_iter_close_container(i, &sub))
+                return -ENOMEM;
+
+        return 0;
+}
+
+static int bus_unit_append_start_latency_histogram(DBusMessageIter *i, const char *property, void *data) {
+        Unit *u = data;
+        DBusMessageIter sub, sub2, sub3;
+        StartPhase p;
+
+        assert(i);
+        assert(property);
+        assert(u);
+
+        if (!dbus_message_iter_open_container(i, DBUS_TYPE_ARRAY, "(sau)", &sub))
+                return -ENOMEM;
+
+        for (p = 0; u->start_latency && p < _START_PHASE_MAX; p++) {
+                const char *name;
+                const uint32_t *buckets;
+                bool success;
+
+                assert_cc(sizeof(u->start_latency->histogram[p][0]) == sizeof(uint32_t));
+
+                name = start_phase_to_string(p);
+                buckets = u->start_latency->histogram[p];
+
+                success =
+                        dbus_message_iter_open_container(&sub, DBUS_TYPE_STRUCT, NULL, &sub2) &&
+                        dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &name) &&
+                        dbus_message_iter_open_container(&sub2, DBUS_TYPE_ARRAY, "u", &sub3) &&
+                        dbus_message_iter_append_fixed_array(&sub3, DBUS_TYPE_UINT32, &buckets, START_LATENCY_BUCKETS) &&
+                        dbus_message_iter_close_container(&sub2, &sub3) &&
+                        dbus_message_iter_close_container(&sub, &sub2);
+                if (!success)
+                        return -ENOMEM;
+        }
+
+        if (!dbus_message_iter_close_container(i, &sub))
+                return -ENOMEM;
+
+        return 0;
+}
+
 static DBusHandlerResult bus_unit_message_dispatch(Unit *u, DBusConnection *connection, DBusMessage *message) {
         _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
         DBusError error;
@@ -1255,27 +1373,27 @@ const BusProperty bus_unit_properties[] = {
         { "Id",                   bus_property_append_string,         "s", offsetof(Unit, id),                                         true },
         { "Names",                bus_unit_append_names,             "as", 0 },
         { "Following",            bus_unit_append_following,          "s", 0 },
-        { "Requires",             bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_REQUIRES]),                true },
-        { "RequiresOverridable",  bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_REQUIRES_OVERRIDABLE]),    true },
-        { "Requisite",            bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_REQUISITE]),               true },
-        { "RequisiteOverridable", bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_REQUISITE_OVERRIDABLE]),   true },
-        { "Wants",                bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_WANTS]),                   true },
-        { "BindsTo",              bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_BINDS_TO]),                true },
-        { "PartOf",               bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_PART_OF]),                 true },
-        { "RequiredBy",           bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_REQUIRED_BY]),             true },
-        { "RequiredByOverridable",bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_REQUIRED_BY_OVERRIDABLE]), true },
-        { "WantedBy",             bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_WANTED_BY]),               true },
-        { "BoundBy",              bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_BOUND_BY]),                true },
-        { "ConsistsOf",           bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_CONSISTS_OF]),             true },
-        { "Conflicts",            bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_CONFLICTS]),               true },
-        { "ConflictedBy",         bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_CONFLICTED_BY]),           true },
-        { "Before",               bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_BEFORE]),                  true },
-        { "After",                bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_AFTER]),                   true },
-        { "OnFailure",            bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_ON_FAILURE]),              true },
-        { "Triggers",             bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_TRIGGERS]),                true },
-        { "TriggeredBy",          bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_TRIGGERED_BY]),            true },
-        { "PropagatesReloadTo",   bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_PROPAGATES_RELOAD_TO]),    true },
-        { "ReloadPropagatedFrom", bus_unit_append_dependencies,      "as", offsetof(Unit, dependencies[UNIT_RELOAD_PROPAGATED_FROM]),  true },
+        { "Requires",             bus_unit_append_dependencies,      "as", 0 },
+        { "RequiresOverridable",  bus_unit_append_dependencies,      "as", 0 },
+        { "Requisite",            bus_unit_append_dependencies,      "as", 0 },
+        { "RequisiteOverridable", bus_unit_append_dependencies,      "as", 0 },
+        { "Wants",                bus_unit_append_dependencies,      "as", 0 },
+        { "BindsTo",              bus_unit_append_dependencies,      "as", 0 },
+        { "PartOf",               bus_unit_append_dependencies,      "as", 0 },
+        { "RequiredBy",           bus_unit_append_dependencies,      "as", 0 },
+        { "RequiredByOverridable",bus_unit_append_dependencies,      "as", 0 },
+        { "WantedBy",             bus_unit_append_dependencies,      "as", 0 },
+        { "BoundBy",              bus_unit_append_dependencies,      "as", 0 },
+        { "ConsistsOf",           bus_unit_append_dependencies,      "as", 0 },
+        { "Conflicts",            bus_unit_append_dependencies,      "as", 0 },
+        { "ConflictedBy",         bus_unit_append_dependencies,      "as", 0 },
+        { "Before",               bus_unit_append_dependencies,      "as", 0 },
+        { "After",                bus_unit_append_dependencies,      "as", 0 },
+        { "OnFailure",            bus_unit_append_dependencies,      "as", 0 },
+        { "Triggers",             bus_unit_append_dependencies,      "as", 0 },
+        { "TriggeredBy",          bus_unit_append_dependencies,      "as", 0 },
+        { "PropagatesReloadTo",   bus_unit_append_dependencies,      "as", 0 },
+        { "ReloadPropagatedFrom", bus_unit_append_dependencies,      "as", 0 },
         { "RequiresMountsFor",    bus_property_append_strv,          "as", offsetof(Unit, requires_mounts_for),                        true },
         { "Documentation",        bus_property_append_strv,          "as", offsetof(Unit, documentation),                              true },
         { "Description",          bus_unit_append_description,        "s", 0 },
@@ -1313,6 +1431,9 @@ const BusProperty bus_unit_properties[] = {
         { "ConditionTimestampMonotonic", bus_property_append_usec,    "t", offsetof(Unit, condition_timestamp.monotonic)      },
         { "ConditionResult",      bus_property_append_bool,           "b", offsetof(Unit, condition_result)                   },
         { "LoadError",            bus_unit_append_load_error,      "(ss)", 0 },
+        { "StartTimestamps",      bus_unit_append_start_timestamps, "a(st)", 0 },
+        { "StartLatency",         bus_unit_append_start_latency,    "a(st)", 0 },
+        { "StartLatencyHistogram", bus_unit_append_start_latency_histogram, "a(sau)", 0 },
         { NULL, }
 };
 
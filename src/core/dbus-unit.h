@@ -122,6 +122,9 @@
         "  <property name=\"ConditionTimestampMonotonic\" type=\"t\" access=\"read\"/>\n" \
         "  <property name=\"ConditionResult\" type=\"b\" access=\"read\"/>\n" \
         "  <property name=\"LoadError\" type=\"(ss)\" access=\"read\"/>\n" \
+        "  <property name=\"StartTimestamps\" type=\"a(st)\" access=\"read\"/>\n" \
+        "  <property name=\"StartLatency\" type=\"a(st)\" access=\"read\"/>\n" \
+        "  <property name=\"StartLatencyHistogram\" type=\"a(sau)\" access=\"read\"/>\n" \
         " </interface>\n"
 
 #define BUS_UNIT_CGROUP_INTERFACE                                       \
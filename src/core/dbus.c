@@ -20,7 +20,6 @@
 ***/
 
 #include <sys/epoll.h>
-#include <sys/timerfd.h>
 #include <errno.h>
 #include <unistd.h>
 #include <dbus/dbus.h>
@@ -47,9 +46,14 @@
 #include "bus-errors.h"
 #include "special.h"
 #include "dbus-common.h"
+#include "profile.h"
 
 #define CONNECTIONS_MAX 512
 
+/* D-Bus timeouts are for method call replies, which may well be
+ * handled a bit late */
+#define BUS_TIMEOUT_ACCURACY_USEC (250*USEC_PER_MSEC)
+
 /* Well-known address (http://dbus.freedesktop.org/doc/dbus-specification.html#message-bus-types) */
 #define DBUS_SYSTEM_BUS_DEFAULT_ADDRESS "unix:path=/var/run/dbus/system_bus_socket"
 /* Only used as a fallback */
@@ -203,39 +207,43 @@ static void bus_toggle_watch(DBusWatch *bus_watch, void *data) {
 }
 
 static int bus_timeout_arm(Manager *m, Watch *w) {
-        struct itimerspec its = {};
-
         assert(m);
         assert(w);
 
-        if (dbus_timeout_get_enabled(w->data.bus_timeout)) {
-                timespec_store(&its.it_value, dbus_timeout_get_interval(w->data.bus_timeout) * USEC_PER_MSEC);
-                its.it_interval = its.it_value;
+        if (!dbus_timeout_get_enabled(w->data.bus_timeout)) {
+                manager_unwatch_timer(m, w);
+                return 0;
         }
 
-        if (timerfd_settime(w->fd, 0, &its, NULL) < 0)
-                return -errno;
-
-        return 0;
+        return manager_watch_timer(m, w, CLOCK_MONOTONIC, true,
+                                   dbus_timeout_get_interval(w->data.bus_timeout) * USEC_PER_MSEC,
+                                   BUS_TIMEOUT_ACCURACY_USEC);
 }
 
 void bus_timeout_event(Manager *m, Watch *w, int events) {
+        int r;
+
         assert(m);
         assert(w);
 
-        /* This is called by the event loop whenever there is
-         * something happening on D-Bus' file handles. */
+        /* This is called by the event loop whenever a D-Bus
+         * timeout elapsed. */
 
         if (!(dbus_timeout_get_enabled(w->data.bus_timeout)))
                 return;
 
+        /* D-Bus timeouts are periodic. Rearm first, the handler
+         * might remove the timeout and free the watch. */
+        r = bus_timeout_arm(m, w);
+        if (r < 0)
+                log_error("Failed to rearm timer: %s", strerror(-r));
+
         dbus_timeout_handle(w->data.bus_timeout);
 }
 
 static dbus_bool_t bus_add_timeout(DBusTimeout *timeout, void *data) {
         Manager *m = data;
         Watch *w;
-        struct epoll_event ev;
 
         assert(timeout);
         assert(m);
@@ -243,32 +251,18 @@ static dbus_bool_t bus_add_timeout(DBusTimeout *timeout, void *data) {
         if (!(w = new0(Watch, 1)))
                 return FALSE;
 
-        if ((w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0)
-                goto fail;
-
+        w->fd = -1;
         w->type = WATCH_DBUS_TIMEOUT;
         w->data.bus_timeout = timeout;
 
-        if (bus_timeout_arm(m, w) < 0)
-                goto fail;
-
-        zero(ev);
-        ev.events = EPOLLIN;
-        ev.data.ptr = w;
-
-        if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, w->fd, &ev) < 0)
-                goto fail;
+        if (bus_timeout_arm(m, w) < 0) {
+                free(w);
+                return FALSE;
+        }
 
         dbus_timeout_set_data(timeout, w, NULL);
 
         return TRUE;
-
-fail:
-        if (w->fd >= 0)
-                close_nointr_nofail(w->fd);
-
-        free(w);
-        return FALSE;
 }
 
 static void bus_remove_timeout(DBusTimeout *timeout, void *data) {
@@ -284,8 +278,7 @@ static void bus_remove_timeout(DBusTimeout *timeout, void *data) {
 
         assert(w->type == WATCH_DBUS_TIMEOUT);
 
-        assert_se(epoll_ctl(m->epoll_fd, EPOLL_CTL_DEL, w->fd, NULL) >= 0);
-        close_nointr_nofail(w->fd);
+        manager_unwatch_timer(m, w);
         free(w);
 }
 
@@ -523,9 +516,14 @@ unsigned bus_dispatch(Manager *m) {
         }
 
         if ((c = set_first(m->bus_connections_for_dispatch))) {
+                usec_t begin;
+
+                begin = now(CLOCK_MONOTONIC);
+
                 if (dbus_connection_dispatch(c) == DBUS_DISPATCH_COMPLETE)
                         set_move_one(m->bus_connections, m->bus_connections_for_dispatch, c);
 
+                profile_add(PROFILE_BUS_DISPATCH, begin);
                 return 1;
         }
 
@@ -1365,6 +1363,49 @@ oom:
         return -ENOMEM;
 }
 
+/* Sends the signal to each client that subscribed on the connection,
+ * addressed to it, so that the bus doesn't deliver it to anybody else
+ * watching */
+static int bus_send_to_subscribers(Manager *m, DBusConnection *c, DBusMessage *message) {
+        Iterator i;
+        Set *s;
+        char *client;
+
+        s = BUS_CONNECTION_SUBSCRIBED(m, c);
+
+        SET_FOREACH(client, s, i) {
+                _cleanup_dbus_message_unref_ DBusMessage *copy = NULL;
+
+                /* Direct connections have just the one peer */
+                if (streq(client, ":no-sender")) {
+                        if (!dbus_connection_send(c, message, NULL))
+                                return -ENOMEM;
+
+                        continue;
+                }
+
+                copy = dbus_message_copy(message);
+                if (!copy)
+                        return -ENOMEM;
+
+                if (!dbus_message_set_destination(copy, client) ||
+                    !dbus_connection_send(c, copy, NULL))
+                        return -ENOMEM;
+        }
+
+        return 0;
+}
+
+static bool bus_broadcast_one(Manager *m, DBusConnection *c, DBusMessage *message) {
+        if (c == m->system_bus && m->running_as != SYSTEMD_SYSTEM)
+                return true;
+
+        if (m->signal_subscribers_only)
+                return bus_send_to_subscribers(m, c, message) >= 0;
+
+        return dbus_connection_send(c, message, NULL);
+}
+
 int bus_broadcast(Manager *m, DBusMessage *message) {
         bool oom = false;
         Iterator i;
@@ -1374,12 +1415,10 @@ int bus_broadcast(Manager *m, DBusMessage *message) {
         assert(message);
 
         SET_FOREACH(c, m->bus_connections_for_dispatch, i)
-                if (c != m->system_bus || m->running_as == SYSTEMD_SYSTEM)
-                        oom = !dbus_connection_send(c, message, NULL);
+                oom = !bus_broadcast_one(m, c, message);
 
         SET_FOREACH(c, m->bus_connections, i)
-                if (c != m->system_bus || m->running_as == SYSTEMD_SYSTEM)
-                        oom = !dbus_connection_send(c, message, NULL);
+                oom = !bus_broadcast_one(m, c, message);
 
         return oom ? -ENOMEM : 0;
 }
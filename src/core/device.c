@@ -37,6 +37,21 @@ static const UnitActiveState state_translation_table[_DEVICE_STATE_MAX] = {
         [DEVICE_PLUGGED] = UNIT_ACTIVE
 };
 
+static void device_forget_links(Device *d) {
+        char **i;
+
+        assert(d);
+
+        /* Drops the symlinks that still resolve to us, they might
+         * have been taken over by another device since */
+        STRV_FOREACH(i, d->links)
+                if (hashmap_get(UNIT(d)->manager->devices_by_link, *i) == d->sysfs)
+                        hashmap_remove(UNIT(d)->manager->devices_by_link, *i);
+
+        strv_free(d->links);
+        d->links = NULL;
+}
+
 static void device_unset_sysfs(Device *d) {
         Device *first;
 
@@ -45,6 +60,8 @@ static void device_unset_sysfs(Device *d) {
         if (!d->sysfs)
                 return;
 
+        device_forget_links(d);
+
         /* Remove this unit from the chain of devices which share the
          * same sysfs path. */
         first = hashmap_get(UNIT(d)->manager->devices_by_sysfs, d->sysfs);
@@ -104,9 +121,9 @@ static int device_coldplug(Unit *u) {
         Device *d = DEVICE(u);
 
         assert(d);
-        assert(d->state == DEVICE_DEAD);
+        assert(d->state == DEVICE_DEAD || (d->state == DEVICE_PLUGGED && d->sysfs));
 
-        if (d->sysfs)
+        if (d->sysfs && d->state == DEVICE_DEAD)
                 device_set_state(d, DEVICE_PLUGGED);
 
         return 0;
@@ -318,6 +335,9 @@ fail:
 static int device_process_new_device(Manager *m, struct udev_device *dev, bool update_state) {
         const char *sysfs, *dn;
         struct udev_list_entry *item = NULL, *first = NULL;
+        _cleanup_strv_free_ char **links = NULL;
+        Device *main;
+        Unit *u;
         int r;
 
         assert(m);
@@ -334,11 +354,21 @@ static int device_process_new_device(Manager *m, struct udev_device *dev, bool u
         if ((dn = udev_device_get_devnode(dev)))
                 device_update_unit(m, dev, dn, false);
 
-        /* Add additional units for all symlinks */
+        /* Add additional units for all symlinks. Only the ones
+         * somebody referenced already are created right away, the
+         * others when they are loaded, see device_load(). With
+         * by-id, by-path, by-uuid... links there are many more of
+         * them than devices, and hardly any of them is ever used. */
+        r = device_find_escape_name(m, sysfs, &u);
+        if (r < 0)
+                return r;
+        main = r > 0 ? DEVICE(u) : NULL;
+
         first = udev_device_get_devlinks_list_entry(dev);
         udev_list_entry_foreach(item, first) {
                 const char *p;
                 struct stat st;
+                char *e;
 
                 /* Don't bother with the /dev/block links */
                 p = udev_list_entry_get_name(item);
@@ -359,7 +389,44 @@ static int device_process_new_device(Manager *m, struct udev_device *dev, bool u
                             st.st_rdev != udev_device_get_devnum(dev))
                                 continue;
 
-                device_update_unit(m, dev, p, false);
+                e = unit_name_from_path(p, ".device");
+                if (!e)
+                        return log_oom();
+
+                if (!main || manager_get_unit(m, e)) {
+                        free(e);
+                        device_update_unit(m, dev, p, false);
+                        continue;
+                }
+
+                r = strv_push(&links, e);
+                if (r < 0) {
+                        free(e);
+                        return log_oom();
+                }
+        }
+
+        if (main) {
+                char **i;
+
+                r = hashmap_ensure_allocated(&m->devices_by_link, string_hash_func, string_compare_func);
+                if (r < 0)
+                        return log_oom();
+
+                device_forget_links(main);
+
+                STRV_FOREACH(i, links) {
+                        r = hashmap_replace(m->devices_by_link, *i, main->sysfs);
+                        if (r < 0) {
+                                main->links = links;
+                                links = NULL;
+                                device_forget_links(main);
+                                return log_oom();
+                        }
+                }
+
+                main->links = links;
+                links = NULL;
         }
 
         if (update_state) {
@@ -392,9 +459,21 @@ static int device_process_path(Manager *m, const char *path, bool update_state)
         return r;
 }
 
+static void device_process_removed_path(Manager *m, const char *sysfs) {
+        Device *d;
+
+        assert(m);
+        assert(sysfs);
+
+        /* Remove all units of this sysfs path */
+        while ((d = hashmap_get(m->devices_by_sysfs, sysfs))) {
+                device_unset_sysfs(d);
+                device_set_state(d, DEVICE_DEAD);
+        }
+}
+
 static int device_process_removed_device(Manager *m, struct udev_device *dev) {
         const char *sysfs;
-        Device *d;
 
         assert(m);
         assert(dev);
@@ -402,12 +481,52 @@ static int device_process_removed_device(Manager *m, struct udev_device *dev) {
         if (!(sysfs = udev_device_get_syspath(dev)))
                 return -ENOMEM;
 
-        /* Remove all units of this sysfs path */
-        while ((d = hashmap_get(m->devices_by_sysfs, sysfs))) {
-                device_unset_sysfs(d);
-                device_set_state(d, DEVICE_DEAD);
+        device_process_removed_path(m, sysfs);
+        return 0;
+}
+
+static int device_load(Unit *u) {
+        Manager *m = u->manager;
+        struct udev_device *dev;
+        _cleanup_free_ char *path = NULL;
+        const char *sysfs;
+        int r;
+
+        assert(u);
+
+        r = unit_load_fragment_and_dropin_optional(u);
+        if (r < 0)
+                return r;
+
+        /* Now that it is referenced, create the unit of a symlink
+         * we only took note of so far */
+        sysfs = hashmap_get(m->devices_by_link, u->id);
+        if (!sysfs || DEVICE(u)->sysfs)
+                return 0;
+
+        hashmap_remove(m->devices_by_link, u->id);
+
+        path = unit_name_to_path(u->id);
+        if (!path)
+                return -ENOMEM;
+
+        dev = udev_device_new_from_syspath(m->udev, sysfs);
+        if (!dev) {
+                log_warning("Failed to get udev device object from udev for path %s.", sysfs);
+                return 0;
         }
 
+        r = device_update_unit(m, dev, path, false);
+        udev_device_unref(dev);
+        if (r < 0)
+                return 0;
+
+        /* Make up for the state change we would have seen if the
+         * unit existed before. Units loaded before the coldplug
+         * leave that to it. */
+        if (!manager_is_reloading_or_reexecuting(m))
+                DEVICE(u)->state = DEVICE_PLUGGED;
+
         return 0;
 }
 
@@ -483,6 +602,12 @@ static void device_shutdown(Manager *m) {
 
         hashmap_free(m->devices_by_sysfs);
         m->devices_by_sysfs = NULL;
+
+        hashmap_free(m->devices_by_link);
+        m->devices_by_link = NULL;
+
+        set_free_free(m->devices_storm_subsystems);
+        m->devices_storm_subsystems = NULL;
 }
 
 static int device_enumerate(Manager *m) {
@@ -558,10 +683,135 @@ fail:
         return r;
 }
 
-void device_fd_event(Manager *m, int events) {
-        struct udev_device *dev;
+static void device_process_event(Manager *m, struct udev_device *dev, const char *action) {
+        const char *ready;
+        int r;
+
+        ready = udev_device_get_property_value(dev, "SYSTEMD_READY");
+
+        if ((action && streq(action, "remove")) || (ready && parse_boolean(ready) == 0)) {
+                if ((r = device_process_removed_device(m, dev)) < 0)
+                        log_error("Failed to process udev device event: %s", strerror(-r));
+        } else {
+                if ((r = device_process_new_device(m, dev, true)) < 0)
+                        log_error("Failed to process udev device event: %s", strerror(-r));
+        }
+}
+
+static int device_remember_subsystem(Manager *m, struct udev_device *dev) {
+        const char *subsystem;
+        char *s;
+        int r;
+
+        subsystem = udev_device_get_subsystem(dev);
+        if (!subsystem)
+                return 0;
+
+        r = set_ensure_allocated(&m->devices_storm_subsystems, string_hash_func, string_compare_func);
+        if (r < 0)
+                return r;
+
+        if (set_get(m->devices_storm_subsystems, (char*) subsystem))
+                return 0;
+
+        s = strdup(subsystem);
+        if (!s)
+                return -ENOMEM;
+
+        r = set_put(m->devices_storm_subsystems, s);
+        if (r < 0) {
+                free(s);
+                return r;
+        }
+
+        return 0;
+}
+
+static int device_resync(Manager *m) {
+        struct udev_enumerate *e;
+        struct udev_list_entry *item;
+        _cleanup_strv_free_ char **gone = NULL;
+        Iterator i;
+        Device *d;
+        char *subsystem, **p;
         int r;
-        const char *action, *ready;
+
+        assert(m);
+
+        /* Events were lost, but the enumeration of all devices is
+         * too expensive to repeat for that. Devices of the
+         * subsystems which saw events in the meantime are processed
+         * again, since their properties might have changed. Of the
+         * others only the ones which appeared or disappeared are
+         * looked at. */
+
+        if (!set_isempty(m->devices_storm_subsystems)) {
+                e = udev_enumerate_new(m->udev);
+                if (!e)
+                        return -ENOMEM;
+
+                r = udev_enumerate_add_match_tag(e, "systemd");
+                SET_FOREACH(subsystem, m->devices_storm_subsystems, i)
+                        if (r >= 0)
+                                r = udev_enumerate_add_match_subsystem(e, subsystem);
+                if (r >= 0)
+                        r = udev_enumerate_scan_devices(e);
+                if (r < 0) {
+                        udev_enumerate_unref(e);
+                        return -EIO;
+                }
+
+                udev_list_entry_foreach(item, udev_enumerate_get_list_entry(e)) {
+                        struct udev_device *dev;
+
+                        dev = udev_device_new_from_syspath(m->udev, udev_list_entry_get_name(item));
+                        if (!dev)
+                                continue;
+
+                        device_process_event(m, dev, NULL);
+                        udev_device_unref(dev);
+                }
+
+                udev_enumerate_unref(e);
+                set_clear_free(m->devices_storm_subsystems);
+        }
+
+        e = udev_enumerate_new(m->udev);
+        if (!e)
+                return -ENOMEM;
+
+        if (udev_enumerate_add_match_tag(e, "systemd") < 0 ||
+            udev_enumerate_scan_devices(e) < 0) {
+                udev_enumerate_unref(e);
+                return -EIO;
+        }
+
+        udev_list_entry_foreach(item, udev_enumerate_get_list_entry(e)) {
+                const char *sysfs = udev_list_entry_get_name(item);
+
+                if (!hashmap_get(m->devices_by_sysfs, sysfs))
+                        device_process_path(m, sysfs, true);
+        }
+
+        udev_enumerate_unref(e);
+
+        HASHMAP_FOREACH(d, m->devices_by_sysfs, i)
+                if (access(d->sysfs, F_OK) < 0 && errno == ENOENT)
+                        if (strv_extend(&gone, d->sysfs) < 0)
+                                return -ENOMEM;
+
+        STRV_FOREACH(p, gone)
+                device_process_removed_path(m, *p);
+
+        return 0;
+}
+
+/* Devices received per udev_monitor_receive_devices() call */
+#define DEVICE_BATCH_MAX 8
+
+void device_fd_event(Manager *m, int events) {
+        struct udev_device *devs[DEVICE_BATCH_MAX];
+        int n, i, r;
 
         assert(m);
 
@@ -574,35 +824,50 @@ void device_fd_event(Manager *m, int events) {
                         return;
         }
 
-        if (!(dev = udev_monitor_receive_device(m->udev_monitor))) {
+        n = udev_monitor_receive_devices(m->udev_monitor, devs, ELEMENTSOF(devs));
+        if (n == -ENOBUFS) {
+                log_warning("udev event queue overflowed, resynchronizing devices.");
+
+                r = device_resync(m);
+                if (r < 0)
+                        log_error("Failed to resynchronize devices: %s", strerror(-r));
+                m->devices_queue_drained = false;
+                return;
+        }
+
+        /* The overflow is reported only after the devices received
+         * before it, hence forget about the subsystems one call late */
+        if (m->devices_queue_drained) {
+                set_clear_free(m->devices_storm_subsystems);
+                m->devices_queue_drained = false;
+        }
+
+        if (n <= 0) {
                 /*
                  * libudev might filter-out devices which pass the bloom filter,
-                 * so getting NULL here is not necessarily an error
+                 * so getting none here is not necessarily an error
                  */
+                m->devices_queue_drained = true;
                 return;
         }
 
-        if (!(action = udev_device_get_action(dev))) {
-                log_error("Failed to get udev action string.");
-                goto fail;
-        }
+        for (i = 0; i < n; i++) {
+                const char *action;
 
-        ready = udev_device_get_property_value(dev, "SYSTEMD_READY");
+                device_remember_subsystem(m, devs[i]);
 
-        if (streq(action, "remove") || (ready && parse_boolean(ready) == 0)) {
-                if ((r = device_process_removed_device(m, dev)) < 0) {
-                        log_error("Failed to process udev device event: %s", strerror(-r));
-                        goto fail;
-                }
-        } else {
-                if ((r = device_process_new_device(m, dev, true)) < 0) {
-                        log_error("Failed to process udev device event: %s", strerror(-r));
-                        goto fail;
-                }
+                action = udev_device_get_action(devs[i]);
+                if (action)
+                        device_process_event(m, devs[i], action);
+                else
+                        log_error("Failed to get udev action string.");
+
+                udev_device_unref(devs[i]);
         }
 
-fail:
-        udev_device_unref(dev);
+        /* Fewer devices than asked for means the queue is drained */
+        if (n < (int) ELEMENTSOF(devs))
+                m->devices_queue_drained = true;
 }
 
 static const char* const device_state_table[_DEVICE_STATE_MAX] = {
@@ -623,7 +888,7 @@ const UnitVTable device_vtable = {
 
         .init = device_init,
 
-        .load = unit_load_fragment_and_dropin_optional,
+        .load = device_load,
         .done = device_done,
         .coldplug = device_coldplug,
 
@@ -634,6 +899,7 @@ const UnitVTable device_vtable = {
 
         .bus_interface = "org.freedesktop.systemd1.Device",
         .bus_message_handler = bus_device_message_handler,
+        .bus_append_properties = bus_device_append_properties,
         .bus_invalidating_properties =  bus_device_invalidating_properties,
 
         .following = device_following,
@@ -45,6 +45,12 @@ struct Device {
 
         LIST_FIELDS(struct Device, same_sysfs);
 
+        /* Unit names of the DEVLINKS symlinks of the device which
+         * have not been referenced yet, hence have no unit, only an
+         * entry in devices_by_link. Only set for the unit named after
+         * the sysfs path. */
+        char **links;
+
         DeviceState state;
 };
 
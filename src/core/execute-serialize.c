@@ -0,0 +1,703 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "execute-serialize.h"
+#include "serialize.h"
+#include "cgroup.h"
+#include "syscall-list.h"
+#include "strv.h"
+#include "util.h"
+#include "log.h"
+
+static void serialize_string(FILE *f, const char *key, const char *s) {
+        if (s)
+                serialize_item(f, true, key, s);
+}
+
+static void serialize_strv(FILE *f, const char *key, char **l) {
+        char **i;
+
+        STRV_FOREACH(i, l)
+                serialize_item(f, true, key, *i);
+}
+
+static void serialize_bool(FILE *f, const char *key, bool b) {
+        serialize_item(f, true, key, yes_no(b));
+}
+
+static unsigned syscall_filter_words(void) {
+        /* Same size as allocated by config_parse_syscall_filter() */
+        return (syscall_max() + 31) >> 4;
+}
+
+static int serialize_context(FILE *f, ExecContext *c) {
+        unsigned i;
+
+        serialize_strv(f, "context-environment", c->environment);
+
+        for (i = 0; i < RLIMIT_NLIMITS; i++)
+                if (c->rlimit[i])
+                        serialize_item_format(f, true, "rlimit", "%u %llu %llu", i,
+                                              (unsigned long long) c->rlimit[i]->rlim_cur,
+                                              (unsigned long long) c->rlimit[i]->rlim_max);
+
+        serialize_string(f, "working-directory", c->working_directory);
+        serialize_string(f, "root-directory", c->root_directory);
+        serialize_item_format(f, true, "umask", "%u", (unsigned) c->umask);
+
+        if (c->oom_score_adjust_set)
+                serialize_item_format(f, true, "oom-score-adjust", "%i", c->oom_score_adjust);
+        if (c->nice_set)
+                serialize_item_format(f, true, "nice", "%i", c->nice);
+        if (c->ioprio_set)
+                serialize_item_format(f, true, "ioprio", "%i", c->ioprio);
+        if (c->cpu_sched_set)
+                serialize_item_format(f, true, "cpu-sched", "%i %i", c->cpu_sched_policy, c->cpu_sched_priority);
+        serialize_bool(f, "cpu-sched-reset-on-fork", c->cpu_sched_reset_on_fork);
+
+        if (c->cpuset) {
+                _cleanup_free_ char *l = NULL;
+                char *p;
+
+                l = new(char, c->cpuset_ncpus * (DECIMAL_STR_MAX(unsigned) + 1) + 1);
+                if (!l)
+                        return -ENOMEM;
+
+                p = l;
+                *p = 0;
+                for (i = 0; i < c->cpuset_ncpus; i++)
+                        if (CPU_ISSET_S(i, CPU_ALLOC_SIZE(c->cpuset_ncpus), c->cpuset))
+                                p += sprintf(p, p == l ? "%u" : " %u", i);
+
+                serialize_item(f, true, "cpu-affinity", l);
+        }
+
+        serialize_item(f, true, "std-input", exec_input_to_string(c->std_input));
+        serialize_item(f, true, "std-output", exec_output_to_string(c->std_output));
+        serialize_item(f, true, "std-error", exec_output_to_string(c->std_error));
+
+        serialize_item_format(f, true, "timer-slack-nsec", "%llu", (unsigned long long) c->timer_slack_nsec);
+        serialize_string(f, "tcpwrap-name", c->tcpwrap_name);
+        serialize_string(f, "tty-path", c->tty_path);
+        serialize_bool(f, "tty-reset", c->tty_reset);
+        serialize_bool(f, "tty-vhangup", c->tty_vhangup);
+        serialize_bool(f, "tty-vt-disallocate", c->tty_vt_disallocate);
+        serialize_bool(f, "ignore-sigpipe", c->ignore_sigpipe);
+
+        serialize_string(f, "user", c->user);
+        serialize_string(f, "group", c->group);
+        serialize_strv(f, "supplementary-group", c->supplementary_groups);
+        serialize_string(f, "pam-name", c->pam_name);
+        serialize_string(f, "utmp-id", c->utmp_id);
+
+        serialize_strv(f, "read-write-dir", c->read_write_dirs);
+        serialize_strv(f, "read-only-dir", c->read_only_dirs);
+        serialize_strv(f, "inaccessible-dir", c->inaccessible_dirs);
+        serialize_item_format(f, true, "mount-flags", "%lu", c->mount_flags);
+
+        serialize_item_format(f, true, "capability-bounding-set-drop", "%llu",
+                              (unsigned long long) c->capability_bounding_set_drop);
+
+        if (c->capabilities) {
+                char *t;
+
+                t = cap_to_text(c->capabilities, NULL);
+                if (!t)
+                        return -ENOMEM;
+
+                serialize_item(f, true, "capabilities", t);
+                cap_free(t);
+        }
+
+        serialize_item_format(f, true, "secure-bits", "%i", c->secure_bits);
+
+        serialize_item_format(f, true, "syslog-priority", "%i", c->syslog_priority);
+        serialize_string(f, "syslog-identifier", c->syslog_identifier);
+        serialize_bool(f, "syslog-level-prefix", c->syslog_level_prefix);
+
+        serialize_bool(f, "non-blocking", c->non_blocking);
+        serialize_bool(f, "private-tmp", c->private_tmp);
+        serialize_bool(f, "private-network", c->private_network);
+        serialize_string(f, "tmp-dir", c->tmp_dir);
+        serialize_string(f, "var-tmp-dir", c->var_tmp_dir);
+        serialize_bool(f, "no-new-privileges", c->no_new_privileges);
+
+        serialize_bool(f, "control-group-modify", c->control_group_modify);
+        serialize_item_format(f, true, "control-group-persistent", "%i", c->control_group_persistent);
+        serialize_bool(f, "same-pgrp", c->same_pgrp);
+
+        if (c->syscall_filter) {
+                _cleanup_free_ char *l = NULL;
+                unsigned n;
+
+                n = syscall_filter_words();
+                l = new(char, n * 8 + 1);
+                if (!l)
+                        return -ENOMEM;
+
+                for (i = 0; i < n; i++)
+                        sprintf(l + i * 8, "%08" PRIx32, c->syscall_filter[i]);
+
+                serialize_item(f, true, "syscall-filter", l);
+        }
+
+        return 0;
+}
+
+int exec_spawn_serialize(FILE *f, ExecCommand *command, ExecContext *context, const ExecParameters *p) {
+        CGroupBonding *b;
+        unsigned i;
+        int r;
+
+        assert(f);
+        assert(command);
+        assert(context);
+        assert(p);
+
+        r = serialize_header(f, true);
+        if (r < 0)
+                return r;
+
+        serialize_item_format(f, true, "log-level", "%i", log_get_max_level());
+        serialize_item(f, true, "log-target", log_target_to_string(log_get_target()));
+
+        serialize_item(f, true, "path", command->path);
+        serialize_strv(f, "argv", p->argv);
+        serialize_strv(f, "environment", p->environment);
+        serialize_strv(f, "files-env", p->files_env);
+
+        for (i = 0; i < p->n_fds; i++)
+                serialize_item_format(f, true, "fd", "%i", p->fds[i]);
+        if (p->socket_fd >= 0)
+                serialize_item_format(f, true, "socket-fd", "%i", p->socket_fd);
+        if (p->idle_pipe)
+                serialize_item_format(f, true, "idle-pipe", "%i %i", p->idle_pipe[0], p->idle_pipe[1]);
+
+        serialize_bool(f, "apply-permissions", p->apply_permissions);
+        serialize_bool(f, "apply-chroot", p->apply_chroot);
+        serialize_bool(f, "apply-tty-stdin", p->apply_tty_stdin);
+        serialize_bool(f, "confirm-spawn", p->confirm_spawn);
+
+        LIST_FOREACH(by_unit, b, p->cgroup_bondings)
+                serialize_item_format(f, true, "cgroup", "%s %s %s %s",
+                                      yes_no(b->essential), yes_no(b->realized),
+                                      b->controller, b->path);
+        serialize_string(f, "cgroup-suffix", p->cgroup_suffix);
+        serialize_string(f, "unit-id", p->unit_id);
+
+        r = serialize_context(f, context);
+        if (r < 0)
+                return r;
+
+        serialize_end(f, true);
+
+        return 0;
+}
+
+static int deserialize_string(char **s, const char *value) {
+        char *t;
+
+        t = strdup(value);
+        if (!t)
+                return -ENOMEM;
+
+        free(*s);
+        *s = t;
+        return 0;
+}
+
+static int deserialize_bool(bool *b, const char *value) {
+        int r;
+
+        r = parse_boolean(value);
+        if (r < 0)
+                return -EBADMSG;
+
+        *b = r;
+        return 0;
+}
+
+static int deserialize_int(int *i, const char *value) {
+        return safe_atoi(value, i) < 0 ? -EBADMSG : 0;
+}
+
+static int deserialize_cgroup(ExecParameters *p, CGroupBonding **last, const char *value) {
+        _cleanup_free_ char *essential = NULL, *realized = NULL;
+        CGroupBonding *b;
+        const char *s;
+        size_t n;
+        int r;
+
+        /* essential realized controller path, the path may contain spaces */
+        s = value;
+
+        n = strcspn(s, " ");
+        essential = strndup(s, n);
+        if (!essential)
+                return -ENOMEM;
+        if (!s[n])
+                return -EBADMSG;
+        s += n + 1;
+
+        n = strcspn(s, " ");
+        realized = strndup(s, n);
+        if (!realized)
+                return -ENOMEM;
+        if (!s[n])
+                return -EBADMSG;
+        s += n + 1;
+
+        n = strcspn(s, " ");
+        if (n == 0 || !s[n] || !s[n+1])
+                return -EBADMSG;
+
+        b = new0(CGroupBonding, 1);
+        if (!b)
+                return -ENOMEM;
+
+        b->fd = -1;
+
+        b->controller = strndup(s, n);
+        b->path = strdup(s + n + 1);
+        if (!b->controller || !b->path) {
+                cgroup_bonding_free(b, false);
+                return -ENOMEM;
+        }
+
+        r = parse_boolean(essential);
+        if (r < 0)
+                goto fail;
+        b->essential = r;
+
+        r = parse_boolean(realized);
+        if (r < 0)
+                goto fail;
+        b->realized = r;
+
+        LIST_INSERT_AFTER(CGroupBonding, by_unit, p->cgroup_bondings, *last, b);
+        *last = b;
+
+        return 0;
+
+fail:
+        cgroup_bonding_free(b, false);
+        return -EBADMSG;
+}
+
+static int deserialize_context_item(ExecContext *c, const char *key, const char *value) {
+        int r, i;
+
+        if (streq(key, "context-environment"))
+                return strv_extend(&c->environment, value);
+
+        else if (streq(key, "rlimit")) {
+                unsigned long long cur, max;
+                unsigned l;
+
+                if (sscanf(value, "%u %llu %llu", &l, &cur, &max) != 3 || l >= RLIMIT_NLIMITS)
+                        return -EBADMSG;
+
+                if (!c->rlimit[l]) {
+                        c->rlimit[l] = new(struct rlimit, 1);
+                        if (!c->rlimit[l])
+                                return -ENOMEM;
+                }
+
+                c->rlimit[l]->rlim_cur = (rlim_t) cur;
+                c->rlimit[l]->rlim_max = (rlim_t) max;
+
+        } else if (streq(key, "working-directory"))
+                return deserialize_string(&c->working_directory, value);
+
+        else if (streq(key, "root-directory"))
+                return deserialize_string(&c->root_directory, value);
+
+        else if (streq(key, "umask")) {
+                unsigned m;
+
+                if (safe_atou(value, &m) < 0 || m > 0777)
+                        return -EBADMSG;
+
+                c->umask = (mode_t) m;
+
+        } else if (streq(key, "oom-score-adjust")) {
+                r = deserialize_int(&c->oom_score_adjust, value);
+                if (r < 0)
+                        return r;
+
+                c->oom_score_adjust_set = true;
+
+        } else if (streq(key, "nice")) {
+                r = deserialize_int(&c->nice, value);
+                if (r < 0)
+                        return r;
+
+                c->nice_set = true;
+
+        } else if (streq(key, "ioprio")) {
+                r = deserialize_int(&c->ioprio, value);
+                if (r < 0)
+                        return r;
+
+                c->ioprio_set = true;
+
+        } else if (streq(key, "cpu-sched")) {
+                if (sscanf(value, "%i %i", &c->cpu_sched_policy, &c->cpu_sched_priority) != 2)
+                        return -EBADMSG;
+
+                c->cpu_sched_set = true;
+
+        } else if (streq(key, "cpu-sched-reset-on-fork"))
+                return deserialize_bool(&c->cpu_sched_reset_on_fork, value);
+
+        else if (streq(key, "cpu-affinity")) {
+                char *w, *state;
+                size_t l;
+
+                if (!c->cpuset) {
+                        c->cpuset = cpu_set_malloc(&c->cpuset_ncpus);
+                        if (!c->cpuset)
+                                return -ENOMEM;
+                }
+
+                FOREACH_WORD(w, l, value, state) {
+                        char _cleanup_free_ *t = NULL;
+                        unsigned cpu;
+
+                        t = strndup(w, l);
+                        if (!t)
+                                return -ENOMEM;
+
+                        if (safe_atou(t, &cpu) < 0 || cpu >= c->cpuset_ncpus)
+                                return -EBADMSG;
+
+                        CPU_SET_S(cpu, CPU_ALLOC_SIZE(c->cpuset_ncpus), c->cpuset);
+                }
+
+        } else if (streq(key, "std-input")) {
+                c->std_input = exec_input_from_string(value);
+                if (c->std_input < 0)
+                        return -EBADMSG;
+
+        } else if (streq(key, "std-output")) {
+                c->std_output = exec_output_from_string(value);
+                if (c->std_output < 0)
+                        return -EBADMSG;
+
+        } else if (streq(key, "std-error")) {
+                c->std_error = exec_output_from_string(value);
+                if (c->std_error < 0)
+                        return -EBADMSG;
+
+        } else if (streq(key, "timer-slack-nsec")) {
+                unsigned long long n;
+
+                if (safe_atollu(value, &n) < 0)
+                        return -EBADMSG;
+
+                c->timer_slack_nsec = (nsec_t) n;
+
+        } else if (streq(key, "tcpwrap-name"))
+                return deserialize_string(&c->tcpwrap_name, value);
+
+        else if (streq(key, "tty-path"))
+                return deserialize_string(&c->tty_path, value);
+
+        else if (streq(key, "tty-reset"))
+                return deserialize_bool(&c->tty_reset, value);
+
+        else if (streq(key, "tty-vhangup"))
+                return deserialize_bool(&c->tty_vhangup, value);
+
+        else if (streq(key, "tty-vt-disallocate"))
+                return deserialize_bool(&c->tty_vt_disallocate, value);
+
+        else if (streq(key, "ignore-sigpipe"))
+                return deserialize_bool(&c->ignore_sigpipe, value);
+
+        else if (streq(key, "user"))
+                return deserialize_string(&c->user, value);
+
+        else if (streq(key, "group"))
+                return deserialize_string(&c->group, value);
+
+        else if (streq(key, "supplementary-group"))
+                return strv_extend(&c->supplementary_groups, value);
+
+        else if (streq(key, "pam-name"))
+                return deserialize_string(&c->pam_name, value);
+
+        else if (streq(key, "utmp-id"))
+                return deserialize_string(&c->utmp_id, value);
+
+        else if (streq(key, "read-write-dir"))
+                return strv_extend(&c->read_write_dirs, value);
+
+        else if (streq(key, "read-only-dir"))
+                return strv_extend(&c->read_only_dirs, value);
+
+        else if (streq(key, "inaccessible-dir"))
+                return strv_extend(&c->inaccessible_dirs, value);
+
+        else if (streq(key, "mount-flags")) {
+                unsigned long long n;
+
+                if (safe_atollu(value, &n) < 0)
+                        return -EBADMSG;
+
+                c->mount_flags = (unsigned long) n;
+
+        } else if (streq(key, "capability-bounding-set-drop")) {
+                unsigned long long n;
+
+                if (safe_atollu(value, &n) < 0)
+                        return -EBADMSG;
+
+                c->capability_bounding_set_drop = (uint64_t) n;
+
+        } else if (streq(key, "capabilities")) {
+                cap_t cap;
+
+                cap = cap_from_text(value);
+                if (!cap)
+                        return -EBADMSG;
+
+                if (c->capabilities)
+                        cap_free(c->capabilities);
+                c->capabilities = cap;
+
+        } else if (streq(key, "secure-bits"))
+                return deserialize_int(&c->secure_bits, value);
+
+        else if (streq(key, "syslog-priority"))
+                return deserialize_int(&c->syslog_priority, value);
+
+        else if (streq(key, "syslog-identifier"))
+                return deserialize_string(&c->syslog_identifier, value);
+
+        else if (streq(key, "syslog-level-prefix"))
+                return deserialize_bool(&c->syslog_level_prefix, value);
+
+        else if (streq(key, "non-blocking"))
+                return deserialize_bool(&c->non_blocking, value);
+
+        else if (streq(key, "private-tmp"))
+                return deserialize_bool(&c->private_tmp, value);
+
+        else if (streq(key, "private-network"))
+                return deserialize_bool(&c->private_network, value);
+
+        else if (streq(key, "tmp-dir"))
+                return deserialize_string(&c->tmp_dir, value);
+
+        else if (streq(key, "var-tmp-dir"))
+                return deserialize_string(&c->var_tmp_dir, value);
+
+        else if (streq(key, "no-new-privileges"))
+                return deserialize_bool(&c->no_new_privileges, value);
+
+        else if (streq(key, "control-group-modify"))
+                return deserialize_bool(&c->control_group_modify, value);
+
+        else if (streq(key, "control-group-persistent"))
+                return deserialize_int(&c->control_group_persistent, value);
+
+        else if (streq(key, "same-pgrp"))
+                return deserialize_bool(&c->same_pgrp, value);
+
+        else if (streq(key, "syscall-filter")) {
+                unsigned n, k;
+
+                n = syscall_filter_words();
+                if (strlen(value) != n * 8)
+                        return -EBADMSG;
+
+                free(c->syscall_filter);
+                c->syscall_filter = new0(uint32_t, n);
+                if (!c->syscall_filter)
+                        return -ENOMEM;
+
+                for (k = 0; k < n * 8; k++) {
+                        i = unhexchar(value[k]);
+                        if (i < 0)
+                                return -EBADMSG;
+
+                        c->syscall_filter[k / 8] = (c->syscall_filter[k / 8] << 4) | (uint32_t) i;
+                }
+
+        } else {
+                log_debug("Unknown serialization key '%s'", key);
+                return 0;
+        }
+
+        return 0;
+}
+
+static int deserialize_item_one(ExecCommand *command, ExecContext *c, ExecParameters *p,
+                                CGroupBonding **last, const char *key, const char *value) {
+        int r;
+
+        if (streq(key, "log-level")) {
+                int level;
+
+                r = deserialize_int(&level, value);
+                if (r < 0)
+                        return r;
+
+                log_set_max_level(level);
+
+        } else if (streq(key, "log-target")) {
+                if (log_set_target_from_string(value) < 0)
+                        return -EBADMSG;
+
+        } else if (streq(key, "path"))
+                return deserialize_string(&command->path, value);
+
+        else if (streq(key, "argv"))
+                return strv_extend(&p->argv, value);
+
+        else if (streq(key, "environment"))
+                return strv_extend(&p->environment, value);
+
+        else if (streq(key, "files-env"))
+                return strv_extend(&p->files_env, value);
+
+        else if (streq(key, "fd")) {
+                int fd, *fds;
+
+                if (safe_atoi(value, &fd) < 0 || fd < 0)
+                        return -EBADMSG;
+
+                fds = realloc(p->fds, sizeof(int) * (p->n_fds + 1));
+                if (!fds)
+                        return -ENOMEM;
+
+                fds[p->n_fds++] = fd;
+                p->fds = fds;
+
+        } else if (streq(key, "socket-fd")) {
+                if (safe_atoi(value, &p->socket_fd) < 0 || p->socket_fd < 0)
+                        return -EBADMSG;
+
+        } else if (streq(key, "idle-pipe")) {
+                if (!p->idle_pipe) {
+                        p->idle_pipe = new(int, 2);
+                        if (!p->idle_pipe)
+                                return -ENOMEM;
+                }
+
+                if (sscanf(value, "%i %i", &p->idle_pipe[0], &p->idle_pipe[1]) != 2)
+                        return -EBADMSG;
+
+        } else if (streq(key, "apply-permissions") ||
+                   streq(key, "apply-chroot") ||
+                   streq(key, "apply-tty-stdin") ||
+                   streq(key, "confirm-spawn")) {
+                bool b;
+
+                r = deserialize_bool(&b, value);
+                if (r < 0)
+                        return r;
+
+                if (streq(key, "apply-permissions"))
+                        p->apply_permissions = b;
+                else if (streq(key, "apply-chroot"))
+                        p->apply_chroot = b;
+                else if (streq(key, "apply-tty-stdin"))
+                        p->apply_tty_stdin = b;
+                else
+                        p->confirm_spawn = b;
+
+        } else if (streq(key, "cgroup"))
+                return deserialize_cgroup(p, last, value);
+
+        else if (streq(key, "cgroup-suffix"))
+                return deserialize_string((char**) &p->cgroup_suffix, value);
+
+        else if (streq(key, "unit-id"))
+                return deserialize_string((char**) &p->unit_id, value);
+
+        else
+                return deserialize_context_item(c, key, value);
+
+        return 0;
+}
+
+int exec_spawn_deserialize(FILE *f, ExecCommand *command, ExecContext *context, ExecParameters *p) {
+        _cleanup_free_ char *buffer = NULL;
+        size_t allocated = 0;
+        CGroupBonding *last = NULL;
+        char *k, *v;
+        bool binary;
+        int r;
+
+        assert(f);
+        assert(command);
+        assert(context);
+        assert(p);
+
+        r = deserialize_header(f, &binary);
+        if (r < 0)
+                return r;
+        if (!binary)
+                return -EBADMSG;
+
+        p->socket_fd = -1;
+
+        for (;;) {
+                r = deserialize_item(f, true, &buffer, &allocated, &k, &v);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        break;
+
+                r = deserialize_item_one(command, context, p, &last, k, v);
+                if (r < 0)
+                        return r;
+        }
+
+        if (!command->path || strv_isempty(p->argv))
+                return -EBADMSG;
+
+        return 0;
+}
+
+void exec_parameters_done(ExecParameters *p) {
+        assert(p);
+
+        strv_free(p->argv);
+        strv_free(p->environment);
+        strv_free(p->files_env);
+
+        free(p->fds);
+        free(p->idle_pipe);
+
+        cgroup_bonding_free_list(p->cgroup_bondings, false);
+
+        free((char*) p->cgroup_suffix);
+        free((char*) p->unit_id);
+
+        zero(*p);
+        p->socket_fd = -1;
+}
@@ -0,0 +1,35 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+
+#include "execute.h"
+
+/* Passes everything exec_child() needs on to systemd-executor, in the
+ * binary serialization format. The receiving side starts out with a
+ * context from exec_context_init() and zeroed command and parameters,
+ * and owns everything it reads, so that it can be released with
+ * exec_command_done(), exec_context_done() and exec_parameters_done(). */
+
+int exec_spawn_serialize(FILE *f, ExecCommand *command, ExecContext *context, const ExecParameters *p);
+int exec_spawn_deserialize(FILE *f, ExecCommand *command, ExecContext *context, ExecParameters *p);
+
+void exec_parameters_done(ExecParameters *p);
@@ -38,6 +38,7 @@
 #include <linux/fs.h>
 #include <linux/oom.h>
 #include <sys/poll.h>
+#include <sys/mman.h>
 #include <linux/seccomp-bpf.h>
 #include <glob.h>
 #include <libgen.h>
@@ -67,6 +68,9 @@
 #include "syscall-list.h"
 #include "env-util.h"
 #include "fileio.h"
+#include "execute-serialize.h"
+#include "profile.h"
+#include "trace.h"
 
 #define IDLE_TIMEOUT_USEC (5*USEC_PER_SEC)
 
@@ -977,561 +981,765 @@ static int apply_seccomp(uint32_t *syscall_filter) {
         return 0;
 }
 
-int exec_spawn(ExecCommand *command,
-               char **argv,
-               ExecContext *context,
-               int fds[], unsigned n_fds,
-               char **environment,
-               bool apply_permissions,
-               bool apply_chroot,
-               bool apply_tty_stdin,
-               bool confirm_spawn,
-               CGroupBonding *cgroup_bondings,
-               CGroupAttribute *cgroup_attributes,
-               const char *cgroup_suffix,
-               const char *unit_id,
-               int idle_pipe[2],
-               pid_t *ret) {
-
-        pid_t pid;
-        int r;
+/* Sets up the execution environment in the new process and executes
+ * the command. This runs either in a process forked off the manager, or
+ * in systemd-executor, after the parameters have been passed on. */
+void exec_child(ExecCommand *command, ExecContext *context, const ExecParameters *p) {
+        int i, r, err;
         char *line;
-        int socket_fd;
-        char _cleanup_strv_free_ **files_env = NULL;
+        sigset_t ss;
+        const char *username = NULL, *home = NULL, *shell = NULL;
+        uid_t uid = (uid_t) -1;
+        gid_t gid = (gid_t) -1;
+        char _cleanup_strv_free_ **our_env = NULL, **pam_env = NULL,
+                **final_env = NULL, **final_argv = NULL;
+        unsigned n_env = 0;
+        bool set_access = false;
 
         assert(command);
         assert(context);
-        assert(ret);
-        assert(fds || n_fds <= 0);
+        assert(p);
 
-        if (context->std_input == EXEC_INPUT_SOCKET ||
-            context->std_output == EXEC_OUTPUT_SOCKET ||
-            context->std_error == EXEC_OUTPUT_SOCKET) {
+        rename_process_from_path(command->path);
 
-                if (n_fds != 1)
-                        return -EINVAL;
+        /* We reset exactly these signals, since they are the
+         * only ones we set to SIG_IGN in the main daemon. All
+         * others we leave untouched because we set them to
+         * SIG_DFL or a valid handler initially, both of which
+         * will be demoted to SIG_DFL. */
+        default_signals(SIGNALS_CRASH_HANDLER,
+                        SIGNALS_IGNORE, -1);
 
-                socket_fd = fds[0];
+        if (context->ignore_sigpipe)
+                ignore_signals(SIGPIPE, -1);
 
-                fds = NULL;
-                n_fds = 0;
-        } else
-                socket_fd = -1;
+        assert_se(sigemptyset(&ss) == 0);
+        if (sigprocmask(SIG_SETMASK, &ss, NULL) < 0) {
+                err = -errno;
+                r = EXIT_SIGNAL_MASK;
+                goto fail_child;
+        }
 
-        r = exec_context_load_environment(context, &files_env);
-        if (r < 0) {
-                log_struct_unit(LOG_ERR,
-                           unit_id,
-                           "MESSAGE=Failed to load environment files: %s", strerror(-r),
-                           "ERRNO=%d", -r,
-                           NULL);
-                return r;
+        if (p->idle_pipe) {
+                if (p->idle_pipe[1] >= 0)
+                        close_nointr_nofail(p->idle_pipe[1]);
+                if (p->idle_pipe[0] >= 0) {
+                        fd_wait_for_event(p->idle_pipe[0], POLLHUP, IDLE_TIMEOUT_USEC);
+                        close_nointr_nofail(p->idle_pipe[0]);
+                }
         }
 
-        if (!argv)
-                argv = command->argv;
+        /* Close sockets very early to make sure we don't
+         * block init reexecution because it cannot bind its
+         * sockets */
+        log_forget_fds();
+        cgroup_bonding_forget_fds_list(p->cgroup_bondings);
+        err = close_all_fds(p->socket_fd >= 0 ? &p->socket_fd : p->fds,
+                                   p->socket_fd >= 0 ? 1 : p->n_fds);
+        if (err < 0) {
+                r = EXIT_FDS;
+                goto fail_child;
+        }
 
-        line = exec_command_line(argv);
-        if (!line)
-                return log_oom();
+        if (!context->same_pgrp)
+                if (setsid() < 0) {
+                        err = -errno;
+                        r = EXIT_SETSID;
+                        goto fail_child;
+                }
 
-        log_struct_unit(LOG_DEBUG,
-                   unit_id,
-                   "MESSAGE=About to execute %s", line,
-                   NULL);
-        free(line);
+        if (context->tcpwrap_name) {
+                if (p->socket_fd >= 0)
+                        if (!socket_tcpwrap(p->socket_fd, context->tcpwrap_name)) {
+                                err = -EACCES;
+                                r = EXIT_TCPWRAP;
+                                goto fail_child;
+                        }
 
-        r = cgroup_bonding_realize_list(cgroup_bondings);
-        if (r < 0)
-                return r;
+                for (i = 0; i < (int) p->n_fds; i++) {
+                        if (!socket_tcpwrap(p->fds[i], context->tcpwrap_name)) {
+                                err = -EACCES;
+                                r = EXIT_TCPWRAP;
+                                goto fail_child;
+                        }
+                }
+        }
 
-        /* We must initialize the attributes in the parent, before we
-        fork, because we really need them initialized before making
-        the process a member of the group (which we do in both the
-        child and the parent), and we cannot really apply them twice
-        (due to 'append' style attributes) */
-        cgroup_attribute_apply_list(cgroup_attributes, cgroup_bondings);
+        exec_context_tty_reset(context);
 
-        if (context->private_tmp && !context->tmp_dir && !context->var_tmp_dir) {
-                r = setup_tmpdirs(&context->tmp_dir, &context->var_tmp_dir);
-                if (r < 0)
-                        return r;
+        if (p->confirm_spawn) {
+                char response;
+
+                err = ask_for_confirmation(&response, p->argv);
+                if (err == -ETIMEDOUT)
+                        write_confirm_message("Confirmation question timed out, assuming positive response.\n");
+                else if (err < 0)
+                        write_confirm_message("Couldn't ask confirmation question, assuming positive response: %s\n", strerror(-err));
+                else if (response == 's') {
+                        write_confirm_message("Skipping execution.\n");
+                        err = -ECANCELED;
+                        r = EXIT_CONFIRM;
+                        goto fail_child;
+                } else if (response == 'n') {
+                        write_confirm_message("Failing execution.\n");
+                        err = r = 0;
+                        goto fail_child;
+                }
         }
 
-        pid = fork();
-        if (pid < 0)
-                return -errno;
+        /* If a socket is connected to STDIN/STDOUT/STDERR, we
+         * must sure to drop O_NONBLOCK */
+        if (p->socket_fd >= 0)
+                fd_nonblock(p->socket_fd, false);
+
+        err = setup_input(context, p->socket_fd, p->apply_tty_stdin);
+        if (err < 0) {
+                r = EXIT_STDIN;
+                goto fail_child;
+        }
+
+        err = setup_output(context, STDOUT_FILENO, p->socket_fd, path_get_file_name(command->path), p->unit_id, p->apply_tty_stdin);
+        if (err < 0) {
+                r = EXIT_STDOUT;
+                goto fail_child;
+        }
+
+        err = setup_output(context, STDERR_FILENO, p->socket_fd, path_get_file_name(command->path), p->unit_id, p->apply_tty_stdin);
+        if (err < 0) {
+                r = EXIT_STDERR;
+                goto fail_child;
+        }
+
+        if (p->cgroup_bondings) {
+                err = cgroup_bonding_install_list(p->cgroup_bondings, 0, p->cgroup_suffix);
+                if (err < 0) {
+                        r = EXIT_CGROUP;
+                        goto fail_child;
+                }
+        }
 
-        if (pid == 0) {
-                int i, err;
-                sigset_t ss;
-                const char *username = NULL, *home = NULL, *shell = NULL;
-                uid_t uid = (uid_t) -1;
-                gid_t gid = (gid_t) -1;
-                char _cleanup_strv_free_ **our_env = NULL, **pam_env = NULL,
-                        **final_env = NULL, **final_argv = NULL;
-                unsigned n_env = 0;
-                bool set_access = false;
-
-                /* child */
-
-                rename_process_from_path(command->path);
-
-                /* We reset exactly these signals, since they are the
-                 * only ones we set to SIG_IGN in the main daemon. All
-                 * others we leave untouched because we set them to
-                 * SIG_DFL or a valid handler initially, both of which
-                 * will be demoted to SIG_DFL. */
-                default_signals(SIGNALS_CRASH_HANDLER,
-                                SIGNALS_IGNORE, -1);
-
-                if (context->ignore_sigpipe)
-                        ignore_signals(SIGPIPE, -1);
-
-                assert_se(sigemptyset(&ss) == 0);
-                if (sigprocmask(SIG_SETMASK, &ss, NULL) < 0) {
+        if (context->oom_score_adjust_set) {
+                char t[16];
+
+                snprintf(t, sizeof(t), "%i", context->oom_score_adjust);
+                char_array_0(t);
+
+                if (write_string_file("/proc/self/oom_score_adj", t) < 0) {
                         err = -errno;
-                        r = EXIT_SIGNAL_MASK;
+                        r = EXIT_OOM_ADJUST;
                         goto fail_child;
                 }
+        }
 
-                if (idle_pipe) {
-                        if (idle_pipe[1] >= 0)
-                                close_nointr_nofail(idle_pipe[1]);
-                        if (idle_pipe[0] >= 0) {
-                                fd_wait_for_event(idle_pipe[0], POLLHUP, IDLE_TIMEOUT_USEC);
-                                close_nointr_nofail(idle_pipe[0]);
-                        }
+        if (context->nice_set)
+                if (setpriority(PRIO_PROCESS, 0, context->nice) < 0) {
+                        err = -errno;
+                        r = EXIT_NICE;
+                        goto fail_child;
                 }
 
-                /* Close sockets very early to make sure we don't
-                 * block init reexecution because it cannot bind its
-                 * sockets */
-                log_forget_fds();
-                err = close_all_fds(socket_fd >= 0 ? &socket_fd : fds,
-                                           socket_fd >= 0 ? 1 : n_fds);
-                if (err < 0) {
-                        r = EXIT_FDS;
+        if (context->cpu_sched_set) {
+                struct sched_param param = {
+                        .sched_priority = context->cpu_sched_priority,
+                };
+
+                r = sched_setscheduler(0,
+                                       context->cpu_sched_policy |
+                                       (context->cpu_sched_reset_on_fork ?
+                                        SCHED_RESET_ON_FORK : 0),
+                                       &param);
+                if (r < 0) {
+                        err = -errno;
+                        r = EXIT_SETSCHEDULER;
                         goto fail_child;
                 }
+        }
 
-                if (!context->same_pgrp)
-                        if (setsid() < 0) {
-                                err = -errno;
-                                r = EXIT_SETSID;
-                                goto fail_child;
-                        }
+        if (context->cpuset)
+                if (sched_setaffinity(0, CPU_ALLOC_SIZE(context->cpuset_ncpus), context->cpuset) < 0) {
+                        err = -errno;
+                        r = EXIT_CPUAFFINITY;
+                        goto fail_child;
+                }
 
-                if (context->tcpwrap_name) {
-                        if (socket_fd >= 0)
-                                if (!socket_tcpwrap(socket_fd, context->tcpwrap_name)) {
-                                        err = -EACCES;
-                                        r = EXIT_TCPWRAP;
-                                        goto fail_child;
-                                }
+        if (context->ioprio_set)
+                if (ioprio_set(IOPRIO_WHO_PROCESS, 0, context->ioprio) < 0) {
+                        err = -errno;
+                        r = EXIT_IOPRIO;
+                        goto fail_child;
+                }
 
-                        for (i = 0; i < (int) n_fds; i++) {
-                                if (!socket_tcpwrap(fds[i], context->tcpwrap_name)) {
-                                        err = -EACCES;
-                                        r = EXIT_TCPWRAP;
-                                        goto fail_child;
-                                }
-                        }
+        if (context->timer_slack_nsec != (nsec_t) -1)
+                if (prctl(PR_SET_TIMERSLACK, context->timer_slack_nsec) < 0) {
+                        err = -errno;
+                        r = EXIT_TIMERSLACK;
+                        goto fail_child;
                 }
 
-                exec_context_tty_reset(context);
+        if (context->utmp_id)
+                utmp_put_init_process(context->utmp_id, getpid(), getsid(0), context->tty_path);
+
+        if (context->user) {
+                username = context->user;
+                err = get_user_creds(&username, &uid, &gid, &home, &shell);
+                if (err < 0) {
+                        r = EXIT_USER;
+                        goto fail_child;
+                }
 
-                if (confirm_spawn) {
-                        char response;
-
-                        err = ask_for_confirmation(&response, argv);
-                        if (err == -ETIMEDOUT)
-                                write_confirm_message("Confirmation question timed out, assuming positive response.\n");
-                        else if (err < 0)
-                                write_confirm_message("Couldn't ask confirmation question, assuming positive response: %s\n", strerror(-err));
-                        else if (response == 's') {
-                                write_confirm_message("Skipping execution.\n");
-                                err = -ECANCELED;
-                                r = EXIT_CONFIRM;
+                if (is_terminal_input(context->std_input)) {
+                        err = chown_terminal(STDIN_FILENO, uid);
+                        if (err < 0) {
+                                r = EXIT_STDIN;
                                 goto fail_child;
-                        } else if (response == 'n') {
-                                write_confirm_message("Failing execution.\n");
-                                err = r = 0;
+                        }
+                }
+
+                if (p->cgroup_bondings && context->control_group_modify) {
+                        err = cgroup_bonding_set_group_access_list(p->cgroup_bondings, 0755, uid, gid);
+                        if (err >= 0)
+                                err = cgroup_bonding_set_task_access_list(
+                                                p->cgroup_bondings,
+                                                0644,
+                                                uid,
+                                                gid,
+                                                context->control_group_persistent);
+                        if (err < 0) {
+                                r = EXIT_CGROUP;
                                 goto fail_child;
                         }
+
+                        set_access = true;
                 }
+        }
 
-                /* If a socket is connected to STDIN/STDOUT/STDERR, we
-                 * must sure to drop O_NONBLOCK */
-                if (socket_fd >= 0)
-                        fd_nonblock(socket_fd, false);
+        if (p->cgroup_bondings && !set_access && context->control_group_persistent >= 0)  {
+                err = cgroup_bonding_set_task_access_list(
+                                p->cgroup_bondings,
+                                (mode_t) -1,
+                                (uid_t) -1,
+                                (uid_t) -1,
+                                context->control_group_persistent);
+                if (err < 0) {
+                        r = EXIT_CGROUP;
+                        goto fail_child;
+                }
+        }
 
-                err = setup_input(context, socket_fd, apply_tty_stdin);
+        if (p->apply_permissions) {
+                err = enforce_groups(context, username, gid);
                 if (err < 0) {
-                        r = EXIT_STDIN;
+                        r = EXIT_GROUP;
                         goto fail_child;
                 }
+        }
+
+        umask(context->umask);
 
-                err = setup_output(context, STDOUT_FILENO, socket_fd, path_get_file_name(command->path), unit_id, apply_tty_stdin);
+#ifdef HAVE_PAM
+        if (p->apply_permissions && context->pam_name && username) {
+                err = setup_pam(context->pam_name, username, uid, context->tty_path, &pam_env, p->fds, p->n_fds);
                 if (err < 0) {
-                        r = EXIT_STDOUT;
+                        r = EXIT_PAM;
+                        goto fail_child;
+                }
+        }
+#endif
+        if (context->private_network) {
+                if (unshare(CLONE_NEWNET) < 0) {
+                        err = -errno;
+                        r = EXIT_NETWORK;
                         goto fail_child;
                 }
 
-                err = setup_output(context, STDERR_FILENO, socket_fd, path_get_file_name(command->path), unit_id, apply_tty_stdin);
+                loopback_setup();
+        }
+
+        if (strv_length(context->read_write_dirs) > 0 ||
+            strv_length(context->read_only_dirs) > 0 ||
+            strv_length(context->inaccessible_dirs) > 0 ||
+            context->mount_flags != 0 ||
+            context->private_tmp) {
+                err = setup_namespace(context->read_write_dirs,
+                                      context->read_only_dirs,
+                                      context->inaccessible_dirs,
+                                      context->tmp_dir,
+                                      context->var_tmp_dir,
+                                      context->private_tmp,
+                                      context->mount_flags);
                 if (err < 0) {
-                        r = EXIT_STDERR;
+                        r = EXIT_NAMESPACE;
                         goto fail_child;
                 }
+        }
 
-                if (cgroup_bondings) {
-                        err = cgroup_bonding_install_list(cgroup_bondings, 0, cgroup_suffix);
-                        if (err < 0) {
-                                r = EXIT_CGROUP;
+        if (p->apply_chroot) {
+                if (context->root_directory)
+                        if (chroot(context->root_directory) < 0) {
+                                err = -errno;
+                                r = EXIT_CHROOT;
                                 goto fail_child;
                         }
+
+                if (chdir(context->working_directory ? context->working_directory : "/") < 0) {
+                        err = -errno;
+                        r = EXIT_CHDIR;
+                        goto fail_child;
                 }
+        } else {
+                char _cleanup_free_ *d = NULL;
 
-                if (context->oom_score_adjust_set) {
-                        char t[16];
+                if (asprintf(&d, "%s/%s",
+                             context->root_directory ? context->root_directory : "",
+                             context->working_directory ? context->working_directory : "") < 0) {
+                        err = -ENOMEM;
+                        r = EXIT_MEMORY;
+                        goto fail_child;
+                }
 
-                        snprintf(t, sizeof(t), "%i", context->oom_score_adjust);
-                        char_array_0(t);
+                if (chdir(d) < 0) {
+                        err = -errno;
+                        r = EXIT_CHDIR;
+                        goto fail_child;
+                }
+        }
 
-                        if (write_string_file("/proc/self/oom_score_adj", t) < 0) {
+        /* We repeat the fd closing here, to make sure that
+         * nothing is leaked from the PAM modules */
+        err = close_all_fds(p->fds, p->n_fds);
+        if (err >= 0)
+                err = shift_fds(p->fds, p->n_fds);
+        if (err >= 0)
+                err = flags_fds(p->fds, p->n_fds, context->non_blocking);
+        if (err < 0) {
+                r = EXIT_FDS;
+                goto fail_child;
+        }
+
+        if (p->apply_permissions) {
+
+                for (i = 0; i < RLIMIT_NLIMITS; i++) {
+                        if (!context->rlimit[i])
+                                continue;
+
+                        if (setrlimit_closest(i, context->rlimit[i]) < 0) {
                                 err = -errno;
-                                r = EXIT_OOM_ADJUST;
+                                r = EXIT_LIMITS;
                                 goto fail_child;
                         }
                 }
 
-                if (context->nice_set)
-                        if (setpriority(PRIO_PROCESS, 0, context->nice) < 0) {
-                                err = -errno;
-                                r = EXIT_NICE;
+                if (context->capability_bounding_set_drop) {
+                        err = capability_bounding_set_drop(context->capability_bounding_set_drop, false);
+                        if (err < 0) {
+                                r = EXIT_CAPABILITIES;
                                 goto fail_child;
                         }
+                }
 
-                if (context->cpu_sched_set) {
-                        struct sched_param param = {
-                                .sched_priority = context->cpu_sched_priority,
-                        };
-
-                        r = sched_setscheduler(0,
-                                               context->cpu_sched_policy |
-                                               (context->cpu_sched_reset_on_fork ?
-                                                SCHED_RESET_ON_FORK : 0),
-                                               &param);
-                        if (r < 0) {
-                                err = -errno;
-                                r = EXIT_SETSCHEDULER;
+                if (context->user) {
+                        err = enforce_user(context, uid);
+                        if (err < 0) {
+                                r = EXIT_USER;
                                 goto fail_child;
                         }
                 }
 
-                if (context->cpuset)
-                        if (sched_setaffinity(0, CPU_ALLOC_SIZE(context->cpuset_ncpus), context->cpuset) < 0) {
+                /* PR_GET_SECUREBITS is not privileged, while
+                 * PR_SET_SECUREBITS is. So to suppress
+                 * potential EPERMs we'll try not to call
+                 * PR_SET_SECUREBITS unless necessary. */
+                if (prctl(PR_GET_SECUREBITS) != context->secure_bits)
+                        if (prctl(PR_SET_SECUREBITS, context->secure_bits) < 0) {
                                 err = -errno;
-                                r = EXIT_CPUAFFINITY;
+                                r = EXIT_SECUREBITS;
                                 goto fail_child;
                         }
 
-                if (context->ioprio_set)
-                        if (ioprio_set(IOPRIO_WHO_PROCESS, 0, context->ioprio) < 0) {
+                if (context->capabilities)
+                        if (cap_set_proc(context->capabilities) < 0) {
                                 err = -errno;
-                                r = EXIT_IOPRIO;
+                                r = EXIT_CAPABILITIES;
                                 goto fail_child;
                         }
 
-                if (context->timer_slack_nsec != (nsec_t) -1)
-                        if (prctl(PR_SET_TIMERSLACK, context->timer_slack_nsec) < 0) {
+                if (context->no_new_privileges)
+                        if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) {
                                 err = -errno;
-                                r = EXIT_TIMERSLACK;
+                                r = EXIT_NO_NEW_PRIVILEGES;
                                 goto fail_child;
                         }
 
-                if (context->utmp_id)
-                        utmp_put_init_process(context->utmp_id, getpid(), getsid(0), context->tty_path);
-
-                if (context->user) {
-                        username = context->user;
-                        err = get_user_creds(&username, &uid, &gid, &home, &shell);
+                if (context->syscall_filter) {
+                        err = apply_seccomp(context->syscall_filter);
                         if (err < 0) {
-                                r = EXIT_USER;
+                                r = EXIT_SECCOMP;
                                 goto fail_child;
                         }
+                }
+        }
 
-                        if (is_terminal_input(context->std_input)) {
-                                err = chown_terminal(STDIN_FILENO, uid);
-                                if (err < 0) {
-                                        r = EXIT_STDIN;
-                                        goto fail_child;
-                                }
-                        }
+        our_env = new(char*, 8);
+        if (!our_env ||
+            (p->n_fds > 0 && (
+                    asprintf(our_env + n_env++, "LISTEN_PID=%lu", (unsigned long) getpid()) < 0 ||
+                    asprintf(our_env + n_env++, "LISTEN_FDS=%u", p->n_fds) < 0)) ||
+            (home && asprintf(our_env + n_env++, "HOME=%s", home) < 0) ||
+            (username && (
+                    asprintf(our_env + n_env++, "LOGNAME=%s", username) < 0 ||
+                    asprintf(our_env + n_env++, "USER=%s", username) < 0)) ||
+            (shell && asprintf(our_env + n_env++, "SHELL=%s", shell) < 0) ||
+            ((is_terminal_input(context->std_input) ||
+              context->std_output == EXEC_OUTPUT_TTY ||
+              context->std_error == EXEC_OUTPUT_TTY) && (
+                      !(our_env[n_env++] = strdup(default_term_for_tty(tty_path(context))))))) {
+
+                err = -ENOMEM;
+                r = EXIT_MEMORY;
+                goto fail_child;
+        }
 
-                        if (cgroup_bondings && context->control_group_modify) {
-                                err = cgroup_bonding_set_group_access_list(cgroup_bondings, 0755, uid, gid);
-                                if (err >= 0)
-                                        err = cgroup_bonding_set_task_access_list(
-                                                        cgroup_bondings,
-                                                        0644,
-                                                        uid,
-                                                        gid,
-                                                        context->control_group_persistent);
-                                if (err < 0) {
-                                        r = EXIT_CGROUP;
-                                        goto fail_child;
-                                }
+        our_env[n_env++] = NULL;
+        assert(n_env <= 8);
 
-                                set_access = true;
-                        }
-                }
+        final_env = strv_env_merge(5,
+                                   p->environment,
+                                   our_env,
+                                   context->environment,
+                                   p->files_env,
+                                   pam_env,
+                                   NULL);
+        if (!final_env) {
+                err = -ENOMEM;
+                r = EXIT_MEMORY;
+                goto fail_child;
+        }
 
-                if (cgroup_bondings && !set_access && context->control_group_persistent >= 0)  {
-                        err = cgroup_bonding_set_task_access_list(
-                                        cgroup_bondings,
-                                        (mode_t) -1,
-                                        (uid_t) -1,
-                                        (uid_t) -1,
-                                        context->control_group_persistent);
-                        if (err < 0) {
-                                r = EXIT_CGROUP;
-                                goto fail_child;
-                        }
-                }
+        final_argv = replace_env_argv(p->argv, final_env);
+        if (!final_argv) {
+                err = -ENOMEM;
+                r = EXIT_MEMORY;
+                goto fail_child;
+        }
 
-                if (apply_permissions) {
-                        err = enforce_groups(context, username, gid);
-                        if (err < 0) {
-                                r = EXIT_GROUP;
-                                goto fail_child;
-                        }
+        final_env = strv_env_clean(final_env);
+
+        if (_unlikely_(log_get_max_level() >= LOG_PRI(LOG_DEBUG))) {
+                line = exec_command_line(final_argv);
+                if (line) {
+                        log_open();
+                        log_struct_unit(LOG_DEBUG,
+                                        p->unit_id,
+                                        "EXECUTABLE=%s", command->path,
+                                        "MESSAGE=Executing: %s",
+                                        line, NULL);
+                        log_close();
+                        free(line);
+                        line = NULL;
                 }
+        }
+        execve(command->path, final_argv, final_env);
+        err = -errno;
+        r = EXIT_EXEC;
+
+fail_child:
+        if (r != 0) {
+                log_open();
+                log_struct(LOG_ERR, MESSAGE_ID(SD_MESSAGE_SPAWN_FAILED),
+                           "EXECUTABLE=%s", command->path,
+                           "MESSAGE=Failed at step %s spawning %s: %s",
+                                  exit_status_to_string(r, EXIT_STATUS_SYSTEMD),
+                                  command->path, strerror(-err),
+                           "ERRNO=%d", -err,
+                           NULL);
+                log_close();
+        }
 
-                umask(context->umask);
+        _exit(r);
+}
 
-#ifdef HAVE_PAM
-                if (apply_permissions && context->pam_name && username) {
-                        err = setup_pam(context->pam_name, username, uid, context->tty_path, &pam_env, fds, n_fds);
-                        if (err < 0) {
-                                r = EXIT_PAM;
-                                goto fail_child;
-                        }
-                }
-#endif
-                if (context->private_network) {
-                        if (unshare(CLONE_NEWNET) < 0) {
-                                err = -errno;
-                                r = EXIT_NETWORK;
-                                goto fail_child;
-                        }
+/* Stack for the short-lived child that shares our memory until it
+ * executes systemd-executor */
+#define EXECUTOR_CHILD_STACK_SIZE (64U*1024U)
 
-                        loopback_setup();
-                }
+typedef struct ExecutorChild {
+        char **argv;
+        int *keep_fds;
+        unsigned n_keep_fds;
 
-                if (strv_length(context->read_write_dirs) > 0 ||
-                    strv_length(context->read_only_dirs) > 0 ||
-                    strv_length(context->inaccessible_dirs) > 0 ||
-                    context->mount_flags != 0 ||
-                    context->private_tmp) {
-                        err = setup_namespace(context->read_write_dirs,
-                                              context->read_only_dirs,
-                                              context->inaccessible_dirs,
-                                              context->tmp_dir,
-                                              context->var_tmp_dir,
-                                              context->private_tmp,
-                                              context->mount_flags);
-                        if (err < 0) {
-                                r = EXIT_NAMESPACE;
-                                goto fail_child;
-                        }
-                }
+        /* Set by the child if it fails before the executor runs */
+        volatile int error;
+} ExecutorChild;
 
-                if (apply_chroot) {
-                        if (context->root_directory)
-                                if (chroot(context->root_directory) < 0) {
-                                        err = -errno;
-                                        r = EXIT_CHROOT;
-                                        goto fail_child;
-                                }
+static int executor_child(void *userdata) {
+        ExecutorChild *c = userdata;
+        unsigned i;
 
-                        if (chdir(context->working_directory ? context->working_directory : "/") < 0) {
-                                err = -errno;
-                                r = EXIT_CHDIR;
-                                goto fail_child;
-                        }
-                } else {
-                        char _cleanup_free_ *d = NULL;
-
-                        if (asprintf(&d, "%s/%s",
-                                     context->root_directory ? context->root_directory : "",
-                                     context->working_directory ? context->working_directory : "") < 0) {
-                                err = -ENOMEM;
-                                r = EXIT_MEMORY;
-                                goto fail_child;
-                        }
+        /* This runs on our memory while we are suspended, so only
+         * plain system calls here: no allocations, no logging, nothing
+         * that touches global state. The file descriptor table is our
+         * own copy however. */
 
-                        if (chdir(d) < 0) {
-                                err = -errno;
-                                r = EXIT_CHDIR;
-                                goto fail_child;
-                        }
+        for (i = 0; i < c->n_keep_fds; i++)
+                if (fcntl(c->keep_fds[i], F_SETFD, 0) < 0) {
+                        c->error = errno;
+                        _exit(EXIT_FDS);
                 }
 
-                /* We repeat the fd closing here, to make sure that
-                 * nothing is leaked from the PAM modules */
-                err = close_all_fds(fds, n_fds);
-                if (err >= 0)
-                        err = shift_fds(fds, n_fds);
-                if (err >= 0)
-                        err = flags_fds(fds, n_fds, context->non_blocking);
-                if (err < 0) {
-                        r = EXIT_FDS;
-                        goto fail_child;
-                }
+        execve(c->argv[0], c->argv, environ);
 
-                if (apply_permissions) {
+        c->error = errno;
+        _exit(EXIT_EXEC);
+}
 
-                        for (i = 0; i < RLIMIT_NLIMITS; i++) {
-                                if (!context->rlimit[i])
-                                        continue;
+/* Forking PID 1 means copying the page tables of a large process, for
+ * every command we run. Instead, we pass the parameters through a pipe
+ * to systemd-executor, which we start from a child that shares our
+ * memory until the exec, and which then does all the setup the forked
+ * child would do. If the executor cannot be started the caller
+ * falls back to fork(). */
+static int exec_spawn_executor(ExecCommand *command, ExecContext *context, const ExecParameters *p, pid_t *ret) {
+        int _cleanup_close_ read_fd = -1, write_fd = -1;
+        char _cleanup_free_ *buf = NULL;
+        int _cleanup_free_ *keep_fds = NULL;
+        char option[sizeof("--deserialize=") + DECIMAL_STR_MAX(int)];
+        char *argv[] = { (char*) SYSTEMD_EXECUTOR_BINARY_PATH, option, NULL };
+        ExecutorChild child = {
+                .argv = argv,
+        };
+        sigset_t ss, saved_ss;
+        size_t size = 0;
+        unsigned i;
+        void *stack;
+        int pipefd[2];
+        ssize_t l, k;
+        pid_t pid;
+        FILE *f;
+        int r;
 
-                                if (setrlimit_closest(i, context->rlimit[i]) < 0) {
-                                        err = -errno;
-                                        r = EXIT_LIMITS;
-                                        goto fail_child;
-                                }
-                        }
+        assert(command);
+        assert(context);
+        assert(p);
+        assert(ret);
 
-                        if (context->capability_bounding_set_drop) {
-                                err = capability_bounding_set_drop(context->capability_bounding_set_drop, false);
-                                if (err < 0) {
-                                        r = EXIT_CAPABILITIES;
-                                        goto fail_child;
-                                }
-                        }
+        if (access(SYSTEMD_EXECUTOR_BINARY_PATH, X_OK) < 0)
+                return -errno;
 
-                        if (context->user) {
-                                err = enforce_user(context, uid);
-                                if (err < 0) {
-                                        r = EXIT_USER;
-                                        goto fail_child;
-                                }
-                        }
+        f = open_memstream(&buf, &size);
+        if (!f)
+                return -errno;
 
-                        /* PR_GET_SECUREBITS is not privileged, while
-                         * PR_SET_SECUREBITS is. So to suppress
-                         * potential EPERMs we'll try not to call
-                         * PR_SET_SECUREBITS unless necessary. */
-                        if (prctl(PR_GET_SECUREBITS) != context->secure_bits)
-                                if (prctl(PR_SET_SECUREBITS, context->secure_bits) < 0) {
-                                        err = -errno;
-                                        r = EXIT_SECUREBITS;
-                                        goto fail_child;
-                                }
+        r = exec_spawn_serialize(f, command, context, p);
+        if (r >= 0) {
+                fflush(f);
+                if (ferror(f))
+                        r = -ENOMEM;
+        }
+        fclose(f);
+        if (r < 0)
+                return r;
 
-                        if (context->capabilities)
-                                if (cap_set_proc(context->capabilities) < 0) {
-                                        err = -errno;
-                                        r = EXIT_CAPABILITIES;
-                                        goto fail_child;
-                                }
+        /* The whole state is written before the child is started, so
+         * that we never block on the executor */
+        if (pipe2(pipefd, O_CLOEXEC) < 0)
+                return -errno;
 
-                        if (context->no_new_privileges)
-                                if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) {
-                                        err = -errno;
-                                        r = EXIT_NO_NEW_PRIVILEGES;
-                                        goto fail_child;
-                                }
+        read_fd = pipefd[0];
+        write_fd = pipefd[1];
 
-                        if (context->syscall_filter) {
-                                err = apply_seccomp(context->syscall_filter);
-                                if (err < 0) {
-                                        r = EXIT_SECCOMP;
-                                        goto fail_child;
-                                }
-                        }
-                }
+        r = fd_nonblock(write_fd, true);
+        if (r < 0)
+                return r;
 
-                our_env = new(char*, 8);
-                if (!our_env ||
-                    (n_fds > 0 && (
-                            asprintf(our_env + n_env++, "LISTEN_PID=%lu", (unsigned long) getpid()) < 0 ||
-                            asprintf(our_env + n_env++, "LISTEN_FDS=%u", n_fds) < 0)) ||
-                    (home && asprintf(our_env + n_env++, "HOME=%s", home) < 0) ||
-                    (username && (
-                            asprintf(our_env + n_env++, "LOGNAME=%s", username) < 0 ||
-                            asprintf(our_env + n_env++, "USER=%s", username) < 0)) ||
-                    (shell && asprintf(our_env + n_env++, "SHELL=%s", shell) < 0) ||
-                    ((is_terminal_input(context->std_input) ||
-                      context->std_output == EXEC_OUTPUT_TTY ||
-                      context->std_error == EXEC_OUTPUT_TTY) && (
-                              !(our_env[n_env++] = strdup(default_term_for_tty(tty_path(context))))))) {
+        l = write(write_fd, buf, size);
+        if (l < 0) {
+                if (errno != EAGAIN)
+                        return -errno;
 
-                        err = -ENOMEM;
-                        r = EXIT_MEMORY;
-                        goto fail_child;
-                }
+                l = 0;
+        }
 
-                our_env[n_env++] = NULL;
-                assert(n_env <= 8);
-
-                final_env = strv_env_merge(5,
-                                           environment,
-                                           our_env,
-                                           context->environment,
-                                           files_env,
-                                           pam_env,
-                                           NULL);
-                if (!final_env) {
-                        err = -ENOMEM;
-                        r = EXIT_MEMORY;
-                        goto fail_child;
-                }
+        if ((size_t) l < size) {
+                /* Does not fit into the default pipe buffer, try
+                 * to make room for the rest */
+                if (fcntl(write_fd, F_SETPIPE_SZ, size) < 0)
+                        return -ENOBUFS;
 
-                final_argv = replace_env_argv(argv, final_env);
-                if (!final_argv) {
-                        err = -ENOMEM;
-                        r = EXIT_MEMORY;
-                        goto fail_child;
-                }
+                k = write(write_fd, buf + l, size - l);
+                if (k < 0 || (size_t) k != size - l)
+                        return -ENOBUFS;
+        }
 
-                final_env = strv_env_clean(final_env);
-
-                if (_unlikely_(log_get_max_level() >= LOG_PRI(LOG_DEBUG))) {
-                        line = exec_command_line(final_argv);
-                        if (line) {
-                                log_open();
-                                log_struct_unit(LOG_DEBUG,
-                                                unit_id,
-                                                "EXECUTABLE=%s", command->path,
-                                                "MESSAGE=Executing: %s",
-                                                line, NULL);
-                                log_close();
-                                free(line);
-                                line = NULL;
-                        }
-                }
-                execve(command->path, final_argv, final_env);
-                err = -errno;
-                r = EXIT_EXEC;
+        close_nointr_nofail(write_fd);
+        write_fd = -1;
 
-        fail_child:
-                if (r != 0) {
-                        log_open();
-                        log_struct(LOG_ERR, MESSAGE_ID(SD_MESSAGE_SPAWN_FAILED),
-                                   "EXECUTABLE=%s", command->path,
-                                   "MESSAGE=Failed at step %s spawning %s: %s",
-                                          exit_status_to_string(r, EXIT_STATUS_SYSTEMD),
-                                          command->path, strerror(-err),
-                                   "ERRNO=%d", -err,
-                                   NULL);
-                        log_close();
-                }
+        keep_fds = new(int, p->n_fds + 4);
+        if (!keep_fds)
+                return -ENOMEM;
 
-                _exit(r);
+        keep_fds[child.n_keep_fds++] = read_fd;
+        for (i = 0; i < p->n_fds; i++)
+                keep_fds[child.n_keep_fds++] = p->fds[i];
+        if (p->socket_fd >= 0)
+                keep_fds[child.n_keep_fds++] = p->socket_fd;
+        if (p->idle_pipe)
+                for (i = 0; i < 2; i++)
+                        if (p->idle_pipe[i] >= 0)
+                                keep_fds[child.n_keep_fds++] = p->idle_pipe[i];
+        child.keep_fds = keep_fds;
+
+        snprintf(option, sizeof(option), "--deserialize=%i", read_fd);
+        char_array_0(option);
+
+        stack = mmap(NULL, EXECUTOR_CHILD_STACK_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED)
+                return -errno;
+
+        /* No signal handler may run in the child, it would run on our
+         * memory */
+        assert_se(sigfillset(&ss) == 0);
+        assert_se(sigprocmask(SIG_SETMASK, &ss, &saved_ss) == 0);
+
+        pid = clone(executor_child, (uint8_t*) stack + EXECUTOR_CHILD_STACK_SIZE, CLONE_VM|CLONE_VFORK|SIGCHLD, &child);
+        r = pid < 0 ? -errno : 0;
+
+        assert_se(sigprocmask(SIG_SETMASK, &saved_ss, NULL) == 0);
+        munmap(stack, EXECUTOR_CHILD_STACK_SIZE);
+
+        if (r < 0)
+                return r;
+
+        if (child.error != 0) {
+                /* Nothing ran yet, so it is safe to try again */
+                wait_for_terminate(pid, NULL);
+                return -child.error;
         }
 
+        *ret = pid;
+        return 0;
+}
+
+int exec_spawn(ExecCommand *command,
+               char **argv,
+               ExecContext *context,
+               int fds[], unsigned n_fds,
+               char **environment,
+               bool apply_permissions,
+               bool apply_chroot,
+               bool apply_tty_stdin,
+               bool confirm_spawn,
+               CGroupBonding *cgroup_bondings,
+               CGroupAttribute *cgroup_attributes,
+               const char *cgroup_suffix,
+               const char *unit_id,
+               int idle_pipe[2],
+               pid_t *ret) {
+
+        pid_t pid;
+        int r;
+        char *line;
+        int socket_fd;
+        char _cleanup_strv_free_ **files_env = NULL;
+        ExecParameters p;
+        usec_t begin;
+
+        assert(command);
+        assert(context);
+        assert(ret);
+        assert(fds || n_fds <= 0);
+
+        if (context->std_input == EXEC_INPUT_SOCKET ||
+            context->std_output == EXEC_OUTPUT_SOCKET ||
+            context->std_error == EXEC_OUTPUT_SOCKET) {
+
+                if (n_fds != 1)
+                        return -EINVAL;
+
+                socket_fd = fds[0];
+
+                fds = NULL;
+                n_fds = 0;
+        } else
+                socket_fd = -1;
+
+        r = exec_context_load_environment(context, &files_env);
+        if (r < 0) {
+                log_struct_unit(LOG_ERR,
+                           unit_id,
+                           "MESSAGE=Failed to load environment files: %s", strerror(-r),
+                           "ERRNO=%d", -r,
+                           NULL);
+                return r;
+        }
+
+        if (!argv)
+                argv = command->argv;
+
+        line = exec_command_line(argv);
+        if (!line)
+                return log_oom();
+
+        log_struct_unit(LOG_DEBUG,
+                   unit_id,
+                   "MESSAGE=About to execute %s", line,
+                   NULL);
+        free(line);
+
+        r = cgroup_bonding_realize_list(cgroup_bondings);
+        if (r < 0)
+                return r;
+
+        /* We must initialize the attributes in the parent, before we
+        fork, because we really need them initialized before making
+        the process a member of the group (which we do in both the
+        child and the parent), and we cannot really apply them twice
+        (due to 'append' style attributes) */
+        cgroup_attribute_apply_list(cgroup_attributes, cgroup_bondings);
+
+        if (context->private_tmp && !context->tmp_dir && !context->var_tmp_dir) {
+                r = setup_tmpdirs(&context->tmp_dir, &context->var_tmp_dir);
+                if (r < 0)
+                        return r;
+        }
+
+        p = (ExecParameters) {
+                .argv = argv,
+                .environment = environment,
+                .files_env = files_env,
+                .fds = fds,
+                .n_fds = n_fds,
+                .socket_fd = socket_fd,
+                .idle_pipe = idle_pipe,
+                .apply_permissions = apply_permissions,
+                .apply_chroot = apply_chroot,
+                .apply_tty_stdin = apply_tty_stdin,
+                .confirm_spawn = confirm_spawn,
+                .cgroup_bondings = cgroup_bondings,
+                .cgroup_suffix = cgroup_suffix,
+                .unit_id = unit_id,
+        };
+
+        begin = now(CLOCK_MONOTONIC);
+        TRACE2(exec_spawn_begin, unit_id, command->path);
+
+        r = exec_spawn_executor(command, context, &p, &pid);
+        if (r < 0) {
+                if (r != -ENOENT)
+                        log_debug_unit(unit_id,
+                                       "Failed to spawn %s through executor, forking: %s",
+                                       command->path, strerror(-r));
+
+                pid = fork();
+                if (pid < 0)
+                        return -errno;
+
+                if (pid == 0)
+                        exec_child(command, context, &p);
+        }
+
+        profile_add(PROFILE_SPAWN, begin);
+        TRACE3(exec_spawn_end, unit_id, command->path, pid);
+
         log_struct_unit(LOG_DEBUG,
                         unit_id,
                         "MESSAGE=Forked %s as %lu",
@@ -1759,15 +1967,24 @@ int exec_context_load_environment(const ExecContext *c, char ***l) {
                         if (r == NULL)
                                 r = p;
                         else {
-                                char **m;
+                                char **j;
+
+                                /* Move the entries over one by one,
+                                 * rather than copying everything we
+                                 * have so far for each file */
+                                STRV_FOREACH(j, p) {
+                                        if (k >= 0)
+                                                k = strv_env_replace(&r, *j);
+                                        if (k < 0)
+                                                free(*j);
+                                }
 
-                                m = strv_env_merge(2, r, p);
-                                strv_free(r);
-                                strv_free(p);
-                                if (!m)
-                                        return -ENOMEM;
+                                free(p);
 
-                                r = m;
+                                if (k < 0) {
+                                        strv_free(r);
+                                        return k;
+                                }
                         }
                 }
         }
@@ -24,6 +24,7 @@
 typedef struct ExecStatus ExecStatus;
 typedef struct ExecCommand ExecCommand;
 typedef struct ExecContext ExecContext;
+typedef struct ExecParameters ExecParameters;
 
 #include <linux/types.h>
 #include <sys/time.h>
@@ -166,6 +167,28 @@ struct ExecContext {
         bool cpu_sched_set:1;
 };
 
+/* Everything exec_spawn() is passed besides the command and the
+ * context, as needed by the process that sets up the execution */
+struct ExecParameters {
+        char **argv;
+        char **environment;
+        char **files_env;
+
+        int *fds;
+        unsigned n_fds;
+        int socket_fd;
+        int *idle_pipe;
+
+        bool apply_permissions:1;
+        bool apply_chroot:1;
+        bool apply_tty_stdin:1;
+        bool confirm_spawn:1;
+
+        struct CGroupBonding *cgroup_bondings;
+        const char *cgroup_suffix;
+        const char *unit_id;
+};
+
 int exec_spawn(ExecCommand *command,
                char **argv,
                ExecContext *context,
@@ -182,6 +205,8 @@ int exec_spawn(ExecCommand *command,
                int pipe_fd[2],
                pid_t *ret);
 
+void exec_child(ExecCommand *command, ExecContext *context, const ExecParameters *p) _noreturn_;
+
 void exec_command_done(ExecCommand *c);
 void exec_command_done_array(ExecCommand *c, unsigned n);
 
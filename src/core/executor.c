@@ -0,0 +1,72 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "log.h"
+#include "util.h"
+#include "execute.h"
+#include "execute-serialize.h"
+
+/* Started by the manager in place of a forked copy of itself, reads
+ * what to execute from the file descriptor passed and then sets up the
+ * execution environment and executes the command just like the forked
+ * copy would. */
+
+int main(int argc, char *argv[]) {
+        ExecCommand command = {};
+        ExecContext context = {};
+        ExecParameters p = {};
+        const char *e;
+        FILE *f;
+        int fd, r;
+
+        log_parse_environment();
+
+        if (argc != 2 || !(e = startswith(argv[1], "--deserialize="))) {
+                log_error("This program is executed by systemd and should not be called directly.");
+                return EXIT_FAILURE;
+        }
+
+        if (safe_atoi(e, &fd) < 0 || fd < 0) {
+                log_error("Failed to parse file descriptor: %s", e);
+                return EXIT_FAILURE;
+        }
+
+        f = fdopen(fd, "re");
+        if (!f) {
+                log_error("Failed to open serialization: %m");
+                return EXIT_FAILURE;
+        }
+
+        exec_context_init(&context);
+
+        r = exec_spawn_deserialize(f, &command, &context, &p);
+        fclose(f);
+
+        if (r < 0) {
+                log_error("Failed to deserialize execution parameters: %s", strerror(-r));
+                return EXIT_FAILURE;
+        }
+
+        exec_child(&command, &context, &p);
+}
@@ -22,7 +22,6 @@
 #include <assert.h>
 #include <errno.h>
 #include <sys/timerfd.h>
-#include <sys/epoll.h>
 
 #include "systemd/sd-id128.h"
 #include "systemd/sd-messages.h"
@@ -37,6 +36,12 @@
 #include "special.h"
 #include "sync.h"
 #include "virt.h"
+#include "serialize.h"
+#include "trace.h"
+
+/* Job timeouts are usually minutes, elapsing a bit later than asked
+ * for lets them share wakeups */
+#define JOB_TIMEOUT_ACCURACY_USEC USEC_PER_SEC
 
 JobBusClient* job_bus_client_new(DBusConnection *connection, const char *name) {
         JobBusClient *cl;
@@ -107,10 +112,8 @@ void job_free(Job *j) {
         if (j->timer_watch.type != WATCH_INVALID) {
                 assert(j->timer_watch.type == WATCH_JOB_TIMER);
                 assert(j->timer_watch.data.job == j);
-                assert(j->timer_watch.fd >= 0);
 
-                assert_se(epoll_ctl(j->manager->epoll_fd, EPOLL_CTL_DEL, j->timer_watch.fd, NULL) >= 0);
-                close_nointr_nofail(j->timer_watch.fd);
+                manager_unwatch_timer(j->manager, &j->timer_watch);
         }
 
         while ((cl = j->bus_client_list)) {
@@ -219,6 +222,12 @@ Job* job_install(Job *j) {
         log_debug_unit(j->unit->id,
                        "Installed new job %s/%s as %u",
                        j->unit->id, job_type_to_string(j->type), (unsigned) j->id);
+        TRACE3(job_enqueue, j->id, j->unit->id, job_type_to_string(j->type));
+
+        if (j->type == JOB_START || j->type == JOB_RESTART)
+                if (unit_start_latency_begin(j->unit) < 0)
+                        log_oom();
+
         return j;
 }
 
@@ -417,7 +426,7 @@ int job_type_merge_and_collapse(JobType *a, JobType b, Unit *u) {
 }
 
 bool job_is_runnable(Job *j) {
-        Iterator i;
+        unsigned i;
         Unit *other;
 
         assert(j);
@@ -444,7 +453,7 @@ bool job_is_runnable(Job *j) {
                  * dependencies, regardless whether they are
                  * starting or stopping something. */
 
-                SET_FOREACH(other, j->unit->dependencies[UNIT_AFTER], i)
+                UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_AFTER, i)
                         if (other->job)
                                 return false;
         }
@@ -452,7 +461,7 @@ bool job_is_runnable(Job *j) {
         /* Also, if something else is being stopped and we should
          * change state after it, then lets wait. */
 
-        SET_FOREACH(other, j->unit->dependencies[UNIT_BEFORE], i)
+        UNIT_FOREACH_DEPENDENCY(other, j->unit, UNIT_BEFORE, i)
                 if (other->job &&
                     (other->job->type == JOB_STOP ||
                      other->job->type == JOB_RESTART))
@@ -497,9 +506,17 @@ int job_run_and_invalidate(Job *j) {
         if (j->state != JOB_WAITING)
                 return 0;
 
+        TRACE3(job_dispatch, j->id, j->unit->id, job_type_to_string(j->type));
+
+        if (j->type == JOB_START || j->type == JOB_RESTART)
+                unit_start_latency_mark(j->unit, START_TIMESTAMP_DISPATCHED);
+
         if (!job_is_runnable(j))
                 return -EAGAIN;
 
+        if (j->type == JOB_START)
+                unit_start_latency_mark(j->unit, START_TIMESTAMP_RUNNABLE);
+
         j->state = JOB_RUNNING;
         m->n_running_jobs++;
         job_add_to_dbus_queue(j);
@@ -751,7 +768,7 @@ int job_finish_and_invalidate(Job *j, JobResult result, bool recursive) {
         Unit *u;
         Unit *other;
         JobType t;
-        Iterator i;
+        unsigned i;
 
         assert(j);
         assert(j->installed);
@@ -762,6 +779,8 @@ int job_finish_and_invalidate(Job *j, JobResult result, bool recursive) {
 
         j->result = result;
 
+        TRACE4(job_finish, j->id, u->id, job_type_to_string(t), job_result_to_string(result));
+
         if (j->state == JOB_RUNNING)
                 j->manager->n_running_jobs--;
 
@@ -796,19 +815,19 @@ int job_finish_and_invalidate(Job *j, JobResult result, bool recursive) {
                 if (t == JOB_START ||
                     t == JOB_VERIFY_ACTIVE) {
 
-                        SET_FOREACH(other, u->dependencies[UNIT_REQUIRED_BY], i)
+                        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRED_BY, i)
                                 if (other->job &&
                                     (other->job->type == JOB_START ||
                                      other->job->type == JOB_VERIFY_ACTIVE))
                                         job_finish_and_invalidate(other->job, JOB_DEPENDENCY, true);
 
-                        SET_FOREACH(other, u->dependencies[UNIT_BOUND_BY], i)
+                        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BOUND_BY, i)
                                 if (other->job &&
                                     (other->job->type == JOB_START ||
                                      other->job->type == JOB_VERIFY_ACTIVE))
                                         job_finish_and_invalidate(other->job, JOB_DEPENDENCY, true);
 
-                        SET_FOREACH(other, u->dependencies[UNIT_REQUIRED_BY_OVERRIDABLE], i)
+                        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRED_BY_OVERRIDABLE, i)
                                 if (other->job &&
                                     !other->job->override &&
                                     (other->job->type == JOB_START ||
@@ -817,7 +836,7 @@ int job_finish_and_invalidate(Job *j, JobResult result, bool recursive) {
 
                 } else if (t == JOB_STOP) {
 
-                        SET_FOREACH(other, u->dependencies[UNIT_CONFLICTED_BY], i)
+                        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTED_BY, i)
                                 if (other->job &&
                                     (other->job->type == JOB_START ||
                                      other->job->type == JOB_VERIFY_ACTIVE))
@@ -847,10 +866,10 @@ int job_finish_and_invalidate(Job *j, JobResult result, bool recursive) {
 
 finish:
         /* Try to start the next jobs that can be started */
-        SET_FOREACH(other, u->dependencies[UNIT_AFTER], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_AFTER, i)
                 if (other->job)
                         job_add_to_run_queue(other->job);
-        SET_FOREACH(other, u->dependencies[UNIT_BEFORE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BEFORE, i)
                 if (other->job)
                         job_add_to_run_queue(other->job);
 
@@ -860,12 +879,7 @@ finish:
 }
 
 int job_start_timer(Job *j) {
-        struct itimerspec its = {};
-        struct epoll_event ev = {
-                .data.ptr = &j->timer_watch,
-                .events = EPOLLIN,
-        };
-        int fd, r;
+        int r;
 
         if (j->unit->job_timeout <= 0 ||
             j->timer_watch.type == WATCH_JOB_TIMER)
@@ -873,34 +887,17 @@ int job_start_timer(Job *j) {
 
         assert(j->timer_watch.type == WATCH_INVALID);
 
-        if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0) {
-                r = -errno;
-                goto fail;
-        }
-
-        timespec_store(&its.it_value, j->unit->job_timeout);
-
-        if (timerfd_settime(fd, 0, &its, NULL) < 0) {
-                r = -errno;
-                goto fail;
-        }
-
-        if (epoll_ctl(j->manager->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
-                r = -errno;
-                goto fail;
-        }
-
         j->timer_watch.type = WATCH_JOB_TIMER;
-        j->timer_watch.fd = fd;
         j->timer_watch.data.job = j;
 
-        return 0;
-
-fail:
-        if (fd >= 0)
-                close_nointr_nofail(fd);
+        r = manager_watch_timer(j->manager, &j->timer_watch, CLOCK_MONOTONIC, true,
+                                j->unit->job_timeout, JOB_TIMEOUT_ACCURACY_USEC);
+        if (r < 0) {
+                watch_init(&j->timer_watch);
+                return r;
+        }
 
-        return r;
+        return 0;
 }
 
 void job_add_to_run_queue(Job *j) {
@@ -950,54 +947,39 @@ void job_timer_event(Job *j, uint64_t n_elapsed, Watch *w) {
 }
 
 int job_serialize(Job *j, FILE *f, FDSet *fds) {
-        fprintf(f, "job-id=%u\n", j->id);
-        fprintf(f, "job-type=%s\n", job_type_to_string(j->type));
-        fprintf(f, "job-state=%s\n", job_state_to_string(j->state));
-        fprintf(f, "job-override=%s\n", yes_no(j->override));
-        fprintf(f, "job-irreversible=%s\n", yes_no(j->irreversible));
-        fprintf(f, "job-sent-dbus-new-signal=%s\n", yes_no(j->sent_dbus_new_signal));
-        fprintf(f, "job-ignore-order=%s\n", yes_no(j->ignore_order));
+        bool b = j->unit->manager->serialize_binary;
+
+        serialize_item_format(f, b, "job-id", "%u", j->id);
+        serialize_item(f, b, "job-type", job_type_to_string(j->type));
+        serialize_item(f, b, "job-state", job_state_to_string(j->state));
+        serialize_item(f, b, "job-override", yes_no(j->override));
+        serialize_item(f, b, "job-irreversible", yes_no(j->irreversible));
+        serialize_item(f, b, "job-sent-dbus-new-signal", yes_no(j->sent_dbus_new_signal));
+        serialize_item(f, b, "job-ignore-order", yes_no(j->ignore_order));
         /* Cannot save bus clients. Just note the fact that we're losing
          * them. job_send_message() will fallback to broadcasting. */
-        fprintf(f, "job-forgot-bus-clients=%s\n",
-                yes_no(j->forgot_bus_clients || j->bus_client_list));
-        if (j->timer_watch.type == WATCH_JOB_TIMER) {
-                int copy = fdset_put_dup(fds, j->timer_watch.fd);
-                if (copy < 0)
-                        return copy;
-                fprintf(f, "job-timer-watch-fd=%d\n", copy);
-        }
+        serialize_item(f, b, "job-forgot-bus-clients",
+                       yes_no(j->forgot_bus_clients || j->bus_client_list));
+        if (j->timer_watch.type == WATCH_JOB_TIMER)
+                serialize_item_format(f, b, "job-timer-watch-usec", "%llu", (unsigned long long) j->timer_watch.timer_next);
 
         /* End marker */
-        fputc('\n', f);
+        serialize_end(f, b);
         return 0;
 }
 
 int job_deserialize(Job *j, FILE *f, FDSet *fds) {
-        for (;;) {
-                char line[LINE_MAX], *l, *v;
-                size_t k;
-
-                if (!fgets(line, sizeof(line), f)) {
-                        if (feof(f))
-                                return 0;
-                        return -errno;
-                }
+        _cleanup_free_ char *buffer = NULL;
+        size_t allocated = 0;
 
-                char_array_0(line);
-                l = strstrip(line);
-
-                /* End marker */
-                if (l[0] == 0)
-                        return 0;
-
-                k = strcspn(l, "=");
+        for (;;) {
+                char *l, *v;
+                int r;
 
-                if (l[k] == '=') {
-                        l[k] = 0;
-                        v = l+k+1;
-                } else
-                        v = l+k;
+                /* Returns 0 on the end marker and at EOF */
+                r = deserialize_item(f, j->unit->manager->serialize_binary, &buffer, &allocated, &l, &v);
+                if (r <= 0)
+                        return r;
 
                 if (streq(l, "job-id")) {
                         if (safe_atou32(v, &j->id) < 0)
@@ -1046,35 +1028,45 @@ int job_deserialize(Job *j, FILE *f, FDSet *fds) {
                                 log_debug("Failed to parse job forgot_bus_clients flag %s", v);
                         else
                                 j->forgot_bus_clients = j->forgot_bus_clients || b;
+                } else if (streq(l, "job-timer-watch-usec")) {
+                        unsigned long long ull;
+
+                        if (sscanf(v, "%llu", &ull) != 1)
+                                log_debug("Failed to parse job-timer-watch-usec value %s", v);
+                        else {
+                                j->timer_watch.type = WATCH_JOB_TIMER;
+                                j->timer_watch.timer_next = (usec_t) ull;
+                                j->timer_watch.data.job = j;
+                        }
                 } else if (streq(l, "job-timer-watch-fd")) {
+                        struct itimerspec its;
                         int fd;
+
+                        /* Older versions passed us a timerfd */
                         if (safe_atoi(v, &fd) < 0 || fd < 0 || !fdset_contains(fds, fd))
                                 log_debug("Failed to parse job-timer-watch-fd value %s", v);
                         else {
-                                if (j->timer_watch.type == WATCH_JOB_TIMER)
-                                        close_nointr_nofail(j->timer_watch.fd);
+                                fd = fdset_remove(fds, fd);
+
+                                if (timerfd_gettime(fd, &its) < 0)
+                                        zero(its);
 
                                 j->timer_watch.type = WATCH_JOB_TIMER;
-                                j->timer_watch.fd = fdset_remove(fds, fd);
+                                j->timer_watch.timer_next = now(CLOCK_MONOTONIC) + timespec_load(&its.it_value);
                                 j->timer_watch.data.job = j;
+
+                                close_nointr_nofail(fd);
                         }
                 }
         }
 }
 
 int job_coldplug(Job *j) {
-        struct epoll_event ev = {
-                .data.ptr = &j->timer_watch,
-                .events = EPOLLIN,
-        };
-
         if (j->timer_watch.type != WATCH_JOB_TIMER)
                 return 0;
 
-        if (epoll_ctl(j->manager->epoll_fd, EPOLL_CTL_ADD, j->timer_watch.fd, &ev) < 0)
-                return -errno;
-
-        return 0;
+        return manager_watch_timer(j->manager, &j->timer_watch, CLOCK_MONOTONIC, false,
+                                   j->timer_watch.timer_next, 0);
 }
 
 void job_shutdown_magic(Job *j) {
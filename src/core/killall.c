@@ -31,6 +31,10 @@
 
 #define TIMEOUT_USEC (10 * USEC_PER_SEC)
 
+/* How often to look for processes that are gone but were not our
+ * children, and hence were not reaped by us */
+#define SCAN_USEC (50 * USEC_PER_MSEC)
+
 static bool ignore_proc(pid_t pid) {
         char buf[PATH_MAX];
         FILE *f;
@@ -76,18 +80,21 @@ static bool ignore_proc(pid_t pid) {
 }
 
 static void wait_for_children(Set *pids, sigset_t *mask) {
-        usec_t until;
+        usec_t until, scan, n;
 
         assert(mask);
 
         if (set_isempty(pids))
                 return;
 
-        until = now(CLOCK_MONOTONIC) + TIMEOUT_USEC;
+        /* Nothing is gone just yet */
+        n = now(CLOCK_MONOTONIC);
+        scan = n + SCAN_USEC;
+        until = n + TIMEOUT_USEC;
+
         for (;;) {
                 struct timespec ts;
                 int k;
-                usec_t n;
                 void *p;
                 Iterator i;
 
@@ -113,28 +120,36 @@ static void wait_for_children(Set *pids, sigset_t *mask) {
                 }
 
                 /* Now explicitly check who might be remaining, who
-                 * might not be our child. */
-                SET_FOREACH(p, pids, i) {
+                 * might not be our child. With lots of processes
+                 * dying one after the other doing that on every
+                 * SIGCHLD would take time quadratic in their number,
+                 * hence it is done only every now and then. */
+                n = now(CLOCK_MONOTONIC);
+                if (n >= scan) {
+                        SET_FOREACH(p, pids, i) {
 
-                        /* We misuse getpgid as a check whether a
-                         * process still exists. */
-                        if (getpgid((pid_t) PTR_TO_ULONG(p)) >= 0)
-                                continue;
+                                /* We misuse getpgid as a check
+                                 * whether a process still exists. */
+                                if (getpgid((pid_t) PTR_TO_ULONG(p)) >= 0)
+                                        continue;
 
-                        if (errno != ESRCH)
-                                continue;
+                                if (errno != ESRCH)
+                                        continue;
 
-                        set_remove(pids, p);
+                                set_remove(pids, p);
+                        }
+
+                        n = now(CLOCK_MONOTONIC);
+                        scan = n + SCAN_USEC;
                 }
 
                 if (set_isempty(pids))
                         return;
 
-                n = now(CLOCK_MONOTONIC);
                 if (n >= until)
                         return;
 
-                timespec_store(&ts, until - n);
+                timespec_store(&ts, MIN(until, scan) - n);
                 k = sigtimedwait(mask, NULL, &ts);
                 if (k != SIGCHLD) {
 
@@ -30,6 +30,8 @@
 #include "conf-parser.h"
 #include "load-fragment.h"
 #include "conf-files.h"
+#include "load-prefetch.h"
+#include "unit-path-index.h"
 
 static int iterate_dir(Unit *u, const char *path, UnitDependency dependency, char ***strv) {
         _cleanup_closedir_ DIR *d = NULL;
@@ -86,6 +88,17 @@ static int iterate_dir(Unit *u, const char *path, UnitDependency dependency, cha
         return 0;
 }
 
+/* Returns 0 only if the index knows that there is no such directory */
+static int unit_path_exists(Unit *u, const char *unit_path, const char *name, const char *suffix) {
+        _cleanup_free_ char *n = NULL;
+
+        n = strappend(name, suffix);
+        if (!n)
+                return -ENOMEM;
+
+        return manager_unit_path_exists(u->manager, unit_path, n);
+}
+
 static int process_dir(Unit *u, const char *unit_path, const char *name, const char *suffix, UnitDependency dependency, char ***strv) {
         int r;
         char *path;
@@ -99,8 +112,7 @@ static int process_dir(Unit *u, const char *unit_path, const char *name, const c
         if (!path)
                 return -ENOMEM;
 
-        if (u->manager->unit_path_cache &&
-            !set_get(u->manager->unit_path_cache, path))
+        if (unit_path_exists(u, unit_path, name, suffix) == 0)
                 r = 0;
         else
                 r = iterate_dir(u, path, dependency, strv);
@@ -118,16 +130,16 @@ static int process_dir(Unit *u, const char *unit_path, const char *name, const c
                         return -ENOMEM;
 
                 path = strjoin(unit_path, "/", template, suffix, NULL);
-                free(template);
-
-                if (!path)
+                if (!path) {
+                        free(template);
                         return -ENOMEM;
+                }
 
-                if (u->manager->unit_path_cache &&
-                    !set_get(u->manager->unit_path_cache, path))
+                if (unit_path_exists(u, unit_path, template, suffix) == 0)
                         r = 0;
                 else
                         r = iterate_dir(u, path, dependency, strv);
+                free(template);
                 free(path);
 
                 if (r < 0)
@@ -198,9 +210,15 @@ int unit_load_dropin(Unit *u) {
                 return 0;
 
         STRV_FOREACH(f, u->dropin_paths) {
-                r = config_parse(u->id, *f, NULL,
-                                 UNIT_VTABLE(u)->sections, config_item_perf_lookup,
-                                 (void*) load_fragment_gperf_lookup, false, u);
+                const ConfigFile *c;
+
+                r = manager_read_unit_file(u->manager, *f, NULL, NULL, &c);
+                if (r < 0)
+                        return r;
+
+                r = config_file_apply(u->id, c,
+                                      UNIT_VTABLE(u)->sections, config_item_perf_lookup,
+                                      (void*) load_fragment_gperf_lookup, false, u);
                 if (r < 0)
                         return r;
         }
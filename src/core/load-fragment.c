@@ -51,6 +51,8 @@
 #include "path-util.h"
 #include "syscall-list.h"
 #include "env-util.h"
+#include "load-prefetch.h"
+#include "unit-path-index.h"
 
 #ifndef HAVE_SYSV_COMPAT
 int config_parse_warn_compat(const char *unit,
@@ -1275,7 +1277,7 @@ int config_parse_trigger_unit(
         assert(rvalue);
         assert(data);
 
-        if (!set_isempty(u->dependencies[UNIT_TRIGGERS])) {
+        if (unit_first_dependency(u, UNIT_TRIGGERS)) {
                 log_syntax(unit, LOG_ERR, filename, line, EINVAL,
                            "Multiple units to trigger specified, ignoring: %s", rvalue);
                 return 0;
@@ -1367,7 +1369,7 @@ int config_parse_path_spec(const char *unit,
 
         s->path = path_kill_slashes(k);
         s->type = b;
-        s->inotify_fd = -1;
+        watch_init(&s->watch);
 
         LIST_PREPEND(PathSpec, spec, p->specs, s);
 
@@ -1580,8 +1582,7 @@ int config_parse_environ(const char *unit,
                 return log_oom();
 
         FOREACH_WORD_QUOTED(w, l, k, state) {
-                _cleanup_free_ char *n;
-                char **x;
+                char *n;
 
                 n = cunescape_length(w, l);
                 if (!n)
@@ -1590,15 +1591,14 @@ int config_parse_environ(const char *unit,
                 if (!env_assignment_is_valid(n)) {
                         log_syntax(unit, LOG_ERR, filename, line, EINVAL,
                                    "Invalid environment assignment, ignoring: %s", rvalue);
+                        free(n);
                         continue;
                 }
 
-                x = strv_env_set(*env, n);
-                if (!x)
+                if (strv_env_replace(env, n) < 0) {
+                        free(n);
                         return log_oom();
-
-                strv_free(*env);
-                *env = x;
+                }
         }
 
         return 0;
@@ -1903,25 +1903,15 @@ int config_parse_unit_requires_mounts_for(const char *unit,
                                           void *data,
                                           void *userdata) {
 
-        Unit *u = userdata;
-        int r;
-        bool empty_before;
-
         assert(filename);
         assert(lvalue);
         assert(rvalue);
         assert(data);
 
-        empty_before = !u->requires_mounts_for;
-
-        r = config_parse_path_strv(unit, filename, line, section, lvalue, ltype,
-                                   rvalue, data, userdata);
-
-        /* Make it easy to find units with requires_mounts set */
-        if (empty_before && u->requires_mounts_for)
-                LIST_PREPEND(Unit, has_requires_mounts_for, u->manager->has_requires_mounts_for, u);
-
-        return r;
+        /* The paths are indexed in unit_add_mount_links() once the
+         * unit is loaded */
+        return config_parse_path_strv(unit, filename, line, section, lvalue, ltype,
+                                      rvalue, data, userdata);
 }
 
 int config_parse_documentation(const char *unit,
@@ -2211,10 +2201,19 @@ static int load_from_path(Unit *u, const char *path) {
                 }
 
         } else  {
+                uint64_t dirs;
+                bool indexed;
                 char **p;
 
+                /* Ask the index which directories have the file,
+                 * so that we don't have to try them all */
+                indexed = manager_unit_path_lookup(u->manager, path, &dirs) >= 0;
+
                 STRV_FOREACH(p, u->manager->lookup_paths.unit_path) {
 
+                        if (indexed && !(dirs & (UINT64_C(1) << (p - u->manager->lookup_paths.unit_path))))
+                                continue;
+
                         /* Instead of opening the path right away, we manually
                          * follow all symlinks and add their name to our unit
                          * name set while doing so */
@@ -2224,11 +2223,7 @@ static int load_from_path(Unit *u, const char *path) {
                                 goto finish;
                         }
 
-                        if (u->manager->unit_path_cache &&
-                            !set_get(u->manager->unit_path_cache, filename))
-                                r = -ENOENT;
-                        else
-                                r = open_follow(&filename, &f, symlink_names, &id);
+                        r = open_follow(&filename, &f, symlink_names, &id);
 
                         if (r < 0) {
                                 free(filename);
@@ -2271,10 +2266,16 @@ static int load_from_path(Unit *u, const char *path) {
         if (null_or_empty(&st))
                 u->load_state = UNIT_MASKED;
         else {
+                const ConfigFile *c;
+
                 /* Now, parse the file contents */
-                r = config_parse(u->id, filename, f, UNIT_VTABLE(u)->sections,
-                                 config_item_perf_lookup,
-                                 (void*) load_fragment_gperf_lookup, false, u);
+                r = manager_read_unit_file(u->manager, filename, f, &st, &c);
+                if (r < 0)
+                        goto finish;
+
+                r = config_file_apply(u->id, c, UNIT_VTABLE(u)->sections,
+                                      config_item_perf_lookup,
+                                      (void*) load_fragment_gperf_lookup, false, u);
                 if (r < 0)
                         goto finish;
 
@@ -0,0 +1,442 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "load-prefetch.h"
+#include "unit-name.h"
+#include "hashmap.h"
+#include "strv.h"
+#include "log.h"
+#include "util.h"
+
+/* Below this many files starting threads is not worth it */
+#define PREFETCH_FILES_MIN 64
+#define PREFETCH_WORKERS_MAX 8U
+
+typedef struct CachedFile {
+        char *path;
+        ConfigFile *config;
+
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        usec_t mtime;
+} CachedFile;
+
+typedef struct PrefetchQueue {
+        pthread_mutex_t mutex;
+
+        /* What we read last time, for reuse */
+        Hashmap *old;
+
+        CachedFile **files;
+        unsigned n_files;
+        size_t n_allocated;
+        unsigned next;
+} PrefetchQueue;
+
+static void cached_file_free(CachedFile *pf) {
+        if (!pf)
+                return;
+
+        config_file_free(pf->config);
+        free(pf->path);
+        free(pf);
+}
+
+static bool cached_file_is_current(CachedFile *pf, const struct stat *st) {
+        assert(pf);
+        assert(st);
+
+        return pf->config &&
+                pf->dev == st->st_dev &&
+                pf->ino == st->st_ino &&
+                pf->size == st->st_size &&
+                pf->mtime == timespec_load(&st->st_mtim);
+}
+
+static void cached_file_set_stat(CachedFile *pf, const struct stat *st) {
+        assert(pf);
+        assert(st);
+
+        pf->dev = st->st_dev;
+        pf->ino = st->st_ino;
+        pf->size = st->st_size;
+        pf->mtime = timespec_load(&st->st_mtim);
+}
+
+static int queue_add(PrefetchQueue *q, const char *dir, const char *name) {
+        _cleanup_free_ char *path = NULL;
+        CachedFile *pf;
+
+        assert(q);
+        assert(dir);
+        assert(name);
+
+        if (!GREEDY_REALLOC(q->files, q->n_allocated, q->n_files + 1))
+                return -ENOMEM;
+
+        path = strjoin(dir, "/", name, NULL);
+        if (!path)
+                return -ENOMEM;
+
+        /* Take over what we read before, the worker decides whether
+         * it is still current */
+        pf = hashmap_remove(q->old, path);
+        if (!pf) {
+                pf = new0(CachedFile, 1);
+                if (!pf)
+                        return -ENOMEM;
+
+                pf->path = path;
+                path = NULL;
+        }
+
+        q->files[q->n_files++] = pf;
+        return 0;
+}
+
+/* Symlinks are left out, they are followed by load_from_path() and
+ * end up on a regular file in one of the unit directories anyway */
+static bool dirent_is_regular(DIR *d, struct dirent *de) {
+        struct stat st;
+
+        if (de->d_type != DT_UNKNOWN)
+                return de->d_type == DT_REG;
+
+        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return false;
+
+        return S_ISREG(st.st_mode);
+}
+
+static bool dirent_is_directory(DIR *d, struct dirent *de) {
+        struct stat st;
+
+        if (de->d_type != DT_UNKNOWN)
+                return de->d_type == DT_DIR;
+
+        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return false;
+
+        return S_ISDIR(st.st_mode);
+}
+
+static int queue_add_dropins(PrefetchQueue *q, const char *path) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        int r;
+
+        d = opendir(path);
+        if (!d)
+                return errno == ENOENT ? 0 : -errno;
+
+        while ((de = readdir(d))) {
+
+                if (ignore_file(de->d_name) ||
+                    !endswith(de->d_name, ".conf") ||
+                    !dirent_is_regular(d, de))
+                        continue;
+
+                r = queue_add(q, path, de->d_name);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int queue_add_unit_path(PrefetchQueue *q, const char *path) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        int r;
+
+        d = opendir(path);
+        if (!d)
+                return errno == ENOENT ? 0 : -errno;
+
+        while ((de = readdir(d))) {
+
+                if (ignore_file(de->d_name))
+                        continue;
+
+                if (endswith(de->d_name, ".d")) {
+                        _cleanup_free_ char *p = NULL;
+
+                        if (!dirent_is_directory(d, de))
+                                continue;
+
+                        p = strjoin(path, "/", de->d_name, NULL);
+                        if (!p)
+                                return -ENOMEM;
+
+                        r = queue_add_dropins(q, p);
+                } else if (unit_name_is_valid(de->d_name, true) && dirent_is_regular(d, de))
+                        r = queue_add(q, path, de->d_name);
+                else
+                        continue;
+
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+/* Runs on the worker threads: no logging, no manager state */
+static void prefetch_one(CachedFile *pf) {
+        ConfigFile *c;
+        struct stat st;
+        FILE *f;
+        int fd;
+
+        if (pf->config) {
+                if (lstat(pf->path, &st) >= 0 && cached_file_is_current(pf, &st))
+                        return;
+
+                config_file_free(pf->config);
+                pf->config = NULL;
+        }
+
+        fd = open(pf->path, O_RDONLY|O_CLOEXEC|O_NOCTTY|O_NOFOLLOW);
+        if (fd < 0)
+                return;
+
+        if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+                close_nointr_nofail(fd);
+                return;
+        }
+
+        f = fdopen(fd, "re");
+        if (!f) {
+                close_nointr_nofail(fd);
+                return;
+        }
+
+        if (config_file_read(pf->path, f, &c) >= 0) {
+                pf->config = c;
+                cached_file_set_stat(pf, &st);
+        }
+
+        fclose(f);
+}
+
+static void unit_file_cache_free(Hashmap *h) {
+        CachedFile *pf;
+
+        while ((pf = hashmap_steal_first(h)))
+                cached_file_free(pf);
+
+        hashmap_free(h);
+}
+
+static void *prefetch_thread(void *p) {
+        PrefetchQueue *q = p;
+
+        for (;;) {
+                CachedFile *pf = NULL;
+
+                assert_se(pthread_mutex_lock(&q->mutex) == 0);
+                if (q->next < q->n_files)
+                        pf = q->files[q->next++];
+                assert_se(pthread_mutex_unlock(&q->mutex) == 0);
+
+                if (!pf)
+                        break;
+
+                prefetch_one(pf);
+        }
+
+        return NULL;
+}
+
+void manager_prefetch_unit_files(Manager *m) {
+        PrefetchQueue q = {
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+        };
+        pthread_t threads[PREFETCH_WORKERS_MAX];
+        unsigned i, n_threads = 0, n_workers = 0;
+        sigset_t ss, saved_ss;
+        long cpus;
+        char **p;
+        int r;
+
+        assert(m);
+
+        /* Everything still listed in here after the queue is built
+         * is gone from disk */
+        q.old = m->unit_file_cache;
+        m->unit_file_cache = NULL;
+
+        STRV_FOREACH(p, m->lookup_paths.unit_path) {
+                r = queue_add_unit_path(&q, *p);
+                if (r < 0) {
+                        log_warning("Failed to enumerate unit files in %s, not prefetching: %s", *p, strerror(-r));
+                        goto finish;
+                }
+        }
+
+        m->unit_file_cache = hashmap_new(string_hash_func, string_compare_func);
+        if (!m->unit_file_cache) {
+                log_oom();
+                goto finish;
+        }
+
+        hashmap_reserve(m->unit_file_cache, q.n_files);
+
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        /* With only a few files or no second CPU just revalidate
+         * what we have and let the load queue read the rest */
+        if (q.n_files >= PREFETCH_FILES_MIN && cpus > 1)
+                n_workers = MIN((unsigned long) cpus - 1, PREFETCH_WORKERS_MAX);
+        else
+                for (i = 0; i < q.n_files; i++) {
+                        CachedFile *pf = q.files[i];
+                        struct stat st;
+
+                        if (pf->config &&
+                            lstat(pf->path, &st) >= 0 &&
+                            cached_file_is_current(pf, &st))
+                                continue;
+
+                        config_file_free(pf->config);
+                        pf->config = NULL;
+                }
+
+        if (n_workers > 0) {
+                /* Signals are for the main thread */
+                assert_se(sigfillset(&ss) >= 0);
+                assert_se(pthread_sigmask(SIG_SETMASK, &ss, &saved_ss) == 0);
+
+                for (; n_threads < n_workers; n_threads++)
+                        if (pthread_create(threads + n_threads, NULL, prefetch_thread, &q) != 0)
+                                break;
+
+                assert_se(pthread_sigmask(SIG_SETMASK, &saved_ss, NULL) == 0);
+
+                /* If not all threads could be started we simply do
+                 * more work here */
+                prefetch_thread(&q);
+
+                for (i = 0; i < n_threads; i++)
+                        pthread_join(threads[i], NULL);
+        }
+
+        for (i = 0; i < q.n_files; i++) {
+                CachedFile *pf = q.files[i];
+
+                if (!pf->config)
+                        continue;
+
+                if (hashmap_put(m->unit_file_cache, pf->path, pf) < 0)
+                        continue;
+
+                q.files[i] = NULL;
+        }
+
+        log_debug("%u of %u unit files cached, read on %u threads.",
+                  hashmap_size(m->unit_file_cache), q.n_files, n_workers > 0 ? n_threads + 1 : 0);
+
+finish:
+        for (i = 0; i < q.n_files; i++)
+                cached_file_free(q.files[i]);
+        free(q.files);
+
+        unit_file_cache_free(q.old);
+
+        pthread_mutex_destroy(&q.mutex);
+}
+
+void manager_flush_unit_files(Manager *m) {
+        assert(m);
+
+        unit_file_cache_free(m->unit_file_cache);
+        m->unit_file_cache = NULL;
+}
+
+/* Returns the contents of path, read before if the file has not been
+ * changed since, or read now. f and st refer to path, if it was
+ * opened already. */
+int manager_read_unit_file(Manager *m, const char *path, FILE *f, const struct stat *st, const ConfigFile **ret) {
+        CachedFile *pf;
+        ConfigFile *c;
+        struct stat buf;
+        int r;
+
+        assert(m);
+        assert(path);
+        assert(ret);
+
+        if (!st) {
+                if (stat(path, &buf) < 0) {
+                        log_error("Failed to stat configuration file '%s': %m", path);
+                        return -errno;
+                }
+
+                st = &buf;
+        }
+
+        pf = hashmap_get(m->unit_file_cache, path);
+        if (pf && cached_file_is_current(pf, st)) {
+                *ret = pf->config;
+                return 0;
+        }
+
+        r = config_file_read(path, f, &c);
+        if (r < 0) {
+                log_error("Failed to read configuration file '%s': %s", path, strerror(-r));
+                return r;
+        }
+
+        if (!pf) {
+                if (!m->unit_file_cache) {
+                        m->unit_file_cache = hashmap_new(string_hash_func, string_compare_func);
+                        if (!m->unit_file_cache)
+                                goto oom;
+                }
+
+                pf = new0(CachedFile, 1);
+                if (!pf)
+                        goto oom;
+
+                pf->path = strdup(path);
+                if (!pf->path || hashmap_put(m->unit_file_cache, pf->path, pf) < 0) {
+                        cached_file_free(pf);
+                        goto oom;
+                }
+        }
+
+        config_file_free(pf->config);
+        pf->config = c;
+        cached_file_set_stat(pf, st);
+
+        *ret = c;
+        return 0;
+
+oom:
+        config_file_free(c);
+        return log_oom();
+}
@@ -0,0 +1,36 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/stat.h>
+
+#include "manager.h"
+#include "conf-parser.h"
+
+/* Keeps unit files and drop-ins around in the split form read by
+ * config_file_read(), validated by inode, size and mtime, so that a
+ * reload only has to read what changed. Before enumerating, what is
+ * not current is read on a couple of worker threads, so that the load
+ * queue only has to apply the assignments on the main thread. */
+
+void manager_prefetch_unit_files(Manager *m);
+void manager_flush_unit_files(Manager *m);
+
+int manager_read_unit_file(Manager *m, const char *path, FILE *f, const struct stat *st, const ConfigFile **ret);
@@ -97,6 +97,11 @@ static usec_t arg_shutdown_watchdog = 10 * USEC_PER_MINUTE;
 static struct rlimit *arg_default_rlimit[RLIMIT_NLIMITS] = {};
 static uint64_t arg_capability_bounding_set_drop = 0;
 static nsec_t arg_timer_slack_nsec = (nsec_t) -1;
+static usec_t arg_default_timer_accuracy_usec = 1 * USEC_PER_MINUTE;
+static usec_t arg_properties_changed_delay_usec = 0;
+static bool arg_signal_subscribers_only = false;
+static usec_t arg_generator_timeout_usec = DEFAULT_TIMEOUT_USEC;
+static usec_t arg_resource_sampling_usec = 0;
 
 static FILE* serialization = NULL;
 
@@ -647,6 +652,11 @@ static int parse_config_file(void) {
                 { "Manager", "ShutdownWatchdogSec",   config_parse_sec,          0, &arg_shutdown_watchdog   },
                 { "Manager", "CapabilityBoundingSet", config_parse_bounding_set, 0, &arg_capability_bounding_set_drop },
                 { "Manager", "TimerSlackNSec",        config_parse_nsec,         0, &arg_timer_slack_nsec    },
+                { "Manager", "DefaultTimerAccuracySec", config_parse_sec,        0, &arg_default_timer_accuracy_usec },
+                { "Manager", "PropertiesChangedDelaySec", config_parse_sec,      0, &arg_properties_changed_delay_usec },
+                { "Manager", "SignalSubscribersOnly", config_parse_bool,         0, &arg_signal_subscribers_only },
+                { "Manager", "GeneratorTimeoutSec",   config_parse_sec,          0, &arg_generator_timeout_usec },
+                { "Manager", "ResourceSamplingSec",   config_parse_sec,          0, &arg_resource_sampling_usec },
                 { "Manager", "DefaultLimitCPU",       config_parse_limit,        0, &arg_default_rlimit[RLIMIT_CPU]},
                 { "Manager", "DefaultLimitFSIZE",     config_parse_limit,        0, &arg_default_rlimit[RLIMIT_FSIZE]},
                 { "Manager", "DefaultLimitDATA",      config_parse_limit,        0, &arg_default_rlimit[RLIMIT_DATA]},
@@ -1075,7 +1085,9 @@ static int prepare_reexecute(Manager *m, FILE **_f, FDSet **_fds, bool switching
                 goto fail;
         }
 
-        r = manager_serialize(m, f, fds, switching_root);
+        /* The binary we execute might be older than us, hence stick
+         * to the text format here */
+        r = manager_serialize(m, f, fds, switching_root, false);
         if (r < 0) {
                 log_error("Failed to serialize state: %s", strerror(-r));
                 goto fail;
@@ -1616,6 +1628,11 @@ int main(int argc, char *argv[]) {
         m->default_std_error = arg_default_std_error;
         m->runtime_watchdog = arg_runtime_watchdog;
         m->shutdown_watchdog = arg_shutdown_watchdog;
+        m->default_timer_accuracy_usec = arg_default_timer_accuracy_usec;
+        m->properties_changed_delay_usec = arg_properties_changed_delay_usec;
+        m->signal_subscribers_only = arg_signal_subscribers_only;
+        m->generator_timeout_usec = arg_generator_timeout_usec;
+        m->resource_sampling_usec = arg_resource_sampling_usec;
 
         manager_set_default_rlimits(m, arg_default_rlimit);
 
@@ -1720,6 +1737,9 @@ int main(int argc, char *argv[]) {
                 }
         }
 
+        /* Don't stall on a busy journal from here on */
+        log_set_queue(true);
+
         for (;;) {
                 r = manager_loop(m);
                 if (r < 0) {
@@ -1788,6 +1808,10 @@ int main(int argc, char *argv[]) {
         }
 
 finish:
+        /* Hand over what the journal could not take yet, as far as
+         * it goes, before we exec or shut down */
+        log_set_queue(false);
+
         if (m)
                 manager_free(m);
 
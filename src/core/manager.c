@@ -72,6 +72,14 @@
 #include "audit-fd.h"
 #include "efivars.h"
 #include "env-util.h"
+#include "load-prefetch.h"
+#include "unit-path-index.h"
+#include "serialize.h"
+#include "pid-cache.h"
+#include "profile.h"
+#include "def.h"
+#include "condition.h"
+#include "trace.h"
 
 /* As soon as 16 units are in our GC queue, make sure to run a gc sweep */
 #define GC_QUEUE_ENTRIES_MAX 16
@@ -83,6 +91,21 @@
 #define JOBS_IN_PROGRESS_WAIT_SEC 5
 #define JOBS_IN_PROGRESS_PERIOD_SEC 1
 #define JOBS_IN_PROGRESS_PERIOD_DIVISOR 3
+#define JOBS_IN_PROGRESS_ACCURACY_USEC (250*USEC_PER_MSEC)
+
+/* How much of the queued up bulk work is done per iteration of the
+ * main loop, before we look for dying children and notifications
+ * again. Running a job may mean spawning a process, hence the run
+ * queue gets the smallest share. */
+#define RUN_QUEUE_BATCH_MAX 64
+#define DBUS_QUEUE_BATCH_MAX 256
+#define CLEANUP_QUEUE_BATCH_MAX 256
+
+/* How often a unit may repeat the same message, and for how many
+ * units we remember that */
+#define UNIT_LOG_RATELIMIT_INTERVAL (10*USEC_PER_SEC)
+#define UNIT_LOG_RATELIMIT_BURST 5
+#define UNIT_LOG_RATELIMIT_KEYS_MAX 1024
 
 /* Where clients shall send notification messages to */
 #define NOTIFY_SOCKET "@/org/freedesktop/systemd1/notify"
@@ -146,71 +169,42 @@ static int manager_setup_notify(Manager *m) {
 }
 
 static int manager_jobs_in_progress_mod_timer(Manager *m) {
-        struct itimerspec its = {
-                .it_value.tv_sec = JOBS_IN_PROGRESS_WAIT_SEC,
-                .it_interval.tv_sec = JOBS_IN_PROGRESS_PERIOD_SEC,
-        };
-
         if (m->jobs_in_progress_watch.type != WATCH_JOBS_IN_PROGRESS)
                 return 0;
 
-        if (timerfd_settime(m->jobs_in_progress_watch.fd, 0, &its, NULL) < 0)
-                return -errno;
-
-        return 0;
+        return manager_watch_timer(m, &m->jobs_in_progress_watch, CLOCK_MONOTONIC, true,
+                                   JOBS_IN_PROGRESS_WAIT_SEC * USEC_PER_SEC, JOBS_IN_PROGRESS_ACCURACY_USEC);
 }
 
 static int manager_watch_jobs_in_progress(Manager *m) {
-        struct epoll_event ev = {
-                .events = EPOLLIN,
-                .data.ptr = &m->jobs_in_progress_watch,
-        };
         int r;
 
         if (m->jobs_in_progress_watch.type != WATCH_INVALID)
                 return 0;
 
         m->jobs_in_progress_watch.type = WATCH_JOBS_IN_PROGRESS;
-        m->jobs_in_progress_watch.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
-        if (m->jobs_in_progress_watch.fd < 0) {
-                log_error("Failed to create timerfd: %m");
-                r = -errno;
-                goto err;
-        }
 
         r = manager_jobs_in_progress_mod_timer(m);
         if (r < 0) {
                 log_error("Failed to set up timer for jobs progress watch: %s", strerror(-r));
-                goto err;
-        }
-
-        if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, m->jobs_in_progress_watch.fd, &ev) < 0) {
-                log_error("Failed to add jobs progress timer fd to epoll: %m");
-                r = -errno;
-                goto err;
+                watch_init(&m->jobs_in_progress_watch);
+                return r;
         }
 
-        log_debug("Set up jobs progress timerfd.");
+        log_debug("Set up jobs progress timer.");
 
         return 0;
-
-err:
-        if (m->jobs_in_progress_watch.fd >= 0)
-                close_nointr_nofail(m->jobs_in_progress_watch.fd);
-        watch_init(&m->jobs_in_progress_watch);
-        return r;
 }
 
 static void manager_unwatch_jobs_in_progress(Manager *m) {
         if (m->jobs_in_progress_watch.type != WATCH_JOBS_IN_PROGRESS)
                 return;
 
-        assert_se(epoll_ctl(m->epoll_fd, EPOLL_CTL_DEL, m->jobs_in_progress_watch.fd, NULL) >= 0);
-        close_nointr_nofail(m->jobs_in_progress_watch.fd);
+        manager_unwatch_timer(m, &m->jobs_in_progress_watch);
         watch_init(&m->jobs_in_progress_watch);
         m->jobs_in_progress_iteration = 0;
 
-        log_debug("Closed jobs progress timerfd.");
+        log_debug("Disabled jobs progress timer.");
 }
 
 #define CYLON_BUFFER_EXTRA (2*strlen(ANSI_RED_ON) + strlen(ANSI_HIGHLIGHT_RED_ON) + 2*strlen(ANSI_HIGHLIGHT_OFF))
@@ -430,6 +424,7 @@ static void manager_strip_environment(Manager *m) {
 
 int manager_new(SystemdRunningAs running_as, Manager **_m) {
         Manager *m;
+        sd_id128_t boot_id;
         int r = -ENOMEM;
 
         assert(_m);
@@ -454,10 +449,26 @@ int manager_new(SystemdRunningAs running_as, Manager **_m) {
 
         watch_init(&m->signal_watch);
         watch_init(&m->mount_watch);
+        watch_init(&m->mount_timer_watch);
         watch_init(&m->swap_watch);
+        watch_init(&m->path_inotify_watch);
         watch_init(&m->udev_watch);
         watch_init(&m->time_change_watch);
         watch_init(&m->jobs_in_progress_watch);
+        watch_init(&m->proc_events_watch);
+        watch_init(&m->cgroups_agent_watch);
+        watch_init(&m->cgroup_sampling_watch);
+
+        m->timers_monotonic.clock_id = CLOCK_MONOTONIC;
+        watch_init(&m->timers_monotonic.watch);
+        m->timers_realtime.clock_id = CLOCK_REALTIME;
+        watch_init(&m->timers_realtime.watch);
+        m->default_timer_accuracy_usec = USEC_PER_MINUTE;
+        m->generator_timeout_usec = DEFAULT_TIMEOUT_USEC;
+
+        /* Shift the coalescing boundaries by a per-boot offset */
+        if (sd_id128_get_boot(&boot_id) >= 0)
+                m->timer_perturb = (boot_id.qwords[0] ^ boot_id.qwords[1]) % USEC_PER_MINUTE;
 
         m->epoll_fd = m->dev_autofs_fd = -1;
         m->current_job_id = 1; /* start as id #1, so that we can leave #0 around as "null-like" value */
@@ -489,6 +500,12 @@ int manager_new(SystemdRunningAs running_as, Manager **_m) {
         if (!(m->watch_bus = hashmap_new(string_hash_func, string_compare_func)))
                 goto fail;
 
+        m->unit_log_ratelimit = ratelimit_map_new(UNIT_LOG_RATELIMIT_INTERVAL,
+                                                  UNIT_LOG_RATELIMIT_BURST,
+                                                  UNIT_LOG_RATELIMIT_KEYS_MAX);
+        if (!m->unit_log_ratelimit)
+                goto fail;
+
         m->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
         if (m->epoll_fd < 0)
                 goto fail;
@@ -501,6 +518,10 @@ int manager_new(SystemdRunningAs running_as, Manager **_m) {
         if (r < 0)
                 goto fail;
 
+        r = manager_setup_pid_cache(m);
+        if (r < 0)
+                goto fail;
+
         r = manager_setup_notify(m);
         if (r < 0)
                 goto fail;
@@ -530,7 +551,7 @@ static unsigned manager_dispatch_cleanup_queue(Manager *m) {
 
         assert(m);
 
-        while ((u = m->cleanup_queue)) {
+        while ((u = m->cleanup_queue) && n < CLEANUP_QUEUE_BATCH_MAX) {
                 assert(u->in_cleanup_queue);
 
                 unit_free(u);
@@ -549,7 +570,7 @@ enum {
 };
 
 static void unit_gc_sweep(Unit *u, unsigned gc_marker) {
-        Iterator i;
+        unsigned i;
         Unit *other;
         bool is_bad;
 
@@ -570,7 +591,7 @@ static void unit_gc_sweep(Unit *u, unsigned gc_marker) {
 
         is_bad = true;
 
-        SET_FOREACH(other, u->dependencies[UNIT_REFERENCED_BY], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REFERENCED_BY, i) {
                 unit_gc_sweep(other, gc_marker);
 
                 if (other->gc_marker == gc_marker + GC_OFFSET_GOOD)
@@ -683,11 +704,16 @@ void manager_free(Manager *m) {
         /* If we reexecute ourselves, we keep the root cgroup
          * around */
         manager_shutdown_cgroup(m, m->exit_code != MANAGER_REEXECUTE);
+        manager_shutdown_pid_cache(m);
 
         manager_undo_generators(m);
 
         bus_done(m);
 
+        for (c = 0; c < _UNIT_TYPE_MAX; c++)
+                path_trie_free(m->units_by_path[c]);
+        path_trie_free(m->units_requiring_mounts_for);
+
         hashmap_free(m->units);
         hashmap_free(m->jobs);
         hashmap_free(m->watch_pids);
@@ -701,8 +727,13 @@ void manager_free(Manager *m) {
                 close_nointr_nofail(m->notify_watch.fd);
         if (m->time_change_watch.fd >= 0)
                 close_nointr_nofail(m->time_change_watch.fd);
-        if (m->jobs_in_progress_watch.fd >= 0)
-                close_nointr_nofail(m->jobs_in_progress_watch.fd);
+        if (m->timers_monotonic.watch.fd >= 0)
+                close_nointr_nofail(m->timers_monotonic.watch.fd);
+        if (m->timers_realtime.watch.fd >= 0)
+                close_nointr_nofail(m->timers_realtime.watch.fd);
+
+        prioq_free(m->timers_monotonic.prioq);
+        prioq_free(m->timers_realtime.prioq);
 
         free(m->notify_socket);
 
@@ -711,8 +742,12 @@ void manager_free(Manager *m) {
 
         strv_free(m->default_controllers);
 
+        execute_timings_free(m->generator_timings, m->n_generator_timings);
+        ratelimit_map_free(m->unit_log_ratelimit);
+
         hashmap_free(m->cgroup_bondings);
-        set_free_free(m->unit_path_cache);
+        manager_unit_path_index_free(m);
+        manager_flush_unit_files(m);
 
         close_pipe(m->idle_pipe);
 
@@ -731,6 +766,17 @@ int manager_enumerate(Manager *m) {
 
         assert(m);
 
+        /* Read all unit files that changed since last time in
+         * parallel first, so that loading them below only has to
+         * apply what was read */
+        manager_prefetch_unit_files(m);
+
+        /* Most unit files become a unit, make room for all of them
+         * at once */
+        hashmap_reserve(m->units, hashmap_size(m->unit_file_cache));
+
+        manager_unit_path_index_begin(m);
+
         /* Let's ask every type to load all units from disk/kernel
          * that it might know */
         for (c = 0; c < _UNIT_TYPE_MAX; c++)
@@ -739,6 +785,8 @@ int manager_enumerate(Manager *m) {
                                 r = q;
 
         manager_dispatch_load_queue(m);
+
+        manager_unit_path_index_end(m);
         return r;
 }
 
@@ -764,66 +812,6 @@ int manager_coldplug(Manager *m) {
         return r;
 }
 
-static void manager_build_unit_path_cache(Manager *m) {
-        char **i;
-        DIR _cleanup_free_ *d = NULL;
-        int r;
-
-        assert(m);
-
-        set_free_free(m->unit_path_cache);
-
-        m->unit_path_cache = set_new(string_hash_func, string_compare_func);
-        if (!m->unit_path_cache) {
-                log_error("Failed to allocate unit path cache.");
-                return;
-        }
-
-        /* This simply builds a list of files we know exist, so that
-         * we don't always have to go to disk */
-
-        STRV_FOREACH(i, m->lookup_paths.unit_path) {
-                struct dirent *de;
-
-                d = opendir(*i);
-                if (!d) {
-                        if (errno != ENOENT)
-                                log_error("Failed to open directory %s: %m", *i);
-                        continue;
-                }
-
-                while ((de = readdir(d))) {
-                        char *p;
-
-                        if (ignore_file(de->d_name))
-                                continue;
-
-                        p = strjoin(streq(*i, "/") ? "" : *i, "/", de->d_name, NULL);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
-
-                        r = set_put(m->unit_path_cache, p);
-                        if (r < 0) {
-                                free(p);
-                                goto fail;
-                        }
-                }
-
-                closedir(d);
-                d = NULL;
-        }
-
-        return;
-
-fail:
-        log_error("Failed to build unit path cache: %s", strerror(-r));
-
-        set_free_free(m->unit_path_cache);
-        m->unit_path_cache = NULL;
-}
-
 int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
         int r, q;
 
@@ -839,8 +827,6 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
         if (r < 0)
                 return r;
 
-        manager_build_unit_path_cache(m);
-
         /* If we will deserialize make sure that during enumeration
          * this is already known, so we increase the counter here
          * already */
@@ -877,10 +863,12 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
                 m->n_reloading --;
         }
 
+        manager_watch_cgroup_sampling(m);
+
         return r;
 }
 
-int manager_add_job(Manager *m, JobType type, Unit *unit, JobMode mode, bool override, DBusError *e, Job **_ret) {
+static int manager_add_job_internal(Manager *m, JobType type, Unit *unit, JobMode mode, bool override, DBusError *e, Job **_ret) {
         int r;
         Transaction *tr;
 
@@ -921,7 +909,9 @@ int manager_add_job(Manager *m, JobType type, Unit *unit, JobMode mode, bool ove
                         goto tr_abort;
         }
 
+        TRACE3(transaction_activate_begin, unit->id, job_type_to_string(type), job_mode_to_string(mode));
         r = transaction_activate(tr, m, mode, e);
+        TRACE2(transaction_activate_end, unit->id, r);
         if (r < 0)
                 goto tr_abort;
 
@@ -941,6 +931,17 @@ tr_abort:
         return r;
 }
 
+int manager_add_job(Manager *m, JobType type, Unit *unit, JobMode mode, bool override, DBusError *e, Job **_ret) {
+        usec_t begin;
+        int r;
+
+        begin = now(CLOCK_MONOTONIC);
+        r = manager_add_job_internal(m, type, unit, mode, override, e, _ret);
+        profile_add(PROFILE_TRANSACTION, begin);
+
+        return r;
+}
+
 int manager_add_job_by_name(Manager *m, JobType type, const char *name, JobMode mode, bool override, DBusError *e, Job **_ret) {
         Unit *unit;
         int r;
@@ -957,6 +958,95 @@ int manager_add_job_by_name(Manager *m, JobType type, const char *name, JobMode
         return manager_add_job(m, type, unit, mode, override, e, _ret);
 }
 
+static bool unit_settled(Unit *u, UnitActiveState state) {
+        UnitActiveState t;
+
+        if (u->job || u->nop_job)
+                return false;
+
+        t = unit_active_state(u);
+
+        if (state == UNIT_ACTIVE)
+                return t == UNIT_ACTIVE || t == UNIT_RELOADING;
+
+        return t == UNIT_INACTIVE || t == UNIT_FAILED;
+}
+
+/* Enqueues a start job for the unit without building a transaction,
+ * if the transaction is known to collapse to that single job anyway:
+ * the unit has no job installed, everything it requires or wants is
+ * active and everything it conflicts with is inactive, and neither
+ * has a job. Dependencies of those units are not looked at, so units
+ * only pulled in by already active units are not started again as
+ * they would be by a transaction. Returns -EAGAIN if the conditions
+ * are not met, in which case the caller should use
+ * manager_add_job(). */
+int manager_add_start_job_fast(Manager *m, Unit *unit, bool override, Job **_ret) {
+        static const UnitDependency active[] = {
+                UNIT_REQUIRES,
+                UNIT_REQUIRES_OVERRIDABLE,
+                UNIT_REQUISITE,
+                UNIT_REQUISITE_OVERRIDABLE,
+                UNIT_WANTS,
+                UNIT_BINDS_TO
+        };
+        static const UnitDependency inactive[] = {
+                UNIT_CONFLICTS,
+                UNIT_CONFLICTED_BY
+        };
+        unsigned i, k;
+        Unit *other;
+        Job *j;
+        int r;
+
+        assert(m);
+        assert(unit);
+
+        if (unit->load_state != UNIT_LOADED ||
+            unit->job || unit->nop_job ||
+            UNIT_VTABLE(unit)->following_set ||
+            !unit_job_is_applicable(unit, JOB_START))
+                return -EAGAIN;
+
+        for (i = 0; i < ELEMENTSOF(active); i++)
+                UNIT_FOREACH_DEPENDENCY(other, unit, active[i], k)
+                        if (!unit_settled(other, UNIT_ACTIVE))
+                                return -EAGAIN;
+
+        for (i = 0; i < ELEMENTSOF(inactive); i++)
+                UNIT_FOREACH_DEPENDENCY(other, unit, inactive[i], k)
+                        if (!unit_settled(other, UNIT_INACTIVE))
+                                return -EAGAIN;
+
+        j = job_new(unit, JOB_START);
+        if (!j)
+                return -ENOMEM;
+
+        j->override = override;
+
+        r = hashmap_put(m->jobs, UINT32_TO_PTR(j->id), j);
+        if (r < 0) {
+                job_free(j);
+                return r;
+        }
+
+        assert_se(job_install(j) == j);
+
+        job_add_to_run_queue(j);
+        job_add_to_dbus_queue(j);
+        job_start_timer(j);
+        job_shutdown_magic(j);
+
+        log_debug_unit(unit->id,
+                       "Enqueued job %s/%s as %u without transaction", unit->id,
+                       job_type_to_string(JOB_START), (unsigned) j->id);
+
+        if (_ret)
+                *_ret = j;
+
+        return 0;
+}
+
 Job *manager_get_job(Manager *m, uint32_t id) {
         assert(m);
 
@@ -973,6 +1063,7 @@ Unit *manager_get_unit(Manager *m, const char *name) {
 unsigned manager_dispatch_load_queue(Manager *m) {
         Unit *u;
         unsigned n = 0;
+        usec_t begin;
 
         assert(m);
 
@@ -981,6 +1072,7 @@ unsigned manager_dispatch_load_queue(Manager *m) {
                 return 0;
 
         m->dispatching_load_queue = true;
+        begin = now(CLOCK_MONOTONIC);
 
         /* Dispatches the load queue. Takes a unit from the queue and
          * tries to load its data until the queue is empty */
@@ -992,6 +1084,9 @@ unsigned manager_dispatch_load_queue(Manager *m) {
                 n++;
         }
 
+        if (n > 0)
+                profile_add(PROFILE_LOAD_QUEUE, begin);
+
         m->dispatching_load_queue = false;
         return n;
 }
@@ -1112,13 +1207,15 @@ void manager_clear_jobs(Manager *m) {
 unsigned manager_dispatch_run_queue(Manager *m) {
         Job *j;
         unsigned n = 0;
+        usec_t begin;
 
         if (m->dispatching_run_queue)
                 return 0;
 
         m->dispatching_run_queue = true;
+        begin = now(CLOCK_MONOTONIC);
 
-        while ((j = m->run_queue)) {
+        while ((j = m->run_queue) && n < RUN_QUEUE_BATCH_MAX) {
                 assert(j->installed);
                 assert(j->in_run_queue);
 
@@ -1126,6 +1223,9 @@ unsigned manager_dispatch_run_queue(Manager *m) {
                 n++;
         }
 
+        if (n > 0)
+                profile_add(PROFILE_RUN_QUEUE, begin);
+
         m->dispatching_run_queue = false;
 
         if (m->n_running_jobs > 0)
@@ -1134,10 +1234,39 @@ unsigned manager_dispatch_run_queue(Manager *m) {
         return n;
 }
 
+/* Whether to hold back the change signals of units queued now, so
+ * that a unit passing through several states in quick succession is
+ * announced only once */
+static bool manager_delay_dbus_queue(Manager *m) {
+        usec_t t;
+
+        assert(m);
+
+        if (!m->dbus_unit_queue) {
+                m->dbus_unit_queue_deadline = 0;
+                return false;
+        }
+
+        if (m->properties_changed_delay_usec <= 0)
+                return false;
+
+        /* Nobody to tell, drop them right away */
+        if (!bus_has_subscriber(m))
+                return false;
+
+        t = now(CLOCK_MONOTONIC);
+
+        if (m->dbus_unit_queue_deadline <= 0)
+                m->dbus_unit_queue_deadline = t + m->properties_changed_delay_usec;
+
+        return t < m->dbus_unit_queue_deadline;
+}
+
 unsigned manager_dispatch_dbus_queue(Manager *m) {
         Job *j;
-        Unit *u;
+        Unit *u, *next;
         unsigned n = 0;
+        usec_t begin;
 
         assert(m);
 
@@ -1145,92 +1274,173 @@ unsigned manager_dispatch_dbus_queue(Manager *m) {
                 return 0;
 
         m->dispatching_dbus_queue = true;
+        begin = now(CLOCK_MONOTONIC);
 
-        while ((u = m->dbus_unit_queue)) {
-                assert(u->in_dbus_queue);
+        if (manager_delay_dbus_queue(m)) {
+                /* Announcing new units is not delayed, so that
+                 * UnitNew still precedes anything else about them */
+                LIST_FOREACH_SAFE(dbus_queue, u, next, m->dbus_unit_queue) {
+                        assert(u->in_dbus_queue);
 
-                bus_unit_send_change_signal(u);
-                n++;
+                        if (n >= DBUS_QUEUE_BATCH_MAX)
+                                break;
+
+                        if (u->sent_dbus_new_signal)
+                                continue;
+
+                        bus_unit_send_change_signal(u);
+                        n++;
+                }
+        } else {
+                while ((u = m->dbus_unit_queue) && n < DBUS_QUEUE_BATCH_MAX) {
+                        assert(u->in_dbus_queue);
+
+                        bus_unit_send_change_signal(u);
+                        n++;
+                }
+
+                if (!m->dbus_unit_queue)
+                        m->dbus_unit_queue_deadline = 0;
         }
 
-        while ((j = m->dbus_job_queue)) {
+        while ((j = m->dbus_job_queue) && n < DBUS_QUEUE_BATCH_MAX) {
                 assert(j->in_dbus_queue);
 
                 bus_job_send_change_signal(j);
                 n++;
         }
 
+        if (n > 0)
+                profile_add(PROFILE_BUS_SIGNALS, begin);
+
         m->dispatching_dbus_queue = false;
         return n;
 }
 
+/* Notification messages received per recvmmsg() call */
+#define NOTIFY_BATCH_MAX 16
+#define NOTIFY_BUFFER_MAX 4096
+
+static bool notify_is_watchdog_only(const char *buf) {
+        return streq(buf, "WATCHDOG=1") || streq(buf, "WATCHDOG=1\n");
+}
+
 static int manager_process_notify_fd(Manager *m) {
-        ssize_t n;
+        int n, i, j;
 
         assert(m);
 
         for (;;) {
-                char buf[4096];
-                struct iovec iovec = {
-                        .iov_base = buf,
-                        .iov_len = sizeof(buf)-1,
-                };
-
+                char buf[NOTIFY_BATCH_MAX][NOTIFY_BUFFER_MAX];
+                struct iovec iovec[NOTIFY_BATCH_MAX];
                 union {
                         struct cmsghdr cmsghdr;
                         uint8_t buf[CMSG_SPACE(sizeof(struct ucred))];
-                } control = {};
-
-                struct msghdr msghdr = {
-                        .msg_iov = &iovec,
-                        .msg_iovlen = 1,
-                        .msg_control = &control,
-                        .msg_controllen = sizeof(control),
-                };
-                struct ucred *ucred;
-                Unit *u;
-                char _cleanup_strv_free_ **tags = NULL;
-
-                n = recvmsg(m->notify_watch.fd, &msghdr, MSG_DONTWAIT);
-                if (n <= 0) {
-                        if (n == 0)
-                                return -EIO;
+                } control[NOTIFY_BATCH_MAX];
+                struct mmsghdr msgs[NOTIFY_BATCH_MAX];
+
+                /* What the messages of this batch resolved to, so
+                 * that the same sender is looked up only once */
+                pid_t pids[NOTIFY_BATCH_MAX];
+                Unit *units[NOTIFY_BATCH_MAX];
+                bool watchdog[NOTIFY_BATCH_MAX];
+
+                for (i = 0; i < NOTIFY_BATCH_MAX; i++) {
+                        iovec[i].iov_base = buf[i];
+                        iovec[i].iov_len = sizeof(buf[i])-1;
+
+                        zero(control[i]);
+                        zero(msgs[i]);
+                        msgs[i].msg_hdr.msg_iov = &iovec[i];
+                        msgs[i].msg_hdr.msg_iovlen = 1;
+                        msgs[i].msg_hdr.msg_control = &control[i];
+                        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+                }
 
+                n = recvmmsg(m->notify_watch.fd, msgs, NOTIFY_BATCH_MAX, MSG_DONTWAIT, NULL);
+                if (n < 0) {
                         if (errno == EAGAIN || errno == EINTR)
                                 break;
 
                         return -errno;
                 }
 
-                if (msghdr.msg_controllen < CMSG_LEN(sizeof(struct ucred)) ||
-                    control.cmsghdr.cmsg_level != SOL_SOCKET ||
-                    control.cmsghdr.cmsg_type != SCM_CREDENTIALS ||
-                    control.cmsghdr.cmsg_len != CMSG_LEN(sizeof(struct ucred))) {
-                        log_warning("Received notify message without credentials. Ignoring.");
-                        continue;
-                }
+                for (i = 0; i < n; i++) {
+                        struct msghdr *mh = &msgs[i].msg_hdr;
+                        struct ucred *ucred;
+                        Unit *u;
+                        char _cleanup_strv_free_ **tags = NULL;
 
-                ucred = (struct ucred*) CMSG_DATA(&control.cmsghdr);
+                        pids[i] = 0;
+                        units[i] = NULL;
+                        watchdog[i] = false;
 
-                u = hashmap_get(m->watch_pids, LONG_TO_PTR(ucred->pid));
-                if (!u) {
-                        u = cgroup_unit_by_pid(m, ucred->pid);
-                        if (!u) {
-                                log_warning("Cannot find unit for notify message of PID %lu.", (unsigned long) ucred->pid);
+                        if (msgs[i].msg_len <= 0)
+                                return -EIO;
+
+                        if (mh->msg_controllen < CMSG_LEN(sizeof(struct ucred)) ||
+                            control[i].cmsghdr.cmsg_level != SOL_SOCKET ||
+                            control[i].cmsghdr.cmsg_type != SCM_CREDENTIALS ||
+                            control[i].cmsghdr.cmsg_len != CMSG_LEN(sizeof(struct ucred))) {
+                                log_warning("Received notify message without credentials. Ignoring.");
                                 continue;
                         }
-                }
 
-                assert((size_t) n < sizeof(buf));
-                buf[n] = 0;
-                tags = strv_split(buf, "\n\r");
-                if (!tags)
-                        return log_oom();
+                        ucred = (struct ucred*) CMSG_DATA(&control[i].cmsghdr);
+
+                        assert(msgs[i].msg_len < sizeof(buf[i]));
+                        buf[i][msgs[i].msg_len] = 0;
+
+                        pids[i] = ucred->pid;
+                        watchdog[i] = notify_is_watchdog_only(buf[i]);
+
+                        for (j = 0; j < i; j++)
+                                if (pids[j] == ucred->pid)
+                                        break;
+
+                        if (j < i) {
+                                /* Already warned about */
+                                if (!units[j])
+                                        continue;
+
+                                units[i] = units[j];
+
+                                /* Watchdog keep-alive pings sent
+                                 * faster than we process them are
+                                 * all the same to the service */
+                                if (watchdog[i]) {
+                                        for (; j < i; j++)
+                                                if (pids[j] == ucred->pid && watchdog[j])
+                                                        break;
 
-                log_debug_unit(u->id, "Got notification message for unit %s", u->id);
+                                        if (j < i)
+                                                continue;
+                                }
+                        } else {
+                                units[i] = hashmap_get(m->watch_pids, LONG_TO_PTR(ucred->pid));
+                                if (!units[i])
+                                        units[i] = pid_cache_get_unit(m, ucred->pid);
+                                if (!units[i]) {
+                                        log_warning("Cannot find unit for notify message of PID %lu.", (unsigned long) ucred->pid);
+                                        continue;
+                                }
+                        }
+
+                        u = units[i];
+
+                        tags = strv_split(buf[i], "\n\r");
+                        if (!tags)
+                                return log_oom();
+
+                        log_debug_unit(u->id, "Got notification message for unit %s", u->id);
+
+                        if (UNIT_VTABLE(u)->notify_message)
+                                UNIT_VTABLE(u)->notify_message(u, ucred->pid, tags);
+                }
 
-                if (UNIT_VTABLE(u)->notify_message)
-                        UNIT_VTABLE(u)->notify_message(u, ucred->pid, tags);
+                /* Anything short of a full batch drained the socket */
+                if (n < NOTIFY_BATCH_MAX)
+                        break;
         }
 
         return 0;
@@ -1279,7 +1489,7 @@ static int manager_dispatch_sigchld(Manager *m) {
                 /* And now figure out the unit this belongs to */
                 u = hashmap_get(m->watch_pids, LONG_TO_PTR(si.si_pid));
                 if (!u)
-                        u = cgroup_unit_by_pid(m, si.si_pid);
+                        u = pid_cache_get_unit(m, si.si_pid);
 
                 /* And now, we actually reap the zombie. */
                 if (waitid(P_PID, si.si_pid, &si, WEXITED) < 0) {
@@ -1289,6 +1499,8 @@ static int manager_dispatch_sigchld(Manager *m) {
                         return -errno;
                 }
 
+                pid_cache_forget(m, si.si_pid);
+
                 if (si.si_code != CLD_EXITED && si.si_code != CLD_KILLED && si.si_code != CLD_DUMPED)
                         continue;
 
@@ -1555,6 +1767,254 @@ static int manager_process_signal_fd(Manager *m) {
         return 0;
 }
 
+static int timer_compare(const void *a, const void *b) {
+        const Watch *x = a, *y = b;
+
+        if (x->timer_next < y->timer_next)
+                return -1;
+
+        if (x->timer_next > y->timer_next)
+                return 1;
+
+        return 0;
+}
+
+/* Rounds next up to a boundary at most accuracy away, so that timers
+ * which tolerate some slack elapse together and wake us up less often.
+ * The boundaries are shifted by a per-boot offset, so that not all
+ * machines on a network wake up at the same time. */
+static usec_t timer_coalesce(Manager *m, usec_t next, usec_t accuracy) {
+        static const usec_t granularity[] = {
+                USEC_PER_MINUTE,
+                10 * USEC_PER_SEC,
+                USEC_PER_SEC,
+                250 * USEC_PER_MSEC,
+        };
+        unsigned i;
+
+        for (i = 0; i < ELEMENTSOF(granularity); i++) {
+                usec_t g = granularity[i], c;
+
+                if (g > accuracy)
+                        continue;
+
+                c = (g + m->timer_perturb % g - next % g) % g;
+                if (next > (usec_t) -1 - c)
+                        break;
+
+                return next + c;
+        }
+
+        return next;
+}
+
+static TimerQueue *manager_get_timer_queue(Manager *m, clockid_t clock_id) {
+        assert(m);
+
+        switch (clock_id) {
+
+        case CLOCK_MONOTONIC:
+                return &m->timers_monotonic;
+
+        case CLOCK_REALTIME:
+                return &m->timers_realtime;
+
+        default:
+                assert_not_reached("Unsupported timer clock");
+        }
+}
+
+static int timer_queue_setup(Manager *m, TimerQueue *q) {
+        struct epoll_event ev = {
+                .events = EPOLLIN,
+                .data.ptr = &q->watch,
+        };
+        int r;
+
+        assert(m);
+        assert(q);
+
+        if (q->watch.type == WATCH_TIMER_QUEUE)
+                return 0;
+
+        r = prioq_ensure_allocated(&q->prioq, timer_compare);
+        if (r < 0)
+                return r;
+
+        q->watch.fd = timerfd_create(q->clock_id, TFD_NONBLOCK|TFD_CLOEXEC);
+        if (q->watch.fd < 0)
+                return -errno;
+
+        if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, q->watch.fd, &ev) < 0) {
+                r = -errno;
+                close_nointr_nofail(q->watch.fd);
+                q->watch.fd = -1;
+                return r;
+        }
+
+        q->watch.type = WATCH_TIMER_QUEUE;
+        q->watch.data.timer_queue = q;
+        q->armed = 0;
+
+        return 0;
+}
+
+static int timer_queue_rearm(TimerQueue *q) {
+        struct itimerspec its = {};
+        Watch *w;
+        usec_t next;
+
+        assert(q);
+
+        w = prioq_peek(q->prioq);
+        if (!w)
+                return 0;
+
+        /* If we are going to wake up earlier anyway there is no
+         * need for a syscall, we'll rearm then */
+        if (q->armed > 0 && q->armed <= w->timer_next)
+                return 0;
+
+        /* Set absolute time in the past, but not 0, since we don't
+         * want to disarm the timer */
+        next = MAX(w->timer_next, (usec_t) 1);
+        timespec_store(&its.it_value, next);
+
+        if (timerfd_settime(q->watch.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+                return -errno;
+
+        q->armed = next;
+        return 0;
+}
+
+int manager_watch_timer(Manager *m, Watch *w, clockid_t clock_id, bool relative, usec_t usec, usec_t accuracy) {
+        TimerQueue *q;
+        usec_t next;
+        int r;
+
+        assert(m);
+        assert(w);
+
+        /* Queues up w to elapse at usec. The type and data of w are
+         * set by the caller and decide how the elapse is dispatched.
+         * If w is queued already, it is moved. */
+
+        q = manager_get_timer_queue(m, clock_id);
+
+        r = timer_queue_setup(m, q);
+        if (r < 0)
+                return r;
+
+        if (usec <= 0)
+                next = 0;
+        else if (relative) {
+                usec_t n = now(clock_id);
+
+                next = usec > (usec_t) -1 - n ? (usec_t) -1 : n + usec;
+        } else
+                next = usec;
+
+        next = timer_coalesce(m, next, accuracy);
+
+        if (w->timer_queued && w->timer_clock != clock_id)
+                manager_unwatch_timer(m, w);
+
+        w->fd = -1;
+        w->timer_next = next;
+        w->timer_clock = clock_id;
+
+        if (w->timer_queued)
+                assert_se(prioq_reshuffle(q->prioq, w, &w->timer_idx) >= 0);
+        else {
+                r = prioq_put(q->prioq, w, &w->timer_idx);
+                if (r < 0)
+                        return r;
+
+                w->timer_queued = true;
+        }
+
+        return timer_queue_rearm(q);
+}
+
+void manager_unwatch_timer(Manager *m, Watch *w) {
+        assert(m);
+        assert(w);
+
+        if (!w->timer_queued)
+                return;
+
+        /* We don't bother with disarming the timerfd, if the watch
+         * was the next one to elapse we'll simply wake up for
+         * nothing once */
+        prioq_remove(manager_get_timer_queue(m, w->timer_clock)->prioq, w, &w->timer_idx);
+        w->timer_queued = false;
+}
+
+static void manager_dispatch_timer(Manager *m, Watch *w) {
+        assert(m);
+        assert(w);
+
+        switch (w->type) {
+
+        case WATCH_UNIT_TIMER:
+                UNIT_VTABLE(w->data.unit)->timer_event(w->data.unit, 1, w);
+                break;
+
+        case WATCH_JOB_TIMER:
+                job_timer_event(w->data.job, 1, w);
+                break;
+
+        case WATCH_DBUS_TIMEOUT:
+                bus_timeout_event(m, w, EPOLLIN);
+                break;
+
+        case WATCH_MOUNT_TIMER:
+                /* The coalescing window for mount table changes is over */
+                mount_table_timer_event(m);
+                break;
+
+        case WATCH_JOBS_IN_PROGRESS:
+                manager_watch_timer(m, w, CLOCK_MONOTONIC, true,
+                                    JOBS_IN_PROGRESS_PERIOD_SEC * USEC_PER_SEC, JOBS_IN_PROGRESS_ACCURACY_USEC);
+                manager_print_jobs_in_progress(m);
+                break;
+
+        case WATCH_CGROUP_SAMPLING:
+                manager_dispatch_cgroup_sampling(m);
+                break;
+
+        default:
+                log_error("timer type=%i", w->type);
+                assert_not_reached("Unknown timer watch type.");
+        }
+}
+
+static int manager_dispatch_timer_queue(Manager *m, TimerQueue *q) {
+        uint64_t v;
+        usec_t n;
+        Watch *w;
+
+        assert(m);
+        assert(q);
+
+        /* not interested in the data */
+        read(q->watch.fd, &v, sizeof(v));
+
+        q->armed = 0;
+        n = now(q->clock_id);
+
+        /* The handlers may queue, move or free other timer watches,
+         * and free this one, hence take it off the queue first */
+        while ((w = prioq_peek(q->prioq)) && w->timer_next <= n) {
+                assert_se(prioq_pop(q->prioq) == w);
+                w->timer_queued = false;
+
+                manager_dispatch_timer(m, w);
+        }
+
+        return timer_queue_rearm(q);
+}
+
 static int process_event(Manager *m, struct epoll_event *ev) {
         int r;
         Watch *w;
@@ -1597,34 +2057,40 @@ static int process_event(Manager *m, struct epoll_event *ev) {
                 UNIT_VTABLE(w->data.unit)->fd_event(w->data.unit, w->fd, ev->events, w);
                 break;
 
-        case WATCH_UNIT_TIMER:
-        case WATCH_JOB_TIMER: {
-                uint64_t v;
-                ssize_t k;
+        case WATCH_TIMER_QUEUE:
+                /* Some timers elapsed, to be dispatched to their watches */
+                r = manager_dispatch_timer_queue(m, w->data.timer_queue);
+                if (r < 0)
+                        return r;
 
-                /* Some timer event, to be dispatched to the units */
-                k = read(w->fd, &v, sizeof(v));
-                if (k != sizeof(v)) {
+                break;
 
-                        if (k < 0 && (errno == EINTR || errno == EAGAIN))
-                                break;
+        case WATCH_PROC_EVENTS:
+                /* Processes forked or exited, for the PID cache */
+                r = manager_dispatch_proc_events(m);
+                if (r < 0)
+                        return r;
 
-                        log_error("Failed to read timer event counter: %s", k < 0 ? strerror(-k) : "Short read");
-                        return k < 0 ? -errno : -EIO;
-                }
+                break;
+
+        case WATCH_CGROUPS_AGENT:
+                /* Some cgroups ran empty */
+                r = manager_dispatch_cgroups_agent(m);
+                if (r < 0)
+                        return r;
 
-                if (w->type == WATCH_UNIT_TIMER)
-                        UNIT_VTABLE(w->data.unit)->timer_event(w->data.unit, v, w);
-                else
-                        job_timer_event(w->data.job, v, w);
                 break;
-        }
 
         case WATCH_MOUNT:
                 /* Some mount table change, intended for the mount subsystem */
                 mount_fd_event(m, ev->events);
                 break;
 
+        case WATCH_PATH_INOTIFY:
+                /* Some file system change, intended for the path specs */
+                path_inotify_fd_event(m, ev->events);
+                break;
+
         case WATCH_SWAP:
                 /* Some swap table change, intended for the swap subsystem */
                 swap_fd_event(m, ev->events);
@@ -1639,10 +2105,6 @@ static int process_event(Manager *m, struct epoll_event *ev) {
                 bus_watch_event(m, w, ev->events);
                 break;
 
-        case WATCH_DBUS_TIMEOUT:
-                bus_timeout_event(m, w, ev->events);
-                break;
-
         case WATCH_TIME_CHANGE: {
                 Unit *u;
                 Iterator i;
@@ -1667,16 +2129,6 @@ static int process_event(Manager *m, struct epoll_event *ev) {
                 break;
         }
 
-        case WATCH_JOBS_IN_PROGRESS: {
-                uint64_t v;
-
-                /* not interested in the data */
-                read(w->fd, &v, sizeof(v));
-
-                manager_print_jobs_in_progress(m);
-                break;
-        }
-
         default:
                 log_error("event type=%i", w->type);
                 assert_not_reached("Unknown epoll event type.");
@@ -1685,7 +2137,23 @@ static int process_event(Manager *m, struct epoll_event *ev) {
         return 0;
 }
 
+/* Between the batches of bulk work, take care of what should not
+ * wait for all of it: notifications, so that READY=1 and WATCHDOG=1
+ * are seen in time, and dying children */
+static int manager_dispatch_urgent(Manager *m) {
+        int r;
+
+        assert(m);
+
+        r = manager_process_notify_fd(m);
+        if (r < 0)
+                return r;
+
+        return manager_dispatch_sigchld(m);
+}
+
 int manager_loop(Manager *m) {
+        usec_t busy = 0;
         int r;
 
         RATELIMIT_DEFINE(rl, 1*USEC_PER_SEC, 50000);
@@ -1693,10 +2161,6 @@ int manager_loop(Manager *m) {
         assert(m);
         m->exit_code = MANAGER_RUNNING;
 
-        /* Release the path cache */
-        set_free_free(m->unit_path_cache);
-        m->unit_path_cache = NULL;
-
         manager_check_finished(m);
 
         /* There might still be some zombies hanging around from
@@ -1709,6 +2173,7 @@ int manager_loop(Manager *m) {
                 struct epoll_event event;
                 int n;
                 int wait_msec = -1;
+                usec_t begin;
 
                 if (m->runtime_watchdog > 0 && m->running_as == SYSTEMD_SYSTEM)
                         watchdog_ping();
@@ -1723,8 +2188,15 @@ int manager_loop(Manager *m) {
                 if (manager_dispatch_load_queue(m) > 0)
                         continue;
 
-                if (manager_dispatch_run_queue(m) > 0)
+                if (manager_dispatch_run_queue(m) > 0) {
+                        if (m->run_queue) {
+                                r = manager_dispatch_urgent(m);
+                                if (r < 0)
+                                        return r;
+                        }
+
                         continue;
+                }
 
                 if (bus_dispatch(m) > 0)
                         continue;
@@ -1735,8 +2207,15 @@ int manager_loop(Manager *m) {
                 if (manager_dispatch_gc_queue(m) > 0)
                         continue;
 
-                if (manager_dispatch_dbus_queue(m) > 0)
+                if (manager_dispatch_dbus_queue(m) > 0) {
+                        if (m->dbus_unit_queue || m->dbus_job_queue) {
+                                r = manager_dispatch_urgent(m);
+                                if (r < 0)
+                                        return r;
+                        }
+
                         continue;
+                }
 
                 if (swap_dispatch_reload(m) > 0)
                         continue;
@@ -1749,7 +2228,33 @@ int manager_loop(Manager *m) {
                 } else
                         wait_msec = -1;
 
+                /* Wake up for the held back change signals */
+                if (m->dbus_unit_queue && m->dbus_unit_queue_deadline > 0) {
+                        usec_t t = now(CLOCK_MONOTONIC);
+                        int k;
+
+                        k = t >= m->dbus_unit_queue_deadline ? 0 :
+                                (int) ((m->dbus_unit_queue_deadline - t + USEC_PER_MSEC - 1) / USEC_PER_MSEC);
+
+                        if (wait_msec < 0 || k < wait_msec)
+                                wait_msec = k;
+                }
+
+                /* Come back for the log messages the journal could
+                 * not take yet */
+                if (log_flush() < 0 && (wait_msec < 0 || wait_msec > LOG_FLUSH_RETRY_MSEC))
+                        wait_msec = LOG_FLUSH_RETRY_MSEC;
+
+                /* All that was done since we last woke up, i.e. how
+                 * long an event might have had to wait for us */
+                if (busy > 0)
+                        profile_add(PROFILE_LOOP_ITERATION, busy);
+
+                TRACE1(loop_wait, wait_msec);
                 n = epoll_wait(m->epoll_fd, &event, 1, wait_msec);
+                busy = now(CLOCK_MONOTONIC);
+                TRACE1(loop_wakeup, n);
+
                 if (n < 0) {
 
                         if (errno == EINTR)
@@ -1761,9 +2266,13 @@ int manager_loop(Manager *m) {
 
                 assert(n == 1);
 
+                begin = busy;
+
                 r = process_event(m, &event);
                 if (r < 0)
                         return r;
+
+                profile_add(PROFILE_EVENT, begin);
         }
 
         return m->exit_code;
@@ -2004,7 +2513,7 @@ int manager_open_serialization(Manager *m, FILE **_f) {
         return 0;
 }
 
-int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
+int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root, bool binary) {
         Iterator i;
         Unit *u;
         const char *t;
@@ -2015,34 +2524,46 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
         assert(f);
         assert(fds);
 
+        r = serialize_header(f, binary);
+        if (r < 0)
+                return r;
+
         m->n_reloading ++;
+        m->serialize_binary = binary;
 
-        fprintf(f, "current-job-id=%i\n", m->current_job_id);
-        fprintf(f, "taint-usr=%s\n", yes_no(m->taint_usr));
-        fprintf(f, "n-installed-jobs=%u\n", m->n_installed_jobs);
-        fprintf(f, "n-failed-jobs=%u\n", m->n_failed_jobs);
+        serialize_item_format(f, binary, "current-job-id", "%i", m->current_job_id);
+        serialize_item(f, binary, "taint-usr", yes_no(m->taint_usr));
+        serialize_item_format(f, binary, "n-installed-jobs", "%u", m->n_installed_jobs);
+        serialize_item_format(f, binary, "n-failed-jobs", "%u", m->n_failed_jobs);
 
-        dual_timestamp_serialize(f, "firmware-timestamp", &m->firmware_timestamp);
-        dual_timestamp_serialize(f, "kernel-timestamp", &m->kernel_timestamp);
-        dual_timestamp_serialize(f, "loader-timestamp", &m->loader_timestamp);
-        dual_timestamp_serialize(f, "initrd-timestamp", &m->initrd_timestamp);
+        serialize_dual_timestamp(f, binary, "firmware-timestamp", &m->firmware_timestamp);
+        serialize_dual_timestamp(f, binary, "kernel-timestamp", &m->kernel_timestamp);
+        serialize_dual_timestamp(f, binary, "loader-timestamp", &m->loader_timestamp);
+        serialize_dual_timestamp(f, binary, "initrd-timestamp", &m->initrd_timestamp);
 
         if (!in_initrd()) {
-                dual_timestamp_serialize(f, "userspace-timestamp", &m->userspace_timestamp);
-                dual_timestamp_serialize(f, "finish-timestamp", &m->finish_timestamp);
+                serialize_dual_timestamp(f, binary, "userspace-timestamp", &m->userspace_timestamp);
+                serialize_dual_timestamp(f, binary, "finish-timestamp", &m->finish_timestamp);
         }
 
         if (!switching_root) {
                 STRV_FOREACH(e, m->environment) {
-                        _cleanup_free_ char *ce;
+                        _cleanup_free_ char *ce = NULL;
+
+                        /* The binary format is length framed, no
+                         * need to escape anything */
+                        if (binary) {
+                                serialize_item(f, true, "env", *e);
+                                continue;
+                        }
 
                         ce = cescape(*e);
                         if (ce)
-                                fprintf(f, "env=%s\n", *e);
+                                serialize_item(f, false, "env", ce);
                 }
         }
 
-        fputc('\n', f);
+        serialize_end(f, binary);
 
         HASHMAP_FOREACH_KEY(u, t, m->units, i) {
                 if (u->id != t)
@@ -2052,8 +2573,7 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
                         continue;
 
                 /* Start marker */
-                fputs(u->id, f);
-                fputc('\n', f);
+                serialize_item(f, binary, u->id, NULL);
 
                 if ((r = unit_serialize(u, f, fds, !switching_root)) < 0) {
                         m->n_reloading --;
@@ -2075,6 +2595,9 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
 }
 
 int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
+        _cleanup_free_ char *buffer = NULL;
+        size_t allocated = 0;
+        char *l, *v;
         int r = 0;
 
         assert(m);
@@ -2082,77 +2605,76 @@ int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
 
         log_debug("Deserializing state...");
 
+        r = deserialize_header(f, &m->serialize_binary);
+        if (r < 0)
+                return r;
+
         m->n_reloading ++;
 
         for (;;) {
-                char line[LINE_MAX], *l;
-
-                if (!fgets(line, sizeof(line), f)) {
-                        if (feof(f))
-                                r = 0;
-                        else
-                                r = -errno;
-
+                r = deserialize_item(f, m->serialize_binary, &buffer, &allocated, &l, &v);
+                if (r < 0)
                         goto finish;
-                }
-
-                char_array_0(line);
-                l = strstrip(line);
+                if (r == 0) {
+                        if (feof(f))
+                                goto finish;
 
-                if (l[0] == 0)
                         break;
+                }
 
-                if (startswith(l, "current-job-id=")) {
+                if (streq(l, "current-job-id")) {
                         uint32_t id;
 
-                        if (safe_atou32(l+15, &id) < 0)
-                                log_debug("Failed to parse current job id value %s", l+15);
+                        if (safe_atou32(v, &id) < 0)
+                                log_debug("Failed to parse current job id value %s", v);
                         else
                                 m->current_job_id = MAX(m->current_job_id, id);
-                } else if (startswith(l, "n-installed-jobs=")) {
+                } else if (streq(l, "n-installed-jobs")) {
                         uint32_t n;
 
-                        if (safe_atou32(l+17, &n) < 0)
-                                log_debug("Failed to parse installed jobs counter %s", l+17);
+                        if (safe_atou32(v, &n) < 0)
+                                log_debug("Failed to parse installed jobs counter %s", v);
                         else
                                 m->n_installed_jobs += n;
-                } else if (startswith(l, "n-failed-jobs=")) {
+                } else if (streq(l, "n-failed-jobs")) {
                         uint32_t n;
 
-                        if (safe_atou32(l+14, &n) < 0)
-                                log_debug("Failed to parse failed jobs counter %s", l+14);
+                        if (safe_atou32(v, &n) < 0)
+                                log_debug("Failed to parse failed jobs counter %s", v);
                         else
                                 m->n_failed_jobs += n;
-                } else if (startswith(l, "taint-usr=")) {
+                } else if (streq(l, "taint-usr")) {
                         int b;
 
-                        if ((b = parse_boolean(l+10)) < 0)
-                                log_debug("Failed to parse taint /usr flag %s", l+10);
+                        if ((b = parse_boolean(v)) < 0)
+                                log_debug("Failed to parse taint /usr flag %s", v);
                         else
                                 m->taint_usr = m->taint_usr || b;
-                } else if (startswith(l, "firmware-timestamp="))
-                        dual_timestamp_deserialize(l+19, &m->firmware_timestamp);
-                else if (startswith(l, "loader-timestamp="))
-                        dual_timestamp_deserialize(l+17, &m->loader_timestamp);
-                else if (startswith(l, "kernel-timestamp="))
-                        dual_timestamp_deserialize(l+17, &m->kernel_timestamp);
-                else if (startswith(l, "initrd-timestamp="))
-                        dual_timestamp_deserialize(l+17, &m->initrd_timestamp);
-                else if (startswith(l, "userspace-timestamp="))
-                        dual_timestamp_deserialize(l+20, &m->userspace_timestamp);
-                else if (startswith(l, "finish-timestamp="))
-                        dual_timestamp_deserialize(l+17, &m->finish_timestamp);
-                else if (startswith(l, "env=")) {
+                } else if (streq(l, "firmware-timestamp"))
+                        dual_timestamp_deserialize(v, &m->firmware_timestamp);
+                else if (streq(l, "loader-timestamp"))
+                        dual_timestamp_deserialize(v, &m->loader_timestamp);
+                else if (streq(l, "kernel-timestamp"))
+                        dual_timestamp_deserialize(v, &m->kernel_timestamp);
+                else if (streq(l, "initrd-timestamp"))
+                        dual_timestamp_deserialize(v, &m->initrd_timestamp);
+                else if (streq(l, "userspace-timestamp"))
+                        dual_timestamp_deserialize(v, &m->userspace_timestamp);
+                else if (streq(l, "finish-timestamp"))
+                        dual_timestamp_deserialize(v, &m->finish_timestamp);
+                else if (streq(l, "env")) {
                         _cleanup_free_ char *uce = NULL;
                         char **e;
 
-                        uce = cunescape(l+4);
-                        if (!uce) {
-                                r = -ENOMEM;
-                                goto finish;
+                        if (!m->serialize_binary) {
+                                uce = cunescape(v);
+                                if (!uce) {
+                                        r = -ENOMEM;
+                                        goto finish;
+                                }
                         }
 
-                        e = strv_env_set(m->environment, uce);
+                        e = strv_env_set(m->environment, uce ? uce : v);
                         if (!e) {
                                 r = -ENOMEM;
                                 goto finish;
@@ -2166,21 +2688,19 @@ int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
 
         for (;;) {
                 Unit *u;
-                char name[UNIT_NAME_MAX+2];
 
                 /* Start marker */
-                if (!fgets(name, sizeof(name), f)) {
+                r = deserialize_item(f, m->serialize_binary, &buffer, &allocated, &l, &v);
+                if (r < 0)
+                        goto finish;
+                if (r == 0) {
                         if (feof(f))
-                                r = 0;
-                        else
-                                r = -errno;
+                                goto finish;
 
-                        goto finish;
+                        continue;
                 }
 
-                char_array_0(name);
-
-                r = manager_load_unit(m, strstrip(name), NULL, NULL, &u);
+                r = manager_load_unit(m, l, NULL, NULL, &u);
                 if (r < 0)
                         goto finish;
 
@@ -2190,10 +2710,8 @@ int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
         }
 
 finish:
-        if (ferror(f)) {
+        if (ferror(f))
                 r = -EIO;
-                goto finish;
-        }
 
         assert(m->n_reloading > 0);
         m->n_reloading --;
@@ -2243,7 +2761,7 @@ int manager_reload(Manager *m) {
                 goto finish;
         }
 
-        r = manager_serialize(m, f, fds, false);
+        r = manager_serialize(m, f, fds, false, true);
         if (r < 0) {
                 m->n_reloading --;
                 goto finish;
@@ -2259,6 +2777,7 @@ int manager_reload(Manager *m) {
         manager_clear_jobs_and_units(m);
         manager_undo_generators(m);
         lookup_paths_free(&m->lookup_paths);
+        condition_flush_cache();
 
         /* Find new unit paths */
         manager_run_generators(m);
@@ -2271,8 +2790,6 @@ int manager_reload(Manager *m) {
         if (q < 0)
                 r = q;
 
-        manager_build_unit_path_cache(m);
-
         /* First, enumerate what we can from all config files */
         q = manager_enumerate(m);
         if (q < 0)
@@ -2351,6 +2868,82 @@ bool manager_unit_inactive_or_pending(Manager *m, const char *name) {
         return unit_inactive_or_pending(u);
 }
 
+static void manager_write_boot_timing(Manager *m) {
+        _cleanup_free_ char *temp_path = NULL;
+        const char *t;
+        Iterator i;
+        FILE *f;
+        Unit *u;
+        int r;
+
+        assert(m);
+
+        if (m->running_as != SYSTEMD_SYSTEM || getpid() != 1)
+                return;
+
+        /* Stores what systemd-analyze would otherwise have to ask
+         * us for unit by unit, in the text serialization format */
+        r = fopen_temporary(BOOT_TIMING_PATH, &f, &temp_path);
+        if (r < 0) {
+                log_warning("Failed to write boot timing data: %s", strerror(-r));
+                return;
+        }
+
+        fchmod(fileno(f), 0644);
+
+        serialize_dual_timestamp(f, false, "firmware-timestamp", &m->firmware_timestamp);
+        serialize_dual_timestamp(f, false, "kernel-timestamp", &m->kernel_timestamp);
+        serialize_dual_timestamp(f, false, "loader-timestamp", &m->loader_timestamp);
+        serialize_dual_timestamp(f, false, "initrd-timestamp", &m->initrd_timestamp);
+        serialize_dual_timestamp(f, false, "userspace-timestamp", &m->userspace_timestamp);
+        serialize_dual_timestamp(f, false, "finish-timestamp", &m->finish_timestamp);
+
+        u = manager_get_unit(m, SPECIAL_DEFAULT_TARGET);
+        if (u)
+                serialize_item(f, false, "default-target", u->id);
+
+        serialize_end(f, false);
+
+        HASHMAP_FOREACH_KEY(u, t, m->units, i) {
+                unsigned j;
+                Unit *other;
+
+                if (u->id != t)
+                        continue;
+
+                /* Units that never started tell nothing about the
+                 * bootup */
+                if (!dual_timestamp_is_set(&u->inactive_exit_timestamp))
+                        continue;
+
+                serialize_item(f, false, u->id, NULL);
+
+                serialize_dual_timestamp(f, false, "inactive-exit-timestamp", &u->inactive_exit_timestamp);
+                serialize_dual_timestamp(f, false, "active-enter-timestamp", &u->active_enter_timestamp);
+                serialize_dual_timestamp(f, false, "active-exit-timestamp", &u->active_exit_timestamp);
+                serialize_dual_timestamp(f, false, "inactive-enter-timestamp", &u->inactive_enter_timestamp);
+
+                UNIT_FOREACH_DEPENDENCY(other, u, UNIT_AFTER, j)
+                        serialize_item(f, false, "after", other->id);
+
+                serialize_end(f, false);
+        }
+
+        fflush(f);
+
+        if (ferror(f))
+                r = -EIO;
+        else if (rename(temp_path, BOOT_TIMING_PATH) < 0)
+                r = -errno;
+
+        if (r < 0) {
+                log_warning("Failed to write boot timing data: %s", strerror(-r));
+                unlink(temp_path);
+        }
+
+        fclose(f);
+}
+
 void manager_check_finished(Manager *m) {
         char userspace[FORMAT_TIMESPAN_MAX], initrd[FORMAT_TIMESPAN_MAX], kernel[FORMAT_TIMESPAN_MAX], sum[FORMAT_TIMESPAN_MAX];
         usec_t firmware_usec, loader_usec, kernel_usec, initrd_usec, userspace_usec, total_usec;
@@ -2433,6 +3026,8 @@ void manager_check_finished(Manager *m) {
                                    NULL);
         }
 
+        manager_write_boot_timing(m);
+
         bus_broadcast_finished(m, firmware_usec, loader_usec, kernel_usec, initrd_usec, userspace_usec, total_usec);
 
         sd_notifyf(false,
@@ -2500,6 +3095,7 @@ void manager_run_generators(Manager *m) {
         DIR *d = NULL;
         const char *generator_path;
         const char *argv[5];
+        usec_t begin;
         int r;
 
         assert(m);
@@ -2533,10 +3129,20 @@ void manager_run_generators(Manager *m) {
         argv[3] = m->generator_unit_path_late;
         argv[4] = NULL;
 
+        execute_timings_free(m->generator_timings, m->n_generator_timings);
+        m->generator_timings = NULL;
+        m->n_generator_timings = 0;
+
+        begin = now(CLOCK_MONOTONIC);
+
         RUN_WITH_UMASK(0022) {
-                execute_directory(generator_path, d, (char**) argv);
+                execute_directory_full(generator_path, d, (char**) argv,
+                                       m->generator_timeout_usec,
+                                       &m->generator_timings, &m->n_generator_timings);
         }
 
+        profile_add(PROFILE_GENERATORS, begin);
+
         trim_generator_dir(m, &m->generator_unit_path);
         trim_generator_dir(m, &m->generator_unit_path_early);
         trim_generator_dir(m, &m->generator_unit_path_late);
@@ -24,9 +24,13 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <time.h>
 #include <dbus/dbus.h>
 
 #include "fdset.h"
+#include "prioq.h"
+#include "ratelimit.h"
+#include "time-util.h"
 
 /* Enforce upper limit how many names we allow */
 #define MANAGER_MAX_NAMES 131072 /* 128K */
@@ -34,6 +38,7 @@
 typedef struct Manager Manager;
 typedef enum WatchType WatchType;
 typedef struct Watch Watch;
+typedef struct TimerQueue TimerQueue;
 
 typedef enum ManagerExitCode {
         MANAGER_RUNNING,
@@ -57,12 +62,18 @@ enum WatchType {
         WATCH_UNIT_TIMER,
         WATCH_JOB_TIMER,
         WATCH_MOUNT,
+        WATCH_MOUNT_TIMER,
         WATCH_SWAP,
         WATCH_UDEV,
         WATCH_DBUS_WATCH,
         WATCH_DBUS_TIMEOUT,
         WATCH_TIME_CHANGE,
-        WATCH_JOBS_IN_PROGRESS
+        WATCH_JOBS_IN_PROGRESS,
+        WATCH_TIMER_QUEUE,
+        WATCH_PROC_EVENTS,
+        WATCH_CGROUPS_AGENT,
+        WATCH_CGROUP_SAMPLING,
+        WATCH_PATH_INOTIFY
 };
 
 struct Watch {
@@ -73,16 +84,34 @@ struct Watch {
                 struct Job *job;
                 DBusWatch *bus_watch;
                 DBusTimeout *bus_timeout;
+                TimerQueue *timer_queue;
         } data;
+
+        /* Timer watches don't have an fd of their own, but are
+         * queued up in the timer queue of their clock */
+        usec_t timer_next;
+        unsigned timer_idx;
+        clockid_t timer_clock;
+        bool timer_queued:1;
+
         bool fd_is_dupped:1;
         bool socket_accept:1;
 };
 
+/* All timer watches of one clock are multiplexed onto one timerfd */
+struct TimerQueue {
+        clockid_t clock_id;
+        Prioq *prioq;
+        Watch watch;
+        usec_t armed; /* what the timerfd is set to, 0 if not armed */
+};
+
 #include "unit.h"
 #include "job.h"
 #include "hashmap.h"
 #include "list.h"
 #include "set.h"
+#include "path-trie.h"
 #include "dbus.h"
 #include "path-lookup.h"
 #include "execute.h"
@@ -100,8 +129,12 @@ struct Manager {
          * type we maintain a per type linked list */
         LIST_HEAD(Unit, units_by_type[_UNIT_TYPE_MAX]);
 
-        /* To optimize iteration of units that have requires_mounts_for set */
-        LIST_HEAD(Unit, has_requires_mounts_for);
+        /* To find the units at or below/above a path without
+         * iterating through all of them we maintain a per type
+         * index of the paths they are interested in, and one of
+         * the paths listed in requires_mounts_for */
+        PathTrie *units_by_path[_UNIT_TYPE_MAX];
+        PathTrie *units_requiring_mounts_for;
 
         /* Units that need to be loaded */
         LIST_HEAD(Unit, load_queue); /* this is actually more a stack than a queue, but uh. */
@@ -124,6 +157,12 @@ struct Manager {
 
         Hashmap *watch_pids;  /* pid => Unit object n:1 */
 
+        /* pid => Unit object n:1, of processes looked up by cgroup,
+         * see pid-cache.h */
+        Hashmap *pid_cache;
+        Hashmap *pid_cache_exited;
+        Watch proc_events_watch;
+
         char *notify_socket;
 
         Watch notify_watch;
@@ -131,12 +170,17 @@ struct Manager {
         Watch time_change_watch;
         Watch jobs_in_progress_watch;
 
+        TimerQueue timers_monotonic;
+        TimerQueue timers_realtime;
+        usec_t timer_perturb;
+
         int epoll_fd;
 
         unsigned n_snapshots;
 
         LookupPaths lookup_paths;
-        Set *unit_path_cache;
+        struct UnitPathIndex *unit_path_index;
+        Hashmap *unit_file_cache;
 
         char **environment;
         char **default_controllers;
@@ -144,6 +188,16 @@ struct Manager {
         usec_t runtime_watchdog;
         usec_t shutdown_watchdog;
 
+        usec_t default_timer_accuracy_usec;
+
+        /* How long to hold back PropertiesChanged signals of units,
+         * and when the ones queued now are due */
+        usec_t properties_changed_delay_usec;
+        usec_t dbus_unit_queue_deadline;
+
+        /* Send signals only to clients that called Subscribe() */
+        bool signal_subscribers_only;
+
         dual_timestamp firmware_timestamp;
         dual_timestamp loader_timestamp;
         dual_timestamp kernel_timestamp;
@@ -155,15 +209,43 @@ struct Manager {
         char *generator_unit_path_early;
         char *generator_unit_path_late;
 
+        /* How long each generator may take, and how long each took
+         * the last time they ran */
+        usec_t generator_timeout_usec;
+        ExecuteTiming *generator_timings;
+        unsigned n_generator_timings;
+
+        /* Messages units repeat in restart storms, limited per unit
+         * and message */
+        RateLimitMap *unit_log_ratelimit;
+
+        /* Data specific to the service subsystem */
+        Hashmap *sysv_scripts; /* path => parsed SysV init script headers */
+
         /* Data specific to the device subsystem */
         struct udev* udev;
         struct udev_monitor* udev_monitor;
         Watch udev_watch;
         Hashmap *devices_by_sysfs;
+        Hashmap *devices_by_link; /* unit name => sysfs path of a device, until the unit is referenced */
+        /* Subsystems of the events received since the udev event
+         * queue was last drained */
+        Set *devices_storm_subsystems;
+        bool devices_queue_drained;
 
         /* Data specific to the mount subsystem */
         FILE *proc_self_mountinfo;
         Watch mount_watch;
+        Hashmap *mountinfo_lines;  /* line of the last read => mount point */
+        Hashmap *mountinfo_points; /* mount point => number of lines */
+        Watch mount_timer_watch;
+        usec_t mountinfo_timestamp;
+
+        /* Data specific to the path subsystem: the watches of all
+         * path specs share one inotify fd */
+        Watch path_inotify_watch;
+        Hashmap *path_inotify_watches; /* inotify wd => PathInotifyWatch */
+        LIST_HEAD(struct PathSpec, path_inotify_queue);
 
         /* Data specific to the swap filesystem */
         FILE *proc_swaps;
@@ -197,6 +279,15 @@ struct Manager {
         Hashmap *cgroup_bondings; /* path string => CGroupBonding object 1:n */
         char *cgroup_hierarchy;
 
+        /* Where systemd-cgroups-agent reports empty groups */
+        Watch cgroups_agent_watch;
+
+        /* How often the resource counters of units are sampled, see
+         * cgroup-sample.h */
+        usec_t resource_sampling_usec;
+        Watch cgroup_sampling_watch;
+        unsigned n_cgroup_sample_fds;
+
         usec_t gc_queue_timestamp;
         int gc_marker;
         unsigned n_in_gc_queue;
@@ -225,6 +316,10 @@ struct Manager {
         /* non-zero if we are reloading or reexecuting, */
         int n_reloading;
 
+        /* Whether the state being serialized or deserialized right
+         * now uses the binary format, see serialize.h */
+        bool serialize_binary;
+
         unsigned n_installed_jobs;
         unsigned n_failed_jobs;
 
@@ -258,6 +353,7 @@ int manager_load_unit_from_dbus_path(Manager *m, const char *s, DBusError *e, Un
 
 int manager_add_job(Manager *m, JobType type, Unit *unit, JobMode mode, bool force, DBusError *e, Job **_ret);
 int manager_add_job_by_name(Manager *m, JobType type, const char *name, JobMode mode, bool force, DBusError *e, Job **_ret);
+int manager_add_start_job_fast(Manager *m, Unit *unit, bool override, Job **_ret);
 
 void manager_dump_units(Manager *s, FILE *f, const char *prefix);
 void manager_dump_jobs(Manager *s, FILE *f, const char *prefix);
@@ -278,7 +374,7 @@ void manager_dispatch_bus_query_pid_done(Manager *m, const char *name, pid_t pid
 
 int manager_open_serialization(Manager *m, FILE **_f);
 
-int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root);
+int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root, bool binary);
 int manager_deserialize(Manager *m, FILE *f, FDSet *fds);
 int manager_distribute_fds(Manager *m, FDSet *fds);
 
@@ -304,3 +400,6 @@ void manager_set_show_status(Manager *m, bool b);
 void manager_status_printf(Manager *m, bool ephemeral, const char *status, const char *format, ...);
 
 void watch_init(Watch *w);
+
+int manager_watch_timer(Manager *m, Watch *w, clockid_t clock_id, bool relative, usec_t usec, usec_t accuracy);
+void manager_unwatch_timer(Manager *m, Watch *w);
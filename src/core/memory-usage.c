@@ -0,0 +1,227 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <malloc.h>
+
+#include "memory-usage.h"
+#include "strv.h"
+#include "service.h"
+#include "socket.h"
+#include "mount.h"
+#include "swap.h"
+
+static size_t msize(const void *p) {
+        return p ? malloc_usable_size((void*) p) : 0;
+}
+
+static size_t strv_msize(MemoryUsage *usage, char **l) {
+        char **i;
+        size_t n;
+
+        if (!l)
+                return 0;
+
+        n = msize(l);
+        STRV_FOREACH(i, l)
+                n += msize(*i);
+
+        usage->categories[MEMORY_STRV].n++;
+        usage->categories[MEMORY_STRV].size += n;
+
+        return n;
+}
+
+static void account_exec_context(MemoryUsage *usage, ExecContext *c) {
+        MemoryCounter *counter = usage->categories + MEMORY_EXEC_CONTEXTS;
+
+        /* The context itself is part of the unit */
+        counter->n++;
+        counter->size +=
+                strv_msize(usage, c->environment) +
+                strv_msize(usage, c->environment_files) +
+                strv_msize(usage, c->supplementary_groups) +
+                strv_msize(usage, c->read_write_dirs) +
+                strv_msize(usage, c->read_only_dirs) +
+                strv_msize(usage, c->inaccessible_dirs) +
+                msize(c->working_directory) +
+                msize(c->root_directory) +
+                msize(c->tcpwrap_name) +
+                msize(c->tty_path) +
+                msize(c->user) +
+                msize(c->group) +
+                msize(c->pam_name) +
+                msize(c->utmp_id) +
+                msize(c->syslog_identifier) +
+                msize(c->tmp_dir) +
+                msize(c->var_tmp_dir);
+}
+
+static void account_exec_command(MemoryUsage *usage, ExecCommand *c, bool embedded) {
+        MemoryCounter *counter = usage->categories + MEMORY_EXEC_COMMANDS;
+
+        if (!c->path)
+                return;
+
+        counter->n++;
+        counter->size +=
+                (embedded ? 0 : msize(c)) +
+                msize(c->path) +
+                strv_msize(usage, c->argv);
+}
+
+static void account_exec_commands(MemoryUsage *usage, Unit *u) {
+        ExecCommand *c;
+        unsigned i;
+
+        switch (u->type) {
+
+        case UNIT_SERVICE:
+                for (i = 0; i < _SERVICE_EXEC_COMMAND_MAX; i++)
+                        LIST_FOREACH(command, c, SERVICE(u)->exec_command[i])
+                                account_exec_command(usage, c, false);
+                break;
+
+        case UNIT_SOCKET:
+                for (i = 0; i < _SOCKET_EXEC_COMMAND_MAX; i++)
+                        LIST_FOREACH(command, c, SOCKET(u)->exec_command[i])
+                                account_exec_command(usage, c, false);
+                break;
+
+        case UNIT_MOUNT:
+                for (i = 0; i < _MOUNT_EXEC_COMMAND_MAX; i++)
+                        account_exec_command(usage, MOUNT(u)->exec_command + i, true);
+                break;
+
+        case UNIT_SWAP:
+                for (i = 0; i < _SWAP_EXEC_COMMAND_MAX; i++)
+                        account_exec_command(usage, SWAP(u)->exec_command + i, true);
+                break;
+
+        default:
+                break;
+        }
+}
+
+static void account_unit(MemoryUsage *usage, Unit *u) {
+        MemoryCounter *counter = usage->units + u->type;
+        ExecContext *ec;
+        Iterator i;
+        char *t;
+
+        counter->n++;
+        counter->size +=
+                msize(u) +
+                set_memory_usage(u->names) +
+                msize(u->instance) +
+                msize(u->dependencies) +
+                hashmap_memory_usage(u->dependencies_index) +
+                strv_msize(usage, u->requires_mounts_for) +
+                strv_msize(usage, u->indexed_paths) +
+                msize(u->description) +
+                strv_msize(usage, u->documentation) +
+                msize(u->fragment_path) +
+                msize(u->source_path) +
+                strv_msize(usage, u->dropin_paths) +
+                msize(u->start_latency);
+
+        SET_FOREACH(t, u->names, i)
+                counter->size += msize(t);
+
+        ec = unit_get_exec_context(u);
+        if (ec)
+                account_exec_context(usage, ec);
+
+        account_exec_commands(usage, u);
+}
+
+void manager_get_memory_usage(Manager *m, MemoryUsage *usage) {
+        HashmapPoolStats pool;
+#ifdef HAVE_MALLINFO2
+        struct mallinfo2 mi;
+#else
+        struct mallinfo mi;
+#endif
+        Hashmap *hashmaps[] = {
+                m->units,
+                m->jobs,
+                m->watch_pids,
+                m->watch_bus,
+                m->cgroup_bondings,
+                m->devices_by_sysfs,
+                m->unit_file_cache,
+        };
+        const char *k;
+        unsigned h;
+        Iterator i;
+        Unit *u;
+        Job *j;
+
+        assert(m);
+        assert(usage);
+
+        zero(*usage);
+
+        HASHMAP_FOREACH_KEY(u, k, m->units, i) {
+                /* Count every unit once, not once per name */
+                if (u->id != k)
+                        continue;
+
+                account_unit(usage, u);
+        }
+
+        HASHMAP_FOREACH(j, m->jobs, i) {
+                usage->categories[MEMORY_JOBS].n++;
+                usage->categories[MEMORY_JOBS].size += msize(j);
+        }
+
+        for (h = 0; h < ELEMENTSOF(hashmaps); h++)
+                if (hashmaps[h]) {
+                        usage->categories[MEMORY_MANAGER_HASHMAPS].n++;
+                        usage->categories[MEMORY_MANAGER_HASHMAPS].size += hashmap_memory_usage(hashmaps[h]);
+                }
+
+        hashmap_get_pool_stats(&pool);
+        usage->categories[MEMORY_HASHMAP_POOL].n = pool.n_used - pool.n_free;
+        usage->categories[MEMORY_HASHMAP_POOL].size = pool.size;
+
+#ifdef HAVE_MALLINFO2
+        mi = mallinfo2();
+        usage->categories[MEMORY_HEAP_IN_USE].size = (uint64_t) mi.uordblks + (uint64_t) mi.hblkhd;
+        usage->categories[MEMORY_HEAP_FREE].size = (uint64_t) mi.fordblks;
+#else
+        /* The fields are int, and wrap beyond 2G */
+        mi = mallinfo();
+        usage->categories[MEMORY_HEAP_IN_USE].size = (unsigned) mi.uordblks + (unsigned) mi.hblkhd;
+        usage->categories[MEMORY_HEAP_FREE].size = (unsigned) mi.fordblks;
+#endif
+}
+
+static const char* const memory_category_table[_MEMORY_CATEGORY_MAX] = {
+        [MEMORY_JOBS] = "job",
+        [MEMORY_EXEC_CONTEXTS] = "exec-context",
+        [MEMORY_EXEC_COMMANDS] = "exec-command",
+        [MEMORY_STRV] = "strv",
+        [MEMORY_MANAGER_HASHMAPS] = "manager-hashmap",
+        [MEMORY_HASHMAP_POOL] = "hashmap-pool",
+        [MEMORY_HEAP_IN_USE] = "heap-in-use",
+        [MEMORY_HEAP_FREE] = "heap-free"
+};
+
+DEFINE_STRING_TABLE_LOOKUP(memory_category, MemoryCategory);
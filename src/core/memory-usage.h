@@ -0,0 +1,59 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <inttypes.h>
+
+#include "unit.h"
+#include "manager.h"
+
+/* Where the memory of PID 1 goes, for systemd-analyze dump-memory.
+ * The sizes are what malloc() actually handed out for the objects
+ * and the strings and arrays they own. Categories may overlap: the
+ * string arrays are also included in the objects they belong to. */
+
+typedef enum MemoryCategory {
+        MEMORY_JOBS,
+        MEMORY_EXEC_CONTEXTS,
+        MEMORY_EXEC_COMMANDS,
+        MEMORY_STRV,
+        MEMORY_MANAGER_HASHMAPS,
+        MEMORY_HASHMAP_POOL,
+        MEMORY_HEAP_IN_USE,
+        MEMORY_HEAP_FREE,
+        _MEMORY_CATEGORY_MAX,
+        _MEMORY_CATEGORY_INVALID = -1
+} MemoryCategory;
+
+typedef struct MemoryCounter {
+        uint64_t n;
+        uint64_t size;
+} MemoryCounter;
+
+typedef struct MemoryUsage {
+        MemoryCounter units[_UNIT_TYPE_MAX];
+        MemoryCounter categories[_MEMORY_CATEGORY_MAX];
+} MemoryUsage;
+
+void manager_get_memory_usage(Manager *m, MemoryUsage *usage);
+
+const char* memory_category_to_string(MemoryCategory c);
+MemoryCategory memory_category_from_string(const char *s);
@@ -43,6 +43,10 @@
 #include "exit-status.h"
 #include "def.h"
 
+/* How long to wait after processing a mount table change before we
+ * look at the next one */
+#define MOUNT_COALESCE_USEC (50*USEC_PER_MSEC)
+
 static const UnitActiveState state_translation_table[_MOUNT_STATE_MAX] = {
         [MOUNT_DEAD] = UNIT_INACTIVE,
         [MOUNT_MOUNTING] = UNIT_ACTIVATING,
@@ -154,8 +158,33 @@ static MountParameters* get_mount_parameters(Mount *m) {
         return get_mount_parameters_fragment(m);
 }
 
+static int mount_add_path_index(Mount *m) {
+        MountParameters *p;
+        int r;
+
+        assert(m);
+
+        r = unit_add_path_index(UNIT(m), m->where);
+        if (r < 0)
+                return r;
+
+        /* Bind mounts and friends depend on the mount their source
+         * lies on too */
+        p = get_mount_parameters_fragment(m);
+        if (p && p->what) {
+                r = unit_add_path_index(UNIT(m), p->what);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
 static int mount_add_mount_links(Mount *m) {
-        Unit *other;
+        _cleanup_set_free_ Set *s = NULL;
+        PathTrie *t;
+        Iterator i;
+        Mount *n;
         int r;
         MountParameters *pm;
 
@@ -164,10 +193,31 @@ static int mount_add_mount_links(Mount *m) {
         pm = get_mount_parameters_fragment(m);
 
         /* Adds in links to other mount points that might lie below or
-         * above us in the hierarchy */
+         * above us in the hierarchy. Mount units are indexed by both
+         * where and what, so the candidates looked up here are a
+         * superset of what we link to. */
+
+        s = set_new(trivial_hash_func, trivial_compare_func);
+        if (!s)
+                return -ENOMEM;
+
+        t = UNIT(m)->manager->units_by_path[UNIT_MOUNT];
+
+        r = path_trie_find_above(t, m->where, s);
+        if (r < 0)
+                return r;
+
+        r = path_trie_find_below(t, m->where, s);
+        if (r < 0)
+                return r;
 
-        LIST_FOREACH(units_by_type, other, UNIT(m)->manager->units_by_type[UNIT_MOUNT]) {
-                Mount *n = MOUNT(other);
+        if (pm && pm->what) {
+                r = path_trie_find_above(t, pm->what, s);
+                if (r < 0)
+                        return r;
+        }
+
+        SET_FOREACH(n, s, i) {
                 MountParameters *pn;
 
                 if (n == m)
@@ -217,13 +267,42 @@ static int mount_add_mount_links(Mount *m) {
         return 0;
 }
 
+/* Returns the units of the index t that lie at or below our mount
+ * point in *ret */
+static int mount_find_units_below(Mount *m, PathTrie *t, Set **ret) {
+        Set *s;
+        int r;
+
+        assert(m);
+        assert(ret);
+
+        s = set_new(trivial_hash_func, trivial_compare_func);
+        if (!s)
+                return -ENOMEM;
+
+        r = path_trie_find_below(t, m->where, s);
+        if (r < 0) {
+                set_free(s);
+                return r;
+        }
+
+        *ret = s;
+        return 0;
+}
+
 static int mount_add_swap_links(Mount *m) {
+        _cleanup_set_free_ Set *s = NULL;
+        Iterator i;
         Unit *other;
         int r;
 
         assert(m);
 
-        LIST_FOREACH(units_by_type, other, UNIT(m)->manager->units_by_type[UNIT_SWAP]) {
+        r = mount_find_units_below(m, UNIT(m)->manager->units_by_path[UNIT_SWAP], &s);
+        if (r < 0)
+                return r;
+
+        SET_FOREACH(other, s, i) {
                 r = swap_add_one_mount_link(SWAP(other), m);
                 if (r < 0)
                         return r;
@@ -233,12 +312,18 @@ static int mount_add_swap_links(Mount *m) {
 }
 
 static int mount_add_path_links(Mount *m) {
+        _cleanup_set_free_ Set *s = NULL;
+        Iterator i;
         Unit *other;
         int r;
 
         assert(m);
 
-        LIST_FOREACH(units_by_type, other, UNIT(m)->manager->units_by_type[UNIT_PATH]) {
+        r = mount_find_units_below(m, UNIT(m)->manager->units_by_path[UNIT_PATH], &s);
+        if (r < 0)
+                return r;
+
+        SET_FOREACH(other, s, i) {
                 r = path_add_one_mount_link(PATH(other), m);
                 if (r < 0)
                         return r;
@@ -248,12 +333,18 @@ static int mount_add_path_links(Mount *m) {
 }
 
 static int mount_add_automount_links(Mount *m) {
+        _cleanup_set_free_ Set *s = NULL;
+        Iterator i;
         Unit *other;
         int r;
 
         assert(m);
 
-        LIST_FOREACH(units_by_type, other, UNIT(m)->manager->units_by_type[UNIT_AUTOMOUNT]) {
+        r = mount_find_units_below(m, UNIT(m)->manager->units_by_path[UNIT_AUTOMOUNT], &s);
+        if (r < 0)
+                return r;
+
+        SET_FOREACH(other, s, i) {
                 r = automount_add_one_mount_link(AUTOMOUNT(other), m);
                 if (r < 0)
                         return r;
@@ -263,12 +354,18 @@ static int mount_add_automount_links(Mount *m) {
 }
 
 static int mount_add_socket_links(Mount *m) {
+        _cleanup_set_free_ Set *s = NULL;
+        Iterator i;
         Unit *other;
         int r;
 
         assert(m);
 
-        LIST_FOREACH(units_by_type, other, UNIT(m)->manager->units_by_type[UNIT_SOCKET]) {
+        r = mount_find_units_below(m, UNIT(m)->manager->units_by_path[UNIT_SOCKET], &s);
+        if (r < 0)
+                return r;
+
+        SET_FOREACH(other, s, i) {
                 r = socket_add_one_mount_link(SOCKET(other), m);
                 if (r < 0)
                         return r;
@@ -278,12 +375,18 @@ static int mount_add_socket_links(Mount *m) {
 }
 
 static int mount_add_requires_mounts_links(Mount *m) {
+        _cleanup_set_free_ Set *s = NULL;
+        Iterator i;
         Unit *other;
         int r;
 
         assert(m);
 
-        LIST_FOREACH(has_requires_mounts_for, other, UNIT(m)->manager->has_requires_mounts_for) {
+        r = mount_find_units_below(m, UNIT(m)->manager->units_requiring_mounts_for, &s);
+        if (r < 0)
+                return r;
+
+        SET_FOREACH(other, s, i) {
                 r = unit_add_one_mount_link(other, m);
                 if (r < 0)
                         return r;
@@ -490,7 +593,7 @@ static int mount_fix_timeouts(Mount *m) {
         MountParameters *p;
         const char *timeout = NULL;
         Unit *other;
-        Iterator i;
+        unsigned i;
         usec_t u;
         char *t;
         int r;
@@ -527,7 +630,7 @@ static int mount_fix_timeouts(Mount *m) {
                 return r;
         }
 
-        SET_FOREACH(other, UNIT(m)->dependencies[UNIT_AFTER], i) {
+        UNIT_FOREACH_DEPENDENCY(other, UNIT(m), UNIT_AFTER, i) {
                 if (other->type != UNIT_DEVICE)
                         continue;
 
@@ -599,6 +702,10 @@ static int mount_add_extras(Mount *m) {
 
         path_kill_slashes(m->where);
 
+        r = mount_add_path_index(m);
+        if (r < 0)
+                return r;
+
         r = unit_add_exec_dependencies(u, &m->exec_context);
         if (r < 0)
                 return r;
@@ -690,11 +797,11 @@ static int mount_load(Unit *u) {
 static int mount_notify_automount(Mount *m, int status) {
         Unit *p;
         int r;
-        Iterator i;
+        unsigned i;
 
         assert(m);
 
-        SET_FOREACH(p, UNIT(m)->dependencies[UNIT_TRIGGERED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(p, UNIT(m), UNIT_TRIGGERED_BY, i)
                 if (p->type == UNIT_AUTOMOUNT) {
                          r = automount_send_ready(AUTOMOUNT(p), status);
                          if (r < 0)
@@ -787,7 +894,7 @@ static int mount_coldplug(Unit *u) {
                         if (r < 0)
                                 return r;
 
-                        r = unit_watch_timer(UNIT(m), CLOCK_MONOTONIC, true, m->timeout_usec, &m->timer_watch);
+                        r = unit_watch_timer(UNIT(m), CLOCK_MONOTONIC, true, m->timeout_usec, 0, &m->timer_watch);
                         if (r < 0)
                                 return r;
                 }
@@ -844,7 +951,7 @@ static int mount_spawn(Mount *m, ExecCommand *c, pid_t *_pid) {
         assert(c);
         assert(_pid);
 
-        r = unit_watch_timer(UNIT(m), CLOCK_MONOTONIC, true, m->timeout_usec, &m->timer_watch);
+        r = unit_watch_timer(UNIT(m), CLOCK_MONOTONIC, true, m->timeout_usec, 0, &m->timer_watch);
         if (r < 0)
                 goto fail;
 
@@ -917,7 +1024,7 @@ static void mount_enter_signal(Mount *m, MountState state, MountResult f) {
                 goto fail;
 
         if (r > 0) {
-                r = unit_watch_timer(UNIT(m), CLOCK_MONOTONIC, true, m->timeout_usec, &m->timer_watch);
+                r = unit_watch_timer(UNIT(m), CLOCK_MONOTONIC, true, m->timeout_usec, 0, &m->timer_watch);
                 if (r < 0)
                         goto fail;
 
@@ -1618,81 +1725,249 @@ fail:
         return r;
 }
 
-static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags) {
-        int r = 0;
+/* Parses one line of /proc/self/mountinfo and passes it on to
+ * mount_add_one(). Returns the mount point in *_where. */
+static int mount_add_mountinfo_line(Manager *m, const char *line, bool set_flags, char **_where) {
+        _cleanup_free_ char *device = NULL, *path = NULL, *options = NULL, *options2 = NULL, *fstype = NULL, *d = NULL, *o = NULL;
+        char *p;
+        int r;
+
+        assert(m);
+        assert(line);
+        assert(_where);
+
+        if (sscanf(line,
+                   "%*s "       /* (1) mount id */
+                   "%*s "       /* (2) parent id */
+                   "%*s "       /* (3) major:minor */
+                   "%*s "       /* (4) root */
+                   "%ms "       /* (5) mount point */
+                   "%ms"        /* (6) mount options */
+                   "%*[^-]"     /* (7) optional fields */
+                   "- "         /* (8) separator */
+                   "%ms "       /* (9) file system type */
+                   "%ms"        /* (10) mount source */
+                   "%ms"        /* (11) mount options 2 */
+                   "%*[^\n]",   /* some rubbish at the end */
+                   &path,
+                   &options,
+                   &fstype,
+                   &device,
+                   &options2) != 5)
+                return -EBADMSG;
+
+        o = strjoin(options, ",", options2, NULL);
+        if (!o)
+                return -ENOMEM;
+
+        d = cunescape(device);
+        p = cunescape(path);
+        if (!d || !p) {
+                free(p);
+                return -ENOMEM;
+        }
+
+        r = mount_add_one(m, d, p, o, fstype, 0, set_flags);
+        if (r < 0) {
+                free(p);
+                return r;
+        }
+
+        *_where = p;
+        return 0;
+}
+
+static Mount* mount_find_by_where(Manager *m, const char *where) {
+        _cleanup_free_ char *e = NULL;
+        Unit *u;
+
+        assert(m);
+        assert(where);
+
+        e = unit_name_from_path(where, ".mount");
+        if (!e)
+                return NULL;
+
+        u = manager_get_unit(m, e);
+        if (!u || u->type != UNIT_MOUNT)
+                return NULL;
+
+        return MOUNT(u);
+}
+
+static int mount_point_ref(Manager *m, const char *where) {
+        unsigned n;
+        char *w;
+        int r;
+
+        assert(m);
+        assert(where);
+
+        r = hashmap_ensure_allocated(&m->mountinfo_points, string_hash_func, string_compare_func);
+        if (r < 0)
+                return r;
+
+        n = PTR_TO_UINT(hashmap_get(m->mountinfo_points, where));
+        if (n > 0)
+                return hashmap_update(m->mountinfo_points, where, UINT_TO_PTR(n + 1));
+
+        w = strdup(where);
+        if (!w)
+                return -ENOMEM;
+
+        r = hashmap_put(m->mountinfo_points, w, UINT_TO_PTR(1));
+        if (r < 0)
+                free(w);
+
+        return r;
+}
+
+static void mount_point_unref(Manager *m, const char *where) {
+        unsigned n;
+        char *w;
+
+        assert(m);
+        assert(where);
+
+        n = PTR_TO_UINT(hashmap_get2(m->mountinfo_points, where, (void**) &w));
+        if (n > 1)
+                hashmap_update(m->mountinfo_points, where, UINT_TO_PTR(n - 1));
+        else if (n == 1) {
+                hashmap_remove(m->mountinfo_points, where);
+                free(w);
+        }
+}
+
+static void mount_flush_mountinfo(Manager *m) {
+        char *w;
+
+        assert(m);
+
+        hashmap_free_free_free(m->mountinfo_lines);
+        m->mountinfo_lines = NULL;
+
+        /* The values are reference counts, only the keys are ours */
+        while ((w = hashmap_steal_first_key(m->mountinfo_points)))
+                free(w);
+
+        hashmap_free(m->mountinfo_points);
+        m->mountinfo_points = NULL;
+}
+
+/* Reads /proc/self/mountinfo. We remember the lines of the last read,
+ * so that lines that did not change since then need not be parsed
+ * and processed again, which matters on hosts with many thousands of
+ * mounts. If changed is NULL all lines are processed and the cache is
+ * rebuilt, otherwise only lines that were added or removed are, and
+ * the mount units affected by them are added to changed. */
+static int mount_load_proc_self_mountinfo(Manager *m, bool set_flags, Set *changed) {
+        _cleanup_free_ char *line = NULL;
+        Hashmap *lines, *old = NULL;
+        size_t allocated = 0;
+        Iterator j;
+        ssize_t l;
         unsigned i;
-        char *device, *path, *options, *options2, *fstype, *d, *p, *o;
+        char *where;
+        Mount *mount;
+        int r = 0, k;
 
         assert(m);
 
+        lines = hashmap_new(string_hash_func, string_compare_func);
+        if (!lines)
+                return -ENOMEM;
+
+        if (changed) {
+                old = m->mountinfo_lines;
+                m->mountinfo_lines = NULL;
+        } else
+                mount_flush_mountinfo(m);
+
         rewind(m->proc_self_mountinfo);
 
-        for (i = 1;; i++) {
-                int k;
-
-                device = path = options = options2 = fstype = d = p = o = NULL;
-
-                if ((k = fscanf(m->proc_self_mountinfo,
-                                "%*s "       /* (1) mount id */
-                                "%*s "       /* (2) parent id */
-                                "%*s "       /* (3) major:minor */
-                                "%*s "       /* (4) root */
-                                "%ms "       /* (5) mount point */
-                                "%ms"        /* (6) mount options */
-                                "%*[^-]"     /* (7) optional fields */
-                                "- "         /* (8) separator */
-                                "%ms "       /* (9) file system type */
-                                "%ms"        /* (10) mount source */
-                                "%ms"        /* (11) mount options 2 */
-                                "%*[^\n]",   /* some rubbish at the end */
-                                &path,
-                                &options,
-                                &fstype,
-                                &device,
-                                &options2)) != 5) {
-
-                        if (k == EOF)
-                                break;
+        for (i = 1; (l = getline(&line, &allocated, m->proc_self_mountinfo)) >= 0; i++) {
+                char *key;
+
+                if (l > 0 && line[l-1] == '\n')
+                        line[l-1] = 0;
+
+                if (hashmap_get(old, line)) {
+                        /* Unchanged since the last time */
+                        k = hashmap_move_one(lines, old, line);
+                        if (k < 0) {
+                                r = k;
+                                goto finish;
+                        }
+
+                        continue;
+                }
 
+                k = mount_add_mountinfo_line(m, line, set_flags, &where);
+                if (k == -EBADMSG) {
                         log_warning("Failed to parse /proc/self/mountinfo:%u.", i);
-                        goto clean_up;
+                        continue;
+                }
+                if (k < 0) {
+                        r = k;
+                        continue;
                 }
 
-                o = strjoin(options, ",", options2, NULL);
-                if (!o) {
-                        r = -ENOMEM;
-                        goto finish;
+                if (changed) {
+                        mount = mount_find_by_where(m, where);
+                        if (mount) {
+                                k = set_put(changed, mount);
+                                if (k < 0 && k != -EEXIST) {
+                                        free(where);
+                                        r = k;
+                                        goto finish;
+                                }
+                        }
                 }
 
-                if (!(d = cunescape(device)) ||
-                    !(p = cunescape(path))) {
+                key = strdup(line);
+                if (!key) {
+                        free(where);
                         r = -ENOMEM;
                         goto finish;
                 }
 
-                if ((k = mount_add_one(m, d, p, o, fstype, 0, set_flags)) < 0)
+                k = hashmap_put(lines, key, where);
+                if (k < 0) {
+                        /* The same line twice, can't really happen */
+                        free(key);
+                        free(where);
+
+                        if (k != -EEXIST) {
+                                r = k;
+                                goto finish;
+                        }
+
+                        continue;
+                }
+
+                k = mount_point_ref(m, where);
+                if (k < 0) {
                         r = k;
+                        goto finish;
+                }
+        }
 
-clean_up:
-                free(device);
-                free(path);
-                free(options);
-                free(options2);
-                free(fstype);
-                free(d);
-                free(p);
-                free(o);
+        /* What is left over from the last time is gone now */
+        HASHMAP_FOREACH(where, old, j) {
+                mount_point_unref(m, where);
+
+                mount = mount_find_by_where(m, where);
+                if (mount) {
+                        k = set_put(changed, mount);
+                        if (k < 0 && k != -EEXIST)
+                                r = k;
+                }
         }
 
 finish:
-        free(device);
-        free(path);
-        free(options);
-        free(options2);
-        free(fstype);
-        free(d);
-        free(p);
-        free(o);
+        hashmap_free_free_free(old);
+
+        m->mountinfo_lines = lines;
 
         return r;
 }
@@ -1704,6 +1979,11 @@ static void mount_shutdown(Manager *m) {
                 fclose(m->proc_self_mountinfo);
                 m->proc_self_mountinfo = NULL;
         }
+
+        manager_unwatch_timer(m, &m->mount_timer_watch);
+        watch_init(&m->mount_timer_watch);
+
+        mount_flush_mountinfo(m);
 }
 
 static int mount_enumerate(Manager *m) {
@@ -1727,7 +2007,11 @@ static int mount_enumerate(Manager *m) {
                         return -errno;
         }
 
-        r = mount_load_proc_self_mountinfo(m, false);
+        m->mount_timer_watch.type = WATCH_MOUNT_TIMER;
+
+        /* The units might be new after a reload, hence always do a
+         * full pass here */
+        r = mount_load_proc_self_mountinfo(m, false, NULL);
         if (r < 0)
                 goto fail;
 
@@ -1738,82 +2022,144 @@ fail:
         return r;
 }
 
-void mount_fd_event(Manager *m, int events) {
+static void mount_process_change(Mount *mount) {
+        assert(mount);
+
+        /* Another line may still be around for a stacked mount
+         * point that was not processed again */
+        if (!mount->is_mounted && mount->where &&
+            hashmap_get(UNIT(mount)->manager->mountinfo_points, mount->where))
+                mount->is_mounted = true;
+
+        if (!mount->is_mounted) {
+                /* This has just been unmounted. */
+
+                mount->from_proc_self_mountinfo = false;
+
+                switch (mount->state) {
+
+                case MOUNT_MOUNTED:
+                        mount_enter_dead(mount, MOUNT_SUCCESS);
+                        break;
+
+                default:
+                        mount_set_state(mount, mount->state);
+                        break;
+
+                }
+
+        } else if (mount->just_mounted || mount->just_changed) {
+
+                /* New or changed mount entry */
+
+                switch (mount->state) {
+
+                case MOUNT_DEAD:
+                case MOUNT_FAILED:
+                        mount_enter_mounted(mount, MOUNT_SUCCESS);
+                        break;
+
+                case MOUNT_MOUNTING:
+                        mount_enter_mounting_done(mount);
+                        break;
+
+                default:
+                        /* Nothing really changed, but let's
+                         * issue an notification call
+                         * nonetheless, in case somebody is
+                         * waiting for this. (e.g. file system
+                         * ro/rw remounts.) */
+                        mount_set_state(mount, mount->state);
+                        break;
+                }
+        }
+
+        /* Reset the flags for later calls */
+        mount->is_mounted = mount->just_mounted = mount->just_changed = false;
+}
+
+static void mount_dispatch_mountinfo(Manager *m) {
+        _cleanup_set_free_ Set *changed = NULL;
+        Iterator i;
+        Mount *mount;
         Unit *u;
         int r;
 
         assert(m);
-        assert(events & EPOLLPRI);
 
-        /* The manager calls this for every fd event happening on the
-         * /proc/self/mountinfo file, which informs us about mounting
-         * table changes */
+        m->mountinfo_timestamp = now(CLOCK_MONOTONIC);
+
+        /* Without a cache of the last read, e.g. after an error,
+         * look at all lines and all units */
+        if (m->mountinfo_lines) {
+                changed = set_new(trivial_hash_func, trivial_compare_func);
+                if (!changed) {
+                        log_oom();
+                        return;
+                }
+        }
 
-        r = mount_load_proc_self_mountinfo(m, true);
+        r = mount_load_proc_self_mountinfo(m, true, changed);
         if (r < 0) {
                 log_error("Failed to reread /proc/self/mountinfo: %s", strerror(-r));
 
                 /* Reset flags, just in case, for later calls */
                 LIST_FOREACH(units_by_type, u, m->units_by_type[UNIT_MOUNT]) {
-                        Mount *mount = MOUNT(u);
-
+                        mount = MOUNT(u);
                         mount->is_mounted = mount->just_mounted = mount->just_changed = false;
                 }
 
+                /* Lines that failed to be processed must be
+                 * looked at again next time */
+                mount_flush_mountinfo(m);
                 return;
         }
 
         manager_dispatch_load_queue(m);
 
-        LIST_FOREACH(units_by_type, u, m->units_by_type[UNIT_MOUNT]) {
-                Mount *mount = MOUNT(u);
-
-                if (!mount->is_mounted) {
-                        /* This has just been unmounted. */
-
-                        mount->from_proc_self_mountinfo = false;
-
-                        switch (mount->state) {
+        if (changed)
+                SET_FOREACH(mount, changed, i)
+                        mount_process_change(mount);
+        else
+                LIST_FOREACH(units_by_type, u, m->units_by_type[UNIT_MOUNT])
+                        mount_process_change(MOUNT(u));
+}
 
-                        case MOUNT_MOUNTED:
-                                mount_enter_dead(mount, MOUNT_SUCCESS);
-                                break;
+void mount_fd_event(Manager *m, int events) {
+        usec_t n, next;
+        int r;
 
-                        default:
-                                mount_set_state(mount, mount->state);
-                                break;
+        assert(m);
+        assert(events & EPOLLPRI);
 
-                        }
+        /* The manager calls this for every fd event happening on the
+         * /proc/self/mountinfo file, which informs us about mounting
+         * table changes. Bursts of changes, e.g. when containers are
+         * started, are coalesced: after having processed a change we
+         * wait for MOUNT_COALESCE_USEC before we look again. */
 
-                } else if (mount->just_mounted || mount->just_changed) {
+        if (m->mount_timer_watch.timer_queued)
+                /* Already scheduled */
+                return;
 
-                        /* New or changed mount entry */
+        n = now(CLOCK_MONOTONIC);
+        next = m->mountinfo_timestamp + MOUNT_COALESCE_USEC;
 
-                        switch (mount->state) {
+        if (m->mountinfo_timestamp > 0 && next > n) {
+                r = manager_watch_timer(m, &m->mount_timer_watch, CLOCK_MONOTONIC, false, next, 0);
+                if (r >= 0)
+                        return;
 
-                        case MOUNT_DEAD:
-                        case MOUNT_FAILED:
-                                mount_enter_mounted(mount, MOUNT_SUCCESS);
-                                break;
+                log_warning("Failed to arm mount table timer: %s", strerror(-r));
+        }
 
-                        case MOUNT_MOUNTING:
-                                mount_enter_mounting_done(mount);
-                                break;
+        mount_dispatch_mountinfo(m);
+}
 
-                        default:
-                                /* Nothing really changed, but let's
-                                 * issue an notification call
-                                 * nonetheless, in case somebody is
-                                 * waiting for this. (e.g. file system
-                                 * ro/rw remounts.) */
-                                mount_set_state(mount, mount->state);
-                                break;
-                        }
-                }
+void mount_table_timer_event(Manager *m) {
+        assert(m);
 
-                /* Reset the flags for later calls */
-                mount->is_mounted = mount->just_mounted = mount->just_changed = false;
-        }
+        mount_dispatch_mountinfo(m);
 }
 
 static void mount_reset_failed(Unit *u) {
@@ -1912,6 +2258,7 @@ const UnitVTable mount_vtable = {
 
         .bus_interface = "org.freedesktop.systemd1.Mount",
         .bus_message_handler = bus_mount_message_handler,
+        .bus_append_properties = bus_mount_append_properties,
         .bus_invalidating_properties =  bus_mount_invalidating_properties,
 
         .enumerate = mount_enumerate,
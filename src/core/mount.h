@@ -110,6 +110,7 @@ struct Mount {
 extern const UnitVTable mount_vtable;
 
 void mount_fd_event(Manager *m, int events);
+void mount_table_timer_event(Manager *m);
 
 const char* mount_state_to_string(MountState i);
 MountState mount_state_from_string(const char *s);
@@ -42,6 +42,147 @@ static const UnitActiveState state_translation_table[_PATH_STATE_MAX] = {
         [PATH_FAILED] = UNIT_FAILED
 };
 
+/* All path specs share one inotify fd. The kernel hands out one
+ * watch descriptor per inode only, hence the specs watching the same
+ * directories share a watch, refcounted, whose mask is the union of
+ * theirs. Events are filtered by the mask of each reference again. */
+struct PathInotifyWatch {
+        int wd; /* -1 once the kernel dropped the watch */
+        uint32_t mask;
+
+        LIST_HEAD(PathInotifyRef, refs);
+};
+
+#define INOTIFY_BUFFER_SIZE (16 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+static int path_inotify_setup(Manager *m) {
+        struct epoll_event ev = {
+                .events = EPOLLIN,
+                .data.ptr = &m->path_inotify_watch,
+        };
+        int r, fd;
+
+        assert(m);
+
+        if (m->path_inotify_watch.type == WATCH_PATH_INOTIFY)
+                return 0;
+
+        r = hashmap_ensure_allocated(&m->path_inotify_watches, trivial_hash_func, trivial_compare_func);
+        if (r < 0)
+                return r;
+
+        fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                r = -errno;
+                close_nointr_nofail(fd);
+                return r;
+        }
+
+        m->path_inotify_watch.type = WATCH_PATH_INOTIFY;
+        m->path_inotify_watch.fd = fd;
+
+        return 0;
+}
+
+static int path_inotify_ref(Manager *m, PathInotifyRef *ref, const char *path, uint32_t mask) {
+        PathInotifyWatch *w;
+        int wd, r;
+
+        assert(m);
+        assert(ref);
+        assert(path);
+
+        wd = inotify_add_watch(m->path_inotify_watch.fd, path, mask|IN_MASK_ADD);
+        if (wd < 0)
+                return -errno;
+
+        w = hashmap_get(m->path_inotify_watches, INT_TO_PTR(wd));
+        if (!w) {
+                w = new0(PathInotifyWatch, 1);
+                if (!w) {
+                        inotify_rm_watch(m->path_inotify_watch.fd, wd);
+                        return -ENOMEM;
+                }
+
+                w->wd = wd;
+
+                r = hashmap_put(m->path_inotify_watches, INT_TO_PTR(wd), w);
+                if (r < 0) {
+                        inotify_rm_watch(m->path_inotify_watch.fd, wd);
+                        free(w);
+                        return r;
+                }
+        }
+
+        w->mask |= mask;
+
+        ref->watch = w;
+        ref->mask = mask;
+        LIST_PREPEND(PathInotifyRef, refs, w->refs, ref);
+
+        return wd;
+}
+
+static void path_inotify_unref(Manager *m, PathInotifyRef *ref) {
+        PathInotifyWatch *w;
+
+        assert(m);
+        assert(ref);
+
+        w = ref->watch;
+        if (!w)
+                return;
+
+        LIST_REMOVE(PathInotifyRef, refs, w->refs, ref);
+        ref->watch = NULL;
+
+        if (w->refs)
+                return;
+
+        if (w->wd >= 0) {
+                hashmap_remove(m->path_inotify_watches, INT_TO_PTR(w->wd));
+                inotify_rm_watch(m->path_inotify_watch.fd, w->wd);
+        }
+
+        free(w);
+}
+
+/* Tells the kernel about a reference needing fewer events now, path
+ * is where the watch was added just before */
+static void path_inotify_narrow(Manager *m, PathInotifyRef *ref, const char *path, uint32_t mask) {
+        PathInotifyWatch *w;
+        PathInotifyRef *i;
+        uint32_t all = 0;
+        int wd;
+
+        assert(m);
+        assert(ref);
+
+        ref->mask = mask;
+
+        w = ref->watch;
+        if (!w || w->wd < 0)
+                return;
+
+        LIST_FOREACH(refs, i, w->refs)
+                all |= i->mask;
+
+        if (all == w->mask)
+                return;
+
+        /* Errors are ignored, the worst that can happen is that we
+         * get spurious events */
+        wd = inotify_add_watch(m->path_inotify_watch.fd, path, all);
+        if (wd == w->wd)
+                w->mask = all;
+        else if (wd >= 0 && !hashmap_get(m->path_inotify_watches, INT_TO_PTR(wd)))
+                /* Replaced since, and we just watched the new one */
+                inotify_rm_watch(m->path_inotify_watch.fd, wd);
+}
+
 int path_spec_watch(PathSpec *s, Unit *u) {
 
         static const int flags_table[_PATH_TYPE_MAX] = {
@@ -54,6 +195,7 @@ int path_spec_watch(PathSpec *s, Unit *u) {
 
         bool exists = false;
         char *slash, *oldslash = NULL;
+        unsigned n = 1;
         int r;
 
         assert(u);
@@ -61,19 +203,27 @@ int path_spec_watch(PathSpec *s, Unit *u) {
 
         path_spec_unwatch(s, u);
 
-        s->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
-        if (s->inotify_fd < 0) {
-                r = -errno;
-                goto fail;
-        }
-
-        r = unit_watch_fd(u, s->inotify_fd, EPOLLIN, &s->watch);
+        r = path_inotify_setup(u->manager);
         if (r < 0)
                 goto fail;
 
         /* This assumes the path was passed through path_kill_slashes()! */
 
+        for (slash = strchr(s->path, '/'); slash; slash = strchr(slash+1, '/'))
+                n++;
+
+        s->refs = new0(PathInotifyRef, n);
+        if (!s->refs) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        s->watch.type = WATCH_FD;
+        s->watch.fd = u->manager->path_inotify_watch.fd;
+        s->watch.data.unit = u;
+
         for (slash = strchr(s->path, '/'); ; slash = strchr(slash+1, '/')) {
+                PathInotifyRef *ref;
                 char *cut = NULL;
                 int flags;
                 char tmp;
@@ -87,21 +237,25 @@ int path_spec_watch(PathSpec *s, Unit *u) {
                 } else
                         flags = flags_table[s->type];
 
-                r = inotify_add_watch(s->inotify_fd, s->path, flags);
+                assert(s->n_refs < n);
+                ref = s->refs + s->n_refs;
+                ref->spec = s;
+
+                r = path_inotify_ref(u->manager, ref, s->path, flags);
                 if (r < 0) {
-                        if (errno == EACCES || errno == ENOENT) {
+                        if (r == -EACCES || r == -ENOENT) {
                                 if (cut)
                                         *cut = tmp;
                                 break;
                         }
 
-                        log_warning("Failed to add watch on %s: %m", s->path);
-                        r = -errno;
+                        log_warning("Failed to add watch on %s: %s", s->path, strerror(-r));
                         if (cut)
                                 *cut = tmp;
                         goto fail;
                 } else {
                         exists = true;
+                        s->n_refs++;
 
                         /* Path exists, we don't need to watch parent
                            too closely. */
@@ -110,9 +264,7 @@ int path_spec_watch(PathSpec *s, Unit *u) {
                                 char tmp2 = *cut2;
                                 *cut2 = '\0';
 
-                                inotify_add_watch(s->inotify_fd, s->path, IN_MOVE_SELF);
-                                /* Error is ignored, the worst can happen is
-                                   we get spurious events. */
+                                path_inotify_narrow(u->manager, ref - 1, s->path, IN_MOVE_SELF);
 
                                 *cut2 = tmp2;
                         }
@@ -125,16 +277,15 @@ int path_spec_watch(PathSpec *s, Unit *u) {
                         oldslash = slash;
                 else {
                         /* whole path has been iterated over */
-                        s->primary_wd = r;
+                        ref->primary = true;
                         break;
                 }
         }
 
         if (!exists) {
-                log_error("Failed to add watch on any of the components of %s: %m",
-                          s->path);
-                r = -errno; /* either EACCESS or ENOENT */
-                goto fail;
+                log_error("Failed to add watch on any of the components of %s: %s",
+                          s->path, strerror(-r));
+                goto fail; /* either EACCESS or ENOENT */
         }
 
         return 0;
@@ -145,53 +296,118 @@ fail:
 }
 
 void path_spec_unwatch(PathSpec *s, Unit *u) {
+        unsigned i;
 
-        if (s->inotify_fd < 0)
-                return;
+        assert(s);
+        assert(u);
 
-        unit_unwatch_fd(u, &s->watch);
+        if (s->in_inotify_queue) {
+                LIST_REMOVE(PathSpec, inotify_queue, u->manager->path_inotify_queue, s);
+                s->in_inotify_queue = false;
+        }
 
-        close_nointr_nofail(s->inotify_fd);
-        s->inotify_fd = -1;
+        s->inotify_changed = false;
+
+        for (i = 0; i < s->n_refs; i++)
+                path_inotify_unref(u->manager, s->refs + i);
+
+        free(s->refs);
+        s->refs = NULL;
+        s->n_refs = 0;
+
+        watch_init(&s->watch);
 }
 
 int path_spec_fd_event(PathSpec *s, uint32_t events) {
-        uint8_t _cleanup_free_ *buf = NULL;
-        struct inotify_event *e;
-        ssize_t k;
-        int l;
-        int r = 0;
+        bool changed;
 
         if (events != EPOLLIN) {
                 log_error("Got invalid poll event on inotify.");
                 return -EINVAL;
         }
 
-        if (ioctl(s->inotify_fd, FIONREAD, &l) < 0) {
-                log_error("FIONREAD failed: %m");
-                return -errno;
+        /* The events have been read already, all that is left is
+         * whether one of them was on the path itself */
+        changed = s->inotify_changed;
+        s->inotify_changed = false;
+
+        return changed;
+}
+
+static void path_inotify_queue_spec(Manager *m, PathSpec *s) {
+        if (s->in_inotify_queue)
+                return;
+
+        LIST_PREPEND(PathSpec, inotify_queue, m->path_inotify_queue, s);
+        s->in_inotify_queue = true;
+}
+
+static void path_inotify_process_event(Manager *m, struct inotify_event *e) {
+        PathInotifyWatch *w;
+        PathInotifyRef *ref;
+        Iterator i;
+
+        if (e->mask & IN_Q_OVERFLOW) {
+                /* Events got lost, let everybody recheck */
+                HASHMAP_FOREACH(w, m->path_inotify_watches, i)
+                        LIST_FOREACH(refs, ref, w->refs)
+                                path_inotify_queue_spec(m, ref->spec);
+                return;
         }
 
-        assert(l > 0);
+        w = hashmap_get(m->path_inotify_watches, INT_TO_PTR(e->wd));
+        if (!w)
+                return;
 
-        buf = malloc(l);
-        if (!buf)
-                return log_oom();
+        LIST_FOREACH(refs, ref, w->refs) {
+                if (!(e->mask & (ref->mask|IN_IGNORED|IN_UNMOUNT)))
+                        continue;
 
-        k = read(s->inotify_fd, buf, l);
-        if (k < 0) {
-                log_error("Failed to read inotify event: %m");
-                return -errno;
+                if (ref->primary &&
+                    (ref->spec->type == PATH_CHANGED || ref->spec->type == PATH_MODIFIED))
+                        ref->spec->inotify_changed = true;
+
+                path_inotify_queue_spec(m, ref->spec);
         }
 
-        e = (struct inotify_event*) buf;
+        if (e->mask & IN_IGNORED) {
+                /* The kernel dropped the watch, the references go
+                 * when their specs are watched again */
+                hashmap_remove(m->path_inotify_watches, INT_TO_PTR(w->wd));
+                w->wd = -1;
+        }
+}
 
+void path_inotify_fd_event(Manager *m, uint32_t events) {
+        union {
+                struct inotify_event e;
+                uint8_t buffer[INOTIFY_BUFFER_SIZE];
+        } u;
+        struct inotify_event *e;
+        PathSpec *s;
+        ssize_t k;
+
+        assert(m);
+
+        if (events != EPOLLIN) {
+                log_error("Got invalid poll event on inotify.");
+                return;
+        }
+
+        /* Just one read at a time, if there is more we'll get woken
+         * up again right away */
+        k = read(m->path_inotify_watch.fd, &u, sizeof(u));
+        if (k < 0) {
+                if (errno != EAGAIN && errno != EINTR)
+                        log_error("Failed to read inotify event: %m");
+                return;
+        }
+
+        e = &u.e;
         while (k > 0) {
                 size_t step;
 
-                if ((s->type == PATH_CHANGED || s->type == PATH_MODIFIED) &&
-                    s->primary_wd == e->wd)
-                        r = 1;
+                path_inotify_process_event(m, e);
 
                 step = sizeof(struct inotify_event) + e->len;
                 assert(step <= (size_t) k);
@@ -200,7 +416,17 @@ int path_spec_fd_event(PathSpec *s, uint32_t events) {
                 k -= step;
         }
 
-        return r;
+        /* Only now that all events of this read are accounted for
+         * dispatch them to the units, which usually watch their specs
+         * again, and hence take them off the queue */
+        while ((s = m->path_inotify_queue)) {
+                Unit *unit = s->watch.data.unit;
+
+                LIST_REMOVE(PathSpec, inotify_queue, m->path_inotify_queue, s);
+                s->in_inotify_queue = false;
+
+                UNIT_VTABLE(unit)->fd_event(unit, s->watch.fd, EPOLLIN, &s->watch);
+        }
 }
 
 static bool path_spec_check_good(PathSpec *s, bool initial) {
@@ -266,7 +492,7 @@ static void path_spec_dump(PathSpec *s, FILE *f, const char *prefix) {
 
 void path_spec_done(PathSpec *s) {
         assert(s);
-        assert(s->inotify_fd == -1);
+        assert(!s->refs);
 
         free(s->path);
 }
@@ -326,13 +552,30 @@ int path_add_one_mount_link(Path *p, Mount *m) {
 }
 
 static int path_add_mount_links(Path *p) {
-        Unit *other;
+        _cleanup_set_free_ Set *s = NULL;
+        PathSpec *spec;
+        Iterator i;
+        Mount *m;
         int r;
 
         assert(p);
 
-        LIST_FOREACH(units_by_type, other, UNIT(p)->manager->units_by_type[UNIT_MOUNT]) {
-                r = path_add_one_mount_link(p, MOUNT(other));
+        s = set_new(trivial_hash_func, trivial_compare_func);
+        if (!s)
+                return -ENOMEM;
+
+        LIST_FOREACH(spec, spec, p->specs) {
+                r = unit_add_path_index(UNIT(p), spec->path);
+                if (r < 0)
+                        return r;
+
+                r = path_trie_find_above(UNIT(p)->manager->units_by_path[UNIT_MOUNT], spec->path, s);
+                if (r < 0)
+                        return r;
+        }
+
+        SET_FOREACH(m, s, i) {
+                r = path_add_one_mount_link(p, m);
                 if (r < 0)
                         return r;
         }
@@ -389,7 +632,7 @@ static int path_load(Unit *u) {
 
         if (u->load_state == UNIT_LOADED) {
 
-                if (set_isempty(u->dependencies[UNIT_TRIGGERS])) {
+                if (!unit_first_dependency(u, UNIT_TRIGGERS)) {
                         Unit *x;
 
                         r = unit_load_related_unit(u, ".service", &x);
@@ -707,7 +950,7 @@ static void path_fd_event(Unit *u, int fd, uint32_t events, Watch *w) {
         /* log_debug("inotify wakeup on %s.", u->id); */
 
         LIST_FOREACH(spec, s, p->specs)
-                if (path_spec_owns_inotify_fd(s, fd))
+                if (path_spec_owns_watch(s, w))
                         break;
 
         if (!s) {
@@ -760,6 +1003,25 @@ static void path_trigger_notify(Unit *u, Unit *other) {
         }
 }
 
+static void path_shutdown(Manager *m) {
+        PathInotifyWatch *w;
+
+        assert(m);
+
+        /* The specs are all gone with their units by now, hence so
+         * are their references */
+        while ((w = hashmap_steal_first(m->path_inotify_watches)))
+                free(w);
+
+        hashmap_free(m->path_inotify_watches);
+        m->path_inotify_watches = NULL;
+
+        if (m->path_inotify_watch.fd >= 0)
+                close_nointr_nofail(m->path_inotify_watch.fd);
+
+        watch_init(&m->path_inotify_watch);
+}
+
 static void path_reset_failed(Unit *u) {
         Path *p = PATH(u);
 
@@ -827,7 +1089,10 @@ const UnitVTable path_vtable = {
 
         .reset_failed = path_reset_failed,
 
+        .shutdown = path_shutdown,
+
         .bus_interface = "org.freedesktop.systemd1.Path",
         .bus_message_handler = bus_path_message_handler,
+        .bus_append_properties = bus_path_append_properties,
         .bus_invalidating_properties = bus_path_invalidating_properties
 };
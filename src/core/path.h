@@ -45,16 +45,38 @@ typedef enum PathType {
         _PATH_TYPE_INVALID = -1
 } PathType;
 
+typedef struct PathInotifyWatch PathInotifyWatch;
+
+/* A reference of a spec on a watch of the shared inotify fd, with
+ * the events the spec is interested in */
+typedef struct PathInotifyRef {
+        struct PathSpec *spec;
+        PathInotifyWatch *watch;
+        uint32_t mask;
+        bool primary;
+
+        LIST_FIELDS(struct PathInotifyRef, refs);
+} PathInotifyRef;
+
 typedef struct PathSpec {
         char *path;
 
+        /* Not registered with epoll itself, but passed to the
+         * fd_event() callback of the unit when the watches of the
+         * spec got events */
         Watch watch;
 
         LIST_FIELDS(struct PathSpec, spec);
 
         PathType type;
-        int inotify_fd;
-        int primary_wd;
+
+        /* One for each component of the path that is watched */
+        PathInotifyRef *refs;
+        unsigned n_refs;
+
+        LIST_FIELDS(struct PathSpec, inotify_queue);
+        bool in_inotify_queue:1;
+        bool inotify_changed:1;
 
         bool previous_exists;
 } PathSpec;
@@ -64,10 +86,12 @@ void path_spec_unwatch(PathSpec *s, Unit *u);
 int path_spec_fd_event(PathSpec *s, uint32_t events);
 void path_spec_done(PathSpec *s);
 
-static inline bool path_spec_owns_inotify_fd(PathSpec *s, int fd) {
-        return s->inotify_fd == fd;
+static inline bool path_spec_owns_watch(PathSpec *s, Watch *w) {
+        return &s->watch == w;
 }
 
+void path_inotify_fd_event(Manager *m, uint32_t events);
+
 typedef enum PathResult {
         PATH_SUCCESS,
         PATH_FAILURE_RESOURCES,
@@ -0,0 +1,304 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+
+#include "log.h"
+#include "util.h"
+#include "hashmap.h"
+#include "cgroup.h"
+#include "pid-cache.h"
+
+/* Processes that exited are kept around separately until they are
+ * reaped, since their zombies are still looked up on SIGCHLD. This
+ * many of them are remembered at most. */
+#define PID_CACHE_EXITED_MAX 4096
+
+#define PROC_EVENTS_BUFFER_SIZE (8*1024)
+#define PROC_EVENTS_RCVBUF (1024*1024)
+
+static int proc_events_send_op(int fd, enum proc_cn_mcast_op op) {
+        struct {
+                struct nlmsghdr header;
+                struct cn_msg cn;
+                enum proc_cn_mcast_op op;
+        } _packed_ msg = {
+                .header.nlmsg_len = sizeof(msg),
+                .header.nlmsg_type = NLMSG_DONE,
+                .header.nlmsg_pid = getpid(),
+                .cn.id.idx = CN_IDX_PROC,
+                .cn.id.val = CN_VAL_PROC,
+                .cn.len = sizeof(enum proc_cn_mcast_op),
+                .op = op,
+        };
+
+        if (send(fd, &msg, sizeof(msg), MSG_NOSIGNAL) < 0)
+                return -errno;
+
+        return 0;
+}
+
+int manager_setup_pid_cache(Manager *m) {
+        struct epoll_event ev = {
+                .events = EPOLLIN,
+                .data.ptr = &m->proc_events_watch,
+        };
+        union {
+                struct sockaddr sa;
+                struct sockaddr_nl nl;
+        } sa = {
+                .nl.nl_family = AF_NETLINK,
+                .nl.nl_groups = CN_IDX_PROC,
+        };
+        int fd, r, value = PROC_EVENTS_RCVBUF;
+
+        assert(m);
+        assert(m->proc_events_watch.type == WATCH_INVALID);
+
+        fd = socket(AF_NETLINK, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, NETLINK_CONNECTOR);
+        if (fd < 0) {
+                log_debug("Failed to allocate process events socket, not caching cgroup lookups: %m");
+                return 0;
+        }
+
+        if (bind(fd, &sa.sa, sizeof(sa.nl)) < 0) {
+                log_debug("Failed to bind process events socket, not caching cgroup lookups: %m");
+                goto fail;
+        }
+
+        /* Losing events means flushing the cache, so try to make
+         * that rare during fork storms */
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &value, sizeof(value)) < 0)
+                setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value));
+
+        r = proc_events_send_op(fd, PROC_CN_MCAST_LISTEN);
+        if (r < 0) {
+                log_debug("Failed to subscribe to process events, not caching cgroup lookups: %s", strerror(-r));
+                goto fail;
+        }
+
+        m->pid_cache = hashmap_new(trivial_hash_func, trivial_compare_func);
+        m->pid_cache_exited = hashmap_new(trivial_hash_func, trivial_compare_func);
+        if (!m->pid_cache || !m->pid_cache_exited) {
+                r = log_oom();
+                goto fail_free;
+        }
+
+        if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                r = -errno;
+                log_error("Failed to add process events socket to epoll: %m");
+                goto fail_free;
+        }
+
+        m->proc_events_watch.type = WATCH_PROC_EVENTS;
+        m->proc_events_watch.fd = fd;
+
+        log_debug("Subscribed to process events.");
+
+        return 0;
+
+fail:
+        close_nointr_nofail(fd);
+        return 0;
+
+fail_free:
+        hashmap_free(m->pid_cache);
+        hashmap_free(m->pid_cache_exited);
+        m->pid_cache = m->pid_cache_exited = NULL;
+        close_nointr_nofail(fd);
+        return r;
+}
+
+void manager_shutdown_pid_cache(Manager *m) {
+        assert(m);
+
+        if (m->proc_events_watch.fd >= 0) {
+                proc_events_send_op(m->proc_events_watch.fd, PROC_CN_MCAST_IGNORE);
+                close_nointr_nofail(m->proc_events_watch.fd);
+        }
+
+        watch_init(&m->proc_events_watch);
+
+        hashmap_free(m->pid_cache);
+        hashmap_free(m->pid_cache_exited);
+        m->pid_cache = m->pid_cache_exited = NULL;
+}
+
+static void pid_cache_fork(Manager *m, pid_t parent, pid_t child) {
+        Unit *u;
+
+        hashmap_remove(m->pid_cache, LONG_TO_PTR(child));
+        hashmap_remove(m->pid_cache_exited, LONG_TO_PTR(child));
+
+        /* Our own children move themselves into their cgroup only
+         * after the fork */
+        if (parent == getpid())
+                return;
+
+        /* Children start out in the cgroup of their parent */
+        u = hashmap_get(m->pid_cache, LONG_TO_PTR(parent));
+        if (u)
+                hashmap_put(m->pid_cache, LONG_TO_PTR(child), u);
+}
+
+static void pid_cache_exit(Manager *m, pid_t pid) {
+        Unit *u;
+
+        u = hashmap_remove(m->pid_cache, LONG_TO_PTR(pid));
+        if (!u)
+                return;
+
+        if (hashmap_size(m->pid_cache_exited) >= PID_CACHE_EXITED_MAX)
+                hashmap_clear(m->pid_cache_exited);
+
+        hashmap_put(m->pid_cache_exited, LONG_TO_PTR(pid), u);
+}
+
+int manager_dispatch_proc_events(Manager *m) {
+        assert(m);
+
+        if (m->proc_events_watch.fd < 0)
+                return 0;
+
+        for (;;) {
+                uint8_t buf[PROC_EVENTS_BUFFER_SIZE] _alignas_(struct nlmsghdr);
+                union {
+                        struct sockaddr sa;
+                        struct sockaddr_nl nl;
+                } sa;
+                socklen_t salen = sizeof(sa);
+                struct nlmsghdr *h;
+                ssize_t n;
+
+                n = recvfrom(m->proc_events_watch.fd, buf, sizeof(buf), MSG_DONTWAIT, &sa.sa, &salen);
+                if (n < 0) {
+                        if (errno == EAGAIN || errno == EINTR)
+                                return 0;
+
+                        if (errno == ENOBUFS) {
+                                /* We missed some events, hence
+                                 * can't trust anything we know */
+                                log_debug("Process events socket overflowed, flushing PID cache.");
+                                pid_cache_flush(m);
+                                continue;
+                        }
+
+                        return -errno;
+                }
+
+                /* Only the kernel may tell us about processes */
+                if (salen < sizeof(sa.nl) || sa.nl.nl_pid != 0)
+                        continue;
+
+                for (h = (struct nlmsghdr*) buf; NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+                        struct cn_msg *cn;
+                        struct proc_event *e;
+
+                        if (h->nlmsg_type == NLMSG_NOOP)
+                                continue;
+
+                        if (h->nlmsg_type == NLMSG_ERROR ||
+                            h->nlmsg_len < NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(struct proc_event)))
+                                break;
+
+                        cn = NLMSG_DATA(h);
+                        if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+                                continue;
+
+                        e = (struct proc_event*) cn->data;
+
+                        switch (e->what) {
+
+                        case PROC_EVENT_FORK:
+                                /* Threads share the unit of their process */
+                                if (e->event_data.fork.child_pid == e->event_data.fork.child_tgid)
+                                        pid_cache_fork(m,
+                                                       e->event_data.fork.parent_tgid,
+                                                       e->event_data.fork.child_tgid);
+                                break;
+
+                        case PROC_EVENT_EXIT:
+                                if (e->event_data.exit.process_pid == e->event_data.exit.process_tgid)
+                                        pid_cache_exit(m, e->event_data.exit.process_tgid);
+                                break;
+
+                        default:
+                                break;
+                        }
+                }
+        }
+}
+
+Unit* pid_cache_get_unit(Manager *m, pid_t pid) {
+        Unit *u;
+
+        assert(m);
+
+        if (pid <= 1)
+                return NULL;
+
+        if (!m->pid_cache)
+                return cgroup_unit_by_pid(m, pid);
+
+        /* Catch up first, so that we know about the PID being reused
+         * since we last saw it */
+        if (manager_dispatch_proc_events(m) < 0)
+                pid_cache_flush(m);
+
+        u = hashmap_get(m->pid_cache, LONG_TO_PTR(pid));
+        if (u)
+                return u;
+
+        u = hashmap_get(m->pid_cache_exited, LONG_TO_PTR(pid));
+        if (u)
+                return u;
+
+        u = cgroup_unit_by_pid(m, pid);
+        if (u)
+                hashmap_put(m->pid_cache, LONG_TO_PTR(pid), u);
+
+        return u;
+}
+
+void pid_cache_forget(Manager *m, pid_t pid) {
+        assert(m);
+
+        if (!m->pid_cache)
+                return;
+
+        hashmap_remove(m->pid_cache, LONG_TO_PTR(pid));
+        hashmap_remove(m->pid_cache_exited, LONG_TO_PTR(pid));
+}
+
+void pid_cache_flush(Manager *m) {
+        assert(m);
+
+        if (!m->pid_cache)
+                return;
+
+        hashmap_clear(m->pid_cache);
+        hashmap_clear(m->pid_cache_exited);
+}
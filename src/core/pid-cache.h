@@ -0,0 +1,41 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "manager.h"
+
+/* Caches which unit a process found in the cgroup tree belongs to,
+ * kept correct with fork and exit events from the kernel's process
+ * events connector. Without the connector (it needs CAP_NET_ADMIN)
+ * nothing is cached and every lookup goes to /proc. */
+
+int manager_setup_pid_cache(Manager *m);
+void manager_shutdown_pid_cache(Manager *m);
+
+int manager_dispatch_proc_events(Manager *m);
+
+/* Like cgroup_unit_by_pid(), but answered from the cache if
+ * possible. Not exact for processes moved between cgroups by somebody
+ * else after they were looked up, hence only to be used where a wrong
+ * answer does no harm beyond a message being misattributed. */
+Unit* pid_cache_get_unit(Manager *m, pid_t pid);
+
+void pid_cache_forget(Manager *m, pid_t pid);
+void pid_cache_flush(Manager *m);
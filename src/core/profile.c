@@ -0,0 +1,54 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include "profile.h"
+
+ProfileCounter profile_counters[_PROFILE_POINT_MAX] = {};
+
+void profile_add(ProfilePoint p, usec_t begin) {
+        ProfileCounter *c;
+        usec_t d;
+
+        assert(p >= 0);
+        assert(p < _PROFILE_POINT_MAX);
+
+        d = now(CLOCK_MONOTONIC) - begin;
+        c = profile_counters + p;
+
+        c->n++;
+        c->total += d;
+        if (d > c->max)
+                c->max = d;
+}
+
+static const char* const profile_point_table[_PROFILE_POINT_MAX] = {
+        [PROFILE_LOAD_QUEUE] = "load-queue",
+        [PROFILE_GENERATORS] = "generators",
+        [PROFILE_TRANSACTION] = "transaction",
+        [PROFILE_RUN_QUEUE] = "run-queue",
+        [PROFILE_SPAWN] = "spawn",
+        [PROFILE_CGROUP] = "cgroup",
+        [PROFILE_BUS_DISPATCH] = "bus-dispatch",
+        [PROFILE_BUS_SIGNALS] = "bus-signals",
+        [PROFILE_EVENT] = "event",
+        [PROFILE_LOOP_ITERATION] = "loop-iteration"
+};
+
+DEFINE_STRING_TABLE_LOOKUP(profile_point, ProfilePoint);
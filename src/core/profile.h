@@ -0,0 +1,57 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include "util.h"
+
+/* Counts how often and for how long PID 1 was busy in a couple of
+ * places, for systemd-analyze profile. The points may nest, for
+ * example spawning happens while the run queue is dispatched. */
+
+typedef enum ProfilePoint {
+        PROFILE_LOAD_QUEUE,
+        PROFILE_GENERATORS,
+        PROFILE_TRANSACTION,
+        PROFILE_RUN_QUEUE,
+        PROFILE_SPAWN,
+        PROFILE_CGROUP,
+        PROFILE_BUS_DISPATCH,
+        PROFILE_BUS_SIGNALS,
+        PROFILE_EVENT,
+        PROFILE_LOOP_ITERATION,
+        _PROFILE_POINT_MAX,
+        _PROFILE_POINT_INVALID = -1
+} ProfilePoint;
+
+typedef struct ProfileCounter {
+        uint64_t n;
+        usec_t total;
+        usec_t max;
+} ProfileCounter;
+
+extern ProfileCounter profile_counters[_PROFILE_POINT_MAX];
+
+/* Accounts the time since begin, taken with now(CLOCK_MONOTONIC) */
+void profile_add(ProfilePoint p, usec_t begin);
+
+const char* profile_point_to_string(ProfilePoint p);
+ProfilePoint profile_point_from_string(const char *s);
@@ -193,6 +193,8 @@ static int service_set_main_pid(Service *s, pid_t pid) {
         s->main_pid = pid;
         s->main_pid_known = true;
 
+        unit_start_latency_mark(UNIT(s), START_TIMESTAMP_MAIN_PID);
+
         if (get_parent_of_pid(pid, &ppid) >= 0 && ppid != getpid()) {
                 log_warning_unit(UNIT(s)->id,
                                  "%s: Supervising process %lu which is not our child. We'll most likely not notice when it exits.",
@@ -253,7 +255,7 @@ static void service_handle_watchdog(Service *s) {
                 return;
         }
 
-        r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->watchdog_usec - offset, &s->watchdog_watch);
+        r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->watchdog_usec - offset, 0, &s->watchdog_watch);
         if (r < 0)
                 log_warning_unit(UNIT(s)->id,
                                  "%s failed to install watchdog timer: %s",
@@ -264,6 +266,15 @@ static void service_reset_watchdog(Service *s) {
         assert(s);
 
         dual_timestamp_get(&s->watchdog_timestamp);
+
+        /* A pending timer elapses no later than the new deadline, and
+         * service_handle_watchdog() then queues it again for the rest
+         * of the time since this ping. Hence a ping costs taking the
+         * time, not moving the timer. */
+        if (s->watchdog_watch.type == WATCH_UNIT_TIMER &&
+            s->watchdog_watch.timer_queued)
+                return;
+
         service_handle_watchdog(s);
 }
 
@@ -531,9 +542,54 @@ static bool usage_contains_reload(const char *line) {
                 strcasestr(line, "|reload\""));
 }
 
-static int service_load_sysv_path(Service *s, const char *path) {
-        FILE *f;
-        Unit *u;
+typedef struct SysvScript {
+        char *path;
+
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        usec_t mtime;
+
+        bool has_lsb:1;
+        bool supports_reload:1;
+        int start_priority;
+        char *runlevels;
+        char *pid_file;
+        char *description;
+
+        /* LSB facility names, not translated yet */
+        char **provides;
+        char **before;
+        char **after;
+} SysvScript;
+
+static void sysv_script_free(SysvScript *sc) {
+        if (!sc)
+                return;
+
+        free(sc->path);
+        free(sc->runlevels);
+        free(sc->pid_file);
+        free(sc->description);
+        strv_free(sc->provides);
+        strv_free(sc->before);
+        strv_free(sc->after);
+        free(sc);
+}
+
+static bool sysv_script_is_current(SysvScript *sc, const struct stat *st) {
+        assert(sc);
+        assert(st);
+
+        return sc->dev == st->st_dev &&
+                sc->ino == st->st_ino &&
+                sc->size == st->st_size &&
+                sc->mtime == timespec_load(&st->st_mtim);
+}
+
+/* Parses the headers of an init script without touching any unit, so
+ * that the result may be cached */
+static int sysv_script_parse(SysvScript *sc, FILE *f, const char *path, const char *unit_id) {
         unsigned line = 0;
         int r;
         enum {
@@ -544,41 +600,11 @@ static int service_load_sysv_path(Service *s, const char *path) {
                 USAGE_CONTINUATION
         } state = NORMAL;
         char *short_description = NULL, *long_description = NULL, *chkconfig_description = NULL, *description;
-        struct stat st;
-        bool supports_reload = false;
 
-        assert(s);
+        assert(sc);
+        assert(f);
         assert(path);
 
-        u = UNIT(s);
-
-        f = fopen(path, "re");
-        if (!f) {
-                r = errno == ENOENT ? 0 : -errno;
-                goto finish;
-        }
-
-        if (fstat(fileno(f), &st) < 0) {
-                r = -errno;
-                goto finish;
-        }
-
-        free(u->source_path);
-        u->source_path = strdup(path);
-        if (!u->source_path) {
-                r = -ENOMEM;
-                goto finish;
-        }
-        u->source_mtime = timespec_load(&st.st_mtim);
-
-        if (null_or_empty(&st)) {
-                u->load_state = UNIT_MASKED;
-                r = 0;
-                goto finish;
-        }
-
-        s->is_sysv = true;
-
         while (!feof(f)) {
                 char l[LINE_MAX], *t;
 
@@ -587,7 +613,7 @@ static int service_load_sysv_path(Service *s, const char *path) {
                                 break;
 
                         r = -errno;
-                        log_error_unit(u->id,
+                        log_error_unit(unit_id,
                                        "Failed to read configuration file '%s': %s",
                                        path, strerror(-r));
                         goto finish;
@@ -603,7 +629,7 @@ static int service_load_sysv_path(Service *s, const char *path) {
                         if ( state == USAGE_CONTINUATION ||
                             (state == NORMAL && strcasestr(t, "usage"))) {
                                 if (usage_contains_reload(t)) {
-                                        supports_reload = true;
+                                        sc->supports_reload = true;
                                         state = NORMAL;
                                 } else if (t[strlen(t)-1] == '\\')
                                         state = USAGE_CONTINUATION;
@@ -616,7 +642,7 @@ static int service_load_sysv_path(Service *s, const char *path) {
 
                 if (state == NORMAL && streq(t, "### BEGIN INIT INFO")) {
                         state = LSB;
-                        s->sysv_has_lsb = true;
+                        sc->has_lsb = true;
                         continue;
                 }
 
@@ -642,7 +668,7 @@ static int service_load_sysv_path(Service *s, const char *path) {
                                            runlevels,
                                            &start_priority) != 2) {
 
-                                        log_warning_unit(u->id,
+                                        log_warning_unit(unit_id,
                                                          "[%s:%u] Failed to parse chkconfig line. Ignoring.",
                                                          path, line);
                                         continue;
@@ -652,11 +678,11 @@ static int service_load_sysv_path(Service *s, const char *path) {
                                  * symlink farms is preferred over the
                                  * data from the LSB header. */
                                 if (start_priority < 0 || start_priority > 99)
-                                        log_warning_unit(u->id,
+                                        log_warning_unit(unit_id,
                                                          "[%s:%u] Start priority out of range. Ignoring.",
                                                          path, line);
                                 else
-                                        s->sysv_start_priority = start_priority;
+                                        sc->start_priority = start_priority;
 
                                 char_array_0(runlevels);
                                 k = delete_chars(runlevels, WHITESPACE "-");
@@ -669,8 +695,8 @@ static int service_load_sysv_path(Service *s, const char *path) {
                                                 goto finish;
                                         }
 
-                                        free(s->sysv_runlevels);
-                                        s->sysv_runlevels = d;
+                                        free(sc->runlevels);
+                                        sc->runlevels = d;
                                 }
 
                         } else if (startswith_no_case(t, "description:")) {
@@ -703,7 +729,7 @@ static int service_load_sysv_path(Service *s, const char *path) {
 
                                 fn = strstrip(t+8);
                                 if (!path_is_absolute(fn)) {
-                                        log_warning_unit(u->id,
+                                        log_warning_unit(unit_id,
                                                          "[%s:%u] PID file not absolute. Ignoring.",
                                                          path, line);
                                         continue;
@@ -714,8 +740,8 @@ static int service_load_sysv_path(Service *s, const char *path) {
                                         goto finish;
                                 }
 
-                                free(s->pid_file);
-                                s->pid_file = fn;
+                                free(sc->pid_file);
+                                sc->pid_file = fn;
                         }
 
                 } else if (state == DESCRIPTION) {
@@ -757,46 +783,14 @@ static int service_load_sysv_path(Service *s, const char *path) {
                                 state = LSB;
 
                                 FOREACH_WORD_QUOTED(w, z, t+9, i) {
-                                        char *n, *m;
+                                        char *n;
 
-                                        if (!(n = strndup(w, z))) {
+                                        n = strndup(w, z);
+                                        if (!n || strv_push(&sc->provides, n) < 0) {
+                                                free(n);
                                                 r = -ENOMEM;
                                                 goto finish;
                                         }
-
-                                        r = sysv_translate_facility(n, path_get_file_name(path), &m);
-                                        free(n);
-
-                                        if (r < 0)
-                                                goto finish;
-
-                                        if (r == 0)
-                                                continue;
-
-                                        if (unit_name_to_type(m) == UNIT_SERVICE)
-                                                r = unit_merge_by_name(u, m);
-                                        else
-                                                /* NB: SysV targets
-                                                 * which are provided
-                                                 * by a service are
-                                                 * pulled in by the
-                                                 * services, as an
-                                                 * indication that the
-                                                 * generic service is
-                                                 * now available. This
-                                                 * is strictly
-                                                 * one-way. The
-                                                 * targets do NOT pull
-                                                 * in the SysV
-                                                 * services! */
-                                                r = unit_add_two_dependencies_by_name(u, UNIT_BEFORE, UNIT_WANTS, m, NULL, true);
-
-                                        if (r < 0)
-                                                log_error_unit(u->id,
-                                                               "[%s:%u] Failed to add LSB Provides name %s, ignoring: %s",
-                                                               path, line, m, strerror(-r));
-
-                                        free(m);
                                 }
 
                         } else if (startswith_no_case(t, "Required-Start:") ||
@@ -809,35 +803,14 @@ static int service_load_sysv_path(Service *s, const char *path) {
                                 state = LSB;
 
                                 FOREACH_WORD_QUOTED(w, z, strchr(t, ':')+1, i) {
-                                        char *n, *m;
+                                        char *n;
 
-                                        if (!(n = strndup(w, z))) {
+                                        n = strndup(w, z);
+                                        if (!n || strv_push(startswith_no_case(t, "X-Start-Before:") ? &sc->before : &sc->after, n) < 0) {
+                                                free(n);
                                                 r = -ENOMEM;
                                                 goto finish;
                                         }
-
-                                        r = sysv_translate_facility(n, path_get_file_name(path), &m);
-
-                                        if (r < 0) {
-                                                log_error_unit(u->id,
-                                                               "[%s:%u] Failed to translate LSB dependency %s, ignoring: %s",
-                                                               path, line, n, strerror(-r));
-                                                free(n);
-                                                continue;
-                                        }
-
-                                        free(n);
-
-                                        if (r == 0)
-                                                continue;
-
-                                        r = unit_add_dependency_by_name(u, startswith_no_case(t, "X-Start-Before:") ? UNIT_BEFORE : UNIT_AFTER, m, NULL, true);
-
-                                        if (r < 0)
-                                                log_error_unit(u->id, "[%s:%u] Failed to add dependency on %s, ignoring: %s",
-                                                               path, line, m, strerror(-r));
-
-                                        free(m);
                                 }
                         } else if (startswith_no_case(t, "Default-Start:")) {
                                 char *k, *d;
@@ -852,8 +825,8 @@ static int service_load_sysv_path(Service *s, const char *path) {
                                                 goto finish;
                                         }
 
-                                        free(s->sysv_runlevels);
-                                        s->sysv_runlevels = d;
+                                        free(sc->runlevels);
+                                        sc->runlevels = d;
                                 }
 
                         } else if (startswith_no_case(t, "Description:")) {
@@ -916,7 +889,262 @@ static int service_load_sysv_path(Service *s, const char *path) {
                 }
         }
 
-        if ((r = sysv_exec_commands(s, supports_reload)) < 0)
+        /* We use the long description only if
+         * no short description is set. */
+
+        if (short_description)
+                description = short_description;
+        else if (chkconfig_description)
+                description = chkconfig_description;
+        else if (long_description)
+                description = long_description;
+        else
+                description = NULL;
+
+        if (description) {
+                sc->description = strappend(sc->has_lsb ? "LSB: " : "SYSV: ", description);
+                if (!sc->description) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+        }
+
+        r = 0;
+
+finish:
+        free(short_description);
+        free(long_description);
+        free(chkconfig_description);
+
+        return r;
+}
+
+/* Returns the parsed headers of path, from the cache if the script
+ * has not changed since it was parsed last, which saves most of the
+ * work on reloads */
+static int manager_get_sysv_script(Manager *m, const char *path, FILE *f, const struct stat *st, const char *unit_id, SysvScript **ret) {
+        SysvScript *sc;
+        int r;
+
+        assert(m);
+        assert(path);
+        assert(f);
+        assert(st);
+        assert(ret);
+
+        sc = hashmap_get(m->sysv_scripts, path);
+        if (sc && sysv_script_is_current(sc, st)) {
+                *ret = sc;
+                return 0;
+        }
+
+        if (sc) {
+                hashmap_remove(m->sysv_scripts, path);
+                sysv_script_free(sc);
+        }
+
+        r = hashmap_ensure_allocated(&m->sysv_scripts, string_hash_func, string_compare_func);
+        if (r < 0)
+                return r;
+
+        sc = new0(SysvScript, 1);
+        if (!sc)
+                return -ENOMEM;
+
+        sc->start_priority = -1;
+        sc->dev = st->st_dev;
+        sc->ino = st->st_ino;
+        sc->size = st->st_size;
+        sc->mtime = timespec_load(&st->st_mtim);
+
+        sc->path = strdup(path);
+        if (!sc->path) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        r = sysv_script_parse(sc, f, path, unit_id);
+        if (r < 0)
+                goto fail;
+
+        r = hashmap_put(m->sysv_scripts, sc->path, sc);
+        if (r < 0)
+                goto fail;
+
+        *ret = sc;
+        return 0;
+
+fail:
+        sysv_script_free(sc);
+        return r;
+}
+
+static void manager_prune_sysv_scripts(Manager *m) {
+        SysvScript *sc;
+        Iterator i;
+
+        assert(m);
+
+        /* Forget about scripts that changed or went away */
+        HASHMAP_FOREACH(sc, m->sysv_scripts, i) {
+                struct stat st;
+
+                if (stat(sc->path, &st) >= 0 && sysv_script_is_current(sc, &st))
+                        continue;
+
+                hashmap_remove(m->sysv_scripts, sc->path);
+                sysv_script_free(sc);
+        }
+}
+
+static void service_shutdown(Manager *m) {
+        SysvScript *sc;
+
+        assert(m);
+
+        while ((sc = hashmap_steal_first(m->sysv_scripts)))
+                sysv_script_free(sc);
+
+        hashmap_free(m->sysv_scripts);
+        m->sysv_scripts = NULL;
+}
+
+static void service_add_sysv_dependencies(Service *s, char **names, UnitDependency d, const char *path) {
+        char **n;
+        int r;
+
+        assert(s);
+        assert(path);
+
+        STRV_FOREACH(n, names) {
+                _cleanup_free_ char *m = NULL;
+
+                r = sysv_translate_facility(*n, path_get_file_name(path), &m);
+                if (r < 0) {
+                        log_error_unit(UNIT(s)->id,
+                                       "[%s] Failed to translate LSB dependency %s, ignoring: %s",
+                                       path, *n, strerror(-r));
+                        continue;
+                }
+
+                if (r == 0)
+                        continue;
+
+                r = unit_add_dependency_by_name(UNIT(s), d, m, NULL, true);
+                if (r < 0)
+                        log_error_unit(UNIT(s)->id,
+                                       "[%s] Failed to add dependency on %s, ignoring: %s",
+                                       path, m, strerror(-r));
+        }
+}
+
+static int service_load_sysv_path(Service *s, const char *path) {
+        FILE *f;
+        Unit *u;
+        SysvScript *sc;
+        char **n;
+        int r;
+        struct stat st;
+
+        assert(s);
+        assert(path);
+
+        u = UNIT(s);
+
+        f = fopen(path, "re");
+        if (!f) {
+                r = errno == ENOENT ? 0 : -errno;
+                goto finish;
+        }
+
+        if (fstat(fileno(f), &st) < 0) {
+                r = -errno;
+                goto finish;
+        }
+
+        free(u->source_path);
+        u->source_path = strdup(path);
+        if (!u->source_path) {
+                r = -ENOMEM;
+                goto finish;
+        }
+        u->source_mtime = timespec_load(&st.st_mtim);
+
+        if (null_or_empty(&st)) {
+                u->load_state = UNIT_MASKED;
+                r = 0;
+                goto finish;
+        }
+
+        s->is_sysv = true;
+
+        r = manager_get_sysv_script(u->manager, path, f, &st, u->id, &sc);
+        if (r < 0)
+                goto finish;
+
+        if (sc->has_lsb)
+                s->sysv_has_lsb = true;
+
+        if (sc->start_priority >= 0)
+                s->sysv_start_priority = sc->start_priority;
+
+        if (sc->runlevels) {
+                char *d;
+
+                d = strdup(sc->runlevels);
+                if (!d) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                free(s->sysv_runlevels);
+                s->sysv_runlevels = d;
+        }
+
+        if (sc->pid_file) {
+                char *fn;
+
+                fn = strdup(sc->pid_file);
+                if (!fn) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                free(s->pid_file);
+                s->pid_file = fn;
+        }
+
+        STRV_FOREACH(n, sc->provides) {
+                _cleanup_free_ char *m = NULL;
+
+                r = sysv_translate_facility(*n, path_get_file_name(path), &m);
+                if (r < 0)
+                        goto finish;
+
+                if (r == 0)
+                        continue;
+
+                if (unit_name_to_type(m) == UNIT_SERVICE)
+                        r = unit_merge_by_name(u, m);
+                else
+                        /* NB: SysV targets which are provided by a
+                         * service are pulled in by the services, as
+                         * an indication that the generic service is
+                         * now available. This is strictly one-way.
+                         * The targets do NOT pull in the SysV
+                         * services! */
+                        r = unit_add_two_dependencies_by_name(u, UNIT_BEFORE, UNIT_WANTS, m, NULL, true);
+
+                if (r < 0)
+                        log_error_unit(u->id,
+                                       "[%s] Failed to add LSB Provides name %s, ignoring: %s",
+                                       path, m, strerror(-r));
+        }
+
+        service_add_sysv_dependencies(s, sc->after, UNIT_AFTER, path);
+        service_add_sysv_dependencies(s, sc->before, UNIT_BEFORE, path);
+
+        if ((r = sysv_exec_commands(s, sc->supports_reload)) < 0)
                 goto finish;
 
         if (s->sysv_runlevels && !chars_intersect(RUNLEVELS_UP, s->sysv_runlevels)) {
@@ -944,22 +1172,11 @@ static int service_load_sysv_path(Service *s, const char *path) {
         s->exec_context.ignore_sigpipe = false;
         s->kill_context.kill_mode = KILL_PROCESS;
 
-        /* We use the long description only if
-         * no short description is set. */
-
-        if (short_description)
-                description = short_description;
-        else if (chkconfig_description)
-                description = chkconfig_description;
-        else if (long_description)
-                description = long_description;
-        else
-                description = NULL;
-
-        if (description) {
+        if (sc->description) {
                 char *d;
 
-                if (!(d = strappend(s->sysv_has_lsb ? "LSB: " : "SYSV: ", description))) {
+                d = strdup(sc->description);
+                if (!d) {
                         r = -ENOMEM;
                         goto finish;
                 }
@@ -981,10 +1198,6 @@ finish:
         if (f)
                 fclose(f);
 
-        free(short_description);
-        free(long_description);
-        free(chkconfig_description);
-
         return r;
 }
 
@@ -1488,7 +1701,7 @@ static int service_search_main_pid(Service *s) {
 }
 
 static void service_notify_sockets_dead(Service *s, bool failed_permanent) {
-        Iterator i;
+        unsigned i;
         Unit *u;
 
         assert(s);
@@ -1498,7 +1711,7 @@ static void service_notify_sockets_dead(Service *s, bool failed_permanent) {
         if (s->socket_fd >= 0)
                 return;
 
-        SET_FOREACH(u, UNIT(s)->dependencies[UNIT_TRIGGERED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(u, UNIT(s), UNIT_TRIGGERED_BY, i)
                 if (u->type == UNIT_SOCKET)
                         socket_notify_service_dead(SOCKET(u), failed_permanent);
 
@@ -1628,7 +1841,7 @@ static int service_coldplug(Unit *u) {
 
                                 k = s->deserialized_state == SERVICE_AUTO_RESTART ? s->restart_usec : s->timeout_start_usec;
 
-                                r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, k, &s->timer_watch);
+                                r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, k, 0, &s->timer_watch);
                                 if (r < 0)
                                         return r;
                         }
@@ -1677,7 +1890,7 @@ static int service_coldplug(Unit *u) {
 }
 
 static int service_collect_fds(Service *s, int **fds, unsigned *n_fds) {
-        Iterator i;
+        unsigned i;
         int r;
         int *rfds = NULL;
         unsigned rn_fds = 0;
@@ -1690,7 +1903,7 @@ static int service_collect_fds(Service *s, int **fds, unsigned *n_fds) {
         if (s->socket_fd >= 0)
                 return 0;
 
-        SET_FOREACH(u, UNIT(s)->dependencies[UNIT_TRIGGERED_BY], i) {
+        UNIT_FOREACH_DEPENDENCY(u, UNIT(s), UNIT_TRIGGERED_BY, i) {
                 int *cfds;
                 unsigned cn_fds;
                 Socket *sock;
@@ -1784,7 +1997,7 @@ static int service_spawn(
 
         if (timeout && s->timeout_start_usec) {
                 r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true,
-                                     s->timeout_start_usec, &s->timer_watch);
+                                     s->timeout_start_usec, 0, &s->timer_watch);
                 if (r < 0)
                         goto fail;
         } else
@@ -1855,6 +2068,14 @@ static int service_spawn(
                 /* FIXME: we need to do something here */
                 goto fail;
 
+        if (s->socket_accept_usec > 0) {
+                if (UNIT_DEREF(s->accept_socket))
+                        socket_connection_spawned(SOCKET(UNIT_DEREF(s->accept_socket)),
+                                                  now(CLOCK_MONOTONIC) - s->socket_accept_usec);
+
+                s->socket_accept_usec = 0;
+        }
+
         *_pid = pid;
 
         return 0;
@@ -1931,7 +2152,7 @@ static void service_enter_dead(Service *s, ServiceResult f, bool allow_restart)
              !set_contains(s->restart_ignore_status.signal, INT_TO_PTR(s->main_exec_status.status)))
                 ) {
 
-                r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->restart_usec, &s->timer_watch);
+                r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->restart_usec, 0, &s->timer_watch);
                 if (r < 0)
                         goto fail;
 
@@ -2013,7 +2234,7 @@ static void service_enter_signal(Service *s, ServiceState state, ServiceResult f
         if (r > 0) {
                 if (s->timeout_stop_usec > 0) {
                         r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true,
-                                             s->timeout_stop_usec, &s->timer_watch);
+                                             s->timeout_stop_usec, 0, &s->timer_watch);
                         if (r < 0)
                                 goto fail;
                 }
@@ -2164,6 +2385,8 @@ static void service_enter_start(Service *s) {
                 c = s->main_command = s->exec_command[SERVICE_EXEC_START];
         }
 
+        unit_start_latency_mark(UNIT(s), START_TIMESTAMP_SPAWN_BEGIN);
+
         r = service_spawn(s,
                           c,
                           s->type == SERVICE_FORKING || s->type == SERVICE_DBUS ||
@@ -2178,6 +2401,8 @@ static void service_enter_start(Service *s) {
         if (r < 0)
                 goto fail;
 
+        unit_start_latency_mark(UNIT(s), START_TIMESTAMP_SPAWN_END);
+
         if (s->type == SERVICE_SIMPLE || s->type == SERVICE_IDLE) {
                 /* For simple services we immediately start
                  * the START_POST binaries. */
@@ -2234,6 +2459,8 @@ static void service_enter_start_pre(Service *s) {
 
                 s->control_command_id = SERVICE_EXEC_START_PRE;
 
+                unit_start_latency_mark(UNIT(s), START_TIMESTAMP_START_PRE);
+
                 r = service_spawn(s,
                                   s->control_command,
                                   true,
@@ -2271,7 +2498,7 @@ static void service_enter_restart(Service *s) {
                 log_info_unit(UNIT(s)->id,
                               "Stop job pending for unit, delaying automatic restart.");
 
-                r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->restart_usec, &s->timer_watch);
+                r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->restart_usec, 0, &s->timer_watch);
                 if (r < 0)
                         goto fail;
 
@@ -2431,9 +2658,10 @@ static int service_start_limit_test(Service *s) {
         switch (s->start_limit_action) {
 
         case SERVICE_START_LIMIT_NONE:
-                log_warning_unit(UNIT(s)->id,
-                                 "%s start request repeated too quickly, refusing to start.",
-                                 UNIT(s)->id);
+                if (unit_log_ratelimit(UNIT(s), "start-limit", NULL))
+                        log_warning_unit(UNIT(s)->id,
+                                         "%s start request repeated too quickly, refusing to start.",
+                                         UNIT(s)->id);
                 break;
 
         case SERVICE_START_LIMIT_REBOOT: {
@@ -2631,10 +2859,10 @@ static int service_serialize(Unit *u, FILE *f, FDSet *fds) {
         if (s->main_exec_status.pid > 0) {
                 unit_serialize_item_format(u, f, "main-exec-status-pid", "%lu",
                                            (unsigned long) s->main_exec_status.pid);
-                dual_timestamp_serialize(f, "main-exec-status-start",
-                                         &s->main_exec_status.start_timestamp);
-                dual_timestamp_serialize(f, "main-exec-status-exit",
-                                         &s->main_exec_status.exit_timestamp);
+                unit_serialize_dual_timestamp(u, f, "main-exec-status-start",
+                                              &s->main_exec_status.start_timestamp);
+                unit_serialize_dual_timestamp(u, f, "main-exec-status-exit",
+                                              &s->main_exec_status.exit_timestamp);
 
                 if (dual_timestamp_is_set(&s->main_exec_status.exit_timestamp)) {
                         unit_serialize_item_format(u, f, "main-exec-status-code", "%i",
@@ -2644,8 +2872,8 @@ static int service_serialize(Unit *u, FILE *f, FDSet *fds) {
                 }
         }
         if (dual_timestamp_is_set(&s->watchdog_timestamp))
-                dual_timestamp_serialize(f, "watchdog-timestamp",
-                                         &s->watchdog_timestamp);
+                unit_serialize_dual_timestamp(u, f, "watchdog-timestamp",
+                                              &s->watchdog_timestamp);
 
         if (s->exec_context.tmp_dir)
                 unit_serialize_item(u, f, "tmp-dir", s->exec_context.tmp_dir);
@@ -2910,7 +3138,7 @@ static int service_demand_pid_file(Service *s) {
         /* PATH_CHANGED would not be enough. There are daemons (sendmail) that
          * keep their PID file open all the time. */
         ps->type = PATH_MODIFIED;
-        ps->inotify_fd = -1;
+        watch_init(&ps->watch);
 
         s->pid_file_pathspec = ps;
 
@@ -2924,7 +3152,7 @@ static void service_fd_event(Unit *u, int fd, uint32_t events, Watch *w) {
         assert(fd >= 0);
         assert(s->state == SERVICE_START || s->state == SERVICE_START_POST);
         assert(s->pid_file_pathspec);
-        assert(path_spec_owns_inotify_fd(s->pid_file_pathspec, fd));
+        assert(path_spec_owns_watch(s->pid_file_pathspec, w));
 
         log_debug_unit(u->id, "inotify event for %s", u->id);
 
@@ -3479,6 +3707,8 @@ static int service_enumerate(Manager *m) {
 
         assert(m);
 
+        manager_prune_sysv_scripts(m);
+
         if (m->running_as != SYSTEMD_SYSTEM)
                 return 0;
 
@@ -3709,14 +3939,15 @@ static void service_bus_query_pid_done(
                 service_set_main_pid(s, pid);
 }
 
-int service_set_socket_fd(Service *s, int fd, Socket *sock) {
+int service_set_socket_fd(Service *s, int fd, Socket *sock, usec_t accepted) {
 
         assert(s);
         assert(fd >= 0);
 
         /* This is called by the socket code when instantiating a new
          * service for a stream socket and the socket needs to be
-         * configured. */
+         * configured. accepted is when the connection was accepted,
+         * for the spawn latency reported by the socket. */
 
         if (UNIT(s)->load_state != UNIT_LOADED)
                 return -EINVAL;
@@ -3728,6 +3959,7 @@ int service_set_socket_fd(Service *s, int fd, Socket *sock) {
                 return -EAGAIN;
 
         s->socket_fd = fd;
+        s->socket_accept_usec = accepted;
         s->got_socket_fd = true;
 
         unit_ref_set(&s->accept_socket, UNIT(sock));
@@ -3885,10 +4117,12 @@ const UnitVTable service_vtable = {
 
         .bus_interface = "org.freedesktop.systemd1.Service",
         .bus_message_handler = bus_service_message_handler,
+        .bus_append_properties = bus_service_append_properties,
         .bus_invalidating_properties =  bus_service_invalidating_properties,
 
 #ifdef HAVE_SYSV_COMPAT
         .enumerate = service_enumerate,
+        .shutdown = service_shutdown,
 #endif
         .status_message_formats = {
                 .starting_stopping = {
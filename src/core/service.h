@@ -155,6 +155,10 @@ struct Service {
         pid_t main_pid, control_pid;
         int socket_fd;
 
+        /* When the connection on socket_fd was accepted, until the
+         * first process is spawned */
+        usec_t socket_accept_usec;
+
         int fsck_passno;
 
         bool permissions_start_only;
@@ -201,7 +205,7 @@ extern const UnitVTable service_vtable;
 
 struct Socket;
 
-int service_set_socket_fd(Service *s, int fd, struct Socket *socket);
+int service_set_socket_fd(Service *s, int fd, struct Socket *socket, usec_t accepted);
 
 const char* service_state_to_string(ServiceState i);
 ServiceState service_state_from_string(const char *s);
@@ -125,7 +125,7 @@ static int snapshot_stop(Unit *u) {
 static int snapshot_serialize(Unit *u, FILE *f, FDSet *fds) {
         Snapshot *s = SNAPSHOT(u);
         Unit *other;
-        Iterator i;
+        unsigned i;
 
         assert(s);
         assert(f);
@@ -133,7 +133,7 @@ static int snapshot_serialize(Unit *u, FILE *f, FDSet *fds) {
 
         unit_serialize_item(u, f, "state", snapshot_state_to_string(s->state));
         unit_serialize_item(u, f, "cleanup", yes_no(s->cleanup));
-        SET_FOREACH(other, u->dependencies[UNIT_WANTS], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS, i)
                 unit_serialize_item(u, f, "wants", other->id);
 
         return 0;
@@ -305,5 +305,6 @@ const UnitVTable snapshot_vtable = {
         .sub_state_to_string = snapshot_sub_state_to_string,
 
         .bus_interface = "org.freedesktop.systemd1.Snapshot",
-        .bus_message_handler = bus_snapshot_message_handler
+        .bus_message_handler = bus_snapshot_message_handler,
+        .bus_append_properties = bus_snapshot_append_properties
 };
@@ -78,6 +78,7 @@ static void socket_init(Unit *u) {
         s->socket_mode = 0666;
 
         s->max_connections = 64;
+        s->n_listeners = 1;
 
         s->priority = -1;
         s->ip_tos = -1;
@@ -245,6 +246,19 @@ static int socket_verify(Socket *s) {
                 return -EINVAL;
         }
 
+        if (s->n_listeners <= 0) {
+                log_error_unit(UNIT(s)->id,
+                               "%s's Listeners setting too small. Refusing.", UNIT(s)->id);
+                return -EINVAL;
+        }
+
+        if (s->n_listeners > 1 && !s->reuse_port) {
+                log_error_unit(UNIT(s)->id,
+                               "%s has more than one listener per address configured, but ReusePort is off. Refusing.",
+                               UNIT(s)->id);
+                return -EINVAL;
+        }
+
         if (s->exec_context.pam_name && s->kill_context.kill_mode != KILL_CONTROL_GROUP) {
                 log_error_unit(UNIT(s)->id,
                                "%s has PAM enabled. Kill mode must be set to 'control-group'. Refusing.",
@@ -295,13 +309,44 @@ int socket_add_one_mount_link(Socket *s, Mount *m) {
 }
 
 static int socket_add_mount_links(Socket *s) {
-        Unit *other;
+        _cleanup_set_free_ Set *mounts = NULL;
+        SocketPort *p;
+        Iterator i;
+        Mount *m;
         int r;
 
         assert(s);
 
-        LIST_FOREACH(units_by_type, other, UNIT(s)->manager->units_by_type[UNIT_MOUNT]) {
-                r = socket_add_one_mount_link(s, MOUNT(other));
+        mounts = set_new(trivial_hash_func, trivial_compare_func);
+        if (!mounts)
+                return -ENOMEM;
+
+        /* The same paths socket_needs_mount() looks at */
+        LIST_FOREACH(port, p, s->ports) {
+                const char *path;
+
+                if (p->type == SOCKET_SOCKET) {
+                        if (socket_address_family(&p->address) != AF_UNIX ||
+                            p->address.sockaddr.un.sun_path[0] == 0)
+                                continue;
+
+                        path = p->address.sockaddr.un.sun_path;
+                } else if (p->type == SOCKET_FIFO || p->type == SOCKET_SPECIAL)
+                        path = p->path;
+                else
+                        continue;
+
+                r = unit_add_path_index(UNIT(s), path);
+                if (r < 0)
+                        return r;
+
+                r = path_trie_find_above(UNIT(s)->manager->units_by_path[UNIT_MOUNT], path, mounts);
+                if (r < 0)
+                        return r;
+        }
+
+        SET_FOREACH(m, mounts, i) {
+                r = socket_add_one_mount_link(s, m);
                 if (r < 0)
                         return r;
         }
@@ -355,6 +400,51 @@ static bool socket_has_exec(Socket *s) {
         return false;
 }
 
+static bool socket_port_can_reuse(SocketPort *p) {
+        assert(p);
+
+        return p->type == SOCKET_SOCKET &&
+                (socket_address_family(&p->address) == AF_INET ||
+                 socket_address_family(&p->address) == AF_INET6);
+}
+
+/* The kernel distributes incoming connections and datagrams among all
+ * sockets bound to the same address with SO_REUSEPORT, hence open the
+ * additional ones as ports of their own, right after the configured
+ * one. */
+static int socket_add_listeners(Socket *s) {
+        SocketPort *p;
+        unsigned i;
+
+        assert(s);
+
+        if (s->n_listeners <= 1)
+                return 0;
+
+        LIST_FOREACH(port, p, s->ports) {
+
+                if (!socket_port_can_reuse(p))
+                        continue;
+
+                for (i = 1; i < s->n_listeners; i++) {
+                        SocketPort *q;
+
+                        q = new0(SocketPort, 1);
+                        if (!q)
+                                return -ENOMEM;
+
+                        q->type = p->type;
+                        q->address = p->address;
+                        q->fd = -1;
+
+                        LIST_INSERT_AFTER(SocketPort, port, s->ports, p, q);
+                        p = q;
+                }
+        }
+
+        return 0;
+}
+
 static int socket_load(Unit *u) {
         Socket *s = SOCKET(u);
         int r;
@@ -385,6 +475,10 @@ static int socket_load(Unit *u) {
                                 return r;
                 }
 
+                r = socket_add_listeners(s);
+                if (r < 0)
+                        return r;
+
                 if ((r = socket_add_mount_links(s)) < 0)
                         return r;
 
@@ -450,6 +544,8 @@ static void socket_dump(Unit *u, FILE *f, const char *prefix) {
                 "%sKeepAlive: %s\n"
                 "%sFreeBind: %s\n"
                 "%sTransparent: %s\n"
+                "%sReusePort: %s\n"
+                "%sListeners: %u\n"
                 "%sBroadcast: %s\n"
                 "%sPassCredentials: %s\n"
                 "%sPassSecurity: %s\n"
@@ -463,6 +559,8 @@ static void socket_dump(Unit *u, FILE *f, const char *prefix) {
                 prefix, yes_no(s->keep_alive),
                 prefix, yes_no(s->free_bind),
                 prefix, yes_no(s->transparent),
+                prefix, yes_no(s->reuse_port),
+                prefix, s->n_listeners,
                 prefix, yes_no(s->broadcast),
                 prefix, yes_no(s->pass_cred),
                 prefix, yes_no(s->pass_sec),
@@ -478,14 +576,21 @@ static void socket_dump(Unit *u, FILE *f, const char *prefix) {
                         "%sBindToDevice: %s\n",
                         prefix, s->bind_to_device);
 
-        if (s->accept)
+        if (s->accept) {
+                char buf[FORMAT_TIMESPAN_MAX];
+
                 fprintf(f,
                         "%sAccepted: %u\n"
                         "%sNConnections: %u\n"
-                        "%sMaxConnections: %u\n",
+                        "%sMaxConnections: %u\n"
+                        "%sAcceptRate: %u/s\n"
+                        "%sSpawnLatency: %s\n",
                         prefix, s->n_accepted,
                         prefix, s->n_connections,
-                        prefix, s->max_connections);
+                        prefix, s->max_connections,
+                        prefix, socket_accept_rate(s),
+                        prefix, format_timespan(buf, sizeof(buf), s->spawn_latency_usec, 0));
+        }
 
         if (s->priority >= 0)
                 fprintf(f,
@@ -1020,6 +1125,7 @@ static int socket_open_fds(Socket *s) {
                                              s->bind_to_device,
                                              s->free_bind,
                                              s->transparent,
+                                             s->reuse_port,
                                              s->directory_mode,
                                              s->socket_mode,
                                              label,
@@ -1172,7 +1278,7 @@ static int socket_coldplug(Unit *u) {
                         if (r < 0)
                                 return r;
 
-                        r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, &s->timer_watch);
+                        r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, 0, &s->timer_watch);
                         if (r < 0)
                                 return r;
                 }
@@ -1205,7 +1311,7 @@ static int socket_spawn(Socket *s, ExecCommand *c, pid_t *_pid) {
         assert(c);
         assert(_pid);
 
-        r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, &s->timer_watch);
+        r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, 0, &s->timer_watch);
         if (r < 0)
                 goto fail;
 
@@ -1308,7 +1414,7 @@ static void socket_enter_signal(Socket *s, SocketState state, SocketResult f) {
                 goto fail;
 
         if (r > 0) {
-                r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, &s->timer_watch);
+                r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, 0, &s->timer_watch);
                 if (r < 0)
                         goto fail;
 
@@ -1438,6 +1544,22 @@ fail:
         socket_enter_dead(s, SOCKET_FAILURE_RESOURCES);
 }
 
+static void socket_count_accepted(Socket *s, usec_t t) {
+        usec_t second;
+
+        assert(s);
+
+        second = t / USEC_PER_SEC;
+
+        if (second != s->accept_second) {
+                s->n_accepted_previous = second == s->accept_second + 1 ? s->n_accepted_current : 0;
+                s->n_accepted_current = 0;
+                s->accept_second = second;
+        }
+
+        s->n_accepted_current++;
+}
+
 static void socket_enter_running(Socket *s, int cfd) {
         int r;
         DBusError error;
@@ -1471,13 +1593,13 @@ static void socket_enter_running(Socket *s, int cfd) {
         }
 
         if (cfd < 0) {
-                Iterator i;
+                unsigned i;
                 Unit *u;
                 bool pending = false;
 
                 /* If there's already a start pending don't bother to
                  * do anything */
-                SET_FOREACH(u, UNIT(s)->dependencies[UNIT_TRIGGERS], i)
+                UNIT_FOREACH_DEPENDENCY(u, UNIT(s), UNIT_TRIGGERS, i)
                         if (unit_active_or_pending(u)) {
                                 pending = true;
                                 break;
@@ -1493,6 +1615,10 @@ static void socket_enter_running(Socket *s, int cfd) {
         } else {
                 char *prefix, *instance = NULL, *name;
                 Service *service;
+                usec_t accepted;
+
+                accepted = now(CLOCK_MONOTONIC);
+                socket_count_accepted(s, accepted);
 
                 if (s->n_connections >= s->max_connections) {
                         log_warning_unit(UNIT(s)->id,
@@ -1548,14 +1674,19 @@ static void socket_enter_running(Socket *s, int cfd) {
                 unit_choose_id(UNIT(service), name);
                 free(name);
 
-                r = service_set_socket_fd(service, cfd, s);
+                r = service_set_socket_fd(service, cfd, s, accepted);
                 if (r < 0)
                         goto fail;
 
                 cfd = -1;
                 s->n_connections ++;
 
-                r = manager_add_job(UNIT(s)->manager, JOB_START, UNIT(service), JOB_REPLACE, true, &error, NULL);
+                /* The instance is new and usually only depends on
+                 * units that are up already, so most of the time
+                 * there is no need to build a transaction for it */
+                r = manager_add_start_job_fast(UNIT(s)->manager, UNIT(service), true, NULL);
+                if (r == -EAGAIN)
+                        r = manager_add_job(UNIT(s)->manager, JOB_START, UNIT(service), JOB_REPLACE, true, &error, NULL);
                 if (r < 0)
                         goto fail;
 
@@ -1634,9 +1765,10 @@ static int socket_start(Unit *u) {
                 service = SERVICE(UNIT_DEREF(s->service));
 
                 if (UNIT(service)->load_state != UNIT_LOADED) {
-                        log_error_unit(u->id,
-                                       "Socket service %s not loaded, refusing.",
-                                       UNIT(service)->id);
+                        if (unit_log_ratelimit(u, "service-not-loaded", NULL))
+                                log_error_unit(u->id,
+                                               "Socket service %s not loaded, refusing.",
+                                               UNIT(service)->id);
                         return -ENOENT;
                 }
 
@@ -1645,9 +1777,10 @@ static int socket_start(Unit *u) {
                 if (service->state != SERVICE_DEAD &&
                     service->state != SERVICE_FAILED &&
                     service->state != SERVICE_AUTO_RESTART) {
-                        log_error_unit(u->id,
-                                       "Socket service %s already active, refusing.",
-                                       UNIT(service)->id);
+                        if (unit_log_ratelimit(u, "service-active", NULL))
+                                log_error_unit(u->id,
+                                               "Socket service %s already active, refusing.",
+                                               UNIT(service)->id);
                         return -EBUSY;
                 }
 
@@ -1876,10 +2009,17 @@ static int socket_deserialize_item(Unit *u, const char *key, const char *value,
                                        "Failed to parse socket value %s", value);
                 else {
 
+                        /* With ReusePort= several ports share the
+                         * address, hand out the fds in order */
                         LIST_FOREACH(port, p, s->ports)
-                                if (socket_address_is(&p->address, value+skip, type))
+                                if (p->fd < 0 && socket_address_is(&p->address, value+skip, type))
                                         break;
 
+                        if (!p)
+                                LIST_FOREACH(port, p, s->ports)
+                                        if (socket_address_is(&p->address, value+skip, type))
+                                                break;
+
                         if (p) {
                                 if (p->fd >= 0)
                                         close_nointr_nofail(p->fd);
@@ -2295,6 +2435,61 @@ void socket_connection_unref(Socket *s) {
                        "%s: One connection closed, %u left.", UNIT(s)->id, s->n_connections);
 }
 
+void socket_connection_spawned(Socket *s, usec_t latency) {
+        assert(s);
+
+        /* Averages over roughly the last eight connections */
+        if (s->spawn_latency_usec <= 0)
+                s->spawn_latency_usec = latency;
+        else
+                s->spawn_latency_usec = s->spawn_latency_usec - s->spawn_latency_usec / 8 + latency / 8;
+}
+
+unsigned socket_accept_rate(Socket *s) {
+        usec_t second;
+
+        assert(s);
+
+        /* Connections accepted during the last full second */
+        second = now(CLOCK_MONOTONIC) / USEC_PER_SEC;
+
+        if (second == s->accept_second)
+                return s->n_accepted_previous;
+        if (second == s->accept_second + 1)
+                return s->n_accepted_current;
+
+        return 0;
+}
+
+unsigned socket_accept_queue_length(Socket *s) {
+        SocketPort *p;
+        unsigned n = 0;
+
+        assert(s);
+
+        /* For listening TCP sockets the kernel reports the
+         * connections waiting to be accepted as tcpi_unacked. Other
+         * socket types have no such interface. */
+        LIST_FOREACH(port, p, s->ports) {
+                struct tcp_info info = {};
+                socklen_t l = sizeof(info);
+
+                if (p->fd < 0 ||
+                    p->type != SOCKET_SOCKET ||
+                    p->address.type != SOCK_STREAM ||
+                    (socket_address_family(&p->address) != AF_INET &&
+                     socket_address_family(&p->address) != AF_INET6))
+                        continue;
+
+                if (getsockopt(p->fd, IPPROTO_TCP, TCP_INFO, &info, &l) < 0)
+                        continue;
+
+                n += info.tcpi_unacked;
+        }
+
+        return n;
+}
+
 static void socket_reset_failed(Unit *u) {
         Socket *s = SOCKET(u);
 
@@ -2389,6 +2584,7 @@ const UnitVTable socket_vtable = {
 
         .bus_interface = "org.freedesktop.systemd1.Socket",
         .bus_message_handler = bus_socket_message_handler,
+        .bus_append_properties = bus_socket_append_properties,
         .bus_invalidating_properties =  bus_socket_invalidating_properties,
 
         .status_message_formats = {
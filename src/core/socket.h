@@ -96,6 +96,19 @@ struct Socket {
         unsigned n_connections;
         unsigned max_connections;
 
+        /* With ReusePort= this many listening sockets are opened for
+         * each IP address */
+        unsigned n_listeners;
+
+        /* Connections accepted in the current and in the previous
+         * second of the monotonic clock, for the accept rate */
+        usec_t accept_second;
+        unsigned n_accepted_current, n_accepted_previous;
+
+        /* Running average of the time from accepting a connection to
+         * spawning the first process of its service */
+        usec_t spawn_latency_usec;
+
         unsigned backlog;
         usec_t timeout_usec;
 
@@ -127,6 +140,7 @@ struct Socket {
         bool keep_alive;
         bool free_bind;
         bool transparent;
+        bool reuse_port;
         bool broadcast;
         bool pass_cred;
         bool pass_sec;
@@ -163,6 +177,13 @@ int socket_add_one_mount_link(Socket *s, Mount *m);
 /* Called from the service code when a per-connection service ended */
 void socket_connection_unref(Socket *s);
 
+/* Called by the service when it spawned the first process for a
+ * connection */
+void socket_connection_spawned(Socket *s, usec_t latency);
+
+unsigned socket_accept_rate(Socket *s);
+unsigned socket_accept_queue_length(Socket *s);
+
 void socket_free_ports(Socket *s);
 
 extern const UnitVTable socket_vtable;
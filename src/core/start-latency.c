@@ -0,0 +1,214 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <errno.h>
+#include <string.h>
+
+#include "serialize.h"
+#include "start-latency.h"
+
+/* The points in time each phase lies between. The time it took to
+ * become ready is measured from the last point passed before. */
+static const StartTimestamp phase_begin[_START_PHASE_MAX] = {
+        [START_PHASE_QUEUE] = START_TIMESTAMP_ENQUEUED,
+        [START_PHASE_ORDERING] = START_TIMESTAMP_DISPATCHED,
+        [START_PHASE_START_PRE] = START_TIMESTAMP_START_PRE,
+        [START_PHASE_SPAWN] = START_TIMESTAMP_SPAWN_BEGIN,
+        [START_PHASE_MAIN_PID] = START_TIMESTAMP_SPAWN_END,
+        [START_PHASE_READY] = _START_TIMESTAMP_INVALID,
+        [START_PHASE_TOTAL] = START_TIMESTAMP_ENQUEUED,
+};
+
+static const StartTimestamp phase_end[_START_PHASE_MAX] = {
+        [START_PHASE_QUEUE] = START_TIMESTAMP_DISPATCHED,
+        [START_PHASE_ORDERING] = START_TIMESTAMP_RUNNABLE,
+        [START_PHASE_START_PRE] = START_TIMESTAMP_SPAWN_BEGIN,
+        [START_PHASE_SPAWN] = START_TIMESTAMP_SPAWN_END,
+        [START_PHASE_MAIN_PID] = START_TIMESTAMP_MAIN_PID,
+        [START_PHASE_READY] = START_TIMESTAMP_READY,
+        [START_PHASE_TOTAL] = START_TIMESTAMP_READY,
+};
+
+void start_latency_begin(StartLatency *l, usec_t t) {
+        assert(l);
+
+        zero(l->timestamps);
+        l->timestamps[START_TIMESTAMP_ENQUEUED] = t;
+}
+
+void start_latency_mark(StartLatency *l, StartTimestamp p, usec_t t) {
+        assert(l);
+        assert(p >= 0);
+        assert(p < _START_TIMESTAMP_MAX);
+
+        /* Only while a start is in progress, and the first time
+         * only, since ExecStart= may be spawned more than once for
+         * Type=oneshot, and jobs may be dispatched more than once */
+        if (l->timestamps[START_TIMESTAMP_ENQUEUED] <= 0 ||
+            l->timestamps[START_TIMESTAMP_READY] > 0 ||
+            l->timestamps[p] > 0)
+                return;
+
+        l->timestamps[p] = t;
+}
+
+void start_latency_finish(StartLatency *l, usec_t t) {
+        StartPhase p;
+
+        assert(l);
+
+        if (l->timestamps[START_TIMESTAMP_ENQUEUED] <= 0 ||
+            l->timestamps[START_TIMESTAMP_READY] > 0)
+                return;
+
+        l->timestamps[START_TIMESTAMP_READY] = t;
+
+        for (p = 0; p < _START_PHASE_MAX; p++) {
+                usec_t d;
+
+                if (start_latency_phase(l, p, &d))
+                        l->histogram[p][start_latency_bucket(d)]++;
+        }
+}
+
+bool start_latency_phase(const StartLatency *l, StartPhase p, usec_t *ret) {
+        usec_t begin, end;
+
+        assert(l);
+        assert(p >= 0);
+        assert(p < _START_PHASE_MAX);
+        assert(ret);
+
+        end = l->timestamps[phase_end[p]];
+
+        if (p == START_PHASE_READY) {
+                StartTimestamp i;
+
+                begin = 0;
+                for (i = START_TIMESTAMP_RUNNABLE; i < START_TIMESTAMP_READY; i++)
+                        if (l->timestamps[i] > 0 && l->timestamps[i] <= end)
+                                begin = MAX(begin, l->timestamps[i]);
+        } else
+                begin = l->timestamps[phase_begin[p]];
+
+        if (begin <= 0 || end <= 0 || end < begin)
+                return false;
+
+        *ret = end - begin;
+        return true;
+}
+
+unsigned start_latency_bucket(usec_t d) {
+        usec_t limit = 100;
+        unsigned i;
+
+        for (i = 0; i < START_LATENCY_BUCKETS - 1; i++, limit *= 10)
+                if (d < limit)
+                        break;
+
+        return i;
+}
+
+void start_latency_serialize(const StartLatency *l, FILE *f, bool binary) {
+        StartTimestamp t;
+        StartPhase p;
+
+        assert(l);
+        assert(f);
+
+        for (t = 0; t < _START_TIMESTAMP_MAX; t++)
+                if (l->timestamps[t] > 0)
+                        serialize_item_format(f, binary, "start-latency-timestamp", "%s %llu",
+                                              start_timestamp_to_string(t),
+                                              (unsigned long long) l->timestamps[t]);
+
+        assert_cc(START_LATENCY_BUCKETS == 7);
+
+        for (p = 0; p < _START_PHASE_MAX; p++)
+                serialize_item_format(f, binary, "start-latency-histogram", "%s %u %u %u %u %u %u %u",
+                                      start_phase_to_string(p),
+                                      l->histogram[p][0], l->histogram[p][1], l->histogram[p][2],
+                                      l->histogram[p][3], l->histogram[p][4], l->histogram[p][5],
+                                      l->histogram[p][6]);
+}
+
+int start_latency_deserialize_item(StartLatency *l, const char *key, const char *value) {
+        char name[32];
+
+        assert(l);
+        assert(key);
+        assert(value);
+
+        if (streq(key, "start-latency-timestamp")) {
+                unsigned long long u;
+                StartTimestamp t;
+
+                if (sscanf(value, "%31s %llu", name, &u) != 2)
+                        return -EBADMSG;
+
+                t = start_timestamp_from_string(name);
+                if (t < 0)
+                        return -EBADMSG;
+
+                l->timestamps[t] = (usec_t) u;
+
+        } else if (streq(key, "start-latency-histogram")) {
+                unsigned h[START_LATENCY_BUCKETS];
+                StartPhase p;
+
+                if (sscanf(value, "%31s %u %u %u %u %u %u %u", name,
+                           h + 0, h + 1, h + 2, h + 3, h + 4, h + 5, h + 6) != 1 + START_LATENCY_BUCKETS)
+                        return -EBADMSG;
+
+                p = start_phase_from_string(name);
+                if (p < 0)
+                        return -EBADMSG;
+
+                memcpy(l->histogram[p], h, sizeof(h));
+        } else
+                return -EINVAL;
+
+        return 0;
+}
+
+static const char* const start_timestamp_table[_START_TIMESTAMP_MAX] = {
+        [START_TIMESTAMP_ENQUEUED] = "enqueued",
+        [START_TIMESTAMP_DISPATCHED] = "dispatched",
+        [START_TIMESTAMP_RUNNABLE] = "runnable",
+        [START_TIMESTAMP_START_PRE] = "start-pre",
+        [START_TIMESTAMP_SPAWN_BEGIN] = "spawn-begin",
+        [START_TIMESTAMP_SPAWN_END] = "spawn-end",
+        [START_TIMESTAMP_MAIN_PID] = "main-pid",
+        [START_TIMESTAMP_READY] = "ready"
+};
+
+DEFINE_STRING_TABLE_LOOKUP(start_timestamp, StartTimestamp);
+
+static const char* const start_phase_table[_START_PHASE_MAX] = {
+        [START_PHASE_QUEUE] = "queue",
+        [START_PHASE_ORDERING] = "ordering",
+        [START_PHASE_START_PRE] = "start-pre",
+        [START_PHASE_SPAWN] = "spawn",
+        [START_PHASE_MAIN_PID] = "main-pid",
+        [START_PHASE_READY] = "ready",
+        [START_PHASE_TOTAL] = "total"
+};
+
+DEFINE_STRING_TABLE_LOOKUP(start_phase, StartPhase);
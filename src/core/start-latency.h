@@ -0,0 +1,90 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "util.h"
+
+/* Where the time goes when a unit is started. The points in time of
+ * the last start are kept, and the time between them is added to a
+ * histogram of each phase whenever a start job completes, in buckets
+ * from below 100 usec to 10 sec and more, each ten times the
+ * previous, like udevd does for events. */
+
+#define START_LATENCY_BUCKETS 7
+
+typedef enum StartTimestamp {
+        START_TIMESTAMP_ENQUEUED,       /* start job installed */
+        START_TIMESTAMP_DISPATCHED,     /* picked from the run queue the first time */
+        START_TIMESTAMP_RUNNABLE,       /* no ordering dependency left to wait for */
+        START_TIMESTAMP_START_PRE,      /* ExecStartPre= spawned */
+        START_TIMESTAMP_SPAWN_BEGIN,    /* ExecStart= about to be spawned */
+        START_TIMESTAMP_SPAWN_END,      /* ExecStart= forked off */
+        START_TIMESTAMP_MAIN_PID,       /* main PID known */
+        START_TIMESTAMP_READY,          /* unit active */
+        _START_TIMESTAMP_MAX,
+        _START_TIMESTAMP_INVALID = -1
+} StartTimestamp;
+
+typedef enum StartPhase {
+        START_PHASE_QUEUE,
+        START_PHASE_ORDERING,
+        START_PHASE_START_PRE,
+        START_PHASE_SPAWN,
+        START_PHASE_MAIN_PID,
+        START_PHASE_READY,
+        START_PHASE_TOTAL,
+        _START_PHASE_MAX,
+        _START_PHASE_INVALID = -1
+} StartPhase;
+
+typedef struct StartLatency {
+        /* CLOCK_MONOTONIC, 0 if not reached during the last start */
+        usec_t timestamps[_START_TIMESTAMP_MAX];
+
+        unsigned histogram[_START_PHASE_MAX][START_LATENCY_BUCKETS];
+} StartLatency;
+
+/* Forgets the last start, and begins a new one at t */
+void start_latency_begin(StartLatency *l, usec_t t);
+
+/* Records that the start in progress reached the specified point, if
+ * it did not already */
+void start_latency_mark(StartLatency *l, StartTimestamp p, usec_t t);
+
+/* Completes the start in progress at t, and accounts its phases */
+void start_latency_finish(StartLatency *l, usec_t t);
+
+/* Returns false if the phase was not passed during the last start */
+bool start_latency_phase(const StartLatency *l, StartPhase p, usec_t *ret);
+
+unsigned start_latency_bucket(usec_t d);
+
+void start_latency_serialize(const StartLatency *l, FILE *f, bool binary);
+int start_latency_deserialize_item(StartLatency *l, const char *key, const char *value);
+
+const char* start_timestamp_to_string(StartTimestamp p);
+StartTimestamp start_timestamp_from_string(const char *s);
+
+const char* start_phase_to_string(StartPhase p);
+StartPhase start_phase_from_string(const char *s);
@@ -158,13 +158,27 @@ int swap_add_one_mount_link(Swap *s, Mount *m) {
 }
 
 static int swap_add_mount_links(Swap *s) {
-        Unit *other;
+        _cleanup_set_free_ Set *mounts = NULL;
+        Iterator i;
+        Mount *m;
         int r;
 
         assert(s);
 
-        LIST_FOREACH(units_by_type, other, UNIT(s)->manager->units_by_type[UNIT_MOUNT])
-                if ((r = swap_add_one_mount_link(s, MOUNT(other))) < 0)
+        r = unit_add_path_index(UNIT(s), s->what);
+        if (r < 0)
+                return r;
+
+        mounts = set_new(trivial_hash_func, trivial_compare_func);
+        if (!mounts)
+                return -ENOMEM;
+
+        r = path_trie_find_above(UNIT(s)->manager->units_by_path[UNIT_MOUNT], s->what, mounts);
+        if (r < 0)
+                return r;
+
+        SET_FOREACH(m, mounts, i)
+                if ((r = swap_add_one_mount_link(s, m)) < 0)
                         return r;
 
         return 0;
@@ -526,7 +540,7 @@ static int swap_coldplug(Unit *u) {
                         if (r < 0)
                                 return r;
 
-                        r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, &s->timer_watch);
+                        r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, 0, &s->timer_watch);
                         if (r < 0)
                                 return r;
                 }
@@ -589,7 +603,7 @@ static int swap_spawn(Swap *s, ExecCommand *c, pid_t *_pid) {
         assert(c);
         assert(_pid);
 
-        r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, &s->timer_watch);
+        r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, 0, &s->timer_watch);
         if (r < 0)
                 goto fail;
 
@@ -664,7 +678,7 @@ static void swap_enter_signal(Swap *s, SwapState state, SwapResult f) {
                 goto fail;
 
         if (r > 0) {
-                r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, &s->timer_watch);
+                r = unit_watch_timer(UNIT(s), CLOCK_MONOTONIC, true, s->timeout_usec, 0, &s->timer_watch);
                 if (r < 0)
                         goto fail;
 
@@ -1357,6 +1371,7 @@ const UnitVTable swap_vtable = {
 
         .bus_interface = "org.freedesktop.systemd1.Swap",
         .bus_message_handler = bus_swap_message_handler,
+        .bus_append_properties = bus_swap_append_properties,
         .bus_invalidating_properties =  bus_swap_invalidating_properties,
 
         .following = swap_following,
@@ -64,7 +64,7 @@ static int target_add_default_dependencies(Target *t) {
                 UNIT_PART_OF
         };
 
-        Iterator i;
+        unsigned i;
         Unit *other;
         int r;
         unsigned k;
@@ -77,7 +77,7 @@ static int target_add_default_dependencies(Target *t) {
          * sure we don't create a loop. */
 
         for (k = 0; k < ELEMENTSOF(deps); k++)
-                SET_FOREACH(other, UNIT(t)->dependencies[deps[k]], i) {
+                UNIT_FOREACH_DEPENDENCY(other, UNIT(t), deps[k], i) {
                         r = unit_add_default_target_dependency(other, UNIT(t));
                         if (r < 0)
                                 return r;
@@ -226,6 +226,7 @@ const UnitVTable target_vtable = {
 
         .bus_interface = "org.freedesktop.systemd1.Target",
         .bus_message_handler = bus_target_message_handler,
+        .bus_append_properties = bus_target_append_properties,
 
         .status_message_formats = {
                 .finished_start_job = {
@@ -73,6 +73,8 @@ struct Timer {
         usec_t next_elapse_monotonic;
         usec_t next_elapse_realtime;
 
+        usec_t accuracy_usec;
+
         TimerState state, deserialized_state;
 
         Watch monotonic_watch;
@@ -28,6 +28,17 @@
 
 static void transaction_unlink_job(Transaction *tr, Job *j, bool delete_dependencies);
 
+static void transaction_add_to_gc_queue(Transaction *tr, Job *j) {
+        assert(tr);
+        assert(j);
+
+        if (j->in_gc_queue)
+                return;
+
+        LIST_PREPEND(Job, gc_queue, tr->gc_queue, j);
+        j->in_gc_queue = true;
+}
+
 static void transaction_delete_job(Transaction *tr, Job *j, bool delete_dependencies) {
         assert(tr);
         assert(j);
@@ -231,47 +242,105 @@ static int delete_one_unmergeable_job(Transaction *tr, Job *j) {
         return -EINVAL;
 }
 
-static int transaction_merge_jobs(Transaction *tr, DBusError *e) {
+static void transaction_collect_garbage(Transaction *tr) {
+        Job *j;
+
+        assert(tr);
+
+        /* Drop jobs that are not required by any other job. Only the
+         * jobs that were queued since we last ran are looked at: jobs
+         * that lost a job requiring them, and jobs that became the
+         * first of their unit. */
+
+        while ((j = tr->gc_queue)) {
+                LIST_REMOVE(Job, gc_queue, tr->gc_queue, j);
+                j->in_gc_queue = false;
+
+                if (j->transaction_prev)
+                        continue;
+
+                if (tr->anchor_job == j || j->object_list) {
+                        /* log_debug("Keeping job %s/%s because of %s/%s", */
+                        /*           j->unit->id, job_type_to_string(j->type), */
+                        /*           j->object_list->subject ? j->object_list->subject->unit->id : "root", */
+                        /*           j->object_list->subject ? job_type_to_string(j->object_list->subject->type) : "root"); */
+                        continue;
+                }
+
+                /* log_debug("Garbage collecting job %s/%s", j->unit->id, job_type_to_string(j->type)); */
+                transaction_delete_job(tr, j, true);
+        }
+}
+
+static int transaction_merge_jobs(Transaction *tr, JobMode mode, DBusError *e) {
+        _cleanup_free_ Unit **units = NULL;
+        unsigned n = 0, u;
         Job *j;
         Iterator i;
         int r;
 
         assert(tr);
 
+        /* Only units with more than one job need merging. Dropping
+         * jobs never adds new ones, so this list stays complete while
+         * we fix up conflicts below. We remember the units rather
+         * than the jobs, since deleting one job might take others
+         * with it. */
+        units = new(Unit*, hashmap_size(tr->jobs));
+        if (!units)
+                return -ENOMEM;
+
+        HASHMAP_FOREACH(j, tr->jobs, i)
+                if (j->transaction_next)
+                        units[n++] = j->unit;
+
         /* First step, check whether any of the jobs for one specific
          * task conflict. If so, try to drop one of them. */
-        HASHMAP_FOREACH(j, tr->jobs, i) {
+        for (u = 0; u < n; u++) {
                 JobType t;
                 Job *k;
 
-                t = j->type;
-                LIST_FOREACH(transaction, k, j->transaction_next) {
-                        if (job_type_merge_and_collapse(&t, k->type, j->unit) >= 0)
-                                continue;
+                while ((j = hashmap_get(tr->jobs, units[u]))) {
+
+                        t = j->type;
+                        LIST_FOREACH(transaction, k, j->transaction_next)
+                                if (job_type_merge_and_collapse(&t, k->type, j->unit) < 0)
+                                        break;
+
+                        if (!k)
+                                break;
 
                         /* OK, we could not merge all jobs for this
                          * action. Let's see if we can get rid of one
                          * of them */
 
                         r = delete_one_unmergeable_job(tr, j);
-                        if (r >= 0)
-                                /* Ok, we managed to drop one, now
-                                 * let's ask our callers to call us
-                                 * again after garbage collecting */
-                                return -EAGAIN;
-
-                        /* We couldn't merge anything. Failure */
-                        dbus_set_error(e, BUS_ERROR_TRANSACTION_JOBS_CONFLICTING, "Transaction contains conflicting jobs '%s' and '%s' for %s. Probably contradicting requirement dependencies configured.",
-                                       job_type_to_string(t), job_type_to_string(k->type), k->unit->id);
-                        return r;
+                        if (r < 0) {
+                                /* We couldn't merge anything. Failure */
+                                dbus_set_error(e, BUS_ERROR_TRANSACTION_JOBS_CONFLICTING, "Transaction contains conflicting jobs '%s' and '%s' for %s. Probably contradicting requirement dependencies configured.",
+                                               job_type_to_string(t), job_type_to_string(k->type), k->unit->id);
+                                return r;
+                        }
+
+                        /* Ok, we managed to drop one, now let's
+                         * garbage collect its dependencies, and
+                         * check this unit again. */
+                        if (mode != JOB_ISOLATE)
+                                transaction_collect_garbage(tr);
                 }
         }
 
         /* Second step, merge the jobs. */
-        HASHMAP_FOREACH(j, tr->jobs, i) {
-                JobType t = j->type;
+        for (u = 0; u < n; u++) {
+                JobType t;
                 Job *k;
 
+                j = hashmap_get(tr->jobs, units[u]);
+                if (!j)
+                        continue;
+
+                t = j->type;
+
                 /* Merge all transaction jobs for j->unit */
                 LIST_FOREACH(transaction, k, j->transaction_next)
                         assert_se(job_type_merge_and_collapse(&t, k->type, j->unit) == 0);
@@ -301,8 +370,8 @@ static void transaction_drop_redundant(Transaction *tr) {
 
         assert(tr);
 
-rescan:
         HASHMAP_FOREACH(j, tr->jobs, i) {
+                Unit *u = j->unit;
                 Job *k;
 
                 LIST_FOREACH(transaction, k, j) {
@@ -313,9 +382,12 @@ rescan:
                                 goto next_unit;
                 }
 
+                /* Not deleting dependencies, hence only this unit's
+                 * entry goes away, which is safe while iterating */
+
                 /* log_debug("Found redundant job %s/%s, dropping.", j->unit->id, job_type_to_string(j->type)); */
-                transaction_delete_job(tr, j, false);
-                goto rescan;
+                while ((k = hashmap_get(tr->jobs, u)))
+                        transaction_delete_job(tr, k, false);
         next_unit:;
         }
 }
@@ -334,160 +406,372 @@ static bool unit_matters_to_anchor(Unit *u, Job *j) {
         return false;
 }
 
-static int transaction_verify_order_one(Transaction *tr, Job *j, Job *from, unsigned generation, DBusError *e) {
-        Iterator i;
-        Unit *u;
+static Job *transaction_order_job(Transaction *tr, Unit *u) {
+        Job *j;
+
+        /* Returns the job of u that takes part in ordering: the one
+         * in the transaction or, if there is none, the one already
+         * running */
+
+        j = hashmap_get(tr->jobs, u);
+        if (j)
+                return j;
+
+        return u->job;
+}
+
+typedef struct OrderFrame {
+        Job *job;
+        unsigned i;
+} OrderFrame;
+
+typedef struct OrderSearch {
+        Transaction *tr;
+
+        /* Jobs visited in this search carry this generation. If
+         * restricted, only jobs carrying the members generation are
+         * looked at. */
+        unsigned generation;
+        unsigned members;
+        bool restricted;
+
+        unsigned index;
+
+        OrderFrame *frames;
+        size_t n_frames, allocated_frames;
+
+        Job **stack;
+        size_t n_stack, allocated_stack;
+
+        /* The units of each cycle found, each list terminated by
+         * NULL */
+        Unit **cycles;
+        size_t n_cycles, allocated_cycles;
+
+        Job **queue;
+        size_t allocated_queue;
+} OrderSearch;
+
+static int order_search_push(OrderSearch *s, Job *j) {
+
+        if (!GREEDY_REALLOC(s->frames, s->allocated_frames, s->n_frames + 1) ||
+            !GREEDY_REALLOC(s->stack, s->allocated_stack, s->n_stack + 1))
+                return -ENOMEM;
+
+        j->generation = s->generation;
+        j->order_index = j->order_lowlink = s->index++;
+        j->order_on_stack = true;
+
+        s->frames[s->n_frames].job = j;
+        s->frames[s->n_frames].i = 0;
+        s->n_frames++;
+
+        s->stack[s->n_stack++] = j;
+
+        return 0;
+}
+
+static int order_search_pop_component(OrderSearch *s, Job *root) {
+        size_t n;
+        Job *k;
+
+        /* Pops the strongly connected component rooted in root off
+         * the stack. Units can't be ordered against themselves, hence
+         * only components of more than one job are cycles. */
+
+        assert(s->n_stack > 0);
+
+        if (s->stack[s->n_stack - 1] == root) {
+                root->order_on_stack = false;
+                s->n_stack--;
+                return 0;
+        }
+
+        n = s->n_stack;
+        do {
+                assert(n > 0);
+                k = s->stack[--n];
+        } while (k != root);
+
+        if (!GREEDY_REALLOC(s->cycles, s->allocated_cycles, s->n_cycles + (s->n_stack - n) + 1))
+                return -ENOMEM;
+
+        while (s->n_stack > n) {
+                k = s->stack[--s->n_stack];
+                k->order_on_stack = false;
+                s->cycles[s->n_cycles++] = k->unit;
+        }
+
+        s->cycles[s->n_cycles++] = NULL;
+        return 0;
+}
+
+static int order_search_visit(OrderSearch *s, Job *root) {
         int r;
 
-        assert(tr);
-        assert(j);
-        assert(!j->transaction_prev);
+        /* Tarjan's algorithm for finding strongly connected
+         * components, without recursion, as ordering chains can be
+         * long. */
 
-        /* Does a recursive sweep through the ordering graph, looking
-         * for a cycle. If we find cycle we try to break it. */
+        r = order_search_push(s, root);
+        if (r < 0)
+                return r;
 
-        /* Have we seen this before? */
-        if (j->generation == generation) {
-                Job *k, *delete;
+        while (s->n_frames > 0) {
+                OrderFrame *f = s->frames + s->n_frames - 1;
+                Job *j = f->job, *o;
+                Unit *u;
 
-                /* If the marker is NULL we have been here already and
-                 * decided the job was loop-free from here. Hence
-                 * shortcut things and return right-away. */
-                if (!j->marker)
-                        return 0;
+                /* We assume that the dependencies are bidirectional,
+                 * and hence can ignore UNIT_AFTER */
+                if (unit_dependency_next(j->unit, UNIT_BEFORE, &f->i, &u)) {
+                        o = transaction_order_job(s->tr, u);
+                        if (!o)
+                                continue;
 
-                /* So, the marker is not NULL and we already have been
-                 * here. We have a cycle. Let's try to break it. We go
-                 * backwards in our path and try to find a suitable
-                 * job to remove. We use the marker to find our way
-                 * back, since smart how we are we stored our way back
-                 * in there. */
-                log_warning_unit(j->unit->id,
-                                 "Found ordering cycle on %s/%s",
-                                 j->unit->id, job_type_to_string(j->type));
-
-                delete = NULL;
-                for (k = from; k; k = ((k->generation == generation && k->marker != k) ? k->marker : NULL)) {
-
-                        /* logging for j not k here here to provide consistent narrative */
-                        log_info_unit(j->unit->id,
-                                      "Walked on cycle path to %s/%s",
-                                      k->unit->id, job_type_to_string(k->type));
-
-                        if (!delete &&
-                            !unit_matters_to_anchor(k->unit, k)) {
-                                /* Ok, we can drop this one, so let's
-                                 * do so. */
-                                delete = k;
+                        if (o->generation == s->generation) {
+                                if (o->order_on_stack)
+                                        j->order_lowlink = MIN(j->order_lowlink, o->order_index);
+                                continue;
                         }
 
-                        /* Check if this in fact was the beginning of
-                         * the cycle */
-                        if (k == j)
-                                break;
-                }
+                        if (s->restricted && o->generation != s->members)
+                                continue;
 
+                        r = order_search_push(s, o);
+                        if (r < 0)
+                                return r;
 
-                if (delete) {
-                        /* logging for j not k here here to provide consistent narrative */
-                        log_warning_unit(j->unit->id,
-                                         "Breaking ordering cycle by deleting job %s/%s",
-                                         delete->unit->id, job_type_to_string(delete->type));
-                        log_error_unit(delete->unit->id,
-                                       "Job %s/%s deleted to break ordering cycle starting with %s/%s",
-                                       delete->unit->id, job_type_to_string(delete->type),
-                                       j->unit->id, job_type_to_string(j->type));
-                        unit_status_printf(delete->unit, ANSI_HIGHLIGHT_RED_ON " SKIP " ANSI_HIGHLIGHT_OFF,
-                                           "Ordering cycle found, skipping %s");
-                        transaction_delete_unit(tr, delete->unit);
-                        return -EAGAIN;
+                        continue;
                 }
 
-                log_error("Unable to break cycle");
+                /* All successors done, backtrack */
+                s->n_frames--;
+                if (s->n_frames > 0) {
+                        Job *parent = s->frames[s->n_frames - 1].job;
+                        parent->order_lowlink = MIN(parent->order_lowlink, j->order_lowlink);
+                }
 
-                dbus_set_error(e, BUS_ERROR_TRANSACTION_ORDER_IS_CYCLIC,
-                               "Transaction order is cyclic. See system logs for details.");
-                return -ENOEXEC;
+                if (j->order_lowlink == j->order_index) {
+                        r = order_search_pop_component(s, j);
+                        if (r < 0)
+                                return r;
+                }
         }
 
-        /* Make the marker point to where we come from, so that we can
-         * find our way backwards if we want to break a cycle. We use
-         * a special marker for the beginning: we point to
-         * ourselves. */
-        j->marker = from ? from : j;
-        j->generation = generation;
+        return 0;
+}
 
-        /* We assume that the dependencies are bidirectional, and
-         * hence can ignore UNIT_AFTER */
-        SET_FOREACH(u, j->unit->dependencies[UNIT_BEFORE], i) {
-                Job *o;
-
-                /* Is there a job for this unit? */
-                o = hashmap_get(tr->jobs, u);
-                if (!o) {
-                        /* Ok, there is no job for this in the
-                         * transaction, but maybe there is already one
-                         * running? */
-                        o = u->job;
+static Job *order_search_find_path(OrderSearch *s, Job *start, unsigned members) {
+        size_t head = 0, tail = 0;
+        unsigned visited;
+
+        /* Finds a shortest cycle through start in a component whose
+         * jobs carry the members generation, by a breadth-first
+         * search back to start. The path is recorded in the markers,
+         * and the last job on it before start is returned. */
+
+        visited = s->generation;
+        start->generation = visited;
+
+        if (!GREEDY_REALLOC(s->queue, s->allocated_queue, 1))
+                return NULL;
+
+        s->queue[tail++] = start;
+
+        while (head < tail) {
+                Job *j = s->queue[head++];
+                unsigned i;
+                Unit *u;
+
+                UNIT_FOREACH_DEPENDENCY(u, j->unit, UNIT_BEFORE, i) {
+                        Job *o;
+
+                        o = transaction_order_job(s->tr, u);
                         if (!o)
                                 continue;
-                }
 
-                r = transaction_verify_order_one(tr, o, j, generation, e);
-                if (r < 0)
-                        return r;
+                        if (o == start)
+                                return j;
+
+                        if (o->generation != members)
+                                continue;
+
+                        if (!GREEDY_REALLOC(s->queue, s->allocated_queue, tail + 1))
+                                return NULL;
+
+                        o->generation = visited;
+                        o->marker = j;
+                        s->queue[tail++] = o;
+                }
         }
 
-        /* Ok, let's backtrack, and remember that this entry is not on
-         * our path anymore. */
+        return NULL;
+}
+
+static int transaction_break_order_cycle(Transaction *tr, OrderSearch *s, Unit **cycle, unsigned *generation, DBusError *e) {
+        Job *j, *k, *from, *delete;
+        unsigned members;
+        Unit **u;
+
+        /* Marks the component's jobs, finds one cycle in it and
+         * deletes a job on that cycle, choosing one that doesn't
+         * matter to the anchor. */
+
+        members = (*generation)++;
+        for (u = cycle; *u; u++)
+                transaction_order_job(tr, *u)->generation = members;
+
+        j = transaction_order_job(tr, cycle[0]);
         j->marker = NULL;
 
-        return 0;
+        s->generation = (*generation)++;
+        from = order_search_find_path(s, j, members);
+        if (!from)
+                return -ENOMEM;
+
+        log_warning_unit(j->unit->id,
+                         "Found ordering cycle on %s/%s",
+                         j->unit->id, job_type_to_string(j->type));
+
+        delete = NULL;
+        for (k = from; k; k = k->marker) {
+
+                /* logging for j not k here here to provide consistent narrative */
+                log_info_unit(j->unit->id,
+                              "Walked on cycle path to %s/%s",
+                              k->unit->id, job_type_to_string(k->type));
+
+                /* Jobs already running can't be dropped from the
+                 * transaction */
+                if (!delete &&
+                    hashmap_get(tr->jobs, k->unit) == k &&
+                    !unit_matters_to_anchor(k->unit, k)) {
+                        /* Ok, we can drop this one, so let's
+                         * do so. */
+                        delete = k;
+                }
+        }
+
+        if (delete) {
+                /* logging for j not k here here to provide consistent narrative */
+                log_warning_unit(j->unit->id,
+                                 "Breaking ordering cycle by deleting job %s/%s",
+                                 delete->unit->id, job_type_to_string(delete->type));
+                log_error_unit(delete->unit->id,
+                               "Job %s/%s deleted to break ordering cycle starting with %s/%s",
+                               delete->unit->id, job_type_to_string(delete->type),
+                               j->unit->id, job_type_to_string(j->type));
+                unit_status_printf(delete->unit, ANSI_HIGHLIGHT_RED_ON " SKIP " ANSI_HIGHLIGHT_OFF,
+                                   "Ordering cycle found, skipping %s");
+                transaction_delete_unit(tr, delete->unit);
+                return 0;
+        }
+
+        log_error("Unable to break cycle");
+
+        dbus_set_error(e, BUS_ERROR_TRANSACTION_ORDER_IS_CYCLIC,
+                       "Transaction order is cyclic. See system logs for details.");
+        return -ENOEXEC;
 }
 
-static int transaction_verify_order(Transaction *tr, unsigned *generation, DBusError *e) {
-        Job *j;
+static int transaction_fix_order_component(Transaction *tr, OrderSearch *s, Unit **component, JobMode mode, unsigned *generation, DBusError *e) {
+        Unit **u;
         int r;
-        Iterator i;
-        unsigned g;
 
-        assert(tr);
-        assert(generation);
+        /* Breaking a cycle only removes jobs and ordering
+         * dependencies, so any remaining cycles lie within the
+         * component it was part of. Keep breaking cycles in it until
+         * it falls apart. */
 
-        /* Check if the ordering graph is cyclic. If it is, try to fix
-         * that up by dropping one of the jobs. */
+        for (;;) {
+                Job *j;
 
-        g = (*generation)++;
+                s->members = (*generation)++;
+                s->generation = (*generation)++;
+                s->restricted = true;
+                s->n_cycles = 0;
 
-        HASHMAP_FOREACH(j, tr->jobs, i)
-                if ((r = transaction_verify_order_one(tr, j, NULL, g, e)) < 0)
+                for (u = component; *u; u++) {
+                        j = transaction_order_job(tr, *u);
+                        if (j)
+                                j->generation = s->members;
+                }
+
+                for (u = component; *u; u++) {
+                        j = transaction_order_job(tr, *u);
+                        if (!j || j->generation != s->members)
+                                continue;
+
+                        r = order_search_visit(s, j);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (s->n_cycles <= 0)
+                        return 0;
+
+                r = transaction_break_order_cycle(tr, s, s->cycles, generation, e);
+                if (r < 0)
                         return r;
 
-        return 0;
+                if (mode != JOB_ISOLATE)
+                        transaction_collect_garbage(tr);
+        }
 }
 
-static void transaction_collect_garbage(Transaction *tr) {
-        Iterator i;
+static int transaction_verify_order(Transaction *tr, JobMode mode, unsigned *generation, DBusError *e) {
+        _cleanup_free_ Unit **cycles = NULL;
+        OrderSearch s = {
+                .tr = tr,
+        };
+        size_t n_cycles, c;
         Job *j;
+        int r;
+        Iterator i;
 
         assert(tr);
+        assert(generation);
+
+        /* Check if the ordering graph is cyclic. If it is, try to fix
+         * that up by dropping jobs. One pass finds all strongly
+         * connected components of the ordering graph, which are then
+         * fixed up one by one. */
 
-        /* Drop jobs that are not required by any other job */
+        s.generation = (*generation)++;
 
-rescan:
         HASHMAP_FOREACH(j, tr->jobs, i) {
-                if (tr->anchor_job == j || j->object_list) {
-                        /* log_debug("Keeping job %s/%s because of %s/%s", */
-                        /*           j->unit->id, job_type_to_string(j->type), */
-                        /*           j->object_list->subject ? j->object_list->subject->unit->id : "root", */
-                        /*           j->object_list->subject ? job_type_to_string(j->object_list->subject->type) : "root"); */
+                if (j->generation == s.generation)
                         continue;
-                }
 
-                /* log_debug("Garbage collecting job %s/%s", j->unit->id, job_type_to_string(j->type)); */
-                transaction_delete_job(tr, j, true);
-                goto rescan;
+                r = order_search_visit(&s, j);
+                if (r < 0)
+                        goto finish;
         }
+
+        /* The components are reused as scratch space while fixing
+         * things up, hence take them out */
+        cycles = s.cycles;
+        n_cycles = s.n_cycles;
+        s.cycles = NULL;
+        s.n_cycles = s.allocated_cycles = 0;
+
+        r = 0;
+        for (c = 0; c < n_cycles; c++) {
+                if (cycles[c] && (c == 0 || !cycles[c-1])) {
+                        r = transaction_fix_order_component(tr, &s, cycles + c, mode, generation, e);
+                        if (r < 0)
+                                break;
+                }
+        }
+
+finish:
+        free(s.frames);
+        free(s.stack);
+        free(s.cycles);
+        free(s.queue);
+
+        return r;
 }
 
 static int transaction_is_destructive(Transaction *tr, JobMode mode, DBusError *e) {
@@ -516,7 +800,9 @@ static int transaction_is_destructive(Transaction *tr, JobMode mode, DBusError *
         return 0;
 }
 
-static void transaction_minimize_impact(Transaction *tr) {
+static int transaction_minimize_impact(Transaction *tr) {
+        _cleanup_free_ Unit **units = NULL;
+        unsigned n = 0, u;
         Job *j;
         Iterator i;
 
@@ -525,9 +811,20 @@ static void transaction_minimize_impact(Transaction *tr) {
         /* Drops all unnecessary jobs that reverse already active jobs
          * or that stop a running service. */
 
-rescan:
-        HASHMAP_FOREACH(j, tr->jobs, i) {
-                LIST_FOREACH(transaction, j, j) {
+        /* Whether a job is dropped depends on nothing but the job
+         * itself, hence one pass is enough. We remember the units
+         * rather than the jobs, since deleting one job might take
+         * others with it. */
+        units = new(Unit*, hashmap_size(tr->jobs));
+        if (!units)
+                return -ENOMEM;
+
+        HASHMAP_FOREACH(j, tr->jobs, i)
+                units[n++] = j->unit;
+
+        for (u = 0; u < n; u++) {
+        rescan:
+                LIST_FOREACH(transaction, j, hashmap_get(tr->jobs, units[u])) {
                         bool stops_running_service, changes_existing_job;
 
                         /* If it matters, we shouldn't drop it */
@@ -567,6 +864,8 @@ rescan:
                         goto rescan;
                 }
         }
+
+        return 0;
 }
 
 static int transaction_apply(Transaction *tr, Manager *m, JobMode mode) {
@@ -658,66 +957,53 @@ int transaction_activate(Transaction *tr, Manager *m, JobMode mode, DBusError *e
         /* Second step: Try not to stop any running services if
          * we don't have to. Don't try to reverse running
          * jobs if we don't have to. */
-        if (mode == JOB_FAIL)
-                transaction_minimize_impact(tr);
+        if (mode == JOB_FAIL) {
+                r = transaction_minimize_impact(tr);
+                if (r < 0)
+                        return r;
+        }
 
         /* Third step: Drop redundant jobs */
         transaction_drop_redundant(tr);
 
-        for (;;) {
-                /* Fourth step: Let's remove unneeded jobs that might
-                 * be lurking. */
-                if (mode != JOB_ISOLATE)
-                        transaction_collect_garbage(tr);
-
-                /* Fifth step: verify order makes sense and correct
-                 * cycles if necessary and possible */
-                r = transaction_verify_order(tr, &generation, e);
-                if (r >= 0)
-                        break;
+        /* Fourth step: Let's remove unneeded jobs that might be
+         * lurking. From here on jobs are garbage collected as
+         * others get dropped. */
+        if (mode != JOB_ISOLATE) {
+                HASHMAP_FOREACH(j, tr->jobs, i)
+                        transaction_add_to_gc_queue(tr, j);
 
-                if (r != -EAGAIN) {
-                        log_warning("Requested transaction contains an unfixable cyclic ordering dependency: %s", bus_error(e, r));
-                        return r;
-                }
-
-                /* Let's see if the resulting transaction ordering
-                 * graph is still cyclic... */
+                transaction_collect_garbage(tr);
         }
 
-        for (;;) {
-                /* Sixth step: let's drop unmergeable entries if
-                 * necessary and possible, merge entries we can
-                 * merge */
-                r = transaction_merge_jobs(tr, e);
-                if (r >= 0)
-                        break;
-
-                if (r != -EAGAIN) {
-                        log_warning("Requested transaction contains unmergeable jobs: %s", bus_error(e, r));
-                        return r;
-                }
-
-                /* Seventh step: an entry got dropped, let's garbage
-                 * collect its dependencies. */
-                if (mode != JOB_ISOLATE)
-                        transaction_collect_garbage(tr);
+        /* Fifth step: verify order makes sense and correct
+         * cycles if necessary and possible */
+        r = transaction_verify_order(tr, mode, &generation, e);
+        if (r < 0) {
+                log_warning("Requested transaction contains an unfixable cyclic ordering dependency: %s", bus_error(e, r));
+                return r;
+        }
 
-                /* Let's see if the resulting transaction still has
-                 * unmergeable entries ... */
+        /* Sixth step: let's drop unmergeable entries if
+         * necessary and possible, merge entries we can
+         * merge */
+        r = transaction_merge_jobs(tr, mode, e);
+        if (r < 0) {
+                log_warning("Requested transaction contains unmergeable jobs: %s", bus_error(e, r));
+                return r;
         }
 
-        /* Eights step: Drop redundant jobs again, if the merging now allows us to drop more. */
+        /* Seventh step: Drop redundant jobs again, if the merging now allows us to drop more. */
         transaction_drop_redundant(tr);
 
-        /* Ninth step: check whether we can actually apply this */
+        /* Eighth step: check whether we can actually apply this */
         r = transaction_is_destructive(tr, mode, e);
         if (r < 0) {
                 log_notice("Requested transaction contradicts existing jobs: %s", bus_error(e, r));
                 return r;
         }
 
-        /* Tenth step: apply changes */
+        /* Ninth step: apply changes */
         r = transaction_apply(tr, m, mode);
         if (r < 0) {
                 log_warning("Failed to apply transaction: %s", strerror(-r));
@@ -794,9 +1080,13 @@ static void transaction_unlink_job(Transaction *tr, Job *j, bool delete_dependen
 
         if (j->transaction_prev)
                 j->transaction_prev->transaction_next = j->transaction_next;
-        else if (j->transaction_next)
+        else if (j->transaction_next) {
                 hashmap_replace(tr->jobs, j->unit, j->transaction_next);
-        else
+
+                /* The garbage collector only looks at the first
+                 * job of each unit */
+                transaction_add_to_gc_queue(tr, j->transaction_next);
+        } else
                 hashmap_remove_value(tr->jobs, j->unit, j);
 
         if (j->transaction_next)
@@ -804,9 +1094,16 @@ static void transaction_unlink_job(Transaction *tr, Job *j, bool delete_dependen
 
         j->transaction_prev = j->transaction_next = NULL;
 
-        while (j->subject_list)
+        while (j->subject_list) {
+                Job *other = j->subject_list->object;
+
                 job_dependency_free(j->subject_list);
 
+                /* Maybe nobody needs the other job anymore */
+                if (!other->object_list)
+                        transaction_add_to_gc_queue(tr, other);
+        }
+
         while (j->object_list) {
                 Job *other = j->object_list->matters ? j->object_list->subject : NULL;
 
@@ -820,6 +1117,13 @@ static void transaction_unlink_job(Transaction *tr, Job *j, bool delete_dependen
                         transaction_delete_job(tr, other, delete_dependencies);
                 }
         }
+
+        /* Dropping the jobs depending on us might have queued us
+         * again, hence do this last */
+        if (j->in_gc_queue) {
+                LIST_REMOVE(Job, gc_queue, tr->gc_queue, j);
+                j->in_gc_queue = false;
+        }
 }
 
 int transaction_add_job_and_dependencies(
@@ -835,6 +1139,7 @@ int transaction_add_job_and_dependencies(
                 DBusError *e) {
         Job *ret;
         Iterator i;
+        unsigned k;
         Unit *dep;
         int r;
         bool is_new;
@@ -916,7 +1221,7 @@ int transaction_add_job_and_dependencies(
 
                 /* Finally, recursively add in all dependencies. */
                 if (type == JOB_START || type == JOB_RESTART) {
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_REQUIRES], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_REQUIRES, k) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_START, dep, ret, true, override, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR)
@@ -927,7 +1232,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_BINDS_TO], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_BINDS_TO, k) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_START, dep, ret, true, override, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR)
@@ -938,7 +1243,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_REQUIRES_OVERRIDABLE], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_REQUIRES_OVERRIDABLE, k) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_START, dep, ret, !override, override, false, false, ignore_order, e);
                                 if (r < 0) {
                                         log_full_unit(r == -EADDRNOTAVAIL ? LOG_DEBUG : LOG_WARNING, dep->id,
@@ -950,7 +1255,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_WANTS], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_WANTS, k) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_START, dep, ret, false, false, false, false, ignore_order, e);
                                 if (r < 0) {
                                         log_full_unit(r == -EADDRNOTAVAIL ? LOG_DEBUG : LOG_WARNING, dep->id,
@@ -962,7 +1267,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_REQUISITE], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_REQUISITE, k) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_VERIFY_ACTIVE, dep, ret, true, override, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR)
@@ -973,7 +1278,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_REQUISITE_OVERRIDABLE], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_REQUISITE_OVERRIDABLE, k) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_VERIFY_ACTIVE, dep, ret, !override, override, false, false, ignore_order, e);
                                 if (r < 0) {
                                         log_full_unit(r == -EADDRNOTAVAIL ? LOG_DEBUG : LOG_WARNING, dep->id,
@@ -985,7 +1290,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_CONFLICTS], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_CONFLICTS, k) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_STOP, dep, ret, true, override, true, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR)
@@ -996,7 +1301,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_CONFLICTED_BY], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_CONFLICTED_BY, k) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_STOP, dep, ret, false, override, false, false, ignore_order, e);
                                 if (r < 0) {
                                         log_warning_unit(dep->id,
@@ -1012,7 +1317,7 @@ int transaction_add_job_and_dependencies(
 
                 if (type == JOB_STOP || type == JOB_RESTART) {
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_REQUIRED_BY], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_REQUIRED_BY, k) {
                                 r = transaction_add_job_and_dependencies(tr, type, dep, ret, true, override, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR)
@@ -1023,7 +1328,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_BOUND_BY], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_BOUND_BY, k) {
                                 r = transaction_add_job_and_dependencies(tr, type, dep, ret, true, override, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR)
@@ -1034,7 +1339,7 @@ int transaction_add_job_and_dependencies(
                                 }
                         }
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_CONSISTS_OF], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_CONSISTS_OF, k) {
                                 r = transaction_add_job_and_dependencies(tr, type, dep, ret, true, override, false, false, ignore_order, e);
                                 if (r < 0) {
                                         if (r != -EBADR)
@@ -1049,7 +1354,7 @@ int transaction_add_job_and_dependencies(
 
                 if (type == JOB_RELOAD) {
 
-                        SET_FOREACH(dep, ret->unit->dependencies[UNIT_PROPAGATES_RELOAD_TO], i) {
+                        UNIT_FOREACH_DEPENDENCY(dep, ret->unit, UNIT_PROPAGATES_RELOAD_TO, k) {
                                 r = transaction_add_job_and_dependencies(tr, JOB_RELOAD, dep, ret, false, override, false, false, ignore_order, e);
                                 if (r < 0) {
                                         log_warning_unit(dep->id,
@@ -1127,6 +1432,7 @@ Transaction *transaction_new(bool irreversible) {
 
 void transaction_free(Transaction *tr) {
         assert(hashmap_isempty(tr->jobs));
+        assert(!tr->gc_queue);
         hashmap_free(tr->jobs);
         free(tr);
 }
@@ -33,6 +33,9 @@ struct Transaction {
         /* Jobs to be added */
         Hashmap *jobs;      /* Unit object => Job object list 1:1 */
         Job *anchor_job;      /* the job the user asked for */
+
+        /* Jobs the garbage collector should have a look at */
+        LIST_HEAD(Job, gc_queue);
         bool irreversible;
 };
 
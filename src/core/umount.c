@@ -21,6 +21,10 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/mount.h>
 #include <sys/swap.h>
@@ -30,15 +34,28 @@
 #include <libudev.h>
 
 #include "list.h"
+#include "hashmap.h"
 #include "mount-setup.h"
 #include "umount.h"
 #include "path-util.h"
 #include "util.h"
 #include "virt.h"
 
+/* Mount points of one level of the tree are unmounted concurrently
+ * once there are at least this many of them. The time goes into
+ * waiting in the kernel rather than into computing, hence the number
+ * of threads does not depend on the number of CPUs. */
+#define UMOUNT_PARALLEL_MIN 8
+#define UMOUNT_WORKERS_MAX 16U
+
+/* We run mlockall()ed, so keep the stacks of the workers small */
+#define UMOUNT_WORKER_STACK (64*1024)
+
 typedef struct MountPoint {
         char *path;
         dev_t devnum;
+        unsigned id;
+        unsigned depth;
         LIST_FIELDS (struct MountPoint, mount_point);
 } MountPoint;
 
@@ -59,26 +76,60 @@ static void mount_points_list_free(MountPoint **head) {
                 mount_point_free(head, *head);
 }
 
+static void mount_points_list_set_depth(MountPoint *head, Hashmap *parents) {
+        MountPoint *m;
+
+        /* The parent of each mount point is only known by its id,
+         * and might well be one of the API file systems that are not
+         * on the list, hence all ids are looked up in the table of
+         * the whole file. Not finding one, or finding the mount
+         * itself, means we reached the root of our namespace. */
+
+        LIST_FOREACH(mount_point, m, head) {
+                unsigned id = m->id, n;
+
+                for (n = 0; n < hashmap_size(parents); n++) {
+                        unsigned parent;
+
+                        parent = PTR_TO_UINT(hashmap_get(parents, UINT_TO_PTR(id)));
+                        if (parent == 0 || parent - 1 == id)
+                                break;
+
+                        id = parent - 1;
+                }
+
+                m->depth = n;
+        }
+}
+
 static int mount_points_list_get(MountPoint **head) {
         FILE *proc_self_mountinfo;
+        Hashmap *parents;
         char *path, *p;
         unsigned int i;
         int r;
 
         assert(head);
 
-        if (!(proc_self_mountinfo = fopen("/proc/self/mountinfo", "re")))
+        parents = hashmap_new(trivial_hash_func, trivial_compare_func);
+        if (!parents)
+                return -ENOMEM;
+
+        if (!(proc_self_mountinfo = fopen("/proc/self/mountinfo", "re"))) {
+                hashmap_free(parents);
                 return -errno;
+        }
 
         for (i = 1;; i++) {
                 int k;
                 MountPoint *m;
+                unsigned id, parent;
 
                 path = p = NULL;
 
                 if ((k = fscanf(proc_self_mountinfo,
-                                "%*s "       /* (1) mount id */
-                                "%*s "       /* (2) parent id */
+                                "%u "        /* (1) mount id */
+                                "%u "        /* (2) parent id */
                                 "%*s "       /* (3) major:minor */
                                 "%*s "       /* (4) root */
                                 "%ms "       /* (5) mount point */
@@ -89,7 +140,9 @@ static int mount_points_list_get(MountPoint **head) {
                                 "%*s"        /* (10) mount source */
                                 "%*s"        /* (11) mount options 2 */
                                 "%*[^\n]",   /* some rubbish at the end */
-                                &path)) != 1) {
+                                &id,
+                                &parent,
+                                &path)) != 3) {
                         if (k == EOF)
                                 break;
 
@@ -99,6 +152,14 @@ static int mount_points_list_get(MountPoint **head) {
                         continue;
                 }
 
+                /* Parents are stored off by one, so that they are
+                 * never NULL */
+                if (hashmap_put(parents, UINT_TO_PTR(id), UINT_TO_PTR(parent + 1)) < 0) {
+                        free(path);
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
                 p = cunescape(path);
                 free(path);
 
@@ -124,13 +185,17 @@ static int mount_points_list_get(MountPoint **head) {
                 }
 
                 m->path = p;
+                m->id = id;
                 LIST_PREPEND(MountPoint, mount_point, *head, m);
         }
 
+        mount_points_list_set_depth(*head, parents);
+
         r = 0;
 
 finish:
         fclose(proc_self_mountinfo);
+        hashmap_free(parents);
 
         return r;
 }
@@ -234,6 +299,7 @@ static int loopback_list_get(MountPoint **head) {
         udev_list_entry_foreach(item, first) {
                 MountPoint *lb;
                 struct udev_device *d;
+                dev_t devnum;
                 char *loop;
                 const char *dn;
 
@@ -247,6 +313,7 @@ static int loopback_list_get(MountPoint **head) {
                         continue;
                 }
 
+                devnum = udev_device_get_devnum(d);
                 loop = strdup(dn);
                 udev_device_unref(d);
 
@@ -262,6 +329,7 @@ static int loopback_list_get(MountPoint **head) {
                 }
 
                 lb->path = loop;
+                lb->devnum = devnum;
                 LIST_PREPEND(MountPoint, mount_point, *head, lb);
         }
 
@@ -399,63 +467,194 @@ static int delete_dm(dev_t devnum) {
         return r >= 0 ? 0 : -errno;
 }
 
+typedef struct UmountJob {
+        MountPoint *mount_point;
+        int error;
+} UmountJob;
+
+typedef struct UmountQueue {
+        pthread_mutex_t mutex;
+        bool remount;
+
+        UmountJob *jobs;
+        unsigned n_jobs;
+        unsigned next;
+} UmountQueue;
+
+/* Skip / and /usr since we cannot unmount that anyway, since we are
+ * running from it. They have already been remounted ro. */
+static bool mount_point_is_root(MountPoint *m) {
+        return path_equal(m->path, "/")
+#ifndef HAVE_SPLIT_USR
+                || path_equal(m->path, "/usr")
+#endif
+                ;
+}
+
+static void umount_one(UmountQueue *q, UmountJob *j) {
+        MountPoint *m = j->mount_point;
+
+        /* If we are in a container, don't attempt to read-only mount
+           anything as that brings no real benefits, but might confuse
+           the host, as we remount the superblock here, not the bind
+           mound. */
+        if (q->remount)
+                /* We always try to remount directories read-only
+                 * first, before we go on and umount them.
+                 *
+                 * Mount points can be stacked. If a mount point is
+                 * stacked below / or /usr, we cannnot umount or
+                 * remount it directly, since there is no way to
+                 * refer to the underlying mount. There's nothing we
+                 * can do about it for the general case, but we can
+                 * do something about it if it is aliased somehwere
+                 * else via a bind mount. If we explicitly remount
+                 * the super block of that alias read-only we hence
+                 * should be relatively safe regarding keeping the fs
+                 * we can otherwise not see dirty. */
+                mount(NULL, m->path, NULL, MS_REMOUNT|MS_RDONLY, NULL);
+
+        if (mount_point_is_root(m)) {
+                j->error = -EBUSY;
+                return;
+        }
+
+        /* Trying to umount. We don't force here since we rely on busy
+         * NFS and FUSE file systems to return EBUSY until we closed
+         * everything on top of them. */
+        j->error = umount2(m->path, 0) < 0 ? -errno : 0;
+}
+
+static void *umount_thread(void *p) {
+        UmountQueue *q = p;
+
+        for (;;) {
+                UmountJob *j = NULL;
+
+                assert_se(pthread_mutex_lock(&q->mutex) == 0);
+                if (q->next < q->n_jobs)
+                        j = q->jobs + q->next++;
+                assert_se(pthread_mutex_unlock(&q->mutex) == 0);
+
+                if (!j)
+                        break;
+
+                umount_one(q, j);
+        }
+
+        return NULL;
+}
+
+static void umount_level(UmountQueue *q) {
+        pthread_t threads[UMOUNT_WORKERS_MAX];
+        pthread_attr_t a;
+        unsigned i, n_threads = 0, n_workers = 0;
+        sigset_t ss, saved_ss;
+
+        q->next = 0;
+
+        if (q->n_jobs >= UMOUNT_PARALLEL_MIN &&
+            pthread_attr_init(&a) == 0) {
+
+                /* n_jobs is at least UMOUNT_PARALLEL_MIN here, we
+                 * do one share of the work ourselves */
+                assert(q->n_jobs > 0);
+                n_workers = MIN(q->n_jobs - 1, UMOUNT_WORKERS_MAX);
+
+                assert_se(pthread_attr_setstacksize(&a, MAX(UMOUNT_WORKER_STACK, PTHREAD_STACK_MIN)) == 0);
+
+                assert_se(sigfillset(&ss) >= 0);
+                assert_se(pthread_sigmask(SIG_SETMASK, &ss, &saved_ss) == 0);
+
+                for (; n_threads < n_workers; n_threads++)
+                        if (pthread_create(threads + n_threads, &a, umount_thread, q) != 0)
+                                break;
+
+                assert_se(pthread_sigmask(SIG_SETMASK, &saved_ss, NULL) == 0);
+                pthread_attr_destroy(&a);
+        }
+
+        /* If not all threads could be started we simply do more work
+         * here */
+        umount_thread(q);
+
+        for (i = 0; i < n_threads; i++)
+                pthread_join(threads[i], NULL);
+}
+
+static int mount_point_compare_depth(const void *a, const void *b) {
+        const UmountJob *x = a, *y = b;
+
+        /* Deepest first */
+        if (x->mount_point->depth > y->mount_point->depth)
+                return -1;
+        if (x->mount_point->depth < y->mount_point->depth)
+                return 1;
+
+        return 0;
+}
+
 static int mount_points_list_umount(MountPoint **head, bool *changed, bool log_error) {
-        MountPoint *m, *n;
+        UmountQueue q = {
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+        };
+        _cleanup_free_ UmountJob *jobs = NULL;
+        MountPoint *m;
+        unsigned n = 0, i, j;
         int n_failed = 0;
 
         assert(head);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
+        LIST_FOREACH(mount_point, m, *head)
+                n++;
 
-                /* If we are in a container, don't attempt to
-                   read-only mount anything as that brings no real
-                   benefits, but might confuse the host, as we remount
-                   the superblock here, not the bind mound. */
-                if (detect_container(NULL) <= 0)  {
-                        /* We always try to remount directories
-                         * read-only first, before we go on and umount
-                         * them.
-                         *
-                         * Mount points can be stacked. If a mount
-                         * point is stacked below / or /usr, we
-                         * cannnot umount or remount it directly,
-                         * since there is no way to refer to the
-                         * underlying mount. There's nothing we can do
-                         * about it for the general case, but we can
-                         * do something about it if it is aliased
-                         * somehwere else via a bind mount. If we
-                         * explicitly remount the super block of that
-                         * alias read-only we hence should be
-                         * relatively safe regarding keeping the fs we
-                         * can otherwise not see dirty. */
-                        mount(NULL, m->path, NULL, MS_REMOUNT|MS_RDONLY, NULL);
-                }
+        if (n <= 0)
+                return 0;
 
-                /* Skip / and /usr since we cannot unmount that
-                 * anyway, since we are running from it. They have
-                 * already been remounted ro. */
-                if (path_equal(m->path, "/")
-#ifndef HAVE_SPLIT_USR
-                    || path_equal(m->path, "/usr")
-#endif
-                )
-                        continue;
+        jobs = new0(UmountJob, n);
+        if (!jobs)
+                return -ENOMEM;
 
-                /* Trying to umount. We don't force here since we rely
-                 * on busy NFS and FUSE file systems to return EBUSY
-                 * until we closed everything on top of them. */
-                log_info("Unmounting %s.", m->path);
-                if (umount2(m->path, 0) == 0) {
-                        if (changed)
-                                *changed = true;
+        i = 0;
+        LIST_FOREACH(mount_point, m, *head)
+                jobs[i++].mount_point = m;
 
-                        mount_point_free(head, m);
-                } else if (log_error) {
-                        log_warning("Could not unmount %s: %m", m->path);
-                        n_failed++;
+        /* Everything below a mount point has to go before it, while
+         * mount points on the same level are in separate subtrees and
+         * independent of each other. Hence the tree is unmounted
+         * level by level, from the leaves up, and each level as a
+         * whole at once. */
+        qsort(jobs, n, sizeof(UmountJob), mount_point_compare_depth);
+
+        q.remount = detect_container(NULL) <= 0;
+
+        for (i = 0; i < n; i = j) {
+                unsigned k;
+
+                for (j = i; j < n && jobs[j].mount_point->depth == jobs[i].mount_point->depth; j++)
+                        if (!mount_point_is_root(jobs[j].mount_point))
+                                log_info("Unmounting %s.", jobs[j].mount_point->path);
+
+                q.jobs = jobs + i;
+                q.n_jobs = j - i;
+                umount_level(&q);
+
+                for (k = i; k < j; k++) {
+                        if (jobs[k].error == 0) {
+                                if (changed)
+                                        *changed = true;
+
+                                mount_point_free(head, jobs[k].mount_point);
+
+                        } else if (log_error && !mount_point_is_root(jobs[k].mount_point)) {
+                                log_warning("Could not unmount %s: %s", jobs[k].mount_point->path, strerror(-jobs[k].error));
+                                n_failed++;
+                        }
                 }
         }
 
+        pthread_mutex_destroy(&q.mutex);
+
         return n_failed;
 }
 
@@ -481,74 +680,122 @@ static int swap_points_list_off(MountPoint **head, bool *changed) {
         return n_failed;
 }
 
+/* Devices stacked on top of another one, like a dm-crypt volume on a
+ * loop device, show up among its holders in sysfs and need to go
+ * first. Instead of rescanning after each round, the devices whose
+ * holders are still around are simply retried once the others are
+ * gone, until nothing changes anymore. */
+static bool block_device_is_held(dev_t devnum) {
+        char p[sizeof("/sys/dev/block/:/holders") + 2*DECIMAL_STR_MAX(unsigned)];
+
+        if (major(devnum) == 0)
+                return false;
+
+        snprintf(p, sizeof(p), "/sys/dev/block/%u:%u/holders", major(devnum), minor(devnum));
+
+        return dir_is_empty(p) == 0;
+}
+
 static int loopback_points_list_detach(MountPoint **head, bool *changed) {
         MountPoint *m, *n;
-        int n_failed = 0, k;
+        int n_failed, k;
         struct stat root_st;
+        bool progress;
 
         assert(head);
 
         k = lstat("/", &root_st);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
-                int r;
-                struct stat loopback_st;
-
-                if (k >= 0 &&
-                    major(root_st.st_dev) != 0 &&
-                    lstat(m->path, &loopback_st) >= 0 &&
-                    root_st.st_dev == loopback_st.st_rdev) {
-                        n_failed ++;
-                        continue;
+        do {
+                progress = false;
+                n_failed = 0;
+
+                LIST_FOREACH_SAFE(mount_point, m, n, *head) {
+                        int r;
+                        struct stat loopback_st;
+
+                        if (k >= 0 &&
+                            major(root_st.st_dev) != 0 &&
+                            lstat(m->path, &loopback_st) >= 0 &&
+                            root_st.st_dev == loopback_st.st_rdev) {
+                                n_failed ++;
+                                continue;
+                        }
+
+                        if (block_device_is_held(m->devnum)) {
+                                n_failed ++;
+                                continue;
+                        }
+
+                        log_info("Detaching loopback %s.", m->path);
+                        r = delete_loopback(m->path);
+                        if (r >= 0) {
+                                if (r > 0 && changed)
+                                        *changed = true;
+
+                                mount_point_free(head, m);
+                                progress = true;
+                        } else {
+                                log_warning("Could not detach loopback %s: %s", m->path, strerror(-r));
+                                n_failed++;
+                        }
                 }
+        } while (progress && n_failed > 0);
 
-                log_info("Detaching loopback %s.", m->path);
-                r = delete_loopback(m->path);
-                if (r >= 0) {
-                        if (r > 0 && changed)
-                                *changed = true;
-
-                        mount_point_free(head, m);
-                } else {
-                        log_warning("Could not detach loopback %s: %m", m->path);
-                        n_failed++;
-                }
-        }
+        LIST_FOREACH(mount_point, m, *head)
+                if (block_device_is_held(m->devnum))
+                        log_warning("Could not detach loopback %s: still in use.", m->path);
 
         return n_failed;
 }
 
 static int dm_points_list_detach(MountPoint **head, bool *changed) {
         MountPoint *m, *n;
-        int n_failed = 0, k;
+        int n_failed, k;
         struct stat root_st;
+        bool progress;
 
         assert(head);
 
         k = lstat("/", &root_st);
 
-        LIST_FOREACH_SAFE(mount_point, m, n, *head) {
-                int r;
-
-                if (k >= 0 &&
-                    major(root_st.st_dev) != 0 &&
-                    root_st.st_dev == m->devnum) {
-                        n_failed ++;
-                        continue;
+        do {
+                progress = false;
+                n_failed = 0;
+
+                LIST_FOREACH_SAFE(mount_point, m, n, *head) {
+                        int r;
+
+                        if (k >= 0 &&
+                            major(root_st.st_dev) != 0 &&
+                            root_st.st_dev == m->devnum) {
+                                n_failed ++;
+                                continue;
+                        }
+
+                        if (block_device_is_held(m->devnum)) {
+                                n_failed ++;
+                                continue;
+                        }
+
+                        log_info("Detaching DM %u:%u.", major(m->devnum), minor(m->devnum));
+                        r = delete_dm(m->devnum);
+                        if (r >= 0) {
+                                if (changed)
+                                        *changed = true;
+
+                                mount_point_free(head, m);
+                                progress = true;
+                        } else {
+                                log_warning("Could not detach DM %s: %s", m->path, strerror(-r));
+                                n_failed++;
+                        }
                 }
+        } while (progress && n_failed > 0);
 
-                log_info("Detaching DM %u:%u.", major(m->devnum), minor(m->devnum));
-                r = delete_dm(m->devnum);
-                if (r >= 0) {
-                        if (changed)
-                                *changed = true;
-
-                        mount_point_free(head, m);
-                } else {
-                        log_warning("Could not detach DM %s: %m", m->path);
-                        n_failed++;
-                }
-        }
+        LIST_FOREACH(mount_point, m, *head)
+                if (block_device_is_held(m->devnum))
+                        log_warning("Could not detach DM %s: still in use.", m->path);
 
         return n_failed;
 }
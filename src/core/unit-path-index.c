@@ -0,0 +1,472 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "unit-path-index.h"
+#include "hashmap.h"
+#include "path-util.h"
+#include "strv.h"
+#include "log.h"
+#include "util.h"
+
+/* Directories are kept as a bit mask per name */
+#define UNIT_PATH_DIRS_MAX 64
+
+/* A directory may be watched both as unit directory and as ancestor
+ * of a missing one, hence IN_MASK_ADD */
+#define DIR_EVENTS (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR|IN_MASK_ADD)
+#define ANCESTOR_EVENTS (IN_CREATE|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR|IN_MASK_ADD)
+
+#define INOTIFY_BUFFER_SIZE (16 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+typedef struct UnitPathEntry {
+        uint64_t dirs;
+        char name[];
+} UnitPathEntry;
+
+typedef struct UnitPathDir {
+        char *path;
+
+        /* The watch on the directory itself, or if it doesn't exist
+         * (yet), on its closest existing ancestor */
+        int wd;
+        int ancestor_wd;
+
+        bool scanned:1;
+} UnitPathDir;
+
+struct UnitPathIndex {
+        int inotify_fd;
+
+        UnitPathDir *dirs;
+        unsigned n_dirs;
+
+        /* name → UnitPathEntry */
+        Hashmap *entries;
+
+        /* While loading units we don't look for changes on every
+         * lookup, and trust what we read for unwatched directories */
+        bool pass:1;
+};
+
+static void index_free(UnitPathIndex *idx) {
+        UnitPathEntry *e;
+        unsigned i;
+
+        if (!idx)
+                return;
+
+        while ((e = hashmap_steal_first(idx->entries)))
+                free(e);
+        hashmap_free(idx->entries);
+
+        for (i = 0; i < idx->n_dirs; i++)
+                free(idx->dirs[i].path);
+        free(idx->dirs);
+
+        if (idx->inotify_fd >= 0)
+                close_nointr_nofail(idx->inotify_fd);
+
+        free(idx);
+}
+
+static int index_new(char **paths, UnitPathIndex **ret) {
+        UnitPathIndex *idx;
+        char **p;
+
+        assert(ret);
+
+        if (strv_length(paths) > UNIT_PATH_DIRS_MAX)
+                return -E2BIG;
+
+        idx = new0(UnitPathIndex, 1);
+        if (!idx)
+                return -ENOMEM;
+
+        idx->dirs = new0(UnitPathDir, MAX(strv_length(paths), 1U));
+        idx->entries = hashmap_new(string_hash_func, string_compare_func);
+        if (!idx->dirs || !idx->entries) {
+                index_free(idx);
+                return -ENOMEM;
+        }
+
+        STRV_FOREACH(p, paths) {
+                UnitPathDir *d = idx->dirs + idx->n_dirs;
+
+                d->path = strdup(*p);
+                if (!d->path) {
+                        index_free(idx);
+                        return -ENOMEM;
+                }
+
+                d->wd = d->ancestor_wd = -1;
+                idx->n_dirs++;
+        }
+
+        /* Without inotify we can still answer during a load pass */
+        idx->inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (idx->inotify_fd < 0)
+                log_debug("Failed to allocate inotify fd for the unit path index: %m");
+
+        *ret = idx;
+        return 0;
+}
+
+static int entry_set(UnitPathIndex *idx, const char *name, unsigned k) {
+        UnitPathEntry *e;
+        int r;
+
+        e = hashmap_get(idx->entries, name);
+        if (e) {
+                e->dirs |= UINT64_C(1) << k;
+                return 0;
+        }
+
+        e = malloc(offsetof(UnitPathEntry, name) + strlen(name) + 1);
+        if (!e)
+                return -ENOMEM;
+
+        e->dirs = UINT64_C(1) << k;
+        strcpy(e->name, name);
+
+        r = hashmap_put(idx->entries, e->name, e);
+        if (r < 0) {
+                free(e);
+                return r;
+        }
+
+        return 0;
+}
+
+static void entry_clear(UnitPathIndex *idx, const char *name, unsigned k) {
+        UnitPathEntry *e;
+
+        e = hashmap_get(idx->entries, name);
+        if (!e)
+                return;
+
+        e->dirs &= ~(UINT64_C(1) << k);
+        if (e->dirs == 0) {
+                hashmap_remove(idx->entries, e->name);
+                free(e);
+        }
+}
+
+/* Drops everything we know about directory k, it is read again on
+ * the next lookup */
+static void dir_forget(UnitPathIndex *idx, unsigned k) {
+        UnitPathDir *d = idx->dirs + k;
+        UnitPathEntry *e;
+        Iterator i;
+
+        if (!d->scanned)
+                return;
+
+        HASHMAP_FOREACH(e, idx->entries, i) {
+                e->dirs &= ~(UINT64_C(1) << k);
+                if (e->dirs == 0) {
+                        hashmap_remove(idx->entries, e->name);
+                        free(e);
+                }
+        }
+
+        d->scanned = false;
+}
+
+static bool dir_is_watched(UnitPathDir *d) {
+        return d->wd >= 0 || d->ancestor_wd >= 0;
+}
+
+static void dir_watch(UnitPathIndex *idx, UnitPathDir *d) {
+        char *p, *parent;
+
+        if (idx->inotify_fd < 0 || dir_is_watched(d))
+                return;
+
+        /* Watch before reading, so that we can't miss anything */
+        d->wd = inotify_add_watch(idx->inotify_fd, d->path, DIR_EVENTS);
+        if (d->wd >= 0 || errno != ENOENT)
+                return;
+
+        /* The directory does not exist, so look for it being
+         * created below the closest ancestor that does */
+        p = strdup(d->path);
+        while (p && path_get_parent(p, &parent) >= 0) {
+                free(p);
+                p = parent;
+
+                d->ancestor_wd = inotify_add_watch(idx->inotify_fd, p, ANCESTOR_EVENTS);
+                if (d->ancestor_wd >= 0 || errno != ENOENT || path_equal(p, "/"))
+                        break;
+        }
+        free(p);
+}
+
+static int dir_scan(UnitPathIndex *idx, unsigned k) {
+        UnitPathDir *d = idx->dirs + k;
+        _cleanup_closedir_ DIR *dir = NULL;
+        struct dirent *de;
+        int r;
+
+        if (d->scanned)
+                return 0;
+
+        dir_watch(idx, d);
+
+        d->scanned = true;
+
+        dir = opendir(d->path);
+        if (!dir) {
+                if (errno == ENOENT)
+                        return 0;
+
+                log_error("Failed to open directory %s: %m", d->path);
+                return 0;
+        }
+
+        while ((de = readdir(dir))) {
+
+                if (ignore_file(de->d_name))
+                        continue;
+
+                r = entry_set(idx, de->d_name, k);
+                if (r < 0) {
+                        dir_forget(idx, k);
+                        return r;
+                }
+        }
+
+        return 0;
+}
+
+static void index_process_event(UnitPathIndex *idx, struct inotify_event *e) {
+        unsigned k;
+
+        if (e->mask & IN_Q_OVERFLOW) {
+                for (k = 0; k < idx->n_dirs; k++)
+                        dir_forget(idx, k);
+                return;
+        }
+
+        for (k = 0; k < idx->n_dirs; k++) {
+                UnitPathDir *d = idx->dirs + k;
+
+                if (d->ancestor_wd == e->wd) {
+                        /* Something appeared above a missing
+                         * directory, look again */
+                        d->ancestor_wd = -1;
+                        dir_forget(idx, k);
+                        continue;
+                }
+
+                if (d->wd != e->wd)
+                        continue;
+
+                if (e->mask & (IN_DELETE_SELF|IN_MOVE_SELF|IN_IGNORED)) {
+                        if (e->mask & IN_IGNORED)
+                                d->wd = -1;
+
+                        dir_forget(idx, k);
+                        continue;
+                }
+
+                if (!d->scanned || e->len <= 0 || ignore_file(e->name))
+                        continue;
+
+                if (e->mask & (IN_CREATE|IN_MOVED_TO)) {
+                        if (entry_set(idx, e->name, k) < 0)
+                                dir_forget(idx, k);
+                } else if (e->mask & (IN_DELETE|IN_MOVED_FROM))
+                        entry_clear(idx, e->name, k);
+        }
+}
+
+static void index_flush_events(UnitPathIndex *idx) {
+        union {
+                struct inotify_event e;
+                uint8_t buffer[INOTIFY_BUFFER_SIZE];
+        } u;
+
+        if (idx->inotify_fd < 0)
+                return;
+
+        for (;;) {
+                struct inotify_event *e;
+                ssize_t k;
+
+                k = read(idx->inotify_fd, &u, sizeof(u));
+                if (k < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        if (errno != EAGAIN)
+                                log_warning("Failed to read unit path inotify events: %m");
+
+                        return;
+                }
+
+                e = &u.e;
+                while (k > 0) {
+                        size_t step;
+
+                        index_process_event(idx, e);
+
+                        step = sizeof(struct inotify_event) + e->len;
+                        assert(step <= (size_t) k);
+
+                        e = (struct inotify_event*) ((uint8_t*) e + step);
+                        k -= step;
+                }
+        }
+}
+
+static int manager_unit_path_index_get(Manager *m, UnitPathIndex **ret) {
+        UnitPathIndex *idx;
+        unsigned k;
+        int r;
+
+        assert(m);
+        assert(ret);
+
+        idx = m->unit_path_index;
+
+        /* Rebuild from scratch if the search path changed */
+        if (idx && idx->n_dirs != strv_length(m->lookup_paths.unit_path)) {
+                index_free(idx);
+                idx = m->unit_path_index = NULL;
+        }
+
+        if (idx)
+                for (k = 0; k < idx->n_dirs; k++)
+                        if (!streq(idx->dirs[k].path, m->lookup_paths.unit_path[k])) {
+                                index_free(idx);
+                                idx = m->unit_path_index = NULL;
+                                break;
+                        }
+
+        if (!idx) {
+                r = index_new(m->lookup_paths.unit_path, &idx);
+                if (r < 0)
+                        return r;
+
+                m->unit_path_index = idx;
+        } else if (!idx->pass)
+                index_flush_events(idx);
+
+        for (k = 0; k < idx->n_dirs; k++) {
+                r = dir_scan(idx, k);
+                if (r < 0)
+                        return r;
+        }
+
+        *ret = idx;
+        return 0;
+}
+
+void manager_unit_path_index_begin(Manager *m) {
+        UnitPathIndex *idx;
+        unsigned k;
+
+        assert(m);
+
+        if (manager_unit_path_index_get(m, &idx) < 0)
+                return;
+
+        /* What we can't watch we read again once per pass */
+        for (k = 0; k < idx->n_dirs; k++)
+                if (!dir_is_watched(idx->dirs + k)) {
+                        dir_forget(idx, k);
+                        dir_scan(idx, k);
+                }
+
+        idx->pass = true;
+}
+
+void manager_unit_path_index_end(Manager *m) {
+        assert(m);
+
+        if (m->unit_path_index)
+                m->unit_path_index->pass = false;
+}
+
+void manager_unit_path_index_free(Manager *m) {
+        assert(m);
+
+        index_free(m->unit_path_index);
+        m->unit_path_index = NULL;
+}
+
+/* Returns in dirs a bit mask of the directories of the unit search
+ * path that contain name, or a negative error if the index can't tell,
+ * in which case the caller has to look on disk */
+int manager_unit_path_lookup(Manager *m, const char *name, uint64_t *dirs) {
+        UnitPathIndex *idx;
+        UnitPathEntry *e;
+        unsigned k;
+        int r;
+
+        assert(m);
+        assert(name);
+        assert(dirs);
+
+        r = manager_unit_path_index_get(m, &idx);
+        if (r < 0)
+                return r;
+
+        if (!idx->pass)
+                for (k = 0; k < idx->n_dirs; k++)
+                        if (!dir_is_watched(idx->dirs + k))
+                                return -EAGAIN;
+
+        e = hashmap_get(idx->entries, name);
+        *dirs = e ? e->dirs : 0;
+
+        return 0;
+}
+
+/* Returns > 0 if the directory dir of the unit search path contains
+ * name, 0 if not, negative if the index can't tell */
+int manager_unit_path_exists(Manager *m, const char *dir, const char *name) {
+        uint64_t dirs;
+        char **p;
+        unsigned k = 0;
+        int r;
+
+        assert(m);
+        assert(dir);
+        assert(name);
+
+        r = manager_unit_path_lookup(m, name, &dirs);
+        if (r < 0)
+                return r;
+
+        STRV_FOREACH(p, m->lookup_paths.unit_path) {
+                if (streq(*p, dir))
+                        return !!(dirs & (UINT64_C(1) << k));
+
+                k++;
+        }
+
+        return -ENOENT;
+}
@@ -0,0 +1,39 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+
+#include "manager.h"
+
+/* An index of which directories of the unit search path contain which
+ * names, so that we don't have to go to disk for every unit and every
+ * .wants/.requires/.d directory we look for. Directories are read when
+ * the index is first used and kept up to date with inotify, so the
+ * index survives reloads. */
+
+typedef struct UnitPathIndex UnitPathIndex;
+
+void manager_unit_path_index_begin(Manager *m);
+void manager_unit_path_index_end(Manager *m);
+void manager_unit_path_index_free(Manager *m);
+
+int manager_unit_path_lookup(Manager *m, const char *name, uint64_t *dirs);
+int manager_unit_path_exists(Manager *m, const char *dir, const char *name);
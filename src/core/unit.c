@@ -23,7 +23,6 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/epoll.h>
-#include <sys/timerfd.h>
 #include <sys/poll.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -49,6 +48,8 @@
 #include "label.h"
 #include "fileio-label.h"
 #include "bus-errors.h"
+#include "serialize.h"
+#include "pid-cache.h"
 
 const UnitVTable * const unit_vtable[_UNIT_TYPE_MAX] = {
         [UNIT_SERVICE] = &service_vtable,
@@ -327,31 +328,191 @@ void unit_add_to_dbus_queue(Unit *u) {
         u->in_dbus_queue = true;
 }
 
-static void bidi_set_free(Unit *u, Set *s) {
-        Iterator i;
-        Unit *other;
+/* Below this number of entries a linear search through a unit's
+ * dependencies is cheaper than maintaining a hash table */
+#define UNIT_DEPENDENCY_INDEX_MIN 16
+
+static void unit_dependency_index_build(Unit *u) {
+        unsigned k;
+
+        assert(u);
+        assert(!u->dependencies_index);
+
+        /* If this fails we just continue with linear search */
+        u->dependencies_index = hashmap_new(trivial_hash_func, trivial_compare_func);
+        if (!u->dependencies_index)
+                return;
+
+        for (k = 0; k < u->n_dependencies; k++)
+                if (hashmap_put(u->dependencies_index, u->dependencies[k].other, UINT_TO_PTR(k + 1)) < 0) {
+                        hashmap_free(u->dependencies_index);
+                        u->dependencies_index = NULL;
+                        return;
+                }
+}
+
+static UnitDependencyEntry *unit_dependency_find(Unit *u, Unit *other) {
+        unsigned k;
+
+        assert(u);
+        assert(other);
+
+        if (u->dependencies_index) {
+                k = PTR_TO_UINT(hashmap_get(u->dependencies_index, other));
+                return k > 0 ? u->dependencies + k - 1 : NULL;
+        }
+
+        for (k = 0; k < u->n_dependencies; k++)
+                if (u->dependencies[k].other == other)
+                        return u->dependencies + k;
+
+        return NULL;
+}
+
+static void unit_dependency_drop_entry(Unit *u, UnitDependencyEntry *e) {
+        unsigned k;
+
+        assert(u);
+        assert(e >= u->dependencies && e < u->dependencies + u->n_dependencies);
+
+        /* Keeps the remaining entries in order. This only happens
+         * when units are merged or freed, so the cost of moving
+         * them doesn't matter. */
+
+        k = e - u->dependencies;
+
+        if (u->dependencies_index)
+                hashmap_remove(u->dependencies_index, e->other);
+
+        u->n_dependencies--;
+        memmove(e, e + 1, (u->n_dependencies - k) * sizeof(UnitDependencyEntry));
+
+        /* The keys exist already, so this cannot fail */
+        if (u->dependencies_index)
+                for (; k < u->n_dependencies; k++)
+                        assert_se(hashmap_replace(u->dependencies_index, u->dependencies[k].other, UINT_TO_PTR(k + 1)) >= 0);
+}
+
+/* Returns 1 if any of the dependencies in mask is new, 0 if all of
+ * them existed already */
+static int unit_dependency_add_mask(Unit *u, uint32_t mask, Unit *other) {
+        UnitDependencyEntry *e;
+        int r;
+
+        assert_cc(_UNIT_DEPENDENCY_MAX <= 32);
+
+        assert(u);
+        assert(other);
+        assert(u != other);
+
+        e = unit_dependency_find(u, other);
+        if (e) {
+                if ((e->mask & mask) == mask)
+                        return 0;
+
+                e->mask |= mask;
+                return 1;
+        }
+
+        if (!GREEDY_REALLOC(u->dependencies, u->dependencies_allocated, u->n_dependencies + 1))
+                return -ENOMEM;
+
+        if (u->dependencies_index) {
+                r = hashmap_put(u->dependencies_index, other, UINT_TO_PTR(u->n_dependencies + 1));
+                if (r < 0)
+                        return r;
+        }
+
+        e = u->dependencies + u->n_dependencies++;
+        e->other = other;
+        e->mask = mask;
+
+        if (!u->dependencies_index && u->n_dependencies > UNIT_DEPENDENCY_INDEX_MIN)
+                unit_dependency_index_build(u);
+
+        return 1;
+}
+
+static void unit_dependency_remove_mask(Unit *u, uint32_t mask, Unit *other) {
+        UnitDependencyEntry *e;
+
+        assert(u);
+        assert(other);
+
+        e = unit_dependency_find(u, other);
+        if (!e)
+                return;
+
+        e->mask &= ~mask;
+        if (e->mask == 0)
+                unit_dependency_drop_entry(u, e);
+}
+
+bool unit_has_dependency(Unit *u, UnitDependency d, Unit *other) {
+        UnitDependencyEntry *e;
+
+        assert(u);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+        assert(other);
+
+        e = unit_dependency_find(u, other);
+        return e && (e->mask & UNIT_DEPENDENCY_MASK(d));
+}
+
+unsigned unit_dependency_count(Unit *u, UnitDependency d) {
+        unsigned k, n = 0;
+
+        assert(u);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+
+        for (k = 0; k < u->n_dependencies; k++)
+                if (u->dependencies[k].mask & UNIT_DEPENDENCY_MASK(d))
+                        n++;
+
+        return n;
+}
+
+Unit *unit_first_dependency(Unit *u, UnitDependency d) {
+        unsigned k;
 
+        assert(u);
+        assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
+
+        for (k = 0; k < u->n_dependencies; k++)
+                if (u->dependencies[k].mask & UNIT_DEPENDENCY_MASK(d))
+                        return u->dependencies[k].other;
+
+        return NULL;
+}
+
+static void unit_free_dependencies(Unit *u) {
         assert(u);
 
-        /* Frees the set and makes sure we are dropped from the
-         * inverse pointers */
+        /* Drops all dependencies and makes sure we are dropped from
+         * the inverse pointers */
 
-        SET_FOREACH(other, s, i) {
-                UnitDependency d;
+        while (u->n_dependencies > 0) {
+                Unit *other = u->dependencies[--u->n_dependencies].other;
+                UnitDependencyEntry *e;
 
-                for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                        set_remove(other->dependencies[d], u);
+                e = unit_dependency_find(other, u);
+                if (e)
+                        unit_dependency_drop_entry(other, e);
 
                 unit_add_to_gc_queue(other);
         }
 
-        set_free(s);
+        free(u->dependencies);
+        u->dependencies = NULL;
+        u->dependencies_allocated = 0;
+
+        hashmap_free(u->dependencies_index);
+        u->dependencies_index = NULL;
 }
 
 void unit_free(Unit *u) {
-        UnitDependency d;
         Iterator i;
-        char *t;
+        char *t, **p;
 
         assert(u);
 
@@ -376,13 +537,16 @@ void unit_free(Unit *u) {
                 job_free(j);
         }
 
-        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                bidi_set_free(u, u->dependencies[d]);
+        unit_free_dependencies(u);
 
-        if (u->requires_mounts_for) {
-                LIST_REMOVE(Unit, has_requires_mounts_for, u->manager->has_requires_mounts_for, u);
-                strv_free(u->requires_mounts_for);
-        }
+        STRV_FOREACH(p, u->requires_mounts_for)
+                path_trie_remove(u->manager->units_requiring_mounts_for, *p, u);
+        strv_free(u->requires_mounts_for);
+
+        if (u->type != _UNIT_TYPE_INVALID)
+                STRV_FOREACH(p, u->indexed_paths)
+                        path_trie_remove(u->manager->units_by_path[u->type], *p, u);
+        strv_free(u->indexed_paths);
 
         if (u->type != _UNIT_TYPE_INVALID)
                 LIST_REMOVE(Unit, units_by_type, u->manager->units_by_type[u->type], u);
@@ -403,6 +567,7 @@ void unit_free(Unit *u) {
 
         cgroup_bonding_free_list(u->cgroup_bondings, u->manager->n_reloading <= 0);
         cgroup_attribute_free_list(u->cgroup_attributes);
+        cgroup_sampler_free(u->manager, u->cgroup_sampler);
 
         free(u->description);
         strv_free(u->documentation);
@@ -415,6 +580,8 @@ void unit_free(Unit *u) {
 
         condition_free_list(u->conditions);
 
+        free(u->start_latency);
+
         while (u->refs)
                 unit_ref_unset(u->refs);
 
@@ -440,29 +607,33 @@ const char* unit_sub_state_to_string(Unit *u) {
         return UNIT_VTABLE(u)->sub_state_to_string(u);
 }
 
-static void complete_move(Set **s, Set **other) {
+static int complete_move(Set **s, Set **other) {
         assert(s);
         assert(other);
 
         if (!*other)
-                return;
+                return 0;
 
         if (*s)
-                set_move(*s, *other);
-        else {
-                *s = *other;
-                *other = NULL;
-        }
+                return set_move(*s, *other);
+
+        *s = *other;
+        *other = NULL;
+
+        return 0;
 }
 
-static void merge_names(Unit *u, Unit *other) {
+static int merge_names(Unit *u, Unit *other) {
         char *t;
         Iterator i;
+        int r;
 
         assert(u);
         assert(other);
 
-        complete_move(&u->names, &other->names);
+        r = complete_move(&u->names, &other->names);
+        if (r < 0)
+                return r;
 
         set_free_free(other->names);
         other->names = NULL;
@@ -470,39 +641,59 @@ static void merge_names(Unit *u, Unit *other) {
 
         SET_FOREACH(t, u->names, i)
                 assert_se(hashmap_replace(u->manager->units, t, u) == 0);
+
+        return 0;
 }
 
-static void merge_dependencies(Unit *u, Unit *other, UnitDependency d) {
-        Iterator i;
-        Unit *back;
-        int r;
+static int merge_dependencies(Unit *u, Unit *other) {
+        int r = 0;
 
         assert(u);
         assert(other);
-        assert(d < _UNIT_DEPENDENCY_MAX);
 
-        /* Fix backwards pointers */
-        SET_FOREACH(back, other->dependencies[d], i) {
-                UnitDependency k;
+        while (other->n_dependencies > 0) {
+                UnitDependencyEntry *e = other->dependencies + other->n_dependencies - 1, *f;
+                Unit *back = e->other;
+                uint32_t mask = e->mask;
+                int q;
+
+                other->n_dependencies--;
 
-                for (k = 0; k < _UNIT_DEPENDENCY_MAX; k++)
-                        if ((r = set_remove_and_put(back->dependencies[k], other, u)) < 0) {
+                /* Fix backwards pointers */
+                f = unit_dependency_find(back, other);
+                if (f) {
+                        uint32_t back_mask = f->mask;
 
-                                if (r == -EEXIST)
-                                        set_remove(back->dependencies[k], other);
-                                else
-                                        assert(r == -ENOENT);
+                        unit_dependency_drop_entry(back, f);
+
+                        if (back != u) {
+                                q = unit_dependency_add_mask(back, back_mask, u);
+                                if (q < 0)
+                                        r = q;
                         }
+                }
+
+                /* Our dependencies on the unit we merge are dropped,
+                 * we won't depend on ourselves */
+                if (back != u) {
+                        q = unit_dependency_add_mask(u, mask, back);
+                        if (q < 0)
+                                r = q;
+                }
         }
 
-        complete_move(&u->dependencies[d], &other->dependencies[d]);
+        free(other->dependencies);
+        other->dependencies = NULL;
+        other->dependencies_allocated = 0;
+
+        hashmap_free(other->dependencies_index);
+        other->dependencies_index = NULL;
 
-        set_free(other->dependencies[d]);
-        other->dependencies[d] = NULL;
+        return r;
 }
 
 int unit_merge(Unit *u, Unit *other) {
-        UnitDependency d;
+        int r;
 
         assert(u);
         assert(other);
@@ -534,15 +725,18 @@ int unit_merge(Unit *u, Unit *other) {
                 return -EEXIST;
 
         /* Merge names */
-        merge_names(u, other);
+        r = merge_names(u, other);
+        if (r < 0)
+                return r;
 
         /* Redirect all references */
         while (other->refs)
                 unit_ref_set(other->refs, u);
 
         /* Merge dependencies */
-        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
-                merge_dependencies(u, other, d);
+        r = merge_dependencies(u, other);
+        if (r < 0)
+                log_error_unit(u->id, "Failed to merge dependencies into %s: %s", u->id, strerror(-r));
 
         other->load_state = UNIT_MERGED;
         other->merged_into = u;
@@ -714,8 +908,9 @@ void unit_dump(Unit *u, FILE *f, const char *prefix) {
 
         for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
                 Unit *other;
+                unsigned k;
 
-                SET_FOREACH(other, u->dependencies[d], i)
+                UNIT_FOREACH_DEPENDENCY(other, u, d, k)
                         fprintf(f, "%s\t%s: %s\n", prefix, unit_dependency_to_string(d), other->id);
         }
 
@@ -846,7 +1041,7 @@ int unit_add_default_target_dependency(Unit *u, Unit *target) {
                 return 0;
 
         /* Don't create loops */
-        if (set_get(target->dependencies[UNIT_BEFORE], u))
+        if (unit_has_dependency(target, UNIT_BEFORE, u))
                 return 0;
 
         return unit_add_dependency(target, UNIT_AFTER, u, true);
@@ -861,14 +1056,14 @@ static int unit_add_default_dependencies(Unit *u) {
         };
 
         Unit *target;
-        Iterator i;
+        unsigned i;
         int r;
         unsigned k;
 
         assert(u);
 
         for (k = 0; k < ELEMENTSOF(deps); k++)
-                SET_FOREACH(target, u->dependencies[deps[k]], i)
+                UNIT_FOREACH_DEPENDENCY(target, u, deps[k], i)
                         if ((r = unit_add_default_target_dependency(u, target)) < 0)
                                 return r;
 
@@ -912,7 +1107,7 @@ int unit_load(Unit *u) {
         }
 
         if (u->on_failure_isolate &&
-            set_size(u->dependencies[UNIT_ON_FAILURE]) > 1) {
+            unit_dependency_count(u, UNIT_ON_FAILURE) > 1) {
 
                 log_error_unit(u->id,
                                "More than one OnFailure= dependencies specified for %s but OnFailureIsolate= enabled. Refusing.", u->id);
@@ -1191,7 +1386,7 @@ bool unit_can_reload(Unit *u) {
 }
 
 static void unit_check_unneeded(Unit *u) {
-        Iterator i;
+        unsigned i;
         Unit *other;
 
         assert(u);
@@ -1205,19 +1400,19 @@ static void unit_check_unneeded(Unit *u) {
         if (!UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(u)))
                 return;
 
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRED_BY, i)
                 if (unit_active_or_pending(other))
                         return;
 
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRED_BY_OVERRIDABLE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRED_BY_OVERRIDABLE, i)
                 if (unit_active_or_pending(other))
                         return;
 
-        SET_FOREACH(other, u->dependencies[UNIT_WANTED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTED_BY, i)
                 if (unit_active_or_pending(other))
                         return;
 
-        SET_FOREACH(other, u->dependencies[UNIT_BOUND_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BOUND_BY, i)
                 if (unit_active_or_pending(other))
                         return;
 
@@ -1228,94 +1423,116 @@ static void unit_check_unneeded(Unit *u) {
 }
 
 static void retroactively_start_dependencies(Unit *u) {
-        Iterator i;
+        unsigned i;
         Unit *other;
 
         assert(u);
         assert(UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(u)));
 
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRES], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES, i)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_REPLACE, true, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_BINDS_TO], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO, i)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_REPLACE, true, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRES_OVERRIDABLE], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES_OVERRIDABLE, i)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_FAIL, false, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_WANTS], i)
-                if (!set_get(u->dependencies[UNIT_AFTER], other) &&
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS, i)
+                if (!unit_has_dependency(u, UNIT_AFTER, other) &&
                     !UNIT_IS_ACTIVE_OR_ACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_START, other, JOB_FAIL, false, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_CONFLICTS], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTS, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, true, NULL, NULL);
 
-        SET_FOREACH(other, u->dependencies[UNIT_CONFLICTED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_CONFLICTED_BY, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, true, NULL, NULL);
 }
 
 static void retroactively_stop_dependencies(Unit *u) {
-        Iterator i;
+        unsigned i;
         Unit *other;
 
         assert(u);
         assert(UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(u)));
 
         /* Pull down units which are bound to us recursively if enabled */
-        SET_FOREACH(other, u->dependencies[UNIT_BOUND_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BOUND_BY, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         manager_add_job(u->manager, JOB_STOP, other, JOB_REPLACE, true, NULL, NULL);
 }
 
 static void check_unneeded_dependencies(Unit *u) {
-        Iterator i;
+        unsigned i;
         Unit *other;
 
         assert(u);
         assert(UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(u)));
 
         /* Garbage collect services that might not be needed anymore, if enabled */
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRES], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_REQUIRES_OVERRIDABLE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUIRES_OVERRIDABLE, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_WANTS], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_WANTS, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_REQUISITE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUISITE, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_REQUISITE_OVERRIDABLE], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_REQUISITE_OVERRIDABLE, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
-        SET_FOREACH(other, u->dependencies[UNIT_BINDS_TO], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_BINDS_TO, i)
                 if (!UNIT_IS_INACTIVE_OR_DEACTIVATING(unit_active_state(other)))
                         unit_check_unneeded(other);
 }
 
+bool unit_log_ratelimit(Unit *u, const char *what, unsigned *suppressed) {
+        char *key;
+
+        assert(u);
+        assert(what);
+
+        /* Tells whether a message the unit repeats on every failed
+         * start may be logged once more, so that restart loops do not
+         * flood the journal with the same lines */
+
+        if (suppressed)
+                *suppressed = 0;
+
+        if (!u->manager->unit_log_ratelimit)
+                return true;
+
+        key = alloca(strlen(what) + 1 + strlen(u->id) + 1);
+        stpcpy(stpcpy(stpcpy(key, what), " "), u->id);
+
+        return ratelimit_map_test(u->manager->unit_log_ratelimit, key, suppressed);
+}
+
 void unit_start_on_failure(Unit *u) {
         Unit *other;
-        Iterator i;
+        unsigned i;
 
         assert(u);
 
-        if (set_size(u->dependencies[UNIT_ON_FAILURE]) <= 0)
+        if (unit_dependency_count(u, UNIT_ON_FAILURE) <= 0)
                 return;
 
         log_info_unit(u->id, "Triggering OnFailure= dependencies of %s.", u->id);
 
-        SET_FOREACH(other, u->dependencies[UNIT_ON_FAILURE], i) {
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_ON_FAILURE, i) {
                 int r;
 
                 r = manager_add_job(u->manager, JOB_START, other, u->on_failure_isolate ? JOB_ISOLATE : JOB_REPLACE, true, NULL, NULL);
@@ -1326,11 +1543,11 @@ void unit_start_on_failure(Unit *u) {
 
 void unit_trigger_notify(Unit *u) {
         Unit *other;
-        Iterator i;
+        unsigned i;
 
         assert(u);
 
-        SET_FOREACH(other, u->dependencies[UNIT_TRIGGERED_BY], i)
+        UNIT_FOREACH_DEPENDENCY(other, u, UNIT_TRIGGERED_BY, i)
                 if (UNIT_VTABLE(other)->trigger_notify)
                         UNIT_VTABLE(other)->trigger_notify(other, u);
 }
@@ -1399,9 +1616,12 @@ void unit_notify(Unit *u, UnitActiveState os, UnitActiveState ns, bool reload_su
                 case JOB_START:
                 case JOB_VERIFY_ACTIVE:
 
-                        if (UNIT_IS_ACTIVE_OR_RELOADING(ns))
+                        if (UNIT_IS_ACTIVE_OR_RELOADING(ns)) {
+                                if (u->job->type == JOB_START && u->start_latency)
+                                        start_latency_finish(u->start_latency, now(CLOCK_MONOTONIC));
+
                                 job_finish_and_invalidate(u->job, JOB_DONE, true);
-                        else if (u->job->state == JOB_RUNNING && ns != UNIT_ACTIVATING) {
+                        } else if (u->job->state == JOB_RUNNING && ns != UNIT_ACTIVATING) {
                                 unexpected = true;
 
                                 if (UNIT_IS_INACTIVE_OR_FAILED(ns))
@@ -1467,8 +1687,18 @@ void unit_notify(Unit *u, UnitActiveState os, UnitActiveState ns, bool reload_su
                         check_unneeded_dependencies(u);
 
                 if (ns != os && ns == UNIT_FAILED) {
-                        log_notice_unit(u->id,
-                                        "Unit %s entered failed state.", u->id);
+                        unsigned suppressed;
+
+                        if (unit_log_ratelimit(u, "failed", &suppressed)) {
+                                if (suppressed > 0)
+                                        log_notice_unit(u->id,
+                                                        "Unit %s entered failed state (%u similar messages suppressed).",
+                                                        u->id, suppressed);
+                                else
+                                        log_notice_unit(u->id,
+                                                        "Unit %s entered failed state.", u->id);
+                        }
+
                         unit_start_on_failure(u);
                 }
         }
@@ -1588,69 +1818,30 @@ void unit_unwatch_pid(Unit *u, pid_t pid) {
         hashmap_remove_value(u->manager->watch_pids, LONG_TO_PTR(pid), u);
 }
 
-int unit_watch_timer(Unit *u, clockid_t clock_id, bool relative, usec_t usec, Watch *w) {
-        struct itimerspec its = {};
-        int flags, fd;
+int unit_watch_timer(Unit *u, clockid_t clock_id, bool relative, usec_t usec, usec_t accuracy, Watch *w) {
         bool ours;
+        int r;
 
         assert(u);
         assert(w);
         assert(w->type == WATCH_INVALID || (w->type == WATCH_UNIT_TIMER && w->data.unit == u));
 
-        /* This will try to reuse the old timer if there is one */
-
-        if (w->type == WATCH_UNIT_TIMER) {
-                assert(w->data.unit == u);
-                assert(w->fd >= 0);
-
-                ours = false;
-                fd = w->fd;
-        } else if (w->type == WATCH_INVALID) {
-
-                ours = true;
-                fd = timerfd_create(clock_id, TFD_NONBLOCK|TFD_CLOEXEC);
-                if (fd < 0)
-                        return -errno;
-        } else
-                assert_not_reached("Invalid watch type");
+        /* This will move the old timer if there is one. There is no
+         * timerfd per watch, the manager multiplexes all timers of a
+         * clock onto one. */
 
-        if (usec <= 0) {
-                /* Set absolute time in the past, but not 0, since we
-                 * don't want to disarm the timer */
-                its.it_value.tv_sec = 0;
-                its.it_value.tv_nsec = 1;
-
-                flags = TFD_TIMER_ABSTIME;
-        } else {
-                timespec_store(&its.it_value, usec);
-                flags = relative ? 0 : TFD_TIMER_ABSTIME;
-        }
-
-        /* This will also flush the elapse counter */
-        if (timerfd_settime(fd, flags, &its, NULL) < 0)
-                goto fail;
-
-        if (w->type == WATCH_INVALID) {
-                struct epoll_event ev = {
-                        .data.ptr = w,
-                        .events = EPOLLIN,
-                };
-
-                if (epoll_ctl(u->manager->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
-                        goto fail;
-        }
+        ours = w->type == WATCH_INVALID;
 
         w->type = WATCH_UNIT_TIMER;
-        w->fd = fd;
         w->data.unit = u;
 
-        return 0;
-
-fail:
-        if (ours)
-                close_nointr_nofail(fd);
+        r = manager_watch_timer(u->manager, w, clock_id, relative, usec, accuracy);
+        if (r < 0 && ours) {
+                w->type = WATCH_INVALID;
+                w->data.unit = NULL;
+        }
 
-        return -errno;
+        return r;
 }
 
 void unit_unwatch_timer(Unit *u, Watch *w) {
@@ -1662,10 +1853,8 @@ void unit_unwatch_timer(Unit *u, Watch *w) {
 
         assert(w->type == WATCH_UNIT_TIMER);
         assert(w->data.unit == u);
-        assert(w->fd >= 0);
 
-        assert_se(epoll_ctl(u->manager->epoll_fd, EPOLL_CTL_DEL, w->fd, NULL) >= 0);
-        close_nointr_nofail(w->fd);
+        manager_unwatch_timer(u->manager, w);
 
         w->fd = -1;
         w->type = WATCH_INVALID;
@@ -1740,34 +1929,27 @@ int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_referen
         if (u == other)
                 return 0;
 
-        if ((r = set_ensure_allocated(&u->dependencies[d], trivial_hash_func, trivial_compare_func)) < 0)
-                return r;
-
-        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID)
-                if ((r = set_ensure_allocated(&other->dependencies[inverse_table[d]], trivial_hash_func, trivial_compare_func)) < 0)
-                        return r;
-
-        if (add_reference)
-                if ((r = set_ensure_allocated(&u->dependencies[UNIT_REFERENCES], trivial_hash_func, trivial_compare_func)) < 0 ||
-                    (r = set_ensure_allocated(&other->dependencies[UNIT_REFERENCED_BY], trivial_hash_func, trivial_compare_func)) < 0)
-                        return r;
-
-        if ((q = set_put(u->dependencies[d], other)) < 0)
+        q = unit_dependency_add_mask(u, UNIT_DEPENDENCY_MASK(d), other);
+        if (q < 0)
                 return q;
 
-        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID)
-                if ((v = set_put(other->dependencies[inverse_table[d]], u)) < 0) {
+        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID) {
+                v = unit_dependency_add_mask(other, UNIT_DEPENDENCY_MASK(inverse_table[d]), u);
+                if (v < 0) {
                         r = v;
                         goto fail;
                 }
+        }
 
         if (add_reference) {
-                if ((w = set_put(u->dependencies[UNIT_REFERENCES], other)) < 0) {
+                w = unit_dependency_add_mask(u, UNIT_DEPENDENCY_MASK(UNIT_REFERENCES), other);
+                if (w < 0) {
                         r = w;
                         goto fail;
                 }
 
-                if ((r = set_put(other->dependencies[UNIT_REFERENCED_BY], u)) < 0)
+                r = unit_dependency_add_mask(other, UNIT_DEPENDENCY_MASK(UNIT_REFERENCED_BY), u);
+                if (r < 0)
                         goto fail;
         }
 
@@ -1776,13 +1958,13 @@ int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_referen
 
 fail:
         if (q > 0)
-                set_remove(u->dependencies[d], other);
+                unit_dependency_remove_mask(u, UNIT_DEPENDENCY_MASK(d), other);
 
         if (v > 0)
-                set_remove(other->dependencies[inverse_table[d]], u);
+                unit_dependency_remove_mask(other, UNIT_DEPENDENCY_MASK(inverse_table[d]), u);
 
         if (w > 0)
-                set_remove(u->dependencies[UNIT_REFERENCES], other);
+                unit_dependency_remove_mask(u, UNIT_DEPENDENCY_MASK(UNIT_REFERENCES), other);
 
         return r;
 }
@@ -1969,6 +2151,10 @@ int unit_add_cgroup(Unit *u, CGroupBonding *b) {
                         LIST_REMOVE(CGroupBonding, by_path, l, b);
                         return r;
                 }
+
+                /* Processes in the group might have been cached
+                 * as belonging to a unit further up */
+                pid_cache_flush(u->manager);
         }
 
         LIST_PREPEND(CGroupBonding, by_unit, u->cgroup_bondings, b);
@@ -2058,6 +2244,8 @@ int unit_add_cgroup_from_text(Unit *u, const char *name, bool overwrite, CGroupB
                 goto fail;
         }
 
+        b->fd = -1;
+
         b->controller = controller;
         b->path = path;
         b->ours = ours;
@@ -2096,6 +2284,8 @@ static int unit_add_one_default_cgroup(Unit *u, const char *controller) {
         if (!b)
                 return -ENOMEM;
 
+        b->fd = -1;
+
         b->controller = strdup(controller);
         if (!b->controller)
                 goto fail;
@@ -2344,27 +2534,30 @@ int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
 
         if (serialize_jobs) {
                 if (u->job) {
-                        fprintf(f, "job\n");
+                        serialize_item(f, u->manager->serialize_binary, "job", NULL);
                         job_serialize(u->job, f, fds);
                 }
 
                 if (u->nop_job) {
-                        fprintf(f, "job\n");
+                        serialize_item(f, u->manager->serialize_binary, "job", NULL);
                         job_serialize(u->nop_job, f, fds);
                 }
         }
 
-        dual_timestamp_serialize(f, "inactive-exit-timestamp", &u->inactive_exit_timestamp);
-        dual_timestamp_serialize(f, "active-enter-timestamp", &u->active_enter_timestamp);
-        dual_timestamp_serialize(f, "active-exit-timestamp", &u->active_exit_timestamp);
-        dual_timestamp_serialize(f, "inactive-enter-timestamp", &u->inactive_enter_timestamp);
-        dual_timestamp_serialize(f, "condition-timestamp", &u->condition_timestamp);
+        unit_serialize_dual_timestamp(u, f, "inactive-exit-timestamp", &u->inactive_exit_timestamp);
+        unit_serialize_dual_timestamp(u, f, "active-enter-timestamp", &u->active_enter_timestamp);
+        unit_serialize_dual_timestamp(u, f, "active-exit-timestamp", &u->active_exit_timestamp);
+        unit_serialize_dual_timestamp(u, f, "inactive-enter-timestamp", &u->inactive_enter_timestamp);
+        unit_serialize_dual_timestamp(u, f, "condition-timestamp", &u->condition_timestamp);
 
         if (dual_timestamp_is_set(&u->condition_timestamp))
                 unit_serialize_item(u, f, "condition-result", yes_no(u->condition_result));
 
+        if (u->start_latency)
+                start_latency_serialize(u->start_latency, f, u->manager->serialize_binary);
+
         /* End marker */
-        fputc('\n', f);
+        serialize_end(f, u->manager->serialize_binary);
         return 0;
 }
 
@@ -2376,14 +2569,9 @@ void unit_serialize_item_format(Unit *u, FILE *f, const char *key, const char *f
         assert(key);
         assert(format);
 
-        fputs(key, f);
-        fputc('=', f);
-
         va_start(ap, format);
-        vfprintf(f, format, ap);
+        serialize_item_formatv(f, u->manager->serialize_binary, key, format, ap);
         va_end(ap);
-
-        fputc('\n', f);
 }
 
 void unit_serialize_item(Unit *u, FILE *f, const char *key, const char *value) {
@@ -2392,10 +2580,21 @@ void unit_serialize_item(Unit *u, FILE *f, const char *key, const char *value) {
         assert(key);
         assert(value);
 
-        fprintf(f, "%s=%s\n", key, value);
+        serialize_item(f, u->manager->serialize_binary, key, value);
+}
+
+void unit_serialize_dual_timestamp(Unit *u, FILE *f, const char *key, dual_timestamp *t) {
+        assert(u);
+        assert(f);
+        assert(key);
+        assert(t);
+
+        serialize_dual_timestamp(f, u->manager->serialize_binary, key, t);
 }
 
 int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
+        _cleanup_free_ char *buffer = NULL;
+        size_t allocated = 0;
         int r;
 
         assert(u);
@@ -2406,29 +2605,12 @@ int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
                 return 0;
 
         for (;;) {
-                char line[LINE_MAX], *l, *v;
-                size_t k;
-
-                if (!fgets(line, sizeof(line), f)) {
-                        if (feof(f))
-                                return 0;
-                        return -errno;
-                }
-
-                char_array_0(line);
-                l = strstrip(line);
+                char *l, *v;
 
-                /* End marker */
-                if (l[0] == 0)
-                        return 0;
-
-                k = strcspn(l, "=");
-
-                if (l[k] == '=') {
-                        l[k] = 0;
-                        v = l+k+1;
-                } else
-                        v = l+k;
+                /* Returns 0 on the end marker and at EOF */
+                r = deserialize_item(f, u->manager->serialize_binary, &buffer, &allocated, &l, &v);
+                if (r <= 0)
+                        return r;
 
                 if (streq(l, "job")) {
                         if (v[0] == '\0') {
@@ -2490,6 +2672,17 @@ int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
                         else
                                 u->condition_result = b;
 
+                        continue;
+                } else if (startswith(l, "start-latency-")) {
+                        if (!u->start_latency) {
+                                u->start_latency = new0(StartLatency, 1);
+                                if (!u->start_latency)
+                                        return -ENOMEM;
+                        }
+
+                        if (start_latency_deserialize_item(u->start_latency, l, v) < 0)
+                                log_debug("Failed to parse start latency value %s", v);
+
                         continue;
                 }
 
@@ -2635,6 +2828,26 @@ Unit *unit_following(Unit *u) {
         return NULL;
 }
 
+int unit_start_latency_begin(Unit *u) {
+        assert(u);
+
+        if (!u->start_latency) {
+                u->start_latency = new0(StartLatency, 1);
+                if (!u->start_latency)
+                        return -ENOMEM;
+        }
+
+        start_latency_begin(u->start_latency, now(CLOCK_MONOTONIC));
+        return 0;
+}
+
+void unit_start_latency_mark(Unit *u, StartTimestamp p) {
+        assert(u);
+
+        if (u->start_latency)
+                start_latency_mark(u->start_latency, p, now(CLOCK_MONOTONIC));
+}
+
 bool unit_stop_pending(Unit *u) {
         assert(u);
 
@@ -2799,6 +3012,35 @@ void unit_ref_unset(UnitRef *ref) {
         ref->unit = NULL;
 }
 
+int unit_add_path_index(Unit *u, const char *path) {
+        PathTrie **t;
+        int r;
+
+        assert(u);
+        assert(path);
+        assert(u->type >= 0 && u->type < _UNIT_TYPE_MAX);
+
+        /* Makes u findable by path in the manager's per type index,
+         * used to find the units at or below/above a mount point
+         * without iterating through all units of a type */
+
+        if (strv_contains(u->indexed_paths, path))
+                return 0;
+
+        t = &u->manager->units_by_path[u->type];
+        if (!*t) {
+                *t = path_trie_new();
+                if (!*t)
+                        return -ENOMEM;
+        }
+
+        r = strv_extend(&u->indexed_paths, path);
+        if (r < 0)
+                return r;
+
+        return path_trie_add(*t, path, u);
+}
+
 int unit_add_one_mount_link(Unit *u, Mount *m) {
         char **i;
 
@@ -2824,13 +3066,42 @@ int unit_add_one_mount_link(Unit *u, Mount *m) {
 }
 
 int unit_add_mount_links(Unit *u) {
-        Unit *other;
+        _cleanup_set_free_ Set *s = NULL;
+        PathTrie **t;
+        Iterator i;
+        Mount *m;
+        char **j;
         int r;
 
         assert(u);
 
-        LIST_FOREACH(units_by_type, other, u->manager->units_by_type[UNIT_MOUNT]) {
-                r = unit_add_one_mount_link(u, MOUNT(other));
+        if (strv_isempty(u->requires_mounts_for))
+                return 0;
+
+        /* Make us findable for mount units loaded later on */
+        t = &u->manager->units_requiring_mounts_for;
+        if (!*t) {
+                *t = path_trie_new();
+                if (!*t)
+                        return -ENOMEM;
+        }
+
+        s = set_new(trivial_hash_func, trivial_compare_func);
+        if (!s)
+                return -ENOMEM;
+
+        STRV_FOREACH(j, u->requires_mounts_for) {
+                r = path_trie_add(*t, *j, u);
+                if (r < 0)
+                        return r;
+
+                r = path_trie_find_above(u->manager->units_by_path[UNIT_MOUNT], *j, s);
+                if (r < 0)
+                        return r;
+        }
+
+        SET_FOREACH(m, s, i) {
+                r = unit_add_one_mount_link(u, m);
                 if (r < 0)
                         return r;
         }
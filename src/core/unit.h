@@ -29,6 +29,7 @@ typedef struct Unit Unit;
 typedef struct UnitVTable UnitVTable;
 typedef enum UnitActiveState UnitActiveState;
 typedef enum UnitDependency UnitDependency;
+typedef struct UnitDependencyEntry UnitDependencyEntry;
 typedef struct UnitRef UnitRef;
 typedef struct UnitStatusMessageFormats UnitStatusMessageFormats;
 
@@ -41,6 +42,7 @@ typedef struct UnitStatusMessageFormats UnitStatusMessageFormats;
 #include "install.h"
 #include "unit-name.h"
 #include "cgroup-semantics.h"
+#include "start-latency.h"
 
 enum UnitActiveState {
         UNIT_ACTIVE,
@@ -113,10 +115,20 @@ enum UnitDependency {
         _UNIT_DEPENDENCY_INVALID = -1
 };
 
+#define UNIT_DEPENDENCY_MASK(d) (1U << (d))
+
+/* One entry for each unit we have a dependency of any type on, with a
+ * bit per UnitDependency */
+struct UnitDependencyEntry {
+        Unit *other;
+        uint32_t mask;
+};
+
 #include "manager.h"
 #include "job.h"
 #include "cgroup.h"
 #include "cgroup-attr.h"
+#include "cgroup-sample.h"
 
 struct Unit {
         Manager *manager;
@@ -129,10 +141,20 @@ struct Unit {
         char *instance;
 
         Set *names;
-        Set *dependencies[_UNIT_DEPENDENCY_MAX];
+
+        /* Most units only have a handful of dependencies, hence they
+         * are kept in a plain array, and only indexed by the other
+         * unit once there are more */
+        UnitDependencyEntry *dependencies;
+        unsigned n_dependencies;
+        size_t dependencies_allocated;
+        Hashmap *dependencies_index;
 
         char **requires_mounts_for;
 
+        /* Paths this unit is indexed under in units_by_path */
+        char **indexed_paths;
+
         char *description;
         char **documentation;
 
@@ -164,16 +186,17 @@ struct Unit {
         dual_timestamp active_exit_timestamp;
         dual_timestamp inactive_enter_timestamp;
 
+        /* Allocated when the first start job is installed */
+        StartLatency *start_latency;
+
         /* Counterparts in the cgroup filesystem */
         CGroupBonding *cgroup_bondings;
         CGroupAttribute *cgroup_attributes;
+        CGroupSampler *cgroup_sampler;
 
         /* Per type list */
         LIST_FIELDS(Unit, units_by_type);
 
-        /* All units which have requires_mounts_for set */
-        LIST_FIELDS(Unit, has_requires_mounts_for);
-
         /* Load queue */
         LIST_FIELDS(Unit, load_queue);
 
@@ -362,6 +385,10 @@ struct UnitVTable {
         /* Called for each message received on the bus */
         DBusHandlerResult (*bus_message_handler)(Unit *u, DBusConnection *c, DBusMessage *message);
 
+        /* Appends the named properties (or all if none are named)
+         * to an open a{sv} array */
+        int (*bus_append_properties)(Unit *u, DBusMessageIter *i, char **properties);
+
         /* Return the unit this unit is following */
         Unit *(*following)(Unit *u);
 
@@ -421,7 +448,27 @@ extern const UnitVTable * const unit_vtable[_UNIT_TYPE_MAX];
 /* For casting the various unit types into a unit */
 #define UNIT(u) (&(u)->meta)
 
-#define UNIT_TRIGGER(u) ((Unit*) set_first((u)->dependencies[UNIT_TRIGGERS]))
+#define UNIT_TRIGGER(u) unit_first_dependency((u), UNIT_TRIGGERS)
+
+/* Moves *i, which starts out at 0, to the entry after the next one
+ * with a dependency of type d. Entries are visited in the order they
+ * were added. */
+static inline bool unit_dependency_next(Unit *u, UnitDependency d, unsigned *i, Unit **other) {
+        while (*i < u->n_dependencies) {
+                const UnitDependencyEntry *e = u->dependencies + (*i)++;
+
+                if (e->mask & UNIT_DEPENDENCY_MASK(d)) {
+                        *other = e->other;
+                        return true;
+                }
+        }
+
+        *other = NULL;
+        return false;
+}
+
+#define UNIT_FOREACH_DEPENDENCY(other, u, d, i)                         \
+        for ((i) = 0; unit_dependency_next((u), (d), &(i), &(other)); )
 
 DEFINE_CAST(SOCKET, Socket);
 DEFINE_CAST(TIMER, Timer);
@@ -442,6 +489,10 @@ int unit_add_name(Unit *u, const char *name);
 int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_reference);
 int unit_add_two_dependencies(Unit *u, UnitDependency d, UnitDependency e, Unit *other, bool add_reference);
 
+bool unit_has_dependency(Unit *u, UnitDependency d, Unit *other);
+unsigned unit_dependency_count(Unit *u, UnitDependency d);
+Unit *unit_first_dependency(Unit *u, UnitDependency d);
+
 int unit_add_dependency_by_name(Unit *u, UnitDependency d, const char *name, const char *filename, bool add_reference);
 int unit_add_two_dependencies_by_name(Unit *u, UnitDependency d, UnitDependency e, const char *name, const char *path, bool add_reference);
 
@@ -504,7 +555,7 @@ void unit_unwatch_fd(Unit *u, Watch *w);
 int unit_watch_pid(Unit *u, pid_t pid);
 void unit_unwatch_pid(Unit *u, pid_t pid);
 
-int unit_watch_timer(Unit *u, clockid_t, bool relative, usec_t usec, Watch *w);
+int unit_watch_timer(Unit *u, clockid_t, bool relative, usec_t usec, usec_t accuracy, Watch *w);
 void unit_unwatch_timer(Unit *u, Watch *w);
 
 int unit_watch_bus_name(Unit *u, const char *name);
@@ -523,6 +574,7 @@ bool unit_can_serialize(Unit *u);
 int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs);
 void unit_serialize_item_format(Unit *u, FILE *f, const char *key, const char *value, ...) _printf_attr_(4,5);
 void unit_serialize_item(Unit *u, FILE *f, const char *key, const char *value);
+void unit_serialize_dual_timestamp(Unit *u, FILE *f, const char *key, dual_timestamp *t);
 int unit_deserialize(Unit *u, FILE *f, FDSet *fds);
 
 int unit_add_node_link(Unit *u, const char *what, bool wants);
@@ -537,6 +589,9 @@ void unit_reset_failed(Unit *u);
 
 Unit *unit_following(Unit *u);
 
+int unit_start_latency_begin(Unit *u);
+void unit_start_latency_mark(Unit *u, StartTimestamp p);
+
 bool unit_stop_pending(Unit *u);
 bool unit_inactive_or_pending(Unit *u);
 bool unit_active_or_pending(Unit *u);
@@ -548,6 +603,8 @@ char *unit_default_cgroup_path(Unit *u);
 int unit_following_set(Unit *u, Set **s);
 
 void unit_start_on_failure(Unit *u);
+
+bool unit_log_ratelimit(Unit *u, const char *what, unsigned *suppressed);
 void unit_trigger_notify(Unit *u);
 
 bool unit_condition_test(Unit *u);
@@ -561,6 +618,7 @@ void unit_ref_unset(UnitRef *ref);
 
 int unit_add_one_mount_link(Unit *u, Mount *m);
 int unit_add_mount_links(Unit *u);
+int unit_add_path_index(Unit *u, const char *path);
 
 int unit_exec_context_defaults(Unit *u, ExecContext *c);
 
@@ -26,6 +26,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/file.h>
+#include <dirent.h>
+#include <signal.h>
 
 #include <libudev.h>
 #include <dbus/dbus.h>
@@ -36,6 +38,7 @@
 #include "bus-errors.h"
 #include "virt.h"
 #include "fileio.h"
+#include "mkdir.h"
 
 static bool arg_skip = false;
 static bool arg_force = false;
@@ -174,11 +177,80 @@ static double percent(int pass, unsigned long cur, unsigned long max) {
                 (double) cur / (double) max;
 }
 
+/* Each instance publishes its progress in a file named after its PID
+ * here, so that the one currently owning the console can show the
+ * progress of all checks running in parallel, rather than just its
+ * own. */
+#define PROGRESS_DIR "/run/systemd/fsck"
+
+static void write_progress(const char *path, const char *device, double p) {
+        char line[LINE_MAX];
+
+        snprintf(line, sizeof(line), "%.1f %s", p, device);
+        char_array_0(line);
+
+        write_string_file_atomic(path, line);
+}
+
+static unsigned read_progress(const char *own, double *sum, double *min, char **slowest) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        unsigned n = 0;
+
+        d = opendir(PROGRESS_DIR);
+        if (!d)
+                return 0;
+
+        while ((de = readdir(d))) {
+                _cleanup_free_ char *fn = NULL, *line = NULL, *device = NULL;
+                pid_t pid;
+                double p;
+
+                if (ignore_file(de->d_name))
+                        continue;
+
+                if (parse_pid(de->d_name, &pid) < 0)
+                        continue;
+
+                fn = strjoin(PROGRESS_DIR "/", de->d_name, NULL);
+                if (!fn)
+                        break;
+
+                /* Left behind by an instance that was killed? */
+                if (kill(pid, 0) < 0 && errno == ESRCH) {
+                        unlink(fn);
+                        continue;
+                }
+
+                if (streq(fn, own))
+                        continue;
+
+                if (read_one_line_file(fn, &line) < 0)
+                        continue;
+
+                if (sscanf(line, "%lf %ms", &p, &device) != 2)
+                        continue;
+
+                *sum += p;
+                n++;
+
+                if (p < *min) {
+                        *min = p;
+                        free(*slowest);
+                        *slowest = device;
+                        device = NULL;
+                }
+        }
+
+        return n;
+}
+
 static int process_progress(int fd) {
         FILE *f, *console;
         usec_t last = 0;
         bool locked = false;
         int clear = 0;
+        _cleanup_free_ char *own = NULL;
 
         f = fdopen(fd, "r");
         if (!f) {
@@ -192,6 +264,12 @@ static int process_progress(int fd) {
                 return -ENOMEM;
         }
 
+        if (asprintf(&own, PROGRESS_DIR "/%lu", (unsigned long) getpid()) < 0 ||
+            mkdir_p(PROGRESS_DIR, 0755) < 0) {
+                free(own);
+                own = NULL;
+        }
+
         while (!feof(f)) {
                 int pass, m;
                 unsigned long cur, max;
@@ -202,16 +280,6 @@ static int process_progress(int fd) {
                 if (fscanf(f, "%i %lu %lu %ms", &pass, &cur, &max, &device) != 4)
                         break;
 
-                /* Only show one progress counter at max */
-                if (!locked) {
-                        if (flock(fileno(console), LOCK_EX|LOCK_NB) < 0) {
-                                free(device);
-                                continue;
-                        }
-
-                        locked = true;
-                }
-
                 /* Only update once every 50ms */
                 t = now(CLOCK_MONOTONIC);
                 if (last + 50 * USEC_PER_MSEC > t)  {
@@ -222,7 +290,38 @@ static int process_progress(int fd) {
                 last = t;
 
                 p = percent(pass, cur, max);
-                fprintf(console, "\r%s: fsck %3.1f%% complete...\r%n", device, p, &m);
+
+                if (own)
+                        write_progress(own, device, p);
+
+                /* Only show one progress counter at max */
+                if (!locked) {
+                        if (flock(fileno(console), LOCK_EX|LOCK_NB) < 0) {
+                                free(device);
+                                continue;
+                        }
+
+                        locked = true;
+                }
+
+                if (own) {
+                        _cleanup_free_ char *slowest = NULL;
+                        double sum = p, min = p;
+                        unsigned n;
+
+                        n = read_progress(own, &sum, &min, &slowest) + 1;
+                        if (n > 1)
+                                fprintf(console, "\rfsck on %u devices %3.1f%% complete, %s at %3.1f%%...%n",
+                                        n, sum / n, slowest ? slowest : device, min, &m);
+                        else
+                                fprintf(console, "\r%s: fsck %3.1f%% complete...%n", device, p, &m);
+                } else
+                        fprintf(console, "\r%s: fsck %3.1f%% complete...%n", device, p, &m);
+
+                /* Overwrite what is left of a longer line before */
+                if (m < clear)
+                        fprintf(console, "%*s", clear - m, "");
+                fputc('\r', console);
                 fflush(console);
 
                 free(device);
@@ -231,6 +330,9 @@ static int process_progress(int fd) {
                         clear = m;
         }
 
+        if (own)
+                unlink(own);
+
         if (clear > 0) {
                 unsigned j;
 
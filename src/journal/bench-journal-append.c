@@ -0,0 +1,332 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "journal-file.h"
+#include "compress.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+/* Drives journal_file_append_entry() with a synthetic entry shape
+ * and reports throughput and the latency distribution of the
+ * appends. Appends that had to grow the file (i.e. went through
+ * posix_fallocate() in journal_file_allocate()) are reported
+ * separately. */
+
+static unsigned arg_entries = 100000;
+static unsigned arg_fields = 8;
+static unsigned arg_cardinality = 100;
+static size_t arg_payload_size = 32;
+static int arg_compress = 0;
+static bool arg_seal = false;
+static const char *arg_directory = "/var/tmp";
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Benchmark appending entries to a journal file.\n\n"
+               "  -h --help               Show this help\n"
+               "  -n --entries=N          Number of entries to append (default: 100000)\n"
+               "     --fields=N           Fields per entry (default: 8)\n"
+               "     --cardinality=N      Distinct values per field, 0 for unique (default: 100)\n"
+               "     --payload-size=BYTES Size of each field value (default: 32)\n"
+               "     --compress=TYPE      Compress large fields: no, yes, xz, lz4 (default: no)\n"
+               "     --seal               Enable sealing, if a key is available\n"
+               "  -D --directory=PATH     Where to create the journal file (default: /var/tmp)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_FIELDS = 0x100,
+                ARG_CARDINALITY,
+                ARG_PAYLOAD_SIZE,
+                ARG_COMPRESS,
+                ARG_SEAL
+        };
+
+        static const struct option options[] = {
+                { "help",         no_argument,       NULL, 'h'              },
+                { "entries",      required_argument, NULL, 'n'              },
+                { "fields",       required_argument, NULL, ARG_FIELDS       },
+                { "cardinality",  required_argument, NULL, ARG_CARDINALITY  },
+                { "payload-size", required_argument, NULL, ARG_PAYLOAD_SIZE },
+                { "compress",     required_argument, NULL, ARG_COMPRESS     },
+                { "seal",         no_argument,       NULL, ARG_SEAL         },
+                { "directory",    required_argument, NULL, 'D'              },
+                { NULL,           0,                 NULL, 0                }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "hn:D:", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case 'n':
+                        r = safe_atou(optarg, &arg_entries);
+                        if (r < 0 || arg_entries <= 0) {
+                                log_error("Failed to parse number of entries: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_FIELDS:
+                        r = safe_atou(optarg, &arg_fields);
+                        if (r < 0 || arg_fields <= 0) {
+                                log_error("Failed to parse number of fields: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_CARDINALITY:
+                        r = safe_atou(optarg, &arg_cardinality);
+                        if (r < 0) {
+                                log_error("Failed to parse cardinality: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_PAYLOAD_SIZE: {
+                        off_t sz;
+
+                        r = parse_bytes(optarg, &sz);
+                        if (r < 0 || sz <= 0) {
+                                log_error("Failed to parse payload size: %s", optarg);
+                                return -EINVAL;
+                        }
+                        arg_payload_size = (size_t) sz;
+                        break;
+                }
+
+                case ARG_COMPRESS:
+                        r = parse_boolean(optarg);
+                        if (r >= 0)
+                                arg_compress = r ? compression_default() : 0;
+                        else {
+                                arg_compress = object_compressed_from_string(optarg);
+                                if (arg_compress < 0) {
+                                        log_error("Failed to parse compression type: %s", optarg);
+                                        return -EINVAL;
+                                }
+                        }
+
+                        if (arg_compress != 0 && !compression_supported(arg_compress)) {
+                                log_error("Compression type %s is not supported.", optarg);
+                                return -EOPNOTSUPP;
+                        }
+                        break;
+
+                case ARG_SEAL:
+                        arg_seal = true;
+                        break;
+
+                case 'D':
+                        arg_directory = optarg;
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        if (optind < argc) {
+                log_error("This program takes no arguments.");
+                return -EINVAL;
+        }
+
+        return 1;
+}
+
+static uint64_t now_nsec(void) {
+        struct timespec ts;
+
+        assert_se(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+
+        return (uint64_t) ts.tv_sec * NSEC_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+static int uint64_cmp(const void *a, const void *b) {
+        const uint64_t *x = a, *y = b;
+
+        return *x < *y ? -1 : *x > *y ? 1 : 0;
+}
+
+static void print_latency(const char *name, uint64_t *l, unsigned n) {
+        if (n <= 0) {
+                printf("%-16s n=0\n", name);
+                return;
+        }
+
+        qsort(l, n, sizeof(uint64_t), uint64_cmp);
+
+        printf("%-16s n=%u p50=%.2fus p99=%.2fus max=%.2fus\n",
+               name, n,
+               (double) l[n / 2] / NSEC_PER_USEC,
+               (double) l[(uint64_t) (n - 1) * 99 / 100] / NSEC_PER_USEC,
+               (double) l[n - 1] / NSEC_PER_USEC);
+}
+
+/* Writes "FIELD_<k>=<value>" into buf, padded to the payload size,
+ * where value is drawn from the field's cardinality */
+static size_t make_field(char *buf, size_t size, unsigned k, unsigned value) {
+        size_t l;
+        int m;
+
+        m = snprintf(buf, size, "FIELD_%u=%u-", k, value);
+        assert_se(m > 0 && (size_t) m < size);
+
+        for (l = m; l < size - 1; l++)
+                buf[l] = 'a' + (value + l) % 26;
+        buf[l] = 0;
+
+        return l;
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_free_ char *path = NULL, *buffer = NULL;
+        _cleanup_free_ uint64_t *append = NULL, *grow = NULL;
+        _cleanup_free_ struct iovec *iovec = NULL;
+        char bytes[FORMAT_BYTES_MAX];
+        JournalFile *f = NULL;
+        uint64_t total = 0, payload = 0, start, end, file_size;
+        unsigned i, k, n_grow = 0;
+        size_t field_size;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                goto finish;
+
+        field_size = strlen("FIELD_=") + DECIMAL_STR_MAX(unsigned) * 2 + 2 + arg_payload_size;
+
+        buffer = new(char, arg_fields * field_size);
+        iovec = new(struct iovec, arg_fields);
+        append = new(uint64_t, arg_entries);
+        grow = new(uint64_t, arg_entries);
+        if (!buffer || !iovec || !append || !grow) {
+                r = log_oom();
+                goto finish;
+        }
+
+        if (asprintf(&path, "%s/bench-journal-append-%llu.journal", arg_directory, (unsigned long long) getpid()) < 0) {
+                r = log_oom();
+                goto finish;
+        }
+
+        r = journal_file_open(path, O_RDWR|O_CREAT|O_EXCL, 0644, arg_compress, arg_seal, NULL, NULL, NULL, &f);
+        if (r < 0) {
+                log_error("Failed to create %s: %s", path, strerror(-r));
+                goto finish;
+        }
+
+        printf("entries=%u fields=%u cardinality=%u payload=%zu compress=%s seal=%s\n",
+               arg_entries, arg_fields, arg_cardinality, arg_payload_size,
+               arg_compress ? object_compressed_to_string(arg_compress) : "no",
+               f->seal ? "yes" : arg_seal ? "no (no key)" : "no");
+
+        srand(0);
+
+        for (i = 0; i < arg_entries; i++) {
+                dual_timestamp ts;
+                uint64_t arena, t;
+
+                for (k = 0; k < arg_fields; k++) {
+                        unsigned value;
+
+                        value = arg_cardinality > 0 ? (unsigned) rand() % arg_cardinality : i;
+
+                        iovec[k].iov_base = buffer + k * field_size;
+                        iovec[k].iov_len = make_field(iovec[k].iov_base, field_size, k, value);
+                        payload += iovec[k].iov_len;
+                }
+
+                dual_timestamp_get(&ts);
+                arena = le64toh(f->header->arena_size);
+
+                t = now_nsec();
+                r = journal_file_append_entry(f, &ts, iovec, arg_fields, NULL, NULL, NULL);
+                t = now_nsec() - t;
+
+                if (r < 0) {
+                        log_error("Failed to append entry %u: %s", i, strerror(-r));
+                        goto finish;
+                }
+
+                append[i] = t;
+                total += t;
+
+                if (le64toh(f->header->arena_size) != arena)
+                        grow[n_grow++] = t;
+        }
+
+        /* Include getting the data to disk, as journald would do
+         * eventually */
+        start = now_nsec();
+        journal_file_set_offline(f);
+        end = now_nsec();
+
+        file_size = le64toh(f->header->header_size) + le64toh(f->header->arena_size);
+
+        printf("%-16s %.0f entries/s, %s/s payload, %.2fus/entry\n",
+               "throughput",
+               (double) arg_entries * NSEC_PER_SEC / total,
+               format_bytes(bytes, sizeof(bytes), (off_t) ((double) payload * NSEC_PER_SEC / total)),
+               (double) total / arg_entries / NSEC_PER_USEC);
+        printf("%-16s %s\n", "file size", format_bytes(bytes, sizeof(bytes), file_size));
+        printf("%-16s %.2fms\n", "offline", (double) (end - start) / NSEC_PER_MSEC);
+
+        print_latency("append", append, arg_entries);
+        print_latency("append+grow", grow, n_grow);
+
+        r = 0;
+
+finish:
+        if (f)
+                journal_file_close(f);
+
+        if (path)
+                unlink(path);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
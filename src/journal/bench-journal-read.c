@@ -0,0 +1,430 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+
+#include <systemd/sd-journal.h>
+
+#include "journal-file.h"
+#include "logs-show.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+/* Builds a synthetic journal directory of several interleaved files
+ * and times the common reader operations on it. Results are printed
+ * as one JSON object per line, so that runs can be compared by
+ * scripts. */
+
+#define BASE_REALTIME (1000000ULL * USEC_PER_SEC)
+#define N_SEEKS 100
+
+static unsigned arg_files = 4;
+static unsigned arg_entries = 50000;
+static unsigned arg_units = 100;
+static const char *arg_directory = NULL;
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Benchmark reading from a synthetic journal directory.\n\n"
+               "  -h --help               Show this help\n"
+               "     --files=N            Number of journal files (default: 4)\n"
+               "  -n --entries=N          Entries per file (default: 50000)\n"
+               "     --units=N            Number of distinct units (default: 100)\n"
+               "  -D --directory=PATH     Read this directory instead of generating one\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_FILES = 0x100,
+                ARG_UNITS
+        };
+
+        static const struct option options[] = {
+                { "help",      no_argument,       NULL, 'h'       },
+                { "files",     required_argument, NULL, ARG_FILES },
+                { "entries",   required_argument, NULL, 'n'       },
+                { "units",     required_argument, NULL, ARG_UNITS },
+                { "directory", required_argument, NULL, 'D'       },
+                { NULL,        0,                 NULL, 0         }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "hn:D:", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_FILES:
+                        r = safe_atou(optarg, &arg_files);
+                        if (r < 0 || arg_files <= 0) {
+                                log_error("Failed to parse number of files: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case 'n':
+                        r = safe_atou(optarg, &arg_entries);
+                        if (r < 0 || arg_entries <= 0) {
+                                log_error("Failed to parse number of entries: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_UNITS:
+                        r = safe_atou(optarg, &arg_units);
+                        if (r < 0 || arg_units <= 0) {
+                                log_error("Failed to parse number of units: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case 'D':
+                        arg_directory = optarg;
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        if (optind < argc) {
+                log_error("This program takes no arguments.");
+                return -EINVAL;
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"entries\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+/* Unit 0 is the most common one, the last one the rarest */
+static unsigned pick_unit(void) {
+        double r;
+
+        r = (double) rand() / ((double) RAND_MAX + 1);
+
+        return (unsigned) (arg_units * r * r * r);
+}
+
+static int generate(const char *directory) {
+        JournalFile **files;
+        unsigned i, k;
+        uint64_t g, n;
+        usec_t t;
+        int r = 0;
+
+        files = new0(JournalFile*, arg_files);
+        if (!files)
+                return log_oom();
+
+        for (k = 0; k < arg_files; k++) {
+                _cleanup_free_ char *fn = NULL;
+
+                if (asprintf(&fn, "%s/bench-%u.journal", directory, k) < 0) {
+                        r = log_oom();
+                        goto finish;
+                }
+
+                r = journal_file_open(fn, O_RDWR|O_CREAT, 0644, 0, false, NULL, NULL, NULL, &files[k]);
+                if (r < 0) {
+                        log_error("Failed to create %s: %s", fn, strerror(-r));
+                        goto finish;
+                }
+        }
+
+        srand(0);
+
+        t = now(CLOCK_MONOTONIC);
+        n = (uint64_t) arg_files * arg_entries;
+
+        /* Entries are spread round-robin over the files, so that
+         * the reader has to interleave all of them */
+        for (g = 0; g < n; g++) {
+                char message[LINE_MAX], unit[DECIMAL_STR_MAX(unsigned) + 64], priority[16];
+                struct iovec iovec[3];
+                dual_timestamp ts;
+
+                snprintf(message, sizeof(message), "MESSAGE=Synthetic message number %llu for the read benchmark", (unsigned long long) g);
+                snprintf(unit, sizeof(unit), "_SYSTEMD_UNIT=bench-%u.service", pick_unit());
+                snprintf(priority, sizeof(priority), "PRIORITY=%u", (unsigned) (g % 8));
+
+                IOVEC_SET_STRING(iovec[0], message);
+                IOVEC_SET_STRING(iovec[1], unit);
+                IOVEC_SET_STRING(iovec[2], priority);
+
+                ts.realtime = BASE_REALTIME + g;
+                ts.monotonic = g + 1;
+
+                r = journal_file_append_entry(files[g % arg_files], &ts, iovec, ELEMENTSOF(iovec), NULL, NULL, NULL);
+                if (r < 0) {
+                        log_error("Failed to append entry: %s", strerror(-r));
+                        goto finish;
+                }
+        }
+
+        report("generate", now(CLOCK_MONOTONIC) - t, n);
+        r = 0;
+
+finish:
+        for (i = 0; i < arg_files; i++)
+                if (files[i])
+                        journal_file_close(files[i]);
+        free(files);
+
+        return r;
+}
+
+static int bench_scan(sd_journal *j, const char *name, const char *match, char **middle_cursor, usec_t *middle_realtime) {
+        uint64_t n = 0;
+        usec_t t;
+        int r;
+
+        sd_journal_flush_matches(j);
+        if (match) {
+                r = sd_journal_add_match(j, match, 0);
+                if (r < 0)
+                        return r;
+        }
+
+        t = now(CLOCK_MONOTONIC);
+
+        r = sd_journal_seek_head(j);
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                r = sd_journal_next(j);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        break;
+
+                n++;
+        }
+
+        report(name, now(CLOCK_MONOTONIC) - t, n);
+
+        if (!middle_cursor)
+                return 0;
+
+        /* Remember a position half way through for the seek
+         * benchmarks */
+        r = sd_journal_seek_head(j);
+        if (r < 0)
+                return r;
+        r = sd_journal_next_skip(j, n / 2 + 1);
+        if (r < 0)
+                return r;
+        r = sd_journal_get_cursor(j, middle_cursor);
+        if (r < 0)
+                return r;
+
+        return sd_journal_get_realtime_usec(j, middle_realtime);
+}
+
+static int bench_seek_realtime(sd_journal *j, usec_t middle) {
+        usec_t t;
+        unsigned i;
+        int r;
+
+        sd_journal_flush_matches(j);
+
+        t = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < N_SEEKS; i++) {
+                r = sd_journal_seek_realtime_usec(j, middle + i * 7);
+                if (r < 0)
+                        return r;
+                r = sd_journal_next(j);
+                if (r < 0)
+                        return r;
+        }
+
+        report("seek-realtime", (now(CLOCK_MONOTONIC) - t) / N_SEEKS, N_SEEKS);
+        return 0;
+}
+
+static int bench_seek_cursor(sd_journal *j, const char *cursor) {
+        usec_t t;
+        unsigned i;
+        int r;
+
+        sd_journal_flush_matches(j);
+
+        t = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < N_SEEKS; i++) {
+                r = sd_journal_seek_cursor(j, cursor);
+                if (r < 0)
+                        return r;
+                r = sd_journal_next(j);
+                if (r < 0)
+                        return r;
+                r = sd_journal_test_cursor(j, cursor);
+                if (r <= 0)
+                        return r < 0 ? r : -EIO;
+        }
+
+        report("seek-cursor", (now(CLOCK_MONOTONIC) - t) / N_SEEKS, N_SEEKS);
+        return 0;
+}
+
+static int bench_query_unique(sd_journal *j) {
+        const void *data;
+        size_t l;
+        uint64_t n = 0;
+        usec_t t;
+        int r;
+
+        t = now(CLOCK_MONOTONIC);
+
+        r = sd_journal_query_unique(j, "_SYSTEMD_UNIT");
+        if (r < 0)
+                return r;
+
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+                n++;
+
+        report("query-unique", now(CLOCK_MONOTONIC) - t, n);
+        return 0;
+}
+
+static int bench_output_json(sd_journal *j) {
+        _cleanup_fclose_ FILE *f = NULL;
+        uint64_t n = 0;
+        usec_t t;
+        int r;
+
+        f = fopen("/dev/null", "we");
+        if (!f)
+                return -errno;
+
+        sd_journal_flush_matches(j);
+
+        t = now(CLOCK_MONOTONIC);
+
+        SD_JOURNAL_FOREACH(j) {
+                r = output_journal(f, j, OUTPUT_JSON, 0, 0);
+                if (r < 0)
+                        return r;
+
+                n++;
+        }
+
+        fflush(f);
+
+        report("output-json", now(CLOCK_MONOTONIC) - t, n);
+        return 0;
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_free_ char *cursor = NULL;
+        char t[] = "/var/tmp/bench-journal-read.XXXXXX";
+        _cleanup_free_ char *common = NULL, *rare = NULL;
+        const char *directory;
+        bool generated = false;
+        sd_journal *j = NULL;
+        usec_t middle = 0;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                goto finish;
+
+        if (arg_directory)
+                directory = arg_directory;
+        else {
+                if (!mkdtemp(t)) {
+                        r = -errno;
+                        log_error("Failed to create temporary directory: %m");
+                        goto finish;
+                }
+
+                directory = t;
+                generated = true;
+
+                r = generate(directory);
+                if (r < 0)
+                        goto finish;
+        }
+
+        if (asprintf(&common, "_SYSTEMD_UNIT=bench-0.service") < 0 ||
+            asprintf(&rare, "_SYSTEMD_UNIT=bench-%u.service", arg_units - 1) < 0) {
+                r = log_oom();
+                goto finish;
+        }
+
+        r = sd_journal_open_directory(&j, directory, 0);
+        if (r < 0) {
+                log_error("Failed to open journal directory %s: %s", directory, strerror(-r));
+                goto finish;
+        }
+
+        r = bench_scan(j, "scan", NULL, &cursor, &middle);
+        if (r >= 0)
+                r = bench_scan(j, "match-common", common, NULL, NULL);
+        if (r >= 0)
+                r = bench_scan(j, "match-rare", rare, NULL, NULL);
+        if (r >= 0)
+                r = bench_seek_realtime(j, middle);
+        if (r >= 0)
+                r = bench_seek_cursor(j, cursor);
+        if (r >= 0)
+                r = bench_query_unique(j);
+        if (r >= 0)
+                r = bench_output_json(j);
+        if (r < 0)
+                log_error("Benchmark failed: %s", strerror(-r));
+
+finish:
+        if (j)
+                sd_journal_close(j);
+
+        if (generated)
+                rm_rf_dangerous(t, false, true, false);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
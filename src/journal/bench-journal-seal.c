@@ -0,0 +1,205 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <gcrypt.h>
+
+#include "fsprg.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+/* Times the building blocks of Forward Secure Sealing: evolving the
+ * FSPRG state, seeking it with the secret key as the verifier does,
+ * and feeding objects into the HMAC as the writer does. Results are
+ * printed as one JSON object per line, like bench-journal-read. */
+
+static unsigned arg_epochs = 10000;
+static unsigned arg_objects = 1000000;
+static size_t arg_object_size = 96;
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Benchmark the Forward Secure Sealing primitives.\n\n"
+               "  -h --help               Show this help\n"
+               "     --epochs=N           Epochs to evolve over (default: 10000)\n"
+               "     --objects=N          Objects to feed into the HMAC (default: 1000000)\n"
+               "     --object-size=BYTES  Size of each object (default: 96)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_EPOCHS = 0x100,
+                ARG_OBJECTS,
+                ARG_OBJECT_SIZE
+        };
+
+        static const struct option options[] = {
+                { "help",        no_argument,       NULL, 'h'             },
+                { "epochs",      required_argument, NULL, ARG_EPOCHS      },
+                { "objects",     required_argument, NULL, ARG_OBJECTS     },
+                { "object-size", required_argument, NULL, ARG_OBJECT_SIZE },
+                { NULL,          0,                 NULL, 0               }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_EPOCHS:
+                        r = safe_atou(optarg, &arg_epochs);
+                        if (r < 0 || arg_epochs <= 0) {
+                                log_error("Failed to parse number of epochs: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_OBJECTS:
+                        r = safe_atou(optarg, &arg_objects);
+                        if (r < 0 || arg_objects <= 0) {
+                                log_error("Failed to parse number of objects: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_OBJECT_SIZE: {
+                        off_t sz;
+
+                        r = parse_bytes(optarg, &sz);
+                        if (r < 0 || sz <= 0) {
+                                log_error("Failed to parse object size: %s", optarg);
+                                return -EINVAL;
+                        }
+                        arg_object_size = (size_t) sz;
+                        break;
+                }
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        if (optind < argc) {
+                log_error("This program takes no arguments.");
+                return -EINVAL;
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+int main(int argc, char *argv[]) {
+        uint8_t seed[FSPRG_RECOMMENDED_SEEDLEN] = {}, key[256 / 8];
+        _cleanup_free_ void *msk = NULL, *mpk = NULL, *state = NULL, *other = NULL, *object = NULL;
+        gcry_md_hd_t hmac = NULL;
+        size_t state_size;
+        unsigned i;
+        usec_t t;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                goto finish;
+
+        state_size = FSPRG_stateinbytes(FSPRG_RECOMMENDED_SECPAR);
+
+        msk = malloc(FSPRG_mskinbytes(FSPRG_RECOMMENDED_SECPAR));
+        mpk = malloc(FSPRG_mpkinbytes(FSPRG_RECOMMENDED_SECPAR));
+        state = malloc(state_size);
+        other = malloc(state_size);
+        object = malloc0(arg_object_size);
+        if (!msk || !mpk || !state || !other || !object) {
+                r = log_oom();
+                goto finish;
+        }
+
+        t = now(CLOCK_MONOTONIC);
+        FSPRG_GenMK(msk, mpk, seed, sizeof(seed), FSPRG_RECOMMENDED_SECPAR);
+        report("genmk", now(CLOCK_MONOTONIC) - t, 1);
+
+        FSPRG_GenState0(state, mpk, seed, sizeof(seed));
+        memcpy(other, state, state_size);
+
+        /* What the writer does per epoch, and after downtime */
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_epochs; i++)
+                FSPRG_Evolve(state);
+        report("evolve", now(CLOCK_MONOTONIC) - t, arg_epochs);
+
+        /* What the verifier does per tag */
+        t = now(CLOCK_MONOTONIC);
+        FSPRG_Seek(other, arg_epochs, msk, seed, sizeof(seed));
+        report("seek", now(CLOCK_MONOTONIC) - t, 1);
+
+        assert_se(memcmp(state, other, state_size) == 0);
+
+        t = now(CLOCK_MONOTONIC);
+        FSPRG_GetKey(state, key, sizeof(key), 0);
+        report("getkey", now(CLOCK_MONOTONIC) - t, 1);
+
+        if (gcry_md_open(&hmac, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC) != 0) {
+                log_error("Failed to set up HMAC.");
+                r = -ENOTSUP;
+                goto finish;
+        }
+
+        gcry_md_setkey(hmac, key, sizeof(key));
+
+        /* What the writer does for every object it appends */
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_objects; i++)
+                gcry_md_write(hmac, object, arg_object_size);
+        gcry_md_read(hmac, 0);
+        report("hmac-object", now(CLOCK_MONOTONIC) - t, arg_objects);
+
+        r = 0;
+
+finish:
+        if (hmac)
+                gcry_md_close(hmac);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
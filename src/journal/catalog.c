@@ -419,15 +419,73 @@ finish:
         return r < 0 ? r : 0;
 }
 
-static int open_mmap(const char *database, int *_fd, struct stat *_st, void **_p) {
-        const CatalogHeader *h;
+struct Catalog {
         int fd;
         void *p;
+        size_t size;
+
+        const uint8_t *items;
+        uint64_t n_items;
+        uint64_t item_size;
+        const char *texts;
+
+        /* The language of the current locale, which is looked up
+         * first, and the length of its language-only prefix, which
+         * is tried next, before falling back to the untranslated
+         * entry */
+        char language[32];
+        size_t language_short;
+
+        /* sd_id128_t → CatalogCacheEntry, for the current language */
+        Hashmap *cache;
+};
+
+typedef struct CatalogCacheEntry {
+        sd_id128_t id;
+        const char *text;
+} CatalogCacheEntry;
+
+static unsigned catalog_id_hash_func(const void *p) {
+        const sd_id128_t *id = p;
+
+        /* IDs are random, so any 32 bits will do */
+        return (unsigned) id->qwords[0] ^ (unsigned) id->qwords[1];
+}
+
+static int catalog_id_compare_func(const void *a, const void *b) {
+        return memcmp(a, b, sizeof(sd_id128_t));
+}
+
+static void catalog_set_language(Catalog *c) {
+        const char *loc;
+        char *e;
+
+        assert(c);
+
+        zero(c->language);
+        c->language_short = 0;
+
+        loc = setlocale(LC_MESSAGES, NULL);
+        if (!loc || !loc[0] || streq(loc, "C") || streq(loc, "POSIX"))
+                return;
+
+        strncpy(c->language, loc, sizeof(c->language) - 1);
+        c->language[strcspn(c->language, ".@")] = 0;
+
+        e = strchr(c->language, '_');
+        if (e)
+                c->language_short = e - c->language;
+}
+
+int catalog_open(const char *database, Catalog **ret) {
+        const CatalogHeader *h;
+        Catalog *c;
         struct stat st;
+        void *p;
+        int fd;
 
-        assert(_fd);
-        assert(_st);
-        assert(_p);
+        assert(database);
+        assert(ret);
 
         fd = open(database, O_RDONLY|O_CLOEXEC);
         if (fd < 0)
@@ -461,67 +519,147 @@ static int open_mmap(const char *database, int *_fd, struct stat *_st, void **_p
                 return -EBADMSG;
         }
 
-        *_fd = fd;
-        *_st = st;
-        *_p = p;
+        c = new0(Catalog, 1);
+        if (!c) {
+                close_nointr_nofail(fd);
+                munmap(p, st.st_size);
+                return -ENOMEM;
+        }
+
+        c->fd = fd;
+        c->p = p;
+        c->size = st.st_size;
+        c->items = (const uint8_t*) p + le64toh(h->header_size);
+        c->n_items = le64toh(h->n_items);
+        c->item_size = le64toh(h->catalog_item_size);
+        c->texts = (const char*) c->items + c->n_items * c->item_size;
+
+        catalog_set_language(c);
 
+        *ret = c;
         return 0;
 }
 
-static const char *find_id(void *p, sd_id128_t id) {
-        CatalogItem key, *f = NULL;
-        const CatalogHeader *h = p;
-        const char *loc;
+void catalog_close(Catalog *c) {
+        if (!c)
+                return;
 
-        zero(key);
-        key.id = id;
+        hashmap_free_free(c->cache);
 
-        loc = setlocale(LC_MESSAGES, NULL);
-        if (loc && loc[0] && !streq(loc, "C") && !streq(loc, "POSIX")) {
-                strncpy(key.language, loc, sizeof(key.language));
-                key.language[strcspn(key.language, ".@")] = 0;
-
-                f = bsearch(&key, (const uint8_t*) p + le64toh(h->header_size), le64toh(h->n_items), le64toh(h->catalog_item_size), catalog_compare_func);
-                if (!f) {
-                        char *e;
-
-                        e = strchr(key.language, '_');
-                        if (e) {
-                                *e = 0;
-                                f = bsearch(&key, (const uint8_t*) p + le64toh(h->header_size), le64toh(h->n_items), le64toh(h->catalog_item_size), catalog_compare_func);
-                        }
-                }
+        munmap(c->p, c->size);
+        close_nointr_nofail(c->fd);
+
+        free(c);
+}
+
+static const CatalogItem *catalog_item(Catalog *c, uint64_t i) {
+        return (const CatalogItem*) (c->items + i * c->item_size);
+}
+
+static int catalog_language_score(Catalog *c, const CatalogItem *i) {
+        if (c->language[0] && strneq(i->language, c->language, sizeof(i->language)))
+                return 3;
+
+        if (c->language_short > 0 &&
+            strneq(i->language, c->language, c->language_short) &&
+            i->language[c->language_short] == 0)
+                return 2;
+
+        if (i->language[0] == 0)
+                return 1;
+
+        return 0;
+}
+
+static const char *find_id(Catalog *c, sd_id128_t id) {
+        const CatalogItem *f = NULL;
+        uint64_t left = 0, right, i;
+        int score = 0;
+
+        assert(c);
+
+        /* The items are sorted by ID first, so all translations of
+         * an ID are next to each other. Find the first of them with
+         * a single binary search on the ID, and pick the best match
+         * for our language from that run. */
+        right = c->n_items;
+        while (left < right) {
+                i = left + (right - left) / 2;
+
+                if (memcmp(&catalog_item(c, i)->id, &id, sizeof(id)) < 0)
+                        left = i + 1;
+                else
+                        right = i;
         }
 
-        if (!f) {
-                zero(key.language);
-                f = bsearch(&key, (const uint8_t*) p + le64toh(h->header_size), le64toh(h->n_items), le64toh(h->catalog_item_size), catalog_compare_func);
+        for (i = left; i < c->n_items; i++) {
+                const CatalogItem *item = catalog_item(c, i);
+                int k;
+
+                if (!sd_id128_equal(item->id, id))
+                        break;
+
+                k = catalog_language_score(c, item);
+                if (k > score) {
+                        f = item;
+                        score = k;
+                }
         }
 
         if (!f)
                 return NULL;
 
-        return (const char*) p +
-                le64toh(h->header_size) +
-                le64toh(h->n_items) * le64toh(h->catalog_item_size) +
-                le64toh(f->offset);
+        return c->texts + le64toh(f->offset);
 }
 
-int catalog_get(const char* database, sd_id128_t id, char **_text) {
-        _cleanup_close_ int fd = -1;
-        void *p = NULL;
-        struct stat st;
-        char *text = NULL;
+int catalog_lookup(Catalog *c, sd_id128_t id, const char **ret) {
+        CatalogCacheEntry *e;
         int r;
+
+        assert(c);
+        assert(ret);
+
+        e = hashmap_get(c->cache, &id);
+        if (!e) {
+                r = hashmap_ensure_allocated(&c->cache, catalog_id_hash_func, catalog_id_compare_func);
+                if (r < 0)
+                        return r;
+
+                e = new(CatalogCacheEntry, 1);
+                if (!e)
+                        return -ENOMEM;
+
+                /* Negative lookups are cached too */
+                e->id = id;
+                e->text = find_id(c, id);
+
+                r = hashmap_put(c->cache, &e->id, e);
+                if (r < 0) {
+                        free(e);
+                        return r;
+                }
+        }
+
+        if (!e->text)
+                return -ENOENT;
+
+        *ret = e->text;
+        return 0;
+}
+
+int catalog_get(const char* database, sd_id128_t id, char **_text) {
+        Catalog *c;
         const char *s;
+        char *text;
+        int r;
 
         assert(_text);
 
-        r = open_mmap(database, &fd, &st, &p);
+        r = catalog_open(database, &c);
         if (r < 0)
                 return r;
 
-        s = find_id(p, id);
+        s = find_id(c, id);
         if (!s) {
                 r = -ENOENT;
                 goto finish;
@@ -537,8 +675,7 @@ int catalog_get(const char* database, sd_id128_t id, char **_text) {
         r = 0;
 
 finish:
-        if (p)
-                munmap(p, st.st_size);
+        catalog_close(c);
 
         return r;
 }
@@ -584,50 +721,49 @@ static void dump_catalog_entry(FILE *f, sd_id128_t id, const char *s, bool oneli
 
 
 int catalog_list(FILE *f, const char *database, bool oneline) {
-        _cleanup_close_ int fd = -1;
-        void *p = NULL;
-        struct stat st;
-        const CatalogHeader *h;
-        const CatalogItem *items;
+        Catalog *c;
         int r;
-        unsigned n;
+        uint64_t n;
         sd_id128_t last_id;
         bool last_id_set = false;
 
-        r = open_mmap(database, &fd, &st, &p);
+        r = catalog_open(database, &c);
         if (r < 0)
                 return r;
 
-        h = p;
-        items = (const CatalogItem*) ((const uint8_t*) p + le64toh(h->header_size));
-
-        for (n = 0; n < le64toh(h->n_items); n++) {
+        for (n = 0; n < c->n_items; n++) {
+                const CatalogItem *item = catalog_item(c, n);
                 const char *s;
 
-                if (last_id_set && sd_id128_equal(last_id, items[n].id))
+                if (last_id_set && sd_id128_equal(last_id, item->id))
                         continue;
 
-                assert_se(s = find_id(p, items[n].id));
+                assert_se(s = find_id(c, item->id));
 
-                dump_catalog_entry(f, items[n].id, s, oneline);
+                dump_catalog_entry(f, item->id, s, oneline);
 
                 last_id_set = true;
-                last_id = items[n].id;
+                last_id = item->id;
         }
 
-        munmap(p, st.st_size);
+        catalog_close(c);
 
         return 0;
 }
 
 int catalog_list_items(FILE *f, const char *database, bool oneline, char **items) {
+        Catalog *c;
         char **item;
         int r = 0;
 
+        r = catalog_open(database, &c);
+        if (r < 0)
+                return r;
+
         STRV_FOREACH(item, items) {
                 sd_id128_t id;
                 int k;
-                char _cleanup_free_ *msg = NULL;
+                const char *msg;
 
                 k = sd_id128_from_string(*item, &id);
                 if (k < 0) {
@@ -638,7 +774,7 @@ int catalog_list_items(FILE *f, const char *database, bool oneline, char **items
                         continue;
                 }
 
-                k = catalog_get(database, id, &msg);
+                k = catalog_lookup(c, id, &msg);
                 if (k < 0) {
                         log_full(k == -ENOENT ? LOG_NOTICE : LOG_ERR,
                                  "Failed to retrieve catalog entry for '%s': %s",
@@ -651,5 +787,7 @@ int catalog_list_items(FILE *f, const char *database, bool oneline, char **items
                 dump_catalog_entry(f, id, msg, oneline);
         }
 
+        catalog_close(c);
+
         return r;
 }
@@ -27,11 +27,16 @@
 #include "hashmap.h"
 #include "strbuf.h"
 
+typedef struct Catalog Catalog;
+
 int catalog_import_file(Hashmap *h, struct strbuf *sb, const char *path);
 unsigned catalog_hash_func(const void *p);
 int catalog_compare_func(const void *a, const void *b);
 int catalog_update(const char* database, const char* root, const char* const* dirs);
 int catalog_get(const char* database, sd_id128_t id, char **data);
+int catalog_open(const char *database, Catalog **ret);
+void catalog_close(Catalog *c);
+int catalog_lookup(Catalog *c, sd_id128_t id, const char **text);
 int catalog_list(FILE *f, const char* database, bool oneline);
 int catalog_list_items(FILE *f, const char* database, bool oneline, char **items);
 extern const char * const catalog_file_dirs[];
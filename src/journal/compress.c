@@ -22,12 +22,54 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+
+#ifdef HAVE_XZ
 #include <lzma.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
 
 #include "macro.h"
+#include "util.h"
+#include "sparse-endian.h"
 #include "compress.h"
 
-bool compress_blob(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
+static const char* const object_compressed_table[] = {
+        [OBJECT_COMPRESSED_XZ] = "xz",
+        [OBJECT_COMPRESSED_LZ4] = "lz4",
+};
+
+DEFINE_STRING_TABLE_LOOKUP(object_compressed, int);
+
+int compression_default(void) {
+#if defined(HAVE_LZ4)
+        return OBJECT_COMPRESSED_LZ4;
+#elif defined(HAVE_XZ)
+        return OBJECT_COMPRESSED_XZ;
+#else
+        return 0;
+#endif
+}
+
+bool compression_supported(int compression) {
+        switch (compression) {
+#ifdef HAVE_XZ
+        case OBJECT_COMPRESSED_XZ:
+                return true;
+#endif
+#ifdef HAVE_LZ4
+        case OBJECT_COMPRESSED_LZ4:
+                return true;
+#endif
+        default:
+                return false;
+        }
+}
+
+#ifdef HAVE_XZ
+bool compress_blob_xz(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
         lzma_stream s = LZMA_STREAM_INIT;
         lzma_ret ret;
         bool b = false;
@@ -66,8 +108,8 @@ fail:
         return b;
 }
 
-bool uncompress_blob(const void *src, uint64_t src_size,
-                     void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
+bool uncompress_blob_xz(const void *src, uint64_t src_size,
+                        void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
 
         lzma_stream s = LZMA_STREAM_INIT;
         lzma_ret ret;
@@ -139,10 +181,10 @@ fail:
         return b;
 }
 
-bool uncompress_startswith(const void *src, uint64_t src_size,
-                           void **buffer, uint64_t *buffer_size,
-                           const void *prefix, uint64_t prefix_len,
-                           uint8_t extra) {
+bool uncompress_startswith_xz(const void *src, uint64_t src_size,
+                              void **buffer, uint64_t *buffer_size,
+                              const void *prefix, uint64_t prefix_len,
+                              uint8_t extra) {
 
         lzma_stream s = LZMA_STREAM_INIT;
         lzma_ret ret;
@@ -214,3 +256,181 @@ fail:
 
         return b;
 }
+#endif
+
+#ifdef HAVE_LZ4
+/* LZ4 blocks do not carry the size of the uncompressed data, hence
+ * we prefix the compressed data with it as little endian 64bit
+ * integer. */
+#define LZ4_HEADER_SIZE sizeof(le64_t)
+
+bool compress_blob_lz4(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
+        le64_t h;
+        int r;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_size);
+
+        /* Returns false if we couldn't compress the data or the
+         * compressed result is longer than the original */
+
+        if (src_size <= LZ4_HEADER_SIZE + 1 || src_size > (uint64_t) LZ4_MAX_INPUT_SIZE)
+                return false;
+
+        r = LZ4_compress_default(src, (char*) dst + LZ4_HEADER_SIZE,
+                                 src_size, src_size - LZ4_HEADER_SIZE - 1);
+        if (r <= 0)
+                return false;
+
+        h = htole64(src_size);
+        memcpy(dst, &h, sizeof(h));
+
+        *dst_size = r + LZ4_HEADER_SIZE;
+        return true;
+}
+
+bool uncompress_blob_size_lz4(const void *src, uint64_t src_size, uint64_t *size) {
+        le64_t h;
+
+        assert(src);
+        assert(size);
+
+        /* Returns the size the blob claims to uncompress to, without
+         * uncompressing it */
+
+        if (src_size <= LZ4_HEADER_SIZE)
+                return false;
+
+        memcpy(&h, src, sizeof(h));
+        *size = le64toh(h);
+        return true;
+}
+
+bool uncompress_blob_lz4(const void *src, uint64_t src_size,
+                         void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
+
+        le64_t h;
+        uint64_t size, want;
+        int r;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size);
+        assert(dst_size);
+        assert(*dst_alloc_size == 0 || *dst);
+
+        if (src_size <= LZ4_HEADER_SIZE)
+                return false;
+
+        memcpy(&h, src, sizeof(h));
+        size = le64toh(h);
+
+        if (size > (uint64_t) LZ4_MAX_INPUT_SIZE)
+                return false;
+
+        /* The size comes from the blob itself, so don't trust it
+         * with more memory than the caller asked for. Like the XZ
+         * path we then return only the first dst_max bytes. */
+        want = dst_max > 0 ? MIN(size, dst_max) : size;
+
+        if (*dst_alloc_size <= want) {
+                void *p;
+
+                p = realloc(*dst, want + 1);
+                if (!p)
+                        return false;
+
+                *dst = p;
+                *dst_alloc_size = want + 1;
+        }
+
+        if (want < size)
+                r = LZ4_decompress_safe_partial((const char*) src + LZ4_HEADER_SIZE, *dst,
+                                                src_size - LZ4_HEADER_SIZE, want, want);
+        else
+                r = LZ4_decompress_safe((const char*) src + LZ4_HEADER_SIZE, *dst,
+                                        src_size - LZ4_HEADER_SIZE, size);
+        if (r < 0 || (uint64_t) r != want)
+                return false;
+
+        *dst_size = want;
+        return true;
+}
+
+bool uncompress_startswith_lz4(const void *src, uint64_t src_size,
+                               void **buffer, uint64_t *buffer_size,
+                               const void *prefix, uint64_t prefix_len,
+                               uint8_t extra) {
+
+        uint64_t size;
+
+        /* Checks whether the uncompressed blob starts with the
+         * mentioned prefix. The byte extra needs to follow the
+         * prefix */
+
+        assert(prefix);
+
+        if (!uncompress_blob_lz4(src, src_size, buffer, buffer_size, &size, 0))
+                return false;
+
+        return size > prefix_len &&
+                memcmp(*buffer, prefix, prefix_len) == 0 &&
+                ((const uint8_t*) *buffer)[prefix_len] == extra;
+}
+#endif
+
+bool compress_blob(int compression, const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
+        switch (compression) {
+#ifdef HAVE_XZ
+        case OBJECT_COMPRESSED_XZ:
+                return compress_blob_xz(src, src_size, dst, dst_size);
+#endif
+#ifdef HAVE_LZ4
+        case OBJECT_COMPRESSED_LZ4:
+                return compress_blob_lz4(src, src_size, dst, dst_size);
+#endif
+        default:
+                return false;
+        }
+}
+
+bool uncompress_blob(int compression,
+                     const void *src, uint64_t src_size,
+                     void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
+
+        switch (compression) {
+#ifdef HAVE_XZ
+        case OBJECT_COMPRESSED_XZ:
+                return uncompress_blob_xz(src, src_size, dst, dst_alloc_size, dst_size, dst_max);
+#endif
+#ifdef HAVE_LZ4
+        case OBJECT_COMPRESSED_LZ4:
+                return uncompress_blob_lz4(src, src_size, dst, dst_alloc_size, dst_size, dst_max);
+#endif
+        default:
+                return false;
+        }
+}
+
+bool uncompress_startswith(int compression,
+                           const void *src, uint64_t src_size,
+                           void **buffer, uint64_t *buffer_size,
+                           const void *prefix, uint64_t prefix_len,
+                           uint8_t extra) {
+
+        switch (compression) {
+#ifdef HAVE_XZ
+        case OBJECT_COMPRESSED_XZ:
+                return uncompress_startswith_xz(src, src_size, buffer, buffer_size, prefix, prefix_len, extra);
+#endif
+#ifdef HAVE_LZ4
+        case OBJECT_COMPRESSED_LZ4:
+                return uncompress_startswith_lz4(src, src_size, buffer, buffer_size, prefix, prefix_len, extra);
+#endif
+        default:
+                return false;
+        }
+}
@@ -36,6 +36,7 @@
 #include "mkdir.h"
 #include "special.h"
 #include "cgroup-util.h"
+#include "journal-send.h"
 
 /* Make sure to not make this larger than the maximum journal entry
  * size. See ENTRY_SIZE_MAX in journald-native.c. */
@@ -98,14 +99,13 @@ static int divert_coredump(void) {
 int main(int argc, char* argv[]) {
         int r, j = 0;
         char *t;
-        ssize_t n;
         pid_t pid;
         uid_t uid;
         gid_t gid;
         struct iovec iovec[14];
         char _cleanup_free_ *core_pid = NULL, *core_uid = NULL, *core_gid = NULL, *core_signal = NULL,
                 *core_timestamp = NULL, *core_comm = NULL, *core_exe = NULL, *core_unit = NULL,
-                *core_session = NULL, *core_message = NULL, *core_cmdline = NULL, *p = NULL;
+                *core_session = NULL, *core_message = NULL, *core_cmdline = NULL;
 
         prctl(PR_SET_DUMPABLE, 0);
 
@@ -234,26 +234,10 @@ int main(int argc, char* argv[]) {
                 goto finish;
         }
 
-        p = malloc(9 + COREDUMP_MAX);
-        if (!p) {
-                r = log_oom();
-                goto finish;
-        }
-
-        memcpy(p, "COREDUMP=", 9);
-
-        n = loop_read(STDIN_FILENO, p + 9, COREDUMP_MAX, false);
-        if (n < 0) {
-                log_error("Failed to read core dump data: %s", strerror(-n));
-                r = (int) n;
-                goto finish;
-        }
-
-        iovec[j].iov_base = p;
-        iovec[j].iov_len = 9 + n;
-        j++;
-
-        r = sd_journal_sendv(iovec, j);
+        /* The core is copied straight from the kernel pipe into the
+         * buffer handed to journald, so that we never need to hold
+         * it in memory ourselves */
+        r = journal_sendv_stream(iovec, j, "COREDUMP", STDIN_FILENO, COREDUMP_MAX);
         if (r < 0)
                 log_error("Failed to send coredump: %s", strerror(-r));
 
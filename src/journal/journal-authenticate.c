@@ -27,6 +27,11 @@
 #include "journal-authenticate.h"
 #include "fsprg.h"
 
+/* Up to this many epochs ahead, evolving the state is cheaper than
+ * seeking with the secret key, which costs about as much as a
+ * thousand squarings */
+#define FSPRG_EVOLVE_MAX 512
+
 static uint64_t journal_file_tag_seqnum(JournalFile *f) {
         uint64_t r;
 
@@ -79,6 +84,8 @@ int journal_file_append_tag(JournalFile *f) {
 
 int journal_file_hmac_start(JournalFile *f) {
         uint8_t key[256 / 8]; /* Let's pass 256 bit from FSPRG to HMAC */
+        uint64_t epoch;
+
         assert(f);
 
         if (!f->seal)
@@ -87,10 +94,19 @@ int journal_file_hmac_start(JournalFile *f) {
         if (f->hmac_running)
                 return 0;
 
-        /* Prepare HMAC for next cycle */
+        /* Prepare HMAC for next cycle. The key only changes with
+         * the epoch, so don't derive it again if several tags are
+         * written per epoch */
         gcry_md_reset(f->hmac);
-        FSPRG_GetKey(f->fsprg_state, key, sizeof(key), 0);
-        gcry_md_setkey(f->hmac, key, sizeof(key));
+
+        epoch = FSPRG_GetEpoch(f->fsprg_state);
+        if (!f->hmac_keyed || f->hmac_epoch != epoch) {
+                FSPRG_GetKey(f->fsprg_state, key, sizeof(key), 0);
+                gcry_md_setkey(f->hmac, key, sizeof(key));
+
+                f->hmac_epoch = epoch;
+                f->hmac_keyed = true;
+        }
 
         f->hmac_running = true;
 
@@ -166,7 +182,6 @@ int journal_file_fsprg_evolve(JournalFile *f, uint64_t realtime) {
 }
 
 int journal_file_fsprg_seek(JournalFile *f, uint64_t goal) {
-        void *msk;
         uint64_t epoch;
 
         assert(f);
@@ -183,8 +198,9 @@ int journal_file_fsprg_seek(JournalFile *f, uint64_t goal) {
                 if (goal == epoch)
                         return 0;
 
-                if (goal == epoch+1) {
-                        FSPRG_Evolve(f->fsprg_state);
+                if (goal > epoch && goal - epoch <= FSPRG_EVOLVE_MAX) {
+                        for (; epoch < goal; epoch++)
+                                FSPRG_Evolve(f->fsprg_state);
                         return 0;
                 }
         } else {
@@ -197,9 +213,18 @@ int journal_file_fsprg_seek(JournalFile *f, uint64_t goal) {
 
         log_debug("Seeking FSPRG key to %llu.", (unsigned long long) goal);
 
-        msk = alloca(FSPRG_mskinbytes(FSPRG_RECOMMENDED_SECPAR));
-        FSPRG_GenMK(msk, NULL, f->fsprg_seed, f->fsprg_seed_size, FSPRG_RECOMMENDED_SECPAR);
-        FSPRG_Seek(f->fsprg_state, goal, msk, f->fsprg_seed, f->fsprg_seed_size);
+        /* Generating the secret key means searching for primes,
+         * which is by far the most expensive part, hence do that
+         * only once per file */
+        if (!f->fsprg_msk) {
+                f->fsprg_msk = malloc(FSPRG_mskinbytes(FSPRG_RECOMMENDED_SECPAR));
+                if (!f->fsprg_msk)
+                        return -ENOMEM;
+
+                FSPRG_GenMK(f->fsprg_msk, NULL, f->fsprg_seed, f->fsprg_seed_size, FSPRG_RECOMMENDED_SECPAR);
+        }
+
+        FSPRG_Seek(f->fsprg_state, goal, f->fsprg_msk, f->fsprg_seed, f->fsprg_seed_size);
         return 0;
 }
 
@@ -274,9 +299,16 @@ int journal_file_hmac_put_object(JournalFile *f, int type, Object *o, uint64_t p
         case OBJECT_FIELD_HASH_TABLE:
         case OBJECT_DATA_HASH_TABLE:
         case OBJECT_ENTRY_ARRAY:
+        case OBJECT_ENTRY_ARRAY_INDEX_HASH_TABLE:
+        case OBJECT_ENTRY_ARRAY_INDEX:
                 /* Nothing: everything is mutable */
                 break;
 
+        case OBJECT_DATA_BLOOM_FILTER:
+                /* All, it's written only once */
+                gcry_md_write(f->hmac, &o->data_bloom_filter.n_data, le64toh(o->object.size) - offsetof(DataBloomFilterObject, n_data));
+                break;
+
         case OBJECT_TAG:
                 /* All but the tag itself */
                 gcry_md_write(f->hmac, &o->tag.seqnum, sizeof(o->tag.seqnum));
@@ -483,6 +515,17 @@ int journal_file_append_first_tag(JournalFile *f) {
         if (r < 0)
                 return r;
 
+        if (JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header)) {
+                p = le64toh(f->header->entry_array_index_hash_table_offset);
+                if (p < offsetof(Object, hash_table.items))
+                        return -EINVAL;
+                p -= offsetof(Object, hash_table.items);
+
+                r = journal_file_hmac_put_object(f, OBJECT_ENTRY_ARRAY_INDEX_HASH_TABLE, NULL, p);
+                if (r < 0)
+                        return r;
+        }
+
         r = journal_file_append_tag(f);
         if (r < 0)
                 return r;
@@ -45,9 +45,12 @@ typedef struct EntryObject EntryObject;
 typedef struct HashTableObject HashTableObject;
 typedef struct EntryArrayObject EntryArrayObject;
 typedef struct TagObject TagObject;
+typedef struct EntryArrayIndexObject EntryArrayIndexObject;
+typedef struct DataBloomFilterObject DataBloomFilterObject;
 
 typedef struct EntryItem EntryItem;
 typedef struct HashItem HashItem;
+typedef struct EntryArrayIndexItem EntryArrayIndexItem;
 
 typedef struct FSSHeader FSSHeader;
 
@@ -61,14 +64,20 @@ enum {
         OBJECT_FIELD_HASH_TABLE,
         OBJECT_ENTRY_ARRAY,
         OBJECT_TAG,
+        OBJECT_ENTRY_ARRAY_INDEX_HASH_TABLE,
+        OBJECT_ENTRY_ARRAY_INDEX,
+        OBJECT_DATA_BLOOM_FILTER,
         _OBJECT_TYPE_MAX
 };
 
 /* Object flags */
 enum {
-        OBJECT_COMPRESSED = 1
+        OBJECT_COMPRESSED_XZ = 1,
+        OBJECT_COMPRESSED_LZ4 = 2
 };
 
+#define OBJECT_COMPRESSION_MASK (OBJECT_COMPRESSED_XZ|OBJECT_COMPRESSED_LZ4)
+
 struct ObjectHeader {
         uint8_t type;
         uint8_t flags;
@@ -136,6 +145,30 @@ struct TagObject {
         uint8_t tag[TAG_LENGTH]; /* SHA-256 HMAC */
 } _packed_;
 
+/* Describes one entry array in a chain: which entry it starts with,
+ * and how many entries the chain has before it */
+struct EntryArrayIndexItem {
+        le64_t entry_array_offset;
+        le64_t first_entry_offset;
+        le64_t n_before;
+} _packed_;
+
+struct EntryArrayIndexObject {
+        ObjectHeader object;
+        le64_t first_entry_array_offset; /* the chain this indexes */
+        le64_t next_hash_offset;
+        le64_t n_items;
+        EntryArrayIndexItem items[];
+} _packed_;
+
+/* Covers the hashes of all data objects of an archived file */
+struct DataBloomFilterObject {
+        ObjectHeader object;
+        le64_t n_data;
+        le64_t n_hashes; /* bits set per data object */
+        uint8_t bits[];
+} _packed_;
+
 union Object {
         ObjectHeader object;
         DataObject data;
@@ -144,6 +177,8 @@ union Object {
         HashTableObject hash_table;
         EntryArrayObject entry_array;
         TagObject tag;
+        EntryArrayIndexObject entry_array_index;
+        DataBloomFilterObject data_bloom_filter;
 };
 
 enum {
@@ -155,11 +190,15 @@ enum {
 
 /* Header flags */
 enum {
-        HEADER_INCOMPATIBLE_COMPRESSED = 1
+        HEADER_INCOMPATIBLE_COMPRESSED_XZ = 1,
+        HEADER_INCOMPATIBLE_COMPRESSED_LZ4 = 2,
+        HEADER_INCOMPATIBLE_XXHASH64 = 4
 };
 
 enum {
-        HEADER_COMPATIBLE_SEALED = 1
+        HEADER_COMPATIBLE_SEALED = 1,
+        HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX = 2,
+        HEADER_COMPATIBLE_DATA_BLOOM_FILTER = 4
 };
 
 #define HEADER_SIGNATURE ((char[]) { 'L', 'P', 'K', 'S', 'H', 'H', 'R', 'H' })
@@ -195,8 +234,19 @@ struct Header {
         /* Added in 189 */
         le64_t n_tags;
         le64_t n_entry_arrays;
-
-        /* Size: 224 */
+        /* Added in 202 */
+        le64_t n_compressed;
+        le64_t n_compress_failed;
+        le64_t n_compress_skipped;
+        le64_t compress_saved_bytes;
+        le64_t entry_array_index_hash_table_offset;
+        le64_t entry_array_index_hash_table_size;
+        le64_t data_hash_chain_depth;
+        le64_t field_hash_chain_depth;
+        le64_t data_bloom_filter_offset;
+        le64_t data_bloom_filter_size;
+
+        /* Size: 304 */
 } _packed_;
 
 #define FSS_HEADER_SIGNATURE ((char[]) { 'K', 'S', 'H', 'H', 'R', 'H', 'L', 'P' })
@@ -26,6 +26,9 @@
 #include <sys/statvfs.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 
 #ifdef HAVE_XATTR
 #include <attr/xattr.h>
@@ -35,17 +38,50 @@
 #include "journal-file.h"
 #include "journal-authenticate.h"
 #include "lookup3.h"
+#include "xxhash64.h"
 #include "compress.h"
 #include "fsprg.h"
+#include "trace.h"
 
 #define DEFAULT_DATA_HASH_TABLE_SIZE (2047ULL*sizeof(HashItem))
 #define DEFAULT_FIELD_HASH_TABLE_SIZE (333ULL*sizeof(HashItem))
+#define DEFAULT_ENTRY_ARRAY_INDEX_HASH_TABLE_SIZE (1023ULL*sizeof(HashItem))
 
-#define COMPRESSION_SIZE_THRESHOLD (512ULL)
+/* Entry array chains get an index once they consist of this many
+ * arrays */
+#define ENTRY_ARRAY_INDEX_MIN 6
+
+/* How many arrays an index covers. Since each array in a chain is
+ * at least twice the size of the one before this is plenty. */
+#define ENTRY_ARRAY_INDEX_ITEMS 48
+
+/* Archived files get a Bloom filter over their data hashes. With
+ * this many bits per data object and hashes per lookup about 1% of
+ * lookups of absent data are false positives. */
+#define DATA_BLOOM_FILTER_BITS_PER_DATA 10
+#define DATA_BLOOM_FILTER_N_HASHES 7
+
+/* How many fields to keep compression statistics for at max */
+#define COMPRESS_STATS_MAX 256
+
+/* How many times we try to compress payloads of a field before we
+ * decide whether it's worth it */
+#define COMPRESS_PROBE_MIN 16
+
+/* If a field does not compress well, try again every so often, in
+ * case its contents changed */
+#define COMPRESS_REPROBE_INTERVAL 256
 
 /* This is the minimum journal file size */
 #define JOURNAL_FILE_SIZE_MIN (4ULL*1024ULL*1024ULL)           /* 4 MiB */
 
+/* Files are grown by a quarter of their size at once, but by at
+ * least FILE_SIZE_INCREASE_MIN and at most FILE_SIZE_INCREASE_MAX.
+ * This keeps the number of fallocate() calls and of extents low,
+ * which matters particularly on copy-on-write file systems */
+#define FILE_SIZE_INCREASE_MIN (8ULL*1024ULL*1024ULL)          /* 8 MiB */
+#define FILE_SIZE_INCREASE_MAX (64ULL*1024ULL*1024ULL)         /* 64 MiB */
+
 /* These are the lower and upper bounds if we deduce the max_use value
  * from the file system size */
 #define DEFAULT_MAX_USE_LOWER (1ULL*1024ULL*1024ULL)           /* 1 MiB */
@@ -65,6 +101,10 @@
 /* n_data was the first entry we added after the initial file format design */
 #define HEADER_SIZE_MIN ALIGN64(offsetof(Header, n_data))
 
+/* If a hash chain of the predecessor got longer than this, make the
+ * hash table of its successor larger */
+#define HASH_CHAIN_DEPTH_MAX 16
+
 /* How many entries to keep in the entry array chain cache at max */
 #define CHAIN_CACHE_MAX 20
 
@@ -103,16 +143,23 @@ int journal_file_set_offline(JournalFile *f) {
         if (f->header->state != STATE_ONLINE)
                 return 0;
 
-        fsync(f->fd);
+        /* The file size only changes through posix_fallocate(),
+         * which fdatasync() takes care of, and we don't care about
+         * the timestamps, hence skip the inode metadata */
+        fdatasync(f->fd);
 
         f->header->state = STATE_OFFLINE;
 
-        fsync(f->fd);
+        fdatasync(f->fd);
 
         return 0;
 }
 
 void journal_file_close(JournalFile *f) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+        unsigned i;
+#endif
+
         assert(f);
 
 #ifdef HAVE_GCRYPT
@@ -121,6 +168,16 @@ void journal_file_close(JournalFile *f) {
                 journal_file_append_tag(f);
 #endif
 
+        /* Make sure readers learn about entries whose notification
+         * was deferred */
+        if (f->post_change_pending && f->fd >= 0)
+                journal_file_post_change(f);
+
+        if (f->fd_limit && f->fd >= 0) {
+                LIST_REMOVE(JournalFile, fd_lru, f->fd_limit->lru, f);
+                f->fd_limit->n_open--;
+        }
+
         /* Sync everything to disk, before we mark the file offline */
         if (f->mmap && f->fd >= 0)
                 mmap_cache_close_fd(f->mmap, f->fd);
@@ -139,9 +196,13 @@ void journal_file_close(JournalFile *f) {
                 mmap_cache_unref(f->mmap);
 
         hashmap_free_free(f->chain_cache);
+        hashmap_free_free(f->compress_stats);
 
-#ifdef HAVE_XZ
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
         free(f->compress_buffer);
+
+        for (i = 0; i < UNCOMPRESS_CACHE_SIZE; i++)
+                free(f->uncompress_cache[i].buffer);
 #endif
 
 #ifdef HAVE_GCRYPT
@@ -151,6 +212,7 @@ void journal_file_close(JournalFile *f) {
                 free(f->fsprg_state);
 
         free(f->fsprg_seed);
+        free(f->fsprg_msk);
 
         if (f->hmac)
                 gcry_md_close(f->hmac);
@@ -159,6 +221,26 @@ void journal_file_close(JournalFile *f) {
         free(f);
 }
 
+static bool journal_file_use_xxhash64(void) {
+        const char *e;
+        int r;
+
+        /* New files hash with xxhash64 unless explicitly told
+         * otherwise, so that files may be generated for older
+         * readers which only know Jenkins' hash. */
+        e = getenv("SYSTEMD_JOURNAL_XXHASH64");
+        if (!e)
+                return true;
+
+        r = parse_boolean(e);
+        if (r < 0) {
+                log_debug("Failed to parse $SYSTEMD_JOURNAL_XXHASH64, ignoring.");
+                return true;
+        }
+
+        return r;
+}
+
 static int journal_file_init_header(JournalFile *f, JournalFile *template) {
         Header h;
         ssize_t k;
@@ -171,7 +253,11 @@ static int journal_file_init_header(JournalFile *f, JournalFile *template) {
         h.header_size = htole64(ALIGN64(sizeof(h)));
 
         h.incompatible_flags =
-                htole32(f->compress ? HEADER_INCOMPATIBLE_COMPRESSED : 0);
+                htole32(f->compress == OBJECT_COMPRESSED_XZ ? HEADER_INCOMPATIBLE_COMPRESSED_XZ :
+                        f->compress == OBJECT_COMPRESSED_LZ4 ? HEADER_INCOMPATIBLE_COMPRESSED_LZ4 : 0);
+
+        if (journal_file_use_xxhash64())
+                h.incompatible_flags |= htole32(HEADER_INCOMPATIBLE_XXHASH64);
 
         h.compatible_flags =
                 htole32(f->seal ? HEADER_COMPATIBLE_SEALED : 0);
@@ -225,6 +311,8 @@ static int journal_file_refresh_header(JournalFile *f) {
 }
 
 static int journal_file_verify_header(JournalFile *f) {
+        uint32_t supported = HEADER_INCOMPATIBLE_XXHASH64;
+
         assert(f);
 
         if (memcmp(f->header->signature, HEADER_SIGNATURE, 8))
@@ -233,23 +321,23 @@ static int journal_file_verify_header(JournalFile *f) {
         /* In both read and write mode we refuse to open files with
          * incompatible flags we don't know */
 #ifdef HAVE_XZ
-        if ((le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_COMPRESSED) != 0)
-                return -EPROTONOSUPPORT;
-#else
-        if (f->header->incompatible_flags != 0)
-                return -EPROTONOSUPPORT;
+        supported |= HEADER_INCOMPATIBLE_COMPRESSED_XZ;
 #endif
+#ifdef HAVE_LZ4
+        supported |= HEADER_INCOMPATIBLE_COMPRESSED_LZ4;
+#endif
+        if ((le32toh(f->header->incompatible_flags) & ~supported) != 0)
+                return -EPROTONOSUPPORT;
 
         /* When open for writing we refuse to open files with
          * compatible flags, too */
         if (f->writable) {
+                supported = HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX;
 #ifdef HAVE_GCRYPT
-                if ((le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SEALED) != 0)
-                        return -EPROTONOSUPPORT;
-#else
-                if (f->header->compatible_flags != 0)
-                        return -EPROTONOSUPPORT;
+                supported |= HEADER_COMPATIBLE_SEALED;
 #endif
+                if ((le32toh(f->header->compatible_flags) & ~supported) != 0)
+                        return -EPROTONOSUPPORT;
         }
 
         if (f->header->state >= _STATE_MAX)
@@ -262,6 +350,24 @@ static int journal_file_verify_header(JournalFile *f) {
         if (JOURNAL_HEADER_SEALED(f->header) && !JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
                 return -EBADMSG;
 
+        if (JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header)) {
+                if (!JOURNAL_HEADER_CONTAINS(f->header, entry_array_index_hash_table_size))
+                        return -EBADMSG;
+
+                if (!VALID64(le64toh(f->header->entry_array_index_hash_table_offset)) ||
+                    le64toh(f->header->entry_array_index_hash_table_offset) < le64toh(f->header->header_size))
+                        return -ENODATA;
+        }
+
+        if (JOURNAL_HEADER_DATA_BLOOM_FILTER(f->header)) {
+                if (!JOURNAL_HEADER_CONTAINS(f->header, data_bloom_filter_size))
+                        return -EBADMSG;
+
+                if (!VALID64(le64toh(f->header->data_bloom_filter_offset)) ||
+                    le64toh(f->header->data_bloom_filter_offset) < le64toh(f->header->header_size))
+                        return -ENODATA;
+        }
+
         if ((le64toh(f->header->header_size) + le64toh(f->header->arena_size)) > (uint64_t) f->last_stat.st_size)
                 return -ENODATA;
 
@@ -305,7 +411,12 @@ static int journal_file_verify_header(JournalFile *f) {
                 }
         }
 
-        f->compress = JOURNAL_HEADER_COMPRESSED(f->header);
+        if (JOURNAL_HEADER_COMPRESSED_LZ4(f->header))
+                f->compress = OBJECT_COMPRESSED_LZ4;
+        else if (JOURNAL_HEADER_COMPRESSED_XZ(f->header))
+                f->compress = OBJECT_COMPRESSED_XZ;
+        else
+                f->compress = 0;
 
         f->seal = JOURNAL_HEADER_SEALED(f->header);
 
@@ -313,7 +424,7 @@ static int journal_file_verify_header(JournalFile *f) {
 }
 
 static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size) {
-        uint64_t old_size, new_size;
+        uint64_t old_size, new_size, want_size;
         int r;
 
         assert(f);
@@ -337,7 +448,15 @@ static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size)
             new_size > f->metrics.max_size)
                 return -E2BIG;
 
-        if (new_size > f->metrics.min_size &&
+        /* Don't grow page by page, but in large steps, see above */
+        want_size = PAGE_ALIGN(old_size + CLAMP(old_size / 4, FILE_SIZE_INCREASE_MIN, FILE_SIZE_INCREASE_MAX));
+        if (want_size < new_size)
+                want_size = new_size;
+        if (f->metrics.max_size > 0 &&
+            want_size > f->metrics.max_size)
+                want_size = f->metrics.max_size;
+
+        if (want_size > f->metrics.min_size &&
             f->metrics.keep_free > 0) {
                 struct statvfs svfs;
 
@@ -351,33 +470,152 @@ static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size)
                         else
                                 available = 0;
 
-                        if (new_size - old_size > available)
+                        /* If the large step doesn't fit anymore,
+                         * fall back to growing only as much as
+                         * needed */
+                        if (want_size - old_size > available)
+                                want_size = new_size;
+
+                        if (new_size > f->metrics.min_size &&
+                            new_size - old_size > available)
                                 return -E2BIG;
                 }
         }
 
         /* Note that the glibc fallocate() fallback is very
-           inefficient, hence we try to minimize the allocation area
-           as we can. */
-        r = posix_fallocate(f->fd, old_size, new_size - old_size);
+           inefficient, as it writes out the whole area. */
+        TRACE3(journal_allocate_begin, f->path, old_size, want_size);
+        r = posix_fallocate(f->fd, old_size, want_size - old_size);
+        TRACE2(journal_allocate_end, f->path, r);
         if (r != 0)
                 return -r;
 
         if (fstat(f->fd, &f->last_stat) < 0)
                 return -errno;
 
-        f->header->arena_size = htole64(new_size - le64toh(f->header->header_size));
+        f->header->arena_size = htole64(want_size - le64toh(f->header->header_size));
+
+        return 0;
+}
+
+static void journal_fd_limit_trim(JournalFdLimit *l, JournalFile *keep) {
+        JournalFile *i, *tail;
+
+        assert(l);
+
+        if (l->n_open <= l->max_open || !l->lru)
+                return;
+
+        LIST_FIND_TAIL(JournalFile, fd_lru, l->lru, tail);
+
+        /* Only archived files are closed: they are never written to
+         * or renamed anymore, so that reopening them by path is
+         * safe. Online files stay open regardless of the limit. */
+        for (i = tail; i && l->n_open > l->max_open; ) {
+                JournalFile *p = i->fd_lru_prev;
+
+                if (i != keep && i->header->state == STATE_ARCHIVED)
+                        journal_file_close_fd(i);
+
+                i = p;
+        }
+}
+
+void journal_file_set_fd_limit(JournalFile *f, JournalFdLimit *l) {
+        assert(f);
+        assert(l);
+        assert(!f->writable);
+        assert(!f->fd_limit);
+        assert(f->fd >= 0);
+
+        f->fd_limit = l;
+        LIST_PREPEND(JournalFile, fd_lru, l->lru, f);
+        l->n_open++;
+
+        journal_fd_limit_trim(l, f);
+}
+
+void journal_file_close_fd(JournalFile *f) {
+        assert(f);
+        assert(!f->writable);
+
+        if (f->fd < 0)
+                return;
+
+        if (f->fd_limit) {
+                LIST_REMOVE(JournalFile, fd_lru, f->fd_limit->lru, f);
+                f->fd_limit->n_open--;
+        }
+
+        /* This unmaps all windows of the file, hence also whatever
+         * pointers we kept into them */
+        mmap_cache_close_fd(f->mmap, f->fd);
+        close_nointr_nofail(f->fd);
+        f->fd = -1;
+
+        f->data_hash_table = NULL;
+        f->field_hash_table = NULL;
+        f->entry_array_index_hash_table = NULL;
+        f->data_bloom_filter = NULL;
+        f->hash_tables_mapped = false;
+}
+
+static int journal_file_reopen_fd(JournalFile *f) {
+        struct stat st;
+        int fd, r;
+
+        assert(f);
+        assert(f->fd < 0);
+        assert(f->fd_limit);
+
+        fd = open(f->path, f->flags|O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0) {
+                r = -errno;
+                close_nointr_nofail(fd);
+                return r;
+        }
+
+        /* Make sure this is still the file we opened originally */
+        if (st.st_dev != f->last_stat.st_dev ||
+            st.st_ino != f->last_stat.st_ino) {
+                close_nointr_nofail(fd);
+                return -ESTALE;
+        }
+
+        f->fd = fd;
+        f->last_stat = st;
+
+        LIST_PREPEND(JournalFile, fd_lru, f->fd_limit->lru, f);
+        f->fd_limit->n_open++;
+
+        journal_fd_limit_trim(f->fd_limit, f);
 
         return 0;
 }
 
 static int journal_file_move_to(JournalFile *f, int context, bool keep_always, uint64_t offset, uint64_t size, void **ret) {
+        int r;
+
         assert(f);
         assert(ret);
 
         if (size <= 0)
                 return -EINVAL;
 
+        if (f->fd_limit) {
+                if (f->fd < 0) {
+                        r = journal_file_reopen_fd(f);
+                        if (r < 0)
+                                return r;
+                } else if (f->fd_limit->lru != f) {
+                        LIST_REMOVE(JournalFile, fd_lru, f->fd_limit->lru, f);
+                        LIST_PREPEND(JournalFile, fd_lru, f->fd_limit->lru, f);
+                }
+        }
+
         /* Avoid SIGBUS on invalid accesses */
         if (offset + size > (uint64_t) f->last_stat.st_size) {
                 /* Hmm, out of range? Let's refresh the fstat() data
@@ -401,6 +639,9 @@ static uint64_t minimum_header_size(Object *o) {
                 [OBJECT_FIELD_HASH_TABLE] = sizeof(HashTableObject),
                 [OBJECT_ENTRY_ARRAY] = sizeof(EntryArrayObject),
                 [OBJECT_TAG] = sizeof(TagObject),
+                [OBJECT_ENTRY_ARRAY_INDEX_HASH_TABLE] = sizeof(HashTableObject),
+                [OBJECT_ENTRY_ARRAY_INDEX] = sizeof(EntryArrayIndexObject),
+                [OBJECT_DATA_BLOOM_FILTER] = sizeof(DataBloomFilterObject),
         };
 
         if (o->object.type >= ELEMENTSOF(table) || table[o->object.type] <= 0)
@@ -533,7 +774,23 @@ int journal_file_append_object(JournalFile *f, int type, uint64_t size, Object *
         return 0;
 }
 
-static int journal_file_setup_data_hash_table(JournalFile *f) {
+static uint64_t hash_table_size_from_template(uint64_t n_objects, uint64_t depth, uint64_t min, uint64_t max) {
+        uint64_t s;
+
+        /* The predecessor of a file is a good predictor of how many
+         * objects it will end up with. We want to stay below 75%
+         * fill level, and if the chains got long nonetheless we
+         * assume the hash values are skewed and add some more
+         * room. */
+
+        s = n_objects * 4 / 3;
+        if (depth > HASH_CHAIN_DEPTH_MAX)
+                s *= 2;
+
+        return CLAMP(s * sizeof(HashItem), min, max);
+}
+
+static int journal_file_setup_data_hash_table(JournalFile *f, JournalFile *template) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -549,6 +806,13 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         if (s < DEFAULT_DATA_HASH_TABLE_SIZE)
                 s = DEFAULT_DATA_HASH_TABLE_SIZE;
 
+        /* If we are replacing a file, size the table after what was
+         * actually stored in it, but never much beyond the estimate */
+        if (template && JOURNAL_HEADER_CONTAINS(template->header, data_hash_chain_depth))
+                s = hash_table_size_from_template(le64toh(template->header->n_data),
+                                                  le64toh(template->header->data_hash_chain_depth),
+                                                  DEFAULT_DATA_HASH_TABLE_SIZE, s * 4);
+
         log_debug("Reserving %llu entries in hash table.", (unsigned long long) (s / sizeof(HashItem)));
 
         r = journal_file_append_object(f,
@@ -566,7 +830,7 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         return 0;
 }
 
-static int journal_file_setup_field_hash_table(JournalFile *f) {
+static int journal_file_setup_field_hash_table(JournalFile *f, JournalFile *template) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -574,9 +838,15 @@ static int journal_file_setup_field_hash_table(JournalFile *f) {
         assert(f);
 
         /* We use a fixed size hash table for the fields as this
-         * number should grow very slowly only */
+         * number should grow very slowly only, unless our
+         * predecessor showed otherwise */
 
         s = DEFAULT_FIELD_HASH_TABLE_SIZE;
+
+        if (template && JOURNAL_HEADER_CONTAINS(template->header, field_hash_chain_depth))
+                s = hash_table_size_from_template(le64toh(template->header->n_fields),
+                                                  le64toh(template->header->field_hash_chain_depth),
+                                                  DEFAULT_FIELD_HASH_TABLE_SIZE, DEFAULT_FIELD_HASH_TABLE_SIZE * 16);
         r = journal_file_append_object(f,
                                        OBJECT_FIELD_HASH_TABLE,
                                        offsetof(Object, hash_table.items) + s,
@@ -592,6 +862,33 @@ static int journal_file_setup_field_hash_table(JournalFile *f) {
         return 0;
 }
 
+static int journal_file_setup_entry_array_index_hash_table(JournalFile *f) {
+        uint64_t s, p;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        /* Only long entry array chains are indexed, hence a fixed
+         * size hash table suffices here too */
+
+        s = DEFAULT_ENTRY_ARRAY_INDEX_HASH_TABLE_SIZE;
+        r = journal_file_append_object(f,
+                                       OBJECT_ENTRY_ARRAY_INDEX_HASH_TABLE,
+                                       offsetof(Object, hash_table.items) + s,
+                                       &o, &p);
+        if (r < 0)
+                return r;
+
+        memset(o->hash_table.items, 0, s);
+
+        f->header->entry_array_index_hash_table_offset = htole64(p + offsetof(Object, hash_table.items));
+        f->header->entry_array_index_hash_table_size = htole64(s);
+        f->header->compatible_flags |= htole32(HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX);
+
+        return 0;
+}
+
 static int journal_file_map_data_hash_table(JournalFile *f) {
         uint64_t s, p;
         void *t;
@@ -636,6 +933,215 @@ static int journal_file_map_field_hash_table(JournalFile *f) {
         return 0;
 }
 
+static int journal_file_map_entry_array_index_hash_table(JournalFile *f) {
+        uint64_t s, p;
+        void *t;
+        int r;
+
+        assert(f);
+
+        if (!JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header))
+                return 0;
+
+        p = le64toh(f->header->entry_array_index_hash_table_offset);
+        s = le64toh(f->header->entry_array_index_hash_table_size);
+
+        if (s < sizeof(HashItem))
+                return -EBADMSG;
+
+        r = journal_file_move_to(f,
+                                 OBJECT_ENTRY_ARRAY_INDEX_HASH_TABLE,
+                                 true,
+                                 p, s,
+                                 &t);
+        if (r < 0)
+                return r;
+
+        f->entry_array_index_hash_table = t;
+        return 0;
+}
+
+static void journal_file_map_data_bloom_filter(JournalFile *f) {
+        uint64_t s, p;
+        Object *o;
+        void *t;
+        int r;
+
+        assert(f);
+
+        if (!JOURNAL_HEADER_DATA_BLOOM_FILTER(f->header))
+                return;
+
+        p = le64toh(f->header->data_bloom_filter_offset);
+        s = le64toh(f->header->data_bloom_filter_size);
+
+        /* The filter is only an optimization. If anything is off
+         * with it we just do without. */
+        if (s <= 0)
+                return;
+
+        r = journal_file_move_to(f,
+                                 OBJECT_DATA_BLOOM_FILTER,
+                                 true,
+                                 p, offsetof(Object, data_bloom_filter.bits) + s,
+                                 &t);
+        if (r < 0) {
+                log_debug("Failed to map data Bloom filter of %s: %s", f->path, strerror(-r));
+                return;
+        }
+
+        o = t;
+        if (o->object.type != OBJECT_DATA_BLOOM_FILTER ||
+            le64toh(o->object.size) != offsetof(Object, data_bloom_filter.bits) + s ||
+            le64toh(o->data_bloom_filter.n_data) != le64toh(f->header->n_data) ||
+            le64toh(o->data_bloom_filter.n_hashes) <= 0 ||
+            le64toh(o->data_bloom_filter.n_hashes) > 64) {
+                log_debug("Data Bloom filter of %s is invalid, ignoring.", f->path);
+                return;
+        }
+
+        f->data_bloom_filter = &o->data_bloom_filter;
+}
+
+int journal_file_map_hash_tables(JournalFile *f) {
+        int r;
+
+        assert(f);
+
+        if (f->hash_tables_mapped)
+                return 0;
+
+        r = journal_file_map_field_hash_table(f);
+        if (r < 0)
+                return r;
+
+        r = journal_file_map_data_hash_table(f);
+        if (r < 0)
+                return r;
+
+        r = journal_file_map_entry_array_index_hash_table(f);
+        if (r < 0)
+                return r;
+
+        if (!f->writable)
+                journal_file_map_data_bloom_filter(f);
+
+        f->hash_tables_mapped = true;
+        return 0;
+}
+
+static uint64_t data_bloom_filter_bit(uint64_t hash, uint64_t i, uint64_t n_bits) {
+
+        /* The data hashes are 64 bit wide and of decent quality, so
+         * derive all bit positions from them by double hashing */
+        return ((hash & 0xffffffffULL) + i * ((hash >> 32) | 1)) % n_bits;
+}
+
+static bool journal_file_data_bloom_filter_test(JournalFile *f, uint64_t hash) {
+        uint64_t n_bits, n, i;
+
+        assert(f);
+
+        if (!f->data_bloom_filter)
+                return true;
+
+        n_bits = le64toh(f->header->data_bloom_filter_size) * 8;
+        n = le64toh(f->data_bloom_filter->n_hashes);
+
+        for (i = 0; i < n; i++) {
+                uint64_t b;
+
+                b = data_bloom_filter_bit(hash, i, n_bits);
+                if (!(f->data_bloom_filter->bits[b / 8] & (1U << (b % 8))))
+                        return false;
+        }
+
+        return true;
+}
+
+static int journal_file_append_data_bloom_filter(JournalFile *f) {
+        uint8_t _cleanup_free_ *bits = NULL;
+        uint64_t n_data, n_bits, s, n = 0, h, m, q;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        /* Archived files never change anymore, hence we can record
+         * which data they contain, so that readers looking for
+         * something else can skip them without touching their hash
+         * table. */
+
+        if (!f->writable || f->header->state != STATE_ONLINE)
+                return 0;
+
+        if (!JOURNAL_HEADER_CONTAINS(f->header, data_bloom_filter_size) ||
+            JOURNAL_HEADER_DATA_BLOOM_FILTER(f->header))
+                return 0;
+
+        n_data = le64toh(f->header->n_data);
+        if (n_data <= 0)
+                return 0;
+
+        s = ALIGN64((n_data * DATA_BLOOM_FILTER_BITS_PER_DATA + 7) / 8);
+        n_bits = s * 8;
+
+        bits = malloc0(s);
+        if (!bits)
+                return -ENOMEM;
+
+        m = le64toh(f->header->data_hash_table_size) / sizeof(HashItem);
+        for (h = 0; h < m; h++) {
+                uint64_t p;
+
+                p = le64toh(f->data_hash_table[h].head_hash_offset);
+                while (p > 0) {
+                        uint64_t hash, i;
+
+                        r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                        if (r < 0)
+                                return r;
+
+                        hash = le64toh(o->data.hash);
+                        for (i = 0; i < DATA_BLOOM_FILTER_N_HASHES; i++) {
+                                uint64_t b;
+
+                                b = data_bloom_filter_bit(hash, i, n_bits);
+                                bits[b / 8] |= 1U << (b % 8);
+                        }
+
+                        n++;
+                        p = le64toh(o->data.next_hash_offset);
+                }
+        }
+
+        /* Better no filter than one that misses something */
+        if (n != n_data)
+                return -EBADMSG;
+
+        r = journal_file_append_object(f, OBJECT_DATA_BLOOM_FILTER,
+                                       offsetof(Object, data_bloom_filter.bits) + s,
+                                       &o, &q);
+        if (r < 0)
+                return r;
+
+        o->data_bloom_filter.n_data = htole64(n_data);
+        o->data_bloom_filter.n_hashes = htole64(DATA_BLOOM_FILTER_N_HASHES);
+        memcpy(o->data_bloom_filter.bits, bits, s);
+
+#ifdef HAVE_GCRYPT
+        r = journal_file_hmac_put_object(f, OBJECT_DATA_BLOOM_FILTER, o, q);
+        if (r < 0)
+                return r;
+#endif
+
+        f->header->data_bloom_filter_offset = htole64(q);
+        f->header->data_bloom_filter_size = htole64(s);
+        f->header->compatible_flags |= htole32(HEADER_COMPATIBLE_DATA_BLOOM_FILTER);
+
+        return 0;
+}
+
 static int journal_file_link_field(
                 JournalFile *f,
                 Object *o,
@@ -727,7 +1233,7 @@ int journal_file_find_field_object_with_hash(
                 const void *field, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h;
+        uint64_t p, osize, h, depth = 0;
         int r;
 
         assert(f);
@@ -738,12 +1244,18 @@ int journal_file_find_field_object_with_hash(
         if (f->header->field_hash_table_size == 0)
                 return -EBADMSG;
 
+        r = journal_file_map_hash_tables(f);
+        if (r < 0)
+                return r;
+
         h = hash % (le64toh(f->header->field_hash_table_size) / sizeof(HashItem));
         p = le64toh(f->field_hash_table[h].head_hash_offset);
 
         while (p > 0) {
                 Object *o;
 
+                depth++;
+
                 r = journal_file_move_to_object(f, OBJECT_FIELD, p, &o);
                 if (r < 0)
                         return r;
@@ -763,6 +1275,13 @@ int journal_file_find_field_object_with_hash(
                 p = le64toh(o->field.next_hash_offset);
         }
 
+        /* Remember the longest chain we had to walk, so that our
+         * successor can be sized accordingly */
+        if (f->writable &&
+            JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth) &&
+            depth > le64toh(f->header->field_hash_chain_depth))
+                f->header->field_hash_chain_depth = htole64(depth);
+
         return 0;
 }
 
@@ -776,7 +1295,7 @@ int journal_file_find_field_object(
         assert(f);
         assert(field && size > 0);
 
-        hash = hash64(field, size);
+        hash = journal_file_hash_data(f, field, size);
 
         return journal_file_find_field_object_with_hash(f,
                                                         field, size, hash,
@@ -788,7 +1307,7 @@ int journal_file_find_data_object_with_hash(
                 const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h;
+        uint64_t p, osize, h, depth = 0;
         int r;
 
         assert(f);
@@ -799,12 +1318,21 @@ int journal_file_find_data_object_with_hash(
         if (f->header->data_hash_table_size == 0)
                 return -EBADMSG;
 
+        r = journal_file_map_hash_tables(f);
+        if (r < 0)
+                return r;
+
+        if (!journal_file_data_bloom_filter_test(f, hash))
+                return 0;
+
         h = hash % (le64toh(f->header->data_hash_table_size) / sizeof(HashItem));
         p = le64toh(f->data_hash_table[h].head_hash_offset);
 
         while (p > 0) {
                 Object *o;
 
+                depth++;
+
                 r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
                 if (r < 0)
                         return r;
@@ -812,8 +1340,8 @@ int journal_file_find_data_object_with_hash(
                 if (le64toh(o->data.hash) != hash)
                         goto next;
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
+                if (o->object.flags & OBJECT_COMPRESSION_MASK) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
                         uint64_t l, rsize;
 
                         l = le64toh(o->object.size);
@@ -822,7 +1350,8 @@ int journal_file_find_data_object_with_hash(
 
                         l -= offsetof(Object, data.payload);
 
-                        if (!uncompress_blob(o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, 0))
+                        if (!uncompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                                             o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, 0))
                                 return -EBADMSG;
 
                         if (rsize == size &&
@@ -856,6 +1385,11 @@ int journal_file_find_data_object_with_hash(
                 p = le64toh(o->data.next_hash_offset);
         }
 
+        if (f->writable &&
+            JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth) &&
+            depth > le64toh(f->header->data_hash_chain_depth))
+                f->header->data_hash_chain_depth = htole64(depth);
+
         return 0;
 }
 
@@ -869,7 +1403,7 @@ int journal_file_find_data_object(
         assert(f);
         assert(data || size == 0);
 
-        hash = hash64(data, size);
+        hash = journal_file_hash_data(f, data, size);
 
         return journal_file_find_data_object_with_hash(f,
                                                        data, size, hash,
@@ -889,7 +1423,7 @@ static int journal_file_append_field(
         assert(f);
         assert(field && size > 0);
 
-        hash = hash64(field, size);
+        hash = journal_file_hash_data(f, field, size);
 
         r = journal_file_find_field_object_with_hash(f, field, size, hash, &o, &p);
         if (r < 0)
@@ -938,12 +1472,200 @@ static int journal_file_append_field(
         return 0;
 }
 
-static int journal_file_append_data(
+static int data_cache_get(
                 JournalFile *f,
-                const void *data, uint64_t size,
+                const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t hash, p;
+        DataCacheItem *ci;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        ci = f->data_cache + (hash % DATA_CACHE_SIZE);
+        if (ci->offset == 0 || ci->hash != hash || ci->size != size)
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, ci->offset, &o);
+        if (r < 0)
+                return r;
+
+        /* Only uncompressed objects are put into the cache, but
+         * let's verify the payload nonetheless, the hash is not
+         * enough to identify it. */
+        if ((o->object.flags & OBJECT_COMPRESSION_MASK) ||
+            le64toh(o->object.size) != offsetof(Object, data.payload) + size ||
+            (size > 0 && memcmp(o->data.payload, data, size) != 0))
+                return 0;
+
+        if (ret)
+                *ret = o;
+
+        if (offset)
+                *offset = ci->offset;
+
+        return 1;
+}
+
+static void data_cache_put(JournalFile *f, Object *o, uint64_t size, uint64_t offset) {
+        DataCacheItem *ci;
+        uint64_t hash;
+
+        assert(f);
+        assert(o);
+
+        if (o->object.flags & OBJECT_COMPRESSION_MASK)
+                return;
+
+        hash = le64toh(o->data.hash);
+
+        ci = f->data_cache + (hash % DATA_CACHE_SIZE);
+        ci->hash = hash;
+        ci->size = size;
+        ci->offset = offset;
+}
+
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+UncompressCacheItem *journal_file_uncompress_cache_get(JournalFile *f, uint64_t p, uint64_t threshold) {
+        unsigned i;
+
+        assert(f);
+        assert(p > 0);
+
+        for (i = 0; i < UNCOMPRESS_CACHE_SIZE; i++) {
+                UncompressCacheItem *ci = f->uncompress_cache + i;
+
+                if (ci->offset != p)
+                        continue;
+
+                /* Whatever was decompressed in full is good for any
+                 * threshold, a truncated copy only for the same
+                 * one */
+                if (ci->threshold != threshold &&
+                    ci->threshold != 0 &&
+                    ci->size >= ci->threshold)
+                        continue;
+
+                ci->last_used = ++f->uncompress_cache_clock;
+                return ci;
+        }
+
+        return NULL;
+}
+
+UncompressCacheItem *journal_file_uncompress_cache_add(JournalFile *f, uint64_t threshold) {
+        UncompressCacheItem *ci = NULL;
+        unsigned i;
+
+        assert(f);
+
+        /* Picks the least recently used slot. It is invalid until the
+         * caller filled it in and set the offset. */
+        for (i = 0; i < UNCOMPRESS_CACHE_SIZE; i++)
+                if (!ci || f->uncompress_cache[i].last_used < ci->last_used)
+                        ci = f->uncompress_cache + i;
+
+        ci->offset = 0;
+        ci->threshold = threshold;
+        ci->size = 0;
+        ci->last_used = ++f->uncompress_cache_clock;
+
+        return ci;
+}
+
+typedef struct CompressStat {
+        uint64_t hash; /* of the field name */
+        unsigned n_tried;
+        unsigned n_compressed;
+        unsigned n_skipped;
+} CompressStat;
+
+static CompressStat* compress_stat_get(JournalFile *f, const void *data, const void *eq) {
+        CompressStat *cs;
+        uint64_t h;
+
+        assert(f);
+
+        if (!eq || eq <= data)
+                return NULL;
+
+        if (!f->compress_stats) {
+                f->compress_stats = hashmap_new(uint64_hash_func, uint64_compare_func);
+                if (!f->compress_stats)
+                        return NULL;
+        }
+
+        h = hash64(data, (const uint8_t*) eq - (const uint8_t*) data);
+
+        cs = hashmap_get(f->compress_stats, &h);
+        if (cs)
+                return cs;
+
+        if (hashmap_size(f->compress_stats) >= COMPRESS_STATS_MAX)
+                /* If the cache is full, let's drop an old item */
+                cs = hashmap_steal_first(f->compress_stats);
+        else {
+                cs = new(CompressStat, 1);
+                if (!cs)
+                        return NULL;
+        }
+
+        zero(*cs);
+        cs->hash = h;
+
+        if (hashmap_put(f->compress_stats, &cs->hash, cs) < 0) {
+                free(cs);
+                return NULL;
+        }
+
+        return cs;
+}
+
+static bool compress_stat_should_try(CompressStat *cs) {
+
+        /* Without statistics (data without field name, or OOM)
+         * we always try */
+        if (!cs)
+                return true;
+
+        if (cs->n_tried < COMPRESS_PROBE_MIN)
+                return true;
+
+        /* Keep trying as long as at least every fourth payload
+         * gets shorter */
+        if (cs->n_compressed * 4 >= cs->n_tried)
+                return true;
+
+        cs->n_skipped++;
+        return cs->n_skipped % COMPRESS_REPROBE_INTERVAL == 0;
+}
+
+static void compress_stat_account(JournalFile *f, CompressStat *cs, bool compressed, uint64_t saved) {
+        assert(f);
+
+        if (cs) {
+                cs->n_tried++;
+                if (compressed)
+                        cs->n_compressed++;
+        }
+
+        if (compressed) {
+                if (JOURNAL_HEADER_CONTAINS(f->header, n_compressed))
+                        f->header->n_compressed = htole64(le64toh(f->header->n_compressed) + 1);
+                if (JOURNAL_HEADER_CONTAINS(f->header, compress_saved_bytes))
+                        f->header->compress_saved_bytes = htole64(le64toh(f->header->compress_saved_bytes) + saved);
+        } else if (JOURNAL_HEADER_CONTAINS(f->header, n_compress_failed))
+                f->header->n_compress_failed = htole64(le64toh(f->header->n_compress_failed) + 1);
+}
+#endif
+
+static int journal_file_append_data_with_hash(
+                JournalFile *f,
+                const void *data, uint64_t size, uint64_t hash,
+                Object **ret, uint64_t *offset) {
+
+        uint64_t p;
         uint64_t osize;
         Object *o;
         int r;
@@ -953,13 +1675,15 @@ static int journal_file_append_data(
         assert(f);
         assert(data || size == 0);
 
-        hash = hash64(data, size);
-
-        r = journal_file_find_data_object_with_hash(f, data, size, hash, &o, &p);
+        r = data_cache_get(f, data, size, hash, &o, &p);
+        if (r == 0)
+                r = journal_file_find_data_object_with_hash(f, data, size, hash, &o, &p);
         if (r < 0)
                 return r;
         else if (r > 0) {
 
+                data_cache_put(f, o, size, p);
+
                 if (ret)
                         *ret = o;
 
@@ -976,19 +1700,31 @@ static int journal_file_append_data(
 
         o->data.hash = htole64(hash);
 
-#ifdef HAVE_XZ
+        eq = memchr(data, '=', size);
+
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
         if (f->compress &&
-            size >= COMPRESSION_SIZE_THRESHOLD) {
+            size >= f->compress_threshold_bytes) {
+                CompressStat *cs;
                 uint64_t rsize;
 
-                compressed = compress_blob(data, size, o->data.payload, &rsize);
+                /* Only try to compress payloads of fields that
+                 * turned out to be compressible in the past */
+                cs = compress_stat_get(f, data, eq);
+                if (compress_stat_should_try(cs)) {
+                        compressed = compress_blob(f->compress, data, size, o->data.payload, &rsize);
+                        compress_stat_account(f, cs, compressed, compressed ? size - rsize : 0);
 
-                if (compressed) {
-                        o->object.size = htole64(offsetof(Object, data.payload) + rsize);
-                        o->object.flags |= OBJECT_COMPRESSED;
+                        if (compressed) {
+                                o->object.size = htole64(offsetof(Object, data.payload) + rsize);
+                                o->object.flags |= f->compress;
 
-                        log_debug("Compressed data object %lu -> %lu", (unsigned long) size, (unsigned long) rsize);
-                }
+                                log_debug("Compressed data object %lu -> %lu using %s",
+                                          (unsigned long) size, (unsigned long) rsize,
+                                          object_compressed_to_string(f->compress));
+                        }
+                } else if (JOURNAL_HEADER_CONTAINS(f->header, n_compress_skipped))
+                        f->header->n_compress_skipped = htole64(le64toh(f->header->n_compress_skipped) + 1);
         }
 #endif
 
@@ -1005,7 +1741,6 @@ static int journal_file_append_data(
         if (r < 0)
                 return r;
 
-        eq = memchr(data, '=', size);
         if (eq && eq > data) {
                 uint64_t fp;
                 Object *fo;
@@ -1026,6 +1761,8 @@ static int journal_file_append_data(
                 return r;
 #endif
 
+        data_cache_put(f, o, size, p);
+
         if (ret)
                 *ret = o;
 
@@ -1035,6 +1772,17 @@ static int journal_file_append_data(
         return 0;
 }
 
+static int journal_file_append_data(
+                JournalFile *f,
+                const void *data, uint64_t size,
+                Object **ret, uint64_t *offset) {
+
+        assert(f);
+        assert(data || size == 0);
+
+        return journal_file_append_data_with_hash(f, data, size, journal_file_hash_data(f, data, size), ret, offset);
+}
+
 uint64_t journal_file_entry_n_items(Object *o) {
         assert(o);
 
@@ -1053,6 +1801,16 @@ uint64_t journal_file_entry_array_n_items(Object *o) {
         return (le64toh(o->object.size) - offsetof(Object, entry_array.items)) / sizeof(uint64_t);
 }
 
+uint64_t journal_file_hash_data(JournalFile *f, const void *data, size_t sz) {
+        assert(f);
+        assert(data || sz == 0);
+
+        if (JOURNAL_HEADER_XXHASH64(f->header))
+                return xxhash64(data, sz, 0);
+
+        return hash64(data, sz);
+}
+
 uint64_t journal_file_hash_table_n_items(Object *o) {
         assert(o);
 
@@ -1063,12 +1821,195 @@ uint64_t journal_file_hash_table_n_items(Object *o) {
         return (le64toh(o->object.size) - offsetof(Object, hash_table.items)) / sizeof(HashItem);
 }
 
+uint64_t journal_file_entry_array_index_n_items(Object *o) {
+        assert(o);
+
+        if (o->object.type != OBJECT_ENTRY_ARRAY_INDEX)
+                return 0;
+
+        return (le64toh(o->object.size) - offsetof(Object, entry_array_index.items)) / sizeof(EntryArrayIndexItem);
+}
+
+static uint64_t entry_array_index_hash(JournalFile *f, uint64_t first) {
+        le64_t k;
+
+        assert(f);
+
+        k = htole64(first);
+        return hash64(&k, sizeof(k)) % (le64toh(f->header->entry_array_index_hash_table_size) / sizeof(HashItem));
+}
+
+static int journal_file_find_entry_array_index(
+                JournalFile *f,
+                uint64_t first,
+                Object **ret, uint64_t *offset) {
+
+        uint64_t p, h;
+        int r;
+
+        assert(f);
+
+        r = journal_file_map_hash_tables(f);
+        if (r < 0)
+                return r;
+
+        if (!f->entry_array_index_hash_table)
+                return 0;
+
+        h = entry_array_index_hash(f, first);
+        p = le64toh(f->entry_array_index_hash_table[h].head_hash_offset);
+
+        while (p > 0) {
+                Object *o;
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY_INDEX, p, &o);
+                if (r < 0)
+                        return r;
+
+                if (le64toh(o->entry_array_index.first_entry_array_offset) == first) {
+
+                        if (ret)
+                                *ret = o;
+
+                        if (offset)
+                                *offset = p;
+
+                        return 1;
+                }
+
+                p = le64toh(o->entry_array_index.next_hash_offset);
+        }
+
+        return 0;
+}
+
+static int journal_file_link_entry_array_index(JournalFile *f, Object *o, uint64_t offset) {
+        uint64_t p, h;
+        int r;
+
+        assert(f);
+        assert(o);
+        assert(offset > 0);
+
+        /* This might alter the window we are looking at */
+
+        o->entry_array_index.next_hash_offset = 0;
+
+        h = entry_array_index_hash(f, le64toh(o->entry_array_index.first_entry_array_offset));
+        p = le64toh(f->entry_array_index_hash_table[h].tail_hash_offset);
+        if (p == 0)
+                f->entry_array_index_hash_table[h].head_hash_offset = htole64(offset);
+        else {
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY_INDEX, p, &o);
+                if (r < 0)
+                        return r;
+
+                o->entry_array_index.next_hash_offset = htole64(offset);
+        }
+
+        f->entry_array_index_hash_table[h].tail_hash_offset = htole64(offset);
+
+        return 0;
+}
+
+static int journal_file_append_entry_array_index(JournalFile *f, uint64_t first) {
+        uint64_t a, q, n = 0, t = 0;
+        Object *o, *array;
+        int r;
+
+        assert(f);
+        assert(first > 0);
+
+        r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY_INDEX,
+                                       offsetof(Object, entry_array_index.items) + ENTRY_ARRAY_INDEX_ITEMS * sizeof(EntryArrayIndexItem),
+                                       &o, &q);
+        if (r < 0)
+                return r;
+
+#ifdef HAVE_GCRYPT
+        r = journal_file_hmac_put_object(f, OBJECT_ENTRY_ARRAY_INDEX, o, q);
+        if (r < 0)
+                return r;
+#endif
+
+        o->entry_array_index.first_entry_array_offset = htole64(first);
+
+        /* Cover all arrays the chain already consists of */
+        a = first;
+        while (a > 0 && n < ENTRY_ARRAY_INDEX_ITEMS) {
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &array);
+                if (r < 0)
+                        return r;
+
+                if (array->entry_array.items[0] != 0) {
+                        o->entry_array_index.items[n].entry_array_offset = htole64(a);
+                        o->entry_array_index.items[n].first_entry_offset = array->entry_array.items[0];
+                        o->entry_array_index.items[n].n_before = htole64(t);
+                        n++;
+                }
+
+                t += journal_file_entry_array_n_items(array);
+                a = le64toh(array->entry_array.next_entry_array_offset);
+        }
+
+        o->entry_array_index.n_items = htole64(n);
+
+        return journal_file_link_entry_array_index(f, o, q);
+}
+
+static void journal_file_index_entry_array(
+                JournalFile *f,
+                uint64_t first,
+                uint64_t n_arrays,
+                uint64_t a,
+                uint64_t p,
+                uint64_t n_before) {
+
+        Object *o;
+        uint64_t n;
+        int r;
+
+        assert(f);
+
+        /* The index is only an optimization, hence don't fail if
+         * we can't update it */
+
+        if (!f->entry_array_index_hash_table)
+                return;
+
+        if (n_arrays < ENTRY_ARRAY_INDEX_MIN)
+                return;
+
+        if (n_arrays == ENTRY_ARRAY_INDEX_MIN)
+                r = journal_file_append_entry_array_index(f, first);
+        else {
+                r = journal_file_find_entry_array_index(f, first, &o, NULL);
+                if (r > 0) {
+                        n = le64toh(o->entry_array_index.n_items);
+
+                        if (n < journal_file_entry_array_index_n_items(o)) {
+                                o->entry_array_index.items[n].entry_array_offset = htole64(a);
+                                o->entry_array_index.items[n].first_entry_offset = htole64(p);
+                                o->entry_array_index.items[n].n_before = htole64(n_before);
+
+                                __sync_synchronize();
+
+                                o->entry_array_index.n_items = htole64(n + 1);
+                        }
+                }
+        }
+
+        if (r < 0)
+                log_debug("Failed to update entry array index of %s: %s", f->path, strerror(-r));
+}
+
 static int link_entry_into_array(JournalFile *f,
                                  le64_t *first,
                                  le64_t *idx,
                                  uint64_t p) {
         int r;
-        uint64_t n = 0, ap = 0, q, i, a, hidx;
+        uint64_t n = 0, ap = 0, q, i, a, hidx, n_arrays = 0;
         Object *o;
 
         assert(f);
@@ -1079,6 +2020,7 @@ static int link_entry_into_array(JournalFile *f,
         a = le64toh(*first);
         i = hidx = le64toh(*idx);
         while (a > 0) {
+                n_arrays++;
 
                 r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
                 if (r < 0)
@@ -1131,6 +2073,9 @@ static int link_entry_into_array(JournalFile *f,
         if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
                 f->header->n_entry_arrays = htole64(le64toh(f->header->n_entry_arrays) + 1);
 
+        if (i == 0)
+                journal_file_index_entry_array(f, le64toh(*first), n_arrays + 1, q, p, hidx);
+
         *idx = htole64(hidx + 1);
 
         return 0;
@@ -1280,6 +2225,8 @@ static int journal_file_append_entry_internal(
 void journal_file_post_change(JournalFile *f) {
         assert(f);
 
+        f->post_change_pending = false;
+
         /* inotify() does not receive IN_MODIFY events from file
          * accesses done via mmap(). After each access we hence
          * trigger IN_MODIFY by truncating the journal file to its
@@ -1301,7 +2248,7 @@ static int entry_item_cmp(const void *_a, const void *_b) {
         return 0;
 }
 
-int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqnum, Object **ret, uint64_t *offset) {
+static int journal_file_append_entry_real(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqnum, Object **ret, uint64_t *offset) {
         unsigned i;
         EntryItem *items;
         int r;
@@ -1346,21 +2293,68 @@ int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const st
          * times for rotating media. */
         qsort(items, n_iovec, sizeof(EntryItem), entry_item_cmp);
 
-        r = journal_file_append_entry_internal(f, ts, xor_hash, items, n_iovec, seqnum, ret, offset);
+        return journal_file_append_entry_internal(f, ts, xor_hash, items, n_iovec, seqnum, ret, offset);
+}
+
+static void journal_file_finish_change(JournalFile *f) {
+        assert(f);
+
+        /* If the owner of the file asked us to, delay waking up
+         * readers until it calls journal_file_post_change()
+         * itself, so that a burst of entries only results in a
+         * single ftruncate(). */
+
+        if (f->defer_post_change)
+                f->post_change_pending = true;
+        else
+                journal_file_post_change(f);
+}
+
+int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqnum, Object **ret, uint64_t *offset) {
+        int r;
 
-        journal_file_post_change(f);
+        TRACE2(journal_append_entry_begin, f->path, n_iovec);
+        r = journal_file_append_entry_real(f, ts, iovec, n_iovec, seqnum, ret, offset);
+        journal_file_finish_change(f);
+        TRACE2(journal_append_entry_end, f->path, r);
 
         return r;
 }
 
-typedef struct ChainCacheItem {
-        uint64_t first; /* the array at the begin of the chain */
-        uint64_t array; /* the cached array */
-        uint64_t begin; /* the first item in the cached array */
-        uint64_t total; /* the total number of items in all arrays before this one in the chain */
-} ChainCacheItem;
+int journal_file_append_entries(JournalFile *f, const JournalBatchEntry batch[], unsigned n_batch, uint64_t *seqnum) {
+        unsigned i;
+        int r = 0;
 
-static void chain_cache_put(
+        assert(f);
+        assert(batch || n_batch == 0);
+
+        if (n_batch <= 0)
+                return 0;
+
+        /* Appends a number of entries in one go, and notifies
+         * readers only once for all of them. If one of the entries
+         * cannot be written we stop there, but the entries before
+         * it stay in the file. */
+
+        for (i = 0; i < n_batch; i++) {
+                r = journal_file_append_entry_real(f, batch[i].ts, batch[i].iovec, batch[i].n_iovec, seqnum, NULL, NULL);
+                if (r < 0)
+                        break;
+        }
+
+        journal_file_finish_change(f);
+
+        return r;
+}
+
+typedef struct ChainCacheItem {
+        uint64_t first; /* the array at the begin of the chain */
+        uint64_t array; /* the cached array */
+        uint64_t begin; /* the first item in the cached array */
+        uint64_t total; /* the total number of items in all arrays before this one in the chain */
+} ChainCacheItem;
+
+static void chain_cache_put(
                 Hashmap *h,
                 ChainCacheItem *ci,
                 uint64_t first,
@@ -1396,6 +2390,121 @@ static void chain_cache_put(
         ci->total = total;
 }
 
+enum {
+        TEST_FOUND,
+        TEST_LEFT,
+        TEST_RIGHT
+};
+
+static int entry_array_index_lookup(
+                JournalFile *f,
+                uint64_t first,
+                uint64_t i,
+                uint64_t *array,
+                uint64_t *n_before) {
+
+        uint64_t left, right, m;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(array);
+        assert(n_before);
+
+        /* Find the array that contains the i'th entry of the chain */
+
+        r = journal_file_find_entry_array_index(f, first, &o, NULL);
+        if (r <= 0)
+                return r;
+
+        left = 0;
+        right = MIN(le64toh(o->entry_array_index.n_items), journal_file_entry_array_index_n_items(o));
+
+        while (left < right) {
+                m = (left + right) / 2;
+
+                if (le64toh(o->entry_array_index.items[m].n_before) <= i)
+                        left = m + 1;
+                else
+                        right = m;
+        }
+
+        if (left <= 0)
+                return 0;
+
+        *array = le64toh(o->entry_array_index.items[left-1].entry_array_offset);
+        *n_before = le64toh(o->entry_array_index.items[left-1].n_before);
+
+        if (*array <= 0)
+                return -EBADMSG;
+
+        return 1;
+}
+
+static int entry_array_index_bisect(
+                JournalFile *f,
+                uint64_t first,
+                uint64_t n,
+                uint64_t needle,
+                int (*test_object)(JournalFile *f, uint64_t p, uint64_t needle),
+                uint64_t *array,
+                uint64_t *n_before) {
+
+        uint64_t left, right, m, p;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(test_object);
+        assert(array);
+        assert(n_before);
+
+        /* Find the last array among the first n entries of the
+         * chain that begins left of what we are looking for. Only
+         * the first entry of each array is tested, hence this
+         * doesn't need to touch the arrays themselves. */
+
+        r = journal_file_find_entry_array_index(f, first, &o, NULL);
+        if (r <= 0)
+                return r;
+
+        left = 0;
+        right = MIN(le64toh(o->entry_array_index.n_items), journal_file_entry_array_index_n_items(o));
+
+        while (left < right) {
+                m = (left + right) / 2;
+
+                if (le64toh(o->entry_array_index.items[m].n_before) >= n) {
+                        right = m;
+                        continue;
+                }
+
+                p = le64toh(o->entry_array_index.items[m].first_entry_offset);
+                if (p <= 0)
+                        return -EBADMSG;
+
+                r = test_object(f, p, needle);
+                if (r < 0)
+                        return r;
+
+                if (r == TEST_LEFT)
+                        left = m + 1;
+                else
+                        right = m;
+        }
+
+        if (left <= 0)
+                return 0;
+
+        *array = le64toh(o->entry_array_index.items[left-1].entry_array_offset);
+        *n_before = le64toh(o->entry_array_index.items[left-1].n_before);
+
+        if (*array <= 0)
+                return -EBADMSG;
+
+        return 1;
+}
+
 static int generic_array_get(JournalFile *f,
                              uint64_t first,
                              uint64_t i,
@@ -1416,6 +2525,18 @@ static int generic_array_get(JournalFile *f,
                 a = ci->array;
                 i -= ci->total;
                 t = ci->total;
+        } else {
+                uint64_t ia, it;
+
+                /* If this is a long chain, look into its index */
+                r = entry_array_index_lookup(f, first, i, &ia, &it);
+                if (r < 0)
+                        return r;
+                if (r > 0) {
+                        a = ia;
+                        i -= it;
+                        t = it;
+                }
         }
 
         while (a > 0) {
@@ -1484,12 +2605,6 @@ static int generic_array_get_plus_one(JournalFile *f,
         return generic_array_get(f, first, i-1, ret, offset);
 }
 
-enum {
-        TEST_FOUND,
-        TEST_LEFT,
-        TEST_RIGHT
-};
-
 static int generic_array_bisect(JournalFile *f,
                                 uint64_t first,
                                 uint64_t n,
@@ -1536,6 +2651,21 @@ static int generic_array_bisect(JournalFile *f,
                 }
         }
 
+        if (a == first) {
+                uint64_t ia, it;
+
+                /* Nothing cached, so if this is a long chain, use
+                 * its index to skip ahead */
+                r = entry_array_index_bisect(f, first, n, needle, test_object, &ia, &it);
+                if (r < 0)
+                        return r;
+                if (r > 0) {
+                        a = ia;
+                        n -= it;
+                        t = it;
+                }
+        }
+
         while (a > 0) {
                 uint64_t left, right, k, lp;
 
@@ -1593,7 +2723,9 @@ static int generic_array_bisect(JournalFile *f,
                         }
                 }
 
-                if (k > n) {
+                /* The needle is right of the last entry, which is in
+                 * this array, even if it is used up exactly */
+                if (k >= n) {
                         if (direction == DIRECTION_UP) {
                                 i = n;
                                 subtract_one = true;
@@ -2246,13 +3378,24 @@ void journal_file_dump(JournalFile *f) {
                                (unsigned long long) le64toh(o->tag.epoch));
                         break;
 
+                case OBJECT_ENTRY_ARRAY_INDEX_HASH_TABLE:
+                        printf("Type: OBJECT_ENTRY_ARRAY_INDEX_HASH_TABLE\n");
+                        break;
+
+                case OBJECT_ENTRY_ARRAY_INDEX:
+                        printf("Type: OBJECT_ENTRY_ARRAY_INDEX first=%llu n_items=%llu\n",
+                               (unsigned long long) le64toh(o->entry_array_index.first_entry_array_offset),
+                               (unsigned long long) le64toh(o->entry_array_index.n_items));
+                        break;
+
                 default:
                         printf("Type: unknown (%u)\n", o->object.type);
                         break;
                 }
 
-                if (o->object.flags & OBJECT_COMPRESSED)
-                        printf("Flags: COMPRESSED\n");
+                if (o->object.flags & OBJECT_COMPRESSION_MASK)
+                        printf("Flags: COMPRESSED (%s)\n",
+                               strna(object_compressed_to_string(o->object.flags & OBJECT_COMPRESSION_MASK)));
 
                 if (p == le64toh(f->header->tail_object_offset))
                         p = 0;
@@ -2279,8 +3422,8 @@ void journal_file_print_header(JournalFile *f) {
                "Boot ID: %s\n"
                "Sequential Number ID: %s\n"
                "State: %s\n"
-               "Compatible Flags:%s%s\n"
-               "Incompatible Flags:%s%s\n"
+               "Compatible Flags:%s%s%s%s\n"
+               "Incompatible Flags:%s%s%s%s\n"
                "Header size: %llu\n"
                "Arena size: %llu\n"
                "Data Hash Table Size: %llu\n"
@@ -2301,9 +3444,13 @@ void journal_file_print_header(JournalFile *f) {
                f->header->state == STATE_ONLINE ? "ONLINE" :
                f->header->state == STATE_ARCHIVED ? "ARCHIVED" : "UNKNOWN",
                JOURNAL_HEADER_SEALED(f->header) ? " SEALED" : "",
-               (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SEALED) ? " ???" : "",
-               JOURNAL_HEADER_COMPRESSED(f->header) ? " COMPRESSED" : "",
-               (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_COMPRESSED) ? " ???" : "",
+               JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header) ? " ENTRY-ARRAY-INDEX" : "",
+               JOURNAL_HEADER_DATA_BLOOM_FILTER(f->header) ? " DATA-BLOOM-FILTER" : "",
+               (le32toh(f->header->compatible_flags) & ~(HEADER_COMPATIBLE_SEALED|HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX|HEADER_COMPATIBLE_DATA_BLOOM_FILTER)) ? " ???" : "",
+               JOURNAL_HEADER_COMPRESSED_XZ(f->header) ? " COMPRESSED-XZ" : "",
+               JOURNAL_HEADER_COMPRESSED_LZ4(f->header) ? " COMPRESSED-LZ4" : "",
+               JOURNAL_HEADER_XXHASH64(f->header) ? " XXHASH64" : "",
+               (le32toh(f->header->incompatible_flags) & ~(HEADER_INCOMPATIBLE_COMPRESSED_XZ|HEADER_INCOMPATIBLE_COMPRESSED_LZ4|HEADER_INCOMPATIBLE_XXHASH64)) ? " ???" : "",
                (unsigned long long) le64toh(f->header->header_size),
                (unsigned long long) le64toh(f->header->arena_size),
                (unsigned long long) le64toh(f->header->data_hash_table_size) / sizeof(HashItem),
@@ -2328,6 +3475,12 @@ void journal_file_print_header(JournalFile *f) {
                        (unsigned long long) le64toh(f->header->n_fields),
                        100.0 * (double) le64toh(f->header->n_fields) / ((double) (le64toh(f->header->field_hash_table_size) / sizeof(HashItem))));
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth))
+                printf("Deepest Data Hash Chain: %llu\n"
+                       "Deepest Field Hash Chain: %llu\n",
+                       (unsigned long long) le64toh(f->header->data_hash_chain_depth),
+                       (unsigned long long) le64toh(f->header->field_hash_chain_depth));
+
         if (JOURNAL_HEADER_CONTAINS(f->header, n_tags))
                 printf("Tag Objects: %llu\n",
                        (unsigned long long) le64toh(f->header->n_tags));
@@ -2335,6 +3488,16 @@ void journal_file_print_header(JournalFile *f) {
                 printf("Entry Array Objects: %llu\n",
                        (unsigned long long) le64toh(f->header->n_entry_arrays));
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, compress_saved_bytes))
+                printf("Compressed Data Objects: %llu\n"
+                       "Data Objects Not Compressible: %llu\n"
+                       "Data Objects Compression Skipped: %llu\n"
+                       "Compression Saved: %s\n",
+                       (unsigned long long) le64toh(f->header->n_compressed),
+                       (unsigned long long) le64toh(f->header->n_compress_failed),
+                       (unsigned long long) le64toh(f->header->n_compress_skipped),
+                       format_bytes(bytes, sizeof(bytes), le64toh(f->header->compress_saved_bytes)));
+
         if (fstat(f->fd, &st) >= 0)
                 printf("Disk usage: %s\n", format_bytes(bytes, sizeof(bytes), (off_t) st.st_blocks * 512ULL));
 }
@@ -2343,7 +3506,7 @@ int journal_file_open(
                 const char *fname,
                 int flags,
                 mode_t mode,
-                bool compress,
+                int compress,
                 bool seal,
                 JournalMetrics *metrics,
                 MMapCache *mmap_cache,
@@ -2375,9 +3538,13 @@ int journal_file_open(
         f->flags = flags;
         f->prot = prot_from_flags(flags);
         f->writable = (flags & O_ACCMODE) != O_RDONLY;
-#ifdef HAVE_XZ
-        f->compress = compress;
-#endif
+        if (template) {
+                f->defer_post_change = template->defer_post_change;
+                f->compress_threshold_bytes = template->compress_threshold_bytes;
+        } else
+                f->compress_threshold_bytes = DEFAULT_COMPRESS_THRESHOLD;
+        if (compression_supported(compress))
+                f->compress = compress;
 #ifdef HAVE_GCRYPT
         f->seal = seal;
 #endif
@@ -2500,11 +3667,15 @@ int journal_file_open(
 #endif
 
         if (newly_created) {
-                r = journal_file_setup_field_hash_table(f);
+                r = journal_file_setup_field_hash_table(f, template);
+                if (r < 0)
+                        goto fail;
+
+                r = journal_file_setup_data_hash_table(f, template);
                 if (r < 0)
                         goto fail;
 
-                r = journal_file_setup_data_hash_table(f);
+                r = journal_file_setup_entry_array_index_hash_table(f);
                 if (r < 0)
                         goto fail;
 
@@ -2515,13 +3686,14 @@ int journal_file_open(
 #endif
         }
 
-        r = journal_file_map_field_hash_table(f);
-        if (r < 0)
-                goto fail;
-
-        r = journal_file_map_data_hash_table(f);
-        if (r < 0)
-                goto fail;
+        /* Readers of large archive directories open many files
+         * but look up data in few of them, hence map the hash
+         * tables only when the first lookup needs them */
+        if (f->writable) {
+                r = journal_file_map_hash_tables(f);
+                if (r < 0)
+                        goto fail;
+        }
 
         *ret = f;
         return 0;
@@ -2532,7 +3704,27 @@ fail:
         return r;
 }
 
-int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
+static void journal_file_log_extents(JournalFile *f) {
+        struct fiemap fm = {
+                .fm_length = FIEMAP_MAX_OFFSET,
+        };
+
+        assert(f);
+
+        /* With fm_extent_count == 0 the kernel just counts the
+         * extents. Heavily fragmented files are slow to read, and
+         * are a hint that the directory should be marked NOCOW on
+         * btrfs. */
+        if (ioctl(f->fd, FS_IOC_FIEMAP, &fm) < 0)
+                return;
+
+        log_debug("Rotating %s: %llu bytes in %u extents.",
+                  f->path,
+                  (unsigned long long) f->last_stat.st_size,
+                  fm.fm_mapped_extents);
+}
+
+int journal_file_rotate(JournalFile **f, int compress, bool seal) {
         char *p;
         size_t l;
         JournalFile *old_file, *new_file = NULL;
@@ -2569,8 +3761,14 @@ int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         if (r < 0)
                 return -errno;
 
+        r = journal_file_append_data_bloom_filter(old_file);
+        if (r < 0)
+                log_debug("Failed to write data Bloom filter of %s: %s", old_file->path, strerror(-r));
+
         old_file->header->state = STATE_ARCHIVED;
 
+        journal_file_log_extents(old_file);
+
         r = journal_file_open(old_file->path, old_file->flags, old_file->mode, compress, seal, NULL, old_file->mmap, old_file, &new_file);
         journal_file_close(old_file);
 
@@ -2582,7 +3780,7 @@ int journal_file_open_reliably(
                 const char *fname,
                 int flags,
                 mode_t mode,
-                bool compress,
+                int compress,
                 bool seal,
                 JournalMetrics *metrics,
                 MMapCache *mmap_cache,
@@ -2632,6 +3830,214 @@ int journal_file_open_reliably(
                                  metrics, mmap_cache, template, ret);
 }
 
+static int data_object_payload(JournalFile *f, Object *o, void **ret, uint64_t *size) {
+        uint64_t l;
+        size_t t;
+
+        assert(f);
+        assert(o);
+        assert(ret);
+        assert(size);
+
+        l = le64toh(o->object.size) - offsetof(Object, data.payload);
+        t = (size_t) l;
+
+        /* We hit the limit on 32bit machines */
+        if ((uint64_t) t != l)
+                return -E2BIG;
+
+        if (o->object.flags & OBJECT_COMPRESSION_MASK) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+                uint64_t rsize;
+
+                if (!uncompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                                     o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, 0))
+                        return -EBADMSG;
+
+                *ret = f->compress_buffer;
+                *size = rsize;
+#else
+                return -EPROTONOSUPPORT;
+#endif
+        } else {
+                *ret = o->data.payload;
+                *size = l;
+        }
+
+        return 0;
+}
+
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+/* How much of a compressed payload we decompress to find the field
+ * name, which is at most 64 characters */
+#define COPY_FIELD_PREFIX_MAX 128
+
+static int journal_file_copy_compressed_data(
+                JournalFile *from,
+                JournalFile *to,
+                Object *o,
+                Object **ret, uint64_t *offset) {
+
+        uint64_t hash, osize, l, rsize, p, q, h;
+        const void *eq;
+        Object *u;
+        int r;
+
+        assert(from);
+        assert(to);
+        assert(o);
+
+        /* Stores a compressed data object in another file as it is,
+         * without decompressing and compressing it again. Returns 0
+         * if that is not safely possible, and the payload needs to
+         * be looked at after all. */
+
+        hash = le64toh(o->data.hash);
+        osize = le64toh(o->object.size);
+        l = osize - offsetof(Object, data.payload);
+
+        /* The field name is the only thing we need in clear text */
+        if (!uncompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                             o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size,
+                             &rsize, COPY_FIELD_PREFIX_MAX))
+                return -EBADMSG;
+
+        eq = memchr(from->compress_buffer, '=', MIN(rsize, (uint64_t) COPY_FIELD_PREFIX_MAX));
+        if (!eq)
+                return 0;
+
+        if (to->header->data_hash_table_size == 0)
+                return -EBADMSG;
+
+        r = journal_file_map_hash_tables(to);
+        if (r < 0)
+                return r;
+
+        /* An object with the same hash might hold the same payload,
+         * which we can only tell for sure without decompressing if
+         * it was compressed the same way */
+        h = hash % (le64toh(to->header->data_hash_table_size) / sizeof(HashItem));
+        for (q = le64toh(to->data_hash_table[h].head_hash_offset); q > 0; q = le64toh(u->data.next_hash_offset)) {
+
+                r = journal_file_move_to_object(to, OBJECT_DATA, q, &u);
+                if (r < 0)
+                        return r;
+
+                if (le64toh(u->data.hash) != hash)
+                        continue;
+
+                if (u->object.flags != o->object.flags ||
+                    le64toh(u->object.size) != osize ||
+                    memcmp(u->data.payload, o->data.payload, l) != 0)
+                        return 0;
+
+                if (ret)
+                        *ret = u;
+
+                if (offset)
+                        *offset = q;
+
+                return 1;
+        }
+
+        r = journal_file_append_object(to, OBJECT_DATA, osize, &u, &p);
+        if (r < 0)
+                return r;
+
+        u->object.flags = o->object.flags;
+        u->data.hash = o->data.hash;
+        memcpy(u->data.payload, o->data.payload, l);
+
+        /* We don't know how much this one saved, but it is
+         * compressed nonetheless */
+        if (JOURNAL_HEADER_CONTAINS(to->header, n_compressed))
+                to->header->n_compressed = htole64(le64toh(to->header->n_compressed) + 1);
+
+        r = journal_file_link_data(to, u, p, hash);
+        if (r < 0)
+                return r;
+
+        r = journal_file_move_to_object(to, OBJECT_DATA, p, &u);
+        if (r < 0)
+                return r;
+
+        if (eq > from->compress_buffer) {
+                uint64_t fp;
+                Object *fo;
+
+                r = journal_file_append_field(to, from->compress_buffer, (const uint8_t*) eq - (const uint8_t*) from->compress_buffer, &fo, &fp);
+                if (r < 0)
+                        return r;
+
+                u->data.next_field_offset = fo->field.head_data_offset;
+                fo->field.head_data_offset = le64toh(p);
+        }
+
+#ifdef HAVE_GCRYPT
+        r = journal_file_hmac_put_object(to, OBJECT_DATA, u, p);
+        if (r < 0)
+                return r;
+#endif
+
+        if (ret)
+                *ret = u;
+
+        if (offset)
+                *offset = p;
+
+        return 1;
+}
+#endif
+
+static int journal_file_copy_data(JournalFile *from, JournalFile *to, uint64_t q, Object **ret, uint64_t *offset) {
+        uint64_t l;
+        void *data;
+        Object *o;
+        int r;
+
+        assert(from);
+        assert(to);
+        assert(q > 0);
+
+        r = journal_file_move_to_object(from, OBJECT_DATA, q, &o);
+        if (r < 0)
+                return r;
+
+        /* With the same hash function on both sides, the stored hash
+         * is good for the other file too, and a compressed payload
+         * can be taken over as it is if the other file compresses the
+         * same way. Otherwise we go the long way, as if the payload
+         * was appended anew. */
+
+        if (JOURNAL_HEADER_XXHASH64(from->header) != JOURNAL_HEADER_XXHASH64(to->header)) {
+                r = data_object_payload(from, o, &data, &l);
+                if (r < 0)
+                        return r;
+
+                return journal_file_append_data(to, data, l, ret, offset);
+        }
+
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+        if ((o->object.flags & OBJECT_COMPRESSION_MASK) &&
+            (o->object.flags & OBJECT_COMPRESSION_MASK) == to->compress) {
+
+                r = journal_file_copy_compressed_data(from, to, o, ret, offset);
+                if (r != 0)
+                        return r < 0 ? r : 0;
+
+                r = journal_file_move_to_object(from, OBJECT_DATA, q, &o);
+                if (r < 0)
+                        return r;
+        }
+#endif
+
+        r = data_object_payload(from, o, &data, &l);
+        if (r < 0)
+                return r;
+
+        return journal_file_append_data_with_hash(to, data, l, le64toh(o->data.hash), ret, offset);
+}
+
 int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p, uint64_t *seqnum, Object **ret, uint64_t *offset) {
         uint64_t i, n;
         uint64_t q, xor_hash = 0;
@@ -2658,10 +4064,8 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
         items = alloca(sizeof(EntryItem) * n);
 
         for (i = 0; i < n; i++) {
-                uint64_t l, h;
+                uint64_t h;
                 le64_t le_hash;
-                size_t t;
-                void *data;
                 Object *u;
 
                 q = le64toh(o->entry.items[i].object_offset);
@@ -2674,42 +4078,323 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 if (le_hash != o->data.hash)
                         return -EBADMSG;
 
-                l = le64toh(o->object.size) - offsetof(Object, data.payload);
-                t = (size_t) l;
+                r = journal_file_copy_data(from, to, q, &u, &h);
+                if (r < 0)
+                        return r;
 
-                /* We hit the limit on 32bit machines */
-                if ((uint64_t) t != l)
-                        return -E2BIG;
+                xor_hash ^= le64toh(u->data.hash);
+                items[i].object_offset = htole64(h);
+                items[i].hash = u->data.hash;
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
-                        uint64_t rsize;
+                r = journal_file_move_to_object(from, OBJECT_ENTRY, p, &o);
+                if (r < 0)
+                        return r;
+        }
 
-                        if (!uncompress_blob(o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size, &rsize, 0))
-                                return -EBADMSG;
+        return journal_file_append_entry_internal(to, &ts, xor_hash, items, n, seqnum, ret, offset);
+}
 
-                        data = from->compress_buffer;
-                        l = rsize;
-#else
-                        return -EPROTONOSUPPORT;
-#endif
-                } else
-                        data = o->data.payload;
+int journal_file_copy_entries(JournalFile *from, JournalFile *to, const uint64_t offsets[], unsigned n_offsets, uint64_t *seqnum, unsigned *n_copied) {
+        unsigned i;
+        int r = 0;
+
+        assert(from);
+        assert(to);
+        assert(offsets || n_offsets == 0);
+
+        /* Copies a number of entries in one go, and notifies readers
+         * of the target only once for all of them, like
+         * journal_file_append_entries(). Stops at the first entry
+         * that cannot be copied, and tells how many made it. */
+
+        for (i = 0; i < n_offsets; i++) {
+                Object *o;
+
+                r = journal_file_move_to_object(from, OBJECT_ENTRY, offsets[i], &o);
+                if (r < 0)
+                        break;
+
+                r = journal_file_copy_entry(from, to, o, offsets[i], seqnum, NULL, NULL);
+                if (r < 0)
+                        break;
+        }
+
+        if (i > 0)
+                journal_file_finish_change(to);
+
+        if (n_copied)
+                *n_copied = i;
+
+        return r < 0 ? r : 0;
+}
+
+typedef struct CompactReservation {
+        uint64_t offset;
+        uint64_t n_entries;
+} CompactReservation;
+
+static int reserve_entry_array(JournalFile *f, uint64_t n, uint64_t *ret) {
+        Object *o;
+        uint64_t q;
+        int r;
+
+        assert(f);
+        assert(n > 0);
+        assert(ret);
+
+        r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY,
+                                       offsetof(Object, entry_array.items) + n * sizeof(uint64_t),
+                                       &o, &q);
+        if (r < 0)
+                return r;
+
+        memset(o->entry_array.items, 0, n * sizeof(uint64_t));
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
+                f->header->n_entry_arrays = htole64(le64toh(f->header->n_entry_arrays) + 1);
+
+        *ret = q;
+        return 0;
+}
 
-                r = journal_file_append_data(to, data, l, &u, &h);
+static int compact_data(JournalFile *from, JournalFile *to, CompactReservation **reservations, size_t *n_reservations) {
+        size_t allocated = 0;
+        uint64_t p = 0;
+        Object *o = NULL;
+        int r;
+
+        assert(from);
+        assert(to);
+        assert(reservations);
+        assert(n_reservations);
+
+        /* First write out all data objects, in the order they are
+         * first referenced, and remember how many entries each of
+         * them will be linked to */
+
+        for (;;) {
+                uint64_t i, n;
+
+                r = journal_file_next_entry(from, o, p, DIRECTION_DOWN, &o, &p);
                 if (r < 0)
                         return r;
+                if (r == 0)
+                        return 0;
 
-                xor_hash ^= le64toh(u->data.hash);
-                items[i].object_offset = htole64(h);
-                items[i].hash = u->data.hash;
+                n = journal_file_entry_n_items(o);
+                for (i = 0; i < n; i++) {
+                        uint64_t q, h, n_data;
+                        Object *d, *u;
+
+                        r = journal_file_move_to_object(from, OBJECT_ENTRY, p, &o);
+                        if (r < 0)
+                                return r;
+
+                        q = le64toh(o->entry.items[i].object_offset);
+
+                        n_data = le64toh(to->header->n_data);
+
+                        r = journal_file_copy_data(from, to, q, &u, &h);
+                        if (r < 0)
+                                return r;
+
+                        if (le64toh(to->header->n_data) == n_data)
+                                continue;
+
+                        r = journal_file_move_to_object(from, OBJECT_DATA, q, &d);
+                        if (r < 0)
+                                return r;
+
+                        if (!GREEDY_REALLOC(*reservations, allocated, *n_reservations + 1))
+                                return -ENOMEM;
+
+                        (*reservations)[*n_reservations].offset = h;
+                        (*reservations)[*n_reservations].n_entries = le64toh(d->data.n_entries);
+                        (*n_reservations)++;
+                }
 
                 r = journal_file_move_to_object(from, OBJECT_ENTRY, p, &o);
                 if (r < 0)
                         return r;
         }
+}
 
-        return journal_file_append_entry_internal(to, &ts, xor_hash, items, n, seqnum, ret, offset);
+static int compact_entry_arrays(JournalFile *from, JournalFile *to, const CompactReservation *reservations, size_t n_reservations) {
+        uint64_t q;
+        size_t i;
+        int r;
+
+        assert(from);
+        assert(to);
+
+        /* Then one entry array for each data object that is large
+         * enough for all of its entries. The first entry is stored
+         * in the data object itself. */
+        for (i = 0; i < n_reservations; i++) {
+                Object *o;
+
+                if (reservations[i].n_entries <= 1)
+                        continue;
+
+                r = reserve_entry_array(to, reservations[i].n_entries - 1, &q);
+                if (r < 0)
+                        return r;
+
+                r = journal_file_move_to_object(to, OBJECT_DATA, reservations[i].offset, &o);
+                if (r < 0)
+                        return r;
+
+                o->data.entry_array_offset = htole64(q);
+        }
+
+        /* And the same for the global one */
+        if (le64toh(from->header->n_entries) > 0) {
+                r = reserve_entry_array(to, le64toh(from->header->n_entries), &q);
+                if (r < 0)
+                        return r;
+
+                to->header->entry_array_offset = htole64(q);
+        }
+
+        return 0;
+}
+
+static int compact_entries(JournalFile *from, JournalFile *to) {
+        sd_id128_t boot_id = SD_ID128_NULL;
+        uint64_t p = 0;
+        Object *o = NULL;
+        int r;
+
+        assert(from);
+        assert(to);
+
+        /* Finally the entries, one after the other, linked into the
+         * arrays reserved above */
+
+        for (;;) {
+                uint64_t seqnum;
+
+                r = journal_file_next_entry(from, o, p, DIRECTION_DOWN, &o, &p);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return 0;
+
+                /* Keep seqnums, so that cursors stay valid, and the
+                 * boot ID, which is taken from the header */
+                seqnum = le64toh(o->entry.seqnum) - 1;
+
+                if (!sd_id128_equal(boot_id, o->entry.boot_id)) {
+                        boot_id = o->entry.boot_id;
+                        to->header->boot_id = boot_id;
+                        to->tail_entry_monotonic_valid = false;
+                }
+
+                r = journal_file_copy_entry(from, to, o, p, &seqnum, NULL, NULL);
+                if (r < 0)
+                        return r;
+
+                r = journal_file_move_to_object(from, OBJECT_ENTRY, p, &o);
+                if (r < 0)
+                        return r;
+        }
+}
+
+int journal_file_compact(JournalFile *from, const char *fname, int compress) {
+        _cleanup_free_ CompactReservation *reservations = NULL;
+        size_t n_reservations = 0;
+        JournalFile *to = NULL;
+        uint64_t size;
+        Object *o;
+        int r;
+
+        assert(from);
+        assert(fname);
+
+        /* Writes a copy of an archived file with the read path in
+         * mind: data objects, entry arrays and entries each in one
+         * block, a single entry array for each data object, and hash
+         * tables sized after the actual number of objects. Sealed
+         * files cannot be rewritten without losing the seal. */
+
+        if (from->header->state != STATE_ARCHIVED)
+                return -EBUSY;
+
+        if (JOURNAL_HEADER_SEALED(from->header))
+                return -EPERM;
+
+        r = journal_file_open(fname, O_RDWR|O_CREAT|O_EXCL, from->last_stat.st_mode & 07777, compress, false, NULL, NULL, from, &to);
+        if (r < 0)
+                return r;
+
+        /* The hash tables are still empty, hence we may pick the
+         * hash function the original file used, so that the entries
+         * keep their xor hash */
+        if (JOURNAL_HEADER_XXHASH64(from->header))
+                to->header->incompatible_flags |= htole32(HEADER_INCOMPATIBLE_XXHASH64);
+        else
+                to->header->incompatible_flags &= ~htole32(HEADER_INCOMPATIBLE_XXHASH64);
+
+        if (from->header->head_entry_seqnum != 0)
+                to->header->tail_entry_seqnum = htole64(le64toh(from->header->head_entry_seqnum) - 1);
+
+        r = compact_data(from, to, &reservations, &n_reservations);
+        if (r < 0)
+                goto fail;
+
+        r = compact_entry_arrays(from, to, reservations, n_reservations);
+        if (r < 0)
+                goto fail;
+
+        r = compact_entries(from, to);
+        if (r < 0)
+                goto fail;
+
+        if (to->header->n_entries != from->header->n_entries) {
+                r = -EBADMSG;
+                goto fail;
+        }
+
+        r = journal_file_append_data_bloom_filter(to);
+        if (r < 0)
+                log_debug("Failed to write data Bloom filter of %s: %s", to->path, strerror(-r));
+
+        to->header->machine_id = from->header->machine_id;
+
+        /* Drop what journal_file_allocate() reserved beyond the last
+         * object */
+        r = journal_file_move_to_object(to, -1, le64toh(to->header->tail_object_offset), &o);
+        if (r < 0)
+                goto fail;
+
+        size = le64toh(to->header->tail_object_offset) + ALIGN64(le64toh(o->object.size));
+        to->header->arena_size = htole64(size - le64toh(to->header->header_size));
+
+        mmap_cache_close_fd(to->mmap, to->fd);
+
+        if (ftruncate(to->fd, size) < 0 ||
+            fstat(to->fd, &to->last_stat) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        if (fchown(to->fd, from->last_stat.st_uid, from->last_stat.st_gid) < 0)
+                log_debug("Failed to change ownership of %s: %m", to->path);
+
+        if (fdatasync(to->fd) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        to->header->state = STATE_ARCHIVED;
+        journal_file_close(to);
+
+        return 0;
+
+fail:
+        unlink(to->path);
+        journal_file_close(to);
+        return r;
 }
 
 void journal_default_metrics(JournalMetrics *m, int fd) {
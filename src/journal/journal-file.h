@@ -34,6 +34,10 @@
 #include "util.h"
 #include "mmap-cache.h"
 #include "hashmap.h"
+#include "list.h"
+
+/* By default only data objects larger than this are compressed */
+#define DEFAULT_COMPRESS_THRESHOLD (512ULL)
 
 typedef struct JournalMetrics {
         uint64_t max_use;
@@ -42,11 +46,45 @@ typedef struct JournalMetrics {
         uint64_t keep_free;
 } JournalMetrics;
 
+/* How many recently used data objects to remember for the write path */
+#define DATA_CACHE_SIZE 64
+
+typedef struct DataCacheItem {
+        uint64_t hash;
+        uint64_t size;
+        uint64_t offset;
+} DataCacheItem;
+
+/* How many decompressed data objects to keep around for the read
+ * path */
+#define UNCOMPRESS_CACHE_SIZE 8
+
+typedef struct UncompressCacheItem {
+        uint64_t offset;
+        uint64_t threshold;
+        uint64_t size;
+        void *buffer;
+        uint64_t buffer_size;
+        unsigned last_used;
+} UncompressCacheItem;
+
 typedef enum direction {
         DIRECTION_UP,
         DIRECTION_DOWN
 } direction_t;
 
+/* Shared by the files of one reader, to bound the number of file
+ * descriptors they keep open at the same time. Archived files beyond
+ * the limit have their fd closed while idle, and are reopened
+ * transparently on the next access. */
+typedef struct JournalFdLimit {
+        unsigned n_open;
+        unsigned max_open;
+
+        /* Most recently used first */
+        LIST_HEAD(struct JournalFile, lru);
+} JournalFdLimit;
+
 typedef struct JournalFile {
         int fd;
 
@@ -55,11 +93,16 @@ typedef struct JournalFile {
         int flags;
         int prot;
         bool writable;
-        bool compress;
+        int compress;
         bool seal;
 
         bool tail_entry_monotonic_valid;
 
+        /* If set, appending entries does not trigger inotify for
+         * readers, the owner calls journal_file_post_change() */
+        bool defer_post_change;
+        bool post_change_pending;
+
         direction_t last_direction;
 
         char *path;
@@ -68,23 +111,56 @@ typedef struct JournalFile {
         Header *header;
         HashItem *data_hash_table;
         HashItem *field_hash_table;
+        HashItem *entry_array_index_hash_table;
+        DataBloomFilterObject *data_bloom_filter;
+
+        /* Read-only files map the above only once the first lookup
+         * needs them */
+        bool hash_tables_mapped;
+
+        JournalFdLimit *fd_limit;
+        LIST_FIELDS(struct JournalFile, fd_lru);
 
         uint64_t current_offset;
 
+        /* Set when the reader found nothing beyond its location
+         * while going down, and how many entries we had then */
+        bool exhausted;
+        uint64_t exhausted_n_entries;
+
         JournalMetrics metrics;
         MMapCache *mmap;
 
         Hashmap *chain_cache;
 
-#ifdef HAVE_XZ
+        /* How well the payloads of each field compressed so far */
+        Hashmap *compress_stats;
+        uint64_t compress_threshold_bytes;
+
+        /* Recently appended or looked up data objects, indexed by
+         * hash, so that fields repeated in every entry don't need
+         * the walk through the on-disk hash chain */
+        DataCacheItem data_cache[DATA_CACHE_SIZE];
+
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
         void *compress_buffer;
         uint64_t compress_buffer_size;
+
+        /* Data objects are shared between entries, and readers tend
+         * to look at the same field more than once per entry */
+        UncompressCacheItem uncompress_cache[UNCOMPRESS_CACHE_SIZE];
+        unsigned uncompress_cache_clock;
 #endif
 
 #ifdef HAVE_GCRYPT
         gcry_md_hd_t hmac;
         bool hmac_running;
 
+        /* The epoch the HMAC context was last keyed for; resetting
+         * the context keeps the key */
+        uint64_t hmac_epoch;
+        bool hmac_keyed;
+
         FSSHeader *fss_file;
         size_t fss_file_size;
 
@@ -96,14 +172,23 @@ typedef struct JournalFile {
 
         void *fsprg_seed;
         size_t fsprg_seed_size;
+
+        /* Only when verifying: derived from the seed on first seek */
+        void *fsprg_msk;
 #endif
 } JournalFile;
 
+typedef struct JournalBatchEntry {
+        const dual_timestamp *ts;
+        const struct iovec *iovec;
+        unsigned n_iovec;
+} JournalBatchEntry;
+
 int journal_file_open(
                 const char *fname,
                 int flags,
                 mode_t mode,
-                bool compress,
+                int compress,
                 bool seal,
                 JournalMetrics *metrics,
                 MMapCache *mmap_cache,
@@ -114,11 +199,16 @@ int journal_file_set_offline(JournalFile *f);
 int journal_file_set_online(JournalFile *f);
 void journal_file_close(JournalFile *j);
 
+int journal_file_map_hash_tables(JournalFile *f);
+
+void journal_file_set_fd_limit(JournalFile *f, JournalFdLimit *l);
+void journal_file_close_fd(JournalFile *f);
+
 int journal_file_open_reliably(
                 const char *fname,
                 int flags,
                 mode_t mode,
-                bool compress,
+                int compress,
                 bool seal,
                 JournalMetrics *metrics,
                 MMapCache *mmap_cache,
@@ -149,17 +239,33 @@ static inline bool VALID_EPOCH(uint64_t u) {
 #define JOURNAL_HEADER_SEALED(h) \
         (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_SEALED))
 
-#define JOURNAL_HEADER_COMPRESSED(h) \
-        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED))
+#define JOURNAL_HEADER_ENTRY_ARRAY_INDEX(h) \
+        (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX))
+
+#define JOURNAL_HEADER_DATA_BLOOM_FILTER(h) \
+        (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_DATA_BLOOM_FILTER))
+
+#define JOURNAL_HEADER_COMPRESSED_XZ(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_XZ))
+
+#define JOURNAL_HEADER_COMPRESSED_LZ4(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_LZ4))
+
+#define JOURNAL_HEADER_XXHASH64(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_XXHASH64))
 
 int journal_file_move_to_object(JournalFile *f, int type, uint64_t offset, Object **ret);
 
 uint64_t journal_file_entry_n_items(Object *o);
 uint64_t journal_file_entry_array_n_items(Object *o);
 uint64_t journal_file_hash_table_n_items(Object *o);
+uint64_t journal_file_entry_array_index_n_items(Object *o);
+
+uint64_t journal_file_hash_data(JournalFile *f, const void *data, size_t sz);
 
 int journal_file_append_object(JournalFile *f, int type, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqno, Object **ret, uint64_t *offset);
+int journal_file_append_entries(JournalFile *f, const JournalBatchEntry batch[], unsigned n_batch, uint64_t *seqno);
 
 int journal_file_find_data_object(JournalFile *f, const void *data, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_data_object_with_hash(JournalFile *f, const void *data, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
@@ -182,12 +288,19 @@ int journal_file_move_to_entry_by_seqnum_for_data(JournalFile *f, uint64_t data_
 int journal_file_move_to_entry_by_realtime_for_data(JournalFile *f, uint64_t data_offset, uint64_t realtime, direction_t direction, Object **ret, uint64_t *offset);
 int journal_file_move_to_entry_by_monotonic_for_data(JournalFile *f, uint64_t data_offset, sd_id128_t boot_id, uint64_t monotonic, direction_t direction, Object **ret, uint64_t *offset);
 
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+UncompressCacheItem *journal_file_uncompress_cache_get(JournalFile *f, uint64_t p, uint64_t threshold);
+UncompressCacheItem *journal_file_uncompress_cache_add(JournalFile *f, uint64_t threshold);
+#endif
+
 int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint64_t p, uint64_t *seqnum, Object **ret, uint64_t *offset);
+int journal_file_copy_entries(JournalFile *from, JournalFile *to, const uint64_t offsets[], unsigned n_offsets, uint64_t *seqnum, unsigned *n_copied);
+int journal_file_compact(JournalFile *from, const char *fname, int compress);
 
 void journal_file_dump(JournalFile *f);
 void journal_file_print_header(JournalFile *f);
 
-int journal_file_rotate(JournalFile **f, bool compress, bool seal);
+int journal_file_rotate(JournalFile **f, int compress, bool seal);
 
 void journal_file_post_change(JournalFile *f);
 
@@ -39,6 +39,9 @@
 #include "build.h"
 #include "fileio.h"
 
+/* How much to serialize at once, and hand to microhttpd per callback */
+#define BATCH_SIZE (64*1024)
+
 typedef struct RequestMeta {
         sd_journal *journal;
 
@@ -49,8 +52,12 @@ typedef struct RequestMeta {
         uint64_t n_entries;
         bool n_entries_set;
 
+        /* What was serialized but not sent yet, starting at
+         * position delta of the response */
         FILE *tmp;
-        uint64_t delta, size;
+        char *buf;
+        size_t buf_size;
+        uint64_t delta;
 
         int argument_parse_error;
 
@@ -99,6 +106,7 @@ static void request_meta_free(
         if (m->tmp)
                 fclose(m->tmp);
 
+        free(m->buf);
         free(m->cursor);
         free(m);
 }
@@ -165,32 +173,70 @@ static int respond_error(
         return r;
 }
 
-static ssize_t request_reader_entries(
-                void *cls,
-                uint64_t pos,
-                char *buf,
-                size_t max) {
+static int request_meta_rewind(RequestMeta *m) {
+        assert(m);
 
-        RequestMeta *m = cls;
-        int r;
-        size_t n, k;
+        if (m->tmp) {
+                rewind(m->tmp);
+                return 0;
+        }
+
+        m->tmp = open_memstream(&m->buf, &m->buf_size);
+        if (!m->tmp) {
+                log_error("Failed to create memory stream: %m");
+                return -errno;
+        }
+
+        return 0;
+}
+
+static int request_meta_flush(RequestMeta *m) {
+        assert(m);
+        assert(m->tmp);
+
+        /* This updates buf and buf_size */
+        if (fflush(m->tmp) != 0) {
+                log_error("Failed to serialize: %m");
+                return -errno;
+        }
+
+        return 0;
+}
+
+static ssize_t request_meta_read(RequestMeta *m, uint64_t pos, char *buf, size_t max) {
+        size_t n;
 
         assert(m);
         assert(buf);
-        assert(max > 0);
-        assert(pos >= m->delta);
+        assert(pos < m->buf_size);
 
-        pos -= m->delta;
+        n = m->buf_size - pos;
+        if (n > max)
+                n = max;
 
-        while (pos >= m->size) {
-                off_t sz;
+        memcpy(buf, m->buf + pos, n);
+        return (ssize_t) n;
+}
 
-                /* End of this entry, so let's serialize the next
-                 * one */
+static int request_serialize_entries(RequestMeta *m) {
+        unsigned n = 0;
+        int r;
+
+        assert(m);
+
+        /* Serializes as many entries as are available right now, up
+         * to BATCH_SIZE. Returns 0 at the end of the stream. */
+
+        r = request_meta_rewind(m);
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                off_t sz;
 
                 if (m->n_entries_set &&
                     m->n_entries <= 0)
-                        return MHD_CONTENT_READER_END_OF_STREAM;
+                        break;
 
                 if (m->n_skip < 0)
                         r = sd_journal_previous_skip(m->journal, (uint64_t) -m->n_skip + 1);
@@ -201,20 +247,22 @@ static ssize_t request_reader_entries(
 
                 if (r < 0) {
                         log_error("Failed to advance journal pointer: %s", strerror(-r));
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                        return r;
                 } else if (r == 0) {
 
-                        if (m->follow) {
+                        /* Whatever we have already should go out
+                         * before we wait for more */
+                        if (m->follow && n == 0) {
                                 r = sd_journal_wait(m->journal, (uint64_t) -1);
                                 if (r < 0) {
                                         log_error("Couldn't wait for journal event: %s", strerror(-r));
-                                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                                        return r;
                                 }
 
                                 continue;
                         }
 
-                        return MHD_CONTENT_READER_END_OF_STREAM;
+                        break;
                 }
 
                 if (m->discrete) {
@@ -223,63 +271,73 @@ static ssize_t request_reader_entries(
                         r = sd_journal_test_cursor(m->journal, m->cursor);
                         if (r < 0) {
                                 log_error("Failed to test cursor: %s", strerror(-r));
-                                return MHD_CONTENT_READER_END_WITH_ERROR;
+                                return r;
                         }
 
-                        if (r == 0)
-                                return MHD_CONTENT_READER_END_OF_STREAM;
+                        if (r == 0) {
+                                m->n_entries_set = true;
+                                m->n_entries = 0;
+                                break;
+                        }
                 }
 
-                pos -= m->size;
-                m->delta += m->size;
-
                 if (m->n_entries_set)
                         m->n_entries -= 1;
 
                 m->n_skip = 0;
 
-                if (m->tmp)
-                        rewind(m->tmp);
-                else {
-                        m->tmp = tmpfile();
-                        if (!m->tmp) {
-                                log_error("Failed to create temporary file: %m");
-                                return MHD_CONTENT_READER_END_WITH_ERROR;
-                        }
-                }
-
                 r = output_journal(m->tmp, m->journal, m->mode, 0, OUTPUT_FULL_WIDTH);
                 if (r < 0) {
                         log_error("Failed to serialize item: %s", strerror(-r));
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                        return r;
                 }
 
-                sz = ftello(m->tmp);
-                if (sz == (off_t) -1) {
-                        log_error("Failed to retrieve file position: %m");
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
-                }
+                n++;
 
-                m->size = (uint64_t) sz;
+                sz = ftello(m->tmp);
+                if (sz == (off_t) -1 || sz >= BATCH_SIZE)
+                        break;
         }
 
-        if (fseeko(m->tmp, pos, SEEK_SET) < 0) {
-                log_error("Failed to seek to position: %m");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
-        }
+        r = request_meta_flush(m);
+        if (r < 0)
+                return r;
 
-        n = m->size - pos;
-        if (n > max)
-                n = max;
+        return n > 0;
+}
+
+static ssize_t request_reader_entries(
+                void *cls,
+                uint64_t pos,
+                char *buf,
+                size_t max) {
+
+        RequestMeta *m = cls;
+        int r;
+
+        assert(m);
+        assert(buf);
+        assert(max > 0);
+        assert(pos >= m->delta);
+
+        pos -= m->delta;
 
-        errno = 0;
-        k = fread(buf, 1, n, m->tmp);
-        if (k != n) {
-                log_error("Failed to read from file: %s", errno ? strerror(errno) : "Premature EOF");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
+        while (pos >= m->buf_size) {
+
+                /* Everything was sent, so let's serialize the next
+                 * batch of entries */
+
+                pos -= m->buf_size;
+                m->delta += m->buf_size;
+
+                r = request_serialize_entries(m);
+                if (r < 0)
+                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                if (r == 0)
+                        return MHD_CONTENT_READER_END_OF_STREAM;
         }
 
-        return (ssize_t) k;
+        return request_meta_read(m, pos, buf, max);
 }
 
 static int request_parse_accept(
@@ -523,7 +581,7 @@ static int request_handler_entries(
         if (r < 0)
                 return respond_error(connection, MHD_HTTP_BAD_REQUEST, "Failed to seek in journal.\n");
 
-        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4*1024, request_reader_entries, m, NULL);
+        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, BATCH_SIZE, request_reader_entries, m, NULL);
         if (!response)
                 return respond_oom(connection);
 
@@ -557,90 +615,83 @@ static int output_field(FILE *f, OutputMode m, const char *d, size_t l) {
         return 0;
 }
 
-static ssize_t request_reader_fields(
-                void *cls,
-                uint64_t pos,
-                char *buf,
-                size_t max) {
-
-        RequestMeta *m = cls;
+static int request_serialize_fields(RequestMeta *m) {
+        unsigned n = 0;
         int r;
-        size_t n, k;
 
         assert(m);
-        assert(buf);
-        assert(max > 0);
-        assert(pos >= m->delta);
 
-        pos -= m->delta;
+        r = request_meta_rewind(m);
+        if (r < 0)
+                return r;
 
-        while (pos >= m->size) {
-                off_t sz;
+        for (;;) {
                 const void *d;
                 size_t l;
-
-                /* End of this field, so let's serialize the next
-                 * one */
+                off_t sz;
 
                 if (m->n_fields_set &&
                     m->n_fields <= 0)
-                        return MHD_CONTENT_READER_END_OF_STREAM;
+                        break;
 
                 r = sd_journal_enumerate_unique(m->journal, &d, &l);
                 if (r < 0) {
                         log_error("Failed to advance field index: %s", strerror(-r));
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                        return r;
                 } else if (r == 0)
-                        return MHD_CONTENT_READER_END_OF_STREAM;
-
-                pos -= m->size;
-                m->delta += m->size;
+                        break;
 
                 if (m->n_fields_set)
                         m->n_fields -= 1;
 
-                if (m->tmp)
-                        rewind(m->tmp);
-                else {
-                        m->tmp = tmpfile();
-                        if (!m->tmp) {
-                                log_error("Failed to create temporary file: %m");
-                                return MHD_CONTENT_READER_END_WITH_ERROR;
-                        }
-                }
-
                 r = output_field(m->tmp, m->mode, d, l);
                 if (r < 0) {
                         log_error("Failed to serialize item: %s", strerror(-r));
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                        return r;
                 }
 
-                sz = ftello(m->tmp);
-                if (sz == (off_t) -1) {
-                        log_error("Failed to retrieve file position: %m");
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
-                }
+                n++;
 
-                m->size = (uint64_t) sz;
+                sz = ftello(m->tmp);
+                if (sz == (off_t) -1 || sz >= BATCH_SIZE)
+                        break;
         }
 
-        if (fseeko(m->tmp, pos, SEEK_SET) < 0) {
-                log_error("Failed to seek to position: %m");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
-        }
+        r = request_meta_flush(m);
+        if (r < 0)
+                return r;
 
-        n = m->size - pos;
-        if (n > max)
-                n = max;
+        return n > 0;
+}
 
-        errno = 0;
-        k = fread(buf, 1, n, m->tmp);
-        if (k != n) {
-                log_error("Failed to read from file: %s", errno ? strerror(errno) : "Premature EOF");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
+static ssize_t request_reader_fields(
+                void *cls,
+                uint64_t pos,
+                char *buf,
+                size_t max) {
+
+        RequestMeta *m = cls;
+        int r;
+
+        assert(m);
+        assert(buf);
+        assert(max > 0);
+        assert(pos >= m->delta);
+
+        pos -= m->delta;
+
+        while (pos >= m->buf_size) {
+                pos -= m->buf_size;
+                m->delta += m->buf_size;
+
+                r = request_serialize_fields(m);
+                if (r < 0)
+                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                if (r == 0)
+                        return MHD_CONTENT_READER_END_OF_STREAM;
         }
 
-        return (ssize_t) k;
+        return request_meta_read(m, pos, buf, max);
 }
 
 static int request_handler_fields(
@@ -666,7 +717,7 @@ static int request_handler_fields(
         if (r < 0)
                 return respond_error(connection, MHD_HTTP_BAD_REQUEST, "Failed to query unique fields.\n");
 
-        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4*1024, request_reader_fields, m, NULL);
+        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, BATCH_SIZE, request_reader_fields, m, NULL);
         if (!response)
                 return respond_oom(connection);
 
@@ -0,0 +1,491 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hashmap.h"
+#include "util.h"
+#include "compress.h"
+#include "mmap-cache.h"
+#include "journal-file.h"
+#include "journal-internal.h"
+#include "journal-grep.h"
+
+#define GREP_WORKERS_MAX 16U
+
+#define MESSAGE_FIELD "MESSAGE"
+
+/* What we know about the MESSAGE= data objects of one file */
+typedef struct GrepFile {
+        char *path;
+        sd_id128_t file_id;
+
+        /* All data objects up to here have been looked at. Newer
+         * ones are appended behind the tail object, hence have
+         * higher offsets. */
+        uint64_t scanned_until;
+
+        /* Offsets of the matching data objects, sorted */
+        uint64_t *matches;
+        unsigned n_matches;
+        size_t n_allocated;
+} GrepFile;
+
+typedef struct GrepJob {
+        GrepFile *file;
+        int r;
+} GrepJob;
+
+struct JournalGrep {
+        char *pattern;
+        size_t pattern_size;
+        bool ignore_case;
+
+        /* Only touched by the reader */
+        Hashmap *files;
+        void *buffer;
+        uint64_t buffer_size;
+};
+
+typedef struct GrepScan {
+        JournalGrep *grep;
+
+        pthread_mutex_t mutex;
+        GrepJob *jobs;
+        unsigned n_jobs, next_job;
+} GrepScan;
+
+static int uint64_compare(const void *a, const void *b) {
+        const uint64_t *x = a, *y = b;
+
+        return *x < *y ? -1 : *x > *y ? 1 : 0;
+}
+
+static void grep_file_free(GrepFile *gf) {
+        if (!gf)
+                return;
+
+        free(gf->path);
+        free(gf->matches);
+        free(gf);
+}
+
+static bool grep_match(JournalGrep *g, const char *p, size_t l) {
+        const char *e;
+
+        assert(g);
+        assert(p);
+
+        /* Skip the field name */
+        if (l < strlen(MESSAGE_FIELD "=") ||
+            memcmp(p, MESSAGE_FIELD "=", strlen(MESSAGE_FIELD "=")) != 0)
+                return false;
+
+        p += strlen(MESSAGE_FIELD "=");
+        l -= strlen(MESSAGE_FIELD "=");
+
+        if (l < g->pattern_size)
+                return false;
+
+        /* memmem() is vectorized by glibc, so let it find
+         * candidates for us whenever case matters */
+        if (!g->ignore_case)
+                return !!memmem(p, l, g->pattern, g->pattern_size);
+
+        if (g->pattern_size == 0)
+                return true;
+
+        for (e = p + l - g->pattern_size; p <= e; p++) {
+                size_t k;
+
+                if (tolower((unsigned char) *p) != g->pattern[0])
+                        continue;
+
+                for (k = 1; k < g->pattern_size; k++)
+                        if (tolower((unsigned char) p[k]) != g->pattern[k])
+                                break;
+
+                if (k >= g->pattern_size)
+                        return true;
+        }
+
+        return false;
+}
+
+/* Looks at all MESSAGE= data objects of f newer than
+ * gf->scanned_until, and records the matching ones in gf */
+static int grep_scan_file(JournalGrep *g, JournalFile *f, GrepFile *gf, void **buffer, uint64_t *buffer_size) {
+        uint64_t q, until, tail;
+        unsigned n_new = 0;
+        Object *o;
+        int r;
+
+        assert(g);
+        assert(f);
+        assert(gf);
+
+        until = gf->scanned_until;
+        tail = le64toh(f->header->tail_object_offset);
+
+        r = journal_file_find_field_object(f, MESSAGE_FIELD, strlen(MESSAGE_FIELD), &o, NULL);
+        if (r < 0)
+                return r;
+        if (r == 0) {
+                gf->scanned_until = MAX(until, tail);
+                return 0;
+        }
+
+        /* New data objects are prepended to the list of their
+         * field, hence it is sorted by offset, newest first */
+        for (q = le64toh(o->field.head_data_offset); q > until; q = le64toh(o->data.next_field_offset)) {
+                uint64_t l;
+                int compression;
+                bool b;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, q, &o);
+                if (r < 0)
+                        return r;
+
+                l = le64toh(o->object.size) - offsetof(Object, data.payload);
+                compression = o->object.flags & OBJECT_COMPRESSION_MASK;
+
+                if (compression) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+                        uint64_t rsize;
+
+                        if (!uncompress_blob(compression, o->data.payload, l, buffer, buffer_size, &rsize, 0))
+                                return -EBADMSG;
+
+                        b = grep_match(g, *buffer, rsize);
+#else
+                        return -EPROTONOSUPPORT;
+#endif
+                } else
+                        b = grep_match(g, (const char*) o->data.payload, l);
+
+                if (!b)
+                        continue;
+
+                if (!GREEDY_REALLOC(gf->matches, gf->n_allocated, gf->n_matches + 1))
+                        return -ENOMEM;
+
+                gf->matches[gf->n_matches++] = q;
+                n_new++;
+        }
+
+        if (n_new > 0)
+                qsort(gf->matches, gf->n_matches, sizeof(uint64_t), uint64_compare);
+
+        gf->scanned_until = MAX(until, tail);
+        return 0;
+}
+
+static void *worker_thread(void *userdata) {
+        GrepScan *s = userdata;
+        MMapCache *m;
+        void *buffer = NULL;
+        uint64_t buffer_size = 0;
+
+        m = mmap_cache_new();
+        if (!m)
+                return NULL;
+
+        for (;;) {
+                GrepJob *job;
+                JournalFile *f;
+
+                assert_se(pthread_mutex_lock(&s->mutex) == 0);
+                job = s->next_job < s->n_jobs ? s->jobs + s->next_job++ : NULL;
+                assert_se(pthread_mutex_unlock(&s->mutex) == 0);
+
+                if (!job)
+                        break;
+
+                /* Never touch the reader's JournalFile, but open
+                 * our own handle of the same file */
+                job->r = journal_file_open(job->file->path, O_RDONLY, 0, 0, false, NULL, m, NULL, &f);
+                if (job->r < 0)
+                        continue;
+
+                if (sd_id128_equal(f->header->file_id, job->file->file_id))
+                        job->r = grep_scan_file(s->grep, f, job->file, &buffer, &buffer_size);
+                else
+                        job->r = -ESTALE;
+
+                journal_file_close(f);
+        }
+
+        free(buffer);
+        mmap_cache_unref(m);
+
+        return NULL;
+}
+
+static GrepFile* grep_file_new(JournalFile *f) {
+        GrepFile *gf;
+
+        assert(f);
+
+        gf = new0(GrepFile, 1);
+        if (!gf)
+                return NULL;
+
+        gf->path = strdup(f->path);
+        if (!gf->path) {
+                free(gf);
+                return NULL;
+        }
+
+        gf->file_id = f->header->file_id;
+
+        return gf;
+}
+
+/* Returns the state of f, searching it right away in this thread if
+ * it was not searched before */
+static int grep_get_file(JournalGrep *g, JournalFile *f, GrepFile **ret) {
+        GrepFile *gf;
+        int r;
+
+        assert(g);
+        assert(f);
+        assert(ret);
+
+        gf = hashmap_get(g->files, f->path);
+        if (gf && sd_id128_equal(gf->file_id, f->header->file_id)) {
+                *ret = gf;
+                return 0;
+        }
+
+        if (gf) {
+                /* The file has been replaced under the same name */
+                hashmap_remove(g->files, gf->path);
+                grep_file_free(gf);
+        }
+
+        gf = grep_file_new(f);
+        if (!gf)
+                return -ENOMEM;
+
+        r = grep_scan_file(g, f, gf, &g->buffer, &g->buffer_size);
+        if (r < 0) {
+                grep_file_free(gf);
+                return r;
+        }
+
+        r = hashmap_put(g->files, gf->path, gf);
+        if (r < 0) {
+                grep_file_free(gf);
+                return r;
+        }
+
+        *ret = gf;
+        return 0;
+}
+
+int journal_grep_new(JournalGrep **ret, const char *pattern, bool ignore_case) {
+        JournalGrep *g;
+        size_t i;
+
+        assert(ret);
+        assert(pattern);
+
+        g = new0(JournalGrep, 1);
+        if (!g)
+                return -ENOMEM;
+
+        g->pattern = strdup(pattern);
+        g->files = hashmap_new(string_hash_func, string_compare_func);
+        if (!g->pattern || !g->files) {
+                journal_grep_free(g);
+                return -ENOMEM;
+        }
+
+        g->pattern_size = strlen(pattern);
+        g->ignore_case = ignore_case;
+
+        if (ignore_case)
+                for (i = 0; i < g->pattern_size; i++)
+                        g->pattern[i] = tolower((unsigned char) g->pattern[i]);
+
+        *ret = g;
+        return 0;
+}
+
+void journal_grep_free(JournalGrep *g) {
+        GrepFile *gf;
+
+        if (!g)
+                return;
+
+        while ((gf = hashmap_steal_first(g->files)))
+                grep_file_free(gf);
+        hashmap_free(g->files);
+
+        free(g->buffer);
+        free(g->pattern);
+        free(g);
+}
+
+int journal_grep_scan(JournalGrep *g, sd_journal *j) {
+        GrepScan s = {
+                .grep = g,
+        };
+        pthread_t threads[GREP_WORKERS_MAX];
+        unsigned n_threads = 0, n_workers, i;
+        sigset_t ss, saved_ss;
+        JournalFile *f;
+        Iterator it;
+        long cpus;
+        int r = 0;
+
+        assert(g);
+        assert(j);
+
+        s.jobs = new0(GrepJob, hashmap_size(j->files));
+        if (!s.jobs)
+                return -ENOMEM;
+
+        HASHMAP_FOREACH(f, j->files, it) {
+                GrepFile *gf;
+
+                gf = hashmap_get(g->files, f->path);
+                if (gf && sd_id128_equal(gf->file_id, f->header->file_id))
+                        continue;
+
+                gf = grep_file_new(f);
+                if (!gf) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                s.jobs[s.n_jobs++].file = gf;
+        }
+
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus < 1)
+                cpus = 1;
+        n_workers = MIN((unsigned long) cpus, GREP_WORKERS_MAX);
+        n_workers = MIN(n_workers, s.n_jobs);
+
+        if (n_workers > 1) {
+                assert_se(pthread_mutex_init(&s.mutex, NULL) == 0);
+
+                /* Signals are for the thread that opened the
+                 * journal, not for us */
+                assert_se(sigfillset(&ss) >= 0);
+                assert_se(pthread_sigmask(SIG_SETMASK, &ss, &saved_ss) == 0);
+
+                for (n_threads = 0; n_threads < n_workers; n_threads++)
+                        if (pthread_create(threads + n_threads, NULL, worker_thread, &s) != 0)
+                                break;
+
+                assert_se(pthread_sigmask(SIG_SETMASK, &saved_ss, NULL) == 0);
+
+                for (i = 0; i < n_threads; i++)
+                        pthread_join(threads[i], NULL);
+
+                pthread_mutex_destroy(&s.mutex);
+        }
+
+        for (i = 0; i < s.n_jobs; i++) {
+                GrepJob *job = s.jobs + i;
+                GrepFile *old;
+
+                /* Files no worker got to, or which a worker failed
+                 * to search, are searched on demand instead */
+                if (i >= s.next_job || job->r < 0)
+                        continue;
+
+                old = hashmap_remove(g->files, job->file->path);
+                grep_file_free(old);
+
+                if (hashmap_put(g->files, job->file->path, job->file) < 0)
+                        continue;
+
+                job->file = NULL;
+        }
+
+finish:
+        for (i = 0; i < s.n_jobs; i++)
+                grep_file_free(s.jobs[i].file);
+        free(s.jobs);
+
+        return r;
+}
+
+int journal_grep_test(JournalGrep *g, sd_journal *j) {
+        JournalFile *f;
+        GrepFile *gf;
+        uint64_t p, n, i;
+        Object *o;
+        int r;
+
+        assert(g);
+        assert(j);
+
+        f = j->current_file;
+        if (!f)
+                return -EADDRNOTAVAIL;
+
+        if (f->current_offset <= 0)
+                return -EADDRNOTAVAIL;
+
+        r = grep_get_file(g, f, &gf);
+        if (r < 0)
+                return r;
+
+        p = f->current_offset;
+        r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
+        if (r < 0)
+                return r;
+
+        n = journal_file_entry_n_items(o);
+        for (i = 0; i < n; i++) {
+                uint64_t q;
+
+                q = le64toh(o->entry.items[i].object_offset);
+
+                if (q > gf->scanned_until) {
+                        /* The entry refers to data objects added
+                         * since we last looked, i.e. we are
+                         * following the file */
+                        r = grep_scan_file(g, f, gf, &g->buffer, &g->buffer_size);
+                        if (r < 0)
+                                return r;
+
+                        r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (bsearch(&q, gf->matches, gf->n_matches, sizeof(uint64_t), uint64_compare))
+                        return 1;
+        }
+
+        return 0;
+}
@@ -0,0 +1,50 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <stdbool.h>
+
+#include "sd-journal.h"
+
+/* Matches the MESSAGE= field of entries against a fixed substring,
+ * for journalctl --grep=. Every MESSAGE= data object of a file is
+ * looked at once only, no matter how many entries refer to it, and
+ * entries are then matched by their data object offsets alone. The
+ * files already open when journal_grep_scan() is called are searched
+ * in parallel, each worker thread with its own handle of the file. */
+
+typedef struct JournalGrep JournalGrep;
+
+int journal_grep_new(JournalGrep **ret, const char *pattern, bool ignore_case);
+void journal_grep_free(JournalGrep *g);
+
+/* Searches all files currently open in j */
+int journal_grep_scan(JournalGrep *g, sd_journal *j);
+
+/* Returns > 0 if the current entry of j matches. Files and data
+ * objects that showed up since the scan are searched on demand. */
+int journal_grep_test(JournalGrep *g, sd_journal *j);
+
+static inline void journal_grep_freep(JournalGrep **g) {
+        journal_grep_free(*g);
+}
+
+#define _cleanup_journal_grep_free_ __attribute__((cleanup(journal_grep_freep)))
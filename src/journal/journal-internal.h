@@ -31,11 +31,16 @@
 #include "list.h"
 #include "hashmap.h"
 #include "set.h"
+#include "prioq.h"
 #include "journal-file.h"
+#include "journal-prefetch.h"
+#include "catalog.h"
 
 typedef struct Match Match;
 typedef struct Location Location;
+typedef struct JournalHeapItem JournalHeapItem;
 typedef struct Directory Directory;
+typedef struct DeferredFile DeferredFile;
 
 typedef enum MatchType {
         MATCH_DISCRETE,
@@ -52,6 +57,7 @@ struct Match {
         char *data;
         size_t size;
         le64_t le_hash;
+        le64_t le_xxhash;
 
         /* For terms */
         LIST_HEAD(Match, matches);
@@ -87,6 +93,20 @@ struct Location {
 
         uint64_t xor_hash;
         bool xor_hash_set;
+
+        /* Where the entry was found, if the location came from a
+         * cursor. Only a hint, the file might be gone by now. */
+        sd_id128_t file_id;
+        uint64_t offset;
+        bool offset_set;
+};
+
+/* The next entry of a file when iterating in some direction */
+struct JournalHeapItem {
+        JournalFile *file;
+        uint64_t offset;
+        Location location;
+        unsigned idx;
 };
 
 struct Directory {
@@ -95,6 +115,14 @@ struct Directory {
         bool is_root;
 };
 
+/* An archived file not opened yet, see journal_open_newest() */
+struct DeferredFile {
+        char *prefix;
+        char *filename;
+        size_t series_length;
+        usec_t head_realtime;
+};
+
 struct sd_journal {
         int flags;
 
@@ -102,12 +130,26 @@ struct sd_journal {
 
         Hashmap *files;
         MMapCache *mmap;
+        JournalFdLimit fd_limit;
 
         Location current_location;
 
         JournalFile *current_file;
         uint64_t current_field;
 
+        /* The next entry of every file, ordered, so that stepping
+         * through all files is O(log n). Only valid if heap is
+         * non-NULL. */
+        Prioq *heap;
+        JournalHeapItem *heap_items;
+        direction_t heap_direction;
+
+        /* Only with SD_JOURNAL_PARALLEL */
+        JournalPrefetch *prefetch;
+
+        /* Opened on the first catalog lookup and kept mapped */
+        Catalog *catalog;
+
         Hashmap *directories_by_path;
         Hashmap *directories_by_wd;
 
@@ -121,6 +163,11 @@ struct sd_journal {
         JournalFile *unique_file;
         uint64_t unique_offset;
 
+        /* The hashes of all values enumerated so far, with the
+         * number of entries referencing them */
+        Hashmap *unique_values;
+        bool unique_seen_xxhash64, unique_seen_hash64;
+
         bool on_network;
 
         size_t data_threshold;
@@ -128,7 +175,23 @@ struct sd_journal {
         Set *errors;
 
         usec_t last_process_usec;
+
+        /* How long to let changes pile up before we process them */
+        usec_t wait_latency_usec;
+
+        bool defer_archives;
+        DeferredFile *deferred;
+        unsigned n_deferred;
+        size_t n_deferred_allocated;
 };
 
 char *journal_make_match_string(sd_journal *j);
 void journal_print_header(sd_journal *j);
+int journal_get_mmap_cache_stats(sd_journal *j, MMapCacheStats *ret);
+int journal_get_unique_n_entries(sd_journal *j, const void *data, size_t size, uint64_t *ret);
+
+/* Opens the active journal files only, and leaves archives for later,
+ * for callers interested in the newest entries only */
+int journal_open_newest(sd_journal **ret, int flags);
+int journal_get_deferred_until(sd_journal *j, usec_t *ret);
+int journal_add_deferred_files(sd_journal *j, usec_t since);
@@ -0,0 +1,626 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hashmap.h"
+#include "list.h"
+#include "util.h"
+#include "compress.h"
+#include "mmap-cache.h"
+#include "journal-prefetch.h"
+
+#define PREFETCH_WORKERS_MAX 16U
+
+/* How many entries of a file we try to stay ahead of the reader */
+#define PREFETCH_ENTRIES 64U
+
+/* How much decompressed data we keep around */
+#define PREFETCH_DATA_SIZE_MAX (64ULL*1024ULL*1024ULL)
+
+typedef enum PrefetchJobType {
+        PREFETCH_JOB_READ,
+        PREFETCH_JOB_FORGET,
+} PrefetchJobType;
+
+typedef struct PrefetchJob PrefetchJob;
+typedef struct PrefetchData PrefetchData;
+typedef struct PrefetchWorker PrefetchWorker;
+
+typedef struct PrefetchKey {
+        sd_id128_t file_id;
+        uint64_t offset;
+} PrefetchKey;
+
+struct PrefetchJob {
+        LIST_FIELDS(PrefetchJob, jobs);
+
+        PrefetchJobType type;
+        sd_id128_t file_id;
+        uint64_t offset;
+        direction_t direction;
+        unsigned skip, count;
+        size_t threshold;
+
+        char path[];
+};
+
+struct PrefetchData {
+        PrefetchKey key;
+        LIST_FIELDS(PrefetchData, queue);
+
+        size_t threshold;
+        void *buffer;
+        uint64_t allocated;
+        uint64_t size;
+};
+
+struct PrefetchWorker {
+        JournalPrefetch *prefetch;
+
+        pthread_t thread;
+        bool started;
+        pthread_cond_t cond;
+
+        /* Protected by the prefetch mutex */
+        LIST_HEAD(PrefetchJob, jobs);
+        PrefetchJob *jobs_tail;
+
+        /* Only touched by the worker itself */
+        Hashmap *files;
+        MMapCache *mmap;
+};
+
+/* What the reader remembers about each file it stepped through */
+typedef struct PrefetchFile {
+        unsigned worker;
+        direction_t direction;
+        unsigned ahead;
+} PrefetchFile;
+
+struct JournalPrefetch {
+        pthread_mutex_t mutex;
+        bool quit;
+
+        PrefetchWorker *workers;
+        unsigned n_workers;
+
+        /* Protected by the mutex. Oldest first, so that we can
+         * evict in FIFO order. */
+        Hashmap *data;
+        LIST_HEAD(PrefetchData, queue);
+        PrefetchData *queue_tail;
+        uint64_t data_size;
+
+        /* Only touched by the reader */
+        Hashmap *files;
+};
+
+static unsigned prefetch_key_hash_func(const void *p) {
+        const PrefetchKey *k = p;
+
+        return (unsigned) (k->offset ^ (k->offset >> 32) ^
+                           k->file_id.qwords[0] ^ (k->file_id.qwords[0] >> 32) ^
+                           k->file_id.qwords[1] ^ (k->file_id.qwords[1] >> 32));
+}
+
+static int prefetch_key_compare_func(const void *a, const void *b) {
+        const PrefetchKey *x = a, *y = b;
+
+        if (x->offset < y->offset)
+                return -1;
+        if (x->offset > y->offset)
+                return 1;
+
+        return memcmp(&x->file_id, &y->file_id, sizeof(x->file_id));
+}
+
+static void prefetch_data_drop(JournalPrefetch *p, PrefetchData *d) {
+        assert(p);
+        assert(d);
+
+        hashmap_remove(p->data, &d->key);
+
+        if (p->queue_tail == d)
+                p->queue_tail = d->queue_prev;
+        LIST_REMOVE(PrefetchData, queue, p->queue, d);
+
+        assert(p->data_size >= d->allocated);
+        p->data_size -= d->allocated;
+
+        free(d->buffer);
+        free(d);
+}
+
+static bool prefetch_data_exists(JournalPrefetch *p, const PrefetchKey *key) {
+        bool b;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+        b = !!hashmap_get(p->data, key);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        return b;
+}
+
+static void prefetch_data_add(JournalPrefetch *p, PrefetchData *d) {
+        assert(p);
+        assert(d);
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        if (hashmap_put(p->data, &d->key, d) < 0) {
+                assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+                free(d->buffer);
+                free(d);
+                return;
+        }
+
+        LIST_INSERT_AFTER(PrefetchData, queue, p->queue, p->queue_tail, d);
+        p->queue_tail = d;
+        p->data_size += d->allocated;
+
+        while (p->data_size > PREFETCH_DATA_SIZE_MAX && p->queue != d)
+                prefetch_data_drop(p, p->queue);
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+}
+
+static JournalFile* worker_get_file(PrefetchWorker *w, const char *path, sd_id128_t file_id) {
+        JournalFile *f;
+        int r;
+
+        assert(w);
+        assert(path);
+
+        f = hashmap_get(w->files, path);
+        if (f) {
+                if (sd_id128_equal(f->header->file_id, file_id))
+                        return f;
+
+                /* The file has been replaced under the same
+                 * name */
+                hashmap_remove(w->files, f->path);
+                journal_file_close(f);
+        }
+
+        r = journal_file_open(path, O_RDONLY, 0, 0, false, NULL, w->mmap, NULL, &f);
+        if (r < 0) {
+                log_debug("Failed to open %s for prefetching: %s", path, strerror(-r));
+                return NULL;
+        }
+
+        if (!sd_id128_equal(f->header->file_id, file_id) ||
+            hashmap_put(w->files, f->path, f) < 0) {
+                journal_file_close(f);
+                return NULL;
+        }
+
+        return f;
+}
+
+static void worker_forget_file(PrefetchWorker *w, const char *path) {
+        JournalFile *f;
+
+        assert(w);
+        assert(path);
+
+        f = hashmap_remove(w->files, path);
+        if (f)
+                journal_file_close(f);
+}
+
+static void worker_prefetch_data(PrefetchWorker *w, JournalFile *f, const PrefetchJob *job, uint64_t offset) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+        PrefetchKey key = {
+                .file_id = job->file_id,
+                .offset = offset,
+        };
+        PrefetchData *d;
+        void *buffer = NULL;
+        uint64_t allocated = 0, rsize, l;
+        Object *o;
+        int r;
+
+        if (prefetch_data_exists(w->prefetch, &key))
+                return;
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, offset, &o);
+        if (r < 0)
+                return;
+
+        if (!(o->object.flags & OBJECT_COMPRESSION_MASK))
+                return;
+
+        l = le64toh(o->object.size) - offsetof(Object, data.payload);
+
+        if (!uncompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                             o->data.payload, l, &buffer, &allocated, &rsize, job->threshold)) {
+                free(buffer);
+                return;
+        }
+
+        d = new0(PrefetchData, 1);
+        if (!d) {
+                free(buffer);
+                return;
+        }
+
+        d->key = key;
+        d->threshold = job->threshold;
+        d->buffer = buffer;
+        d->allocated = allocated;
+        d->size = rsize;
+
+        prefetch_data_add(w->prefetch, d);
+#endif
+}
+
+static void worker_run_job(PrefetchWorker *w, const PrefetchJob *job) {
+        JournalFile *f;
+        uint64_t p;
+        Object *o;
+        unsigned i;
+        int r;
+
+        assert(w);
+        assert(job);
+
+        if (job->type == PREFETCH_JOB_FORGET) {
+                worker_forget_file(w, job->path);
+                return;
+        }
+
+        f = worker_get_file(w, job->path, job->file_id);
+        if (!f)
+                return;
+
+        p = job->offset;
+        r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
+        if (r < 0)
+                return;
+
+        for (i = 0; i < job->skip + job->count; i++) {
+                uint64_t k, n;
+
+                if (i > 0) {
+                        r = journal_file_next_entry(f, o, p, job->direction, &o, &p);
+                        if (r <= 0)
+                                return;
+                }
+
+                if (i < job->skip)
+                        continue;
+
+                n = journal_file_entry_n_items(o);
+                for (k = 0; k < n; k++) {
+                        /* Moving to the data object might have
+                         * invalidated the entry, hence look it up
+                         * again */
+                        r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
+                        if (r < 0)
+                                return;
+
+                        worker_prefetch_data(w, f, job, le64toh(o->entry.items[k].object_offset));
+                }
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
+                if (r < 0)
+                        return;
+        }
+}
+
+static void *worker_thread(void *userdata) {
+        PrefetchWorker *w = userdata;
+        JournalPrefetch *p = w->prefetch;
+
+        for (;;) {
+                PrefetchJob *job;
+
+                assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+                while (!w->jobs && !p->quit)
+                        assert_se(pthread_cond_wait(&w->cond, &p->mutex) == 0);
+
+                if (p->quit) {
+                        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+                        break;
+                }
+
+                job = w->jobs;
+                if (w->jobs_tail == job)
+                        w->jobs_tail = NULL;
+                LIST_REMOVE(PrefetchJob, jobs, w->jobs, job);
+
+                assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+                worker_run_job(w, job);
+                free(job);
+        }
+
+        return NULL;
+}
+
+static int worker_submit(JournalPrefetch *p, unsigned worker, PrefetchJobType type, JournalFile *f,
+                         uint64_t offset, direction_t direction, unsigned skip, size_t threshold) {
+        PrefetchWorker *w;
+        PrefetchJob *job;
+        size_t l;
+
+        assert(p);
+        assert(worker < p->n_workers);
+        assert(f);
+
+        l = strlen(f->path);
+        job = malloc0(offsetof(PrefetchJob, path) + l + 1);
+        if (!job)
+                return -ENOMEM;
+
+        job->type = type;
+        job->file_id = f->header->file_id;
+        job->offset = offset;
+        job->direction = direction;
+        job->skip = skip;
+        job->count = PREFETCH_ENTRIES;
+        job->threshold = threshold;
+        memcpy(job->path, f->path, l + 1);
+
+        w = p->workers + worker;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+        LIST_INSERT_AFTER(PrefetchJob, jobs, w->jobs, w->jobs_tail, job);
+        w->jobs_tail = job;
+        assert_se(pthread_cond_signal(&w->cond) == 0);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        return 0;
+}
+
+int journal_prefetch_new(JournalPrefetch **ret) {
+        JournalPrefetch *p;
+        sigset_t ss, saved_ss;
+        long cpus;
+        unsigned i;
+        int r;
+
+        assert(ret);
+
+        p = new0(JournalPrefetch, 1);
+        if (!p)
+                return -ENOMEM;
+
+        assert_se(pthread_mutex_init(&p->mutex, NULL) == 0);
+
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus < 1)
+                cpus = 1;
+        p->n_workers = MIN((unsigned long) cpus, PREFETCH_WORKERS_MAX);
+
+        p->workers = new0(PrefetchWorker, p->n_workers);
+        p->data = hashmap_new(prefetch_key_hash_func, prefetch_key_compare_func);
+        p->files = hashmap_new(trivial_hash_func, trivial_compare_func);
+        if (!p->workers || !p->data || !p->files) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        for (i = 0; i < p->n_workers; i++) {
+                PrefetchWorker *w = p->workers + i;
+
+                w->prefetch = p;
+                assert_se(pthread_cond_init(&w->cond, NULL) == 0);
+
+                w->files = hashmap_new(string_hash_func, string_compare_func);
+                w->mmap = mmap_cache_new();
+                if (!w->files || !w->mmap) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+        }
+
+        /* Signals are for the thread that opened the journal, not
+         * for us */
+        assert_se(sigfillset(&ss) >= 0);
+        assert_se(pthread_sigmask(SIG_SETMASK, &ss, &saved_ss) == 0);
+
+        for (i = 0; i < p->n_workers; i++) {
+                PrefetchWorker *w = p->workers + i;
+
+                r = pthread_create(&w->thread, NULL, worker_thread, w);
+                if (r != 0) {
+                        r = -r;
+                        break;
+                }
+
+                w->started = true;
+        }
+
+        assert_se(pthread_sigmask(SIG_SETMASK, &saved_ss, NULL) == 0);
+
+        if (i < p->n_workers)
+                goto fail;
+
+        *ret = p;
+        return 0;
+
+fail:
+        journal_prefetch_free(p);
+        return r;
+}
+
+void journal_prefetch_free(JournalPrefetch *p) {
+        PrefetchFile *pf;
+        unsigned i;
+
+        if (!p)
+                return;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+        p->quit = true;
+        for (i = 0; i < p->n_workers; i++)
+                if (p->workers[i].started)
+                        assert_se(pthread_cond_signal(&p->workers[i].cond) == 0);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        for (i = 0; p->workers && i < p->n_workers; i++) {
+                PrefetchWorker *w = p->workers + i;
+                PrefetchJob *job;
+                JournalFile *f;
+
+                if (w->started)
+                        pthread_join(w->thread, NULL);
+
+                while ((job = w->jobs)) {
+                        LIST_REMOVE(PrefetchJob, jobs, w->jobs, job);
+                        free(job);
+                }
+
+                while ((f = hashmap_steal_first(w->files)))
+                        journal_file_close(f);
+                hashmap_free(w->files);
+
+                if (w->mmap)
+                        mmap_cache_unref(w->mmap);
+
+                pthread_cond_destroy(&w->cond);
+        }
+
+        while (p->queue)
+                prefetch_data_drop(p, p->queue);
+        hashmap_free(p->data);
+
+        while ((pf = hashmap_steal_first(p->files)))
+                free(pf);
+        hashmap_free(p->files);
+
+        pthread_mutex_destroy(&p->mutex);
+
+        free(p->workers);
+        free(p);
+}
+
+void journal_prefetch_schedule(JournalPrefetch *p, JournalFile *f, uint64_t offset, direction_t direction, size_t threshold) {
+        PrefetchFile *pf;
+
+        assert(p);
+        assert(f);
+
+        /* Nothing to win for uncompressed files */
+        if (!(le32toh(f->header->incompatible_flags) & (HEADER_INCOMPATIBLE_COMPRESSED_XZ|HEADER_INCOMPATIBLE_COMPRESSED_LZ4)))
+                return;
+
+        pf = hashmap_get(p->files, f);
+        if (!pf) {
+                pf = new0(PrefetchFile, 1);
+                if (!pf)
+                        return;
+
+                /* Always hand the same file to the same worker, so
+                 * that each file is opened at most once more */
+                pf->worker = string_hash_func(f->path) % p->n_workers;
+                pf->direction = direction;
+
+                if (hashmap_put(p->files, f, pf) < 0) {
+                        free(pf);
+                        return;
+                }
+        }
+
+        if (pf->direction != direction) {
+                pf->direction = direction;
+                pf->ahead = 0;
+        } else if (pf->ahead > 0)
+                pf->ahead--;
+
+        if (pf->ahead > PREFETCH_ENTRIES / 2)
+                return;
+
+        if (worker_submit(p, pf->worker, PREFETCH_JOB_READ, f, offset, direction, pf->ahead, threshold) < 0)
+                return;
+
+        pf->ahead += PREFETCH_ENTRIES;
+}
+
+void journal_prefetch_forget(JournalPrefetch *p, JournalFile *f) {
+        PrefetchFile *pf;
+
+        assert(p);
+        assert(f);
+
+        pf = hashmap_remove(p->files, f);
+        if (!pf)
+                return;
+
+        /* The worker's own handle of the file has to go too, so
+         * that deleted files don't stay pinned */
+        worker_submit(p, pf->worker, PREFETCH_JOB_FORGET, f, 0, DIRECTION_DOWN, 0, 0);
+        free(pf);
+}
+
+int journal_prefetch_take(JournalPrefetch *p, JournalFile *f, uint64_t offset, size_t threshold,
+                          void **buffer, uint64_t *buffer_size, uint64_t *size) {
+        PrefetchKey key = {
+                .offset = offset,
+        };
+        PrefetchData *d;
+        int r = 0;
+
+        assert(p);
+        assert(f);
+        assert(buffer);
+        assert(buffer_size);
+        assert(size);
+
+        key.file_id = f->header->file_id;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        /* Data objects are shared between entries, hence we keep
+         * our copy around rather than giving it away */
+        d = hashmap_get(p->data, &key);
+        if (d && d->threshold == threshold) {
+
+                if (*buffer_size < d->size) {
+                        void *b;
+
+                        b = realloc(*buffer, d->size);
+                        if (!b) {
+                                r = -ENOMEM;
+                                goto finish;
+                        }
+
+                        *buffer = b;
+                        *buffer_size = d->size;
+                }
+
+                memcpy(*buffer, d->buffer, d->size);
+                *size = d->size;
+                r = 1;
+        }
+
+finish:
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+        return r;
+}
@@ -0,0 +1,46 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include "journal-file.h"
+
+/* Decompresses data objects on worker threads ahead of the reader,
+ * for SD_JOURNAL_PARALLEL. The workers never touch the reader's
+ * JournalFile objects (nor their MMapCache, which is not thread
+ * safe), but open their own handles of the same files. */
+
+typedef struct JournalPrefetch JournalPrefetch;
+
+int journal_prefetch_new(JournalPrefetch **ret);
+void journal_prefetch_free(JournalPrefetch *p);
+
+/* Called by the reader whenever it steps onto an entry of f */
+void journal_prefetch_schedule(JournalPrefetch *p, JournalFile *f, uint64_t offset, direction_t direction, size_t threshold);
+
+/* Called by the reader before f is closed */
+void journal_prefetch_forget(JournalPrefetch *p, JournalFile *f);
+
+/* If the data object at offset in f has already been decompressed,
+ * copies it into the buffer and returns 1 */
+int journal_prefetch_take(JournalPrefetch *p, JournalFile *f, uint64_t offset, size_t threshold,
+                          void **buffer, uint64_t *buffer_size, uint64_t *size);
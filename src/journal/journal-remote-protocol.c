@@ -0,0 +1,402 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "journal-remote-protocol.h"
+#include "compress.h"
+#include "util.h"
+
+/* Single entries barely compress, and are not worth the effort */
+#define COMPRESS_THRESHOLD 512
+
+/* Like journald we put some limits on what a single entry may contain */
+#define ENTRY_FIELDS_MAX 1024
+#define FIELD_NAME_MAX 64
+
+void journal_remote_frame_done(JournalRemoteFrame *f) {
+        assert(f);
+
+        free(f->data);
+        free(f->raw);
+        zero(*f);
+}
+
+static int writev_full(int fd, struct iovec *iovec, unsigned n) {
+
+        while (n > 0) {
+                ssize_t k;
+
+                k = writev(fd, iovec, n);
+                if (k < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return -errno;
+                }
+
+                while (n > 0 && (size_t) k >= iovec->iov_len) {
+                        k -= iovec->iov_len;
+                        iovec++;
+                        n--;
+                }
+
+                if (n > 0) {
+                        iovec->iov_base = (uint8_t*) iovec->iov_base + k;
+                        iovec->iov_len -= k;
+                }
+        }
+
+        return 0;
+}
+
+int journal_remote_send_frame(
+                int fd,
+                JournalRemoteFrameType type,
+                uint64_t seqnum,
+                int compression,
+                const void *data,
+                size_t size) {
+
+        JournalRemoteFrameHeader h = {};
+        _cleanup_free_ void *compressed = NULL;
+        uint64_t compressed_size = 0;
+        struct iovec iovec[2];
+
+        assert(fd >= 0);
+        assert(type > 0 && type < _JOURNAL_REMOTE_FRAME_TYPE_MAX);
+        assert(data || size == 0);
+
+        if (size > JOURNAL_REMOTE_PAYLOAD_MAX)
+                return -E2BIG;
+
+        if (compression != 0 && size >= COMPRESS_THRESHOLD) {
+                compressed = malloc(size);
+                if (!compressed)
+                        return -ENOMEM;
+
+                /* If it doesn't get smaller we send it as it is */
+                if (!compress_blob(compression, data, size, compressed, &compressed_size))
+                        compression = 0;
+        } else
+                compression = 0;
+
+        memcpy(h.signature, JOURNAL_REMOTE_SIGNATURE, sizeof(h.signature));
+        h.type = htole32(type);
+        h.compression = htole32(compression);
+        h.seqnum = htole64(seqnum);
+        h.size = htole64(compression != 0 ? compressed_size : size);
+        h.uncompressed_size = htole64(size);
+
+        /* Header and payload go out in one go, so that the header
+         * doesn't sit in a packet of its own */
+        iovec[0].iov_base = &h;
+        iovec[0].iov_len = sizeof(h);
+        iovec[1].iov_base = compression != 0 ? compressed : (void*) data;
+        iovec[1].iov_len = compression != 0 ? compressed_size : size;
+
+        return writev_full(fd, iovec, iovec[1].iov_len > 0 ? 2 : 1);
+}
+
+static int read_full(int fd, void *p, size_t size) {
+        ssize_t k;
+
+        k = loop_read(fd, p, size, false);
+        if (k < 0)
+                return (int) k;
+        if ((size_t) k != size)
+                return -EPIPE;
+
+        return 0;
+}
+
+int journal_remote_recv_frame(int fd, JournalRemoteFrame *f) {
+        JournalRemoteFrameHeader h;
+        uint64_t size, uncompressed_size;
+        uint32_t type;
+        int compression, r;
+        ssize_t k;
+
+        assert(fd >= 0);
+        assert(f);
+
+        k = loop_read(fd, &h, sizeof(h), false);
+        if (k < 0)
+                return (int) k;
+
+        /* The peer may hang up between frames, but not within one */
+        if (k == 0)
+                return 0;
+        if (k != sizeof(h))
+                return -EPIPE;
+
+        if (memcmp(h.signature, JOURNAL_REMOTE_SIGNATURE, sizeof(h.signature)) != 0)
+                return -EBADMSG;
+
+        type = le32toh(h.type);
+        if (type <= 0 || type >= _JOURNAL_REMOTE_FRAME_TYPE_MAX)
+                return -EBADMSG;
+
+        compression = (int) le32toh(h.compression);
+        if (compression != 0 && !compression_supported(compression))
+                return -EPROTONOSUPPORT;
+
+        size = le64toh(h.size);
+        uncompressed_size = le64toh(h.uncompressed_size);
+
+        if (size > JOURNAL_REMOTE_PAYLOAD_MAX ||
+            uncompressed_size > JOURNAL_REMOTE_PAYLOAD_MAX)
+                return -EBADMSG;
+
+        if (compression == 0 ? size != uncompressed_size : size <= 0 || uncompressed_size <= 0)
+                return -EBADMSG;
+
+        if (compression != 0) {
+                uint64_t rsize;
+
+                if (!GREEDY_REALLOC(f->raw, f->raw_allocated, size))
+                        return -ENOMEM;
+
+                r = read_full(fd, f->raw, size);
+                if (r < 0)
+                        return r;
+
+#ifdef HAVE_LZ4
+                /* LZ4 blobs carry the size they uncompress to, refuse
+                 * one that disagrees with the frame before allocating
+                 * anything for it */
+                if (compression == OBJECT_COMPRESSED_LZ4 &&
+                    (!uncompress_blob_size_lz4(f->raw, size, &rsize) || rsize != uncompressed_size))
+                        return -EBADMSG;
+#endif
+
+                /* Allow one byte more than announced, so that a blob
+                 * uncompressing to more than that is noticed rather
+                 * than silently truncated */
+                if (!uncompress_blob(compression, f->raw, size,
+                                     &f->data, &f->allocated, &rsize, uncompressed_size + 1))
+                        return -EBADMSG;
+
+                if (rsize != uncompressed_size)
+                        return -EBADMSG;
+        } else if (size > 0) {
+
+                if (f->allocated < size) {
+                        void *p;
+
+                        p = realloc(f->data, size);
+                        if (!p)
+                                return -ENOMEM;
+
+                        f->data = p;
+                        f->allocated = size;
+                }
+
+                r = read_full(fd, f->data, size);
+                if (r < 0)
+                        return r;
+        }
+
+        f->type = type;
+        f->seqnum = le64toh(h.seqnum);
+        f->size = uncompressed_size;
+
+        return 1;
+}
+
+void journal_remote_entry_done(JournalRemoteEntry *e) {
+        assert(e);
+
+        free(e->iovec);
+        zero(*e);
+}
+
+static bool valid_field_name(const char *p, size_t l) {
+        const char *a;
+
+        if (l <= 0 || l > FIELD_NAME_MAX)
+                return false;
+
+        if (p[0] >= '0' && p[0] <= '9')
+                return false;
+
+        /* Unlike journald we accept the trusted fields starting with
+         * an underscore, since they were set by the journald of the
+         * sender */
+        for (a = p; a < p + l; a++)
+                if (!((*a >= 'A' && *a <= 'Z') ||
+                      (*a >= '0' && *a <= '9') ||
+                      *a == '_'))
+                        return false;
+
+        return true;
+}
+
+static int parse_usec_field(const char *p, size_t l, uint64_t *ret) {
+        char buf[DECIMAL_STR_MAX(uint64_t)];
+
+        if (l <= 0 || l >= sizeof(buf))
+                return -EBADMSG;
+
+        memcpy(buf, p, l);
+        buf[l] = 0;
+
+        return safe_atou64(buf, ret) < 0 ? -EBADMSG : 0;
+}
+
+static int entry_add_field(JournalRemoteEntry *e, char *p, size_t l, size_t name_length, bool *have_realtime) {
+        const char *value = p + name_length + 1;
+        size_t value_length = l - name_length - 1;
+        int r;
+
+        if (!valid_field_name(p, name_length))
+                return -EBADMSG;
+
+        /* The fields added by the export format itself */
+        if (name_length >= 2 && p[0] == '_' && p[1] == '_') {
+
+                if (name_length == 20 && memcmp(p, "__REALTIME_TIMESTAMP", 20) == 0) {
+                        r = parse_usec_field(value, value_length, &e->ts.realtime);
+                        if (r < 0)
+                                return r;
+
+                        *have_realtime = true;
+
+                } else if (name_length == 21 && memcmp(p, "__MONOTONIC_TIMESTAMP", 21) == 0) {
+                        r = parse_usec_field(value, value_length, &e->ts.monotonic);
+                        if (r < 0)
+                                return r;
+                }
+
+                /* Everything else, the cursor in particular, only
+                 * makes sense on the sending side */
+                return 0;
+        }
+
+        if (name_length == 8 && memcmp(p, "_BOOT_ID", 8) == 0) {
+                char buf[33];
+
+                if (value_length != 32)
+                        return -EBADMSG;
+
+                memcpy(buf, value, 32);
+                buf[32] = 0;
+
+                if (sd_id128_from_string(buf, &e->boot_id) < 0)
+                        return -EBADMSG;
+        }
+
+        if (e->n_iovec >= ENTRY_FIELDS_MAX)
+                return -E2BIG;
+
+        if (!GREEDY_REALLOC(e->iovec, e->n_allocated, e->n_iovec + 1))
+                return -ENOMEM;
+
+        e->iovec[e->n_iovec].iov_base = p;
+        e->iovec[e->n_iovec].iov_len = l;
+        e->n_iovec++;
+
+        return 0;
+}
+
+int journal_remote_parse_entry(char *p, size_t size, size_t *consumed, JournalRemoteEntry *e) {
+        char *q = p, *end = p + size;
+        bool have_realtime = false;
+        int r;
+
+        assert(p || size == 0);
+        assert(consumed);
+        assert(e);
+
+        /* Parses one entry in export format. The field iovecs point
+         * into the buffer, which is modified to turn binary fields
+         * into the FIELD=VALUE form the journal files want. */
+
+        e->n_iovec = 0;
+        zero(e->ts);
+        e->boot_id = SD_ID128_NULL;
+
+        if (size <= 0) {
+                *consumed = 0;
+                return 0;
+        }
+
+        for (;;) {
+                char *n, *eq;
+
+                n = memchr(q, '\n', end - q);
+                if (!n)
+                        return -EBADMSG;
+
+                /* An empty line terminates the entry */
+                if (n == q) {
+                        q++;
+                        break;
+                }
+
+                eq = memchr(q, '=', n - q);
+                if (eq) {
+                        r = entry_add_field(e, q, n - q, eq - q, &have_realtime);
+                        if (r < 0)
+                                return r;
+
+                        q = n + 1;
+                } else {
+                        size_t k = n - q;
+                        le64_t l_le;
+                        uint64_t l;
+                        char *data;
+
+                        /* A binary field: the name on a line of its
+                         * own, followed by the size and the data */
+                        if ((size_t) (end - n - 1) < sizeof(l_le))
+                                return -EBADMSG;
+
+                        memcpy(&l_le, n + 1, sizeof(l_le));
+                        l = le64toh(l_le);
+
+                        data = n + 1 + sizeof(l_le);
+                        if (l >= (uint64_t) (end - data) || data[l] != '\n')
+                                return -EBADMSG;
+
+                        /* Move the name right in front of the data */
+                        memmove(data - k - 1, q, k);
+                        data[-1] = '=';
+
+                        r = entry_add_field(e, data - k - 1, k + 1 + l, k, &have_realtime);
+                        if (r < 0)
+                                return r;
+
+                        q = data + l + 1;
+                }
+
+                if (q >= end)
+                        return -EBADMSG;
+        }
+
+        if (!have_realtime)
+                return -EBADMSG;
+
+        *consumed = q - p;
+        return 1;
+}
@@ -0,0 +1,94 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+#include <systemd/sd-id128.h>
+
+#include "macro.h"
+#include "sparse-endian.h"
+#include "util.h"
+
+/* The stream between systemd-journal-upload and
+ * systemd-journal-remote is a sequence of frames, each a fixed header
+ * followed by its payload. The uploader first sends a HELLO frame
+ * with its machine ID, then ENTRIES frames, each carrying a batch of
+ * entries in the export format, possibly compressed as a whole. The
+ * receiver answers each batch it has written with an ACK frame
+ * carrying the sequence number of that batch, and nothing else. */
+
+#define JOURNAL_REMOTE_PORT 19532
+
+/* Neither compressed nor uncompressed payloads may be larger */
+#define JOURNAL_REMOTE_PAYLOAD_MAX (64ULL*1024ULL*1024ULL)
+
+typedef enum JournalRemoteFrameType {
+        JOURNAL_REMOTE_HELLO = 1,
+        JOURNAL_REMOTE_ENTRIES = 2,
+        JOURNAL_REMOTE_ACK = 3,
+        _JOURNAL_REMOTE_FRAME_TYPE_MAX
+} JournalRemoteFrameType;
+
+typedef struct JournalRemoteFrameHeader {
+        uint8_t signature[8];
+        le32_t type;
+        le32_t compression;
+        le64_t seqnum;
+        le64_t size;
+        le64_t uncompressed_size;
+} _packed_ JournalRemoteFrameHeader;
+
+#define JOURNAL_REMOTE_SIGNATURE ((const char[]) { 'J', 'R', 'M', 'T', 'S', 'T', 'R', '1' })
+
+typedef struct JournalRemoteFrame {
+        JournalRemoteFrameType type;
+        uint64_t seqnum;
+
+        /* The uncompressed payload */
+        void *data;
+        uint64_t size;
+        uint64_t allocated;
+
+        /* The payload as it came in, if compressed */
+        uint8_t *raw;
+        size_t raw_allocated;
+} JournalRemoteFrame;
+
+void journal_remote_frame_done(JournalRemoteFrame *f);
+
+int journal_remote_send_frame(int fd, JournalRemoteFrameType type, uint64_t seqnum, int compression, const void *data, size_t size);
+int journal_remote_recv_frame(int fd, JournalRemoteFrame *f);
+
+typedef struct JournalRemoteEntry {
+        struct iovec *iovec;
+        unsigned n_iovec;
+        size_t n_allocated;
+
+        dual_timestamp ts;
+        sd_id128_t boot_id;
+} JournalRemoteEntry;
+
+void journal_remote_entry_done(JournalRemoteEntry *e);
+
+int journal_remote_parse_entry(char *p, size_t size, size_t *consumed, JournalRemoteEntry *e);
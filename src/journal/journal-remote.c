@@ -0,0 +1,589 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "sd-daemon.h"
+#include "log.h"
+#include "util.h"
+#include "mkdir.h"
+#include "socket-util.h"
+#include "build.h"
+#include "journal-file.h"
+#include "journal-vacuum.h"
+#include "journald-server.h"
+#include "journal-remote-protocol.h"
+
+#define REMOTE_JOURNAL_PATH "/var/log/journal/remote"
+
+static const char *arg_output = REMOTE_JOURNAL_PATH;
+static const char *arg_listen = NULL;
+static bool arg_compress = true;
+
+typedef struct Receiver {
+        JournalFile *file;
+        int lock_fd;
+        JournalMetrics metrics;
+
+        JournalRemoteEntry *entries;
+        size_t n_entries_allocated;
+
+        JournalBatchEntry *batch;
+        size_t n_batch_allocated;
+} Receiver;
+
+static void receiver_done(Receiver *r) {
+        size_t i;
+
+        if (r->file)
+                journal_file_close(r->file);
+
+        for (i = 0; i < r->n_entries_allocated; i++)
+                journal_remote_entry_done(r->entries + i);
+
+        free(r->entries);
+        free(r->batch);
+
+        if (r->lock_fd >= 0)
+                close_nointr_nofail(r->lock_fd);
+}
+
+static int receiver_rotate(Receiver *r) {
+        int k;
+
+        k = journal_file_rotate(&r->file, arg_compress, false);
+        if (k < 0) {
+                log_error("Failed to rotate %s: %s", r->file ? r->file->path : arg_output, strerror(-k));
+                return k;
+        }
+
+        /* All remote machines share the space in the directory */
+        journal_directory_vacuum(arg_output, r->metrics.max_use, r->metrics.keep_free, 0, NULL);
+
+        return 0;
+}
+
+static int receiver_flush(Receiver *r, unsigned n) {
+        unsigned i, done = 0;
+        bool rotated = false;
+        int k;
+
+        if (n <= 0)
+                return 0;
+
+        if (!GREEDY_REALLOC(r->batch, r->n_batch_allocated, n))
+                return log_oom();
+
+        for (i = 0; i < n; i++) {
+                r->batch[i].ts = &r->entries[i].ts;
+                r->batch[i].iovec = r->entries[i].iovec;
+                r->batch[i].n_iovec = r->entries[i].n_iovec;
+        }
+
+        if (journal_file_rotate_suggested(r->file, 0)) {
+                log_debug("%s: Journal header limits reached or header out-of-date, rotating.", r->file->path);
+
+                k = receiver_rotate(r);
+                if (k < 0)
+                        return k;
+        }
+
+        for (;;) {
+                uint64_t before;
+
+                /* The journal file uses the boot ID from its header
+                 * for the entries, like journal_file_copy_entry()
+                 * we set it to the one of the sender */
+                r->file->header->boot_id = r->entries[0].boot_id;
+
+                before = le64toh(r->file->header->n_entries);
+
+                k = journal_file_append_entries(r->file, r->batch + done, n - done, NULL);
+                if (k >= 0)
+                        return 0;
+
+                /* Entries written before the failing one stay in the
+                 * file, don't write them twice */
+                done += le64toh(r->file->header->n_entries) - before;
+
+                if (rotated || !shall_try_append_again(r->file, k)) {
+                        log_error("Failed to write entry to %s (%u fields), ignoring: %s",
+                                  r->file->path, r->batch[done].n_iovec, strerror(-k));
+
+                        /* Skip over the bad entry */
+                        done++;
+                        if (done >= n)
+                                return 0;
+
+                        rotated = false;
+                        continue;
+                }
+
+                k = receiver_rotate(r);
+                if (k < 0)
+                        return k;
+
+                rotated = true;
+        }
+}
+
+static int receiver_write(Receiver *r, char *p, size_t size) {
+        unsigned n = 0;
+        int k;
+
+        /* Parse the whole batch, and write it in runs of entries with
+         * the same boot ID */
+
+        while (size > 0) {
+                size_t consumed;
+
+                if (n >= r->n_entries_allocated) {
+                        size_t a = MAX(r->n_entries_allocated * 2, (size_t) 64);
+                        JournalRemoteEntry *e;
+
+                        e = realloc(r->entries, a * sizeof(JournalRemoteEntry));
+                        if (!e)
+                                return log_oom();
+
+                        memzero(e + r->n_entries_allocated, (a - r->n_entries_allocated) * sizeof(JournalRemoteEntry));
+                        r->entries = e;
+                        r->n_entries_allocated = a;
+                }
+
+                k = journal_remote_parse_entry(p, size, &consumed, r->entries + n);
+                if (k < 0) {
+                        log_error("Failed to parse entry: %s", strerror(-k));
+                        return k;
+                }
+
+                p += consumed;
+                size -= consumed;
+
+                if (n > 0 && !sd_id128_equal(r->entries[n].boot_id, r->entries[0].boot_id)) {
+                        JournalRemoteEntry t;
+
+                        k = receiver_flush(r, n);
+                        if (k < 0)
+                                return k;
+
+                        /* Start the next run with this entry */
+                        t = r->entries[0];
+                        r->entries[0] = r->entries[n];
+                        r->entries[n] = t;
+                        n = 0;
+                }
+
+                n++;
+        }
+
+        return receiver_flush(r, n);
+}
+
+static int receiver_open(Receiver *r, const char *name) {
+        _cleanup_free_ char *fn = NULL, *lock = NULL;
+        int k;
+
+        k = mkdir_p(arg_output, 0755);
+        if (k < 0) {
+                log_error("Failed to create %s: %s", arg_output, strerror(-k));
+                return k;
+        }
+
+        fn = strjoin(arg_output, "/remote-", name, ".journal", NULL);
+        if (!fn)
+                return log_oom();
+
+        /* Two connections from the same peer would mess up the
+         * files. The lock is taken on a file of its own, since
+         * rotation replaces the journal file, and goes away when we
+         * exit. */
+        lock = strjoin(arg_output, "/.remote-", name, ".lock", NULL);
+        if (!lock)
+                return log_oom();
+
+        r->lock_fd = open(lock, O_RDWR|O_CREAT|O_CLOEXEC|O_NOCTTY, 0600);
+        if (r->lock_fd < 0) {
+                log_error("Failed to open %s: %m", lock);
+                return -errno;
+        }
+
+        if (flock(r->lock_fd, LOCK_EX|LOCK_NB) < 0) {
+                k = -errno;
+                log_error("Another connection is writing %s already.", fn);
+                return k;
+        }
+
+        r->metrics.max_use = (uint64_t) -1;
+        r->metrics.max_size = (uint64_t) -1;
+        r->metrics.min_size = (uint64_t) -1;
+        r->metrics.keep_free = (uint64_t) -1;
+
+        k = journal_file_open_reliably(fn, O_RDWR|O_CREAT, 0640, arg_compress, false, &r->metrics, NULL, NULL, &r->file);
+        if (k < 0) {
+                log_error("Failed to open %s: %s", fn, strerror(-k));
+                return k;
+        }
+
+        return 0;
+}
+
+static char *peer_to_string(int fd) {
+        SocketAddress a = {
+                .size = sizeof(a.sockaddr),
+                .type = SOCK_STREAM,
+        };
+        char *p;
+
+        if (getpeername(fd, &a.sockaddr.sa, &a.size) < 0)
+                return NULL;
+
+        if (socket_address_print(&a, &p) < 0)
+                return NULL;
+
+        return p;
+}
+
+static char *peer_to_name(int fd) {
+        union sockaddr_union sa;
+        socklen_t salen = sizeof(sa);
+        char buf[INET6_ADDRSTRLEN];
+        struct ucred ucred;
+        socklen_t l = sizeof(ucred);
+        char *p;
+
+        /* The machine ID in the greeting is whatever the peer claims
+         * it is, hence name the files after what we know about the
+         * peer ourselves: its address, or its UID on a local
+         * socket. */
+
+        if (getpeername(fd, &sa.sa, &salen) < 0)
+                return NULL;
+
+        switch (sa.sa.sa_family) {
+
+        case AF_INET:
+                if (!inet_ntop(AF_INET, &sa.in4.sin_addr, buf, sizeof(buf)))
+                        return NULL;
+                return strdup(buf);
+
+        case AF_INET6:
+                /* Dual-stack sockets see IPv4 peers as mapped
+                 * addresses, name them like plain IPv4 ones */
+                if (IN6_IS_ADDR_V4MAPPED(&sa.in6.sin6_addr)) {
+                        if (!inet_ntop(AF_INET, sa.in6.sin6_addr.s6_addr + 12, buf, sizeof(buf)))
+                                return NULL;
+                } else if (!inet_ntop(AF_INET6, &sa.in6.sin6_addr, buf, sizeof(buf)))
+                        return NULL;
+                return strdup(buf);
+
+        case AF_UNIX:
+                if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &ucred, &l) < 0 || l != sizeof(ucred))
+                        return NULL;
+                if (asprintf(&p, "uid-%lu", (unsigned long) ucred.uid) < 0)
+                        return NULL;
+                return p;
+
+        default:
+                return NULL;
+        }
+}
+
+static int process_connection(int fd) {
+        _cleanup_free_ char *peer = NULL, *name = NULL;
+        JournalRemoteFrame frame = {};
+        Receiver receiver = {
+                .lock_fd = -1,
+        };
+        uint64_t n_batches = 0;
+        sd_id128_t machine;
+        char ids[33];
+        int r;
+
+        peer = peer_to_string(fd);
+
+        name = peer_to_name(fd);
+        if (!name) {
+                log_error("Failed to identify peer %s.", strna(peer));
+                r = -EINVAL;
+                goto finish;
+        }
+
+        r = journal_remote_recv_frame(fd, &frame);
+        if (r == 0)
+                goto finish;
+        if (r < 0) {
+                log_error("Failed to receive greeting from %s: %s", strna(peer), strerror(-r));
+                goto finish;
+        }
+
+        if (frame.type != JOURNAL_REMOTE_HELLO || frame.size != 32) {
+                log_error("Invalid greeting from %s.", strna(peer));
+                r = -EBADMSG;
+                goto finish;
+        }
+
+        memcpy(ids, frame.data, 32);
+        ids[32] = 0;
+
+        r = sd_id128_from_string(ids, &machine);
+        if (r < 0) {
+                log_error("Invalid machine ID from %s.", strna(peer));
+                goto finish;
+        }
+
+        log_debug("Receiving journal of %s from %s.", ids, strna(peer));
+
+        r = receiver_open(&receiver, name);
+        if (r < 0)
+                goto finish;
+
+        for (;;) {
+                r = journal_remote_recv_frame(fd, &frame);
+                if (r == 0)
+                        break;
+                if (r < 0) {
+                        log_error("Failed to receive from %s: %s", strna(peer), strerror(-r));
+                        goto finish;
+                }
+
+                if (frame.type != JOURNAL_REMOTE_ENTRIES) {
+                        log_error("Unexpected frame from %s.", strna(peer));
+                        r = -EBADMSG;
+                        goto finish;
+                }
+
+                r = receiver_write(&receiver, frame.data, frame.size);
+                if (r < 0)
+                        goto finish;
+
+                /* Only now may the sender forget about the batch */
+                r = journal_remote_send_frame(fd, JOURNAL_REMOTE_ACK, frame.seqnum, 0, NULL, 0);
+                if (r < 0) {
+                        log_error("Failed to acknowledge batch to %s: %s", strna(peer), strerror(-r));
+                        goto finish;
+                }
+
+                n_batches++;
+        }
+
+        log_debug("Connection from %s closed after %llu batches.", strna(peer), (unsigned long long) n_batches);
+        r = 0;
+
+finish:
+        receiver_done(&receiver);
+        journal_remote_frame_done(&frame);
+
+        return r;
+}
+
+static int accept_connections(int fd) {
+        struct sigaction sa = {
+                .sa_handler = SIG_IGN,
+                .sa_flags = SA_NOCLDWAIT|SA_RESTART,
+        };
+
+        /* Every connection gets a process of its own, like with
+         * Accept=yes in the socket unit. Nobody waits for them. */
+        assert_se(sigaction(SIGCHLD, &sa, NULL) == 0);
+
+        for (;;) {
+                int cfd;
+                pid_t pid;
+
+                cfd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+                if (cfd < 0) {
+                        if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED)
+                                continue;
+
+                        log_error("Failed to accept connection: %m");
+                        return -errno;
+                }
+
+                pid = fork();
+                if (pid < 0) {
+                        log_error("Failed to fork: %m");
+                        close_nointr_nofail(cfd);
+                        continue;
+                }
+
+                if (pid == 0) {
+                        close_nointr_nofail(fd);
+                        _exit(process_connection(cfd) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+                }
+
+                close_nointr_nofail(cfd);
+        }
+}
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Receive journal entries from systemd-journal-upload.\n\n"
+               "  -h --help              Show this help\n"
+               "     --version           Show package version\n"
+               "     --listen=ADDRESS    Listen on address instead of passed socket\n"
+               "  -o --output=DIR        Write journal files to directory\n"
+               "                         (default: " REMOTE_JOURNAL_PATH ")\n"
+               "     --no-compress       Don't compress journal files\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+        enum {
+                ARG_VERSION = 0x100,
+                ARG_LISTEN,
+                ARG_NO_COMPRESS,
+        };
+
+        static const struct option options[] = {
+                { "help",        no_argument,       NULL, 'h'             },
+                { "version",     no_argument,       NULL, ARG_VERSION     },
+                { "listen",      required_argument, NULL, ARG_LISTEN      },
+                { "output",      required_argument, NULL, 'o'             },
+                { "no-compress", no_argument,       NULL, ARG_NO_COMPRESS },
+                { NULL,          0,                 NULL, 0               }
+        };
+
+        int c;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "ho:", options, NULL)) >= 0)
+                switch(c) {
+
+                case 'h':
+                        return help();
+
+                case ARG_VERSION:
+                        puts(PACKAGE_STRING);
+                        puts(SYSTEMD_FEATURES);
+                        return 0;
+
+                case ARG_LISTEN:
+                        arg_listen = optarg;
+                        break;
+
+                case 'o':
+                        arg_output = optarg;
+                        break;
+
+                case ARG_NO_COMPRESS:
+                        arg_compress = false;
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+
+        if (optind < argc) {
+                log_error("This program takes no arguments.");
+                return -EINVAL;
+        }
+
+        return 1;
+}
+
+int main(int argc, char *argv[]) {
+        int r, n, fd = -1;
+
+        log_set_target(LOG_TARGET_AUTO);
+        log_parse_environment();
+        log_open();
+
+        umask(0022);
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        ignore_signals(SIGPIPE, -1);
+
+        n = sd_listen_fds(1);
+        if (n < 0) {
+                log_error("Failed to determine passed sockets: %s", strerror(-n));
+                return EXIT_FAILURE;
+        }
+        if (n > 1) {
+                log_error("Can't listen on more than one socket.");
+                return EXIT_FAILURE;
+        }
+
+        if (arg_listen) {
+                SocketAddress a = {
+                        .type = SOCK_STREAM,
+                };
+
+                if (n > 0) {
+                        log_error("Got a socket passed and --listen=, refusing.");
+                        return EXIT_FAILURE;
+                }
+
+                r = socket_address_parse(&a, arg_listen);
+                if (r < 0) {
+                        log_error("Failed to parse address %s.", arg_listen);
+                        return EXIT_FAILURE;
+                }
+
+                r = socket_address_listen(&a, SOMAXCONN, SOCKET_ADDRESS_DEFAULT, NULL,
+                                          false, false, false, 0755, 0666, NULL, &fd);
+                if (r < 0) {
+                        log_error("Failed to listen on %s: %s", arg_listen, strerror(-r));
+                        return EXIT_FAILURE;
+                }
+
+        } else if (n == 1) {
+
+                fd = SD_LISTEN_FDS_START;
+
+                /* With Accept=yes we are handed the connection */
+                if (sd_is_socket(fd, AF_UNSPEC, SOCK_STREAM, 0) > 0)
+                        return process_connection(fd) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+                if (sd_is_socket(fd, AF_UNSPEC, SOCK_STREAM, 1) <= 0) {
+                        log_error("Passed file descriptor is not a stream socket.");
+                        return EXIT_FAILURE;
+                }
+
+        } else {
+                log_error("No socket passed and no --listen= specified.");
+                return EXIT_FAILURE;
+        }
+
+        r = accept_connections(fd);
+        close_nointr_nofail(fd);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -26,15 +26,25 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <printf.h>
+#include <sys/mman.h>
 
 #define SD_JOURNAL_SUPPRESS_LOCATION
 
 #include "sd-journal.h"
+#include "journal-send.h"
 #include "util.h"
 #include "socket-util.h"
+#include "missing.h"
 
 #define SNDBUF_SIZE (8*1024*1024)
 
+/* Messages at least this large are passed in a sealed memfd right
+ * away, instead of trying a datagram first. */
+#define MEMFD_MIN_SIZE (256*1024)
+
+/* The kernel does not take more datagrams per sendmmsg() anyway */
+#define SENDMMSG_MAX 1024U
+
 #define ALLOCA_CODE_FUNC(f, func)                 \
         do {                                      \
                 size_t _fl;                       \
@@ -198,25 +208,13 @@ finish:
         return r;
 }
 
-_public_ int sd_journal_sendv(const struct iovec *iov, int n) {
-        PROTECT_ERRNO;
-        int fd, buffer_fd;
-        struct iovec *w;
-        uint64_t *l;
-        int i, j = 0;
-        struct msghdr mh;
-        struct sockaddr_un sa;
-        ssize_t k;
-        union {
-                struct cmsghdr cmsghdr;
-                uint8_t buf[CMSG_SPACE(sizeof(int))];
-        } control;
-        struct cmsghdr *cmsg;
-        /* We use /dev/shm instead of /tmp here, since we want this to
-         * be a tmpfs, and one that is available from early boot on
-         * and where unprivileged users can create files. */
-        char path[] = "/dev/shm/journal.XXXXXX";
+static int fill_iovec_message(const struct iovec *iov, int n, struct iovec *w, uint64_t *l) {
         bool have_syslog_identifier = false;
+        int i, j = 0;
+
+        /* Serializes the fields in iov in the native protocol into
+         * w, which needs room for n * 5 + 3 entries, and l, for n
+         * entries. Returns the number of entries used in w. */
 
         if (_unlikely_(!iov))
                 return -EINVAL;
@@ -224,9 +222,6 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
         if (_unlikely_(n <= 0))
                 return -EINVAL;
 
-        w = alloca(sizeof(struct iovec) * n * 5 + 3);
-        l = alloca(sizeof(uint64_t) * n);
-
         for (i = 0; i < n; i++) {
                 char *c, *nl;
 
@@ -288,30 +283,37 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
                 IOVEC_SET_STRING(w[j++], "\n");
         }
 
-        fd = journal_fd();
-        if (_unlikely_(fd < 0))
-                return fd;
+        return j;
+}
 
-        zero(sa);
-        sa.sun_family = AF_UNIX;
-        strncpy(sa.sun_path, "/run/systemd/journal/socket", sizeof(sa.sun_path));
+static void journal_socket_address(struct sockaddr_un *sa, struct msghdr *mh) {
+        zero(*sa);
+        sa->sun_family = AF_UNIX;
+        strncpy(sa->sun_path, "/run/systemd/journal/socket", sizeof(sa->sun_path));
 
-        zero(mh);
-        mh.msg_name = &sa;
-        mh.msg_namelen = offsetof(struct sockaddr_un, sun_path) + strlen(sa.sun_path);
-        mh.msg_iov = w;
-        mh.msg_iovlen = j;
+        zero(*mh);
+        mh->msg_name = sa;
+        mh->msg_namelen = offsetof(struct sockaddr_un, sun_path) + strlen(sa->sun_path);
+}
 
-        k = sendmsg(fd, &mh, MSG_NOSIGNAL);
-        if (k >= 0)
-                return 0;
+static int open_buffer_fd(bool *sealable) {
+        /* We use /dev/shm instead of /tmp here, since we want this to
+         * be a tmpfs, and one that is available from early boot on
+         * and where unprivileged users can create files. */
+        char path[] = "/dev/shm/journal.XXXXXX";
+        int buffer_fd;
 
-        if (errno != EMSGSIZE && errno != ENOBUFS)
-                return -errno;
+        assert(sealable);
 
-        /* Message doesn't fit... Let's dump the data in a temporary
-         * file and just pass a file descriptor of it to the other
-         * side */
+        /* If we can seal the memfd the other side can map it
+         * directly instead of reading it. */
+        buffer_fd = memfd_create("journal-message", MFD_ALLOW_SEALING|MFD_CLOEXEC);
+        if (buffer_fd >= 0) {
+                *sealable = true;
+                return buffer_fd;
+        }
+
+        *sealable = false;
 
         buffer_fd = mkostemp(path, O_CLOEXEC|O_RDWR);
         if (buffer_fd < 0)
@@ -322,14 +324,28 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
                 return -errno;
         }
 
-        n = writev(buffer_fd, w, j);
-        if (n < 0) {
+        return buffer_fd;
+}
+
+static int send_buffer_fd(int fd, int buffer_fd, bool sealable) {
+        struct msghdr mh;
+        struct sockaddr_un sa;
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct cmsghdr *cmsg;
+        ssize_t k;
+
+        /* Passes buffer_fd to the other side, and closes it */
+
+        if (sealable &&
+            fcntl(buffer_fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL) < 0) {
                 close_nointr_nofail(buffer_fd);
                 return -errno;
         }
 
-        mh.msg_iov = NULL;
-        mh.msg_iovlen = 0;
+        journal_socket_address(&sa, &mh);
 
         zero(control);
         mh.msg_control = &control;
@@ -352,6 +368,258 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
         return 0;
 }
 
+static int send_message(int fd, struct iovec *w, int j) {
+        struct msghdr mh;
+        struct sockaddr_un sa;
+        int buffer_fd;
+        bool sealable;
+        ssize_t k;
+
+        journal_socket_address(&sa, &mh);
+        mh.msg_iov = w;
+        mh.msg_iovlen = j;
+
+        if (IOVEC_TOTAL_SIZE(w, j) < MEMFD_MIN_SIZE) {
+                k = sendmsg(fd, &mh, MSG_NOSIGNAL);
+                if (k >= 0)
+                        return 0;
+
+                if (errno != EMSGSIZE && errno != ENOBUFS)
+                        return -errno;
+        }
+
+        /* Message doesn't fit... Let's dump the data in a memfd or
+         * temporary file and just pass a file descriptor of it to
+         * the other side. */
+
+        buffer_fd = open_buffer_fd(&sealable);
+        if (buffer_fd < 0)
+                return buffer_fd;
+
+        k = writev(buffer_fd, w, j);
+        if (k < 0) {
+                close_nointr_nofail(buffer_fd);
+                return -errno;
+        }
+
+        return send_buffer_fd(fd, buffer_fd, sealable);
+}
+
+_public_ int sd_journal_sendv(const struct iovec *iov, int n) {
+        PROTECT_ERRNO;
+        int fd;
+        struct iovec *w;
+        uint64_t *l;
+        int j;
+
+        if (_unlikely_(!iov))
+                return -EINVAL;
+
+        if (_unlikely_(n <= 0))
+                return -EINVAL;
+
+        w = alloca(sizeof(struct iovec) * (n * 5 + 3));
+        l = alloca(sizeof(uint64_t) * n);
+
+        j = fill_iovec_message(iov, n, w, l);
+        if (j < 0)
+                return j;
+
+        fd = journal_fd();
+        if (_unlikely_(fd < 0))
+                return fd;
+
+        return send_message(fd, w, j);
+}
+
+_public_ int sd_journal_sendv_batch(const struct iovec * const *iov, const int *n, unsigned n_entries) {
+        PROTECT_ERRNO;
+        _cleanup_free_ struct iovec *w = NULL;
+        _cleanup_free_ uint64_t *l = NULL;
+        _cleanup_free_ struct mmsghdr *mm = NULL;
+        struct sockaddr_un sa;
+        struct msghdr mh;
+        size_t n_w = 0, n_l = 0;
+        bool use_mmsg = true;
+        unsigned i;
+        int fd;
+
+        if (n_entries <= 0)
+                return 0;
+
+        if (_unlikely_(!iov || !n))
+                return -EINVAL;
+
+        for (i = 0; i < n_entries; i++) {
+                if (_unlikely_(!iov[i] || n[i] <= 0))
+                        return -EINVAL;
+
+                n_w += n[i] * 5 + 3;
+                n_l += n[i];
+        }
+
+        w = new(struct iovec, n_w);
+        l = new(uint64_t, n_l);
+        mm = new0(struct mmsghdr, n_entries);
+        if (!w || !l || !mm)
+                return -ENOMEM;
+
+        /* Serialize everything first, so that nothing is sent if
+         * any of the entries is invalid */
+        journal_socket_address(&sa, &mh);
+        n_w = n_l = 0;
+
+        for (i = 0; i < n_entries; i++) {
+                int j;
+
+                j = fill_iovec_message(iov[i], n[i], w + n_w, l + n_l);
+                if (j < 0)
+                        return j;
+
+                mm[i].msg_hdr = mh;
+                mm[i].msg_hdr.msg_iov = w + n_w;
+                mm[i].msg_hdr.msg_iovlen = j;
+
+                n_w += j;
+                n_l += n[i];
+        }
+
+        fd = journal_fd();
+        if (_unlikely_(fd < 0))
+                return fd;
+
+        i = 0;
+        while (i < n_entries) {
+                unsigned k;
+                int r;
+
+                /* Collect the datagrams in a row that may go out
+                 * together */
+                for (k = 0; use_mmsg && i + k < n_entries && k < SENDMMSG_MAX; k++)
+                        if (IOVEC_TOTAL_SIZE(mm[i+k].msg_hdr.msg_iov, mm[i+k].msg_hdr.msg_iovlen) >= MEMFD_MIN_SIZE)
+                                break;
+
+                if (k > 0) {
+                        r = sendmmsg(fd, mm + i, k, MSG_NOSIGNAL);
+                        if (r > 0) {
+                                i += r;
+                                continue;
+                        }
+
+                        if (errno == ENOSYS)
+                                use_mmsg = false;
+                        else if (errno != EMSGSIZE && errno != ENOBUFS)
+                                return -errno;
+                }
+
+                /* Too large for a datagram, or no sendmmsg(), hence
+                 * send this one on its own */
+                r = send_message(fd, mm[i].msg_hdr.msg_iov, mm[i].msg_hdr.msg_iovlen);
+                if (r < 0)
+                        return r;
+
+                i++;
+        }
+
+        return 0;
+}
+
+int journal_sendv_stream(const struct iovec *iov, int n, const char *field, int input_fd, uint64_t max) {
+        PROTECT_ERRNO;
+        int fd, buffer_fd, j, r;
+        struct iovec *w;
+        uint64_t *l, le64, size = 0;
+        size_t fl;
+        off_t offset;
+        bool sealable;
+        ssize_t k;
+
+        if (_unlikely_(!field))
+                return -EINVAL;
+
+        if (_unlikely_(input_fd < 0))
+                return -EINVAL;
+
+        if (_unlikely_(!iov))
+                return -EINVAL;
+
+        if (_unlikely_(n <= 0))
+                return -EINVAL;
+
+        w = alloca(sizeof(struct iovec) * (n * 5 + 3));
+        l = alloca(sizeof(uint64_t) * n);
+
+        j = fill_iovec_message(iov, n, w, l);
+        if (j < 0)
+                return j;
+
+        fd = journal_fd();
+        if (_unlikely_(fd < 0))
+                return fd;
+
+        buffer_fd = open_buffer_fd(&sealable);
+        if (buffer_fd < 0)
+                return buffer_fd;
+
+        k = writev(buffer_fd, w, j);
+        if (k < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        /* The binary field goes last. Its size is only known once
+         * it has been copied, hence fill that in at the end. */
+        fl = strlen(field);
+        offset = k + fl + 1;
+        le64 = 0;
+
+        k = loop_write(buffer_fd, field, fl, false);
+        if (k >= 0)
+                k = loop_write(buffer_fd, "\n", 1, false);
+        if (k >= 0)
+                k = loop_write(buffer_fd, &le64, sizeof(le64), false);
+        if (k < 0) {
+                r = (int) k;
+                goto fail;
+        }
+
+        while (size < max) {
+                uint8_t buffer[64*1024];
+
+                k = loop_read(input_fd, buffer, MIN(sizeof(buffer), max - size), false);
+                if (k < 0) {
+                        r = (int) k;
+                        goto fail;
+                }
+                if (k == 0)
+                        break;
+
+                r = loop_write(buffer_fd, buffer, k, false);
+                if (r < 0)
+                        goto fail;
+
+                size += k;
+        }
+
+        le64 = htole64(size);
+        if (pwrite(buffer_fd, &le64, sizeof(le64), offset) != sizeof(le64)) {
+                r = errno ? -errno : -EIO;
+                goto fail;
+        }
+
+        k = loop_write(buffer_fd, "\n", 1, false);
+        if (k < 0) {
+                r = (int) k;
+                goto fail;
+        }
+
+        return send_buffer_fd(fd, buffer_fd, sealable);
+
+fail:
+        close_nointr_nofail(buffer_fd);
+        return r;
+}
+
 static int fill_iovec_perror_and_send(const char *message, int skip, struct iovec iov[]) {
         PROTECT_ERRNO;
         size_t n, k;
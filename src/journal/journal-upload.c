@@ -0,0 +1,580 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include <systemd/sd-journal.h>
+
+#include "log.h"
+#include "util.h"
+#include "fileio.h"
+#include "mkdir.h"
+#include "socket-util.h"
+#include "logs-show.h"
+#include "build.h"
+#include "compress.h"
+#include "journal-remote-protocol.h"
+
+#define STATE_FILE "/var/lib/systemd/journal-upload/state"
+
+/* Batches are sent as soon as no more entries are available, and
+ * never get larger than this */
+#define BATCH_SIZE_MAX (4U*1024U*1024U)
+
+#define WINDOW_MAX 64U
+
+static const char *arg_remote = NULL;
+static const char *arg_directory = NULL;
+static const char *arg_save_state = STATE_FILE;
+static unsigned arg_batch = 1024;
+static unsigned arg_window = 8;
+static int arg_compression = -1;
+static bool arg_follow = false;
+
+typedef struct Uploader {
+        sd_journal *journal;
+        int fd;
+        int compression;
+
+        /* The batches sent but not acknowledged yet, and the cursor
+         * of the last entry of each, oldest first */
+        char *pending[WINDOW_MAX];
+        unsigned pending_first, n_pending;
+        uint64_t seqnum;
+
+        bool at_end;
+} Uploader;
+
+static int load_state(Uploader *u) {
+        _cleanup_free_ char *cursor = NULL;
+        int r;
+
+        if (!arg_save_state)
+                return 0;
+
+        r = parse_env_file(arg_save_state, NEWLINE, "LAST_CURSOR", &cursor, NULL);
+        if (r == -ENOENT)
+                return 0;
+        if (r < 0) {
+                log_error("Failed to read state file %s: %s", arg_save_state, strerror(-r));
+                return r;
+        }
+
+        if (!cursor)
+                return 0;
+
+        r = sd_journal_seek_cursor(u->journal, cursor);
+        if (r < 0) {
+                log_error("Failed to seek to cursor %s: %s", cursor, strerror(-r));
+                return r;
+        }
+
+        /* Don't send the last entry the receiver got again, unless
+         * it is gone from the journal */
+        r = sd_journal_next(u->journal);
+        if (r < 0)
+                return r;
+
+        if (r > 0 && sd_journal_test_cursor(u->journal, cursor) <= 0) {
+                r = sd_journal_previous(u->journal);
+                if (r < 0)
+                        return r;
+        }
+
+        log_debug("Resuming after %s.", cursor);
+
+        return 0;
+}
+
+static int save_state(const char *cursor) {
+        _cleanup_free_ char *line = NULL;
+        int r;
+
+        if (!arg_save_state)
+                return 0;
+
+        line = strjoin("LAST_CURSOR=", cursor, NULL);
+        if (!line)
+                return log_oom();
+
+        r = write_string_file_atomic(arg_save_state, line);
+        if (r < 0) {
+                log_error("Failed to save state to %s: %s", arg_save_state, strerror(-r));
+                return r;
+        }
+
+        return 0;
+}
+
+static int connect_remote(const char *remote) {
+        _cleanup_free_ char *host = NULL, *port = NULL;
+        SocketAddress a = {
+                .type = SOCK_STREAM,
+        };
+        struct addrinfo hints = {
+                .ai_family = AF_UNSPEC,
+                .ai_socktype = SOCK_STREAM,
+        }, *result = NULL, *i;
+        const char *colon;
+        int fd, r;
+
+        /* Addresses and socket paths first, like in socket units */
+        if (socket_address_parse(&a, remote) >= 0) {
+                fd = socket(socket_address_family(&a), SOCK_STREAM|SOCK_CLOEXEC, 0);
+                if (fd < 0)
+                        return -errno;
+
+                if (connect(fd, &a.sockaddr.sa, a.size) < 0) {
+                        r = -errno;
+                        close_nointr_nofail(fd);
+                        return r;
+                }
+
+                return fd;
+        }
+
+        /* Then host names, with an optional port */
+        colon = strrchr(remote, ':');
+        if (colon) {
+                host = strndup(remote, colon - remote);
+                port = strdup(colon + 1);
+        } else {
+                host = strdup(remote);
+                if (asprintf(&port, "%u", JOURNAL_REMOTE_PORT) < 0)
+                        port = NULL;
+        }
+        if (!host || !port)
+                return -ENOMEM;
+
+        r = getaddrinfo(host, port, &hints, &result);
+        if (r != 0) {
+                log_error("Failed to resolve %s: %s", remote, gai_strerror(r));
+                return -EHOSTUNREACH;
+        }
+
+        r = -EHOSTUNREACH;
+        for (i = result; i; i = i->ai_next) {
+                fd = socket(i->ai_family, i->ai_socktype|SOCK_CLOEXEC, i->ai_protocol);
+                if (fd < 0) {
+                        r = -errno;
+                        continue;
+                }
+
+                if (connect(fd, i->ai_addr, i->ai_addrlen) >= 0) {
+                        r = fd;
+                        break;
+                }
+
+                r = -errno;
+                close_nointr_nofail(fd);
+        }
+
+        freeaddrinfo(result);
+
+        return r;
+}
+
+static int send_batch(Uploader *u) {
+        _cleanup_free_ char *data = NULL, *cursor = NULL;
+        size_t size = 0;
+        unsigned n = 0;
+        FILE *f;
+        int r = 0;
+
+        f = open_memstream(&data, &size);
+        if (!f)
+                return log_oom();
+
+        while (n < arg_batch && (size_t) ftell(f) < BATCH_SIZE_MAX) {
+
+                r = sd_journal_next(u->journal);
+                if (r < 0) {
+                        log_error("Failed to iterate through journal: %s", strerror(-r));
+                        break;
+                }
+
+                if (r == 0) {
+                        u->at_end = true;
+                        break;
+                }
+
+                r = output_journal(f, u->journal, OUTPUT_EXPORT, 0, 0);
+                if (r < 0)
+                        break;
+
+                n++;
+        }
+
+        fclose(f);
+
+        if (r < 0)
+                return r;
+
+        if (n <= 0)
+                return 0;
+
+        r = sd_journal_get_cursor(u->journal, &cursor);
+        if (r < 0) {
+                log_error("Failed to get cursor: %s", strerror(-r));
+                return r;
+        }
+
+        r = journal_remote_send_frame(u->fd, JOURNAL_REMOTE_ENTRIES, u->seqnum + 1, u->compression, data, size);
+        if (r < 0) {
+                log_error("Failed to send batch: %s", strerror(-r));
+                return r;
+        }
+
+        log_debug("Sent batch %llu with %u entries, %zu bytes.", (unsigned long long) u->seqnum + 1, n, size);
+
+        u->seqnum++;
+        u->pending[(u->pending_first + u->n_pending) % WINDOW_MAX] = cursor;
+        u->n_pending++;
+        cursor = NULL;
+
+        return 1;
+}
+
+static int process_ack(Uploader *u, JournalRemoteFrame *frame) {
+        char *last = NULL;
+        uint64_t oldest;
+        int r;
+
+        oldest = u->seqnum - u->n_pending + 1;
+
+        if (frame->type != JOURNAL_REMOTE_ACK ||
+            frame->seqnum < oldest || frame->seqnum > u->seqnum) {
+                log_error("Received invalid acknowledgement.");
+                return -EBADMSG;
+        }
+
+        while (oldest <= frame->seqnum) {
+                free(last);
+                last = u->pending[u->pending_first];
+                u->pending[u->pending_first] = NULL;
+
+                u->pending_first = (u->pending_first + 1) % WINDOW_MAX;
+                u->n_pending--;
+                oldest++;
+        }
+
+        r = save_state(last);
+        free(last);
+
+        return r;
+}
+
+static int upload(Uploader *u) {
+        JournalRemoteFrame frame = {};
+        char ids[33];
+        sd_id128_t machine;
+        int r;
+
+        r = sd_id128_get_machine(&machine);
+        if (r < 0) {
+                log_error("Failed to get machine ID: %s", strerror(-r));
+                return r;
+        }
+
+        r = journal_remote_send_frame(u->fd, JOURNAL_REMOTE_HELLO, 0, 0, sd_id128_to_string(machine, ids), 32);
+        if (r < 0) {
+                log_error("Failed to send greeting: %s", strerror(-r));
+                return r;
+        }
+
+        for (;;) {
+                struct pollfd pollfd[2] = {
+                        { .fd = u->fd, .events = POLLIN },
+                        { .fd = -1 },
+                };
+                uint64_t timeout = (uint64_t) -1;
+                int t = -1;
+
+                /* Keep at most the window of batches in flight. If
+                 * the receiver can't keep up we stop reading the
+                 * journal until it acknowledges some. */
+                while (!u->at_end && u->n_pending < arg_window) {
+                        r = send_batch(u);
+                        if (r < 0)
+                                goto finish;
+                }
+
+                if (u->at_end && u->n_pending <= 0 && !arg_follow) {
+                        r = 0;
+                        break;
+                }
+
+                if (u->at_end && arg_follow && u->n_pending < arg_window) {
+                        pollfd[1].fd = sd_journal_get_fd(u->journal);
+                        if (pollfd[1].fd < 0) {
+                                r = pollfd[1].fd;
+                                log_error("Failed to get journal fd: %s", strerror(-r));
+                                goto finish;
+                        }
+
+                        pollfd[1].events = sd_journal_get_events(u->journal);
+
+                        r = sd_journal_get_timeout(u->journal, &timeout);
+                        if (r < 0)
+                                goto finish;
+
+                        if (timeout != (uint64_t) -1) {
+                                usec_t n;
+
+                                n = now(CLOCK_MONOTONIC);
+                                t = timeout > n ? (int) ((timeout - n + USEC_PER_MSEC - 1) / USEC_PER_MSEC) : 0;
+                        }
+                }
+
+                r = poll(pollfd, pollfd[1].fd >= 0 ? 2 : 1, t);
+                if (r < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        r = -errno;
+                        log_error("poll() failed: %m");
+                        goto finish;
+                }
+
+                if (pollfd[0].revents) {
+                        r = journal_remote_recv_frame(u->fd, &frame);
+                        if (r == 0)
+                                r = -ECONNRESET;
+                        if (r < 0) {
+                                log_error("Failed to receive acknowledgement: %s", strerror(-r));
+                                goto finish;
+                        }
+
+                        r = process_ack(u, &frame);
+                        if (r < 0)
+                                goto finish;
+                }
+
+                if (pollfd[1].fd >= 0) {
+                        r = sd_journal_process(u->journal);
+                        if (r < 0) {
+                                log_error("Failed to process journal events: %s", strerror(-r));
+                                goto finish;
+                        }
+
+                        if (r != SD_JOURNAL_NOP)
+                                u->at_end = false;
+                }
+        }
+
+finish:
+        journal_remote_frame_done(&frame);
+
+        return r;
+}
+
+static int help(void) {
+
+        printf("%s [OPTIONS...] ADDRESS\n\n"
+               "Push journal entries to systemd-journal-remote.\n\n"
+               "  -h --help               Show this help\n"
+               "     --version            Show package version\n"
+               "  -D --directory=PATH     Upload the journal files in directory\n"
+               "  -f --follow             Keep uploading new entries\n"
+               "     --save-state[=FILE]  Remember what was acknowledged\n"
+               "                          (default: " STATE_FILE ")\n"
+               "     --no-save-state      Upload the whole journal, don't remember\n"
+               "     --batch=N            Send up to N entries at once (default: 1024)\n"
+               "     --window=N           Wait for acknowledgements with N batches\n"
+               "                          in flight (default: 8)\n"
+               "     --compress=TYPE      Compress batches with xz, lz4 or no\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+        enum {
+                ARG_VERSION = 0x100,
+                ARG_SAVE_STATE,
+                ARG_NO_SAVE_STATE,
+                ARG_BATCH,
+                ARG_WINDOW,
+                ARG_COMPRESS,
+        };
+
+        static const struct option options[] = {
+                { "help",          no_argument,       NULL, 'h'               },
+                { "version",       no_argument,       NULL, ARG_VERSION       },
+                { "directory",     required_argument, NULL, 'D'               },
+                { "follow",        no_argument,       NULL, 'f'               },
+                { "save-state",    optional_argument, NULL, ARG_SAVE_STATE    },
+                { "no-save-state", no_argument,       NULL, ARG_NO_SAVE_STATE },
+                { "batch",         required_argument, NULL, ARG_BATCH         },
+                { "window",        required_argument, NULL, ARG_WINDOW        },
+                { "compress",      required_argument, NULL, ARG_COMPRESS      },
+                { NULL,            0,                 NULL, 0                 }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "hD:f", options, NULL)) >= 0)
+                switch(c) {
+
+                case 'h':
+                        return help();
+
+                case ARG_VERSION:
+                        puts(PACKAGE_STRING);
+                        puts(SYSTEMD_FEATURES);
+                        return 0;
+
+                case 'D':
+                        arg_directory = optarg;
+                        break;
+
+                case 'f':
+                        arg_follow = true;
+                        break;
+
+                case ARG_SAVE_STATE:
+                        arg_save_state = optarg ? optarg : STATE_FILE;
+                        break;
+
+                case ARG_NO_SAVE_STATE:
+                        arg_save_state = NULL;
+                        break;
+
+                case ARG_BATCH:
+                        r = safe_atou(optarg, &arg_batch);
+                        if (r < 0 || arg_batch <= 0) {
+                                log_error("Failed to parse batch size: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_WINDOW:
+                        r = safe_atou(optarg, &arg_window);
+                        if (r < 0 || arg_window <= 0 || arg_window > WINDOW_MAX) {
+                                log_error("Window must be between 1 and %u: %s", WINDOW_MAX, optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_COMPRESS:
+                        if (streq(optarg, "no"))
+                                arg_compression = 0;
+                        else {
+                                arg_compression = object_compressed_from_string(optarg);
+                                if (arg_compression < 0 || !compression_supported(arg_compression)) {
+                                        log_error("Unsupported compression: %s", optarg);
+                                        return -EINVAL;
+                                }
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+
+        if (optind + 1 != argc) {
+                log_error("This program takes one argument, the address to upload to.");
+                return -EINVAL;
+        }
+
+        arg_remote = argv[optind];
+
+        return 1;
+}
+
+int main(int argc, char *argv[]) {
+        Uploader u = {
+                .fd = -1,
+        };
+        unsigned i;
+        int r;
+
+        log_set_target(LOG_TARGET_AUTO);
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        /* A receiver going away shall not kill us */
+        ignore_signals(SIGPIPE, -1);
+
+        u.compression = arg_compression >= 0 ? arg_compression : compression_default();
+
+        if (arg_save_state) {
+                r = mkdir_parents(arg_save_state, 0755);
+                if (r < 0) {
+                        log_error("Failed to create directory for %s: %s", arg_save_state, strerror(-r));
+                        goto finish;
+                }
+        }
+
+        if (arg_directory)
+                r = sd_journal_open_directory(&u.journal, arg_directory, 0);
+        else
+                r = sd_journal_open(&u.journal, SD_JOURNAL_LOCAL_ONLY);
+        if (r < 0) {
+                log_error("Failed to open journal: %s", strerror(-r));
+                goto finish;
+        }
+
+        r = load_state(&u);
+        if (r < 0)
+                goto finish;
+
+        u.fd = connect_remote(arg_remote);
+        if (u.fd < 0) {
+                r = u.fd;
+                log_error("Failed to connect to %s: %s", arg_remote, strerror(-r));
+                goto finish;
+        }
+
+        r = upload(&u);
+
+finish:
+        for (i = 0; i < WINDOW_MAX; i++)
+                free(u.pending[i]);
+
+        if (u.fd >= 0)
+                close_nointr_nofail(u.fd);
+
+        if (u.journal)
+                sd_journal_close(u.journal);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -34,6 +34,8 @@
 #include "journal-vacuum.h"
 #include "sd-id128.h"
 #include "util.h"
+#include "hashmap.h"
+#include "prioq.h"
 
 struct vacuum_info {
         uint64_t usage;
@@ -44,6 +46,26 @@ struct vacuum_info {
         uint64_t seqnum;
 
         bool have_seqnum;
+
+        unsigned prioq_idx;
+        unsigned generation;
+};
+
+struct JournalVacuumCache {
+        char *directory;
+
+        /* filename → struct vacuum_info, and the same objects
+         * ordered by vacuum_compare() */
+        Hashmap *files;
+        Prioq *queue;
+
+        uint64_t sum;
+
+        /* The directory mtime as of the last time we read it */
+        struct timespec mtime;
+        bool valid;
+
+        unsigned generation;
 };
 
 static int vacuum_compare(const void *_a, const void *_b) {
@@ -147,162 +169,320 @@ static int journal_file_empty(int dir_fd, const char *name) {
         return le64toh(n_entries) == 0;
 }
 
-int journal_directory_vacuum(
-                const char *directory,
-                uint64_t max_use,
-                uint64_t min_free,
-                usec_t max_retention_usec,
-                usec_t *oldest_usec) {
+static void vacuum_info_free(struct vacuum_info *v) {
+        if (!v)
+                return;
 
-        _cleanup_closedir_ DIR *d = NULL;
-        int r = 0;
-        struct vacuum_info *list = NULL;
-        unsigned n_list = 0, i;
-        size_t n_allocated = 0;
-        uint64_t sum = 0, freed = 0;
-        usec_t retention_limit = 0;
+        free(v->filename);
+        free(v);
+}
+
+static void vacuum_cache_drop(JournalVacuumCache *c, struct vacuum_info *v) {
+        assert(c);
+        assert(v);
+
+        prioq_remove(c->queue, v, &v->prioq_idx);
+        hashmap_remove(c->files, v->filename);
+
+        if (v->usage < c->sum)
+                c->sum -= v->usage;
+        else
+                c->sum = 0;
+
+        vacuum_info_free(v);
+}
+
+JournalVacuumCache* journal_vacuum_cache_free(JournalVacuumCache *c) {
+        struct vacuum_info *v;
+
+        if (!c)
+                return NULL;
+
+        while ((v = hashmap_steal_first(c->files)))
+                vacuum_info_free(v);
+
+        hashmap_free(c->files);
+        prioq_free(c->queue);
+        free(c->directory);
+        free(c);
+
+        return NULL;
+}
+
+static int vacuum_cache_new(const char *directory, JournalVacuumCache **ret) {
+        JournalVacuumCache *c;
 
         assert(directory);
+        assert(ret);
+
+        c = new0(JournalVacuumCache, 1);
+        if (!c)
+                return -ENOMEM;
+
+        c->directory = strdup(directory);
+        c->files = hashmap_new(string_hash_func, string_compare_func);
+        c->queue = prioq_new(vacuum_compare);
+        if (!c->directory || !c->files || !c->queue) {
+                journal_vacuum_cache_free(c);
+                return -ENOMEM;
+        }
 
-        if (max_use <= 0 && min_free <= 0 && max_retention_usec <= 0)
+        *ret = c;
+        return 0;
+}
+
+static int vacuum_cache_add(
+                JournalVacuumCache *c,
+                int dir_fd,
+                const char *name,
+                uint64_t *freed) {
+
+        struct vacuum_info *v;
+        struct stat st;
+        size_t q;
+        unsigned long long seqnum = 0, realtime;
+        sd_id128_t seqnum_id = {};
+        bool have_seqnum;
+        char *p;
+        int r;
+
+        assert(c);
+        assert(name);
+        assert(freed);
+
+        q = strlen(name);
+
+        if (endswith(name, ".journal")) {
+
+                /* Vacuum archived files */
+
+                if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8)
+                        return 0;
+
+                if (name[q-8-16-1] != '-' ||
+                    name[q-8-16-1-16-1] != '-' ||
+                    name[q-8-16-1-16-1-32-1] != '@')
+                        return 0;
+
+                p = strndup(name + q-8-16-1-16-1-32, 32);
+                if (!p)
+                        return -ENOMEM;
+
+                r = sd_id128_from_string(p, &seqnum_id);
+                free(p);
+                if (r < 0)
+                        return 0;
+
+                if (sscanf(name + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2)
+                        return 0;
+
+                have_seqnum = true;
+
+        } else if (endswith(name, ".journal~")) {
+                unsigned long long tmp;
+
+                /* Vacuum corrupted files */
+
+                if (q < 1 + 16 + 1 + 16 + 8 + 1)
+                        return 0;
+
+                if (name[q-1-8-16-1] != '-' ||
+                    name[q-1-8-16-1-16-1] != '@')
+                        return 0;
+
+                if (sscanf(name + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2)
+                        return 0;
+
+                have_seqnum = false;
+        } else
+                /* We do not vacuum active files or unknown files! */
                 return 0;
 
-        if (max_retention_usec > 0) {
-                retention_limit = now(CLOCK_REALTIME);
-                if (retention_limit > max_retention_usec)
-                        retention_limit -= max_retention_usec;
-                else
-                        max_retention_usec = retention_limit = 0;
+        /* Archived files never change, hence there's no need to
+         * look at the ones we already know again */
+        v = hashmap_get(c->files, name);
+        if (v) {
+                v->generation = c->generation;
+                return 0;
         }
 
-        d = opendir(directory);
-        if (!d)
-                return -errno;
+        if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return 0;
 
-        for (;;) {
-                int k;
-                struct dirent *de;
-                union dirent_storage buf;
-                size_t q;
-                struct stat st;
-                char *p;
-                unsigned long long seqnum = 0, realtime;
-                sd_id128_t seqnum_id;
-                bool have_seqnum;
+        if (!S_ISREG(st.st_mode))
+                return 0;
 
-                k = readdir_r(d, &buf.de, &de);
-                if (k != 0) {
-                        r = -k;
-                        goto finish;
-                }
+        if (journal_file_empty(dir_fd, name)) {
+                /* Always vacuum empty non-online files. */
 
-                if (!de)
-                        break;
+                uint64_t size = 512UL * (uint64_t) st.st_blocks;
 
-                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
-                        continue;
+                if (unlinkat(dir_fd, name, 0) >= 0) {
+                        log_info("Deleted empty journal %s/%s (%"PRIu64" bytes).",
+                                 c->directory, name, size);
+                        *freed += size;
+                } else if (errno != ENOENT)
+                        log_warning("Failed to delete %s/%s: %m", c->directory, name);
 
-                if (!S_ISREG(st.st_mode))
-                        continue;
+                return 0;
+        }
 
-                q = strlen(de->d_name);
+        v = new0(struct vacuum_info, 1);
+        if (!v)
+                return -ENOMEM;
 
-                if (endswith(de->d_name, ".journal")) {
+        v->filename = strdup(name);
+        if (!v->filename) {
+                free(v);
+                return -ENOMEM;
+        }
 
-                        /* Vacuum archived files */
+        patch_realtime(c->directory, name, &st, &realtime);
 
-                        if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8)
-                                continue;
+        v->usage = 512UL * (uint64_t) st.st_blocks;
+        v->seqnum = seqnum;
+        v->realtime = realtime;
+        v->seqnum_id = seqnum_id;
+        v->have_seqnum = have_seqnum;
+        v->generation = c->generation;
 
-                        if (de->d_name[q-8-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1-32-1] != '@')
-                                continue;
+        r = hashmap_put(c->files, v->filename, v);
+        if (r < 0) {
+                vacuum_info_free(v);
+                return r;
+        }
 
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+        r = prioq_put(c->queue, v, &v->prioq_idx);
+        if (r < 0) {
+                hashmap_remove(c->files, v->filename);
+                vacuum_info_free(v);
+                return r;
+        }
 
-                        de->d_name[q-8-16-1-16-1] = 0;
-                        if (sd_id128_from_string(de->d_name + q-8-16-1-16-1-32, &seqnum_id) < 0) {
-                                free(p);
-                                continue;
-                        }
+        c->sum += v->usage;
+        return 0;
+}
 
-                        if (sscanf(de->d_name + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2) {
-                                free(p);
-                                continue;
-                        }
+static void vacuum_cache_set_mtime(JournalVacuumCache *c, const struct stat *st) {
+        assert(c);
+        assert(st);
 
-                        have_seqnum = true;
+        c->mtime = st->st_mtim;
 
-                } else if (endswith(de->d_name, ".journal~")) {
-                        unsigned long long tmp;
+        /* Timestamps are coarse, hence an mtime that is very recent
+         * might not reflect changes made right after we looked. Don't
+         * trust it in that case. */
+        c->valid = timespec_load(&c->mtime) + USEC_PER_SEC < now(CLOCK_REALTIME);
+}
+
+static int vacuum_cache_scan(JournalVacuumCache *c, DIR *d, uint64_t *freed) {
+        struct vacuum_info *v;
+        Iterator i;
+        int r;
 
-                        /* Vacuum corrupted files */
+        assert(c);
+        assert(d);
+        assert(freed);
+
+        c->generation++;
+
+        for (;;) {
+                int k;
+                struct dirent *de;
+                union dirent_storage buf;
 
-                        if (q < 1 + 16 + 1 + 16 + 8 + 1)
-                                continue;
+                k = readdir_r(d, &buf.de, &de);
+                if (k != 0)
+                        return -k;
 
-                        if (de->d_name[q-1-8-16-1] != '-' ||
-                            de->d_name[q-1-8-16-1-16-1] != '@')
-                                continue;
+                if (!de)
+                        break;
 
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+                r = vacuum_cache_add(c, dirfd(d), de->d_name, freed);
+                if (r < 0)
+                        return r;
+        }
 
-                        if (sscanf(de->d_name + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2) {
-                                free(p);
-                                continue;
-                        }
+        /* Forget about everything that vanished behind our back */
+        HASHMAP_FOREACH(v, c->files, i)
+                if (v->generation != c->generation)
+                        vacuum_cache_drop(c, v);
 
-                        have_seqnum = false;
-                } else
-                        /* We do not vacuum active files or unknown files! */
-                        continue;
+        return 0;
+}
 
-                if (journal_file_empty(dirfd(d), p)) {
-                        /* Always vacuum empty non-online files. */
+int journal_directory_vacuum_cached(
+                JournalVacuumCache **cache,
+                const char *directory,
+                uint64_t max_use,
+                uint64_t min_free,
+                usec_t max_retention_usec,
+                usec_t *oldest_usec) {
 
-                        uint64_t size = 512UL * (uint64_t) st.st_blocks;
+        _cleanup_closedir_ DIR *d = NULL;
+        JournalVacuumCache *c;
+        struct vacuum_info *v;
+        struct stat st;
+        int r = 0;
+        uint64_t freed = 0;
+        usec_t retention_limit = 0;
+        bool in_sync;
 
-                        if (unlinkat(dirfd(d), p, 0) >= 0) {
-                                log_info("Deleted empty journal %s/%s (%"PRIu64" bytes).",
-                                         directory, p, size);
-                                freed += size;
-                        } else if (errno != ENOENT)
-                                log_warning("Failed to delete %s/%s: %m", directory, p);
+        assert(cache);
+        assert(directory);
 
-                        free(p);
+        if (max_use <= 0 && min_free <= 0 && max_retention_usec <= 0)
+                return 0;
 
-                        continue;
-                }
+        if (max_retention_usec > 0) {
+                retention_limit = now(CLOCK_REALTIME);
+                if (retention_limit > max_retention_usec)
+                        retention_limit -= max_retention_usec;
+                else
+                        max_retention_usec = retention_limit = 0;
+        }
 
-                patch_realtime(directory, p, &st, &realtime);
+        if (*cache && !streq((*cache)->directory, directory))
+                *cache = journal_vacuum_cache_free(*cache);
 
-                GREEDY_REALLOC(list, n_allocated, n_list + 1);
+        if (!*cache) {
+                r = vacuum_cache_new(directory, cache);
+                if (r < 0)
+                        return r;
+        }
 
-                list[n_list].filename = p;
-                list[n_list].usage = 512UL * (uint64_t) st.st_blocks;
-                list[n_list].seqnum = seqnum;
-                list[n_list].realtime = realtime;
-                list[n_list].seqnum_id = seqnum_id;
-                list[n_list].have_seqnum = have_seqnum;
+        c = *cache;
 
-                sum += list[n_list].usage;
+        d = opendir(directory);
+        if (!d) {
+                c->valid = false;
+                return -errno;
+        }
 
-                n_list ++;
+        if (fstat(dirfd(d), &st) < 0) {
+                c->valid = false;
+                return -errno;
         }
 
-        if (n_list > 0)
-                qsort(list, n_list, sizeof(struct vacuum_info), vacuum_compare);
+        /* Only read the directory if it changed since we last looked
+         * at it. The mtime is taken before reading, so that changes
+         * made while we read are picked up next time. */
+        if (!c->valid ||
+            c->mtime.tv_sec != st.st_mtim.tv_sec ||
+            c->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+
+                c->valid = false;
+
+                r = vacuum_cache_scan(c, d, &freed);
+                if (r < 0)
+                        goto finish;
 
-        for (i = 0; i < n_list; i++) {
+                vacuum_cache_set_mtime(c, &st);
+        }
+
+        in_sync = freed == 0;
+
+        while ((v = prioq_peek(c->queue))) {
                 struct statvfs ss;
 
                 if (fstatvfs(dirfd(d), &ss) < 0) {
@@ -310,34 +490,58 @@ int journal_directory_vacuum(
                         goto finish;
                 }
 
-                if ((max_retention_usec <= 0 || list[i].realtime >= retention_limit) &&
-                    (max_use <= 0 || sum <= max_use) &&
+                if ((max_retention_usec <= 0 || v->realtime >= retention_limit) &&
+                    (max_use <= 0 || c->sum <= max_use) &&
                     (min_free <= 0 || (uint64_t) ss.f_bavail * (uint64_t) ss.f_bsize >= min_free))
                         break;
 
-                if (unlinkat(dirfd(d), list[i].filename, 0) >= 0) {
+                if (unlinkat(dirfd(d), v->filename, 0) >= 0) {
                         log_debug("Deleted archived journal %s/%s (%"PRIu64" bytes).",
-                                  directory, list[i].filename, list[i].usage);
-                        freed += list[i].usage;
-
-                        if (list[i].usage < sum)
-                                sum -= list[i].usage;
-                        else
-                                sum = 0;
+                                  directory, v->filename, v->usage);
+                        freed += v->usage;
+                } else if (errno != ENOENT) {
+                        log_warning("Failed to delete %s/%s: %m", directory, v->filename);
+
+                        /* The file stays around, make sure we
+                         * find it again next time */
+                        c->valid = false;
+                }
 
-                } else if (errno != ENOENT)
-                        log_warning("Failed to delete %s/%s: %m", directory, list[i].filename);
+                in_sync = false;
+                vacuum_cache_drop(c, v);
         }
 
-        if (oldest_usec && i < n_list && (*oldest_usec == 0 || list[i].realtime < *oldest_usec))
-                *oldest_usec = list[i].realtime;
+        if (oldest_usec && v && (*oldest_usec == 0 || v->realtime < *oldest_usec))
+                *oldest_usec = v->realtime;
 
-finish:
-        for (i = 0; i < n_list; i++)
-                free(list[i].filename);
-        free(list);
+        /* Our own deletions changed the directory mtime. Remember
+         * the new one, so that we don't reread the directory next
+         * time only because of them. */
+        if (!in_sync && c->valid) {
+                if (fstat(dirfd(d), &st) >= 0)
+                        vacuum_cache_set_mtime(c, &st);
+                else
+                        c->valid = false;
+        }
 
+finish:
         log_info("Vacuuming done, freed %"PRIu64" bytes", freed);
 
         return r;
 }
+
+int journal_directory_vacuum(
+                const char *directory,
+                uint64_t max_use,
+                uint64_t min_free,
+                usec_t max_retention_usec,
+                usec_t *oldest_usec) {
+
+        JournalVacuumCache *c = NULL;
+        int r;
+
+        r = journal_directory_vacuum_cached(&c, directory, max_use, min_free, max_retention_usec, oldest_usec);
+        journal_vacuum_cache_free(c);
+
+        return r;
+}
@@ -23,4 +23,11 @@
 
 #include <inttypes.h>
 
+#include "time-util.h"
+
+typedef struct JournalVacuumCache JournalVacuumCache;
+
+JournalVacuumCache* journal_vacuum_cache_free(JournalVacuumCache *c);
+
+int journal_directory_vacuum_cached(JournalVacuumCache **cache, const char *directory, uint64_t max_use, uint64_t min_free, usec_t max_retention_usec, usec_t *oldest_usec);
 int journal_directory_vacuum(const char *directory, uint64_t max_use, uint64_t min_free, usec_t max_retention_usec, usec_t *oldest_usec);
@@ -44,10 +44,14 @@ static int journal_file_object_verify(JournalFile *f, Object *o) {
          * possible field values. It does not follow any references to
          * other objects. */
 
-        if ((o->object.flags & OBJECT_COMPRESSED) &&
+        if ((o->object.flags & OBJECT_COMPRESSION_MASK) &&
             o->object.type != OBJECT_DATA)
                 return -EBADMSG;
 
+        /* Only one compression algorithm per object */
+        if ((o->object.flags & OBJECT_COMPRESSION_MASK) == OBJECT_COMPRESSION_MASK)
+                return -EBADMSG;
+
         switch (o->object.type) {
 
         case OBJECT_DATA: {
@@ -62,23 +66,24 @@ static int journal_file_object_verify(JournalFile *f, Object *o) {
 
                 h1 = le64toh(o->data.hash);
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
+                if (o->object.flags & OBJECT_COMPRESSION_MASK) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
                         void *b = NULL;
                         uint64_t alloc = 0, b_size;
 
-                        if (!uncompress_blob(o->data.payload,
+                        if (!uncompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                                             o->data.payload,
                                              le64toh(o->object.size) - offsetof(Object, data.payload),
                                              &b, &alloc, &b_size, 0))
                                 return -EBADMSG;
 
-                        h2 = hash64(b, b_size);
+                        h2 = journal_file_hash_data(f, b, b_size);
                         free(b);
 #else
                         return -EPROTONOSUPPORT;
 #endif
                 } else
-                        h2 = hash64(o->data.payload, le64toh(o->object.size) - offsetof(Object, data.payload));
+                        h2 = journal_file_hash_data(f, o->data.payload, le64toh(o->object.size) - offsetof(Object, data.payload));
 
                 if (h1 != h2)
                         return -EBADMSG;
@@ -123,6 +128,7 @@ static int journal_file_object_verify(JournalFile *f, Object *o) {
 
         case OBJECT_DATA_HASH_TABLE:
         case OBJECT_FIELD_HASH_TABLE:
+        case OBJECT_ENTRY_ARRAY_INDEX_HASH_TABLE:
                 if ((le64toh(o->object.size) - offsetof(HashTableObject, items)) % sizeof(HashItem) != 0)
                         return -EBADMSG;
 
@@ -169,6 +175,43 @@ static int journal_file_object_verify(JournalFile *f, Object *o) {
                         return -EBADMSG;
 
                 break;
+
+        case OBJECT_ENTRY_ARRAY_INDEX:
+                if ((le64toh(o->object.size) - offsetof(EntryArrayIndexObject, items)) % sizeof(EntryArrayIndexItem) != 0)
+                        return -EBADMSG;
+
+                if (le64toh(o->entry_array_index.n_items) > journal_file_entry_array_index_n_items(o))
+                        return -EBADMSG;
+
+                if (o->entry_array_index.first_entry_array_offset == 0 ||
+                    !VALID64(le64toh(o->entry_array_index.first_entry_array_offset)) ||
+                    !VALID64(le64toh(o->entry_array_index.next_hash_offset)))
+                        return -EBADMSG;
+
+                for (i = 0; i < le64toh(o->entry_array_index.n_items); i++) {
+                        if (o->entry_array_index.items[i].entry_array_offset == 0 ||
+                            !VALID64(le64toh(o->entry_array_index.items[i].entry_array_offset)) ||
+                            o->entry_array_index.items[i].first_entry_offset == 0 ||
+                            !VALID64(le64toh(o->entry_array_index.items[i].first_entry_offset)))
+                                return -EBADMSG;
+
+                        if (i > 0 &&
+                            le64toh(o->entry_array_index.items[i].n_before) <= le64toh(o->entry_array_index.items[i-1].n_before))
+                                return -EBADMSG;
+                }
+
+                break;
+
+        case OBJECT_DATA_BLOOM_FILTER:
+                if (le64toh(o->object.size) <= offsetof(DataBloomFilterObject, bits))
+                        return -EBADMSG;
+
+                if (le64toh(o->data_bloom_filter.n_data) <= 0 ||
+                    le64toh(o->data_bloom_filter.n_hashes) <= 0 ||
+                    le64toh(o->data_bloom_filter.n_hashes) > 64)
+                        return -EBADMSG;
+
+                break;
         }
 
         return 0;
@@ -675,7 +718,7 @@ int journal_file_verify(
         uint64_t entry_seqnum = 0, entry_monotonic = 0, entry_realtime = 0;
         sd_id128_t entry_boot_id;
         bool entry_seqnum_set = false, entry_monotonic_set = false, entry_realtime_set = false, found_main_entry_array = false;
-        uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0;
+        uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0, n_entry_array_index_hash_tables = 0, n_data_bloom_filters = 0, data_bloom_filter_n_data = 0;
         usec_t last_usec = 0;
         int data_fd = -1, entry_fd = -1, entry_array_fd = -1;
         char data_path[] = "/var/tmp/journal-data-XXXXXX",
@@ -726,9 +769,9 @@ int journal_file_verify(
         unlink(entry_array_path);
 
 #ifdef HAVE_GCRYPT
-        if ((le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SEALED) != 0)
+        if ((le32toh(f->header->compatible_flags) & ~(HEADER_COMPATIBLE_SEALED|HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX|HEADER_COMPATIBLE_DATA_BLOOM_FILTER)) != 0)
 #else
-        if (f->header->compatible_flags != 0)
+        if ((le32toh(f->header->compatible_flags) & ~(HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX|HEADER_COMPATIBLE_DATA_BLOOM_FILTER)) != 0)
 #endif
         {
                 log_error("Cannot verify file with unknown extensions.");
@@ -743,6 +786,12 @@ int journal_file_verify(
                         goto fail;
                 }
 
+        r = journal_file_map_hash_tables(f);
+        if (r < 0) {
+                log_error("Failed to map hash tables.");
+                goto fail;
+        }
+
         /* First iteration: we go through all objects, verify the
          * superficial structure, headers, hashes. */
 
@@ -774,8 +823,14 @@ int journal_file_verify(
                         goto fail;
                 }
 
-                if ((o->object.flags & OBJECT_COMPRESSED) && !JOURNAL_HEADER_COMPRESSED(f->header)) {
-                        log_error("Compressed object in file without compression at %llu", (unsigned long long) p);
+                if ((o->object.flags & OBJECT_COMPRESSED_XZ) && !JOURNAL_HEADER_COMPRESSED_XZ(f->header)) {
+                        log_error("XZ compressed object in file without XZ compression at %llu", (unsigned long long) p);
+                        r = -EBADMSG;
+                        goto fail;
+                }
+
+                if ((o->object.flags & OBJECT_COMPRESSED_LZ4) && !JOURNAL_HEADER_COMPRESSED_LZ4(f->header)) {
+                        log_error("LZ4 compressed object in file without LZ4 compression at %llu", (unsigned long long) p);
                         r = -EBADMSG;
                         goto fail;
                 }
@@ -887,6 +942,51 @@ int journal_file_verify(
                         n_field_hash_tables++;
                         break;
 
+                case OBJECT_ENTRY_ARRAY_INDEX_HASH_TABLE:
+                        if (n_entry_array_index_hash_tables > 0 ||
+                            !JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header)) {
+                                log_error("Unexpected entry array index hash table at %llu", (unsigned long long) p);
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        if (le64toh(f->header->entry_array_index_hash_table_offset) != p + offsetof(HashTableObject, items) ||
+                            le64toh(f->header->entry_array_index_hash_table_size) != le64toh(o->object.size) - offsetof(HashTableObject, items)) {
+                                log_error("Header fields for entry array index hash table invalid");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        n_entry_array_index_hash_tables++;
+                        break;
+
+                case OBJECT_ENTRY_ARRAY_INDEX:
+                        if (!JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header)) {
+                                log_error("Entry array index in file without index at %llu", (unsigned long long) p);
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+                        break;
+
+                case OBJECT_DATA_BLOOM_FILTER:
+                        if (n_data_bloom_filters > 0 ||
+                            !JOURNAL_HEADER_DATA_BLOOM_FILTER(f->header)) {
+                                log_error("Unexpected data Bloom filter at %llu", (unsigned long long) p);
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        if (le64toh(f->header->data_bloom_filter_offset) != p ||
+                            le64toh(f->header->data_bloom_filter_size) != le64toh(o->object.size) - offsetof(DataBloomFilterObject, bits)) {
+                                log_error("Header fields for data Bloom filter invalid");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        data_bloom_filter_n_data = le64toh(o->data_bloom_filter.n_data);
+                        n_data_bloom_filters++;
+                        break;
+
                 case OBJECT_ENTRY_ARRAY:
                         r = write_uint64(entry_array_fd, p);
                         if (r < 0)
@@ -1061,6 +1161,19 @@ int journal_file_verify(
                 goto fail;
         }
 
+        if (JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header) && n_entry_array_index_hash_tables != 1) {
+                log_error("Missing entry array index hash table");
+                r = -EBADMSG;
+                goto fail;
+        }
+
+        if (JOURNAL_HEADER_DATA_BLOOM_FILTER(f->header) &&
+            (n_data_bloom_filters != 1 || data_bloom_filter_n_data != n_data)) {
+                log_error("Missing or incomplete data Bloom filter");
+                r = -EBADMSG;
+                goto fail;
+        }
+
         if (!found_main_entry_array) {
                 log_error("Missing entry array");
                 r = -EBADMSG;
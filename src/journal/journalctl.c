@@ -20,6 +20,7 @@
 ***/
 
 #include <locale.h>
+#include <ctype.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <stddef.h>
@@ -32,6 +33,7 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/wait.h>
 #include <linux/fs.h>
 
 #ifdef HAVE_ACL
@@ -52,14 +54,19 @@
 #include "journal-internal.h"
 #include "journal-def.h"
 #include "journal-verify.h"
+#include "journal-grep.h"
 #include "journal-authenticate.h"
 #include "journal-qrcode.h"
 #include "fsprg.h"
 #include "unit-name.h"
 #include "catalog.h"
+#include "compress.h"
 
 #define DEFAULT_FSS_INTERVAL_USEC (15*USEC_PER_MINUTE)
 
+/* stdio buffer for output that goes to a pipe or file */
+#define OUTPUT_BUFFER_SIZE (256*1024)
+
 static OutputMode arg_output = OUTPUT_SHORT;
 static bool arg_pager_end = false;
 static bool arg_follow = false;
@@ -75,6 +82,8 @@ static const char *arg_cursor = NULL;
 static const char *arg_directory = NULL;
 static int arg_priorities = 0xFF;
 static const char *arg_verify_key = NULL;
+static unsigned arg_verify_jobs = 1;
+static int arg_compress = -1;
 #ifdef HAVE_GCRYPT
 static usec_t arg_interval = DEFAULT_FSS_INTERVAL_USEC;
 #endif
@@ -83,8 +92,11 @@ static bool arg_since_set = false, arg_until_set = false;
 static const char *arg_unit = NULL;
 static bool arg_unit_system;
 static const char *arg_field = NULL;
+static const char *arg_grep = NULL;
+static int arg_case_sensitive = -1;
 static bool arg_catalog = false;
 static bool arg_reverse = false;
+static bool arg_debug_stats = false;
 static const char *arg_root = NULL;
 
 static enum {
@@ -94,6 +106,7 @@ static enum {
         ACTION_SETUP_KEYS,
         ACTION_VERIFY,
         ACTION_DISK_USAGE,
+        ACTION_COMPACT,
         ACTION_LIST_CATALOG,
         ACTION_DUMP_CATALOG,
         ACTION_UPDATE_CATALOG
@@ -111,6 +124,9 @@ static int help(void) {
                "  -u --unit=UNIT         Show data only from the specified unit\n"
                "     --user-unit=UNIT    Show data only from the specified user session unit\n"
                "  -p --priority=RANGE    Show only messages within the specified priority range\n"
+               "  -g --grep=STRING       Show only messages containing the specified string\n"
+               "     --case-sensitive[=BOOL]\n"
+               "                         Force case sensitive or insensitive matching\n"
                "  -e --pager-end         Immediately jump to end of the journal in the pager\n"
                "  -f --follow            Follow journal\n"
                "  -n --lines[=INTEGER]   Number of journal entries to show\n"
@@ -126,6 +142,9 @@ static int help(void) {
                "  -m --merge             Show entries from all available journals\n"
                "  -D --directory=PATH    Show journal files from directory\n"
                "     --root=ROOT         Operate on catalog files underneath the root ROOT\n"
+               "     --debug-stats       Show mmap cache statistics when done\n"
+               "     --verify-jobs=N     Verify up to N journal files in parallel\n"
+               "     --compress=TYPE     Compression to use when compacting: no, yes, xz, lz4\n"
 #ifdef HAVE_GCRYPT
                "     --interval=TIME     Time interval for changing the FSS sealing key\n"
                "     --verify-key=KEY    Specify FSS verification key\n"
@@ -136,6 +155,7 @@ static int help(void) {
                "     --new-id128         Generate a new 128 Bit ID\n"
                "     --header            Show journal header information\n"
                "     --disk-usage        Show total disk usage\n"
+               "     --compact           Rewrite archived journal files for faster reading\n"
                "  -F --field=FIELD       List all values a certain field takes\n"
                "     --list-catalog      Show message IDs of all entries in the message catalog\n"
                "     --dump-catalog      Show entries in the message catalog\n"
@@ -169,7 +189,12 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_USER_UNIT,
                 ARG_LIST_CATALOG,
                 ARG_DUMP_CATALOG,
-                ARG_UPDATE_CATALOG
+                ARG_UPDATE_CATALOG,
+                ARG_DEBUG_STATS,
+                ARG_VERIFY_JOBS,
+                ARG_COMPACT,
+                ARG_COMPRESS,
+                ARG_CASE_SENSITIVE
         };
 
         static const struct option options[] = {
@@ -191,11 +216,16 @@ static int parse_argv(int argc, char *argv[]) {
                 { "root",         required_argument, NULL, ARG_ROOT         },
                 { "header",       no_argument,       NULL, ARG_HEADER       },
                 { "priority",     required_argument, NULL, 'p'              },
+                { "grep",         required_argument, NULL, 'g'              },
+                { "case-sensitive", optional_argument, NULL, ARG_CASE_SENSITIVE },
                 { "setup-keys",   no_argument,       NULL, ARG_SETUP_KEYS   },
                 { "interval",     required_argument, NULL, ARG_INTERVAL     },
                 { "verify",       no_argument,       NULL, ARG_VERIFY       },
                 { "verify-key",   required_argument, NULL, ARG_VERIFY_KEY   },
+                { "verify-jobs",  required_argument, NULL, ARG_VERIFY_JOBS  },
                 { "disk-usage",   no_argument,       NULL, ARG_DISK_USAGE   },
+                { "compact",      no_argument,       NULL, ARG_COMPACT      },
+                { "compress",     required_argument, NULL, ARG_COMPRESS     },
                 { "cursor",       required_argument, NULL, 'c'              },
                 { "since",        required_argument, NULL, ARG_SINCE        },
                 { "until",        required_argument, NULL, ARG_UNTIL        },
@@ -206,6 +236,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "list-catalog", no_argument,       NULL, ARG_LIST_CATALOG },
                 { "dump-catalog", no_argument,       NULL, ARG_DUMP_CATALOG },
                 { "update-catalog",no_argument,      NULL, ARG_UPDATE_CATALOG },
+                { "debug-stats",  no_argument,       NULL, ARG_DEBUG_STATS  },
                 { "reverse",      no_argument,       NULL, 'r'              },
                 { NULL,           0,                 NULL, 0                }
         };
@@ -215,7 +246,7 @@ static int parse_argv(int argc, char *argv[]) {
         assert(argc >= 0);
         assert(argv);
 
-        while ((c = getopt_long(argc, argv, "hefo:an::qmbD:p:c:u:F:xr", options, NULL)) >= 0) {
+        while ((c = getopt_long(argc, argv, "hefo:an::qmbD:p:g:c:u:F:xr", options, NULL)) >= 0) {
 
                 switch (c) {
 
@@ -333,14 +364,52 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_action = ACTION_PRINT_HEADER;
                         break;
 
+                case ARG_DEBUG_STATS:
+                        arg_debug_stats = true;
+                        break;
+
                 case ARG_VERIFY:
                         arg_action = ACTION_VERIFY;
                         break;
 
+                case ARG_VERIFY_JOBS:
+                        r = safe_atou(optarg, &arg_verify_jobs);
+                        if (r < 0) {
+                                log_error("Failed to parse number of verification jobs: %s", optarg);
+                                return -EINVAL;
+                        }
+
+                        arg_action = ACTION_VERIFY;
+                        break;
+
                 case ARG_DISK_USAGE:
                         arg_action = ACTION_DISK_USAGE;
                         break;
 
+                case ARG_COMPACT:
+                        arg_action = ACTION_COMPACT;
+                        break;
+
+                case ARG_COMPRESS:
+                        r = parse_boolean(optarg);
+                        if (r >= 0)
+                                arg_compress = r ? compression_default() : 0;
+                        else {
+                                arg_compress = object_compressed_from_string(optarg);
+                                if (arg_compress < 0) {
+                                        log_error("Failed to parse compression type: %s", optarg);
+                                        return -EINVAL;
+                                }
+                        }
+
+                        if (arg_compress != 0 && !compression_supported(arg_compress)) {
+                                log_error("Compression type %s is not supported.", optarg);
+                                return -EOPNOTSUPP;
+                        }
+
+                        arg_action = ACTION_COMPACT;
+                        break;
+
 #ifdef HAVE_GCRYPT
                 case ARG_SETUP_KEYS:
                         arg_action = ACTION_SETUP_KEYS;
@@ -457,6 +526,22 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_catalog = true;
                         break;
 
+                case 'g':
+                        arg_grep = optarg;
+                        break;
+
+                case ARG_CASE_SENSITIVE:
+                        if (optarg) {
+                                r = parse_boolean(optarg);
+                                if (r < 0) {
+                                        log_error("Failed to parse case sensitivity: %s", optarg);
+                                        return -EINVAL;
+                                }
+                                arg_case_sensitive = r;
+                        } else
+                                arg_case_sensitive = true;
+                        break;
+
                 case ARG_LIST_CATALOG:
                         arg_action = ACTION_LIST_CATALOG;
                         break;
@@ -500,6 +585,54 @@ static int parse_argv(int argc, char *argv[]) {
         return 1;
 }
 
+static int open_grep(JournalGrep **ret) {
+        bool ignore_case;
+        const char *c;
+
+        assert(ret);
+
+        /* Like less and vim, ignore case unless the pattern
+         * contains upper case characters */
+        if (arg_case_sensitive >= 0)
+                ignore_case = !arg_case_sensitive;
+        else {
+                ignore_case = true;
+                for (c = arg_grep; *c; c++)
+                        if (isupper((unsigned char) *c)) {
+                                ignore_case = false;
+                                break;
+                        }
+        }
+
+        return journal_grep_new(ret, arg_grep, ignore_case);
+}
+
+/* Like sd_journal_previous_skip() from the tail, but counts only the
+ * entries matching the pattern */
+static int previous_skip_grep(sd_journal *j, JournalGrep *grep, unsigned skip) {
+        unsigned n = 0;
+        int r;
+
+        assert(j);
+        assert(grep);
+
+        while (n < skip) {
+                r = sd_journal_previous(j);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        break;
+
+                r = journal_grep_test(grep, j);
+                if (r < 0)
+                        return r;
+                if (r > 0)
+                        n++;
+        }
+
+        return n;
+}
+
 static int generate_new_id128(void) {
         sd_id128_t id;
         int r;
@@ -843,50 +976,416 @@ finish:
 #endif
 }
 
-static int verify(sd_journal *j) {
-        int r = 0;
+typedef struct VerifyResult {
+        int r;
+        usec_t first, validated, last;
+} VerifyResult;
+
+typedef struct VerifyJob {
+        JournalFile *file;
+        pid_t pid;
+        int fd;
+} VerifyJob;
+
+static void verify_report(JournalFile *f, const VerifyResult *v) {
+        assert(f);
+        assert(v);
+
+        if (v->r < 0) {
+                log_warning("FAIL: %s (%s)", f->path, strerror(-v->r));
+                return;
+        }
+
+        log_info("PASS: %s", f->path);
+
+        if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
+                char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
+
+                if (v->validated > 0) {
+                        log_info("=> Validated from %s to %s, final %s entries not sealed.",
+                                 format_timestamp(a, sizeof(a), v->first),
+                                 format_timestamp(b, sizeof(b), v->validated),
+                                 format_timespan(c, sizeof(c), v->last > v->validated ? v->last - v->validated : 0, 0));
+                } else if (v->last > 0)
+                        log_info("=> No sealing yet, %s of entries not sealed.",
+                                 format_timespan(c, sizeof(c), v->last - v->first, 0));
+                else
+                        log_info("=> No sealing yet, no entries in file.");
+        }
+}
+
+static void verify_file(JournalFile *f, bool show_progress, VerifyResult *v) {
+        assert(f);
+        assert(v);
+
+#ifdef HAVE_GCRYPT
+        if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
+                log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
+#endif
+
+        zero(*v);
+        v->r = journal_file_verify(f, arg_verify_key, &v->first, &v->validated, &v->last, show_progress);
+}
+
+static void verify_draw_progress(unsigned n_done, unsigned n_files, uint64_t bytes, usec_t start) {
+        char a[FORMAT_BYTES_MAX], b[FORMAT_BYTES_MAX];
+        usec_t d;
+
+        if (!on_tty())
+                return;
+
+        d = now(CLOCK_MONOTONIC) - start;
+
+        printf("\rVerified %u of %u files, %s at %s/s\x1B[K",
+               n_done, n_files,
+               format_bytes(a, sizeof(a), bytes),
+               format_bytes(b, sizeof(b), d > 0 ? (off_t) (bytes * USEC_PER_SEC / d) : 0));
+        fflush(stdout);
+}
+
+static void verify_flush_progress(void) {
+        if (!on_tty())
+                return;
+
+        fputs("\r\x1B[K", stdout);
+        fflush(stdout);
+}
+
+static int verify_fork(VerifyJob *job, JournalFile *f) {
+        int pipefd[2];
+        pid_t pid;
+
+        assert(job);
+        assert(f);
+
+        if (pipe2(pipefd, O_CLOEXEC) < 0)
+                return -errno;
+
+        pid = fork();
+        if (pid < 0) {
+                close_pipe(pipefd);
+                return -errno;
+        }
+
+        if (pid == 0) {
+                VerifyResult v;
+
+                /* Child */
+                close_nointr_nofail(pipefd[0]);
+
+                verify_file(f, false, &v);
+                if (loop_write(pipefd[1], &v, sizeof(v), false) != sizeof(v))
+                        _exit(EXIT_FAILURE);
+
+                _exit(EXIT_SUCCESS);
+        }
+
+        close_nointr_nofail(pipefd[1]);
+
+        job->file = f;
+        job->pid = pid;
+        job->fd = pipefd[0];
+
+        return 0;
+}
+
+static int verify_reap(VerifyJob *jobs, unsigned n_jobs, VerifyJob **ret, VerifyResult *v) {
+        siginfo_t si;
+        unsigned i;
+
+        assert(jobs);
+        assert(ret);
+        assert(v);
+
+        /* The pager is not running while verifying, hence every
+         * child we collect here is one of ours. */
+        for (;;) {
+                zero(si);
+
+                if (waitid(P_ALL, 0, &si, WEXITED) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        return -errno;
+                }
+
+                for (i = 0; i < n_jobs; i++)
+                        if (jobs[i].pid == si.si_pid)
+                                break;
+
+                if (i < n_jobs)
+                        break;
+        }
+
+        if (si.si_code != CLD_EXITED || si.si_status != EXIT_SUCCESS ||
+            loop_read(jobs[i].fd, v, sizeof(*v), false) != sizeof(*v)) {
+                zero(*v);
+                v->r = -EIO;
+        }
+
+        close_nointr_nofail(jobs[i].fd);
+        jobs[i].pid = 0;
+        jobs[i].fd = -1;
+
+        *ret = jobs + i;
+        return 0;
+}
+
+static int verify_parallel(sd_journal *j, unsigned n_jobs, uint64_t *bytes) {
+        _cleanup_free_ VerifyJob *jobs = NULL;
+        unsigned n_running = 0, n_done = 0, n_files, i;
+        usec_t start;
+        Iterator it;
+        JournalFile *f;
+        int r = 0, k;
+
+        assert(j);
+        assert(n_jobs > 1);
+        assert(bytes);
+
+        n_files = hashmap_size(j->files);
+        if (n_jobs > n_files)
+                n_jobs = n_files;
+
+        jobs = new0(VerifyJob, n_jobs);
+        if (!jobs)
+                return log_oom();
+
+        start = now(CLOCK_MONOTONIC);
+        it = ITERATOR_FIRST;
+        f = hashmap_iterate(j->files, &it, NULL);
+
+        while (f || n_running > 0) {
+                VerifyJob *job;
+                VerifyResult v;
+
+                if (f && n_running < n_jobs) {
+                        for (i = 0; i < n_jobs; i++)
+                                if (jobs[i].pid == 0)
+                                        break;
+
+                        assert(i < n_jobs);
+
+                        k = verify_fork(jobs + i, f);
+                        if (k < 0) {
+                                log_error("Failed to fork verification job: %s", strerror(-k));
+                                r = k;
+
+                                /* Stop spawning, but collect what is running */
+                                f = NULL;
+                                continue;
+                        }
+
+                        n_running++;
+                        f = hashmap_iterate(j->files, &it, NULL);
+                        continue;
+                }
+
+                k = verify_reap(jobs, n_jobs, &job, &v);
+                if (k < 0) {
+                        log_error("Failed to wait for verification job: %s", strerror(-k));
+                        return k;
+                }
+
+                n_running--;
+                n_done++;
+                *bytes += job->file->last_stat.st_size;
+
+                verify_flush_progress();
+                verify_report(job->file, &v);
+                verify_draw_progress(n_done, n_files, *bytes, start);
+
+                if (v.r == -EINVAL) {
+                        /* If the key was invalid there's no point in
+                         * starting any further jobs. */
+                        f = NULL;
+                        r = v.r;
+                } else if (v.r < 0 && r != -EINVAL)
+                        r = v.r;
+        }
+
+        verify_flush_progress();
+
+        return r;
+}
+
+static int verify_serial(sd_journal *j, uint64_t *bytes) {
         Iterator i;
         JournalFile *f;
+        int r = 0;
+
+        assert(j);
+        assert(bytes);
+
+        HASHMAP_FOREACH(f, j->files, i) {
+                VerifyResult v;
+
+                verify_file(f, true, &v);
+
+                /* If the key was invalid give up right-away. */
+                if (v.r == -EINVAL)
+                        return v.r;
+
+                verify_report(f, &v);
+                *bytes += f->last_stat.st_size;
+
+                if (v.r < 0)
+                        r = v.r;
+        }
+
+        return r;
+}
+
+static int verify(sd_journal *j) {
+        char a[FORMAT_BYTES_MAX], b[FORMAT_TIMESPAN_MAX], c[FORMAT_BYTES_MAX];
+        uint64_t bytes = 0;
+        unsigned n_jobs;
+        usec_t start, d;
+        int r;
 
         assert(j);
 
         log_show_color(true);
 
-        HASHMAP_FOREACH(f, j->files, i) {
-                int k;
-                usec_t first, validated, last;
+        n_jobs = arg_verify_jobs;
+        if (n_jobs == 0) {
+                long n;
 
-#ifdef HAVE_GCRYPT
-                if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
-                        log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
+                n = sysconf(_SC_NPROCESSORS_ONLN);
+                n_jobs = n > 0 ? (unsigned) n : 1;
+        }
+
+        start = now(CLOCK_MONOTONIC);
+
+        if (n_jobs > 1 && hashmap_size(j->files) > 1)
+                r = verify_parallel(j, n_jobs, &bytes);
+        else
+                r = verify_serial(j, &bytes);
+
+        if (r == -EINVAL)
+                return r;
+
+        d = now(CLOCK_MONOTONIC) - start;
+        log_info("Verified %u files, %s in %s, %s/s.",
+                 hashmap_size(j->files),
+                 format_bytes(a, sizeof(a), bytes),
+                 format_timespan(b, sizeof(b), d, USEC_PER_MSEC),
+                 format_bytes(c, sizeof(c), d > 0 ? (off_t) (bytes * USEC_PER_SEC / d) : 0));
+
+        return r;
+}
+
+static int compact_file(JournalFile *f, uint64_t *before, uint64_t *after) {
+        _cleanup_free_ char *t = NULL;
+        JournalFile *c = NULL;
+        const char *fn;
+        struct stat st;
+        int compress, r;
+
+        assert(f);
+        assert(before);
+        assert(after);
+
+        /* Online files are still being written to */
+        if (f->header->state != STATE_ARCHIVED)
+                return 0;
+
+        if (JOURNAL_HEADER_SEALED(f->header)) {
+                log_notice("Journal file %s is sealed, not compacting.", f->path);
+                return 0;
+        }
+
+        if (arg_compress >= 0)
+                compress = arg_compress;
+        else if (JOURNAL_HEADER_COMPRESSED_XZ(f->header))
+                compress = OBJECT_COMPRESSED_XZ;
+        else if (JOURNAL_HEADER_COMPRESSED_LZ4(f->header))
+                compress = OBJECT_COMPRESSED_LZ4;
+        else
+                compress = 0;
+
+        /* Readers ignore hidden files, hence they won't pick up the
+         * copy before it replaces the original */
+        fn = path_get_file_name(f->path);
+        t = strjoin(strndupa(f->path, fn - f->path), ".#", fn, NULL);
+        if (!t)
+                return log_oom();
+
+        r = journal_file_compact(f, t, compress);
+        if (r < 0) {
+                log_error("Failed to compact %s: %s", f->path, strerror(-r));
+                return r;
+        }
+
+        /* Never replace a file by something we can't read back */
+        r = journal_file_open(t, O_RDONLY, 0, 0, false, NULL, NULL, NULL, &c);
+        if (r >= 0) {
+                r = journal_file_verify(c, NULL, NULL, NULL, NULL, false);
+                journal_file_close(c);
+        }
+        if (r < 0) {
+                log_error("Compacted copy of %s fails verification, keeping original: %s", f->path, strerror(-r));
+                unlink(t);
+                return r;
+        }
+
+#ifdef HAVE_ACL
+        {
+                acl_t acl;
+
+                acl = acl_get_file(f->path, ACL_TYPE_ACCESS);
+                if (acl) {
+                        if (acl_set_file(t, ACL_TYPE_ACCESS, acl) < 0)
+                                log_warning("Failed to copy ACL of %s: %m", f->path);
+                        acl_free(acl);
+                }
+        }
 #endif
 
-                k = journal_file_verify(f, arg_verify_key, &first, &validated, &last, true);
-                if (k == -EINVAL) {
-                        /* If the key was invalid give up right-away. */
-                        return k;
-                } else if (k < 0) {
-                        log_warning("FAIL: %s (%s)", f->path, strerror(-k));
+        if (stat(t, &st) < 0) {
+                r = -errno;
+                unlink(t);
+                return r;
+        }
+
+        if (rename(t, f->path) < 0) {
+                r = -errno;
+                log_error("Failed to replace %s: %m", f->path);
+                unlink(t);
+                return r;
+        }
+
+        *before += (uint64_t) f->last_stat.st_blocks * 512ULL;
+        *after += (uint64_t) st.st_blocks * 512ULL;
+
+        return 1;
+}
+
+static int compact(sd_journal *j) {
+        char a[FORMAT_BYTES_MAX], b[FORMAT_BYTES_MAX];
+        uint64_t before = 0, after = 0;
+        unsigned n = 0;
+        JournalFile *f;
+        Iterator i;
+        int r = 0;
+
+        assert(j);
+
+        HASHMAP_FOREACH(f, j->files, i) {
+                int k;
+
+                k = compact_file(f, &before, &after);
+                if (k < 0)
                         r = k;
-                } else {
-                        char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
-                        log_info("PASS: %s", f->path);
-
-                        if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
-                                if (validated > 0) {
-                                        log_info("=> Validated from %s to %s, final %s entries not sealed.",
-                                                 format_timestamp(a, sizeof(a), first),
-                                                 format_timestamp(b, sizeof(b), validated),
-                                                 format_timespan(c, sizeof(c), last > validated ? last - validated : 0, 0));
-                                } else if (last > 0)
-                                        log_info("=> No sealing yet, %s of entries not sealed.",
-                                                 format_timespan(c, sizeof(c), last - first, 0));
-                                else
-                                        log_info("=> No sealing yet, no entries in file.");
-                        }
-                }
+                else if (k > 0)
+                        n++;
         }
 
+        log_info("Compacted %u files from %s to %s.",
+                 n,
+                 format_bytes(a, sizeof(a), before),
+                 format_bytes(b, sizeof(b), after));
+
         return r;
 }
 
@@ -999,9 +1498,35 @@ static int access_check(sd_journal *j) {
         return r;
 }
 
+static void print_debug_stats(sd_journal *j) {
+        MMapCacheStats st;
+
+        if (journal_get_mmap_cache_stats(j, &st) < 0)
+                return;
+
+        fprintf(stderr,
+                "MMap cache context hits: %llu\n"
+                "MMap cache window hits: %llu\n"
+                "MMap cache misses: %llu\n"
+                "MMap cache context detaches: %llu\n"
+                "MMap cache evictions: %llu\n"
+                "MMap cache windows: %u\n"
+                "MMap cache contexts: %u\n"
+                "MMap cache file descriptors: %u\n",
+                (unsigned long long) st.context_hits,
+                (unsigned long long) st.window_hits,
+                (unsigned long long) st.misses,
+                (unsigned long long) st.context_detaches,
+                (unsigned long long) st.evictions,
+                st.n_windows,
+                st.n_contexts,
+                st.n_fds);
+}
+
 int main(int argc, char *argv[]) {
         int r;
         _cleanup_journal_close_ sd_journal *j = NULL;
+        _cleanup_journal_grep_free_ JournalGrep *grep = NULL;
         bool need_seek = false;
         sd_id128_t previous_boot_id;
         bool previous_boot_id_valid = false, first_line = true;
@@ -1080,6 +1605,11 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
+        if (arg_action == ACTION_COMPACT) {
+                r = compact(j);
+                goto finish;
+        }
+
         if (arg_action == ACTION_PRINT_HEADER) {
                 journal_print_header(j);
                 return EXIT_SUCCESS;
@@ -1147,6 +1677,20 @@ int main(int argc, char *argv[]) {
                 return EXIT_SUCCESS;
         }
 
+        if (arg_grep) {
+                r = open_grep(&grep);
+                if (r < 0) {
+                        log_error("Failed to set up pattern: %s", strerror(-r));
+                        return EXIT_FAILURE;
+                }
+
+                r = journal_grep_scan(grep, j);
+                if (r < 0) {
+                        log_error("Failed to search journal: %s", strerror(-r));
+                        return EXIT_FAILURE;
+                }
+        }
+
         if (arg_cursor) {
                 r = sd_journal_seek_cursor(j, arg_cursor);
                 if (r < 0) {
@@ -1181,7 +1725,10 @@ int main(int argc, char *argv[]) {
                         return EXIT_FAILURE;
                 }
 
-                r = sd_journal_previous_skip(j, arg_lines);
+                if (grep)
+                        r = previous_skip_grep(j, grep, arg_lines);
+                else
+                        r = sd_journal_previous_skip(j, arg_lines);
 
         } else if (arg_reverse) {
                 r = sd_journal_seek_tail(j);
@@ -1210,6 +1757,10 @@ int main(int argc, char *argv[]) {
         if (!arg_no_pager && !arg_follow)
                 pager_open(arg_pager_end);
 
+        /* Unless a terminal is attached, write in large blocks */
+        if (!isatty(STDOUT_FILENO))
+                setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
         if (!arg_quiet) {
                 usec_t start, end;
                 char start_buf[FORMAT_TIMESTAMP_MAX], end_buf[FORMAT_TIMESTAMP_MAX];
@@ -1273,6 +1824,18 @@ int main(int argc, char *argv[]) {
                                         goto finish;
                         }
 
+                        if (grep) {
+                                r = journal_grep_test(grep, j);
+                                if (r < 0) {
+                                        log_error("Failed to match entry: %s", strerror(-r));
+                                        goto finish;
+                                }
+                                if (r == 0) {
+                                        need_seek = true;
+                                        continue;
+                                }
+                        }
+
                         if (!arg_merge) {
                                 sd_id128_t boot_id;
 
@@ -1304,6 +1867,8 @@ int main(int argc, char *argv[]) {
                 if (!arg_follow)
                         break;
 
+                fflush(stdout);
+
                 r = sd_journal_wait(j, (uint64_t) -1);
                 if (r < 0) {
                         log_error("Couldn't wait for journal event: %s", strerror(-r));
@@ -1316,5 +1881,8 @@ int main(int argc, char *argv[]) {
 finish:
         pager_close();
 
+        if (arg_debug_stats && j)
+                print_debug_stats(j);
+
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
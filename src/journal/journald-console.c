@@ -25,6 +25,7 @@
 
 #include "journald-server.h"
 #include "journald-console.h"
+#include "journald-forward.h"
 
 void server_forward_console(
                 Server *s,
@@ -68,18 +69,21 @@ void server_forward_console(
         IOVEC_SET_STRING(iovec[n++], message);
         IOVEC_SET_STRING(iovec[n++], "\n");
 
-        tty = s->tty_path ? s->tty_path : "/dev/console";
+        /* Keep the terminal open, and write to it without blocking,
+         * so that a slow serial console doesn't hold up logging */
+        if (forward_queue_get_fd(s->console_queue) < 0) {
+                tty = s->tty_path ? s->tty_path : "/dev/console";
 
-        fd = open_terminal(tty, O_WRONLY|O_NOCTTY|O_CLOEXEC);
-        if (fd < 0) {
-                log_debug("Failed to open %s for logging: %s", tty, strerror(errno));
-                goto finish;
-        }
+                fd = open_terminal(tty, O_WRONLY|O_NOCTTY|O_CLOEXEC|O_NONBLOCK);
+                if (fd < 0) {
+                        log_debug("Failed to open %s for logging: %s", tty, strerror(-fd));
+                        goto finish;
+                }
 
-        if (writev(fd, iovec, n) < 0)
-                log_debug("Failed to write to %s for logging: %s", tty, strerror(errno));
+                forward_queue_set_fd(s->console_queue, fd);
+        }
 
-        close_nointr_nofail(fd);
+        forward_queue_push(s->console_queue, iovec, n, NULL);
 
 finish:
         free(ident_buf);
@@ -0,0 +1,357 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+#include "list.h"
+#include "journald-server.h"
+#include "journald-forward.h"
+
+/* How much data we are willing to hold back for a slow target */
+#define FORWARD_QUEUE_SIZE_MAX (1024*1024)
+
+#define WARN_FORWARD_MISSED_USEC (30 * USEC_PER_SEC)
+
+typedef struct ForwardRecord ForwardRecord;
+
+struct ForwardRecord {
+        LIST_FIELDS(ForwardRecord, records);
+
+        struct ucred ucred;
+        bool has_ucred;
+
+        size_t size;
+        size_t offset;
+        char data[];
+};
+
+struct ForwardQueue {
+        Server *server;
+        const char *name;
+        ForwardQueueType type;
+        sd_id128_t message_id;
+
+        int fd;
+        bool watching;
+
+        LIST_HEAD(ForwardRecord, records);
+        ForwardRecord *records_tail;
+        size_t size;
+
+        unsigned n_missed;
+        usec_t last_warn;
+};
+
+int forward_queue_new(Server *s, const char *name, ForwardQueueType type, sd_id128_t message_id, ForwardQueue **ret) {
+        ForwardQueue *q;
+
+        assert(s);
+        assert(name);
+        assert(ret);
+
+        q = new0(ForwardQueue, 1);
+        if (!q)
+                return -ENOMEM;
+
+        q->server = s;
+        q->name = name;
+        q->type = type;
+        q->message_id = message_id;
+        q->fd = -1;
+
+        *ret = q;
+        return 0;
+}
+
+static void forward_queue_drop(ForwardQueue *q, ForwardRecord *r) {
+        assert(q);
+        assert(r);
+
+        if (q->records_tail == r)
+                q->records_tail = r->records_prev;
+
+        LIST_REMOVE(ForwardRecord, records, q->records, r);
+
+        assert(q->size >= r->size - r->offset);
+        q->size -= r->size - r->offset;
+
+        free(r);
+}
+
+static void forward_queue_watch(ForwardQueue *q, bool b) {
+        struct epoll_event ev = {
+                .events = EPOLLOUT,
+        };
+
+        assert(q);
+
+        if (q->watching == b || q->fd < 0)
+                return;
+
+        ev.data.fd = q->fd;
+        if (epoll_ctl(q->server->epoll_fd, b ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, q->fd, &ev) < 0) {
+                log_debug("Failed to %s %s fd in epoll object: %m", b ? "add" : "remove", q->name);
+                return;
+        }
+
+        q->watching = b;
+}
+
+void forward_queue_close(ForwardQueue *q) {
+        assert(q);
+
+        /* Whatever is left over can't be delivered anymore */
+        while (q->records) {
+                forward_queue_drop(q, q->records);
+                q->n_missed++;
+        }
+
+        forward_queue_watch(q, false);
+
+        if (q->fd >= 0) {
+                close_nointr_nofail(q->fd);
+                q->fd = -1;
+        }
+}
+
+void forward_queue_free(ForwardQueue *q) {
+        if (!q)
+                return;
+
+        forward_queue_close(q);
+        free(q);
+}
+
+int forward_queue_get_fd(ForwardQueue *q) {
+        assert(q);
+
+        return q->fd;
+}
+
+void forward_queue_set_fd(ForwardQueue *q, int fd) {
+        assert(q);
+        assert(fd >= 0);
+
+        forward_queue_close(q);
+        q->fd = fd;
+}
+
+static ssize_t forward_queue_send(ForwardQueue *q, const struct iovec *iovec, unsigned n, const struct ucred *ucred) {
+        struct msghdr msghdr = {
+                .msg_iov = (struct iovec *) iovec,
+                .msg_iovlen = n,
+        };
+        struct cmsghdr *cmsg;
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(sizeof(struct ucred))];
+        } control;
+        ssize_t k;
+
+        assert(q);
+        assert(q->fd >= 0);
+
+        if (q->type == FORWARD_QUEUE_STREAM) {
+                k = writev(q->fd, iovec, n);
+                return k < 0 ? -errno : k;
+        }
+
+        if (ucred) {
+                zero(control);
+                msghdr.msg_control = &control;
+                msghdr.msg_controllen = sizeof(control);
+
+                cmsg = CMSG_FIRSTHDR(&msghdr);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_CREDENTIALS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+                memcpy(CMSG_DATA(cmsg), ucred, sizeof(struct ucred));
+                msghdr.msg_controllen = cmsg->cmsg_len;
+        }
+
+        k = sendmsg(q->fd, &msghdr, MSG_NOSIGNAL);
+        if (k >= 0)
+                return k;
+
+        if (ucred && errno == ESRCH) {
+                struct ucred u;
+
+                /* Hmm, presumably the sender process vanished
+                 * by now, so let's fix it as good as we
+                 * can, and retry */
+
+                u = *ucred;
+                u.pid = getpid();
+                memcpy(CMSG_DATA(cmsg), &u, sizeof(struct ucred));
+
+                k = sendmsg(q->fd, &msghdr, MSG_NOSIGNAL);
+                if (k >= 0)
+                        return k;
+        }
+
+        return -errno;
+}
+
+static bool forward_queue_error_is_fatal(ForwardQueue *q, int error) {
+        assert(q);
+
+        /* For datagrams anything but the other side going away only
+         * affects the one message */
+        if (q->type == FORWARD_QUEUE_STREAM)
+                return true;
+
+        return error == -ECONNREFUSED || error == -ENOTCONN || error == -EPIPE;
+}
+
+int forward_queue_push(ForwardQueue *q, const struct iovec *iovec, unsigned n, const struct ucred *ucred) {
+        ForwardRecord *r;
+        size_t size = 0, offset = 0;
+        ssize_t k;
+        unsigned i;
+        char *p;
+
+        assert(q);
+        assert(iovec || n == 0);
+
+        if (q->fd < 0)
+                return -ENOTCONN;
+
+        for (i = 0; i < n; i++)
+                size += iovec[i].iov_len;
+
+        if (size <= 0)
+                return 0;
+
+        /* If nothing is pending, try to get rid of the data right
+         * away. Only queue what the target can't take right now. */
+        if (!q->records) {
+                k = forward_queue_send(q, iovec, n, ucred);
+                if (k >= 0 && (size_t) k >= size)
+                        return 0;
+
+                if (k < 0 && k != -EAGAIN) {
+                        log_debug("Failed to forward to %s: %s", q->name, strerror(-k));
+
+                        if (forward_queue_error_is_fatal(q, k))
+                                forward_queue_close(q);
+
+                        return k;
+                }
+
+                if (k > 0)
+                        offset = k;
+        }
+
+        if (q->size + (size - offset) > FORWARD_QUEUE_SIZE_MAX) {
+                q->n_missed++;
+                return -ENOBUFS;
+        }
+
+        r = malloc(offsetof(ForwardRecord, data) + size);
+        if (!r) {
+                q->n_missed++;
+                return -ENOMEM;
+        }
+
+        r->size = size;
+        r->offset = offset;
+        r->has_ucred = !!ucred;
+        if (ucred)
+                r->ucred = *ucred;
+
+        for (i = 0, p = r->data; i < n; i++) {
+                memcpy(p, iovec[i].iov_base, iovec[i].iov_len);
+                p += iovec[i].iov_len;
+        }
+
+        LIST_INSERT_AFTER(ForwardRecord, records, q->records, q->records_tail, r);
+        q->records_tail = r;
+        q->size += size - offset;
+
+        forward_queue_watch(q, true);
+        return 0;
+}
+
+int forward_queue_process(ForwardQueue *q, uint32_t events) {
+        assert(q);
+
+        if (events & (EPOLLERR|EPOLLHUP)) {
+                log_debug("Forwarding target %s went away.", q->name);
+                forward_queue_close(q);
+                return 0;
+        }
+
+        while (q->records) {
+                ForwardRecord *r = q->records;
+                struct iovec iovec = {
+                        .iov_base = r->data + r->offset,
+                        .iov_len = r->size - r->offset,
+                };
+                ssize_t k;
+
+                k = forward_queue_send(q, &iovec, 1, r->has_ucred ? &r->ucred : NULL);
+                if (k == -EAGAIN)
+                        return 0;
+
+                if (k < 0) {
+                        log_debug("Failed to forward to %s: %s", q->name, strerror(-k));
+
+                        if (forward_queue_error_is_fatal(q, k)) {
+                                forward_queue_close(q);
+                                return k;
+                        }
+
+                        forward_queue_drop(q, r);
+                        q->n_missed++;
+                        continue;
+                }
+
+                if ((size_t) k < iovec.iov_len) {
+                        r->offset += k;
+                        q->size -= k;
+                        continue;
+                }
+
+                forward_queue_drop(q, r);
+        }
+
+        forward_queue_watch(q, false);
+        return 0;
+}
+
+void forward_queue_maybe_warn(ForwardQueue *q) {
+        usec_t n;
+
+        assert(q);
+
+        if (q->n_missed <= 0)
+                return;
+
+        n = now(CLOCK_MONOTONIC);
+        if (q->last_warn + WARN_FORWARD_MISSED_USEC > n)
+                return;
+
+        server_driver_message(q->server, q->message_id, "Forwarding to %s missed %u messages.", q->name, q->n_missed);
+
+        q->n_missed = 0;
+        q->last_warn = n;
+}
@@ -0,0 +1,43 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "sd-id128.h"
+#include "journald-server.h"
+
+typedef enum ForwardQueueType {
+        FORWARD_QUEUE_STREAM,
+        FORWARD_QUEUE_DATAGRAM,
+} ForwardQueueType;
+
+int forward_queue_new(Server *s, const char *name, ForwardQueueType type, sd_id128_t message_id, ForwardQueue **ret);
+void forward_queue_free(ForwardQueue *q);
+
+int forward_queue_get_fd(ForwardQueue *q);
+void forward_queue_set_fd(ForwardQueue *q, int fd);
+void forward_queue_close(ForwardQueue *q);
+
+int forward_queue_push(ForwardQueue *q, const struct iovec *iovec, unsigned n, const struct ucred *ucred);
+int forward_queue_process(ForwardQueue *q, uint32_t events);
+
+void forward_queue_maybe_warn(ForwardQueue *q);
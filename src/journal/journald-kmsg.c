@@ -28,6 +28,8 @@
 #include <systemd/sd-messages.h>
 #include <libudev.h>
 
+#include "hashmap.h"
+#include "strv.h"
 #include "journald-server.h"
 #include "journald-kmsg.h"
 #include "journald-syslog.h"
@@ -104,6 +106,126 @@ static bool is_us(const char *pid) {
         return t == getpid();
 }
 
+/* How many records to read from /dev/kmsg per wake-up */
+#define KMSG_BATCH_MAX 256
+
+/* The udev data of a kernel device is looked up at most once per
+ * this interval. Kernel message storms tend to come from a few
+ * devices, so this saves most lookups. */
+#define KERNEL_DEVICE_CACHE_USEC (5*USEC_PER_SEC)
+#define KERNEL_DEVICE_CACHE_MAX 128
+
+typedef struct KernelDevice {
+        char *id;
+        usec_t timestamp;
+        char **fields;
+} KernelDevice;
+
+static void kernel_device_free(KernelDevice *d) {
+        if (!d)
+                return;
+
+        free(d->id);
+        strv_free(d->fields);
+        free(d);
+}
+
+void kernel_device_cache_free(Hashmap *h) {
+        KernelDevice *d;
+
+        while ((d = hashmap_steal_first(h)))
+                kernel_device_free(d);
+
+        hashmap_free(h);
+}
+
+static KernelDevice *kernel_device_lookup(Server *s, const char *id) {
+        struct udev_device *ud;
+        struct udev_list_entry *ll;
+        KernelDevice *d;
+        const char *g;
+        unsigned j = 0;
+        usec_t ts;
+        char *b;
+
+        assert(s);
+        assert(id);
+
+        ts = now(CLOCK_MONOTONIC);
+
+        d = hashmap_get(s->kernel_device_cache, id);
+        if (d) {
+                if (d->timestamp + KERNEL_DEVICE_CACHE_USEC > ts)
+                        return d;
+
+                hashmap_remove(s->kernel_device_cache, id);
+                kernel_device_free(d);
+        }
+
+        if (hashmap_ensure_allocated(&s->kernel_device_cache, string_hash_func, string_compare_func) < 0)
+                return NULL;
+
+        /* Nothing fancy, if we are full just start over */
+        if (hashmap_size(s->kernel_device_cache) >= KERNEL_DEVICE_CACHE_MAX)
+                while ((d = hashmap_steal_first(s->kernel_device_cache)))
+                        kernel_device_free(d);
+
+        d = new0(KernelDevice, 1);
+        if (!d)
+                return NULL;
+
+        d->id = strdup(id);
+        if (!d->id)
+                goto fail;
+
+        d->timestamp = ts;
+
+        /* Devices we can't find are cached too, with no fields */
+        ud = udev_device_new_from_device_id(s->udev, (char*) id);
+        if (ud) {
+                g = udev_device_get_devnode(ud);
+                if (g) {
+                        b = strappend("_UDEV_DEVNODE=", g);
+                        if (b && strv_push(&d->fields, b) < 0)
+                                free(b);
+                }
+
+                g = udev_device_get_sysname(ud);
+                if (g) {
+                        b = strappend("_UDEV_SYSNAME=", g);
+                        if (b && strv_push(&d->fields, b) < 0)
+                                free(b);
+                }
+
+                ll = udev_device_get_devlinks_list_entry(ud);
+                udev_list_entry_foreach(ll, ll) {
+
+                        if (j >= N_IOVEC_UDEV_FIELDS)
+                                break;
+
+                        g = udev_list_entry_get_name(ll);
+                        if (g) {
+                                b = strappend("_UDEV_DEVLINK=", g);
+                                if (b && strv_push(&d->fields, b) < 0)
+                                        free(b);
+                        }
+
+                        j++;
+                }
+
+                udev_device_unref(ud);
+        }
+
+        if (hashmap_put(s->kernel_device_cache, d->id, d) < 0)
+                goto fail;
+
+        return d;
+
+fail:
+        kernel_device_free(d);
+        return NULL;
+}
+
 static void dev_kmsg_record(Server *s, char *p, size_t l) {
         struct iovec iovec[N_IOVEC_META_FIELDS + 7 + N_IOVEC_KERNEL_FIELDS + 2 + N_IOVEC_UDEV_FIELDS];
         char *message = NULL, *syslog_priority = NULL, *syslog_pid = NULL, *syslog_facility = NULL, *syslog_identifier = NULL, *source_time = NULL;
@@ -216,53 +338,15 @@ static void dev_kmsg_record(Server *s, char *p, size_t l) {
         }
 
         if (kernel_device) {
-                struct udev_device *ud;
-
-                ud = udev_device_new_from_device_id(s->udev, kernel_device);
-                if (ud) {
-                        const char *g;
-                        struct udev_list_entry *ll;
-                        char *b;
-
-                        g = udev_device_get_devnode(ud);
-                        if (g) {
-                                b = strappend("_UDEV_DEVNODE=", g);
-                                if (b) {
-                                        IOVEC_SET_STRING(iovec[n++], b);
-                                        z++;
-                                }
-                        }
-
-                        g = udev_device_get_sysname(ud);
-                        if (g) {
-                                b = strappend("_UDEV_SYSNAME=", g);
-                                if (b) {
-                                        IOVEC_SET_STRING(iovec[n++], b);
-                                        z++;
-                                }
-                        }
-
-                        j = 0;
-                        ll = udev_device_get_devlinks_list_entry(ud);
-                        udev_list_entry_foreach(ll, ll) {
-
-                                if (j > N_IOVEC_UDEV_FIELDS)
-                                        break;
-
-                                g = udev_list_entry_get_name(ll);
-                                if (g) {
-                                        b = strappend("_UDEV_DEVLINK=", g);
-                                        if (b) {
-                                                IOVEC_SET_STRING(iovec[n++], b);
-                                                z++;
-                                        }
-                                }
-
-                                j++;
-                        }
-
-                        udev_device_unref(ud);
-                }
+                KernelDevice *d;
+                char **i;
+
+                /* The fields belong to the cache, hence aren't
+                 * counted in z */
+                d = kernel_device_lookup(s, kernel_device);
+                if (d)
+                        STRV_FOREACH(i, d->fields)
+                                IOVEC_SET_STRING(iovec[n++], *i);
         }
 
         if (asprintf(&source_time, "_SOURCE_MONOTONIC_TIMESTAMP=%llu", usec) >= 0)
@@ -319,7 +403,7 @@ finish:
         free(pid);
 }
 
-int server_read_dev_kmsg(Server *s) {
+static int dev_kmsg_read_one(Server *s) {
         char buffer[8192+1]; /* the kernel-side limit per record is 8K currently */
         ssize_t l;
 
@@ -349,6 +433,32 @@ int server_read_dev_kmsg(Server *s) {
         return 1;
 }
 
+int server_read_dev_kmsg(Server *s) {
+        unsigned i;
+        int r = 0;
+
+        assert(s);
+
+        /* Read everything that is queued, up to a limit so that the
+         * other sources still get their turn. Unless a writer thread
+         * does the writing, take the journal lock only once for the
+         * whole batch. */
+
+        if (!s->writer)
+                server_lock_journals(s);
+
+        for (i = 0; i < KMSG_BATCH_MAX; i++) {
+                r = dev_kmsg_read_one(s);
+                if (r <= 0)
+                        break;
+        }
+
+        if (!s->writer)
+                server_unlock_journals(s);
+
+        return r;
+}
+
 int server_flush_dev_kmsg(Server *s) {
         int r;
 
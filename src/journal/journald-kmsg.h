@@ -27,6 +27,8 @@ int server_open_dev_kmsg(Server *s);
 int server_read_dev_kmsg(Server *s);
 int server_flush_dev_kmsg(Server *s);
 
+void kernel_device_cache_free(Hashmap *h);
+
 void server_forward_kmsg(Server *s, int priority, const char *identifier, const char *message, struct ucred *ucred);
 
 int server_open_kernel_seqnum(Server *s);
@@ -22,9 +22,12 @@
 #include <unistd.h>
 #include <stddef.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #include "socket-util.h"
 #include "path-util.h"
+#include "missing.h"
 #include "journald-server.h"
 #include "journald-native.h"
 #include "journald-kmsg.h"
@@ -286,13 +289,22 @@ void server_process_native_file(
 
         struct stat st;
         _cleanup_free_ void *p = NULL;
+        bool sealed;
         ssize_t n;
         int r;
 
         assert(s);
         assert(fd >= 0);
 
-        if (!ucred || ucred->uid != 0) {
+        /* If it's a memfd that has been sealed against any further
+         * modification we can map it safely without fearing
+         * truncation, and don't need to care where it lives, since
+         * it lives nowhere. */
+        r = fcntl(fd, F_GET_SEALS);
+        sealed = r >= 0 &&
+                (r & (F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE)) == (F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE);
+
+        if (!sealed && (!ucred || ucred->uid != 0)) {
                 _cleanup_free_ char *sl = NULL, *k = NULL;
                 const char *e;
 
@@ -324,9 +336,9 @@ void server_process_native_file(
         }
 
         /* Data is in the passed file, since it didn't fit in a
-         * datagram. We can't map the file here, since clients might
-         * then truncate it and trigger a SIGBUS for us. So let's
-         * stupidly read it */
+         * datagram. Unless it is sealed we can't map the file here,
+         * since clients might then truncate it and trigger a SIGBUS
+         * for us. So let's stupidly read it in that case */
 
         if (fstat(fd, &st) < 0) {
                 log_error("Failed to stat passed file, ignoring: %m");
@@ -346,6 +358,19 @@ void server_process_native_file(
                 return;
         }
 
+        if (sealed) {
+                void *m;
+
+                m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (m != MAP_FAILED) {
+                        server_process_native_message(s, m, st.st_size, ucred, tv, label, label_len);
+                        munmap(m, st.st_size);
+                        return;
+                }
+
+                log_debug("Failed to map sealed file, falling back to reading it: %m");
+        }
+
         p = malloc(st.st_size);
         if (!p) {
                 log_oom();
@@ -0,0 +1,295 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_SELINUX
+#include <selinux/selinux.h>
+#endif
+
+#include <systemd/sd-login.h>
+
+#include "util.h"
+#include "hashmap.h"
+#include "cgroup-util.h"
+#include "audit.h"
+#include "journald-pid-cache.h"
+
+/* Chatty processes log many lines in a row, so a small cache goes a
+ * long way. Entries are checked against the start time of the
+ * process, so that recycled PIDs are caught, and are refreshed after
+ * a while, since a process may change its name, command line or
+ * cgroup. */
+#define PID_CACHE_MAX 128
+#define PID_CACHE_TTL_USEC (10*USEC_PER_SEC)
+
+struct PidCache {
+        Hashmap *entries;
+        LIST_HEAD(PidMetadata, lru);
+        PidMetadata *lru_tail;
+
+        uint64_t n_hits;
+        uint64_t n_misses;
+        uint64_t n_expired;
+        uint64_t n_evictions;
+};
+
+static char *shortened_cgroup_path(pid_t pid) {
+        int r;
+        char _cleanup_free_ *process_path = NULL, *init_path = NULL;
+        char *path;
+
+        assert(pid > 0);
+
+        r = cg_get_by_pid(SYSTEMD_CGROUP_CONTROLLER, pid, &process_path);
+        if (r < 0)
+                return NULL;
+
+        r = cg_get_by_pid(SYSTEMD_CGROUP_CONTROLLER, 1, &init_path);
+        if (r < 0)
+                return NULL;
+
+        if (endswith(init_path, "/system"))
+                init_path[strlen(init_path) - 7] = 0;
+        else if (streq(init_path, "/"))
+                init_path[0] = 0;
+
+        if (startswith(process_path, init_path)) {
+                path = strdup(process_path + strlen(init_path));
+        } else {
+                path = process_path;
+                process_path = NULL;
+        }
+
+        return path;
+}
+
+static char *field_from(const char *field, char *value) {
+        char *f;
+
+        if (!value)
+                return NULL;
+
+        f = strappend(field, value);
+        free(value);
+
+        return f;
+}
+
+static void pid_metadata_free(PidMetadata *m) {
+        if (!m)
+                return;
+
+        free(m->comm);
+        free(m->exe);
+        free(m->cmdline);
+        free(m->audit_session);
+        free(m->audit_loginuid);
+        free(m->cgroup);
+        free(m->cgroup_field);
+        free(m->session);
+        free(m->owner_uid);
+        free(m->unit);
+        free(m->selinux_context);
+        free(m);
+}
+
+static PidMetadata *pid_metadata_new(pid_t pid, unsigned long long starttime) {
+        PidMetadata *m;
+        char *t;
+#ifdef HAVE_AUDIT
+        uint32_t audit;
+        uid_t loginuid;
+#endif
+
+        assert(pid > 0);
+
+        m = new0(PidMetadata, 1);
+        if (!m)
+                return NULL;
+
+        m->pid = pid;
+        m->starttime = starttime;
+        m->timestamp = now(CLOCK_MONOTONIC);
+
+        /* Failing to read any of these is not fatal, we just won't
+         * have the field then */
+
+        if (get_process_comm(pid, &t) >= 0)
+                m->comm = field_from("_COMM=", t);
+
+        if (get_process_exe(pid, &t) >= 0)
+                m->exe = field_from("_EXE=", t);
+
+        if (get_process_cmdline(pid, 0, false, &t) >= 0)
+                m->cmdline = field_from("_CMDLINE=", t);
+
+#ifdef HAVE_AUDIT
+        if (audit_session_from_pid(pid, &audit) >= 0)
+                if (asprintf(&m->audit_session, "_AUDIT_SESSION=%lu", (unsigned long) audit) < 0)
+                        m->audit_session = NULL;
+
+        if (audit_loginuid_from_pid(pid, &loginuid) >= 0)
+                if (asprintf(&m->audit_loginuid, "_AUDIT_LOGINUID=%lu", (unsigned long) loginuid) < 0)
+                        m->audit_loginuid = NULL;
+#endif
+
+        m->cgroup = shortened_cgroup_path(pid);
+        if (m->cgroup)
+                m->cgroup_field = strappend("_SYSTEMD_CGROUP=", m->cgroup);
+
+#ifdef HAVE_LOGIND
+        if (sd_pid_get_session(pid, &t) >= 0)
+                m->session = field_from("_SYSTEMD_SESSION=", t);
+
+        if (sd_pid_get_owner_uid(pid, &m->owner) >= 0) {
+                m->owner_valid = true;
+                if (asprintf(&m->owner_uid, "_SYSTEMD_OWNER_UID=%lu", (unsigned long) m->owner) < 0)
+                        m->owner_uid = NULL;
+        }
+#endif
+
+        if (cg_pid_get_unit(pid, &t) >= 0)
+                m->unit = field_from("_SYSTEMD_UNIT=", t);
+        else if (cg_pid_get_user_unit(pid, &t) >= 0)
+                m->unit = field_from("_SYSTEMD_USER_UNIT=", t);
+
+#ifdef HAVE_SELINUX
+        {
+                security_context_t con;
+
+                if (getpidcon(pid, &con) >= 0) {
+                        m->selinux_context = strappend("_SELINUX_CONTEXT=", con);
+                        freecon(con);
+                }
+        }
+#endif
+
+        return m;
+}
+
+PidCache *pid_cache_new(void) {
+        PidCache *c;
+
+        c = new0(PidCache, 1);
+        if (!c)
+                return NULL;
+
+        c->entries = hashmap_new(trivial_hash_func, trivial_compare_func);
+        if (!c->entries) {
+                free(c);
+                return NULL;
+        }
+
+        return c;
+}
+
+static void pid_cache_remove(PidCache *c, PidMetadata *m) {
+        assert(c);
+        assert(m);
+
+        hashmap_remove(c->entries, UINT32_TO_PTR(m->pid));
+
+        if (c->lru_tail == m)
+                c->lru_tail = m->lru_prev;
+        LIST_REMOVE(PidMetadata, lru, c->lru, m);
+
+        pid_metadata_free(m);
+}
+
+void pid_cache_free(PidCache *c) {
+        if (!c)
+                return;
+
+        while (c->lru)
+                pid_cache_remove(c, c->lru);
+
+        hashmap_free(c->entries);
+        free(c);
+}
+
+PidMetadata *pid_cache_get(PidCache *c, pid_t pid) {
+        unsigned long long starttime = 0;
+        PidMetadata *m;
+
+        assert(c);
+        assert(pid > 0);
+
+        /* If the process is already gone we still use whatever we
+         * have cached, which is better than nothing */
+        get_starttime_of_pid(pid, &starttime);
+
+        m = hashmap_get(c->entries, UINT32_TO_PTR(pid));
+        if (m) {
+                if ((starttime == 0 || m->starttime == starttime) &&
+                    m->timestamp + PID_CACHE_TTL_USEC > now(CLOCK_MONOTONIC)) {
+
+                        c->n_hits++;
+
+                        /* Move to the front of the LRU list */
+                        if (c->lru != m) {
+                                if (c->lru_tail == m)
+                                        c->lru_tail = m->lru_prev;
+                                LIST_REMOVE(PidMetadata, lru, c->lru, m);
+                                LIST_PREPEND(PidMetadata, lru, c->lru, m);
+                        }
+
+                        return m;
+                }
+
+                c->n_expired++;
+                pid_cache_remove(c, m);
+        }
+
+        c->n_misses++;
+
+        while (hashmap_size(c->entries) >= PID_CACHE_MAX) {
+                assert(c->lru_tail);
+
+                c->n_evictions++;
+                pid_cache_remove(c, c->lru_tail);
+        }
+
+        m = pid_metadata_new(pid, starttime);
+        if (!m)
+                return NULL;
+
+        if (hashmap_put(c->entries, UINT32_TO_PTR(pid), m) < 0) {
+                pid_metadata_free(m);
+                return NULL;
+        }
+
+        LIST_PREPEND(PidMetadata, lru, c->lru, m);
+        if (!c->lru_tail)
+                c->lru_tail = m;
+
+        return m;
+}
+
+void pid_cache_get_stats(PidCache *c, PidCacheStats *stats) {
+        assert(c);
+        assert(stats);
+
+        stats->hits = c->n_hits;
+        stats->misses = c->n_misses;
+        stats->expired = c->n_expired;
+        stats->evictions = c->n_evictions;
+        stats->n_entries = hashmap_size(c->entries);
+}
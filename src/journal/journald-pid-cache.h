@@ -0,0 +1,70 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "list.h"
+#include "time-util.h"
+
+typedef struct PidMetadata PidMetadata;
+typedef struct PidCache PidCache;
+
+/* Everything we know about a process from /proc and friends. All
+ * strings except cgroup are complete journal fields, i.e. include
+ * the field name. */
+struct PidMetadata {
+        pid_t pid;
+        unsigned long long starttime;
+        usec_t timestamp;
+
+        LIST_FIELDS(PidMetadata, lru);
+
+        char *comm;
+        char *exe;
+        char *cmdline;
+        char *audit_session;
+        char *audit_loginuid;
+        char *cgroup;
+        char *cgroup_field;
+        char *session;
+        char *owner_uid;
+        char *unit;
+        char *selinux_context;
+
+        uid_t owner;
+        bool owner_valid;
+};
+
+typedef struct PidCacheStats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t expired;
+        uint64_t evictions;
+        unsigned n_entries;
+} PidCacheStats;
+
+PidCache *pid_cache_new(void);
+void pid_cache_free(PidCache *c);
+
+PidMetadata *pid_cache_get(PidCache *c, pid_t pid);
+void pid_cache_get_stats(PidCache *c, PidCacheStats *stats);
@@ -28,8 +28,6 @@
 #include "hashmap.h"
 
 #define POOLS_MAX 5
-#define BUCKETS_MAX 127
-#define GROUPS_MAX 2047
 
 static const int priority_map[] = {
         [LOG_EMERG]   = 0,
@@ -45,9 +43,14 @@ static const int priority_map[] = {
 typedef struct JournalRateLimitPool JournalRateLimitPool;
 typedef struct JournalRateLimitGroup JournalRateLimitGroup;
 
+/* Each pool is a token bucket that holds up to burst tokens and is
+ * refilled with burst tokens per interval. To avoid divisions,
+ * tokens are counted in units of 1/interval, so that a message costs
+ * interval units and each microsecond adds burst units. */
 struct JournalRateLimitPool {
-        usec_t begin;
-        unsigned num;
+        uint64_t tokens;
+        usec_t refilled;
+        usec_t reported;
         unsigned suppressed;
 };
 
@@ -55,51 +58,71 @@ struct JournalRateLimitGroup {
         JournalRateLimit *parent;
 
         char *id;
+        unsigned burst;
+        uint64_t dropped;
         JournalRateLimitPool pools[POOLS_MAX];
-        unsigned hash;
 
-        LIST_FIELDS(JournalRateLimitGroup, bucket);
         LIST_FIELDS(JournalRateLimitGroup, lru);
 };
 
 struct JournalRateLimit {
         usec_t interval;
         unsigned burst;
+        unsigned groups_max;
 
-        JournalRateLimitGroup* buckets[BUCKETS_MAX];
+        Hashmap *groups;
         JournalRateLimitGroup *lru, *lru_tail;
 
-        unsigned n_groups;
+        /* Borrowed, maps cgroup path prefixes to bursts */
+        Hashmap *overrides;
+
+        /* Cache for burst_modulate() */
+        uint64_t available;
+        unsigned available_log2;
 };
 
-JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst) {
+JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst, unsigned groups_max) {
         JournalRateLimit *r;
 
         assert(interval > 0 || burst == 0);
+        assert(groups_max > 0);
 
         r = new0(JournalRateLimit, 1);
         if (!r)
                 return NULL;
 
+        r->groups = hashmap_new(string_hash_func, string_compare_func);
+        if (!r->groups) {
+                free(r);
+                return NULL;
+        }
+
         r->interval = interval;
         r->burst = burst;
+        r->groups_max = groups_max;
+        r->available = (uint64_t) -1;
+        r->available_log2 = u64log2(r->available);
 
         return r;
 }
 
+void journal_rate_limit_set_overrides(JournalRateLimit *r, Hashmap *overrides) {
+        assert(r);
+
+        r->overrides = overrides;
+}
+
 static void journal_rate_limit_group_free(JournalRateLimitGroup *g) {
         assert(g);
 
         if (g->parent) {
-                assert(g->parent->n_groups > 0);
+                assert(hashmap_size(g->parent->groups) > 0);
 
                 if (g->parent->lru_tail == g)
                         g->parent->lru_tail = g->lru_prev;
 
                 LIST_REMOVE(JournalRateLimitGroup, lru, g->parent->lru, g);
-                LIST_REMOVE(JournalRateLimitGroup, bucket, g->parent->buckets[g->hash % BUCKETS_MAX], g);
-
-                g->parent->n_groups --;
+                hashmap_remove(g->parent->groups, g->id);
         }
 
         free(g->id);
@@ -112,34 +135,41 @@ void journal_rate_limit_free(JournalRateLimit *r) {
         while (r->lru)
                 journal_rate_limit_group_free(r->lru);
 
+        hashmap_free(r->groups);
         free(r);
 }
 
-static bool journal_rate_limit_group_expired(JournalRateLimitGroup *g, usec_t ts) {
-        unsigned i;
+static unsigned journal_rate_limit_burst_for(JournalRateLimit *r, const char *id) {
+        char *prefix, *e;
+        void *v;
 
-        assert(g);
+        assert(r);
+        assert(id);
 
-        for (i = 0; i < POOLS_MAX; i++)
-                if (g->pools[i].begin + g->parent->interval >= ts)
-                        return false;
+        if (hashmap_isempty(r->overrides))
+                return r->burst;
 
-        return true;
-}
+        /* Find the longest configured prefix of the group id, by
+         * cutting off one path component after the other. */
+        prefix = strdupa(id);
+        for (;;) {
+                v = hashmap_get(r->overrides, prefix);
+                if (v)
+                        return PTR_TO_UINT(v) - 1;
 
-static void journal_rate_limit_vacuum(JournalRateLimit *r, usec_t ts) {
-        assert(r);
+                e = strrchr(prefix, '/');
+                if (!e || e == prefix)
+                        break;
 
-        /* Makes room for at least one new item, but drop all
-         * expored items too. */
+                *e = 0;
+        }
 
-        while (r->n_groups >= GROUPS_MAX ||
-               (r->lru_tail && journal_rate_limit_group_expired(r->lru_tail, ts)))
-                journal_rate_limit_group_free(r->lru_tail);
+        return r->burst;
 }
 
 static JournalRateLimitGroup* journal_rate_limit_group_new(JournalRateLimit *r, const char *id, usec_t ts) {
         JournalRateLimitGroup *g;
+        unsigned i;
 
         assert(r);
         assert(id);
@@ -152,15 +182,23 @@ static JournalRateLimitGroup* journal_rate_limit_group_new(JournalRateLimit *r,
         if (!g->id)
                 goto fail;
 
-        g->hash = string_hash_func(g->id);
+        g->burst = journal_rate_limit_burst_for(r, id);
 
-        journal_rate_limit_vacuum(r, ts);
+        /* Start out with full buckets */
+        for (i = 0; i < POOLS_MAX; i++)
+                g->pools[i].refilled = ts - r->interval;
+
+        /* Make room for the new group by dropping the one that was
+         * used least recently */
+        if (hashmap_size(r->groups) >= r->groups_max)
+                journal_rate_limit_group_free(r->lru_tail);
+
+        if (hashmap_put(r->groups, g->id, g) < 0)
+                goto fail;
 
-        LIST_PREPEND(JournalRateLimitGroup, bucket, r->buckets[g->hash % BUCKETS_MAX], g);
         LIST_PREPEND(JournalRateLimitGroup, lru, r->lru, g);
         if (!g->lru_next)
                 r->lru_tail = g;
-        r->n_groups ++;
 
         g->parent = r;
         return g;
@@ -170,13 +208,18 @@ fail:
         return NULL;
 }
 
-static unsigned burst_modulate(unsigned burst, uint64_t available) {
+static unsigned burst_modulate(JournalRateLimit *r, unsigned burst, uint64_t available) {
         unsigned k;
 
         /* Modulates the burst rate a bit with the amount of available
          * disk space */
 
-        k = u64log2(available);
+        if (available != r->available) {
+                r->available = available;
+                r->available_log2 = u64log2(available);
+        }
+
+        k = r->available_log2;
 
         /* 1MB */
         if (k <= 20)
@@ -198,12 +241,12 @@ static unsigned burst_modulate(unsigned burst, uint64_t available) {
         return burst;
 }
 
-int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, uint64_t available) {
-        unsigned h;
+int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, uint64_t available, uint64_t *dropped) {
         JournalRateLimitGroup *g;
         JournalRateLimitPool *p;
         unsigned burst;
-        usec_t ts;
+        uint64_t capacity;
+        usec_t ts, elapsed;
 
         assert(id);
 
@@ -213,48 +256,64 @@ int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, u
         if (r->interval == 0 || r->burst == 0)
                 return 1;
 
-        burst = burst_modulate(r->burst, available);
-
         ts = now(CLOCK_MONOTONIC);
 
-        h = string_hash_func(id);
-        g = r->buckets[h % BUCKETS_MAX];
-
-        LIST_FOREACH(bucket, g, g)
-                if (streq(g->id, id))
-                        break;
-
-        if (!g) {
+        g = hashmap_get(r->groups, id);
+        if (g) {
+                /* Keep the LRU list in order of use */
+                if (g != r->lru) {
+                        if (r->lru_tail == g)
+                                r->lru_tail = g->lru_prev;
+
+                        LIST_REMOVE(JournalRateLimitGroup, lru, r->lru, g);
+                        LIST_PREPEND(JournalRateLimitGroup, lru, r->lru, g);
+                }
+        } else {
                 g = journal_rate_limit_group_new(r, id, ts);
                 if (!g)
                         return -ENOMEM;
         }
 
+        if (g->burst == 0)
+                return 1;
+
+        burst = burst_modulate(r, g->burst, available);
+        if (burst == 0)
+                burst = 1;
+
+        capacity = (uint64_t) burst > (uint64_t) -1 / r->interval ?
+                (uint64_t) -1 : (uint64_t) burst * r->interval;
+
         p = &g->pools[priority_map[priority]];
 
-        if (p->begin <= 0) {
-                p->suppressed = 0;
-                p->num = 1;
-                p->begin = ts;
-                return 1;
-        }
+        elapsed = ts - p->refilled;
+        if (elapsed >= r->interval)
+                p->tokens = capacity;
+        else
+                p->tokens = MIN(capacity, p->tokens + elapsed * burst);
+        p->refilled = ts;
 
-        if (p->begin + r->interval < ts) {
+        if (p->tokens >= r->interval) {
                 unsigned s;
 
+                p->tokens -= r->interval;
+
+                /* Report suppressed messages at most once per
+                 * interval */
+                if (p->suppressed <= 0 || p->reported + r->interval > ts)
+                        return 1;
+
                 s = p->suppressed;
                 p->suppressed = 0;
-                p->num = 1;
-                p->begin = ts;
+                p->reported = ts;
 
-                return 1 + s;
-        }
+                if (dropped)
+                        *dropped = g->dropped;
 
-        if (p->num <= burst) {
-                p->num++;
-                return 1;
+                return 1 + s;
         }
 
         p->suppressed++;
+        g->dropped++;
         return 0;
 }
@@ -23,9 +23,11 @@
 
 #include "macro.h"
 #include "util.h"
+#include "hashmap.h"
 
 typedef struct JournalRateLimit JournalRateLimit;
 
-JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst);
+JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst, unsigned groups_max);
 void journal_rate_limit_free(JournalRateLimit *r);
-int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, uint64_t available);
+void journal_rate_limit_set_overrides(JournalRateLimit *r, Hashmap *overrides);
+int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, uint64_t available, uint64_t *dropped);
@@ -41,6 +41,7 @@
 #include "journal-file.h"
 #include "socket-util.h"
 #include "cgroup-util.h"
+#include "path-util.h"
 #include "list.h"
 #include "virt.h"
 #include "missing.h"
@@ -48,6 +49,7 @@
 #include "journal-internal.h"
 #include "journal-vacuum.h"
 #include "journal-authenticate.h"
+#include "compress.h"
 #include "journald-server.h"
 #include "journald-rate-limit.h"
 #include "journald-kmsg.h"
@@ -55,6 +57,10 @@
 #include "journald-stream.h"
 #include "journald-console.h"
 #include "journald-native.h"
+#include "journald-writer.h"
+#include "journald-pid-cache.h"
+#include "journald-forward.h"
+#include "trace.h"
 
 #ifdef HAVE_ACL
 #include <sys/acl.h>
@@ -69,11 +75,39 @@
 #define USER_JOURNALS_MAX 1024
 
 #define DEFAULT_SYNC_INTERVAL_USEC (5*USEC_PER_MINUTE)
+#define DEFAULT_SYNC_CRITICAL_INTERVAL_USEC (100*USEC_PER_MSEC)
 #define DEFAULT_RATE_LIMIT_INTERVAL (10*USEC_PER_SEC)
 #define DEFAULT_RATE_LIMIT_BURST 200
+#define DEFAULT_RATE_LIMIT_GROUPS_MAX 2047
 
 #define RECHECK_AVAILABLE_SPACE_USEC (30*USEC_PER_SEC)
 
+#define DEFAULT_WRITE_QUEUE_MAX 4096
+
+#define DEFAULT_LINE_MAX (48*1024)
+#define LINE_MAX_MIN 79
+#define LINE_MAX_MAX (64*1024*1024)
+
+#define DEFAULT_STDOUT_STREAMS_MAX 4096
+
+/* Datagrams received per recvmmsg() call, and the space for each. The
+ * latter covers the default socket send buffer size, larger datagrams
+ * are read individually if we see them coming. */
+#define DATAGRAM_BATCH_MAX 16
+#define DATAGRAM_SLOT_SIZE (256U*1024U)
+
+/* The runtime journal is flushed to /var piecemeal, interleaved with
+ * live messages: entries are copied in batches, and one step copies
+ * at most so many of them or runs for so long. Steps are made when
+ * there is nothing else to do, but at least once per interval. */
+#define FLUSH_BATCH_MAX 256
+#define FLUSH_STEP_ENTRIES_MAX 4096
+#define FLUSH_STEP_USEC (10*USEC_PER_MSEC)
+#define FLUSH_STEP_INTERVAL_USEC (50*USEC_PER_MSEC)
+
+/* How often the journal lock is held by the current thread */
+static __thread unsigned journals_locked = 0;
+
 static const char* const storage_table[] = {
         [STORAGE_AUTO] = "auto",
         [STORAGE_VOLATILE] = "volatile",
@@ -93,7 +127,155 @@ static const char* const split_mode_table[] = {
 DEFINE_STRING_TABLE_LOOKUP(split_mode, SplitMode);
 DEFINE_CONFIG_PARSE_ENUM(config_parse_split_mode, split_mode, SplitMode, "Failed to parse split mode setting");
 
-static uint64_t available_space(Server *s) {
+static const char* const write_overflow_table[] = {
+        [WRITE_OVERFLOW_BLOCK] = "block",
+        [WRITE_OVERFLOW_DROP] = "drop"
+};
+
+DEFINE_STRING_TABLE_LOOKUP(write_overflow, WriteOverflow);
+DEFINE_CONFIG_PARSE_ENUM(config_parse_write_overflow, write_overflow, WriteOverflow, "Failed to parse write overflow setting");
+
+void server_lock_journals(Server *s) {
+        assert(s);
+
+        pthread_mutex_lock(&s->journal_lock);
+        journals_locked++;
+}
+
+void server_unlock_journals(Server *s) {
+        assert(s);
+        assert(journals_locked > 0);
+
+        journals_locked--;
+        pthread_mutex_unlock(&s->journal_lock);
+}
+
+int config_parse_compress(const char* unit,
+                          const char *filename,
+                          unsigned line,
+                          const char *section,
+                          const char *lvalue,
+                          int ltype,
+                          const char *rvalue,
+                          void *data,
+                          void *userdata) {
+
+        int *compress = data, k;
+
+        assert(filename);
+        assert(lvalue);
+        assert(rvalue);
+        assert(data);
+
+        /* Takes either a boolean, in which case we pick the best
+         * algorithm we have been built with, or the name of a
+         * specific compression algorithm. */
+
+        k = parse_boolean(rvalue);
+        if (k >= 0) {
+                *compress = k ? compression_default() : 0;
+                return 0;
+        }
+
+        k = object_compressed_from_string(rvalue);
+        if (k < 0) {
+                log_syntax(unit, LOG_ERR, filename, line, EINVAL,
+                           "Failed to parse compression setting, ignoring: %s", rvalue);
+                return 0;
+        }
+
+        if (!compression_supported(k)) {
+                log_syntax(unit, LOG_WARNING, filename, line, EOPNOTSUPP,
+                           "Compression algorithm %s is not supported, using default: %s", rvalue,
+                           strna(object_compressed_to_string(compression_default())));
+                k = compression_default();
+        }
+
+        *compress = k;
+        return 0;
+}
+
+int config_parse_rate_limit_override(const char* unit,
+                                     const char *filename,
+                                     unsigned line,
+                                     const char *section,
+                                     const char *lvalue,
+                                     int ltype,
+                                     const char *rvalue,
+                                     void *data,
+                                     void *userdata) {
+
+        Hashmap **overrides = data;
+        _cleanup_free_ char *prefix = NULL;
+        const char *w;
+        unsigned burst;
+        char *k;
+        int r;
+
+        assert(filename);
+        assert(lvalue);
+        assert(rvalue);
+        assert(data);
+
+        /* Takes a cgroup path prefix and a burst for the groups
+         * below it, for example "/user 100". An empty assignment
+         * resets the list. */
+
+        if (isempty(rvalue)) {
+                while ((k = hashmap_steal_first_key(*overrides)))
+                        free(k);
+                return 0;
+        }
+
+        w = strpbrk(rvalue, WHITESPACE);
+        if (!w) {
+                log_syntax(unit, LOG_ERR, filename, line, EINVAL,
+                           "Missing burst in rate limit override, ignoring: %s", rvalue);
+                return 0;
+        }
+
+        prefix = strndup(rvalue, w - rvalue);
+        if (!prefix)
+                return log_oom();
+
+        if (!path_is_absolute(prefix)) {
+                log_syntax(unit, LOG_ERR, filename, line, EINVAL,
+                           "Rate limit override prefix is not absolute, ignoring: %s", rvalue);
+                return 0;
+        }
+
+        path_kill_slashes(prefix);
+
+        r = safe_atou(w + strspn(w, WHITESPACE), &burst);
+        if (r < 0 || burst == (unsigned) -1) {
+                log_syntax(unit, LOG_ERR, filename, line, EINVAL,
+                           "Failed to parse rate limit override burst, ignoring: %s", rvalue);
+                return 0;
+        }
+
+        r = hashmap_ensure_allocated(overrides, string_hash_func, string_compare_func);
+        if (r < 0)
+                return log_oom();
+
+        /* The burst is stored shifted by one, so that 0 can be told
+         * apart from a missing entry */
+        if (hashmap_get2(*overrides, prefix, (void**) &k)) {
+                r = hashmap_update(*overrides, k, UINT_TO_PTR(burst + 1));
+                if (r < 0)
+                        return log_oom();
+
+                return 0;
+        }
+
+        r = hashmap_put(*overrides, prefix, UINT_TO_PTR(burst + 1));
+        if (r < 0)
+                return log_oom();
+
+        prefix = NULL;
+        return 0;
+}
+
+static uint64_t available_space_locked(Server *s) {
         char ids[33];
         char _cleanup_free_ *p = NULL;
         const char *f;
@@ -175,6 +357,24 @@ static uint64_t available_space(Server *s) {
         return avail;
 }
 
+static uint64_t available_space(Server *s) {
+        uint64_t avail;
+
+        assert(s);
+
+        /* Don't wait for the writer thread if it is busy, the last
+         * value we calculated is good enough then. It is only ever
+         * updated from this thread. */
+        if (pthread_mutex_trylock(&s->journal_lock) != 0)
+                return s->cached_available_space;
+
+        journals_locked++;
+        avail = available_space_locked(s);
+        server_unlock_journals(s);
+
+        return avail;
+}
+
 static void server_read_file_gid(Server *s) {
         const char *g = "systemd-journal";
         int r;
@@ -194,6 +394,15 @@ static void server_read_file_gid(Server *s) {
         s->file_gid_valid = true;
 }
 
+static void server_setup_file(Server *s, JournalFile *f) {
+        assert(s);
+        assert(f);
+
+        /* Reader wakeups are batched up in server_post_change() */
+        f->defer_post_change = true;
+        f->compress_threshold_bytes = s->compress_threshold_bytes;
+}
+
 void server_fix_perms(Server *s, JournalFile *f, uid_t uid) {
         int r;
 #ifdef HAVE_ACL
@@ -290,6 +499,7 @@ static JournalFile* find_journal(Server *s, uid_t uid) {
         if (r < 0)
                 return s->system_journal;
 
+        server_setup_file(s, f);
         server_fix_perms(s, f, uid);
 
         r = hashmap_put(s->user_journals, UINT32_TO_PTR(uid), f);
@@ -309,6 +519,8 @@ void server_rotate(Server *s) {
 
         log_debug("Rotating...");
 
+        server_lock_journals(s);
+
         if (s->runtime_journal) {
                 r = journal_file_rotate(&s->runtime_journal, s->compress, false);
                 if (r < 0)
@@ -346,6 +558,25 @@ void server_rotate(Server *s) {
                         server_fix_perms(s, f, PTR_TO_UINT32(k));
                 }
         }
+
+        server_unlock_journals(s);
+}
+
+void server_notify_status(Server *s) {
+        PidCacheStats st;
+        uint64_t total;
+
+        assert(s);
+
+        /* Show some statistics in "systemctl status" */
+        pid_cache_get_stats(s->pid_cache, &st);
+        total = st.hits + st.misses;
+
+        sd_notifyf(false,
+                   "STATUS=Processing requests... (metadata cache: %u entries, %"PRIu64" hits, %"PRIu64" misses, %u%% hit rate, %"PRIu64" expired, %"PRIu64" evicted)",
+                   st.n_entries, st.hits, st.misses,
+                   total > 0 ? (unsigned) (st.hits * 100 / total) : 0,
+                   st.expired, st.evictions);
 }
 
 void server_sync(Server *s) {
@@ -356,6 +587,9 @@ void server_sync(Server *s) {
 
         static const struct itimerspec sync_timer_disable = {};
 
+        TRACE0(journal_sync_begin);
+        server_lock_journals(s);
+
         if (s->system_journal) {
                 r = journal_file_set_offline(s->system_journal);
                 if (r < 0)
@@ -373,9 +607,16 @@ void server_sync(Server *s) {
                 log_error("Failed to disable max timer: %m");
 
         s->sync_scheduled = false;
+        s->sync_deadline_usec = 0;
+        s->last_sync_usec = now(CLOCK_MONOTONIC);
+
+        server_unlock_journals(s);
+        TRACE0(journal_sync_end);
+
+        server_notify_status(s);
 }
 
-void server_vacuum(Server *s) {
+static void vacuum_locked(Server *s) {
         char *p;
         char ids[33];
         sd_id128_t machine;
@@ -400,7 +641,7 @@ void server_vacuum(Server *s) {
                         return;
                 }
 
-                r = journal_directory_vacuum(p, s->system_metrics.max_use, s->system_metrics.keep_free, s->max_retention_usec, &s->oldest_file_usec);
+                r = journal_directory_vacuum_cached(&s->system_vacuum_cache, p, s->system_metrics.max_use, s->system_metrics.keep_free, s->max_retention_usec, &s->oldest_file_usec);
                 if (r < 0 && r != -ENOENT)
                         log_error("Failed to vacuum %s: %s", p, strerror(-r));
                 free(p);
@@ -413,7 +654,7 @@ void server_vacuum(Server *s) {
                         return;
                 }
 
-                r = journal_directory_vacuum(p, s->runtime_metrics.max_use, s->runtime_metrics.keep_free, s->max_retention_usec, &s->oldest_file_usec);
+                r = journal_directory_vacuum_cached(&s->runtime_vacuum_cache, p, s->runtime_metrics.max_use, s->runtime_metrics.keep_free, s->max_retention_usec, &s->oldest_file_usec);
                 if (r < 0 && r != -ENOENT)
                         log_error("Failed to vacuum %s: %s", p, strerror(-r));
                 free(p);
@@ -422,34 +663,12 @@ void server_vacuum(Server *s) {
         s->cached_available_space_timestamp = 0;
 }
 
-static char *shortened_cgroup_path(pid_t pid) {
-        int r;
-        char _cleanup_free_ *process_path = NULL, *init_path = NULL;
-        char *path;
-
-        assert(pid > 0);
-
-        r = cg_get_by_pid(SYSTEMD_CGROUP_CONTROLLER, pid, &process_path);
-        if (r < 0)
-                return NULL;
-
-        r = cg_get_by_pid(SYSTEMD_CGROUP_CONTROLLER, 1, &init_path);
-        if (r < 0)
-                return NULL;
-
-        if (endswith(init_path, "/system"))
-                init_path[strlen(init_path) - 7] = 0;
-        else if (streq(init_path, "/"))
-                init_path[0] = 0;
-
-        if (startswith(process_path, init_path)) {
-                path = strdup(process_path + strlen(init_path));
-        } else {
-                path = process_path;
-                process_path = NULL;
-        }
+void server_vacuum(Server *s) {
+        assert(s);
 
-        return path;
+        server_lock_journals(s);
+        vacuum_locked(s);
+        server_unlock_journals(s);
 }
 
 bool shall_try_append_again(JournalFile *f, int r) {
@@ -481,7 +700,7 @@ bool shall_try_append_again(JournalFile *f, int r) {
         return true;
 }
 
-static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned n) {
+void server_write_to_journal(Server *s, uid_t uid, const dual_timestamp *ts, struct iovec *iovec, unsigned n, int priority) {
         JournalFile *f;
         bool vacuumed = false;
         int r;
@@ -489,6 +708,7 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned
         assert(s);
         assert(iovec);
         assert(n > 0);
+        assert(journals_locked > 0);
 
         f = find_journal(s, uid);
         if (!f)
@@ -505,9 +725,9 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned
                         return;
         }
 
-        r = journal_file_append_entry(f, NULL, iovec, n, &s->seqnum, NULL, NULL);
+        r = journal_file_append_entry(f, ts, iovec, n, &s->seqnum, NULL, NULL);
         if (r >= 0) {
-                server_schedule_sync(s);
+                server_schedule_sync(s, priority);
                 return;
         }
 
@@ -524,9 +744,11 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned
                 return;
 
         log_debug("Retrying write.");
-        r = journal_file_append_entry(f, NULL, iovec, n, &s->seqnum, NULL, NULL);
+        r = journal_file_append_entry(f, ts, iovec, n, &s->seqnum, NULL, NULL);
         if (r < 0)
                 log_error("Failed to write entry, ignoring: %s", strerror(-r));
+        else
+                server_schedule_sync(s, priority);
 }
 
 static void dispatch_message_real(
@@ -535,7 +757,9 @@ static void dispatch_message_real(
                 struct ucred *ucred,
                 struct timeval *tv,
                 const char *label, size_t label_len,
-                const char *unit_id) {
+                const char *unit_id,
+                PidMetadata *md,
+                int priority) {
 
         char pid[sizeof("_PID=") + DECIMAL_STR_MAX(ucred->pid)],
                 uid[sizeof("_UID=") + DECIMAL_STR_MAX(ucred->uid)],
@@ -544,13 +768,7 @@ static void dispatch_message_real(
                 boot_id[sizeof("_BOOT_ID=") + 32] = "_BOOT_ID=",
                 machine_id[sizeof("_MACHINE_ID=") + 32] = "_MACHINE_ID=";
 
-        char _cleanup_free_ *comm = NULL, *cmdline = NULL, *hostname = NULL,
-                *exe = NULL, *cgroup = NULL, *session = NULL,
-                *owner_uid = NULL, *unit = NULL, *selinux_context = NULL;
-
-#ifdef HAVE_AUDIT
-        char _cleanup_free_ *audit_session = NULL, *audit_loginuid = NULL;
-#endif
+        char _cleanup_free_ *hostname = NULL, *unit = NULL, *selinux_context = NULL;
 
         sd_id128_t id;
         int r;
@@ -563,12 +781,9 @@ static void dispatch_message_real(
         assert(n > 0);
         assert(n + N_IOVEC_META_FIELDS <= m);
 
-        if (ucred) {
-#ifdef HAVE_AUDIT
-                uint32_t audit;
-                uid_t loginuid;
-#endif
+        TRACE3(journal_dispatch, ucred ? ucred->pid : 0, n, priority);
 
+        if (ucred) {
                 realuid = ucred->uid;
 
                 snprintf(pid, sizeof(pid) - 1, "_PID=%lu", (unsigned long) ucred->pid);
@@ -583,85 +798,41 @@ static void dispatch_message_real(
                 char_array_0(gid);
                 IOVEC_SET_STRING(iovec[n++], gid);
 
-                r = get_process_comm(ucred->pid, &t);
-                if (r >= 0) {
-                        comm = strappend("_COMM=", t);
-                        free(t);
-
-                        if (comm)
-                                IOVEC_SET_STRING(iovec[n++], comm);
+                if (!md)
+                        md = pid_cache_get(s->pid_cache, ucred->pid);
+                if (md) {
+                        if (md->comm)
+                                IOVEC_SET_STRING(iovec[n++], md->comm);
+                        if (md->exe)
+                                IOVEC_SET_STRING(iovec[n++], md->exe);
+                        if (md->cmdline)
+                                IOVEC_SET_STRING(iovec[n++], md->cmdline);
+                        if (md->audit_session)
+                                IOVEC_SET_STRING(iovec[n++], md->audit_session);
+                        if (md->audit_loginuid)
+                                IOVEC_SET_STRING(iovec[n++], md->audit_loginuid);
+                        if (md->cgroup_field)
+                                IOVEC_SET_STRING(iovec[n++], md->cgroup_field);
+                        if (md->session)
+                                IOVEC_SET_STRING(iovec[n++], md->session);
+                        if (md->owner_uid)
+                                IOVEC_SET_STRING(iovec[n++], md->owner_uid);
+
+                        owner = md->owner;
+                        owner_valid = md->owner_valid;
                 }
 
-                r = get_process_exe(ucred->pid, &t);
-                if (r >= 0) {
-                        exe = strappend("_EXE=", t);
-                        free(t);
-
-                        if (exe)
-                                IOVEC_SET_STRING(iovec[n++], exe);
-                }
-
-                r = get_process_cmdline(ucred->pid, 0, false, &t);
-                if (r >= 0) {
-                        cmdline = strappend("_CMDLINE=", t);
-                        free(t);
-
-                        if (cmdline)
-                                IOVEC_SET_STRING(iovec[n++], cmdline);
-                }
-
-#ifdef HAVE_AUDIT
-                r = audit_session_from_pid(ucred->pid, &audit);
-                if (r >= 0)
-                        if (asprintf(&audit_session, "_AUDIT_SESSION=%lu", (unsigned long) audit) >= 0)
-                                IOVEC_SET_STRING(iovec[n++], audit_session);
-
-                r = audit_loginuid_from_pid(ucred->pid, &loginuid);
-                if (r >= 0)
-                        if (asprintf(&audit_loginuid, "_AUDIT_LOGINUID=%lu", (unsigned long) loginuid) >= 0)
-                                IOVEC_SET_STRING(iovec[n++], audit_loginuid);
-#endif
-
-                t = shortened_cgroup_path(ucred->pid);
-                if (t) {
-                        cgroup = strappend("_SYSTEMD_CGROUP=", t);
-                        free(t);
-
-                        if (cgroup)
-                                IOVEC_SET_STRING(iovec[n++], cgroup);
-                }
-
-#ifdef HAVE_LOGIND
-                if (sd_pid_get_session(ucred->pid, &t) >= 0) {
-                        session = strappend("_SYSTEMD_SESSION=", t);
-                        free(t);
-
-                        if (session)
-                                IOVEC_SET_STRING(iovec[n++], session);
-                }
-
-                if (sd_pid_get_owner_uid(ucred->pid, &owner) >= 0) {
-                        owner_valid = true;
-                        if (asprintf(&owner_uid, "_SYSTEMD_OWNER_UID=%lu", (unsigned long) owner) >= 0)
-                                IOVEC_SET_STRING(iovec[n++], owner_uid);
-                }
-#endif
-
-                if (cg_pid_get_unit(ucred->pid, &t) >= 0) {
-                        unit = strappend("_SYSTEMD_UNIT=", t);
-                        free(t);
-                } else if (cg_pid_get_user_unit(ucred->pid, &t) >= 0) {
-                        unit = strappend("_SYSTEMD_USER_UNIT=", t);
-                        free(t);
-                } else if (unit_id) {
-                        if (session)
+                if (md && md->unit)
+                        IOVEC_SET_STRING(iovec[n++], md->unit);
+                else if (unit_id) {
+                        if (md && md->session)
                                 unit = strappend("_SYSTEMD_USER_UNIT=", unit_id);
                         else
                                 unit = strappend("_SYSTEMD_UNIT=", unit_id);
-                }
 
-                if (unit)
-                        IOVEC_SET_STRING(iovec[n++], unit);
+                        if (unit)
+                                IOVEC_SET_STRING(iovec[n++], unit);
+                }
 
 #ifdef HAVE_SELINUX
                 if (label) {
@@ -670,16 +841,8 @@ static void dispatch_message_real(
                                 *((char*) mempcpy(stpcpy(selinux_context, "_SELINUX_CONTEXT="), label, label_len)) = 0;
                                 IOVEC_SET_STRING(iovec[n++], selinux_context);
                         }
-                } else {
-                        security_context_t con;
-
-                        if (getpidcon(ucred->pid, &con) >= 0) {
-                                selinux_context = strappend("_SELINUX_CONTEXT=", con);
-                                if (selinux_context)
-                                        IOVEC_SET_STRING(iovec[n++], selinux_context);
-                                freecon(con);
-                        }
-                }
+                } else if (md && md->selinux_context)
+                        IOVEC_SET_STRING(iovec[n++], md->selinux_context);
 #endif
         }
 
@@ -729,27 +892,60 @@ static void dispatch_message_real(
         else
                 journal_uid = 0;
 
-        write_to_journal(s, journal_uid, iovec, n);
+        /* Hand the entry over to the writer thread, unless we are
+         * called with the journals locked, for example when we log
+         * about the journals themselves. Waiting for the writer would
+         * deadlock then. */
+        if (s->writer && journals_locked == 0) {
+                dual_timestamp ts;
+                unsigned k;
+
+                dual_timestamp_get(&ts);
+
+                r = journal_writer_enqueue(s->writer, journal_uid, &ts, iovec, n, priority);
+                if (r == -ENOBUFS)
+                        return;
+                if (r < 0) {
+                        log_error("Failed to queue entry, ignoring: %s", strerror(-r));
+                        return;
+                }
+
+                k = journal_writer_reset_dropped(s->writer);
+                if (k > 0)
+                        server_driver_message(s, SD_MESSAGE_JOURNAL_DROPPED,
+                                              "Dropped %u messages, write queue was full.", k);
+                return;
+        }
+
+        server_lock_journals(s);
+        server_write_to_journal(s, journal_uid, NULL, iovec, n, priority);
+        server_unlock_journals(s);
 }
 
-void server_driver_message(Server *s, sd_id128_t message_id, const char *format, ...) {
+#define DRIVER_FIELDS_MAX 4
+
+static void driver_message_internal(
+                Server *s,
+                sd_id128_t message_id,
+                const struct iovec *fields, unsigned n_fields,
+                const char *format, va_list ap) {
+
         char mid[11 + 32 + 1];
         char buffer[16 + LINE_MAX + 1];
-        struct iovec iovec[N_IOVEC_META_FIELDS + 4];
-        int n = 0;
-        va_list ap;
+        struct iovec iovec[N_IOVEC_META_FIELDS + 4 + DRIVER_FIELDS_MAX];
+        unsigned n = 0, i;
         struct ucred ucred = {};
 
         assert(s);
+        assert(fields || n_fields == 0);
+        assert(n_fields <= DRIVER_FIELDS_MAX);
         assert(format);
 
         IOVEC_SET_STRING(iovec[n++], "PRIORITY=6");
         IOVEC_SET_STRING(iovec[n++], "_TRANSPORT=driver");
 
         memcpy(buffer, "MESSAGE=", 8);
-        va_start(ap, format);
         vsnprintf(buffer + 8, sizeof(buffer) - 8, format, ap);
-        va_end(ap);
         char_array_0(buffer);
         IOVEC_SET_STRING(iovec[n++], buffer);
 
@@ -759,11 +955,64 @@ void server_driver_message(Server *s, sd_id128_t message_id, const char *format,
                 IOVEC_SET_STRING(iovec[n++], mid);
         }
 
+        for (i = 0; i < n_fields; i++)
+                iovec[n++] = fields[i];
+
         ucred.pid = getpid();
         ucred.uid = getuid();
         ucred.gid = getgid();
 
-        dispatch_message_real(s, iovec, n, ELEMENTSOF(iovec), &ucred, NULL, NULL, 0, NULL);
+        dispatch_message_real(s, iovec, n, ELEMENTSOF(iovec), &ucred, NULL, NULL, 0, NULL, NULL, LOG_INFO);
+}
+
+void server_driver_message(Server *s, sd_id128_t message_id, const char *format, ...) {
+        va_list ap;
+
+        va_start(ap, format);
+        driver_message_internal(s, message_id, NULL, 0, format, ap);
+        va_end(ap);
+}
+
+static void driver_message_fields(Server *s, sd_id128_t message_id, const struct iovec *fields, unsigned n_fields, const char *format, ...) {
+        va_list ap;
+
+        va_start(ap, format);
+        driver_message_internal(s, message_id, fields, n_fields, format, ap);
+        va_end(ap);
+}
+
+static void rate_limit_message(Server *s, const char *group, unsigned suppressed, uint64_t dropped) {
+        _cleanup_free_ char *f_group = NULL;
+        char f_suppressed[sizeof("N_SUPPRESSED=") + DECIMAL_STR_MAX(unsigned)];
+        char f_dropped[sizeof("N_DROPPED_TOTAL=") + DECIMAL_STR_MAX(uint64_t)];
+        struct iovec fields[3];
+        unsigned n = 0;
+
+        assert(s);
+        assert(group);
+
+        /* Carry the drop counters of the rate limit group as fields
+         * too, so that they can be matched on */
+
+        f_group = strappend("RATE_LIMIT_GROUP=", group);
+        if (f_group)
+                IOVEC_SET_STRING(fields[n++], f_group);
+
+        snprintf(f_suppressed, sizeof(f_suppressed), "N_SUPPRESSED=%u", suppressed);
+        IOVEC_SET_STRING(fields[n++], f_suppressed);
+
+        snprintf(f_dropped, sizeof(f_dropped), "N_DROPPED_TOTAL=%llu", (unsigned long long) dropped);
+        IOVEC_SET_STRING(fields[n++], f_dropped);
+
+        driver_message_fields(s, SD_MESSAGE_JOURNAL_DROPPED, fields, n,
+                              "Suppressed %u messages from %s", suppressed, group);
+}
+
+void server_maybe_warn_forward_missed(Server *s) {
+        assert(s);
+
+        forward_queue_maybe_warn(s->syslog_queue);
+        forward_queue_maybe_warn(s->console_queue);
 }
 
 void server_dispatch_message(
@@ -776,8 +1025,10 @@ void server_dispatch_message(
                 int priority) {
 
         int rl;
+        uint64_t dropped = 0;
         char _cleanup_free_ *path = NULL;
         char *c;
+        PidMetadata *md = NULL;
 
         assert(s);
         assert(iovec || n == 0);
@@ -791,7 +1042,11 @@ void server_dispatch_message(
         if (!ucred)
                 goto finish;
 
-        path = shortened_cgroup_path(ucred->pid);
+        md = pid_cache_get(s->pid_cache, ucred->pid);
+        if (!md || !md->cgroup)
+                goto finish;
+
+        path = strdup(md->cgroup);
         if (!path)
                 goto finish;
 
@@ -812,18 +1067,22 @@ void server_dispatch_message(
         }
 
         rl = journal_rate_limit_test(s->rate_limit, path,
-                                     priority & LOG_PRIMASK, available_space(s));
+                                     priority & LOG_PRIMASK, available_space(s), &dropped);
 
         if (rl == 0)
                 return;
 
         /* Write a suppression message if we suppressed something */
-        if (rl > 1)
-                server_driver_message(s, SD_MESSAGE_JOURNAL_DROPPED,
-                                      "Suppressed %u messages from %s", rl - 1, path);
+        if (rl > 1) {
+                rate_limit_message(s, path, rl - 1, dropped);
+
+                /* That went through the cache too, don't rely on our
+                 * entry still being around */
+                md = NULL;
+        }
 
 finish:
-        dispatch_message_real(s, iovec, n, m, ucred, tv, label, label_len, unit_id);
+        dispatch_message_real(s, iovec, n, m, ucred, tv, label, label_len, unit_id, md, priority);
 }
 
 
@@ -869,6 +1128,7 @@ static int system_journal_open(Server *s) {
                 if (r >= 0) {
                         char fb[FORMAT_BYTES_MAX];
 
+                        server_setup_file(s, s->system_journal);
                         server_fix_perms(s, s->system_journal, 0);
                         server_driver_message(s, SD_ID128_NULL, "Allowing system journal files to grow to %s.",
                                               format_bytes(fb, sizeof(fb), s->system_metrics.max_use));
@@ -923,6 +1183,7 @@ static int system_journal_open(Server *s) {
                 if (s->runtime_journal) {
                         char fb[FORMAT_BYTES_MAX];
 
+                        server_setup_file(s, s->runtime_journal);
                         server_fix_perms(s, s->runtime_journal, 0);
                         server_driver_message(s, SD_ID128_NULL, "Allowing runtime journal files to grow to %s.",
                                               format_bytes(fb, sizeof(fb), s->runtime_metrics.max_use));
@@ -932,7 +1193,7 @@ static int system_journal_open(Server *s) {
         return r;
 }
 
-int server_flush_to_var(Server *s) {
+static int flush_to_var_start_locked(Server *s) {
         int r;
         sd_id128_t machine;
         sd_journal *j = NULL;
@@ -946,6 +1207,10 @@ int server_flush_to_var(Server *s) {
         if (!s->runtime_journal)
                 return 0;
 
+        /* Already at it? */
+        if (s->flush_journal)
+                return 0;
+
         system_journal_open(s);
 
         if (!s->system_journal)
@@ -967,48 +1232,152 @@ int server_flush_to_var(Server *s) {
 
         sd_journal_set_data_threshold(j, 0);
 
-        SD_JOURNAL_FOREACH(j) {
-                Object *o = NULL;
+        /* Live messages keep going to the runtime journal until we
+         * caught up with it, hence we need to learn about runtime
+         * files rotated meanwhile */
+        r = sd_journal_get_fd(j);
+        if (r < 0) {
+                log_error("Failed to watch runtime journal: %s", strerror(-r));
+                sd_journal_close(j);
+                return r;
+        }
+
+        s->flush_journal = j;
+        s->flush_n_entries = 0;
+        s->flush_start_usec = now(CLOCK_MONOTONIC);
+
+        return 1;
+}
+
+static int flush_batch(Server *s, JournalFile *from, const uint64_t offsets[], unsigned n) {
+        unsigned k = 0;
+        int r;
+
+        assert(s);
+
+        if (n <= 0)
+                return 0;
+
+        r = journal_file_copy_entries(from, s->system_journal, offsets, n, NULL, &k);
+        s->flush_n_entries += k;
+        if (r >= 0)
+                return 0;
+
+        if (!shall_try_append_again(s->system_journal, r)) {
+                log_error("Can't write entry: %s", strerror(-r));
+                return r;
+        }
+
+        server_rotate(s);
+        server_vacuum(s);
+
+        if (!s->system_journal) {
+                log_notice("Didn't flush runtime journal since rotation of system journal wasn't successful.");
+                return -EIO;
+        }
+
+        log_debug("Retrying write.");
+        offsets += k;
+        n -= k;
+
+        r = journal_file_copy_entries(from, s->system_journal, offsets, n, NULL, &k);
+        s->flush_n_entries += k;
+        if (r < 0) {
+                log_error("Can't write entry: %s", strerror(-r));
+                return r;
+        }
+
+        return 0;
+}
+
+static int flush_to_var_step_locked(Server *s) {
+        uint64_t offsets[FLUSH_BATCH_MAX];
+        JournalFile *from = NULL;
+        unsigned n = 0, n_step = 0;
+        char ts[FORMAT_TIMESPAN_MAX];
+        usec_t deadline;
+        sd_journal *j;
+        int r;
+
+        assert(s);
+
+        j = s->flush_journal;
+        if (!j)
+                return 0;
+
+        if (!s->system_journal) {
+                r = -EIO;
+                goto finish;
+        }
+
+        s->flush_step_usec = now(CLOCK_MONOTONIC);
+        deadline = s->flush_step_usec + FLUSH_STEP_USEC;
+
+        for (;;) {
                 JournalFile *f;
 
-                f = j->current_file;
-                assert(f && f->current_offset > 0);
+                if (n >= FLUSH_BATCH_MAX) {
+                        r = flush_batch(s, from, offsets, n);
+                        if (r < 0)
+                                goto finish;
+
+                        n_step += n;
+                        n = 0;
 
-                r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+                        if (n_step >= FLUSH_STEP_ENTRIES_MAX ||
+                            now(CLOCK_MONOTONIC) >= deadline)
+                                return 1;
+                }
+
+                r = sd_journal_next(j);
                 if (r < 0) {
-                        log_error("Can't read entry: %s", strerror(-r));
+                        log_error("Failed to iterate runtime journal: %s", strerror(-r));
                         goto finish;
                 }
 
-                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset, NULL, NULL, NULL);
-                if (r >= 0)
-                        continue;
+                if (r == 0) {
+                        /* The files go away on changes, hence
+                         * copy what we have before looking */
+                        r = flush_batch(s, from, offsets, n);
+                        if (r < 0)
+                                goto finish;
 
-                if (!shall_try_append_again(s->system_journal, r)) {
-                        log_error("Can't write entry: %s", strerror(-r));
-                        goto finish;
-                }
+                        n = 0;
+                        from = NULL;
 
-                server_rotate(s);
-                server_vacuum(s);
+                        r = sd_journal_process(j);
+                        if (r < 0) {
+                                log_error("Failed to process runtime journal changes: %s", strerror(-r));
+                                goto finish;
+                        }
 
-                if (!s->system_journal) {
-                        log_notice("Didn't flush runtime journal since rotation of system journal wasn't successful.");
-                        r = -EIO;
-                        goto finish;
+                        if (r == SD_JOURNAL_INVALIDATE)
+                                continue;
+
+                        break;
                 }
 
-                log_debug("Retrying write.");
-                r = journal_file_copy_entry(f, s->system_journal, o, f->current_offset, NULL, NULL, NULL);
-                if (r < 0) {
-                        log_error("Can't write entry: %s", strerror(-r));
-                        goto finish;
+                f = j->current_file;
+                assert(f && f->current_offset > 0);
+
+                if (f != from) {
+                        r = flush_batch(s, from, offsets, n);
+                        if (r < 0)
+                                goto finish;
+
+                        n_step += n;
+                        n = 0;
+                        from = f;
                 }
+
+                offsets[n++] = f->current_offset;
         }
 
-finish:
-        journal_file_post_change(s->system_journal);
+        log_debug("Flushed %" PRIu64 " entries to /var in %s.",
+                  s->flush_n_entries,
+                  format_timespan(ts, sizeof(ts), now(CLOCK_MONOTONIC) - s->flush_start_usec, USEC_PER_MSEC));
 
+finish:
         journal_file_close(s->runtime_journal);
         s->runtime_journal = NULL;
 
@@ -1016,10 +1385,250 @@ finish:
                 rm_rf("/run/log/journal", false, true, false);
 
         sd_journal_close(j);
+        s->flush_journal = NULL;
+
+        return r;
+}
+
+int server_flush_to_var(Server *s) {
+        int r;
+
+        assert(s);
+
+        server_lock_journals(s);
+        r = flush_to_var_start_locked(s);
+        server_unlock_journals(s);
+
+        if (r <= 0)
+                return r;
+
+        return server_flush_to_var_step(s);
+}
+
+int server_flush_to_var_step(Server *s) {
+        int r;
+
+        assert(s);
+
+        server_lock_journals(s);
+        r = flush_to_var_step_locked(s);
+        server_unlock_journals(s);
+
+        /* Done with it, so let's put what we copied to disk */
+        if (r <= 0)
+                server_sync(s);
 
         return r;
 }
 
+bool server_flush_to_var_due(Server *s, usec_t n) {
+        assert(s);
+
+        return s->flush_journal &&
+                n >= s->flush_step_usec + FLUSH_STEP_INTERVAL_USEC;
+}
+
+typedef union DatagramControl {
+        struct cmsghdr cmsghdr;
+
+        /* We use NAME_MAX space for the SELinux label here. The
+         * kernel currently enforces no limit, but according to
+         * suggestions from the SELinux people this will change and
+         * it will probably be identical to NAME_MAX. For now we use
+         * that, but this should be updated one day when the final
+         * limit is known.*/
+        uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
+                    CMSG_SPACE(sizeof(struct timeval)) +
+                    CMSG_SPACE(sizeof(int)) + /* fd */
+                    CMSG_SPACE(NAME_MAX)]; /* selinux label */
+} DatagramControl;
+
+struct DatagramBatch {
+        struct mmsghdr msgs[DATAGRAM_BATCH_MAX];
+        struct iovec iovecs[DATAGRAM_BATCH_MAX];
+        DatagramControl controls[DATAGRAM_BATCH_MAX];
+        char *buffers[DATAGRAM_BATCH_MAX];
+};
+
+static void process_datagram(Server *s, int fd, char *buffer, size_t n, struct msghdr *msghdr) {
+        struct ucred *ucred = NULL;
+        struct timeval *tv = NULL;
+        struct cmsghdr *cmsg;
+        char *label = NULL;
+        size_t label_len = 0;
+        int *fds = NULL;
+        unsigned n_fds = 0;
+
+        assert(s);
+        assert(buffer);
+        assert(msghdr);
+
+        for (cmsg = CMSG_FIRSTHDR(msghdr); cmsg; cmsg = CMSG_NXTHDR(msghdr, cmsg)) {
+
+                if (cmsg->cmsg_level == SOL_SOCKET &&
+                    cmsg->cmsg_type == SCM_CREDENTIALS &&
+                    cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred)))
+                        ucred = (struct ucred*) CMSG_DATA(cmsg);
+                else if (cmsg->cmsg_level == SOL_SOCKET &&
+                         cmsg->cmsg_type == SCM_SECURITY) {
+                        label = (char*) CMSG_DATA(cmsg);
+                        label_len = cmsg->cmsg_len - CMSG_LEN(0);
+                } else if (cmsg->cmsg_level == SOL_SOCKET &&
+                           cmsg->cmsg_type == SO_TIMESTAMP &&
+                           cmsg->cmsg_len == CMSG_LEN(sizeof(struct timeval)))
+                        tv = (struct timeval*) CMSG_DATA(cmsg);
+                else if (cmsg->cmsg_level == SOL_SOCKET &&
+                         cmsg->cmsg_type == SCM_RIGHTS) {
+                        fds = (int*) CMSG_DATA(cmsg);
+                        n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                }
+        }
+
+        if (fd == s->syslog_fd) {
+                char *e;
+
+                if (n > 0 && n_fds == 0) {
+                        e = memchr(buffer, '\n', n);
+                        if (e)
+                                *e = 0;
+                        else
+                                buffer[n] = 0;
+
+                        server_process_syslog_message(s, strstrip(buffer), ucred, tv, label, label_len);
+                } else if (n_fds > 0)
+                        log_warning("Got file descriptors via syslog socket. Ignoring.");
+
+        } else {
+                if (n > 0 && n_fds == 0)
+                        server_process_native_message(s, buffer, n, ucred, tv, label, label_len);
+                else if (n == 0 && n_fds == 1)
+                        server_process_native_file(s, fds[0], ucred, tv, label, label_len);
+                else if (n_fds > 0)
+                        log_warning("Got too many file descriptors via native socket. Ignoring.");
+        }
+
+        close_many(fds, n_fds);
+}
+
+static int receive_datagram(Server *s, int fd, size_t size) {
+        struct msghdr msghdr;
+        struct iovec iovec;
+        DatagramControl control;
+        ssize_t n;
+
+        assert(s);
+
+        if (s->buffer_size < size) {
+                void *b;
+                size_t l;
+
+                l = MAX(LINE_MAX + size, s->buffer_size * 2);
+                b = realloc(s->buffer, l+1);
+
+                if (!b) {
+                        log_error("Couldn't increase buffer.");
+                        return -ENOMEM;
+                }
+
+                s->buffer_size = l;
+                s->buffer = b;
+        }
+
+        zero(iovec);
+        iovec.iov_base = s->buffer;
+        iovec.iov_len = s->buffer_size;
+
+        zero(control);
+        zero(msghdr);
+        msghdr.msg_iov = &iovec;
+        msghdr.msg_iovlen = 1;
+        msghdr.msg_control = &control;
+        msghdr.msg_controllen = sizeof(control);
+
+        n = recvmsg(fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+
+                if (errno == EINTR || errno == EAGAIN)
+                        return 0;
+
+                log_error("recvmsg() failed: %m");
+                return -errno;
+        }
+
+        process_datagram(s, fd, s->buffer, n, &msghdr);
+        return 1;
+}
+
+static int receive_datagram_batch(Server *s, int fd) {
+        DatagramBatch *b;
+        unsigned i;
+        int n;
+
+        assert(s);
+
+        if (!s->datagram_batch) {
+                s->datagram_batch = new0(DatagramBatch, 1);
+                if (!s->datagram_batch)
+                        return log_oom();
+        }
+
+        b = s->datagram_batch;
+
+        for (i = 0; i < DATAGRAM_BATCH_MAX; i++) {
+                struct msghdr *mh = &b->msgs[i].msg_hdr;
+
+                /* Allocated lazily, and never cleared, so that only
+                 * the pages actually used for data get touched */
+                if (!b->buffers[i]) {
+                        b->buffers[i] = malloc(DATAGRAM_SLOT_SIZE + 1);
+                        if (!b->buffers[i])
+                                return log_oom();
+                }
+
+                b->iovecs[i].iov_base = b->buffers[i];
+                b->iovecs[i].iov_len = DATAGRAM_SLOT_SIZE;
+
+                zero(*mh);
+                mh->msg_iov = &b->iovecs[i];
+                mh->msg_iovlen = 1;
+                mh->msg_control = &b->controls[i];
+                mh->msg_controllen = sizeof(b->controls[i]);
+                b->msgs[i].msg_len = 0;
+        }
+
+        n = recvmmsg(fd, b->msgs, DATAGRAM_BATCH_MAX, MSG_DONTWAIT|MSG_CMSG_CLOEXEC, NULL);
+        if (n < 0) {
+
+                if (errno == EINTR || errno == EAGAIN)
+                        return 0;
+
+                log_error("recvmmsg() failed: %m");
+                return -errno;
+        }
+
+        for (i = 0; i < (unsigned) n; i++) {
+                struct msghdr *mh = &b->msgs[i].msg_hdr;
+
+                if (mh->msg_flags & MSG_TRUNC) {
+                        struct cmsghdr *cmsg;
+
+                        log_warning("Received datagram larger than %u bytes, ignoring.", DATAGRAM_SLOT_SIZE);
+
+                        /* Don't leak any passed fds */
+                        for (cmsg = CMSG_FIRSTHDR(mh); cmsg; cmsg = CMSG_NXTHDR(mh, cmsg))
+                                if (cmsg->cmsg_level == SOL_SOCKET &&
+                                    cmsg->cmsg_type == SCM_RIGHTS)
+                                        close_many((int*) CMSG_DATA(cmsg), (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                        continue;
+                }
+
+                process_datagram(s, fd, b->buffers[i], b->msgs[i].msg_len, mh);
+        }
+
+        /* A full batch suggests there is more waiting */
+        return n >= DATAGRAM_BATCH_MAX;
+}
+
 int process_event(Server *s, struct epoll_event *ev) {
         assert(s);
         assert(ev);
@@ -1051,7 +1660,6 @@ int process_event(Server *s, struct epoll_event *ev) {
                                  sfsi.ssi_pid);
                         touch("/run/systemd/journal/flushed");
                         server_flush_to_var(s);
-                        server_sync(s);
                         return 1;
                 }
 
@@ -1109,124 +1717,31 @@ int process_event(Server *s, struct epoll_event *ev) {
                 }
 
                 for (;;) {
-                        struct msghdr msghdr;
-                        struct iovec iovec;
-                        struct ucred *ucred = NULL;
-                        struct timeval *tv = NULL;
-                        struct cmsghdr *cmsg;
-                        char *label = NULL;
-                        size_t label_len = 0;
-                        union {
-                                struct cmsghdr cmsghdr;
-
-                                /* We use NAME_MAX space for the
-                                 * SELinux label here. The kernel
-                                 * currently enforces no limit, but
-                                 * according to suggestions from the
-                                 * SELinux people this will change and
-                                 * it will probably be identical to
-                                 * NAME_MAX. For now we use that, but
-                                 * this should be updated one day when
-                                 * the final limit is known.*/
-                                uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
-                                            CMSG_SPACE(sizeof(struct timeval)) +
-                                            CMSG_SPACE(sizeof(int)) + /* fd */
-                                            CMSG_SPACE(NAME_MAX)]; /* selinux label */
-                        } control;
-                        ssize_t n;
-                        int v;
-                        int *fds = NULL;
-                        unsigned n_fds = 0;
+                        int v, k;
 
                         if (ioctl(ev->data.fd, SIOCINQ, &v) < 0) {
                                 log_error("SIOCINQ failed: %m");
                                 return -errno;
                         }
 
-                        if (s->buffer_size < (size_t) v) {
-                                void *b;
-                                size_t l;
-
-                                l = MAX(LINE_MAX + (size_t) v, s->buffer_size * 2);
-                                b = realloc(s->buffer, l+1);
-
-                                if (!b) {
-                                        log_error("Couldn't increase buffer.");
-                                        return -ENOMEM;
-                                }
-
-                                s->buffer_size = l;
-                                s->buffer = b;
-                        }
-
-                        zero(iovec);
-                        iovec.iov_base = s->buffer;
-                        iovec.iov_len = s->buffer_size;
-
-                        zero(control);
-                        zero(msghdr);
-                        msghdr.msg_iov = &iovec;
-                        msghdr.msg_iovlen = 1;
-                        msghdr.msg_control = &control;
-                        msghdr.msg_controllen = sizeof(control);
-
-                        n = recvmsg(ev->data.fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
-                        if (n < 0) {
-
-                                if (errno == EINTR || errno == EAGAIN)
-                                        return 1;
-
-                                log_error("recvmsg() failed: %m");
-                                return -errno;
-                        }
+                        /* Datagrams that might not fit into a batch
+                         * slot are read one by one */
+                        if ((size_t) v > DATAGRAM_SLOT_SIZE)
+                                k = receive_datagram(s, ev->data.fd, (size_t) v);
+                        else
+                                k = receive_datagram_batch(s, ev->data.fd);
+                        if (k <= 0)
+                                return k < 0 ? k : 1;
+                }
 
-                        for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+        } else if (ev->data.fd == forward_queue_get_fd(s->syslog_queue)) {
 
-                                if (cmsg->cmsg_level == SOL_SOCKET &&
-                                    cmsg->cmsg_type == SCM_CREDENTIALS &&
-                                    cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred)))
-                                        ucred = (struct ucred*) CMSG_DATA(cmsg);
-                                else if (cmsg->cmsg_level == SOL_SOCKET &&
-                                         cmsg->cmsg_type == SCM_SECURITY) {
-                                        label = (char*) CMSG_DATA(cmsg);
-                                        label_len = cmsg->cmsg_len - CMSG_LEN(0);
-                                } else if (cmsg->cmsg_level == SOL_SOCKET &&
-                                         cmsg->cmsg_type == SO_TIMESTAMP &&
-                                         cmsg->cmsg_len == CMSG_LEN(sizeof(struct timeval)))
-                                        tv = (struct timeval*) CMSG_DATA(cmsg);
-                                else if (cmsg->cmsg_level == SOL_SOCKET &&
-                                         cmsg->cmsg_type == SCM_RIGHTS) {
-                                        fds = (int*) CMSG_DATA(cmsg);
-                                        n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
-                                }
-                        }
+                forward_queue_process(s->syslog_queue, ev->events);
+                return 1;
 
-                        if (ev->data.fd == s->syslog_fd) {
-                                char *e;
-
-                                if (n > 0 && n_fds == 0) {
-                                        e = memchr(s->buffer, '\n', n);
-                                        if (e)
-                                                *e = 0;
-                                        else
-                                                s->buffer[n] = 0;
-
-                                        server_process_syslog_message(s, strstrip(s->buffer), ucred, tv, label, label_len);
-                                } else if (n_fds > 0)
-                                        log_warning("Got file descriptors via syslog socket. Ignoring.");
-
-                        } else {
-                                if (n > 0 && n_fds == 0)
-                                        server_process_native_message(s, s->buffer, n, ucred, tv, label, label_len);
-                                else if (n == 0 && n_fds == 1)
-                                        server_process_native_file(s, fds[0], ucred, tv, label, label_len);
-                                else if (n_fds > 0)
-                                        log_warning("Got too many file descriptors via native socket. Ignoring.");
-                        }
-
-                        close_many(fds, n_fds);
-                }
+        } else if (ev->data.fd == forward_queue_get_fd(s->console_queue)) {
 
+                forward_queue_process(s->console_queue, ev->events);
                 return 1;
 
         } else if (ev->data.fd == s->stdout_fd) {
@@ -1390,48 +1905,94 @@ static int server_open_sync_timer(Server *s) {
         return 0;
 }
 
-int server_schedule_sync(Server *s) {
+int server_schedule_sync(Server *s, int priority) {
+        struct itimerspec sync_timer_enable = {};
+        usec_t n, when;
         int r;
 
         assert(s);
 
-        if (s->sync_scheduled)
-                return 0;
+        n = now(CLOCK_MONOTONIC);
 
-        if (s->sync_interval_usec) {
-                struct itimerspec sync_timer_enable = {};
+        if (LOG_PRI(priority) <= LOG_CRIT) {
+                /* Critical messages are synced right away, unless
+                 * we synced only very recently. In that case the
+                 * sync is delayed a bit so that a storm of them
+                 * results in at most one sync per interval. */
+                if (s->sync_critical_interval_usec <= 0 ||
+                    s->last_sync_usec + s->sync_critical_interval_usec <= n) {
+                        server_sync(s);
+                        return 0;
+                }
 
-                timespec_store(&sync_timer_enable.it_value, s->sync_interval_usec);
+                when = s->last_sync_usec + s->sync_critical_interval_usec;
 
-                r = timerfd_settime(s->sync_timer_fd, 0, &sync_timer_enable, NULL);
-                if (r < 0)
-                        return -errno;
+        } else {
+                if (s->sync_scheduled)
+                        return 0;
+
+                if (s->sync_interval_usec <= 0) {
+                        s->sync_scheduled = true;
+                        return 0;
+                }
+
+                when = n + s->sync_interval_usec;
         }
 
+        /* Never postpone a sync that is already due earlier */
+        if (s->sync_scheduled && s->sync_deadline_usec > 0 && s->sync_deadline_usec <= when)
+                return 0;
+
+        timespec_store(&sync_timer_enable.it_value, when);
+
+        r = timerfd_settime(s->sync_timer_fd, TFD_TIMER_ABSTIME, &sync_timer_enable, NULL);
+        if (r < 0)
+                return -errno;
+
         s->sync_scheduled = true;
+        s->sync_deadline_usec = when;
 
         return 0;
 }
 
 int server_init(Server *s) {
+        pthread_mutexattr_t attr;
         int n, r, fd;
 
         assert(s);
 
         zero(*s);
+
+        /* Rotation and vacuuming happen from within the write path
+         * as well as from the main loop, hence allow recursion */
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&s->journal_lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
         s->sync_timer_fd = s->syslog_fd = s->native_fd = s->stdout_fd =
             s->signal_fd = s->epoll_fd = s->dev_kmsg_fd = -1;
-        s->compress = true;
+        s->compress = compression_default();
+        s->compress_threshold_bytes = DEFAULT_COMPRESS_THRESHOLD;
         s->seal = true;
 
         s->sync_interval_usec = DEFAULT_SYNC_INTERVAL_USEC;
+        s->sync_critical_interval_usec = DEFAULT_SYNC_CRITICAL_INTERVAL_USEC;
         s->sync_scheduled = false;
 
         s->rate_limit_interval = DEFAULT_RATE_LIMIT_INTERVAL;
         s->rate_limit_burst = DEFAULT_RATE_LIMIT_BURST;
+        s->rate_limit_groups_max = DEFAULT_RATE_LIMIT_GROUPS_MAX;
 
         s->forward_to_syslog = true;
 
+        s->write_behind = false;
+        s->write_queue_max = DEFAULT_WRITE_QUEUE_MAX;
+        s->write_overflow = WRITE_OVERFLOW_BLOCK;
+
+        s->line_max = DEFAULT_LINE_MAX;
+        s->stdout_streams_max = DEFAULT_STDOUT_STREAMS_MAX;
+
         s->max_level_store = LOG_DEBUG;
         s->max_level_syslog = LOG_DEBUG;
         s->max_level_kmsg = LOG_NOTICE;
@@ -1449,6 +2010,15 @@ int server_init(Server *s) {
                 s->rate_limit_interval = s->rate_limit_burst = 0;
         }
 
+        if (s->rate_limit_groups_max <= 0)
+                s->rate_limit_groups_max = DEFAULT_RATE_LIMIT_GROUPS_MAX;
+
+        if (s->line_max < LINE_MAX_MIN || s->line_max > LINE_MAX_MAX) {
+                log_debug("Clamping line length limit %zu to %u..%u",
+                          s->line_max, LINE_MAX_MIN, LINE_MAX_MAX);
+                s->line_max = CLAMP(s->line_max, (size_t) LINE_MAX_MIN, (size_t) LINE_MAX_MAX);
+        }
+
         mkdir_p("/run/systemd/journal", 0755);
 
         s->user_journals = hashmap_new(trivial_hash_func, trivial_compare_func);
@@ -1459,6 +2029,18 @@ int server_init(Server *s) {
         if (!s->mmap)
                 return log_oom();
 
+        s->pid_cache = pid_cache_new();
+        if (!s->pid_cache)
+                return log_oom();
+
+        r = forward_queue_new(s, "syslog", FORWARD_QUEUE_DATAGRAM, SD_MESSAGE_FORWARD_SYSLOG_MISSED, &s->syslog_queue);
+        if (r < 0)
+                return log_oom();
+
+        r = forward_queue_new(s, "console", FORWARD_QUEUE_STREAM, SD_ID128_NULL, &s->console_queue);
+        if (r < 0)
+                return log_oom();
+
         s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
         if (s->epoll_fd < 0) {
                 log_error("Failed to create epoll object: %m");
@@ -1539,17 +2121,54 @@ int server_init(Server *s) {
                 return -ENOMEM;
 
         s->rate_limit = journal_rate_limit_new(s->rate_limit_interval,
-                                               s->rate_limit_burst);
+                                               s->rate_limit_burst,
+                                               s->rate_limit_groups_max);
         if (!s->rate_limit)
                 return -ENOMEM;
 
+        journal_rate_limit_set_overrides(s->rate_limit, s->rate_limit_overrides);
+
         r = system_journal_open(s);
         if (r < 0)
                 return r;
 
+        if (s->write_behind) {
+                r = journal_writer_new(s, &s->writer);
+                if (r < 0) {
+                        log_error("Failed to start writer thread: %s", strerror(-r));
+                        return r;
+                }
+        }
+
         return 0;
 }
 
+void server_post_change(Server *s) {
+        JournalFile *f;
+        Iterator i;
+
+        assert(s);
+
+        /* We defer the inotify wakeup of readers until the event we
+         * are processing has been fully handled, so that draining a
+         * socket backlog results in only one notification per file
+         * instead of one per entry. */
+
+        server_lock_journals(s);
+
+        if (s->system_journal && s->system_journal->post_change_pending)
+                journal_file_post_change(s->system_journal);
+
+        if (s->runtime_journal && s->runtime_journal->post_change_pending)
+                journal_file_post_change(s->runtime_journal);
+
+        HASHMAP_FOREACH(f, s->user_journals, i)
+                if (f->post_change_pending)
+                        journal_file_post_change(f);
+
+        server_unlock_journals(s);
+}
+
 void server_maybe_append_tags(Server *s) {
 #ifdef HAVE_GCRYPT
         JournalFile *f;
@@ -1558,11 +2177,15 @@ void server_maybe_append_tags(Server *s) {
 
         n = now(CLOCK_REALTIME);
 
+        server_lock_journals(s);
+
         if (s->system_journal)
                 journal_file_maybe_append_tag(s->system_journal, n);
 
         HASHMAP_FOREACH(f, s->user_journals, i)
                 journal_file_maybe_append_tag(f, n);
+
+        server_unlock_journals(s);
 #endif
 }
 
@@ -1570,6 +2193,11 @@ void server_done(Server *s) {
         JournalFile *f;
         assert(s);
 
+        /* Write out whatever is still queued, before we close the
+         * files */
+        journal_writer_free(s->writer);
+        s->writer = NULL;
+
         while (s->stdout_streams)
                 stdout_stream_free(s->stdout_streams);
 
@@ -1579,11 +2207,17 @@ void server_done(Server *s) {
         if (s->runtime_journal)
                 journal_file_close(s->runtime_journal);
 
+        if (s->flush_journal)
+                sd_journal_close(s->flush_journal);
+
         while ((f = hashmap_steal_first(s->user_journals)))
                 journal_file_close(f);
 
         hashmap_free(s->user_journals);
 
+        journal_vacuum_cache_free(s->system_vacuum_cache);
+        journal_vacuum_cache_free(s->runtime_vacuum_cache);
+
         if (s->epoll_fd >= 0)
                 close_nointr_nofail(s->epoll_fd);
 
@@ -1608,15 +2242,40 @@ void server_done(Server *s) {
         if (s->rate_limit)
                 journal_rate_limit_free(s->rate_limit);
 
+        if (s->rate_limit_overrides) {
+                char *k;
+
+                while ((k = hashmap_steal_first_key(s->rate_limit_overrides)))
+                        free(k);
+                hashmap_free(s->rate_limit_overrides);
+        }
+
         if (s->kernel_seqnum)
                 munmap(s->kernel_seqnum, sizeof(uint64_t));
 
         free(s->buffer);
+
+        if (s->datagram_batch) {
+                unsigned i;
+
+                for (i = 0; i < DATAGRAM_BATCH_MAX; i++)
+                        free(s->datagram_batch->buffers[i]);
+                free(s->datagram_batch);
+        }
         free(s->tty_path);
 
         if (s->mmap)
                 mmap_cache_unref(s->mmap);
 
+        pid_cache_free(s->pid_cache);
+
+        forward_queue_free(s->syslog_queue);
+        forward_queue_free(s->console_queue);
+
+        kernel_device_cache_free(s->kernel_device_cache);
+
         if (s->udev)
                 udev_unref(s->udev);
+
+        pthread_mutex_destroy(&s->journal_lock);
 }
@@ -26,8 +26,13 @@
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <pthread.h>
+
+#include <systemd/sd-journal.h>
 
 #include "journal-file.h"
+#include "journal-vacuum.h"
+#include "journald-pid-cache.h"
 #include "hashmap.h"
 #include "util.h"
 #include "audit.h"
@@ -51,7 +56,17 @@ typedef enum SplitMode {
         _SPLIT_INVALID = -1
 } SplitMode;
 
+typedef enum WriteOverflow {
+        WRITE_OVERFLOW_BLOCK,
+        WRITE_OVERFLOW_DROP,
+        _WRITE_OVERFLOW_MAX,
+        _WRITE_OVERFLOW_INVALID = -1
+} WriteOverflow;
+
 typedef struct StdoutStream StdoutStream;
+typedef struct JournalWriter JournalWriter;
+typedef struct DatagramBatch DatagramBatch;
+typedef struct ForwardQueue ForwardQueue;
 
 typedef struct Server {
         int epoll_fd;
@@ -65,28 +80,40 @@ typedef struct Server {
         JournalFile *system_journal;
         Hashmap *user_journals;
 
+        /* Reader on the runtime journal while it is flushed to /var */
+        sd_journal *flush_journal;
+        uint64_t flush_n_entries;
+        usec_t flush_start_usec;
+        usec_t flush_step_usec;
+
         uint64_t seqnum;
 
         char *buffer;
         size_t buffer_size;
 
+        DatagramBatch *datagram_batch;
+
         JournalRateLimit *rate_limit;
         usec_t sync_interval_usec;
+        usec_t sync_critical_interval_usec;
         usec_t rate_limit_interval;
         unsigned rate_limit_burst;
+        unsigned rate_limit_groups_max;
+        Hashmap *rate_limit_overrides;
 
         JournalMetrics runtime_metrics;
         JournalMetrics system_metrics;
 
-        bool compress;
+        int compress;
+        uint64_t compress_threshold_bytes;
         bool seal;
 
         bool forward_to_kmsg;
         bool forward_to_syslog;
         bool forward_to_console;
 
-        unsigned n_forward_syslog_missed;
-        usec_t last_warn_forward_syslog_missed;
+        ForwardQueue *syslog_queue;
+        ForwardQueue *console_queue;
 
         uint64_t cached_available_space;
         usec_t cached_available_space_timestamp;
@@ -97,11 +124,16 @@ typedef struct Server {
         usec_t max_file_usec;
         usec_t oldest_file_usec;
 
+        JournalVacuumCache *system_vacuum_cache;
+        JournalVacuumCache *runtime_vacuum_cache;
+
         gid_t file_gid;
         bool file_gid_valid;
 
         LIST_HEAD(StdoutStream, stdout_streams);
         unsigned n_stdout_streams;
+        unsigned stdout_streams_max;
+        size_t line_max;
 
         char *tty_path;
 
@@ -115,14 +147,28 @@ typedef struct Server {
 
         MMapCache *mmap;
 
+        PidCache *pid_cache;
+
         bool dev_kmsg_readable;
 
         uint64_t *kernel_seqnum;
 
         struct udev *udev;
+        Hashmap *kernel_device_cache;
 
         int sync_timer_fd;
         bool sync_scheduled;
+        usec_t sync_deadline_usec;
+        usec_t last_sync_usec;
+
+        /* Protects the journal files and everything that goes with
+         * them, if a separate writer thread is used */
+        pthread_mutex_t journal_lock;
+
+        bool write_behind;
+        unsigned write_queue_max;
+        WriteOverflow write_overflow;
+        JournalWriter *writer;
 } Server;
 
 #define N_IOVEC_META_FIELDS 17
@@ -131,6 +177,7 @@ typedef struct Server {
 
 void server_dispatch_message(Server *s, struct iovec *iovec, unsigned n, unsigned m, struct ucred *ucred, struct timeval *tv, const char *label, size_t label_len, const char *unit_id, int priority);
 void server_driver_message(Server *s, sd_id128_t message_id, const char *format, ...);
+void server_maybe_warn_forward_missed(Server *s);
 
 /* gperf lookup function */
 const struct ConfigPerfItem* journald_gperf_lookup(const char *key, unsigned length);
@@ -140,19 +187,36 @@ int config_parse_storage(const char *unit, const char *filename, unsigned line,
 const char *storage_to_string(Storage s);
 Storage storage_from_string(const char *s);
 
+int config_parse_compress(const char *unit, const char *filename, unsigned line, const char *section, const char *lvalue, int ltype, const char *rvalue, void *data, void *userdata);
+
 int config_parse_split_mode(const char *unit, const char *filename, unsigned line, const char *section, const char *lvalue, int ltype, const char *rvalue, void *data, void *userdata);
 
 const char *split_mode_to_string(SplitMode s);
 SplitMode split_mode_from_string(const char *s);
 
+int config_parse_rate_limit_override(const char *unit, const char *filename, unsigned line, const char *section, const char *lvalue, int ltype, const char *rvalue, void *data, void *userdata);
+
+int config_parse_write_overflow(const char *unit, const char *filename, unsigned line, const char *section, const char *lvalue, int ltype, const char *rvalue, void *data, void *userdata);
+
+const char *write_overflow_to_string(WriteOverflow o);
+WriteOverflow write_overflow_from_string(const char *s);
+
+void server_lock_journals(Server *s);
+void server_unlock_journals(Server *s);
+void server_write_to_journal(Server *s, uid_t uid, const dual_timestamp *ts, struct iovec *iovec, unsigned n, int priority);
+
 void server_fix_perms(Server *s, JournalFile *f, uid_t uid);
 bool shall_try_append_again(JournalFile *f, int r);
 int server_init(Server *s);
 void server_done(Server *s);
 void server_sync(Server *s);
+void server_notify_status(Server *s);
 void server_vacuum(Server *s);
 void server_rotate(Server *s);
-int server_schedule_sync(Server *s);
+int server_schedule_sync(Server *s, int priority);
 int server_flush_to_var(Server *s);
+int server_flush_to_var_step(Server *s);
+bool server_flush_to_var_due(Server *s, usec_t n);
 int process_event(Server *s, struct epoll_event *ev);
+void server_post_change(Server *s);
 void server_maybe_append_tags(Server *s);
@@ -35,8 +35,6 @@
 #include "journald-kmsg.h"
 #include "journald-console.h"
 
-#define STDOUT_STREAMS_MAX 4096
-
 typedef enum StdoutStreamState {
         STDOUT_STREAM_IDENTIFIER,
         STDOUT_STREAM_UNIT_ID,
@@ -67,19 +65,63 @@ struct StdoutStream {
         bool forward_to_kmsg:1;
         bool forward_to_console:1;
 
-        char buffer[LINE_MAX+1];
+        /* The fields which are the same for every line, put together
+         * once the header has been read. The priority ones are only
+         * used for lines without a level prefix changing them. */
+        char *syslog_identifier;
+        char syslog_priority[sizeof("PRIORITY=") + DECIMAL_STR_MAX(int)];
+        char syslog_facility[sizeof("SYSLOG_FACILITY=") + DECIMAL_STR_MAX(int)];
+        size_t label_len;
+
+        /* The unprocessed data is length bytes at offset. Of
+         * these, the first scanned bytes are known to contain no
+         * newline. The buffer is allocated + 1 bytes large, so that
+         * there's always room for a trailing NUL byte. */
+        char *buffer;
+        size_t allocated;
+        size_t offset;
         size_t length;
+        size_t scanned;
 
         LIST_FIELDS(StdoutStream, stdout_stream);
 };
 
+static void format_priority_fields(int priority, char *syslog_priority, char *syslog_facility) {
+        sprintf(syslog_priority, "PRIORITY=%i", priority & LOG_PRIMASK);
+
+        if (priority & LOG_FACMASK)
+                sprintf(syslog_facility, "SYSLOG_FACILITY=%i", LOG_FAC(priority));
+        else
+                syslog_facility[0] = 0;
+}
+
+static int stdout_stream_setup_fields(StdoutStream *s) {
+        assert(s);
+
+        if (s->identifier) {
+                s->syslog_identifier = strappend("SYSLOG_IDENTIFIER=", s->identifier);
+                if (!s->syslog_identifier)
+                        return log_oom();
+        }
+
+        format_priority_fields(s->priority, s->syslog_priority, s->syslog_facility);
+
+#ifdef HAVE_SELINUX
+        if (s->security_context)
+                s->label_len = strlen((char*) s->security_context);
+#endif
+
+        return 0;
+}
+
 static int stdout_stream_log(StdoutStream *s, const char *p) {
         struct iovec iovec[N_IOVEC_META_FIELDS + 5];
-        char *message = NULL, *syslog_priority = NULL, *syslog_facility = NULL, *syslog_identifier = NULL;
+        char _cleanup_free_ *message = NULL;
+        char buf_priority[sizeof(s->syslog_priority)], buf_facility[sizeof(s->syslog_facility)];
+        const char *syslog_priority, *syslog_facility;
         unsigned n = 0;
         int priority;
         char *label = NULL;
-        size_t label_len = 0;
 
         assert(s);
         assert(p);
@@ -101,38 +143,34 @@ static int stdout_stream_log(StdoutStream *s, const char *p) {
         if (s->forward_to_console || s->server->forward_to_console)
                 server_forward_console(s->server, priority, s->identifier, p, &s->ucred);
 
+        if (priority == s->priority) {
+                syslog_priority = s->syslog_priority;
+                syslog_facility = s->syslog_facility;
+        } else {
+                format_priority_fields(priority, buf_priority, buf_facility);
+                syslog_priority = buf_priority;
+                syslog_facility = buf_facility;
+        }
+
         IOVEC_SET_STRING(iovec[n++], "_TRANSPORT=stdout");
+        IOVEC_SET_STRING(iovec[n++], syslog_priority);
 
-        if (asprintf(&syslog_priority, "PRIORITY=%i", priority & LOG_PRIMASK) >= 0)
-                IOVEC_SET_STRING(iovec[n++], syslog_priority);
+        if (syslog_facility[0])
+                IOVEC_SET_STRING(iovec[n++], syslog_facility);
 
-        if (priority & LOG_FACMASK)
-                if (asprintf(&syslog_facility, "SYSLOG_FACILITY=%i", LOG_FAC(priority)) >= 0)
-                        IOVEC_SET_STRING(iovec[n++], syslog_facility);
-
-        if (s->identifier) {
-                syslog_identifier = strappend("SYSLOG_IDENTIFIER=", s->identifier);
-                if (syslog_identifier)
-                        IOVEC_SET_STRING(iovec[n++], syslog_identifier);
-        }
+        if (s->syslog_identifier)
+                IOVEC_SET_STRING(iovec[n++], s->syslog_identifier);
 
         message = strappend("MESSAGE=", p);
         if (message)
                 IOVEC_SET_STRING(iovec[n++], message);
 
 #ifdef HAVE_SELINUX
-        if (s->security_context) {
+        if (s->security_context)
                 label = (char*) s->security_context;
-                label_len = strlen((char*) s->security_context);
-        }
 #endif
 
-        server_dispatch_message(s->server, iovec, n, ELEMENTSOF(iovec), &s->ucred, NULL, label, label_len, s->unit_id, priority);
-
-        free(message);
-        free(syslog_priority);
-        free(syslog_facility);
-        free(syslog_identifier);
+        server_dispatch_message(s->server, iovec, n, ELEMENTSOF(iovec), &s->ucred, NULL, label, s->label_len, s->unit_id, priority);
 
         return 0;
 }
@@ -225,7 +263,7 @@ static int stdout_stream_line(StdoutStream *s, char *p) {
 
                 s->forward_to_console = !!r;
                 s->state = STDOUT_STREAM_RUNNING;
-                return 0;
+                return stdout_stream_setup_fields(s);
 
         case STDOUT_STREAM_RUNNING:
                 return stdout_stream_log(s, p);
@@ -241,22 +279,25 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
 
         assert(s);
 
-        p = s->buffer;
+        p = s->buffer + s->offset;
         remaining = s->length;
         for (;;) {
                 char *end;
                 size_t skip;
 
-                end = memchr(p, '\n', remaining);
+                end = memchr(p + s->scanned, '\n', remaining - s->scanned);
                 if (end)
                         skip = end - p + 1;
-                else if (remaining >= sizeof(s->buffer) - 1) {
-                        end = p + sizeof(s->buffer) - 1;
+                else if (remaining >= s->server->line_max) {
+                        end = p + remaining;
                         skip = remaining;
-                } else
+                } else {
+                        s->scanned = remaining;
                         break;
+                }
 
                 *end = 0;
+                s->scanned = 0;
 
                 r = stdout_stream_line(s, p);
                 if (r < 0)
@@ -276,11 +317,44 @@ static int stdout_stream_scan(StdoutStream *s, bool force_flush) {
                 remaining = 0;
         }
 
-        if (p > s->buffer) {
-                memmove(s->buffer, p, remaining);
-                s->length = remaining;
+        /* Don't move the left-over data to the front here, that's
+         * done only once the end of the buffer is reached */
+        s->offset = remaining > 0 ? (size_t) (p - s->buffer) : 0;
+        s->length = remaining;
+        if (remaining == 0)
+                s->scanned = 0;
+
+        return 0;
+}
+
+static int stdout_stream_make_room(StdoutStream *s) {
+        size_t a;
+        char *b;
+
+        assert(s);
+
+        if (s->offset + s->length < s->allocated)
+                return 0;
+
+        if (s->offset > 0) {
+                memmove(s->buffer, s->buffer + s->offset, s->length);
+                s->offset = 0;
+                return 0;
         }
 
+        /* The line doesn't fit yet, so grow the buffer, doubling it
+         * each time, up to the configured maximum line length */
+        a = MAX(s->allocated * 2, (size_t) LINE_MAX);
+        a = MIN(a, s->server->line_max);
+        assert(a > s->allocated);
+
+        b = realloc(s->buffer, a + 1);
+        if (!b)
+                return log_oom();
+
+        s->buffer = b;
+        s->allocated = a;
+
         return 0;
 }
 
@@ -290,7 +364,11 @@ int stdout_stream_process(StdoutStream *s) {
 
         assert(s);
 
-        l = read(s->fd, s->buffer+s->length, sizeof(s->buffer)-1-s->length);
+        r = stdout_stream_make_room(s);
+        if (r < 0)
+                return r;
+
+        l = read(s->fd, s->buffer + s->offset + s->length, s->allocated - s->offset - s->length);
         if (l < 0) {
 
                 if (errno == EAGAIN)
@@ -339,6 +417,9 @@ void stdout_stream_free(StdoutStream *s) {
 #endif
 
         free(s->identifier);
+        free(s->unit_id);
+        free(s->syslog_identifier);
+        free(s->buffer);
         free(s);
 }
 
@@ -359,7 +440,7 @@ int stdout_stream_new(Server *s) {
                 return -errno;
         }
 
-        if (s->n_stdout_streams >= STDOUT_STREAMS_MAX) {
+        if (s->n_stdout_streams >= s->stdout_streams_max) {
                 log_warning("Too many stdout streams, refusing connection.");
                 close_nointr_nofail(fd);
                 return 0;
@@ -29,82 +29,59 @@
 #include "journald-syslog.h"
 #include "journald-kmsg.h"
 #include "journald-console.h"
+#include "journald-forward.h"
 
-/* Warn once every 30s if we missed syslog message */
-#define WARN_FORWARD_SYSLOG_MISSED_USEC (30 * USEC_PER_SEC)
-
-static void forward_syslog_iovec(Server *s, const struct iovec *iovec, unsigned n_iovec, struct ucred *ucred, struct timeval *tv) {
-
+static int forward_syslog_connect(Server *s) {
         union sockaddr_union sa = {
                 .un.sun_family = AF_UNIX,
                 .un.sun_path = "/run/systemd/journal/syslog",
         };
-        struct msghdr msghdr = {
-                .msg_iov = (struct iovec *) iovec,
-                .msg_iovlen = n_iovec,
-                .msg_name = &sa,
-                .msg_namelen = offsetof(union sockaddr_union, un.sun_path)
-                               + sizeof("/run/systemd/journal/syslog") - 1,
-        };
-        struct cmsghdr *cmsg;
-        union {
-                struct cmsghdr cmsghdr;
-                uint8_t buf[CMSG_SPACE(sizeof(struct ucred))];
-        } control;
+        int fd;
 
         assert(s);
-        assert(iovec);
-        assert(n_iovec > 0);
 
-        if (ucred) {
-                zero(control);
-                msghdr.msg_control = &control;
-                msghdr.msg_controllen = sizeof(control);
-
-                cmsg = CMSG_FIRSTHDR(&msghdr);
-                cmsg->cmsg_level = SOL_SOCKET;
-                cmsg->cmsg_type = SCM_CREDENTIALS;
-                cmsg->cmsg_len = CMSG_LEN(sizeof(struct ucred));
-                memcpy(CMSG_DATA(cmsg), ucred, sizeof(struct ucred));
-                msghdr.msg_controllen = cmsg->cmsg_len;
-        }
-
-        /* Forward the syslog message we received via /dev/log to
-         * /run/systemd/syslog. Unfortunately we currently can't set
-         * the SO_TIMESTAMP auxiliary data, and hence we don't. */
+        if (forward_queue_get_fd(s->syslog_queue) >= 0)
+                return 0;
 
-        if (sendmsg(s->syslog_fd, &msghdr, MSG_NOSIGNAL) >= 0)
-                return;
+        /* We use a connected socket of our own for forwarding, so
+         * that epoll can tell us when there's room again on the
+         * other side */
+        fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+        if (fd < 0)
+                return -errno;
 
-        /* The socket is full? I guess the syslog implementation is
-         * too slow, and we shouldn't wait for that... */
-        if (errno == EAGAIN) {
-                s->n_forward_syslog_missed++;
-                return;
+        if (connect(fd, &sa.sa, offsetof(union sockaddr_union, un.sun_path)
+                    + sizeof("/run/systemd/journal/syslog") - 1) < 0) {
+                close_nointr_nofail(fd);
+                return -errno;
         }
 
-        if (ucred && errno == ESRCH) {
-                struct ucred u;
+        forward_queue_set_fd(s->syslog_queue, fd);
+        return 0;
+}
 
-                /* Hmm, presumably the sender process vanished
-                 * by now, so let's fix it as good as we
-                 * can, and retry */
+static void forward_syslog_iovec(Server *s, const struct iovec *iovec, unsigned n_iovec, struct ucred *ucred, struct timeval *tv) {
+        int r;
 
-                u = *ucred;
-                u.pid = getpid();
-                memcpy(CMSG_DATA(cmsg), &u, sizeof(struct ucred));
+        assert(s);
+        assert(iovec);
+        assert(n_iovec > 0);
 
-                if (sendmsg(s->syslog_fd, &msghdr, MSG_NOSIGNAL) >= 0)
-                        return;
+        /* Forward the syslog message we received via /dev/log to
+         * /run/systemd/syslog. Unfortunately we currently can't set
+         * the SO_TIMESTAMP auxiliary data, and hence we don't. */
 
-                if (errno == EAGAIN) {
-                        s->n_forward_syslog_missed++;
-                        return;
-                }
+        r = forward_syslog_connect(s);
+        if (r < 0) {
+                if (r != -ENOENT && r != -ECONNREFUSED)
+                        log_debug("Failed to connect to syslog socket: %s", strerror(-r));
+                return;
         }
 
-        if (errno != ENOENT)
-                log_debug("Failed to forward syslog message: %m");
+        /* If the syslog implementation is too slow the message is
+         * queued, and it is sent once there is room again. We
+         * shouldn't wait for that... */
+        forward_queue_push(s->syslog_queue, iovec, n_iovec, ucred);
 }
 
 static void forward_syslog_raw(Server *s, int priority, const char *buffer, struct ucred *ucred, struct timeval *tv) {
@@ -476,20 +453,3 @@ int server_open_syslog_socket(Server *s) {
 
         return 0;
 }
-
-void server_maybe_warn_forward_syslog_missed(Server *s) {
-        usec_t n;
-        assert(s);
-
-        if (s->n_forward_syslog_missed <= 0)
-                return;
-
-        n = now(CLOCK_MONOTONIC);
-        if (s->last_warn_forward_syslog_missed + WARN_FORWARD_SYSLOG_MISSED_USEC > n)
-                return;
-
-        server_driver_message(s, SD_MESSAGE_FORWARD_SYSLOG_MISSED, "Forwarding to syslog missed %u messages.", s->n_forward_syslog_missed);
-
-        s->n_forward_syslog_missed = 0;
-        s->last_warn_forward_syslog_missed = n;
-}
@@ -0,0 +1,256 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "list.h"
+#include "journald-server.h"
+#include "journald-writer.h"
+
+typedef struct WriterEntry WriterEntry;
+
+struct WriterEntry {
+        LIST_FIELDS(WriterEntry, entries);
+
+        uid_t uid;
+        dual_timestamp ts;
+        int priority;
+
+        unsigned n_iovec;
+        struct iovec iovec[];
+};
+
+struct JournalWriter {
+        Server *server;
+
+        pthread_t thread;
+        bool thread_started;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t not_empty;
+        pthread_cond_t not_full;
+
+        LIST_HEAD(WriterEntry, entries);
+        WriterEntry *entries_tail;
+        unsigned n_entries;
+
+        unsigned n_dropped;
+        bool stop;
+};
+
+static WriterEntry *writer_entry_new(uid_t uid, const dual_timestamp *ts, const struct iovec *iovec, unsigned n, int priority) {
+        WriterEntry *e;
+        size_t sz = 0;
+        uint8_t *p;
+        unsigned i;
+
+        /* The iovecs point to buffers that belong to the caller and
+         * are only valid until it returns, hence copy everything into
+         * a single allocation. */
+
+        for (i = 0; i < n; i++)
+                sz += iovec[i].iov_len;
+
+        e = malloc(offsetof(WriterEntry, iovec) + sizeof(struct iovec) * n + sz);
+        if (!e)
+                return NULL;
+
+        LIST_INIT(WriterEntry, entries, e);
+        e->uid = uid;
+        e->ts = *ts;
+        e->priority = priority;
+        e->n_iovec = n;
+
+        p = (uint8_t*) (e->iovec + n);
+        for (i = 0; i < n; i++) {
+                memcpy(p, iovec[i].iov_base, iovec[i].iov_len);
+                e->iovec[i].iov_base = p;
+                e->iovec[i].iov_len = iovec[i].iov_len;
+                p += iovec[i].iov_len;
+        }
+
+        return e;
+}
+
+static WriterEntry *writer_pop(JournalWriter *w) {
+        WriterEntry *e;
+
+        e = w->entries;
+        if (!e)
+                return NULL;
+
+        LIST_REMOVE(WriterEntry, entries, w->entries, e);
+        if (w->entries_tail == e)
+                w->entries_tail = NULL;
+
+        w->n_entries--;
+        pthread_cond_signal(&w->not_full);
+
+        return e;
+}
+
+static void *writer_thread(void *userdata) {
+        JournalWriter *w = userdata;
+
+        pthread_mutex_lock(&w->mutex);
+
+        for (;;) {
+                WriterEntry *e;
+                bool caught_up;
+
+                e = writer_pop(w);
+                if (!e) {
+                        if (w->stop)
+                                break;
+
+                        pthread_cond_wait(&w->not_empty, &w->mutex);
+                        continue;
+                }
+
+                pthread_mutex_unlock(&w->mutex);
+
+                server_lock_journals(w->server);
+                server_write_to_journal(w->server, e->uid, &e->ts, e->iovec, e->n_iovec, e->priority);
+                free(e);
+
+                pthread_mutex_lock(&w->mutex);
+                caught_up = !w->entries;
+                pthread_mutex_unlock(&w->mutex);
+
+                /* Wake up readers once we caught up with the queue,
+                 * not after every single entry */
+                if (caught_up)
+                        server_post_change(w->server);
+
+                server_unlock_journals(w->server);
+
+                pthread_mutex_lock(&w->mutex);
+        }
+
+        pthread_mutex_unlock(&w->mutex);
+
+        return NULL;
+}
+
+int journal_writer_new(Server *s, JournalWriter **ret) {
+        JournalWriter *w;
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        w = new0(JournalWriter, 1);
+        if (!w)
+                return -ENOMEM;
+
+        w->server = s;
+        pthread_mutex_init(&w->mutex, NULL);
+        pthread_cond_init(&w->not_empty, NULL);
+        pthread_cond_init(&w->not_full, NULL);
+
+        r = pthread_create(&w->thread, NULL, writer_thread, w);
+        if (r != 0) {
+                journal_writer_free(w);
+                return -r;
+        }
+
+        w->thread_started = true;
+
+        *ret = w;
+        return 0;
+}
+
+void journal_writer_free(JournalWriter *w) {
+        WriterEntry *e;
+
+        if (!w)
+                return;
+
+        if (w->thread_started) {
+                /* The thread flushes everything still queued before
+                 * it exits */
+                pthread_mutex_lock(&w->mutex);
+                w->stop = true;
+                pthread_cond_signal(&w->not_empty);
+                pthread_mutex_unlock(&w->mutex);
+
+                pthread_join(w->thread, NULL);
+        }
+
+        while ((e = writer_pop(w)))
+                free(e);
+
+        pthread_cond_destroy(&w->not_full);
+        pthread_cond_destroy(&w->not_empty);
+        pthread_mutex_destroy(&w->mutex);
+
+        free(w);
+}
+
+int journal_writer_enqueue(JournalWriter *w, uid_t uid, const dual_timestamp *ts, const struct iovec *iovec, unsigned n, int priority) {
+        WriterEntry *e;
+
+        assert(w);
+        assert(ts);
+        assert(iovec);
+        assert(n > 0);
+
+        e = writer_entry_new(uid, ts, iovec, n, priority);
+        if (!e)
+                return -ENOMEM;
+
+        pthread_mutex_lock(&w->mutex);
+
+        while (w->server->write_queue_max > 0 &&
+               w->n_entries >= w->server->write_queue_max) {
+
+                if (w->server->write_overflow == WRITE_OVERFLOW_DROP) {
+                        w->n_dropped++;
+                        pthread_mutex_unlock(&w->mutex);
+                        free(e);
+                        return -ENOBUFS;
+                }
+
+                pthread_cond_wait(&w->not_full, &w->mutex);
+        }
+
+        LIST_INSERT_AFTER(WriterEntry, entries, w->entries, w->entries_tail, e);
+        w->entries_tail = e;
+        w->n_entries++;
+
+        pthread_cond_signal(&w->not_empty);
+        pthread_mutex_unlock(&w->mutex);
+
+        return 0;
+}
+
+unsigned journal_writer_reset_dropped(JournalWriter *w) {
+        unsigned n;
+
+        assert(w);
+
+        pthread_mutex_lock(&w->mutex);
+        n = w->n_dropped;
+        w->n_dropped = 0;
+        pthread_mutex_unlock(&w->mutex);
+
+        return n;
+}
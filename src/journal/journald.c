@@ -76,6 +76,8 @@ int main(int argc, char *argv[]) {
 
                 n = now(CLOCK_REALTIME);
 
+                server_lock_journals(&server);
+
                 if (server.max_retention_usec > 0 && server.oldest_file_usec > 0) {
 
                         /* The retention time is reached, so let's vacuum! */
@@ -83,6 +85,7 @@ int main(int argc, char *argv[]) {
                                 log_info("Retention time reached.");
                                 server_rotate(&server);
                                 server_vacuum(&server);
+                                server_unlock_journals(&server);
                                 continue;
                         }
 
@@ -103,6 +106,17 @@ int main(int argc, char *argv[]) {
                 }
 #endif
 
+                server_unlock_journals(&server);
+
+                /* Flushing the runtime journal to /var happens in
+                 * steps, whenever there are no messages waiting, and
+                 * every now and then even if there are */
+                if (server_flush_to_var_due(&server, now(CLOCK_MONOTONIC)))
+                        server_flush_to_var_step(&server);
+
+                if (server.flush_journal)
+                        t = 0;
+
                 r = epoll_wait(server.epoll_fd, &event, 1, t);
                 if (r < 0) {
 
@@ -120,10 +134,12 @@ int main(int argc, char *argv[]) {
                                 goto finish;
                         else if (r == 0)
                                 break;
-                }
+                } else if (server.flush_journal)
+                        server_flush_to_var_step(&server);
 
+                server_post_change(&server);
                 server_maybe_append_tags(&server);
-                server_maybe_warn_forward_syslog_missed(&server);
+                server_maybe_warn_forward_missed(&server);
         }
 
         log_debug("systemd-journald stopped as pid %lu", (unsigned long) getpid());
@@ -20,8 +20,10 @@
 ***/
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <string.h>
 
 #include "hashmap.h"
@@ -40,6 +42,7 @@ struct Window {
 
         bool keep_always;
         bool in_unused;
+        bool sequential;
 
         void *ptr;
         uint64_t offset;
@@ -66,6 +69,12 @@ struct FileDescriptor {
         MMapCache *cache;
         int fd;
         LIST_HEAD(Window, windows);
+
+        /* The range of the most recently added window, to detect
+         * sequential scans */
+        uint64_t last_offset;
+        uint64_t last_end;
+        unsigned n_sequential;
 };
 
 struct MMapCache {
@@ -75,22 +84,50 @@ struct MMapCache {
         Hashmap *contexts;
 
         unsigned n_windows;
+        uint64_t window_size_max;
+
+        MMapCacheStats stats;
 
         LIST_HEAD(Window, unused);
         Window *last_unused;
 };
 
 #define WINDOWS_MIN 64
-#define WINDOW_SIZE (8ULL*1024ULL*1024ULL)
+
+/* Windows grow with the file they map, between these bounds. On
+ * 32bit archs address space is scarce, hence stick to the minimum
+ * there. */
+#define WINDOW_SIZE_MIN (8ULL*1024ULL*1024ULL)
+#define WINDOW_SIZE_MAX (sizeof(void*) >= 8 ? 128ULL*1024ULL*1024ULL : WINDOW_SIZE_MIN)
+
+/* Map each file in roughly this many windows */
+#define WINDOWS_PER_FILE 16
+
+/* After this many consecutive windows that follow each other we
+ * assume a sequential scan */
+#define SEQUENTIAL_WINDOWS_MIN 2
 
 MMapCache* mmap_cache_new(void) {
         MMapCache *m;
+        struct rlimit rl;
 
         m = new0(MMapCache, 1);
         if (!m)
                 return NULL;
 
         m->n_ref = 1;
+        m->window_size_max = WINDOW_SIZE_MAX;
+
+        /* Make sure the windows we keep around fit comfortably
+         * into the address space we are allowed to use */
+        if (getrlimit(RLIMIT_AS, &rl) >= 0 &&
+            rl.rlim_cur != RLIM_INFINITY) {
+                uint64_t l;
+
+                l = PAGE_ALIGN((uint64_t) rl.rlim_cur / 4 / WINDOWS_MIN);
+                m->window_size_max = CLAMP(l, WINDOW_SIZE_MIN, m->window_size_max);
+        }
+
         return m;
 }
 
@@ -126,6 +163,20 @@ static void window_unlink(Window *w) {
         }
 }
 
+static void window_evict(Window *w) {
+        assert(w);
+
+        /* If this window was only read as part of a sequential
+         * scan, it is unlikely to be needed again soon, hence tell
+         * the kernel to drop it from the page cache rather than
+         * pushing out more useful pages. Note that MADV_DONTNEED
+         * wouldn't help here, since for shared file mappings it
+         * only drops the page table entries, and so does
+         * munmap(). */
+        if (w->sequential && w->fd && !(w->prot & PROT_WRITE))
+                posix_fadvise(w->fd->fd, w->offset, w->size, POSIX_FADV_DONTNEED);
+}
+
 static void window_free(Window *w) {
         assert(w);
 
@@ -163,6 +214,8 @@ static Window *window_add(MMapCache *m) {
 
                 /* Reuse an existing one */
                 w = m->last_unused;
+                window_evict(w);
+                m->stats.evictions++;
                 window_unlink(w);
                 zero(*w);
         }
@@ -338,7 +391,9 @@ static int make_room(MMapCache *m) {
         if (!m->last_unused)
                 return 0;
 
+        window_evict(m->last_unused);
         window_free(m->last_unused);
+        m->stats.evictions++;
         return 1;
 }
 
@@ -373,10 +428,12 @@ static int try_context(
 
                 /* Drop the reference to the window, since it's unnecessary now */
                 context_detach_window(c);
+                m->stats.context_detaches++;
                 return 0;
         }
 
         c->window->keep_always = c->window->keep_always || keep_always;
+        m->stats.context_hits++;
 
         *ret = (uint8_t*) c->window->ptr + (offset - c->window->offset);
         return 1;
@@ -421,11 +478,43 @@ static int find_mmap(
 
         context_attach_window(c, w);
         w->keep_always = w->keep_always || keep_always;
+        m->stats.window_hits++;
 
         *ret = (uint8_t*) w->ptr + (offset - w->offset);
         return 1;
 }
 
+static uint64_t window_size(MMapCache *m, struct stat *st) {
+        uint64_t l;
+
+        assert(m);
+
+        if (!st)
+                return WINDOW_SIZE_MIN;
+
+        /* Large files get large windows, so that scanning through
+         * them doesn't require us to map and unmap all the time */
+        l = PAGE_ALIGN((uint64_t) st->st_size / WINDOWS_PER_FILE);
+
+        return CLAMP(l, WINDOW_SIZE_MIN, m->window_size_max);
+}
+
+static bool fd_is_sequential(FileDescriptor *f, uint64_t offset, size_t size, uint64_t wsize) {
+        assert(f);
+
+        /* Does this request start in or right after the most
+         * recently added window, and reach beyond it? */
+        if (f->last_end > 0 &&
+            offset >= f->last_offset &&
+            offset < f->last_end + wsize &&
+            offset + size > f->last_end)
+                f->n_sequential++;
+        else
+                f->n_sequential = 0;
+
+        return f->n_sequential >= SEQUENTIAL_WINDOWS_MIN;
+}
+
 static int add_mmap(
                 MMapCache *m,
                 int fd,
@@ -437,11 +526,12 @@ static int add_mmap(
                 struct stat *st,
                 void **ret) {
 
-        uint64_t woffset, wsize;
+        uint64_t woffset, wsize, target;
         Context *c;
         FileDescriptor *f;
         Window *w;
         void *d;
+        bool sequential;
         int r;
 
         assert(m);
@@ -450,21 +540,33 @@ static int add_mmap(
         assert(size > 0);
         assert(ret);
 
+        f = fd_add(m, fd);
+        if (!f)
+                return -ENOMEM;
+
+        target = window_size(m, st);
+        sequential = fd_is_sequential(f, offset, size, target);
+
         woffset = offset & ~((uint64_t) page_size() - 1ULL);
         wsize = size + (offset - woffset);
         wsize = PAGE_ALIGN(wsize);
 
-        if (wsize < WINDOW_SIZE) {
+        if (wsize < target) {
                 uint64_t delta;
 
-                delta = PAGE_ALIGN((WINDOW_SIZE - wsize) / 2);
+                /* When scanning sequentially, map what comes next,
+                 * otherwise center the window on the request */
+                if (sequential)
+                        delta = 0;
+                else
+                        delta = PAGE_ALIGN((target - wsize) / 2);
 
                 if (delta > offset)
                         woffset = 0;
                 else
                         woffset -= delta;
 
-                wsize = WINDOW_SIZE;
+                wsize = target;
         }
 
         if (st) {
@@ -493,19 +595,24 @@ static int add_mmap(
                         return -ENOMEM;
         }
 
+        if (sequential) {
+                madvise(d, wsize, MADV_SEQUENTIAL);
+                madvise(d, wsize, MADV_WILLNEED);
+        }
+
         c = context_add(m, context);
         if (!c)
                 return -ENOMEM;
 
-        f = fd_add(m, fd);
-        if (!f)
-                return -ENOMEM;
-
         w = window_add(m);
         if (!w)
                 return -ENOMEM;
 
+        f->last_offset = woffset;
+        f->last_end = woffset + wsize;
+
         w->keep_always = keep_always;
+        w->sequential = sequential;
         w->ptr = d;
         w->offset = woffset;
         w->prot = prot;
@@ -513,6 +620,7 @@ static int add_mmap(
         w->fd = f;
 
         LIST_PREPEND(Window, by_fd, f->windows, w);
+        m->stats.misses++;
 
         context_detach_window(c);
         c->window = w;
@@ -579,3 +687,13 @@ void mmap_cache_close_context(MMapCache *m, unsigned context) {
 
         context_free(c);
 }
+
+void mmap_cache_get_stats(MMapCache *m, MMapCacheStats *ret) {
+        assert(m);
+        assert(ret);
+
+        *ret = m->stats;
+        ret->n_windows = m->n_windows;
+        ret->n_contexts = hashmap_size(m->contexts);
+        ret->n_fds = hashmap_size(m->fds);
+}
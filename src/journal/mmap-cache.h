@@ -27,6 +27,17 @@
 
 typedef struct MMapCache MMapCache;
 
+typedef struct MMapCacheStats {
+        uint64_t context_hits;     /* request was in the context's current window */
+        uint64_t window_hits;      /* request was in another window of the same file */
+        uint64_t misses;           /* a new window had to be mapped */
+        uint64_t context_detaches; /* the context's window didn't match the request */
+        uint64_t evictions;        /* an unused window was dropped to make room */
+        unsigned n_windows;
+        unsigned n_contexts;
+        unsigned n_fds;
+} MMapCacheStats;
+
 MMapCache* mmap_cache_new(void);
 MMapCache* mmap_cache_ref(MMapCache *m);
 MMapCache* mmap_cache_unref(MMapCache *m);
@@ -34,3 +45,5 @@ MMapCache* mmap_cache_unref(MMapCache *m);
 int mmap_cache_get(MMapCache *m, int fd, int prot, unsigned context, bool keep_always, uint64_t offset, size_t size, struct stat *st, void **ret);
 void mmap_cache_close_fd(MMapCache *m, int fd);
 void mmap_cache_close_context(MMapCache *m, unsigned context);
+
+void mmap_cache_get_stats(MMapCache *m, MMapCacheStats *ret);
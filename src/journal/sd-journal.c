@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <sys/inotify.h>
 #include <sys/poll.h>
+#include <sys/resource.h>
 #include <sys/vfs.h>
 #include <linux/magic.h>
 
@@ -35,13 +36,17 @@
 #include "list.h"
 #include "path-util.h"
 #include "lookup3.h"
+#include "xxhash64.h"
 #include "compress.h"
 #include "journal-internal.h"
 #include "missing.h"
 #include "catalog.h"
 #include "replace-var.h"
 
-#define JOURNAL_FILES_MAX 1024
+#define JOURNAL_FILES_MAX 7168
+
+/* Archived files beyond this many have their fds closed while idle */
+#define JOURNAL_FILES_OPEN_MAX 1024
 
 #define JOURNAL_FILES_RECHECK_USEC (2 * USEC_PER_SEC)
 
@@ -64,17 +69,31 @@ static int set_put_error(sd_journal *j, int r) {
         return set_put(j->errors, INT_TO_PTR(r));
 }
 
+static void heap_invalidate(sd_journal *j) {
+        assert(j);
+
+        prioq_free(j->heap);
+        j->heap = NULL;
+
+        free(j->heap_items);
+        j->heap_items = NULL;
+}
+
 static void detach_location(sd_journal *j) {
         Iterator i;
         JournalFile *f;
 
         assert(j);
 
+        heap_invalidate(j);
+
         j->current_file = NULL;
         j->current_field = 0;
 
-        HASHMAP_FOREACH(f, j->files, i)
+        HASHMAP_FOREACH(f, j->files, i) {
                 f->current_offset = 0;
+                f->exhausted = false;
+        }
 }
 
 static void reset_location(sd_journal *j) {
@@ -277,6 +296,7 @@ _public_ int sd_journal_add_match(sd_journal *j, const void *data, size_t size)
                 goto fail;
 
         m->le_hash = le_hash;
+        m->le_xxhash = htole64(xxhash64(data, size, 0));
         m->size = size;
         m->data = memdup(data, size);
         if (!m->data)
@@ -387,90 +407,6 @@ _public_ void sd_journal_flush_matches(sd_journal *j) {
         detach_location(j);
 }
 
-static int compare_entry_order(JournalFile *af, Object *_ao,
-                         JournalFile *bf, uint64_t bp) {
-
-        uint64_t a, b;
-        Object *ao, *bo;
-        int r;
-
-        assert(af);
-        assert(bf);
-        assert(_ao);
-
-        /* The mmap cache might invalidate the object from the first
-         * file if we look at the one from the second file. Hence
-         * temporarily copy the header of the first one, and look at
-         * that only. */
-        ao = alloca(offsetof(EntryObject, items));
-        memcpy(ao, _ao, offsetof(EntryObject, items));
-
-        r = journal_file_move_to_object(bf, OBJECT_ENTRY, bp, &bo);
-        if (r < 0)
-                return strcmp(af->path, bf->path);
-
-        /* We operate on two different files here, hence we can access
-         * two objects at the same time, which we normally can't.
-         *
-         * If contents and timestamps match, these entries are
-         * identical, even if the seqnum does not match */
-
-        if (sd_id128_equal(ao->entry.boot_id, bo->entry.boot_id) &&
-            ao->entry.monotonic == bo->entry.monotonic &&
-            ao->entry.realtime == bo->entry.realtime &&
-            ao->entry.xor_hash == bo->entry.xor_hash)
-                return 0;
-
-        if (sd_id128_equal(af->header->seqnum_id, bf->header->seqnum_id)) {
-
-                /* If this is from the same seqnum source, compare
-                 * seqnums */
-                a = le64toh(ao->entry.seqnum);
-                b = le64toh(bo->entry.seqnum);
-
-                if (a < b)
-                        return -1;
-                if (a > b)
-                        return 1;
-
-                /* Wow! This is weird, different data but the same
-                 * seqnums? Something is borked, but let's make the
-                 * best of it and compare by time. */
-        }
-
-        if (sd_id128_equal(ao->entry.boot_id, bo->entry.boot_id)) {
-
-                /* If the boot id matches compare monotonic time */
-                a = le64toh(ao->entry.monotonic);
-                b = le64toh(bo->entry.monotonic);
-
-                if (a < b)
-                        return -1;
-                if (a > b)
-                        return 1;
-        }
-
-        /* Otherwise compare UTC time */
-        a = le64toh(ao->entry.realtime);
-        b = le64toh(bo->entry.realtime);
-
-        if (a < b)
-                return -1;
-        if (a > b)
-                return 1;
-
-        /* Finally, compare by contents */
-        a = le64toh(ao->entry.xor_hash);
-        b = le64toh(bo->entry.xor_hash);
-
-        if (a < b)
-                return -1;
-        if (a > b)
-                return 1;
-
-        return 0;
-}
-
 static int compare_with_location(JournalFile *af, Object *ao, Location *l) {
         uint64_t a;
 
@@ -531,6 +467,57 @@ static int compare_with_location(JournalFile *af, Object *ao, Location *l) {
         return 0;
 }
 
+static int compare_locations(const Location *a, const Location *b) {
+        assert(a);
+        assert(b);
+        assert(a->type == LOCATION_DISCRETE);
+        assert(b->type == LOCATION_DISCRETE);
+
+        /* Orders two entries, possibly from different files, by
+         * the copies of their headers. If contents and timestamps
+         * match, these entries are identical, even if the seqnum
+         * does not match. */
+
+        if (sd_id128_equal(a->boot_id, b->boot_id) &&
+            a->monotonic == b->monotonic &&
+            a->realtime == b->realtime &&
+            a->xor_hash == b->xor_hash)
+                return 0;
+
+        if (sd_id128_equal(a->seqnum_id, b->seqnum_id)) {
+                if (a->seqnum < b->seqnum)
+                        return -1;
+                if (a->seqnum > b->seqnum)
+                        return 1;
+        }
+
+        if (sd_id128_equal(a->boot_id, b->boot_id)) {
+                if (a->monotonic < b->monotonic)
+                        return -1;
+                if (a->monotonic > b->monotonic)
+                        return 1;
+        }
+
+        if (a->realtime < b->realtime)
+                return -1;
+        if (a->realtime > b->realtime)
+                return 1;
+
+        if (a->xor_hash < b->xor_hash)
+                return -1;
+        if (a->xor_hash > b->xor_hash)
+                return 1;
+
+        return 0;
+}
+
+static uint64_t match_hash(JournalFile *f, Match *m) {
+        assert(f);
+        assert(m);
+
+        return le64toh(JOURNAL_HEADER_XXHASH64(f->header) ? m->le_xxhash : m->le_hash);
+}
+
 static int next_for_match(
                 sd_journal *j,
                 Match *m,
@@ -551,7 +538,7 @@ static int next_for_match(
         if (m->type == MATCH_DISCRETE) {
                 uint64_t dp;
 
-                r = journal_file_find_data_object_with_hash(f, m->data, m->size, le64toh(m->le_hash), NULL, &dp);
+                r = journal_file_find_data_object_with_hash(f, m->data, m->size, match_hash(f, m), NULL, &dp);
                 if (r <= 0)
                         return r;
 
@@ -645,7 +632,7 @@ static int find_location_for_match(
         if (m->type == MATCH_DISCRETE) {
                 uint64_t dp;
 
-                r = journal_file_find_data_object_with_hash(f, m->data, m->size, le64toh(m->le_hash), NULL, &dp);
+                r = journal_file_find_data_object_with_hash(f, m->data, m->size, match_hash(f, m), NULL, &dp);
                 if (r <= 0)
                         return r;
 
@@ -791,6 +778,128 @@ static int next_with_matches(
         return next_for_match(j, j->level0, f, direction == DIRECTION_DOWN ? cp+1 : cp-1, direction, ret, offset);
 }
 
+static int file_beyond_location(sd_journal *j, JournalFile *f, direction_t direction) {
+        Location *l;
+
+        assert(j);
+        assert(f);
+
+        /* Checks whether the header of the file tells us that there
+         * is nothing in it beyond the current location, so that we
+         * can avoid bisecting it. */
+
+        l = &j->current_location;
+
+        if (l->type != LOCATION_DISCRETE && l->type != LOCATION_SEEK)
+                return 0;
+
+        if (le64toh(f->header->n_entries) <= 0)
+                return 0;
+
+        if (l->seqnum_set &&
+            sd_id128_equal(l->seqnum_id, f->header->seqnum_id)) {
+
+                if (direction == DIRECTION_DOWN)
+                        return le64toh(f->header->tail_entry_seqnum) < l->seqnum;
+                else
+                        return le64toh(f->header->head_entry_seqnum) > l->seqnum;
+        }
+
+        if (!l->realtime_set)
+                return 0;
+
+        if (l->monotonic_set) {
+                char t[9+32+1] = "_BOOT_ID=";
+                int r;
+
+                /* Entries of the same boot are ordered by their
+                 * monotonic timestamps, which the header doesn't
+                 * tell us anything about */
+                sd_id128_to_string(l->boot_id, t + 9);
+
+                r = journal_file_find_data_object(f, t, strlen(t), NULL, NULL);
+                if (r != 0)
+                        return r;
+        }
+
+        if (direction == DIRECTION_DOWN)
+                return le64toh(f->header->tail_entry_realtime) < l->realtime;
+        else
+                return le64toh(f->header->head_entry_realtime) > l->realtime;
+}
+
+static bool entry_matches_location(JournalFile *f, Object *o, Location *l) {
+        assert(f);
+        assert(o);
+        assert(l);
+
+        if (l->seqnum_set &&
+            (!sd_id128_equal(l->seqnum_id, f->header->seqnum_id) ||
+             l->seqnum != le64toh(o->entry.seqnum)))
+                return false;
+
+        if (l->monotonic_set &&
+            (!sd_id128_equal(l->boot_id, o->entry.boot_id) ||
+             l->monotonic != le64toh(o->entry.monotonic)))
+                return false;
+
+        if (l->realtime_set && l->realtime != le64toh(o->entry.realtime))
+                return false;
+
+        if (l->xor_hash_set && l->xor_hash != le64toh(o->entry.xor_hash))
+                return false;
+
+        return true;
+}
+
+static int find_location_by_offset(
+                sd_journal *j,
+                JournalFile *f,
+                direction_t direction,
+                Object **ret,
+                uint64_t *offset) {
+
+        Location *l;
+        Object *o;
+        uint64_t p;
+        int r;
+
+        assert(j);
+        assert(f);
+        assert(ret);
+        assert(offset);
+
+        /* If the cursor tells us where in this very file the entry
+         * is, we can go there directly instead of bisecting by
+         * seqnum or time. Returns -ESTALE if the hint is of no use,
+         * in which case the caller should do the bisection. */
+
+        l = &j->current_location;
+
+        if (l->type != LOCATION_SEEK || !l->offset_set)
+                return -ESTALE;
+
+        if (!sd_id128_equal(l->file_id, f->header->file_id))
+                return -ESTALE;
+
+        /* The offset is not trusted, make sure it actually is one
+         * of the entries of the file and still the one we are
+         * looking for */
+        r = journal_file_move_to_entry_by_offset(f, l->offset, direction, &o, &p);
+        if (r <= 0 || p != l->offset)
+                return -ESTALE;
+
+        if (!entry_matches_location(f, o, l))
+                return -ESTALE;
+
+        if (j->level0)
+                return next_for_match(j, j->level0, f, p, direction, ret, offset);
+
+        *ret = o;
+        *offset = p;
+        return 1;
+}
+
 static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direction, Object **ret, uint64_t *offset) {
         Object *c;
         uint64_t cp;
@@ -810,7 +919,15 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
                 if (r <= 0)
                         return r;
         } else {
-                r = find_location_with_matches(j, f, direction, &c, &cp);
+                r = file_beyond_location(j, f, direction);
+                if (r < 0)
+                        return r;
+                if (r > 0)
+                        return 0;
+
+                r = find_location_by_offset(j, f, direction, &c, &cp);
+                if (r == -ESTALE)
+                        r = find_location_with_matches(j, f, direction, &c, &cp);
                 if (r <= 0)
                         return r;
         }
@@ -849,54 +966,178 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         }
 }
 
-static int real_journal_next(sd_journal *j, direction_t direction) {
-        JournalFile *f, *new_file = NULL;
-        uint64_t new_offset = 0;
-        Object *o;
-        uint64_t p;
+static int heap_compare_down(const void *a, const void *b) {
+        const JournalHeapItem *x = a, *y = b;
+
+        return compare_locations(&x->location, &y->location);
+}
+
+static int heap_compare_up(const void *a, const void *b) {
+        const JournalHeapItem *x = a, *y = b;
+
+        return compare_locations(&y->location, &x->location);
+}
+
+static void file_set_exhausted(JournalFile *f, direction_t direction) {
+        assert(f);
+
+        /* Entries are only ever appended, hence as long as we only
+         * move on downwards, a file that doesn't grow has nothing
+         * for us anymore. This way following the journal only looks
+         * at the files that were written to. */
+        if (direction != DIRECTION_DOWN)
+                return;
+
+        f->exhausted = true;
+        f->exhausted_n_entries = le64toh(f->header->n_entries);
+}
+
+static bool file_is_exhausted(JournalFile *f) {
+        assert(f);
+
+        return f->exhausted && le64toh(f->header->n_entries) == f->exhausted_n_entries;
+}
+
+static int heap_rebuild(sd_journal *j, direction_t direction) {
+        JournalFile *f;
         Iterator i;
+        unsigned n = 0;
         int r;
 
-        if (!j)
-                return -EINVAL;
+        assert(j);
+
+        heap_invalidate(j);
+
+        j->heap = prioq_new(direction == DIRECTION_DOWN ? heap_compare_down : heap_compare_up);
+        if (!j->heap)
+                return -ENOMEM;
+
+        j->heap_items = new(JournalHeapItem, MAX(hashmap_size(j->files), 1U));
+        if (!j->heap_items) {
+                heap_invalidate(j);
+                return -ENOMEM;
+        }
+
+        j->heap_direction = direction;
 
         HASHMAP_FOREACH(f, j->files, i) {
-                bool found;
+                JournalHeapItem *item;
+                Object *o;
+                uint64_t p;
+
+                /* Going up, everything might be beyond the location
+                 * again */
+                if (direction != DIRECTION_DOWN)
+                        f->exhausted = false;
+                else if (file_is_exhausted(f))
+                        continue;
 
                 r = next_beyond_location(j, f, direction, &o, &p);
                 if (r < 0) {
                         log_debug("Can't iterate through %s, ignoring: %s", f->path, strerror(-r));
                         continue;
-                } else if (r == 0)
+                } else if (r == 0) {
+                        file_set_exhausted(f, direction);
                         continue;
+                }
 
-                if (!new_file)
-                        found = true;
-                else {
+                item = j->heap_items + n++;
+                item->file = f;
+                item->offset = p;
+                init_location(&item->location, LOCATION_DISCRETE, f, o);
+
+                r = prioq_put(j->heap, item, &item->idx);
+                if (r < 0) {
+                        heap_invalidate(j);
+                        return r;
+                }
+        }
+
+        return 0;
+}
+
+static void heap_advance(sd_journal *j, JournalHeapItem *item) {
+        JournalFile *f;
+        Object *o;
+        uint64_t p;
+        int r;
+
+        assert(j);
+        assert(item);
+
+        /* Look for the next entry of this file beyond the current
+         * location, starting from the one we had. The file keeps
+         * pointing to the old one, which is never beyond the
+         * current location, so that this can be repeated if the
+         * heap is rebuilt. */
+
+        f = item->file;
+        f->current_offset = item->offset;
+        f->last_direction = j->heap_direction;
+
+        r = next_beyond_location(j, f, j->heap_direction, &o, &p);
+        if (r <= 0) {
+                if (r < 0)
+                        log_debug("Can't iterate through %s, ignoring: %s", f->path, strerror(-r));
+                else
+                        file_set_exhausted(f, j->heap_direction);
+
+                prioq_remove(j->heap, item, &item->idx);
+                return;
+        }
+
+        item->offset = p;
+        init_location(&item->location, LOCATION_DISCRETE, f, o);
+        prioq_reshuffle(j->heap, item, &item->idx);
+}
+
+static int real_journal_next(sd_journal *j, direction_t direction) {
+        JournalHeapItem *item;
+        Object *o;
+        int r;
+
+        if (!j)
+                return -EINVAL;
+
+        if (!j->heap || j->heap_direction != direction) {
+                r = heap_rebuild(j, direction);
+                if (r < 0)
+                        return r;
+        }
+
+        /* Move on all files whose next entry is the one we returned
+         * last, or a copy of it */
+        if (j->current_location.type == LOCATION_DISCRETE)
+                for (;;) {
                         int k;
 
-                        k = compare_entry_order(f, o, new_file, new_offset);
+                        item = prioq_peek(j->heap);
+                        if (!item)
+                                break;
 
-                        if (direction == DIRECTION_DOWN)
-                                found = k < 0;
-                        else
-                                found = k > 0;
-                }
+                        k = compare_locations(&item->location, &j->current_location);
+                        if (direction == DIRECTION_DOWN ? k > 0 : k < 0)
+                                break;
 
-                if (found) {
-                        new_file = f;
-                        new_offset = p;
+                        heap_advance(j, item);
                 }
-        }
 
-        if (!new_file)
+        item = prioq_peek(j->heap);
+        if (!item) {
+                /* Files might have grown in the meantime, hence start
+                 * over when we are asked again */
+                heap_invalidate(j);
                 return 0;
+        }
 
-        r = journal_file_move_to_object(new_file, OBJECT_ENTRY, new_offset, &o);
+        r = journal_file_move_to_object(item->file, OBJECT_ENTRY, item->offset, &o);
         if (r < 0)
                 return r;
 
-        set_location(j, LOCATION_DISCRETE, new_file, o, direction, new_offset);
+        set_location(j, LOCATION_DISCRETE, item->file, o, direction, item->offset);
+
+        if (j->prefetch)
+                journal_prefetch_schedule(j->prefetch, item->file, item->offset, direction, j->data_threshold);
 
         return 1;
 }
@@ -950,7 +1191,7 @@ _public_ int sd_journal_previous_skip(sd_journal *j, uint64_t skip) {
 _public_ int sd_journal_get_cursor(sd_journal *j, char **cursor) {
         Object *o;
         int r;
-        char bid[33], sid[33];
+        char bid[33], sid[33], fid[33];
 
         if (!j)
                 return -EINVAL;
@@ -966,13 +1207,15 @@ _public_ int sd_journal_get_cursor(sd_journal *j, char **cursor) {
 
         sd_id128_to_string(j->current_file->header->seqnum_id, sid);
         sd_id128_to_string(o->entry.boot_id, bid);
+        sd_id128_to_string(j->current_file->header->file_id, fid);
 
         if (asprintf(cursor,
-                     "s=%s;i=%llx;b=%s;m=%llx;t=%llx;x=%llx",
+                     "s=%s;i=%llx;b=%s;m=%llx;t=%llx;x=%llx;f=%s;o=%llx",
                      sid, (unsigned long long) le64toh(o->entry.seqnum),
                      bid, (unsigned long long) le64toh(o->entry.monotonic),
                      (unsigned long long) le64toh(o->entry.realtime),
-                     (unsigned long long) le64toh(o->entry.xor_hash)) < 0)
+                     (unsigned long long) le64toh(o->entry.xor_hash),
+                     fid, (unsigned long long) j->current_file->current_offset) < 0)
                 return -ENOMEM;
 
         return 0;
@@ -981,15 +1224,17 @@ _public_ int sd_journal_get_cursor(sd_journal *j, char **cursor) {
 _public_ int sd_journal_seek_cursor(sd_journal *j, const char *cursor) {
         char *w, *state;
         size_t l;
-        unsigned long long seqnum, monotonic, realtime, xor_hash;
+        unsigned long long seqnum, monotonic, realtime, xor_hash, offset;
         bool
                 seqnum_id_set = false,
                 seqnum_set = false,
                 boot_id_set = false,
                 monotonic_set = false,
                 realtime_set = false,
-                xor_hash_set = false;
-        sd_id128_t seqnum_id, boot_id;
+                xor_hash_set = false,
+                file_id_set = false,
+                offset_set = false;
+        sd_id128_t seqnum_id, boot_id, file_id;
 
         if (!j)
                 return -EINVAL;
@@ -1042,6 +1287,17 @@ _public_ int sd_journal_seek_cursor(sd_journal *j, const char *cursor) {
                         if (sscanf(item+2, "%llx", &xor_hash) != 1)
                                 k = -EINVAL;
                         break;
+
+                case 'f':
+                        file_id_set = true;
+                        k = sd_id128_from_string(item+2, &file_id);
+                        break;
+
+                case 'o':
+                        offset_set = true;
+                        if (sscanf(item+2, "%llx", &offset) != 1)
+                                k = -EINVAL;
+                        break;
                 }
 
                 free(item);
@@ -1081,6 +1337,12 @@ _public_ int sd_journal_seek_cursor(sd_journal *j, const char *cursor) {
                 j->current_location.xor_hash_set = true;
         }
 
+        if (file_id_set && offset_set && offset > 0) {
+                j->current_location.file_id = file_id;
+                j->current_location.offset = (uint64_t) offset;
+                j->current_location.offset_set = true;
+        }
+
         return 0;
 }
 
@@ -1231,10 +1493,150 @@ static void check_network(sd_journal *j, int fd) {
                 sfs.f_type == SMB_SUPER_MAGIC;
 }
 
+static size_t series_length(const char *filename) {
+        const char *e;
+
+        /* The part of the name that stays the same when the file is
+         * archived, i.e. "system" for system@....journal */
+        e = strchr(filename, '@');
+        if (!e)
+                e = strstr(filename, ".journal");
+        if (!e)
+                return strlen(filename);
+
+        return e - filename;
+}
+
+static bool parse_archive_name(const char *filename, usec_t *head_realtime) {
+        const char *a, *e, *p;
+        usec_t t = 0;
+
+        /* Archived files are named
+         * prefix@seqnum_id-head_seqnum-head_realtime.journal, the
+         * numbers in hex. Files renamed after corruption end in
+         * .journal~ and are left alone. */
+
+        a = strchr(filename, '@');
+        if (!a)
+                return false;
+
+        e = endswith(filename, ".journal");
+        if (!e || e - a < 1 + 16)
+                return false;
+
+        for (p = e - 16; p < e; p++) {
+                int c;
+
+                c = unhexchar(*p);
+                if (c < 0)
+                        return false;
+
+                t = (t << 4) | c;
+        }
+
+        if (p[-17] != '-')
+                return false;
+
+        *head_realtime = t;
+        return true;
+}
+
+static int defer_file(sd_journal *j, const char *prefix, const char *filename, usec_t head_realtime) {
+        DeferredFile *d;
+        unsigned i;
+
+        assert(j);
+
+        for (i = 0; i < j->n_deferred; i++)
+                if (streq(j->deferred[i].filename, filename) &&
+                    streq(j->deferred[i].prefix, prefix))
+                        return 0;
+
+        if (!GREEDY_REALLOC(j->deferred, j->n_deferred_allocated, j->n_deferred + 1))
+                return -ENOMEM;
+
+        d = j->deferred + j->n_deferred;
+        d->prefix = strdup(prefix);
+        d->filename = strdup(filename);
+        if (!d->prefix || !d->filename) {
+                free(d->prefix);
+                free(d->filename);
+                return -ENOMEM;
+        }
+
+        d->series_length = series_length(filename);
+        d->head_realtime = head_realtime;
+        j->n_deferred++;
+
+        log_debug("File %s/%s got deferred.", prefix, filename);
+
+        return 0;
+}
+
+static void forget_deferred_file(sd_journal *j, unsigned i) {
+        assert(j);
+        assert(i < j->n_deferred);
+
+        free(j->deferred[i].prefix);
+        free(j->deferred[i].filename);
+
+        memmove(j->deferred + i, j->deferred + i + 1, (j->n_deferred - i - 1) * sizeof(DeferredFile));
+        j->n_deferred--;
+}
+
+static bool deferred_file_same_series(DeferredFile *d, const char *prefix, size_t prefix_length, const char *filename) {
+        assert(d);
+
+        return strlen(d->prefix) == prefix_length &&
+                strncmp(d->prefix, prefix, prefix_length) == 0 &&
+                series_length(filename) == d->series_length &&
+                strncmp(d->filename, filename, d->series_length) == 0;
+}
+
+static usec_t deferred_file_until(sd_journal *j, DeferredFile *d) {
+        usec_t until = (usec_t) -1;
+        JournalFile *f;
+        Iterator i;
+        unsigned k;
+
+        assert(j);
+        assert(d);
+
+        /* Files of the same series follow each other, hence the
+         * entries of an archive are older than the first one of the
+         * next file of its series. Without such a file we can't
+         * tell anything. */
+
+        for (k = 0; k < j->n_deferred; k++) {
+                DeferredFile *e = j->deferred + k;
+
+                if (e->head_realtime > d->head_realtime &&
+                    deferred_file_same_series(d, e->prefix, strlen(e->prefix), e->filename))
+                        until = MIN(until, e->head_realtime);
+        }
+
+        HASHMAP_FOREACH(f, j->files, i) {
+                const char *fn;
+                usec_t h;
+
+                fn = strrchr(f->path, '/');
+                if (!fn)
+                        continue;
+
+                h = le64toh(f->header->head_entry_realtime);
+                if (h > d->head_realtime &&
+                    deferred_file_same_series(d, f->path, fn - f->path, fn + 1))
+                        until = MIN(until, h);
+        }
+
+        return until;
+}
+
 static int add_file(sd_journal *j, const char *prefix, const char *filename) {
         char _cleanup_free_ *path = NULL;
         int r;
         JournalFile *f;
+        usec_t head_realtime;
 
         assert(j);
         assert(prefix);
@@ -1254,12 +1656,15 @@ static int add_file(sd_journal *j, const char *prefix, const char *filename) {
         if (hashmap_get(j->files, path))
                 return 0;
 
+        if (j->defer_archives && parse_archive_name(filename, &head_realtime))
+                return defer_file(j, prefix, filename, head_realtime);
+
         if (hashmap_size(j->files) >= JOURNAL_FILES_MAX) {
                 log_debug("Too many open journal files, not adding %s, ignoring.", path);
                 return set_put_error(j, -ETOOMANYREFS);
         }
 
-        r = journal_file_open(path, O_RDONLY, 0, false, false, NULL, j->mmap, NULL, &f);
+        r = journal_file_open(path, O_RDONLY, 0, 0, false, NULL, j->mmap, NULL, &f);
         if (r < 0) {
                 if (errno == ENOENT)
                         return 0;
@@ -1279,6 +1684,9 @@ static int add_file(sd_journal *j, const char *prefix, const char *filename) {
 
         check_network(j, f->fd);
 
+        journal_file_set_fd_limit(f, &j->fd_limit);
+
+        heap_invalidate(j);
         j->current_invalidate_counter ++;
 
         return 0;
@@ -1287,11 +1695,19 @@ static int add_file(sd_journal *j, const char *prefix, const char *filename) {
 static int remove_file(sd_journal *j, const char *prefix, const char *filename) {
         char *path;
         JournalFile *f;
+        unsigned i;
 
         assert(j);
         assert(prefix);
         assert(filename);
 
+        for (i = 0; i < j->n_deferred; i++)
+                if (streq(j->deferred[i].filename, filename) &&
+                    streq(j->deferred[i].prefix, prefix)) {
+                        forget_deferred_file(j, i);
+                        return 0;
+                }
+
         path = strjoin(prefix, "/", filename, NULL);
         if (!path)
                 return -ENOMEM;
@@ -1305,6 +1721,11 @@ static int remove_file(sd_journal *j, const char *prefix, const char *filename)
 
         log_debug("File %s got removed.", f->path);
 
+        heap_invalidate(j);
+
+        if (j->prefetch)
+                journal_prefetch_forget(j->prefetch, f);
+
         if (j->current_file == f) {
                 j->current_file = NULL;
                 j->current_field = 0;
@@ -1562,8 +1983,19 @@ static int allocate_inotify(sd_journal *j) {
         return 0;
 }
 
+static unsigned journal_files_open_max(void) {
+        struct rlimit rl;
+
+        /* Leave at least half of the fds to the program using us */
+        if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur == RLIM_INFINITY)
+                return JOURNAL_FILES_OPEN_MAX;
+
+        return (unsigned) CLAMP(rl.rlim_cur / 2, (rlim_t) 16, (rlim_t) JOURNAL_FILES_OPEN_MAX);
+}
+
 static sd_journal *journal_new(int flags, const char *path) {
         sd_journal *j;
+        const char *e;
 
         j = new0(sd_journal, 1);
         if (!j)
@@ -1573,6 +2005,20 @@ static sd_journal *journal_new(int flags, const char *path) {
         j->flags = flags;
         j->data_threshold = DEFAULT_DATA_THRESHOLD;
 
+        e = getenv("SYSTEMD_JOURNAL_WAIT_LATENCY");
+        if (e && parse_sec(e, &j->wait_latency_usec) < 0) {
+                log_debug("Failed to parse $SYSTEMD_JOURNAL_WAIT_LATENCY, ignoring.");
+                j->wait_latency_usec = 0;
+        }
+
+        j->fd_limit.max_open = journal_files_open_max();
+
+        e = getenv("SYSTEMD_JOURNAL_FILES_OPEN_MAX");
+        if (e && (safe_atou(e, &j->fd_limit.max_open) < 0 || j->fd_limit.max_open <= 0)) {
+                log_debug("Failed to parse $SYSTEMD_JOURNAL_FILES_OPEN_MAX, ignoring.");
+                j->fd_limit.max_open = journal_files_open_max();
+        }
+
         if (path) {
                 j->path = strdup(path);
                 if (!j->path)
@@ -1585,6 +2031,10 @@ static sd_journal *journal_new(int flags, const char *path) {
         if (!j->files || !j->directories_by_path || !j->mmap)
                 goto fail;
 
+        if (flags & SD_JOURNAL_PARALLEL)
+                if (journal_prefetch_new(&j->prefetch) < 0)
+                        goto fail;
+
         return j;
 
 fail:
@@ -1601,7 +2051,8 @@ _public_ int sd_journal_open(sd_journal **ret, int flags) {
 
         if (flags & ~(SD_JOURNAL_LOCAL_ONLY|
                       SD_JOURNAL_RUNTIME_ONLY|
-                      SD_JOURNAL_SYSTEM_ONLY))
+                      SD_JOURNAL_SYSTEM_ONLY|
+                      SD_JOURNAL_PARALLEL))
                 return -EINVAL;
 
         j = journal_new(flags, NULL);
@@ -1621,6 +2072,101 @@ fail:
         return r;
 }
 
+int journal_open_newest(sd_journal **ret, int flags) {
+        sd_journal *j;
+        int r;
+
+        assert(ret);
+
+        if (flags & ~(SD_JOURNAL_LOCAL_ONLY|
+                      SD_JOURNAL_RUNTIME_ONLY|
+                      SD_JOURNAL_SYSTEM_ONLY))
+                return -EINVAL;
+
+        j = journal_new(flags, NULL);
+        if (!j)
+                return -ENOMEM;
+
+        j->defer_archives = true;
+
+        r = add_search_paths(j);
+        if (r < 0) {
+                sd_journal_close(j);
+                return r;
+        }
+
+        *ret = j;
+        return 0;
+}
+
+int journal_get_deferred_until(sd_journal *j, usec_t *ret) {
+        usec_t until = 0;
+        unsigned i;
+
+        assert(j);
+        assert(ret);
+
+        /* Tells up to when the entries of the files we didn't open
+         * yet might reach */
+
+        if (j->n_deferred <= 0)
+                return 0;
+
+        for (i = 0; i < j->n_deferred; i++)
+                until = MAX(until, deferred_file_until(j, j->deferred + i));
+
+        *ret = until;
+        return 1;
+}
+
+int journal_add_deferred_files(sd_journal *j, usec_t since) {
+        _cleanup_free_ bool *wanted = NULL;
+        unsigned i, n = 0;
+        int r;
+
+        assert(j);
+
+        /* Opens the files that might hold entries at or after
+         * since. Decide first, since every file we add changes what
+         * we know about the others. */
+
+        if (j->n_deferred <= 0)
+                return 0;
+
+        wanted = new(bool, j->n_deferred);
+        if (!wanted)
+                return -ENOMEM;
+
+        for (i = 0; i < j->n_deferred; i++)
+                wanted[i] = deferred_file_until(j, j->deferred + i) >= since;
+
+        j->defer_archives = false;
+
+        for (i = j->n_deferred; i > 0; i--) {
+                DeferredFile *d = j->deferred + i - 1;
+
+                if (!wanted[i - 1])
+                        continue;
+
+                r = add_file(j, d->prefix, d->filename);
+                if (r < 0) {
+                        log_debug("Failed to add file %s/%s: %s", d->prefix, d->filename, strerror(-r));
+                        r = set_put_error(j, r);
+                        if (r < 0) {
+                                j->defer_archives = true;
+                                return r;
+                        }
+                }
+
+                forget_deferred_file(j, i - 1);
+                n++;
+        }
+
+        j->defer_archives = true;
+
+        return n;
+}
+
 _public_ int sd_journal_open_directory(sd_journal **ret, const char *path, int flags) {
         sd_journal *j;
         int r;
@@ -1631,7 +2177,7 @@ _public_ int sd_journal_open_directory(sd_journal **ret, const char *path, int f
         if (!path)
                 return -EINVAL;
 
-        if (flags != 0)
+        if (flags & ~SD_JOURNAL_PARALLEL)
                 return -EINVAL;
 
         j = journal_new(flags, path);
@@ -1661,6 +2207,13 @@ _public_ void sd_journal_close(sd_journal *j) {
                 return;
 
         sd_journal_flush_matches(j);
+        heap_invalidate(j);
+
+        /* Stop the workers first, they hold their own handles of
+         * our files */
+        journal_prefetch_free(j->prefetch);
+
+        catalog_close(j->catalog);
 
         while ((f = hashmap_steal_first(j->files)))
                 journal_file_close(f);
@@ -1682,8 +2235,13 @@ _public_ void sd_journal_close(sd_journal *j) {
         if (j->mmap)
                 mmap_cache_unref(j->mmap);
 
+        while (j->n_deferred > 0)
+                forget_deferred_file(j, j->n_deferred - 1);
+        free(j->deferred);
+
         free(j->path);
         free(j->unique_field);
+        hashmap_free_free(j->unique_values);
         set_free(j->errors);
         free(j);
 }
@@ -1778,6 +2336,70 @@ static bool field_is_valid(const char *field) {
         return true;
 }
 
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+static int uncompress_data(
+                sd_journal *j,
+                JournalFile *f,
+                Object *o,
+                uint64_t p,
+                const char *field,
+                size_t field_length,
+                const void **data,
+                uint64_t *size) {
+
+        int compression = o->object.flags & OBJECT_COMPRESSION_MASK;
+        UncompressCacheItem *ci;
+        uint64_t l;
+        int r;
+
+        assert(j);
+        assert(f);
+        assert(o);
+        assert(data);
+        assert(size);
+
+        /* Decompresses the data object at p, unless we did so
+         * recently. If a field is specified and the object turns
+         * out not to be one of it, returns 0 without decompressing
+         * all of it. */
+
+        ci = journal_file_uncompress_cache_get(f, p, j->data_threshold);
+        if (ci)
+                goto finish;
+
+        l = le64toh(o->object.size) - offsetof(Object, data.payload);
+
+        /* Don't let the objects of other fields push out the ones
+         * we have */
+        if (field &&
+            !uncompress_startswith(compression,
+                                   o->data.payload, l,
+                                   &f->compress_buffer, &f->compress_buffer_size,
+                                   field, field_length, '='))
+                return 0;
+
+        ci = journal_file_uncompress_cache_add(f, j->data_threshold);
+
+        r = j->prefetch ? journal_prefetch_take(j->prefetch, f, p, j->data_threshold, &ci->buffer, &ci->buffer_size, &ci->size) : 0;
+        if (r < 0)
+                return r;
+
+        if (r == 0 &&
+            !uncompress_blob(compression,
+                             o->data.payload, l,
+                             &ci->buffer, &ci->buffer_size, &ci->size,
+                             j->data_threshold))
+                return -EBADMSG;
+
+        ci->offset = p;
+
+finish:
+        *data = ci->buffer;
+        *size = ci->size;
+        return 1;
+}
+#endif
+
 _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **data, size_t *size) {
         JournalFile *f;
         uint64_t i, n;
@@ -1827,21 +2449,22 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
 
                 l = le64toh(o->object.size) - offsetof(Object, data.payload);
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
+                if (o->object.flags & OBJECT_COMPRESSION_MASK) {
 
-#ifdef HAVE_XZ
-                        if (uncompress_startswith(o->data.payload, l,
-                                                  &f->compress_buffer, &f->compress_buffer_size,
-                                                  field, field_length, '=')) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+                        const void *d;
+                        uint64_t rsize;
 
-                                uint64_t rsize;
+                        r = uncompress_data(j, f, o, p, field, field_length, &d, &rsize);
+                        if (r < 0)
+                                return r;
 
-                                if (!uncompress_blob(o->data.payload, l,
-                                                     &f->compress_buffer, &f->compress_buffer_size, &rsize,
-                                                     j->data_threshold))
-                                        return -EBADMSG;
+                        if (r > 0 &&
+                            rsize > field_length &&
+                            memcmp(d, field, field_length) == 0 &&
+                            ((const char*) d)[field_length] == '=') {
 
-                                *data = f->compress_buffer;
+                                *data = d;
                                 *size = (size_t) rsize;
 
                                 return 0;
@@ -1873,7 +2496,7 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
         return -ENOENT;
 }
 
-static int return_data(sd_journal *j, JournalFile *f, Object *o, const void **data, size_t *size) {
+static int return_data(sd_journal *j, JournalFile *f, Object *o, uint64_t p, const void **data, size_t *size) {
         size_t t;
         uint64_t l;
 
@@ -1884,14 +2507,15 @@ static int return_data(sd_journal *j, JournalFile *f, Object *o, const void **da
         if ((uint64_t) t != l)
                 return -E2BIG;
 
-        if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
+        if (o->object.flags & OBJECT_COMPRESSION_MASK) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
                 uint64_t rsize;
+                int r;
 
-                if (!uncompress_blob(o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, j->data_threshold))
-                        return -EBADMSG;
+                r = uncompress_data(j, f, o, p, NULL, 0, data, &rsize);
+                if (r < 0)
+                        return r;
 
-                *data = f->compress_buffer;
                 *size = (size_t) rsize;
 #else
                 return -EPROTONOSUPPORT;
@@ -1942,7 +2566,7 @@ _public_ int sd_journal_enumerate_data(sd_journal *j, const void **data, size_t
         if (le_hash != o->data.hash)
                 return -EBADMSG;
 
-        r = return_data(j, f, o, data, size);
+        r = return_data(j, f, o, p, data, size);
         if (r < 0)
                 return r;
 
@@ -2177,6 +2801,18 @@ _public_ int sd_journal_wait(sd_journal *j, uint64_t timeout_usec) {
         if (r < 0)
                 return r;
 
+        /* Under heavy write load, let a few more writes pile up so
+         * that we wake up once for all of them, rather than once for
+         * each */
+        if (r > 0 && j->wait_latency_usec > 0) {
+                usec_t d = j->wait_latency_usec;
+
+                if (timeout_usec != (uint64_t) -1 && d > timeout_usec)
+                        d = timeout_usec;
+
+                usleep(d);
+        }
+
         return sd_journal_process(j);
 }
 
@@ -2275,6 +2911,16 @@ void journal_print_header(sd_journal *j) {
         }
 }
 
+int journal_get_mmap_cache_stats(sd_journal *j, MMapCacheStats *ret) {
+        if (!j)
+                return -EINVAL;
+        if (!ret)
+                return -EINVAL;
+
+        mmap_cache_get_stats(j->mmap, ret);
+        return 0;
+}
+
 _public_ int sd_journal_get_usage(sd_journal *j, uint64_t *bytes) {
         Iterator i;
         JournalFile *f;
@@ -2288,7 +2934,11 @@ _public_ int sd_journal_get_usage(sd_journal *j, uint64_t *bytes) {
         HASHMAP_FOREACH(f, j->files, i) {
                 struct stat st;
 
-                if (fstat(f->fd, &st) < 0)
+                /* Files whose fd was closed are archived, and
+                 * hence didn't change since we last looked */
+                if (f->fd < 0)
+                        st = f->last_stat;
+                else if (fstat(f->fd, &st) < 0)
                         return -errno;
 
                 sum += (uint64_t) st.st_blocks * 512ULL;
@@ -2298,6 +2948,101 @@ _public_ int sd_journal_get_usage(sd_journal *j, uint64_t *bytes) {
         return 0;
 }
 
+typedef struct UniqueValue {
+        uint64_t hash;
+        bool xxhash64;
+        uint64_t n_entries;
+} UniqueValue;
+
+static unsigned unique_value_hash_func(const void *p) {
+        const UniqueValue *v = p;
+
+        /* The hash is already the hash of the data */
+        return (unsigned) (v->hash ^ (v->hash >> 32));
+}
+
+static int unique_value_compare_func(const void *a, const void *b) {
+        const UniqueValue *x = a, *y = b;
+
+        if (x->hash < y->hash)
+                return -1;
+        if (x->hash > y->hash)
+                return 1;
+
+        return (int) x->xxhash64 - (int) y->xxhash64;
+}
+
+static void unique_values_reset(sd_journal *j) {
+        UniqueValue *v;
+
+        assert(j);
+
+        while ((v = hashmap_steal_first(j->unique_values)))
+                free(v);
+
+        j->unique_seen_xxhash64 = j->unique_seen_hash64 = false;
+}
+
+static UniqueValue *unique_value_get(sd_journal *j, uint64_t hash, bool xxhash64) {
+        UniqueValue k = {
+                .hash = hash,
+                .xxhash64 = xxhash64,
+        };
+
+        return hashmap_get(j->unique_values, &k);
+}
+
+static int unique_value_add(sd_journal *j, uint64_t hash, bool xxhash64, uint64_t n_entries) {
+        UniqueValue *v;
+        int r;
+
+        r = hashmap_ensure_allocated(&j->unique_values, unique_value_hash_func, unique_value_compare_func);
+        if (r < 0)
+                return r;
+
+        v = new0(UniqueValue, 1);
+        if (!v)
+                return -ENOMEM;
+
+        v->hash = hash;
+        v->xxhash64 = xxhash64;
+        v->n_entries = n_entries;
+
+        r = hashmap_put(j->unique_values, v, v);
+        if (r < 0) {
+                free(v);
+                return r;
+        }
+
+        return 0;
+}
+
+int journal_get_unique_n_entries(sd_journal *j, const void *data, size_t size, uint64_t *ret) {
+        UniqueValue *v;
+        uint64_t n = 0;
+
+        assert(j);
+        assert(data || size == 0);
+        assert(ret);
+
+        /* Only complete once sd_journal_enumerate_unique() reached
+         * the end */
+
+        v = unique_value_get(j, xxhash64(data, size, 0), true);
+        if (v)
+                n += v->n_entries;
+
+        v = unique_value_get(j, hash64(data, size), false);
+        if (v)
+                n += v->n_entries;
+
+        if (n <= 0)
+                return -ENOENT;
+
+        *ret = n;
+        return 0;
+}
+
 _public_ int sd_journal_query_unique(sd_journal *j, const char *field) {
         char *f;
 
@@ -2316,6 +3061,7 @@ _public_ int sd_journal_query_unique(sd_journal *j, const char *field) {
         j->unique_field = f;
         j->unique_file = NULL;
         j->unique_offset = 0;
+        unique_values_reset(j);
 
         return 0;
 }
@@ -2344,11 +3090,9 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
         }
 
         for (;;) {
-                JournalFile *of;
-                Iterator i;
-                const void *odata;
-                size_t ol;
-                bool found;
+                uint64_t hash, n_entries;
+                UniqueValue *v;
+                bool xx;
 
                 /* Proceed to next data object in the field's linked list */
                 if (j->unique_offset == 0) {
@@ -2357,6 +3101,11 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
                                 return r;
 
                         j->unique_offset = r > 0 ? le64toh(o->field.head_data_offset) : 0;
+
+                        if (JOURNAL_HEADER_XXHASH64(j->unique_file->header))
+                                j->unique_seen_xxhash64 = true;
+                        else
+                                j->unique_seen_hash64 = true;
                 } else {
                         r = journal_file_move_to_object(j->unique_file, OBJECT_DATA, j->unique_offset, &o);
                         if (r < 0)
@@ -2377,50 +3126,42 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
                         continue;
                 }
 
-                /* We do not use the type context here, but 0 instead,
-                 * so that we can look at this data object at the same
-                 * time as one on another file */
-                r = journal_file_move_to_object(j->unique_file, 0, j->unique_offset, &o);
+                r = journal_file_move_to_object(j->unique_file, OBJECT_DATA, j->unique_offset, &o);
                 if (r < 0)
                         return r;
 
-                /* Let's do the type check by hand, since we used 0 context above. */
-                if (o->object.type != OBJECT_DATA)
-                        return -EBADMSG;
+                /* Values we returned before are recognized by their
+                 * hash alone, so that neither the payload nor other
+                 * files need to be looked at. */
+                hash = le64toh(o->data.hash);
+                n_entries = le64toh(o->data.n_entries);
+                xx = JOURNAL_HEADER_XXHASH64(j->unique_file->header);
+
+                v = unique_value_get(j, hash, xx);
+                if (v) {
+                        v->n_entries += n_entries;
+                        continue;
+                }
 
-                r = return_data(j, j->unique_file, o, &odata, &ol);
+                r = return_data(j, j->unique_file, o, j->unique_offset, data, l);
                 if (r < 0)
                         return r;
 
-                /* OK, now let's see if we already returned this data
-                 * object by checking if it exists in the earlier
-                 * traversed files. */
-                found = false;
-                HASHMAP_FOREACH(of, j->files, i) {
-                        Object *oo;
-                        uint64_t op;
-
-                        if (of == j->unique_file)
-                                break;
+                /* Files using the other hash function might have had
+                 * this value already, but we can only tell by
+                 * hashing it ourselves */
+                if (xx ? j->unique_seen_hash64 : j->unique_seen_xxhash64) {
+                        v = unique_value_get(j, xx ? hash64(*data, *l) : xxhash64(*data, *l, 0), !xx);
+                        if (v) {
+                                r = unique_value_add(j, hash, xx, n_entries);
+                                if (r < 0)
+                                        return r;
 
-                        /* Skip this file it didn't have any fields
-                         * indexed */
-                        if (JOURNAL_HEADER_CONTAINS(of->header, n_fields) &&
-                            le64toh(of->header->n_fields) <= 0)
                                 continue;
-
-                        r = journal_file_find_data_object_with_hash(of, odata, ol, le64toh(o->data.hash), &oo, &op);
-                        if (r < 0)
-                                return r;
-
-                        if (r > 0)
-                                found = true;
+                        }
                 }
 
-                if (found)
-                        continue;
-
-                r = return_data(j, j->unique_file, o, data, l);
+                r = unique_value_add(j, hash, xx, n_entries);
                 if (r < 0)
                         return r;
 
@@ -2434,6 +3175,7 @@ _public_ void sd_journal_restart_unique(sd_journal *j) {
 
         j->unique_file = NULL;
         j->unique_offset = 0;
+        unique_values_reset(j);
 }
 
 _public_ int sd_journal_reliable_fd(sd_journal *j) {
@@ -2466,7 +3208,8 @@ _public_ int sd_journal_get_catalog(sd_journal *j, char **ret) {
         const void *data;
         size_t size;
         sd_id128_t id;
-        _cleanup_free_ char *text = NULL, *cid = NULL;
+        _cleanup_free_ char *cid = NULL;
+        const char *text;
         char *t;
         int r;
 
@@ -2487,7 +3230,13 @@ _public_ int sd_journal_get_catalog(sd_journal *j, char **ret) {
         if (r < 0)
                 return r;
 
-        r = catalog_get(CATALOG_DATABASE, id, &text);
+        if (!j->catalog) {
+                r = catalog_open(CATALOG_DATABASE, &j->catalog);
+                if (r < 0)
+                        return r;
+        }
+
+        r = catalog_lookup(j->catalog, id, &text);
         if (r < 0)
                 return r;
 
@@ -26,6 +26,7 @@
 #include <errno.h>
 
 #include "util.h"
+#include "fileio.h"
 #include "log.h"
 #include "macro.h"
 #include "sd-messages.h"
@@ -106,6 +107,52 @@ static void test_catalog_update(void) {
         assert(r >= 0);
 }
 
+static void test_catalog_lookup(void) {
+        char dir[] = "/tmp/test-catalog-dir.XXXXXX";
+        char name[] = "/tmp/test-catalog.XXXXXX";
+        _cleanup_free_ char *path = NULL, *text = NULL;
+        const char *dirs[] = { dir, NULL };
+        const char *a, *b;
+        sd_id128_t id = SD_ID128_MAKE(00,27,22,9c,a0,64,41,81,a7,6c,4e,92,45,8a,fa,ff);
+        Catalog *c;
+        int fd;
+
+        assert_se(mkdtemp(dir));
+        assert_se(path = strappend(dir, "/test.catalog"));
+        assert_se(write_string_file(path,
+                                    "-- 0027229ca0644181a76c4e92458afaff\n"
+                                    "Subject: message\n"
+                                    "\n"
+                                    "payload\n"
+                                    "\n"
+                                    "-- 0027229ca0644181a76c4e92458afaff de\n"
+                                    "Subject: Nachricht\n"
+                                    "\n"
+                                    "Inhalt\n") >= 0);
+
+        fd = mkstemp(name);
+        assert_se(fd >= 0);
+        close_nointr_nofail(fd);
+
+        assert_se(catalog_update(name, NULL, dirs) >= 0);
+
+        /* The cached lookup must agree with the one-shot one */
+        assert_se(catalog_get(name, id, &text) >= 0);
+        assert_se(catalog_open(name, &c) >= 0);
+        assert_se(catalog_lookup(c, id, &a) >= 0);
+        assert_se(streq(a, text));
+        assert_se(catalog_lookup(c, id, &b) >= 0);
+        assert_se(a == b);
+
+        assert_se(catalog_lookup(c, SD_MESSAGE_COREDUMP, &a) == -ENOENT);
+        assert_se(catalog_lookup(c, SD_MESSAGE_COREDUMP, &a) == -ENOENT);
+        catalog_close(c);
+
+        unlink(name);
+        unlink(path);
+        rmdir(dir);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_free_ char *text = NULL;
         int r;
@@ -118,6 +165,8 @@ int main(int argc, char *argv[]) {
 
         test_catalog_update();
 
+        test_catalog_lookup();
+
         r = catalog_list(stdout, database, true);
         assert_se(r >= 0);
 
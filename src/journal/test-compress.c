@@ -0,0 +1,105 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "compress.h"
+
+static void test_compress_uncompress(int compression) {
+        char text[] = "text\0foofoofoofoo AAAAAAAAAAAAAAAAAAAAAAAA aaaaaaaaaaaaaaaaaaaaaaaa"
+                      "foofoofoofoo AAAAAAAAAAAAAAAAAAAAAAAA aaaaaaaaaaaaaaaaaaaaaaaa";
+        char random[64];
+        char compressed[sizeof(text)];
+        void *decompressed = NULL;
+        uint64_t csize, usize, dsize = 0;
+        unsigned i;
+
+        log_info("/* testing %s compression */", object_compressed_to_string(compression));
+
+        assert_se(compress_blob(compression, text, sizeof(text), compressed, &csize));
+        assert_se(csize < sizeof(text));
+
+        assert_se(uncompress_blob(compression, compressed, csize, &decompressed, &dsize, &usize, 0));
+        assert_se(usize == sizeof(text));
+        assert_se(memcmp(decompressed, text, sizeof(text)) == 0);
+
+        assert_se(!uncompress_blob(compression, "garbage", 7, &decompressed, &dsize, &usize, 0));
+
+        /* With dst_max only the beginning is returned */
+        assert_se(uncompress_blob(compression, compressed, csize, &decompressed, &dsize, &usize, 4));
+        assert_se(usize == 4);
+        assert_se(memcmp(decompressed, "text", 4) == 0);
+
+        assert_se(uncompress_startswith(compression, compressed, csize, &decompressed, &dsize, "text", 4, '\0'));
+        assert_se(!uncompress_startswith(compression, compressed, csize, &decompressed, &dsize, "text", 4, 'X'));
+        assert_se(!uncompress_startswith(compression, compressed, csize, &decompressed, &dsize, "sometext", 8, '\0'));
+
+        /* Data that doesn't get any shorter must be refused */
+        for (i = 0; i < sizeof(random); i++)
+                random[i] = (char) random_ull();
+        assert_se(!compress_blob(compression, random, sizeof(random), compressed, &csize));
+
+        free(decompressed);
+}
+
+#ifdef HAVE_LZ4
+static void test_lz4_size_header(void) {
+        char text[] = "foofoofoofoo AAAAAAAAAAAAAAAAAAAAAAAA aaaaaaaaaaaaaaaaaaaaaaaa";
+        char compressed[sizeof(text)];
+        void *decompressed = NULL;
+        uint64_t csize, usize, dsize = 0;
+        le64_t h;
+
+        assert_se(compress_blob_lz4(text, sizeof(text), compressed, &csize));
+
+        /* A blob claiming to be huge must not make us allocate more
+         * than the caller allows */
+        h = htole64(0x7000000);
+        memcpy(compressed, &h, sizeof(h));
+        uncompress_blob_lz4(compressed, csize, &decompressed, &dsize, &usize, sizeof(text));
+        assert_se(dsize <= sizeof(text) + 1);
+
+        free(decompressed);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(streq_ptr(object_compressed_to_string(OBJECT_COMPRESSED_XZ), "xz"));
+        assert_se(streq_ptr(object_compressed_to_string(OBJECT_COMPRESSED_LZ4), "lz4"));
+        assert_se(object_compressed_from_string("lz4") == OBJECT_COMPRESSED_LZ4);
+        assert_se(object_compressed_from_string("foo") < 0);
+
+        assert_se(compression_default() == 0 || compression_supported(compression_default()));
+
+#ifdef HAVE_XZ
+        test_compress_uncompress(OBJECT_COMPRESSED_XZ);
+#endif
+#ifdef HAVE_LZ4
+        test_compress_uncompress(OBJECT_COMPRESSED_LZ4);
+        test_lz4_size_header();
+#endif
+
+        return 0;
+}
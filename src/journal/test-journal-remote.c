@@ -0,0 +1,210 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "compress.h"
+#include "journal-remote-protocol.h"
+
+static void test_parse_entry(void) {
+        char buf[] =
+                "__CURSOR=s=1;i=2\n"
+                "__REALTIME_TIMESTAMP=1000\n"
+                "__MONOTONIC_TIMESTAMP=2000\n"
+                "_BOOT_ID=0123456789abcdef0123456789abcdef\n"
+                "MESSAGE=hello\n"
+                "BINARY\n"
+                "\003\0\0\0\0\0\0\0a\nb\n"
+                "\n"
+                "__REALTIME_TIMESTAMP=3000\n"
+                "MESSAGE=again\n"
+                "\n";
+        JournalRemoteEntry e = {};
+        size_t consumed, offset;
+
+        assert_se(journal_remote_parse_entry(buf, sizeof(buf) - 1, &consumed, &e) == 1);
+        assert_se(e.ts.realtime == 1000);
+        assert_se(e.ts.monotonic == 2000);
+        assert_se(streq(sd_id128_to_string(e.boot_id, (char[33]) {}), "0123456789abcdef0123456789abcdef"));
+
+        /* The cursor and timestamps are dropped, the boot ID kept */
+        assert_se(e.n_iovec == 3);
+        assert_se(e.iovec[0].iov_len == 41);
+        assert_se(e.iovec[1].iov_len == 13 && memcmp(e.iovec[1].iov_base, "MESSAGE=hello", 13) == 0);
+        assert_se(e.iovec[2].iov_len == 10 && memcmp(e.iovec[2].iov_base, "BINARY=a\nb", 10) == 0);
+
+        offset = consumed;
+        assert_se(journal_remote_parse_entry(buf + offset, sizeof(buf) - 1 - offset, &consumed, &e) == 1);
+        assert_se(e.ts.realtime == 3000);
+        assert_se(e.ts.monotonic == 0);
+        assert_se(sd_id128_equal(e.boot_id, SD_ID128_NULL));
+        assert_se(e.n_iovec == 1);
+
+        offset += consumed;
+        assert_se(offset == sizeof(buf) - 1);
+        assert_se(journal_remote_parse_entry(buf + offset, 0, &consumed, &e) == 0);
+
+        journal_remote_entry_done(&e);
+}
+
+static void test_parse_invalid(const char *s, size_t size) {
+        _cleanup_free_ char *buf = NULL;
+        JournalRemoteEntry e = {};
+        size_t consumed;
+
+        buf = memdup(s, size);
+        assert_se(buf);
+
+        assert_se(journal_remote_parse_entry(buf, size, &consumed, &e) < 0);
+
+        journal_remote_entry_done(&e);
+}
+
+static void test_frames(int compression) {
+        JournalRemoteFrame f = {};
+        char data[4096];
+        unsigned i;
+        int fds[2];
+
+        log_info("/* testing frames with compression %i */", compression);
+
+        for (i = 0; i < sizeof(data); i++)
+                data[i] = 'a' + i % 7;
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fds) >= 0);
+
+        assert_se(journal_remote_send_frame(fds[0], JOURNAL_REMOTE_ENTRIES, 7, compression, data, sizeof(data)) == 0);
+        assert_se(journal_remote_send_frame(fds[0], JOURNAL_REMOTE_ACK, 8, compression, NULL, 0) == 0);
+        close_nointr_nofail(fds[0]);
+
+        assert_se(journal_remote_recv_frame(fds[1], &f) == 1);
+        assert_se(f.type == JOURNAL_REMOTE_ENTRIES);
+        assert_se(f.seqnum == 7);
+        assert_se(f.size == sizeof(data));
+        assert_se(memcmp(f.data, data, sizeof(data)) == 0);
+
+        assert_se(journal_remote_recv_frame(fds[1], &f) == 1);
+        assert_se(f.type == JOURNAL_REMOTE_ACK);
+        assert_se(f.seqnum == 8);
+        assert_se(f.size == 0);
+
+        assert_se(journal_remote_recv_frame(fds[1], &f) == 0);
+
+        close_nointr_nofail(fds[1]);
+        journal_remote_frame_done(&f);
+}
+
+static void test_frame_invalid(void) {
+        JournalRemoteFrameHeader h = {};
+        JournalRemoteFrame f = {};
+        int fds[2];
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fds) >= 0);
+
+        /* Claims more than the peer sends before hanging up */
+        memcpy(h.signature, JOURNAL_REMOTE_SIGNATURE, sizeof(h.signature));
+        h.type = htole32(JOURNAL_REMOTE_ENTRIES);
+        h.size = h.uncompressed_size = htole64(100);
+        assert_se(write(fds[0], &h, sizeof(h)) == sizeof(h));
+        assert_se(write(fds[0], "x", 1) == 1);
+        close_nointr_nofail(fds[0]);
+
+        assert_se(journal_remote_recv_frame(fds[1], &f) == -EPIPE);
+        close_nointr_nofail(fds[1]);
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fds) >= 0);
+
+        h.size = h.uncompressed_size = htole64(JOURNAL_REMOTE_PAYLOAD_MAX + 1);
+        assert_se(write(fds[0], &h, sizeof(h)) == sizeof(h));
+        assert_se(journal_remote_recv_frame(fds[1], &f) == -EBADMSG);
+
+        close_nointr_nofail(fds[0]);
+        close_nointr_nofail(fds[1]);
+        journal_remote_frame_done(&f);
+}
+
+static void test_frame_size_mismatch(int compression) {
+        JournalRemoteFrameHeader h = {};
+        JournalRemoteFrame f = {};
+        char data[4096], compressed[sizeof(data)];
+        uint64_t csize;
+        unsigned i;
+        int fds[2];
+
+        for (i = 0; i < sizeof(data); i++)
+                data[i] = 'a' + i / 512;
+        assert_se(compress_blob(compression, data, sizeof(data), compressed, &csize));
+
+        /* Announces less than the blob uncompresses to */
+        memcpy(h.signature, JOURNAL_REMOTE_SIGNATURE, sizeof(h.signature));
+        h.type = htole32(JOURNAL_REMOTE_ENTRIES);
+        h.compression = htole32(compression);
+        h.size = htole64(csize);
+        h.uncompressed_size = htole64(100);
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fds) >= 0);
+        assert_se(write(fds[0], &h, sizeof(h)) == sizeof(h));
+        assert_se(write(fds[0], compressed, csize) == (ssize_t) csize);
+
+        assert_se(journal_remote_recv_frame(fds[1], &f) == -EBADMSG);
+#ifdef HAVE_LZ4
+        /* LZ4 blobs are refused before anything is allocated */
+        if (compression == OBJECT_COMPRESSED_LZ4)
+                assert_se(f.allocated == 0);
+#endif
+
+        close_nointr_nofail(fds[0]);
+        close_nointr_nofail(fds[1]);
+        journal_remote_frame_done(&f);
+}
+
+int main(int argc, char *argv[]) {
+        log_set_max_level(LOG_DEBUG);
+
+        test_parse_entry();
+
+        /* No timestamp */
+        test_parse_invalid("MESSAGE=foo\n\n", 13);
+        /* Not terminated */
+        test_parse_invalid("__REALTIME_TIMESTAMP=1\nMESSAGE=foo\n", 35);
+        /* Binary field longer than the buffer */
+        test_parse_invalid("__REALTIME_TIMESTAMP=1\nB\n\377\0\0\0\0\0\0\0a\n\n", 37);
+        /* Invalid field name */
+        test_parse_invalid("__REALTIME_TIMESTAMP=1\nfoo=bar\n\n", 32);
+
+        test_frames(0);
+#ifdef HAVE_XZ
+        test_frames(OBJECT_COMPRESSED_XZ);
+        test_frame_size_mismatch(OBJECT_COMPRESSED_XZ);
+#endif
+#ifdef HAVE_LZ4
+        test_frames(OBJECT_COMPRESSED_LZ4);
+        test_frame_size_mismatch(OBJECT_COMPRESSED_LZ4);
+#endif
+
+        test_frame_invalid();
+
+        return 0;
+}
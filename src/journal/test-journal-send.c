@@ -59,6 +59,25 @@ int main(int argc, char *argv[]) {
                         "WITH_BINARY=this is a binary value \a",
                         NULL);
 
+        {
+                struct iovec a[2], b[1], c[2];
+                const struct iovec *entries[] = { a, b, c };
+                const int n[] = { ELEMENTSOF(a), ELEMENTSOF(b), ELEMENTSOF(c) };
+
+                IOVEC_SET_STRING(a[0], "MESSAGE=First of a batch");
+                IOVEC_SET_STRING(a[1], "VALUE=1");
+                IOVEC_SET_STRING(b[0], "MESSAGE=Second of a batch");
+                IOVEC_SET_STRING(c[0], "MESSAGE=Huge one in a batch");
+                IOVEC_SET_STRING(c[1], huge);
+
+                sd_journal_sendv_batch(entries, n, ELEMENTSOF(entries));
+
+                /* A bad entry holds up the whole batch */
+                IOVEC_SET_STRING(b[0], "nofield");
+                assert_se(sd_journal_sendv_batch(entries, n, ELEMENTSOF(entries)) == -EINVAL);
+                assert_se(sd_journal_sendv_batch(entries, n, 0) == 0);
+        }
+
         syslog(LOG_NOTICE, "Hello World!");
 
         sd_journal_print(LOG_NOTICE, "Hello World");
@@ -25,12 +25,27 @@
 #include <systemd/sd-journal.h>
 
 #include "journal-file.h"
+#include "compress.h"
 #include "journal-internal.h"
 #include "util.h"
 #include "log.h"
 
 #define N_ENTRIES 200
 
+/* Large enough to end up compressed */
+static char *make_blob(unsigned i) {
+        char *b, *p;
+        unsigned k;
+
+        assert_se(b = malloc(5 + 64 * 16 + 1));
+
+        p = stpcpy(b, "BLOB=");
+        for (k = 0; k < 64; k++)
+                p += sprintf(p, "%08u-%07u", i, k);
+
+        return b;
+}
+
 static void verify_contents(sd_journal *j, unsigned skip) {
         unsigned i;
 
@@ -55,9 +70,29 @@ static void verify_contents(sd_journal *j, unsigned skip) {
                 printf("\t%s\n", k);
 
                 if (skip > 0) {
+                        char _cleanup_free_ *b = NULL;
+                        size_t threshold;
+
                         assert_se(safe_atou(k + 7, &u) >= 0);
                         assert_se(i == u);
                         i += skip;
+
+                        b = make_blob(u);
+                        assert_se(sd_journal_get_data(j, "BLOB", &d, &l) >= 0);
+                        assert_se(l == strlen(b));
+                        assert_se(memcmp(d, b, l) == 0);
+
+                        /* A truncated copy must not be handed out
+                         * once we want all of it */
+                        assert_se(sd_journal_get_data_threshold(j, &threshold) >= 0);
+                        assert_se(sd_journal_set_data_threshold(j, 64) >= 0);
+                        assert_se(sd_journal_get_data(j, "BLOB", &d, &l) >= 0);
+                        assert_se(l >= 64 && l <= strlen(b));
+                        assert_se(memcmp(d, b, l) == 0);
+                        assert_se(sd_journal_set_data_threshold(j, threshold) >= 0);
+                        assert_se(sd_journal_get_data(j, "BLOB", &d, &l) >= 0);
+                        assert_se(l == strlen(b));
+                        assert_se(memcmp(d, b, l) == 0);
                 }
 
                 free(k);
@@ -71,6 +106,251 @@ static void verify_contents(sd_journal *j, unsigned skip) {
                 assert_se(i == N_ENTRIES);
 }
 
+static unsigned current_number(sd_journal *j) {
+        const void *d;
+        size_t l;
+        char *k;
+        unsigned u;
+
+        assert_se(sd_journal_get_data(j, "NUMBER", &d, &l) >= 0);
+        assert_se(k = strndup(d, l));
+        assert_se(safe_atou(k + 7, &u) >= 0);
+        free(k);
+
+        return u;
+}
+
+static void verify_zigzag(sd_journal *j) {
+        unsigned i;
+
+        assert(j);
+
+        /* Changing direction in the middle must neither skip nor
+         * repeat entries, regardless which files they come from */
+        assert_se(sd_journal_seek_head(j) >= 0);
+
+        for (i = 0; i < N_ENTRIES / 2; i++) {
+                assert_se(sd_journal_next(j) > 0);
+                assert_se(current_number(j) == i);
+        }
+
+        for (i = N_ENTRIES / 2 - 1; i > N_ENTRIES / 4; i--) {
+                assert_se(sd_journal_previous(j) > 0);
+                assert_se(current_number(j) == i - 1);
+        }
+
+        for (i = N_ENTRIES / 4 + 1; i < N_ENTRIES; i++) {
+                assert_se(sd_journal_next(j) > 0);
+                assert_se(current_number(j) == i);
+        }
+
+        assert_se(sd_journal_next(j) == 0);
+}
+
+static void verify_seek_cursor(sd_journal *j) {
+        char _cleanup_free_ *c = NULL, *broken = NULL;
+        char *o;
+        unsigned i;
+
+        assert(j);
+
+        /* Seeking to a cursor must find the entry again, both via the
+         * offset hint and, if that points elsewhere, by bisection */
+        assert_se(sd_journal_seek_head(j) >= 0);
+        for (i = 0; i <= N_ENTRIES / 3; i++)
+                assert_se(sd_journal_next(j) > 0);
+        assert_se(sd_journal_get_cursor(j, &c) >= 0);
+
+        assert_se(sd_journal_seek_cursor(j, c) >= 0);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(sd_journal_test_cursor(j, c) > 0);
+        assert_se(current_number(j) == N_ENTRIES / 3);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(current_number(j) == N_ENTRIES / 3 + 1);
+
+        assert_se(sd_journal_seek_cursor(j, c) >= 0);
+        assert_se(sd_journal_previous(j) > 0);
+        assert_se(current_number(j) == N_ENTRIES / 3);
+
+        assert_se(broken = strdup(c));
+        assert_se(o = strstr(broken, ";o="));
+        o[3] = o[3] == '1' ? '2' : '1';
+
+        assert_se(sd_journal_seek_cursor(j, broken) >= 0);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(sd_journal_test_cursor(j, c) > 0);
+        assert_se(current_number(j) == N_ENTRIES / 3);
+}
+
+static void append_number(JournalFile *f, unsigned i) {
+        char s[32];
+        struct iovec iovec;
+        dual_timestamp ts;
+
+        dual_timestamp_get(&ts);
+        snprintf(s, sizeof(s), "NUMBER=%u", i);
+        iovec.iov_base = s;
+        iovec.iov_len = strlen(s);
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+}
+
+static void test_follow(void) {
+        char t[] = "/tmp/journal-follow-XXXXXX";
+        sd_journal _cleanup_journal_close_ *j = NULL;
+        JournalFile *a, *b;
+        char *p;
+
+        /* Files that found nothing new once are only looked at again
+         * when they grew */
+        assert_se(mkdtemp(t));
+
+        assert_se(asprintf(&p, "%s/a.journal", t) >= 0);
+        assert_se(journal_file_open(p, O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &a) == 0);
+        free(p);
+        assert_se(asprintf(&p, "%s/b.journal", t) >= 0);
+        assert_se(journal_file_open(p, O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &b) == 0);
+        free(p);
+
+        append_number(a, 0);
+        append_number(b, 1);
+
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(current_number(j) == 0);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(current_number(j) == 1);
+        assert_se(sd_journal_next(j) == 0);
+        assert_se(sd_journal_next(j) == 0);
+
+        append_number(a, 2);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(current_number(j) == 2);
+        assert_se(sd_journal_next(j) == 0);
+
+        append_number(b, 3);
+        append_number(a, 4);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(current_number(j) == 3);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(current_number(j) == 4);
+        assert_se(sd_journal_next(j) == 0);
+
+        /* Going back must see everything again */
+        assert_se(sd_journal_previous(j) > 0);
+        assert_se(current_number(j) == 3);
+        assert_se(sd_journal_previous(j) > 0);
+        assert_se(current_number(j) == 2);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(current_number(j) == 3);
+
+        journal_file_close(a);
+        journal_file_close(b);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+}
+
+static void test_unique_mixed_hash(void) {
+        char t[] = "/tmp/journal-unique-XXXXXX";
+        sd_journal _cleanup_journal_close_ *j = NULL;
+        JournalFile *f;
+        dual_timestamp ts;
+        struct iovec iovec;
+        const void *data;
+        size_t l;
+        char s[32];
+        unsigned i, n;
+        uint64_t u;
+
+        /* Values must be recognized across files that use different
+         * hash functions, too */
+        assert_se(mkdtemp(t));
+
+        for (n = 0; n < 2; n++) {
+                char _cleanup_free_ *p = NULL;
+
+                assert_se(setenv("SYSTEMD_JOURNAL_XXHASH64", n ? "1" : "0", 1) >= 0);
+                assert_se(asprintf(&p, "%s/%u.journal", t, n) >= 0);
+                assert_se(journal_file_open(p, O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+
+                dual_timestamp_get(&ts);
+                for (i = n * 5; i < n * 5 + 10; i++) {
+                        snprintf(s, sizeof(s), "UNIQUE=%u", i);
+                        iovec.iov_base = s;
+                        iovec.iov_len = strlen(s);
+                        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+                }
+
+                journal_file_close(f);
+        }
+
+        assert_se(unsetenv("SYSTEMD_JOURNAL_XXHASH64") >= 0);
+
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+        assert_se(sd_journal_query_unique(j, "UNIQUE") >= 0);
+
+        n = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+                n++;
+        assert_se(n == 15);
+
+        assert_se(journal_get_unique_n_entries(j, "UNIQUE=7", 8, &u) >= 0);
+        assert_se(u == 2);
+        assert_se(journal_get_unique_n_entries(j, "UNIQUE=2", 8, &u) >= 0);
+        assert_se(u == 1);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+}
+
+static void test_fd_limit(void) {
+        char t[] = "/tmp/journal-fd-limit-XXXXXX";
+        sd_journal _cleanup_journal_close_ *j = NULL;
+        JournalFile *f[3];
+        unsigned i, n;
+
+        /* Archived files beyond the limit have their fd closed, and
+         * must be reopened transparently when iterated over */
+        assert_se(mkdtemp(t));
+
+        for (n = 0; n < ELEMENTSOF(f); n++) {
+                char _cleanup_free_ *p = NULL;
+
+                assert_se(asprintf(&p, "%s/%u.journal", t, n) >= 0);
+                assert_se(journal_file_open(p, O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f[n]) == 0);
+        }
+
+        for (i = 0; i < 30; i++)
+                append_number(f[i % ELEMENTSOF(f)], i);
+
+        for (n = 0; n < ELEMENTSOF(f); n++) {
+                char _cleanup_free_ *p = NULL;
+
+                assert_se(journal_file_rotate(&f[n], 0, false) >= 0);
+                assert_se(p = strdup(f[n]->path));
+                journal_file_close(f[n]);
+                assert_se(unlink(p) >= 0);
+        }
+
+        assert_se(setenv("SYSTEMD_JOURNAL_FILES_OPEN_MAX", "1", 1) >= 0);
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+        assert_se(unsetenv("SYSTEMD_JOURNAL_FILES_OPEN_MAX") >= 0);
+        assert_se(j->fd_limit.n_open == 1);
+
+        for (i = 0; i < 30; i++) {
+                assert_se(sd_journal_next(j) > 0);
+                assert_se(current_number(j) == i);
+                assert_se(j->fd_limit.n_open == 1);
+        }
+        assert_se(sd_journal_next(j) == 0);
+
+        assert_se(sd_journal_add_match(j, "NUMBER=17", 0) >= 0);
+        assert_se(sd_journal_seek_head(j) >= 0);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(current_number(j) == 17);
+        assert_se(sd_journal_next(j) == 0);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+}
+
 int main(int argc, char *argv[]) {
         JournalFile *one, *two, *three;
         char t[] = "/tmp/journal-stream-XXXXXX";
@@ -79,23 +359,31 @@ int main(int argc, char *argv[]) {
         char *z;
         const void *data;
         size_t l;
+        uint64_t u, middle = 0, last = 0;
 
         log_set_max_level(LOG_DEBUG);
 
         assert_se(mkdtemp(t));
         assert_se(chdir(t) >= 0);
 
-        assert_se(journal_file_open("one.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &one) == 0);
-        assert_se(journal_file_open("two.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &two) == 0);
-        assert_se(journal_file_open("three.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &three) == 0);
+        assert_se(journal_file_open("one.journal", O_RDWR|O_CREAT, 0666, compression_default(), false, NULL, NULL, NULL, &one) == 0);
+        assert_se(journal_file_open("two.journal", O_RDWR|O_CREAT, 0666, compression_default(), false, NULL, NULL, NULL, &two) == 0);
+        assert_se(journal_file_open("three.journal", O_RDWR|O_CREAT, 0666, compression_default(), false, NULL, NULL, NULL, &three) == 0);
 
         for (i = 0; i < N_ENTRIES; i++) {
-                char *p, *q;
+                char *p, *q, *b;
                 dual_timestamp ts;
-                struct iovec iovec[2];
+                struct iovec iovec[3];
 
                 dual_timestamp_get(&ts);
 
+                /* Make sure the timestamps differ */
+                if (ts.realtime <= last)
+                        ts.realtime = last + 1;
+                last = ts.realtime;
+                if (i == N_ENTRIES / 2)
+                        middle = ts.realtime;
+
                 assert_se(asprintf(&p, "NUMBER=%u", i) >= 0);
                 iovec[0].iov_base = p;
                 iovec[0].iov_len = strlen(p);
@@ -105,17 +393,22 @@ int main(int argc, char *argv[]) {
                 iovec[1].iov_base = q;
                 iovec[1].iov_len = strlen(q);
 
+                b = make_blob(i);
+                iovec[2].iov_base = b;
+                iovec[2].iov_len = strlen(b);
+
                 if (i % 10 == 0)
-                        assert_se(journal_file_append_entry(three, &ts, iovec, 2, NULL, NULL, NULL) == 0);
+                        assert_se(journal_file_append_entry(three, &ts, iovec, 3, NULL, NULL, NULL) == 0);
                 else {
                         if (i % 3 == 0)
-                                assert_se(journal_file_append_entry(two, &ts, iovec, 2, NULL, NULL, NULL) == 0);
+                                assert_se(journal_file_append_entry(two, &ts, iovec, 3, NULL, NULL, NULL) == 0);
 
-                        assert_se(journal_file_append_entry(one, &ts, iovec, 2, NULL, NULL, NULL) == 0);
+                        assert_se(journal_file_append_entry(one, &ts, iovec, 3, NULL, NULL, NULL) == 0);
                 }
 
                 free(p);
                 free(q);
+                free(b);
         }
 
         journal_file_close(one);
@@ -148,6 +441,23 @@ int main(int argc, char *argv[]) {
         sd_journal_flush_matches(j);
 
         verify_contents(j, 1);
+        verify_zigzag(j);
+        verify_seek_cursor(j);
+
+        /* Seeking by time must find the right entry, even though
+         * some files end before that point in time */
+        assert_se(sd_journal_seek_realtime_usec(j, middle) >= 0);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(sd_journal_get_realtime_usec(j, &u) >= 0);
+        assert_se(u >= middle);
+        assert_se(sd_journal_get_data(j, "NUMBER", &data, &l) >= 0);
+        printf("seeked to %.*s\n", (int) l, (const char*) data);
+        assert_se(sd_journal_previous(j) > 0);
+        assert_se(sd_journal_get_realtime_usec(j, &u) >= 0);
+        assert_se(u < middle);
+
+        assert_se(sd_journal_seek_realtime_usec(j, last + 1) >= 0);
+        assert_se(sd_journal_next(j) == 0);
 
         printf("NEXT TEST\n");
         assert_se(sd_journal_add_match(j, "MAGIC=quux", 0) >= 0);
@@ -172,10 +482,41 @@ int main(int argc, char *argv[]) {
         verify_contents(j, 0);
 
         assert_se(sd_journal_query_unique(j, "NUMBER") >= 0);
-        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+        i = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l) {
                 printf("%.*s\n", (int) l, (const char*) data);
+                i++;
+        }
+        assert_se(i == N_ENTRIES);
+
+        /* Entries that went to two files are counted twice */
+        assert_se(journal_get_unique_n_entries(j, "NUMBER=3", 8, &u) >= 0);
+        assert_se(u == 2);
+        assert_se(journal_get_unique_n_entries(j, "NUMBER=10", 9, &u) >= 0);
+        assert_se(u == 1);
+        assert_se(journal_get_unique_n_entries(j, "NUMBER=4711", 11, &u) == -ENOENT);
+
+        /* Enumerating again must not skip what we saw before */
+        sd_journal_restart_unique(j);
+        i = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+                i++;
+        assert_se(i == N_ENTRIES);
+
+        /* Reading with worker threads decompressing ahead of us must
+         * not make a difference */
+        sd_journal_close(j);
+        assert_se(sd_journal_open_directory(&j, t, SD_JOURNAL_PARALLEL) >= 0);
+        verify_contents(j, 1);
+        verify_zigzag(j);
+        verify_seek_cursor(j);
+        verify_contents(j, 1);
 
         assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
 
+        test_unique_mixed_hash();
+        test_fd_limit();
+        test_follow();
+
         return 0;
 }
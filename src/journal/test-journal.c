@@ -21,18 +21,554 @@
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 #include <systemd/sd-journal.h>
 
 #include "log.h"
 #include "journal-file.h"
+#include "compress.h"
 #include "journal-authenticate.h"
 #include "journal-vacuum.h"
+#include "journal-verify.h"
+#include "journal-grep.h"
+#include "lookup3.h"
+#include "xxhash64.h"
+
+static void test_entry_array_index(void) {
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec[2];
+        static const char all[] = "INDEX=all", odd[] = "INDEX=odd";
+        uint64_t all_offset, odd_offset, p, s;
+        Object *o;
+        unsigned n;
+
+        assert_se(journal_file_open("index.journal", O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header));
+
+        /* Enough entries for both data objects to get an indexed
+         * entry array chain */
+        iovec[0].iov_base = (void*) all;
+        iovec[0].iov_len = strlen(all);
+        iovec[1].iov_base = (void*) odd;
+        iovec[1].iov_len = strlen(odd);
+        for (s = 1; s <= 3000; s++) {
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, iovec, s % 2 ? 2 : 1, NULL, NULL, NULL) == 0);
+        }
+
+        assert_se(journal_file_find_data_object(f, all, strlen(all), NULL, &all_offset) == 1);
+        assert_se(journal_file_find_data_object(f, odd, strlen(odd), NULL, &odd_offset) == 1);
+
+        for (s = 1; s <= 3000; s += 97) {
+                hashmap_clear_free(f->chain_cache);
+                assert_se(journal_file_move_to_entry_by_seqnum_for_data(f, all_offset, s, DIRECTION_DOWN, &o, NULL) == 1);
+                assert_se(le64toh(o->entry.seqnum) == s);
+
+                hashmap_clear_free(f->chain_cache);
+                assert_se(journal_file_move_to_entry_by_seqnum_for_data(f, odd_offset, s, DIRECTION_DOWN, &o, NULL) == 1);
+                assert_se(le64toh(o->entry.seqnum) == (s % 2 ? s : s + 1));
+
+                hashmap_clear_free(f->chain_cache);
+                assert_se(journal_file_move_to_entry_by_seqnum_for_data(f, odd_offset, s, DIRECTION_UP, &o, NULL) == 1);
+                assert_se(le64toh(o->entry.seqnum) == (s % 2 ? s : s - 1));
+        }
+
+        hashmap_clear_free(f->chain_cache);
+        assert_se(journal_file_move_to_entry_by_seqnum_for_data(f, odd_offset, 3000, DIRECTION_DOWN, &o, NULL) == 0);
+
+        n = 0;
+        o = NULL;
+        p = 0;
+        while (journal_file_next_entry_for_data(f, o, p, odd_offset, DIRECTION_DOWN, &o, &p) > 0) {
+                assert_se(le64toh(o->entry.seqnum) == 2 * n + 1);
+                n++;
+        }
+        assert_se(n == 1500);
+
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+
+        journal_file_close(f);
+}
+
+static void test_bisect_full_array(void) {
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec[2];
+        static const char foo[] = "UNIT=foo", bar[] = "UNIT=bar";
+        uint64_t foo_offset, last, s;
+        Object *o;
+
+        assert_se(journal_file_open("bisect.journal", O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        /* One entry inline in the data object and four in its first
+         * entry array, which is thus used up exactly */
+        for (s = 1; s <= 20; s++) {
+                dual_timestamp_get(&ts);
+                IOVEC_SET_STRING(iovec[0], "MESSAGE=bisect");
+                IOVEC_SET_STRING(iovec[1], s <= 5 ? foo : bar);
+                assert_se(journal_file_append_entry(f, &ts, iovec, 2, NULL, NULL, &last) == 0);
+        }
+
+        assert_se(journal_file_find_data_object(f, foo, strlen(foo), NULL, &foo_offset) == 1);
+
+        /* Going up from beyond the last entry finds the last entry */
+        assert_se(journal_file_move_to_entry_by_offset_for_data(f, foo_offset, last, DIRECTION_UP, &o, NULL) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 5);
+
+        hashmap_clear_free(f->chain_cache);
+        assert_se(journal_file_move_to_entry_by_seqnum_for_data(f, foo_offset, 20, DIRECTION_UP, &o, NULL) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 5);
+
+        assert_se(journal_file_move_to_entry_by_offset_for_data(f, foo_offset, last, DIRECTION_DOWN, &o, NULL) == 0);
+
+        journal_file_close(f);
+}
+
+static void test_hash_table_size(void) {
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        char data[32];
+        uint64_t n_data;
+        unsigned i;
+
+        assert_se(journal_file_open("hash.journal", O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(le64toh(f->header->data_hash_table_size) == 2047 * sizeof(HashItem));
+
+        dual_timestamp_get(&ts);
+        for (i = 0; i < 5000; i++) {
+                snprintf(data, sizeof(data), "UNIQUE=%u", i);
+                iovec.iov_base = data;
+                iovec.iov_len = strlen(data);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        n_data = le64toh(f->header->n_data);
+        assert_se(le64toh(f->header->data_hash_chain_depth) > 1);
+
+        /* The successor should be sized after what we stored */
+        assert_se(journal_file_rotate(&f, 0, false) >= 0);
+        assert_se(le64toh(f->header->data_hash_table_size) >= n_data * 4 / 3 * sizeof(HashItem));
+        assert_se(le64toh(f->header->field_hash_table_size) == 333 * sizeof(HashItem));
+
+        journal_file_close(f);
+}
+
+static void test_hash_function(void) {
+        static const char test[] = "HASH=1";
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        uint64_t p;
+        Object *o;
+        unsigned xx;
+
+        dual_timestamp_get(&ts);
+        iovec.iov_base = (void*) test;
+        iovec.iov_len = strlen(test);
+
+        for (xx = 0; xx <= 1; xx++) {
+                assert_se(setenv("SYSTEMD_JOURNAL_XXHASH64", xx ? "1" : "0", 1) >= 0);
+                assert_se(journal_file_open(xx ? "xxhash64.journal" : "hash64.journal", O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+                assert_se(JOURNAL_HEADER_XXHASH64(f->header) == !!xx);
+
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+                assert_se(journal_file_find_data_object(f, test, strlen(test), &o, &p) == 1);
+                assert_se(le64toh(o->data.hash) == (xx ? xxhash64(test, strlen(test), 0) : hash64(test, strlen(test))));
+                assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+
+                journal_file_close(f);
+        }
+
+        assert_se(unsetenv("SYSTEMD_JOURNAL_XXHASH64") >= 0);
+}
+
+static unsigned count_archived(const char *directory) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        unsigned n = 0;
+
+        d = opendir(directory);
+        assert_se(d);
+
+        while ((de = readdir(d)))
+                if (startswith(de->d_name, "vacuum@"))
+                        n++;
+
+        return n;
+}
+
+/* Returns the path of the archived file in the directory, which
+ * belongs to the journal file named like the directory */
+static char *find_archived(const char *directory) {
+        _cleanup_closedir_ DIR *d = NULL;
+        char _cleanup_free_ *prefix = NULL;
+        struct dirent *de;
+        char *path = NULL;
+
+        assert_se(prefix = strappend(directory, "@"));
+        assert_se(d = opendir(directory));
+
+        while ((de = readdir(d)))
+                if (startswith(de->d_name, prefix)) {
+                        free(path);
+                        assert_se(path = strjoin(directory, "/", de->d_name, NULL));
+                }
+
+        assert_se(path);
+        return path;
+}
+
+static void test_vacuum_cache(void) {
+        JournalVacuumCache *c = NULL;
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        static const char test[] = "VACUUM=1";
+        unsigned i;
+
+        assert_se(mkdir("vacuum", 0755) >= 0);
+        assert_se(journal_file_open("vacuum/vacuum.journal", O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        iovec.iov_base = (void*) test;
+        iovec.iov_len = strlen(test);
+
+        for (i = 0; i < 3; i++) {
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+                assert_se(journal_file_rotate(&f, 0, false) >= 0);
+        }
+
+        /* Nothing to do, but the archived files are now known */
+        assert_se(journal_directory_vacuum_cached(&c, "vacuum", (uint64_t) -1, 0, 0, NULL) >= 0);
+        assert_se(count_archived("vacuum") == 3);
+
+        /* Files archived after the first run must be picked up too */
+        dual_timestamp_get(&ts);
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        assert_se(journal_file_rotate(&f, 0, false) >= 0);
+        assert_se(count_archived("vacuum") == 4);
+
+        /* The active file is never deleted */
+        assert_se(journal_directory_vacuum_cached(&c, "vacuum", 1, 0, 0, NULL) >= 0);
+        assert_se(count_archived("vacuum") == 0);
+        assert_se(access("vacuum/vacuum.journal", F_OK) >= 0);
+
+        /* ... and neither are files within the retention time */
+        dual_timestamp_get(&ts);
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        assert_se(journal_file_rotate(&f, 0, false) >= 0);
+        assert_se(journal_directory_vacuum_cached(&c, "vacuum", 0, 0, USEC_PER_HOUR, NULL) >= 0);
+        assert_se(count_archived("vacuum") == 1);
+
+        journal_file_close(f);
+        journal_vacuum_cache_free(c);
+}
+
+static void test_data_bloom_filter(void) {
+        char _cleanup_free_ *path = NULL;
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        char data[32];
+        unsigned i;
+
+        assert_se(mkdir("bloom", 0755) >= 0);
+        assert_se(journal_file_open("bloom/bloom.journal", O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        dual_timestamp_get(&ts);
+        for (i = 0; i < 1000; i++) {
+                snprintf(data, sizeof(data), "BLOOM=%u", i);
+                iovec.iov_base = data;
+                iovec.iov_len = strlen(data);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        /* Only archived files get a filter */
+        assert_se(!JOURNAL_HEADER_DATA_BLOOM_FILTER(f->header));
+        assert_se(journal_file_rotate(&f, 0, false) >= 0);
+        assert_se(!JOURNAL_HEADER_DATA_BLOOM_FILTER(f->header));
+        journal_file_close(f);
+
+        path = find_archived("bloom");
+
+        assert_se(journal_file_open(path, O_RDONLY, 0, 0, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(JOURNAL_HEADER_DATA_BLOOM_FILTER(f->header));
+        assert_se(!f->hash_tables_mapped);
+        assert_se(journal_file_map_hash_tables(f) >= 0);
+        assert_se(f->data_bloom_filter);
+
+        /* No false negatives, ever */
+        for (i = 0; i < 1000; i++) {
+                snprintf(data, sizeof(data), "BLOOM=%u", i);
+                assert_se(journal_file_find_data_object(f, data, strlen(data), NULL, NULL) == 1);
+        }
+
+        for (i = 1000; i < 2000; i++) {
+                snprintf(data, sizeof(data), "BLOOM=%u", i);
+                assert_se(journal_file_find_data_object(f, data, strlen(data), NULL, NULL) == 0);
+        }
+
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+
+        journal_file_close(f);
+}
+
+static void test_compact(void) {
+        char _cleanup_free_ *path = NULL;
+        dual_timestamp ts;
+        JournalFile *f, *c;
+        struct iovec iovec[2];
+        char data[32];
+        Object *o, *u;
+        uint64_t p, q;
+        unsigned i;
+
+        assert_se(mkdir("compact", 0755) >= 0);
+        assert_se(journal_file_open("compact/compact.journal", O_RDWR|O_CREAT, 0666, 0, false, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < 1000; i++) {
+                snprintf(data, sizeof(data), "COMPACT=%u", i % 7);
+                IOVEC_SET_STRING(iovec[0], data);
+                IOVEC_SET_STRING(iovec[1], i % 2 ? "ODD=1" : "EVEN=1");
+
+                dual_timestamp_get(&ts);
+                assert_se(journal_file_append_entry(f, &ts, iovec, 2, NULL, NULL, NULL) == 0);
+        }
+
+        assert_se(journal_file_rotate(&f, 0, false) >= 0);
+        journal_file_close(f);
+
+        path = find_archived("compact");
+
+        assert_se(journal_file_open(path, O_RDONLY, 0, 0, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_compact(f, "compact/.#compacted.journal", 0) >= 0);
+        assert_se(journal_file_open("compact/.#compacted.journal", O_RDONLY, 0, 0, false, NULL, NULL, NULL, &c) == 0);
+
+        assert_se(journal_file_verify(c, NULL, NULL, NULL, NULL, false) >= 0);
+        assert_se(c->header->state == STATE_ARCHIVED);
+        assert_se(c->header->n_entries == f->header->n_entries);
+        assert_se(c->header->n_data == f->header->n_data);
+        assert_se(sd_id128_equal(c->header->seqnum_id, f->header->seqnum_id));
+
+        /* One array per data object with more than one entry, and
+         * the global one */
+        assert_se(le64toh(c->header->n_entry_arrays) == 7 + 2 + 1);
+        assert_se(le64toh(c->header->n_entry_arrays) < le64toh(f->header->n_entry_arrays));
+
+        /* Entries must come out the same, and keep their seqnums */
+        o = u = NULL;
+        p = q = 0;
+        for (i = 0; i < 1000; i++) {
+                assert_se(journal_file_next_entry(f, o, p, DIRECTION_DOWN, &o, &p) == 1);
+                assert_se(journal_file_next_entry(c, u, q, DIRECTION_DOWN, &u, &q) == 1);
+
+                assert_se(o->entry.seqnum == u->entry.seqnum);
+                assert_se(o->entry.realtime == u->entry.realtime);
+                assert_se(o->entry.xor_hash == u->entry.xor_hash);
+                assert_se(sd_id128_equal(o->entry.boot_id, u->entry.boot_id));
+        }
+        assert_se(journal_file_next_entry(c, u, q, DIRECTION_DOWN, &u, &q) == 0);
+
+        snprintf(data, sizeof(data), "COMPACT=%u", 3);
+        assert_se(journal_file_find_data_object(c, data, strlen(data), &u, NULL) == 1);
+        assert_se(le64toh(u->data.n_entries) == 143);
+
+        journal_file_close(c);
+        journal_file_close(f);
+}
+
+static void test_compress_skip(void) {
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        char data[600];
+        unsigned i, j;
+
+        assert_se(journal_file_open("compress.journal", O_RDWR|O_CREAT, 0666, compression_default(), false, NULL, NULL, NULL, &f) == 0);
+
+        if (!f->compress) {
+                journal_file_close(f);
+                return;
+        }
+
+        dual_timestamp_get(&ts);
+
+        /* Payloads of a field that never get any shorter should
+         * stop being compressed after a while */
+        memcpy(data, "RANDOM=", 7);
+        for (i = 0; i < 64; i++) {
+                for (j = 7; j < sizeof(data); j++)
+                        data[j] = (char) random_ull();
+
+                iovec.iov_base = data;
+                iovec.iov_len = sizeof(data);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        assert_se(le64toh(f->header->n_compressed) + le64toh(f->header->n_compress_failed) < 64);
+        assert_se(le64toh(f->header->n_compress_skipped) > 0);
+
+        /* Small payloads are never compressed */
+        f->compress_threshold_bytes = sizeof(data) + 1;
+        memset(data + 7, 'x', sizeof(data) - 7);
+        memcpy(data, "REPEAT=", 7);
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        assert_se(le64toh(f->header->n_compressed) == 0);
+
+        journal_file_close(f);
+}
+
+static void test_copy_entries(void) {
+        dual_timestamp ts;
+        JournalFile *from, *to;
+        struct iovec iovec[2];
+        uint64_t offsets[16], p;
+        char data[32], big[600];
+        unsigned i, n;
+        uint8_t flags;
+        Object *o;
+
+        assert_se(journal_file_open("copy-from.journal", O_RDWR|O_CREAT, 0666, compression_default(), false, NULL, NULL, NULL, &from) == 0);
+        assert_se(journal_file_open("copy-to.journal", O_RDWR|O_CREAT, 0666, compression_default(), false, NULL, NULL, NULL, &to) == 0);
+
+        memcpy(big, "BIG=", 4);
+        memset(big + 4, 'x', sizeof(big) - 4);
+
+        for (i = 0; i < ELEMENTSOF(offsets); i++) {
+                dual_timestamp_get(&ts);
+                snprintf(data, sizeof(data), "MESSAGE=%u", i % 3);
+                IOVEC_SET_STRING(iovec[0], data);
+                iovec[1].iov_base = big;
+                iovec[1].iov_len = sizeof(big);
+                assert_se(journal_file_append_entry(from, &ts, iovec, 2, NULL, NULL, &offsets[i]) == 0);
+        }
+
+        to->defer_post_change = true;
+        assert_se(journal_file_copy_entries(from, to, offsets, ELEMENTSOF(offsets), NULL, &n) == 0);
+        assert_se(n == ELEMENTSOF(offsets));
+        assert_se(le64toh(to->header->n_entries) == ELEMENTSOF(offsets));
+        assert_se(to->post_change_pending);
+        journal_file_post_change(to);
+
+        /* Compressed payloads are taken over as they are */
+        assert_se(le64toh(to->header->n_data) == le64toh(from->header->n_data));
+        assert_se(le64toh(to->header->n_fields) == le64toh(from->header->n_fields));
+        assert_se(journal_file_find_data_object(from, big, sizeof(big), &o, &p) == 1);
+        flags = o->object.flags;
+        assert_se(journal_file_find_data_object(to, big, sizeof(big), &o, &p) == 1);
+        assert_se(o->object.flags == flags);
+        assert_se(journal_file_find_field_object(to, "BIG", 3, NULL, NULL) == 1);
+
+        /* Entries older than the tail of the target are refused,
+         * and nothing is copied after them */
+        assert_se(journal_file_copy_entries(from, to, offsets, 2, NULL, &n) == -EINVAL);
+        assert_se(n == 0);
+        assert_se(!to->post_change_pending);
+        assert_se(le64toh(to->header->n_entries) == ELEMENTSOF(offsets));
+
+        journal_file_close(from);
+        journal_file_close(to);
+}
+
+static unsigned grep_count(sd_journal *j, JournalGrep *g) {
+        unsigned n = 0;
+        int r;
+
+        assert_se(sd_journal_seek_head(j) >= 0);
+        while (sd_journal_next(j) > 0) {
+                r = journal_grep_test(g, j);
+                assert_se(r >= 0);
+                if (r > 0)
+                        n++;
+        }
+
+        return n;
+}
+
+static void grep_append(JournalFile *f, const char *message) {
+        dual_timestamp ts;
+        struct iovec iovec[2];
+        char _cleanup_free_ *m = NULL;
+
+        assert_se(m = strappend("MESSAGE=", message));
+        IOVEC_SET_STRING(iovec[0], m);
+        IOVEC_SET_STRING(iovec[1], "GREP=1");
+
+        dual_timestamp_get(&ts);
+        assert_se(journal_file_append_entry(f, &ts, iovec, 2, NULL, NULL, NULL) == 0);
+}
+
+static void test_grep(void) {
+        sd_journal _cleanup_journal_close_ *j = NULL;
+        JournalGrep *g, *h;
+        JournalFile *f;
+        char path[32], message[64], big[4096];
+        unsigned i, k;
+
+        assert_se(mkdir("grep", 0755) >= 0);
+
+        /* Every tenth entry of each file matches, with one of them
+         * sharing its data object with all others, and a large one
+         * that is compressed, if we can */
+        memset(big, 'x', sizeof(big) - 1);
+        big[sizeof(big) - 1] = 0;
+        memcpy(big + 1000, "HeLLo", 5);
+
+        for (k = 0; k < 3; k++) {
+                snprintf(path, sizeof(path), "grep/grep%u.journal", k);
+                assert_se(journal_file_open(path, O_RDWR|O_CREAT, 0666, compression_default(), false, NULL, NULL, NULL, &f) == 0);
+
+                for (i = 0; i < 300; i++) {
+                        if (i % 10 == 0)
+                                snprintf(message, sizeof(message), "Hello %u", i);
+                        else if (i % 10 == 5)
+                                snprintf(message, sizeof(message), "hello again");
+                        else
+                                snprintf(message, sizeof(message), "Bye %u", i);
+                        grep_append(f, message);
+                }
+                grep_append(f, big);
+
+                journal_file_close(f);
+        }
+
+        assert_se(sd_journal_open_directory(&j, "grep", 0) >= 0);
+
+        assert_se(journal_grep_new(&g, "hello", true) >= 0);
+        assert_se(journal_grep_scan(g, j) >= 0);
+        assert_se(grep_count(j, g) == 3 * (30 + 30 + 1));
+
+        /* Without a scan the files are searched on demand */
+        assert_se(journal_grep_new(&h, "Hello", false) >= 0);
+        assert_se(grep_count(j, h) == 3 * 30);
+        journal_grep_free(h);
+
+        assert_se(journal_grep_new(&h, "xxxHeLLo", false) >= 0);
+        assert_se(journal_grep_scan(h, j) >= 0);
+        assert_se(grep_count(j, h) == 3);
+        journal_grep_free(h);
+
+        /* Entries written after the scan are searched once we get
+         * to them */
+        assert_se(journal_file_open("grep/grep0.journal", O_RDWR, 0, compression_default(), false, NULL, NULL, NULL, &f) == 0);
+        grep_append(f, "hElLo once more");
+        grep_append(f, "Bye once more");
+        journal_file_close(f);
+
+        assert_se(grep_count(j, g) == 3 * (30 + 30 + 1) + 1);
+
+        journal_grep_free(g);
+}
 
 int main(int argc, char *argv[]) {
         dual_timestamp ts;
         JournalFile *f;
         struct iovec iovec;
+        JournalBatchEntry batch[2];
         static const char test[] = "TEST1=1", test2[] = "TEST2=2";
         Object *o;
         uint64_t p;
@@ -43,7 +579,7 @@ int main(int argc, char *argv[]) {
         assert_se(mkdtemp(t));
         assert_se(chdir(t) >= 0);
 
-        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, true, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, compression_default(), true, NULL, NULL, NULL, &f) == 0);
 
         dual_timestamp_get(&ts);
 
@@ -114,11 +650,36 @@ int main(int argc, char *argv[]) {
 
         assert(journal_file_move_to_entry_by_seqnum(f, 10, DIRECTION_DOWN, &o, NULL) == 0);
 
-        journal_file_rotate(&f, true, true);
-        journal_file_rotate(&f, true, true);
+        batch[0].ts = &ts;
+        batch[0].iovec = &iovec;
+        batch[0].n_iovec = 1;
+        batch[1] = batch[0];
+        f->defer_post_change = true;
+        assert_se(journal_file_append_entries(f, batch, ELEMENTSOF(batch), NULL) == 0);
+        assert(f->post_change_pending);
+        journal_file_post_change(f);
+        assert(!f->post_change_pending);
+
+        assert(journal_file_move_to_entry_by_seqnum(f, 5, DIRECTION_DOWN, &o, &p) == 1);
+        assert(le64toh(o->entry.seqnum) == 5);
+        assert(journal_file_next_entry(f, o, p, DIRECTION_DOWN, &o, &p) == 0);
+
+        journal_file_rotate(&f, compression_default(), true);
+        journal_file_rotate(&f, compression_default(), true);
 
         journal_file_close(f);
 
+        test_entry_array_index();
+        test_bisect_full_array();
+        test_hash_table_size();
+        test_hash_function();
+        test_vacuum_cache();
+        test_data_bloom_filter();
+        test_compact();
+        test_compress_skip();
+        test_copy_entries();
+        test_grep();
+
         journal_directory_vacuum(".", 3000000, 0, 0, NULL);
 
         log_error("Exiting...");
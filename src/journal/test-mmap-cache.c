@@ -33,6 +33,9 @@ int main(int argc, char *argv[]) {
         char px[] = "/tmp/testmmapXXXXXXX", py[] = "/tmp/testmmapYXXXXXX", pz[] = "/tmp/testmmapZXXXXXX";
         MMapCache *m;
         void *p, *q;
+        struct stat st;
+        MMapCacheStats stats;
+        unsigned i;
 
         assert_se(m = mmap_cache_new());
 
@@ -61,6 +64,11 @@ int main(int argc, char *argv[]) {
 
         assert((uint8_t*) p + 2 == (uint8_t*) q);
 
+        mmap_cache_get_stats(m, &stats);
+        assert_se(stats.misses == 1);
+        assert_se(stats.context_hits == 1);
+        assert_se(stats.window_hits == 1);
+
         r = mmap_cache_get(m, x, PROT_READ, 0, false, 16ULL*1024ULL*1024ULL, 2, NULL, &p);
         assert(r >= 0);
 
@@ -69,6 +77,22 @@ int main(int argc, char *argv[]) {
 
         assert((uint8_t*) p + 1 == (uint8_t*) q);
 
+        /* Scan a file front to back, which should switch the cache
+         * into sequential mode, and check we see the right data */
+        assert_se(ftruncate(y, 64ULL*1024ULL*1024ULL) >= 0);
+        for (i = 0; i < 64; i++) {
+                uint64_t v = i;
+
+                assert_se(pwrite(y, &v, sizeof(v), i*1024ULL*1024ULL) == sizeof(v));
+        }
+        assert_se(fstat(y, &st) >= 0);
+
+        for (i = 0; i < 64; i++) {
+                r = mmap_cache_get(m, y, PROT_READ, 2, false, i*1024ULL*1024ULL, sizeof(uint64_t), &st, &p);
+                assert_se(r >= 0);
+                assert_se(*(uint64_t*) p == i);
+        }
+
         mmap_cache_unref(m);
 
         close_nointr_nofail(x);
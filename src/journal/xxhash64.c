@@ -0,0 +1,115 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <string.h>
+
+#include "sparse-endian.h"
+#include "xxhash64.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t rotl64(uint64_t x, unsigned r) {
+        return (x << r) | (x >> (64 - r));
+}
+
+/* The input may be unaligned, hence copy it out */
+static inline uint64_t read64(const uint8_t *p) {
+        le64_t v;
+
+        memcpy(&v, p, sizeof(v));
+        return le64toh(v);
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+        le32_t v;
+
+        memcpy(&v, p, sizeof(v));
+        return le32toh(v);
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+        acc += input * PRIME64_2;
+        acc = rotl64(acc, 31);
+        return acc * PRIME64_1;
+}
+
+static inline uint64_t merge_round64(uint64_t acc, uint64_t val) {
+        acc ^= round64(0, val);
+        return acc * PRIME64_1 + PRIME64_4;
+}
+
+uint64_t xxhash64(const void *data, size_t length, uint64_t seed) {
+        const uint8_t *p = data, *end = p + length;
+        uint64_t h;
+
+        if (length >= 32) {
+                const uint8_t *limit = end - 32;
+                uint64_t v1 = seed + PRIME64_1 + PRIME64_2,
+                         v2 = seed + PRIME64_2,
+                         v3 = seed,
+                         v4 = seed - PRIME64_1;
+
+                do {
+                        v1 = round64(v1, read64(p));
+                        v2 = round64(v2, read64(p + 8));
+                        v3 = round64(v3, read64(p + 16));
+                        v4 = round64(v4, read64(p + 24));
+                        p += 32;
+                } while (p <= limit);
+
+                h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+                h = merge_round64(h, v1);
+                h = merge_round64(h, v2);
+                h = merge_round64(h, v3);
+                h = merge_round64(h, v4);
+        } else
+                h = seed + PRIME64_5;
+
+        h += (uint64_t) length;
+
+        while (p + 8 <= end) {
+                h ^= round64(0, read64(p));
+                h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+                p += 8;
+        }
+
+        if (p + 4 <= end) {
+                h ^= (uint64_t) read32(p) * PRIME64_1;
+                h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+                p += 4;
+        }
+
+        while (p < end) {
+                h ^= (uint64_t) *p * PRIME64_5;
+                h = rotl64(h, 11) * PRIME64_1;
+                p++;
+        }
+
+        h ^= h >> 33;
+        h *= PRIME64_2;
+        h ^= h >> 29;
+        h *= PRIME64_3;
+        h ^= h >> 32;
+
+        return h;
+}
@@ -0,0 +1,719 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+
+#include "sd-bus.h"
+#include "bus-internal.h"
+#include "bus-message.h"
+
+/* Runs a client against a server thread, either directly over a
+ * socketpair, or through the real bus, where the server is addressed
+ * by its unique name. Measures round trip latencies of method calls
+ * with various payload sizes, throughput of signals, marshalling of a
+ * large array shaped like the reply to ListUnits(), and passing of
+ * fds. Only the public API is used, as far as possible, so that the
+ * same program can be built against older trees for comparison.
+ * Results are printed as one JSON object per line, like
+ * bench-hashmap. */
+
+#define INTERFACE "org.freedesktop.systemd.bench"
+
+static unsigned arg_iterations = 10000;
+static unsigned arg_units = 1000;
+static bool arg_memfd = false;
+static enum {
+        BUS_SOCKETPAIR,
+        BUS_USER,
+        BUS_SYSTEM
+} arg_bus = BUS_SOCKETPAIR;
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Benchmark message passing with libsystemd-bus.\n\n"
+               "  -h --help               Show this help\n"
+               "     --user               Go through the user bus\n"
+               "     --system             Go through the system bus\n"
+               "     --iterations=N       Calls and signals per run (default: 10000)\n"
+               "     --units=N            Elements of the large array (default: 1000)\n"
+               "     --memfd              Pass large bodies as memfd on the socket pair\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_USER = 0x100,
+                ARG_SYSTEM,
+                ARG_ITERATIONS,
+                ARG_UNITS,
+                ARG_MEMFD
+        };
+
+        static const struct option options[] = {
+                { "help",       no_argument,       NULL, 'h'            },
+                { "user",       no_argument,       NULL, ARG_USER       },
+                { "system",     no_argument,       NULL, ARG_SYSTEM     },
+                { "iterations", required_argument, NULL, ARG_ITERATIONS },
+                { "units",      required_argument, NULL, ARG_UNITS      },
+                { "memfd",      no_argument,       NULL, ARG_MEMFD      },
+                { NULL,         0,                 NULL, 0              }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_USER:
+                        arg_bus = BUS_USER;
+                        break;
+
+                case ARG_SYSTEM:
+                        arg_bus = BUS_SYSTEM;
+                        break;
+
+                case ARG_ITERATIONS:
+                        r = safe_atou(optarg, &arg_iterations);
+                        if (r < 0 || arg_iterations <= 0) {
+                                log_error("Failed to parse number of iterations: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_UNITS:
+                        r = safe_atou(optarg, &arg_units);
+                        if (r < 0) {
+                                log_error("Failed to parse number of units: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_MEMFD:
+                        arg_memfd = true;
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+static int usec_compare(const void *a, const void *b) {
+        const usec_t *x = a, *y = b;
+
+        return *x < *y ? -1 : *x > *y ? 1 : 0;
+}
+
+static void report_latency(const char *name, usec_t *l, unsigned n) {
+        usec_t t = 0;
+        unsigned i;
+
+        assert(n > 0);
+
+        for (i = 0; i < n; i++)
+                t += l[i];
+
+        qsort(l, n, sizeof(usec_t), usec_compare);
+
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %u, "
+               "\"p50\" : %llu, \"p90\" : %llu, \"p99\" : %llu, \"max\" : %llu }\n",
+               name, (unsigned long long) t, n,
+               (unsigned long long) l[n / 2],
+               (unsigned long long) l[n * 9 / 10],
+               (unsigned long long) l[n * 99 / 100],
+               (unsigned long long) l[n - 1]);
+}
+
+static int server_handle(sd_bus *bus, sd_bus_message *m, uint32_t *n_ticks, bool *quit) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        int r;
+
+        if (sd_bus_message_is_signal(m, INTERFACE, "Tick")) {
+                (*n_ticks)++;
+                return 0;
+        }
+
+        if (!sd_bus_message_is_method_call(m, NULL, NULL))
+                return 0;
+
+        r = sd_bus_message_new_method_return(bus, m, &reply);
+        if (r < 0)
+                return r;
+
+        if (sd_bus_message_is_method_call(m, INTERFACE, "Ping")) {
+                const char *s;
+
+                r = sd_bus_message_read(m, "s", &s);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(reply, "s", s);
+
+        } else if (sd_bus_message_is_method_call(m, INTERFACE, "Count")) {
+
+                r = sd_bus_message_append(reply, "u", *n_ticks);
+                *n_ticks = 0;
+
+        } else if (sd_bus_message_is_method_call(m, INTERFACE, "Units")) {
+                const char *id, *description, *load, *active, *sub, *following, *job_type;
+                const char *unit_path, *job_path;
+                uint32_t job_id, n = 0;
+
+                r = sd_bus_message_enter_container(m, 'a', "(ssssssouso)");
+                if (r < 0)
+                        return r;
+
+                while ((r = sd_bus_message_enter_container(m, SD_BUS_TYPE_STRUCT, "ssssssouso")) > 0) {
+
+                        r = sd_bus_message_read(m, "ssssssouso",
+                                                &id, &description, &load, &active, &sub, &following,
+                                                &unit_path, &job_id, &job_type, &job_path);
+                        if (r < 0)
+                                return r;
+
+                        r = sd_bus_message_exit_container(m);
+                        if (r < 0)
+                                return r;
+
+                        n++;
+                }
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_exit_container(m);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(reply, "u", n);
+
+        } else if (sd_bus_message_is_method_call(m, INTERFACE, "Fd")) {
+                int fd;
+
+                r = sd_bus_message_read(m, "h", &fd);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(reply, "h", fd);
+
+        } else if (sd_bus_message_is_method_call(m, INTERFACE, "Exit")) {
+
+                *quit = true;
+                r = 0;
+
+        } else {
+                sd_bus_message_unref(reply);
+                reply = NULL;
+
+                r = sd_bus_message_new_method_error(
+                                bus, m,
+                                &SD_BUS_ERROR_MAKE("org.freedesktop.DBus.Error.UnknownMethod", "Unknown method."),
+                                &reply);
+        }
+        if (r < 0)
+                return r;
+
+        return sd_bus_send(bus, reply, NULL);
+}
+
+static void *server(void *p) {
+        sd_bus *bus = p;
+        uint32_t n_ticks = 0;
+        bool quit = false;
+        int r;
+
+        while (!quit) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+
+                r = sd_bus_process(bus, &m);
+                if (r < 0) {
+                        log_error("Failed to process requests: %s", strerror(-r));
+                        goto fail;
+                }
+
+                if (r == 0) {
+                        r = sd_bus_wait(bus, (uint64_t) -1);
+                        if (r < 0) {
+                                log_error("Failed to wait: %s", strerror(-r));
+                                goto fail;
+                        }
+
+                        continue;
+                }
+
+                if (!m)
+                        continue;
+
+                r = server_handle(bus, m, &n_ticks, &quit);
+                if (r < 0) {
+                        log_error("Failed to handle %s: %s", strna(sd_bus_message_get_member(m)), strerror(-r));
+                        goto fail;
+                }
+        }
+
+        r = 0;
+
+fail:
+        sd_bus_flush(bus);
+        sd_bus_unref(bus);
+
+        return INT_TO_PTR(r);
+}
+
+static int call(sd_bus *bus, sd_bus_message *m, sd_bus_message **reply) {
+        sd_bus_error error = SD_BUS_ERROR_NULL;
+        int r;
+
+        r = sd_bus_send_with_reply_and_block(bus, m, 0, &error, reply);
+        if (r < 0) {
+                log_error("Failed to issue %s(): %s", sd_bus_message_get_member(m), bus_error_message(&error, -r));
+                sd_bus_error_free(&error);
+        }
+
+        return r;
+}
+
+static int new_call(sd_bus *bus, const char *destination, const char *member, sd_bus_message **m) {
+        int r;
+
+        r = sd_bus_message_new_method_call(bus, destination, "/", INTERFACE, member, m);
+        if (r < 0)
+                log_error("Failed to allocate method call: %s", strerror(-r));
+
+        return r;
+}
+
+static int bench_ping(sd_bus *bus, const char *destination, size_t size, unsigned n) {
+        _cleanup_free_ usec_t *l = NULL;
+        _cleanup_free_ char *payload = NULL;
+        char name[DECIMAL_STR_MAX(size_t) + 6];
+        unsigned i;
+        int r;
+
+        l = new(usec_t, n);
+        payload = new(char, size + 1);
+        if (!l || !payload)
+                return log_oom();
+
+        memset(payload, 'x', size);
+        payload[size] = 0;
+
+        for (i = 0; i < n; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
+                const char *s;
+                usec_t t;
+
+                t = now(CLOCK_MONOTONIC);
+
+                r = new_call(bus, destination, "Ping", &m);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(m, "s", payload);
+                if (r < 0)
+                        return r;
+
+                r = call(bus, m, &reply);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_read(reply, "s", &s);
+                if (r < 0)
+                        return r;
+
+                l[i] = now(CLOCK_MONOTONIC) - t;
+
+                assert_se(strlen(s) == size);
+        }
+
+        snprintf(name, sizeof(name), "ping-%zu", size);
+        report_latency(name, l, n);
+
+        return 0;
+}
+
+static int bench_signals(sd_bus *bus, const char *destination) {
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
+        uint32_t n;
+        unsigned i;
+        usec_t t;
+        int r;
+
+        t = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < arg_iterations; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *s = NULL;
+
+                r = sd_bus_message_new_signal(bus, "/", INTERFACE, "Tick", &s);
+                if (r < 0)
+                        return r;
+
+                /* Signals are broadcast on the real bus, make sure
+                 * only the server gets them */
+                if (destination) {
+                        r = sd_bus_message_set_destination(s, destination);
+                        if (r < 0)
+                                return r;
+                }
+
+                r = sd_bus_message_append(s, "u", i);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_send(bus, s, NULL);
+                if (r < 0) {
+                        log_error("Failed to send signal: %s", strerror(-r));
+                        return r;
+                }
+        }
+
+        /* Ordering guarantees that all signals arrived once the
+         * reply to this is in */
+        r = new_call(bus, destination, "Count", &m);
+        if (r < 0)
+                return r;
+
+        r = call(bus, m, &reply);
+        if (r < 0)
+                return r;
+
+        t = now(CLOCK_MONOTONIC) - t;
+
+        r = sd_bus_message_read(reply, "u", &n);
+        if (r < 0)
+                return r;
+
+        assert_se(n == arg_iterations);
+
+        report("signals", t, n);
+
+        return 0;
+}
+
+static int bench_units(sd_bus *bus, const char *destination) {
+        unsigned i, j, k;
+        usec_t t;
+        int r;
+
+        /* Transferring large arrays is mostly copying, so fewer
+         * rounds suffice */
+        k = MAX(arg_iterations / 100, 1U);
+
+        t = now(CLOCK_MONOTONIC);
+
+        for (j = 0; j < k; j++) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
+                uint32_t n;
+
+                r = new_call(bus, destination, "Units", &m);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_open_container(m, 'a', "(ssssssouso)");
+                if (r < 0)
+                        return r;
+
+                for (i = 0; i < arg_units; i++) {
+                        r = sd_bus_message_append(m, "(ssssssouso)",
+                                                  "foobar.service", "Foo Bar Service",
+                                                  "loaded", "active", "running", "",
+                                                  "/org/freedesktop/systemd1/unit/foobar_2eservice",
+                                                  (uint32_t) 0, "", "/");
+                        if (r < 0)
+                                return r;
+                }
+
+                r = sd_bus_message_close_container(m);
+                if (r < 0)
+                        return r;
+
+                r = call(bus, m, &reply);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_read(reply, "u", &n);
+                if (r < 0)
+                        return r;
+
+                assert_se(n == arg_units);
+        }
+
+        report("units", now(CLOCK_MONOTONIC) - t, (uint64_t) k * arg_units);
+
+        return 0;
+}
+
+static int bench_fds(sd_bus *bus, const char *destination) {
+        _cleanup_free_ usec_t *l = NULL;
+        unsigned i;
+        int r;
+
+        if (sd_bus_can_send(bus, SD_BUS_TYPE_UNIX_FD) <= 0) {
+                log_info("Passing fds is not supported on this connection, skipping.");
+                return 0;
+        }
+
+        l = new(usec_t, arg_iterations);
+        if (!l)
+                return log_oom();
+
+        for (i = 0; i < arg_iterations; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
+                int fd;
+                usec_t t;
+
+                t = now(CLOCK_MONOTONIC);
+
+                r = new_call(bus, destination, "Fd", &m);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append(m, "h", STDERR_FILENO);
+                if (r < 0)
+                        return r;
+
+                r = call(bus, m, &reply);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_read(reply, "h", &fd);
+                if (r < 0)
+                        return r;
+
+                l[i] = now(CLOCK_MONOTONIC) - t;
+
+                assert_se(fd >= 0);
+        }
+
+        report_latency("fds", l, arg_iterations);
+
+        return 0;
+}
+
+static int client(sd_bus *bus, const char *destination) {
+        static const size_t sizes[] = { 16, 1024, 65536 };
+        static const size_t large_sizes[] = { 1024*1024, 8*1024*1024 };
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
+        unsigned i;
+        int r;
+
+        for (i = 0; i < ELEMENTSOF(sizes); i++) {
+                r = bench_ping(bus, destination, sizes[i], arg_iterations);
+                if (r < 0)
+                        return r;
+        }
+
+        /* Bodies of this size are passed as memfd with --memfd */
+        for (i = 0; i < ELEMENTSOF(large_sizes); i++) {
+                r = bench_ping(bus, destination, large_sizes[i], MAX(arg_iterations / 100, 1U));
+                if (r < 0)
+                        return r;
+        }
+
+        r = bench_signals(bus, destination);
+        if (r < 0)
+                return r;
+
+        r = bench_units(bus, destination);
+        if (r < 0)
+                return r;
+
+        r = bench_fds(bus, destination);
+        if (r < 0)
+                return r;
+
+        r = new_call(bus, destination, "Exit", &m);
+        if (r < 0)
+                return r;
+
+        return call(bus, m, &reply);
+}
+
+static int open_pair(sd_bus **a, sd_bus **b) {
+        _cleanup_bus_unref_ sd_bus *x = NULL, *y = NULL;
+        sd_id128_t id;
+        int fds[2], r;
+
+        r = sd_id128_randomize(&id);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_new(&x);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_new(&y);
+        if (r < 0)
+                return r;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+                return -errno;
+
+        /* The buses own the fds from here on */
+        assert_se(sd_bus_set_fd(x, fds[0], fds[0]) >= 0);
+        assert_se(sd_bus_set_fd(y, fds[1], fds[1]) >= 0);
+
+        r = sd_bus_set_server(x, 1, id);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_set_negotiate_fds(x, true);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_set_negotiate_fds(y, true);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_set_negotiate_memfd(x, arg_memfd);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_set_negotiate_memfd(y, arg_memfd);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_start(x);
+        if (r < 0)
+                return r;
+
+        r = sd_bus_start(y);
+        if (r < 0)
+                return r;
+
+        *a = x;
+        *b = y;
+        x = y = NULL;
+
+        return 0;
+}
+
+static int open_bus(sd_bus **a, sd_bus **b) {
+        _cleanup_bus_unref_ sd_bus *x = NULL, *y = NULL;
+        int r;
+
+        r = arg_bus == BUS_USER ? sd_bus_open_user(&x) : sd_bus_open_system(&x);
+        if (r < 0)
+                return r;
+
+        r = arg_bus == BUS_USER ? sd_bus_open_user(&y) : sd_bus_open_system(&y);
+        if (r < 0)
+                return r;
+
+        *a = x;
+        *b = y;
+        x = y = NULL;
+
+        return 0;
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_bus_unref_ sd_bus *bus = NULL;
+        _cleanup_free_ char *destination = NULL;
+        sd_bus *server_bus = NULL;
+        pthread_t s;
+        void *p;
+        int r, q;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        if (arg_bus == BUS_SOCKETPAIR)
+                r = open_pair(&server_bus, &bus);
+        else
+                r = open_bus(&server_bus, &bus);
+        if (r < 0) {
+                log_error("Failed to connect: %s", strerror(-r));
+                return EXIT_FAILURE;
+        }
+
+        if (arg_bus != BUS_SOCKETPAIR) {
+                const char *unique;
+
+                r = sd_bus_get_unique_name(server_bus, &unique);
+                if (r < 0) {
+                        log_error("Failed to get unique name: %s", strerror(-r));
+                        sd_bus_unref(server_bus);
+                        return EXIT_FAILURE;
+                }
+
+                destination = strdup(unique);
+                if (!destination) {
+                        sd_bus_unref(server_bus);
+                        log_oom();
+                        return EXIT_FAILURE;
+                }
+        }
+
+        /* From here on the server bus belongs to the thread */
+        r = pthread_create(&s, NULL, server, server_bus);
+        if (r != 0) {
+                log_error("Failed to start server: %s", strerror(r));
+                sd_bus_unref(server_bus);
+                return EXIT_FAILURE;
+        }
+
+        r = client(bus, destination);
+
+        q = pthread_join(s, &p);
+        if (q != 0) {
+                log_error("Failed to join server: %s", strerror(q));
+                return EXIT_FAILURE;
+        }
+
+        if (r < 0 || PTR_TO_INT(p) < 0)
+                return EXIT_FAILURE;
+
+        return EXIT_SUCCESS;
+}
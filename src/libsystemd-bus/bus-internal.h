@@ -26,9 +26,11 @@
 #include <netinet/in.h>
 
 #include "hashmap.h"
+#include "path-trie.h"
 #include "prioq.h"
 #include "list.h"
 #include "util.h"
+#include "event-loop.h"
 
 #include "sd-bus.h"
 #include "bus-error.h"
@@ -61,6 +63,20 @@ struct object_callback {
         unsigned last_iteration;
 };
 
+struct object_vtable {
+        char *path;
+        char *interface;
+        const sd_bus_vtable *vtable;
+        void *userdata;
+
+        /* Pointers into the vtable, sorted by member name for
+         * bsearch() */
+        const sd_bus_vtable **methods, **properties;
+        unsigned n_methods, n_properties;
+
+        LIST_FIELDS(struct object_vtable, vtables);
+};
+
 enum bus_state {
         BUS_UNSET,
         BUS_OPENING,
@@ -83,6 +99,8 @@ struct sd_bus {
 
         bool negotiate_fds:1;
         bool can_fds:1;
+        bool negotiate_memfd:1;
+        bool can_memfd:1;
         bool bus_client:1;
         bool ucred_valid:1;
         bool is_server:1;
@@ -96,6 +114,8 @@ struct sd_bus {
 
         void *rbuffer;
         size_t rbuffer_size;
+        size_t rbuffer_allocated;
+        size_t rindex;
 
         sd_bus_message **rqueue;
         unsigned rqueue_size;
@@ -113,6 +133,8 @@ struct sd_bus {
         Hashmap *reply_callbacks;
         LIST_HEAD(struct filter_callback, filter_callbacks);
         Hashmap *object_callbacks;
+        Hashmap *object_vtables;
+        PathTrie *object_trie;
 
         union {
                 struct sockaddr sa;
@@ -147,6 +169,11 @@ struct sd_bus {
 
         uint64_t hello_serial;
         unsigned iteration_counter;
+
+        EventLoop *event;
+        EventSource *input_io_source;
+        EventSource *output_io_source;
+        EventSource *time_source;
 };
 
 static inline void bus_unrefp(sd_bus **b) {
@@ -154,6 +181,28 @@ static inline void bus_unrefp(sd_bus **b) {
 }
 
 #define _cleanup_bus_unref_ __attribute__((cleanup(bus_unrefp)))
+
+struct call_group_slot {
+        uint64_t serial;
+        sd_bus_message *reply;
+};
+
+struct sd_bus_call_group {
+        sd_bus *bus;
+
+        struct call_group_slot **slots;
+        unsigned n_slots;
+        size_t n_allocated;
+
+        /* Slots still waiting for their reply, by serial */
+        Hashmap *pending;
+};
+
+static inline void bus_call_group_freep(sd_bus_call_group **g) {
+        sd_bus_call_group_free(*g);
+}
+
+#define _cleanup_bus_call_group_free_ __attribute__((cleanup(bus_call_group_freep)))
 #define _cleanup_bus_error_free_ __attribute__((cleanup(sd_bus_error_free)))
 
 #define BUS_DEFAULT_TIMEOUT ((usec_t) (25 * USEC_PER_SEC))
@@ -164,6 +213,19 @@ static inline void bus_unrefp(sd_bus **b) {
 #define BUS_MESSAGE_SIZE_MAX (64*1024*1024)
 #define BUS_AUTH_SIZE_MAX (64*1024)
 
+/* How much to read ahead of the current message, and how much of the
+ * write queue to hand to the kernel at once */
+#define BUS_READ_BATCH_SIZE (16*1024)
+#define BUS_WRITE_BATCH_SIZE (64*1024)
+
+/* Bodies of at least this size are passed as a sealed memfd instead
+ * of inline, if the peer agreed to that. BUS_MESSAGE_BODY_MEMFD is
+ * set in the header flags then, and the memfd is the last fd that
+ * comes with the message. The flag is private to this
+ * implementation, and never used unless negotiated. */
+#define BUS_MEMFD_MIN_SIZE (512*1024)
+#define BUS_MESSAGE_BODY_MEMFD 0x80
+
 #define BUS_CONTAINER_DEPTH 128
 
 /* Defined by the specification as maximum size of an array in
@@ -190,5 +252,7 @@ int bus_message_type_from_string(const char *s, uint8_t *u);
 #define error_name_is_valid interface_name_is_valid
 
 int bus_ensure_running(sd_bus *bus);
+int bus_attach_event(sd_bus *bus, EventLoop *e);
+void bus_detach_event(sd_bus *bus);
 int bus_start_running(sd_bus *bus);
 int bus_next_address(sd_bus *bus);
@@ -64,8 +64,18 @@ static inline bool BUS_MATCH_IS_COMPARE(enum bus_match_node_type t) {
 }
 
 static inline bool BUS_MATCH_CAN_HASH(enum bus_match_node_type t) {
-        return (t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_PATH) ||
-                (t >= BUS_MATCH_ARG && t <= BUS_MATCH_ARG_LAST);
+        return (t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_PATH_NAMESPACE) ||
+                (t >= BUS_MATCH_ARG && t <= BUS_MATCH_ARG_LAST) ||
+                (t >= BUS_MATCH_ARG_NAMESPACE && t <= BUS_MATCH_ARG_NAMESPACE_LAST);
+}
+
+static inline char BUS_MATCH_NAMESPACE_SEPARATOR(enum bus_match_node_type t) {
+        if (t == BUS_MATCH_PATH_NAMESPACE)
+                return '/';
+        if (t >= BUS_MATCH_ARG_NAMESPACE && t <= BUS_MATCH_ARG_NAMESPACE_LAST)
+                return '.';
+
+        return 0;
 }
 
 static void bus_match_node_free(struct bus_match_node *node) {
@@ -196,6 +206,56 @@ static bool value_node_same(
         }
 }
 
+static int bus_match_run_namespace(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                int ret,
+                sd_bus_message *m,
+                const char *test_str) {
+
+        _cleanup_free_ char *p = NULL;
+        char separator, *e;
+        int r;
+
+        assert(node);
+        assert(test_str);
+
+        /* A namespace matches the string itself and everything
+         * below it. Hence, instead of testing each value node in
+         * turn, look up the string and each of its prefixes that
+         * ends right before a separator. */
+
+        separator = BUS_MATCH_NAMESPACE_SEPARATOR(node->type);
+        assert(separator);
+
+        p = strdup(test_str);
+        if (!p)
+                return -ENOMEM;
+
+        e = strchr(p, 0);
+        for (;;) {
+                struct bus_match_node *found;
+
+                found = hashmap_get(node->compare.children, p);
+                if (found) {
+                        r = bus_match_run(bus, found, ret, m);
+                        if (r != 0)
+                                return r;
+
+                        if (bus && bus->match_callbacks_modified)
+                                return 0;
+                }
+
+                do {
+                        if (e <= p)
+                                return 0;
+                        e--;
+                } while (*e != separator);
+
+                *e = 0;
+        }
+}
+
 int bus_match_run(
                 sd_bus *bus,
                 struct bus_match_node *node,
@@ -301,7 +361,16 @@ int bus_match_run(
                 assert_not_reached("Unknown match type.");
         }
 
-        if (BUS_MATCH_CAN_HASH(node->type)) {
+        if (test_str && BUS_MATCH_NAMESPACE_SEPARATOR(node->type)) {
+
+                /* Lookup via hash table too, but for a number of
+                 * prefixes */
+
+                r = bus_match_run_namespace(bus, node, ret, m, test_str);
+                if (r != 0)
+                        return r;
+
+        } else if (BUS_MATCH_CAN_HASH(node->type)) {
                 struct bus_match_node *found;
 
                 /* Lookup via hash table, nice! So let's jump directly. */
@@ -480,7 +549,7 @@ static int bus_match_find_compare_value(
         else if (BUS_MATCH_CAN_HASH(t))
                 n = hashmap_get(c->compare.children, value_str);
         else {
-                for (n = c->child; !value_node_same(n, t, value_u8, value_str); n = n->next)
+                for (n = c->child; n && !value_node_same(n, t, value_u8, value_str); n = n->next)
                         ;
         }
 
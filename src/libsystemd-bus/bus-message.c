@@ -21,10 +21,13 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "util.h"
 #include "utf8.h"
 #include "strv.h"
+#include "missing.h"
 
 #include "sd-bus.h"
 #include "bus-message.h"
@@ -62,6 +65,12 @@ static void message_free(sd_bus_message *m) {
         if (m->free_body)
                 free(m->body);
 
+        if (m->body_mapped > 0)
+                munmap(m->body, m->body_mapped);
+
+        if (m->body_memfd >= 0)
+                close_nointr_nofail(m->body_memfd);
+
         if (m->free_fds) {
                 close_many(m->fds, m->n_fds);
                 free(m->fds);
@@ -74,12 +83,15 @@ static void message_free(sd_bus_message *m) {
         free(m);
 }
 
-static void* buffer_extend(void **p, uint32_t *sz, size_t align, size_t extend) {
+/* Grows geometrically, so that appending many small items does not
+ * realloc() and copy the whole buffer every time */
+static void* buffer_extend(void **p, uint32_t *sz, size_t *allocated, size_t align, size_t extend) {
         size_t start, n;
         void *k;
 
         assert(p);
         assert(sz);
+        assert(allocated);
         assert(align > 0);
 
         start = ALIGN_TO((size_t) *sz, align);
@@ -91,7 +103,7 @@ static void* buffer_extend(void **p, uint32_t *sz, size_t align, size_t extend)
         if (n > (size_t) ((uint32_t) -1))
                 return NULL;
 
-        k = realloc(*p, n);
+        k = greedy_realloc(p, allocated, n);
         if (!k)
                 return NULL;
 
@@ -111,7 +123,7 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz) {
         assert(m);
 
         o = m->fields;
-        p = buffer_extend(&m->fields, &m->header->fields_size, align, sz);
+        p = buffer_extend(&m->fields, &m->header->fields_size, &m->fields_allocated, align, sz);
         if (!p)
                 return NULL;
 
@@ -225,9 +237,47 @@ static int message_append_field_uint32(sd_bus_message *m, uint8_t h, uint32_t x)
         return 0;
 }
 
+static int message_map_body(sd_bus_message *m, int fd, size_t size) {
+        struct stat st;
+        void *p;
+        int seals;
+
+        assert(m);
+        assert(fd >= 0);
+
+        if (size <= 0)
+                return -EBADMSG;
+
+        /* Only map what the sender can neither modify nor truncate
+         * anymore, so that it cannot pull the message from under
+         * us while we parse it */
+        seals = fcntl(fd, F_GET_SEALS);
+        if (seals < 0)
+                return -errno;
+
+        if ((seals & (F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE)) != (F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE))
+                return -EPERM;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+
+        if ((uint64_t) st.st_size != size)
+                return -EBADMSG;
+
+        p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+                return -errno;
+
+        m->body = p;
+        m->body_mapped = size;
+
+        return 0;
+}
+
 int bus_message_from_malloc(
                 void *buffer,
                 size_t length,
+                int body_memfd,
                 int *fds,
                 unsigned n_fds,
                 const struct ucred *ucred,
@@ -256,6 +306,9 @@ int bus_message_from_malloc(
         if (h->type == _SD_BUS_MESSAGE_TYPE_INVALID)
                 return -EBADMSG;
 
+        if (!!(h->flags & BUS_MESSAGE_BODY_MEMFD) != (body_memfd >= 0))
+                return -EBADMSG;
+
         if (h->endian == SD_BUS_NATIVE_ENDIAN) {
                 fs = h->fields_size;
                 bs = h->body_size;
@@ -265,7 +318,9 @@ int bus_message_from_malloc(
         } else
                 return -EBADMSG;
 
-        total = sizeof(struct bus_header) + ALIGN_TO(fs, 8) + bs;
+        total = sizeof(struct bus_header) + ALIGN_TO(fs, 8);
+        if (body_memfd < 0)
+                total += bs;
         if (length != total)
                 return -EBADMSG;
 
@@ -283,10 +338,17 @@ int bus_message_from_malloc(
         m->sealed = true;
         m->header = h;
         m->fields = (uint8_t*) buffer + sizeof(struct bus_header);
-        m->body = (uint8_t*) buffer + sizeof(struct bus_header) + ALIGN_TO(fs, 8);
+        m->body_memfd = -1;
         m->fds = fds;
         m->n_fds = n_fds;
 
+        if (body_memfd >= 0) {
+                r = message_map_body(m, body_memfd, bs);
+                if (r < 0)
+                        goto fail;
+        } else
+                m->body = (uint8_t*) buffer + sizeof(struct bus_header) + ALIGN_TO(fs, 8);
+
         if (ucred) {
                 m->uid = ucred->uid;
                 m->pid = ucred->pid;
@@ -311,6 +373,7 @@ int bus_message_from_malloc(
         /* We take possession of the memory and fds now */
         m->free_header = true;
         m->free_fds = true;
+        m->body_memfd = body_memfd;
 
         *ret = m;
         return 0;
@@ -332,6 +395,7 @@ static sd_bus_message *message_new(sd_bus *bus, uint8_t type) {
         m->header->endian = SD_BUS_NATIVE_ENDIAN;
         m->header->type = type;
         m->header->version = bus ? bus->message_version : 1;
+        m->body_memfd = -1;
         m->allow_fds = !bus || bus->can_fds || (bus->state != BUS_HELLO && bus->state != BUS_RUNNING);
 
         return m;
@@ -750,10 +814,26 @@ static struct bus_container *message_get_container(sd_bus_message *m) {
         return m->containers + m->n_containers - 1;
 }
 
+/* Adjust the pointers into the body after it moved from o, and account
+ * the added bytes to the arrays being appended to */
+static void message_adjust_body(sd_bus_message *m, void *o, size_t added) {
+        struct bus_container *c;
+
+        for (c = m->containers; c < m->containers + m->n_containers; c++)
+                if (c->array_size) {
+                        c->array_size = (uint32_t*) ((uint8_t*) m->body + ((uint8_t*) c->array_size - (uint8_t*) o));
+                        *c->array_size += added;
+                }
+
+        if (o != m->body) {
+                if (m->error.message)
+                        m->error.message = (const char*) m->body + (m->error.message - (const char*) o);
+        }
+}
+
 static void *message_extend_body(sd_bus_message *m, size_t align, size_t sz) {
         void *p, *o;
         size_t added;
-        struct bus_container *c;
 
         assert(m);
         assert(align > 0);
@@ -761,26 +841,55 @@ static void *message_extend_body(sd_bus_message *m, size_t align, size_t sz) {
         o = m->body;
         added = m->header->body_size;
 
-        p = buffer_extend(&m->body, &m->header->body_size, align, sz);
+        p = buffer_extend(&m->body, &m->header->body_size, &m->body_allocated, align, sz);
         if (!p)
                 return NULL;
 
         added = m->header->body_size - added;
+        message_adjust_body(m, o, added);
 
-        for (c = m->containers; c < m->containers + m->n_containers; c++)
-                if (c->array_size) {
-                        c->array_size = (uint32_t*) ((uint8_t*) m->body + ((uint8_t*) c->array_size - (uint8_t*) o));
-                        *c->array_size += added;
-                }
+        m->free_body = true;
 
-        if (o != m->body) {
-                if (m->error.message)
-                        m->error.message = (const char*) m->body + (m->error.message - (const char*) o);
+        return p;
+}
+
+int sd_bus_message_reserve(sd_bus_message *m, size_t size, unsigned n_fds) {
+        size_t need;
+
+        if (!m)
+                return -EINVAL;
+        if (m->sealed)
+                return -EPERM;
+
+        need = (size_t) m->header->body_size + size;
+        if (need > (size_t) ((uint32_t) -1))
+                return -ENOBUFS;
+
+        /* Exactly what was asked for, the caller knows best */
+        if (need > m->body_allocated) {
+                void *o, *k;
+
+                o = m->body;
+                k = realloc(m->body, need);
+                if (!k)
+                        return -ENOMEM;
+
+                m->body = k;
+                m->body_allocated = need;
+                m->free_body = true;
+                message_adjust_body(m, o, 0);
         }
 
-        m->free_body = true;
+        if (n_fds > 0) {
+                if (!m->allow_fds)
+                        return -ENOTSUP;
 
-        return p;
+                if (!GREEDY_REALLOC(m->fds, m->fds_allocated, m->n_fds + n_fds))
+                        return -ENOMEM;
+                m->free_fds = true;
+        }
+
+        return 0;
 }
 
 int message_append_basic(sd_bus_message *m, char type, const void *p, const void **stored) {
@@ -865,7 +974,7 @@ int message_append_basic(sd_bus_message *m, char type, const void *p, const void
                         goto fail;
                 }
 
-                f = realloc(m->fds, sizeof(int) * (m->n_fds + 1));
+                f = GREEDY_REALLOC(m->fds, m->fds_allocated, m->n_fds + 1);
                 if (!f) {
                         r = -ENOMEM;
                         goto fail;
@@ -941,6 +1050,47 @@ int sd_bus_message_append_basic(sd_bus_message *m, char type, const void *p) {
         return message_append_basic(m, type, p, NULL);
 }
 
+/* All elements of an array share the signature of the array, which
+ * was validated when the array was opened. If the contents asked for
+ * are exactly that, then they are valid too, and there is no need to
+ * parse them again for each element. */
+static bool container_is_element(struct bus_container *c, char begin, const char *contents, char end) {
+        size_t l;
+
+        assert(c);
+        assert(contents);
+
+        if (c->enclosing != SD_BUS_TYPE_ARRAY || !c->signature)
+                return false;
+
+        if (c->signature[0] != begin)
+                return false;
+
+        l = strlen(contents);
+        if (strncmp(c->signature + 1, contents, l) != 0)
+                return false;
+
+        if (end == 0)
+                return c->signature[1 + l] == 0;
+
+        return c->signature[1 + l] == end && c->signature[2 + l] == 0;
+}
+
+/* Same for finding the end of the element at s, which inside an
+ * array is the end of the signature */
+static int container_element_length(struct bus_container *c, const char *s, size_t *l) {
+        assert(c);
+        assert(s);
+        assert(l);
+
+        if (c->enclosing == SD_BUS_TYPE_ARRAY) {
+                *l = strlen(s);
+                return 0;
+        }
+
+        return signature_element_length(s, l);
+}
+
 static int bus_message_open_array(
                 sd_bus_message *m,
                 struct bus_container *c,
@@ -958,7 +1108,8 @@ static int bus_message_open_array(
         assert(contents);
         assert(array_size);
 
-        if (!signature_is_single(contents))
+        if (!container_is_element(c, SD_BUS_TYPE_ARRAY, contents, 0) &&
+            !signature_is_single(contents))
                 return -EINVAL;
 
         alignment = bus_type_get_alignment(contents[0]);
@@ -1084,7 +1235,8 @@ static int bus_message_open_struct(
         assert(c);
         assert(contents);
 
-        if (!signature_is_valid(contents, false))
+        if (!container_is_element(c, SD_BUS_TYPE_STRUCT_BEGIN, contents, SD_BUS_TYPE_STRUCT_END) &&
+            !signature_is_valid(contents, false))
                 return -EINVAL;
 
         if (c->signature && c->signature[c->index]) {
@@ -1134,7 +1286,8 @@ static int bus_message_open_dict_entry(
         assert(c);
         assert(contents);
 
-        if (!signature_is_pair(contents))
+        if (!container_is_element(c, SD_BUS_TYPE_DICT_ENTRY_BEGIN, contents, SD_BUS_TYPE_DICT_ENTRY_END) &&
+            !signature_is_pair(contents))
                 return -EINVAL;
 
         if (c->enclosing != SD_BUS_TYPE_ARRAY)
@@ -1678,7 +1831,8 @@ static int bus_message_enter_array(
         assert(contents);
         assert(array_size);
 
-        if (!signature_is_single(contents))
+        if (!container_is_element(c, SD_BUS_TYPE_ARRAY, contents, 0) &&
+            !signature_is_single(contents))
                 return -EINVAL;
 
         alignment = bus_type_get_alignment(contents[0]);
@@ -1782,7 +1936,8 @@ static int bus_message_enter_struct(
         assert(c);
         assert(contents);
 
-        if (!signature_is_valid(contents, false))
+        if (!container_is_element(c, SD_BUS_TYPE_STRUCT_BEGIN, contents, SD_BUS_TYPE_STRUCT_END) &&
+            !signature_is_valid(contents, false))
                 return -EINVAL;
 
         if (!c->signature || c->signature[c->index] == 0)
@@ -1817,7 +1972,8 @@ static int bus_message_enter_dict_entry(
         assert(c);
         assert(contents);
 
-        if (!signature_is_pair(contents))
+        if (!container_is_element(c, SD_BUS_TYPE_DICT_ENTRY_BEGIN, contents, SD_BUS_TYPE_DICT_ENTRY_END) &&
+            !signature_is_pair(contents))
                 return -EINVAL;
 
         if (c->enclosing != SD_BUS_TYPE_ARRAY)
@@ -1976,7 +2132,7 @@ int sd_bus_message_peek_type(sd_bus_message *m, char *type, const char **content
                         size_t l;
                         char *sig;
 
-                        r = signature_element_length(c->signature+c->index+1, &l);
+                        r = container_element_length(c, c->signature+c->index+1, &l);
                         if (r < 0)
                                 return r;
 
@@ -2005,7 +2161,7 @@ int sd_bus_message_peek_type(sd_bus_message *m, char *type, const char **content
                         size_t l;
                         char *sig;
 
-                        r = signature_element_length(c->signature+c->index, &l);
+                        r = container_element_length(c, c->signature+c->index, &l);
                         if (r < 0)
                                 return r;
 
@@ -2703,7 +2859,7 @@ static void setup_iovec(sd_bus_message *m) {
                 }
         }
 
-        if (m->body) {
+        if (m->body && m->body_memfd < 0) {
                 m->iovec[m->n_iovec].iov_base = m->body;
                 m->iovec[m->n_iovec].iov_len = m->header->body_size;
                 m->size += m->iovec[m->n_iovec].iov_len;
@@ -2743,6 +2899,53 @@ int bus_message_seal(sd_bus_message *m, uint64_t serial) {
         return 0;
 }
 
+int bus_message_body_to_memfd(sd_bus_message *m) {
+        _cleanup_close_ int fd = -1;
+        size_t size;
+        void *p;
+
+        assert(m);
+        assert(m->sealed);
+
+        if (m->body_memfd >= 0)
+                return 0;
+
+        size = m->header->body_size;
+        if (size <= 0)
+                return -EINVAL;
+
+        fd = memfd_create("sd-bus-body", MFD_ALLOW_SEALING|MFD_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        if (loop_write(fd, m->body, size, false) != (ssize_t) size)
+                return -EIO;
+
+        if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL) < 0)
+                return -errno;
+
+        /* Keep reading the body from the memfd, so that it is in
+         * memory only once */
+        p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+                return -errno;
+
+        if (m->free_body)
+                free(m->body);
+
+        m->body = p;
+        m->free_body = false;
+        m->body_allocated = 0;
+        m->body_mapped = size;
+        m->body_memfd = fd;
+        fd = -1;
+
+        m->header->flags |= BUS_MESSAGE_BODY_MEMFD;
+        setup_iovec(m);
+
+        return 0;
+}
+
 int sd_bus_message_set_destination(sd_bus_message *m, const char *destination) {
         if (!m)
                 return -EINVAL;
@@ -2965,6 +3168,10 @@ int bus_message_get_blob(sd_bus_message *m, void **buffer, size_t *sz) {
         for (i = 0, total = 0; i < m->n_iovec; i++)
                 total += m->iovec[i].iov_len;
 
+        /* The blob always carries the body inline */
+        if (m->body_memfd >= 0)
+                total += BUS_MESSAGE_BODY_SIZE(m);
+
         p = malloc(total);
         if (!p)
                 return -ENOMEM;
@@ -2972,6 +3179,11 @@ int bus_message_get_blob(sd_bus_message *m, void **buffer, size_t *sz) {
         for (i = 0, e = p; i < m->n_iovec; i++)
                 e = mempcpy(e, m->iovec[i].iov_base, m->iovec[i].iov_len);
 
+        if (m->body_memfd >= 0) {
+                memcpy(e, m->body, BUS_MESSAGE_BODY_SIZE(m));
+                ((struct bus_header*) p)->flags &= ~BUS_MESSAGE_BODY_MEMFD;
+        }
+
         *buffer = p;
         *sz = total;
 
@@ -3020,9 +3232,9 @@ const char* bus_message_get_arg(sd_bus_message *m, unsigned i) {
         if (r < 0)
                 return NULL;
 
-        while (i > 0) {
+        for (;;) {
                 r = sd_bus_message_peek_type(m, &type, NULL);
-                if (r < 0)
+                if (r <= 0)
                         return NULL;
 
                 if (type != SD_BUS_TYPE_STRING &&
@@ -3034,6 +3246,9 @@ const char* bus_message_get_arg(sd_bus_message *m, unsigned i) {
                 if (r < 0)
                         return NULL;
 
+                if (i == 0)
+                        break;
+
                 i--;
         }
 
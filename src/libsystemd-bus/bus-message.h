@@ -80,6 +80,16 @@ struct sd_bus_message {
         void *fields;
         void *body;
 
+        /* If the body is passed as memfd, it is mapped read-only
+         * from it and not part of the iovecs */
+        int body_memfd;
+        size_t body_mapped;
+
+        /* what is allocated for appending, in bytes */
+        size_t fields_allocated;
+        size_t body_allocated;
+        size_t fds_allocated;
+
         char *label;
 
         size_t rindex;
@@ -134,9 +144,12 @@ int bus_message_dump(sd_bus_message *m);
 int bus_message_get_blob(sd_bus_message *m, void **buffer, size_t *sz);
 int bus_message_read_strv_extend(sd_bus_message *m, char ***l);
 
+int bus_message_body_to_memfd(sd_bus_message *m);
+
 int bus_message_from_malloc(
                 void *buffer,
                 size_t length,
+                int body_memfd,
                 int *fds,
                 unsigned n_fds,
                 const struct ucred *ucred,
@@ -108,29 +108,37 @@ static int bus_socket_write_auth(sd_bus *b) {
 }
 
 static int bus_socket_auth_verify_client(sd_bus *b) {
-        char *e, *f, *start;
+        char *e, *f, *g, *start;
         sd_id128_t peer;
         unsigned i;
         int r;
 
         assert(b);
 
-        /* We expect two response lines: "OK" and possibly
-         * "AGREE_UNIX_FD" */
+        /* We expect up to three response lines: "OK", and possibly
+         * "AGREE_UNIX_FD" and "AGREE_MEMFD" */
 
         e = memmem(b->rbuffer, b->rbuffer_size, "\r\n", 2);
         if (!e)
                 return 0;
 
+        f = g = NULL;
+        start = e + 2;
+
         if (b->negotiate_fds) {
-                f = memmem(e + 2, b->rbuffer_size - (e - (char*) b->rbuffer) - 2, "\r\n", 2);
+                f = memmem(start, b->rbuffer_size - (start - (char*) b->rbuffer), "\r\n", 2);
                 if (!f)
                         return 0;
 
                 start = f + 2;
-        } else {
-                f = NULL;
-                start = e + 2;
+
+                if (b->negotiate_memfd) {
+                        g = memmem(start, b->rbuffer_size - (start - (char*) b->rbuffer), "\r\n", 2);
+                        if (!g)
+                                return 0;
+
+                        start = g + 2;
+                }
         }
 
         /* Nice! We got all the lines we need. First check the OK
@@ -162,13 +170,18 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
 
         b->server_id = peer;
 
-        /* And possibly check the second line, too */
+        /* And possibly check the other lines, too */
 
         if (f)
                 b->can_fds =
                         (f - e == sizeof("\r\nAGREE_UNIX_FD") - 1) &&
                         memcmp(e + 2, "AGREE_UNIX_FD", sizeof("AGREE_UNIX_FD") - 1) == 0;
 
+        if (g)
+                b->can_memfd = b->can_fds &&
+                        (g - f == sizeof("\r\nAGREE_MEMFD") - 1) &&
+                        memcmp(f + 2, "AGREE_MEMFD", sizeof("AGREE_MEMFD") - 1) == 0;
+
         b->rbuffer_size -= (start - (char*) b->rbuffer);
         memmove(b->rbuffer, start, b->rbuffer_size);
 
@@ -411,6 +424,13 @@ static int bus_socket_auth_verify_server(sd_bus *b) {
                                 b->can_fds = true;
                                 r = bus_socket_auth_write(b, "AGREE_UNIX_FD\r\n");
                         }
+                } else if (line_equals(line, l, "NEGOTIATE_MEMFD")) {
+                        if (b->auth == _BUS_AUTH_INVALID || !b->can_fds || !b->negotiate_memfd)
+                                r = bus_socket_auth_write(b, "ERROR\r\n");
+                        else {
+                                b->can_memfd = true;
+                                r = bus_socket_auth_write(b, "AGREE_MEMFD\r\n");
+                        }
                 } else
                         r = bus_socket_auth_write(b, "ERROR\r\n");
 
@@ -468,6 +488,7 @@ static int bus_socket_read_auth(sd_bus *b) {
                 return -ENOMEM;
 
         b->rbuffer = p;
+        b->rbuffer_allocated = n;
 
         zero(iov);
         iov.iov_base = (uint8_t*) b->rbuffer + b->rbuffer_size;
@@ -592,7 +613,9 @@ static int bus_socket_start_auth_client(sd_bus *b) {
         if (!b->auth_buffer)
                 return -ENOMEM;
 
-        if (b->negotiate_fds)
+        if (b->negotiate_fds && b->negotiate_memfd)
+                auth_suffix = "\r\nNEGOTIATE_UNIX_FD\r\nNEGOTIATE_MEMFD\r\nBEGIN\r\n";
+        else if (b->negotiate_fds)
                 auth_suffix = "\r\nNEGOTIATE_UNIX_FD\r\nBEGIN\r\n";
         else
                 auth_suffix = "\r\nBEGIN\r\n";
@@ -718,51 +741,90 @@ int bus_socket_take_fd(sd_bus *b) {
         return bus_socket_start_auth(b);
 }
 
-int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+int bus_socket_write_queue(sd_bus *bus, sd_bus_message **q, unsigned n, size_t *idx) {
         struct iovec *iov;
         ssize_t k;
-        size_t n;
-        unsigned j;
+        size_t sum;
+        unsigned i, j, n_iovec, n_fds;
 
         assert(bus);
-        assert(m);
+        assert(q);
+        assert(n > 0);
         assert(idx);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (*idx >= m->size)
+        if (*idx >= q[0]->size)
                 return 0;
 
-        n = m->n_iovec * sizeof(struct iovec);
-        iov = alloca(n);
-        memcpy(iov, m->iovec, n);
+        /* Large bodies go to a sealed memfd if the peer can take
+         * them that way. This is decided only now, as the message
+         * might have been queued before the authentication
+         * finished. If it fails the body is simply sent inline. */
+        if (*idx == 0 &&
+            bus->can_memfd &&
+            !bus->prefer_writev &&
+            q[0]->body_memfd < 0 &&
+            BUS_MESSAGE_BODY_SIZE(q[0]) >= BUS_MEMFD_MIN_SIZE &&
+            q[0]->n_fds < BUS_FDS_MAX)
+                bus_message_body_to_memfd(q[0]);
+
+        /* Gather as many of the queued messages into one write as
+         * fit into the batch size. The kernel attaches fds to the
+         * first bytes of a write, hence a message carrying fds must
+         * always start one. */
+        n_iovec = q[0]->n_iovec;
+        sum = q[0]->size - *idx;
+        for (i = 1; i < n; i++) {
+                if (q[i]->n_fds > 0 || q[i]->body_memfd >= 0)
+                        break;
+                if (sum + q[i]->size > BUS_WRITE_BATCH_SIZE)
+                        break;
+
+                n_iovec += q[i]->n_iovec;
+                sum += q[i]->size;
+        }
+        n = i;
+
+        iov = alloca(n_iovec * sizeof(struct iovec));
+        for (i = 0, j = 0; i < n; i++) {
+                memcpy(iov + j, q[i]->iovec, q[i]->n_iovec * sizeof(struct iovec));
+                j += q[i]->n_iovec;
+        }
 
         j = 0;
         iovec_advance(iov, &j, *idx);
 
         if (bus->prefer_writev)
-                k = writev(bus->output_fd, iov, m->n_iovec);
+                k = writev(bus->output_fd, iov + j, n_iovec - j);
         else {
                 struct msghdr mh;
                 zero(mh);
 
-                if (m->n_fds > 0) {
+                /* If the message was partially written already,
+                 * its fds went out with the first part. A body
+                 * memfd follows the fds of the message itself. */
+                n_fds = q[0]->n_fds + (q[0]->body_memfd >= 0);
+                if (n_fds > 0 && *idx == 0) {
                         struct cmsghdr *control;
-                        control = alloca(CMSG_SPACE(sizeof(int) * m->n_fds));
+                        control = alloca(CMSG_SPACE(sizeof(int) * n_fds));
 
                         mh.msg_control = control;
                         control->cmsg_level = SOL_SOCKET;
                         control->cmsg_type = SCM_RIGHTS;
-                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * m->n_fds);
-                        memcpy(CMSG_DATA(control), m->fds, sizeof(int) * m->n_fds);
+                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
+                        memcpy(CMSG_DATA(control), q[0]->fds, sizeof(int) * q[0]->n_fds);
+
+                        if (q[0]->body_memfd >= 0)
+                                ((int*) CMSG_DATA(control))[q[0]->n_fds] = q[0]->body_memfd;
                 }
 
-                mh.msg_iov = iov;
-                mh.msg_iovlen = m->n_iovec;
+                mh.msg_iov = iov + j;
+                mh.msg_iovlen = n_iovec - j;
 
                 k = sendmsg(bus->output_fd, &mh, MSG_DONTWAIT|MSG_NOSIGNAL);
                 if (k < 0 && errno == ENOTSOCK) {
                         bus->prefer_writev = true;
-                        k = writev(bus->output_fd, iov, m->n_iovec);
+                        k = writev(bus->output_fd, iov + j, n_iovec - j);
                 }
         }
 
@@ -773,7 +835,14 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         return 1;
 }
 
+int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+        assert(m);
+
+        return bus_socket_write_queue(bus, &m, 1, idx);
+}
+
 static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
+        const uint8_t *p;
         uint32_t a, b;
         uint8_t e;
         uint64_t sum;
@@ -782,7 +851,7 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         assert(need);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (bus->rbuffer_size < sizeof(struct bus_header)) {
+        if (bus->rbuffer_size - bus->rindex < sizeof(struct bus_header)) {
                 *need = sizeof(struct bus_header) + 8;
 
                 /* Minimum message size:
@@ -804,10 +873,12 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
                 return 0;
         }
 
-        a = ((const uint32_t*) bus->rbuffer)[1];
-        b = ((const uint32_t*) bus->rbuffer)[3];
+        /* Messages read ahead are not necessarily aligned */
+        p = (const uint8_t*) bus->rbuffer + bus->rindex;
+        memcpy(&a, p + 4, sizeof(a));
+        memcpy(&b, p + 12, sizeof(b));
 
-        e = ((const uint8_t*) bus->rbuffer)[0];
+        e = p[0];
         if (e == SD_BUS_LITTLE_ENDIAN) {
                 a = le32toh(a);
                 b = le32toh(b);
@@ -821,6 +892,14 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         if (sum >= BUS_MESSAGE_SIZE_MAX)
                 return -ENOBUFS;
 
+        /* A body passed as memfd is not part of the stream */
+        if (p[2] & BUS_MESSAGE_BODY_MEMFD) {
+                if (!bus->can_memfd)
+                        return -EBADMSG;
+
+                sum -= a;
+        }
+
         *need = (size_t) sum;
         return 0;
 }
@@ -828,33 +907,59 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
 static int bus_socket_make_message(sd_bus *bus, size_t size, sd_bus_message **m) {
         sd_bus_message *t;
         void *b;
-        int r;
+        int memfd = -1, r;
 
         assert(bus);
         assert(m);
-        assert(bus->rbuffer_size >= size);
+        assert(bus->rbuffer_size - bus->rindex >= size);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (bus->rbuffer_size > size) {
-                b = memdup((const uint8_t*) bus->rbuffer + size,
-                           bus->rbuffer_size - size);
+        /* A message that was read into a buffer of its own is
+         * handed over as it is. Messages sharing the read-ahead
+         * buffer with others are copied out of it, which keeps the
+         * buffer around for the next read. */
+        if (bus->rindex == 0 && bus->rbuffer_size == size &&
+            (bus->can_fds || size >= BUS_READ_BATCH_SIZE))
+                b = bus->rbuffer;
+        else {
+                b = memdup((const uint8_t*) bus->rbuffer + bus->rindex, size);
                 if (!b)
                         return -ENOMEM;
-        } else
-                b = NULL;
+        }
+
+        /* The body memfd is the last of the fds that came with the
+         * message */
+        if (((const uint8_t*) b)[2] & BUS_MESSAGE_BODY_MEMFD) {
+                if (bus->n_fds <= 0) {
+                        if (b != bus->rbuffer)
+                                free(b);
+                        return -EBADMSG;
+                }
+
+                memfd = bus->fds[--bus->n_fds];
+        }
 
-        r = bus_message_from_malloc(bus->rbuffer, size,
+        r = bus_message_from_malloc(b, size, memfd,
                                     bus->fds, bus->n_fds,
                                     bus->ucred_valid ? &bus->ucred : NULL,
                                     bus->label[0] ? bus->label : NULL,
                                     &t);
         if (r < 0) {
-                free(b);
+                if (b != bus->rbuffer)
+                        free(b);
+                if (memfd >= 0)
+                        close_nointr_nofail(memfd);
                 return r;
         }
 
-        bus->rbuffer = b;
-        bus->rbuffer_size -= size;
+        if (b == bus->rbuffer) {
+                bus->rbuffer = NULL;
+                bus->rbuffer_size = bus->rbuffer_allocated = 0;
+        } else {
+                bus->rindex += size;
+                if (bus->rindex >= bus->rbuffer_size)
+                        bus->rbuffer_size = bus->rindex = 0;
+        }
 
         bus->fds = NULL;
         bus->n_fds = 0;
@@ -867,7 +972,7 @@ int bus_socket_read_message(sd_bus *bus, sd_bus_message **m) {
         struct msghdr mh;
         struct iovec iov;
         ssize_t k;
-        size_t need;
+        size_t need, want;
         int r;
         void *b;
         union {
@@ -877,7 +982,7 @@ int bus_socket_read_message(sd_bus *bus, sd_bus_message **m) {
                             CMSG_SPACE(NAME_MAX)]; /*selinux label */
         } control;
         struct cmsghdr *cmsg;
-        bool handle_cmsg;
+        bool handle_cmsg = false;
 
         assert(bus);
         assert(m);
@@ -887,18 +992,35 @@ int bus_socket_read_message(sd_bus *bus, sd_bus_message **m) {
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size >= need)
+        if (bus->rbuffer_size - bus->rindex >= need)
                 return bus_socket_make_message(bus, need, m);
 
-        b = realloc(bus->rbuffer, need);
-        if (!b)
-                return -ENOMEM;
+        /* Move what we have of the current message to the front */
+        if (bus->rindex > 0) {
+                bus->rbuffer_size -= bus->rindex;
+                memmove(bus->rbuffer, (uint8_t*) bus->rbuffer + bus->rindex, bus->rbuffer_size);
+                bus->rindex = 0;
+        }
 
-        bus->rbuffer = b;
+        /* Read ahead, so that a single read picks up all messages
+         * queued in the socket that fit. The kernel hands out fds
+         * with whatever bytes a read returns, hence with fd passing
+         * enabled we never read past the current message, so that
+         * they stay attributed to the right one. */
+        want = bus->can_fds ? need : MAX(need, (size_t) BUS_READ_BATCH_SIZE);
+
+        if (want > bus->rbuffer_allocated) {
+                b = realloc(bus->rbuffer, want);
+                if (!b)
+                        return -ENOMEM;
+
+                bus->rbuffer = b;
+                bus->rbuffer_allocated = want;
+        }
 
         zero(iov);
         iov.iov_base = (uint8_t*) bus->rbuffer + bus->rbuffer_size;
-        iov.iov_len = need - bus->rbuffer_size;
+        iov.iov_len = want - bus->rbuffer_size;
 
         if (bus->prefer_readv)
                 k = readv(bus->input_fd, &iov, 1);
@@ -940,7 +1062,7 @@ int bus_socket_read_message(sd_bus *bus, sd_bus_message **m) {
                                         return -EIO;
                                 }
 
-                                f = realloc(bus->fds, sizeof(int) + (bus->n_fds + n));
+                                f = realloc(bus->fds, sizeof(int) * (bus->n_fds + n));
                                 if (!f) {
                                         close_many((int*) CMSG_DATA(cmsg), n);
                                         return -ENOMEM;
@@ -977,7 +1099,7 @@ int bus_socket_read_message(sd_bus *bus, sd_bus_message **m) {
         if (r < 0)
                 return r;
 
-        if (bus->rbuffer_size >= need)
+        if (bus->rbuffer_size - bus->rindex >= need)
                 return bus_socket_make_message(bus, need, m);
 
         return 1;
@@ -0,0 +1,613 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <stdlib.h>
+
+#include "util.h"
+#include "list.h"
+
+#include "sd-bus.h"
+#include "bus-internal.h"
+#include "bus-message.h"
+#include "bus-signature.h"
+#include "bus-type.h"
+#include "bus-error.h"
+#include "bus-vtable.h"
+
+/* Objects registered with a vtable are dispatched by the library
+ * itself: methods and properties are looked up by binary search in
+ * arrays sorted by member name, which are built once when the vtable
+ * is added. Signatures are validated at that time too, so that
+ * checking the one of a call comes down to a string comparison. The
+ * Properties interface is answered straight from the vtable. */
+
+static const char *vtable_member(const sd_bus_vtable *e) {
+        assert(e);
+
+        if (e->type == _SD_BUS_VTABLE_METHOD)
+                return e->x.method.member;
+
+        assert(e->type == _SD_BUS_VTABLE_PROPERTY);
+        return e->x.property.member;
+}
+
+static int vtable_compare(const void *a, const void *b) {
+        const sd_bus_vtable * const *x = a, * const *y = b;
+
+        return strcmp(vtable_member(*x), vtable_member(*y));
+}
+
+static int vtable_lookup_compare(const void *key, const void *b) {
+        const sd_bus_vtable * const *y = b;
+
+        return strcmp(key, vtable_member(*y));
+}
+
+static const sd_bus_vtable *vtable_find(const sd_bus_vtable **l, unsigned n, const char *member) {
+        const sd_bus_vtable **e;
+
+        if (!member || n <= 0)
+                return NULL;
+
+        e = bsearch(member, l, n, sizeof(*l), vtable_lookup_compare);
+        return e ? *e : NULL;
+}
+
+static struct object_vtable *object_vtable_find(struct object_vtable *first, const char *interface) {
+        struct object_vtable *v;
+
+        LIST_FOREACH(vtables, v, first)
+                if (streq_ptr(v->interface, interface))
+                        return v;
+
+        return NULL;
+}
+
+static void object_vtable_free(struct object_vtable *v) {
+        if (!v)
+                return;
+
+        free(v->methods);
+        free(v->properties);
+        free(v->interface);
+        free(v->path);
+        free(v);
+}
+
+static int sort_members(const sd_bus_vtable **l, unsigned n) {
+        unsigned i;
+
+        qsort(l, n, sizeof(*l), vtable_compare);
+
+        for (i = 1; i < n; i++)
+                if (streq(vtable_member(l[i-1]), vtable_member(l[i])))
+                        return -EINVAL;
+
+        return 0;
+}
+
+static int object_vtable_index(struct object_vtable *v) {
+        const sd_bus_vtable *e;
+        unsigned n_methods = 0, n_properties = 0;
+        int r;
+
+        assert(v);
+
+        if (v->vtable[0].type != _SD_BUS_VTABLE_START)
+                return -EINVAL;
+
+        for (e = v->vtable + 1; e->type != _SD_BUS_VTABLE_END; e++) {
+
+                switch (e->type) {
+
+                case _SD_BUS_VTABLE_METHOD:
+                        if (!member_name_is_valid(e->x.method.member) ||
+                            !signature_is_valid(strempty(e->x.method.signature), false) ||
+                            !signature_is_valid(strempty(e->x.method.result), false) ||
+                            !e->x.method.handler)
+                                return -EINVAL;
+
+                        n_methods++;
+                        break;
+
+                case _SD_BUS_VTABLE_PROPERTY:
+                        if (!member_name_is_valid(e->x.property.member) ||
+                            !e->x.property.signature ||
+                            !signature_is_single(e->x.property.signature))
+                                return -EINVAL;
+
+                        /* Without a getter we marshal the field
+                         * ourselves, which works for basic types
+                         * only */
+                        if (!e->x.property.get &&
+                            (!bus_type_is_basic(e->x.property.signature[0]) || e->x.property.signature[1] != 0))
+                                return -EINVAL;
+
+                        n_properties++;
+                        break;
+
+                default:
+                        return -EINVAL;
+                }
+        }
+
+        v->methods = new(const sd_bus_vtable*, MAX(n_methods, 1U));
+        v->properties = new(const sd_bus_vtable*, MAX(n_properties, 1U));
+        if (!v->methods || !v->properties)
+                return -ENOMEM;
+
+        for (e = v->vtable + 1; e->type != _SD_BUS_VTABLE_END; e++) {
+                if (e->type == _SD_BUS_VTABLE_METHOD)
+                        v->methods[v->n_methods++] = e;
+                else
+                        v->properties[v->n_properties++] = e;
+        }
+
+        r = sort_members(v->methods, v->n_methods);
+        if (r < 0)
+                return r;
+
+        return sort_members(v->properties, v->n_properties);
+}
+
+static int reply_unknown(sd_bus *bus, sd_bus_message *m, const sd_bus_error *error) {
+        int r;
+
+        /* Leave the call to handlers registered with
+         * sd_bus_add_object() for the same path, if there are any */
+        if (hashmap_get(bus->object_callbacks, m->path))
+                return 0;
+
+        r = sd_bus_reply_method_error(bus, m, error);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
+static int reply_errno(sd_bus *bus, sd_bus_message *m, int error) {
+        _cleanup_bus_error_free_ sd_bus_error e = SD_BUS_ERROR_NULL;
+        int r;
+
+        bus_error_from_errno(&e, error);
+
+        r = sd_bus_reply_method_error(bus, m, &e);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
+static int reply_invalid_args(sd_bus *bus, sd_bus_message *m, const char *interface, const char *signature) {
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        int r;
+
+        sd_bus_error_set(&error,
+                         "org.freedesktop.DBus.Error.InvalidArgs",
+                         "Invalid arguments '%s' to call %s.%s(), expecting '%s'.",
+                         strempty(m->root_container.signature), interface, m->member, signature);
+
+        r = sd_bus_reply_method_error(bus, m, &error);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
+static int process_method(sd_bus *bus, sd_bus_message *m, struct object_vtable *first) {
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        const sd_bus_vtable *e = NULL;
+        struct object_vtable *v;
+        int r;
+
+        LIST_FOREACH(vtables, v, first) {
+                if (m->interface && !streq(v->interface, m->interface))
+                        continue;
+
+                e = vtable_find(v->methods, v->n_methods, m->member);
+                if (e)
+                        break;
+        }
+
+        if (!e) {
+                sd_bus_error_set(&error,
+                                 "org.freedesktop.DBus.Error.UnknownMethod",
+                                 "Unknown method '%s' or interface '%s'.", m->member, strna(m->interface));
+
+                return reply_unknown(bus, m, &error);
+        }
+
+        if (!streq(strempty(m->root_container.signature), strempty(e->x.method.signature)))
+                return reply_invalid_args(bus, m, v->interface, strempty(e->x.method.signature));
+
+        r = e->x.method.handler(bus, 0, m, v->userdata);
+        if (r < 0)
+                return reply_errno(bus, m, r);
+
+        return 1;
+}
+
+static int append_property(sd_bus *bus, struct object_vtable *v, const sd_bus_vtable *e, sd_bus_message *reply) {
+        const char *signature;
+        void *p;
+        int r;
+
+        assert(bus);
+        assert(v);
+        assert(e);
+        assert(reply);
+
+        signature = e->x.property.signature;
+        p = (uint8_t*) v->userdata + e->x.property.offset;
+
+        r = sd_bus_message_open_container(reply, SD_BUS_TYPE_VARIANT, signature);
+        if (r < 0)
+                return r;
+
+        if (e->x.property.get)
+                r = e->x.property.get(bus, v->path, v->interface, e->x.property.member, reply, p);
+        else if (signature[0] == SD_BUS_TYPE_STRING || signature[0] == SD_BUS_TYPE_SIGNATURE)
+                r = sd_bus_message_append_basic(reply, signature[0], strempty(*(const char**) p));
+        else if (signature[0] == SD_BUS_TYPE_OBJECT_PATH)
+                r = sd_bus_message_append_basic(reply, signature[0], *(const char**) p);
+        else
+                r = sd_bus_message_append_basic(reply, signature[0], p);
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_close_container(reply);
+}
+
+static int append_all_properties(sd_bus *bus, struct object_vtable *v, sd_bus_message *reply) {
+        const sd_bus_vtable *e;
+        int r;
+
+        for (e = v->vtable + 1; e->type != _SD_BUS_VTABLE_END; e++) {
+                if (e->type != _SD_BUS_VTABLE_PROPERTY)
+                        continue;
+
+                r = sd_bus_message_open_container(reply, SD_BUS_TYPE_DICT_ENTRY, "sv");
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_append_basic(reply, SD_BUS_TYPE_STRING, e->x.property.member);
+                if (r < 0)
+                        return r;
+
+                r = append_property(bus, v, e, reply);
+                if (r < 0)
+                        return r;
+
+                r = sd_bus_message_close_container(reply);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int process_properties(sd_bus *bus, sd_bus_message *m, struct object_vtable *first) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        const char *interface, *property = NULL, *signature;
+        const sd_bus_vtable *e = NULL;
+        struct object_vtable *v;
+        int r;
+
+        if (streq_ptr(m->member, "Get"))
+                signature = "ss";
+        else if (streq_ptr(m->member, "GetAll"))
+                signature = "s";
+        else if (streq_ptr(m->member, "Set"))
+                signature = "ssv";
+        else {
+                sd_bus_error_set(&error,
+                                 "org.freedesktop.DBus.Error.UnknownMethod",
+                                 "Unknown method '%s' on interface '%s'.", m->member, m->interface);
+
+                return reply_unknown(bus, m, &error);
+        }
+
+        if (!streq(strempty(m->root_container.signature), signature))
+                return reply_invalid_args(bus, m, m->interface, signature);
+
+        if (signature[1] == 's')
+                r = sd_bus_message_read(m, "ss", &interface, &property);
+        else
+                r = sd_bus_message_read(m, "s", &interface);
+        if (r < 0)
+                return reply_errno(bus, m, r);
+
+        if (property) {
+                v = object_vtable_find(first, interface);
+                if (v)
+                        e = vtable_find(v->properties, v->n_properties, property);
+                if (!e) {
+                        sd_bus_error_set(&error,
+                                         "org.freedesktop.DBus.Error.UnknownProperty",
+                                         "Unknown property '%s' on interface '%s'.", property, interface);
+
+                        return reply_unknown(bus, m, &error);
+                }
+
+                if (streq(m->member, "Set")) {
+                        sd_bus_error_set(&error,
+                                         "org.freedesktop.DBus.Error.PropertyReadOnly",
+                                         "Property '%s' is read-only.", property);
+
+                        r = sd_bus_reply_method_error(bus, m, &error);
+                        if (r < 0)
+                                return r;
+
+                        return 1;
+                }
+        } else if (!isempty(interface) && !object_vtable_find(first, interface)) {
+                sd_bus_error_set(&error,
+                                 "org.freedesktop.DBus.Error.UnknownInterface",
+                                 "Unknown interface '%s'.", interface);
+
+                return reply_unknown(bus, m, &error);
+        }
+
+        if (m->header->flags & SD_BUS_MESSAGE_NO_REPLY_EXPECTED)
+                return 1;
+
+        r = sd_bus_message_new_method_return(bus, m, &reply);
+        if (r < 0)
+                return r;
+
+        if (e)
+                r = append_property(bus, v, e, reply);
+        else {
+                r = sd_bus_message_open_container(reply, SD_BUS_TYPE_ARRAY, "{sv}");
+                if (r < 0)
+                        return r;
+
+                /* An empty interface asks for the properties of
+                 * all of them */
+                LIST_FOREACH(vtables, v, first) {
+                        if (!isempty(interface) && !streq(v->interface, interface))
+                                continue;
+
+                        r = append_all_properties(bus, v, reply);
+                        if (r < 0)
+                                break;
+                }
+
+                if (r >= 0)
+                        r = sd_bus_message_close_container(reply);
+        }
+        if (r < 0)
+                return reply_errno(bus, m, r);
+
+        r = sd_bus_send(bus, reply, NULL);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
+int bus_vtable_process(sd_bus *bus, sd_bus_message *m) {
+        struct object_vtable *first;
+
+        assert(bus);
+        assert(m);
+
+        if (m->header->type != SD_BUS_MESSAGE_TYPE_METHOD_CALL)
+                return 0;
+
+        if (!m->path)
+                return 0;
+
+        first = hashmap_get(bus->object_vtables, m->path);
+        if (!first)
+                return 0;
+
+        if (streq_ptr(m->interface, "org.freedesktop.DBus.Properties"))
+                return process_properties(bus, m, first);
+
+        /* Introspection is done by process_introspect(), which asks
+         * us for our part */
+        if (streq_ptr(m->interface, "org.freedesktop.DBus.Introspectable"))
+                return 0;
+
+        return process_method(bus, m, first);
+}
+
+static int introspect_args(FILE *f, const char *signature, const char *direction) {
+        int r;
+
+        signature = strempty(signature);
+        while (*signature) {
+                size_t l;
+
+                r = signature_element_length(signature, &l);
+                if (r < 0)
+                        return r;
+
+                fprintf(f, "   <arg type=\"%.*s\" direction=\"%s\"/>\n", (int) l, signature, direction);
+                signature += l;
+        }
+
+        return 0;
+}
+
+int bus_vtable_introspect(sd_bus *bus, const char *path, FILE *f) {
+        struct object_vtable *first, *v;
+        const sd_bus_vtable *e;
+        int r;
+
+        assert(bus);
+        assert(path);
+        assert(f);
+
+        first = hashmap_get(bus->object_vtables, path);
+        if (!first)
+                return 0;
+
+        fputs(SD_BUS_INTROSPECT_INTERFACE_PROPERTIES, f);
+
+        LIST_FOREACH(vtables, v, first) {
+                fprintf(f, " <interface name=\"%s\">\n", v->interface);
+
+                for (e = v->vtable + 1; e->type != _SD_BUS_VTABLE_END; e++) {
+
+                        if (e->type == _SD_BUS_VTABLE_METHOD) {
+                                fprintf(f, "  <method name=\"%s\">\n", e->x.method.member);
+
+                                r = introspect_args(f, e->x.method.signature, "in");
+                                if (r < 0)
+                                        return r;
+
+                                r = introspect_args(f, e->x.method.result, "out");
+                                if (r < 0)
+                                        return r;
+
+                                fputs("  </method>\n", f);
+                        } else
+                                fprintf(f, "  <property name=\"%s\" type=\"%s\" access=\"read\"/>\n",
+                                        e->x.property.member, e->x.property.signature);
+                }
+
+                fputs(" </interface>\n", f);
+        }
+
+        return 1;
+}
+
+void bus_vtable_free_all(sd_bus *bus) {
+        struct object_vtable *first, *v;
+
+        assert(bus);
+
+        while ((first = hashmap_steal_first(bus->object_vtables)))
+                while ((v = first)) {
+                        LIST_REMOVE(struct object_vtable, vtables, first, v);
+                        object_vtable_free(v);
+                }
+
+        hashmap_free(bus->object_vtables);
+        bus->object_vtables = NULL;
+}
+
+int sd_bus_add_object_vtable(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                const sd_bus_vtable *vtable,
+                void *userdata) {
+
+        struct object_vtable *first, *v;
+        int r;
+
+        if (!bus)
+                return -EINVAL;
+        if (!path || !object_path_is_valid(path))
+                return -EINVAL;
+        if (!interface || !interface_name_is_valid(interface))
+                return -EINVAL;
+        if (!vtable)
+                return -EINVAL;
+
+        /* These are implemented by us */
+        if (streq(interface, "org.freedesktop.DBus.Properties") ||
+            streq(interface, "org.freedesktop.DBus.Introspectable") ||
+            streq(interface, "org.freedesktop.DBus.Peer"))
+                return -EINVAL;
+
+        r = hashmap_ensure_allocated(&bus->object_vtables, string_hash_func, string_compare_func);
+        if (r < 0)
+                return r;
+
+        if (!bus->object_trie) {
+                bus->object_trie = path_trie_new();
+                if (!bus->object_trie)
+                        return -ENOMEM;
+        }
+
+        first = hashmap_get(bus->object_vtables, path);
+        if (object_vtable_find(first, interface))
+                return -EEXIST;
+
+        v = new0(struct object_vtable, 1);
+        if (!v)
+                return -ENOMEM;
+
+        v->vtable = vtable;
+        v->userdata = userdata;
+
+        v->path = strdup(path);
+        v->interface = strdup(interface);
+        if (!v->path || !v->interface) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        r = object_vtable_index(v);
+        if (r < 0)
+                goto fail;
+
+        r = path_trie_add(bus->object_trie, v->path, v);
+        if (r < 0)
+                goto fail;
+
+        LIST_PREPEND(struct object_vtable, vtables, first, v);
+
+        r = hashmap_replace(bus->object_vtables, v->path, v);
+        if (r < 0) {
+                LIST_REMOVE(struct object_vtable, vtables, first, v);
+                goto fail;
+        }
+
+        return 0;
+
+fail:
+        path_trie_remove(bus->object_trie, v->path, v);
+        object_vtable_free(v);
+        return r;
+}
+
+int sd_bus_remove_object_vtable(sd_bus *bus, const char *path, const char *interface) {
+        struct object_vtable *first, *v;
+
+        if (!bus)
+                return -EINVAL;
+        if (!path)
+                return -EINVAL;
+        if (!interface)
+                return -EINVAL;
+
+        first = hashmap_get(bus->object_vtables, path);
+        v = object_vtable_find(first, interface);
+        if (!v)
+                return 0;
+
+        LIST_REMOVE(struct object_vtable, vtables, first, v);
+
+        if (first)
+                assert_se(hashmap_replace(bus->object_vtables, first->path, first) >= 0);
+        else
+                assert_se(hashmap_remove(bus->object_vtables, path) == v);
+
+        path_trie_remove(bus->object_trie, v->path, v);
+        object_vtable_free(v);
+
+        return 1;
+}
@@ -27,10 +27,23 @@
 #include "bus-message.h"
 #include "bus-internal.h"
 
+static int read_reply(sd_bus_call_group *g, unsigned idx, const char *types, void *p) {
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        int r;
+
+        r = sd_bus_call_group_get_reply(g, idx, NULL, &reply);
+        if (r < 0)
+                return r;
+
+        return sd_bus_message_read(reply, types, p);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_bus_unref_ sd_bus *bus = NULL;
+        _cleanup_bus_call_group_free_ sd_bus_call_group *g = NULL;
         _cleanup_strv_free_ char **l = NULL;
         char **i;
+        unsigned k;
         int r;
         size_t max_i = 0;
 
@@ -48,24 +61,62 @@ int main(int argc, char *argv[]) {
 
         strv_sort(l);
 
-        STRV_FOREACH(i, l)
+        /* Ask for the details of all names at once, instead of
+         * waiting for each reply in turn */
+        r = sd_bus_call_group_new(bus, &g);
+        if (r < 0) {
+                log_oom();
+                goto fail;
+        }
+
+        STRV_FOREACH(i, l) {
+                static const char *const methods[] = {
+                        "GetConnectionUnixProcessID",
+                        "GetConnectionUnixUser",
+                        "GetNameOwner",
+                };
+
+                for (k = 0; k < ELEMENTSOF(methods); k++) {
+                        r = sd_bus_call_group_add_method(
+                                        g,
+                                        "org.freedesktop.DBus",
+                                        "/",
+                                        "org.freedesktop.DBus",
+                                        methods[k],
+                                        NULL,
+                                        "s",
+                                        *i);
+                        if (r < 0) {
+                                log_error("Failed to issue method call: %s", strerror(-r));
+                                goto fail;
+                        }
+                }
+
                 max_i = MAX(max_i, strlen(*i));
+        }
+
+        /* Names whose calls timed out are shown without details */
+        r = sd_bus_call_group_wait(g, 0);
+        if (r < 0 && r != -ETIMEDOUT) {
+                log_error("Failed to wait for replies: %s", strerror(-r));
+                goto fail;
+        }
 
         printf("%-*s %*s %-*s %-*s CONNECTION\n",
                (int) max_i, "NAME", 10, "PID", 15, "PROCESS", 16, "USER");
 
+        k = 0;
         STRV_FOREACH(i, l) {
-                _cleanup_free_ char *owner = NULL;
-                pid_t pid;
-                uid_t uid;
+                const char *owner;
+                uint32_t pid, uid;
 
                 /* if ((*i)[0] == ':') */
                 /*         continue; */
 
                 printf("%-*s", (int) max_i, *i);
 
-                r = sd_bus_get_owner_pid(bus, *i, &pid);
-                if (r >= 0) {
+                r = read_reply(g, k++, "u", &pid);
+                if (r >= 0 && pid > 0) {
                         _cleanup_free_ char *comm = NULL;
 
                         printf(" %10lu", (unsigned long) pid);
@@ -75,7 +126,7 @@ int main(int argc, char *argv[]) {
                 } else
                         printf("          - -              ");
 
-                r = sd_bus_get_owner_uid(bus, *i, &uid);
+                r = read_reply(g, k++, "u", &uid);
                 if (r >= 0) {
                         _cleanup_free_ char *u = NULL;
 
@@ -92,7 +143,9 @@ int main(int argc, char *argv[]) {
                 } else
                         printf(" -               ");
 
-                r = sd_bus_get_owner(bus, *i, &owner);
+                /* The string stays valid as long as the reply, which
+                 * the group keeps */
+                r = read_reply(g, k++, "s", &owner);
                 if (r >= 0)
                         printf(" %s\n", owner);
                 else
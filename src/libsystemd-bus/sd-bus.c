@@ -30,7 +30,6 @@
 #include "util.h"
 #include "macro.h"
 #include "strv.h"
-#include "set.h"
 
 #include "sd-bus.h"
 #include "bus-internal.h"
@@ -38,6 +37,7 @@
 #include "bus-type.h"
 #include "bus-socket.h"
 #include "bus-control.h"
+#include "bus-vtable.h"
 
 static int bus_poll(sd_bus *bus, bool need_more, uint64_t timeout_usec);
 
@@ -83,6 +83,8 @@ static void bus_free(sd_bus *b) {
         }
 
         hashmap_free(b->object_callbacks);
+        bus_vtable_free_all(b);
+        path_trie_free(b->object_trie);
 
         bus_match_free(&b->match_callbacks);
 
@@ -202,6 +204,16 @@ int sd_bus_set_negotiate_fds(sd_bus *bus, int b) {
         return 0;
 }
 
+int sd_bus_set_negotiate_memfd(sd_bus *bus, int b) {
+        if (!bus)
+                return -EINVAL;
+        if (bus->state != BUS_UNSET)
+                return -EPERM;
+
+        bus->negotiate_memfd = !!b;
+        return 0;
+}
+
 int sd_bus_set_server(sd_bus *bus, int b, sd_id128_t server_id) {
         if (!bus)
                 return -EINVAL;
@@ -859,6 +871,8 @@ void sd_bus_close(sd_bus *bus) {
         if (!bus)
                 return;
 
+        bus_detach_event(bus);
+
         if (bus->input_fd >= 0)
                 close_nointr_nofail(bus->input_fd);
         if (bus->output_fd >= 0 && bus->output_fd != bus->input_fd)
@@ -957,29 +971,28 @@ static int dispatch_wqueue(sd_bus *bus) {
                 return -ENOTCONN;
 
         while (bus->wqueue_size > 0) {
+                unsigned n;
 
-                r = bus_socket_write_message(bus, bus->wqueue[0], &bus->windex);
+                r = bus_socket_write_queue(bus, bus->wqueue, bus->wqueue_size, &bus->windex);
                 if (r < 0) {
                         sd_bus_close(bus);
                         return r;
                 } else if (r == 0)
                         /* Didn't do anything this time */
                         return ret;
-                else if (bus->windex >= bus->wqueue[0]->size) {
-                        /* Fully written. Let's drop the entry from
-                         * the queue.
-                         *
-                         * This isn't particularly optimized, but
-                         * well, this is supposed to be our worst-case
-                         * buffer only, and the socket buffer is
-                         * supposed to be our primary buffer, and if
-                         * it got full, then all bets are off
-                         * anyway. */
-
-                        sd_bus_message_unref(bus->wqueue[0]);
-                        bus->wqueue_size --;
-                        memmove(bus->wqueue, bus->wqueue + 1, sizeof(sd_bus_message*) * bus->wqueue_size);
-                        bus->windex = 0;
+
+                /* A single write might have covered several
+                 * messages. Let's drop all entries that are fully
+                 * written now from the queue, windex then refers
+                 * to the first one left. */
+                for (n = 0; n < bus->wqueue_size && bus->windex >= bus->wqueue[n]->size; n++) {
+                        bus->windex -= bus->wqueue[n]->size;
+                        sd_bus_message_unref(bus->wqueue[n]);
+                }
+
+                if (n > 0) {
+                        bus->wqueue_size -= n;
+                        memmove(bus->wqueue, bus->wqueue + n, sizeof(sd_bus_message*) * bus->wqueue_size);
 
                         ret = 1;
                 }
@@ -1025,6 +1038,25 @@ static int dispatch_rqueue(sd_bus *bus, sd_bus_message **m) {
         return ret;
 }
 
+static int bus_wqueue_append(sd_bus *bus, sd_bus_message *m) {
+        sd_bus_message **q;
+
+        assert(bus);
+        assert(m);
+
+        if (bus->wqueue_size >= BUS_WQUEUE_MAX)
+                return -ENOBUFS;
+
+        q = realloc(bus->wqueue, sizeof(sd_bus_message*) * (bus->wqueue_size + 1));
+        if (!q)
+                return -ENOMEM;
+
+        bus->wqueue = q;
+        q[bus->wqueue_size ++] = sd_bus_message_ref(m);
+
+        return 0;
+}
+
 int sd_bus_send(sd_bus *bus, sd_bus_message *m, uint64_t *serial) {
         int r;
 
@@ -1045,6 +1077,9 @@ int sd_bus_send(sd_bus *bus, sd_bus_message *m, uint64_t *serial) {
                         return -ENOTSUP;
         }
 
+        if (m->body_memfd >= 0 && !bus->can_memfd)
+                return -ENOTSUP;
+
         /* If the serial number isn't kept, then we know that no reply
          * is expected */
         if (!serial && !m->sealed)
@@ -1077,19 +1112,10 @@ int sd_bus_send(sd_bus *bus, sd_bus_message *m, uint64_t *serial) {
                         bus->windex = idx;
                 }
         } else {
-                sd_bus_message **q;
-
                 /* Just append it to the queue. */
-
-                if (bus->wqueue_size >= BUS_WQUEUE_MAX)
-                        return -ENOBUFS;
-
-                q = realloc(bus->wqueue, sizeof(sd_bus_message*) * (bus->wqueue_size + 1));
-                if (!q)
-                        return -ENOMEM;
-
-                bus->wqueue = q;
-                q[bus->wqueue_size ++] = sd_bus_message_ref(m);
+                r = bus_wqueue_append(bus, m);
+                if (r < 0)
+                        return r;
         }
 
         if (serial)
@@ -1372,6 +1398,286 @@ int sd_bus_send_with_reply_and_block(
         }
 }
 
+int sd_bus_call_group_new(sd_bus *bus, sd_bus_call_group **ret) {
+        sd_bus_call_group *g;
+
+        if (!bus)
+                return -EINVAL;
+        if (!ret)
+                return -EINVAL;
+
+        g = new0(sd_bus_call_group, 1);
+        if (!g)
+                return -ENOMEM;
+
+        g->bus = sd_bus_ref(bus);
+
+        *ret = g;
+        return 0;
+}
+
+void sd_bus_call_group_free(sd_bus_call_group *g) {
+        unsigned i;
+
+        if (!g)
+                return;
+
+        for (i = 0; i < g->n_slots; i++) {
+                sd_bus_message_unref(g->slots[i]->reply);
+                free(g->slots[i]);
+        }
+
+        free(g->slots);
+        hashmap_free(g->pending);
+        sd_bus_unref(g->bus);
+        free(g);
+}
+
+int sd_bus_call_group_add(sd_bus_call_group *g, sd_bus_message *m, unsigned *idx) {
+        struct call_group_slot *s;
+        sd_bus *bus;
+        int r;
+
+        if (!g)
+                return -EINVAL;
+        if (!m)
+                return -EINVAL;
+
+        bus = g->bus;
+
+        if (bus->state == BUS_UNSET)
+                return -ENOTCONN;
+        if (bus->output_fd < 0)
+                return -ENOTCONN;
+        if (m->header->type != SD_BUS_MESSAGE_TYPE_METHOD_CALL)
+                return -EINVAL;
+        if (m->header->flags & SD_BUS_MESSAGE_NO_REPLY_EXPECTED)
+                return -EINVAL;
+
+        if (m->n_fds > 0) {
+                r = sd_bus_can_send(bus, SD_BUS_TYPE_UNIX_FD);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return -ENOTSUP;
+        }
+
+        if (m->body_memfd >= 0 && !bus->can_memfd)
+                return -ENOTSUP;
+
+        r = bus_ensure_running(bus);
+        if (r < 0)
+                return r;
+
+        r = hashmap_ensure_allocated(&g->pending, uint64_hash_func, uint64_compare_func);
+        if (r < 0)
+                return r;
+
+        if (!GREEDY_REALLOC(g->slots, g->n_allocated, g->n_slots + 1))
+                return -ENOMEM;
+
+        r = bus_seal_message(bus, m);
+        if (r < 0)
+                return r;
+
+        s = new0(struct call_group_slot, 1);
+        if (!s)
+                return -ENOMEM;
+
+        s->serial = BUS_MESSAGE_SERIAL(m);
+
+        r = hashmap_put(g->pending, &s->serial, s);
+        if (r < 0) {
+                free(s);
+                return r;
+        }
+
+        /* Only queue the call for now, so that all calls of the
+         * group go out in as few writes as possible once we wait for
+         * them */
+        r = bus_wqueue_append(bus, m);
+        if (r < 0) {
+                hashmap_remove(g->pending, &s->serial);
+                free(s);
+                return r;
+        }
+
+        if (idx)
+                *idx = g->n_slots;
+
+        g->slots[g->n_slots++] = s;
+
+        return 0;
+}
+
+int sd_bus_call_group_add_method(
+                sd_bus_call_group *g,
+                const char *destination,
+                const char *path,
+                const char *interface,
+                const char *member,
+                unsigned *idx,
+                const char *types, ...) {
+
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+        va_list ap;
+        int r;
+
+        if (!g)
+                return -EINVAL;
+
+        r = sd_bus_message_new_method_call(g->bus, destination, path, interface, member, &m);
+        if (r < 0)
+                return r;
+
+        va_start(ap, types);
+        r = bus_message_append_ap(m, types, ap);
+        va_end(ap);
+        if (r < 0)
+                return r;
+
+        return sd_bus_call_group_add(g, m, idx);
+}
+
+static bool call_group_take(sd_bus_call_group *g, sd_bus_message *m) {
+        struct call_group_slot *s;
+
+        assert(g);
+        assert(m);
+
+        if (m->header->type != SD_BUS_MESSAGE_TYPE_METHOD_RETURN &&
+            m->header->type != SD_BUS_MESSAGE_TYPE_METHOD_ERROR)
+                return false;
+
+        s = hashmap_remove(g->pending, &m->reply_serial);
+        if (!s)
+                return false;
+
+        s->reply = m;
+        return true;
+}
+
+int sd_bus_call_group_wait(sd_bus_call_group *g, uint64_t usec) {
+        usec_t timeout;
+        bool room = false;
+        unsigned i, j;
+        sd_bus *bus;
+        int r;
+
+        if (!g)
+                return -EINVAL;
+
+        bus = g->bus;
+
+        if (hashmap_isempty(g->pending))
+                return 0;
+
+        if (bus->state == BUS_UNSET)
+                return -ENOTCONN;
+        if (bus->input_fd < 0)
+                return -ENOTCONN;
+
+        /* Replies might have been queued up already, by blocking
+         * calls made since ours were added */
+        for (i = 0, j = 0; i < bus->rqueue_size; i++)
+                if (!call_group_take(g, bus->rqueue[i]))
+                        bus->rqueue[j++] = bus->rqueue[i];
+        bus->rqueue_size = j;
+
+        timeout = calc_elapse(usec);
+
+        r = dispatch_wqueue(bus);
+        if (r < 0)
+                return r;
+
+        while (!hashmap_isempty(g->pending)) {
+                sd_bus_message *incoming = NULL;
+                usec_t left;
+
+                if (!room) {
+                        sd_bus_message **q;
+
+                        if (bus->rqueue_size >= BUS_RQUEUE_MAX)
+                                return -ENOBUFS;
+
+                        q = realloc(bus->rqueue, (bus->rqueue_size + 1) * sizeof(sd_bus_message*));
+                        if (!q)
+                                return -ENOMEM;
+
+                        bus->rqueue = q;
+                        room = true;
+                }
+
+                r = bus_socket_read_message(bus, &incoming);
+                if (r < 0)
+                        return r;
+                if (incoming) {
+                        /* Everything that is not ours is left for
+                         * sd_bus_process() */
+                        if (!call_group_take(g, incoming)) {
+                                bus->rqueue[bus->rqueue_size ++] = incoming;
+                                room = false;
+                        }
+
+                        continue;
+                }
+                if (r != 0)
+                        continue;
+
+                if (timeout > 0) {
+                        usec_t n;
+
+                        n = now(CLOCK_MONOTONIC);
+                        if (n >= timeout)
+                                return -ETIMEDOUT;
+
+                        left = timeout - n;
+                } else
+                        left = (uint64_t) -1;
+
+                r = bus_poll(bus, true, left);
+                if (r < 0)
+                        return r;
+
+                r = dispatch_wqueue(bus);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+int sd_bus_call_group_get_reply(sd_bus_call_group *g, unsigned idx, sd_bus_error *error, sd_bus_message **reply) {
+        struct call_group_slot *s;
+        int r;
+
+        if (!g)
+                return -EINVAL;
+        if (idx >= g->n_slots)
+                return -EINVAL;
+        if (bus_error_is_dirty(error))
+                return -EINVAL;
+
+        s = g->slots[idx];
+
+        /* Not answered before the wait timed out */
+        if (!s->reply)
+                return -ETIMEDOUT;
+
+        if (s->reply->header->type == SD_BUS_MESSAGE_TYPE_METHOD_ERROR) {
+                r = sd_bus_error_copy(error, &s->reply->error);
+                if (r < 0)
+                        return r;
+
+                return bus_error_to_errno(&s->reply->error);
+        }
+
+        if (reply)
+                *reply = sd_bus_message_ref(s->reply);
+
+        return 0;
+}
+
 int sd_bus_get_fd(sd_bus *bus) {
         if (!bus)
                 return -EINVAL;
@@ -1635,7 +1941,7 @@ static int process_object(sd_bus *bus, sd_bus_message *m) {
         pl = strlen(m->path);
 
         do {
-                char p[pl+1];
+                char p[pl+1], *e;
 
                 bus->object_callbacks_modified = false;
 
@@ -1651,16 +1957,17 @@ static int process_object(sd_bus *bus, sd_bus_message *m) {
                         found = true;
                 }
 
-                /* Look for fallback prefixes */
+                /* Look for fallback prefixes, chopping off one
+                 * component after the other from the end */
                 strcpy(p, m->path);
+                e = p + pl;
                 for (;;) {
-                        char *e;
-
                         if (bus->object_callbacks_modified)
                                 break;
 
-                        e = strrchr(p, '/');
-                        if (e == p || !e)
+                        while (e > p && *(--e) != '/')
+                                ;
+                        if (e == p)
                                 break;
 
                         *e = 0;
@@ -1704,12 +2011,10 @@ static int process_object(sd_bus *bus, sd_bus_message *m) {
 static int process_introspect(sd_bus *bus, sd_bus_message *m) {
         _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
         _cleanup_free_ char *introspection = NULL;
-        _cleanup_set_free_free_ Set *s = NULL;
+        _cleanup_strv_free_ char **children = NULL;
         _cleanup_fclose_ FILE *f = NULL;
-        struct object_callback *c;
-        Iterator i;
         size_t size = 0;
-        char *node;
+        char **node;
         int r;
 
         assert(bus);
@@ -1721,41 +2026,13 @@ static int process_introspect(sd_bus *bus, sd_bus_message *m) {
         if (!m->path)
                 return 0;
 
-        s = set_new(string_hash_func, string_compare_func);
-        if (!s)
-                return -ENOMEM;
-
-        HASHMAP_FOREACH(c, bus->object_callbacks, i) {
-                const char *e;
-                char *a, *p;
-
-                if (streq(c->path, "/"))
-                        continue;
-
-                if (streq(m->path, "/"))
-                        e = c->path;
-                else {
-                        e = startswith(c->path, m->path);
-                        if (!e || *e != '/')
-                                continue;
-                }
-
-                a = strdup(e+1);
-                if (!a)
-                        return -ENOMEM;
-
-                p = strchr(a, '/');
-                if (p)
-                        *p = 0;
-
-                r = set_put(s, a);
-                if (r < 0) {
-                        free(a);
+        /* The trie knows the child nodes in the tree right away,
+         * instead of us checking each registered object */
+        r = path_trie_list_children(bus->object_trie, m->path, &children);
+        if (r < 0)
+                return r;
 
-                        if (r != -EEXIST)
-                                return r;
-                }
-        }
+        strv_sort(children);
 
         f = open_memstream(&introspection, &size);
         if (!f)
@@ -1766,10 +2043,12 @@ static int process_introspect(sd_bus *bus, sd_bus_message *m) {
         fputs(SD_BUS_INTROSPECT_INTERFACE_PEER, f);
         fputs(SD_BUS_INTROSPECT_INTERFACE_INTROSPECTABLE, f);
 
-        while ((node = set_steal_first(s))) {
-                fprintf(f, " <node name=\"%s\"/>\n", node);
-                free(node);
-        }
+        r = bus_vtable_introspect(bus, m->path, f);
+        if (r < 0)
+                return r;
+
+        STRV_FOREACH(node, children)
+                fprintf(f, " <node name=\"%s\"/>\n", *node);
 
         fputs("</node>\n", f);
 
@@ -1821,6 +2100,10 @@ static int process_message(sd_bus *bus, sd_bus_message *m) {
         if (r != 0)
                 return r;
 
+        r = bus_vtable_process(bus, m);
+        if (r != 0)
+                return r;
+
         r = process_object(bus, m);
         if (r != 0)
                 return r;
@@ -2030,6 +2313,128 @@ int sd_bus_flush(sd_bus *bus) {
         }
 }
 
+static int bus_event_process(sd_bus *bus) {
+        int r;
+
+        /* Messages read ahead in one go are already complete in our
+         * buffer, so keep going until there is nothing left to do */
+        do
+                r = sd_bus_process(bus, NULL);
+        while (r > 0);
+
+        return r;
+}
+
+static int io_callback(EventSource *s, int fd, uint32_t revents, void *userdata) {
+        return bus_event_process(userdata);
+}
+
+static int time_callback(EventSource *s, usec_t usec, void *userdata) {
+        return bus_event_process(userdata);
+}
+
+static int prepare_callback(EventSource *s, void *userdata) {
+        sd_bus *bus = userdata;
+        uint64_t until;
+        int events, r;
+
+        assert(bus);
+
+        events = sd_bus_get_events(bus);
+        if (events < 0)
+                return events;
+
+        if (bus->output_io_source) {
+                r = event_source_set_io_events(bus->input_io_source, events & POLLIN);
+                if (r < 0)
+                        return r;
+
+                r = event_source_set_io_events(bus->output_io_source, events & POLLOUT);
+                if (r < 0)
+                        return r;
+
+                r = event_source_set_enabled(bus->output_io_source, events & POLLOUT);
+                if (r < 0)
+                        return r;
+        } else {
+                r = event_source_set_io_events(bus->input_io_source, events);
+                if (r < 0)
+                        return r;
+        }
+
+        /* Messages might have been queued up by a blocking call from
+         * some other callback, which we need to dispatch right away */
+        if (bus->rqueue_size > 0) {
+                until = 0;
+                r = 1;
+        } else {
+                r = sd_bus_get_timeout(bus, &until);
+                if (r < 0)
+                        return r;
+        }
+
+        if (r > 0) {
+                r = event_source_set_time(bus->time_source, until);
+                if (r < 0)
+                        return r;
+        }
+
+        return event_source_set_enabled(bus->time_source, r > 0);
+}
+
+int bus_attach_event(sd_bus *bus, EventLoop *e) {
+        int r;
+
+        if (!bus)
+                return -EINVAL;
+        if (!e)
+                return -EINVAL;
+        if (bus->event)
+                return -EBUSY;
+        if (bus->input_fd < 0)
+                return -ENOTCONN;
+
+        bus->event = e;
+
+        r = event_add_io(e, bus->input_fd, EPOLLIN, io_callback, bus, &bus->input_io_source);
+        if (r < 0)
+                goto fail;
+
+        if (bus->output_fd != bus->input_fd) {
+                r = event_add_io(e, bus->output_fd, EPOLLOUT, io_callback, bus, &bus->output_io_source);
+                if (r < 0)
+                        goto fail;
+        }
+
+        r = event_add_time(e, 0, time_callback, bus, &bus->time_source);
+        if (r < 0)
+                goto fail;
+
+        /* The events and the timeout we wait for are recalculated
+         * before each iteration, as they change with every message
+         * queued or received */
+        r = event_source_set_prepare(bus->input_io_source, prepare_callback);
+        if (r < 0)
+                goto fail;
+
+        return 0;
+
+fail:
+        bus_detach_event(bus);
+        return r;
+}
+
+void bus_detach_event(sd_bus *bus) {
+        assert(bus);
+
+        event_source_free(bus->input_io_source);
+        event_source_free(bus->output_io_source);
+        event_source_free(bus->time_source);
+
+        bus->input_io_source = bus->output_io_source = bus->time_source = NULL;
+        bus->event = NULL;
+}
+
 int sd_bus_add_filter(sd_bus *bus, sd_bus_message_handler_t callback, void *userdata) {
         struct filter_callback *f;
 
@@ -2090,6 +2495,12 @@ static int bus_add_object(
         if (r < 0)
                 return r;
 
+        if (!bus->object_trie) {
+                bus->object_trie = path_trie_new();
+                if (!bus->object_trie)
+                        return -ENOMEM;
+        }
+
         c = new0(struct object_callback, 1);
         if (!c)
                 return -ENOMEM;
@@ -2104,15 +2515,24 @@ static int bus_add_object(
         c->userdata = userdata;
         c->is_fallback = fallback;
 
-        bus->object_callbacks_modified = true;
         r = hashmap_put(bus->object_callbacks, c->path, c);
+        if (r < 0)
+                goto fail;
+
+        r = path_trie_add(bus->object_trie, c->path, c);
         if (r < 0) {
-                free(c->path);
-                free(c);
-                return r;
+                hashmap_remove(bus->object_callbacks, c->path);
+                path_trie_remove(bus->object_trie, c->path, c);
+                goto fail;
         }
 
+        bus->object_callbacks_modified = true;
         return 0;
+
+fail:
+        free(c->path);
+        free(c);
+        return r;
 }
 
 static int bus_remove_object(
@@ -2140,6 +2560,7 @@ static int bus_remove_object(
 
         bus->object_callbacks_modified = true;
         assert_se(c == hashmap_remove(bus->object_callbacks, c->path));
+        path_trie_remove(bus->object_trie, c->path, c);
 
         free(c->path);
         free(c);
@@ -35,6 +35,79 @@
 #include "sd-bus.h"
 #include "bus-message.h"
 
+/* Shaped like the reply to ListUnits(), the largest message systemctl
+ * has to deal with, where the element signature of the array is the
+ * same for each of the many structs in it */
+static void bench_units(unsigned n_units) {
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+        const char *id, *description, *load, *active, *sub, *following, *job_type;
+        const char *unit_path, *job_path;
+        const char *contents;
+        uint32_t job_id;
+        usec_t t, t_append, t_read;
+        unsigned i;
+        char type;
+        int r;
+
+        r = sd_bus_message_new_method_call(NULL, "foobar.waldo", "/", "foobar.waldo", "Units", &m);
+        assert_se(r >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+
+        r = sd_bus_message_open_container(m, 'a', "(ssssssouso)");
+        assert_se(r >= 0);
+
+        for (i = 0; i < n_units; i++) {
+                r = sd_bus_message_append(m, "(ssssssouso)",
+                                          "foobar.service", "Foo Bar Service",
+                                          "loaded", "active", "running", "",
+                                          "/org/freedesktop/systemd1/unit/foobar_2eservice",
+                                          (uint32_t) 0, "", "/");
+                assert_se(r >= 0);
+        }
+
+        r = sd_bus_message_close_container(m);
+        assert_se(r >= 0);
+
+        r = bus_message_seal(m, 4713);
+        assert_se(r >= 0);
+
+        t_append = now(CLOCK_MONOTONIC) - t;
+
+        r = sd_bus_message_rewind(m, true);
+        assert_se(r >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+
+        r = sd_bus_message_enter_container(m, 'a', "(ssssssouso)");
+        assert_se(r > 0);
+
+        for (i = 0; i < n_units; i++) {
+                r = sd_bus_message_peek_type(m, &type, &contents);
+                assert_se(r > 0);
+                assert_se(type == SD_BUS_TYPE_STRUCT);
+                assert_se(streq(contents, "ssssssouso"));
+
+                r = sd_bus_message_read(m, "(ssssssouso)",
+                                        &id, &description, &load, &active, &sub, &following,
+                                        &unit_path, &job_id, &job_type, &job_path);
+                assert_se(r > 0);
+                assert_se(streq(id, "foobar.service"));
+                assert_se(streq(job_path, "/"));
+        }
+
+        r = sd_bus_message_peek_type(m, &type, &contents);
+        assert_se(r == 0);
+
+        r = sd_bus_message_exit_container(m);
+        assert_se(r >= 0);
+
+        t_read = now(CLOCK_MONOTONIC) - t;
+
+        log_info("%u units: appended in %llu usec, read in %llu usec",
+                 n_units, (unsigned long long) t_append, (unsigned long long) t_read);
+}
+
 int main(int argc, char *argv[]) {
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
         int r, boolean;
@@ -123,7 +196,7 @@ int main(int argc, char *argv[]) {
 
         m = sd_bus_message_unref(m);
 
-        r = bus_message_from_malloc(buffer, sz, NULL, 0, NULL, NULL, &m);
+        r = bus_message_from_malloc(buffer, sz, -1, NULL, 0, NULL, NULL, &m);
         assert_se(r >= 0);
 
         bus_message_dump(m);
@@ -171,5 +244,55 @@ int main(int argc, char *argv[]) {
         r = sd_bus_message_peek_type(m, NULL, NULL);
         assert_se(r == 0);
 
+        {
+                _cleanup_bus_message_unref_ sd_bus_message *n = NULL;
+                unsigned i;
+                void *body;
+
+                r = sd_bus_message_new_method_call(NULL, "foobar.waldo", "/", "foobar.waldo", "List", &n);
+                assert_se(r >= 0);
+
+                /* Appending within the reserved space must not move the body */
+                r = sd_bus_message_reserve(n, 4 + 1000 * 8, 0);
+                assert_se(r >= 0);
+                body = n->body;
+
+                r = sd_bus_message_open_container(n, 'a', "s");
+                assert_se(r >= 0);
+
+                for (i = 0; i < 1000; i++) {
+                        r = sd_bus_message_append_basic(n, 's', "abc");
+                        assert_se(r >= 0);
+                }
+
+                r = sd_bus_message_close_container(n);
+                assert_se(r >= 0);
+                assert_se(n->body == body);
+                assert_se(n->header->body_size == 4 + 1000 * 8);
+
+                r = bus_message_seal(n, 4712);
+                assert_se(r >= 0);
+
+                r = sd_bus_message_reserve(n, 1, 0);
+                assert_se(r == -EPERM);
+
+                r = sd_bus_message_rewind(n, true);
+                assert_se(r >= 0);
+
+                r = sd_bus_message_enter_container(n, 'a', "s");
+                assert_se(r > 0);
+
+                for (i = 0; i < 1000; i++) {
+                        r = sd_bus_message_read_basic(n, 's', &x);
+                        assert_se(r > 0);
+                        assert_se(streq(x, "abc"));
+                }
+
+                r = sd_bus_message_read_basic(n, 's', &x);
+                assert_se(r == 0);
+        }
+
+        bench_units(10000);
+
         return 0;
 }
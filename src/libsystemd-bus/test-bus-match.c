@@ -55,6 +55,50 @@ static bool mask_contains(unsigned a[], unsigned n) {
         return true;
 }
 
+#define N_UNITS 1000
+#define N_RUNS 1000
+
+static unsigned n_called = 0;
+
+static int count(sd_bus *b, int ret, sd_bus_message *m, void *userdata) {
+        n_called++;
+        return 0;
+}
+
+static void test_many(void) {
+        struct bus_match_node root;
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+        usec_t t;
+        unsigned i;
+
+        zero(root);
+        root.type = BUS_MATCH_ROOT;
+
+        /* One match per unit, like services watching all of them for
+         * PropertiesChanged do it */
+        for (i = 0; i < N_UNITS; i++) {
+                char match[256];
+
+                snprintf(match, sizeof(match),
+                         "type='signal',path_namespace='/org/freedesktop/systemd1/unit/u%u',arg0namespace='org.freedesktop.systemd%u'", i, i);
+                assert_se(bus_match_add(&root, match, count, INT_TO_PTR(i), NULL) >= 0);
+        }
+
+        assert_se(sd_bus_message_new_signal(NULL, "/org/freedesktop/systemd1/unit/u42/sub", "org.freedesktop.DBus.Properties", "PropertiesChanged", &m) >= 0);
+        assert_se(sd_bus_message_append(m, "s", "org.freedesktop.systemd42.Unit") >= 0);
+        assert_se(bus_message_seal(m, 1) >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < N_RUNS; i++)
+                assert_se(bus_match_run(NULL, &root, 0, m) == 0);
+        t = now(CLOCK_MONOTONIC) - t;
+
+        log_info("%u runs against %u matches took %llu usec", N_RUNS, N_UNITS, (unsigned long long) t);
+        assert_se(n_called == N_RUNS);
+
+        bus_match_free(&root);
+}
+
 int main(int argc, char *argv[]) {
         struct bus_match_node root;
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
@@ -81,7 +125,7 @@ int main(int argc, char *argv[]) {
         bus_match_dump(&root, 0);
 
         assert_se(sd_bus_message_new_signal(NULL, "/foo/bar", "bar", "waldo", &m) >= 0);
-        assert_se(sd_bus_message_append(m, "ssss", "one", "two", "/prefix/three", "prefix.four") >= 0);
+        assert_se(sd_bus_message_append(m, "sssss", "zero", "one", "two", "/prefix/three", "prefix.four") >= 0);
         assert_se(bus_message_seal(m, 1) >= 0);
 
         zero(mask);
@@ -110,5 +154,7 @@ int main(int argc, char *argv[]) {
 
         bus_match_free(&root);
 
+        test_many();
+
         return 0;
 }
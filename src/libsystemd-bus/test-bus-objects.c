@@ -0,0 +1,351 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "util.h"
+#include "macro.h"
+#include "strv.h"
+
+#include "sd-bus.h"
+#include "bus-internal.h"
+#include "bus-message.h"
+
+#define N_GROUP_CALLS 50
+
+struct context {
+        int fds[2];
+        bool quit;
+        char *something;
+        uint32_t value;
+};
+
+static int something_handler(sd_bus *bus, int ret, sd_bus_message *m, void *userdata) {
+        struct context *c = userdata;
+        const char *s;
+        char *n;
+        int r;
+
+        r = sd_bus_message_read(m, "s", &s);
+        assert_se(r > 0);
+
+        n = strjoin("<<<", s, ">>>", NULL);
+        assert_se(n);
+
+        free(c->something);
+        c->something = n;
+        c->value++;
+
+        log_info("AlterSomething() called, got %s, returning %s", s, n);
+
+        r = sd_bus_reply_method_return(bus, m, "s", n);
+        assert_se(r >= 0);
+
+        return 1;
+}
+
+static int exit_handler(sd_bus *bus, int ret, sd_bus_message *m, void *userdata) {
+        struct context *c = userdata;
+        int r;
+
+        c->quit = true;
+
+        r = sd_bus_reply_method_return(bus, m, "");
+        assert_se(r >= 0);
+
+        return 1;
+}
+
+static int failing_handler(sd_bus *bus, int ret, sd_bus_message *m, void *userdata) {
+        return -EACCES;
+}
+
+static int get_handler(sd_bus *bus, const char *path, const char *interface, const char *property, sd_bus_message *reply, void *userdata) {
+        struct context *c = userdata;
+
+        return sd_bus_message_append(reply, "as", 2, path, c->something ? c->something : "");
+}
+
+static const sd_bus_vtable vtable[] = {
+        SD_BUS_VTABLE_START,
+        SD_BUS_METHOD("AlterSomething", "s", "s", something_handler),
+        SD_BUS_METHOD("Exit", "", "", exit_handler),
+        SD_BUS_METHOD("Fail", "", "", failing_handler),
+        SD_BUS_PROPERTY("Value", "u", NULL, offsetof(struct context, value)),
+        SD_BUS_PROPERTY("Something", "s", NULL, offsetof(struct context, something)),
+        SD_BUS_PROPERTY("AutomaticStringProperty", "as", get_handler, 0),
+        SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable invalid_vtable[] = {
+        SD_BUS_VTABLE_START,
+        SD_BUS_METHOD("Twice", "", "", exit_handler),
+        SD_BUS_METHOD("Twice", "s", "", exit_handler),
+        SD_BUS_VTABLE_END
+};
+
+static void *server(void *p) {
+        struct context *c = p;
+        sd_bus *bus = NULL;
+        EventLoop *e = NULL;
+        sd_id128_t id;
+        int r;
+
+        c->quit = false;
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, c->fds[0], c->fds[0]) >= 0);
+        assert_se(sd_bus_set_server(bus, 1, id) >= 0);
+
+        assert_se(sd_bus_add_object_vtable(bus, "/foo", "org.freedesktop.systemd.test", vtable, c) >= 0);
+        assert_se(sd_bus_add_object_vtable(bus, "/foo", "org.freedesktop.systemd.test", vtable, c) == -EEXIST);
+        assert_se(sd_bus_add_object_vtable(bus, "/foo", "org.freedesktop.systemd.test2", vtable, c) >= 0);
+        assert_se(sd_bus_add_object_vtable(bus, "/foo", "org.freedesktop.DBus.Properties", vtable, c) == -EINVAL);
+        assert_se(sd_bus_add_object_vtable(bus, "/foo", "org.freedesktop.systemd.invalid", invalid_vtable, c) == -EINVAL);
+        assert_se(sd_bus_add_object_vtable(bus, "/foo/bar", "org.freedesktop.systemd.test", vtable, c) >= 0);
+
+        assert_se(sd_bus_remove_object_vtable(bus, "/foo", "org.freedesktop.systemd.test2") == 1);
+        assert_se(sd_bus_remove_object_vtable(bus, "/foo", "org.freedesktop.systemd.test2") == 0);
+
+        assert_se(sd_bus_start(bus) >= 0);
+
+        /* Serve the bus from an event loop, as daemons do */
+        assert_se(event_loop_new(&e) >= 0);
+        assert_se(bus_attach_event(bus, e) >= 0);
+        assert_se(bus_attach_event(bus, e) == -EBUSY);
+
+        while (!c->quit) {
+                r = event_loop_run(e, (usec_t) -1);
+                if (r < 0) {
+                        log_error("Failed to run event loop: %s", strerror(-r));
+                        goto fail;
+                }
+        }
+
+        r = 0;
+
+fail:
+        if (bus) {
+                sd_bus_flush(bus);
+                sd_bus_unref(bus);
+        }
+
+        event_loop_free(e);
+
+        return INT_TO_PTR(r);
+}
+
+static int call(sd_bus *bus, const char *path, const char *interface, const char *member,
+                sd_bus_error *error, sd_bus_message **reply, const char *types, ...) {
+
+        _cleanup_bus_message_unref_ sd_bus_message *m = NULL;
+        va_list ap;
+        int r;
+
+        r = sd_bus_message_new_method_call(bus, "org.freedesktop.systemd.test", path, interface, member, &m);
+        if (r < 0)
+                return r;
+
+        va_start(ap, types);
+        r = bus_message_append_ap(m, types, ap);
+        va_end(ap);
+        if (r < 0)
+                return r;
+
+        return sd_bus_send_with_reply_and_block(bus, m, 0, error, reply);
+}
+
+static int client(struct context *c) {
+        _cleanup_bus_unref_ sd_bus *bus = NULL;
+        _cleanup_bus_message_unref_ sd_bus_message *reply = NULL;
+        _cleanup_bus_error_free_ sd_bus_error error = SD_BUS_ERROR_NULL;
+        sd_bus_call_group *g;
+        const char *s, *name;
+        uint32_t u;
+        unsigned n, idx;
+
+        assert_se(sd_bus_new(&bus) >= 0);
+        assert_se(sd_bus_set_fd(bus, c->fds[1], c->fds[1]) >= 0);
+        assert_se(sd_bus_start(bus) >= 0);
+
+        assert_se(call(bus, "/foo", "org.freedesktop.systemd.test", "AlterSomething", &error, &reply, "s", "hallo") >= 0);
+        assert_se(sd_bus_message_read(reply, "s", &s) > 0);
+        assert_se(streq(s, "<<<hallo>>>"));
+        sd_bus_message_unref(reply);
+        reply = NULL;
+
+        /* Without interface the member is looked up on all of them */
+        assert_se(call(bus, "/foo", NULL, "AlterSomething", &error, &reply, "s", "test") >= 0);
+        assert_se(sd_bus_message_read(reply, "s", &s) > 0);
+        assert_se(streq(s, "<<<test>>>"));
+        sd_bus_message_unref(reply);
+        reply = NULL;
+
+        assert_se(call(bus, "/foo", "org.freedesktop.systemd.test", "AlterSomething", &error, NULL, "u", 4711) < 0);
+        assert_se(sd_bus_error_has_name(&error, "org.freedesktop.DBus.Error.InvalidArgs"));
+        sd_bus_error_free(&error);
+
+        assert_se(call(bus, "/foo", "org.freedesktop.systemd.test", "DoesNotExist", &error, NULL, "") < 0);
+        assert_se(sd_bus_error_has_name(&error, "org.freedesktop.DBus.Error.UnknownMethod"));
+        sd_bus_error_free(&error);
+
+        assert_se(call(bus, "/foo", "org.freedesktop.systemd.test2", "AlterSomething", &error, NULL, "s", "removed") < 0);
+        assert_se(sd_bus_error_has_name(&error, "org.freedesktop.DBus.Error.UnknownMethod"));
+        sd_bus_error_free(&error);
+
+        assert_se(call(bus, "/foo", "org.freedesktop.systemd.test", "Fail", &error, NULL, "") < 0);
+        assert_se(sd_bus_error_has_name(&error, "org.freedesktop.DBus.Error.AccessDenied"));
+        sd_bus_error_free(&error);
+
+        assert_se(call(bus, "/foo", "org.freedesktop.DBus.Properties", "Get", &error, &reply, "ss", "org.freedesktop.systemd.test", "Value") >= 0);
+        assert_se(sd_bus_message_enter_container(reply, 'v', "u") > 0);
+        assert_se(sd_bus_message_read(reply, "u", &u) > 0);
+        assert_se(u == 2);
+        assert_se(sd_bus_message_exit_container(reply) > 0);
+        sd_bus_message_unref(reply);
+        reply = NULL;
+
+        assert_se(call(bus, "/foo", "org.freedesktop.DBus.Properties", "Get", &error, &reply, "ss", "org.freedesktop.systemd.test", "Something") >= 0);
+        assert_se(sd_bus_message_read(reply, "v", "s", &s) > 0);
+        assert_se(streq(s, "<<<test>>>"));
+        sd_bus_message_unref(reply);
+        reply = NULL;
+
+        assert_se(call(bus, "/foo", "org.freedesktop.DBus.Properties", "Get", &error, NULL, "ss", "org.freedesktop.systemd.test", "DoesNotExist") < 0);
+        assert_se(sd_bus_error_has_name(&error, "org.freedesktop.DBus.Error.UnknownProperty"));
+        sd_bus_error_free(&error);
+
+        assert_se(call(bus, "/foo", "org.freedesktop.DBus.Properties", "Set", &error, NULL, "ssv", "org.freedesktop.systemd.test", "Value", "u", 7) < 0);
+        assert_se(sd_bus_error_has_name(&error, "org.freedesktop.DBus.Error.PropertyReadOnly"));
+        sd_bus_error_free(&error);
+
+        /* GetAll returns the properties in vtable order */
+        assert_se(call(bus, "/foo", "org.freedesktop.DBus.Properties", "GetAll", &error, &reply, "s", "") >= 0);
+        assert_se(sd_bus_message_enter_container(reply, 'a', "{sv}") > 0);
+        for (n = 0; sd_bus_message_enter_container(reply, 'e', "sv") > 0; n++) {
+                assert_se(sd_bus_message_read(reply, "s", &name) > 0);
+
+                if (streq(name, "AutomaticStringProperty")) {
+                        const char *a, *b;
+
+                        assert_se(n == 2);
+                        assert_se(sd_bus_message_read(reply, "v", "as", 2, &a, &b) > 0);
+                        assert_se(streq(a, "/foo"));
+                        assert_se(streq(b, "<<<test>>>"));
+                } else if (streq(name, "Value")) {
+                        assert_se(n == 0);
+                        assert_se(sd_bus_message_read(reply, "v", "u", &u) > 0);
+                        assert_se(u == 2);
+                } else {
+                        assert_se(n == 1);
+                        assert_se(streq(name, "Something"));
+                        assert_se(sd_bus_message_read(reply, "v", "s", &s) > 0);
+                }
+
+                assert_se(sd_bus_message_exit_container(reply) > 0);
+        }
+        assert_se(n == 3);
+        sd_bus_message_unref(reply);
+        reply = NULL;
+
+        assert_se(call(bus, "/foo", "org.freedesktop.DBus.Introspectable", "Introspect", &error, &reply, "") >= 0);
+        assert_se(sd_bus_message_read(reply, "s", &s) > 0);
+        assert_se(strstr(s, "<interface name=\"org.freedesktop.DBus.Properties\">"));
+        assert_se(strstr(s, "<interface name=\"org.freedesktop.systemd.test\">"));
+        assert_se(strstr(s, "  <method name=\"AlterSomething\">\n"
+                            "   <arg type=\"s\" direction=\"in\"/>\n"
+                            "   <arg type=\"s\" direction=\"out\"/>\n"
+                            "  </method>\n"));
+        assert_se(strstr(s, "<property name=\"AutomaticStringProperty\" type=\"as\" access=\"read\"/>"));
+        assert_se(!strstr(s, "org.freedesktop.systemd.test2"));
+        assert_se(strstr(s, "<node name=\"bar\"/>"));
+        sd_bus_message_unref(reply);
+        reply = NULL;
+
+        /* Pipelined calls, all answered in the order they were
+         * issued in */
+        assert_se(sd_bus_call_group_new(bus, &g) >= 0);
+        for (n = 0; n < N_GROUP_CALLS; n++) {
+                char t[DECIMAL_STR_MAX(unsigned)];
+
+                snprintf(t, sizeof(t), "%u", n);
+                assert_se(sd_bus_call_group_add_method(g, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "AlterSomething", &idx, "s", t) >= 0);
+                assert_se(idx == n);
+        }
+        assert_se(sd_bus_call_group_add_method(g, "org.freedesktop.systemd.test", "/foo", "org.freedesktop.systemd.test", "AlterSomething", &idx, "u", 4711) >= 0);
+
+        assert_se(sd_bus_call_group_wait(g, 0) >= 0);
+
+        for (n = 0; n < N_GROUP_CALLS; n++) {
+                char t[DECIMAL_STR_MAX(unsigned) + 6];
+
+                snprintf(t, sizeof(t), "<<<%u>>>", n);
+                assert_se(sd_bus_call_group_get_reply(g, n, &error, &reply) >= 0);
+                assert_se(sd_bus_message_read(reply, "s", &s) > 0);
+                assert_se(streq(s, t));
+                sd_bus_message_unref(reply);
+                reply = NULL;
+        }
+
+        assert_se(sd_bus_call_group_get_reply(g, idx, &error, NULL) < 0);
+        assert_se(sd_bus_error_has_name(&error, "org.freedesktop.DBus.Error.InvalidArgs"));
+        sd_bus_error_free(&error);
+        assert_se(sd_bus_call_group_get_reply(g, idx + 1, &error, NULL) == -EINVAL);
+
+        sd_bus_call_group_free(g);
+
+        assert_se(call(bus, "/foo", "org.freedesktop.systemd.test", "Exit", &error, NULL, "") >= 0);
+
+        return 0;
+}
+
+int main(int argc, char *argv[]) {
+        struct context c;
+        pthread_t s;
+        void *p;
+        int r, q;
+
+        zero(c);
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM, 0, c.fds) >= 0);
+
+        r = pthread_create(&s, NULL, server, &c);
+        if (r != 0)
+                return -r;
+
+        r = client(&c);
+
+        q = pthread_join(s, &p);
+        if (q != 0)
+                return -q;
+
+        assert_se(r >= 0);
+        assert_se(PTR_TO_INT(p) >= 0);
+
+        free(c.something);
+
+        return EXIT_SUCCESS;
+}
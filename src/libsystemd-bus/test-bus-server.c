@@ -41,13 +41,41 @@ struct context {
 
         bool client_anonymous_auth;
         bool server_anonymous_auth;
+
+        bool client_negotiate_memfd;
+        bool server_negotiate_memfd;
 };
 
+static bool context_can_memfd(struct context *c) {
+        return c->client_negotiate_unix_fds && c->server_negotiate_unix_fds &&
+                c->client_negotiate_memfd && c->server_negotiate_memfd;
+}
+
+/* Sent ahead of the Exit call, so that several of them are in flight
+ * at once and get batched into single reads and writes */
+#define N_SIGNALS 100
+
+/* Large enough to be passed as memfd, if negotiated */
+#define BLOB_SIZE (BUS_MEMFD_MIN_SIZE + 4711)
+
+static char *blob_new(void) {
+        char *b;
+
+        b = malloc(BLOB_SIZE + 1);
+        assert_se(b);
+
+        memset(b, 'x', BLOB_SIZE);
+        b[BLOB_SIZE] = 0;
+
+        return b;
+}
+
 static void *server(void *p) {
         struct context *c = p;
         sd_bus *bus = NULL;
         sd_id128_t id;
         bool quit = false;
+        uint32_t n_signals = 0;
         int r;
 
         assert_se(sd_id128_randomize(&id) >= 0);
@@ -57,6 +85,7 @@ static void *server(void *p) {
         assert_se(sd_bus_set_server(bus, 1, id) >= 0);
         assert_se(sd_bus_set_negotiate_fds(bus, c->server_negotiate_unix_fds) >= 0);
         assert_se(sd_bus_set_anonymous(bus, c->server_anonymous_auth) >= 0);
+        assert_se(sd_bus_set_negotiate_memfd(bus, c->server_negotiate_memfd) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
         while (!quit) {
@@ -83,10 +112,49 @@ static void *server(void *p) {
 
                 log_info("Got message! member=%s", strna(sd_bus_message_get_member(m)));
 
-                if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Exit")) {
+                if (sd_bus_message_is_signal(m, "org.freedesktop.systemd.test", "Notify")) {
+                        uint32_t i;
+
+                        assert_se(sd_bus_message_read(m, "u", &i) > 0);
+                        assert_se(i == n_signals);
+                        n_signals++;
+
+                } else if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Blob")) {
+                        const char *s;
+
+                        assert_se((m->body_memfd >= 0) == context_can_memfd(c));
+
+                        assert_se(sd_bus_message_read(m, "s", &s) > 0);
+                        assert_se(strlen(s) == BLOB_SIZE);
+                        assert_se(s[0] == 'x' && s[BLOB_SIZE - 1] == 'x');
+
+                        /* Send it back, so that the other direction is covered too */
+                        r = sd_bus_message_new_method_return(bus, m, &reply);
+                        if (r < 0) {
+                                log_error("Failed to allocate return: %s", strerror(-r));
+                                goto fail;
+                        }
+
+                        r = sd_bus_message_append(reply, "s", s);
+                        if (r < 0) {
+                                log_error("Failed to append blob: %s", strerror(-r));
+                                goto fail;
+                        }
+
+                } else if (sd_bus_message_is_method_call(m, "org.freedesktop.systemd.test", "Exit")) {
+
+                        assert_se(n_signals == N_SIGNALS);
 
                         assert_se((sd_bus_can_send(bus, 'h') >= 1) == (c->server_negotiate_unix_fds && c->client_negotiate_unix_fds));
 
+                        if (sd_bus_can_send(bus, 'h') >= 1) {
+                                int a, b;
+
+                                /* More than one fd in a single message */
+                                assert_se(sd_bus_message_read(m, "hh", &a, &b) > 0);
+                                assert_se(a >= 0 && b >= 0 && a != b);
+                        }
+
                         r = sd_bus_message_new_method_return(bus, m, &reply);
                         if (r < 0) {
                                 log_error("Failed to allocate return: %s", strerror(-r));
@@ -130,14 +198,76 @@ static int client(struct context *c) {
         _cleanup_bus_message_unref_ sd_bus_message *m = NULL, *reply = NULL;
         _cleanup_bus_unref_ sd_bus *bus = NULL;
         sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_free_ char *blob = NULL;
+        const char *echo;
+        uint32_t i;
         int r;
 
         assert_se(sd_bus_new(&bus) >= 0);
         assert_se(sd_bus_set_fd(bus, c->fds[1], c->fds[1]) >= 0);
         assert_se(sd_bus_set_negotiate_fds(bus, c->client_negotiate_unix_fds) >= 0);
         assert_se(sd_bus_set_anonymous(bus, c->client_anonymous_auth) >= 0);
+        assert_se(sd_bus_set_negotiate_memfd(bus, c->client_negotiate_memfd) >= 0);
         assert_se(sd_bus_start(bus) >= 0);
 
+        for (i = 0; i < N_SIGNALS; i++) {
+                _cleanup_bus_message_unref_ sd_bus_message *s = NULL;
+
+                r = sd_bus_message_new_signal(bus, "/", "org.freedesktop.systemd.test", "Notify", &s);
+                if (r < 0) {
+                        log_error("Failed to allocate signal: %s", strerror(-r));
+                        return r;
+                }
+
+                r = sd_bus_message_append(s, "u", i);
+                if (r < 0) {
+                        log_error("Failed to append to signal: %s", strerror(-r));
+                        return r;
+                }
+
+                r = sd_bus_send(bus, s, NULL);
+                if (r < 0) {
+                        log_error("Failed to send signal: %s", strerror(-r));
+                        return r;
+                }
+        }
+
+        r = sd_bus_message_new_method_call(
+                        bus,
+                        "org.freedesktop.systemd.test",
+                        "/",
+                        "org.freedesktop.systemd.test",
+                        "Blob",
+                        &m);
+        if (r < 0) {
+                log_error("Failed to allocate method call: %s", strerror(-r));
+                return r;
+        }
+
+        blob = blob_new();
+
+        r = sd_bus_message_append(m, "s", blob);
+        if (r < 0) {
+                log_error("Failed to append blob: %s", strerror(-r));
+                return r;
+        }
+
+        r = sd_bus_send_with_reply_and_block(bus, m, 0, &error, &reply);
+        if (r < 0) {
+                log_error("Failed to issue method call: %s", bus_error_message(&error, -r));
+                return r;
+        }
+
+        assert_se((m->body_memfd >= 0) == context_can_memfd(c));
+        assert_se((reply->body_memfd >= 0) == context_can_memfd(c));
+
+        assert_se(sd_bus_message_read(reply, "s", &echo) > 0);
+        assert_se(streq(echo, blob));
+
+        sd_bus_message_unref(m);
+        sd_bus_message_unref(reply);
+        m = reply = NULL;
+
         r = sd_bus_message_new_method_call(
                         bus,
                         "org.freedesktop.systemd.test",
@@ -150,6 +280,14 @@ static int client(struct context *c) {
                 return r;
         }
 
+        if (c->client_negotiate_unix_fds && c->server_negotiate_unix_fds) {
+                r = sd_bus_message_append(m, "hh", STDIN_FILENO, STDERR_FILENO);
+                if (r < 0) {
+                        log_error("Failed to append fds: %s", strerror(-r));
+                        return r;
+                }
+        }
+
         r = sd_bus_send_with_reply_and_block(bus, m, 0, &error, &reply);
         if (r < 0) {
                 log_error("Failed to issue method call: %s", bus_error_message(&error, -r));
@@ -160,7 +298,8 @@ static int client(struct context *c) {
 }
 
 static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_fds,
-                    bool client_anonymous_auth, bool server_anonymous_auth) {
+                    bool client_anonymous_auth, bool server_anonymous_auth,
+                    bool client_negotiate_memfd, bool server_negotiate_memfd) {
 
         struct context c;
         pthread_t s;
@@ -175,6 +314,8 @@ static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_f
         c.server_negotiate_unix_fds = server_negotiate_unix_fds;
         c.client_anonymous_auth = client_anonymous_auth;
         c.server_anonymous_auth = server_anonymous_auth;
+        c.client_negotiate_memfd = client_negotiate_memfd;
+        c.server_negotiate_memfd = server_negotiate_memfd;
 
         r = pthread_create(&s, NULL, server, &c);
         if (r != 0)
@@ -198,26 +339,41 @@ static int test_one(bool client_negotiate_unix_fds, bool server_negotiate_unix_f
 int main(int argc, char *argv[]) {
         int r;
 
-        r = test_one(true, true, false, false);
+        r = test_one(true, true, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, false, false, false);
+        r = test_one(true, false, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(false, true, false, false);
+        r = test_one(false, true, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(false, false, false, false);
+        r = test_one(false, false, false, false, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, true, true, true);
+        r = test_one(true, true, true, true, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, true, false, true);
+        r = test_one(true, true, false, true, false, false);
         assert_se(r >= 0);
 
-        r = test_one(true, true, true, false);
+        r = test_one(true, true, true, false, false, false);
         assert_se(r == -EPERM);
 
+        r = test_one(true, true, false, false, true, true);
+        assert_se(r >= 0);
+
+        r = test_one(true, true, false, false, true, false);
+        assert_se(r >= 0);
+
+        r = test_one(true, true, false, false, false, true);
+        assert_se(r >= 0);
+
+        r = test_one(false, true, false, false, true, true);
+        assert_se(r >= 0);
+
+        r = test_one(true, false, false, false, true, true);
+        assert_se(r >= 0);
+
         return EXIT_SUCCESS;
 }
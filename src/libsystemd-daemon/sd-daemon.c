@@ -423,14 +423,127 @@ _sd_export_ int sd_is_mq(int fd, const char *path) {
 #endif
 }
 
+#if !defined(DISABLE_SYSTEMD) && defined(__linux__) && defined(SOCK_CLOEXEC)
+static int notify_address(const char *e, union sockaddr_union *sockaddr, socklen_t *l) {
+
+        /* Must be an abstract socket, or an absolute path */
+        if ((e[0] != '@' && e[0] != '/') || e[1] == 0)
+                return -EINVAL;
+
+        memset(sockaddr, 0, sizeof(*sockaddr));
+        sockaddr->sa.sa_family = AF_UNIX;
+        strncpy(sockaddr->un.sun_path, e, sizeof(sockaddr->un.sun_path));
+
+        if (sockaddr->un.sun_path[0] == '@')
+                sockaddr->un.sun_path[0] = 0;
+
+        *l = offsetof(struct sockaddr_un, sun_path) + strlen(e);
+
+        if (*l > sizeof(struct sockaddr_un))
+                *l = sizeof(struct sockaddr_un);
+
+        return 0;
+}
+
+static int notify_send(int fd, union sockaddr_union *sockaddr, socklen_t l, struct iovec *iovec, size_t n) {
+        struct msghdr msghdr;
+
+        memset(&msghdr, 0, sizeof(msghdr));
+        msghdr.msg_name = sockaddr;
+        msghdr.msg_namelen = l;
+        msghdr.msg_iov = iovec;
+        msghdr.msg_iovlen = n;
+
+        if (sendmsg(fd, &msghdr, MSG_NOSIGNAL) < 0)
+                return -errno;
+
+        return 1;
+}
+
+/* The socket kept by the _cached() calls. It belongs to the process
+ * that created it, a forked child makes its own. Daemons like to
+ * close all fds they do not know of, after which the number might
+ * be in use for something else, hence it is checked to still be
+ * what we opened before each use. One thread at a time may use it,
+ * others fall back to a socket of their own. */
+static int notify_fd = -1;
+static pid_t notify_fd_pid = 0;
+static dev_t notify_fd_dev = 0;
+static ino_t notify_fd_ino = 0;
+
+/* The pid of the process holding it, since a child may be forked
+ * while another thread holds it */
+static pid_t notify_lock = 0;
+
+static int notify_lock_take(pid_t pid) {
+
+        for (;;) {
+                pid_t l = notify_lock;
+
+                if (l == pid)
+                        return 0;
+
+                if (__sync_bool_compare_and_swap(&notify_lock, l, pid))
+                        return 1;
+        }
+}
+
+static void notify_lock_release(void) {
+        __sync_lock_release(&notify_lock);
+}
+
+static int notify_fd_is_ours(void) {
+        struct stat st;
+
+        return
+                fstat(notify_fd, &st) >= 0 &&
+                st.st_dev == notify_fd_dev &&
+                st.st_ino == notify_fd_ino;
+}
+
+static int notify_fd_get(pid_t pid) {
+        struct stat st;
+        int fd;
+
+        if (notify_fd >= 0) {
+                if (notify_fd_is_ours()) {
+                        if (notify_fd_pid == pid)
+                                return notify_fd;
+
+                        /* Inherited from our parent */
+                        close(notify_fd);
+                }
+
+                notify_fd = -1;
+        }
+
+        fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0) {
+                int r = -errno;
+                close(fd);
+                return r;
+        }
+
+        notify_fd = fd;
+        notify_fd_pid = pid;
+        notify_fd_dev = st.st_dev;
+        notify_fd_ino = st.st_ino;
+
+        return fd;
+}
+#endif
+
 _sd_export_ int sd_notify(int unset_environment, const char *state) {
 #if defined(DISABLE_SYSTEMD) || !defined(__linux__) || !defined(SOCK_CLOEXEC)
         return 0;
 #else
         int fd = -1, r;
-        struct msghdr msghdr;
         struct iovec iovec;
         union sockaddr_union sockaddr;
+        socklen_t l;
         const char *e;
 
         if (!state) {
@@ -442,11 +555,9 @@ _sd_export_ int sd_notify(int unset_environment, const char *state) {
         if (!e)
                 return 0;
 
-        /* Must be an abstract socket, or an absolute path */
-        if ((e[0] != '@' && e[0] != '/') || e[1] == 0) {
-                r = -EINVAL;
+        r = notify_address(e, &sockaddr, &l);
+        if (r < 0)
                 goto finish;
-        }
 
         fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
         if (fd < 0) {
@@ -454,46 +565,133 @@ _sd_export_ int sd_notify(int unset_environment, const char *state) {
                 goto finish;
         }
 
-        memset(&sockaddr, 0, sizeof(sockaddr));
-        sockaddr.sa.sa_family = AF_UNIX;
-        strncpy(sockaddr.un.sun_path, e, sizeof(sockaddr.un.sun_path));
-
-        if (sockaddr.un.sun_path[0] == '@')
-                sockaddr.un.sun_path[0] = 0;
-
         memset(&iovec, 0, sizeof(iovec));
         iovec.iov_base = (char*) state;
         iovec.iov_len = strlen(state);
 
-        memset(&msghdr, 0, sizeof(msghdr));
-        msghdr.msg_name = &sockaddr;
-        msghdr.msg_namelen = offsetof(struct sockaddr_un, sun_path) + strlen(e);
+        r = notify_send(fd, &sockaddr, l, &iovec, 1);
+
+finish:
+        if (unset_environment)
+                unsetenv("NOTIFY_SOCKET");
 
-        if (msghdr.msg_namelen > sizeof(struct sockaddr_un))
-                msghdr.msg_namelen = sizeof(struct sockaddr_un);
+        if (fd >= 0)
+                close(fd);
 
-        msghdr.msg_iov = &iovec;
-        msghdr.msg_iovlen = 1;
+        return r;
+#endif
+}
 
-        if (sendmsg(fd, &msghdr, MSG_NOSIGNAL) < 0) {
-                r = -errno;
+_sd_export_ int sd_notifyf(int unset_environment, const char *format, ...) {
+#if defined(DISABLE_SYSTEMD) || !defined(__linux__)
+        return 0;
+#else
+        va_list ap;
+        char *p = NULL;
+        int r;
+
+        va_start(ap, format);
+        r = vasprintf(&p, format, ap);
+        va_end(ap);
+
+        if (r < 0 || !p)
+                return -ENOMEM;
+
+        r = sd_notify(unset_environment, p);
+        free(p);
+
+        return r;
+#endif
+}
+
+_sd_export_ int sd_notifyv_cached(int unset_environment, const char * const *states) {
+#if defined(DISABLE_SYSTEMD) || !defined(__linux__) || !defined(SOCK_CLOEXEC)
+        return 0;
+#else
+        struct iovec iovec_buffer[16], *iovec = iovec_buffer;
+        union sockaddr_union sockaddr;
+        socklen_t l;
+        const char *e;
+        size_t n = 0, k;
+        pid_t pid;
+        int fd, r;
+
+        if (!states) {
+                r = -EINVAL;
+                goto finish;
+        }
+
+        e = getenv("NOTIFY_SOCKET");
+        if (!e)
+                return 0;
+
+        r = notify_address(e, &sockaddr, &l);
+        if (r < 0)
                 goto finish;
+
+        /* One iovec for each assignment, and one for each newline
+         * between them */
+        for (k = 0; states[k]; k++)
+                ;
+
+        if (k * 2 > sizeof(iovec_buffer) / sizeof(iovec_buffer[0])) {
+                iovec = malloc(sizeof(struct iovec) * k * 2);
+                if (!iovec) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
         }
 
-        r = 1;
+        for (k = 0; states[k]; k++) {
+                if (n > 0 && ((const char*) iovec[n-1].iov_base)[iovec[n-1].iov_len-1] != '\n') {
+                        iovec[n].iov_base = (char*) "\n";
+                        iovec[n].iov_len = 1;
+                        n++;
+                }
+
+                iovec[n].iov_base = (char*) states[k];
+                iovec[n].iov_len = strlen(states[k]);
+                if (iovec[n].iov_len > 0)
+                        n++;
+        }
+
+        pid = getpid();
+
+        if (notify_lock_take(pid)) {
+                fd = notify_fd_get(pid);
+                r = fd < 0 ? fd : notify_send(fd, &sockaddr, l, iovec, n);
+                notify_lock_release();
+        } else {
+                fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+                if (fd < 0)
+                        r = -errno;
+                else {
+                        r = notify_send(fd, &sockaddr, l, iovec, n);
+                        close(fd);
+                }
+        }
 
 finish:
         if (unset_environment)
                 unsetenv("NOTIFY_SOCKET");
 
-        if (fd >= 0)
-                close(fd);
+        if (iovec != iovec_buffer)
+                free(iovec);
 
         return r;
 #endif
 }
 
-_sd_export_ int sd_notifyf(int unset_environment, const char *format, ...) {
+_sd_export_ int sd_notify_cached(int unset_environment, const char *state) {
+        const char *states[2];
+
+        states[0] = state;
+        states[1] = NULL;
+
+        return sd_notifyv_cached(unset_environment, state ? states : NULL);
+}
+
+_sd_export_ int sd_notifyf_cached(int unset_environment, const char *format, ...) {
 #if defined(DISABLE_SYSTEMD) || !defined(__linux__)
         return 0;
 #else
@@ -508,7 +706,7 @@ _sd_export_ int sd_notifyf(int unset_environment, const char *format, ...) {
         if (r < 0 || !p)
                 return -ENOMEM;
 
-        r = sd_notify(unset_environment, p);
+        r = sd_notify_cached(unset_environment, p);
         free(p);
 
         return r;
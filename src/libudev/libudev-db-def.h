@@ -0,0 +1,74 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifndef _LIBUDEV_DB_DEF_H_
+#define _LIBUDEV_DB_DEF_H_
+
+#include "sparse-endian.h"
+
+/*
+ * Snapshot of all files in /run/udev/data/, written by udevd whenever it
+ * is idle, so that readers do not need to open a file per device. udevd
+ * clears 'valid' in place before it handles events, which might change
+ * the files; readers fall back to the files then.
+ */
+#define UDEV_DB_SNAPSHOT "/run/udev/data.bin"
+#define UDEV_DB_SIG { 'U', 'D', 'E', 'V', 'D', 'A', 'T', 'A' }
+
+struct udev_db_header_f {
+        uint8_t signature[8];
+
+        /* version of tool which created the file */
+        le64_t tool_version;
+        le64_t file_size;
+
+        /* size of structures to allow them to grow */
+        le64_t header_size;
+        le64_t entry_size;
+
+        le64_t valid;
+
+        /* array of entries, sorted by the id of the device */
+        le64_t entries_off;
+        le64_t entries_count;
+
+        /* ids and contents of the files, NUL-terminated */
+        le64_t strings_off;
+        le64_t strings_len;
+
+        /* array of the properties in the files, sorted by KEY=VALUE */
+        le64_t properties_off;
+        le64_t properties_count;
+        le64_t property_size;
+} _packed_;
+
+/* offsets are relative to the string section */
+struct udev_db_entry_f {
+        le64_t id_off;
+        le64_t data_off;
+        le64_t data_len;
+} _packed_;
+
+/* the inverse of the properties of the entries, for enumerating by property */
+struct udev_db_property_f {
+        le64_t property_off;
+        le64_t entry;
+} _packed_;
+
+#endif
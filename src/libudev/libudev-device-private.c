@@ -25,10 +25,14 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <dirent.h>
 #include <sys/stat.h>
 
 #include "libudev.h"
 #include "libudev-private.h"
+#include "libudev-db-def.h"
+#include "fileio.h"
 
 static void udev_device_tag(struct udev_device *dev, const char *tag, bool add)
 {
@@ -190,3 +194,251 @@ int udev_device_delete_db(struct udev_device *udev_device)
         unlink(filename);
         return 0;
 }
+
+struct db_file {
+        char *id;
+        char *data;
+        size_t len;
+};
+
+struct db_property {
+        char *property;
+        size_t entry;
+};
+
+static int db_file_cmp(const void *a, const void *b)
+{
+        const struct db_file *fa = a, *fb = b;
+
+        return strcmp(fa->id, fb->id);
+}
+
+static int db_property_cmp(const void *a, const void *b)
+{
+        const struct db_property *pa = a, *pb = b;
+        int r;
+
+        r = strcmp(pa->property, pb->property);
+        if (r != 0)
+                return r;
+        return pa->entry < pb->entry ? -1 : pa->entry > pb->entry;
+}
+
+/* add the E: lines of a file to the properties */
+static int db_add_properties(struct db_property **properties, size_t *count, size_t *allocated,
+                             const struct db_file *file, size_t entry)
+{
+        const char *p, *end;
+
+        end = file->data + file->len;
+        for (p = file->data; p < end; ) {
+                const char *eol;
+
+                eol = memchr(p, '\n', end - p);
+                if (eol == NULL)
+                        break;
+                if (eol - p < 3)
+                        break;
+
+                if (p[0] == 'E' && p[1] == ':') {
+                        if (*count >= *allocated) {
+                                struct db_property *n;
+
+                                *allocated = MAX(256U, *allocated * 2);
+                                n = realloc(*properties, *allocated * sizeof(struct db_property));
+                                if (n == NULL)
+                                        return -1;
+                                *properties = n;
+                        }
+
+                        (*properties)[*count].property = strndup(p + 2, eol - (p + 2));
+                        if ((*properties)[*count].property == NULL)
+                                return -1;
+                        (*properties)[*count].entry = entry;
+                        (*count)++;
+                }
+                p = eol + 1;
+        }
+
+        return 0;
+}
+
+/* collect all of /run/udev/data/ into one file, which readers can map */
+int udev_db_write_snapshot(struct udev *udev)
+{
+        const char sig[] = UDEV_DB_SIG;
+        struct udev_db_header_f head = {};
+        struct db_file *files = NULL;
+        size_t files_count = 0, files_allocated = 0;
+        struct db_property *properties = NULL;
+        size_t properties_count = 0, properties_allocated = 0;
+        uint64_t strings_len = 0, strings_off;
+        DIR *dir;
+        FILE *f = NULL;
+        size_t i;
+        int r = -1;
+
+        dir = opendir("/run/udev/data");
+        if (dir == NULL && errno != ENOENT) {
+                udev_err(udev, "unable to open /run/udev/data: %m\n");
+                return -1;
+        }
+
+        if (dir != NULL) {
+                struct dirent *dent;
+
+                for (dent = readdir(dir); dent != NULL; dent = readdir(dir)) {
+                        char filename[UTIL_PATH_SIZE];
+                        struct db_file *file;
+
+                        if (dent->d_name[0] == '.')
+                                continue;
+                        if (endswith(dent->d_name, ".tmp"))
+                                continue;
+
+                        if (files_count >= files_allocated) {
+                                struct db_file *n;
+
+                                files_allocated = MAX(64U, files_allocated * 2);
+                                n = realloc(files, files_allocated * sizeof(struct db_file));
+                                if (n == NULL)
+                                        goto finish;
+                                files = n;
+                        }
+
+                        file = &files[files_count];
+                        strscpyl(filename, sizeof(filename), "/run/udev/data/", dent->d_name, NULL);
+                        /* removed while we were looking */
+                        if (read_full_file(filename, &file->data, &file->len) < 0)
+                                continue;
+                        file->id = strdup(dent->d_name);
+                        if (file->id == NULL) {
+                                free(file->data);
+                                goto finish;
+                        }
+                        files_count++;
+                        strings_len += strlen(file->id) + 1 + file->len + 1;
+                }
+        }
+
+        if (files_count > 0)
+                qsort(files, files_count, sizeof(struct db_file), db_file_cmp);
+
+        for (i = 0; i < files_count; i++)
+                if (db_add_properties(&properties, &properties_count, &properties_allocated, &files[i], i) < 0)
+                        goto finish;
+        if (properties_count > 0)
+                qsort(properties, properties_count, sizeof(struct db_property), db_property_cmp);
+        for (i = 0; i < properties_count; i++)
+                strings_len += strlen(properties[i].property) + 1;
+
+        f = fopen(UDEV_DB_SNAPSHOT ".tmp", "we");
+        if (f == NULL) {
+                udev_err(udev, "unable to create " UDEV_DB_SNAPSHOT ".tmp: %m\n");
+                goto finish;
+        }
+
+        /* an empty string section would not be accepted */
+        strings_len++;
+
+        memcpy(head.signature, sig, sizeof(head.signature));
+        head.tool_version = htole64(atoi(VERSION));
+        head.header_size = htole64(sizeof(struct udev_db_header_f));
+        head.entry_size = htole64(sizeof(struct udev_db_entry_f));
+        head.valid = htole64(1);
+        head.entries_off = htole64(sizeof(struct udev_db_header_f));
+        head.entries_count = htole64(files_count);
+        head.property_size = htole64(sizeof(struct udev_db_property_f));
+        head.properties_off = htole64(sizeof(struct udev_db_header_f) + files_count * sizeof(struct udev_db_entry_f));
+        head.properties_count = htole64(properties_count);
+        strings_off = le64toh(head.properties_off) + properties_count * sizeof(struct udev_db_property_f);
+        head.strings_off = htole64(strings_off);
+        head.strings_len = htole64(strings_len);
+        head.file_size = htole64(strings_off + strings_len);
+        fwrite(&head, sizeof(head), 1, f);
+
+        strings_len = 1;
+        for (i = 0; i < files_count; i++) {
+                struct udev_db_entry_f entry;
+                size_t id_len = strlen(files[i].id) + 1;
+
+                entry.id_off = htole64(strings_len);
+                entry.data_off = htole64(strings_len + id_len);
+                entry.data_len = htole64(files[i].len);
+                fwrite(&entry, sizeof(entry), 1, f);
+                strings_len += id_len + files[i].len + 1;
+        }
+
+        for (i = 0; i < properties_count; i++) {
+                struct udev_db_property_f property;
+
+                property.property_off = htole64(strings_len);
+                property.entry = htole64(properties[i].entry);
+                fwrite(&property, sizeof(property), 1, f);
+                strings_len += strlen(properties[i].property) + 1;
+        }
+
+        fputc('\0', f);
+        for (i = 0; i < files_count; i++) {
+                fwrite(files[i].id, strlen(files[i].id) + 1, 1, f);
+                fwrite(files[i].data, files[i].len, 1, f);
+                fputc('\0', f);
+        }
+        for (i = 0; i < properties_count; i++)
+                fwrite(properties[i].property, strlen(properties[i].property) + 1, 1, f);
+
+        fflush(f);
+        if (ferror(f)) {
+                udev_err(udev, "unable to write " UDEV_DB_SNAPSHOT ".tmp: %m\n");
+                unlink(UDEV_DB_SNAPSHOT ".tmp");
+                goto finish;
+        }
+
+        if (rename(UDEV_DB_SNAPSHOT ".tmp", UDEV_DB_SNAPSHOT) < 0) {
+                udev_err(udev, "unable to create " UDEV_DB_SNAPSHOT ": %m\n");
+                unlink(UDEV_DB_SNAPSHOT ".tmp");
+                goto finish;
+        }
+
+        udev_dbg(udev, "wrote db snapshot of %zu devices\n", files_count);
+        r = 0;
+finish:
+        if (f != NULL)
+                fclose(f);
+        if (dir != NULL)
+                closedir(dir);
+        for (i = 0; i < files_count; i++) {
+                free(files[i].id);
+                free(files[i].data);
+        }
+        free(files);
+        for (i = 0; i < properties_count; i++)
+                free(properties[i].property);
+        free(properties);
+        return r;
+}
+
+/* tell the readers to use the files again, before they change */
+int udev_db_invalidate_snapshot(struct udev *udev)
+{
+        le64_t valid = 0;
+        int fd;
+        ssize_t n;
+
+        fd = open(UDEV_DB_SNAPSHOT, O_WRONLY|O_CLOEXEC);
+        if (fd < 0) {
+                if (errno == ENOENT)
+                        return 0;
+                udev_err(udev, "unable to open " UDEV_DB_SNAPSHOT ": %m\n");
+                return -1;
+        }
+
+        n = pwrite(fd, &valid, sizeof(valid), offsetof(struct udev_db_header_f, valid));
+        close(fd);
+        if (n != sizeof(valid)) {
+                /* readers must not trust it any longer */
+                unlink(UDEV_DB_SNAPSHOT);
+                return -1;
+        }
+        return 0;
+}
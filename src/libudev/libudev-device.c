@@ -27,14 +27,18 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <fnmatch.h>
 #include <net/if.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <linux/sockios.h>
 
 #include "libudev.h"
 #include "libudev-private.h"
+#include "libudev-db-def.h"
+#include "hashmap.h"
 
 /**
  * SECTION:libudev-device
@@ -510,6 +514,324 @@ _public_ const char *udev_device_get_property_value(struct udev_device *udev_dev
         return udev_list_entry_get_value(list_entry);
 }
 
+/* the mapped database snapshot, see libudev-db-def.h */
+struct udev_db_snapshot {
+        void *map;
+        size_t size;
+        dev_t dev;
+        ino_t ino;
+        const struct udev_db_header_f *head;
+        const struct udev_db_entry_f *entries;
+        size_t entries_count;
+        size_t entry_size;
+        const struct udev_db_property_f *properties;
+        size_t properties_count;
+        size_t property_size;
+        const char *strings;
+        size_t strings_len;
+};
+
+void udev_db_snapshot_free(struct udev_db_snapshot *db_snapshot)
+{
+        if (db_snapshot == NULL)
+                return;
+        munmap(db_snapshot->map, db_snapshot->size);
+        free(db_snapshot);
+}
+
+static bool db_snapshot_is_valid(const struct udev_db_snapshot *db_snapshot)
+{
+        /* cleared by udevd through its own mapping of the file */
+        return le64toh(((volatile const struct udev_db_header_f *) db_snapshot->head)->valid) != 0;
+}
+
+static struct udev_db_snapshot *db_snapshot_open(struct udev *udev, int fd, const struct stat *st)
+{
+        const char sig[] = UDEV_DB_SIG;
+        struct udev_db_snapshot *db_snapshot;
+        const struct udev_db_header_f *head;
+        uint64_t entries_off, entries_count, entry_size, strings_off, strings_len;
+        uint64_t properties_off, properties_count, property_size;
+
+        if ((size_t) st->st_size < sizeof(struct udev_db_header_f))
+                return NULL;
+
+        db_snapshot = calloc(1, sizeof(struct udev_db_snapshot));
+        if (db_snapshot == NULL)
+                return NULL;
+
+        db_snapshot->size = st->st_size;
+        db_snapshot->dev = st->st_dev;
+        db_snapshot->ino = st->st_ino;
+        db_snapshot->map = mmap(NULL, db_snapshot->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (db_snapshot->map == MAP_FAILED) {
+                free(db_snapshot);
+                return NULL;
+        }
+
+        head = db_snapshot->head = db_snapshot->map;
+        entries_off = le64toh(head->entries_off);
+        entries_count = le64toh(head->entries_count);
+        entry_size = le64toh(head->entry_size);
+        strings_off = le64toh(head->strings_off);
+        strings_len = le64toh(head->strings_len);
+        properties_off = le64toh(head->properties_off);
+        properties_count = le64toh(head->properties_count);
+        property_size = le64toh(head->property_size);
+
+        if (memcmp(head->signature, sig, sizeof(head->signature)) != 0 ||
+            le64toh(head->file_size) != db_snapshot->size ||
+            le64toh(head->header_size) < sizeof(struct udev_db_header_f) ||
+            entry_size < sizeof(struct udev_db_entry_f) ||
+            entries_off > db_snapshot->size ||
+            entries_count > (db_snapshot->size - entries_off) / entry_size ||
+            property_size < sizeof(struct udev_db_property_f) ||
+            properties_off > db_snapshot->size ||
+            properties_count > (db_snapshot->size - properties_off) / property_size ||
+            strings_off > db_snapshot->size ||
+            strings_len == 0 || strings_len > db_snapshot->size - strings_off ||
+            ((const char *) db_snapshot->map)[strings_off + strings_len - 1] != '\0') {
+                udev_dbg(udev, "error recognizing the format of " UDEV_DB_SNAPSHOT "\n");
+                udev_db_snapshot_free(db_snapshot);
+                return NULL;
+        }
+
+        db_snapshot->entries = (const struct udev_db_entry_f *) ((const uint8_t *) db_snapshot->map + entries_off);
+        db_snapshot->entries_count = entries_count;
+        db_snapshot->entry_size = entry_size;
+        db_snapshot->properties = (const struct udev_db_property_f *) ((const uint8_t *) db_snapshot->map + properties_off);
+        db_snapshot->properties_count = properties_count;
+        db_snapshot->property_size = property_size;
+        db_snapshot->strings = (const char *) db_snapshot->map + strings_off;
+        db_snapshot->strings_len = strings_len;
+        return db_snapshot;
+}
+
+/* the current snapshot, if udevd did not start handling events since it was written */
+static struct udev_db_snapshot *db_snapshot_get(struct udev *udev)
+{
+        struct udev_db_snapshot *db_snapshot;
+        struct stat st;
+        int fd;
+
+        db_snapshot = udev_get_db_snapshot(udev);
+        if (db_snapshot != NULL && db_snapshot_is_valid(db_snapshot))
+                return db_snapshot;
+
+        /* look for a new file only if the one we have was invalidated */
+        if (stat(UDEV_DB_SNAPSHOT, &st) < 0) {
+                udev_db_snapshot_free(db_snapshot);
+                udev_set_db_snapshot(udev, NULL);
+                return NULL;
+        }
+        if (db_snapshot != NULL && db_snapshot->dev == st.st_dev && db_snapshot->ino == st.st_ino)
+                return NULL;
+
+        udev_db_snapshot_free(db_snapshot);
+        udev_set_db_snapshot(udev, NULL);
+
+        fd = open(UDEV_DB_SNAPSHOT, O_RDONLY|O_CLOEXEC);
+        if (fd < 0)
+                return NULL;
+        if (fstat(fd, &st) < 0) {
+                close(fd);
+                return NULL;
+        }
+        db_snapshot = db_snapshot_open(udev, fd, &st);
+        close(fd);
+        if (db_snapshot == NULL)
+                return NULL;
+
+        udev_set_db_snapshot(udev, db_snapshot);
+        if (!db_snapshot_is_valid(db_snapshot))
+                return NULL;
+        return db_snapshot;
+}
+
+/* returns 1 and the contents of the database file, 0 if there is none, or -1 if unknown */
+static int db_snapshot_lookup(struct udev *udev, const char *id, const char **data, size_t *len)
+{
+        struct udev_db_snapshot *db_snapshot;
+        size_t lo, hi;
+
+        db_snapshot = db_snapshot_get(udev);
+        if (db_snapshot == NULL)
+                return -1;
+
+        lo = 0;
+        hi = db_snapshot->entries_count;
+        while (lo < hi) {
+                const struct udev_db_entry_f *entry;
+                uint64_t id_off;
+                size_t mid;
+                int r;
+
+                mid = lo + (hi - lo) / 2;
+                entry = (const struct udev_db_entry_f *) ((const uint8_t *) db_snapshot->entries + mid * db_snapshot->entry_size);
+                id_off = le64toh(entry->id_off);
+                if (id_off >= db_snapshot->strings_len)
+                        return -1;
+
+                r = strcmp(id, db_snapshot->strings + id_off);
+                if (r == 0) {
+                        uint64_t data_off, data_len;
+
+                        data_off = le64toh(entry->data_off);
+                        data_len = le64toh(entry->data_len);
+                        if (data_off > db_snapshot->strings_len || data_len > db_snapshot->strings_len - data_off)
+                                return -1;
+                        *data = db_snapshot->strings + data_off;
+                        *len = data_len;
+                        return 1;
+                }
+                if (r < 0)
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+
+        return 0;
+}
+
+static const char *db_snapshot_property(const struct udev_db_snapshot *db_snapshot, size_t i, size_t *entry)
+{
+        const struct udev_db_property_f *property;
+        uint64_t off;
+
+        property = (const struct udev_db_property_f *) ((const uint8_t *) db_snapshot->properties + i * db_snapshot->property_size);
+        off = le64toh(property->property_off);
+        if (off >= db_snapshot->strings_len)
+                return NULL;
+        *entry = le64toh(property->entry);
+        return db_snapshot->strings + off;
+}
+
+/*
+ * Add the ids of all devices with a property key, whose value matches
+ * the glob value, to the list. Returns -1 if there is no current
+ * snapshot to look at.
+ */
+int udev_db_snapshot_find_property(struct udev *udev, const char *key, const char *value, struct udev_list *list)
+{
+        struct udev_db_snapshot *db_snapshot;
+        size_t lo, hi, keylen;
+
+        db_snapshot = db_snapshot_get(udev);
+        if (db_snapshot == NULL)
+                return -1;
+
+        /* find the first property of the key */
+        keylen = strlen(key);
+        lo = 0;
+        hi = db_snapshot->properties_count;
+        while (lo < hi) {
+                const char *property;
+                size_t mid, entry;
+                int r;
+
+                mid = lo + (hi - lo) / 2;
+                property = db_snapshot_property(db_snapshot, mid, &entry);
+                if (property == NULL)
+                        return -1;
+                r = strncmp(property, key, keylen);
+                if (r == 0)
+                        r = (unsigned char) property[keylen] < '=' ? -1 : 0;
+                if (r < 0)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        for (; lo < db_snapshot->properties_count; lo++) {
+                const struct udev_db_entry_f *e;
+                const char *property;
+                size_t entry;
+                uint64_t id_off;
+
+                property = db_snapshot_property(db_snapshot, lo, &entry);
+                if (property == NULL)
+                        return -1;
+                if (!strneq(property, key, keylen) || property[keylen] != '=')
+                        break;
+                if (fnmatch(value, &property[keylen+1], 0) != 0)
+                        continue;
+
+                if (entry >= db_snapshot->entries_count)
+                        return -1;
+                e = (const struct udev_db_entry_f *) ((const uint8_t *) db_snapshot->entries + entry * db_snapshot->entry_size);
+                id_off = le64toh(e->id_off);
+                if (id_off >= db_snapshot->strings_len)
+                        return -1;
+                udev_list_entry_add(list, db_snapshot->strings + id_off, NULL);
+        }
+
+        return 0;
+}
+
+static void read_db_line(struct udev_device *udev_device, char key, const char *val)
+{
+        char filename[UTIL_PATH_SIZE];
+        struct udev_list_entry *entry;
+
+        switch(key) {
+        case 'S':
+                strscpyl(filename, sizeof(filename), "/dev/", val, NULL);
+                udev_device_add_devlink(udev_device, filename);
+                break;
+        case 'L':
+                udev_device_set_devlink_priority(udev_device, atoi(val));
+                break;
+        case 'E':
+                entry = udev_device_add_property_from_string(udev_device, val);
+                udev_list_entry_set_num(entry, true);
+                break;
+        case 'G':
+                udev_device_add_tag(udev_device, val);
+                break;
+        case 'W':
+                udev_device_set_watch_handle(udev_device, atoi(val));
+                break;
+        case 'I':
+                udev_device_set_usec_initialized(udev_device, strtoull(val, NULL, 10));
+                break;
+        }
+}
+
+static int read_db_snapshot(struct udev_device *udev_device, const char *id)
+{
+        char line[UTIL_LINE_SIZE];
+        const char *data, *end, *p;
+        size_t len;
+        int r;
+
+        r = db_snapshot_lookup(udev_device->udev, id, &data, &len);
+        if (r <= 0)
+                return r;
+        udev_device->is_initialized = true;
+
+        end = data + len;
+        for (p = data; p < end; ) {
+                const char *eol;
+                size_t l;
+
+                eol = memchr(p, '\n', end - p);
+                if (eol == NULL)
+                        break;
+                l = eol - p;
+                if (l < 3)
+                        break;
+                if (l >= sizeof(line))
+                        l = sizeof(line) - 1;
+                memcpy(line, p, l);
+                line[l] = '\0';
+                read_db_line(udev_device, line[0], &line[2]);
+                p = eol + 1;
+        }
+
+        udev_dbg(udev_device->udev, "device %p filled with db snapshot data\n", udev_device);
+        return 1;
+}
+
 int udev_device_read_db(struct udev_device *udev_device, const char *dbfile)
 {
         char filename[UTIL_PATH_SIZE];
@@ -519,6 +841,7 @@ int udev_device_read_db(struct udev_device *udev_device, const char *dbfile)
         /* providing a database file will always force-load it */
         if (dbfile == NULL) {
                 const char *id;
+                int r;
 
                 if (udev_device->db_loaded)
                         return 0;
@@ -527,6 +850,14 @@ int udev_device_read_db(struct udev_device *udev_device, const char *dbfile)
                 id = udev_device_get_id_filename(udev_device);
                 if (id == NULL)
                         return -1;
+
+                /* look it up in the snapshot of all files, if udevd keeps it current */
+                r = read_db_snapshot(udev_device, id);
+                if (r > 0)
+                        return 0;
+                if (r == 0)
+                        return -1;
+
                 strscpyl(filename, sizeof(filename), "/run/udev/data/", id, NULL);
                 dbfile = filename;
         }
@@ -540,36 +871,12 @@ int udev_device_read_db(struct udev_device *udev_device, const char *dbfile)
 
         while (fgets(line, sizeof(line), f)) {
                 ssize_t len;
-                const char *val;
-                struct udev_list_entry *entry;
 
                 len = strlen(line);
                 if (len < 4)
                         break;
                 line[len-1] = '\0';
-                val = &line[2];
-                switch(line[0]) {
-                case 'S':
-                        strscpyl(filename, sizeof(filename), "/dev/", val, NULL);
-                        udev_device_add_devlink(udev_device, filename);
-                        break;
-                case 'L':
-                        udev_device_set_devlink_priority(udev_device, atoi(val));
-                        break;
-                case 'E':
-                        entry = udev_device_add_property_from_string(udev_device, val);
-                        udev_list_entry_set_num(entry, true);
-                        break;
-                case 'G':
-                        udev_device_add_tag(udev_device, val);
-                        break;
-                case 'W':
-                        udev_device_set_watch_handle(udev_device, atoi(val));
-                        break;
-                case 'I':
-                        udev_device_set_usec_initialized(udev_device, strtoull(val, NULL, 10));
-                        break;
-                }
+                read_db_line(udev_device, line[0], &line[2]);
         }
         fclose(f);
 
@@ -951,6 +1258,87 @@ _public_ struct udev_device *udev_device_new_from_environment(struct udev *udev)
         return udev_device;
 }
 
+/*
+ * Parent devices, kept by the context across events, together with
+ * everything they loaded lazily: their sysattr values, uevent file and
+ * database entry. Children below the same parents, like the partitions
+ * of a disk or the ports of a hub, then walk up the chain without
+ * reading sysfs again. The cache is only enabled by the udevd workers,
+ * and flushed as soon as the main daemon dispatched an event other
+ * than "add", which might have changed a parent.
+ */
+#define DEVICE_CACHE_ENTRIES_MAX 256
+
+struct udev_device_cache {
+        Hashmap *devices;
+        unsigned long long int seqnum;
+};
+
+void udev_device_cache_free(struct udev_device_cache *cache)
+{
+        struct udev_device *dev;
+
+        if (cache == NULL)
+                return;
+        while ((dev = hashmap_steal_first(cache->devices)))
+                udev_device_unref(dev);
+        hashmap_free(cache->devices);
+        free(cache);
+}
+
+/* called before every event with the seqnum of the last event which was not an "add" */
+int udev_device_cache_validate(struct udev *udev, unsigned long long int seqnum)
+{
+        struct udev_device_cache *cache;
+        struct udev_device *dev;
+
+        cache = udev_get_device_cache(udev);
+        if (cache == NULL) {
+                cache = calloc(1, sizeof(struct udev_device_cache));
+                if (cache == NULL)
+                        return -ENOMEM;
+                cache->devices = hashmap_new(string_hash_func, string_compare_func);
+                if (cache->devices == NULL) {
+                        free(cache);
+                        return -ENOMEM;
+                }
+                cache->seqnum = seqnum;
+                udev_set_device_cache(udev, cache);
+                return 0;
+        }
+
+        if (cache->seqnum == seqnum && hashmap_size(cache->devices) < DEVICE_CACHE_ENTRIES_MAX)
+                return 0;
+
+        while ((dev = hashmap_steal_first(cache->devices)))
+                udev_device_unref(dev);
+        cache->seqnum = seqnum;
+        return 0;
+}
+
+static struct udev_device *device_new_from_syspath_cached(struct udev *udev, const char *syspath)
+{
+        struct udev_device_cache *cache;
+        struct udev_device *dev;
+
+        cache = udev_get_device_cache(udev);
+        if (cache == NULL)
+                return udev_device_new_from_syspath(udev, syspath);
+
+        dev = hashmap_get(cache->devices, syspath);
+        if (dev != NULL)
+                return udev_device_ref(dev);
+
+        dev = udev_device_new_from_syspath(udev, syspath);
+        if (dev == NULL)
+                return NULL;
+
+        /* keyed by the syspath of the device, which the cache keeps a reference to */
+        if (hashmap_put(cache->devices, dev->syspath, dev) >= 0)
+                udev_device_ref(dev);
+        return dev;
+}
+
 static struct udev_device *device_new_from_parent(struct udev_device *udev_device)
 {
         struct udev_device *udev_device_parent = NULL;
@@ -966,7 +1354,7 @@ static struct udev_device *device_new_from_parent(struct udev_device *udev_devic
                 if (pos == NULL || pos < &subdir[2])
                         break;
                 pos[0] = '\0';
-                udev_device_parent = udev_device_new_from_syspath(udev_device->udev, path);
+                udev_device_parent = device_new_from_syspath_cached(udev_device->udev, path);
                 if (udev_device_parent != NULL)
                         return udev_device_parent;
         }
@@ -26,6 +26,7 @@
 #include <dirent.h>
 #include <fnmatch.h>
 #include <stdbool.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/param.h>
 
@@ -649,24 +650,68 @@ static bool match_sysname(struct udev_enumerate *udev_enumerate, const char *sys
         return false;
 }
 
-static int scan_dir_and_add_devices(struct udev_enumerate *udev_enumerate,
+/* whether any filter needs more than the syspath and the sysname */
+static bool match_needs_device(struct udev_enumerate *udev_enumerate)
+{
+        return udev_enumerate->match_is_initialized ||
+               udev_enumerate->parent_match != NULL ||
+               udev_list_get_entry(&udev_enumerate->tags_match_list) != NULL ||
+               udev_list_get_entry(&udev_enumerate->properties_match_list) != NULL ||
+               udev_list_get_entry(&udev_enumerate->sysattr_match_list) != NULL ||
+               udev_list_get_entry(&udev_enumerate->sysattr_nomatch_list) != NULL;
+}
+
+/* the same checks as udev_device_new_from_syspath(), relative to the directory */
+static bool device_exists_at(struct udev *udev, int dfd, const char *path, const char *name,
+                             char *syspath, size_t size)
+{
+        struct stat statbuf;
+
+        strscpyl(syspath, size, path, "/", name, NULL);
+        util_resolve_sys_link_at(udev, dfd, name, syspath, size);
+
+        if (startswith(syspath + strlen("/sys"), "/devices/")) {
+                char file[UTIL_PATH_SIZE];
+
+                strscpyl(file, sizeof(file), name, "/uevent", NULL);
+                return fstatat(dfd, file, &statbuf, 0) == 0;
+        }
+
+        return fstatat(dfd, name, &statbuf, 0) == 0 && S_ISDIR(statbuf.st_mode);
+}
+
+/* basefd refers to /sys/<basedir>, or is AT_FDCWD */
+static int scan_dir_and_add_devices(struct udev_enumerate *udev_enumerate, int basefd,
                                     const char *basedir, const char *subdir1, const char *subdir2)
 {
         char path[UTIL_PATH_SIZE];
+        const char *relpath;
         size_t l;
         char *s;
+        bool needs_device;
+        int fd;
         DIR *dir;
         struct dirent *dent;
 
         s = path;
         l = strpcpyl(&s, sizeof(path), "/sys/", basedir, NULL);
+        relpath = s + 1;
         if (subdir1 != NULL)
                 l = strpcpyl(&s, l, "/", subdir1, NULL);
         if (subdir2 != NULL)
                 strpcpyl(&s, l, "/", subdir2, NULL);
-        dir = opendir(path);
-        if (dir == NULL)
+        if (basefd == AT_FDCWD || subdir1 == NULL)
+                relpath = path;
+        fd = openat(basefd, relpath, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0)
+                return -ENOENT;
+        dir = fdopendir(fd);
+        if (dir == NULL) {
+                close(fd);
                 return -ENOENT;
+        }
+
+        needs_device = match_needs_device(udev_enumerate);
         for (dent = readdir(dir); dent != NULL; dent = readdir(dir)) {
                 char syspath[UTIL_PATH_SIZE];
                 struct udev_device *dev;
@@ -677,6 +722,14 @@ static int scan_dir_and_add_devices(struct udev_enumerate *udev_enumerate,
                 if (!match_sysname(udev_enumerate, dent->d_name))
                         continue;
 
+                /* nothing to look at, but whether it is a device */
+                if (!needs_device) {
+                        if (device_exists_at(udev_enumerate->udev, dirfd(dir), path, dent->d_name,
+                                             syspath, sizeof(syspath)))
+                                syspath_add(udev_enumerate, syspath);
+                        continue;
+                }
+
                 strscpyl(syspath, sizeof(syspath), path, "/", dent->d_name, NULL);
                 dev = udev_device_new_from_syspath(udev_enumerate->udev, syspath);
                 if (dev == NULL)
@@ -749,7 +802,7 @@ static int scan_dir(struct udev_enumerate *udev_enumerate, const char *basedir,
                         continue;
                 if (!match_subsystem(udev_enumerate, subsystem != NULL ? subsystem : dent->d_name))
                         continue;
-                scan_dir_and_add_devices(udev_enumerate, basedir, dent->d_name, subdir);
+                scan_dir_and_add_devices(udev_enumerate, dirfd(dir), basedir, dent->d_name, subdir);
         }
         closedir(dir);
         return 0;
@@ -825,6 +878,64 @@ nomatch:
         return 0;
 }
 
+/*
+ * Properties named ID_* are never set by the kernel, but only by rules
+ * and builtins, hence all devices carrying them have them stored in the
+ * database.
+ */
+static bool property_is_indexed(const char *key, const char *value)
+{
+        return value != NULL && startswith(key, "ID_") && strpbrk(key, "*?[") == NULL;
+}
+
+static int scan_devices_properties(struct udev_enumerate *udev_enumerate)
+{
+        struct udev_list_entry *list_entry;
+        struct udev_list ids;
+        int r = 0;
+
+        /* any of the properties matches, all of them have to be in the index */
+        udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_enumerate->properties_match_list))
+                if (!property_is_indexed(udev_list_entry_get_name(list_entry), udev_list_entry_get_value(list_entry)))
+                        return -ENOENT;
+
+        udev_list_init(udev_enumerate->udev, &ids, true);
+        udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_enumerate->properties_match_list)) {
+                if (udev_db_snapshot_find_property(udev_enumerate->udev,
+                                                   udev_list_entry_get_name(list_entry),
+                                                   udev_list_entry_get_value(list_entry), &ids) < 0) {
+                        r = -ENOENT;
+                        goto out;
+                }
+        }
+
+        udev_list_entry_foreach(list_entry, udev_list_get_entry(&ids)) {
+                struct udev_device *dev;
+
+                dev = udev_device_new_from_device_id(udev_enumerate->udev, (char *) udev_list_entry_get_name(list_entry));
+                if (dev == NULL)
+                        continue;
+
+                if (!match_subsystem(udev_enumerate, udev_device_get_subsystem(dev)))
+                        goto nomatch;
+                if (!match_sysname(udev_enumerate, udev_device_get_sysname(dev)))
+                        goto nomatch;
+                if (!match_parent(udev_enumerate, dev))
+                        goto nomatch;
+                if (!match_property(udev_enumerate, dev))
+                        goto nomatch;
+                if (!match_sysattr(udev_enumerate, dev))
+                        goto nomatch;
+
+                syspath_add(udev_enumerate, udev_device_get_syspath(dev));
+nomatch:
+                udev_device_unref(dev);
+        }
+out:
+        udev_list_cleanup(&ids);
+        return r;
+}
+
 static int parent_add_child(struct udev_enumerate *enumerate, const char *path)
 {
         struct udev_device *dev;
@@ -920,6 +1031,11 @@ _public_ int udev_enumerate_scan_devices(struct udev_enumerate *udev_enumerate)
         if (udev_list_get_entry(&udev_enumerate->tags_match_list) != NULL)
                 return scan_devices_tags(udev_enumerate);
 
+        /* lookup devices by property in the index of the database snapshot */
+        if (udev_list_get_entry(&udev_enumerate->properties_match_list) != NULL &&
+            scan_devices_properties(udev_enumerate) >= 0)
+                return 0;
+
         /* walk the subtree of one parent device only */
         if (udev_enumerate->parent_match != NULL)
                 return scan_devices_children(udev_enumerate);
@@ -946,7 +1062,7 @@ _public_ int udev_enumerate_scan_subsystems(struct udev_enumerate *udev_enumerat
 
         /* all kernel modules */
         if (match_subsystem(udev_enumerate, "module"))
-                scan_dir_and_add_devices(udev_enumerate, "module", NULL, NULL);
+                scan_dir_and_add_devices(udev_enumerate, AT_FDCWD, "module", NULL, NULL);
 
         if (stat("/sys/subsystem", &statbuf) == 0)
                 subsysdir = "subsystem";
@@ -955,7 +1071,7 @@ _public_ int udev_enumerate_scan_subsystems(struct udev_enumerate *udev_enumerat
 
         /* all subsystems (only buses support coldplug) */
         if (match_subsystem(udev_enumerate, "subsystem"))
-                scan_dir_and_add_devices(udev_enumerate, subsysdir, NULL, NULL);
+                scan_dir_and_add_devices(udev_enumerate, AT_FDCWD, subsysdir, NULL, NULL);
 
         /* all subsystem drivers */
         if (match_subsystem(udev_enumerate, "drivers"))
@@ -30,6 +30,7 @@
 
 #include "libudev-private.h"
 #include "libudev-hwdb-def.h"
+#include "glob-match.h"
 
 /**
  * SECTION:libudev-hwdb
@@ -38,6 +39,14 @@
  * Libudev hardware database interface.
  */
 
+/* the results of the most recent lookups, devices of the same model often come in numbers */
+#define HWDB_CACHE_SIZE 16
+
+struct hwdb_cache_entry {
+        char *modalias;
+        struct udev_list properties_list;
+};
+
 /**
  * udev_hwdb:
  *
@@ -54,7 +63,11 @@ struct udev_hwdb {
                 const char *map;
         };
 
-        struct udev_list properties_list;
+        /* the list the current lookup adds to */
+        struct udev_list *properties_list;
+
+        struct hwdb_cache_entry cache[HWDB_CACHE_SIZE];
+        unsigned int cache_next;
 };
 
 struct linebuf {
@@ -100,6 +113,34 @@ static void linebuf_rem_char(struct linebuf *buf) {
         linebuf_rem(buf, 1);
 }
 
+static bool linebuf_fnmatch(struct linebuf *buf, const char *search) {
+        const char *pattern;
+
+        pattern = linebuf_get(buf);
+        if (!pattern)
+                return false;
+        if (glob_simple(pattern, buf->len))
+                return glob_match(pattern, buf->len, search);
+        return fnmatch(pattern, search, 0) == 0;
+}
+
+/*
+ * Whether any pattern starting with the one in buf can match, which is when
+ * the pattern followed by a '*' does. This does not hold for an incomplete
+ * bracket expression, those are not checked.
+ */
+static bool linebuf_fnmatch_prefix(struct linebuf *buf, const char *search) {
+        bool match;
+
+        if (memchr(buf->bytes, '[', buf->len) || !glob_simple(buf->bytes, buf->len))
+                return true;
+        if (!linebuf_add_char(buf, '*'))
+                return true;
+        match = glob_match(buf->bytes, buf->len, search);
+        linebuf_rem_char(buf);
+        return match;
+}
+
 static const struct trie_child_entry_f *trie_node_children(struct udev_hwdb *hwdb, const struct trie_node_f *node) {
         return (const struct trie_child_entry_f *)((const char *)node + le64toh(hwdb->head->node_size));
 }
@@ -120,22 +161,24 @@ static const char *trie_string(struct udev_hwdb *hwdb, le64_t off) {
         return hwdb->map + le64toh(off);
 }
 
-static int trie_children_cmp_f(const void *v1, const void *v2) {
-        const struct trie_child_entry_f *n1 = v1;
-        const struct trie_child_entry_f *n2 = v2;
-
-        return n1->c - n2->c;
-}
-
 static const struct trie_node_f *node_lookup_f(struct udev_hwdb *hwdb, const struct trie_node_f *node, uint8_t c) {
-        struct trie_child_entry_f *child;
-        struct trie_child_entry_f search;
-
-        search.c = c;
-        child = bsearch(&search, trie_node_children(hwdb, node), node->children_count,
-                        le64toh(hwdb->head->child_entry_size), trie_children_cmp_f);
-        if (child)
-                return trie_node_from_off(hwdb, child->child_off);
+        const char *children = (const char *)trie_node_children(hwdb, node);
+        size_t size = le64toh(hwdb->head->child_entry_size);
+        size_t lo = 0, hi = node->children_count;
+
+        /* the children are sorted by character, called for every character of the lookup */
+        while (lo < hi) {
+                const struct trie_child_entry_f *child;
+                size_t mid = (lo + hi) / 2;
+
+                child = (const struct trie_child_entry_f *)(children + mid * size);
+                if (child->c == c)
+                        return trie_node_from_off(hwdb, child->child_off);
+                if (child->c < c)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
         return NULL;
 }
 
@@ -143,7 +186,7 @@ static int hwdb_add_property(struct udev_hwdb *hwdb, const char *key, const char
         /* TODO: add sub-matches (+) against DMI data */
         if (key[0] != ' ')
                 return 0;
-        if (udev_list_entry_add(&hwdb->properties_list, key+1, value) == NULL)
+        if (udev_list_entry_add(hwdb->properties_list, key+1, value) == NULL)
                 return -ENOMEM;
         return 0;
 }
@@ -159,6 +202,12 @@ static int trie_fnmatch_f(struct udev_hwdb *hwdb, const struct trie_node_f *node
         len = strlen(prefix + p);
         linebuf_add(buf, prefix + p, len);
 
+        /* nothing below can match */
+        if (!linebuf_fnmatch_prefix(buf, search)) {
+                linebuf_rem(buf, len);
+                return 0;
+        }
+
         for (i = 0; i < node->children_count; i++) {
                 const struct trie_child_entry_f *child = &trie_node_children(hwdb, node)[i];
 
@@ -169,7 +218,7 @@ static int trie_fnmatch_f(struct udev_hwdb *hwdb, const struct trie_node_f *node
                 linebuf_rem_char(buf);
         }
 
-        if (le64toh(node->values_count) && fnmatch(linebuf_get(buf), search, 0) == 0)
+        if (le64toh(node->values_count) && linebuf_fnmatch(buf, search))
                 for (i = 0; i < le64toh(node->values_count); i++) {
                         err = hwdb_add_property(hwdb, trie_string(hwdb, trie_node_values(hwdb, node)[i].key_off),
                                                 trie_string(hwdb, trie_node_values(hwdb, node)[i].value_off));
@@ -263,13 +312,15 @@ static int trie_search_f(struct udev_hwdb *hwdb, const char *search) {
 _public_ struct udev_hwdb *udev_hwdb_new(struct udev *udev) {
         struct udev_hwdb *hwdb;
         const char sig[] = HWDB_SIG;
+        unsigned int i;
 
         hwdb = new0(struct udev_hwdb, 1);
         if (!hwdb)
                 return NULL;
 
         hwdb->refcount = 1;
-        udev_list_init(udev, &hwdb->properties_list, true);
+        for (i = 0; i < HWDB_CACHE_SIZE; i++)
+                udev_list_init(udev, &hwdb->cache[i].properties_list, true);
 
         hwdb->f = fopen("/etc/udev/hwdb.bin", "re");
         if (!hwdb->f) {
@@ -333,6 +384,8 @@ _public_ struct udev_hwdb *udev_hwdb_ref(struct udev_hwdb *hwdb) {
  * Returns: the passed hwdb context if it has still an active reference, or #NULL otherwise.
  **/
 _public_ struct udev_hwdb *udev_hwdb_unref(struct udev_hwdb *hwdb) {
+        unsigned int i;
+
         if (!hwdb)
                 return NULL;
         hwdb->refcount--;
@@ -342,7 +395,10 @@ _public_ struct udev_hwdb *udev_hwdb_unref(struct udev_hwdb *hwdb) {
                 munmap((void *)hwdb->map, hwdb->st.st_size);
         if (hwdb->f)
                 fclose(hwdb->f);
-        udev_list_cleanup(&hwdb->properties_list);
+        for (i = 0; i < HWDB_CACHE_SIZE; i++) {
+                free(hwdb->cache[i].modalias);
+                udev_list_cleanup(&hwdb->cache[i].properties_list);
+        }
         free(hwdb);
         return NULL;
 }
@@ -375,6 +431,8 @@ bool udev_hwdb_validate(struct udev_hwdb *hwdb) {
  * Returns: a udev_list_entry.
  */
 _public_ struct udev_list_entry *udev_hwdb_get_properties_list_entry(struct udev_hwdb *hwdb, const char *modalias, unsigned int flags) {
+        struct hwdb_cache_entry *entry;
+        unsigned int i;
         int err;
 
         if (!hwdb || !hwdb->f) {
@@ -382,11 +440,26 @@ _public_ struct udev_list_entry *udev_hwdb_get_properties_list_entry(struct udev
                 return NULL;
         }
 
-        udev_list_cleanup(&hwdb->properties_list);
+        for (i = 0; i < HWDB_CACHE_SIZE; i++)
+                if (hwdb->cache[i].modalias && streq(hwdb->cache[i].modalias, modalias))
+                        return udev_list_get_entry(&hwdb->cache[i].properties_list);
+
+        /* replace the oldest one */
+        entry = &hwdb->cache[hwdb->cache_next];
+        hwdb->cache_next = (hwdb->cache_next + 1) % HWDB_CACHE_SIZE;
+        free(entry->modalias);
+        entry->modalias = NULL;
+        udev_list_cleanup(&entry->properties_list);
+
+        hwdb->properties_list = &entry->properties_list;
         err = trie_search_f(hwdb, modalias);
         if (err < 0) {
+                udev_list_cleanup(&entry->properties_list);
                 errno = -err;
                 return NULL;
         }
-        return udev_list_get_entry(&hwdb->properties_list);
+
+        /* not worth failing the lookup for */
+        entry->modalias = strdup(modalias);
+        return udev_list_get_entry(&entry->properties_list);
 }
@@ -58,7 +58,25 @@ struct udev_monitor {
         socklen_t addrlen;
         struct udev_list filter_subsystem_list;
         struct udev_list filter_tag_list;
+        struct udev_monitor_batch *batch;
         bool bound;
+        bool overflow;
+};
+
+#define UDEV_MONITOR_BUFFER_SIZE        8192
+
+/* Upper limit for growing the socket buffer after events were lost */
+#define UDEV_MONITOR_RCVBUF_MAX         (128*1024*1024)
+
+/* Messages received per recvmmsg() call by udev_monitor_receive_devices() */
+#define UDEV_MONITOR_BATCH_MAX          8U
+
+struct udev_monitor_batch {
+        char buf[UDEV_MONITOR_BATCH_MAX][UDEV_MONITOR_BUFFER_SIZE];
+        char cred_msg[UDEV_MONITOR_BATCH_MAX][CMSG_SPACE(sizeof(struct ucred))];
+        union sockaddr_union snl[UDEV_MONITOR_BATCH_MAX];
+        struct iovec iov[UDEV_MONITOR_BATCH_MAX];
+        struct mmsghdr msgs[UDEV_MONITOR_BATCH_MAX];
 };
 
 enum udev_monitor_netlink_group {
@@ -366,6 +384,9 @@ _public_ int udev_monitor_enable_receiving(struct udev_monitor *udev_monitor)
  * Set the size of the kernel socket buffer. This call needs the
  * appropriate privileges to succeed.
  *
+ * The buffer is doubled in size, up to 128 MB, whenever it overflowed
+ * and events were lost, as far as the privileges allow it.
+ *
  * Returns: 0 on success, otherwise -1 on error.
  */
 _public_ int udev_monitor_set_receive_buffer_size(struct udev_monitor *udev_monitor, int size)
@@ -375,6 +396,23 @@ _public_ int udev_monitor_set_receive_buffer_size(struct udev_monitor *udev_moni
         return setsockopt(udev_monitor->sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size));
 }
 
+static void monitor_grow_receive_buffer(struct udev_monitor *udev_monitor)
+{
+        int size;
+        socklen_t l = sizeof(size);
+
+        /* the kernel reports twice the size that was set */
+        if (getsockopt(udev_monitor->sock, SOL_SOCKET, SO_RCVBUF, &size, &l) < 0)
+                return;
+        if (size >= 2 * UDEV_MONITOR_RCVBUF_MAX)
+                return;
+        size = MIN(size, UDEV_MONITOR_RCVBUF_MAX);
+
+        /* without privileges this is capped at net.core.rmem_max */
+        if (setsockopt(udev_monitor->sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+                setsockopt(udev_monitor->sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
 int udev_monitor_disconnect(struct udev_monitor *udev_monitor)
 {
         int err;
@@ -421,6 +459,7 @@ _public_ struct udev_monitor *udev_monitor_unref(struct udev_monitor *udev_monit
                 close(udev_monitor->sock);
         udev_list_cleanup(&udev_monitor->filter_subsystem_list);
         udev_list_cleanup(&udev_monitor->filter_tag_list);
+        free(udev_monitor->batch);
         free(udev_monitor);
         return NULL;
 }
@@ -493,94 +532,159 @@ tag:
         return 0;
 }
 
-/**
- * udev_monitor_receive_device:
- * @udev_monitor: udev monitor
- *
- * Receive data from the udev monitor socket, allocate a new udev
- * device, fill in the received data, and return the device.
- *
- * Only socket connections with uid=0 are accepted.
- *
- * The monitor socket is by default set to NONBLOCK. A variant of poll() on
- * the file descriptor returned by udev_monitor_get_fd() should to be used to
- * wake up when new devices arrive, or alternatively the file descriptor
- * switched into blocking mode.
- *
- * The initial refcount is 1, and needs to be decremented to
- * release the resources of the udev device.
- *
- * Returns: a new udev device, or #NULL, in case of an error
- **/
-_public_ struct udev_device *udev_monitor_receive_device(struct udev_monitor *udev_monitor)
+/*
+ * The values of the properties the filter looks at, pointing into the
+ * received message, to drop events before a device is created for them.
+ * Kernel events, and subsystem matches with several entries, are not
+ * covered by the socket filter, and usually make up most of the
+ * events a monitor receives.
+ */
+struct udev_monitor_properties {
+        const char *subsystem;
+        const char *devtype;
+        const char *tags;
+};
+
+static void properties_parse(const char *buf, ssize_t bufpos, ssize_t buflen,
+                             struct udev_monitor_properties *properties)
 {
-        struct udev_device *udev_device;
-        struct msghdr smsg;
-        struct iovec iov;
-        char cred_msg[CMSG_SPACE(sizeof(struct ucred))];
-        struct cmsghdr *cmsg;
-        union sockaddr_union snl;
-        struct ucred *cred;
-        char buf[8192];
-        ssize_t buflen;
-        ssize_t bufpos;
-        struct udev_monitor_netlink_header *nlh;
+        memset(properties, 0x00, sizeof(struct udev_monitor_properties));
 
-retry:
-        if (udev_monitor == NULL)
-                return NULL;
-        iov.iov_base = &buf;
-        iov.iov_len = sizeof(buf);
-        memset (&smsg, 0x00, sizeof(struct msghdr));
-        smsg.msg_iov = &iov;
-        smsg.msg_iovlen = 1;
-        smsg.msg_control = cred_msg;
-        smsg.msg_controllen = sizeof(cred_msg);
+        while (bufpos < buflen) {
+                const char *key;
+                size_t keylen;
 
-        if (udev_monitor->snl.nl.nl_family != 0) {
-                smsg.msg_name = &snl;
-                smsg.msg_namelen = sizeof(snl);
+                key = &buf[bufpos];
+                keylen = strlen(key);
+                if (keylen == 0)
+                        break;
+                bufpos += keylen + 1;
+
+                if (startswith(key, "SUBSYSTEM="))
+                        properties->subsystem = &key[10];
+                else if (startswith(key, "DEVTYPE="))
+                        properties->devtype = &key[8];
+                else if (startswith(key, "TAGS="))
+                        properties->tags = &key[5];
         }
+}
 
-        buflen = recvmsg(udev_monitor->sock, &smsg, 0);
-        if (buflen < 0) {
-                if (errno != EINTR)
-                        udev_dbg(udev_monitor->udev, "unable to receive message\n");
-                return NULL;
+/* splits the TAGS value like udev_device_add_property_from_string_parse() */
+static bool properties_has_tag(const char *tags, const char *tag)
+{
+        size_t len = strlen(tag);
+        const char *next;
+
+        next = strchr(tags, ':');
+        if (next == NULL)
+                return false;
+        next++;
+        while (next[0] != '\0') {
+                const char *t = next;
+
+                next = strchr(t, ':');
+                if (next == NULL)
+                        break;
+                if ((size_t)(next - t) == len && strncmp(t, tag, len) == 0)
+                        return true;
+                next++;
         }
+        return false;
+}
+
+/*
+ * Same as passes_filter(), returns -1 if the answer depends on things
+ * the message does not carry, which the device reads from sysfs.
+ */
+static int passes_filter_properties(struct udev_monitor *udev_monitor,
+                                    const struct udev_monitor_properties *properties)
+{
+        struct udev_list_entry *list_entry;
+
+        if (udev_list_get_entry(&udev_monitor->filter_subsystem_list) == NULL)
+                goto tag;
+        if (properties->subsystem == NULL)
+                return -1;
+        udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_monitor->filter_subsystem_list)) {
+                const char *devtype;
+
+                if (!streq(properties->subsystem, udev_list_entry_get_name(list_entry)))
+                        continue;
 
-        if (buflen < 32 || (size_t)buflen >= sizeof(buf)) {
+                devtype = udev_list_entry_get_value(list_entry);
+                if (devtype == NULL)
+                        goto tag;
+                if (properties->devtype == NULL)
+                        return -1;
+                if (streq(properties->devtype, devtype))
+                        goto tag;
+        }
+        return 0;
+
+tag:
+        if (udev_list_get_entry(&udev_monitor->filter_tag_list) == NULL)
+                return 1;
+        if (properties->tags == NULL)
+                return 0;
+        if (strlen(properties->tags) >= UTIL_PATH_SIZE)
+                return -1;
+        udev_list_entry_foreach(list_entry, udev_list_get_entry(&udev_monitor->filter_tag_list)) {
+                if (properties_has_tag(properties->tags, udev_list_entry_get_name(list_entry)))
+                        return 1;
+        }
+        return 0;
+}
+
+/*
+ * Check a received message and create the device it describes. Returns
+ * 1 and the device, 0 if the device does not pass the current filter,
+ * and -1 if the message is not valid.
+ */
+static int monitor_parse_message(struct udev_monitor *udev_monitor, struct msghdr *smsg,
+                                 union sockaddr_union *snl, char *buf, ssize_t buflen,
+                                 struct udev_device **ret)
+{
+        struct udev_device *udev_device;
+        struct cmsghdr *cmsg;
+        struct ucred *cred;
+        ssize_t bufpos;
+        struct udev_monitor_netlink_header *nlh;
+        struct udev_monitor_properties properties;
+        int r;
+
+        if (buflen < 32 || buflen >= UDEV_MONITOR_BUFFER_SIZE) {
                 udev_dbg(udev_monitor->udev, "invalid message length\n");
-                return NULL;
+                return -1;
         }
+        buf[buflen] = '\0';
 
         if (udev_monitor->snl.nl.nl_family != 0) {
-                if (snl.nl.nl_groups == 0) {
+                if (snl->nl.nl_groups == 0) {
                         /* unicast message, check if we trust the sender */
                         if (udev_monitor->snl_trusted_sender.nl.nl_pid == 0 ||
-                            snl.nl.nl_pid != udev_monitor->snl_trusted_sender.nl.nl_pid) {
+                            snl->nl.nl_pid != udev_monitor->snl_trusted_sender.nl.nl_pid) {
                                 udev_dbg(udev_monitor->udev, "unicast netlink message ignored\n");
-                                return NULL;
+                                return -1;
                         }
-                } else if (snl.nl.nl_groups == UDEV_MONITOR_KERNEL) {
-                        if (snl.nl.nl_pid > 0) {
+                } else if (snl->nl.nl_groups == UDEV_MONITOR_KERNEL) {
+                        if (snl->nl.nl_pid > 0) {
                                 udev_dbg(udev_monitor->udev, "multicast kernel netlink message from pid %d ignored\n",
-                                     snl.nl.nl_pid);
-                                return NULL;
+                                     snl->nl.nl_pid);
+                                return -1;
                         }
                 }
         }
 
-        cmsg = CMSG_FIRSTHDR(&smsg);
+        cmsg = CMSG_FIRSTHDR(smsg);
         if (cmsg == NULL || cmsg->cmsg_type != SCM_CREDENTIALS) {
                 udev_dbg(udev_monitor->udev, "no sender credentials received, message ignored\n");
-                return NULL;
+                return -1;
         }
 
         cred = (struct ucred *)CMSG_DATA(cmsg);
         if (cred->uid != 0) {
                 udev_dbg(udev_monitor->udev, "sender uid=%d, message ignored\n", cred->uid);
-                return NULL;
+                return -1;
         }
 
         if (memcmp(buf, "libudev", 8) == 0) {
@@ -589,29 +693,35 @@ retry:
                 if (nlh->magic != htonl(UDEV_MONITOR_MAGIC)) {
                         udev_err(udev_monitor->udev, "unrecognized message signature (%x != %x)\n",
                             nlh->magic, htonl(UDEV_MONITOR_MAGIC));
-                        return NULL;
+                        return -1;
                 }
                 if (nlh->properties_off+32 > (size_t)buflen)
-                        return NULL;
+                        return -1;
                 bufpos = nlh->properties_off;
         } else {
                 /* kernel message with header */
                 bufpos = strlen(buf) + 1;
                 if ((size_t)bufpos < sizeof("a@/d") || bufpos >= buflen) {
                         udev_dbg(udev_monitor->udev, "invalid message length\n");
-                        return NULL;
+                        return -1;
                 }
 
                 /* check message header */
                 if (strstr(buf, "@/") == NULL) {
                         udev_dbg(udev_monitor->udev, "unrecognized message header\n");
-                        return NULL;
+                        return -1;
                 }
         }
 
+        /* skip device, if it can be told from the message that it does not pass the current filter */
+        properties_parse(buf, bufpos, buflen, &properties);
+        r = passes_filter_properties(udev_monitor, &properties);
+        if (r == 0)
+                return 0;
+
         udev_device = udev_device_new(udev_monitor->udev);
         if (udev_device == NULL)
-                return NULL;
+                return -1;
         udev_device_set_info_loaded(udev_device);
 
         while (bufpos < buflen) {
@@ -629,16 +739,93 @@ retry:
         if (udev_device_add_property_from_string_parse_finish(udev_device) < 0) {
                 udev_dbg(udev_monitor->udev, "missing values, invalid device\n");
                 udev_device_unref(udev_device);
-                return NULL;
+                return -1;
         }
 
         /* skip device, if it does not pass the current filter */
-        if (!passes_filter(udev_monitor, udev_device)) {
+        if (r < 0 && !passes_filter(udev_monitor, udev_device)) {
+                udev_device_unref(udev_device);
+                return 0;
+        }
+
+        *ret = udev_device;
+        return 1;
+}
+
+/**
+ * udev_monitor_receive_device:
+ * @udev_monitor: udev monitor
+ *
+ * Receive data from the udev monitor socket, allocate a new udev
+ * device, fill in the received data, and return the device.
+ *
+ * Only socket connections with uid=0 are accepted.
+ *
+ * The monitor socket is by default set to NONBLOCK. A variant of poll() on
+ * the file descriptor returned by udev_monitor_get_fd() should to be used to
+ * wake up when new devices arrive, or alternatively the file descriptor
+ * switched into blocking mode.
+ *
+ * If events were lost, because the socket buffer overflowed, #NULL
+ * is returned once with errno set to ENOBUFS. The state of the
+ * devices should then be read again.
+ *
+ * The initial refcount is 1, and needs to be decremented to
+ * release the resources of the udev device.
+ *
+ * Returns: a new udev device, or #NULL, in case of an error
+ **/
+_public_ struct udev_device *udev_monitor_receive_device(struct udev_monitor *udev_monitor)
+{
+        struct udev_device *udev_device = NULL;
+        struct msghdr smsg;
+        struct iovec iov;
+        char cred_msg[CMSG_SPACE(sizeof(struct ucred))];
+        union sockaddr_union snl;
+        char buf[UDEV_MONITOR_BUFFER_SIZE];
+        ssize_t buflen;
+        int r;
+
+retry:
+        if (udev_monitor == NULL)
+                return NULL;
+        iov.iov_base = &buf;
+        iov.iov_len = sizeof(buf);
+        memset (&smsg, 0x00, sizeof(struct msghdr));
+        smsg.msg_iov = &iov;
+        smsg.msg_iovlen = 1;
+        smsg.msg_control = cred_msg;
+        smsg.msg_controllen = sizeof(cred_msg);
+
+        if (udev_monitor->snl.nl.nl_family != 0) {
+                smsg.msg_name = &snl;
+                smsg.msg_namelen = sizeof(snl);
+        }
+
+        if (udev_monitor->overflow) {
+                udev_monitor->overflow = false;
+                errno = ENOBUFS;
+                return NULL;
+        }
+
+        buflen = recvmsg(udev_monitor->sock, &smsg, 0);
+        if (buflen < 0) {
+                if (errno == ENOBUFS) {
+                        udev_dbg(udev_monitor->udev, "socket buffer overflowed, events were lost\n");
+                        monitor_grow_receive_buffer(udev_monitor);
+                        errno = ENOBUFS;
+                } else if (errno != EINTR)
+                        udev_dbg(udev_monitor->udev, "unable to receive message\n");
+                return NULL;
+        }
+
+        r = monitor_parse_message(udev_monitor, &smsg, &snl, buf, buflen, &udev_device);
+        if (r < 0)
+                return NULL;
+        if (r == 0) {
                 struct pollfd pfd[1];
                 int rc;
 
-                udev_device_unref(udev_device);
-
                 /* if something is queued, get next device */
                 pfd[0].fd = udev_monitor->sock;
                 pfd[0].events = POLLIN;
@@ -651,6 +838,104 @@ retry:
         return udev_device;
 }
 
+/**
+ * udev_monitor_receive_devices:
+ * @udev_monitor: udev monitor
+ * @devices: array to store the received devices in
+ * @n: number of entries of @devices
+ *
+ * Receive up to @n devices from the udev monitor socket, like
+ * udev_monitor_receive_device() does, but with several messages
+ * read by every system call. This returns as soon as no more
+ * messages are queued, and blocks only for the first one, if
+ * the file descriptor was switched into blocking mode.
+ *
+ * If events were lost, because the socket buffer overflowed, -ENOBUFS
+ * is returned once, after the devices received before. The state of
+ * the devices should then be read again.
+ *
+ * Every stored device has a refcount of 1, and needs to be
+ * decremented to release the resources of the udev device.
+ *
+ * Returns: the number of stored devices, 0 if none of the queued
+ * ones passed the filter, or a negative error value.
+ **/
+_public_ int udev_monitor_receive_devices(struct udev_monitor *udev_monitor,
+                                          struct udev_device **devices, unsigned int n)
+{
+        struct udev_monitor_batch *b;
+        unsigned int stored = 0;
+        int flags = MSG_WAITFORONE;
+
+        if (udev_monitor == NULL || devices == NULL)
+                return -EINVAL;
+
+        if (udev_monitor->batch == NULL) {
+                udev_monitor->batch = malloc(sizeof(struct udev_monitor_batch));
+                if (udev_monitor->batch == NULL)
+                        return -ENOMEM;
+        }
+        b = udev_monitor->batch;
+
+        if (udev_monitor->overflow) {
+                udev_monitor->overflow = false;
+                return -ENOBUFS;
+        }
+
+        while (stored < n) {
+                unsigned int want = MIN(n - stored, UDEV_MONITOR_BATCH_MAX);
+                unsigned int i;
+                int k;
+
+                for (i = 0; i < want; i++) {
+                        b->iov[i].iov_base = b->buf[i];
+                        b->iov[i].iov_len = sizeof(b->buf[i]);
+                        memset(&b->msgs[i], 0x00, sizeof(struct mmsghdr));
+                        b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+                        b->msgs[i].msg_hdr.msg_iovlen = 1;
+                        b->msgs[i].msg_hdr.msg_control = b->cred_msg[i];
+                        b->msgs[i].msg_hdr.msg_controllen = sizeof(b->cred_msg[i]);
+                        if (udev_monitor->snl.nl.nl_family != 0) {
+                                b->msgs[i].msg_hdr.msg_name = &b->snl[i];
+                                b->msgs[i].msg_hdr.msg_namelen = sizeof(b->snl[i]);
+                        }
+                }
+
+                k = recvmmsg(udev_monitor->sock, b->msgs, want, flags, NULL);
+                if (k < 0) {
+                        if (errno == ENOBUFS) {
+                                udev_dbg(udev_monitor->udev, "socket buffer overflowed, events were lost\n");
+                                monitor_grow_receive_buffer(udev_monitor);
+                                if (stored == 0)
+                                        return -ENOBUFS;
+                                udev_monitor->overflow = true;
+                                break;
+                        }
+                        if (stored > 0 || errno == EAGAIN)
+                                break;
+                        if (errno != EINTR)
+                                udev_dbg(udev_monitor->udev, "unable to receive message\n");
+                        return -errno;
+                }
+
+                for (i = 0; i < (unsigned int) k; i++) {
+                        struct udev_device *udev_device;
+
+                        if (monitor_parse_message(udev_monitor, &b->msgs[i].msg_hdr, &b->snl[i],
+                                                  b->buf[i], b->msgs[i].msg_len, &udev_device) > 0)
+                                devices[stored++] = udev_device;
+                }
+
+                if ((unsigned int) k < want)
+                        break;
+
+                /* only wait for the first message */
+                flags = MSG_DONTWAIT;
+        }
+
+        return stored;
+}
+
 int udev_monitor_send_device(struct udev_monitor *udev_monitor,
                              struct udev_monitor *destination, struct udev_device *udev_device)
 {
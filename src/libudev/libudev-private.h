@@ -53,6 +53,12 @@ void udev_log(struct udev *udev,
 int udev_get_rules_path(struct udev *udev, char **path[], usec_t *ts_usec[]);
 struct udev_list_entry *udev_add_property(struct udev *udev, const char *key, const char *value);
 struct udev_list_entry *udev_get_properties_list_entry(struct udev *udev);
+struct udev_db_snapshot;
+struct udev_db_snapshot *udev_get_db_snapshot(struct udev *udev);
+void udev_set_db_snapshot(struct udev *udev, struct udev_db_snapshot *db_snapshot);
+struct udev_device_cache;
+struct udev_device_cache *udev_get_device_cache(struct udev *udev);
+void udev_set_device_cache(struct udev *udev, struct udev_device_cache *device_cache);
 
 /* libudev-device.c */
 struct udev_device *udev_device_new(struct udev *udev);
@@ -70,6 +76,11 @@ int udev_device_add_property_from_string_parse_finish(struct udev_device *udev_d
 char **udev_device_get_properties_envp(struct udev_device *udev_device);
 ssize_t udev_device_get_properties_monitor_buf(struct udev_device *udev_device, const char **buf);
 int udev_device_read_db(struct udev_device *udev_device, const char *dbfile);
+void udev_db_snapshot_free(struct udev_db_snapshot *db_snapshot);
+struct udev_list;
+int udev_db_snapshot_find_property(struct udev *udev, const char *key, const char *value, struct udev_list *list);
+void udev_device_cache_free(struct udev_device_cache *cache);
+int udev_device_cache_validate(struct udev *udev, unsigned long long int seqnum);
 int udev_device_read_uevent_file(struct udev_device *udev_device);
 int udev_device_set_action(struct udev_device *udev_device, const char *action);
 const char *udev_device_get_devpath_old(struct udev_device *udev_device);
@@ -91,6 +102,8 @@ void udev_device_set_db_persist(struct udev_device *udev_device);
 /* libudev-device-private.c */
 int udev_device_update_db(struct udev_device *udev_device);
 int udev_device_delete_db(struct udev_device *udev_device);
+int udev_db_write_snapshot(struct udev *udev);
+int udev_db_invalidate_snapshot(struct udev *udev);
 int udev_device_tag_index(struct udev_device *dev, struct udev_device *dev_old, bool add);
 
 /* libudev-monitor.c - netlink/unix socket communication  */
@@ -144,6 +157,7 @@ unsigned long long int udev_get_kernel_seqnum(struct udev *udev);
 int udev_queue_read_seqnum(FILE *queue_file, unsigned long long int *seqnum);
 ssize_t udev_queue_read_devpath(FILE *queue_file, char *devpath, size_t size);
 ssize_t udev_queue_skip_devpath(FILE *queue_file);
+int udev_queue_count_queued(struct udev_queue *udev_queue, unsigned long long int *seqnum_udev);
 
 /* libudev-queue-private.c */
 struct udev_queue_export *udev_queue_export_new(struct udev *udev);
@@ -162,6 +176,7 @@ bool udev_hwdb_validate(struct udev_hwdb *hwdb);
 #define UDEV_ALLOWED_CHARS_INPUT        "/ $%?,"
 ssize_t util_get_sys_core_link_value(struct udev *udev, const char *slink, const char *syspath, char *value, size_t size);
 int util_resolve_sys_link(struct udev *udev, char *syspath, size_t size);
+int util_resolve_sys_link_at(struct udev *udev, int dfd, const char *name, char *syspath, size_t size);
 int util_log_priority(const char *priority);
 size_t util_path_encode(const char *src, char *dest, size_t size);
 void util_remove_trailing_chars(char *path, char c);
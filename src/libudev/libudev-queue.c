@@ -342,6 +342,43 @@ out:
         return is_empty;
 }
 
+/*
+ * Count the events udevd queued but did not finish yet, and get the last
+ * seqnum it queued, in a single pass over the queue file.
+ */
+int udev_queue_count_queued(struct udev_queue *udev_queue, unsigned long long int *seqnum_udev)
+{
+        FILE *queue_file;
+        int queued = 0;
+
+        if (udev_queue == NULL)
+                return -EINVAL;
+        queue_file = open_queue_file(udev_queue, seqnum_udev);
+        if (queue_file == NULL)
+                return -ENOENT;
+
+        for (;;) {
+                unsigned long long int seqnum;
+                ssize_t devpath_len;
+
+                if (udev_queue_read_seqnum(queue_file, &seqnum) < 0)
+                        break;
+                devpath_len = udev_queue_skip_devpath(queue_file);
+                if (devpath_len < 0)
+                        break;
+
+                if (devpath_len > 0) {
+                        queued++;
+                        *seqnum_udev = seqnum;
+                } else {
+                        queued--;
+                }
+        }
+
+        fclose(queue_file);
+        return MAX(queued, 0);
+}
+
 /**
  * udev_queue_get_seqnum_sequence_is_finished:
  * @udev_queue: udev queue context
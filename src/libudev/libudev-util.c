@@ -219,7 +219,8 @@ ssize_t util_get_sys_core_link_value(struct udev *udev, const char *slink, const
         return strscpy(value, size, pos);
 }
 
-int util_resolve_sys_link(struct udev *udev, char *syspath, size_t size)
+/* resolve the link name in the directory dfd, syspath is its full path */
+int util_resolve_sys_link_at(struct udev *udev, int dfd, const char *name, char *syspath, size_t size)
 {
         char link_target[UTIL_PATH_SIZE];
 
@@ -228,7 +229,7 @@ int util_resolve_sys_link(struct udev *udev, char *syspath, size_t size)
         int back;
         char *base = NULL;
 
-        len = readlink(syspath, link_target, sizeof(link_target));
+        len = readlinkat(dfd, name, link_target, sizeof(link_target));
         if (len <= 0 || len == (ssize_t)sizeof(link_target))
                 return -1;
         link_target[len] = '\0';
@@ -246,6 +247,11 @@ int util_resolve_sys_link(struct udev *udev, char *syspath, size_t size)
         return 0;
 }
 
+int util_resolve_sys_link(struct udev *udev, char *syspath, size_t size)
+{
+        return util_resolve_sys_link_at(udev, AT_FDCWD, syspath, syspath, size);
+}
+
 int util_log_priority(const char *priority)
 {
         char *endptr;
@@ -52,6 +52,8 @@ struct udev {
         void *userdata;
         struct udev_list properties_list;
         int log_priority;
+        struct udev_db_snapshot *db_snapshot;
+        struct udev_device_cache *device_cache;
 };
 
 void udev_log(struct udev *udev,
@@ -240,6 +242,8 @@ _public_ struct udev *udev_unref(struct udev *udev)
         if (udev->refcount > 0)
                 return udev;
         udev_list_cleanup(&udev->properties_list);
+        udev_device_cache_free(udev->device_cache);
+        udev_db_snapshot_free(udev->db_snapshot);
         free(udev);
         return NULL;
 }
@@ -312,3 +316,23 @@ struct udev_list_entry *udev_get_properties_list_entry(struct udev *udev)
 {
         return udev_list_get_entry(&udev->properties_list);
 }
+
+struct udev_db_snapshot *udev_get_db_snapshot(struct udev *udev)
+{
+        return udev->db_snapshot;
+}
+
+void udev_set_db_snapshot(struct udev *udev, struct udev_db_snapshot *db_snapshot)
+{
+        udev->db_snapshot = db_snapshot;
+}
+
+struct udev_device_cache *udev_get_device_cache(struct udev *udev)
+{
+        return udev->device_cache;
+}
+
+void udev_set_device_cache(struct udev *udev, struct udev_device_cache *device_cache)
+{
+        udev->device_cache = device_cache;
+}
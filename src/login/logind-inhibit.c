@@ -70,6 +70,8 @@ void inhibitor_free(Inhibitor *i) {
         hashmap_remove(i->manager->inhibitors, i->id);
         inhibitor_remove_fifo(i);
 
+        manager_invalidate_idle_hint(i->manager);
+
         if (i->state_file) {
                 unlink(i->state_file);
                 free(i->state_file);
@@ -164,6 +166,8 @@ int inhibitor_start(Inhibitor *i) {
 
         i->started = true;
 
+        manager_invalidate_idle_hint(i->manager);
+
         manager_send_changed(i->manager, i->mode == INHIBIT_BLOCK ? "BlockInhibited\0" : "DelayInhibited\0");
 
         return 0;
@@ -183,6 +187,8 @@ int inhibitor_stop(Inhibitor *i) {
 
         i->started = false;
 
+        manager_invalidate_idle_hint(i->manager);
+
         manager_send_changed(i->manager, i->mode == INHIBIT_BLOCK ? "BlockInhibited\0" : "DelayInhibited\0");
 
         return 0;
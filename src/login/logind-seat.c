@@ -69,6 +69,9 @@ void seat_free(Seat *s) {
         if (s->in_gc_queue)
                 LIST_REMOVE(Seat, gc_queue, s->manager->seat_gc_queue, s);
 
+        if (s->in_save_queue)
+                LIST_REMOVE(Seat, save_queue, s->manager->seat_save_queue, s);
+
         while (s->sessions)
                 session_free(s->sessions);
 
@@ -512,6 +515,16 @@ void seat_add_to_gc_queue(Seat *s) {
         s->in_gc_queue = true;
 }
 
+void seat_add_to_save_queue(Seat *s) {
+        assert(s);
+
+        if (s->in_save_queue)
+                return;
+
+        LIST_PREPEND(Seat, save_queue, s->manager->seat_save_queue, s);
+        s->in_save_queue = true;
+}
+
 static bool seat_name_valid_char(char c) {
         return
                 (c >= 'a' && c <= 'z') ||
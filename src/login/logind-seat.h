@@ -41,9 +41,11 @@ struct Seat {
         LIST_HEAD(Session, sessions);
 
         bool in_gc_queue:1;
+        bool in_save_queue:1;
         bool started:1;
 
         LIST_FIELDS(Seat, gc_queue);
+        LIST_FIELDS(Seat, save_queue);
 };
 
 Seat *seat_new(Manager *m, const char *id);
@@ -73,6 +75,7 @@ int seat_stop_sessions(Seat *s);
 
 int seat_check_gc(Seat *s, bool drop_not_started);
 void seat_add_to_gc_queue(Seat *s);
+void seat_add_to_save_queue(Seat *s);
 
 bool seat_name_is_valid(const char *name);
 char *seat_bus_path(Seat *s);
@@ -34,6 +34,7 @@
 #include "cgroup-util.h"
 #include "logind-session.h"
 #include "fileio.h"
+#include "trace.h"
 
 Session* session_new(Manager *m, User *u, const char *id) {
         Session *s;
@@ -65,6 +66,8 @@ Session* session_new(Manager *m, User *u, const char *id) {
 
         LIST_PREPEND(Session, sessions_by_user, u->sessions, s);
 
+        manager_invalidate_idle_hint(m);
+
         return s;
 }
 
@@ -103,6 +106,8 @@ void session_free(Session *s) {
         hashmap_remove(s->manager->sessions, s->id);
         session_remove_fifo(s);
 
+        manager_invalidate_idle_hint(s->manager);
+
         free(s->state_file);
         free(s);
 }
@@ -541,6 +546,8 @@ int session_start(Session *s) {
         if (s->started)
                 return 0;
 
+        TRACE2(session_start, s->id, s->user->uid);
+
         r = user_start(s->user);
         if (r < 0)
                 return r;
@@ -568,14 +575,17 @@ int session_start(Session *s) {
 
         s->started = true;
 
-        /* Save session data */
+        /* Save session data. The session file has to be in place
+         * before anybody learns about the session, but the user and
+         * seat files list all their sessions, and are hence written
+         * only once for all logins processed in one go. */
         session_save(s);
-        user_save(s->user);
+        user_add_to_save_queue(s->user);
 
         session_send_signal(s, true);
 
         if (s->seat) {
-                seat_save(s->seat);
+                seat_add_to_save_queue(s->seat);
 
                 if (s->seat->active == s)
                         seat_send_changed(s->seat, "Sessions\0ActiveSession\0");
@@ -686,6 +696,8 @@ int session_stop(Session *s) {
 
         assert(s);
 
+        TRACE2(session_stop, s->id, s->user->uid);
+
         if (s->started)
                 log_struct(s->type == SESSION_TTY || s->type == SESSION_X11 ? LOG_INFO : LOG_DEBUG,
                            MESSAGE_ID(SD_MESSAGE_SESSION_STOP),
@@ -717,11 +729,11 @@ int session_stop(Session *s) {
                         seat_set_active(s->seat, NULL);
 
                 seat_send_changed(s->seat, "Sessions\0");
-                seat_save(s->seat);
+                seat_add_to_save_queue(s->seat);
         }
 
         user_send_changed(s->user, "Sessions\0");
-        user_save(s->user);
+        user_add_to_save_queue(s->user);
 
         return r;
 }
@@ -772,39 +784,26 @@ static int get_process_ctty_atime(pid_t pid, usec_t *atime) {
         return get_tty_atime(p, atime);
 }
 
-int session_get_idle_hint(Session *s, dual_timestamp *t) {
-        usec_t atime = 0, n;
+static int session_sample_tty_atime(Session *s, usec_t *atime) {
         int r;
 
         assert(s);
-
-        /* Explicit idle hint is set */
-        if (s->idle_hint) {
-                if (t)
-                        *t = s->idle_hint_timestamp;
-
-                return s->idle_hint;
-        }
-
-        /* Graphical sessions should really implement a real
-         * idle hint logic */
-        if (s->display)
-                goto dont_know;
+        assert(atime);
 
         /* For sessions with an explicitly configured tty, let's check
          * its atime */
         if (s->tty) {
-                r = get_tty_atime(s->tty, &atime);
+                r = get_tty_atime(s->tty, atime);
                 if (r >= 0)
-                        goto found_atime;
+                        return 0;
         }
 
         /* For sessions with a leader but no explicitly configured
          * tty, let's check the controlling tty of the leader */
         if (s->leader > 0) {
-                r = get_process_ctty_atime(s->leader, &atime);
+                r = get_process_ctty_atime(s->leader, atime);
                 if (r >= 0)
-                        goto found_atime;
+                        return 0;
         }
 
         /* For other TTY sessions, let's find the most recent atime of
@@ -815,20 +814,55 @@ int session_get_idle_hint(Session *s, dual_timestamp *t) {
                 if (cg_enumerate_processes(SYSTEMD_CGROUP_CONTROLLER, s->cgroup_path, &f) >= 0) {
                         pid_t pid;
 
-                        atime = 0;
+                        *atime = 0;
                         while (cg_read_pid(f, &pid) > 0) {
                                 usec_t a;
 
                                 if (get_process_ctty_atime(pid, &a) >= 0)
-                                        if (atime == 0 || atime < a)
-                                                atime = a;
+                                        if (*atime == 0 || *atime < a)
+                                                *atime = a;
                         }
 
-                        if (atime != 0)
-                                goto found_atime;
+                        if (*atime != 0)
+                                return 0;
                 }
         }
 
+        return -ENOENT;
+}
+
+int session_get_idle_hint(Session *s, dual_timestamp *t) {
+        usec_t atime, n;
+
+        assert(s);
+
+        /* Explicit idle hint is set */
+        if (s->idle_hint) {
+                if (t)
+                        *t = s->idle_hint_timestamp;
+
+                return s->idle_hint;
+        }
+
+        /* Graphical sessions should really implement a real
+         * idle hint logic */
+        if (s->display)
+                goto dont_know;
+
+        /* Don't stat() the TTYs again for every aggregated idle hint
+         * and every property read, a recent sample is good enough */
+        n = now(CLOCK_MONOTONIC);
+        if (s->tty_atime_sampled == 0 || n >= s->tty_atime_sampled + IDLE_HINT_SAMPLE_USEC) {
+                if (session_sample_tty_atime(s, &s->tty_atime) < 0)
+                        s->tty_atime = 0;
+
+                s->tty_atime_sampled = n;
+        }
+
+        atime = s->tty_atime;
+        if (atime != 0)
+                goto found_atime;
+
 dont_know:
         if (t)
                 *t = s->idle_hint_timestamp;
@@ -856,6 +890,8 @@ void session_set_idle_hint(Session *s, bool b) {
         s->idle_hint = b;
         dual_timestamp_get(&s->idle_hint_timestamp);
 
+        manager_invalidate_idle_hint(s->manager);
+
         session_send_changed(s,
                              "IdleHint\0"
                              "IdleSinceHint\0"
@@ -97,6 +97,11 @@ struct Session {
         bool idle_hint;
         dual_timestamp idle_hint_timestamp;
 
+        /* The most recent atime of the TTYs of the session, 0 if
+         * none was found, and when it was sampled */
+        usec_t tty_atime;
+        usec_t tty_atime_sampled;
+
         bool kill_processes;
         bool in_gc_queue:1;
         bool started:1;
@@ -73,6 +73,9 @@ void user_free(User *u) {
         if (u->in_gc_queue)
                 LIST_REMOVE(User, gc_queue, u->manager->user_gc_queue, u);
 
+        if (u->in_save_queue)
+                LIST_REMOVE(User, save_queue, u->manager->user_save_queue, u);
+
         while (u->sessions)
                 session_free(u->sessions);
 
@@ -599,6 +602,16 @@ void user_add_to_gc_queue(User *u) {
         u->in_gc_queue = true;
 }
 
+void user_add_to_save_queue(User *u) {
+        assert(u);
+
+        if (u->in_save_queue)
+                return;
+
+        LIST_PREPEND(User, save_queue, u->manager->user_save_queue, u);
+        u->in_save_queue = true;
+}
+
 UserState user_get_state(User *u) {
         Session *i;
         bool all_closing = true;
@@ -38,6 +38,7 @@
 #include "strv.h"
 #include "conf-parser.h"
 #include "mkdir.h"
+#include "trace.h"
 
 Manager *manager_new(void) {
         Manager *m;
@@ -47,7 +48,6 @@ Manager *manager_new(void) {
                 return NULL;
 
         m->console_active_fd = -1;
-        m->bus_fd = -1;
         m->udev_seat_fd = -1;
         m->udev_vcsa_fd = -1;
         m->udev_button_fd = -1;
@@ -120,6 +120,9 @@ void manager_free(Manager *m) {
 
         assert(m);
 
+        /* We might be restarted, so leave current state behind */
+        manager_dispatch_save_queue(m);
+
         while ((session = hashmap_first(m->sessions)))
                 session_free(session);
 
@@ -171,8 +174,7 @@ void manager_free(Manager *m) {
                 dbus_connection_unref(m->bus);
         }
 
-        if (m->bus_fd >= 0)
-                close_nointr_nofail(m->bus_fd);
+        event_loop_free(m->bus_event);
 
         if (m->epoll_fd >= 0)
                 close_nointr_nofail(m->epoll_fd);
@@ -1027,82 +1029,54 @@ static int manager_reserve_vt(Manager *m) {
         return 0;
 }
 
-int manager_get_session_by_cgroup(Manager *m, const char *cgroup, Session **session) {
-        Session *s;
-        char *p;
+static void *cgroup_hashmap_get_prefix(Hashmap *h, const char *cgroup) {
+        void *v;
+        char *p, *e;
 
-        assert(m);
+        assert(h);
         assert(cgroup);
-        assert(session);
 
-        s = hashmap_get(m->session_cgroups, cgroup);
-        if (s) {
-                *session = s;
-                return 1;
-        }
+        /* Processes are mostly found in the cgroup of their session
+         * or a few levels below it, so look at the path itself first,
+         * and then walk up on a copy of it on the stack. Nothing in
+         * the cgroup tree can have a longer path than PATH_MAX. */
 
-        p = strdup(cgroup);
-        if (!p)
-                return log_oom();
+        v = hashmap_get(h, cgroup);
+        if (v)
+                return v;
 
-        for (;;) {
-                char *e;
+        if (strlen(cgroup) >= PATH_MAX)
+                return NULL;
 
-                e = strrchr(p, '/');
-                if (!e || e == p) {
-                        free(p);
-                        *session = NULL;
-                        return 0;
-                }
+        p = strdupa(cgroup);
 
+        while ((e = strrchr(p, '/')) && e != p) {
                 *e = 0;
 
-                s = hashmap_get(m->session_cgroups, p);
-                if (s) {
-                        free(p);
-                        *session = s;
-                        return 1;
-                }
+                v = hashmap_get(h, p);
+                if (v)
+                        return v;
         }
-}
 
-int manager_get_user_by_cgroup(Manager *m, const char *cgroup, User **user) {
-        User *u;
-        char *p;
+        return NULL;
+}
 
+int manager_get_session_by_cgroup(Manager *m, const char *cgroup, Session **session) {
         assert(m);
         assert(cgroup);
-        assert(user);
-
-        u = hashmap_get(m->user_cgroups, cgroup);
-        if (u) {
-                *user = u;
-                return 1;
-        }
-
-        p = strdup(cgroup);
-        if (!p)
-                return log_oom();
-
-        for (;;) {
-                char *e;
+        assert(session);
 
-                e = strrchr(p, '/');
-                if (!e || e == p) {
-                        free(p);
-                        *user = NULL;
-                        return 0;
-                }
+        *session = cgroup_hashmap_get_prefix(m->session_cgroups, cgroup);
+        return !!*session;
+}
 
-                *e = 0;
+int manager_get_user_by_cgroup(Manager *m, const char *cgroup, User **user) {
+        assert(m);
+        assert(cgroup);
+        assert(user);
 
-                u = hashmap_get(m->user_cgroups, p);
-                if (u) {
-                        free(p);
-                        *user = u;
-                        return 1;
-                }
-        }
+        *user = cgroup_hashmap_get_prefix(m->user_cgroups, cgroup);
+        return !!*user;
 }
 
 int manager_get_session_by_pid(Manager *m, pid_t pid, Session **session) {
@@ -1181,7 +1155,7 @@ static int manager_connect_bus(Manager *m) {
 
         assert(m);
         assert(!m->bus);
-        assert(m->bus_fd < 0);
+        assert(!m->bus_event);
 
         dbus_error_init(&error);
 
@@ -1227,15 +1201,19 @@ static int manager_connect_bus(Manager *m) {
                 goto fail;
         }
 
-        m->bus_fd = bus_loop_open(m->bus);
-        if (m->bus_fd < 0) {
-                r = m->bus_fd;
+        r = event_loop_new(&m->bus_event);
+        if (r < 0)
                 goto fail;
-        }
 
-        if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, m->bus_fd, &ev) < 0)
+        r = bus_loop_open(m->bus, m->bus_event);
+        if (r < 0)
                 goto fail;
 
+        if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, event_loop_get_fd(m->bus_event), &ev) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
         return 0;
 
 fail:
@@ -1404,14 +1382,48 @@ void manager_gc(Manager *m, bool drop_not_started) {
         }
 }
 
+void manager_dispatch_save_queue(Manager *m) {
+        Seat *seat;
+        User *user;
+
+        assert(m);
+
+        while ((seat = m->seat_save_queue)) {
+                LIST_REMOVE(Seat, save_queue, m->seat_save_queue, seat);
+                seat->in_save_queue = false;
+
+                seat_save(seat);
+        }
+
+        while ((user = m->user_save_queue)) {
+                LIST_REMOVE(User, save_queue, m->user_save_queue, user);
+                user->in_save_queue = false;
+
+                user_save(user);
+        }
+}
+
 int manager_get_idle_hint(Manager *m, dual_timestamp *t) {
         Session *s;
         bool idle_hint;
         dual_timestamp ts = { 0, 0 };
         Iterator i;
+        usec_t n;
 
         assert(m);
 
+        /* D-Bus clients read the IdleHint properties often, so
+         * don't go through all sessions again for every read */
+        n = now(CLOCK_MONOTONIC);
+        if (n < m->idle_hint_until) {
+                if (t)
+                        *t = m->idle_hint_timestamp;
+
+                return m->idle_hint;
+        }
+
+        TRACE1(idle_hint_scan, hashmap_size(m->sessions));
+
         idle_hint = !manager_is_inhibited(m, INHIBIT_IDLE, INHIBIT_BLOCK, t, false, false, 0);
 
         HASHMAP_FOREACH(s, m->sessions, i) {
@@ -1437,12 +1449,34 @@ int manager_get_idle_hint(Manager *m, dual_timestamp *t) {
                 }
         }
 
+        m->idle_hint = idle_hint;
+        m->idle_hint_timestamp = ts;
+        m->idle_hint_until = n + IDLE_HINT_SAMPLE_USEC;
+
         if (t)
                 *t = ts;
 
         return idle_hint;
 }
 
+void manager_invalidate_idle_hint(Manager *m) {
+        assert(m);
+
+        m->idle_hint_until = 0;
+}
+
+static void manager_flush_idle_hint(Manager *m) {
+        Session *s;
+        Iterator i;
+
+        assert(m);
+
+        HASHMAP_FOREACH(s, m->sessions, i)
+                s->tty_atime_sampled = 0;
+
+        manager_invalidate_idle_hint(m);
+}
+
 int manager_dispatch_idle_action(Manager *m) {
         struct dual_timestamp since;
         struct itimerspec its = {};
@@ -1459,6 +1493,10 @@ int manager_dispatch_idle_action(Manager *m) {
 
         n = now(CLOCK_MONOTONIC);
 
+        /* Before taking action, make sure nobody typed anything
+         * since the TTYs were sampled last */
+        manager_flush_idle_hint(m);
+
         r = manager_get_idle_hint(m, &since);
         if (r <= 0)
                 /* Not idle. Let's check if after a timeout it might be idle then. */
@@ -1625,6 +1663,10 @@ int manager_run(Manager *m) {
 
                 manager_gc(m, true);
 
+                /* Everything queued up is processed, write out what
+                 * changed on the way */
+                manager_dispatch_save_queue(m);
+
                 if (m->action_what != 0 && !m->action_job) {
                         usec_t x, y;
 
@@ -1634,6 +1676,14 @@ int manager_run(Manager *m) {
                         msec = x >= y ? 0 : (int) ((y - x) / USEC_PER_MSEC);
                 }
 
+                if (log_flush() < 0 && (msec < 0 || msec > LOG_FLUSH_RETRY_MSEC))
+                        msec = LOG_FLUSH_RETRY_MSEC;
+
+                /* Apply the watch changes D-Bus made while
+                 * dispatching, before we wait on the bus loop fd */
+                if (event_loop_prepare(m->bus_event) > 0)
+                        msec = 0;
+
                 n = epoll_wait(m->epoll_fd, &event, 1, msec);
                 if (n < 0) {
                         if (errno == EINTR || errno == EAGAIN)
@@ -1669,7 +1719,7 @@ int manager_run(Manager *m) {
                         break;
 
                 case FD_BUS:
-                        bus_loop_dispatch(m->bus_fd);
+                        event_loop_run(m->bus_event, 0);
                         break;
 
                 default:
@@ -1715,6 +1765,7 @@ int main(int argc, char *argv[]) {
         log_set_facility(LOG_AUTH);
         log_parse_environment();
         log_open();
+        log_set_queue(true);
 
         umask(0022);
 
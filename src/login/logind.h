@@ -31,6 +31,7 @@
 #include "list.h"
 #include "hashmap.h"
 #include "cgroup-util.h"
+#include "event-loop.h"
 
 typedef struct Manager Manager;
 
@@ -42,6 +43,10 @@ typedef struct Manager Manager;
 #include "logind-button.h"
 #include "logind-action.h"
 
+/* How long the sampled TTY atime of a session, and the idle hint of
+ * the system derived from them, are used before they are refreshed */
+#define IDLE_HINT_SAMPLE_USEC (5*USEC_PER_SEC)
+
 struct Manager {
         DBusConnection *bus;
 
@@ -56,6 +61,10 @@ struct Manager {
         LIST_HEAD(Session, session_gc_queue);
         LIST_HEAD(User, user_gc_queue);
 
+        /* Users and seats whose state files are out of date */
+        LIST_HEAD(Seat, seat_save_queue);
+        LIST_HEAD(User, user_save_queue);
+
         struct udev *udev;
         struct udev_monitor *udev_seat_monitor, *udev_vcsa_monitor, *udev_button_monitor;
 
@@ -64,7 +73,7 @@ struct Manager {
         int udev_button_fd;
 
         int console_active_fd;
-        int bus_fd;
+        EventLoop *bus_event;
         int epoll_fd;
 
         unsigned n_autovts;
@@ -112,6 +121,13 @@ struct Manager {
         usec_t idle_action_not_before_usec;
         HandleAction idle_action;
 
+        /* The idle hint of the system, valid until
+         * idle_hint_until, or until a session or an inhibitor it
+         * is aggregated from changes */
+        bool idle_hint;
+        dual_timestamp idle_hint_timestamp;
+        usec_t idle_hint_until;
+
         HandleAction handle_power_key;
         HandleAction handle_suspend_key;
         HandleAction handle_hibernate_key;
@@ -168,8 +184,10 @@ int manager_spawn_autovt(Manager *m, int vtnr);
 void manager_cgroup_notify_empty(Manager *m, const char *cgroup);
 
 void manager_gc(Manager *m, bool drop_not_started);
+void manager_dispatch_save_queue(Manager *m);
 
 int manager_get_idle_hint(Manager *m, dual_timestamp *t);
+void manager_invalidate_idle_hint(Manager *m);
 
 int manager_get_user_by_cgroup(Manager *m, const char *cgroup, User **user);
 int manager_get_session_by_cgroup(Manager *m, const char *cgroup, Session **session);
@@ -22,6 +22,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <sys/inotify.h>
 #include <sys/poll.h>
 
@@ -31,6 +33,209 @@
 #include "sd-login.h"
 #include "strv.h"
 #include "fileio.h"
+#include "env-util.h"
+#include "hashmap.h"
+
+enum {
+        CATEGORY_SEAT,
+        CATEGORY_SESSION,
+        CATEGORY_UID,
+        _CATEGORY_MAX
+};
+
+static const char* const category_table[_CATEGORY_MAX] = {
+        [CATEGORY_SEAT] = "seat",
+        [CATEGORY_SESSION] = "session",
+        [CATEGORY_UID] = "uid"
+};
+
+static const char* const category_directory_table[_CATEGORY_MAX] = {
+        [CATEGORY_SEAT] = "/run/systemd/seats/",
+        [CATEGORY_SESSION] = "/run/systemd/sessions/",
+        [CATEGORY_UID] = "/run/systemd/users/"
+};
+
+struct sd_login_monitor {
+        int fd;
+        int wd[_CATEGORY_MAX];
+        bool cache;
+};
+
+/* Contents of state files, kept for the categories of all monitors
+ * that have caching turned on. Logind replaces the files by renaming
+ * new versions over them, so the IN_MOVED_TO and IN_DELETE events the
+ * monitors watch for tell exactly which entries to drop. */
+typedef struct CachedFile {
+        char *path;
+        char **env;
+        int error;
+} CachedFile;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Hashmap *cache = NULL;
+static unsigned cache_monitors[_CATEGORY_MAX] = {};
+
+static int category_from_path(const char *path) {
+        int i;
+
+        for (i = 0; i < _CATEGORY_MAX; i++)
+                if (startswith(path, category_directory_table[i]))
+                        return i;
+
+        return -1;
+}
+
+static void cached_file_free(CachedFile *f) {
+        if (!f)
+                return;
+
+        free(f->path);
+        strv_free(f->env);
+        free(f);
+}
+
+/* Drops the file name of the category, or all files of the category
+ * if name is NULL. Needs to be called with the cache locked. */
+static void cache_drop(int category, const char *name) {
+        CachedFile *f;
+        Iterator i;
+
+        if (!cache)
+                return;
+
+        if (name) {
+                char *p;
+
+                p = alloca(strlen(category_directory_table[category]) + strlen(name) + 1);
+                stpcpy(stpcpy(p, category_directory_table[category]), name);
+
+                cached_file_free(hashmap_remove(cache, p));
+                return;
+        }
+
+        HASHMAP_FOREACH(f, cache, i)
+                if (category_from_path(f->path) == category) {
+                        hashmap_remove(cache, f->path);
+                        cached_file_free(f);
+                }
+
+        if (hashmap_isempty(cache)) {
+                hashmap_free(cache);
+                cache = NULL;
+        }
+}
+
+static CachedFile *cache_get(const char *path) {
+        CachedFile *f;
+        int r;
+
+        f = hashmap_get(cache, path);
+        if (f)
+                return f;
+
+        if (!cache) {
+                cache = hashmap_new(string_hash_func, string_compare_func);
+                if (!cache)
+                        return NULL;
+        }
+
+        f = new0(CachedFile, 1);
+        if (!f)
+                return NULL;
+
+        f->path = strdup(path);
+        if (!f->path) {
+                free(f);
+                return NULL;
+        }
+
+        /* A file that does not exist is remembered just the same,
+         * its creation triggers an event too */
+        r = load_env_file(path, NEWLINE, &f->env);
+        if (r < 0 && r != -ENOENT) {
+                cached_file_free(f);
+                return NULL;
+        }
+
+        f->error = r;
+
+        if (hashmap_put(cache, f->path, f) < 0) {
+                cached_file_free(f);
+                return NULL;
+        }
+
+        return f;
+}
+
+static int env_lookup(char **l, va_list ap) {
+        const char *key;
+
+        while ((key = va_arg(ap, const char*))) {
+                char **value, *v, *t = NULL;
+
+                value = va_arg(ap, char**);
+
+                v = strv_env_get(l, key);
+                if (!v)
+                        continue;
+
+                /* Like parse_env_file(), which has no empty values */
+                if (*v) {
+                        t = strdup(v);
+                        if (!t)
+                                return -ENOMEM;
+                }
+
+                free(*value);
+                *value = t;
+        }
+
+        return 0;
+}
+
+/* Like parse_env_file(), but served from the cache if a monitor for
+ * the category has it turned on */
+static int login_parse_env_file(const char *path, ...) {
+        _cleanup_strv_free_ char **l = NULL;
+        va_list ap;
+        int category, r;
+
+        category = category_from_path(path);
+
+        if (category >= 0) {
+                CachedFile *f;
+
+                assert_se(pthread_mutex_lock(&cache_mutex) == 0);
+
+                if (cache_monitors[category] > 0) {
+                        f = cache_get(path);
+                        if (!f)
+                                r = -ENOMEM;
+                        else if (f->error < 0)
+                                r = f->error;
+                        else {
+                                va_start(ap, path);
+                                r = env_lookup(f->env, ap);
+                                va_end(ap);
+                        }
+
+                        assert_se(pthread_mutex_unlock(&cache_mutex) == 0);
+                        return r;
+                }
+
+                assert_se(pthread_mutex_unlock(&cache_mutex) == 0);
+        }
+
+        r = load_env_file(path, NEWLINE, &l);
+        if (r < 0)
+                return r;
+
+        va_start(ap, path);
+        r = env_lookup(l, ap);
+        va_end(ap);
+
+        return r;
+}
 
 _public_ int sd_pid_get_session(pid_t pid, char **session) {
         int r;
@@ -145,7 +350,7 @@ _public_ int sd_uid_get_state(uid_t uid, char**state) {
         if (asprintf(&p, "/run/systemd/users/%lu", (unsigned long) uid) < 0)
                 return -ENOMEM;
 
-        r = parse_env_file(p, NEWLINE, "STATE", &s, NULL);
+        r = login_parse_env_file(p, "STATE", &s, NULL);
         free(p);
 
         if (r == -ENOENT) {
@@ -181,7 +386,7 @@ _public_ int sd_uid_is_on_seat(uid_t uid, int require_active, const char *seat)
         if (!p)
                 return -ENOMEM;
 
-        r = parse_env_file(p, NEWLINE, variable, &s, NULL);
+        r = login_parse_env_file(p, variable, &s, NULL);
         free(p);
 
         if (r < 0) {
@@ -220,9 +425,9 @@ static int uid_get_array(uid_t uid, const char *variable, char ***array) {
         if (asprintf(&p, "/run/systemd/users/%lu", (unsigned long) uid) < 0)
                 return -ENOMEM;
 
-        r = parse_env_file(p, NEWLINE,
-                           variable, &s,
-                           NULL);
+        r = login_parse_env_file(p,
+                                 variable, &s,
+                                 NULL);
         free(p);
 
         if (r < 0) {
@@ -312,7 +517,7 @@ _public_ int sd_session_is_active(const char *session) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, "ACTIVE", &s, NULL);
+        r = login_parse_env_file(p, "ACTIVE", &s, NULL);
         free(p);
 
         if (r < 0) {
@@ -340,7 +545,7 @@ _public_ int sd_session_get_state(const char *session, char **state) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, "STATE", &s, NULL);
+        r = login_parse_env_file(p, "STATE", &s, NULL);
         free(p);
 
         if (r < 0) {
@@ -364,7 +569,7 @@ _public_ int sd_session_get_uid(const char *session, uid_t *uid) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, "UID", &s, NULL);
+        r = login_parse_env_file(p, "UID", &s, NULL);
         free(p);
 
         if (r < 0) {
@@ -392,7 +597,7 @@ static int session_get_string(const char *session, const char *field, char **val
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE, field, &s, NULL);
+        r = login_parse_env_file(p, field, &s, NULL);
         free(p);
 
         if (r < 0) {
@@ -468,10 +673,10 @@ _public_ int sd_seat_get_active(const char *seat, char **session, uid_t *uid) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE,
-                           "ACTIVE", &s,
-                           "ACTIVE_UID", &t,
-                           NULL);
+        r = login_parse_env_file(p,
+                                 "ACTIVE", &s,
+                                 "ACTIVE_UID", &t,
+                                 NULL);
         free(p);
 
         if (r < 0) {
@@ -519,10 +724,10 @@ _public_ int sd_seat_get_sessions(const char *seat, char ***sessions, uid_t **ui
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE,
-                           "SESSIONS", &s,
-                           "ACTIVE_SESSIONS", &t,
-                           NULL);
+        r = login_parse_env_file(p,
+                                 "SESSIONS", &s,
+                                 "ACTIVE_SESSIONS", &t,
+                                 NULL);
         free(p);
 
         if (r < 0) {
@@ -607,9 +812,9 @@ static int seat_get_can(const char *seat, const char *variable) {
         if (r < 0)
                 return r;
 
-        r = parse_env_file(p, NEWLINE,
-                           variable, &s,
-                           NULL);
+        r = login_parse_env_file(p,
+                                 variable, &s,
+                                 NULL);
         free(p);
 
         if (r < 0) {
@@ -713,49 +918,36 @@ finish:
         return r;
 }
 
-static inline int MONITOR_TO_FD(sd_login_monitor *m) {
-        return (int) (unsigned long) m - 1;
-}
-
-static inline sd_login_monitor* FD_TO_MONITOR(int fd) {
-        return (sd_login_monitor*) (unsigned long) (fd + 1);
-}
-
 _public_ int sd_login_monitor_new(const char *category, sd_login_monitor **m) {
-        int fd, k;
+        sd_login_monitor *n;
         bool good = false;
+        int i;
 
         if (!m)
                 return -EINVAL;
 
-        fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
-        if (fd < 0)
-                return errno;
+        n = new(sd_login_monitor, 1);
+        if (!n)
+                return -ENOMEM;
 
-        if (!category || streq(category, "seat")) {
-                k = inotify_add_watch(fd, "/run/systemd/seats/", IN_MOVED_TO|IN_DELETE);
-                if (k < 0) {
-                        close_nointr_nofail(fd);
-                        return -errno;
-                }
+        n->cache = false;
 
-                good = true;
+        n->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (n->fd < 0) {
+                free(n);
+                return -errno;
         }
 
-        if (!category || streq(category, "session")) {
-                k = inotify_add_watch(fd, "/run/systemd/sessions/", IN_MOVED_TO|IN_DELETE);
-                if (k < 0) {
-                        close_nointr_nofail(fd);
-                        return -errno;
-                }
+        for (i = 0; i < _CATEGORY_MAX; i++) {
+                n->wd[i] = -1;
 
-                good = true;
-        }
+                if (category && !streq(category, category_table[i]))
+                        continue;
 
-        if (!category || streq(category, "uid")) {
-                k = inotify_add_watch(fd, "/run/systemd/users/", IN_MOVED_TO|IN_DELETE);
-                if (k < 0) {
-                        close_nointr_nofail(fd);
+                n->wd[i] = inotify_add_watch(n->fd, category_directory_table[i], IN_MOVED_TO|IN_DELETE);
+                if (n->wd[i] < 0) {
+                        close_nointr_nofail(n->fd);
+                        free(n);
                         return -errno;
                 }
 
@@ -763,32 +955,114 @@ _public_ int sd_login_monitor_new(const char *category, sd_login_monitor **m) {
         }
 
         if (!good) {
-                close_nointr(fd);
+                close_nointr(n->fd);
+                free(n);
                 return -EINVAL;
         }
 
-        *m = FD_TO_MONITOR(fd);
+        *m = n;
+        return 0;
+}
+
+_public_ int sd_login_monitor_set_cache(sd_login_monitor *m, int b) {
+        int i;
+
+        if (!m)
+                return -EINVAL;
+
+        if (m->cache == !!b)
+                return 0;
+
+        assert_se(pthread_mutex_lock(&cache_mutex) == 0);
+
+        for (i = 0; i < _CATEGORY_MAX; i++) {
+                if (m->wd[i] < 0)
+                        continue;
+
+                if (b)
+                        cache_monitors[i]++;
+                else {
+                        assert(cache_monitors[i] > 0);
+                        cache_monitors[i]--;
+
+                        if (cache_monitors[i] <= 0)
+                                cache_drop(i, NULL);
+                }
+        }
+
+        assert_se(pthread_mutex_unlock(&cache_mutex) == 0);
+
+        m->cache = !!b;
         return 0;
 }
 
 _public_ sd_login_monitor* sd_login_monitor_unref(sd_login_monitor *m) {
-        int fd;
 
         if (!m)
                 return NULL;
 
-        fd = MONITOR_TO_FD(m);
-        close_nointr(fd);
+        sd_login_monitor_set_cache(m, false);
+
+        close_nointr(m->fd);
+        free(m);
 
         return NULL;
 }
 
 _public_ int sd_login_monitor_flush(sd_login_monitor *m) {
+        union inotify_event_buffer {
+                struct inotify_event ev;
+                uint8_t raw[4096];
+        } buffer;
+        int r = 0;
 
         if (!m)
                 return -EINVAL;
 
-        return flush_fd(MONITOR_TO_FD(m));
+        if (!m->cache)
+                return flush_fd(m->fd);
+
+        for (;;) {
+                struct inotify_event *e;
+                ssize_t l;
+
+                l = read(m->fd, &buffer, sizeof(buffer));
+                if (l < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        if (errno == EAGAIN)
+                                return r;
+
+                        return -errno;
+                }
+
+                if (l == 0)
+                        return r;
+
+                r = 1;
+
+                assert_se(pthread_mutex_lock(&cache_mutex) == 0);
+
+                for (e = &buffer.ev; (uint8_t*) e < buffer.raw + l;
+                     e = (struct inotify_event*) ((uint8_t*) e + sizeof(struct inotify_event) + e->len)) {
+                        int i;
+
+                        /* Events were lost, start over */
+                        if (e->mask & IN_Q_OVERFLOW) {
+                                for (i = 0; i < _CATEGORY_MAX; i++)
+                                        if (m->wd[i] >= 0)
+                                                cache_drop(i, NULL);
+                                continue;
+                        }
+
+                        for (i = 0; i < _CATEGORY_MAX; i++)
+                                if (m->wd[i] == e->wd)
+                                        cache_drop(i, e->len > 0 ? e->name : NULL);
+                }
+
+                assert_se(pthread_mutex_unlock(&cache_mutex) == 0);
+        }
 }
 
 _public_ int sd_login_monitor_get_fd(sd_login_monitor *m) {
@@ -796,7 +1070,7 @@ _public_ int sd_login_monitor_get_fd(sd_login_monitor *m) {
         if (!m)
                 return -EINVAL;
 
-        return MONITOR_TO_FD(m);
+        return m->fd;
 }
 
 _public_ int sd_login_monitor_get_events(sd_login_monitor *m) {
@@ -27,6 +27,7 @@
 #include <limits.h>
 #include <dirent.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <libkmod.h>
 
 #include "log.h"
@@ -35,8 +36,12 @@
 #include "conf-files.h"
 #include "virt.h"
 #include "fileio.h"
+#include "time-util.h"
+
+#define JOBS_MAX 16
 
 static char **arg_proc_cmdline_modules = NULL;
+static unsigned arg_jobs = 1;
 
 static const char conf_file_dirs[] =
         "/etc/modules-load.d\0"
@@ -117,8 +122,88 @@ static int parse_proc_cmdline(void) {
         return 0;
 }
 
-static int load_module(struct kmod_ctx *ctx, const char *m) {
-        const int probe_flags = KMOD_PROBE_APPLY_BLACKLIST;
+/* Modules are loaded in the order they are listed in, unless --jobs=
+ * asks for more than one at a time. Then each one waits only for those
+ * listed modules it depends on. */
+typedef struct Module {
+        char *name;
+        char **deps;
+        bool started, done;
+        int r;
+} Module;
+
+typedef struct ModuleQueue {
+        Module *modules;
+        unsigned n_modules, n_started;
+        size_t allocated;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+} ModuleQueue;
+
+static Module *queue_find(ModuleQueue *q, const char *name) {
+        unsigned i;
+
+        for (i = 0; i < q->n_modules; i++)
+                if (streq(q->modules[i].name, name))
+                        return q->modules + i;
+
+        return NULL;
+}
+
+static int queue_add(ModuleQueue *q, struct kmod_module *mod) {
+        const char *name;
+        Module *m;
+
+        name = kmod_module_get_name(mod);
+        if (queue_find(q, name))
+                return 0;
+
+        if (!GREEDY_REALLOC(q->modules, q->allocated, q->n_modules + 1))
+                return log_oom();
+
+        m = q->modules + q->n_modules;
+        zero(*m);
+
+        m->name = strdup(name);
+        if (!m->name)
+                return log_oom();
+
+        q->n_modules++;
+
+        if (arg_jobs > 1) {
+                struct kmod_list *itr, *deps;
+                int r = 0;
+
+                deps = kmod_module_get_dependencies(mod);
+                kmod_list_foreach(itr, deps) {
+                        struct kmod_module *d;
+
+                        d = kmod_module_get_module(itr);
+                        if (r >= 0)
+                                r = strv_extend(&m->deps, kmod_module_get_name(d));
+                        kmod_module_unref(d);
+                }
+                kmod_module_unref_list(deps);
+
+                if (r < 0)
+                        return log_oom();
+        }
+
+        return 0;
+}
+
+static void queue_done(ModuleQueue *q) {
+        unsigned i;
+
+        for (i = 0; i < q->n_modules; i++) {
+                free(q->modules[i].name);
+                strv_free(q->modules[i].deps);
+        }
+
+        free(q->modules);
+}
+
+static int lookup_module(struct kmod_ctx *ctx, ModuleQueue *q, const char *m) {
         struct kmod_list *itr, *modlist = NULL;
         int r = 0;
 
@@ -137,44 +222,173 @@ static int load_module(struct kmod_ctx *ctx, const char *m) {
 
         kmod_list_foreach(itr, modlist) {
                 struct kmod_module *mod;
-                int state, err;
 
                 mod = kmod_module_get_module(itr);
-                state = kmod_module_get_initstate(mod);
+                if (r >= 0)
+                        r = queue_add(q, mod);
+                kmod_module_unref(mod);
+        }
 
-                switch (state) {
-                case KMOD_MODULE_BUILTIN:
-                        log_info("Module '%s' is builtin", kmod_module_get_name(mod));
-                        break;
+        kmod_module_unref_list(modlist);
 
-                case KMOD_MODULE_LIVE:
-                        log_debug("Module '%s' is already loaded", kmod_module_get_name(mod));
-                        break;
+        return r;
+}
 
-                default:
-                        err = kmod_module_probe_insert_module(mod, probe_flags,
-                                                              NULL, NULL, NULL, NULL);
-
-                        if (err == 0)
-                                log_info("Inserted module '%s'", kmod_module_get_name(mod));
-                        else if (err == KMOD_PROBE_APPLY_BLACKLIST)
-                                log_info("Module '%s' is blacklisted", kmod_module_get_name(mod));
-                        else {
-                                log_error("Failed to insert '%s': %s", kmod_module_get_name(mod),
-                                          strerror(-err));
-                                r = err;
-                        }
-                }
+static int insert_module(struct kmod_ctx *ctx, const char *name) {
+        const int probe_flags = KMOD_PROBE_APPLY_BLACKLIST;
+        struct kmod_module *mod;
+        char ts[FORMAT_TIMESPAN_MAX];
+        usec_t t;
+        int r;
 
-                kmod_module_unref(mod);
+        r = kmod_module_new_from_name(ctx, name, &mod);
+        if (r < 0) {
+                log_error("Failed to find module '%s': %s", name, strerror(-r));
+                return r;
         }
 
-        kmod_module_unref_list(modlist);
+        switch (kmod_module_get_initstate(mod)) {
+        case KMOD_MODULE_BUILTIN:
+                log_info("Module '%s' is builtin", name);
+                r = 0;
+                break;
+
+        case KMOD_MODULE_LIVE:
+                log_debug("Module '%s' is already loaded", name);
+                r = 0;
+                break;
+
+        default:
+                t = now(CLOCK_MONOTONIC);
+                r = kmod_module_probe_insert_module(mod, probe_flags,
+                                                    NULL, NULL, NULL, NULL);
+                t = now(CLOCK_MONOTONIC) - t;
+
+                if (r == 0)
+                        log_info("Inserted module '%s' in %s", name,
+                                 format_timespan(ts, sizeof(ts), t, 0));
+                else if (r == KMOD_PROBE_APPLY_BLACKLIST) {
+                        log_info("Module '%s' is blacklisted", name);
+                        r = 0;
+                } else
+                        log_error("Failed to insert '%s': %s", name, strerror(-r));
+        }
+
+        kmod_module_unref(mod);
 
         return r;
 }
 
-static int apply_file(struct kmod_ctx *ctx, const char *path, bool ignore_enoent) {
+static Module *queue_next(ModuleQueue *q) {
+        unsigned i;
+
+        for (i = 0; i < q->n_modules; i++) {
+                Module *m = q->modules + i;
+                char **d;
+
+                if (m->started)
+                        continue;
+
+                STRV_FOREACH(d, m->deps) {
+                        Module *dep;
+
+                        dep = queue_find(q, *d);
+                        if (dep && !dep->done)
+                                break;
+                }
+
+                if (!d || !*d)
+                        return m;
+        }
+
+        return NULL;
+}
+
+static void queue_run_one(ModuleQueue *q, struct kmod_ctx *ctx) {
+
+        pthread_mutex_lock(&q->mutex);
+
+        while (q->n_started < q->n_modules) {
+                Module *m;
+                int r;
+
+                /* Nothing ready? Then wait for a dependency to
+                 * finish. */
+                m = queue_next(q);
+                if (!m) {
+                        pthread_cond_wait(&q->cond, &q->mutex);
+                        continue;
+                }
+
+                m->started = true;
+                q->n_started++;
+
+                pthread_mutex_unlock(&q->mutex);
+                r = insert_module(ctx, m->name);
+                pthread_mutex_lock(&q->mutex);
+
+                m->r = r;
+                m->done = true;
+                pthread_cond_broadcast(&q->cond);
+        }
+
+        pthread_mutex_unlock(&q->mutex);
+}
+
+static void *queue_thread(void *p) {
+        ModuleQueue *q = p;
+        struct kmod_ctx *ctx;
+
+        /* kmod contexts may not be shared between threads */
+        ctx = kmod_new(NULL, NULL);
+        if (!ctx)
+                return NULL;
+
+        kmod_load_resources(ctx);
+        kmod_set_log_fn(ctx, systemd_kmod_log, NULL);
+
+        queue_run_one(q, ctx);
+
+        kmod_unref(ctx);
+        return NULL;
+}
+
+static int queue_run(ModuleQueue *q, struct kmod_ctx *ctx) {
+        pthread_t threads[JOBS_MAX];
+        pthread_attr_t attr;
+        unsigned n_threads, k;
+
+        if (q->n_modules <= 0)
+                return 0;
+
+        n_threads = MIN(arg_jobs, q->n_modules);
+
+        assert_se(pthread_attr_init(&attr) == 0);
+        assert_se(pthread_attr_setstacksize(&attr, 256*1024) == 0);
+
+        /* We are one of the threads ourselves */
+        for (k = 0; k + 1 < n_threads; k++)
+                if (pthread_create(threads + k, &attr, queue_thread, q) != 0) {
+                        log_debug("Failed to start thread, continuing with %u.", k + 1);
+                        break;
+                }
+        n_threads = k;
+
+        pthread_attr_destroy(&attr);
+
+        queue_run_one(q, ctx);
+
+        for (k = 0; k < n_threads; k++)
+                pthread_join(threads[k], NULL);
+
+        for (k = 0; k < q->n_modules; k++)
+                if (q->modules[k].r < 0)
+                        return q->modules[k].r;
+
+        return 0;
+}
+
+static int apply_file(struct kmod_ctx *ctx, ModuleQueue *q, const char *path, bool ignore_enoent) {
         _cleanup_fclose_ FILE *f = NULL;
         int r;
 
@@ -209,7 +423,7 @@ static int apply_file(struct kmod_ctx *ctx, const char *path, bool ignore_enoent
                 if (strchr(COMMENTS "\n", *l))
                         continue;
 
-                k = load_module(ctx, l);
+                k = lookup_module(ctx, q, l);
                 if (k < 0 && r == 0)
                         r = k;
         }
@@ -221,7 +435,8 @@ static int help(void) {
 
         printf("%s [OPTIONS...] [CONFIGURATION FILE...]\n\n"
                "Loads statically configured kernel modules.\n\n"
-               "  -h --help             Show this help\n",
+               "  -h --help             Show this help\n"
+               "  -j --jobs=N           Load up to N modules at a time (default: 1)\n",
                program_invocation_short_name);
 
         return 0;
@@ -231,6 +446,7 @@ static int parse_argv(int argc, char *argv[]) {
 
         static const struct option options[] = {
                 { "help",      no_argument,       NULL, 'h'           },
+                { "jobs",      required_argument, NULL, 'j'           },
                 { NULL,        0,                 NULL, 0             }
         };
 
@@ -239,7 +455,7 @@ static int parse_argv(int argc, char *argv[]) {
         assert(argc >= 0);
         assert(argv);
 
-        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+        while ((c = getopt_long(argc, argv, "hj:", options, NULL)) >= 0) {
 
                 switch (c) {
 
@@ -247,6 +463,13 @@ static int parse_argv(int argc, char *argv[]) {
                         help();
                         return 0;
 
+                case 'j':
+                        if (safe_atou(optarg, &arg_jobs) < 0 || arg_jobs < 1 || arg_jobs > JOBS_MAX) {
+                                log_error("Failed to parse number of jobs: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -262,6 +485,10 @@ static int parse_argv(int argc, char *argv[]) {
 int main(int argc, char *argv[]) {
         int r, k;
         struct kmod_ctx *ctx;
+        ModuleQueue q = {
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+                .cond = PTHREAD_COND_INITIALIZER,
+        };
 
         r = parse_argv(argc, argv);
         if (r <= 0)
@@ -291,7 +518,7 @@ int main(int argc, char *argv[]) {
                 int i;
 
                 for (i = optind; i < argc; i++) {
-                        k = apply_file(ctx, argv[i], false);
+                        k = apply_file(ctx, &q, argv[i], false);
                         if (k < 0 && r == 0)
                                 r = k;
                 }
@@ -301,7 +528,7 @@ int main(int argc, char *argv[]) {
                 char **fn, **i;
 
                 STRV_FOREACH(i, arg_proc_cmdline_modules) {
-                        k = load_module(ctx, *i);
+                        k = lookup_module(ctx, &q, *i);
                         if (k < 0 && r == 0)
                                 r = k;
                 }
@@ -313,13 +540,18 @@ int main(int argc, char *argv[]) {
                 }
 
                 STRV_FOREACH(fn, files) {
-                        k = apply_file(ctx, *fn, true);
+                        k = apply_file(ctx, &q, *fn, true);
                         if (k < 0 && r == 0)
                                 r = k;
                 }
         }
 
+        k = queue_run(&q, ctx);
+        if (k < 0 && r == 0)
+                r = k;
+
 finish:
+        queue_done(&q);
         kmod_unref(ctx);
         strv_free(arg_proc_cmdline_modules);
 
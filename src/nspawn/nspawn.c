@@ -71,6 +71,11 @@ typedef enum LinkJournal {
         LINK_GUEST
 } LinkJournal;
 
+typedef enum ConsoleMode {
+        CONSOLE_INTERACTIVE,
+        CONSOLE_PIPE
+} ConsoleMode;
+
 static char *arg_directory = NULL;
 static char *arg_user = NULL;
 static char **arg_controllers = NULL;
@@ -79,6 +84,7 @@ static bool arg_private_network = false;
 static bool arg_read_only = false;
 static bool arg_boot = false;
 static LinkJournal arg_link_journal = LINK_AUTO;
+static ConsoleMode arg_console_mode = CONSOLE_INTERACTIVE;
 static uint64_t arg_retain =
         (1ULL << CAP_CHOWN) |
         (1ULL << CAP_DAC_OVERRIDE) |
@@ -107,6 +113,8 @@ static uint64_t arg_retain =
         (1ULL << CAP_AUDIT_CONTROL);
 static char **arg_bind = NULL;
 static char **arg_bind_ro = NULL;
+static char *arg_template = NULL;
+static bool arg_prepare_template = false;
 
 static int help(void) {
 
@@ -128,7 +136,13 @@ static int help(void) {
                "  -j                       Equivalent to --link-journal=host\n"
                "     --bind=PATH[:PATH]    Bind mount a file or directory from the host into\n"
                "                           the container\n"
-               "     --bind-ro=PATH[:PATH] Similar, but creates a read-only bind mount\n",
+               "     --bind-ro=PATH[:PATH] Similar, but creates a read-only bind mount\n"
+               "     --console=MODE        Run the container on a pty (interactive), or hand\n"
+               "                           it our stdin, stdout and stderr directly (pipe)\n"
+               "     --template=PATH       Start the container from a mount namespace\n"
+               "                           prepared with --prepare-template\n"
+               "     --prepare-template    Prepare the shared part of the container setup\n"
+               "                           once and pin it as --template=, then exit\n",
                program_invocation_short_name);
 
         return 0;
@@ -144,7 +158,10 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_CAPABILITY,
                 ARG_LINK_JOURNAL,
                 ARG_BIND,
-                ARG_BIND_RO
+                ARG_BIND_RO,
+                ARG_TEMPLATE,
+                ARG_PREPARE_TEMPLATE,
+                ARG_CONSOLE
         };
 
         static const struct option options[] = {
@@ -161,6 +178,9 @@ static int parse_argv(int argc, char *argv[]) {
                 { "link-journal",    required_argument, NULL, ARG_LINK_JOURNAL    },
                 { "bind",            required_argument, NULL, ARG_BIND            },
                 { "bind-ro",         required_argument, NULL, ARG_BIND_RO         },
+                { "template",        required_argument, NULL, ARG_TEMPLATE        },
+                { "prepare-template", no_argument,      NULL, ARG_PREPARE_TEMPLATE },
+                { "console",         required_argument, NULL, ARG_CONSOLE         },
                 { NULL,              0,                 NULL, 0                   }
         };
 
@@ -310,6 +330,31 @@ static int parse_argv(int argc, char *argv[]) {
                         break;
                 }
 
+                case ARG_TEMPLATE:
+                        free(arg_template);
+                        arg_template = path_make_absolute_cwd(optarg);
+                        if (!arg_template)
+                                return log_oom();
+
+                        path_kill_slashes(arg_template);
+                        break;
+
+                case ARG_PREPARE_TEMPLATE:
+                        arg_prepare_template = true;
+                        break;
+
+                case ARG_CONSOLE:
+                        if (streq(optarg, "interactive"))
+                                arg_console_mode = CONSOLE_INTERACTIVE;
+                        else if (streq(optarg, "pipe"))
+                                arg_console_mode = CONSOLE_PIPE;
+                        else {
+                                log_error("Failed to parse console mode %s", optarg);
+                                return -EINVAL;
+                        }
+
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -923,6 +968,235 @@ static int setup_journal(const char *directory) {
         return 0;
 }
 
+static void log_phase(const char *phase, usec_t *t) {
+        char buf[FORMAT_TIMESPAN_MAX];
+        usec_t n;
+
+        n = now(CLOCK_MONOTONIC);
+        log_debug("%s took %s.", phase, format_timespan(buf, sizeof(buf), n - *t, 0));
+        *t = n;
+}
+
+static int setup_root(const char *dest) {
+
+        /* Mark everything as slave, so that we still receive mounts
+         * from the real root, but don't propagate mounts to the real
+         * root. */
+        if (mount(NULL, "/", NULL, MS_SLAVE|MS_REC, NULL) < 0) {
+                log_error("MS_SLAVE|MS_REC failed: %m");
+                return -errno;
+        }
+
+        /* Turn directory into bind mount */
+        if (mount(dest, dest, "bind", MS_BIND|MS_REC, NULL) < 0) {
+                log_error("Failed to make bind mount.");
+                return -errno;
+        }
+
+        if (arg_read_only)
+                if (mount(dest, dest, "bind", MS_BIND|MS_REMOUNT|MS_RDONLY|MS_REC, NULL) < 0) {
+                        log_error("Failed to make read-only.");
+                        return -errno;
+                }
+
+        return 0;
+}
+
+/* Everything that does not depend on the namespaces of a specific
+ * container, and hence may be done once for all of them by
+ * --prepare-template */
+static int setup_shared(const char *dest) {
+        int r;
+
+        r = setup_timezone(dest);
+        if (r < 0)
+                return r;
+
+        r = setup_resolv_conf(dest);
+        if (r < 0)
+                return r;
+
+        r = setup_journal(dest);
+        if (r < 0)
+                return r;
+
+        r = mount_binds(dest, arg_bind, 0);
+        if (r < 0)
+                return r;
+
+        return mount_binds(dest, arg_bind_ro, MS_RDONLY);
+}
+
+static bool binds_below_api_mounts(char **l) {
+        char **x, **y;
+
+        /* These are mounted for each container anew, on top of
+         * whatever the template has there */
+        STRV_FOREACH_PAIR(x, y, l)
+                if (path_startswith(*y, "/proc") ||
+                    path_startswith(*y, "/sys") ||
+                    path_startswith(*y, "/dev") ||
+                    path_startswith(*y, "/run"))
+                        return true;
+
+        return false;
+}
+
+static int prepare_template(const char *dest) {
+        _cleanup_free_ char *dir = NULL, *ns = NULL;
+        siginfo_t status;
+        pid_t pid;
+        int r;
+
+        assert(dest);
+        assert(arg_template);
+
+        if (binds_below_api_mounts(arg_bind) || binds_below_api_mounts(arg_bind_ro)) {
+                log_error("Bind mounts below /proc, /sys, /dev or /run cannot be part of a template.");
+                return -EINVAL;
+        }
+
+        /* The namespace is kept alive by bind mounting it onto a
+         * file. Do that below a private mount, so that the bind mount
+         * does not propagate into the very namespace it pins. */
+        dir = dirname_malloc(arg_template);
+        if (!dir)
+                return log_oom();
+
+        r = mkdir_p(dir, 0755);
+        if (r < 0) {
+                log_error("Failed to create %s: %s", dir, strerror(-r));
+                return r;
+        }
+
+        r = path_is_mount_point(dir, true);
+        if (r < 0) {
+                log_error("Failed to detect whether %s is a mount point: %s", dir, strerror(-r));
+                return r;
+        }
+
+        if (r == 0 && mount(dir, dir, "bind", MS_BIND, NULL) < 0) {
+                log_error("Failed to make bind mount of %s: %m", dir);
+                return -errno;
+        }
+
+        if (mount(NULL, dir, NULL, MS_PRIVATE, NULL) < 0) {
+                log_error("Failed to make %s private: %m", dir);
+                return -errno;
+        }
+
+        /* Replace an earlier template, containers started from it
+         * keep their copy */
+        if (umount2(arg_template, MNT_DETACH) < 0 && errno != EINVAL && errno != ENOENT) {
+                log_error("Failed to unmount old template %s: %m", arg_template);
+                return -errno;
+        }
+
+        r = touch(arg_template);
+        if (r < 0) {
+                log_error("Failed to create %s: %s", arg_template, strerror(-r));
+                return r;
+        }
+
+        pid = syscall(__NR_clone, SIGCHLD|CLONE_NEWNS, NULL);
+        if (pid < 0) {
+                log_error("clone() failed: %m");
+                return -errno;
+        }
+
+        if (pid == 0) {
+                /* child */
+
+                if (prctl(PR_SET_PDEATHSIG, SIGKILL) < 0) {
+                        log_error("PR_SET_PDEATHSIG failed: %m");
+                        _exit(EXIT_FAILURE);
+                }
+
+                if (setup_root(dest) < 0 ||
+                    setup_shared(dest) < 0)
+                        _exit(EXIT_FAILURE);
+
+                /* Wait until the parent pinned the namespace */
+                raise(SIGSTOP);
+                _exit(EXIT_SUCCESS);
+        }
+
+        zero(status);
+        if (waitid(P_PID, pid, &status, WEXITED|WSTOPPED) < 0) {
+                log_error("waitid() failed: %m");
+                r = -errno;
+                goto finish;
+        }
+
+        if (status.si_code != CLD_STOPPED) {
+                log_error("Failed to prepare template for %s.", dest);
+                r = -EIO;
+                goto finish;
+        }
+
+        if (asprintf(&ns, "/proc/%lu/ns/mnt", (unsigned long) pid) < 0) {
+                r = log_oom();
+                goto finish;
+        }
+
+        if (mount(ns, arg_template, NULL, MS_BIND, NULL) < 0) {
+                log_error("Failed to pin template at %s: %m", arg_template);
+                r = -errno;
+                goto finish;
+        }
+
+        log_info("Prepared template for %s at %s.", dest, arg_template);
+        r = 0;
+
+finish:
+        kill(pid, SIGKILL);
+        wait_for_terminate(pid, NULL);
+
+        if (r < 0)
+                unlink(arg_template);
+
+        return r;
+}
+
+static int join_template(const char *dest) {
+        _cleanup_close_ int fd = -1;
+        int r;
+
+        assert(dest);
+        assert(arg_template);
+
+        fd = open(arg_template, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0) {
+                log_error("Failed to open template %s: %m", arg_template);
+                return -errno;
+        }
+
+        if (setns(fd, CLONE_NEWNS) < 0) {
+                log_error("Failed to join template %s: %m", arg_template);
+                return -errno;
+        }
+
+        /* Continue on a copy, so that the template stays untouched
+         * for further containers. The mounts in there are already
+         * slaves, and copies stay that way. */
+        if (unshare(CLONE_NEWNS) < 0) {
+                log_error("Failed to copy template %s: %m", arg_template);
+                return -errno;
+        }
+
+        r = path_is_mount_point(dest, false);
+        if (r < 0) {
+                log_error("Failed to detect whether %s is a mount point: %s", dest, strerror(-r));
+                return r;
+        }
+        if (r == 0) {
+                log_error("Template %s was not prepared for %s.", arg_template, dest);
+                return -EINVAL;
+        }
+
+        return 0;
+}
+
 static int drop_capabilities(void) {
         return capability_bounding_set_drop(~arg_retain, false);
 }
@@ -941,23 +1215,134 @@ static int is_os_tree(const char *path) {
         return r < 0 ? 0 : 1;
 }
 
+/* Data is queued in buffers that start small and grow while the other
+ * side writes faster than we can pass it on */
+#define PTY_BUFFER_MIN (4U*1024U)
+#define PTY_BUFFER_MAX (256U*1024U)
+
+typedef struct PtyBuffer {
+        char *data;
+        size_t allocated;
+        size_t start;
+        size_t full;
+} PtyBuffer;
+
+static ssize_t pty_buffer_fill(PtyBuffer *b, int fd) {
+        size_t end;
+        ssize_t k;
+
+        assert(b);
+        assert(b->full < b->allocated);
+
+        /* Move what is left to the front once the end is reached */
+        if (b->start + b->full >= b->allocated) {
+                memmove(b->data, b->data + b->start, b->full);
+                b->start = 0;
+        }
+
+        end = b->start + b->full;
+        k = read(fd, b->data + end, b->allocated - end);
+        if (k < 0)
+                return -errno;
+
+        b->full += k;
+
+        /* Filled up in one go? Then try with more next time. */
+        if ((size_t) k == b->allocated - end && b->allocated < PTY_BUFFER_MAX) {
+                char *p;
+
+                p = realloc(b->data, b->allocated * 2);
+                if (p) {
+                        b->data = p;
+                        b->allocated *= 2;
+                }
+        }
+
+        return k;
+}
+
+static ssize_t pty_buffer_drain(PtyBuffer *b, int fd) {
+        ssize_t k;
+
+        assert(b);
+        assert(b->full > 0);
+
+        k = write(fd, b->data + b->start, b->full);
+        if (k < 0)
+                return -errno;
+
+        b->start += k;
+        b->full -= k;
+        if (b->full == 0)
+                b->start = 0;
+
+        return k;
+}
+
+static int pty_buffer_take_pipe(PtyBuffer *b, int pipefd[2], size_t full) {
+
+        assert(b);
+        assert(b->full == 0);
+
+        /* Falls back from splicing, by moving what is still queued
+         * in the pipe to the buffer */
+
+        if (full > b->allocated) {
+                char *p;
+
+                p = realloc(b->data, full);
+                if (!p)
+                        return -ENOMEM;
+
+                b->data = p;
+                b->allocated = full;
+        }
+
+        if (full > 0 && loop_read(pipefd[0], b->data, full, false) != (ssize_t) full)
+                return -EIO;
+
+        b->start = 0;
+        b->full = full;
+
+        close_pipe(pipefd);
+        return 0;
+}
+
+static bool pty_can_splice(int fd) {
+        struct stat st;
+        int flags;
+
+        /* splice() refuses files opened for appending. Terminals are
+         * left to read() and write(), they are slow anyway. */
+
+        if (fstat(fd, &st) < 0)
+                return false;
+
+        if (!S_ISFIFO(st.st_mode) && !S_ISREG(st.st_mode) && !S_ISSOCK(st.st_mode))
+                return false;
+
+        flags = fcntl(fd, F_GETFL);
+        return flags >= 0 && !(flags & O_APPEND);
+}
+
+static bool pty_io_again(int r) {
+        return r == -EAGAIN || r == -EPIPE || r == -ECONNRESET || r == -EIO;
+}
+
 static int process_pty(int master, pid_t pid, sigset_t *mask) {
 
-        char in_buffer[LINE_MAX], out_buffer[LINE_MAX];
-        size_t in_buffer_full = 0, out_buffer_full = 0;
+        PtyBuffer in = {}, out = {};
+        int out_pipe[2] = { -1, -1 };
+        size_t out_pipe_size = 0, out_pipe_full = 0;
+        bool out_splice = false;
         struct epoll_event stdin_ev, stdout_ev, master_ev, signal_ev;
         bool stdin_readable = false, stdout_writable = false, master_readable = false, master_writable = false;
         int ep = -1, signal_fd = -1, r;
         bool tried_orderly_shutdown = false;
 
-        assert(master >= 0);
         assert(pid > 0);
         assert(mask);
 
-        fd_nonblock(STDIN_FILENO, 1);
-        fd_nonblock(STDOUT_FILENO, 1);
-        fd_nonblock(master, 1);
-
         signal_fd = signalfd(-1, mask, SFD_NONBLOCK|SFD_CLOEXEC);
         if (signal_fd < 0) {
                 log_error("signalfd(): %m");
@@ -972,47 +1357,80 @@ static int process_pty(int master, pid_t pid, sigset_t *mask) {
                 goto finish;
         }
 
-        /* We read from STDIN only if this is actually a TTY,
-         * otherwise we assume non-interactivity. */
-        if (isatty(STDIN_FILENO)) {
-                zero(stdin_ev);
-                stdin_ev.events = EPOLLIN|EPOLLET;
-                stdin_ev.data.fd = STDIN_FILENO;
+        zero(signal_ev);
+        signal_ev.events = EPOLLIN;
+        signal_ev.data.fd = signal_fd;
 
-                if (epoll_ctl(ep, EPOLL_CTL_ADD, STDIN_FILENO, &stdin_ev) < 0) {
-                        log_error("Failed to register STDIN in epoll: %m");
-                        r = -errno;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, signal_fd, &signal_ev) < 0) {
+                log_error("Failed to register signalfd in epoll: %m");
+                r = -errno;
+                goto finish;
+        }
+
+        /* Without a pty the container uses our stdin, stdout and
+         * stderr directly, and there is nothing to forward */
+        if (master >= 0) {
+                in.data = malloc(PTY_BUFFER_MIN);
+                out.data = malloc(PTY_BUFFER_MIN);
+                if (!in.data || !out.data) {
+                        r = log_oom();
                         goto finish;
                 }
-        }
+                in.allocated = out.allocated = PTY_BUFFER_MIN;
+
+                fd_nonblock(STDIN_FILENO, 1);
+                fd_nonblock(STDOUT_FILENO, 1);
+                fd_nonblock(master, 1);
+
+                /* Pass the output of the container on through a pipe
+                 * with splice(), without copying it to us, if stdout
+                 * allows that */
+                if (pty_can_splice(STDOUT_FILENO) &&
+                    pipe2(out_pipe, O_NONBLOCK|O_CLOEXEC) >= 0) {
+                        int sz;
+
+                        sz = fcntl(out_pipe[0], F_GETPIPE_SZ);
+                        out_pipe_size = sz > 0 ? (size_t) sz : PIPE_BUF;
+                        out_splice = true;
+                }
 
-        zero(stdout_ev);
-        stdout_ev.events = EPOLLOUT|EPOLLET;
-        stdout_ev.data.fd = STDOUT_FILENO;
+                /* We read from STDIN only if this is actually a TTY,
+                 * otherwise we assume non-interactivity. */
+                if (isatty(STDIN_FILENO)) {
+                        zero(stdin_ev);
+                        stdin_ev.events = EPOLLIN|EPOLLET;
+                        stdin_ev.data.fd = STDIN_FILENO;
 
-        zero(master_ev);
-        master_ev.events = EPOLLIN|EPOLLOUT|EPOLLET;
-        master_ev.data.fd = master;
+                        if (epoll_ctl(ep, EPOLL_CTL_ADD, STDIN_FILENO, &stdin_ev) < 0) {
+                                log_error("Failed to register STDIN in epoll: %m");
+                                r = -errno;
+                                goto finish;
+                        }
+                }
 
-        zero(signal_ev);
-        signal_ev.events = EPOLLIN;
-        signal_ev.data.fd = signal_fd;
+                zero(stdout_ev);
+                stdout_ev.events = EPOLLOUT|EPOLLET;
+                stdout_ev.data.fd = STDOUT_FILENO;
+
+                zero(master_ev);
+                master_ev.events = EPOLLIN|EPOLLOUT|EPOLLET;
+                master_ev.data.fd = master;
 
-        if (epoll_ctl(ep, EPOLL_CTL_ADD, STDOUT_FILENO, &stdout_ev) < 0) {
-                if (errno != EPERM) {
-                        log_error("Failed to register stdout in epoll: %m");
+                if (epoll_ctl(ep, EPOLL_CTL_ADD, STDOUT_FILENO, &stdout_ev) < 0) {
+                        if (errno != EPERM) {
+                                log_error("Failed to register stdout in epoll: %m");
+                                r = -errno;
+                                goto finish;
+                        }
+                        /* stdout without epoll support. Likely redirected to regular file. */
+                        stdout_writable = true;
+                }
+
+                if (epoll_ctl(ep, EPOLL_CTL_ADD, master, &master_ev) < 0) {
+                        log_error("Failed to register fds in epoll: %m");
                         r = -errno;
                         goto finish;
                 }
-                /* stdout without epoll support. Likely redirected to regular file. */
-                stdout_writable = true;
-        }
-
-        if (epoll_ctl(ep, EPOLL_CTL_ADD, master, &master_ev) < 0 ||
-            epoll_ctl(ep, EPOLL_CTL_ADD, signal_fd, &signal_ev) < 0) {
-                log_error("Failed to register fds in epoll: %m");
-                r = -errno;
-                goto finish;
         }
 
         for (;;) {
@@ -1076,7 +1494,7 @@ static int process_pty(int master, pid_t pid, sigset_t *mask) {
                                                 struct winsize ws;
 
                                                 /* The window size changed, let's forward that. */
-                                                if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) >= 0)
+                                                if (master >= 0 && ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) >= 0)
                                                         ioctl(master, TIOCSWINSZ, &ws);
                                         } else if (sfsi.ssi_signo == SIGTERM && arg_boot && !tried_orderly_shutdown) {
 
@@ -1094,80 +1512,123 @@ static int process_pty(int master, pid_t pid, sigset_t *mask) {
                         }
                 }
 
-                while ((stdin_readable && in_buffer_full <= 0) ||
-                       (master_writable && in_buffer_full > 0) ||
-                       (master_readable && out_buffer_full <= 0) ||
-                       (stdout_writable && out_buffer_full > 0)) {
+                for (;;) {
+                        size_t out_full;
+                        bool out_space;
 
-                        if (stdin_readable && in_buffer_full < LINE_MAX) {
+                        if (out_splice) {
+                                out_full = out_pipe_full;
+                                out_space = out_pipe_full < out_pipe_size;
+                        } else {
+                                out_full = out.full;
+                                out_space = out.full < out.allocated;
+                        }
+
+                        if (!(stdin_readable && in.full <= 0) &&
+                            !(master_writable && in.full > 0) &&
+                            !(master_readable && out_full <= 0) &&
+                            !(stdout_writable && out_full > 0))
+                                break;
 
-                                k = read(STDIN_FILENO, in_buffer + in_buffer_full, LINE_MAX - in_buffer_full);
+                        if (stdin_readable && in.full < in.allocated) {
+
+                                k = pty_buffer_fill(&in, STDIN_FILENO);
                                 if (k < 0) {
 
-                                        if (errno == EAGAIN || errno == EPIPE || errno == ECONNRESET || errno == EIO)
+                                        if (pty_io_again(k))
                                                 stdin_readable = false;
                                         else {
-                                                log_error("read(): %m");
-                                                r = -errno;
+                                                log_error("read(): %s", strerror(-k));
+                                                r = k;
                                                 goto finish;
                                         }
-                                } else
-                                        in_buffer_full += (size_t) k;
+                                }
                         }
 
-                        if (master_writable && in_buffer_full > 0) {
+                        if (master_writable && in.full > 0) {
 
-                                k = write(master, in_buffer, in_buffer_full);
+                                k = pty_buffer_drain(&in, master);
                                 if (k < 0) {
 
-                                        if (errno == EAGAIN || errno == EPIPE || errno == ECONNRESET || errno == EIO)
+                                        if (pty_io_again(k))
                                                 master_writable = false;
                                         else {
-                                                log_error("write(): %m");
-                                                r = -errno;
+                                                log_error("write(): %s", strerror(-k));
+                                                r = k;
                                                 goto finish;
                                         }
-
-                                } else {
-                                        assert(in_buffer_full >= (size_t) k);
-                                        memmove(in_buffer, in_buffer + k, in_buffer_full - k);
-                                        in_buffer_full -= k;
                                 }
                         }
 
-                        if (master_readable && out_buffer_full < LINE_MAX) {
+                        if (master_readable && out_space) {
 
-                                k = read(master, out_buffer + out_buffer_full, LINE_MAX - out_buffer_full);
-                                if (k < 0) {
+                                if (out_splice) {
+                                        k = splice(master, NULL, out_pipe[1], NULL, out_pipe_size - out_pipe_full, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+                                        if (k < 0)
+                                                k = -errno;
+                                        else {
+                                                out_pipe_full += k;
+
+                                                /* Filled up in one go? Then try with more next time. */
+                                                if (out_pipe_full >= out_pipe_size && out_pipe_size < PTY_BUFFER_MAX) {
+                                                        int sz;
+
+                                                        sz = fcntl(out_pipe[1], F_SETPIPE_SZ, out_pipe_size * 2);
+                                                        if (sz > 0)
+                                                                out_pipe_size = sz;
+                                                }
+                                        }
+                                } else
+                                        k = pty_buffer_fill(&out, master);
 
-                                        if (errno == EAGAIN || errno == EPIPE || errno == ECONNRESET || errno == EIO)
+                                if (k == -EINVAL && out_splice) {
+                                        /* The pty does not support splice() on this kernel */
+                                        r = pty_buffer_take_pipe(&out, out_pipe, out_pipe_full);
+                                        if (r < 0) {
+                                                log_error("Failed to stop splicing: %s", strerror(-r));
+                                                goto finish;
+                                        }
+                                        out_splice = false;
+                                } else if (k < 0) {
+
+                                        if (pty_io_again(k))
                                                 master_readable = false;
                                         else {
-                                                log_error("read(): %m");
-                                                r = -errno;
+                                                log_error("read(): %s", strerror(-k));
+                                                r = k;
                                                 goto finish;
                                         }
-                                }  else
-                                        out_buffer_full += (size_t) k;
+                                }
                         }
 
-                        if (stdout_writable && out_buffer_full > 0) {
+                        if (stdout_writable && (out_splice ? out_pipe_full : out.full) > 0) {
 
-                                k = write(STDOUT_FILENO, out_buffer, out_buffer_full);
-                                if (k < 0) {
+                                if (out_splice) {
+                                        k = splice(out_pipe[0], NULL, STDOUT_FILENO, NULL, out_pipe_full, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+                                        if (k < 0)
+                                                k = -errno;
+                                        else
+                                                out_pipe_full -= k;
+                                } else
+                                        k = pty_buffer_drain(&out, STDOUT_FILENO);
+
+                                if (k == -EINVAL && out_splice) {
+                                        /* stdout does not support splice() after all */
+                                        r = pty_buffer_take_pipe(&out, out_pipe, out_pipe_full);
+                                        if (r < 0) {
+                                                log_error("Failed to stop splicing: %s", strerror(-r));
+                                                goto finish;
+                                        }
+                                        out_splice = false;
+                                } else if (k < 0) {
 
-                                        if (errno == EAGAIN || errno == EPIPE || errno == ECONNRESET || errno == EIO)
+                                        if (pty_io_again(k))
                                                 stdout_writable = false;
                                         else {
-                                                log_error("write(): %m");
-                                                r = -errno;
+                                                log_error("write(): %s", strerror(-k));
+                                                r = k;
                                                 goto finish;
                                         }
-
-                                } else {
-                                        assert(out_buffer_full >= (size_t) k);
-                                        memmove(out_buffer, out_buffer + k, out_buffer_full - k);
-                                        out_buffer_full -= k;
                                 }
                         }
                 }
@@ -1180,6 +1641,10 @@ finish:
         if (signal_fd >= 0)
                 close_nointr_nofail(signal_fd);
 
+        close_pipe(out_pipe);
+        free(in.data);
+        free(out.data);
+
         return r;
 }
 
@@ -1196,6 +1661,9 @@ int main(int argc, char *argv[]) {
         struct winsize ws;
         int kmsg_socket_pair[2] = { -1, -1 };
         FDSet *fds = NULL;
+        usec_t t;
+
+        t = now(CLOCK_MONOTONIC);
 
         log_parse_environment();
         log_open();
@@ -1204,6 +1672,11 @@ int main(int argc, char *argv[]) {
         if (r <= 0)
                 goto finish;
 
+        if (arg_prepare_template && !arg_template) {
+                log_error("--prepare-template requires --template=.");
+                goto finish;
+        }
+
         if (arg_directory) {
                 char *p;
 
@@ -1240,6 +1713,12 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
+        if (arg_prepare_template) {
+                if (prepare_template(arg_directory) >= 0)
+                        r = EXIT_SUCCESS;
+                goto finish;
+        }
+
         log_close();
         n_fd_passed = sd_listen_fds(false);
         if (n_fd_passed > 0) {
@@ -1275,35 +1754,38 @@ int main(int argc, char *argv[]) {
                         log_warning("Failed to create cgroup in controller %s: %s", *controller, strerror(-k));
         }
 
-        master = posix_openpt(O_RDWR|O_NOCTTY|O_CLOEXEC|O_NDELAY);
-        if (master < 0) {
-                log_error("Failed to acquire pseudo tty: %m");
-                goto finish;
-        }
+        if (arg_console_mode == CONSOLE_INTERACTIVE) {
+                master = posix_openpt(O_RDWR|O_NOCTTY|O_CLOEXEC|O_NDELAY);
+                if (master < 0) {
+                        log_error("Failed to acquire pseudo tty: %m");
+                        goto finish;
+                }
 
-        console = ptsname(master);
-        if (!console) {
-                log_error("Failed to determine tty name: %m");
-                goto finish;
-        }
+                console = ptsname(master);
+                if (!console) {
+                        log_error("Failed to determine tty name: %m");
+                        goto finish;
+                }
 
-        log_info("Spawning namespace container on %s (console is %s).", arg_directory, console);
+                log_info("Spawning namespace container on %s (console is %s).", arg_directory, console);
 
-        if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) >= 0)
-                ioctl(master, TIOCSWINSZ, &ws);
+                if (ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) >= 0)
+                        ioctl(master, TIOCSWINSZ, &ws);
 
-        if (unlockpt(master) < 0) {
-                log_error("Failed to unlock tty: %m");
-                goto finish;
-        }
+                if (unlockpt(master) < 0) {
+                        log_error("Failed to unlock tty: %m");
+                        goto finish;
+                }
 
-        if (tcgetattr(STDIN_FILENO, &saved_attr) >= 0) {
-                saved_attr_valid = true;
+                if (tcgetattr(STDIN_FILENO, &saved_attr) >= 0) {
+                        saved_attr_valid = true;
 
-                raw_attr = saved_attr;
-                cfmakeraw(&raw_attr);
-                raw_attr.c_lflag &= ~ECHO;
-        }
+                        raw_attr = saved_attr;
+                        cfmakeraw(&raw_attr);
+                        raw_attr.c_lflag &= ~ECHO;
+                }
+        } else
+                log_info("Spawning namespace container on %s (passing stdin, stdout and stderr through).", arg_directory);
 
         if (socketpair(AF_UNIX, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0, kmsg_socket_pair) < 0) {
                 log_error("Failed to create kmsg socket pair");
@@ -1314,6 +1796,8 @@ int main(int argc, char *argv[]) {
         sigset_add_many(&mask, SIGCHLD, SIGWINCH, SIGTERM, SIGINT, -1);
         assert_se(sigprocmask(SIG_BLOCK, &mask, NULL) == 0);
 
+        log_phase("Preparing cgroup and console", &t);
+
         for (;;) {
                 siginfo_t status;
                 int pipefd[2];
@@ -1323,7 +1807,9 @@ int main(int argc, char *argv[]) {
                         goto finish;
                 }
 
-                pid = syscall(__NR_clone, SIGCHLD|CLONE_NEWIPC|CLONE_NEWNS|CLONE_NEWPID|CLONE_NEWUTS|(arg_private_network ? CLONE_NEWNET : 0), NULL);
+                /* With a template the child joins a copy of that
+                 * instead of a copy of ours */
+                pid = syscall(__NR_clone, SIGCHLD|CLONE_NEWIPC|CLONE_NEWPID|CLONE_NEWUTS|(arg_template ? 0 : CLONE_NEWNS)|(arg_private_network ? CLONE_NEWNET : 0), NULL);
                 if (pid < 0) {
                         if (errno == EINVAL)
                                 log_error("clone() failed, do you have namespace support enabled in your kernel? (You need UTS, IPC, PID and NET namespacing built in): %m");
@@ -1360,8 +1846,10 @@ int main(int argc, char *argv[]) {
                         fd_wait_for_event(pipefd[0], POLLHUP, -1);
                         close_nointr_nofail(pipefd[0]);
 
-                        close_nointr_nofail(master);
-                        master = -1;
+                        if (master >= 0) {
+                                close_nointr_nofail(master);
+                                master = -1;
+                        }
 
                         if (saved_attr_valid) {
                                 if (tcsetattr(STDIN_FILENO, TCSANOW, &raw_attr) < 0) {
@@ -1370,10 +1858,6 @@ int main(int argc, char *argv[]) {
                                 }
                         }
 
-                        close_nointr(STDIN_FILENO);
-                        close_nointr(STDOUT_FILENO);
-                        close_nointr(STDERR_FILENO);
-
                         close_nointr_nofail(kmsg_socket_pair[0]);
                         kmsg_socket_pair[0] = -1;
 
@@ -1382,21 +1866,29 @@ int main(int argc, char *argv[]) {
                         assert_se(sigemptyset(&mask) == 0);
                         assert_se(sigprocmask(SIG_SETMASK, &mask, NULL) == 0);
 
-                        k = open_terminal(console, O_RDWR);
-                        if (k != STDIN_FILENO) {
-                                if (k >= 0) {
-                                        close_nointr_nofail(k);
-                                        k = -EINVAL;
-                                }
+                        /* Without a console the container keeps
+                         * our stdin, stdout and stderr */
+                        if (console) {
+                                close_nointr(STDIN_FILENO);
+                                close_nointr(STDOUT_FILENO);
+                                close_nointr(STDERR_FILENO);
+
+                                k = open_terminal(console, O_RDWR);
+                                if (k != STDIN_FILENO) {
+                                        if (k >= 0) {
+                                                close_nointr_nofail(k);
+                                                k = -EINVAL;
+                                        }
 
-                                log_error("Failed to open console: %s", strerror(-k));
-                                goto child_fail;
-                        }
+                                        log_error("Failed to open console: %s", strerror(-k));
+                                        goto child_fail;
+                                }
 
-                        if (dup2(STDIN_FILENO, STDOUT_FILENO) != STDOUT_FILENO ||
-                            dup2(STDIN_FILENO, STDERR_FILENO) != STDERR_FILENO) {
-                                log_error("Failed to duplicate console: %m");
-                                goto child_fail;
+                                if (dup2(STDIN_FILENO, STDOUT_FILENO) != STDOUT_FILENO ||
+                                    dup2(STDIN_FILENO, STDERR_FILENO) != STDERR_FILENO) {
+                                        log_error("Failed to duplicate console: %m");
+                                        goto child_fail;
+                                }
                         }
 
                         if (setsid() < 0) {
@@ -1409,29 +1901,25 @@ int main(int argc, char *argv[]) {
                                 goto child_fail;
                         }
 
-                        /* Mark everything as slave, so that we still
-                         * receive mounts from the real root, but don't
-                         * propagate mounts to the real root. */
-                        if (mount(NULL, "/", NULL, MS_SLAVE|MS_REC, NULL) < 0) {
-                                log_error("MS_SLAVE|MS_REC failed: %m");
-                                goto child_fail;
-                        }
+                        t = now(CLOCK_MONOTONIC);
 
-                        /* Turn directory into bind mount */
-                        if (mount(arg_directory, arg_directory, "bind", MS_BIND|MS_REC, NULL) < 0) {
-                                log_error("Failed to make bind mount.");
-                                goto child_fail;
-                        }
+                        if (arg_template) {
+                                if (join_template(arg_directory) < 0)
+                                        goto child_fail;
 
-                        if (arg_read_only)
-                                if (mount(arg_directory, arg_directory, "bind", MS_BIND|MS_REMOUNT|MS_RDONLY|MS_REC, NULL) < 0) {
-                                        log_error("Failed to make read-only.");
+                                log_phase("Joining template", &t);
+                        } else {
+                                if (setup_root(arg_directory) < 0)
                                         goto child_fail;
-                                }
+
+                                log_phase("Setting up root directory", &t);
+                        }
 
                         if (mount_all(arg_directory) < 0)
                                 goto child_fail;
 
+                        log_phase("Mounting API file systems", &t);
+
                         if (copy_devnodes(arg_directory) < 0)
                                 goto child_fail;
 
@@ -1440,7 +1928,7 @@ int main(int argc, char *argv[]) {
 
                         dev_setup(arg_directory);
 
-                        if (setup_dev_console(arg_directory, console) < 0)
+                        if (console && setup_dev_console(arg_directory, console) < 0)
                                 goto child_fail;
 
                         if (setup_kmsg(arg_directory, kmsg_socket_pair[1]) < 0)
@@ -1449,23 +1937,17 @@ int main(int argc, char *argv[]) {
                         close_nointr_nofail(kmsg_socket_pair[1]);
                         kmsg_socket_pair[1] = -1;
 
-                        if (setup_boot_id(arg_directory) < 0)
-                                goto child_fail;
-
-                        if (setup_timezone(arg_directory) < 0)
-                                goto child_fail;
+                        log_phase("Populating /dev", &t);
 
-                        if (setup_resolv_conf(arg_directory) < 0)
-                                goto child_fail;
-
-                        if (setup_journal(arg_directory) < 0)
+                        if (setup_boot_id(arg_directory) < 0)
                                 goto child_fail;
 
-                        if (mount_binds(arg_directory, arg_bind, 0) < 0)
-                                goto child_fail;
+                        if (!arg_template) {
+                                if (setup_shared(arg_directory) < 0)
+                                        goto child_fail;
 
-                        if (mount_binds(arg_directory, arg_bind_ro, MS_RDONLY) < 0)
-                                goto child_fail;
+                                log_phase("Setting up timezone, resolv.conf, journal and bind mounts", &t);
+                        }
 
                         if (chdir(arg_directory) < 0) {
                                 log_error("chdir(%s) failed: %m", arg_directory);
@@ -1487,6 +1969,8 @@ int main(int argc, char *argv[]) {
                                 goto child_fail;
                         }
 
+                        log_phase("Changing root", &t);
+
                         umask(0022);
 
                         loopback_setup();
@@ -1679,6 +2163,7 @@ finish:
                 cg_kill_recursive_and_wait(SYSTEMD_CGROUP_CONTROLLER, newcg, true);
 
         free(arg_directory);
+        free(arg_template);
         strv_free(arg_controllers);
         free(oldcg);
         free(newcg);
@@ -38,7 +38,7 @@ struct address {
 #define _public_ __attribute__ ((visibility("default")))
 #define _hidden_ __attribute__ ((visibility("hidden")))
 
-int ifconf_acquire_addresses(struct address **_list, unsigned *_n_list) _hidden_;
+int ifconf_acquire_addresses(int family, struct address **_list, unsigned *_n_list) _hidden_;
 
 static inline size_t PROTO_ADDRESS_SIZE(int proto) {
         assert(proto == AF_INET || proto == AF_INET6);
@@ -33,6 +33,10 @@
 #include <unistd.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "ifconf.h"
 
@@ -152,7 +156,7 @@ static int read_reply(int fd, struct address **list, unsigned *n_list) {
 }
 
 
-int ifconf_acquire_addresses(struct address **_list, unsigned *_n_list) {
+static int dump_addresses(int family, struct address **_list, unsigned *_n_list) {
 
         struct {
                 struct nlmsghdr hdr;
@@ -164,7 +168,7 @@ int ifconf_acquire_addresses(struct address **_list, unsigned *_n_list) {
                         .nlmsg_seq = SEQ,
                         .nlmsg_pid = 0,
                 }, {
-                        .rtgen_family = AF_UNSPEC,
+                        .rtgen_family = family,
                 }
         };
         int r, on = 1;
@@ -172,7 +176,7 @@ int ifconf_acquire_addresses(struct address **_list, unsigned *_n_list) {
         unsigned n_list = 0;
         int fd;
 
-        fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
+        fd = socket(PF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC, NETLINK_ROUTE);
         if (fd < 0)
                 return -errno;
 
@@ -197,7 +201,232 @@ finish:
                 return r;
         }
 
-        qsort(list, n_list, sizeof(struct address), address_compare);
+        *_list = list;
+        *_n_list = n_list;
+
+        return 0;
+}
+
+/* Programs resolving their own host name over and over would
+ * otherwise dump all addresses from the kernel for each lookup. Hence
+ * the addresses of each family are cached for a second, and dropped
+ * earlier when the kernel announces a change on the monitor socket. */
+
+#define CACHE_USEC 1000000ULL
+
+struct address_cache {
+        struct address *list;
+        unsigned n_list;
+        uint64_t timestamp;
+        bool valid;
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct address_cache cache_inet = {}, cache_inet6 = {};
+static pid_t cache_pid = 0;
+
+/* The program might close the socket behind our back and reuse the
+ * fd for something else, hence remember what it referred to */
+static int monitor_fd = -1;
+static dev_t monitor_dev = 0;
+static ino_t monitor_ino = 0;
+
+static uint64_t now_usec(void) {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000ULL;
+}
+
+static void cache_invalidate(int family) {
+
+        if (family == AF_UNSPEC || family == AF_INET)
+                cache_inet.valid = false;
+
+        if (family == AF_UNSPEC || family == AF_INET6)
+                cache_inet6.valid = false;
+}
+
+static bool monitor_is_ours(void) {
+        struct stat st;
+
+        if (monitor_fd < 0)
+                return false;
+
+        if (fstat(monitor_fd, &st) < 0)
+                return false;
+
+        return st.st_dev == monitor_dev && st.st_ino == monitor_ino;
+}
+
+static void monitor_open(void) {
+        struct sockaddr_nl snl = {
+                .nl_family = AF_NETLINK,
+                .nl_groups = RTMGRP_IPV4_IFADDR|RTMGRP_IPV6_IFADDR,
+        };
+        struct stat st;
+        int fd;
+
+        fd = socket(PF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, NETLINK_ROUTE);
+        if (fd < 0)
+                return;
+
+        if (bind(fd, (struct sockaddr*) &snl, sizeof(snl)) < 0 ||
+            fstat(fd, &st) < 0) {
+                close(fd);
+                return;
+        }
+
+        monitor_fd = fd;
+        monitor_dev = st.st_dev;
+        monitor_ino = st.st_ino;
+}
+
+static void monitor_drain(void) {
+
+        for (;;) {
+                union {
+                        struct nlmsghdr hdr;
+                        uint8_t buf[8*1024];
+                } resp;
+                struct sockaddr_nl snl;
+                socklen_t sl = sizeof(snl);
+                struct nlmsghdr *p;
+                ssize_t bytes;
+
+                bytes = recvfrom(monitor_fd, &resp, sizeof(resp), MSG_DONTWAIT, (struct sockaddr*) &snl, &sl);
+                if (bytes < 0) {
+                        if (errno == EAGAIN || errno == EINTR)
+                                return;
+
+                        /* On ENOBUFS we lost messages, and then we
+                         * can't tell what changed */
+                        cache_invalidate(AF_UNSPEC);
+
+                        if (errno == ENOBUFS)
+                                continue;
+
+                        close(monitor_fd);
+                        monitor_fd = -1;
+                        return;
+                }
+
+                /* Only the kernel may tell us */
+                if (sl != sizeof(snl) || snl.nl_pid != 0)
+                        continue;
+
+                for (p = &resp.hdr; NLMSG_OK(p, (size_t) bytes); p = NLMSG_NEXT(p, bytes)) {
+                        struct ifaddrmsg *ifaddrmsg;
+
+                        if (p->nlmsg_type != RTM_NEWADDR &&
+                            p->nlmsg_type != RTM_DELADDR)
+                                continue;
+
+                        if (p->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg))) {
+                                cache_invalidate(AF_UNSPEC);
+                                continue;
+                        }
+
+                        ifaddrmsg = NLMSG_DATA(p);
+                        cache_invalidate(ifaddrmsg->ifa_family);
+                }
+        }
+}
+
+static void cache_check(void) {
+        pid_t pid;
+
+        /* After fork() the monitor socket is shared with the parent,
+         * which would steal the notifications from us */
+        pid = getpid();
+        if (pid != cache_pid) {
+                cache_invalidate(AF_UNSPEC);
+
+                if (monitor_is_ours())
+                        close(monitor_fd);
+                monitor_fd = -1;
+
+                cache_pid = pid;
+        }
+
+        if (monitor_fd >= 0 && !monitor_is_ours()) {
+                cache_invalidate(AF_UNSPEC);
+                monitor_fd = -1;
+        }
+
+        /* Subscribe before dumping, so that no change is missed */
+        if (monitor_fd < 0)
+                monitor_open();
+
+        if (monitor_fd >= 0)
+                monitor_drain();
+}
+
+static int cache_append(struct address_cache *c, int family, uint64_t t,
+                        struct address **list, unsigned *n_list) {
+        struct address *l;
+
+        if (!c->valid || t >= c->timestamp + CACHE_USEC) {
+                struct address *fresh = NULL;
+                unsigned n_fresh = 0;
+                int r;
+
+                r = dump_addresses(family, &fresh, &n_fresh);
+                if (r < 0)
+                        return r;
+
+                free(c->list);
+                c->list = fresh;
+                c->n_list = n_fresh;
+                c->timestamp = t;
+                c->valid = true;
+        }
+
+        if (c->n_list <= 0)
+                return 0;
+
+        l = realloc(*list, (*n_list + c->n_list) * sizeof(struct address));
+        if (!l)
+                return -ENOMEM;
+
+        memcpy(l + *n_list, c->list, c->n_list * sizeof(struct address));
+        *list = l;
+        *n_list += c->n_list;
+
+        return 0;
+}
+
+int ifconf_acquire_addresses(int family, struct address **_list, unsigned *_n_list) {
+        struct address *list = NULL;
+        unsigned n_list = 0;
+        uint64_t t;
+        int r = 0;
+
+        assert(family == AF_UNSPEC || family == AF_INET || family == AF_INET6);
+
+        pthread_mutex_lock(&cache_lock);
+
+        cache_check();
+        t = now_usec();
+
+        /* Dump each family on its own, so that the kernel filters
+         * out what we don't need */
+        if (family != AF_INET6)
+                r = cache_append(&cache_inet, AF_INET, t, &list, &n_list);
+
+        if (r >= 0 && family != AF_INET)
+                r = cache_append(&cache_inet6, AF_INET6, t, &list, &n_list);
+
+        pthread_mutex_unlock(&cache_lock);
+
+        if (r < 0) {
+                free(list);
+                return r;
+        }
+
+        if (n_list > 0)
+                qsort(list, n_list, sizeof(struct address), address_compare);
 
         *_list = list;
         *_n_list = n_list;
@@ -121,7 +121,7 @@ enum nss_status _nss_myhostname_gethostbyname4_r(
         }
 
         /* If this fails, n_addresses is 0. Which is fine */
-        ifconf_acquire_addresses(&addresses, &n_addresses);
+        ifconf_acquire_addresses(AF_UNSPEC, &addresses, &n_addresses);
 
         /* If this call fails we fill in 0 as scope. Which is fine */
         lo_ifi = if_nametoindex(LOOPBACK_INTERFACE);
@@ -211,7 +211,7 @@ static enum nss_status fill_in_hostent(
 
         alen = PROTO_ADDRESS_SIZE(af);
 
-        ifconf_acquire_addresses(&addresses, &n_addresses);
+        ifconf_acquire_addresses(af, &addresses, &n_addresses);
 
         for (a = addresses, n = 0, c = 0; n < n_addresses; a++, n++)
                 if (af == a->family)
@@ -410,7 +410,7 @@ enum nss_status _nss_myhostname_gethostbyaddr2_r(
                 return NSS_STATUS_UNAVAIL;
         }
 
-        ifconf_acquire_addresses(&addresses, &n_addresses);
+        ifconf_acquire_addresses(af, &addresses, &n_addresses);
 
         for (a = addresses, n = 0; n < n_addresses; n++, a++) {
                 if (af != a->family)
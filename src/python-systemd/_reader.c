@@ -328,24 +328,48 @@ static PyObject* Reader_get(Reader *self, PyObject *args)
 }
 
 
-PyDoc_STRVAR(Reader_get_next__doc__,
-             "get_next([skip]) -> dict\n\n"
-             "Return dictionary of the next log entry. Optional skip value will\n"
-             "return the `skip`\\-th log entry. Returns an empty dict on EOF.");
-static PyObject* Reader_get_next(Reader *self, PyObject *args)
-{
-    PyObject _cleanup_Py_DECREF_ *tmp = NULL;
+typedef struct FieldFilter {
+    const char *name;
+    size_t len;
+    PyObject *key;
+} FieldFilter;
+
+static int entry_add(PyObject *dict, PyObject *key, PyObject *value) {
+    PyObject *cur_value;
+    int r;
+
+    cur_value = PyDict_GetItem(dict, key);
+    if (!cur_value)
+        return PyDict_SetItem(dict, key, value);
+
+    if (PyList_CheckExact(cur_value))
+        return PyList_Append(cur_value, value);
+    else {
+        PyObject _cleanup_Py_DECREF_ *tmp_list = PyList_New(0);
+        if (!tmp_list)
+            return -1;
+
+        r = PyList_Append(tmp_list, cur_value);
+        if (r < 0)
+            return r;
+
+        r = PyList_Append(tmp_list, value);
+        if (r < 0)
+            return r;
+
+        return PyDict_SetItem(dict, key, tmp_list);
+    }
+}
+
+/* Builds the dictionary for the current entry. If filters are
+ * specified, fields not listed there are skipped before any Python
+ * object is created for them. */
+static PyObject* entry_dict(Reader *self, const FieldFilter *filters, Py_ssize_t n_filters) {
     PyObject *dict;
     const void *msg;
     size_t msg_len;
     int r;
 
-    tmp = Reader_next(self, args);
-    if (!tmp)
-        return NULL;
-    if (tmp == Py_False) /* EOF */
-        return PyDict_New();
-
     dict = PyDict_New();
     if (!dict)
             return NULL;
@@ -353,39 +377,37 @@ static PyObject* Reader_get_next(Reader *self, PyObject *args)
     SD_JOURNAL_FOREACH_DATA(self->j, msg, msg_len) {
         PyObject _cleanup_Py_DECREF_ *key = NULL, *value = NULL;
 
-        r = extract(msg, msg_len, &key, &value);
-        if (r < 0)
-            goto error;
+        if (filters) {
+            const char *delim_ptr;
+            Py_ssize_t i;
+
+            delim_ptr = memchr(msg, '=', msg_len);
+            if (!delim_ptr)
+                continue;
+
+            for (i = 0; i < n_filters; i++)
+                if (filters[i].len == (size_t) (delim_ptr - (const char*) msg) &&
+                    memcmp(msg, filters[i].name, filters[i].len) == 0)
+                    break;
+
+            if (i >= n_filters)
+                continue;
 
-        if (PyDict_Contains(dict, key)) {
-            PyObject *cur_value = PyDict_GetItem(dict, key);
-
-            if (PyList_CheckExact(cur_value)) {
-                r = PyList_Append(cur_value, value);
-                if (r < 0)
-                    goto error;
-            } else {
-                PyObject _cleanup_Py_DECREF_ *tmp_list = PyList_New(0);
-                if (!tmp_list)
-                    goto error;
-
-                r = PyList_Append(tmp_list, cur_value);
-                if (r < 0)
-                    goto error;
-
-                r = PyList_Append(tmp_list, value);
-                if (r < 0)
-                    goto error;
-
-                r = PyDict_SetItem(dict, key, tmp_list);
-                if (r < 0)
-                    goto error;
-            }
+            r = extract(msg, msg_len, NULL, &value);
+            if (r < 0)
+                goto error;
+
+            r = entry_add(dict, filters[i].key, value);
         } else {
-            r = PyDict_SetItem(dict, key, value);
+            r = extract(msg, msg_len, &key, &value);
             if (r < 0)
                 goto error;
+
+            r = entry_add(dict, key, value);
         }
+
+        if (r < 0)
+            goto error;
     }
 
     return dict;
@@ -396,6 +418,97 @@ error:
 }
 
 
+PyDoc_STRVAR(Reader_get_next__doc__,
+             "get_next([skip]) -> dict\n\n"
+             "Return dictionary of the next log entry. Optional skip value will\n"
+             "return the `skip`\\-th log entry. Returns an empty dict on EOF.");
+static PyObject* Reader_get_next(Reader *self, PyObject *args)
+{
+    PyObject _cleanup_Py_DECREF_ *tmp = NULL;
+
+    tmp = Reader_next(self, args);
+    if (!tmp)
+        return NULL;
+    if (tmp == Py_False) /* EOF */
+        return PyDict_New();
+
+    return entry_dict(self, NULL, 0);
+}
+
+
+PyDoc_STRVAR(Reader_get_next_batch__doc__,
+             "get_next_batch(n[, fields]) -> list\n\n"
+             "Return a list of dictionaries of the next `n` log entries, fewer\n"
+             "if the end of the journal is reached first. If a sequence of\n"
+             "field names is passed as `fields` only those fields are returned.\n"
+             "Equivalent to calling get_next() up to `n` times, but cheaper.");
+static PyObject* Reader_get_next_batch(Reader *self, PyObject *args, PyObject *keywds)
+{
+    static const char* const kwlist[] = {"n", "fields", NULL};
+    PyObject _cleanup_Py_DECREF_ *seq = NULL;
+    PyObject *fields = Py_None, *list = NULL;
+    FieldFilter *filters = NULL;
+    Py_ssize_t n_filters = 0, i;
+    unsigned n, k;
+    int r;
+
+    if (!PyArg_ParseTupleAndKeywords(args, keywds, "I|O:get_next_batch", (char**) kwlist,
+                                     &n, &fields))
+        return NULL;
+
+    if (fields != Py_None) {
+        seq = PySequence_Fast(fields, "fields must be a sequence of field names");
+        if (!seq)
+            return NULL;
+
+        n_filters = PySequence_Fast_GET_SIZE(seq);
+        filters = PyMem_New(FieldFilter, MAX(n_filters, 1));
+        if (!filters)
+            return PyErr_NoMemory();
+
+        for (i = 0; i < n_filters; i++) {
+            filters[i].key = PySequence_Fast_ITEMS(seq)[i];
+            if (!PyArg_Parse(filters[i].key, "s", &filters[i].name))
+                goto finish;
+
+            filters[i].len = strlen(filters[i].name);
+        }
+    }
+
+    list = PyList_New(0);
+    if (!list)
+        goto finish;
+
+    for (k = 0; k < n; k++) {
+        PyObject _cleanup_Py_DECREF_ *dict = NULL;
+
+        Py_BEGIN_ALLOW_THREADS
+        r = sd_journal_next(self->j);
+        Py_END_ALLOW_THREADS
+
+        if (set_error(r, NULL, NULL) < 0)
+            goto fail;
+        if (r == 0)
+            break;
+
+        dict = entry_dict(self, filters, n_filters);
+        if (!dict)
+            goto fail;
+
+        if (PyList_Append(list, dict) < 0)
+            goto fail;
+    }
+
+finish:
+    PyMem_Free(filters);
+    return list;
+
+fail:
+    Py_CLEAR(list);
+    goto finish;
+}
+
+
 PyDoc_STRVAR(Reader_get_realtime__doc__,
              "get_realtime() -> int\n\n"
              "Return the realtime timestamp for the current journal entry\n"
@@ -911,6 +1024,7 @@ static PyMethodDef Reader_methods[] = {
     {"next",            (PyCFunction) Reader_next, METH_VARARGS, Reader_next__doc__},
     {"get",             (PyCFunction) Reader_get, METH_VARARGS, Reader_get__doc__},
     {"get_next",        (PyCFunction) Reader_get_next, METH_VARARGS, Reader_get_next__doc__},
+    {"get_next_batch",  (PyCFunction) Reader_get_next_batch, METH_VARARGS|METH_KEYWORDS, Reader_get_next_batch__doc__},
     {"get_previous",    (PyCFunction) Reader_get_previous, METH_VARARGS, Reader_get_previous__doc__},
     {"get_realtime",    (PyCFunction) Reader_get_realtime, METH_NOARGS, Reader_get_realtime__doc__},
     {"get_monotonic",   (PyCFunction) Reader_get_monotonic, METH_NOARGS, Reader_get_monotonic__doc__},
@@ -200,6 +200,20 @@ class Reader(_Reader):
         return self._convert_entry(
             super(Reader, self).get_next(skip))
 
+    def get_next_batch(self, n, fields=None):
+        """Return a list of up to `n` next log entries as dictionaries.
+
+        Fewer entries are returned when the end of the journal is
+        reached. If `fields` is a sequence of field names, only those
+        fields are included in the entries, the others are skipped
+        without ever being turned into Python objects.
+
+        Entries will be processed with converters specified during
+        Reader creation.
+        """
+        return [self._convert_entry(entry)
+                for entry in super(Reader, self).get_next_batch(n, fields)]
+
     def query_unique(self, field):
         """Return unique values appearing in the journal for given `field`.
 
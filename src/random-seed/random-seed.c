@@ -23,19 +23,77 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <stddef.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/random.h>
+#if HAVE_DECL_GETRANDOM
+#include <sys/random.h>
+#endif
 
 #include "log.h"
 #include "util.h"
 #include "mkdir.h"
+#include "missing.h"
 
 #define POOL_SIZE_MIN 512
 
+static ssize_t read_new_seed(int random_fd, void *buf, size_t buf_size) {
+        int fd = -1;
+        ssize_t k;
+
+        /* getrandom() saves us from opening the device, and refuses
+         * to hand out anything before the pool is initialized. In
+         * that case fall back to /dev/urandom like we always did,
+         * since some data is still better than none. */
+        k = getrandom(buf, buf_size, GRND_NONBLOCK);
+        if (k > 0)
+                return k;
+        if (k < 0 && errno != ENOSYS && errno != EAGAIN)
+                return -errno;
+
+        if (random_fd < 0) {
+                fd = open("/dev/urandom", O_RDONLY|O_CLOEXEC|O_NOCTTY);
+                if (fd < 0)
+                        return -errno;
+
+                random_fd = fd;
+        }
+
+        k = loop_read(random_fd, buf, buf_size, false);
+        if (k < 0)
+                k = -errno;
+
+        if (fd >= 0)
+                close_nointr_nofail(fd);
+
+        return k;
+}
+
+static int credit_seed(int random_fd, const void *buf, size_t size) {
+        _cleanup_free_ struct rand_pool_info *info = NULL;
+
+        info = malloc(offsetof(struct rand_pool_info, buf) + size);
+        if (!info)
+                return -ENOMEM;
+
+        info->entropy_count = size * 8;
+        info->buf_size = size;
+        memcpy(info->buf, buf, size);
+
+        if (ioctl(random_fd, RNDADDENTROPY, info) < 0)
+                return -errno;
+
+        return 0;
+}
+
 int main(int argc, char *argv[]) {
         int seed_fd = -1, random_fd = -1;
         int ret = EXIT_FAILURE;
-        void* buf;
-        size_t buf_size = 0;
+        void *buf, *old_seed = NULL;
+        size_t buf_size = 0, old_seed_size = 0;
+        bool load, credit = false;
+        const char *e;
         ssize_t r;
         FILE *f;
 
@@ -79,6 +137,23 @@ int main(int argc, char *argv[]) {
 
         if (streq(argv[1], "load")) {
 
+                load = true;
+
+                /* Crediting the seed is only safe if it is never
+                 * used twice, hence it is off unless the
+                 * administrator knows that this installation is not
+                 * cloned from an image carrying the same seed. */
+                e = getenv("SYSTEMD_RANDOM_SEED_CREDIT");
+                if (e) {
+                        int k;
+
+                        k = parse_boolean(e);
+                        if (k < 0)
+                                log_warning("Failed to parse $SYSTEMD_RANDOM_SEED_CREDIT, ignoring: %s", e);
+                        else
+                                credit = k;
+                }
+
                 if ((seed_fd = open(RANDOM_SEED, O_RDWR|O_CLOEXEC|O_NOCTTY|O_CREAT, 0600)) < 0) {
                         if ((seed_fd = open(RANDOM_SEED, O_RDONLY|O_CLOEXEC|O_NOCTTY)) < 0) {
                                 log_error("Failed to open random seed: %m");
@@ -100,6 +175,18 @@ int main(int argc, char *argv[]) {
                 } else {
                         lseek(seed_fd, 0, SEEK_SET);
 
+                        if (credit) {
+                                /* Keep the old seed around until
+                                 * the new one is on disk */
+                                old_seed = memdup(buf, r);
+                                if (!old_seed) {
+                                        log_oom();
+                                        goto finish;
+                                }
+
+                                old_seed_size = (size_t) r;
+                        }
+
                         if ((r = loop_write(random_fd, buf, (size_t) r, false)) <= 0)
                                 log_error("Failed to write seed to /dev/urandom: %s",
                                           r < 0 ? strerror(errno) : "short write");
@@ -107,15 +194,12 @@ int main(int argc, char *argv[]) {
 
         } else if (streq(argv[1], "save")) {
 
+                load = false;
+
                 if ((seed_fd = open(RANDOM_SEED, O_WRONLY|O_CLOEXEC|O_NOCTTY|O_CREAT, 0600)) < 0) {
                         log_error("Failed to open random seed: %m");
                         goto finish;
                 }
-
-                if ((random_fd = open("/dev/urandom", O_RDONLY|O_CLOEXEC|O_NOCTTY)) < 0) {
-                        log_error("Failed to open /dev/urandom: %m");
-                        goto finish;
-                }
         } else {
                 log_error("Unknown verb %s.", argv[1]);
                 goto finish;
@@ -127,13 +211,35 @@ int main(int argc, char *argv[]) {
         fchmod(seed_fd, 0600);
         fchown(seed_fd, 0, 0);
 
-        if ((r = loop_read(random_fd, buf, buf_size, false)) <= 0)
-                log_error("Failed to read new seed from /dev/urandom: %s", r < 0 ? strerror(errno) : "EOF");
-        else {
-                if ((r = loop_write(seed_fd, buf, (size_t) r, false)) <= 0)
-                        log_error("Failed to write new random seed file: %s", r < 0 ? strerror(errno) : "short write");
+        if ((r = read_new_seed(random_fd, buf, buf_size)) <= 0)
+                log_error("Failed to read new seed: %s", r < 0 ? strerror(-r) : "EOF");
+        else if ((r = loop_write(seed_fd, buf, (size_t) r, false)) <= 0) {
+                log_error("Failed to write new random seed file: %s", r < 0 ? strerror(errno) : "short write");
+                r = -EIO;
         }
 
+        if (old_seed) {
+                /* Only credit the old seed once it cannot come back
+                 * after a crash. This is the only place where we
+                 * wait for the disk. */
+                if (r <= 0)
+                        log_warning("Not crediting random seed, since it could not be replaced.");
+                else if (fdatasync(seed_fd) < 0)
+                        log_warning("Not crediting random seed, failed to sync new seed: %m");
+                else {
+                        r = credit_seed(random_fd, old_seed, old_seed_size);
+                        if (r < 0)
+                                log_warning("Failed to credit random seed: %s", strerror(-r));
+                        else
+                                log_debug("Credited %zu bits of entropy from random seed.", old_seed_size * 8);
+                }
+        } else if (!load && r > 0)
+                /* At shutdown just get the write-out started. The
+                 * final sync before the disks are unmounted waits for
+                 * it, so that we don't stall the units queued behind
+                 * us. */
+                (void) sync_file_range(seed_fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+
         ret = EXIT_SUCCESS;
 
 finish:
@@ -144,6 +250,7 @@ finish:
                 close_nointr_nofail(seed_fd);
 
         free(buf);
+        free(old_seed);
 
         return ret;
 }
@@ -38,6 +38,7 @@ int main_analyze(const char *pack_path) {
         int a;
         int missing = 0;
         off_t tsize = 0;
+        uint64_t totals[2];
 
         if (!pack_path)
                 pack_path = "/.readahead";
@@ -60,18 +61,21 @@ int main_analyze(const char *pack_path) {
                 goto fail;
         }
 
-        if ((a = getc(pack)) == EOF) {
+        if ((a = getc(pack)) == EOF ||
+            fread(totals, sizeof(totals), 1, pack) != 1) {
                 log_error("Pack file corrupt.");
                 goto fail;
         }
 
-        fputs("   pct  sections     size: path\n"
-              "   ===  ========     ====: ====\n", stdout);
+        fputs("   pct  sections     size  used: path\n"
+              "   ===  ========     ====  ====: ====\n", stdout);
 
         for (;;) {
                 char path[PATH_MAX];
                 struct stat st;
                 uint64_t inode;
+                uint32_t usage[2];
+                char used[DECIMAL_STR_MAX(unsigned) + 2] = "-";
                 int pages = 0;
                 int sections = 0;
 
@@ -80,11 +84,17 @@ int main_analyze(const char *pack_path) {
 
                 path[strlen(path)-1] = 0;
 
-                if (fread(&inode, sizeof(inode), 1, pack) != 1) {
+                if (fread(&inode, sizeof(inode), 1, pack) != 1 ||
+                    fread(usage, sizeof(usage), 1, pack) != 1) {
                         log_error("Pack file corrupt.");
                         goto fail;
                 }
 
+                /* Share of the pages replayed at the boot this was
+                 * collected at that were of use */
+                if (usage[0] > 0)
+                        snprintf(used, sizeof(used), "%u%%", (unsigned) ((uint64_t) usage[1] * 100 / usage[0]));
+
                 for (;;) {
                         uint32_t b, c;
 
@@ -114,16 +124,18 @@ int main_analyze(const char *pack_path) {
 
                         tsize += size;
 
-                        printf("  %4d%% (%2d) %12ld: %s\n",
+                        printf("  %4d%% (%2d) %12ld %5s: %s\n",
                                 sections ? (int) (size * 100 / st.st_size) : 100,
                                 sections ? sections : 1,
                                 (unsigned long)size,
+                                used,
                                 path);
                 } else {
-                        printf("  %4dp (%2d) %12s: %s (MISSING)\n",
+                        printf("  %4dp (%2d) %12s %5s: %s (MISSING)\n",
                                 sections ? pages : -1,
                                 sections ? sections : 1,
                                 "???",
+                                used,
                                 path);
                         missing++;
                 }
@@ -132,14 +144,18 @@ int main_analyze(const char *pack_path) {
 
         fclose(pack);
 
-        printf("\nHOST:    %s"
-               "TYPE:    %c\n"
-               "MISSING: %d\n"
-               "TOTAL:   %llu\n",
+        printf("\nHOST:     %s"
+               "TYPE:     %c\n"
+               "MISSING:  %d\n"
+               "TOTAL:    %llu\n"
+               "REPLAYED: %llu\n"
+               "USED:     %llu\n",
                line,
                a,
                missing,
-               (unsigned long long) tsize);
+               (unsigned long long) tsize,
+               (unsigned long long) (totals[0] * page_size()),
+               (unsigned long long) (totals[1] * page_size()));
 
         return EXIT_SUCCESS;
 
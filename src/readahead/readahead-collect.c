@@ -74,17 +74,144 @@ static usec_t starttime;
 #define SECTOR_TO_PTR(s) ULONG_TO_PTR((s)+1)
 #define PTR_TO_SECTOR(p) (PTR_TO_ULONG(p)-1)
 
+/* If less than this share of the pages replayed during boot was still
+ * around at its end, the pack file is dropped rather than rewritten,
+ * so that the next boot collects a fresh sample without replay. */
+#define REPLAY_USED_PERCENT_MIN 50
+
+/* What the replay during this boot read, so that we can find out how
+ * much of it was of any use */
+typedef struct ReplayedFile {
+        /* Pairs of first and last page, none if the entire file was
+         * read */
+        uint32_t *ranges;
+        unsigned n_ranges;
+        bool packed;
+        char path[];
+} ReplayedFile;
+
+static void replayed_file_free(ReplayedFile *f) {
+        if (!f)
+                return;
+
+        free(f->ranges);
+        free(f);
+}
+
+static void replayed_free(Hashmap *h) {
+        ReplayedFile *f;
+
+        while ((f = hashmap_steal_first(h)))
+                replayed_file_free(f);
+
+        hashmap_free(h);
+}
+
+static Hashmap *replayed_load(const char *pack_fn) {
+        _cleanup_fclose_ FILE *pack = NULL;
+        char line[LINE_MAX];
+        uint64_t totals[2];
+        Hashmap *h;
+
+        pack = fopen(pack_fn, "re");
+        if (!pack)
+                return NULL;
+
+        if (!fgets(line, sizeof(line), pack) ||
+            !streq(line, CANONICAL_HOST READAHEAD_PACK_FILE_VERSION) ||
+            getc(pack) == EOF ||
+            fread(totals, sizeof(totals), 1, pack) != 1)
+                return NULL;
+
+        h = hashmap_new(string_hash_func, string_compare_func);
+        if (!h)
+                return NULL;
+
+        while (fgets(line, sizeof(line), pack)) {
+                ReplayedFile *f;
+                uint64_t inode;
+                uint32_t usage[2];
+                size_t allocated = 0, l;
+
+                truncate_nl(line);
+                l = strlen(line);
+
+                f = malloc0(offsetof(ReplayedFile, path) + l + 1);
+                if (!f)
+                        goto fail;
+
+                memcpy(f->path, line, l + 1);
+
+                if (hashmap_put(h, f->path, f) < 0) {
+                        replayed_file_free(f);
+                        goto fail;
+                }
+
+                if (fread(&inode, sizeof(inode), 1, pack) != 1 ||
+                    fread(usage, sizeof(usage), 1, pack) != 1)
+                        goto fail;
+
+                for (;;) {
+                        uint32_t b, c;
+
+                        if (fread(&b, sizeof(b), 1, pack) != 1 ||
+                            fread(&c, sizeof(c), 1, pack) != 1)
+                                goto fail;
+
+                        if (b == 0 && c == 0)
+                                break;
+
+                        if (!GREEDY_REALLOC(f->ranges, allocated, 2 * (f->n_ranges + 1)))
+                                goto fail;
+
+                        f->ranges[2 * f->n_ranges] = b;
+                        f->ranges[2 * f->n_ranges + 1] = c;
+                        f->n_ranges++;
+                }
+        }
+
+        return h;
+
+fail:
+        replayed_free(h);
+        return NULL;
+}
+
+/* Counts the pages of a file of the given size that were replayed,
+ * and of those the ones still in memory according to vec */
+static void replayed_file_count(ReplayedFile *f, uint32_t pages, const uint8_t *vec, uint32_t *replayed, uint32_t *used) {
+        unsigned i;
+
+        *replayed = *used = 0;
+
+        for (i = 0; i < MAX(f->n_ranges, 1U); i++) {
+                uint32_t b = 0, c = pages, j;
+
+                if (f->n_ranges > 0) {
+                        b = MIN(f->ranges[2 * i], pages);
+                        c = MIN(f->ranges[2 * i + 1], pages);
+                }
+
+                *replayed += c - b;
+
+                if (vec)
+                        for (j = b; j < c; j++)
+                                *used += vec[j] & 1;
+        }
+}
+
 static int btrfs_defrag(int fd) {
         struct btrfs_ioctl_vol_args data = { .fd = fd };
 
         return ioctl(fd, BTRFS_IOC_DEFRAG, &data);
 }
 
-static int pack_file(FILE *pack, const char *fn, bool on_btrfs) {
+static int pack_file(FILE *pack, const char *fn, bool on_btrfs, Hashmap *replayed, uint64_t *replayed_pages, uint64_t *used_pages) {
         struct stat st;
         void *start = MAP_FAILED;
         uint8_t *vec;
-        uint32_t b, c;
+        uint32_t b, c, usage[2] = {};
+        ReplayedFile *rf;
         uint64_t inode;
         size_t l, pages;
         bool mapped;
@@ -133,6 +260,14 @@ static int pack_file(FILE *pack, const char *fn, bool on_btrfs) {
                 goto finish;
         }
 
+        rf = hashmap_get(replayed, fn);
+        if (rf) {
+                replayed_file_count(rf, pages, vec, &usage[0], &usage[1]);
+                *replayed_pages += usage[0];
+                *used_pages += usage[1];
+                rf->packed = true;
+        }
+
         fputs(fn, pack);
         fputc('\n', pack);
 
@@ -140,6 +275,10 @@ static int pack_file(FILE *pack, const char *fn, bool on_btrfs) {
         inode = (uint64_t) st.st_ino;
         fwrite(&inode, sizeof(inode), 1, pack);
 
+        /* How much of what was replayed of this file during this
+         * boot was still around at its end */
+        fwrite(usage, sizeof(usage), 1, pack);
+
         mapped = false;
         for (c = 0; c < pages; c++) {
                 bool new_mapped = !!(vec[c] & 1);
@@ -179,7 +318,7 @@ finish:
         return r;
 }
 
-static unsigned long fd_first_block(int fd) {
+static uint64_t fd_first_block(int fd) {
         struct {
                 struct fiemap fiemap;
                 struct fiemap_extent extent;
@@ -197,20 +336,35 @@ static unsigned long fd_first_block(int fd) {
         if (data.fiemap.fm_extents[0].fe_flags & FIEMAP_EXTENT_UNKNOWN)
                 return 0;
 
-        return (unsigned long) data.fiemap.fm_extents[0].fe_physical;
+        return data.fiemap.fm_extents[0].fe_physical;
 }
 
+/* One allocation per file, the hashmaps are keyed by the embedded
+ * path and inode. The first block is only looked up once collection
+ * is over, and only if we order by it. */
 struct item {
-        const char *path;
-        unsigned long block;
-        unsigned long bin;
+        uint64_t inode;
+        uint64_t block;
+        unsigned bin;
+        char path[];
 };
 
+static void item_get_block(struct item *i) {
+        int fd;
+
+        fd = open(i->path, O_RDONLY|O_CLOEXEC|O_NOATIME|O_NOCTTY|O_NOFOLLOW);
+        if (fd < 0)
+                return;
+
+        i->block = fd_first_block(fd);
+        close_nointr_nofail(fd);
+}
+
 static int qsort_compare(const void *a, const void *b) {
         const struct item *i, *j;
 
-        i = a;
-        j = b;
+        i = *(struct item* const*) a;
+        j = *(struct item* const*) b;
 
         /* sort by bin first */
         if (i->bin < j->bin)
@@ -237,9 +391,13 @@ static int collect(const char *root) {
         struct pollfd pollfd[_FD_MAX] = {};
         int fanotify_fd = -1, signal_fd = -1, inotify_fd = -1, r = 0;
         pid_t my_pid;
-        Hashmap *files = NULL;
+        Hashmap *files = NULL, *inodes = NULL, *replayed = NULL;
+        ReplayedFile *rf;
+        uint64_t replayed_pages = 0, used_pages = 0;
+        long totals_offset;
         Iterator i;
-        char *p, *q;
+        struct item *q;
+        char *p;
         sigset_t mask;
         FILE *pack = NULL;
         char *pack_fn_new = NULL, *pack_fn = NULL;
@@ -281,7 +439,8 @@ static int collect(const char *root) {
         }
 
         files = hashmap_new(string_hash_func, string_compare_func);
-        if (!files) {
+        inodes = hashmap_new(uint64_hash_func, uint64_compare_func);
+        if (!files || !inodes) {
                 log_error("Failed to allocate set.");
                 r = -ENOMEM;
                 goto finish;
@@ -335,9 +494,12 @@ static int collect(const char *root) {
         }
 
         for (;;) {
-                union {
+                /* Large enough for a few hundred events, so that we
+                 * don't need a poll() and a read() for each file
+                 * opened during boot. */
+                static union {
                         struct fanotify_event_metadata metadata;
-                        char buffer[4096];
+                        char buffer[64*1024];
                 } data;
                 ssize_t n;
                 struct fanotify_event_metadata *m;
@@ -432,7 +594,11 @@ static int collect(const char *root) {
                 }
 
                 for (m = &data.metadata; FAN_EVENT_OK(m, n); m = FAN_EVENT_NEXT(m, n)) {
-                        char fn[PATH_MAX];
+                        char fn[sizeof("/proc/self/fd/") + DECIMAL_STR_MAX(int)];
+                        struct item *entry;
+                        struct stat st;
+                        uint64_t inode;
+                        size_t l;
                         int k;
 
                         if (m->fd < 0)
@@ -445,48 +611,59 @@ static int collect(const char *root) {
                         if (m->pid == shared->replay)
                                 goto next_iteration;
 
+                        /* The same files are opened by many
+                         * processes during boot, don't bother
+                         * resolving the path again for those. */
+                        if (fstat(m->fd, &st) < 0) {
+                                log_warning("fstat() failed: %m");
+                                goto next_iteration;
+                        }
+
+                        inode = (uint64_t) st.st_ino;
+                        if (hashmap_get(inodes, &inode))
+                                goto next_iteration;
+
                         snprintf(fn, sizeof(fn), "/proc/self/fd/%i", m->fd);
                         char_array_0(fn);
 
-                        if ((k = readlink_malloc(fn, &p)) >= 0) {
-                                if (startswith(p, "/tmp") ||
-                                    endswith(p, " (deleted)") ||
-                                    hashmap_get(files, p))
-                                        /* Not interesting, or
-                                         * already read */
-                                        free(p);
-                                else {
-                                        unsigned long ul;
-                                        usec_t entrytime;
-                                        struct item *entry;
-
-                                        entry = new0(struct item, 1);
-                                        if (!entry) {
-                                                r = log_oom();
-                                                goto finish;
-                                        }
-
-                                        ul = fd_first_block(m->fd);
-
-                                        entrytime = now(CLOCK_MONOTONIC);
-
-                                        entry->block = ul;
-                                        entry->path = strdup(p);
-                                        if (!entry->path) {
-                                                free(entry);
-                                                r = log_oom();
-                                                goto finish;
-                                        }
-                                        entry->bin = (entrytime - starttime) / 2000000;
-
-                                        if ((k = hashmap_put(files, p, entry)) < 0) {
-                                                log_warning("set_put() failed: %s", strerror(-k));
-                                                free(p);
-                                        }
-                                }
-
-                        } else
+                        k = readlink_malloc(fn, &p);
+                        if (k < 0) {
                                 log_warning("readlink(%s) failed: %s", fn, strerror(-k));
+                                goto next_iteration;
+                        }
+
+                        if (startswith(p, "/tmp") ||
+                            endswith(p, " (deleted)") ||
+                            hashmap_get(files, p)) {
+                                /* Not interesting, or already read */
+                                free(p);
+                                goto next_iteration;
+                        }
+
+                        l = strlen(p);
+                        entry = malloc(offsetof(struct item, path) + l + 1);
+                        if (!entry) {
+                                free(p);
+                                r = log_oom();
+                                goto finish;
+                        }
+
+                        entry->inode = inode;
+                        entry->block = 0;
+                        entry->bin = (now(CLOCK_MONOTONIC) - starttime) / 2000000;
+                        memcpy(entry->path, p, l + 1);
+                        free(p);
+
+                        k = hashmap_put(files, entry->path, entry);
+                        if (k < 0) {
+                                log_warning("hashmap_put() failed: %s", strerror(-k));
+                                free(entry);
+                                goto next_iteration;
+                        }
+
+                        k = hashmap_put(inodes, &entry->inode, entry);
+                        if (k < 0)
+                                log_warning("hashmap_put() failed: %s", strerror(-k));
 
                 next_iteration:
                         if (m->fd >= 0)
@@ -508,6 +685,12 @@ done:
         on_btrfs = statfs(root, &sfs) >= 0 && (long) sfs.f_type == (long) BTRFS_SUPER_MAGIC;
         log_debug("On btrfs: %s", yes_no(on_btrfs));
 
+        /* The pack file is still the one replayed during this boot,
+         * if any */
+        __sync_synchronize();
+        if (shared->replay > 0)
+                replayed = replayed_load(pack_fn);
+
         if (asprintf(&pack_fn_new, "%s/.readahead.new", root) < 0) {
                 r = log_oom();
                 goto finish;
@@ -523,15 +706,20 @@ done:
         fputs(CANONICAL_HOST READAHEAD_PACK_FILE_VERSION, pack);
         putc(on_ssd ? 'S' : 'R', pack);
 
+        /* Pages replayed and used in total, filled in later */
+        totals_offset = ftell(pack);
+        fwrite(&replayed_pages, sizeof(replayed_pages), 1, pack);
+        fwrite(&used_pages, sizeof(used_pages), 1, pack);
+
         if (on_ssd || on_btrfs) {
 
                 /* On SSD or on btrfs, just write things out in the
                  * order the files were accessed. */
 
-                HASHMAP_FOREACH_KEY(q, p, files, i)
-                        pack_file(pack, p, on_btrfs);
+                HASHMAP_FOREACH(q, files, i)
+                        pack_file(pack, q->path, on_btrfs, replayed, &replayed_pages, &used_pages);
         } else {
-                struct item *ordered, *j;
+                struct item **ordered, **j;
                 unsigned k, n;
 
                 /* On rotating media, order things by the block
@@ -540,27 +728,55 @@ done:
                 log_debug("Ordering...");
 
                 n = hashmap_size(files);
-                if (!(ordered = new(struct item, n))) {
+                if (!(ordered = new(struct item*, n))) {
                         r = log_oom();
                         goto finish;
                 }
 
                 j = ordered;
-                HASHMAP_FOREACH_KEY(q, p, files, i) {
-                        memcpy(j, q, sizeof(struct item));
-                        j++;
+                HASHMAP_FOREACH(q, files, i) {
+                        item_get_block(q);
+                        *(j++) = q;
                 }
 
                 assert(ordered + n == j);
 
-                qsort(ordered, n, sizeof(struct item), qsort_compare);
+                qsort(ordered, n, sizeof(struct item*), qsort_compare);
 
                 for (k = 0; k < n; k++)
-                        pack_file(pack, ordered[k].path, on_btrfs);
+                        pack_file(pack, ordered[k]->path, on_btrfs, replayed, &replayed_pages, &used_pages);
 
                 free(ordered);
         }
 
+        /* Whatever was replayed of files nobody opened was wasted */
+        HASHMAP_FOREACH(rf, replayed, i) {
+                struct stat st;
+                uint32_t r_pages, u_pages;
+
+                if (rf->packed || stat(rf->path, &st) < 0)
+                        continue;
+
+                replayed_file_count(rf, PAGE_ALIGN(st.st_size) / page_size(), NULL, &r_pages, &u_pages);
+                replayed_pages += r_pages;
+        }
+
+        if (replayed_pages > 0) {
+                log_debug("Replayed %llu pages, %llu of them used.",
+                          (unsigned long long) replayed_pages, (unsigned long long) used_pages);
+
+                if (used_pages * 100 < replayed_pages * REPLAY_USED_PERCENT_MIN) {
+                        log_info("Most read-ahead data went unused, dropping pack file.");
+                        unlink(pack_fn);
+                        goto finish;
+                }
+        }
+
+        if (fseek(pack, totals_offset, SEEK_SET) >= 0) {
+                fwrite(&replayed_pages, sizeof(replayed_pages), 1, pack);
+                fwrite(&used_pages, sizeof(used_pages), 1, pack);
+        }
+
         log_debug("Finalizing...");
 
         fflush(pack);
@@ -599,10 +815,9 @@ finish:
         free(pack_fn_new);
         free(pack_fn);
 
-        while ((p = hashmap_steal_first_key(files)))
-                free(p);
-
-        hashmap_free(files);
+        hashmap_free(inodes);
+        hashmap_free_free(files);
+        replayed_free(replayed);
 
         if (previous_block_readahead_set) {
                 uint64_t bytes;
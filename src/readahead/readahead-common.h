@@ -29,7 +29,7 @@
 
 #define READAHEAD_FILE_SIZE_MAX (10*1024*1024)
 
-#define READAHEAD_PACK_FILE_VERSION ";VERSION=2\n"
+#define READAHEAD_PACK_FILE_VERSION ";VERSION=3\n"
 
 extern unsigned arg_files_max;
 extern off_t arg_file_size_max;
@@ -33,6 +33,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/inotify.h>
 
 #include <systemd/sd-daemon.h>
@@ -46,14 +48,54 @@
 
 static ReadaheadShared *shared = NULL;
 
-static int unpack_file(FILE *pack) {
-        char fn[PATH_MAX];
-        int r = 0, fd = -1;
-        bool any = false;
-        struct stat st;
+/* On SSDs the order of the files does not matter much, but a single
+ * thread issuing one request after the other cannot keep the device
+ * busy. There the files are handed to worker threads. The request
+ * queue of the device has been bumped already, hence what limits us is
+ * the number of CPUs submitting requests in parallel. */
+#define REPLAY_WORKERS_MAX 16
+#define REPLAY_QUEUE_SIZE 256
+#define REPLAY_WORKER_STACK (64*1024)
+
+typedef struct ReplayFile {
+        char *path;
         uint64_t inode;
 
+        /* Pairs of first and last page */
+        uint32_t *ranges;
+        unsigned n_ranges;
+} ReplayFile;
+
+typedef struct ReplayQueue {
+        pthread_mutex_t mutex;
+        pthread_cond_t not_empty, not_full;
+
+        ReplayFile *files[REPLAY_QUEUE_SIZE];
+        unsigned first, n_files;
+
+        bool done;
+} ReplayQueue;
+
+static void replay_file_free(ReplayFile *f) {
+        if (!f)
+                return;
+
+        free(f->path);
+        free(f->ranges);
+        free(f);
+}
+
+static int unpack_file(FILE *pack, ReplayFile **ret) {
+        char fn[PATH_MAX];
+        ReplayFile *f;
+        uint32_t usage[2];
+        size_t allocated = 0;
+        int r;
+
         assert(pack);
+        assert(ret);
+
+        *ret = NULL;
 
         if (!fgets(fn, sizeof(fn), pack))
                 return 0;
@@ -61,30 +103,22 @@ static int unpack_file(FILE *pack) {
         char_array_0(fn);
         truncate_nl(fn);
 
-        fd = open(fn, O_RDONLY|O_CLOEXEC|O_NOATIME|O_NOCTTY|O_NOFOLLOW);
-        if (fd < 0) {
-
-                if (errno != ENOENT && errno != EPERM && errno != EACCES && errno != ELOOP)
-                        log_warning("open(%s) failed: %m", fn);
+        f = new0(ReplayFile, 1);
+        if (!f)
+                return log_oom();
 
-        } else if (file_verify(fd, fn, arg_file_size_max, &st) <= 0) {
-                close_nointr_nofail(fd);
-                fd = -1;
+        f->path = strdup(fn);
+        if (!f->path) {
+                r = log_oom();
+                goto fail;
         }
 
-        if (fread(&inode, sizeof(inode), 1, pack) != 1) {
+        /* Skip over the usage data */
+        if (fread(&f->inode, sizeof(f->inode), 1, pack) != 1 ||
+            fread(usage, sizeof(usage), 1, pack) != 1) {
                 log_error("Premature end of pack file.");
                 r = -EIO;
-                goto finish;
-        }
-
-        if (fd >= 0) {
-                /* If the inode changed the file got deleted, so just
-                 * ignore this entry */
-                if (st.st_ino != (uint64_t) inode) {
-                        close_nointr_nofail(fd);
-                        fd = -1;
-                }
+                goto fail;
         }
 
         for (;;) {
@@ -94,7 +128,7 @@ static int unpack_file(FILE *pack) {
                     fread(&c, sizeof(c), 1, pack) != 1) {
                         log_error("Premature end of pack file.");
                         r = -EIO;
-                        goto finish;
+                        goto fail;
                 }
 
                 if (b == 0 && c == 0)
@@ -103,47 +137,189 @@ static int unpack_file(FILE *pack) {
                 if (c <= b) {
                         log_error("Invalid pack file.");
                         r = -EIO;
-                        goto finish;
+                        goto fail;
+                }
+
+                if (!GREEDY_REALLOC(f->ranges, allocated, 2 * (f->n_ranges + 1))) {
+                        r = log_oom();
+                        goto fail;
                 }
 
-                log_debug("%s: page %u to %u", fn, b, c);
+                f->ranges[2 * f->n_ranges] = b;
+                f->ranges[2 * f->n_ranges + 1] = c;
+                f->n_ranges++;
+        }
 
-                any = true;
+        *ret = f;
+        return 1;
 
-                if (fd >= 0)
-                        if (posix_fadvise(fd, b * page_size(), (c - b) * page_size(), POSIX_FADV_WILLNEED) < 0) {
-                                log_warning("posix_fadvise() failed: %m");
-                                goto finish;
-                        }
+fail:
+        replay_file_free(f);
+        return r;
+}
+
+static void replay_file(ReplayFile *f) {
+        struct stat st;
+        unsigned i;
+        int fd, k;
+
+        assert(f);
+
+        fd = open(f->path, O_RDONLY|O_CLOEXEC|O_NOATIME|O_NOCTTY|O_NOFOLLOW);
+        if (fd < 0) {
+                if (errno != ENOENT && errno != EPERM && errno != EACCES && errno != ELOOP)
+                        log_warning("open(%s) failed: %m", f->path);
+
+                return;
         }
 
-        if (!any && fd >= 0) {
+        if (file_verify(fd, f->path, arg_file_size_max, &st) <= 0)
+                goto finish;
+
+        /* If the inode changed the file got deleted, so just ignore
+         * this entry */
+        if (st.st_ino != (uint64_t) f->inode)
+                goto finish;
+
+        for (i = 0; i < f->n_ranges; i++) {
+                uint32_t b = f->ranges[2 * i], c = f->ranges[2 * i + 1];
+
+                log_debug("%s: page %u to %u", f->path, b, c);
+
+                k = posix_fadvise(fd, b * page_size(), (c - b) * page_size(), POSIX_FADV_WILLNEED);
+                if (k != 0) {
+                        log_warning("posix_fadvise() failed: %s", strerror(k));
+                        goto finish;
+                }
+        }
+
+        if (f->n_ranges <= 0) {
                 /* if no range is encoded in the pack file this is
                  * intended to mean that the whole file shall be
                  * read */
 
-                if (posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED) < 0) {
-                        log_warning("posix_fadvise() failed: %m");
-                        goto finish;
-                }
+                k = posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+                if (k != 0)
+                        log_warning("posix_fadvise() failed: %s", strerror(k));
         }
 
 finish:
-        if (fd >= 0)
-                close_nointr_nofail(fd);
+        close_nointr_nofail(fd);
+}
 
-        return r;
+static void *replay_thread(void *p) {
+        ReplayQueue *q = p;
+
+        for (;;) {
+                ReplayFile *f;
+
+                assert_se(pthread_mutex_lock(&q->mutex) == 0);
+
+                while (q->n_files <= 0 && !q->done)
+                        assert_se(pthread_cond_wait(&q->not_empty, &q->mutex) == 0);
+
+                if (q->n_files <= 0) {
+                        assert_se(pthread_mutex_unlock(&q->mutex) == 0);
+                        break;
+                }
+
+                f = q->files[q->first];
+                q->first = (q->first + 1) % REPLAY_QUEUE_SIZE;
+                q->n_files--;
+
+                assert_se(pthread_cond_signal(&q->not_full) == 0);
+                assert_se(pthread_mutex_unlock(&q->mutex) == 0);
+
+                replay_file(f);
+                replay_file_free(f);
+        }
+
+        return NULL;
+}
+
+static void replay_queue_push(ReplayQueue *q, ReplayFile *f) {
+        assert_se(pthread_mutex_lock(&q->mutex) == 0);
+
+        while (q->n_files >= REPLAY_QUEUE_SIZE)
+                assert_se(pthread_cond_wait(&q->not_full, &q->mutex) == 0);
+
+        q->files[(q->first + q->n_files) % REPLAY_QUEUE_SIZE] = f;
+        q->n_files++;
+
+        assert_se(pthread_cond_signal(&q->not_empty) == 0);
+        assert_se(pthread_mutex_unlock(&q->mutex) == 0);
+}
+
+static unsigned replay_workers_start(ReplayQueue *q, pthread_t *threads) {
+        pthread_attr_t a;
+        sigset_t ss, saved_ss;
+        unsigned n_threads = 0, n_workers;
+        long n_cpus;
+
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_workers = CLAMP(n_cpus, 2, REPLAY_WORKERS_MAX);
+
+        if (pthread_attr_init(&a) != 0)
+                return 0;
+
+        assert_se(pthread_attr_setstacksize(&a, MAX(REPLAY_WORKER_STACK, PTHREAD_STACK_MIN)) == 0);
+
+        /* Signals are for the main thread */
+        assert_se(sigfillset(&ss) >= 0);
+        assert_se(pthread_sigmask(SIG_SETMASK, &ss, &saved_ss) == 0);
+
+        for (; n_threads < n_workers; n_threads++)
+                if (pthread_create(threads + n_threads, &a, replay_thread, q) != 0)
+                        break;
+
+        assert_se(pthread_sigmask(SIG_SETMASK, &saved_ss, NULL) == 0);
+        pthread_attr_destroy(&a);
+
+        log_debug("Replaying with %u threads.", n_threads);
+
+        return n_threads;
+}
+
+static void replay_workers_stop(ReplayQueue *q, pthread_t *threads, unsigned n_threads, bool cancel) {
+        unsigned i;
+
+        assert_se(pthread_mutex_lock(&q->mutex) == 0);
+
+        /* Drop what has not been started yet, if we shall stop right
+         * away */
+        if (cancel)
+                for (; q->n_files > 0; q->n_files--) {
+                        replay_file_free(q->files[q->first]);
+                        q->first = (q->first + 1) % REPLAY_QUEUE_SIZE;
+                }
+
+        q->done = true;
+
+        assert_se(pthread_cond_broadcast(&q->not_empty) == 0);
+        assert_se(pthread_mutex_unlock(&q->mutex) == 0);
+
+        for (i = 0; i < n_threads; i++)
+                pthread_join(threads[i], NULL);
 }
 
 static int replay(const char *root) {
         FILE *pack = NULL;
         char line[LINE_MAX];
+        uint64_t totals[2];
         int r = 0;
         char *pack_fn = NULL;
         int c;
         bool on_ssd, ready = false;
         int prio;
         int inotify_fd = -1;
+        ReplayQueue queue = {
+                .mutex = PTHREAD_MUTEX_INITIALIZER,
+                .not_empty = PTHREAD_COND_INITIALIZER,
+                .not_full = PTHREAD_COND_INITIALIZER,
+        };
+        pthread_t threads[REPLAY_WORKERS_MAX];
+        unsigned n_threads = 0;
+        bool cancel = false;
 
         assert(root);
 
@@ -186,7 +362,8 @@ static int replay(const char *root) {
                 goto finish;
         }
 
-        if ((c = getc(pack)) == EOF) {
+        if ((c = getc(pack)) == EOF ||
+            fread(totals, sizeof(totals), 1, pack) != 1) {
                 log_debug("Premature end of pack file.");
                 r = -EIO;
                 goto finish;
@@ -211,6 +388,9 @@ static int replay(const char *root) {
         if (ioprio_set(IOPRIO_WHO_PROCESS, getpid(), prio) < 0)
                 log_warning("Failed to set IDLE IO priority class: %m");
 
+        if (on_ssd)
+                n_threads = replay_workers_start(&queue, threads);
+
         sd_notify(0, "STATUS=Replaying readahead data");
 
         log_debug("Replaying...");
@@ -224,6 +404,7 @@ static int replay(const char *root) {
                 uint8_t inotify_buffer[sizeof(struct inotify_event) + FILENAME_MAX];
                 int k;
                 ssize_t n;
+                ReplayFile *f;
 
                 if ((n = read(inotify_fd, &inotify_buffer, sizeof(inotify_buffer))) < 0) {
                         if (errno != EINTR && errno != EAGAIN) {
@@ -239,6 +420,7 @@ static int replay(const char *root) {
 
                                 if ((e->mask & IN_CREATE) && streq(e->name, "noreplay")) {
                                         log_debug("Got termination request");
+                                        cancel = true;
                                         goto done;
                                 }
 
@@ -250,11 +432,21 @@ static int replay(const char *root) {
                         }
                 }
 
-                if ((k = unpack_file(pack)) < 0) {
+                if ((k = unpack_file(pack, &f)) < 0) {
                         r = k;
                         goto finish;
                 }
 
+                if (!f)
+                        continue;
+
+                if (n_threads > 0)
+                        replay_queue_push(&queue, f);
+                else {
+                        replay_file(f);
+                        replay_file_free(f);
+                }
+
                 if (!ready) {
                         /* We delay the ready notification until we
                          * queued at least one read */
@@ -264,6 +456,11 @@ static int replay(const char *root) {
         }
 
 done:
+        if (n_threads > 0) {
+                replay_workers_stop(&queue, threads, n_threads, cancel);
+                n_threads = 0;
+        }
+
         if (!ready)
                 sd_notify(0, "READY=1");
 
@@ -276,6 +473,9 @@ done:
         log_debug("Done.");
 
 finish:
+        if (n_threads > 0)
+                replay_workers_stop(&queue, threads, n_threads, true);
+
         if (pack)
                 fclose(pack);
 
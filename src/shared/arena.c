@@ -0,0 +1,123 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "arena.h"
+
+/* The first chunk fits a typical unit file in one page, later ones
+ * double in size, up to this */
+#define ARENA_CHUNK_MIN (4096 - ALIGN(sizeof(ArenaChunk)))
+#define ARENA_CHUNK_MAX (64*1024)
+
+struct ArenaChunk {
+        ArenaChunk *next;
+};
+
+static uint8_t *chunk_data(ArenaChunk *c) {
+        return (uint8_t*) c + ALIGN(sizeof(ArenaChunk));
+}
+
+void *arena_alloc(Arena *a, size_t size) {
+        ArenaChunk *c;
+        size_t n;
+
+        assert(a);
+
+        size = ALIGN(size);
+
+        if (a->chunks && a->size - a->used >= size) {
+                void *p;
+
+                p = chunk_data(a->chunks) + a->used;
+                a->used += size;
+                return p;
+        }
+
+        if (size > ARENA_CHUNK_MAX / 2) {
+                /* Large allocations get a chunk of their own, which
+                 * is put behind the current one, so that the rest of
+                 * that is not wasted */
+                c = malloc(ALIGN(sizeof(ArenaChunk)) + size);
+                if (!c)
+                        return NULL;
+
+                if (a->chunks) {
+                        c->next = a->chunks->next;
+                        a->chunks->next = c;
+                } else {
+                        c->next = NULL;
+                        a->chunks = c;
+                        a->used = a->size = size;
+                }
+
+                return chunk_data(c);
+        }
+
+        n = a->chunks ? MIN(a->size * 2, (size_t) ARENA_CHUNK_MAX) : ARENA_CHUNK_MIN;
+        n = MAX(n, size);
+
+        c = malloc(ALIGN(sizeof(ArenaChunk)) + n);
+        if (!c)
+                return NULL;
+
+        c->next = a->chunks;
+        a->chunks = c;
+        a->size = n;
+        a->used = size;
+
+        return chunk_data(c);
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t n) {
+        char *p;
+
+        assert(a);
+        assert(s);
+
+        n = strnlen(s, n);
+
+        p = arena_alloc(a, n + 1);
+        if (!p)
+                return NULL;
+
+        memcpy(p, s, n);
+        p[n] = 0;
+
+        return p;
+}
+
+char *arena_strdup(Arena *a, const char *s) {
+        return arena_strndup(a, s, (size_t) -1);
+}
+
+void arena_free(Arena *a) {
+        ArenaChunk *c;
+
+        assert(a);
+
+        while ((c = a->chunks)) {
+                a->chunks = c->next;
+                free(c);
+        }
+
+        a->used = a->size = 0;
+}
@@ -779,65 +779,105 @@ static int find_matching_component(const CalendarComponent *c, int *val) {
         return r;
 }
 
-static bool tm_out_of_bounds(const struct tm *tm) {
-        struct tm t;
-        assert(tm);
+static bool is_leap_year(int year) {
+        return year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+}
 
-        t = *tm;
+static int days_in_month(int year, int month) {
+        static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
 
-        if (mktime(&t) == (time_t) -1)
-                return true;
+        assert(month >= 0 && month <= 11);
 
-        /* Did any normalization take place? If so, it was out of bounds before */
-        return
-                t.tm_year != tm->tm_year ||
-                t.tm_mon != tm->tm_mon ||
-                t.tm_mday != tm->tm_mday ||
-                t.tm_hour != tm->tm_hour ||
-                t.tm_min != tm->tm_min ||
-                t.tm_sec != tm->tm_sec;
+        return month == 1 && is_leap_year(year) ? 29 : days[month];
 }
 
-static bool matches_weekday(int weekdays_bits, const struct tm *tm) {
-        struct tm t;
+/* Counts like weekdays_bits, from Monday on */
+static int day_of_week(int year, int month, int day) {
+        static const int offset[12] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
         int k;
 
-        if (weekdays_bits < 0 || weekdays_bits >= 127)
-                return true;
+        if (month < 2)
+                year--;
 
-        t = *tm;
-        if (mktime(&t) == (time_t) -1)
-                return false;
+        /* 0 is Sunday here */
+        k = (year + year/4 - year/100 + year/400 + offset[month] + day) % 7;
 
-        k = t.tm_wday == 0 ? 6 : t.tm_wday - 1;
-        return (weekdays_bits & (1 << k));
+        return k == 0 ? 6 : k - 1;
 }
 
+/* How many days until one of the weekdays is reached */
+static int days_to_weekday(int weekdays_bits, const struct tm *tm) {
+        int k, i;
+
+        if (weekdays_bits < 0 || (weekdays_bits & 127) == 127)
+                return 0;
+
+        k = day_of_week(tm->tm_year + 1900, tm->tm_mon, tm->tm_mday);
+
+        for (i = 0; i < 7; i++)
+                if (weekdays_bits & (1 << ((k + i) % 7)))
+                        return i;
+
+        return -ENOENT;
+}
+
+/* Finds the next point in local time matching the spec, with plain
+ * calendar arithmetic: each component is moved to its next matching
+ * value directly, and only when none is left the next larger
+ * component is advanced. No mktime() is involved, hence whether the
+ * result actually exists in the local time zone is up to the
+ * caller. */
 static int find_next(const CalendarSpec *spec, struct tm *tm) {
         struct tm c;
-        int r;
+        int r, last_year;
 
         assert(spec);
         assert(tm);
 
         c = *tm;
 
+        /* The Gregorian calendar repeats every 400 years, if nothing
+         * matched until then nothing ever will, like with
+         * "*-02-30". */
+        last_year = c.tm_year + 400;
+
         for (;;) {
-                /* Normalize the current date */
-                mktime(&c);
-                c.tm_isdst = -1;
+                /* Carry over what was advanced below */
+                if (c.tm_sec > 59) {
+                        c.tm_min++;
+                        c.tm_sec = 0;
+                }
+                if (c.tm_min > 59) {
+                        c.tm_hour++;
+                        c.tm_min = 0;
+                }
+                if (c.tm_hour > 23) {
+                        c.tm_mday++;
+                        c.tm_hour = 0;
+                }
+                if (c.tm_mon <= 11 && c.tm_mday > days_in_month(c.tm_year + 1900, c.tm_mon)) {
+                        c.tm_mday -= days_in_month(c.tm_year + 1900, c.tm_mon);
+                        c.tm_mon++;
+                }
+                if (c.tm_mon > 11) {
+                        c.tm_year++;
+                        c.tm_mon = 0;
+                }
+
+                if (c.tm_year > last_year)
+                        return -ENOENT;
 
                 c.tm_year += 1900;
                 r = find_matching_component(spec->year, &c.tm_year);
                 c.tm_year -= 1900;
 
+                if (r < 0)
+                        return r;
                 if (r > 0) {
                         c.tm_mon = 0;
                         c.tm_mday = 1;
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
                 }
-                if (r < 0 || tm_out_of_bounds(&c))
-                        return r;
 
                 c.tm_mon += 1;
                 r = find_matching_component(spec->month, &c.tm_mon);
@@ -847,7 +887,7 @@ static int find_next(const CalendarSpec *spec, struct tm *tm) {
                         c.tm_mday = 1;
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
                 }
-                if (r < 0 || tm_out_of_bounds(&c)) {
+                if (r < 0 || c.tm_mon > 11) {
                         c.tm_year ++;
                         c.tm_mon = 0;
                         c.tm_mday = 1;
@@ -858,15 +898,20 @@ static int find_next(const CalendarSpec *spec, struct tm *tm) {
                 r = find_matching_component(spec->day, &c.tm_mday);
                 if (r > 0)
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
-                if (r < 0 || tm_out_of_bounds(&c)) {
+                if (r < 0 || c.tm_mday > days_in_month(c.tm_year + 1900, c.tm_mon)) {
                         c.tm_mon ++;
                         c.tm_mday = 1;
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
                         continue;
                 }
 
-                if (!matches_weekday(spec->weekdays_bits, &c)) {
-                        c.tm_mday++;
+                /* None of the days skipped here can match, whatever
+                 * the day component says */
+                r = days_to_weekday(spec->weekdays_bits, &c);
+                if (r < 0)
+                        return r;
+                if (r > 0) {
+                        c.tm_mday += r;
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
                         continue;
                 }
@@ -874,7 +919,7 @@ static int find_next(const CalendarSpec *spec, struct tm *tm) {
                 r = find_matching_component(spec->hour, &c.tm_hour);
                 if (r > 0)
                         c.tm_min = c.tm_sec = 0;
-                if (r < 0 || tm_out_of_bounds(&c)) {
+                if (r < 0 || c.tm_hour > 23) {
                         c.tm_mday ++;
                         c.tm_hour = c.tm_min = c.tm_sec = 0;
                         continue;
@@ -883,26 +928,92 @@ static int find_next(const CalendarSpec *spec, struct tm *tm) {
                 r = find_matching_component(spec->minute, &c.tm_min);
                 if (r > 0)
                         c.tm_sec = 0;
-                if (r < 0 || tm_out_of_bounds(&c)) {
+                if (r < 0 || c.tm_min > 59) {
                         c.tm_hour ++;
                         c.tm_min = c.tm_sec = 0;
                         continue;
                 }
 
                 r = find_matching_component(spec->second, &c.tm_sec);
-                if (r < 0 || tm_out_of_bounds(&c)) {
+                if (r < 0 || c.tm_sec > 59) {
                         c.tm_min ++;
                         c.tm_sec = 0;
                         continue;
                 }
 
-
                 *tm = c;
                 return 0;
         }
 }
 
-int calendar_spec_next_usec(const CalendarSpec *spec, usec_t usec, usec_t *next) {
+static bool tm_same(const struct tm *a, const struct tm *b) {
+        return
+                a->tm_year == b->tm_year &&
+                a->tm_mon == b->tm_mon &&
+                a->tm_mday == b->tm_mday &&
+                a->tm_hour == b->tm_hour &&
+                a->tm_min == b->tm_min &&
+                a->tm_sec == b->tm_sec;
+}
+
+/* The UTC offset changed somewhere in (l, h], returns when */
+static time_t find_offset_change(time_t l, time_t h) {
+        struct tm tm;
+        long offset;
+
+        assert(l < h);
+
+        assert_se(localtime_r(&h, &tm));
+        offset = tm.tm_gmtoff;
+
+        while (h - l > 1) {
+                time_t m = l + (h - l) / 2;
+
+                assert_se(localtime_r(&m, &tm));
+                if (tm.tm_gmtoff == offset)
+                        h = m;
+                else
+                        l = m;
+        }
+
+        return h;
+}
+
+static time_t seconds_of_day(const struct tm *tm) {
+        return (time_t) tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec;
+}
+
+/* After the clock was put back, local times exist twice. mktime()
+ * picks one of them depending on what it was asked before, we take
+ * the first one that is not behind us. */
+static time_t first_instance(time_t t, const struct tm *tm, time_t start) {
+        struct tm a, b, c;
+        time_t u;
+        long other;
+
+        u = t - 24 * 3600;
+        assert_se(localtime_r(&u, &a));
+        u = t + 24 * 3600;
+        assert_se(localtime_r(&u, &b));
+
+        if (a.tm_gmtoff == b.tm_gmtoff)
+                return t;
+
+        assert_se(localtime_r(&t, &c));
+        other = c.tm_gmtoff == a.tm_gmtoff ? b.tm_gmtoff : a.tm_gmtoff;
+
+        u = t + c.tm_gmtoff - other;
+        assert_se(localtime_r(&u, &c));
+        if (c.tm_gmtoff != other || seconds_of_day(&c) != seconds_of_day(tm))
+                return t;
+
+        if (t >= start && (u < start || t < u))
+                return t;
+
+        return u;
+}
+
+static int find_next_time(const CalendarSpec *spec, time_t start, time_t *next) {
         struct tm tm;
         time_t t;
         int r;
@@ -910,17 +1021,78 @@ int calendar_spec_next_usec(const CalendarSpec *spec, usec_t usec, usec_t *next)
         assert(spec);
         assert(next);
 
-        t = (time_t) (usec / USEC_PER_SEC) + 1;
-        assert_se(localtime_r(&t, &tm));
+        assert_se(localtime_r(&start, &tm));
+
+        for (;;) {
+                struct tm c;
+                time_t delta;
+
+                r = find_next(spec, &tm);
+                if (r < 0)
+                        return r;
 
-        r = find_next(spec, &tm);
+                c = tm;
+                c.tm_isdst = -1;
+                t = mktime(&c);
+                if (t == (time_t) -1)
+                        return -EINVAL;
+
+                if (tm_same(&c, &tm)) {
+                        t = first_instance(t, &tm, start);
+                        if (t >= start)
+                                break;
+
+                        tm.tm_sec++;
+                        continue;
+                }
+
+                /* Skipped when the clock was put forward. mktime()
+                 * moved us across the gap by its length, in either
+                 * direction. Continue with the first local time after
+                 * the gap. */
+                delta = seconds_of_day(&c) - seconds_of_day(&tm);
+                if (delta > 12 * 3600)
+                        delta -= 24 * 3600;
+                else if (delta <= -12 * 3600)
+                        delta += 24 * 3600;
+                if (delta < 0)
+                        delta = -delta;
+
+                t = find_offset_change(t - delta, t + delta);
+                assert_se(localtime_r(&t, &tm));
+        }
+
+        *next = t;
+        return 0;
+}
+
+int calendar_spec_next_usec(const CalendarSpec *spec, usec_t usec, usec_t *next) {
+        struct tm a, b;
+        time_t start, t, u;
+        int r;
+
+        assert(spec);
+        assert(next);
+
+        start = (time_t) (usec / USEC_PER_SEC) + 1;
+
+        r = find_next_time(spec, start, &t);
         if (r < 0)
                 return r;
 
-        t = mktime(&tm);
-        if (t == (time_t) -1)
-                return -EINVAL;
+        /* When the clock is put back before that, the local times
+         * just behind us come once more */
+        u = start + 24 * 3600;
+        assert_se(localtime_r(&start, &a));
+        assert_se(localtime_r(&u, &b));
 
+        if (b.tm_gmtoff < a.tm_gmtoff) {
+                time_t again;
+
+                u = find_offset_change(start, u);
+                if (u < t && find_next_time(spec, u, &again) >= 0 && again < t)
+                        t = again;
+        }
 
         *next = (usec_t) t * USEC_PER_SEC;
         return 0;
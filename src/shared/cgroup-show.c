@@ -23,6 +23,8 @@
 #include <string.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "util.h"
 #include "macro.h"
@@ -51,30 +53,21 @@ static unsigned ilog10(unsigned long ul) {
         return n;
 }
 
-static void show_pid_array(int pids[], unsigned n_pids, const char *prefix, unsigned n_columns, bool extra, bool more, bool kernel_threads, OutputFlags flags) {
+static void show_pid_array(pid_t pids[], unsigned n_pids, const char *prefix, unsigned n_columns, bool extra, bool more, bool kernel_threads, OutputFlags flags) {
         unsigned i, m, pid_width;
-        pid_t biggest = 0;
 
-        /* Filter duplicates */
-        m = 0;
-        for (i = 0; i < n_pids; i++) {
-                unsigned j;
-
-                if (pids[i] > biggest)
-                        biggest = pids[i];
+        if (n_pids <= 0)
+                return;
 
-                for (j = i+1; j < n_pids; j++)
-                        if (pids[i] == pids[j])
-                                break;
+        /* Sort, and then filter duplicates, which are neighbours now */
+        qsort(pids, n_pids, sizeof(pid_t), compare);
 
-                if (j >= n_pids)
+        m = 1;
+        for (i = 1; i < n_pids; i++)
+                if (pids[i] != pids[m-1])
                         pids[m++] = pids[i];
-        }
         n_pids = m;
-        pid_width = ilog10(biggest);
-
-        /* And sort */
-        qsort(pids, n_pids, sizeof(pid_t), compare);
+        pid_width = ilog10(pids[n_pids-1]);
 
         if(flags & OUTPUT_FULL_WIDTH)
                 n_columns = 0;
@@ -101,165 +94,169 @@ static void show_pid_array(int pids[], unsigned n_pids, const char *prefix, unsi
         }
 }
 
+/* Like cg_is_empty_recursive(), but relative to the group fd, and
+ * without reading more of any PID list than its first byte */
+static int is_empty_recursive_at(int dfd) {
+        _cleanup_closedir_ DIR *d = NULL;
+        const char *name;
+        char c;
+        int fd, r;
+        ssize_t l;
 
-static int show_cgroup_one_by_path(const char *path, const char *prefix, unsigned n_columns, bool more, bool kernel_threads, OutputFlags flags) {
-        char *fn;
-        FILE *f;
-        size_t n = 0, n_allocated = 0;
-        pid_t *pids = NULL;
-        char *p;
-        pid_t pid;
-        int r;
+        fd = openat(dfd, "cgroup.procs", O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return errno == ENOENT ? 1 : -errno;
 
-        r = cg_fix_path(path, &p);
-        if (r < 0)
-                return r;
+        l = read(fd, &c, 1);
+        r = l < 0 ? -errno : 0;
+        close_nointr_nofail(fd);
 
-        r = asprintf(&fn, "%s/cgroup.procs", p);
-        free(p);
         if (r < 0)
-                return -ENOMEM;
-
-        f = fopen(fn, "re");
-        free(fn);
-        if (!f)
-                return -errno;
-
-        while ((r = cg_read_pid(f, &pid)) > 0) {
-
-                if (!kernel_threads && is_kernel_thread(pid) > 0)
-                        continue;
-
-                if (n >= n_allocated) {
-                        pid_t *npids;
-
-                        n_allocated = MAX(16U, n*2U);
+                return r;
+        if (l > 0)
+                return 0;
 
-                        npids = realloc(pids, sizeof(pid_t) * n_allocated);
-                        if (!npids) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+        d = cg_opendir_at(dfd);
+        if (!d)
+                return errno == ENOENT ? 1 : -errno;
 
-                        pids = npids;
-                }
+        while ((r = cg_open_next_subgroup(d, &name, &fd)) > 0) {
+                r = is_empty_recursive_at(fd);
+                close_nointr_nofail(fd);
 
-                assert(n < n_allocated);
-                pids[n++] = pid;
+                if (r <= 0)
+                        return r;
         }
 
-        if (r < 0)
-                goto finish;
+        return r < 0 ? r : 1;
+}
 
-        if (n > 0)
-                show_pid_array(pids, n, prefix, n_columns, false, more, kernel_threads, flags);
+static int show_cgroup_one_at(int dfd, const char *prefix, unsigned n_columns, bool more, bool kernel_threads, OutputFlags flags) {
+        _cleanup_free_ pid_t *pids = NULL;
+        size_t allocated = 0;
+        unsigned i, n = 0, m;
+        int r;
 
-        r = 0;
+        r = cg_read_pid_list_at(dfd, "cgroup.procs", &pids, &allocated, &n);
+        if (r < 0)
+                return r;
 
-finish:
-        free(pids);
+        if (!kernel_threads) {
+                for (i = 0, m = 0; i < n; i++)
+                        if (is_kernel_thread(pids[i]) <= 0)
+                                pids[m++] = pids[i];
+                n = m;
+        }
 
-        if (f)
-                fclose(f);
+        show_pid_array(pids, n, prefix, n_columns, false, more, kernel_threads, flags);
 
-        return r;
+        return 0;
 }
 
-int show_cgroup_by_path(const char *path, const char *prefix, unsigned n_columns, bool kernel_threads, OutputFlags flags) {
-        DIR *d;
+/* Walks the tree down through the directory fds of the groups, so that
+ * no paths need to be built and resolved again on each level */
+static int show_cgroup_at(int dfd, const char *prefix, unsigned n_columns, bool kernel_threads, OutputFlags flags) {
+        _cleanup_closedir_ DIR *d = NULL;
+        _cleanup_free_ char *p1 = NULL, *p2 = NULL;
         char *last = NULL;
-        char *p1 = NULL, *p2 = NULL, *fn = NULL, *gn = NULL;
+        int last_fd = -1;
         bool shown_pids = false;
-        int r;
-
-        assert(path);
-
-        if (n_columns <= 0)
-                n_columns = columns();
-
-        if (!prefix)
-                prefix = "";
+        const char *name;
+        int fd, r;
 
-        r = cg_fix_path(path, &fn);
-        if (r < 0)
-                return r;
-
-        d = opendir(fn);
-        if (!d) {
-                free(fn);
+        d = cg_opendir_at(dfd);
+        if (!d)
                 return -errno;
-        }
 
-        while ((r = cg_read_subgroup(d, &gn)) > 0) {
-                char *k;
+        while ((r = cg_open_next_subgroup(d, &name, &fd)) > 0) {
 
-                r = asprintf(&k, "%s/%s", fn, gn);
-                free(gn);
-                if (r < 0) {
-                        r = -ENOMEM;
-                        goto finish;
-                }
-
-                if (!(flags & OUTPUT_SHOW_ALL) && cg_is_empty_recursive(NULL, k, false) > 0) {
-                        free(k);
+                if (!(flags & OUTPUT_SHOW_ALL) && is_empty_recursive_at(fd) > 0) {
+                        close_nointr_nofail(fd);
                         continue;
                 }
 
                 if (!shown_pids) {
-                        show_cgroup_one_by_path(path, prefix, n_columns, true, kernel_threads, flags);
+                        show_cgroup_one_at(dfd, prefix, n_columns, true, kernel_threads, flags);
                         shown_pids = true;
                 }
 
                 if (last) {
-                        printf("%s%s%s\n", prefix, draw_special_char(DRAW_TREE_BRANCH),
-                                           path_get_file_name(last));
+                        printf("%s%s%s\n", prefix, draw_special_char(DRAW_TREE_BRANCH), last);
 
                         if (!p1) {
                                 p1 = strappend(prefix, draw_special_char(DRAW_TREE_VERT));
                                 if (!p1) {
-                                        free(k);
+                                        close_nointr_nofail(fd);
                                         r = -ENOMEM;
                                         goto finish;
                                 }
                         }
 
-                        show_cgroup_by_path(last, p1, n_columns-2, kernel_threads, flags);
+                        show_cgroup_at(last_fd, p1, n_columns-2, kernel_threads, flags);
+
+                        close_nointr_nofail(last_fd);
                         free(last);
                 }
 
-                last = k;
+                last_fd = fd;
+                last = strdup(name);
+                if (!last) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
         }
 
         if (r < 0)
                 goto finish;
 
         if (!shown_pids)
-                show_cgroup_one_by_path(path, prefix, n_columns, !!last, kernel_threads, flags);
+                show_cgroup_one_at(dfd, prefix, n_columns, !!last, kernel_threads, flags);
 
         if (last) {
-                printf("%s%s%s\n", prefix, draw_special_char(DRAW_TREE_RIGHT),
-                                   path_get_file_name(last));
+                printf("%s%s%s\n", prefix, draw_special_char(DRAW_TREE_RIGHT), last);
 
+                p2 = strappend(prefix, "  ");
                 if (!p2) {
-                        p2 = strappend(prefix, "  ");
-                        if (!p2) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+                        r = -ENOMEM;
+                        goto finish;
                 }
 
-                show_cgroup_by_path(last, p2, n_columns-2, kernel_threads, flags);
+                show_cgroup_at(last_fd, p2, n_columns-2, kernel_threads, flags);
         }
 
         r = 0;
 
 finish:
-        free(p1);
-        free(p2);
         free(last);
-        free(fn);
 
-        closedir(d);
+        if (last_fd >= 0)
+                close_nointr_nofail(last_fd);
+
+        return r;
+}
+
+int show_cgroup_by_path(const char *path, const char *prefix, unsigned n_columns, bool kernel_threads, OutputFlags flags) {
+        _cleanup_free_ char *fn = NULL;
+        int fd, r;
+
+        assert(path);
+
+        if (n_columns <= 0)
+                n_columns = columns();
+
+        if (!prefix)
+                prefix = "";
+
+        r = cg_fix_path(path, &fn);
+        if (r < 0)
+                return r;
+
+        fd = open(fn, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        r = show_cgroup_at(fd, prefix, n_columns, kernel_threads, flags);
+        close_nointr_nofail(fd);
 
         return r;
 }
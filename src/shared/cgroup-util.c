@@ -27,7 +27,7 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <ftw.h>
+#include <fcntl.h>
 
 #include "cgroup-util.h"
 #include "log.h"
@@ -192,39 +192,196 @@ int cg_rmdir(const char *controller, const char *path, bool honour_sticky) {
         return (r < 0 && errno != ENOENT) ? -errno : 0;
 }
 
-int cg_kill(const char *controller, const char *path, int sig, bool sigcont, bool ignore_self, Set *s) {
+/* Size of the reads of PID lists. With thousands of processes stdio's
+ * buffer would take hundreds of read()s */
+#define PID_LIST_READ_MAX (64*1024)
+
+/* Reads all PIDs listed in the file fn of the group dfd refers to */
+int cg_read_pid_list_at(int dfd, const char *fn, pid_t **pids, size_t *allocated, unsigned *n) {
+        _cleanup_free_ char *buf = NULL;
+        size_t size = 0, buf_allocated = 0;
+        unsigned k = 0;
+        char *p;
+        int fd, r = 0;
+
+        assert(dfd >= 0);
+        assert(fn);
+        assert(pids);
+        assert(allocated);
+        assert(n);
+
+        fd = openat(dfd, fn, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        for (;;) {
+                ssize_t l;
+
+                if (!GREEDY_REALLOC(buf, buf_allocated, size + PID_LIST_READ_MAX + 1)) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                l = read(fd, buf + size, buf_allocated - size - 1);
+                if (l < 0) {
+                        r = -errno;
+                        goto finish;
+                }
+
+                if (l == 0)
+                        break;
+
+                size += l;
+        }
+
+        buf[size] = 0;
+
+        /* Note that the cgroup.procs might contain duplicates! See
+         * cgroups.txt for details. */
+        for (p = buf;;) {
+                unsigned long ul;
+                char *e;
+
+                p += strspn(p, WHITESPACE);
+                if (!*p)
+                        break;
+
+                errno = 0;
+                ul = strtoul(p, &e, 10);
+                if (errno > 0 || e == p || ul <= 0) {
+                        r = -EIO;
+                        goto finish;
+                }
+
+                if (!GREEDY_REALLOC(*pids, *allocated, k + 1)) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                (*pids)[k++] = (pid_t) ul;
+                p = e;
+        }
+
+        *n = k;
+
+finish:
+        close_nointr_nofail(fd);
+        return r;
+}
+
+static int cg_open(const char *controller, const char *path) {
+        _cleanup_free_ char *fs = NULL;
+        int r, fd;
+
+        r = cg_get_path(controller, path, NULL, &fs);
+        if (r < 0)
+                return r;
+
+        fd = open(fs, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0)
+                return -errno;
+
+        return fd;
+}
+
+/* Like cg_enumerate_subgroups(), but relative to a group fd, which
+ * stays usable */
+DIR *cg_opendir_at(int dfd) {
+        DIR *d;
+        int fd;
+
+        fd = openat(dfd, ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0)
+                return NULL;
+
+        d = fdopendir(fd);
+        if (!d)
+                close_nointr_nofail(fd);
+
+        return d;
+}
+
+/* Opens the next subgroup of d, returns 0 at the end */
+int cg_open_next_subgroup(DIR *d, const char **name, int *fd) {
+        struct dirent *de;
+
+        assert(d);
+        assert(name);
+        assert(fd);
+
+        for (;;) {
+                errno = 0;
+                de = readdir(d);
+                if (!de)
+                        return errno ? -errno : 0;
+
+                if (de->d_type != DT_DIR)
+                        continue;
+
+                if (streq(de->d_name, ".") ||
+                    streq(de->d_name, ".."))
+                        continue;
+
+                *fd = openat(dirfd(d), de->d_name, O_RDONLY|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
+                if (*fd < 0) {
+                        /* Removed since we read the directory */
+                        if (errno == ENOENT)
+                                continue;
+
+                        return -errno;
+                }
+
+                *name = de->d_name;
+                return 1;
+        }
+}
+
+static int cg_rmdir_at(int dfd, const char *name, int fd) {
+        struct stat st;
+
+        /* If the sticky bit is set don't remove the directory */
+        if (fstatat(fd, "tasks", &st, AT_SYMLINK_NOFOLLOW) >= 0 &&
+            (st.st_uid == 0 || st.st_uid == getuid()) &&
+            (st.st_mode & S_ISVTX))
+                return 0;
+
+        if (unlinkat(dfd, name, AT_REMOVEDIR) < 0 && errno != ENOENT)
+                return -errno;
+
+        return 0;
+}
+
+static int cg_kill_at(int dfd, int sig, bool sigcont, bool ignore_self, Set *s) {
+        _cleanup_free_ pid_t *pids = NULL;
+        size_t allocated = 0;
         bool done = false;
         int r, ret = 0;
         pid_t my_pid;
-        FILE *f = NULL;
-        Set *allocated_set = NULL;
 
-        assert(controller);
-        assert(path);
-        assert(sig >= 0);
+        assert(dfd >= 0);
+        assert(s);
 
         /* This goes through the tasks list and kills them all. This
          * is repeated until no further processes are added to the
          * tasks list, to properly handle forking processes */
 
-        if (!s)
-                if (!(s = allocated_set = set_new(trivial_hash_func, trivial_compare_func)))
-                        return -ENOMEM;
-
         my_pid = getpid();
 
         do {
-                pid_t pid = 0;
+                unsigned n = 0, i;
+
                 done = true;
 
-                if ((r = cg_enumerate_processes(controller, path, &f)) < 0) {
-                        if (ret >= 0 && r != -ENOENT)
+                r = cg_read_pid_list_at(dfd, "cgroup.procs", &pids, &allocated, &n);
+                if (r < 0) {
+                        if (ret >= 0 && r != -ENOENT && r != -ENODEV)
                                 ret = r;
 
-                        goto finish;
+                        return ret;
                 }
 
-                while ((r = cg_read_pid(f, &pid)) > 0) {
+                for (i = 0; i < n; i++) {
+                        pid_t pid = pids[i];
 
                         if (pid == my_pid && ignore_self)
                                 continue;
@@ -247,100 +404,110 @@ int cg_kill(const char *controller, const char *path, int sig, bool sigcont, boo
 
                         done = false;
 
-                        if ((r = set_put(s, LONG_TO_PTR(pid))) < 0) {
+                        r = set_put(s, LONG_TO_PTR(pid));
+                        if (r < 0) {
                                 if (ret >= 0)
                                         ret = r;
 
-                                goto finish;
+                                return ret;
                         }
                 }
 
-                if (r < 0) {
-                        if (ret >= 0)
-                                ret = r;
-
-                        goto finish;
-                }
-
-                fclose(f);
-                f = NULL;
-
                 /* To avoid racing against processes which fork
                  * quicker than we can kill them we repeat this until
                  * no new pids need to be killed. */
 
         } while (!done);
 
-finish:
-        if (allocated_set)
-                set_free(allocated_set);
-
-        if (f)
-                fclose(f);
-
         return ret;
 }
 
-int cg_kill_recursive(const char *controller, const char *path, int sig, bool sigcont, bool ignore_self, bool rem, Set *s) {
-        int r, ret = 0;
-        DIR *d = NULL;
-        char *fn;
-        Set *allocated_set = NULL;
+static int cg_kill_recursive_at(int dfd, int sig, bool sigcont, bool ignore_self, bool rem, Set *s) {
+        _cleanup_closedir_ DIR *d = NULL;
+        const char *name;
+        int r, ret, fd;
 
-        assert(path);
-        assert(controller);
-        assert(sig >= 0);
+        ret = cg_kill_at(dfd, sig, sigcont, ignore_self, s);
 
-        if (!s)
-                if (!(s = allocated_set = set_new(trivial_hash_func, trivial_compare_func)))
-                        return -ENOMEM;
+        d = cg_opendir_at(dfd);
+        if (!d) {
+                if (ret >= 0 && errno != ENOENT)
+                        ret = -errno;
+
+                return ret;
+        }
 
-        ret = cg_kill(controller, path, sig, sigcont, ignore_self, s);
+        while ((r = cg_open_next_subgroup(d, &name, &fd)) > 0) {
+                int q;
 
-        if ((r = cg_enumerate_subgroups(controller, path, &d)) < 0) {
-                if (ret >= 0 && r != -ENOENT)
-                        ret = r;
+                q = cg_kill_recursive_at(fd, sig, sigcont, ignore_self, rem, s);
+                if (q != 0 && ret >= 0)
+                        ret = q;
 
-                goto finish;
+                if (rem) {
+                        q = cg_rmdir_at(dirfd(d), name, fd);
+                        if (q < 0 && ret >= 0 && q != -EBUSY)
+                                ret = q;
+                }
+
+                close_nointr_nofail(fd);
         }
 
-        while ((r = cg_read_subgroup(d, &fn)) > 0) {
-                char *p = NULL;
+        if (r < 0 && ret >= 0)
+                ret = r;
 
-                r = asprintf(&p, "%s/%s", path, fn);
-                free(fn);
+        return ret;
+}
 
-                if (r < 0) {
-                        if (ret >= 0)
-                                ret = -ENOMEM;
+int cg_kill(const char *controller, const char *path, int sig, bool sigcont, bool ignore_self, Set *s) {
+        _cleanup_set_free_ Set *allocated_set = NULL;
+        _cleanup_close_ int fd = -1;
 
-                        goto finish;
-                }
+        assert(controller);
+        assert(path);
+        assert(sig >= 0);
 
-                r = cg_kill_recursive(controller, p, sig, sigcont, ignore_self, rem, s);
-                free(p);
+        fd = cg_open(controller, path);
+        if (fd < 0)
+                return fd == -ENOENT ? 0 : fd;
 
-                if (r != 0 && ret >= 0)
-                        ret = r;
+        if (!s) {
+                s = allocated_set = set_new(trivial_hash_func, trivial_compare_func);
+                if (!s)
+                        return -ENOMEM;
         }
 
-        if (r < 0 && ret >= 0)
-                ret = r;
+        return cg_kill_at(fd, sig, sigcont, ignore_self, s);
+}
 
-        if (rem)
-                if ((r = cg_rmdir(controller, path, true)) < 0) {
-                        if (ret >= 0 &&
-                            r != -ENOENT &&
-                            r != -EBUSY)
-                                ret = r;
-                }
+int cg_kill_recursive(const char *controller, const char *path, int sig, bool sigcont, bool ignore_self, bool rem, Set *s) {
+        _cleanup_set_free_ Set *allocated_set = NULL;
+        _cleanup_close_ int fd = -1;
+        int r, ret;
 
-finish:
-        if (d)
-                closedir(d);
+        assert(path);
+        assert(controller);
+        assert(sig >= 0);
+
+        /* Walks the tree through directory fds, so that the paths
+         * don't need to be built and resolved again at each level */
+        fd = cg_open(controller, path);
+        if (fd < 0)
+                return fd == -ENOENT ? 0 : fd;
+
+        if (!s) {
+                s = allocated_set = set_new(trivial_hash_func, trivial_compare_func);
+                if (!s)
+                        return -ENOMEM;
+        }
+
+        ret = cg_kill_recursive_at(fd, sig, sigcont, ignore_self, rem, s);
 
-        if (allocated_set)
-                set_free(allocated_set);
+        if (rem) {
+                r = cg_rmdir(controller, path, true);
+                if (r < 0 && ret >= 0 && r != -ENOENT && r != -EBUSY)
+                        ret = r;
+        }
 
         return ret;
 }
@@ -376,17 +543,16 @@ int cg_kill_recursive_and_wait(const char *controller, const char *path, bool re
         return 0;
 }
 
-int cg_migrate(const char *cfrom, const char *pfrom, const char *cto, const char *pto, bool ignore_self) {
-        bool done = false;
+static int cg_migrate_at(int dfd, int tfd, bool ignore_self) {
         _cleanup_set_free_ Set *s = NULL;
+        _cleanup_free_ pid_t *pids = NULL;
+        size_t allocated = 0;
+        bool done = false;
         int r, ret = 0;
         pid_t my_pid;
-        _cleanup_fclose_ FILE *f = NULL;
 
-        assert(cfrom);
-        assert(pfrom);
-        assert(cto);
-        assert(pto);
+        assert(dfd >= 0);
+        assert(tfd >= 0);
 
         s = set_new(trivial_hash_func, trivial_compare_func);
         if (!s)
@@ -395,18 +561,21 @@ int cg_migrate(const char *cfrom, const char *pfrom, const char *cto, const char
         my_pid = getpid();
 
         do {
-                pid_t pid = 0;
+                unsigned n = 0, i;
+
                 done = true;
 
-                r = cg_enumerate_tasks(cfrom, pfrom, &f);
+                r = cg_read_pid_list_at(dfd, "tasks", &pids, &allocated, &n);
                 if (r < 0) {
-                        if (ret >= 0 && r != -ENOENT)
+                        if (ret >= 0 && r != -ENOENT && r != -ENODEV)
                                 ret = r;
 
                         return ret;
                 }
 
-                while ((r = cg_read_pid(f, &pid)) > 0) {
+                for (i = 0; i < n; i++) {
+                        char c[DECIMAL_STR_MAX(pid_t) + 2];
+                        pid_t pid = pids[i];
 
                         /* This might do weird stuff if we aren't a
                          * single-threaded program. However, we
@@ -417,10 +586,12 @@ int cg_migrate(const char *cfrom, const char *pfrom, const char *cto, const char
                         if (set_get(s, LONG_TO_PTR(pid)) == LONG_TO_PTR(pid))
                                 continue;
 
-                        r = cg_attach(cto, pto, pid);
-                        if (r < 0) {
-                                if (ret >= 0 && r != -ESRCH)
-                                        ret = r;
+                        /* Each write to tasks moves one PID */
+                        snprintf(c, sizeof(c), "%lu\n", (unsigned long) pid);
+
+                        if (write(tfd, c, strlen(c)) < 0) {
+                                if (ret >= 0 && errno != ESRCH)
+                                        ret = -errno;
                         } else if (ret == 0)
                                 ret = 1;
 
@@ -434,60 +605,102 @@ int cg_migrate(const char *cfrom, const char *pfrom, const char *cto, const char
                                 return ret;
                         }
                 }
-
-                if (r < 0) {
-                        if (ret >= 0)
-                                ret = r;
-
-                        return ret;
-                }
-
-                fclose(f);
-                f = NULL;
         } while (!done);
 
         return ret;
 }
 
-int cg_migrate_recursive(const char *cfrom, const char *pfrom, const char *cto, const char *pto, bool ignore_self, bool rem) {
-        int r, ret = 0;
+static int cg_migrate_recursive_at(int dfd, int tfd, bool ignore_self, bool rem) {
         _cleanup_closedir_ DIR *d = NULL;
-        char *fn;
+        const char *name;
+        int r, ret, fd;
 
-        assert(cfrom);
-        assert(pfrom);
-        assert(cto);
-        assert(pto);
+        ret = cg_migrate_at(dfd, tfd, ignore_self);
 
-        ret = cg_migrate(cfrom, pfrom, cto, pto, ignore_self);
+        d = cg_opendir_at(dfd);
+        if (!d) {
+                if (ret >= 0 && errno != ENOENT)
+                        ret = -errno;
 
-        r = cg_enumerate_subgroups(cfrom, pfrom, &d);
-        if (r < 0) {
-                if (ret >= 0 && r != -ENOENT)
-                        ret = r;
                 return ret;
         }
 
-        while ((r = cg_read_subgroup(d, &fn)) > 0) {
-                _cleanup_free_ char *p = NULL;
+        while ((r = cg_open_next_subgroup(d, &name, &fd)) > 0) {
+                int q;
 
-                p = strjoin(pfrom, "/", fn, NULL);
-                free(fn);
-                if (!p) {
-                        if (ret >= 0)
-                                ret = -ENOMEM;
+                q = cg_migrate_recursive_at(fd, tfd, ignore_self, rem);
+                if (q != 0 && ret >= 0)
+                        ret = q;
 
-                        return ret;
+                if (rem) {
+                        q = cg_rmdir_at(dirfd(d), name, fd);
+                        if (q < 0 && ret >= 0 && q != -EBUSY)
+                                ret = q;
                 }
 
-                r = cg_migrate_recursive(cfrom, p, cto, pto, ignore_self, rem);
-                if (r != 0 && ret >= 0)
-                        ret = r;
+                close_nointr_nofail(fd);
         }
 
         if (r < 0 && ret >= 0)
                 ret = r;
 
+        return ret;
+}
+
+static int cg_open_tasks(const char *controller, const char *path) {
+        _cleanup_free_ char *fs = NULL;
+        int r, fd;
+
+        r = cg_get_path_and_check(controller, path, "tasks", &fs);
+        if (r < 0)
+                return r;
+
+        fd = open(fs, O_WRONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd < 0)
+                return -errno;
+
+        return fd;
+}
+
+int cg_migrate(const char *cfrom, const char *pfrom, const char *cto, const char *pto, bool ignore_self) {
+        _cleanup_close_ int fd = -1, tfd = -1;
+
+        assert(cfrom);
+        assert(pfrom);
+        assert(cto);
+        assert(pto);
+
+        fd = cg_open(cfrom, pfrom);
+        if (fd < 0)
+                return fd == -ENOENT ? 0 : fd;
+
+        tfd = cg_open_tasks(cto, pto);
+        if (tfd < 0)
+                return tfd;
+
+        return cg_migrate_at(fd, tfd, ignore_self);
+}
+
+int cg_migrate_recursive(const char *cfrom, const char *pfrom, const char *cto, const char *pto, bool ignore_self, bool rem) {
+        _cleanup_close_ int fd = -1, tfd = -1;
+        int r, ret;
+
+        assert(cfrom);
+        assert(pfrom);
+        assert(cto);
+        assert(pto);
+
+        fd = cg_open(cfrom, pfrom);
+        if (fd < 0)
+                return fd == -ENOENT ? 0 : fd;
+
+        /* The target is opened once for all the groups we empty */
+        tfd = cg_open_tasks(cto, pto);
+        if (tfd < 0)
+                return tfd;
+
+        ret = cg_migrate_recursive_at(fd, tfd, ignore_self, rem);
+
         if (rem) {
                 r = cg_rmdir(cfrom, pfrom, true);
                 if (r < 0 && ret >= 0 && r != -ENOENT && r != -EBUSY)
@@ -497,6 +710,41 @@ int cg_migrate_recursive(const char *cfrom, const char *pfrom, const char *cto,
         return ret;
 }
 
+int cg_freezer_set_state(const char *path, bool frozen) {
+        _cleanup_free_ char *fs = NULL;
+        unsigned i;
+        int r;
+
+        assert(path);
+
+        r = cg_get_path("freezer", path, "freezer.state", &fs);
+        if (r < 0)
+                return r;
+
+        r = write_string_file(fs, frozen ? "FROZEN" : "THAWED");
+        if (r < 0)
+                return r;
+
+        if (!frozen)
+                return 0;
+
+        /* Freezing happens asynchronously, give it a moment */
+        for (i = 0; i < 10; i++) {
+                _cleanup_free_ char *state = NULL;
+
+                r = read_one_line_file(fs, &state);
+                if (r < 0)
+                        return r;
+
+                if (streq(state, "FROZEN"))
+                        return 0;
+
+                usleep(USEC_PER_MSEC);
+        }
+
+        return -ETIMEDOUT;
+}
+
 static const char *normalize_controller(const char *controller) {
 
         if (streq(controller, SYSTEMD_CGROUP_CONTROLLER))
@@ -594,35 +842,84 @@ int cg_get_path_and_check(const char *controller, const char *path, const char *
         return join_path(p, path, suffix, fs);
 }
 
-static int trim_cb(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
-        char *p;
-        bool is_sticky;
+static bool dir_is_priv_sticky_at(int fd) {
+        struct stat st;
 
-        if (typeflag != FTW_DP)
-                return 0;
+        /* Whether the cgroup directory fd is marked to stay */
 
-        if (ftwbuf->level < 1)
-                return 0;
+        if (fstatat(fd, "tasks", &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return false;
 
-        p = strappend(path, "/tasks");
-        if (!p) {
-                errno = ENOMEM;
-                return 1;
+        return
+                (st.st_uid == 0 || st.st_uid == getuid()) &&
+                (st.st_mode & S_ISVTX);
+}
+
+static int trim_fd(int fd, dev_t dev) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        int r = 0;
+
+        /* Removes the cgroups below fd, depth first and relative to
+         * their parents, so that no paths need to be built and
+         * looked up again. Takes possession of fd. */
+
+        d = fdopendir(fd);
+        if (!d) {
+                close_nointr_nofail(fd);
+                return -errno;
         }
 
-        is_sticky = file_is_priv_sticky(p) > 0;
-        free(p);
+        for (;;) {
+                struct stat st;
+                bool is_sticky;
+                int subfd, q;
 
-        if (is_sticky)
-                return 0;
+                errno = 0;
+                de = readdir(d);
+                if (!de) {
+                        if (errno > 0 && r == 0)
+                                r = -errno;
+                        break;
+                }
 
-        rmdir(path);
-        return 0;
+                if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN)
+                        continue;
+
+                if (streq(de->d_name, ".") || streq(de->d_name, ".."))
+                        continue;
+
+                subfd = openat(dirfd(d), de->d_name, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
+                if (subfd < 0) {
+                        if (errno != ENOENT && errno != ENOTDIR && r == 0)
+                                r = -errno;
+                        continue;
+                }
+
+                /* Stay on this hierarchy */
+                if (fstat(subfd, &st) < 0 || st.st_dev != dev) {
+                        close_nointr_nofail(subfd);
+                        continue;
+                }
+
+                is_sticky = dir_is_priv_sticky_at(subfd);
+
+                /* This closes subfd */
+                q = trim_fd(subfd, dev);
+                if (q < 0 && r == 0)
+                        r = q;
+
+                if (!is_sticky)
+                        unlinkat(dirfd(d), de->d_name, AT_REMOVEDIR);
+        }
+
+        return r;
 }
 
 int cg_trim(const char *controller, const char *path, bool delete_root) {
-        char *fs;
-        int r = 0;
+        _cleanup_free_ char *fs = NULL;
+        struct stat st;
+        int fd, r;
 
         assert(controller);
         assert(path);
@@ -631,31 +928,26 @@ int cg_trim(const char *controller, const char *path, bool delete_root) {
         if (r < 0)
                 return r;
 
-        errno = 0;
-        if (nftw(fs, trim_cb, 64, FTW_DEPTH|FTW_MOUNT|FTW_PHYS) < 0)
-                r = errno ? -errno : -EIO;
-
-        if (delete_root) {
-                bool is_sticky;
-                char *p;
+        fd = open(fs, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
+        if (fd < 0)
+                return -errno;
 
-                p = strappend(fs, "/tasks");
-                if (!p) {
-                        free(fs);
-                        return -ENOMEM;
-                }
+        if (fstat(fd, &st) < 0) {
+                r = -errno;
+                close_nointr_nofail(fd);
+                return r;
+        }
 
-                is_sticky = file_is_priv_sticky(p) > 0;
-                free(p);
+        if (delete_root && dir_is_priv_sticky_at(fd))
+                delete_root = false;
 
-                if (!is_sticky)
-                        if (rmdir(fs) < 0 && errno != ENOENT) {
-                                if (r == 0)
-                                        r = -errno;
-                        }
-        }
+        r = trim_fd(fd, st.st_dev);
 
-        free(fs);
+        if (delete_root)
+                if (rmdir(fs) < 0 && errno != ENOENT) {
+                        if (r == 0)
+                                r = -errno;
+                }
 
         return r;
 }
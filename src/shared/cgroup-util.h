@@ -35,6 +35,11 @@ int cg_read_pid(FILE *f, pid_t *_pid);
 int cg_enumerate_subgroups(const char *controller, const char *path, DIR **_d);
 int cg_read_subgroup(DIR *d, char **fn);
 
+/* Relative to a group directory fd, for walking trees without building paths */
+int cg_read_pid_list_at(int dfd, const char *fn, pid_t **pids, size_t *allocated, unsigned *n);
+DIR *cg_opendir_at(int dfd);
+int cg_open_next_subgroup(DIR *d, const char **name, int *fd);
+
 int cg_kill(const char *controller, const char *path, int sig, bool sigcont, bool ignore_self, Set *s);
 int cg_kill_recursive(const char *controller, const char *path, int sig, bool sigcont, bool ignore_self, bool remove, Set *s);
 int cg_kill_recursive_and_wait(const char *controller, const char *path, bool remove);
@@ -42,6 +47,9 @@ int cg_kill_recursive_and_wait(const char *controller, const char *path, bool re
 int cg_migrate(const char *cfrom, const char *pfrom, const char *cto, const char *pto, bool ignore_self);
 int cg_migrate_recursive(const char *cfrom, const char *pfrom, const char *cto, const char *pto, bool ignore_self, bool remove);
 
+/* Freezes or thaws the group of that path in the freezer hierarchy */
+int cg_freezer_set_state(const char *path, bool frozen);
+
 int cg_split_spec(const char *spec, char **controller, char **path);
 int cg_join_spec(const char *controller, const char *path, char **spec);
 int cg_fix_path(const char *path, char **result);
@@ -129,14 +129,23 @@ int config_item_perf_lookup(
         if (!section)
                 p = lookup(lvalue, strlen(lvalue));
         else {
+                size_t ls, ll;
                 char *key;
 
-                key = strjoin(section, ".", lvalue, NULL);
-                if (!key)
-                        return -ENOMEM;
+                /* Called for every assignment, so build the key on
+                 * the stack. Anything longer than a line cannot be in
+                 * the table anyway. */
+                ls = strlen(section);
+                ll = strlen(lvalue);
+                if (ls + 1 + ll >= LINE_MAX)
+                        return 0;
+
+                key = newa(char, ls + 1 + ll + 1);
+                memcpy(key, section, ls);
+                key[ls] = '.';
+                memcpy(key + ls + 1, lvalue, ll + 1);
 
-                p = lookup(key, strlen(key));
-                free(key);
+                p = lookup(key, ls + 1 + ll);
         }
 
         if (!p)
@@ -191,44 +200,79 @@ static int next_assignment(const char *unit,
         return 0;
 }
 
+/* Split a logical line into its pieces. Assignments are split at
+ * the first '=', everything else is kept whole for parse_line() to
+ * interpret. Returns 0 for lines that carry no information. */
+static int split_line(ConfigFile *c, unsigned line, const char *l) {
+        ConfigLine *cl;
+        char *t, *e;
+
+        assert(c);
+        assert(l);
+
+        l += strspn(l, WHITESPACE);
+        if (!*l || strchr(COMMENTS "\n", *l))
+                return 0;
+
+        t = arena_strdup(&c->arena, l);
+        if (!t)
+                return -ENOMEM;
+
+        t = strstrip(t);
+
+        if (!GREEDY_REALLOC(c->lines, c->n_allocated, c->n_lines + 1))
+                return -ENOMEM;
+
+        cl = c->lines + c->n_lines++;
+        cl->line = line;
+        cl->lvalue = t;
+        cl->rvalue = NULL;
+
+        if (startswith(t, ".include ") || *t == '[')
+                return 1;
+
+        e = strchr(t, '=');
+        if (!e)
+                return 1;
+
+        *e = 0;
+        cl->lvalue = strstrip(t);
+        cl->rvalue = strstrip(e + 1);
+
+        return 1;
+}
+
 /* Parse a variable assignment line */
 static int parse_line(const char* unit,
                       const char *filename,
-                      unsigned line,
+                      const ConfigLine *cl,
                       const char *sections,
                       ConfigItemLookup lookup,
                       void *table,
                       bool relaxed,
-                      char **section,
-                      char *l,
+                      Arena *arena,
+                      const char **section,
                       void *userdata) {
 
-        char *e;
+        const char *l;
 
         assert(filename);
-        assert(line > 0);
+        assert(cl);
         assert(lookup);
-        assert(l);
 
-        l = strstrip(l);
+        l = cl->lvalue;
 
-        if (!*l)
-                return 0;
-
-        if (strchr(COMMENTS "\n", *l))
-                return 0;
-
-        if (startswith(l, ".include ")) {
+        if (!cl->rvalue && startswith(l, ".include ")) {
                 char _cleanup_free_ *fn;
 
-                fn = file_in_same_dir(filename, strstrip(l+9));
+                fn = file_in_same_dir(filename, strstrip(strdupa(l+9)));
                 if (!fn)
                         return -ENOMEM;
 
                 return config_parse(unit, fn, NULL, sections, lookup, table, relaxed, userdata);
         }
 
-        if (*l == '[') {
+        if (!cl->rvalue && *l == '[') {
                 size_t k;
                 char *n;
 
@@ -236,27 +280,24 @@ static int parse_line(const char* unit,
                 assert(k > 0);
 
                 if (l[k-1] != ']') {
-                        log_syntax(unit, LOG_ERR, filename, line, EBADMSG,
+                        log_syntax(unit, LOG_ERR, filename, cl->line, EBADMSG,
                                    "Invalid section header '%s'", l);
                         return -EBADMSG;
                 }
 
-                n = strndup(l+1, k-2);
+                n = arena_strndup(arena, l+1, k-2);
                 if (!n)
                         return -ENOMEM;
 
                 if (sections && !nulstr_contains(sections, n)) {
 
                         if (!relaxed)
-                                log_syntax(unit, LOG_WARNING, filename, line, EINVAL,
+                                log_syntax(unit, LOG_WARNING, filename, cl->line, EINVAL,
                                            "Unknown section '%s'. Ignoring.", n);
 
-                        free(n);
                         *section = NULL;
-                } else {
-                        free(*section);
+                } else
                         *section = n;
-                }
 
                 return 0;
         }
@@ -264,81 +305,92 @@ static int parse_line(const char* unit,
         if (sections && !*section) {
 
                 if (!relaxed)
-                        log_syntax(unit, LOG_WARNING, filename, line, EINVAL,
+                        log_syntax(unit, LOG_WARNING, filename, cl->line, EINVAL,
                                    "Assignment outside of section. Ignoring.");
 
                 return 0;
         }
 
-        e = strchr(l, '=');
-        if (!e) {
-                log_syntax(unit, LOG_WARNING, filename, line, EINVAL, "Missing '='.");
+        if (!cl->rvalue) {
+                log_syntax(unit, LOG_WARNING, filename, cl->line, EINVAL, "Missing '='.");
                 return -EBADMSG;
         }
 
-        *e = 0;
-        e++;
-
         return next_assignment(unit,
                                filename,
-                               line,
+                               cl->line,
                                lookup,
                                table,
                                *section,
-                               strstrip(l),
-                               strstrip(e),
+                               cl->lvalue,
+                               cl->rvalue,
                                relaxed,
                                userdata);
 }
 
-/* Go through the file and parse each line */
-int config_parse(const char *unit,
-                 const char *filename,
-                 FILE *f,
-                 const char *sections,
-                 ConfigItemLookup lookup,
-                 void *table,
-                 bool relaxed,
-                 void *userdata) {
+void config_file_free(ConfigFile *c) {
+        if (!c)
+                return;
+
+        arena_free(&c->arena);
+        free(c->lines);
+        free(c->filename);
+        free(c);
+}
 
+/* Go through the file and split it into lines, joining continuation
+ * lines. This does not log and does not touch any global state, so
+ * that it may be called from other threads. */
+int config_file_read(const char *filename, FILE *f, ConfigFile **ret) {
         unsigned line = 0;
-        char _cleanup_free_ *section = NULL, *continuation = NULL;
+        char _cleanup_free_ *continuation = NULL;
         FILE _cleanup_fclose_ *ours = NULL;
+        ConfigFile *c;
         int r;
 
         assert(filename);
-        assert(lookup);
+        assert(ret);
 
         if (!f) {
                 f = ours = fopen(filename, "re");
-                if (!f) {
-                        log_error("Failed to open configuration file '%s': %m", filename);
+                if (!f)
                         return -errno;
-                }
+        }
+
+        c = new0(ConfigFile, 1);
+        if (!c)
+                return -ENOMEM;
+
+        c->filename = strdup(filename);
+        if (!c->filename) {
+                r = -ENOMEM;
+                goto fail;
         }
 
         while (!feof(f)) {
-                char l[LINE_MAX], *p, *c = NULL, *e;
+                char l[LINE_MAX], *p, *cc = NULL, *e;
                 bool escaped = false;
 
                 if (!fgets(l, sizeof(l), f)) {
                         if (feof(f))
                                 break;
 
-                        log_error("Failed to read configuration file '%s': %m", filename);
-                        return -errno;
+                        r = errno > 0 ? -errno : -EIO;
+                        goto fail;
                 }
 
                 truncate_nl(l);
 
                 if (continuation) {
-                        c = strappend(continuation, l);
-                        if (!c)
-                                return -ENOMEM;
+                        cc = strappend(continuation, l);
+                        if (!cc) {
+                                r = -ENOMEM;
+                                goto fail;
+                        }
 
                         free(continuation);
                         continuation = NULL;
-                        p = c;
+                        p = cc;
                 } else
                         p = l;
 
@@ -352,34 +404,99 @@ int config_parse(const char *unit,
                 if (escaped) {
                         *(e-1) = ' ';
 
-                        if (c)
-                                continuation = c;
+                        if (cc)
+                                continuation = cc;
                         else {
                                 continuation = strdup(l);
-                                if (!continuation)
-                                        return -ENOMEM;
+                                if (!continuation) {
+                                        r = -ENOMEM;
+                                        goto fail;
+                                }
                         }
 
                         continue;
                 }
 
+                r = split_line(c, ++line, p);
+                free(cc);
+
+                if (r < 0)
+                        goto fail;
+        }
+
+        *ret = c;
+        return 0;
+
+fail:
+        config_file_free(c);
+        return r;
+}
+
+/* Run the assignments of a file that was read before */
+int config_file_apply(const char *unit,
+                      const ConfigFile *c,
+                      const char *sections,
+                      ConfigItemLookup lookup,
+                      void *table,
+                      bool relaxed,
+                      void *userdata) {
+
+        const char *section = NULL;
+        Arena arena = {};
+        unsigned i;
+        int r = 0;
+
+        assert(c);
+        assert(lookup);
+
+        /* Section names only live as long as this, so allocate them
+         * together */
+
+        for (i = 0; i < c->n_lines; i++) {
                 r = parse_line(unit,
-                               filename,
-                               ++line,
+                               c->filename,
+                               c->lines + i,
                                sections,
                                lookup,
                                table,
                                relaxed,
+                               &arena,
                                &section,
-                               p,
                                userdata);
-                free(c);
-
                 if (r < 0)
-                        return r;
+                        break;
         }
 
-        return 0;
+        arena_free(&arena);
+
+        return r < 0 ? r : 0;
+}
+
+int config_parse(const char *unit,
+                 const char *filename,
+                 FILE *f,
+                 const char *sections,
+                 ConfigItemLookup lookup,
+                 void *table,
+                 bool relaxed,
+                 void *userdata) {
+
+        ConfigFile *c;
+        int r;
+
+        assert(filename);
+        assert(lookup);
+
+        r = config_file_read(filename, f, &c);
+        if (r < 0) {
+                log_error("Failed to read configuration file '%s': %s", filename, strerror(-r));
+                return r;
+        }
+
+        r = config_file_apply(unit, c, sections, lookup, table, relaxed, userdata);
+        config_file_free(c);
+
+        return r;
 }
 
 #define DEFINE_PARSER(type, vartype, conv_func)                         \
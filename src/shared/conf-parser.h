@@ -25,6 +25,7 @@
 #include <stdbool.h>
 
 #include "macro.h"
+#include "arena.h"
 
 /* An abstract parser for simple, line based, shallow configuration
  * files consisting of variable assignments only. */
@@ -80,6 +81,36 @@ int config_item_table_lookup(void *table, const char *section, const char *lvalu
  * ConfigPerfItem tables */
 int config_item_perf_lookup(void *table, const char *section, const char *lvalue, ConfigParserCallback *func, int *ltype, void **data, void *userdata);
 
+/* One logical line of a configuration file, with continuation lines
+ * joined and whitespace stripped. For assignments lvalue and rvalue
+ * are split, for anything else rvalue is NULL. */
+typedef struct ConfigLine {
+        unsigned line;
+        char *lvalue;
+        char *rvalue;
+} ConfigLine;
+
+/* A configuration file that has been read but not interpreted yet */
+typedef struct ConfigFile {
+        char *filename;
+        ConfigLine *lines;
+        unsigned n_lines;
+        size_t n_allocated;
+
+        /* Backs the strings of all lines */
+        Arena arena;
+} ConfigFile;
+
+int config_file_read(const char *filename, FILE *f, ConfigFile **ret);
+int config_file_apply(const char *unit,
+                      const ConfigFile *c,
+                      const char *sections,  /* nulstr */
+                      ConfigItemLookup lookup,
+                      void *table,
+                      bool relaxed,
+                      void *userdata);
+void config_file_free(ConfigFile *c);
+
 int config_parse(const char *unit,
                  const char *filename,
                  FILE *f,
@@ -265,6 +265,90 @@ const char *bus_error(const DBusError *error, int err) {
         return strerror(err < 0 ? -err : err);
 }
 
+/* Appends one property as dictionary entry to an open a{sv} array */
+static int bus_append_property(DBusMessageIter *iter, const BusBoundProperties *bp, const BusProperty *p) {
+        DBusMessageIter sub, sub2;
+        void *data;
+        int r;
+
+        if (!dbus_message_iter_open_container(iter, DBUS_TYPE_DICT_ENTRY, NULL, &sub) ||
+            !dbus_message_iter_append_basic(&sub, DBUS_TYPE_STRING, &p->property) ||
+            !dbus_message_iter_open_container(&sub, DBUS_TYPE_VARIANT, p->signature, &sub2))
+                return -ENOMEM;
+
+        data = (char*)bp->base + p->offset;
+        if (p->indirect)
+                data = *(void**)data;
+        r = p->append(&sub2, p->property, data);
+        if (r < 0)
+                return r;
+
+        if (!dbus_message_iter_close_container(&sub, &sub2) ||
+            !dbus_message_iter_close_container(iter, &sub))
+                return -ENOMEM;
+
+        return 0;
+}
+
+static const BusProperty *bus_find_property(
+                const BusBoundProperties *bound_properties,
+                const BusBoundProperties *end,
+                const char *name,
+                const BusBoundProperties **ret) {
+
+        const BusBoundProperties *bp;
+        const BusProperty *p;
+
+        for (bp = bound_properties; bp->interface && (!end || bp < end); bp++)
+                for (p = bp->properties; p->property; p++)
+                        if (streq(p->property, name)) {
+                                if (ret)
+                                        *ret = bp;
+                                return p;
+                        }
+
+        return NULL;
+}
+
+/* Appends the named properties to an open a{sv} array, or all of
+ * them if none are named. Names that are unknown are skipped, and
+ * properties bound under several interfaces are added only once. */
+int bus_append_bound_properties(DBusMessageIter *iter, const BusBoundProperties *bound_properties, char **properties) {
+        const BusBoundProperties *bp;
+        const BusProperty *p;
+        char **name;
+        int r;
+
+        assert(iter);
+        assert(bound_properties);
+
+        if (strv_isempty(properties)) {
+                for (bp = bound_properties; bp->interface; bp++)
+                        for (p = bp->properties; p->property; p++) {
+                                if (bus_find_property(bound_properties, bp, p->property, NULL))
+                                        continue;
+
+                                r = bus_append_property(iter, bp, p);
+                                if (r < 0)
+                                        return r;
+                        }
+
+                return 0;
+        }
+
+        STRV_FOREACH(name, properties) {
+                p = bus_find_property(bound_properties, NULL, *name, &bp);
+                if (!p)
+                        continue;
+
+                r = bus_append_property(iter, bp, p);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
 DBusHandlerResult bus_default_message_handler(
                 DBusConnection *c,
                 DBusMessage *message,
@@ -349,7 +433,7 @@ get_prop:
                 const char *interface;
                 const BusBoundProperties *bp;
                 const BusProperty *p;
-                DBusMessageIter iter, sub, sub2, sub3;
+                DBusMessageIter iter, sub;
 
                 if (!dbus_message_get_args(
                             message,
@@ -377,25 +461,11 @@ get_prop:
                                 continue;
 
                         for (p = bp->properties; p->property; p++) {
-                                void *data;
-
-                                if (!dbus_message_iter_open_container(&sub, DBUS_TYPE_DICT_ENTRY, NULL, &sub2) ||
-                                    !dbus_message_iter_append_basic(&sub2, DBUS_TYPE_STRING, &p->property) ||
-                                    !dbus_message_iter_open_container(&sub2, DBUS_TYPE_VARIANT, p->signature, &sub3))
-                                        goto oom;
-
-                                data = (char*)bp->base + p->offset;
-                                if (p->indirect)
-                                        data = *(void**)data;
-                                r = p->append(&sub3, p->property, data);
+                                r = bus_append_property(&sub, bp, p);
                                 if (r == -ENOMEM)
                                         goto oom;
                                 if (r < 0)
                                         return bus_send_error_reply(c, message, NULL, r);
-
-                                if (!dbus_message_iter_close_container(&sub2, &sub3) ||
-                                    !dbus_message_iter_close_container(&sub, &sub2))
-                                        goto oom;
                         }
                 }
 
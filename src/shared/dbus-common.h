@@ -131,6 +131,8 @@ DBusHandlerResult bus_default_message_handler(
                 const char *interfaces,
                 const BusBoundProperties *bound_properties);
 
+int bus_append_bound_properties(DBusMessageIter *iter, const BusBoundProperties *bound_properties, char **properties);
+
 int bus_property_append_string(DBusMessageIter *i, const char *property, void *data);
 int bus_property_append_strv(DBusMessageIter *i, const char *property, void *data);
 int bus_property_append_bool(DBusMessageIter *i, const char *property, void *data);
@@ -21,10 +21,8 @@
 
 #include <stdbool.h>
 #include <assert.h>
-#include <sys/epoll.h>
 #include <string.h>
 #include <errno.h>
-#include <sys/timerfd.h>
 #include <unistd.h>
 
 #include "dbus-loop.h"
@@ -32,218 +30,198 @@
 #include "util.h"
 
 /* Minimal implementation of the dbus loop which integrates all dbus
- * events into a single epoll fd which we can triviall integrate with
- * other loops. Note that this is not used in the main systemd daemon
+ * events into an event loop whose single fd we can trivially
+ * integrate with other loops. D-Bus toggles its watches and timeouts
+ * a lot, which the event loop folds into at most one epoll_ctl() per
+ * iteration. Note that this is not used in the main systemd daemon
  * since we run a more elaborate mainloop there. */
 
-typedef struct EpollData {
-        int fd;
-        void *object;
-        bool is_timeout:1;
-        bool fd_is_dupped:1;
-} EpollData;
+typedef struct WatchData {
+        EventSource *source;
+        int dup_fd;
+} WatchData;
+
+static int watch_handler(EventSource *s, int fd, uint32_t revents, void *userdata) {
+        DBusWatch *watch = userdata;
+
+        assert(watch);
+
+        if (dbus_watch_get_enabled(watch))
+                dbus_watch_handle(watch, bus_events_to_flags(revents));
+
+        return 0;
+}
 
 static dbus_bool_t add_watch(DBusWatch *watch, void *data) {
-        EpollData _cleanup_free_ *e = NULL;
-        struct epoll_event ev = {};
+        _cleanup_free_ WatchData *d = NULL;
+        EventLoop *e = data;
+        int fd, r;
 
         assert(watch);
+        assert(e);
 
-        e = new0(EpollData, 1);
-        if (!e)
+        d = new0(WatchData, 1);
+        if (!d)
                 return FALSE;
 
-        e->fd = dbus_watch_get_unix_fd(watch);
-        e->object = watch;
-        e->is_timeout = false;
-
-        ev.events = bus_flags_to_events(watch);
-        ev.data.ptr = e;
+        d->dup_fd = -1;
 
-        if (epoll_ctl(PTR_TO_INT(data), EPOLL_CTL_ADD, e->fd, &ev) < 0) {
+        fd = dbus_watch_get_unix_fd(watch);
 
-                if (errno != EEXIST)
-                        return FALSE;
+        r = event_add_io(e, fd, bus_flags_to_events(watch), watch_handler, watch, &d->source);
+        if (r == -EEXIST) {
 
                 /* Hmm, bloody D-Bus creates multiple watches on the
                  * same fd. epoll() does not like that. As a dirty
                  * hack we simply dup() the fd and hence get a second
                  * one we can safely add to the epoll(). */
 
-                e->fd = dup(e->fd);
-                if (e->fd < 0)
+                d->dup_fd = dup(fd);
+                if (d->dup_fd < 0)
                         return FALSE;
 
-                if (epoll_ctl(PTR_TO_INT(data), EPOLL_CTL_ADD, e->fd, &ev) < 0) {
-                        close_nointr_nofail(e->fd);
+                r = event_add_io(e, d->dup_fd, bus_flags_to_events(watch), watch_handler, watch, &d->source);
+                if (r < 0) {
+                        close_nointr_nofail(d->dup_fd);
                         return FALSE;
                 }
 
-                e->fd_is_dupped = true;
-        }
+        } else if (r < 0)
+                return FALSE;
+
+        /* Disabled watches still get EPOLLHUP, hence keep them out
+         * of the epoll entirely */
+        if (!dbus_watch_get_enabled(watch))
+                event_source_set_enabled(d->source, false);
 
-        dbus_watch_set_data(watch, e, NULL);
-        e = NULL; /* prevent freeing */
+        dbus_watch_set_data(watch, d, NULL);
+        d = NULL; /* prevent freeing */
 
         return TRUE;
 }
 
 static void remove_watch(DBusWatch *watch, void *data) {
-        EpollData _cleanup_free_ *e = NULL;
+        _cleanup_free_ WatchData *d = NULL;
 
         assert(watch);
 
-        e = dbus_watch_get_data(watch);
-        if (!e)
+        d = dbus_watch_get_data(watch);
+        if (!d)
                 return;
 
-        assert_se(epoll_ctl(PTR_TO_INT(data), EPOLL_CTL_DEL, e->fd, NULL) >= 0);
+        dbus_watch_set_data(watch, NULL, NULL);
 
-        if (e->fd_is_dupped)
-                close_nointr_nofail(e->fd);
+        event_source_free(d->source);
+
+        if (d->dup_fd >= 0)
+                close_nointr_nofail(d->dup_fd);
 }
 
 static void toggle_watch(DBusWatch *watch, void *data) {
-        EpollData *e;
-        struct epoll_event ev = {};
+        WatchData *d;
 
         assert(watch);
 
-        e = dbus_watch_get_data(watch);
-        if (!e)
+        d = dbus_watch_get_data(watch);
+        if (!d)
                 return;
 
-        ev.data.ptr = e;
-        ev.events = bus_flags_to_events(watch);
-
-        assert_se(epoll_ctl(PTR_TO_INT(data), EPOLL_CTL_MOD, e->fd, &ev) == 0);
+        /* Both only take effect when the loop is about to wait
+         * again, so toggling back and forth is cheap */
+        event_source_set_io_events(d->source, bus_flags_to_events(watch));
+        event_source_set_enabled(d->source, dbus_watch_get_enabled(watch));
 }
 
-static int timeout_arm(EpollData *e) {
-        struct itimerspec its = {};
+static int timeout_arm(EventSource *s, DBusTimeout *timeout) {
+        int r;
 
-        assert(e);
-        assert(e->is_timeout);
+        assert(s);
+        assert(timeout);
 
-        if (dbus_timeout_get_enabled(e->object)) {
-                timespec_store(&its.it_value, dbus_timeout_get_interval(e->object) * USEC_PER_MSEC);
-                its.it_interval = its.it_value;
+        if (dbus_timeout_get_enabled(timeout)) {
+                r = event_source_set_time(s, now(CLOCK_MONOTONIC) + dbus_timeout_get_interval(timeout) * USEC_PER_MSEC);
+                if (r < 0)
+                        return r;
         }
 
-        if (timerfd_settime(e->fd, 0, &its, NULL) < 0)
-                return -errno;
-
-        return 0;
+        return event_source_set_enabled(s, dbus_timeout_get_enabled(timeout));
 }
 
-static dbus_bool_t add_timeout(DBusTimeout *timeout, void *data) {
-        EpollData *e;
-        struct epoll_event ev = {};
+static int timeout_handler(EventSource *s, usec_t usec, void *userdata) {
+        DBusTimeout *timeout = userdata;
+        int r;
 
         assert(timeout);
 
-        e = new0(EpollData, 1);
-        if (!e)
-                return FALSE;
-
-        e->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
-        if (e->fd < 0)
-                goto fail;
+        /* D-Bus timeouts are periodic, our timers are not. Rearm
+         * first, since handling the timeout might remove it. */
+        r = timeout_arm(s, timeout);
+        if (r < 0)
+                return r;
 
-        e->object = timeout;
-        e->is_timeout = true;
+        dbus_timeout_handle(timeout);
 
-        if (timeout_arm(e) < 0)
-                goto fail;
+        return 0;
+}
 
-        ev.events = EPOLLIN;
-        ev.data.ptr = e;
+static dbus_bool_t add_timeout(DBusTimeout *timeout, void *data) {
+        EventLoop *e = data;
+        EventSource *s;
+        int r;
 
-        if (epoll_ctl(PTR_TO_INT(data), EPOLL_CTL_ADD, e->fd, &ev) < 0)
-                goto fail;
+        assert(timeout);
+        assert(e);
 
-        dbus_timeout_set_data(timeout, e, NULL);
+        r = event_add_time(e, 0, timeout_handler, timeout, &s);
+        if (r < 0)
+                return FALSE;
 
-        return TRUE;
+        r = timeout_arm(s, timeout);
+        if (r < 0) {
+                event_source_free(s);
+                return FALSE;
+        }
 
-fail:
-        if (e->fd >= 0)
-                close_nointr_nofail(e->fd);
+        dbus_timeout_set_data(timeout, s, NULL);
 
-        free(e);
-        return FALSE;
+        return TRUE;
 }
 
 static void remove_timeout(DBusTimeout *timeout, void *data) {
-        EpollData _cleanup_free_ *e = NULL;
+        EventSource *s;
 
         assert(timeout);
 
-        e = dbus_timeout_get_data(timeout);
-        if (!e)
+        s = dbus_timeout_get_data(timeout);
+        if (!s)
                 return;
 
-        assert_se(epoll_ctl(PTR_TO_INT(data), EPOLL_CTL_DEL, e->fd, NULL) >= 0);
-        close_nointr_nofail(e->fd);
+        dbus_timeout_set_data(timeout, NULL, NULL);
+        event_source_free(s);
 }
 
 static void toggle_timeout(DBusTimeout *timeout, void *data) {
-        EpollData *e;
+        EventSource *s;
         int r;
 
         assert(timeout);
 
-        e = dbus_timeout_get_data(timeout);
-        if (!e)
+        s = dbus_timeout_get_data(timeout);
+        if (!s)
                 return;
 
-        r = timeout_arm(e);
+        r = timeout_arm(s, timeout);
         if (r < 0)
                 log_error("Failed to rearm timer: %s", strerror(-r));
 }
 
-int bus_loop_open(DBusConnection *c) {
-        int fd;
-
+int bus_loop_open(DBusConnection *c, EventLoop *e) {
         assert(c);
+        assert(e);
 
-        fd = epoll_create1(EPOLL_CLOEXEC);
-        if (fd < 0)
-                return -errno;
-
-        if (!dbus_connection_set_watch_functions(c, add_watch, remove_watch, toggle_watch, INT_TO_PTR(fd), NULL) ||
-            !dbus_connection_set_timeout_functions(c, add_timeout, remove_timeout, toggle_timeout, INT_TO_PTR(fd), NULL)) {
-                close_nointr_nofail(fd);
+        if (!dbus_connection_set_watch_functions(c, add_watch, remove_watch, toggle_watch, e, NULL) ||
+            !dbus_connection_set_timeout_functions(c, add_timeout, remove_timeout, toggle_timeout, e, NULL))
                 return -ENOMEM;
-        }
-
-        return fd;
-}
-
-int bus_loop_dispatch(int fd) {
-        int n;
-        struct epoll_event event = {};
-        EpollData *d;
-
-        assert(fd >= 0);
-
-        n = epoll_wait(fd, &event, 1, 0);
-        if (n < 0)
-                return errno == EAGAIN || errno == EINTR ? 0 : -errno;
-
-        assert_se(d = event.data.ptr);
-
-        if (d->is_timeout) {
-                DBusTimeout *t = d->object;
-
-                if (dbus_timeout_get_enabled(t))
-                        dbus_timeout_handle(t);
-        } else {
-                DBusWatch *w = d->object;
-
-                if (dbus_watch_get_enabled(w))
-                        dbus_watch_handle(w, bus_events_to_flags(event.events));
-        }
 
         return 0;
 }
@@ -23,5 +23,6 @@
 
 #include <dbus/dbus.h>
 
-int bus_loop_open(DBusConnection *c);
-int bus_loop_dispatch(int fd);
+#include "event-loop.h"
+
+int bus_loop_open(DBusConnection *c, EventLoop *e);
@@ -31,5 +31,13 @@
 
 #define SYSTEMD_CGROUP_CONTROLLER "name=systemd"
 
+/* Written by the system manager when bootup finished, for
+ * systemd-analyze --offline */
+#define BOOT_TIMING_PATH "/run/systemd/boot-timing"
+
+/* Datagram socket of the system manager, told by
+ * systemd-cgroups-agent about groups that ran empty */
+#define CGROUPS_AGENT_SOCKET "/run/systemd/cgroups-agent"
+
 #define SIGNALS_CRASH_HANDLER SIGSEGV,SIGILL,SIGFPE,SIGBUS,SIGQUIT,SIGABRT
 #define SIGNALS_IGNORE SIGKILL,SIGPIPE
@@ -354,6 +354,31 @@ fail:
         return NULL;
 }
 
+int strv_env_replace(char ***l, char *p) {
+        char **f;
+        size_t n;
+
+        assert(l);
+        assert(p);
+
+        /* Like strv_env_set(), but edits *l in place and takes
+         * ownership of p instead of copying everything, so that
+         * assigning many variables one by one stays cheap */
+
+        n = strcspn(p, "=");
+        if (p[n] == '=')
+                n++;
+
+        STRV_FOREACH(f, *l)
+                if (strneq(*f, p, n)) {
+                        free(*f);
+                        *f = p;
+                        return 0;
+                }
+
+        return strv_push(l, p);
+}
+
 char *strv_env_get_n(char **l, const char *name, size_t k) {
         char **i;
 
@@ -38,6 +38,7 @@ char **strv_env_merge(unsigned n_lists, ...);
 char **strv_env_delete(char **x, unsigned n_lists, ...); /* New copy */
 
 char **strv_env_set(char **x, const char *p); /* New copy ... */
+int strv_env_replace(char ***l, char *p); /* In place, takes ownership of p */
 char **strv_env_unset(char **l, const char *p); /* In place ... */
 
 char *strv_env_get_n(char **l, const char *name, size_t k);
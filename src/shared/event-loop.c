@@ -0,0 +1,1085 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "macro.h"
+#include "list.h"
+#include "hashmap.h"
+#include "prioq.h"
+#include "log.h"
+#include "event-loop.h"
+
+/* How many epoll events to fetch at once */
+#define EPOLL_QUEUE_MAX 64
+
+typedef enum EventSourceType {
+        SOURCE_IO,
+        SOURCE_TIME,
+        SOURCE_SIGNAL,
+        SOURCE_CHILD,
+        SOURCE_DEFER
+} EventSourceType;
+
+struct EventSource {
+        EventLoop *loop;
+        EventSourceType type;
+        void *userdata;
+        event_prepare_handler_t prepare_callback;
+
+        bool enabled:1;
+        bool in_dirty:1;
+
+        /* Freed from a callback, and waiting for the end of the
+         * iteration to actually go away */
+        bool dead:1;
+
+        LIST_FIELDS(EventSource, sources);
+        LIST_FIELDS(EventSource, dirty);
+        LIST_FIELDS(EventSource, prepare);
+        LIST_FIELDS(EventSource, defer);
+
+        union {
+                struct {
+                        event_io_handler_t callback;
+                        int fd;
+                        uint32_t events;
+                        uint32_t registered_events;
+                        bool registered;
+                } io;
+                struct {
+                        event_time_handler_t callback;
+                        usec_t next;
+                        unsigned prioq_index;
+                        unsigned iteration;
+                } time;
+                struct {
+                        event_signal_handler_t callback;
+                        int sig;
+                } signal;
+                struct {
+                        event_child_handler_t callback;
+                        pid_t pid;
+                        int options;
+                } child;
+                struct {
+                        event_defer_handler_t callback;
+                } defer;
+        };
+};
+
+struct EventLoop {
+        int epoll_fd;
+        int timer_fd;
+        int signal_fd;
+
+        /* Enabled timer sources, and the time the timerfd is armed
+         * for */
+        Prioq *timers;
+        usec_t timer_armed;
+
+        sigset_t sigset;
+        EventSource *signal_sources[_NSIG];
+
+        Hashmap *child_sources;
+        unsigned n_enabled_child_sources;
+
+        LIST_HEAD(EventSource, sources);
+        LIST_HEAD(EventSource, garbage);
+
+        /* IO sources whose epoll registration is out of date */
+        LIST_HEAD(EventSource, dirty);
+
+        LIST_HEAD(EventSource, prepare);
+        LIST_HEAD(EventSource, defer);
+
+        unsigned iteration;
+        unsigned n_dispatched;
+
+        bool iterating:1;
+        bool exit_requested:1;
+        int exit_code;
+};
+
+static int time_compare(const void *a, const void *b) {
+        const EventSource *x = a, *y = b;
+
+        if (x->time.next < y->time.next)
+                return -1;
+        if (x->time.next > y->time.next)
+                return 1;
+
+        return 0;
+}
+
+int event_loop_new(EventLoop **ret) {
+        struct epoll_event ev = {
+                .events = EPOLLIN,
+        };
+        EventLoop *e;
+        int r;
+
+        assert(ret);
+
+        e = new0(EventLoop, 1);
+        if (!e)
+                return -ENOMEM;
+
+        e->epoll_fd = e->timer_fd = e->signal_fd = -1;
+        e->timer_armed = (usec_t) -1;
+        sigemptyset(&e->sigset);
+
+        e->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (e->epoll_fd < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        e->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+        if (e->timer_fd < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        ev.data.ptr = &e->timer_fd;
+        if (epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, e->timer_fd, &ev) < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        *ret = e;
+        return 0;
+
+fail:
+        event_loop_free(e);
+        return r;
+}
+
+static void source_free_now(EventSource *s);
+
+void event_loop_free(EventLoop *e) {
+        EventSource *s;
+
+        if (!e)
+                return;
+
+        assert(!e->iterating);
+
+        while ((s = e->sources)) {
+                LIST_REMOVE(EventSource, sources, e->sources, s);
+                source_free_now(s);
+        }
+
+        if (e->signal_fd >= 0)
+                close_nointr_nofail(e->signal_fd);
+        if (e->timer_fd >= 0)
+                close_nointr_nofail(e->timer_fd);
+        if (e->epoll_fd >= 0)
+                close_nointr_nofail(e->epoll_fd);
+
+        prioq_free(e->timers);
+        hashmap_free(e->child_sources);
+
+        free(e);
+}
+
+int event_loop_get_fd(EventLoop *e) {
+        if (!e)
+                return -EINVAL;
+
+        return e->epoll_fd;
+}
+
+static EventSource *source_new(EventLoop *e, EventSourceType type) {
+        EventSource *s;
+
+        assert(e);
+
+        s = new0(EventSource, 1);
+        if (!s)
+                return NULL;
+
+        s->loop = e;
+        s->type = type;
+        s->enabled = true;
+
+        LIST_PREPEND(EventSource, sources, e->sources, s);
+
+        return s;
+}
+
+static int io_update(EventSource *s) {
+        struct epoll_event ev = {};
+
+        assert(s);
+        assert(s->type == SOURCE_IO);
+
+        if (s->enabled && !s->dead) {
+                if (s->io.registered && s->io.registered_events == s->io.events)
+                        return 0;
+
+                ev.events = s->io.events;
+                ev.data.ptr = s;
+
+                if (epoll_ctl(s->loop->epoll_fd,
+                              s->io.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                              s->io.fd, &ev) < 0)
+                        return -errno;
+
+                s->io.registered = true;
+                s->io.registered_events = s->io.events;
+
+        } else if (s->io.registered) {
+                /* The fd might have been closed already, in which
+                 * case the kernel dropped it for us */
+                epoll_ctl(s->loop->epoll_fd, EPOLL_CTL_DEL, s->io.fd, NULL);
+                s->io.registered = false;
+        }
+
+        return 0;
+}
+
+static void io_mark_dirty(EventSource *s) {
+        assert(s);
+
+        if (s->in_dirty)
+                return;
+
+        LIST_PREPEND(EventSource, dirty, s->loop->dirty, s);
+        s->in_dirty = true;
+}
+
+static bool signal_wanted(EventLoop *e, int sig) {
+        EventSource *s;
+
+        s = e->signal_sources[sig];
+        if (s && s->enabled && !s->dead)
+                return true;
+
+        return sig == SIGCHLD && e->n_enabled_child_sources > 0;
+}
+
+static int signal_update(EventLoop *e, int sig) {
+        struct epoll_event ev = {
+                .events = EPOLLIN,
+        };
+        bool add;
+        int fd, r;
+
+        assert(e);
+
+        add = signal_wanted(e, sig);
+        if (add == !!sigismember(&e->sigset, sig))
+                return 0;
+
+        if (add)
+                assert_se(sigaddset(&e->sigset, sig) == 0);
+        else
+                assert_se(sigdelset(&e->sigset, sig) == 0);
+
+        fd = signalfd(e->signal_fd, &e->sigset, SFD_NONBLOCK|SFD_CLOEXEC);
+        if (fd < 0) {
+                r = -errno;
+                goto fail;
+        }
+
+        if (e->signal_fd < 0) {
+                ev.data.ptr = &e->signal_fd;
+                if (epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                        r = -errno;
+                        close_nointr_nofail(fd);
+                        goto fail;
+                }
+
+                e->signal_fd = fd;
+        }
+
+        return 0;
+
+fail:
+        if (add)
+                sigdelset(&e->sigset, sig);
+        else
+                sigaddset(&e->sigset, sig);
+
+        return r;
+}
+
+int event_add_io(EventLoop *e, int fd, uint32_t events, event_io_handler_t callback, void *userdata, EventSource **ret) {
+        EventSource *s;
+        int r;
+
+        if (!e)
+                return -EINVAL;
+        if (fd < 0)
+                return -EINVAL;
+        if (!callback)
+                return -EINVAL;
+
+        s = source_new(e, SOURCE_IO);
+        if (!s)
+                return -ENOMEM;
+
+        s->userdata = userdata;
+        s->io.callback = callback;
+        s->io.fd = fd;
+        s->io.events = events;
+
+        /* Register right away, so that errors such as EEXIST are
+         * reported to the caller */
+        r = io_update(s);
+        if (r < 0) {
+                event_source_free(s);
+                return r;
+        }
+
+        if (ret)
+                *ret = s;
+
+        return 0;
+}
+
+int event_add_time(EventLoop *e, usec_t usec, event_time_handler_t callback, void *userdata, EventSource **ret) {
+        EventSource *s;
+        int r;
+
+        if (!e)
+                return -EINVAL;
+        if (!callback)
+                return -EINVAL;
+
+        r = prioq_ensure_allocated(&e->timers, time_compare);
+        if (r < 0)
+                return r;
+
+        s = source_new(e, SOURCE_TIME);
+        if (!s)
+                return -ENOMEM;
+
+        s->userdata = userdata;
+        s->time.callback = callback;
+        s->time.next = usec;
+
+        r = prioq_put(e->timers, s, &s->time.prioq_index);
+        if (r < 0) {
+                s->enabled = false;
+                event_source_free(s);
+                return r;
+        }
+
+        if (ret)
+                *ret = s;
+
+        return 0;
+}
+
+int event_add_signal(EventLoop *e, int sig, event_signal_handler_t callback, void *userdata, EventSource **ret) {
+        EventSource *s;
+        int r;
+
+        if (!e)
+                return -EINVAL;
+        if (sig <= 0 || sig >= _NSIG)
+                return -EINVAL;
+        if (!callback)
+                return -EINVAL;
+
+        if (e->signal_sources[sig])
+                return -EBUSY;
+
+        s = source_new(e, SOURCE_SIGNAL);
+        if (!s)
+                return -ENOMEM;
+
+        s->userdata = userdata;
+        s->signal.callback = callback;
+        s->signal.sig = sig;
+        e->signal_sources[sig] = s;
+
+        r = signal_update(e, sig);
+        if (r < 0) {
+                event_source_free(s);
+                return r;
+        }
+
+        if (ret)
+                *ret = s;
+
+        return 0;
+}
+
+int event_add_child(EventLoop *e, pid_t pid, int options, event_child_handler_t callback, void *userdata, EventSource **ret) {
+        EventSource *s;
+        int r;
+
+        if (!e)
+                return -EINVAL;
+        if (pid <= 1)
+                return -EINVAL;
+        if (options == 0 || (options & ~(WEXITED|WSTOPPED|WCONTINUED)))
+                return -EINVAL;
+        if (!callback)
+                return -EINVAL;
+
+        r = hashmap_ensure_allocated(&e->child_sources, trivial_hash_func, trivial_compare_func);
+        if (r < 0)
+                return r;
+
+        if (hashmap_get(e->child_sources, INT_TO_PTR(pid)))
+                return -EBUSY;
+
+        s = source_new(e, SOURCE_CHILD);
+        if (!s)
+                return -ENOMEM;
+
+        s->userdata = userdata;
+        s->child.callback = callback;
+        s->child.pid = pid;
+        s->child.options = options;
+
+        r = hashmap_put(e->child_sources, INT_TO_PTR(pid), s);
+        if (r < 0) {
+                s->enabled = false;
+                event_source_free(s);
+                return r;
+        }
+
+        e->n_enabled_child_sources++;
+
+        r = signal_update(e, SIGCHLD);
+        if (r < 0) {
+                event_source_free(s);
+                return r;
+        }
+
+        if (ret)
+                *ret = s;
+
+        return 0;
+}
+
+int event_add_defer(EventLoop *e, event_defer_handler_t callback, void *userdata, EventSource **ret) {
+        EventSource *s;
+
+        if (!e)
+                return -EINVAL;
+        if (!callback)
+                return -EINVAL;
+
+        s = source_new(e, SOURCE_DEFER);
+        if (!s)
+                return -ENOMEM;
+
+        s->userdata = userdata;
+        s->defer.callback = callback;
+
+        LIST_PREPEND(EventSource, defer, e->defer, s);
+
+        if (ret)
+                *ret = s;
+
+        return 0;
+}
+
+static void source_disconnect(EventSource *s) {
+        EventLoop *e;
+        bool enabled;
+
+        assert(s);
+
+        e = s->loop;
+        enabled = s->enabled;
+        s->enabled = false;
+
+        switch (s->type) {
+
+        case SOURCE_IO:
+                io_update(s);
+                break;
+
+        case SOURCE_TIME:
+                if (enabled)
+                        prioq_remove(e->timers, s, &s->time.prioq_index);
+                break;
+
+        case SOURCE_SIGNAL:
+                if (e->signal_sources[s->signal.sig] == s)
+                        e->signal_sources[s->signal.sig] = NULL;
+
+                signal_update(e, s->signal.sig);
+                break;
+
+        case SOURCE_CHILD:
+                if (enabled) {
+                        assert(e->n_enabled_child_sources > 0);
+                        e->n_enabled_child_sources--;
+                }
+
+                signal_update(e, SIGCHLD);
+                break;
+
+        case SOURCE_DEFER:
+                break;
+        }
+}
+
+static void source_free_now(EventSource *s) {
+        EventLoop *e;
+
+        assert(s);
+
+        e = s->loop;
+
+        if (!s->dead)
+                source_disconnect(s);
+
+        if (s->type == SOURCE_CHILD && hashmap_get(e->child_sources, INT_TO_PTR(s->child.pid)) == s)
+                hashmap_remove(e->child_sources, INT_TO_PTR(s->child.pid));
+
+        if (s->type == SOURCE_DEFER)
+                LIST_REMOVE(EventSource, defer, e->defer, s);
+
+        if (s->in_dirty)
+                LIST_REMOVE(EventSource, dirty, e->dirty, s);
+
+        if (s->prepare_callback)
+                LIST_REMOVE(EventSource, prepare, e->prepare, s);
+
+        free(s);
+}
+
+void event_source_free(EventSource *s) {
+        EventLoop *e;
+
+        if (!s)
+                return;
+
+        /* Already freed from a callback in this iteration */
+        if (s->dead)
+                return;
+
+        e = s->loop;
+
+        LIST_REMOVE(EventSource, sources, e->sources, s);
+
+        if (!e->iterating) {
+                source_free_now(s);
+                return;
+        }
+
+        /* The source might still be referenced by events we have
+         * not dispatched yet, or by the lists we are walking. Unhook
+         * it from the kernel and the timers now, but free the memory
+         * only once the iteration is over. */
+        source_disconnect(s);
+        s->dead = true;
+
+        LIST_PREPEND(EventSource, sources, e->garbage, s);
+}
+
+int event_source_set_enabled(EventSource *s, bool enabled) {
+        EventLoop *e;
+        int r;
+
+        if (!s)
+                return -EINVAL;
+        if (s->dead)
+                return -ESTALE;
+
+        if (s->enabled == enabled)
+                return 0;
+
+        e = s->loop;
+
+        switch (s->type) {
+
+        case SOURCE_IO:
+                s->enabled = enabled;
+                io_mark_dirty(s);
+                break;
+
+        case SOURCE_TIME:
+                if (enabled) {
+                        r = prioq_put(e->timers, s, &s->time.prioq_index);
+                        if (r < 0)
+                                return r;
+                } else
+                        prioq_remove(e->timers, s, &s->time.prioq_index);
+
+                s->enabled = enabled;
+                break;
+
+        case SOURCE_SIGNAL:
+                s->enabled = enabled;
+
+                r = signal_update(e, s->signal.sig);
+                if (r < 0) {
+                        s->enabled = !enabled;
+                        return r;
+                }
+                break;
+
+        case SOURCE_CHILD:
+                s->enabled = enabled;
+
+                if (enabled)
+                        e->n_enabled_child_sources++;
+                else
+                        e->n_enabled_child_sources--;
+
+                r = signal_update(e, SIGCHLD);
+                if (r < 0) {
+                        s->enabled = !enabled;
+
+                        if (enabled)
+                                e->n_enabled_child_sources--;
+                        else
+                                e->n_enabled_child_sources++;
+
+                        return r;
+                }
+                break;
+
+        case SOURCE_DEFER:
+                s->enabled = enabled;
+                break;
+        }
+
+        return 0;
+}
+
+bool event_source_get_enabled(EventSource *s) {
+        if (!s)
+                return false;
+
+        return s->enabled;
+}
+
+int event_source_set_io_events(EventSource *s, uint32_t events) {
+        if (!s)
+                return -EINVAL;
+        if (s->type != SOURCE_IO)
+                return -EDOM;
+        if (s->dead)
+                return -ESTALE;
+
+        if (s->io.events == events)
+                return 0;
+
+        s->io.events = events;
+
+        if (s->enabled)
+                io_mark_dirty(s);
+
+        return 0;
+}
+
+int event_source_set_time(EventSource *s, usec_t usec) {
+        if (!s)
+                return -EINVAL;
+        if (s->type != SOURCE_TIME)
+                return -EDOM;
+        if (s->dead)
+                return -ESTALE;
+
+        if (s->time.next == usec)
+                return 0;
+
+        s->time.next = usec;
+
+        if (s->enabled)
+                prioq_reshuffle(s->loop->timers, s, &s->time.prioq_index);
+
+        return 0;
+}
+
+int event_source_set_prepare(EventSource *s, event_prepare_handler_t callback) {
+        EventLoop *e;
+
+        if (!s)
+                return -EINVAL;
+        if (s->dead)
+                return -ESTALE;
+
+        e = s->loop;
+
+        if (!s->prepare_callback && callback)
+                LIST_PREPEND(EventSource, prepare, e->prepare, s);
+        else if (s->prepare_callback && !callback)
+                LIST_REMOVE(EventSource, prepare, e->prepare, s);
+
+        s->prepare_callback = callback;
+
+        return 0;
+}
+
+void *event_source_get_userdata(EventSource *s) {
+        if (!s)
+                return NULL;
+
+        return s->userdata;
+}
+
+EventLoop *event_source_get_loop(EventSource *s) {
+        if (!s)
+                return NULL;
+
+        return s->loop;
+}
+
+static void source_result(EventSource *s, int r) {
+        assert(s);
+
+        s->loop->n_dispatched++;
+
+        if (r >= 0 || s->dead)
+                return;
+
+        log_debug("Event source %p failed, disabling: %s", s, strerror(-r));
+        event_source_set_enabled(s, false);
+}
+
+static void flush_dirty(EventLoop *e) {
+        EventSource *s;
+        int r;
+
+        assert(e);
+
+        while ((s = e->dirty)) {
+                LIST_REMOVE(EventSource, dirty, e->dirty, s);
+                s->in_dirty = false;
+
+                r = io_update(s);
+                if (r < 0) {
+                        log_debug("Failed to update epoll registration of fd %i: %s", s->io.fd, strerror(-r));
+                        s->enabled = false;
+                }
+        }
+}
+
+static int timer_arm(EventLoop *e) {
+        struct itimerspec its = {};
+        EventSource *s;
+        usec_t t;
+
+        assert(e);
+
+        s = prioq_peek(e->timers);
+
+        /* An all-zero expiry would disarm the timer instead */
+        t = s ? MAX(s->time.next, (usec_t) 1) : (usec_t) -1;
+        if (t == e->timer_armed)
+                return 0;
+
+        if (s)
+                timespec_store(&its.it_value, t);
+
+        if (timerfd_settime(e->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+                return -errno;
+
+        e->timer_armed = t;
+        return 0;
+}
+
+static void flush_timer_fd(EventLoop *e) {
+        uint64_t x;
+
+        assert(e);
+
+        if (read(e->timer_fd, &x, sizeof(x)) == sizeof(x))
+                e->timer_armed = (usec_t) -1;
+}
+
+static void dispatch_timers(EventLoop *e) {
+        EventSource *s;
+        usec_t n;
+
+        assert(e);
+
+        n = now(CLOCK_MONOTONIC);
+
+        while ((s = prioq_peek(e->timers))) {
+                int r;
+
+                /* Timers that were enabled again by their own
+                 * callbacks wait for the next iteration */
+                if (s->time.next > n || s->time.iteration == e->iteration)
+                        break;
+
+                s->time.iteration = e->iteration;
+                event_source_set_enabled(s, false);
+
+                r = s->time.callback(s, s->time.next, s->userdata);
+                source_result(s, r);
+        }
+}
+
+static void dispatch_children(EventLoop *e) {
+        EventSource *s;
+        Iterator i;
+
+        assert(e);
+
+        HASHMAP_FOREACH(s, e->child_sources, i) {
+                siginfo_t si = {};
+                int r;
+
+                if (!s->enabled || s->dead)
+                        continue;
+
+                if (waitid(P_PID, s->child.pid, &si, s->child.options|WNOHANG) < 0) {
+                        log_debug("Failed to wait for child %lu: %m", (unsigned long) s->child.pid);
+                        event_source_set_enabled(s, false);
+                        continue;
+                }
+
+                if (si.si_pid == 0)
+                        continue;
+
+                /* Once the child is gone there is nothing left to
+                 * watch */
+                if (si.si_code == CLD_EXITED || si.si_code == CLD_KILLED || si.si_code == CLD_DUMPED)
+                        event_source_set_enabled(s, false);
+
+                r = s->child.callback(s, &si, s->userdata);
+                source_result(s, r);
+        }
+}
+
+static int dispatch_signals(EventLoop *e) {
+        assert(e);
+
+        for (;;) {
+                struct signalfd_siginfo si;
+                EventSource *s;
+                ssize_t l;
+                int r;
+
+                l = read(e->signal_fd, &si, sizeof(si));
+                if (l < 0) {
+                        if (errno == EAGAIN || errno == EINTR)
+                                return 0;
+
+                        return -errno;
+                }
+
+                if (l != sizeof(si))
+                        return -EIO;
+
+                if (si.ssi_signo == SIGCHLD && e->n_enabled_child_sources > 0)
+                        dispatch_children(e);
+
+                if (si.ssi_signo >= _NSIG)
+                        continue;
+
+                s = e->signal_sources[si.ssi_signo];
+                if (!s || !s->enabled || s->dead)
+                        continue;
+
+                r = s->signal.callback(s, &si, s->userdata);
+                source_result(s, r);
+        }
+}
+
+static void dispatch_defer(EventLoop *e) {
+        EventSource *s;
+
+        assert(e);
+
+        LIST_FOREACH(defer, s, e->defer) {
+                int r;
+
+                if (!s->enabled || s->dead)
+                        continue;
+
+                event_source_set_enabled(s, false);
+
+                r = s->defer.callback(s, s->userdata);
+                source_result(s, r);
+        }
+}
+
+static void run_prepare(EventLoop *e) {
+        EventSource *s;
+
+        assert(e);
+
+        LIST_FOREACH(prepare, s, e->prepare) {
+                int r;
+
+                if (!s->enabled || s->dead)
+                        continue;
+
+                r = s->prepare_callback(s, s->userdata);
+                if (r < 0) {
+                        log_debug("Prepare callback of event source %p failed, disabling: %s", s, strerror(-r));
+                        event_source_set_enabled(s, false);
+                }
+        }
+}
+
+static bool have_defer(EventLoop *e) {
+        EventSource *s;
+
+        LIST_FOREACH(defer, s, e->defer)
+                if (s->enabled && !s->dead)
+                        return true;
+
+        return false;
+}
+
+static int loop_prepare(EventLoop *e) {
+        int r;
+
+        assert(e);
+
+        run_prepare(e);
+        flush_dirty(e);
+
+        r = timer_arm(e);
+        if (r < 0)
+                return r;
+
+        return have_defer(e);
+}
+
+static void collect_garbage(EventLoop *e) {
+        EventSource *s;
+
+        assert(e);
+
+        while ((s = e->garbage)) {
+                LIST_REMOVE(EventSource, sources, e->garbage, s);
+                source_free_now(s);
+        }
+}
+
+int event_loop_prepare(EventLoop *e) {
+        int r;
+
+        if (!e)
+                return -EINVAL;
+        if (e->iterating)
+                return -EBUSY;
+
+        e->iterating = true;
+        r = loop_prepare(e);
+        collect_garbage(e);
+        e->iterating = false;
+
+        return r;
+}
+
+int event_loop_run(EventLoop *e, usec_t timeout) {
+        struct epoll_event ev_queue[EPOLL_QUEUE_MAX];
+        EventSource *s;
+        int r, m, i, msec;
+
+        if (!e)
+                return -EINVAL;
+        if (e->iterating)
+                return -EBUSY;
+
+        e->iterating = true;
+        e->iteration++;
+        e->n_dispatched = 0;
+
+        r = loop_prepare(e);
+        if (r < 0)
+                goto finish;
+        if (r > 0)
+                timeout = 0;
+
+        if (timeout == (usec_t) -1)
+                msec = -1;
+        else
+                msec = (int) MIN(timeout / USEC_PER_MSEC + (timeout % USEC_PER_MSEC > 0), (usec_t) INT_MAX);
+
+        m = epoll_wait(e->epoll_fd, ev_queue, ELEMENTSOF(ev_queue), msec);
+        if (m < 0) {
+                r = errno == EINTR ? 0 : -errno;
+                goto finish;
+        }
+
+        for (i = 0; i < m; i++) {
+
+                if (ev_queue[i].data.ptr == &e->timer_fd)
+                        flush_timer_fd(e);
+
+                else if (ev_queue[i].data.ptr == &e->signal_fd) {
+                        r = dispatch_signals(e);
+                        if (r < 0)
+                                goto finish;
+
+                } else {
+                        s = ev_queue[i].data.ptr;
+
+                        /* Disabled or freed by an earlier callback */
+                        if (!s->enabled || s->dead)
+                                continue;
+
+                        r = s->io.callback(s, s->io.fd, ev_queue[i].events, s->userdata);
+                        source_result(s, r);
+                }
+        }
+
+        dispatch_timers(e);
+        dispatch_defer(e);
+
+        r = 0;
+
+finish:
+        collect_garbage(e);
+        e->iterating = false;
+
+        if (r < 0)
+                return r;
+
+        return e->n_dispatched > 0;
+}
+
+int event_loop_loop(EventLoop *e) {
+        int r;
+
+        if (!e)
+                return -EINVAL;
+
+        while (!e->exit_requested) {
+                r = event_loop_run(e, (usec_t) -1);
+                if (r < 0)
+                        return r;
+        }
+
+        return e->exit_code;
+}
+
+int event_loop_exit(EventLoop *e, int code) {
+        if (!e)
+                return -EINVAL;
+
+        e->exit_requested = true;
+        e->exit_code = code;
+
+        return 0;
+}
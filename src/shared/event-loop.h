@@ -0,0 +1,88 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <stdbool.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include "time-util.h"
+
+/* A small epoll based event loop, for daemons that do not need the
+ * elaborate main loop of PID 1. All sources are served through a
+ * single epoll fd, which may itself be watched by another loop.
+ *
+ * Enabling, disabling and changing the events of IO sources only
+ * takes effect when the loop is about to wait again, hence toggling
+ * them repeatedly in between costs one epoll_ctl() at most. All timer
+ * sources share a single timerfd, which is only rearmed when the
+ * earliest of them changes. Signals and child events require their
+ * signals, and SIGCHLD respectively, to be blocked by the caller.
+ *
+ * Timer and defer sources are disabled right before their callback
+ * is invoked, and need to be enabled again to fire another time. A
+ * callback returning an error disables its source. Sources may be
+ * freed from within any callback. */
+
+typedef struct EventLoop EventLoop;
+typedef struct EventSource EventSource;
+
+typedef int (*event_io_handler_t)(EventSource *s, int fd, uint32_t revents, void *userdata);
+typedef int (*event_time_handler_t)(EventSource *s, usec_t usec, void *userdata);
+typedef int (*event_signal_handler_t)(EventSource *s, const struct signalfd_siginfo *si, void *userdata);
+typedef int (*event_child_handler_t)(EventSource *s, const siginfo_t *si, void *userdata);
+typedef int (*event_defer_handler_t)(EventSource *s, void *userdata);
+typedef int (*event_prepare_handler_t)(EventSource *s, void *userdata);
+
+int event_loop_new(EventLoop **ret);
+void event_loop_free(EventLoop *e);
+
+int event_loop_get_fd(EventLoop *e);
+
+int event_add_io(EventLoop *e, int fd, uint32_t events, event_io_handler_t callback, void *userdata, EventSource **ret);
+int event_add_time(EventLoop *e, usec_t usec, event_time_handler_t callback, void *userdata, EventSource **ret);
+int event_add_signal(EventLoop *e, int sig, event_signal_handler_t callback, void *userdata, EventSource **ret);
+int event_add_child(EventLoop *e, pid_t pid, int options, event_child_handler_t callback, void *userdata, EventSource **ret);
+int event_add_defer(EventLoop *e, event_defer_handler_t callback, void *userdata, EventSource **ret);
+
+void event_source_free(EventSource *s);
+
+int event_source_set_enabled(EventSource *s, bool enabled);
+bool event_source_get_enabled(EventSource *s);
+int event_source_set_io_events(EventSource *s, uint32_t events);
+int event_source_set_time(EventSource *s, usec_t usec);
+int event_source_set_prepare(EventSource *s, event_prepare_handler_t callback);
+void *event_source_get_userdata(EventSource *s);
+EventLoop *event_source_get_loop(EventSource *s);
+
+/* When the fd of the loop is watched by another loop, call this
+ * before that one waits, so that pending changes to the sources take
+ * effect. Returns > 0 if sources are pending that should be
+ * dispatched without waiting. */
+int event_loop_prepare(EventLoop *e);
+
+int event_loop_run(EventLoop *e, usec_t timeout);
+int event_loop_loop(EventLoop *e);
+int event_loop_exit(EventLoop *e, int code);
+
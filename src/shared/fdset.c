@@ -24,27 +24,75 @@
 #include <fcntl.h>
 #include <unistd.h>
 
-#include "set.h"
 #include "util.h"
 #include "macro.h"
 #include "fdset.h"
 #include "sd-daemon.h"
 
-#define MAKE_SET(s) ((Set*) s)
-#define MAKE_FDSET(s) ((FDSet*) s)
+/* File descriptors are small integers, densely allocated by the
+ * kernel, hence a bitmap indexed by fd keeps them best: adding,
+ * removing and looking up are constant time, and the set stays a
+ * few KB even when serializing tens of thousands of fds. */
 
-/* Make sure we can distuingish fd 0 and NULL */
-#define FD_TO_PTR(fd) INT_TO_PTR((fd)+1)
-#define PTR_TO_FD(p) (PTR_TO_INT(p)-1)
+#define BITS_PER_WORD (sizeof(unsigned long) * 8)
+
+struct FDSet {
+        unsigned long *bits;
+        unsigned n_words;
+        unsigned n_fds;
+};
+
+/* Iterators are the fd returned last, plus one so that
+ * ITERATOR_FIRST is right before fd 0 */
+#define FD_TO_ITERATOR(fd) ((Iterator) (uintptr_t) ((fd) + 1))
+#define ITERATOR_TO_FD(i) ((int) ((uintptr_t) (i) - 1))
 
 FDSet *fdset_new(void) {
-        return MAKE_FDSET(set_new(trivial_hash_func, trivial_compare_func));
+        return new0(FDSet, 1);
+}
+
+/* Returns the lowest fd >= from in s, or -ENOENT */
+static int fdset_next(FDSet *s, int from) {
+        unsigned w;
+        unsigned long b;
+
+        assert(s);
+        assert(from >= 0);
+
+        w = from / BITS_PER_WORD;
+        if (w >= s->n_words)
+                return -ENOENT;
+
+        b = s->bits[w] & (~0UL << (from % BITS_PER_WORD));
+
+        while (b == 0) {
+                if (++w >= s->n_words)
+                        return -ENOENT;
+
+                b = s->bits[w];
+        }
+
+        return w * BITS_PER_WORD + __builtin_ctzl(b);
+}
+
+static void fdset_unset(FDSet *s, int fd) {
+        s->bits[fd / BITS_PER_WORD] &= ~(1UL << (fd % BITS_PER_WORD));
+        s->n_fds--;
+}
+
+/* Frees the set without closing the fds in it */
+static void fdset_free_keep(FDSet *s) {
+        free(s->bits);
+        free(s);
 }
 
 void fdset_free(FDSet *s) {
-        void *p;
+        int fd;
+
+        if (!s)
+                return;
 
-        while ((p = set_steal_first(MAKE_SET(s)))) {
+        for (fd = fdset_next(s, 0); fd >= 0; fd = fdset_next(s, fd + 1)) {
                 /* Valgrind's fd might have ended up in this set here,
                  * due to fdset_new_fill(). We'll ignore all failures
                  * here, so that the EBADFD that valgrind will return
@@ -56,18 +104,42 @@ void fdset_free(FDSet *s) {
                  * duplicates. So don't be surprised about these log
                  * messages. */
 
-                log_debug("Closing left-over fd %i", PTR_TO_FD(p));
-                close_nointr(PTR_TO_FD(p));
+                log_debug("Closing left-over fd %i", fd);
+                close_nointr(fd);
         }
 
-        set_free(MAKE_SET(s));
+        fdset_free_keep(s);
 }
 
 int fdset_put(FDSet *s, int fd) {
+        unsigned w;
+
         assert(s);
         assert(fd >= 0);
 
-        return set_put(MAKE_SET(s), FD_TO_PTR(fd));
+        w = fd / BITS_PER_WORD;
+
+        if (w >= s->n_words) {
+                unsigned long *b;
+                unsigned n;
+
+                n = MAX(w + 1, s->n_words * 2);
+                b = realloc(s->bits, n * sizeof(unsigned long));
+                if (!b)
+                        return -ENOMEM;
+
+                memzero(b + s->n_words, (n - s->n_words) * sizeof(unsigned long));
+                s->bits = b;
+                s->n_words = n;
+        }
+
+        if (s->bits[w] & (1UL << (fd % BITS_PER_WORD)))
+                return -EEXIST;
+
+        s->bits[w] |= 1UL << (fd % BITS_PER_WORD);
+        s->n_fds++;
+
+        return 0;
 }
 
 int fdset_put_dup(FDSet *s, int fd) {
@@ -90,17 +162,25 @@ int fdset_put_dup(FDSet *s, int fd) {
 }
 
 bool fdset_contains(FDSet *s, int fd) {
+        unsigned w;
+
         assert(s);
         assert(fd >= 0);
 
-        return !!set_get(MAKE_SET(s), FD_TO_PTR(fd));
+        w = fd / BITS_PER_WORD;
+
+        return w < s->n_words && (s->bits[w] & (1UL << (fd % BITS_PER_WORD)));
 }
 
 int fdset_remove(FDSet *s, int fd) {
         assert(s);
         assert(fd >= 0);
 
-        return set_remove(MAKE_SET(s), FD_TO_PTR(fd)) ? fd : -ENOENT;
+        if (!fdset_contains(s, fd))
+                return -ENOENT;
+
+        fdset_unset(s, fd);
+        return fd;
 }
 
 int fdset_new_fill(FDSet **_s) {
@@ -154,20 +234,18 @@ finish:
 
         /* We won't close the fds here! */
         if (s)
-                set_free(MAKE_SET(s));
+                fdset_free_keep(s);
 
         return r;
 }
 
 int fdset_cloexec(FDSet *fds, bool b) {
-        Iterator i;
-        void *p;
-        int r;
+        int fd, r;
 
         assert(fds);
 
-        SET_FOREACH(p, MAKE_SET(fds), i)
-                if ((r = fd_cloexec(PTR_TO_FD(p), b)) < 0)
+        for (fd = fdset_next(fds, 0); fd >= 0; fd = fdset_next(fds, fd + 1))
+                if ((r = fd_cloexec(fd, b)) < 0)
                         return r;
 
         return 0;
@@ -200,37 +278,87 @@ int fdset_new_listen_fds(FDSet **_s, bool unset) {
 
 fail:
         if (s)
-                set_free(MAKE_SET(s));
+                fdset_free_keep(s);
 
         return r;
 }
 
 int fdset_close_others(FDSet *fds) {
-        void *e;
-        Iterator i;
-        int *a;
-        unsigned j, m;
+        DIR *d;
+        struct dirent *de;
+        int r = 0;
+
+        /* Closes all fds not in the set, except for stdin, stdout
+         * and stderr. Unlike close_all_fds() this looks each fd up
+         * in constant time, so that it doesn't matter how many we
+         * keep. A NULL set is empty, like with the other sets. */
+
+        if (!fds)
+                return close_all_fds(NULL, 0);
+
+        d = opendir("/proc/self/fd");
+        if (!d) {
+                int fd, *a;
+                unsigned j = 0;
+
+                /* Without /proc we need to brute force through
+                 * the fd table anyway */
+                a = alloca(sizeof(int) * (fds->n_fds + 1));
+                for (fd = fdset_next(fds, 0); fd >= 0; fd = fdset_next(fds, fd + 1))
+                        a[j++] = fd;
+
+                return close_all_fds(a, j);
+        }
+
+        while ((de = readdir(d))) {
+                int fd = -1;
+
+                if (ignore_file(de->d_name))
+                        continue;
+
+                if (safe_atoi(de->d_name, &fd) < 0)
+                        /* Let's better ignore this, just in case */
+                        continue;
+
+                if (fd < 3)
+                        continue;
 
-        j = 0, m = fdset_size(fds);
-        a = alloca(sizeof(int) * m);
-        SET_FOREACH(e, MAKE_SET(fds), i)
-                a[j++] = PTR_TO_FD(e);
+                if (fd == dirfd(d))
+                        continue;
+
+                if (fdset_contains(fds, fd))
+                        continue;
 
-        assert(j == m);
+                if (close_nointr(fd) < 0) {
+                        /* Valgrind has its own FD and doesn't want to have it closed */
+                        if (errno != EBADF && r == 0)
+                                r = -errno;
+                }
+        }
 
-        return close_all_fds(a, j);
+        closedir(d);
+        return r;
 }
 
 unsigned fdset_size(FDSet *fds) {
-        return set_size(MAKE_SET(fds));
+        return fds ? fds->n_fds : 0;
 }
 
 int fdset_iterate(FDSet *s, Iterator *i) {
-        void *p;
+        int fd;
+
+        assert(s);
+        assert(i);
+
+        if (*i == ITERATOR_LAST)
+                return -ENOENT;
 
-        p = set_iterate(MAKE_SET(s), i);
-        if (!p)
+        fd = fdset_next(s, ITERATOR_TO_FD(*i) + 1);
+        if (fd < 0) {
+                *i = ITERATOR_LAST;
                 return -ENOENT;
+        }
 
-        return PTR_TO_FD(p);
+        *i = FD_TO_ITERATOR(fd);
+        return fd;
 }
@@ -0,0 +1,143 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "macro.h"
+#include "glob-match.h"
+
+/* The closing bracket of a bracket expression, p pointing right
+ * after the opening one. Like fnmatch(), a leading ']' is a member. */
+static const char *bracket_end(const char *p, const char *end) {
+        if (p < end && (*p == '!' || *p == '^'))
+                p++;
+        if (p < end && *p == ']')
+                p++;
+
+        for (; p < end; p++)
+                if (*p == ']')
+                        return p;
+
+        return NULL;
+}
+
+static bool bracket_match(const char *p, const char *e, unsigned char c) {
+        bool negate = false, found = false;
+
+        if (*p == '!' || *p == '^') {
+                negate = true;
+                p++;
+        }
+
+        while (p < e) {
+                unsigned char lo, hi;
+
+                lo = hi = *p;
+                if (p + 2 < e && p[1] == '-') {
+                        hi = p[2];
+                        p += 3;
+                } else
+                        p++;
+
+                if (c >= lo && c <= hi)
+                        found = true;
+        }
+
+        return found != negate;
+}
+
+bool glob_simple(const char *pattern, size_t n) {
+        size_t i;
+
+        assert(pattern);
+
+        for (i = 0; i < n; i++) {
+                if (pattern[i] == '\\')
+                        return false;
+
+                /* Character classes, equivalence classes and
+                 * collating symbols depend on the locale */
+                if (pattern[i] == '[' && i + 1 < n &&
+                    (pattern[i+1] == ':' || pattern[i+1] == '=' || pattern[i+1] == '.'))
+                        return false;
+        }
+
+        return true;
+}
+
+bool glob_match(const char *pattern, size_t n, const char *s) {
+        const char *p = pattern, *end = pattern + n;
+        const char *star_p = NULL, *star_s = NULL;
+
+        assert(pattern);
+        assert(s);
+
+        /* Each element but '*' matches exactly one character, hence
+         * when a match fails it suffices to let the last '*' eat one
+         * more, instead of backtracking through all of them */
+
+        while (*s) {
+                if (p < end) {
+                        if (*p == '*') {
+                                star_p = ++p;
+                                star_s = s;
+                                continue;
+                        }
+
+                        if (*p == '?') {
+                                p++;
+                                s++;
+                                continue;
+                        }
+
+                        if (*p == '[') {
+                                const char *e;
+
+                                e = bracket_end(p + 1, end);
+                                if (e) {
+                                        if (bracket_match(p + 1, e, *s)) {
+                                                p = e + 1;
+                                                s++;
+                                                continue;
+                                        }
+
+                                        goto backtrack;
+                                }
+
+                                /* Unterminated, hence a literal '[' */
+                        }
+
+                        if (*p == *s) {
+                                p++;
+                                s++;
+                                continue;
+                        }
+                }
+
+        backtrack:
+                if (!star_p)
+                        return false;
+
+                p = star_p;
+                s = ++star_s;
+        }
+
+        while (p < end && *p == '*')
+                p++;
+
+        return p == end;
+}
@@ -0,0 +1,34 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A replacement for fnmatch(pattern, s, 0) in the C locale, which
+ * takes the pattern by length, so that alternatives of a longer string
+ * can be matched in place, and skips the locale handling of glibc.
+ *
+ * glob_match() supports '*', '?' and bracket expressions with ranges
+ * and negation. Patterns with backslash escapes or character classes
+ * are not, which glob_simple() tells. */
+
+bool glob_simple(const char *pattern, size_t n);
+bool glob_match(const char *pattern, size_t n, const char *s);
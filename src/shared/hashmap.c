@@ -23,32 +23,87 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/auxv.h>
+#if HAVE_DECL_GETRANDOM
+#include <sys/random.h>
+#endif
 
 #include "util.h"
 #include "hashmap.h"
 #include "macro.h"
-
-#define NBUCKETS 127
+#include "siphash24.h"
+#include "missing.h"
+
+/* Entries are kept in one flat array, linked in insertion order by
+ * their indexes, and looked up through a separate array of buckets
+ * with open addressing and linear probing. Each bucket carries the
+ * full hash of its entry, so that collisions are mostly resolved
+ * without touching the entry at all.
+ *
+ * Entries never move within the array: removed ones are reused by
+ * later insertions, and growing copies the array as it is. Hence the
+ * indexes stay valid, which keeps iterators working across insertions
+ * and across removal of the entry just returned.
+ *
+ * When a large table grows, its entries are moved to the new buckets
+ * a few at a time on the following changes, and lookups check the
+ * old buckets too until that is done. */
+
+#define IDX_NIL ((unsigned) -1)
+
+/* Small enough for the dependency sets of units, most of which hold
+ * a handful of entries only */
+#define INITIAL_SHIFT 2
+
+/* Below that many entries, moving them all at once takes no time
+ * worth mentioning */
+#define REHASH_INCREMENTAL_MIN 4096
+
+/* Entries to move per change while growing. Growing doubles the
+ * buckets, so this is done long before they fill up again. */
+#define REHASH_STEP 4
 
 struct hashmap_entry {
         const void *key;
         void *value;
-        struct hashmap_entry *bucket_next, *bucket_previous;
-        struct hashmap_entry *iterate_next, *iterate_previous;
+        unsigned hash;
+        unsigned iterate_next, iterate_previous;
+};
+
+/* Zero for empty buckets, so that large bucket arrays can come
+ * straight from fresh pages */
+struct hashmap_bucket {
+        unsigned hash;
+        unsigned idx_plus_one;
 };
 
 struct Hashmap {
         hash_func_t hash_func;
         compare_func_t compare_func;
 
-        struct hashmap_entry *iterate_list_head, *iterate_list_tail;
+        struct hashmap_entry *entries;
+        struct hashmap_bucket *buckets;
+        unsigned shift;
+
+        /* While growing, the buckets before, which still point to
+         * the entries from rehash_next on */
+        struct hashmap_bucket *old_buckets;
+        unsigned old_shift;
+        unsigned rehash_next;
+
+        /* Entries handed out so far, and those of them removed
+         * again, linked through iterate_next */
+        unsigned n_used;
+        unsigned free_list;
+
+        unsigned iterate_list_head, iterate_list_tail;
         unsigned n_entries;
 
         bool from_pool;
 };
 
-#define BY_HASH(h) ((struct hashmap_entry**) ((uint8_t*) (h) + ALIGN(sizeof(Hashmap))))
-
 struct pool {
         struct pool *next;
         unsigned n_tiles;
@@ -58,9 +113,6 @@ struct pool {
 static struct pool *first_hashmap_pool = NULL;
 static void *first_hashmap_tile = NULL;
 
-static struct pool *first_entry_pool = NULL;
-static void *first_entry_tile = NULL;
-
 static void* allocate_tile(struct pool **first_pool, void **first_tile, size_t tile_size) {
         unsigned i;
 
@@ -118,21 +170,76 @@ __attribute__((destructor)) static void cleanup_pool(void) {
         /* Be nice to valgrind */
 
         drop_pool(first_hashmap_pool);
-        drop_pool(first_entry_pool);
 }
 
 #endif
 
-unsigned string_hash_func(const void *p) {
-        unsigned hash = 5381;
-        const signed char *c;
+/* Key for hashing strings, which are frequently under control of
+ * somebody else, so that collisions cannot be precomputed. It is
+ * picked on the first string hash, which may happen on any thread:
+ * 0 means not picked yet, 1 that somebody is picking it, 2 that it
+ * is ready. */
+static uint8_t string_hash_key[16];
+static unsigned string_hash_key_state = 0;
+
+static void string_hash_key_pick(uint8_t key[16]) {
+        static const uint8_t fixed_key[2][16] = {
+                { 0x3a, 0x8b, 0x5f, 0x21, 0xd4, 0x97, 0x0e, 0x6c, 0xb2, 0x45, 0xf8, 0x13, 0x7d, 0xa0, 0xc9, 0x56 },
+                { 0x91, 0x2e, 0xc7, 0x64, 0x0b, 0xfa, 0x38, 0xd5, 0x6f, 0x83, 0x1c, 0xe9, 0x42, 0xb7, 0x05, 0x7a },
+        };
+        _cleanup_close_ int fd = -1;
+        const void *auxv;
+        uint64_t k[2];
+
+        /* Don't block if the pool isn't initialized yet this early
+         * during boot, /dev/urandom will do then */
+        if (getrandom(key, 16, GRND_NONBLOCK) == 16)
+                return;
 
-        /* DJB's hash function */
+        fd = open("/dev/urandom", O_RDONLY|O_CLOEXEC|O_NOCTTY);
+        if (fd >= 0 && loop_read(fd, key, 16, true) == 16)
+                return;
 
-        for (c = p; *c; c++)
-                hash = (hash << 5) + hash + (unsigned) *c;
+        /* /dev/urandom might not even exist yet. The kernel handed
+         * us 16 random bytes on exec(), but glibc uses them for the
+         * stack protector and pointer guard, so only ever use them
+         * through a one-way function that doesn't reveal them. */
+        auxv = (const void*) getauxval(AT_RANDOM);
+        if (auxv) {
+                k[0] = siphash24(auxv, 16, fixed_key[0]);
+                k[1] = siphash24(auxv, 16, fixed_key[1]);
+        } else {
+                k[0] = random_ull();
+                k[1] = random_ull();
+        }
+
+        memcpy(key, k, 16);
+}
+
+static const uint8_t *string_hash_key_get(void) {
+        if (_likely_(string_hash_key_state == 2)) {
+                __sync_synchronize();
+                return string_hash_key;
+        }
+
+        if (__sync_bool_compare_and_swap(&string_hash_key_state, 0, 1)) {
+                string_hash_key_pick(string_hash_key);
+                __sync_synchronize();
+                string_hash_key_state = 2;
+        } else
+                while (*(volatile unsigned*) &string_hash_key_state != 2)
+                        sched_yield();
 
-        return hash;
+        __sync_synchronize();
+        return string_hash_key;
+}
+
+unsigned string_hash_func(const void *p) {
+        uint64_t u;
+
+        u = siphash24(p, strlen(p), string_hash_key_get());
+
+        return (unsigned) (u ^ (u >> 32));
 }
 
 int string_compare_func(const void *a, const void *b) {
@@ -166,24 +273,79 @@ int uint64_compare_func(const void *_a, const void *_b) {
         return a < b ? -1 : (a > b ? 1 : 0);
 }
 
+
+/* Up to three quarters of the buckets may be used */
+static inline unsigned capacity(unsigned shift) {
+        return (1U << shift) - (1U << shift) / 4;
+}
+
+static inline unsigned bucket_home(unsigned shift, unsigned hash) {
+        assert_cc(sizeof(unsigned) == 4);
+
+        /* Fibonacci hashing, so that the low bits of aligned
+         * pointers, which are all the same, don't matter */
+        return (hash * 2654435769U) >> (32 - shift);
+}
+
+static void buckets_insert(struct hashmap_bucket *buckets, unsigned shift, unsigned hash, unsigned idx) {
+        unsigned b, mask = (1U << shift) - 1;
+
+        for (b = bucket_home(shift, hash); buckets[b].idx_plus_one != 0; b = (b + 1) & mask)
+                ;
+
+        buckets[b].hash = hash;
+        buckets[b].idx_plus_one = idx + 1;
+}
+
+static unsigned buckets_find_idx(struct hashmap_bucket *buckets, unsigned shift, unsigned hash, unsigned idx) {
+        unsigned b, mask = (1U << shift) - 1;
+
+        /* Returns the bucket pointing to the entry idx, or IDX_NIL */
+
+        for (b = bucket_home(shift, hash); buckets[b].idx_plus_one != 0; b = (b + 1) & mask)
+                if (buckets[b].idx_plus_one == idx + 1)
+                        return b;
+
+        return IDX_NIL;
+}
+
+static void buckets_delete(struct hashmap_bucket *buckets, unsigned shift, unsigned b) {
+        unsigned n, mask = (1U << shift) - 1;
+
+        /* Moves back the entries behind the bucket which could not
+         * get their home bucket, so that no lookup stops short of
+         * them */
+
+        for (n = (b + 1) & mask; buckets[n].idx_plus_one != 0; n = (n + 1) & mask) {
+                unsigned home;
+
+                home = bucket_home(shift, buckets[n].hash);
+
+                /* Leave it if its home is cyclically in (b, n] */
+                if (b <= n ? (b < home && home <= n) : (b < home || home <= n))
+                        continue;
+
+                buckets[b] = buckets[n];
+                b = n;
+        }
+
+        buckets[b].idx_plus_one = 0;
+}
+
 Hashmap *hashmap_new(hash_func_t hash_func, compare_func_t compare_func) {
         bool b;
         Hashmap *h;
-        size_t size;
 
         b = is_main_thread();
 
-        size = ALIGN(sizeof(Hashmap)) + NBUCKETS * sizeof(struct hashmap_entry*);
-
         if (b) {
-                h = allocate_tile(&first_hashmap_pool, &first_hashmap_tile, size);
+                h = allocate_tile(&first_hashmap_pool, &first_hashmap_tile, sizeof(Hashmap));
                 if (!h)
                         return NULL;
 
-                memset(h, 0, size);
+                zero(*h);
         } else {
-                h = malloc0(size);
-
+                h = new0(Hashmap, 1);
                 if (!h)
                         return NULL;
         }
@@ -191,8 +353,8 @@ Hashmap *hashmap_new(hash_func_t hash_func, compare_func_t compare_func) {
         h->hash_func = hash_func ? hash_func : trivial_hash_func;
         h->compare_func = compare_func ? compare_func : trivial_compare_func;
 
-        h->n_entries = 0;
-        h->iterate_list_head = h->iterate_list_tail = NULL;
+        h->free_list = IDX_NIL;
+        h->iterate_list_head = h->iterate_list_tail = IDX_NIL;
 
         h->from_pool = b;
 
@@ -211,75 +373,241 @@ int hashmap_ensure_allocated(Hashmap **h, hash_func_t hash_func, compare_func_t
         return 0;
 }
 
-static void link_entry(Hashmap *h, struct hashmap_entry *e, unsigned hash) {
+static void rehash_step(Hashmap *h, unsigned n) {
+        assert(h);
+        assert(h->old_buckets);
+
+        /* Entries added since growing went to the new buckets right
+         * away, and those removed meanwhile are in neither, hence
+         * only move what is found in the old buckets */
+        for (; n > 0 && h->rehash_next < h->n_used; n--, h->rehash_next++) {
+                struct hashmap_entry *e = h->entries + h->rehash_next;
+                unsigned b;
+
+                b = buckets_find_idx(h->old_buckets, h->old_shift, e->hash, h->rehash_next);
+                if (b == IDX_NIL)
+                        continue;
+
+                buckets_delete(h->old_buckets, h->old_shift, b);
+                buckets_insert(h->buckets, h->shift, e->hash, h->rehash_next);
+        }
+
+        if (h->rehash_next >= h->n_used) {
+                free(h->old_buckets);
+                h->old_buckets = NULL;
+        }
+}
+
+static int resize(Hashmap *h, unsigned shift) {
+        struct hashmap_entry *entries;
+        struct hashmap_bucket *buckets;
+        unsigned i;
+
+        assert(h);
+        assert(shift < 32);
+        assert(capacity(shift) >= h->n_used);
+
+        /* Growing twice in a row, finish the first one */
+        if (h->old_buckets)
+                rehash_step(h, (unsigned) -1);
+
+        buckets = new0(struct hashmap_bucket, 1U << shift);
+        if (!buckets)
+                return -ENOMEM;
+
+        /* Entries stay where they are, so that their indexes remain
+         * valid. For large arrays realloc() does not even copy. */
+        entries = realloc(h->entries, capacity(shift) * sizeof(struct hashmap_entry));
+        if (!entries) {
+                free(buckets);
+                return -ENOMEM;
+        }
+
+        h->entries = entries;
+
+        if (h->n_entries >= REHASH_INCREMENTAL_MIN) {
+
+                /* Large tables keep their old buckets for a while,
+                 * and move a few entries over on every change, so
+                 * that no single insertion has to move them all */
+                h->old_buckets = h->buckets;
+                h->old_shift = h->shift;
+                h->rehash_next = 0;
+
+                h->buckets = buckets;
+                h->shift = shift;
+
+                return 0;
+        }
+
+        free(h->buckets);
+        h->buckets = buckets;
+        h->shift = shift;
+
+        for (i = h->iterate_list_head; i != IDX_NIL; i = h->entries[i].iterate_next)
+                buckets_insert(h->buckets, h->shift, h->entries[i].hash, i);
+
+        return 0;
+}
+
+/* Makes room for n entries in total */
+static int reserve(Hashmap *h, unsigned n) {
+        unsigned shift;
+
+        assert(h);
+
+        if (n <= 0 || (h->buckets && n <= capacity(h->shift)))
+                return 0;
+
+        shift = h->buckets ? h->shift : INITIAL_SHIFT;
+        while (capacity(shift) < n) {
+                if (shift >= 31)
+                        return -ENOMEM;
+
+                shift++;
+        }
+
+        return resize(h, shift);
+}
+
+int hashmap_reserve(Hashmap *h, unsigned entries_add) {
+        assert(h);
+
+        if (entries_add > (unsigned) -1 - h->n_entries)
+                return -ENOMEM;
+
+        return reserve(h, h->n_entries + entries_add);
+}
+
+static unsigned buckets_scan(Hashmap *h, struct hashmap_bucket *buckets, unsigned shift,
+                             unsigned hash, const void *key) {
+        unsigned b, mask = (1U << shift) - 1;
+
+        for (b = bucket_home(shift, hash); buckets[b].idx_plus_one != 0; b = (b + 1) & mask)
+                if (buckets[b].hash == hash &&
+                    h->compare_func(h->entries[buckets[b].idx_plus_one - 1].key, key) == 0)
+                        return buckets[b].idx_plus_one - 1;
+
+        return IDX_NIL;
+}
+
+static unsigned hash_scan(Hashmap *h, unsigned hash, const void *key) {
+        unsigned i;
+
+        assert(h);
+
+        /* Returns the index of the key's entry, or IDX_NIL */
+
+        if (!h->buckets)
+                return IDX_NIL;
+
+        i = buckets_scan(h, h->buckets, h->shift, hash, key);
+        if (i == IDX_NIL && h->old_buckets)
+                i = buckets_scan(h, h->old_buckets, h->old_shift, hash, key);
+
+        return i;
+}
+
+static unsigned find_entry(Hashmap *h, const void *key) {
+        assert(h);
+
+        if (!h->buckets)
+                return IDX_NIL;
+
+        return hash_scan(h, h->hash_func(key), key);
+}
+
+static unsigned link_entry(Hashmap *h, const void *key, void *value, unsigned hash) {
+        struct hashmap_entry *e;
+        unsigned i;
+
         assert(h);
-        assert(e);
+        assert(h->buckets);
+        assert(h->n_entries < capacity(h->shift));
 
-        /* Insert into hash table */
-        e->bucket_next = BY_HASH(h)[hash];
-        e->bucket_previous = NULL;
-        if (BY_HASH(h)[hash])
-                BY_HASH(h)[hash]->bucket_previous = e;
-        BY_HASH(h)[hash] = e;
+        /* The caller made sure there is room, and that the key is
+         * not in the hashmap yet */
+
+        if (h->old_buckets)
+                rehash_step(h, REHASH_STEP);
+
+        if (h->free_list != IDX_NIL) {
+                i = h->free_list;
+                h->free_list = h->entries[i].iterate_next;
+        } else {
+                assert(h->n_used < capacity(h->shift));
+                i = h->n_used++;
+        }
+
+        e = h->entries + i;
+        e->key = key;
+        e->value = value;
+        e->hash = hash;
+
+        buckets_insert(h->buckets, h->shift, hash, i);
 
         /* Insert into iteration list */
         e->iterate_previous = h->iterate_list_tail;
-        e->iterate_next = NULL;
-        if (h->iterate_list_tail) {
-                assert(h->iterate_list_head);
-                h->iterate_list_tail->iterate_next = e;
+        e->iterate_next = IDX_NIL;
+        if (h->iterate_list_tail != IDX_NIL) {
+                assert(h->iterate_list_head != IDX_NIL);
+                h->entries[h->iterate_list_tail].iterate_next = i;
         } else {
-                assert(!h->iterate_list_head);
-                h->iterate_list_head = e;
+                assert(h->iterate_list_head == IDX_NIL);
+                h->iterate_list_head = i;
         }
-        h->iterate_list_tail = e;
+        h->iterate_list_tail = i;
 
         h->n_entries++;
         assert(h->n_entries >= 1);
+
+        return i;
 }
 
-static void unlink_entry(Hashmap *h, struct hashmap_entry *e, unsigned hash) {
+static void unlink_entry(Hashmap *h, unsigned i) {
+        struct hashmap_entry *e;
+        unsigned b;
+
         assert(h);
-        assert(e);
+        assert(i < h->n_used);
+
+        if (h->old_buckets)
+                rehash_step(h, REHASH_STEP);
+
+        e = h->entries + i;
 
         /* Remove from iteration list */
-        if (e->iterate_next)
-                e->iterate_next->iterate_previous = e->iterate_previous;
+        if (e->iterate_next != IDX_NIL)
+                h->entries[e->iterate_next].iterate_previous = e->iterate_previous;
         else
                 h->iterate_list_tail = e->iterate_previous;
 
-        if (e->iterate_previous)
-                e->iterate_previous->iterate_next = e->iterate_next;
+        if (e->iterate_previous != IDX_NIL)
+                h->entries[e->iterate_previous].iterate_next = e->iterate_next;
         else
                 h->iterate_list_head = e->iterate_next;
 
-        /* Remove from hash table bucket list */
-        if (e->bucket_next)
-                e->bucket_next->bucket_previous = e->bucket_previous;
+        /* Remove from buckets, the old ones if it is not moved yet */
+        b = buckets_find_idx(h->buckets, h->shift, e->hash, i);
+        if (b != IDX_NIL)
+                buckets_delete(h->buckets, h->shift, b);
+        else {
+                assert(h->old_buckets);
 
-        if (e->bucket_previous)
-                e->bucket_previous->bucket_next = e->bucket_next;
-        else
-                BY_HASH(h)[hash] = e->bucket_next;
+                b = buckets_find_idx(h->old_buckets, h->old_shift, e->hash, i);
+                assert(b != IDX_NIL);
 
-        assert(h->n_entries >= 1);
-        h->n_entries--;
-}
-
-static void remove_entry(Hashmap *h, struct hashmap_entry *e) {
-        unsigned hash;
-
-        assert(h);
-        assert(e);
-
-        hash = h->hash_func(e->key) % NBUCKETS;
+                buckets_delete(h->old_buckets, h->old_shift, b);
+        }
 
-        unlink_entry(h, e, hash);
+        /* Keep it for reuse */
+        e->key = e->value = NULL;
+        e->iterate_next = h->free_list;
+        e->iterate_previous = IDX_NIL;
+        h->free_list = i;
 
-        if (h->from_pool)
-                deallocate_tile(&first_entry_tile, e);
-        else
-                free(e);
+        assert(h->n_entries >= 1);
+        h->n_entries--;
 }
 
 void hashmap_free(Hashmap*h) {
@@ -324,8 +652,16 @@ void hashmap_clear(Hashmap *h) {
         if (!h)
                 return;
 
-        while (h->iterate_list_head)
-                remove_entry(h, h->iterate_list_head);
+        free(h->entries);
+        free(h->buckets);
+        free(h->old_buckets);
+        h->entries = NULL;
+        h->buckets = h->old_buckets = NULL;
+        h->shift = 0;
+
+        h->n_used = h->n_entries = 0;
+        h->free_list = IDX_NIL;
+        h->iterate_list_head = h->iterate_list_tail = IDX_NIL;
 }
 
 void hashmap_clear_free(Hashmap *h) {
@@ -336,80 +672,62 @@ void hashmap_clear_free(Hashmap *h) {
 
         while ((p = hashmap_steal_first(h)))
                 free(p);
+
+        hashmap_clear(h);
 }
 
 void hashmap_clear_free_free(Hashmap *h) {
         if (!h)
                 return;
 
-        while (h->iterate_list_head) {
+        while (h->iterate_list_head != IDX_NIL) {
                 void *a, *b;
 
-                a = h->iterate_list_head->value;
-                b = (void*) h->iterate_list_head->key;
-                remove_entry(h, h->iterate_list_head);
+                a = h->entries[h->iterate_list_head].value;
+                b = (void*) h->entries[h->iterate_list_head].key;
+                unlink_entry(h, h->iterate_list_head);
                 free(a);
                 free(b);
         }
-}
 
-
-static struct hashmap_entry *hash_scan(Hashmap *h, unsigned hash, const void *key) {
-        struct hashmap_entry *e;
-        assert(h);
-        assert(hash < NBUCKETS);
-
-        for (e = BY_HASH(h)[hash]; e; e = e->bucket_next)
-                if (h->compare_func(e->key, key) == 0)
-                        return e;
-
-        return NULL;
+        hashmap_clear(h);
 }
 
 int hashmap_put(Hashmap *h, const void *key, void *value) {
-        struct hashmap_entry *e;
-        unsigned hash;
+        unsigned hash, i;
+        int r;
 
         assert(h);
 
-        hash = h->hash_func(key) % NBUCKETS;
+        hash = h->hash_func(key);
 
-        e = hash_scan(h, hash, key);
-        if (e) {
+        i = hash_scan(h, hash, key);
+        if (i != IDX_NIL) {
 
-                if (e->value == value)
+                if (h->entries[i].value == value)
                         return 0;
 
                 return -EEXIST;
         }
 
-        if (h->from_pool)
-                e = allocate_tile(&first_entry_pool, &first_entry_tile, sizeof(struct hashmap_entry));
-        else
-                e = new(struct hashmap_entry, 1);
-
-        if (!e)
-                return -ENOMEM;
-
-        e->key = key;
-        e->value = value;
+        r = reserve(h, h->n_entries + 1);
+        if (r < 0)
+                return r;
 
-        link_entry(h, e, hash);
+        link_entry(h, key, value, hash);
 
         return 1;
 }
 
 int hashmap_replace(Hashmap *h, const void *key, void *value) {
-        struct hashmap_entry *e;
-        unsigned hash;
+        unsigned i;
 
         assert(h);
 
-        hash = h->hash_func(key) % NBUCKETS;
-        e = hash_scan(h, hash, key);
-        if (e) {
-                e->key = key;
-                e->value = value;
+        i = find_entry(h, key);
+        if (i != IDX_NIL) {
+                h->entries[i].key = key;
+                h->entries[i].value = value;
                 return 0;
         }
 
@@ -417,158 +735,135 @@ int hashmap_replace(Hashmap *h, const void *key, void *value) {
 }
 
 int hashmap_update(Hashmap *h, const void *key, void *value) {
-        struct hashmap_entry *e;
-        unsigned hash;
+        unsigned i;
 
         assert(h);
 
-        hash = h->hash_func(key) % NBUCKETS;
-        e = hash_scan(h, hash, key);
-        if (!e)
+        i = find_entry(h, key);
+        if (i == IDX_NIL)
                 return -ENOENT;
 
-        e->value = value;
+        h->entries[i].value = value;
         return 0;
 }
 
 void* hashmap_get(Hashmap *h, const void *key) {
-        unsigned hash;
-        struct hashmap_entry *e;
+        unsigned i;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % NBUCKETS;
-        e = hash_scan(h, hash, key);
-        if (!e)
+        i = find_entry(h, key);
+        if (i == IDX_NIL)
                 return NULL;
 
-        return e->value;
+        return h->entries[i].value;
 }
 
 void* hashmap_get2(Hashmap *h, const void *key, void **key2) {
-        unsigned hash;
-        struct hashmap_entry *e;
+        unsigned i;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % NBUCKETS;
-        e = hash_scan(h, hash, key);
-        if (!e)
+        i = find_entry(h, key);
+        if (i == IDX_NIL)
                 return NULL;
 
         if (key2)
-                *key2 = (void*) e->key;
+                *key2 = (void*) h->entries[i].key;
 
-        return e->value;
+        return h->entries[i].value;
 }
 
 bool hashmap_contains(Hashmap *h, const void *key) {
-        unsigned hash;
 
         if (!h)
                 return false;
 
-        hash = h->hash_func(key) % NBUCKETS;
-
-        if (!hash_scan(h, hash, key))
-                return false;
-
-        return true;
+        return find_entry(h, key) != IDX_NIL;
 }
 
 void* hashmap_remove(Hashmap *h, const void *key) {
-        struct hashmap_entry *e;
-        unsigned hash;
+        unsigned i;
         void *data;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % NBUCKETS;
-
-        if (!(e = hash_scan(h, hash, key)))
+        i = find_entry(h, key);
+        if (i == IDX_NIL)
                 return NULL;
 
-        data = e->value;
-        remove_entry(h, e);
+        data = h->entries[i].value;
+        unlink_entry(h, i);
 
         return data;
 }
 
 int hashmap_remove_and_put(Hashmap *h, const void *old_key, const void *new_key, void *value) {
-        struct hashmap_entry *e;
-        unsigned old_hash, new_hash;
+        unsigned i;
 
         if (!h)
                 return -ENOENT;
 
-        old_hash = h->hash_func(old_key) % NBUCKETS;
-        if (!(e = hash_scan(h, old_hash, old_key)))
+        i = find_entry(h, old_key);
+        if (i == IDX_NIL)
                 return -ENOENT;
 
-        new_hash = h->hash_func(new_key) % NBUCKETS;
-        if (hash_scan(h, new_hash, new_key))
+        if (find_entry(h, new_key) != IDX_NIL)
                 return -EEXIST;
 
-        unlink_entry(h, e, old_hash);
-
-        e->key = new_key;
-        e->value = value;
-
-        link_entry(h, e, new_hash);
+        /* This frees up the room for the new entry */
+        unlink_entry(h, i);
+        link_entry(h, new_key, value, h->hash_func(new_key));
 
         return 0;
 }
 
 int hashmap_remove_and_replace(Hashmap *h, const void *old_key, const void *new_key, void *value) {
-        struct hashmap_entry *e, *k;
-        unsigned old_hash, new_hash;
+        unsigned i, k;
 
         if (!h)
                 return -ENOENT;
 
-        old_hash = h->hash_func(old_key) % NBUCKETS;
-        if (!(e = hash_scan(h, old_hash, old_key)))
+        i = find_entry(h, old_key);
+        if (i == IDX_NIL)
                 return -ENOENT;
 
-        new_hash = h->hash_func(new_key) % NBUCKETS;
+        k = find_entry(h, new_key);
+        if (k != IDX_NIL && k != i)
+                unlink_entry(h, k);
 
-        if ((k = hash_scan(h, new_hash, new_key)))
-                if (e != k)
-                        remove_entry(h, k);
-
-        unlink_entry(h, e, old_hash);
-
-        e->key = new_key;
-        e->value = value;
-
-        link_entry(h, e, new_hash);
+        unlink_entry(h, i);
+        link_entry(h, new_key, value, h->hash_func(new_key));
 
         return 0;
 }
 
 void* hashmap_remove_value(Hashmap *h, const void *key, void *value) {
-        struct hashmap_entry *e;
-        unsigned hash;
+        unsigned i;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % NBUCKETS;
-
-        if (!(e = hash_scan(h, hash, key)))
+        i = find_entry(h, key);
+        if (i == IDX_NIL)
                 return NULL;
 
-        if (e->value != value)
+        if (h->entries[i].value != value)
                 return NULL;
 
-        remove_entry(h, e);
+        unlink_entry(h, i);
 
         return value;
 }
 
+/* Iterators point to the entry returned next, off by one so that
+ * they don't collide with ITERATOR_FIRST */
+#define IDX_TO_ITERATOR(i) ((Iterator) ((uintptr_t) (i) + 1))
+#define ITERATOR_TO_IDX(i) ((unsigned) ((uintptr_t) (i) - 1))
+
 void *hashmap_iterate(Hashmap *h, Iterator *i, const void **key) {
         struct hashmap_entry *e;
 
@@ -580,13 +875,13 @@ void *hashmap_iterate(Hashmap *h, Iterator *i, const void **key) {
         if (*i == ITERATOR_LAST)
                 goto at_end;
 
-        if (*i == ITERATOR_FIRST && !h->iterate_list_head)
+        if (*i == ITERATOR_FIRST && h->iterate_list_head == IDX_NIL)
                 goto at_end;
 
-        e = *i == ITERATOR_FIRST ? h->iterate_list_head : (struct hashmap_entry*) *i;
+        e = h->entries + (*i == ITERATOR_FIRST ? h->iterate_list_head : ITERATOR_TO_IDX(*i));
 
-        if (e->iterate_next)
-                *i = (Iterator) e->iterate_next;
+        if (e->iterate_next != IDX_NIL)
+                *i = IDX_TO_ITERATOR(e->iterate_next);
         else
                 *i = ITERATOR_LAST;
 
@@ -615,13 +910,13 @@ void *hashmap_iterate_backwards(Hashmap *h, Iterator *i, const void **key) {
         if (*i == ITERATOR_FIRST)
                 goto at_beginning;
 
-        if (*i == ITERATOR_LAST && !h->iterate_list_tail)
+        if (*i == ITERATOR_LAST && h->iterate_list_tail == IDX_NIL)
                 goto at_beginning;
 
-        e = *i == ITERATOR_LAST ? h->iterate_list_tail : (struct hashmap_entry*) *i;
+        e = h->entries + (*i == ITERATOR_LAST ? h->iterate_list_tail : ITERATOR_TO_IDX(*i));
 
-        if (e->iterate_previous)
-                *i = (Iterator) e->iterate_previous;
+        if (e->iterate_previous != IDX_NIL)
+                *i = IDX_TO_ITERATOR(e->iterate_previous);
         else
                 *i = ITERATOR_FIRST;
 
@@ -640,20 +935,18 @@ at_beginning:
 }
 
 void *hashmap_iterate_skip(Hashmap *h, const void *key, Iterator *i) {
-        unsigned hash;
-        struct hashmap_entry *e;
+        unsigned k;
 
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % NBUCKETS;
-
-        if (!(e = hash_scan(h, hash, key)))
+        k = find_entry(h, key);
+        if (k == IDX_NIL)
                 return NULL;
 
-        *i = (Iterator) e;
+        *i = IDX_TO_ITERATOR(k);
 
-        return e->value;
+        return h->entries[k].value;
 }
 
 void* hashmap_first(Hashmap *h) {
@@ -661,10 +954,10 @@ void* hashmap_first(Hashmap *h) {
         if (!h)
                 return NULL;
 
-        if (!h->iterate_list_head)
+        if (h->iterate_list_head == IDX_NIL)
                 return NULL;
 
-        return h->iterate_list_head->value;
+        return h->entries[h->iterate_list_head].value;
 }
 
 void* hashmap_first_key(Hashmap *h) {
@@ -672,10 +965,10 @@ void* hashmap_first_key(Hashmap *h) {
         if (!h)
                 return NULL;
 
-        if (!h->iterate_list_head)
+        if (h->iterate_list_head == IDX_NIL)
                 return NULL;
 
-        return (void*) h->iterate_list_head->key;
+        return (void*) h->entries[h->iterate_list_head].key;
 }
 
 void* hashmap_last(Hashmap *h) {
@@ -683,10 +976,10 @@ void* hashmap_last(Hashmap *h) {
         if (!h)
                 return NULL;
 
-        if (!h->iterate_list_tail)
+        if (h->iterate_list_tail == IDX_NIL)
                 return NULL;
 
-        return h->iterate_list_tail->value;
+        return h->entries[h->iterate_list_tail].value;
 }
 
 void* hashmap_steal_first(Hashmap *h) {
@@ -695,11 +988,11 @@ void* hashmap_steal_first(Hashmap *h) {
         if (!h)
                 return NULL;
 
-        if (!h->iterate_list_head)
+        if (h->iterate_list_head == IDX_NIL)
                 return NULL;
 
-        data = h->iterate_list_head->value;
-        remove_entry(h, h->iterate_list_head);
+        data = h->entries[h->iterate_list_head].value;
+        unlink_entry(h, h->iterate_list_head);
 
         return data;
 }
@@ -710,11 +1003,11 @@ void* hashmap_steal_first_key(Hashmap *h) {
         if (!h)
                 return NULL;
 
-        if (!h->iterate_list_head)
+        if (h->iterate_list_head == IDX_NIL)
                 return NULL;
 
-        key = (void*) h->iterate_list_head->key;
-        remove_entry(h, h->iterate_list_head);
+        key = (void*) h->entries[h->iterate_list_head].key;
+        unlink_entry(h, h->iterate_list_head);
 
         return key;
 }
@@ -727,6 +1020,49 @@ unsigned hashmap_size(Hashmap *h) {
         return h->n_entries;
 }
 
+size_t hashmap_memory_usage(Hashmap *h) {
+        size_t n;
+
+        /* The memory the hashmap itself takes, but not its keys and
+         * values */
+
+        if (!h)
+                return 0;
+
+        n = sizeof(Hashmap);
+        if (h->buckets)
+                n += capacity(h->shift) * sizeof(struct hashmap_entry) +
+                        (1U << h->shift) * sizeof(struct hashmap_bucket);
+        if (h->old_buckets)
+                n += (1U << h->old_shift) * sizeof(struct hashmap_bucket);
+
+        return n;
+}
+
+void hashmap_get_pool_stats(HashmapPoolStats *stats) {
+        struct pool *p;
+        void *t;
+
+        assert(stats);
+
+        /* Only covers the hashmap objects allocated by the main
+         * thread, which come from the pool */
+
+        zero(*stats);
+
+        for (p = first_hashmap_pool; p; p = p->next) {
+                stats->n_pools++;
+                stats->n_tiles += p->n_tiles;
+                stats->n_used += p->n_used;
+                stats->size += PAGE_ALIGN(ALIGN(sizeof(struct pool)) + p->n_tiles*sizeof(Hashmap));
+        }
+
+        for (t = first_hashmap_tile; t; t = * (void**) t)
+                stats->n_free++;
+
+        stats->tile_size = sizeof(Hashmap);
+}
+
 bool hashmap_isempty(Hashmap *h) {
 
         if (!h)
@@ -736,71 +1072,84 @@ bool hashmap_isempty(Hashmap *h) {
 }
 
 int hashmap_merge(Hashmap *h, Hashmap *other) {
-        struct hashmap_entry *e;
+        unsigned i;
+        int r;
 
         assert(h);
 
         if (!other)
                 return 0;
 
-        for (e = other->iterate_list_head; e; e = e->iterate_next) {
-                int r;
+        r = reserve(h, h->n_entries + other->n_entries);
+        if (r < 0)
+                return r;
 
-                if ((r = hashmap_put(h, e->key, e->value)) < 0)
-                        if (r != -EEXIST)
-                                return r;
+        for (i = other->iterate_list_head; i != IDX_NIL; i = other->entries[i].iterate_next) {
+                r = hashmap_put(h, other->entries[i].key, other->entries[i].value);
+                if (r < 0 && r != -EEXIST)
+                        return r;
         }
 
         return 0;
 }
 
-void hashmap_move(Hashmap *h, Hashmap *other) {
-        struct hashmap_entry *e, *n;
+int hashmap_move(Hashmap *h, Hashmap *other) {
+        unsigned i, n;
+        int r;
 
         assert(h);
 
         /* The same as hashmap_merge(), but every new item from other
-         * is moved to h. This function is guaranteed to succeed. */
+         * is moved to h. Either all of them are moved, or, if we
+         * cannot make room for them, none. */
 
         if (!other)
-                return;
+                return 0;
+
+        r = reserve(h, h->n_entries + other->n_entries);
+        if (r < 0)
+                return r;
 
-        for (e = other->iterate_list_head; e; e = n) {
-                unsigned h_hash, other_hash;
+        for (i = other->iterate_list_head; i != IDX_NIL; i = n) {
+                struct hashmap_entry *e = other->entries + i;
+                unsigned h_hash;
 
                 n = e->iterate_next;
 
-                h_hash = h->hash_func(e->key) % NBUCKETS;
+                h_hash = h->hash_func(e->key);
 
-                if (hash_scan(h, h_hash, e->key))
+                if (hash_scan(h, h_hash, e->key) != IDX_NIL)
                         continue;
 
-                other_hash = other->hash_func(e->key) % NBUCKETS;
-
-                unlink_entry(other, e, other_hash);
-                link_entry(h, e, h_hash);
+                link_entry(h, e->key, e->value, h_hash);
+                unlink_entry(other, i);
         }
+
+        return 0;
 }
 
 int hashmap_move_one(Hashmap *h, Hashmap *other, const void *key) {
-        unsigned h_hash, other_hash;
-        struct hashmap_entry *e;
+        unsigned i;
+        int r;
 
         if (!other)
                 return 0;
 
         assert(h);
 
-        h_hash = h->hash_func(key) % NBUCKETS;
-        if (hash_scan(h, h_hash, key))
+        if (find_entry(h, key) != IDX_NIL)
                 return -EEXIST;
 
-        other_hash = other->hash_func(key) % NBUCKETS;
-        if (!(e = hash_scan(other, other_hash, key)))
+        i = find_entry(other, key);
+        if (i == IDX_NIL)
                 return -ENOENT;
 
-        unlink_entry(other, e, other_hash);
-        link_entry(h, e, h_hash);
+        r = reserve(h, h->n_entries + 1);
+        if (r < 0)
+                return r;
+
+        link_entry(h, other->entries[i].key, other->entries[i].value, h->hash_func(key));
+        unlink_entry(other, i);
 
         return 0;
 }
@@ -840,8 +1189,7 @@ char **hashmap_get_strv(Hashmap *h) {
 }
 
 void *hashmap_next(Hashmap *h, const void *key) {
-        unsigned hash;
-        struct hashmap_entry *e;
+        unsigned i;
 
         assert(h);
         assert(key);
@@ -849,14 +1197,13 @@ void *hashmap_next(Hashmap *h, const void *key) {
         if (!h)
                 return NULL;
 
-        hash = h->hash_func(key) % NBUCKETS;
-        e = hash_scan(h, hash, key);
-        if (!e)
+        i = find_entry(h, key);
+        if (i == IDX_NIL)
                 return NULL;
 
-        e = e->iterate_next;
-        if (!e)
+        i = h->entries[i].iterate_next;
+        if (i == IDX_NIL)
                 return NULL;
 
-        return e->value;
+        return h->entries[i].value;
 }
@@ -22,6 +22,7 @@
 ***/
 
 #include <stdbool.h>
+#include <stddef.h>
 
 /* Pretty straightforward hash table implementation. As a minor
  * optimization a NULL hashmap object will be treated as empty hashmap
@@ -53,6 +54,7 @@ void hashmap_free_free(Hashmap *h);
 void hashmap_free_free_free(Hashmap *h);
 Hashmap *hashmap_copy(Hashmap *h);
 int hashmap_ensure_allocated(Hashmap **h, hash_func_t hash_func, compare_func_t compare_func);
+int hashmap_reserve(Hashmap *h, unsigned entries_add);
 
 int hashmap_put(Hashmap *h, const void *key, void *value);
 int hashmap_update(Hashmap *h, const void *key, void *value);
@@ -66,11 +68,23 @@ int hashmap_remove_and_put(Hashmap *h, const void *old_key, const void *new_key,
 int hashmap_remove_and_replace(Hashmap *h, const void *old_key, const void *new_key, void *value);
 
 int hashmap_merge(Hashmap *h, Hashmap *other);
-void hashmap_move(Hashmap *h, Hashmap *other);
+int hashmap_move(Hashmap *h, Hashmap *other);
 int hashmap_move_one(Hashmap *h, Hashmap *other, const void *key);
 
 unsigned hashmap_size(Hashmap *h);
 bool hashmap_isempty(Hashmap *h);
+size_t hashmap_memory_usage(Hashmap *h);
+
+typedef struct HashmapPoolStats {
+        unsigned n_pools;
+        unsigned n_tiles;
+        unsigned n_used; /* handed out at least once */
+        unsigned n_free; /* of those, given back since */
+        size_t tile_size;
+        size_t size;
+} HashmapPoolStats;
+
+void hashmap_get_pool_stats(HashmapPoolStats *stats);
 
 void *hashmap_iterate(Hashmap *h, Iterator *i, const void **key);
 void *hashmap_iterate_backwards(Hashmap *h, Iterator *i, const void **key);
@@ -38,6 +38,7 @@
 #include "conf-files.h"
 #include "specifier.h"
 #include "install-printf.h"
+#include "list.h"
 
 typedef struct {
         Hashmap *will_install;
@@ -354,21 +355,132 @@ static int remove_marked_symlinks(
         return r;
 }
 
-static int find_symlinks_fd(
-                const char *name,
-                int fd,
-                const char *path,
-                const char *config_path,
-                bool *same_name_link) {
+typedef struct SymlinkEntry SymlinkEntry;
 
-        int r = 0;
+struct SymlinkEntry {
+        char *path;
+        char *dest;
+
+        LIST_FIELDS(SymlinkEntry, by_name);
+        LIST_FIELDS(SymlinkEntry, by_dest);
+};
+
+/* All symlinks below one config directory, by the names of both
+ * their ends, so that any number of units can be looked up with a
+ * single walk of the tree */
+typedef struct SymlinkIndex {
+        char *config_path;
+
+        Hashmap *by_name;
+        Hashmap *by_dest;
+
+        /* The first error hit while walking the tree, reported for
+         * the units that weren't found */
+        int error;
+} SymlinkIndex;
+
+/* The indexes of a scope, loaded on first use and shared by all
+ * lookups of one operation */
+typedef struct ScopeSymlinks {
+        UnitFileScope scope;
+        const char *root_dir;
+
+        bool loaded;
+        SymlinkIndex runtime;
+        SymlinkIndex persistent;
+} ScopeSymlinks;
+
+#define _cleanup_scope_symlinks_done_ \
+        __attribute__((cleanup(scope_symlinks_done)))
+
+static void symlink_index_done(SymlinkIndex *x) {
+        SymlinkEntry *head;
+
+        assert(x);
+
+        /* Every entry is on exactly one of the by_name lists */
+        while ((head = hashmap_steal_first(x->by_name))) {
+                SymlinkEntry *e, *n;
+
+                LIST_FOREACH_SAFE(by_name, e, n, head) {
+                        free(e->path);
+                        free(e->dest);
+                        free(e);
+                }
+        }
+
+        hashmap_free(x->by_name);
+        hashmap_free(x->by_dest);
+        free(x->config_path);
+        zero(*x);
+}
+
+static int symlink_index_add(SymlinkIndex *x, char *path, char *dest) {
+        SymlinkEntry *e, *head;
+        const char *k;
+        int r;
+
+        assert(x);
+        assert(path);
+        assert(dest);
+
+        /* Takes possession of path and dest */
+
+        r = hashmap_ensure_allocated(&x->by_name, string_hash_func, string_compare_func);
+        if (r < 0)
+                goto fail;
+
+        r = hashmap_ensure_allocated(&x->by_dest, string_hash_func, string_compare_func);
+        if (r < 0)
+                goto fail;
+
+        e = new0(SymlinkEntry, 1);
+        if (!e) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        e->path = path;
+        e->dest = dest;
+
+        k = path_get_file_name(e->path);
+        head = hashmap_get(x->by_name, k);
+        if (head)
+                LIST_INSERT_AFTER(SymlinkEntry, by_name, head, head, e);
+        else {
+                r = hashmap_put(x->by_name, k, e);
+                if (r < 0) {
+                        free(e);
+                        goto fail;
+                }
+        }
+
+        k = path_get_file_name(e->dest);
+        head = hashmap_get(x->by_dest, k);
+        if (head)
+                LIST_INSERT_AFTER(SymlinkEntry, by_dest, head, head, e);
+        else {
+                r = hashmap_put(x->by_dest, k, e);
+                if (r < 0)
+                        /* Still owned by its by_name list, since
+                         * that went first */
+                        return r;
+        }
+
+        return 0;
+
+fail:
+        free(path);
+        free(dest);
+        return r;
+}
+
+static int symlink_index_add_fd(SymlinkIndex *x, int fd, const char *path) {
         DIR _cleanup_closedir_ *d = NULL;
 
-        assert(name);
+        assert(x);
         assert(fd >= 0);
         assert(path);
-        assert(config_path);
-        assert(same_name_link);
 
         d = fdopendir(fd);
         if (!d) {
@@ -383,10 +495,10 @@ static int find_symlinks_fd(
 
                 k = readdir_r(d, &buf.de, &de);
                 if (k != 0)
-                        return -errno;
+                        return -k;
 
                 if (!de)
-                        return r;
+                        return 0;
 
                 if (ignore_file(de->d_name))
                         continue;
@@ -402,8 +514,8 @@ static int find_symlinks_fd(
                                 if (errno == ENOENT)
                                         continue;
 
-                                if (r == 0)
-                                        r = -errno;
+                                if (x->error == 0)
+                                        x->error = -errno;
                                 continue;
                         }
 
@@ -414,17 +526,14 @@ static int find_symlinks_fd(
                         }
 
                         /* This will close nfd, regardless whether it succeeds or not */
-                        q = find_symlinks_fd(name, nfd, p, config_path, same_name_link);
-
-                        if (q > 0)
-                                return 1;
-
-                        if (r == 0)
-                                r = q;
+                        q = symlink_index_add_fd(x, nfd, p);
+                        if (q == -ENOMEM)
+                                return q;
+                        if (q < 0 && x->error == 0)
+                                x->error = q;
 
                 } else if (de->d_type == DT_LNK) {
-                        char _cleanup_free_ *p = NULL, *dest = NULL;
-                        bool found_path, found_dest, b = false;
+                        char *p, *dest;
                         int q;
 
                         /* Acquire symlink name */
@@ -435,60 +544,31 @@ static int find_symlinks_fd(
                         /* Acquire symlink destination */
                         q = readlink_and_canonicalize(p, &dest);
                         if (q < 0) {
+                                free(p);
+
                                 if (q == -ENOENT)
                                         continue;
 
-                                if (r == 0)
-                                        r = q;
+                                if (x->error == 0)
+                                        x->error = q;
                                 continue;
                         }
 
-                        /* Check if the symlink itself matches what we
-                         * are looking for */
-                        if (path_is_absolute(name))
-                                found_path = path_equal(p, name);
-                        else
-                                found_path = streq(de->d_name, name);
-
-                        /* Check if what the symlink points to
-                         * matches what we are looking for */
-                        if (path_is_absolute(name))
-                                found_dest = path_equal(dest, name);
-                        else
-                                found_dest = streq(path_get_file_name(dest), name);
-
-                        if (found_path && found_dest) {
-                                char _cleanup_free_ *t = NULL;
-
-                                /* Filter out same name links in the main
-                                 * config path */
-                                t = path_make_absolute(name, config_path);
-                                if (!t)
-                                        return -ENOMEM;
-
-                                b = path_equal(t, p);
-                        }
-
-                        if (b)
-                                *same_name_link = true;
-                        else if (found_path || found_dest)
-                                return 1;
+                        q = symlink_index_add(x, p, dest);
+                        if (q < 0)
+                                return q;
                 }
         }
-
-        return r;
 }
 
-static int find_symlinks(
-                const char *name,
-                const char *config_path,
-                bool *same_name_link) {
-
+static int symlink_index_load(SymlinkIndex *x, char *config_path) {
         int fd;
 
-        assert(name);
+        assert(x);
         assert(config_path);
-        assert(same_name_link);
+
+        /* Takes possession of config_path */
+        x->config_path = config_path;
 
         fd = open(config_path, O_RDONLY|O_NONBLOCK|O_DIRECTORY|O_CLOEXEC|O_NOFOLLOW);
         if (fd < 0) {
@@ -498,31 +578,103 @@ static int find_symlinks(
         }
 
         /* This takes possession of fd and closes it */
-        return find_symlinks_fd(name, fd, config_path, config_path, same_name_link);
+        return symlink_index_add_fd(x, fd, config_path);
+}
+
+static int symlink_index_find(SymlinkIndex *x, const char *name, bool *same_name_link) {
+        SymlinkEntry *e;
+
+        assert(x);
+        assert(name);
+        assert(same_name_link);
+
+        /* Links named like the unit count, unless they point to
+         * something of the same name right in the config directory,
+         * which merely links the unit in */
+        LIST_FOREACH(by_name, e, (SymlinkEntry*) hashmap_get(x->by_name, name)) {
+                const char *p;
+
+                if (!streq(path_get_file_name(e->dest), name))
+                        return 1;
+
+                p = path_startswith(e->path, x->config_path);
+                if (!p || !path_equal(p, name))
+                        return 1;
+
+                *same_name_link = true;
+        }
+
+        /* And so do links pointing to the unit, under whatever name */
+        LIST_FOREACH(by_dest, e, (SymlinkEntry*) hashmap_get(x->by_dest, name))
+                if (!streq(path_get_file_name(e->path), name))
+                        return 1;
+
+        return x->error;
+}
+
+static void scope_symlinks_done(ScopeSymlinks *s) {
+        assert(s);
+
+        symlink_index_done(&s->runtime);
+        symlink_index_done(&s->persistent);
+        s->loaded = false;
+}
+
+static int scope_symlinks_load(ScopeSymlinks *s) {
+        char *path;
+        int r;
+
+        assert(s);
+        assert(s->scope >= 0);
+        assert(s->scope < _UNIT_FILE_SCOPE_MAX);
+
+        if (s->loaded)
+                return 0;
+
+        if (s->scope == UNIT_FILE_SYSTEM || s->scope == UNIT_FILE_GLOBAL) {
+                r = get_config_path(s->scope, true, s->root_dir, &path);
+                if (r < 0)
+                        return r;
+
+                r = symlink_index_load(&s->runtime, path);
+                if (r < 0)
+                        goto fail;
+        }
+
+        r = get_config_path(s->scope, false, s->root_dir, &path);
+        if (r < 0)
+                goto fail;
+
+        r = symlink_index_load(&s->persistent, path);
+        if (r < 0)
+                goto fail;
+
+        s->loaded = true;
+        return 0;
+
+fail:
+        scope_symlinks_done(s);
+        return r;
 }
 
 static int find_symlinks_in_scope(
-                UnitFileScope scope,
-                const char *root_dir,
+                ScopeSymlinks *s,
                 const char *name,
                 UnitFileState *state) {
 
         int r;
-        char _cleanup_free_ *path = NULL;
         bool same_name_link_runtime = false, same_name_link = false;
 
-        assert(scope >= 0);
-        assert(scope < _UNIT_FILE_SCOPE_MAX);
+        assert(s);
         assert(name);
 
-        if (scope == UNIT_FILE_SYSTEM || scope == UNIT_FILE_GLOBAL) {
-
-                /* First look in runtime config path */
-                r = get_config_path(scope, true, root_dir, &path);
-                if (r < 0)
-                        return r;
+        r = scope_symlinks_load(s);
+        if (r < 0)
+                return r;
 
-                r = find_symlinks(name, path, &same_name_link_runtime);
+        /* First look in runtime config path */
+        if (s->runtime.config_path) {
+                r = symlink_index_find(&s->runtime, name, &same_name_link_runtime);
                 if (r < 0)
                         return r;
                 else if (r > 0) {
@@ -532,11 +684,7 @@ static int find_symlinks_in_scope(
         }
 
         /* Then look in the normal config path */
-        r = get_config_path(scope, false, root_dir, &path);
-        if (r < 0)
-                return r;
-
-        r = find_symlinks(name, path, &same_name_link);
+        r = symlink_index_find(&s->persistent, name, &same_name_link);
         if (r < 0)
                 return r;
         else if (r > 0) {
@@ -1016,7 +1164,9 @@ static int unit_file_load(
                 return -ENOMEM;
         }
 
-        r = config_parse(NULL, path, f, NULL,
+        /* Only look at the sections we have items for, so that the
+         * rest of the file is skipped without any lookups */
+        r = config_parse(NULL, path, f, "Install\0Exec\0",
                          config_item_table_lookup, (void*) items, true, info);
         if (r < 0)
                 return r;
@@ -1371,7 +1521,9 @@ static int install_context_apply(
                 if (q < 0)
                         return q;
 
-                assert_se(hashmap_move_one(c->have_installed, c->will_install, i->name) == 0);
+                q = hashmap_move_one(c->have_installed, c->will_install, i->name);
+                if (q < 0)
+                        return q;
 
                 q = unit_file_search(c, i, paths, root_dir, false);
                 if (q < 0) {
@@ -1412,7 +1564,9 @@ static int install_context_mark_for_removal(
                 if (q < 0)
                         return q;
 
-                assert_se(hashmap_move_one(c->have_installed, c->will_install, i->name) == 0);
+                q = hashmap_move_one(c->have_installed, c->will_install, i->name);
+                if (q < 0)
+                        return q;
 
                 q = unit_file_search(c, i, paths, root_dir, false);
                 if (q < 0) {
@@ -1578,6 +1732,10 @@ UnitFileState unit_file_get_state(
                 const char *name) {
 
         LookupPaths _cleanup_lookup_paths_free_ paths = {};
+        ScopeSymlinks _cleanup_scope_symlinks_done_ symlinks = {
+                .scope = scope,
+                .root_dir = root_dir,
+        };
         UnitFileState state = _UNIT_FILE_STATE_INVALID;
         char **i;
         char _cleanup_free_ *path = NULL;
@@ -1631,7 +1789,7 @@ UnitFileState unit_file_get_state(
                         return state;
                 }
 
-                r = find_symlinks_in_scope(scope, root_dir, name, &state);
+                r = find_symlinks_in_scope(&symlinks, name, &state);
                 if (r < 0)
                         return r;
                 else if (r > 0)
@@ -1802,6 +1960,10 @@ int unit_file_get_list(
                 Hashmap *h) {
 
         LookupPaths _cleanup_lookup_paths_free_ paths = {};
+        ScopeSymlinks _cleanup_scope_symlinks_done_ symlinks = {
+                .scope = scope,
+                .root_dir = root_dir,
+        };
         char **i;
         char _cleanup_free_ *buf = NULL;
         DIR _cleanup_closedir_ *d = NULL;
@@ -1894,7 +2056,7 @@ int unit_file_get_list(
                                 goto found;
                         }
 
-                        r = find_symlinks_in_scope(scope, root_dir, de->d_name, &f->state);
+                        r = find_symlinks_in_scope(&symlinks, de->d_name, &f->state);
                         if (r < 0)
                                 return r;
                         else if (r > 0) {
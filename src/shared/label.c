@@ -109,7 +109,16 @@ int label_fix(const char *path, bool ignore_enoent, bool ignore_erofs) {
                         return 0;
 
                 if (r == 0) {
-                        r = lsetfilecon(path, fcon);
+                        security_context_t oldcon = NULL;
+
+                        /* Looking at the label is a lot cheaper than
+                         * setting it, and most are right already */
+                        if (lgetfilecon_raw(path, &oldcon) >= 0 && streq(oldcon, fcon))
+                                r = 0;
+                        else
+                                r = lsetfilecon(path, fcon);
+
+                        freecon(oldcon);
                         freecon(fcon);
 
                         /* If the FS doesn't support labels, then exit without warning */
@@ -55,6 +55,19 @@ static bool show_location = false;
  * use here. */
 static char *log_abort_msg = NULL;
 
+/* Messages the journal could not take right away, if queueing is
+ * enabled, oldest first. Daemons that must not lose their logs nor
+ * stall on them flush this from their event loop. */
+#define LOG_QUEUE_MAX 1024U
+#define LOG_QUEUE_BYTES_MAX (4U*1024U*1024U)
+
+static bool log_queue_enabled = false;
+static struct iovec log_queue[LOG_QUEUE_MAX];
+static unsigned log_queue_first = 0, log_queue_n = 0;
+static size_t log_queue_bytes = 0;
+static unsigned log_queue_dropped = 0;
+static pid_t log_queue_pid = 0;
+
 void log_close_console(void) {
 
         if (console_fd < 0)
@@ -280,7 +293,23 @@ void log_set_target(LogTarget target) {
         log_target = target;
 }
 
+static void log_queue_drop(void) {
+
+        while (log_queue_n > 0) {
+                free(log_queue[log_queue_first].iov_base);
+                log_queue_first = (log_queue_first + 1) % LOG_QUEUE_MAX;
+                log_queue_n--;
+        }
+
+        log_queue_first = 0;
+        log_queue_bytes = 0;
+}
+
 void log_close(void) {
+        /* Last chance for whatever is still queued */
+        log_flush();
+        log_queue_drop();
+
         log_close_journal();
         log_close_syslog();
         log_close_kmsg();
@@ -289,6 +318,10 @@ void log_close(void) {
 
 void log_forget_fds(void) {
         console_fd = kmsg_fd = syslog_fd = journal_fd = -1;
+
+        /* The queued messages are the parent's to send */
+        log_queue_drop();
+        log_queue_dropped = 0;
 }
 
 void log_set_max_level(int level) {
@@ -465,6 +498,155 @@ static int log_do_header(char *header, size_t size,
         return 0;
 }
 
+static void log_queue_push(const struct iovec *iovec, unsigned n) {
+        size_t size;
+        uint8_t *p;
+        unsigned i;
+
+        size = IOVEC_TOTAL_SIZE(iovec, n);
+
+        if (log_queue_n <= 0 && log_queue_dropped <= 0)
+                log_queue_pid = getpid();
+
+        if (log_queue_n >= LOG_QUEUE_MAX ||
+            log_queue_bytes + size > LOG_QUEUE_BYTES_MAX) {
+                log_queue_dropped++;
+                return;
+        }
+
+        p = malloc(size);
+        if (!p) {
+                log_queue_dropped++;
+                return;
+        }
+
+        for (i = 0, size = 0; i < n; i++) {
+                memcpy(p + size, iovec[i].iov_base, iovec[i].iov_len);
+                size += iovec[i].iov_len;
+        }
+
+        i = (log_queue_first + log_queue_n) % LOG_QUEUE_MAX;
+        log_queue[i].iov_base = p;
+        log_queue[i].iov_len = size;
+        log_queue_n++;
+        log_queue_bytes += size;
+}
+
+static int log_send_dropped(void) {
+        char header[LINE_MAX], message[LINE_MAX];
+        struct iovec iovec[2] = {};
+        struct msghdr mh = {
+                .msg_iov = iovec,
+                .msg_iovlen = ELEMENTSOF(iovec),
+        };
+
+        log_do_header(header, sizeof(header), log_facility | LOG_WARNING,
+                      NULL, 0, NULL, NULL, NULL);
+
+        snprintf(message, sizeof(message),
+                 "MESSAGE=Dropped %u log messages the journal could not take in time.\n",
+                 log_queue_dropped);
+        char_array_0(message);
+
+        IOVEC_SET_STRING(iovec[0], header);
+        IOVEC_SET_STRING(iovec[1], message);
+
+        if (sendmsg(journal_fd, &mh, MSG_NOSIGNAL|MSG_DONTWAIT) < 0)
+                return -errno;
+
+        log_queue_dropped = 0;
+        return 0;
+}
+
+int log_flush(void) {
+        PROTECT_ERRNO;
+
+        if (log_queue_n <= 0 && log_queue_dropped <= 0)
+                return 0;
+
+        /* Forked off children that log don't get to send what their
+         * parent queued */
+        if (log_queue_pid != getpid()) {
+                log_queue_drop();
+                log_queue_dropped = 0;
+                return 0;
+        }
+
+        if (journal_fd < 0) {
+                /* Nowhere to send them to anymore */
+                log_queue_dropped += log_queue_n;
+                log_queue_drop();
+                return 0;
+        }
+
+        while (log_queue_n > 0) {
+                struct iovec *v = log_queue + log_queue_first;
+                struct msghdr mh = {
+                        .msg_iov = v,
+                        .msg_iovlen = 1,
+                };
+
+                if (sendmsg(journal_fd, &mh, MSG_NOSIGNAL|MSG_DONTWAIT) < 0) {
+                        if (errno == EAGAIN)
+                                return -EAGAIN;
+
+                        /* Cannot be delivered at all, don't let it
+                         * hold up the rest */
+                        log_queue_dropped++;
+                }
+
+                log_queue_bytes -= v->iov_len;
+                free(v->iov_base);
+                log_queue_first = (log_queue_first + 1) % LOG_QUEUE_MAX;
+                log_queue_n--;
+        }
+
+        log_queue_first = 0;
+
+        /* Caught up, hence tell how much got lost on the way */
+        if (log_queue_dropped > 0)
+                if (log_send_dropped() == -EAGAIN)
+                        return -EAGAIN;
+
+        return 0;
+}
+
+void log_set_queue(bool b) {
+        log_queue_enabled = b;
+
+        if (!b) {
+                log_flush();
+                log_queue_drop();
+        }
+}
+
+static int send_to_journal(struct iovec *iovec, unsigned n) {
+        struct msghdr mh = {
+                .msg_iov = iovec,
+                .msg_iovlen = n,
+        };
+
+        if (!log_queue_enabled) {
+                if (sendmsg(journal_fd, &mh, MSG_NOSIGNAL) < 0)
+                        return -errno;
+
+                return 1;
+        }
+
+        /* Keep the order, hence only send directly if nothing is
+         * waiting anymore */
+        if (log_flush() >= 0) {
+                if (sendmsg(journal_fd, &mh, MSG_NOSIGNAL|MSG_DONTWAIT) >= 0)
+                        return 1;
+
+                if (errno != EAGAIN)
+                        return -errno;
+        }
+
+        log_queue_push(iovec, n);
+        return 1;
+}
+
 static int write_to_journal(
         int level,
         const char*file,
@@ -476,7 +658,6 @@ static int write_to_journal(
 
         char header[LINE_MAX];
         struct iovec iovec[4] = {};
-        struct msghdr mh = {};
 
         if (journal_fd < 0)
                 return 0;
@@ -489,13 +670,7 @@ static int write_to_journal(
         IOVEC_SET_STRING(iovec[2], buffer);
         IOVEC_SET_STRING(iovec[3], "\n");
 
-        mh.msg_iov = iovec;
-        mh.msg_iovlen = ELEMENTSOF(iovec);
-
-        if (sendmsg(journal_fd, &mh, MSG_NOSIGNAL) < 0)
-                return -errno;
-
-        return 1;
+        return send_to_journal(iovec, ELEMENTSOF(iovec));
 }
 
 static int log_dispatch(
@@ -737,7 +912,6 @@ int log_struct_internal(
                 char header[LINE_MAX];
                 struct iovec iovec[17] = {};
                 unsigned n = 0, i;
-                struct msghdr mh;
                 static const char nl = '\n';
 
                 /* If the journal is available do structured logging */
@@ -775,14 +949,7 @@ int log_struct_internal(
                         format = va_arg(ap, char *);
                 }
 
-                zero(mh);
-                mh.msg_iov = iovec;
-                mh.msg_iovlen = n;
-
-                if (sendmsg(journal_fd, &mh, MSG_NOSIGNAL) < 0)
-                        r = -errno;
-                else
-                        r = 1;
+                r = send_to_journal(iovec, n);
 
         finish:
                 va_end(ap);
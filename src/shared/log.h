@@ -63,6 +63,15 @@ int log_open(void);
 void log_close(void);
 void log_forget_fds(void);
 
+/* Queue up messages the journal cannot take right away, rather than
+ * falling back to kmsg, and send them on with log_flush(). Loops
+ * calling log_flush() should come back after LOG_FLUSH_RETRY_MSEC if
+ * it returns -EAGAIN. */
+void log_set_queue(bool b);
+int log_flush(void);
+
+#define LOG_FLUSH_RETRY_MSEC 100
+
 void log_close_syslog(void);
 void log_close_journal(void);
 void log_close_kmsg(void);
@@ -26,10 +26,12 @@
 #include <string.h>
 
 #include "logs-show.h"
+#include "journal-internal.h"
 #include "log.h"
 #include "util.h"
 #include "utf8.h"
 #include "hashmap.h"
+#include "strv.h"
 
 #define PRINT_THRESHOLD 128
 #define JSON_THRESHOLD 4096
@@ -54,35 +56,58 @@ static int print_catalog(FILE *f, sd_journal *j) {
         return 0;
 }
 
-static int parse_field(const void *data, size_t length, const char *field, char **target, size_t *target_size) {
+typedef struct ParseFieldVec {
+        const char *field;
+        size_t field_len;
+        char **target;
+        size_t *target_len;
+} ParseFieldVec;
+
+#define PARSE_FIELD_VEC_ENTRY(_field, _target, _target_len)             \
+        { .field = _field, .field_len = sizeof(_field) - 1, .target = _target, .target_len = _target_len }
+
+static int parse_fieldv(const void *data, size_t length, const ParseFieldVec *fields, unsigned n_fields) {
+        const char *eq;
         size_t fl, nl;
-        void *buf;
+        unsigned i;
 
         assert(data);
-        assert(field);
-        assert(target);
-        assert(target_size);
+        assert(fields);
 
-        fl = strlen(field);
-        if (length < fl)
+        /* Looks at the field name only once, and then only compares
+         * it with the fields of the same length, instead of trying
+         * each of them in turn on the data */
+        eq = memchr(data, '=', length);
+        if (!eq)
                 return 0;
 
-        if (memcmp(data, field, fl))
-                return 0;
+        fl = eq - (const char*) data + 1;
 
-        nl = length - fl;
-        buf = malloc(nl+1);
-        if (!buf)
-                return log_oom();
+        for (i = 0; i < n_fields; i++) {
+                const ParseFieldVec *fv = fields + i;
+                char *buf;
+
+                if (fv->field_len != fl ||
+                    fv->field[0] != *(const char*) data ||
+                    memcmp(data, fv->field, fl) != 0)
+                        continue;
+
+                nl = length - fl;
+                buf = malloc(nl+1);
+                if (!buf)
+                        return log_oom();
 
-        memcpy(buf, (const char*) data + fl, nl);
-        ((char*)buf)[nl] = 0;
+                memcpy(buf, eq + 1, nl);
+                buf[nl] = 0;
 
-        free(*target);
-        *target = buf;
-        *target_size = nl;
+                free(*fv->target);
+                *fv->target = buf;
+                *fv->target_len = nl;
 
-        return 1;
+                return 1;
+        }
+
+        return 0;
 }
 
 static bool shall_print(const char *p, size_t l, OutputFlags flags) {
@@ -115,6 +140,17 @@ static int output_short(
         size_t hostname_len = 0, identifier_len = 0, comm_len = 0, pid_len = 0, fake_pid_len = 0, message_len = 0, realtime_len = 0, monotonic_len = 0, priority_len = 0;
         int p = LOG_INFO;
         const char *color_on = "", *color_off = "";
+        const ParseFieldVec fields[] = {
+                PARSE_FIELD_VEC_ENTRY("_PID=", &pid, &pid_len),
+                PARSE_FIELD_VEC_ENTRY("_COMM=", &comm, &comm_len),
+                PARSE_FIELD_VEC_ENTRY("MESSAGE=", &message, &message_len),
+                PARSE_FIELD_VEC_ENTRY("PRIORITY=", &priority, &priority_len),
+                PARSE_FIELD_VEC_ENTRY("_HOSTNAME=", &hostname, &hostname_len),
+                PARSE_FIELD_VEC_ENTRY("SYSLOG_PID=", &fake_pid, &fake_pid_len),
+                PARSE_FIELD_VEC_ENTRY("SYSLOG_IDENTIFIER=", &identifier, &identifier_len),
+                PARSE_FIELD_VEC_ENTRY("_SOURCE_REALTIME_TIMESTAMP=", &realtime, &realtime_len),
+                PARSE_FIELD_VEC_ENTRY("_SOURCE_MONOTONIC_TIMESTAMP=", &monotonic, &monotonic_len),
+        };
 
         assert(f);
         assert(j);
@@ -122,56 +158,7 @@ static int output_short(
         sd_journal_set_data_threshold(j, flags & OUTPUT_SHOW_ALL ? 0 : PRINT_THRESHOLD);
 
         SD_JOURNAL_FOREACH_DATA(j, data, length) {
-
-                r = parse_field(data, length, "PRIORITY=", &priority, &priority_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
-
-                r = parse_field(data, length, "_HOSTNAME=", &hostname, &hostname_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
-
-                r = parse_field(data, length, "SYSLOG_IDENTIFIER=", &identifier, &identifier_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
-
-                r = parse_field(data, length, "_COMM=", &comm, &comm_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
-
-                r = parse_field(data, length, "_PID=", &pid, &pid_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
-
-                r = parse_field(data, length, "SYSLOG_PID=", &fake_pid, &fake_pid_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
-
-                r = parse_field(data, length, "_SOURCE_REALTIME_TIMESTAMP=", &realtime, &realtime_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
-
-                r = parse_field(data, length, "_SOURCE_MONOTONIC_TIMESTAMP=", &monotonic, &monotonic_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
-
-                r = parse_field(data, length, "MESSAGE=", &message, &message_len);
+                r = parse_fieldv(data, length, fields, ELEMENTSOF(fields));
                 if (r < 0)
                         return r;
         }
@@ -470,13 +457,26 @@ void json_escape(
                 fputc('\"', f);
 
                 while (l > 0) {
+                        size_t n;
+
+                        /* Most of the data needs no escaping, copy
+                         * it in runs rather than byte by byte */
+                        for (n = 0; n < l; n++)
+                                if (p[n] == '"' || p[n] == '\\' || (uint8_t) p[n] < ' ')
+                                        break;
+
+                        if (n > 0) {
+                                fwrite(p, 1, n, f);
+                                p += n;
+                                l -= n;
+                                continue;
+                        }
+
                         if (*p == '"' || *p == '\\') {
                                 fputc('\\', f);
                                 fputc(*p, f);
-                        } else if (*p < ' ')
-                                fprintf(f, "\\u%04x", *p);
-                        else
-                                fputc(*p, f);
+                        } else
+                                fprintf(f, "\\u%04x", (uint8_t) *p);
 
                         p++;
                         l--;
@@ -769,8 +769,9 @@ int output_journal(
         if (n_columns <= 0)
                 n_columns = columns();
 
+        /* Not flushed here, that's up to the caller before it
+         * waits for more entries */
         ret = output_funcs[mode](f, j, mode, n_columns, flags);
-        fflush(stdout);
         return ret;
 }
 
@@ -859,6 +860,8 @@ static int show_journal(FILE *f,
                 if (!(flags & OUTPUT_FOLLOW))
                         break;
 
+                fflush(f);
+
                 r = sd_journal_wait(j, (usec_t) -1);
                 if (r < 0)
                         goto finish;
@@ -930,6 +933,46 @@ int add_matches_for_user_unit(sd_journal *j, const char *unit, uid_t uid) {
         return r;
 }
 
+/* Adds archived files to a journal opened with journal_open_newest()
+ * until the last how_many entries matching are known to be among the
+ * files open, newest first */
+static int add_files_for_tail(sd_journal *j, unsigned how_many) {
+        int r;
+
+        assert(j);
+
+        for (;;) {
+                usec_t until, since;
+
+                r = journal_get_deferred_until(j, &until);
+                if (r <= 0)
+                        return r;
+
+                r = sd_journal_seek_tail(j);
+                if (r < 0)
+                        return r;
+
+                r = sd_journal_previous_skip(j, how_many);
+                if (r < 0)
+                        return r;
+
+                if ((unsigned) r >= how_many) {
+                        r = sd_journal_get_realtime_usec(j, &since);
+                        if (r < 0)
+                                return r;
+
+                        /* Whatever we didn't open yet is older */
+                        if (since > until)
+                                return 0;
+                } else
+                        since = until;
+
+                r = journal_add_deferred_files(j, since);
+                if (r <= 0)
+                        return r;
+        }
+}
+
 int show_journal_by_unit(
                 FILE *f,
                 const char *unit,
@@ -952,7 +995,7 @@ int show_journal_by_unit(
         if (how_many <= 0)
                 return 0;
 
-        r = sd_journal_open(&j, jflags);
+        r = journal_open_newest(&j, jflags);
         if (r < 0)
                 return r;
 
@@ -963,6 +1006,10 @@ int show_journal_by_unit(
         if (r < 0)
                 return r;
 
+        r = add_files_for_tail(j, how_many);
+        if (r < 0)
+                return r;
+
         r = show_journal(f, j, mode, n_columns, not_before, how_many, flags);
         if (r < 0)
                 return r;
@@ -970,6 +1017,320 @@ int show_journal_by_unit(
         return 0;
 }
 
+struct JournalTails {
+        sd_journal *journal;
+        Hashmap *units;
+        unsigned how_many;
+        uid_t uid;
+        bool system;
+};
+
+typedef struct JournalTail {
+        char *unit;
+        char **cursors;
+        unsigned n_cursors;
+} JournalTail;
+
+static int get_field(sd_journal *j, const char *field, char **ret) {
+        const void *data;
+        size_t l, fl;
+        int r;
+
+        r = sd_journal_get_data(j, field, &data, &l);
+        if (r < 0)
+                return r;
+
+        fl = strlen(field);
+        if (l <= fl || ((const char*) data)[fl] != '=')
+                return -EBADMSG;
+
+        *ret = strndup((const char*) data + fl + 1, l - fl - 1);
+        if (!*ret)
+                return -ENOMEM;
+
+        return 0;
+}
+
+static bool field_equals(sd_journal *j, const char *field, const char *value) {
+        _cleanup_free_ char *v = NULL;
+
+        return get_field(j, field, &v) >= 0 && streq(v, value);
+}
+
+static int journal_tails_add(JournalTails *t, const char *field) {
+        _cleanup_free_ char *unit = NULL, *cursor = NULL;
+        JournalTail *tail;
+        int r;
+
+        if (get_field(t->journal, field, &unit) < 0)
+                return 0;
+
+        tail = hashmap_get(t->units, unit);
+        if (!tail || tail->n_cursors >= t->how_many)
+                return 0;
+
+        r = sd_journal_get_cursor(t->journal, &cursor);
+        if (r < 0)
+                return r;
+
+        /* Matched by more than one of the unit's matches */
+        if (tail->n_cursors > 0 && streq(tail->cursors[tail->n_cursors - 1], cursor))
+                return 0;
+
+        if (strv_push(&tail->cursors, cursor) < 0)
+                return -ENOMEM;
+
+        cursor = NULL;
+        tail->n_cursors++;
+
+        return tail->n_cursors >= t->how_many;
+}
+
+/* Adds the current entry to the units it belongs to, the same way
+ * add_matches_for_unit() and add_matches_for_user_unit() select
+ * them. Returns how many units are complete now. */
+static int journal_tails_add_entry(JournalTails *t) {
+        int r, n = 0;
+
+        if (t->system) {
+                r = journal_tails_add(t, "_SYSTEMD_UNIT");
+                if (r < 0)
+                        return r;
+                n += r;
+
+                if (field_equals(t->journal, "MESSAGE_ID", "fc2e22bc6ee647b6b90729ab34a250b1")) {
+                        r = journal_tails_add(t, "COREDUMP_UNIT");
+                        if (r < 0)
+                                return r;
+                        n += r;
+                }
+
+                if (field_equals(t->journal, "_PID", "1")) {
+                        r = journal_tails_add(t, "UNIT");
+                        if (r < 0)
+                                return r;
+                        n += r;
+                }
+        } else {
+                char uid[DECIMAL_STR_MAX(uid_t)];
+                const char *fields[] = { "_SYSTEMD_USER_UNIT", "USER_UNIT", "COREDUMP_USER_UNIT" };
+                unsigned i;
+
+                snprintf(uid, sizeof(uid), "%d", t->uid);
+                if (!field_equals(t->journal, "_UID", uid))
+                        return 0;
+
+                for (i = 0; i < ELEMENTSOF(fields); i++) {
+                        r = journal_tails_add(t, fields[i]);
+                        if (r < 0)
+                                return r;
+                        n += r;
+                }
+        }
+
+        return n;
+}
+
+int journal_tails_new(JournalTails **ret, char **units, unsigned how_many, uid_t uid, bool system) {
+        JournalTails *t;
+        char **unit;
+        unsigned n_full = 0, n_units = 0;
+        int r;
+
+        assert(ret);
+
+        t = new0(JournalTails, 1);
+        if (!t)
+                return -ENOMEM;
+
+        t->how_many = how_many;
+        t->uid = uid;
+        t->system = system;
+
+        t->units = hashmap_new(string_hash_func, string_compare_func);
+        if (!t->units) {
+                r = -ENOMEM;
+                goto fail;
+        }
+
+        r = sd_journal_open(&t->journal, SD_JOURNAL_LOCAL_ONLY | system * SD_JOURNAL_SYSTEM_ONLY);
+        if (r < 0)
+                goto fail;
+
+        STRV_FOREACH(unit, units) {
+                JournalTail *tail;
+
+                if (hashmap_get(t->units, *unit))
+                        continue;
+
+                tail = new0(JournalTail, 1);
+                if (!tail) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+
+                tail->unit = strdup(*unit);
+                if (!tail->unit) {
+                        free(tail);
+                        r = -ENOMEM;
+                        goto fail;
+                }
+
+                r = hashmap_put(t->units, tail->unit, tail);
+                if (r < 0) {
+                        free(tail->unit);
+                        free(tail);
+                        goto fail;
+                }
+
+                /* The matches of all units are OR'ed, since the
+                 * journal ORs terms that are joined by disjunctions */
+                if (n_units > 0) {
+                        r = sd_journal_add_disjunction(t->journal);
+                        if (r < 0)
+                                goto fail;
+                }
+
+                if (system)
+                        r = add_matches_for_unit(t->journal, *unit);
+                else
+                        r = add_matches_for_user_unit(t->journal, *unit, uid);
+                if (r < 0)
+                        goto fail;
+
+                n_units++;
+        }
+
+        if (how_many <= 0 || n_units <= 0)
+                goto finish;
+
+        /* Walk backwards once over the entries of all units and
+         * remember the last how_many of each, until all are
+         * complete */
+        r = sd_journal_seek_tail(t->journal);
+        if (r < 0)
+                goto fail;
+
+        while (n_full < n_units) {
+                r = sd_journal_previous(t->journal);
+                if (r < 0)
+                        goto fail;
+                if (r == 0)
+                        break;
+
+                r = journal_tails_add_entry(t);
+                if (r < 0)
+                        goto fail;
+
+                n_full += r;
+        }
+
+finish:
+        *ret = t;
+        return 0;
+
+fail:
+        journal_tails_free(t);
+        return r;
+}
+
+void journal_tails_free(JournalTails *t) {
+        JournalTail *tail;
+
+        if (!t)
+                return;
+
+        while ((tail = hashmap_steal_first(t->units))) {
+                free(tail->unit);
+                strv_free(tail->cursors);
+                free(tail);
+        }
+
+        hashmap_free(t->units);
+
+        if (t->journal)
+                sd_journal_close(t->journal);
+
+        free(t);
+}
+
+int show_journal_tail(
+                FILE *f,
+                JournalTails *t,
+                const char *unit,
+                OutputMode mode,
+                unsigned n_columns,
+                usec_t not_before,
+                OutputFlags flags) {
+
+        JournalTail *tail;
+        unsigned i, line = 0;
+        int r;
+
+        assert(t);
+        assert(unit);
+        assert(mode >= 0);
+        assert(mode < _OUTPUT_MODE_MAX);
+
+        tail = hashmap_get(t->units, unit);
+        if (!tail)
+                return -ENOENT;
+
+        /* Like show_journal(), but only for the entries collected
+         * before, from oldest to newest */
+        for (i = tail->n_cursors; i > 0; i--) {
+                usec_t usec;
+
+                r = sd_journal_seek_cursor(t->journal, tail->cursors[i - 1]);
+                if (r < 0)
+                        return r;
+
+                r = sd_journal_next(t->journal);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        continue;
+
+                if (not_before > 0) {
+                        r = sd_journal_get_monotonic_usec(t->journal, &usec, NULL);
+
+                        /* -ESTALE is returned if the
+                           timestamp is not from this boot */
+                        if (r == -ESTALE)
+                                continue;
+                        else if (r < 0)
+                                return r;
+
+                        if (usec < not_before)
+                                continue;
+                }
+
+                line++;
+
+                r = output_journal(f, t->journal, mode, n_columns, flags);
+                if (r < 0)
+                        return r;
+        }
+
+        if ((flags & OUTPUT_WARN_CUTOFF) && line < t->how_many && not_before > 0) {
+                sd_id128_t boot_id;
+                usec_t cutoff;
+
+                r = sd_id128_get_boot(&boot_id);
+                if (r < 0)
+                        return r;
+
+                r = sd_journal_get_cutoff_monotonic_usec(t->journal, boot_id, &cutoff, NULL);
+                if (r < 0)
+                        return r;
+
+                if (r > 0 && not_before < cutoff)
+                        fprintf(f, "Warning: Journal has been rotated since unit was started. Log output is incomplete or unavailable.\n");
+        }
+
+        return 0;
+}
+
 static const char *const output_mode_table[_OUTPUT_MODE_MAX] = {
         [OUTPUT_SHORT] = "short",
         [OUTPUT_SHORT_MONOTONIC] = "short-monotonic",
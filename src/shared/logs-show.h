@@ -57,6 +57,28 @@ int show_journal_by_unit(
                 OutputFlags flags,
                 bool system);
 
+/* Collects the last entries of several units in one pass over the
+ * journal, to be shown unit by unit with show_journal_tail() */
+typedef struct JournalTails JournalTails;
+
+int journal_tails_new(
+                JournalTails **ret,
+                char **units,
+                unsigned how_many,
+                uid_t uid,
+                bool system);
+
+void journal_tails_free(JournalTails *t);
+
+int show_journal_tail(
+                FILE *f,
+                JournalTails *t,
+                const char *unit,
+                OutputMode mode,
+                unsigned n_columns,
+                usec_t not_before,
+                OutputFlags flags);
+
 void json_escape(
                 FILE *f,
                 const char* p,
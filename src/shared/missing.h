@@ -24,8 +24,11 @@
 /* Missing glibc definitions to access certain kernel APIs */
 
 #include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <linux/oom.h>
@@ -56,6 +59,21 @@
 #define F_GETPIPE_SZ (F_LINUX_SPECIFIC_BASE + 8)
 #endif
 
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (F_LINUX_SPECIFIC_BASE + 9)
+#define F_GET_SEALS (F_LINUX_SPECIFIC_BASE + 10)
+
+#define F_SEAL_SEAL     0x0001   /* prevent further seals from being set */
+#define F_SEAL_SHRINK   0x0002   /* prevent file from shrinking */
+#define F_SEAL_GROW     0x0004   /* prevent file from growing */
+#define F_SEAL_WRITE    0x0008   /* prevent writes */
+#endif
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC       0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
 #ifndef IP_FREEBIND
 #define IP_FREEBIND 15
 #endif
@@ -84,6 +102,10 @@
 #define IP_TRANSPARENT 19
 #endif
 
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT 15
+#endif
+
 #if !HAVE_DECL_PIVOT_ROOT
 static inline int pivot_root(const char *new_root, const char *put_old) {
         return syscall(SYS_pivot_root, new_root, put_old);
@@ -250,6 +272,161 @@ static inline int name_to_handle_at(int fd, const char *name, struct file_handle
 }
 #endif
 
+#if defined __x86_64__
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create 319
+#  endif
+#elif defined __i386__
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create 356
+#  endif
+#elif defined __arm__
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create 385
+#  endif
+#elif defined __aarch64__
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create 279
+#  endif
+#elif defined __powerpc__
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create 360
+#  endif
+#else
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create -1
+#  endif
+#endif
+
+#if !HAVE_DECL_MEMFD_CREATE
+static inline int memfd_create(const char *name, unsigned int flags) {
+#  if __NR_memfd_create >= 0
+        return syscall(__NR_memfd_create, name, flags);
+#  else
+        errno = ENOSYS;
+        return -1;
+#  endif
+}
+#endif
+
+#if defined __x86_64__
+#  ifndef __NR_getrandom
+#    define __NR_getrandom 318
+#  endif
+#elif defined __i386__
+#  ifndef __NR_getrandom
+#    define __NR_getrandom 355
+#  endif
+#elif defined __arm__
+#  ifndef __NR_getrandom
+#    define __NR_getrandom 384
+#  endif
+#elif defined __aarch64__
+#  ifndef __NR_getrandom
+#    define __NR_getrandom 278
+#  endif
+#elif defined __powerpc__
+#  ifndef __NR_getrandom
+#    define __NR_getrandom 359
+#  endif
+#else
+#  ifndef __NR_getrandom
+#    define __NR_getrandom -1
+#  endif
+#endif
+
+#if !HAVE_DECL_GETRANDOM
+static inline int getrandom(void *buffer, size_t count, unsigned flags) {
+#  if __NR_getrandom >= 0
+        return syscall(__NR_getrandom, buffer, count, flags);
+#  else
+        errno = ENOSYS;
+        return -1;
+#  endif
+}
+#endif
+
+#ifndef GRND_NONBLOCK
+#define GRND_NONBLOCK 0x0001
+#endif
+
+#if defined __x86_64__
+#  ifndef __NR_statx
+#    define __NR_statx 332
+#  endif
+#elif defined __i386__
+#  ifndef __NR_statx
+#    define __NR_statx 383
+#  endif
+#elif defined __arm__
+#  ifndef __NR_statx
+#    define __NR_statx 397
+#  endif
+#elif defined __aarch64__
+#  ifndef __NR_statx
+#    define __NR_statx 291
+#  endif
+#elif defined __powerpc__
+#  ifndef __NR_statx
+#    define __NR_statx 383
+#  endif
+#else
+#  ifndef __NR_statx
+#    define __NR_statx -1
+#  endif
+#endif
+
+#ifndef STATX_BTIME
+struct statx_timestamp {
+        int64_t tv_sec;
+        uint32_t tv_nsec;
+        int32_t __reserved;
+};
+
+struct statx {
+        uint32_t stx_mask;
+        uint32_t stx_blksize;
+        uint64_t stx_attributes;
+        uint32_t stx_nlink;
+        uint32_t stx_uid;
+        uint32_t stx_gid;
+        uint16_t stx_mode;
+        uint16_t __spare0[1];
+        uint64_t stx_ino;
+        uint64_t stx_size;
+        uint64_t stx_blocks;
+        uint64_t stx_attributes_mask;
+        struct statx_timestamp stx_atime;
+        struct statx_timestamp stx_btime;
+        struct statx_timestamp stx_ctime;
+        struct statx_timestamp stx_mtime;
+        uint32_t stx_rdev_major;
+        uint32_t stx_rdev_minor;
+        uint32_t stx_dev_major;
+        uint32_t stx_dev_minor;
+        uint64_t __spare2[14];
+};
+
+#define STATX_BTIME 0x00000800U
+#endif
+
+#if !HAVE_DECL_STATX
+static inline int statx(int dfd, const char *filename, int flags, unsigned int mask, struct statx *buffer) {
+#  if __NR_statx >= 0
+        return syscall(__NR_statx, dfd, filename, flags, mask, buffer);
+#  else
+        errno = ENOSYS;
+        return -1;
+#  endif
+}
+#endif
+
+#if !HAVE_DECL_GETDENTS64
+static inline ssize_t getdents64(int fd, void *buffer, size_t length) {
+        return syscall(__NR_getdents64, fd, buffer, length);
+}
+#endif
+
 #ifndef HAVE_SECURE_GETENV
 #  ifdef HAVE___SECURE_GETENV
 #    define secure_getenv __secure_getenv
@@ -92,7 +92,8 @@ static char** user_dirs(
         const char *home, *e;
         char *config_home = NULL, *data_home = NULL;
         char **config_dirs = NULL, **data_dirs = NULL;
-        char **r = NULL, **t;
+        _cleanup_strv_builder_free_ StrvBuilder b = {};
+        char **r = NULL;
 
         /* Implement the mechanisms defined in
          *
@@ -150,73 +151,20 @@ static char** user_dirs(
                 goto fail;
 
         /* Now merge everything we found. */
-        if (generator_early) {
-                t = strv_append(r, generator_early);
-                if (!t)
-                        goto fail;
-                strv_free(r);
-                r = t;
-        }
-
-        if (config_home) {
-                t = strv_append(r, config_home);
-                if (!t)
-                        goto fail;
-                strv_free(r);
-                r = t;
-        }
-
-        if (!strv_isempty(config_dirs)) {
-                t = strv_merge_concat(r, config_dirs, "/systemd/user");
-                if (!t)
-                        goto finish;
-                strv_free(r);
-                r = t;
-        }
-
-        t = strv_merge(r, (char**) config_unit_paths);
-        if (!t)
+        if (strv_builder_extend(&b, generator_early) < 0 ||
+            strv_builder_extend(&b, config_home) < 0 ||
+            strv_builder_extend_strv(&b, config_dirs, "/systemd/user") < 0 ||
+            strv_builder_extend_strv(&b, (char**) config_unit_paths, NULL) < 0 ||
+            strv_builder_extend(&b, generator) < 0 ||
+            strv_builder_extend(&b, data_home) < 0 ||
+            strv_builder_extend_strv(&b, data_dirs, "/systemd/user") < 0 ||
+            strv_builder_extend_strv(&b, (char**) data_unit_paths, NULL) < 0 ||
+            strv_builder_extend(&b, generator_late) < 0)
                 goto fail;
-        strv_free(r);
-        r = t;
 
-        if (generator) {
-                t = strv_append(r, generator);
-                if (!t)
-                        goto fail;
-                strv_free(r);
-                r = t;
-        }
-
-        if (data_home) {
-                t = strv_append(r, data_home);
-                if (!t)
-                        goto fail;
-                strv_free(r);
-                r = t;
-        }
-
-        if (!strv_isempty(data_dirs)) {
-                t = strv_merge_concat(r, data_dirs, "/systemd/user");
-                if (!t)
-                        goto fail;
-                strv_free(r);
-                r = t;
-        }
-
-        t = strv_merge(r, (char**) data_unit_paths);
-        if (!t)
+        r = strv_builder_steal(&b);
+        if (!r)
                 goto fail;
-        strv_free(r);
-        r = t;
-
-        if (generator_late) {
-                t = strv_append(r, generator_late);
-                if (!t)
-                        goto fail;
-                strv_free(r);
-                r = t;
-        }
 
         if (!path_strv_make_absolute_cwd(r))
                 goto fail;
@@ -0,0 +1,290 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <string.h>
+
+#include "util.h"
+#include "strv.h"
+#include "path-trie.h"
+
+struct PathTrie {
+        /* The component this node is reached by, NULL for the root */
+        char *name;
+
+        Hashmap *children;
+        Set *values;
+};
+
+PathTrie *path_trie_new(void) {
+        return new0(PathTrie, 1);
+}
+
+void path_trie_free(PathTrie *t) {
+        PathTrie *c;
+
+        if (!t)
+                return;
+
+        while ((c = hashmap_steal_first(t->children)))
+                path_trie_free(c);
+
+        hashmap_free(t->children);
+        set_free(t->values);
+        free(t->name);
+        free(t);
+}
+
+/* Returns the next component of *path and its length, or NULL at the
+ * end */
+static const char *next_component(const char **path, size_t *l) {
+        const char *c;
+
+        assert(path);
+        assert(l);
+
+        c = *path + strspn(*path, "/");
+        if (*c == 0)
+                return NULL;
+
+        *l = strcspn(c, "/");
+        *path = c + *l;
+
+        return c;
+}
+
+static PathTrie *child_get(PathTrie *t, const char *c, size_t l) {
+        char *k;
+
+        assert(t);
+
+        k = strndupa(c, l);
+        return hashmap_get(t->children, k);
+}
+
+int path_trie_add(PathTrie *t, const char *path, void *value) {
+        const char *c;
+        size_t l;
+        int r;
+
+        assert(t);
+        assert(path);
+        assert(value);
+
+        /* path_startswith() never matches relative against absolute
+         * paths, and all we deal with are absolute ones */
+        if (path[0] != '/')
+                return 0;
+
+        while ((c = next_component(&path, &l))) {
+                PathTrie *n;
+
+                n = child_get(t, c, l);
+                if (!n) {
+                        r = hashmap_ensure_allocated(&t->children, string_hash_func, string_compare_func);
+                        if (r < 0)
+                                return r;
+
+                        n = new0(PathTrie, 1);
+                        if (!n)
+                                return -ENOMEM;
+
+                        n->name = strndup(c, l);
+                        if (!n->name) {
+                                free(n);
+                                return -ENOMEM;
+                        }
+
+                        r = hashmap_put(t->children, n->name, n);
+                        if (r < 0) {
+                                path_trie_free(n);
+                                return r;
+                        }
+                }
+
+                t = n;
+        }
+
+        r = set_ensure_allocated(&t->values, trivial_hash_func, trivial_compare_func);
+        if (r < 0)
+                return r;
+
+        r = set_put(t->values, value);
+        if (r < 0 && r != -EEXIST)
+                return r;
+
+        return 0;
+}
+
+/* Returns true if t became empty and may be dropped by its parent */
+static bool trie_remove(PathTrie *t, const char *path, void *value) {
+        const char *c;
+        size_t l;
+
+        c = next_component(&path, &l);
+        if (c) {
+                PathTrie *n;
+
+                n = child_get(t, c, l);
+                if (!n)
+                        return false;
+
+                if (trie_remove(n, path, value)) {
+                        hashmap_remove(t->children, n->name);
+                        path_trie_free(n);
+                }
+        } else
+                set_remove(t->values, value);
+
+        return set_isempty(t->values) && hashmap_isempty(t->children);
+}
+
+void path_trie_remove(PathTrie *t, const char *path, void *value) {
+        assert(path);
+        assert(value);
+
+        if (!t || path[0] != '/')
+                return;
+
+        /* Never drop the root itself */
+        trie_remove(t, path, value);
+}
+
+static int add_values(Set *s, Set *values) {
+        Iterator i;
+        void *v;
+        int r;
+
+        assert(s);
+
+        SET_FOREACH(v, values, i) {
+                r = set_put(s, v);
+                if (r < 0 && r != -EEXIST)
+                        return r;
+        }
+
+        return 0;
+}
+
+int path_trie_find_above(PathTrie *t, const char *path, Set *s) {
+        const char *c;
+        size_t l;
+        int r;
+
+        assert(path);
+        assert(s);
+
+        if (!t || path[0] != '/')
+                return 0;
+
+        for (;;) {
+                r = add_values(s, t->values);
+                if (r < 0)
+                        return r;
+
+                c = next_component(&path, &l);
+                if (!c)
+                        return 0;
+
+                t = child_get(t, c, l);
+                if (!t)
+                        return 0;
+        }
+}
+
+static int add_subtree(PathTrie *t, Set *s) {
+        Iterator i;
+        PathTrie *c;
+        int r;
+
+        assert(t);
+        assert(s);
+
+        r = add_values(s, t->values);
+        if (r < 0)
+                return r;
+
+        HASHMAP_FOREACH(c, t->children, i) {
+                r = add_subtree(c, s);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+int path_trie_find_below(PathTrie *t, const char *path, Set *s) {
+        const char *c;
+        size_t l;
+
+        assert(path);
+        assert(s);
+
+        if (!t || path[0] != '/')
+                return 0;
+
+        while ((c = next_component(&path, &l))) {
+                t = child_get(t, c, l);
+                if (!t)
+                        return 0;
+        }
+
+        return add_subtree(t, s);
+}
+
+int path_trie_list_children(PathTrie *t, const char *path, char ***l) {
+        const char *c;
+        PathTrie *n;
+        Iterator i;
+        char **e;
+        size_t k, j;
+        int r = 0;
+
+        assert(path);
+        assert(l);
+
+        if (!t || path[0] != '/')
+                return 0;
+
+        while ((c = next_component(&path, &k))) {
+                t = child_get(t, c, k);
+                if (!t)
+                        return 0;
+        }
+
+        /* Make room for all of them at once, there might be many */
+        j = strv_length(*l);
+        e = realloc(*l, sizeof(char*) * (j + hashmap_size(t->children) + 1));
+        if (!e)
+                return -ENOMEM;
+        *l = e;
+
+        HASHMAP_FOREACH(n, t->children, i) {
+                e[j] = strdup(n->name);
+                if (!e[j]) {
+                        r = -ENOMEM;
+                        break;
+                }
+
+                j++;
+        }
+
+        e[j] = NULL;
+        return r;
+}
@@ -0,0 +1,44 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "set.h"
+
+/* A trie over the components of absolute paths, with a set of values
+ * attached to each path. Components are compared like
+ * path_startswith() does, i.e. duplicate slashes don't matter. */
+
+typedef struct PathTrie PathTrie;
+
+PathTrie *path_trie_new(void);
+void path_trie_free(PathTrie *t);
+
+int path_trie_add(PathTrie *t, const char *path, void *value);
+void path_trie_remove(PathTrie *t, const char *path, void *value);
+
+/* Add the values of the path itself and of all its parents to s */
+int path_trie_find_above(PathTrie *t, const char *path, Set *s);
+
+/* Add the values of the path itself and of everything below it to s */
+int path_trie_find_below(PathTrie *t, const char *path, Set *s);
+
+/* Add the names of the components directly below the path to l, for
+ * which values exist somewhere underneath */
+int path_trie_list_children(PathTrie *t, const char *path, char ***l);
@@ -22,6 +22,14 @@
 #include "util.h"
 #include "prioq.h"
 
+/* An implicit d-ary heap. Binary heaps are the default, but a wider
+ * fan-out makes the heap shallower and keeps the children of an item
+ * on a single cache line, which pays off for large queues that are
+ * shuffled down a lot, for example the timer queues and the
+ * journal's merge heap. */
+
+#define PRIOQ_ARITY_MAX 16
+
 struct prioq_item {
         void *data;
         unsigned *idx;
@@ -30,21 +38,29 @@ struct prioq_item {
 struct Prioq {
         compare_func_t compare_func;
         unsigned n_items, n_allocated;
+        unsigned arity;
 
         struct prioq_item *items;
 };
 
-Prioq *prioq_new(compare_func_t compare_func) {
+Prioq *prioq_new_arity(compare_func_t compare_func, unsigned arity) {
         Prioq *q;
 
+        assert(arity >= 2 && arity <= PRIOQ_ARITY_MAX);
+
         q = new0(Prioq, 1);
         if (!q)
                 return q;
 
         q->compare_func = compare_func;
+        q->arity = arity;
         return q;
 }
 
+Prioq *prioq_new(compare_func_t compare_func) {
+        return prioq_new_arity(compare_func, 2);
+}
+
 void prioq_free(Prioq *q) {
         if (!q)
                 return;
@@ -66,107 +82,107 @@ int prioq_ensure_allocated(Prioq **q, compare_func_t compare_func) {
         return 0;
 }
 
-static void swap(Prioq *q, unsigned j, unsigned k) {
-        void *saved_data;
-        unsigned *saved_idx;
+static void set_item(Prioq *q, unsigned k, const struct prioq_item *i) {
+        q->items[k] = *i;
 
-        assert(q);
-        assert(j < q->n_items);
-        assert(k < q->n_items);
-
-        assert(!q->items[j].idx || *(q->items[j].idx) == j);
-        assert(!q->items[k].idx || *(q->items[k].idx) == k);
-
-        saved_data = q->items[j].data;
-        saved_idx = q->items[j].idx;
-        q->items[j].data = q->items[k].data;
-        q->items[j].idx = q->items[k].idx;
-        q->items[k].data = saved_data;
-        q->items[k].idx = saved_idx;
-
-        if (q->items[j].idx)
-                *q->items[j].idx = j;
-
-        if (q->items[k].idx)
-                *q->items[k].idx = k;
+        if (i->idx)
+                *i->idx = k;
 }
 
+/* Both of these move a hole rather than swapping items, so that each
+ * item passed by is written only once */
 static unsigned shuffle_up(Prioq *q, unsigned idx) {
+        struct prioq_item i;
+
         assert(q);
+        assert(idx < q->n_items);
+        assert(!q->items[idx].idx || *(q->items[idx].idx) == idx);
+
+        i = q->items[idx];
 
         while (idx > 0) {
                 unsigned k;
 
-                k = (idx-1)/2;
+                k = (idx-1) / q->arity;
 
-                if (q->compare_func(q->items[k].data, q->items[idx].data) < 0)
+                if (q->compare_func(q->items[k].data, i.data) < 0)
                         break;
 
-                swap(q, idx, k);
+                set_item(q, idx, q->items + k);
                 idx = k;
         }
 
+        set_item(q, idx, &i);
         return idx;
 }
 
 static unsigned shuffle_down(Prioq *q, unsigned idx) {
+        struct prioq_item i;
+
         assert(q);
+        assert(idx < q->n_items);
+        assert(!q->items[idx].idx || *(q->items[idx].idx) == idx);
+
+        i = q->items[idx];
 
         for (;;) {
                 unsigned j, k, s;
 
-                k = (idx+1)*2; /* right child */
-                j = k-1;       /* left child */
-
+                j = idx * q->arity + 1; /* first child */
                 if (j >= q->n_items)
                         break;
 
-                if (q->compare_func(q->items[j].data, q->items[idx].data) < 0)
-
-                        /* So our left child is smaller than we are, let's
-                         * remember this fact */
-                        s = j;
-                else
-                        s = idx;
-
-                if (k < q->n_items &&
-                    q->compare_func(q->items[k].data, q->items[s].data) < 0)
-
-                        /* So our right child is smaller than we are, let's
-                         * remember this fact */
-                        s = k;
+                k = MIN(j + q->arity, q->n_items);
 
-                /* s now points to the smallest of the three items */
+                /* Find the smallest of our children */
+                for (s = j++; j < k; j++)
+                        if (q->compare_func(q->items[j].data, q->items[s].data) < 0)
+                                s = j;
 
-                if (s == idx)
-                        /* No swap necessary, we're done */
+                if (q->compare_func(q->items[s].data, i.data) >= 0)
+                        /* No child smaller than we are, we're done */
                         break;
 
-                swap(q, idx, s);
+                set_item(q, idx, q->items + s);
                 idx = s;
         }
 
+        set_item(q, idx, &i);
         return idx;
 }
 
+static int grow(Prioq *q, unsigned n_add) {
+        unsigned n;
+        struct prioq_item *j;
+
+        assert(q);
+
+        if (q->n_items + n_add <= q->n_allocated)
+                return 0;
+
+        if (q->n_items + n_add < q->n_items)
+                return -ENOMEM;
+
+        n = MAX((q->n_items + n_add) * 2, 16u);
+        j = realloc(q->items, sizeof(struct prioq_item) * n);
+        if (!j)
+                return -ENOMEM;
+
+        q->items = j;
+        q->n_allocated = n;
+        return 0;
+}
+
 int prioq_put(Prioq *q, void *data, unsigned *idx) {
         struct prioq_item *i;
         unsigned k;
+        int r;
 
         assert(q);
 
-        if (q->n_items >= q->n_allocated) {
-                unsigned n;
-                struct prioq_item *j;
-
-                n = MAX((q->n_items+1) * 2, 16u);
-                j = realloc(q->items, sizeof(struct prioq_item) * n);
-                if (!j)
-                        return -ENOMEM;
-
-                q->items = j;
-                q->n_allocated = n;
-        }
+        r = grow(q, 1);
+        if (r < 0)
+                return r;
 
         k = q->n_items++;
         i = q->items + k;
@@ -181,6 +197,45 @@ int prioq_put(Prioq *q, void *data, unsigned *idx) {
         return 0;
 }
 
+int prioq_put_many(Prioq *q, void **data, unsigned **idx, unsigned n) {
+        unsigned k, old;
+        int r;
+
+        assert(q);
+        assert(data || n == 0);
+
+        r = grow(q, n);
+        if (r < 0)
+                return r;
+
+        old = q->n_items;
+
+        for (k = 0; k < n; k++) {
+                struct prioq_item i = {
+                        .data = data[k],
+                        .idx = idx ? idx[k] : NULL,
+                };
+
+                set_item(q, q->n_items++, &i);
+        }
+
+        if (n < old) {
+                /* Only a few new items, sift them up one by one */
+                for (k = old; k < q->n_items; k++)
+                        shuffle_up(q, k);
+
+                return 0;
+        }
+
+        /* Otherwise rebuild the whole heap bottom-up, which only takes
+         * linear time */
+        if (q->n_items > 1)
+                for (k = (q->n_items - 2) / q->arity + 1; k > 0; k--)
+                        shuffle_down(q, k - 1);
+
+        return 0;
+}
+
 static void remove_item(Prioq *q, struct prioq_item *i) {
         struct prioq_item *l;
 
@@ -217,7 +272,7 @@ static struct prioq_item* find_item(Prioq *q, void *data, unsigned *idx) {
         assert(q);
 
         if (idx) {
-                if (*idx > q->n_items)
+                if (*idx >= q->n_items)
                         return NULL;
 
                 i = q->items + *idx;
@@ -26,10 +26,12 @@
 typedef struct Prioq Prioq;
 
 Prioq *prioq_new(compare_func_t compare);
+Prioq *prioq_new_arity(compare_func_t compare, unsigned arity);
 void prioq_free(Prioq *q);
 int prioq_ensure_allocated(Prioq **q, compare_func_t compare_func);
 
 int prioq_put(Prioq *q, void *data, unsigned *idx);
+int prioq_put_many(Prioq *q, void **data, unsigned **idx, unsigned n);
 int prioq_remove(Prioq *q, void *data, unsigned *idx);
 int prioq_reshuffle(Prioq *q, void *data, unsigned *idx);
 
@@ -23,6 +23,8 @@
 
 #include "ratelimit.h"
 #include "log.h"
+#include "hashmap.h"
+#include "list.h"
 
 /* Modelled after Linux' lib/ratelimit.c by Dave Young
  * <hidave.darkstar@gmail.com>, which is licensed GPLv2. */
@@ -55,3 +57,146 @@ good:
         r->num++;
         return true;
 }
+
+typedef struct RateLimitEntry RateLimitEntry;
+
+struct RateLimitEntry {
+        char *key;
+        RateLimit limit;
+        unsigned suppressed;
+
+        LIST_FIELDS(RateLimitEntry, lru);
+};
+
+struct RateLimitMap {
+        usec_t interval;
+        unsigned burst;
+        unsigned max;
+
+        Hashmap *entries;
+
+        /* Most recently used first */
+        RateLimitEntry *lru, *lru_tail;
+};
+
+RateLimitMap *ratelimit_map_new(usec_t interval, unsigned burst, unsigned max) {
+        RateLimitMap *m;
+
+        assert(max > 0);
+
+        m = new0(RateLimitMap, 1);
+        if (!m)
+                return NULL;
+
+        m->entries = hashmap_new(string_hash_func, string_compare_func);
+        if (!m->entries) {
+                free(m);
+                return NULL;
+        }
+
+        m->interval = interval;
+        m->burst = burst;
+        m->max = max;
+
+        return m;
+}
+
+static void ratelimit_entry_free(RateLimitMap *m, RateLimitEntry *e) {
+        assert(m);
+        assert(e);
+
+        hashmap_remove(m->entries, e->key);
+
+        if (e == m->lru_tail)
+                m->lru_tail = e->lru_prev;
+        LIST_REMOVE(RateLimitEntry, lru, m->lru, e);
+
+        free(e->key);
+        free(e);
+}
+
+void ratelimit_map_free(RateLimitMap *m) {
+        if (!m)
+                return;
+
+        while (m->lru)
+                ratelimit_entry_free(m, m->lru);
+
+        hashmap_free(m->entries);
+        free(m);
+}
+
+static RateLimitEntry *ratelimit_map_get(RateLimitMap *m, const char *key) {
+        RateLimitEntry *e;
+
+        e = hashmap_get(m->entries, key);
+        if (e) {
+                /* Move to the front */
+                if (e != m->lru) {
+                        if (e == m->lru_tail)
+                                m->lru_tail = e->lru_prev;
+
+                        LIST_REMOVE(RateLimitEntry, lru, m->lru, e);
+                        LIST_PREPEND(RateLimitEntry, lru, m->lru, e);
+                }
+
+                return e;
+        }
+
+        if (hashmap_size(m->entries) >= m->max)
+                ratelimit_entry_free(m, m->lru_tail);
+
+        e = new0(RateLimitEntry, 1);
+        if (!e)
+                return NULL;
+
+        e->key = strdup(key);
+        if (!e->key) {
+                free(e);
+                return NULL;
+        }
+
+        if (hashmap_put(m->entries, e->key, e) < 0) {
+                free(e->key);
+                free(e);
+                return NULL;
+        }
+
+        RATELIMIT_INIT(e->limit, m->interval, m->burst);
+
+        LIST_PREPEND(RateLimitEntry, lru, m->lru, e);
+        if (!m->lru_tail)
+                m->lru_tail = e;
+
+        return e;
+}
+
+bool ratelimit_map_test(RateLimitMap *m, const char *key, unsigned *suppressed) {
+        RateLimitEntry *e;
+
+        assert(m);
+        assert(key);
+
+        /* Returns true if another event for key may pass, and, in
+         * suppressed, how many were held back since the last one
+         * that did. If we run out of memory we let it pass, rather
+         * than losing it. */
+
+        if (suppressed)
+                *suppressed = 0;
+
+        e = ratelimit_map_get(m, key);
+        if (!e)
+                return true;
+
+        if (!ratelimit_test(&e->limit)) {
+                e->suppressed++;
+                return false;
+        }
+
+        if (suppressed)
+                *suppressed = e->suppressed;
+        e->suppressed = 0;
+
+        return true;
+}
@@ -55,3 +55,12 @@ typedef struct RateLimit {
         } while (false)
 
 bool ratelimit_test(RateLimit *r);
+
+/* A RateLimit for each of a bounded number of keys, forgetting the
+ * least recently used ones first, for limiting messages per source */
+typedef struct RateLimitMap RateLimitMap;
+
+RateLimitMap *ratelimit_map_new(usec_t interval, unsigned burst, unsigned max);
+void ratelimit_map_free(RateLimitMap *m);
+
+bool ratelimit_map_test(RateLimitMap *m, const char *key, unsigned *suppressed);
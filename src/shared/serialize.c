@@ -0,0 +1,305 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "serialize.h"
+#include "sparse-endian.h"
+#include "util.h"
+
+/* The text format starts with a printable key, never with a NUL byte */
+static const char binary_magic[8] = { 0, 'S', 'D', 'S', 'T', 'A', 'T', 'E' };
+
+typedef struct _packed_ BinaryHeader {
+        char magic[8];
+        le32_t version;
+} BinaryHeader;
+
+/* Key and value follow, each with a terminating NUL that is included
+ * in the sizes, so that they can be read in one go and used in
+ * place. A key size of 0 is the end marker. */
+typedef struct _packed_ BinaryItem {
+        le16_t key_size;
+        le32_t value_size;
+} BinaryItem;
+
+/* Items up to this size are assembled on the stack and written with a
+ * single call */
+#define ITEM_BUFFER_SIZE 512
+
+int serialize_header(FILE *f, bool binary) {
+        BinaryHeader h;
+
+        assert(f);
+
+        if (!binary)
+                return 0;
+
+        memcpy(h.magic, binary_magic, sizeof(h.magic));
+        h.version = htole32(SERIALIZE_BINARY_VERSION);
+
+        if (fwrite(&h, sizeof(h), 1, f) != 1)
+                return -EIO;
+
+        return 0;
+}
+
+int deserialize_header(FILE *f, bool *binary) {
+        BinaryHeader h;
+        int c;
+
+        assert(f);
+        assert(binary);
+
+        c = getc(f);
+        if (c == EOF) {
+                *binary = false;
+                return ferror(f) ? -EIO : 0;
+        }
+
+        if (c != binary_magic[0]) {
+                if (ungetc(c, f) == EOF)
+                        return -EIO;
+
+                *binary = false;
+                return 0;
+        }
+
+        h.magic[0] = c;
+        if (fread(h.magic + 1, sizeof(h) - 1, 1, f) != 1)
+                return -EBADMSG;
+
+        if (memcmp(h.magic, binary_magic, sizeof(h.magic)) != 0)
+                return -EBADMSG;
+
+        if (le32toh(h.version) > SERIALIZE_BINARY_VERSION)
+                return -EPROTONOSUPPORT;
+
+        *binary = true;
+        return 0;
+}
+
+static void serialize_binary_item(FILE *f, const char *key, size_t key_size, const char *value, size_t value_size) {
+        union {
+                BinaryItem item;
+                uint8_t bytes[ITEM_BUFFER_SIZE];
+        } buf;
+        size_t n;
+
+        assert(key_size <= 0xFFFF);
+        assert(value_size <= SERIALIZE_VALUE_MAX);
+
+        buf.item.key_size = htole16((uint16_t) key_size);
+        buf.item.value_size = htole32((uint32_t) value_size);
+
+        n = sizeof(BinaryItem) + key_size + value_size;
+        if (n <= sizeof(buf)) {
+                memcpy(buf.bytes + sizeof(BinaryItem), key, key_size);
+                memcpy(buf.bytes + sizeof(BinaryItem) + key_size, value, value_size);
+                fwrite(buf.bytes, n, 1, f);
+                return;
+        }
+
+        fwrite(&buf.item, sizeof(BinaryItem), 1, f);
+        fwrite(key, key_size, 1, f);
+        fwrite(value, value_size, 1, f);
+}
+
+/* Writes key with value, or just key if value is NULL, as used for
+ * section start markers */
+void serialize_item(FILE *f, bool binary, const char *key, const char *value) {
+        assert(f);
+        assert(key);
+        assert(key[0]);
+
+        if (binary)
+                serialize_binary_item(f,
+                                      key, strlen(key) + 1,
+                                      value ? value : "", value ? strlen(value) + 1 : 1);
+        else if (value)
+                fprintf(f, "%s=%s\n", key, value);
+        else {
+                fputs(key, f);
+                fputc('\n', f);
+        }
+}
+
+void serialize_item_formatv(FILE *f, bool binary, const char *key, const char *format, va_list ap) {
+        _cleanup_free_ char *value = NULL;
+        char buf[ITEM_BUFFER_SIZE];
+        va_list aq;
+        int n;
+
+        assert(f);
+        assert(key);
+        assert(format);
+
+        if (!binary) {
+                fputs(key, f);
+                fputc('=', f);
+                vfprintf(f, format, ap);
+                fputc('\n', f);
+                return;
+        }
+
+        /* Most values are short numbers, avoid the allocation for
+         * them */
+        va_copy(aq, ap);
+        n = vsnprintf(buf, sizeof(buf), format, aq);
+        va_end(aq);
+
+        if (n < 0)
+                return;
+
+        if ((size_t) n < sizeof(buf)) {
+                serialize_binary_item(f, key, strlen(key) + 1, buf, n + 1);
+                return;
+        }
+
+        n = vasprintf(&value, format, ap);
+        if (n < 0) {
+                value = NULL;
+                log_oom();
+                return;
+        }
+
+        serialize_binary_item(f, key, strlen(key) + 1, value, n + 1);
+}
+
+void serialize_item_format(FILE *f, bool binary, const char *key, const char *format, ...) {
+        va_list ap;
+
+        va_start(ap, format);
+        serialize_item_formatv(f, binary, key, format, ap);
+        va_end(ap);
+}
+
+void serialize_dual_timestamp(FILE *f, bool binary, const char *key, dual_timestamp *t) {
+        assert(f);
+        assert(key);
+        assert(t);
+
+        if (!binary) {
+                dual_timestamp_serialize(f, key, t);
+                return;
+        }
+
+        if (!dual_timestamp_is_set(t))
+                return;
+
+        serialize_item_format(f, true, key, "%llu %llu",
+                              (unsigned long long) t->realtime,
+                              (unsigned long long) t->monotonic);
+}
+
+void serialize_end(FILE *f, bool binary) {
+        assert(f);
+
+        if (binary)
+                serialize_binary_item(f, "", 0, "", 0);
+        else
+                fputc('\n', f);
+}
+
+static int deserialize_text_item(FILE *f, char **buffer, size_t *allocated, char **key, char **value) {
+        char *l;
+        size_t k;
+
+        if (!GREEDY_REALLOC(*buffer, *allocated, LINE_MAX))
+                return -ENOMEM;
+
+        if (!fgets(*buffer, LINE_MAX, f)) {
+                if (feof(f))
+                        return 0;
+
+                return errno > 0 ? -errno : -EIO;
+        }
+
+        l = strstrip(*buffer);
+
+        /* End marker */
+        if (l[0] == 0)
+                return 0;
+
+        k = strcspn(l, "=");
+
+        if (l[k] == '=') {
+                l[k] = 0;
+                *value = l+k+1;
+        } else
+                *value = l+k;
+
+        *key = l;
+        return 1;
+}
+
+static int deserialize_binary_item(FILE *f, char **buffer, size_t *allocated, char **key, char **value) {
+        size_t key_size, value_size;
+        BinaryItem i;
+        size_t n;
+
+        n = fread(&i, 1, sizeof(i), f);
+        if (n == 0 && feof(f))
+                return 0;
+        if (n != sizeof(i))
+                return ferror(f) ? -EIO : -EBADMSG;
+
+        key_size = le16toh(i.key_size);
+        value_size = le32toh(i.value_size);
+
+        /* End marker */
+        if (key_size == 0)
+                return value_size == 0 ? 0 : -EBADMSG;
+
+        if (value_size == 0 || value_size > SERIALIZE_VALUE_MAX)
+                return -EBADMSG;
+
+        if (!GREEDY_REALLOC(*buffer, *allocated, key_size + value_size))
+                return -ENOMEM;
+
+        if (fread(*buffer, key_size + value_size, 1, f) != 1)
+                return -EBADMSG;
+
+        if ((*buffer)[key_size - 1] != 0 ||
+            (*buffer)[key_size + value_size - 1] != 0)
+                return -EBADMSG;
+
+        *key = *buffer;
+        *value = *buffer + key_size;
+        return 1;
+}
+
+/* Returns 1 and the next item in key and value, pointing into buffer,
+ * or 0 at the end of a section and at the end of the file, which can
+ * be told apart with feof() */
+int deserialize_item(FILE *f, bool binary, char **buffer, size_t *allocated, char **key, char **value) {
+        assert(f);
+        assert(buffer);
+        assert(allocated);
+        assert(key);
+        assert(value);
+
+        if (binary)
+                return deserialize_binary_item(f, buffer, allocated, key, value);
+
+        return deserialize_text_item(f, buffer, allocated, key, value);
+}
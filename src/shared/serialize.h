@@ -0,0 +1,52 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "macro.h"
+#include "time-util.h"
+
+/* The state passed on across reloads and reexecution is a sequence of
+ * key/value items, grouped into sections that end with an end marker.
+ *
+ * In the text format each item is a "key=value" line and the end
+ * marker an empty line. The binary format starts with a header
+ * carrying a version, and frames each item with the lengths of key
+ * and value, so that reading it needs no line splitting or stripping,
+ * and values are neither length limited nor escaped. */
+
+#define SERIALIZE_BINARY_VERSION 1
+
+/* Upper limit for a single value, to catch corrupted streams */
+#define SERIALIZE_VALUE_MAX (16U*1024U*1024U)
+
+int serialize_header(FILE *f, bool binary);
+int deserialize_header(FILE *f, bool *binary);
+
+void serialize_item(FILE *f, bool binary, const char *key, const char *value);
+void serialize_item_formatv(FILE *f, bool binary, const char *key, const char *format, va_list ap) _printf_attr_(4, 0);
+void serialize_item_format(FILE *f, bool binary, const char *key, const char *format, ...) _printf_attr_(4, 5);
+void serialize_dual_timestamp(FILE *f, bool binary, const char *key, dual_timestamp *t);
+void serialize_end(FILE *f, bool binary);
+
+int deserialize_item(FILE *f, bool binary, char **buffer, size_t *allocated, char **key, char **value);
@@ -77,6 +77,10 @@ bool set_isempty(Set *s) {
         return hashmap_isempty(MAKE_HASHMAP(s));
 }
 
+size_t set_memory_usage(Set *s) {
+        return hashmap_memory_usage(MAKE_HASHMAP(s));
+}
+
 void *set_iterate(Set *s, Iterator *i) {
         return hashmap_iterate(MAKE_HASHMAP(s), i, NULL);
 }
@@ -105,7 +109,7 @@ int set_merge(Set *s, Set *other) {
         return hashmap_merge(MAKE_HASHMAP(s), MAKE_HASHMAP(other));
 }
 
-void set_move(Set *s, Set *other) {
+int set_move(Set *s, Set *other) {
         return hashmap_move(MAKE_HASHMAP(s), MAKE_HASHMAP(other));
 }
 
@@ -0,0 +1,98 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "siphash24.h"
+
+/* SipHash-2-4, as described by Jean-Philippe Aumasson and Daniel
+ * J. Bernstein in "SipHash: a fast short-input PRF". Input and key
+ * are read as little-endian, regardless of the host. */
+
+#define ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                                                        \
+        do {                                                            \
+                v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+                v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                  \
+                v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                  \
+                v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+        } while (false)
+
+static uint64_t load64_le(const uint8_t *p) {
+        return
+                (uint64_t) p[0] |
+                ((uint64_t) p[1] << 8) |
+                ((uint64_t) p[2] << 16) |
+                ((uint64_t) p[3] << 24) |
+                ((uint64_t) p[4] << 32) |
+                ((uint64_t) p[5] << 40) |
+                ((uint64_t) p[6] << 48) |
+                ((uint64_t) p[7] << 56);
+}
+
+uint64_t siphash24(const void *in, size_t inlen, const uint8_t k[16]) {
+        const uint8_t *m = in, *end;
+        uint64_t k0, k1, v0, v1, v2, v3, b;
+        unsigned left;
+
+        k0 = load64_le(k);
+        k1 = load64_le(k + 8);
+
+        v0 = UINT64_C(0x736f6d6570736575) ^ k0;
+        v1 = UINT64_C(0x646f72616e646f6d) ^ k1;
+        v2 = UINT64_C(0x6c7967656e657261) ^ k0;
+        v3 = UINT64_C(0x7465646279746573) ^ k1;
+
+        end = m + (inlen & ~(size_t) 7);
+        left = inlen & 7;
+        b = (uint64_t) inlen << 56;
+
+        for (; m < end; m += 8) {
+                uint64_t w;
+
+                w = load64_le(m);
+                v3 ^= w;
+                SIPROUND;
+                SIPROUND;
+                v0 ^= w;
+        }
+
+        switch (left) {
+        case 7: b |= (uint64_t) m[6] << 48;
+        case 6: b |= (uint64_t) m[5] << 40;
+        case 5: b |= (uint64_t) m[4] << 32;
+        case 4: b |= (uint64_t) m[3] << 24;
+        case 3: b |= (uint64_t) m[2] << 16;
+        case 2: b |= (uint64_t) m[1] << 8;
+        case 1: b |= (uint64_t) m[0];
+        case 0: break;
+        }
+
+        v3 ^= b;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= b;
+
+        v2 ^= 0xff;
+        SIPROUND;
+        SIPROUND;
+        SIPROUND;
+        SIPROUND;
+
+        return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -424,6 +424,104 @@ int strv_extend(char ***l, const char *value) {
         return r;
 }
 
+int strv_builder_push(StrvBuilder *b, char *value) {
+        assert(b);
+
+        if (!value)
+                return 0;
+
+        if (!GREEDY_REALLOC(b->l, b->allocated, b->n + 2))
+                return -ENOMEM;
+
+        b->l[b->n++] = value;
+        b->l[b->n] = NULL;
+
+        return 0;
+}
+
+int strv_builder_extend(StrvBuilder *b, const char *value) {
+        char *v;
+        int r;
+
+        assert(b);
+
+        if (!value)
+                return 0;
+
+        v = strdup(value);
+        if (!v)
+                return -ENOMEM;
+
+        r = strv_builder_push(b, v);
+        if (r < 0)
+                free(v);
+
+        return r;
+}
+
+int strv_builder_extend_strv(StrvBuilder *b, char **l, const char *suffix) {
+        char **i;
+
+        assert(b);
+
+        /* Appends copies of all strings of l, each with suffix
+         * appended if one is given */
+
+        if (!GREEDY_REALLOC(b->l, b->allocated, b->n + strv_length(l) + 1))
+                return -ENOMEM;
+
+        STRV_FOREACH(i, l) {
+                char *v;
+                int r;
+
+                v = suffix ? strappend(*i, suffix) : strdup(*i);
+                if (!v)
+                        return -ENOMEM;
+
+                r = strv_builder_push(b, v);
+                if (r < 0) {
+                        free(v);
+                        return r;
+                }
+        }
+
+        return 0;
+}
+
+char **strv_builder_steal(StrvBuilder *b) {
+        char **l;
+
+        assert(b);
+
+        /* Returns the list built so far, which is empty rather than
+         * NULL if nothing was appended. Hence NULL means OOM. */
+
+        if (!GREEDY_REALLOC(b->l, b->allocated, b->n + 1))
+                return NULL;
+
+        b->l[b->n] = NULL;
+
+        l = b->l;
+        b->l = NULL;
+        b->n = 0;
+        b->allocated = 0;
+
+        return l;
+}
+
+void strv_builder_free(StrvBuilder *b) {
+        assert(b);
+
+        if (b->l) {
+                b->l[b->n] = NULL;
+                strv_free(b->l);
+        }
+
+        b->l = NULL;
+        b->n = 0;
+        b->allocated = 0;
+}
+
 char **strv_uniq(char **l) {
         char **i;
 
@@ -43,6 +43,22 @@ char **strv_append(char **l, const char *s);
 int strv_extend(char ***l, const char *value);
 int strv_push(char ***l, char *value);
 
+/* A string list that tracks its length and allocated size, so that
+ * appending to it takes amortized constant time. Zero-initialize it,
+ * append, and then either take the list with strv_builder_steal(), or
+ * release it with strv_builder_free(). */
+typedef struct StrvBuilder {
+        char **l;
+        unsigned n;
+        size_t allocated;
+} StrvBuilder;
+
+int strv_builder_push(StrvBuilder *b, char *value);
+int strv_builder_extend(StrvBuilder *b, const char *value);
+int strv_builder_extend_strv(StrvBuilder *b, char **l, const char *suffix);
+char **strv_builder_steal(StrvBuilder *b);
+void strv_builder_free(StrvBuilder *b);
+
 char **strv_remove(char **l, const char *s);
 char **strv_remove_prefix(char **l, const char *s);
 char **strv_uniq(char **l);
@@ -0,0 +1,50 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+/* Static tracepoints (USDT) for latency analysis with perf, bpftrace
+ * or SystemTap. With --enable-tracepoints they compile to a single
+ * nop each, plus a note in the ELF file telling the tracer where the
+ * nop is and how to find the arguments. Without, they compile to
+ * nothing, and their arguments are not evaluated.
+ *
+ * All probes use the provider "systemd", for example:
+ *
+ *   bpftrace -e 'usdt:/usr/lib/systemd/systemd:systemd:job_finish { ... }'
+ *
+ * Only pass arguments which are cheap to compute, i.e. plain
+ * integers and strings that exist anyway. */
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+
+#define TRACE0(name)                    DTRACE_PROBE(systemd, name)
+#define TRACE1(name, a)                 DTRACE_PROBE1(systemd, name, a)
+#define TRACE2(name, a, b)              DTRACE_PROBE2(systemd, name, a, b)
+#define TRACE3(name, a, b, c)           DTRACE_PROBE3(systemd, name, a, b, c)
+#define TRACE4(name, a, b, c, d)        DTRACE_PROBE4(systemd, name, a, b, c, d)
+#else
+#define TRACE0(name)                    do {} while (0)
+#define TRACE1(name, a)                 do {} while (0)
+#define TRACE2(name, a, b)              do {} while (0)
+#define TRACE3(name, a, b, c)           do {} while (0)
+#define TRACE4(name, a, b, c, d)        do {} while (0)
+#endif
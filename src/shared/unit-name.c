@@ -27,11 +27,30 @@
 #include "util.h"
 #include "unit-name.h"
 
-#define VALID_CHARS                             \
-        "0123456789"                            \
-        "abcdefghijklmnopqrstuvwxyz"            \
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"            \
-        ":-_.\\"
+/* Classes of the bytes that may appear in unit names, looked up
+ * directly instead of searching a list of the valid characters for
+ * each of them */
+enum {
+        CHAR_PREFIX   = 1,  /* valid in the prefix */
+        CHAR_INSTANCE = 2,  /* valid in the instance */
+        CHAR_PLAIN    = 4,  /* valid, and not escaped in paths */
+};
+
+#define CHAR_VALID (CHAR_PREFIX|CHAR_INSTANCE)
+
+static const uint8_t char_class[256] = {
+        ['0' ... '9'] = CHAR_VALID|CHAR_PLAIN,
+        ['a' ... 'z'] = CHAR_VALID|CHAR_PLAIN,
+        ['A' ... 'Z'] = CHAR_VALID|CHAR_PLAIN,
+        [':'] = CHAR_VALID|CHAR_PLAIN,
+        ['_'] = CHAR_VALID|CHAR_PLAIN,
+        ['.'] = CHAR_VALID|CHAR_PLAIN,
+        ['-'] = CHAR_VALID,
+        ['\\'] = CHAR_VALID,
+        ['@'] = CHAR_INSTANCE,
+};
+
+#define char_is(c, class) (char_class[(uint8_t) (c)] & (class))
 
 static const char* const unit_type_table[_UNIT_TYPE_MAX] = {
         [UNIT_SERVICE] = "service",
@@ -69,24 +88,30 @@ bool unit_name_is_valid(const char *n, bool template_ok) {
 
         assert(n);
 
-        if (strlen(n) >= UNIT_NAME_MAX)
+        /* The suffix consists of valid characters only too, hence
+         * check everything in one go, remembering where the parts
+         * start */
+        for (i = n, e = at = NULL; *i; i++) {
+
+                if (!char_is(*i, CHAR_INSTANCE))
+                        return false;
+
+                if (*i == '.')
+                        e = i;
+                else if (*i == '@' && !at)
+                        at = i;
+        }
+
+        if (i - n >= UNIT_NAME_MAX)
                 return false;
 
-        e = strrchr(n, '.');
         if (!e || e == n)
                 return false;
 
         if (unit_type_from_string(e + 1) < 0)
                 return false;
 
-        for (i = n, at = NULL; i < e; i++) {
-
-                if (*i == '@' && !at)
-                        at = i;
-
-                if (!strchr("@" VALID_CHARS, *i))
-                        return false;
-        }
+        /* An @ in the suffix makes it invalid anyway */
 
         if (at) {
                 if (at == n)
@@ -112,7 +137,7 @@ bool unit_instance_is_valid(const char *i) {
          * allow them in the prefix! */
 
         for (; *i; i++)
-                if (!strchr("@" VALID_CHARS, *i))
+                if (!char_is(*i, CHAR_INSTANCE))
                         return false;
 
         return true;
@@ -126,7 +151,7 @@ bool unit_prefix_is_valid(const char *p) {
                 return false;
 
         for (; *p; p++)
-                if (!strchr(VALID_CHARS, *p))
+                if (!char_is(*p, CHAR_PREFIX))
                         return false;
 
         return true;
@@ -232,7 +257,7 @@ static char *do_escape(const char *f, char *t) {
         for (; *f; f++) {
                 if (*f == '/')
                         *(t++) = '-';
-                else if (*f == '-' || *f == '\\' || !strchr(VALID_CHARS, *f))
+                else if (!char_is(*f, CHAR_PLAIN))
                         t = do_escape_char(*f, t);
                 else
                         *(t++) = *f;
@@ -241,35 +266,59 @@ static char *do_escape(const char *f, char *t) {
         return t;
 }
 
-char *unit_name_escape(const char *f) {
-        char *r, *t;
+/* Like do_escape(), but for a path, dropping all leading, trailing
+ * and duplicate slashes on the way, as path_kill_slashes() would */
+static char *do_path_escape(const char *f, char *t) {
+        assert(f);
+        assert(t);
 
-        r = new(char, strlen(f)*4+1);
-        if (!r)
-                return NULL;
+        if (!*f)
+                return t;
 
-        t = do_escape(f, r);
-        *t = 0;
+        f += strspn(f, "/");
 
-        return r;
+        /* The root directory */
+        if (!*f) {
+                *(t++) = '-';
+                return t;
+        }
+
+        if (*f == '.') {
+                t = do_escape_char(*f, t);
+                f++;
+        }
+
+        for (; *f; f++) {
+                if (*f == '/') {
+                        f += strspn(f, "/") - 1;
+                        if (!f[1])
+                                break;
+
+                        *(t++) = '-';
+                } else if (!char_is(*f, CHAR_PLAIN))
+                        t = do_escape_char(*f, t);
+                else
+                        *(t++) = *f;
+        }
+
+        return t;
 }
 
-char *unit_name_unescape(const char *f) {
-        char *r, *t;
+/* Unescapes the l bytes at f into t, which may be f itself */
+static char *do_unescape(const char *f, size_t l, char *t) {
+        const char *end = f + l;
 
         assert(f);
+        assert(t);
 
-        r = strdup(f);
-        if (!r)
-                return NULL;
-
-        for (t = r; *f; f++) {
+        for (; f < end; f++) {
                 if (*f == '-')
                         *(t++) = '/';
                 else if (*f == '\\') {
                         int a, b;
 
-                        if (f[1] != 'x' ||
+                        if (end - f < 4 ||
+                            f[1] != 'x' ||
                             (a = unhexchar(f[2])) < 0 ||
                             (b = unhexchar(f[3])) < 0) {
                                 /* Invalid escape code, let's take it literal then */
@@ -282,52 +331,77 @@ char *unit_name_unescape(const char *f) {
                         *(t++) = *f;
         }
 
+        return t;
+}
+
+char *unit_name_escape(const char *f) {
+        char *r, *t;
+
+        r = new(char, strlen(f)*4+1);
+        if (!r)
+                return NULL;
+
+        t = do_escape(f, r);
         *t = 0;
 
         return r;
 }
 
-char *unit_name_path_escape(const char *f) {
-        char *p, *e;
+char *unit_name_unescape(const char *f) {
+        char *r, *t;
 
         assert(f);
 
-        p = strdup(f);
-        if (!p)
+        r = strdup(f);
+        if (!r)
                 return NULL;
 
-        path_kill_slashes(p);
-
-        if (streq(p, "/")) {
-                free(p);
-                return strdup("-");
-        }
-
-        e = unit_name_escape(p[0] == '/' ? p + 1 : p);
-        free(p);
+        t = do_unescape(r, strlen(r), r);
+        *t = 0;
 
-        return e;
+        return r;
 }
 
-char *unit_name_path_unescape(const char *f) {
-        char *e;
+char *unit_name_path_escape(const char *f) {
+        char *r, *t;
 
         assert(f);
 
-        e = unit_name_unescape(f);
-        if (!e)
+        r = new(char, strlen(f)*4+2);
+        if (!r)
                 return NULL;
 
-        if (e[0] != '/') {
-                char *w;
+        t = do_path_escape(f, r);
+        *t = 0;
 
-                w = strappend("/", e);
-                free(e);
+        return r;
+}
 
-                return w;
-        }
+/* Unescapes the l bytes at f as a path, which is made absolute */
+static char *do_path_unescape(const char *f, size_t l) {
+        char *r, *t;
+
+        /* Unescaping only ever gets shorter, but we might need to
+         * prepend a slash */
+        r = new(char, l + 2);
+        if (!r)
+                return NULL;
+
+        t = do_unescape(f, l, r + 1);
+        *t = 0;
+
+        if (r[1] == '/')
+                memmove(r, r + 1, t - r);
+        else
+                r[0] = '/';
+
+        return r;
+}
+
+char *unit_name_path_unescape(const char *f) {
+        assert(f);
 
-        return e;
+        return do_path_unescape(f, strlen(f));
 }
 
 bool unit_name_is_template(const char *n) {
@@ -405,51 +479,58 @@ char *unit_name_template(const char *f) {
 }
 
 char *unit_name_from_path(const char *path, const char *suffix) {
-        char *p, *r;
+        char *r, *t;
+        size_t l;
 
         assert(path);
         assert(suffix);
 
-        p = unit_name_path_escape(path);
-        if (!p)
+        /* Escaping never takes more than four bytes per byte, hence
+         * allocate that once and write the name right into it */
+        l = strlen(suffix);
+        r = new(char, strlen(path)*4+1+l+1);
+        if (!r)
                 return NULL;
 
-        r = strappend(p, suffix);
-        free(p);
+        t = do_path_escape(path, r);
+        memcpy(t, suffix, l+1);
 
         return r;
 }
 
 char *unit_name_from_path_instance(const char *prefix, const char *path, const char *suffix) {
-        char *p, *r;
+        char *r, *t;
+        size_t a, b;
 
         assert(prefix);
         assert(path);
         assert(suffix);
 
-        p = unit_name_path_escape(path);
-        if (!p)
+        a = strlen(prefix);
+        b = strlen(suffix);
+        r = new(char, a+1+strlen(path)*4+1+b+1);
+        if (!r)
                 return NULL;
 
-        r = strjoin(prefix, "@", p, suffix, NULL);
-        free(p);
+        t = mempcpy(r, prefix, a);
+        *(t++) = '@';
+        t = do_path_escape(path, t);
+        memcpy(t, suffix, b+1);
 
         return r;
 }
 
 char *unit_name_to_path(const char *name) {
-        char *w, *e;
+        const char *p;
 
         assert(name);
 
-        w = unit_name_to_prefix(name);
-        if (!w)
-                return NULL;
-
-        e = unit_name_path_unescape(w);
-        free(w);
+        /* The prefix ends at the instance or the suffix */
+        p = strchr(name, '@');
+        if (!p)
+                assert_se(p = strrchr(name, '.'));
 
-        return e;
+        return do_path_unescape(name, p - name);
 }
 
 char *unit_dbus_path_from_name(const char *name) {
@@ -492,7 +573,7 @@ char *unit_name_mangle(const char *name) {
         for (f = name, t = r; *f; f++) {
                 if (*f == '/')
                         *(t++) = '-';
-                else if (!strchr("@" VALID_CHARS, *f))
+                else if (!char_is(*f, CHAR_INSTANCE))
                         t = do_escape_char(*f, t);
                 else
                         *(t++) = *f;
@@ -522,7 +603,7 @@ char *snapshot_name_mangle(const char *name) {
         for (f = name, t = r; *f; f++) {
                 if (*f == '/')
                         *(t++) = '-';
-                else if (!strchr(VALID_CHARS, *f))
+                else if (!char_is(*f, CHAR_PREFIX))
                         t = do_escape_char(*f, t);
                 else
                         *(t++) = *f;
@@ -48,11 +48,101 @@
 #include <string.h>
 #include <stdbool.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "utf8.h"
 #include "util.h"
 
 #define FILTER_CHAR '_'
 
+/* Almost all log data is plain ASCII. The helpers below find out how
+ * many of the leading bytes are, 16 bytes at a time with SSE2, or a
+ * word at a time otherwise, so that only the rest needs to be decoded
+ * character by character. They may stop early, but never late. */
+
+#ifndef __SSE2__
+#define ONES ((unsigned long) -1 / 0xFF)
+#define HIGHS (ONES * 0x80)
+
+/* Non-zero if any byte of the word is smaller than n, for n <= 128 */
+#define HAS_LESS(w, n) (((w) - ONES * (n)) & ~(w) & HIGHS)
+
+static inline unsigned long load_word(const uint8_t *p) {
+        unsigned long w;
+
+        memcpy(&w, p, sizeof(w));
+        return w;
+}
+#endif
+
+/* Bytes from ' ' to '~', and '\t' */
+static inline size_t ascii_printable_span(const uint8_t *p, size_t length) {
+        const uint8_t *s = p;
+
+#ifdef __SSE2__
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i del = _mm_set1_epi8(0x7F);
+
+        while (length >= 16) {
+                __m128i v, bad;
+
+                /* The comparison is signed, hence catches all bytes
+                 * with the high bit set too */
+                v = _mm_loadu_si128((const __m128i*) p);
+                bad = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab), _mm_cmplt_epi8(v, space));
+                bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, del));
+
+                if (_mm_movemask_epi8(bad) != 0)
+                        break;
+
+                p += 16;
+                length -= 16;
+        }
+#else
+        /* Tabs are left to the slow path here */
+        while (length >= sizeof(unsigned long)) {
+                unsigned long w;
+
+                w = load_word(p);
+                if ((w & HIGHS) || HAS_LESS(w, ' ') || HAS_LESS(w ^ (ONES * 0x7F), 1))
+                        break;
+
+                p += sizeof(unsigned long);
+                length -= sizeof(unsigned long);
+        }
+#endif
+
+        return p - s;
+}
+
+/* Bytes from 0x01 to 0x7F, the caller makes sure there is no NUL */
+static inline size_t ascii_span(const uint8_t *p, size_t length) {
+        const uint8_t *s = p;
+
+#ifdef __SSE2__
+        while (length >= 16) {
+                if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*) p)) != 0)
+                        break;
+
+                p += 16;
+                length -= 16;
+        }
+#else
+        while (length >= sizeof(unsigned long)) {
+                if (load_word(p) & HIGHS)
+                        break;
+
+                p += sizeof(unsigned long);
+                length -= sizeof(unsigned long);
+        }
+#endif
+
+        return p - s;
+}
+
 static inline bool is_unicode_valid(uint32_t ch) {
 
         if (ch >= 0x110000) /* End of unicode space */
@@ -98,12 +188,23 @@ char* utf8_is_printable_n(const char* str, size_t length) {
         assert(str);
 
         for (p = (const uint8_t*) str; length; p++, length--) {
+                size_t n;
+
+                n = ascii_printable_span(p, length);
+                if (n > 0) {
+                        p += n;
+                        length -= n;
+
+                        if (!length)
+                                break;
+                }
+
                 if (*p < 128) {
                         val = *p;
                 } else {
                         if ((*p & 0xe0) == 0xc0) { /* 110xxxxx two-char seq. */
                                 min = 128;
-                                val = (uint32_t) (*p & 0x1e);
+                                val = (uint32_t) (*p & 0x1f);
                                 goto ONE_REMAINING;
                         } else if ((*p & 0xf0) == 0xe0) { /* 1110xxxx three-char seq.*/
                                 min = (1 << 11);
@@ -124,14 +225,14 @@ char* utf8_is_printable_n(const char* str, size_t length) {
                 TWO_REMAINING:
                         p++;
                         length--;
-                        if (!is_continuation_char(*p))
+                        if (!length || !is_continuation_char(*p))
                                 goto error;
                         merge_continuation_char(&val, *p);
 
                 ONE_REMAINING:
                         p++;
                         length--;
-                        if (!is_continuation_char(*p))
+                        if (!length || !is_continuation_char(*p))
                                 goto error;
                         merge_continuation_char(&val, *p);
 
@@ -152,14 +253,32 @@ error:
 static char* utf8_validate(const char *str, char *output) {
         uint32_t val = 0;
         uint32_t min = 0;
-        const uint8_t *p, *last;
+        const uint8_t *p, *last, *end;
         int size;
         uint8_t *o;
 
         assert(str);
 
+        /* Knowing the end lets us look at more than one byte at a
+         * time without reading past it */
+        end = (const uint8_t*) str + strlen(str);
+
         o = (uint8_t*) output;
-        for (p = (const uint8_t*) str; *p; p++) {
+        for (p = (const uint8_t*) str; p < end; p++) {
+                size_t n;
+
+                n = ascii_span(p, end - p);
+                if (n > 0) {
+                        if (o) {
+                                memcpy(o, p, n);
+                                o += n;
+                        }
+
+                        p += n;
+                        if (p >= end)
+                                break;
+                }
+
                 if (*p < 128) {
                         if (o)
                                 *o = *p;
@@ -169,7 +288,7 @@ static char* utf8_validate(const char *str, char *output) {
                         if ((*p & 0xe0) == 0xc0) { /* 110xxxxx two-char seq. */
                                 size = 2;
                                 min = 128;
-                                val = (uint32_t) (*p & 0x1e);
+                                val = (uint32_t) (*p & 0x1f);
                                 goto ONE_REMAINING;
                         } else if ((*p & 0xf0) == 0xe0) { /* 1110xxxx three-char seq.*/
                                 size = 3;
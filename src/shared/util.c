@@ -618,18 +618,15 @@ int get_process_cmdline(pid_t pid, size_t max_length, bool comm_fallback, char *
         if (!f)
                 return -errno;
         if (max_length == 0) {
-                size_t len = 1;
+                size_t len = 0, allocated = 0;
                 while ((c = getc(f)) != EOF) {
-                        k = realloc(r, len+1);
-                        if (k == NULL) {
+                        if (!GREEDY_REALLOC(r, allocated, len+2)) {
                                 free(r);
                                 fclose(f);
                                 return -ENOMEM;
                         }
-                        r = k;
-                        r[len-1] = isprint(c) ? c : ' ';
+                        r[len++] = isprint(c) ? c : ' ';
                         r[len] = 0;
-                        len++;
                 }
         } else {
                 bool space = false;
@@ -3655,24 +3652,63 @@ bool dirent_is_file_with_suffix(const struct dirent *de, const char *suffix) {
         return endswith(de->d_name, suffix);
 }
 
-void execute_directory(const char *directory, DIR *d, char *argv[]) {
+void execute_timings_free(ExecuteTiming *t, unsigned n) {
+        unsigned i;
+
+        for (i = 0; i < n; i++)
+                free(t[i].name);
+
+        free(t);
+}
+
+int execute_directory_full(
+                const char *directory,
+                DIR *d,
+                char *argv[],
+                usec_t timeout,
+                ExecuteTiming **timings,
+                unsigned *n_timings) {
+
         DIR *_d = NULL;
         struct dirent *de;
         Hashmap *pids = NULL;
+        ExecuteTiming *t = NULL;
+        size_t allocated = 0;
+        unsigned n = 0, n_timed_out = 0;
+        pid_t pgid = 0;
+        sigset_t mask, saved_mask;
+        bool got_sigchld = false;
+        int r = 0;
 
         assert(directory);
+        assert(!timings == !n_timings);
 
         /* Executes all binaries in a directory in parallel and
-         * waits for them to finish. */
+         * waits for them to finish. Each one that takes longer than
+         * timeout is killed, if one is set.
+         *
+         * They are put into a process group of their own, led by
+         * the first one, so that we can reap whichever finishes
+         * first without touching other children of the caller. PID 1
+         * has plenty of those, and doesn't reap them meanwhile.
+         *
+         * SIGCHLD is blocked while we wait for it, and raised again
+         * afterwards if we took any, so that the caller doesn't miss
+         * one meant for it. */
+
+        assert_se(sigemptyset(&mask) == 0);
+        assert_se(sigaddset(&mask, SIGCHLD) == 0);
+        assert_se(sigprocmask(SIG_BLOCK, &mask, &saved_mask) == 0);
 
         if (!d) {
                 if (!(_d = opendir(directory))) {
 
                         if (errno == ENOENT)
-                                return;
+                                goto finish;
 
+                        r = -errno;
                         log_error("Failed to enumerate directory %s: %m", directory);
-                        return;
+                        goto finish;
                 }
 
                 d = _d;
@@ -3680,6 +3716,7 @@ void execute_directory(const char *directory, DIR *d, char *argv[]) {
 
         if (!(pids = hashmap_new(trivial_hash_func, trivial_compare_func))) {
                 log_error("Failed to allocate set.");
+                r = -ENOMEM;
                 goto finish;
         }
 
@@ -3691,13 +3728,29 @@ void execute_directory(const char *directory, DIR *d, char *argv[]) {
                 if (!dirent_is_file(de))
                         continue;
 
+                if (!GREEDY_REALLOC(t, allocated, n + 1)) {
+                        r = log_oom();
+                        break;
+                }
+
                 if (asprintf(&path, "%s/%s", directory, de->d_name) < 0) {
                         log_oom();
                         continue;
                 }
 
+                zero(t[n]);
+                t[n].name = strdup(de->d_name);
+                if (!t[n].name) {
+                        log_oom();
+                        free(path);
+                        continue;
+                }
+
+                t[n].usec = now(CLOCK_MONOTONIC);
+
                 if ((pid = fork()) < 0) {
                         log_error("Failed to fork: %m");
+                        free(t[n].name);
                         free(path);
                         continue;
                 }
@@ -3706,6 +3759,13 @@ void execute_directory(const char *directory, DIR *d, char *argv[]) {
                         char *_argv[2];
                         /* Child */
 
+                        assert_se(sigprocmask(SIG_SETMASK, &saved_mask, NULL) == 0);
+
+                        if (setpgid(0, pgid) < 0) {
+                                log_error("Failed to join process group: %m");
+                                _exit(EXIT_FAILURE);
+                        }
+
                         if (!argv) {
                                 _argv[0] = path;
                                 _argv[1] = NULL;
@@ -3719,38 +3779,127 @@ void execute_directory(const char *directory, DIR *d, char *argv[]) {
                         _exit(EXIT_FAILURE);
                 }
 
+                /* Also done here, so that the group exists before
+                 * the next child is forked. EACCES means the child
+                 * already did it and exec'd. */
+                if (setpgid(pid, pgid) < 0 && errno != EACCES) {
+                        log_error("Failed to move %s into process group: %m", path);
+                        kill(pid, SIGKILL);
+                        waitpid(pid, NULL, 0);
+                        free(t[n].name);
+                        free(path);
+                        continue;
+                }
+
+                if (pgid == 0)
+                        pgid = pid;
+
                 log_debug("Spawned %s as %lu", path, (unsigned long) pid);
 
-                if ((k = hashmap_put(pids, UINT_TO_PTR(pid), path)) < 0) {
+                if ((k = hashmap_put(pids, UINT_TO_PTR(pid), UINT_TO_PTR(n + 1))) < 0) {
                         log_error("Failed to add PID to set: %s", strerror(-k));
+                        free(t[n].name);
                         free(path);
+                        continue;
                 }
+
+                free(path);
+                n++;
         }
 
         while (!hashmap_isempty(pids)) {
-                pid_t pid = PTR_TO_UINT(hashmap_first_key(pids));
                 siginfo_t si = {};
-                char *path;
+                void *p;
 
-                if (waitid(P_PID, pid, &si, WEXITED) < 0) {
+                /* Whichever of ours finishes first, so that its time
+                 * is right. This might also find processes that
+                 * were forked off by one of ours and then reparented
+                 * to us, which are reaped and otherwise ignored. */
+                if (waitid(P_PGID, pgid, &si, WEXITED|WNOHANG|WNOWAIT) < 0) {
 
                         if (errno == EINTR)
                                 continue;
 
+                        r = -errno;
                         log_error("waitid() failed: %m");
                         goto finish;
                 }
 
-                if ((path = hashmap_remove(pids, UINT_TO_PTR(si.si_pid)))) {
-                        if (!is_clean_exit(si.si_code, si.si_status, NULL)) {
+                if (si.si_pid == 0) {
+                        usec_t now_usec, deadline = (usec_t) -1;
+                        struct timespec ts;
+                        Iterator i;
+                        void *k;
+
+                        /* Nothing finished yet. Kill whatever ran
+                         * out of time, and sleep until the next one
+                         * does, or a child changes state. */
+                        now_usec = now(CLOCK_MONOTONIC);
+
+                        HASHMAP_FOREACH_KEY(p, k, pids, i) {
+                                ExecuteTiming *e = t + PTR_TO_UINT(p) - 1;
+
+                                if (timeout <= 0 || e->timed_out)
+                                        continue;
+
+                                if (e->usec + timeout <= now_usec) {
+                                        kill(PTR_TO_UINT(k), SIGKILL);
+                                        e->timed_out = true;
+                                        n_timed_out++;
+                                } else
+                                        deadline = MIN(deadline, e->usec + timeout);
+                        }
+
+                        if (sigtimedwait(&mask, NULL,
+                                         deadline == (usec_t) -1 ? NULL : timespec_store(&ts, deadline - now_usec)) >= 0)
+                                got_sigchld = true;
+                        else if (errno != EAGAIN && errno != EINTR) {
+                                r = -errno;
+                                log_error("sigtimedwait() failed: %m");
+                                goto finish;
+                        }
+
+                        continue;
+                }
+
+                p = hashmap_get(pids, UINT_TO_PTR(si.si_pid));
+
+                /* Before the last of ours is reaped, and its zombie
+                 * no longer keeps the group ID from being reused,
+                 * get rid of whatever the ones that timed out left
+                 * behind */
+                if (p && n_timed_out > 0 && hashmap_size(pids) == 1)
+                        kill(-pgid, SIGKILL);
+
+                if (waitid(P_PID, si.si_pid, &si, WEXITED) < 0) {
+
+                        if (errno == EINTR)
+                                continue;
+
+                        r = -errno;
+                        log_error("waitid() failed: %m");
+                        goto finish;
+                }
+
+                if ((p = hashmap_remove(pids, UINT_TO_PTR(si.si_pid)))) {
+                        ExecuteTiming *e = t + PTR_TO_UINT(p) - 1;
+                        char ts[FORMAT_TIMESPAN_MAX];
+
+                        e->usec = now(CLOCK_MONOTONIC) - e->usec;
+                        e->code = si.si_code;
+                        e->status = si.si_status;
+
+                        if (e->timed_out)
+                                log_error("%s/%s timed out after %s, killed.", directory, e->name,
+                                          format_timespan(ts, sizeof(ts), timeout, 0));
+                        else if (!is_clean_exit(si.si_code, si.si_status, NULL)) {
                                 if (si.si_code == CLD_EXITED)
-                                        log_error("%s exited with exit status %i.", path, si.si_status);
+                                        log_error("%s/%s exited with exit status %i.", directory, e->name, si.si_status);
                                 else
-                                        log_error("%s terminated by signal %s.", path, signal_to_string(si.si_status));
+                                        log_error("%s/%s terminated by signal %s.", directory, e->name, signal_to_string(si.si_status));
                         } else
-                                log_debug("%s exited successfully.", path);
-
-                        free(path);
+                                log_debug("%s/%s exited successfully after %s.", directory, e->name,
+                                          format_timespan(ts, sizeof(ts), e->usec, USEC_PER_MSEC));
                 }
         }
 
@@ -3758,8 +3907,23 @@ finish:
         if (_d)
                 closedir(_d);
 
-        if (pids)
-                hashmap_free_free(pids);
+        hashmap_free(pids);
+
+        assert_se(sigprocmask(SIG_SETMASK, &saved_mask, NULL) == 0);
+        if (got_sigchld)
+                raise(SIGCHLD);
+
+        if (timings) {
+                *timings = t;
+                *n_timings = n;
+        } else
+                execute_timings_free(t, n);
+
+        return r;
+}
+
+void execute_directory(const char *directory, DIR *d, char *argv[]) {
+        execute_directory_full(directory, d, argv, 0, NULL, NULL);
 }
 
 int kill_and_sigcont(pid_t pid, int sig) {
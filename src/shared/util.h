@@ -401,7 +401,17 @@ bool tty_is_console(const char *tty);
 int vtnr_from_tty(const char *tty);
 const char *default_term_for_tty(const char *tty);
 
+typedef struct ExecuteTiming {
+        char *name;
+        usec_t usec;
+        int code;
+        int status;
+        bool timed_out;
+} ExecuteTiming;
+
 void execute_directory(const char *directory, DIR *_d, char *argv[]);
+int execute_directory_full(const char *directory, DIR *_d, char *argv[], usec_t timeout, ExecuteTiming **timings, unsigned *n_timings);
+void execute_timings_free(ExecuteTiming *t, unsigned n);
 
 int kill_and_sigcont(pid_t pid, int sig);
 
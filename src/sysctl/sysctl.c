@@ -26,6 +26,8 @@
 #include <stdio.h>
 #include <limits.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "log.h"
 #include "strv.h"
@@ -58,13 +60,85 @@ static char *normalize_sysctl(char *s) {
         return s;
 }
 
-static int apply_sysctl(const char *property, const char *value) {
+static bool value_equal(const char *current, const char *value) {
+        const char *a = current, *b = value;
+
+        /* The kernel separates multiple fields with tabs, while the
+         * configuration might use any whitespace */
+        for (;;) {
+                size_t la, lb;
+
+                a += strspn(a, WHITESPACE);
+                b += strspn(b, WHITESPACE);
+
+                la = strcspn(a, WHITESPACE);
+                lb = strcspn(b, WHITESPACE);
+
+                if (la != lb || memcmp(a, b, la) != 0)
+                        return false;
+
+                if (la == 0)
+                        return true;
+
+                a += la;
+                b += lb;
+        }
+}
+
+static int write_sysctl(int dfd, const char *property, const char *value) {
+        _cleanup_close_ int fd = -1;
+        _cleanup_free_ char *line = NULL;
+        size_t l;
+        ssize_t n;
+
+        /* Writing to net/ipv[46]/conf/all/ is passed on to all
+         * interfaces, which might differ by now. Everything else is
+         * only written when the value would actually change. */
+        fd = strstr(property, "/conf/all/") ? -1 : openat(dfd, property, O_RDWR|O_CLOEXEC|O_NOCTTY);
+        if (fd >= 0) {
+                char buf[LINE_MAX];
+
+                n = read(fd, buf, sizeof(buf) - 1);
+                if (n >= 0) {
+                        buf[n] = 0;
+
+                        if (value_equal(buf, value))
+                                return 0;
+                }
+
+                if (lseek(fd, 0, SEEK_SET) < 0)
+                        return -errno;
+
+        } else {
+                /* Some settings are write-only */
+                fd = openat(dfd, property, O_WRONLY|O_CLOEXEC|O_NOCTTY);
+                if (fd < 0)
+                        return -errno;
+        }
+
+        line = strappend(value, "\n");
+        if (!line)
+                return -ENOMEM;
+
+        /* Needs to be a single write, the kernel parses each one on
+         * its own */
+        l = strlen(line);
+        n = write(fd, line, l);
+        if (n < 0)
+                return -errno;
+        if ((size_t) n != l)
+                return -EIO;
+
+        return 1;
+}
+
+static int apply_sysctl(int dfd, const char *property, const char *value) {
         _cleanup_free_ char *p = NULL;
         char *n;
+        char ts[FORMAT_TIMESPAN_MAX];
+        usec_t t;
         int r = 0, k;
 
-        log_debug("Setting '%s' to '%s'", property, value);
-
         p = new(char, sizeof("/proc/sys/") + strlen(property));
         if (!p)
                 return log_oom();
@@ -88,29 +162,45 @@ static int apply_sysctl(const char *property, const char *value) {
                 }
         }
 
-        k = write_string_file(p, value);
+        t = now(CLOCK_MONOTONIC);
+        k = write_sysctl(dfd, property + strspn(property, "/"), value);
+        t = now(CLOCK_MONOTONIC) - t;
+
         if (k < 0) {
                 log_full(k == -ENOENT ? LOG_DEBUG : LOG_WARNING,
                          "Failed to write '%s' to '%s': %s", value, p, strerror(-k));
 
                 if (k != -ENOENT && r == 0)
                         r = k;
-        }
+        } else if (k == 0)
+                log_debug("'%s' is already set to '%s'", property, value);
+        else
+                log_debug("Set '%s' to '%s' in %s", property, value,
+                          format_timespan(ts, sizeof(ts), t, 0));
 
         return r;
 }
 
 static int apply_all(Hashmap *sysctl_options) {
+        _cleanup_close_ int dfd = -1;
         int r = 0;
         char *property, *value;
         Iterator i;
 
         assert(sysctl_options);
 
+        /* Resolve /proc/sys only once, not for each of possibly
+         * thousands of settings */
+        dfd = open("/proc/sys", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (dfd < 0) {
+                log_error("Failed to open /proc/sys: %m");
+                return -errno;
+        }
+
         HASHMAP_FOREACH_KEY(value, property, sysctl_options, i) {
                 int k;
 
-                k = apply_sysctl(property, value);
+                k = apply_sysctl(dfd, property, value);
                 if (k < 0 && r == 0)
                         r = k;
         }
@@ -2282,7 +2282,7 @@ typedef struct UnitStatusInfo {
         LIST_HEAD(ExecStatusInfo, exec);
 } UnitStatusInfo;
 
-static void print_status_info(UnitStatusInfo *i) {
+static void print_status_info(UnitStatusInfo *i, JournalTails *tails) {
         ExecStatusInfo *p;
         const char *on, *off, *ss;
         usec_t timestamp;
@@ -2557,15 +2557,26 @@ static void print_status_info(UnitStatusInfo *i) {
 
         if (i->id && arg_transport != TRANSPORT_SSH) {
                 printf("\n");
-                show_journal_by_unit(stdout,
-                                     i->id,
-                                     arg_output,
-                                     0,
-                                     i->inactive_exit_timestamp_monotonic,
-                                     arg_lines,
-                                     getuid(),
-                                     flags,
-                                     arg_scope == UNIT_FILE_SYSTEM);
+
+                /* Use what was read from the journal for all units
+                 * at once, if possible */
+                if (!tails ||
+                    show_journal_tail(stdout,
+                                      tails,
+                                      i->id,
+                                      arg_output,
+                                      0,
+                                      i->inactive_exit_timestamp_monotonic,
+                                      flags) == -ENOENT)
+                        show_journal_by_unit(stdout,
+                                             i->id,
+                                             arg_output,
+                                             0,
+                                             i->inactive_exit_timestamp_monotonic,
+                                             arg_lines,
+                                             getuid(),
+                                             flags,
+                                             arg_scope == UNIT_FILE_SYSTEM);
         }
 
         if (i->need_daemon_reload)
@@ -3074,38 +3085,22 @@ static int print_property(const char *name, DBusMessageIter *iter) {
         return 0;
 }
 
-static int show_one(const char *verb, DBusConnection *bus, const char *path, bool show_properties, bool *new_line) {
-        DBusMessage _cleanup_free_ *reply = NULL;
-        const char *interface = "";
-        int r;
-        DBusMessageIter iter, sub, sub2, sub3;
+static int show_properties_iter(const char *verb, DBusMessageIter *iter, bool show_properties, JournalTails *tails, bool *new_line) {
+        DBusMessageIter sub, sub2, sub3;
         UnitStatusInfo info = {};
         ExecStatusInfo *p;
+        int r;
 
-        assert(path);
+        assert(iter);
         assert(new_line);
 
-        r = bus_method_call_with_reply(
-                        bus,
-                        "org.freedesktop.systemd1",
-                        path,
-                        "org.freedesktop.DBus.Properties",
-                        "GetAll",
-                        &reply,
-                        NULL,
-                        DBUS_TYPE_STRING, &interface,
-                        DBUS_TYPE_INVALID);
-        if (r < 0)
-                return r;
-
-        if (!dbus_message_iter_init(reply, &iter) ||
-            dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY ||
-            dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_DICT_ENTRY)  {
+        if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY ||
+            dbus_message_iter_get_element_type(iter) != DBUS_TYPE_DICT_ENTRY)  {
                 log_error("Failed to parse reply.");
                 return -EIO;
         }
 
-        dbus_message_iter_recurse(&iter, &sub);
+        dbus_message_iter_recurse(iter, &sub);
 
         if (*new_line)
                 printf("\n");
@@ -3144,7 +3139,7 @@ static int show_one(const char *verb, DBusConnection *bus, const char *path, boo
                 if (streq(verb, "help"))
                         show_unit_help(&info);
                 else
-                        print_status_info(&info);
+                        print_status_info(&info, tails);
         }
 
         strv_free(info.documentation);
@@ -3165,6 +3160,204 @@ static int show_one(const char *verb, DBusConnection *bus, const char *path, boo
         return r;
 }
 
+static int show_one(const char *verb, DBusConnection *bus, const char *path, bool show_properties, bool *new_line) {
+        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
+        const char *interface = "";
+        DBusMessageIter iter;
+        int r;
+
+        assert(path);
+        assert(new_line);
+
+        r = bus_method_call_with_reply(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        path,
+                        "org.freedesktop.DBus.Properties",
+                        "GetAll",
+                        &reply,
+                        NULL,
+                        DBUS_TYPE_STRING, &interface,
+                        DBUS_TYPE_INVALID);
+        if (r < 0)
+                return r;
+
+        if (!dbus_message_iter_init(reply, &iter)) {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        return show_properties_iter(verb, &iter, show_properties, NULL, new_line);
+}
+
+/* Sends GetAll() without waiting for the reply, so that the replies
+ * for many units may be collected afterwards in one go */
+static int show_one_send(DBusConnection *bus, const char *path, DBusPendingCall **pending) {
+        _cleanup_dbus_message_unref_ DBusMessage *m = NULL;
+        const char *interface = "";
+
+        assert(bus);
+        assert(path);
+        assert(pending);
+
+        m = dbus_message_new_method_call(
+                        "org.freedesktop.systemd1",
+                        path,
+                        "org.freedesktop.DBus.Properties",
+                        "GetAll");
+        if (!m)
+                return log_oom();
+
+        if (!dbus_message_append_args(m,
+                                      DBUS_TYPE_STRING, &interface,
+                                      DBUS_TYPE_INVALID))
+                return log_oom();
+
+        if (!dbus_connection_send_with_reply(bus, m, pending, -1))
+                return log_oom();
+
+        if (!*pending) {
+                log_error("Failed to issue method call: connection closed.");
+                return -EIO;
+        }
+
+        return 0;
+}
+
+static int show_one_collect(const char *verb, DBusPendingCall *pending, bool show_properties, JournalTails *tails, bool *new_line) {
+        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
+        DBusError _cleanup_dbus_error_free_ error;
+        DBusMessageIter iter;
+
+        assert(pending);
+
+        dbus_error_init(&error);
+
+        dbus_pending_call_block(pending);
+
+        reply = dbus_pending_call_steal_reply(pending);
+        if (!reply)
+                return log_oom();
+
+        if (dbus_set_error_from_message(&error, reply)) {
+                log_error("Failed to issue method call: %s", bus_error_message(&error));
+
+                if (dbus_error_has_name(&error, DBUS_ERROR_ACCESS_DENIED))
+                        return -EACCES;
+
+                return -EIO;
+        }
+
+        if (!dbus_message_iter_init(reply, &iter)) {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        return show_properties_iter(verb, &iter, show_properties, tails, new_line);
+}
+
+static JournalTails *get_journal_tails(char **units) {
+        JournalTails *tails = NULL;
+
+        /* Only worth it if more than one unit is shown */
+        if (arg_transport == TRANSPORT_SSH || arg_lines <= 0 || strv_length(units) <= 1)
+                return NULL;
+
+        if (journal_tails_new(&tails, units, arg_lines, getuid(), arg_scope == UNIT_FILE_SYSTEM) < 0)
+                return NULL;
+
+        return tails;
+}
+
+struct unit_properties {
+        const char *id;
+        DBusMessageIter properties;
+};
+
+static int compare_unit_properties(const void *a, const void *b) {
+        const struct unit_properties *u = a, *v = b;
+
+        return strcmp(u->id, v->id);
+}
+
+/* Fetches all properties of the units matching any of the patterns
+ * in one call, sorted by name */
+static int get_unit_properties_list(DBusConnection *bus, char **patterns, DBusMessage **reply,
+                                    struct unit_properties **units, unsigned *c) {
+        _cleanup_dbus_message_unref_ DBusMessage *m = NULL;
+        DBusMessageIter iter, sub;
+        DBusError error;
+        unsigned n_units = 0;
+        size_t allocated = 0;
+
+        assert(bus);
+        assert(reply);
+        assert(units);
+        assert(c);
+
+        dbus_error_init(&error);
+
+        m = dbus_message_new_method_call(
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "ListUnitsFiltered");
+        if (!m)
+                return log_oom();
+
+        dbus_message_iter_init_append(m, &iter);
+
+        if (bus_append_strv_iter(&iter, patterns) < 0 ||
+            bus_append_strv_iter(&iter, NULL) < 0 ||
+            bus_append_strv_iter(&iter, NULL) < 0)
+                return log_oom();
+
+        *reply = dbus_connection_send_with_reply_and_block(bus, m, -1, &error);
+        if (!*reply) {
+                log_error("Failed to issue method call: %s", bus_error_message(&error));
+                dbus_error_free(&error);
+                return -EIO;
+        }
+
+        if (!dbus_message_iter_init(*reply, &iter) ||
+            dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY ||
+            dbus_message_iter_get_element_type(&iter) != DBUS_TYPE_STRUCT) {
+                log_error("Failed to parse reply.");
+                return -EIO;
+        }
+
+        dbus_message_iter_recurse(&iter, &sub);
+
+        while (dbus_message_iter_get_arg_type(&sub) != DBUS_TYPE_INVALID) {
+                struct unit_properties *u;
+                DBusMessageIter sub2;
+
+                if (!GREEDY_REALLOC(*units, allocated, n_units + 1))
+                        return log_oom();
+
+                u = *units + n_units;
+
+                dbus_message_iter_recurse(&sub, &sub2);
+
+                if (bus_iter_get_basic_and_next(&sub2, DBUS_TYPE_STRING, &u->id, true) < 0 ||
+                    dbus_message_iter_get_arg_type(&sub2) != DBUS_TYPE_ARRAY) {
+                        log_error("Failed to parse reply.");
+                        return -EIO;
+                }
+
+                u->properties = sub2;
+                n_units++;
+
+                dbus_message_iter_next(&sub);
+        }
+
+        *c = n_units;
+        if (*units)
+                qsort(*units, *c, sizeof(struct unit_properties), compare_unit_properties);
+
+        return 0;
+}
+
 static int show_one_by_pid(const char *verb, DBusConnection *bus, uint32_t pid, bool *new_line) {
         _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
         const char *path = NULL;
@@ -3198,39 +3391,118 @@ static int show_one_by_pid(const char *verb, DBusConnection *bus, uint32_t pid,
 }
 
 static int show_all(const char* verb, DBusConnection *bus, bool show_properties, bool *new_line) {
-        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
+        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL, *properties_reply = NULL;
         _cleanup_free_ struct unit_info *unit_infos = NULL;
-        unsigned c = 0;
+        _cleanup_free_ struct unit_properties *units = NULL;
+        _cleanup_strv_builder_free_ StrvBuilder b = {};
+        _cleanup_strv_free_ char **names = NULL;
+        unsigned c = 0, n_units = 0;
         const struct unit_info *u;
+        JournalTails *tails = NULL;
         int r;
 
         r = get_unit_list(bus, &reply, &unit_infos, &c);
         if (r < 0)
                 return r;
 
+        for (u = unit_infos; u < unit_infos + c; u++)
+                if (output_show_unit(u))
+                        if (strv_builder_extend(&b, u->id) < 0)
+                                return log_oom();
+
+        if (b.n <= 0)
+                return 0;
+
+        names = strv_builder_steal(&b);
+        if (!names)
+                return log_oom();
+
+        /* Unit names contain no glob characters, hence the names
+         * match only themselves */
+        r = get_unit_properties_list(bus, names, &properties_reply, &units, &n_units);
+        if (r < 0)
+                return r;
+
+        if (!show_properties)
+                tails = get_journal_tails(names);
+
+        r = 0;
         for (u = unit_infos; u < unit_infos + c; u++) {
                 char _cleanup_free_ *p = NULL;
+                struct unit_properties key = { .id = u->id }, *up;
 
                 if (!output_show_unit(u))
                         continue;
 
+                /* Might have gone away in between */
+                up = bsearch(&key, units, n_units, sizeof(struct unit_properties), compare_unit_properties);
+                if (!up)
+                        continue;
+
                 p = unit_dbus_path_from_name(u->id);
-                if (!p)
-                        return log_oom();
+                if (!p) {
+                        r = log_oom();
+                        break;
+                }
 
                 printf("%s -> '%s'\n", u->id, p);
 
-                r = show_one(verb, bus, p, show_properties, new_line);
+                r = show_properties_iter(verb, &up->properties, show_properties, tails, new_line);
                 if (r != 0)
-                        return r;
+                        break;
         }
 
-        return 0;
+        journal_tails_free(tails);
+
+        return r;
+}
+
+static int show_glob(const char *verb, DBusConnection *bus, const char *pattern, bool show_properties, bool *new_line) {
+        _cleanup_dbus_message_unref_ DBusMessage *reply = NULL;
+        _cleanup_free_ struct unit_properties *units = NULL;
+        _cleanup_free_ char **names = NULL;
+        char *patterns[] = { (char*) pattern, NULL };
+        JournalTails *tails = NULL;
+        unsigned c = 0, i;
+        int r, ret = 0;
+
+        r = get_unit_properties_list(bus, patterns, &reply, &units, &c);
+        if (r < 0)
+                return r;
+
+        if (!show_properties && c > 1) {
+                names = new0(char*, c + 1);
+                if (!names)
+                        return log_oom();
+
+                for (i = 0; i < c; i++)
+                        names[i] = (char*) units[i].id;
+
+                tails = get_journal_tails(names);
+        }
+
+        for (i = 0; i < c; i++) {
+                r = show_properties_iter(verb, &units[i].properties, show_properties, tails, new_line);
+                if (r < 0) {
+                        ret = r;
+                        break;
+                }
+                if (r != 0)
+                        ret = r;
+        }
+
+        journal_tails_free(tails);
+
+        return ret;
 }
 
 static int show(DBusConnection *bus, char **args) {
         int r, ret = 0;
         bool show_properties, show_status, new_line = false;
+        _cleanup_free_ DBusPendingCall **pending = NULL;
+        _cleanup_strv_free_ char **names = NULL;
+        JournalTails *tails = NULL;
+        unsigned n, k;
         char **name;
 
         assert(bus);
@@ -3250,22 +3522,67 @@ static int show(DBusConnection *bus, char **args) {
         if (show_status && strv_length(args) <= 1)
                 return show_all(args[0], bus, false, &new_line);
 
-        STRV_FOREACH(name, args+1) {
+        n = strv_length(args+1);
+        pending = new0(DBusPendingCall*, n);
+        if (!pending)
+                return log_oom();
+
+        /* Ask for the properties of all named units first, and
+         * collect the replies only afterwards, so that we don't wait
+         * for a full round trip for each of them */
+        for (k = 0; k < n; k++) {
+                _cleanup_free_ char *p = NULL;
+                char *u;
                 uint32_t id;
 
-                if (safe_atou32(*name, &id) < 0) {
-                        _cleanup_free_ char *p = NULL, *n = NULL;
+                name = args + 1 + k;
+                if (strpbrk(*name, "*?[") || safe_atou32(*name, &id) >= 0)
+                        continue;
+
+                u = unit_name_mangle(*name);
+                if (!u) {
+                        ret = log_oom();
+                        goto finish;
+                }
+
+                if (strv_push(&names, u) < 0) {
+                        free(u);
+                        ret = log_oom();
+                        goto finish;
+                }
+
+                p = unit_dbus_path_from_name(u);
+                if (!p) {
+                        ret = log_oom();
+                        goto finish;
+                }
+
+                r = show_one_send(bus, p, &pending[k]);
+                if (r < 0) {
+                        ret = r;
+                        goto finish;
+                }
+        }
+
+        if (show_status)
+                tails = get_journal_tails(names);
+
+        for (k = 0; k < n; k++) {
+                uint32_t id;
+
+                name = args + 1 + k;
+
+                if (pending[k]) {
                         /* Interpret as unit name */
 
-                        n = unit_name_mangle(*name);
-                        if (!n)
-                                return log_oom();
+                        r = show_one_collect(args[0], pending[k], show_properties, tails, &new_line);
+                        if (r != 0)
+                                ret = r;
 
-                        p = unit_dbus_path_from_name(n);
-                        if (!p)
-                                return log_oom();
+                } else if (strpbrk(*name, "*?[")) {
+                        /* Interpret as unit name pattern */
 
-                        r = show_one(args[0], bus, p, show_properties, &new_line);
+                        r = show_glob(args[0], bus, *name, show_properties, &new_line);
                         if (r != 0)
                                 ret = r;
 
@@ -3273,8 +3590,11 @@ static int show(DBusConnection *bus, char **args) {
                         _cleanup_free_ char *p = NULL;
 
                         /* Interpret as job id */
-                        if (asprintf(&p, "/org/freedesktop/systemd1/job/%u", id) < 0)
-                                return log_oom();
+                        assert_se(safe_atou32(*name, &id) >= 0);
+                        if (asprintf(&p, "/org/freedesktop/systemd1/job/%u", id) < 0) {
+                                ret = log_oom();
+                                goto finish;
+                        }
 
                         r = show_one(args[0], bus, p, show_properties, &new_line);
                         if (r != 0)
@@ -3282,12 +3602,22 @@ static int show(DBusConnection *bus, char **args) {
 
                 } else {
                         /* Interpret as PID */
+                        assert_se(safe_atou32(*name, &id) >= 0);
                         r = show_one_by_pid(args[0], bus, id, &new_line);
                         if (r != 0)
                                 ret = r;
                 }
         }
 
+finish:
+        for (k = 0; k < n; k++)
+                if (pending[k]) {
+                        dbus_pending_call_cancel(pending[k]);
+                        dbus_pending_call_unref(pending[k]);
+                }
+
+        journal_tails_free(tails);
+
         return ret;
 }
 
@@ -43,6 +43,7 @@ extern "C" {
 
 typedef struct sd_bus sd_bus;
 typedef struct sd_bus_message sd_bus_message;
+typedef struct sd_bus_call_group sd_bus_call_group;
 
 typedef struct {
         const char *name;
@@ -52,6 +53,65 @@ typedef struct {
 
 typedef int (*sd_bus_message_handler_t)(sd_bus *bus, int ret, sd_bus_message *m, void *userdata);
 
+/* Object vtables. Properties without a getter are marshalled straight
+ * from userdata plus their offset, which works for basic types
+ * only. Strings, object paths and signatures are stored as char*,
+ * booleans as int. */
+
+typedef int (*sd_bus_property_get_t)(sd_bus *bus, const char *path, const char *interface, const char *property, sd_bus_message *reply, void *userdata);
+
+enum {
+        _SD_BUS_VTABLE_START = '<',
+        _SD_BUS_VTABLE_END = '>',
+        _SD_BUS_VTABLE_METHOD = 'M',
+        _SD_BUS_VTABLE_PROPERTY = 'P'
+};
+
+typedef struct sd_bus_vtable {
+        /* Don't initialize this structure directly, use the macros
+         * below */
+        int type;
+        union {
+                struct {
+                        const char *member;
+                        const char *signature;
+                        const char *result;
+                        sd_bus_message_handler_t handler;
+                } method;
+                struct {
+                        const char *member;
+                        const char *signature;
+                        sd_bus_property_get_t get;
+                        size_t offset;
+                } property;
+        } x;
+} sd_bus_vtable;
+
+#define SD_BUS_VTABLE_START                                             \
+        { .type = _SD_BUS_VTABLE_START }
+#define SD_BUS_METHOD(_member, _signature, _result, _handler)           \
+        {                                                               \
+                .type = _SD_BUS_VTABLE_METHOD,                          \
+                .x.method = {                                           \
+                        .member = _member,                              \
+                        .signature = _signature,                        \
+                        .result = _result,                              \
+                        .handler = _handler,                            \
+                },                                                      \
+        }
+#define SD_BUS_PROPERTY(_member, _signature, _get, _offset)             \
+        {                                                               \
+                .type = _SD_BUS_VTABLE_PROPERTY,                        \
+                .x.property = {                                         \
+                        .member = _member,                              \
+                        .signature = _signature,                        \
+                        .get = _get,                                    \
+                        .offset = _offset,                              \
+                },                                                      \
+        }
+#define SD_BUS_VTABLE_END                                               \
+        { .type = _SD_BUS_VTABLE_END }
+
 /* Connections */
 
 int sd_bus_open_system(sd_bus **ret);
@@ -65,6 +125,7 @@ int sd_bus_set_bus_client(sd_bus *bus, int b);
 int sd_bus_set_server(sd_bus *bus, int b, sd_id128_t server_id);
 int sd_bus_set_anonymous(sd_bus *bus, int b);
 int sd_bus_set_negotiate_fds(sd_bus *bus, int b);
+int sd_bus_set_negotiate_memfd(sd_bus *bus, int b);
 int sd_bus_start(sd_bus *ret);
 
 void sd_bus_close(sd_bus *bus);
@@ -81,6 +142,16 @@ int sd_bus_send_with_reply(sd_bus *bus, sd_bus_message *m, sd_bus_message_handle
 int sd_bus_send_with_reply_cancel(sd_bus *bus, uint64_t serial);
 int sd_bus_send_with_reply_and_block(sd_bus *bus, sd_bus_message *m, uint64_t usec, sd_bus_error *error, sd_bus_message **r);
 
+/* Call groups: all calls added are sent together, and waited for
+ * with a single deadline. Replies are then picked up by the index
+ * each call got when it was added. */
+int sd_bus_call_group_new(sd_bus *bus, sd_bus_call_group **g);
+void sd_bus_call_group_free(sd_bus_call_group *g);
+int sd_bus_call_group_add(sd_bus_call_group *g, sd_bus_message *m, unsigned *idx);
+int sd_bus_call_group_add_method(sd_bus_call_group *g, const char *destination, const char *path, const char *interface, const char *member, unsigned *idx, const char *types, ...);
+int sd_bus_call_group_wait(sd_bus_call_group *g, uint64_t usec);
+int sd_bus_call_group_get_reply(sd_bus_call_group *g, unsigned idx, sd_bus_error *error, sd_bus_message **r);
+
 int sd_bus_get_fd(sd_bus *bus);
 int sd_bus_get_events(sd_bus *bus);
 int sd_bus_get_timeout(sd_bus *bus, uint64_t *timeout_usec);
@@ -97,6 +168,9 @@ int sd_bus_remove_object(sd_bus *bus, const char *path, sd_bus_message_handler_t
 int sd_bus_add_fallback(sd_bus *bus, const char *prefix, sd_bus_message_handler_t callback, void *userdata);
 int sd_bus_remove_fallback(sd_bus *bus, const char *prefix, sd_bus_message_handler_t callback, void *userdata);
 
+int sd_bus_add_object_vtable(sd_bus *bus, const char *path, const char *interface, const sd_bus_vtable *vtable, void *userdata);
+int sd_bus_remove_object_vtable(sd_bus *bus, const char *path, const char *interface);
+
 int sd_bus_add_match(sd_bus *bus, const char *match, sd_bus_message_handler_t callback, void *userdata);
 int sd_bus_remove_match(sd_bus *bus, const char *match, sd_bus_message_handler_t callback, void *userdata);
 
@@ -135,6 +209,7 @@ int sd_bus_message_is_method_error(sd_bus_message *m, const char *name);
 int sd_bus_message_set_no_reply(sd_bus_message *m, int b);
 int sd_bus_message_set_destination(sd_bus_message *m, const char *destination);
 
+int sd_bus_message_reserve(sd_bus_message *m, size_t size, unsigned n_fds);
 int sd_bus_message_append(sd_bus_message *m, const char *types, ...);
 int sd_bus_message_append_basic(sd_bus_message *m, char type, const void *p);
 int sd_bus_message_open_container(sd_bus_message *m, char type, const char *contents);
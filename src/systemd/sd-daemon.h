@@ -262,6 +262,33 @@ int sd_notify(int unset_environment, const char *state);
 */
 int sd_notifyf(int unset_environment, const char *format, ...) _sd_printf_attr_(2,3);
 
+/*
+  Similar to sd_notify() and sd_notifyf(), but the socket used to
+  talk to the init system is kept open for later calls, instead of
+  being created and closed for each call. Meant for daemons that
+  send notifications often, for example WATCHDOG=1 or STATUS=
+  progress reports. The socket is closed on exec(), and a forked
+  child creates its own.
+
+  See sd_notify(3) for more information.
+*/
+int sd_notify_cached(int unset_environment, const char *state);
+int sd_notifyf_cached(int unset_environment, const char *format, ...) _sd_printf_attr_(2,3);
+
+/*
+  Similar to sd_notify_cached(), but takes a NULL terminated array
+  of assignments, which are sent in one datagram, separated by
+  newlines.
+
+  Example: A worker could report its progress like this:
+
+     const char *states[] = { "WATCHDOG=1", status, NULL };
+     sd_notifyv_cached(0, states);
+
+  See sd_notify(3) for more information.
+*/
+int sd_notifyv_cached(int unset_environment, const char * const *states);
+
 /*
   Returns > 0 if the system was booted with systemd. Returns < 0 on
   error. Returns 0 if the system was not booted with systemd. Note
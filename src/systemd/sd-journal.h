@@ -41,6 +41,7 @@ int sd_journal_print(int priority, const char *format, ...) __attribute__ ((form
 int sd_journal_printv(int priority, const char *format, va_list ap);
 int sd_journal_send(const char *format, ...) __attribute__((sentinel));
 int sd_journal_sendv(const struct iovec *iov, int n);
+int sd_journal_sendv_batch(const struct iovec * const *iov, const int *n, unsigned n_entries);
 int sd_journal_perror(const char *message);
 
 /* Used by the macros below. Don't call this directly. */
@@ -74,7 +75,8 @@ typedef struct sd_journal sd_journal;
 enum {
         SD_JOURNAL_LOCAL_ONLY = 1,
         SD_JOURNAL_RUNTIME_ONLY = 2,
-        SD_JOURNAL_SYSTEM_ONLY = 4
+        SD_JOURNAL_SYSTEM_ONLY = 4,
+        SD_JOURNAL_PARALLEL = 8
 };
 
 /* Wakeup event types */
@@ -163,6 +163,12 @@ int sd_login_monitor_get_events(sd_login_monitor *m);
 /* Get timeout for poll(), as usec value relative to CLOCK_MONOTONIC's epoch */
 int sd_login_monitor_get_timeout(sd_login_monitor *m, uint64_t *timeout_usec);
 
+/* Enables or disables caching of the state of the categories the
+ * monitor watches. Cached state is invalidated by
+ * sd_login_monitor_flush(), hence reflects the state as of the last
+ * flush. */
+int sd_login_monitor_set_cache(sd_login_monitor *m, int b);
+
 #ifdef __cplusplus
 }
 #endif
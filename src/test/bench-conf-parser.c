@@ -0,0 +1,293 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "fileio.h"
+#include "conf-parser.h"
+
+/* Reads and applies a generated corpus of unit files, to tell how
+ * much of parsing is spent reading and splitting lines, and how much
+ * in looking up each assignment. The table lookup is timed with a
+ * table the size of the one for unit fragments, and with the short one
+ * install.c uses. Results are printed as one JSON object per line,
+ * like bench-hashmap. */
+
+static unsigned arg_files = 10000;
+static unsigned arg_iterations = 3;
+
+#define N_KEYS 200
+
+static char *keys[N_KEYS];
+static ConfigTableItem *large_table;
+static unsigned n_assignments;
+
+static int count_assignment(
+                const char *unit,
+                const char *filename,
+                unsigned line,
+                const char *section,
+                const char *lvalue,
+                int ltype,
+                const char *rvalue,
+                void *data,
+                void *userdata) {
+
+        n_assignments++;
+        return 0;
+}
+
+static const ConfigTableItem small_table[] = {
+        { "Install", "Alias",      count_assignment, 0, NULL },
+        { "Install", "WantedBy",   count_assignment, 0, NULL },
+        { "Install", "RequiredBy", count_assignment, 0, NULL },
+        { "Install", "Also",       count_assignment, 0, NULL },
+        { "Exec",    "User",       count_assignment, 0, NULL },
+        { NULL, NULL, NULL, 0, NULL }
+};
+
+static int null_lookup(
+                void *table,
+                const char *section,
+                const char *lvalue,
+                ConfigParserCallback *func,
+                int *ltype,
+                void **data,
+                void *userdata) {
+
+        return 0;
+}
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Benchmark reading and applying unit files.\n\n"
+               "  -h --help               Show this help\n"
+               "     --files=N            Unit files in the corpus (default: 10000)\n"
+               "     --iterations=N       How often to repeat (default: 3)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_FILES = 0x100,
+                ARG_ITERATIONS
+        };
+
+        static const struct option options[] = {
+                { "help",       no_argument,       NULL, 'h'            },
+                { "files",      required_argument, NULL, ARG_FILES      },
+                { "iterations", required_argument, NULL, ARG_ITERATIONS },
+                { NULL,         0,                 NULL, 0              }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_FILES:
+                        r = safe_atou(optarg, &arg_files);
+                        if (r < 0 || arg_files <= 0) {
+                                log_error("Failed to parse number of files: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_ITERATIONS:
+                        r = safe_atou(optarg, &arg_iterations);
+                        if (r < 0 || arg_iterations <= 0) {
+                                log_error("Failed to parse number of iterations: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        if (optind < argc) {
+                log_error("This program takes no arguments.");
+                return -EINVAL;
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+static void make_tables(void) {
+        unsigned i;
+
+        /* Like load-fragment: most keys in [Service], the rest spread
+         * over [Unit] and [Install], and the ones actually used
+         * towards the end, as they tend to be */
+        large_table = new0(ConfigTableItem, N_KEYS + 1);
+        assert_se(large_table);
+
+        for (i = 0; i < N_KEYS; i++) {
+                assert_se(asprintf(&keys[i], "Key%u", i) >= 0);
+
+                large_table[i].section = i % 4 == 0 ? "Unit" : i % 4 == 1 ? "Install" : "Service";
+                large_table[i].lvalue = keys[i];
+                large_table[i].parse = count_assignment;
+        }
+}
+
+static void make_corpus(const char *dir) {
+        unsigned i, k;
+
+        for (i = 0; i < arg_files; i++) {
+                _cleanup_free_ char *p = NULL;
+                FILE *f;
+
+                assert_se(asprintf(&p, "%s/app-tenant-%u@.service", dir, i) >= 0);
+                f = fopen(p, "we");
+                assert_se(f);
+
+                fprintf(f,
+                        "# Generated for bench-conf-parser\n"
+                        "[Unit]\n"
+                        "Key%u=Application instance %u\n"
+                        "Key%u=network.target remote-fs.target\n"
+                        "\n"
+                        "[Service]\n",
+                        N_KEYS - 4, i, N_KEYS - 8);
+
+                for (k = 0; k < 16; k++)
+                        fprintf(f, "Key%u=/usr/bin/app --instance=%%i --tenant=%u \\\n  --verbose\n",
+                                N_KEYS - 1 - 4*k - (k % 2), i);
+
+                fprintf(f,
+                        "\n"
+                        "[Install]\n"
+                        "Key%u=multi-user.target\n"
+                        "WantedBy=multi-user.target\n",
+                        N_KEYS - 3);
+
+                assert_se(fclose(f) == 0);
+        }
+}
+
+static void run(const char *dir) {
+        ConfigFile **files;
+        usec_t t, t_read = 0, t_null = 0, t_large = 0, t_small = 0;
+        unsigned i, j;
+
+        files = new0(ConfigFile*, arg_files);
+        assert_se(files);
+
+        for (j = 0; j < arg_iterations; j++) {
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_files; i++) {
+                        _cleanup_free_ char *p = NULL;
+
+                        assert_se(asprintf(&p, "%s/app-tenant-%u@.service", dir, i) >= 0);
+                        assert_se(config_file_read(p, NULL, files + i) >= 0);
+                }
+                t_read += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_files; i++)
+                        assert_se(config_file_apply(NULL, files[i], "Unit\0Service\0Install\0",
+                                                    null_lookup, NULL, true, NULL) >= 0);
+                t_null += now(CLOCK_MONOTONIC) - t;
+
+                n_assignments = 0;
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_files; i++)
+                        assert_se(config_file_apply(NULL, files[i], "Unit\0Service\0Install\0",
+                                                    config_item_table_lookup, large_table, true, NULL) >= 0);
+                t_large += now(CLOCK_MONOTONIC) - t;
+                assert_se(n_assignments == arg_files * 19);
+
+                n_assignments = 0;
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_files; i++)
+                        assert_se(config_file_apply(NULL, files[i], "Install\0Exec\0",
+                                                    config_item_table_lookup, (void*) small_table, true, NULL) >= 0);
+                t_small += now(CLOCK_MONOTONIC) - t;
+                assert_se(n_assignments == arg_files);
+
+                for (i = 0; i < arg_files; i++)
+                        config_file_free(files[i]);
+        }
+
+        report("read", t_read, (uint64_t) arg_iterations * arg_files);
+        report("apply-no-lookup", t_null, (uint64_t) arg_iterations * arg_files);
+        report("apply-large-table", t_large, (uint64_t) arg_iterations * arg_files);
+        report("apply-install-table", t_small, (uint64_t) arg_iterations * arg_files);
+
+        free(files);
+}
+
+int main(int argc, char *argv[]) {
+        char dir[] = "/tmp/bench-conf-parser-XXXXXX";
+        unsigned i;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                goto finish;
+
+        assert_se(mkdtemp(dir));
+
+        make_tables();
+        make_corpus(dir);
+        run(dir);
+
+        rm_rf_dangerous(dir, false, true, false);
+
+        for (i = 0; i < N_KEYS; i++)
+                free(keys[i]);
+        free(large_table);
+
+        r = 0;
+
+finish:
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
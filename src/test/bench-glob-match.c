@@ -0,0 +1,411 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <glob.h>
+#include <fnmatch.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "strv.h"
+#include "env-util.h"
+#include "path-util.h"
+#include "conf-files.h"
+#include "strxcpyx.h"
+#include "glob-match.h"
+
+/* Replays recorded uevents against the glob keys of udev rules, with
+ * fnmatch() as udev used to, and with glob_match() as it does now.
+ *
+ * Events are read from files holding KEY=VALUE lines, separated by
+ * empty lines, as "udevadm monitor --property" prints them; other lines
+ * are ignored. Without files the uevent attributes of all devices in
+ * /sys/class are replayed. Only KERNEL, SUBSYSTEM, DRIVER, ACTION,
+ * DEVPATH and ENV{} keys are looked at. Results are printed as one
+ * JSON object per line, like bench-hashmap. */
+
+static const char *arg_rules = "rules";
+static unsigned arg_iterations = 100;
+
+typedef struct Pattern {
+        char *key;
+        char *value;
+        size_t length;
+        bool simple, split;
+} Pattern;
+
+static int help(void) {
+
+        printf("%s [OPTIONS...] [FILE...]\n\n"
+               "Benchmark matching udev rules globs against recorded uevents.\n\n"
+               "  -h --help               Show this help\n"
+               "     --rules=DIR          Rules directory (default: rules)\n"
+               "     --iterations=N       How often to repeat (default: 100)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_RULES = 0x100,
+                ARG_ITERATIONS
+        };
+
+        static const struct option options[] = {
+                { "help",       no_argument,       NULL, 'h'            },
+                { "rules",      required_argument, NULL, ARG_RULES      },
+                { "iterations", required_argument, NULL, ARG_ITERATIONS },
+                { NULL,         0,                 NULL, 0              }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_RULES:
+                        arg_rules = optarg;
+                        break;
+
+                case ARG_ITERATIONS:
+                        r = safe_atou(optarg, &arg_iterations);
+                        if (r < 0 || arg_iterations <= 0) {
+                                log_error("Failed to parse number of iterations: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+/* Picks the glob matches out of a rule, roughly like udev does */
+static void parse_rule(const char *line, Pattern **patterns, unsigned *n_patterns) {
+        const char *p = line;
+
+        for (;;) {
+                char key[64], *value;
+                size_t k, l;
+                bool match;
+
+                p += strspn(p, WHITESPACE ",");
+
+                k = strspn(p, "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+                if (k == 0 || k >= sizeof(key))
+                        return;
+                memcpy(key, p, k);
+                key[k] = 0;
+                p += k;
+
+                if (*p == '{') {
+                        l = strcspn(p + 1, "}");
+                        if (p[1 + l] != '}' || l == 0 || l >= sizeof(key))
+                                return;
+
+                        if (streq(key, "ENV")) {
+                                memcpy(key, p + 1, l);
+                                key[l] = 0;
+                        } else
+                                key[0] = 0;
+
+                        p += l + 2;
+                } else if (!nulstr_contains("KERNEL\0SUBSYSTEM\0DRIVER\0ACTION\0DEVPATH\0", key))
+                        key[0] = 0;
+
+                p += strspn(p, WHITESPACE);
+                match = startswith(p, "==") || startswith(p, "!=");
+                p += strspn(p, "=!+:-");
+                p += strspn(p, WHITESPACE);
+
+                if (*p != '"')
+                        return;
+                l = strcspn(p + 1, "\"");
+                if (p[1 + l] != '"')
+                        return;
+
+                value = strndup(p + 1, l);
+                assert_se(value);
+                p += l + 2;
+
+                if (!match || key[0] == 0 || !value[strcspn(value, "*?[")] || streq(value, "?*")) {
+                        free(value);
+                        continue;
+                }
+
+                *patterns = realloc(*patterns, (*n_patterns + 1) * sizeof(Pattern));
+                assert_se(*patterns);
+
+                (*patterns)[*n_patterns].key = strdup(key);
+                assert_se((*patterns)[*n_patterns].key);
+                (*patterns)[*n_patterns].value = value;
+                (*patterns)[*n_patterns].length = l;
+                (*patterns)[*n_patterns].simple = glob_simple(value, l);
+                (*patterns)[*n_patterns].split = !!strchr(value, '|');
+                (*n_patterns)++;
+        }
+}
+
+static void load_rules(const char *dir, Pattern **patterns, unsigned *n_patterns) {
+        _cleanup_strv_free_ char **files = NULL;
+        char **f;
+        int r;
+
+        r = conf_files_list(&files, ".rules", NULL, dir, NULL);
+        if (r < 0) {
+                log_error("Failed to enumerate rules in %s: %s", dir, strerror(-r));
+                exit(EXIT_FAILURE);
+        }
+
+        STRV_FOREACH(f, files) {
+                _cleanup_fclose_ FILE *file = NULL;
+                char line[LINE_MAX];
+
+                file = fopen(*f, "re");
+                if (!file) {
+                        log_error("Failed to open %s: %m", *f);
+                        exit(EXIT_FAILURE);
+                }
+
+                while (fgets(line, sizeof(line), file))
+                        if (line[strspn(line, WHITESPACE)] != '#')
+                                parse_rule(line, patterns, n_patterns);
+        }
+}
+
+static void add_event(char ****events, unsigned *n_events, char **event) {
+        const char *devpath;
+
+        if (strv_isempty(event)) {
+                strv_free(event);
+                return;
+        }
+
+        /* The kernel name of the device is not part of the uevent */
+        devpath = strv_env_get(event, "DEVPATH");
+        if (devpath) {
+                char *kernel;
+
+                kernel = strappend("KERNEL=", path_get_file_name(devpath));
+                assert_se(kernel);
+                assert_se(strv_push(&event, kernel) >= 0);
+        }
+
+        *events = realloc(*events, (*n_events + 1) * sizeof(char**));
+        assert_se(*events);
+        (*events)[(*n_events)++] = event;
+}
+
+static void load_events(FILE *f, char ****events, unsigned *n_events, char **extra) {
+        char **event = NULL, **l;
+        char line[LINE_MAX];
+
+        while (fgets(line, sizeof(line), f)) {
+                truncate_nl(line);
+
+                if (line[0] == 0) {
+                        add_event(events, n_events, event);
+                        event = NULL;
+                        continue;
+                }
+
+                if (!strchr(line, '='))
+                        continue;
+
+                assert_se(strv_extend(&event, line) >= 0);
+        }
+
+        STRV_FOREACH(l, extra)
+                assert_se(strv_extend(&event, *l) >= 0);
+
+        add_event(events, n_events, event);
+}
+
+static bool match_fnmatch(const Pattern *p, const char *v) {
+        char value[LINE_MAX], *k, *next;
+
+        if (!p->split)
+                return fnmatch(p->value, v, 0) == 0;
+
+        strscpy(value, sizeof(value), p->value);
+        for (k = value; k; k = next) {
+                next = strchr(k, '|');
+                if (next)
+                        *(next++) = 0;
+
+                if (fnmatch(k, v, 0) == 0)
+                        return true;
+        }
+
+        return false;
+}
+
+static bool match_glob(const Pattern *p, const char *v) {
+        const char *k, *next;
+
+        if (!p->simple)
+                return match_fnmatch(p, v);
+
+        if (!p->split)
+                return glob_match(p->value, p->length, v);
+
+        for (k = p->value;; k = next + 1) {
+                next = strchr(k, '|');
+                if (glob_match(k, next ? (size_t) (next - k) : strlen(k), v))
+                        return true;
+                if (!next)
+                        return false;
+        }
+}
+
+int main(int argc, char *argv[]) {
+        Pattern *patterns = NULL;
+        char ***events = NULL;
+        const char **values;
+        unsigned n_patterns = 0, n_events = 0, i, j, k;
+        uint64_t n = 0, matched = 0;
+        usec_t t, t_fnmatch = 0, t_glob = 0;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        load_rules(arg_rules, &patterns, &n_patterns);
+
+        if (optind < argc) {
+                for (i = optind; i < (unsigned) argc; i++) {
+                        _cleanup_fclose_ FILE *f = NULL;
+
+                        f = fopen(argv[i], "re");
+                        if (!f) {
+                                log_error("Failed to open %s: %m", argv[i]);
+                                return EXIT_FAILURE;
+                        }
+
+                        load_events(f, &events, &n_events, NULL);
+                }
+        } else {
+                glob_t g = {};
+
+                if (glob("/sys/class/*/*/uevent", 0, NULL, &g) == 0)
+                        for (i = 0; i < g.gl_pathc; i++) {
+                                _cleanup_fclose_ FILE *f = NULL;
+                                _cleanup_strv_free_ char **extra = NULL;
+                                char *subsystem, *kernel;
+
+                                f = fopen(g.gl_pathv[i], "re");
+                                if (!f)
+                                        continue;
+
+                                /* /sys/class/<subsystem>/<kernel>/uevent */
+                                subsystem = strdupa(g.gl_pathv[i] + strlen("/sys/class/"));
+                                kernel = strchr(subsystem, '/');
+                                *(kernel++) = 0;
+                                kernel[strcspn(kernel, "/")] = 0;
+
+                                extra = strv_new("ACTION=add", NULL);
+                                assert_se(extra);
+                                assert_se(strv_push(&extra, strappend("SUBSYSTEM=", subsystem)) >= 0);
+                                assert_se(strv_push(&extra, strappend("KERNEL=", kernel)) >= 0);
+
+                                load_events(f, &events, &n_events, extra);
+                        }
+
+                globfree(&g);
+        }
+
+        if (n_patterns == 0 || n_events == 0) {
+                log_error("Found %u glob keys and %u events, nothing to do.", n_patterns, n_events);
+                return EXIT_FAILURE;
+        }
+
+        /* Look up the values once, matching is what is measured */
+        values = new(const char*, n_events * n_patterns);
+        assert_se(values);
+        for (i = 0; i < n_events; i++)
+                for (k = 0; k < n_patterns; k++)
+                        values[i * n_patterns + k] = strempty(strv_env_get(events[i], patterns[k].key));
+
+        for (j = 0; j < arg_iterations; j++) {
+                uint64_t m_fnmatch = 0, m_glob = 0;
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < n_events * n_patterns; i++)
+                        m_fnmatch += match_fnmatch(&patterns[i % n_patterns], values[i]);
+                t_fnmatch += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < n_events * n_patterns; i++)
+                        m_glob += match_glob(&patterns[i % n_patterns], values[i]);
+                t_glob += now(CLOCK_MONOTONIC) - t;
+
+                assert_se(m_fnmatch == m_glob);
+                matched = m_glob;
+        }
+
+        n = (uint64_t) arg_iterations * n_events * n_patterns;
+
+        log_info("%u events, %u glob keys, %llu matches per replay",
+                 n_events, n_patterns, (unsigned long long) matched);
+
+        report("fnmatch", t_fnmatch, n);
+        report("glob-match", t_glob, n);
+
+        for (i = 0; i < n_events; i++)
+                strv_free(events[i]);
+        free(events);
+        for (k = 0; k < n_patterns; k++) {
+                free(patterns[k].key);
+                free(patterns[k].value);
+        }
+        free(patterns);
+        free(values);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,296 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "hashmap.h"
+#include "set.h"
+
+/* Exercises Hashmap and Set the way the manager does: unit names
+ * looked up by string, PIDs watched and unwatched, and lots of small
+ * dependency sets. Only the public API is used, so that the same
+ * program can be built against older trees for comparison. Results
+ * are printed as one JSON object per line, like bench-serialize. */
+
+static unsigned arg_entries = 10000;
+static unsigned arg_iterations = 20;
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Benchmark the hashmap implementation.\n\n"
+               "  -h --help               Show this help\n"
+               "     --entries=N          Entries per hashmap (default: 10000)\n"
+               "     --iterations=N       How often to repeat (default: 20)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_ENTRIES = 0x100,
+                ARG_ITERATIONS
+        };
+
+        static const struct option options[] = {
+                { "help",       no_argument,       NULL, 'h'            },
+                { "entries",    required_argument, NULL, ARG_ENTRIES    },
+                { "iterations", required_argument, NULL, ARG_ITERATIONS },
+                { NULL,         0,                 NULL, 0              }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_ENTRIES:
+                        r = safe_atou(optarg, &arg_entries);
+                        if (r < 0 || arg_entries <= 0) {
+                                log_error("Failed to parse number of entries: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_ITERATIONS:
+                        r = safe_atou(optarg, &arg_iterations);
+                        if (r < 0 || arg_iterations <= 0) {
+                                log_error("Failed to parse number of iterations: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        if (optind < argc) {
+                log_error("This program takes no arguments.");
+                return -EINVAL;
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+static void run_strings(void) {
+        usec_t t, t_put = 0, t_get = 0, t_miss = 0, t_iterate = 0, t_steal = 0;
+        char **names, **misses;
+        uint64_t n = 0;
+        unsigned i, j;
+
+        names = new(char*, arg_entries);
+        misses = new(char*, arg_entries);
+        assert_se(names && misses);
+
+        for (i = 0; i < arg_entries; i++) {
+                assert_se(asprintf(&names[i], "app@%u.service", i) >= 0);
+                assert_se(asprintf(&misses[i], "other@%u.socket", i) >= 0);
+        }
+
+        for (j = 0; j < arg_iterations; j++) {
+                Hashmap *h;
+                Iterator it;
+                void *v;
+
+                h = hashmap_new(string_hash_func, string_compare_func);
+                assert_se(h);
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_entries; i++)
+                        assert_se(hashmap_put(h, names[i], names[i]) == 1);
+                t_put += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_entries; i++)
+                        assert_se(hashmap_get(h, names[i]) == names[i]);
+                t_get += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_entries; i++)
+                        assert_se(!hashmap_get(h, misses[i]));
+                t_miss += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                HASHMAP_FOREACH(v, h, it)
+                        n++;
+                t_iterate += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                while (hashmap_steal_first(h))
+                        ;
+                t_steal += now(CLOCK_MONOTONIC) - t;
+
+                hashmap_free(h);
+        }
+
+        report("string-put", t_put, (uint64_t) arg_iterations * arg_entries);
+        report("string-get", t_get, (uint64_t) arg_iterations * arg_entries);
+        report("string-miss", t_miss, (uint64_t) arg_iterations * arg_entries);
+        report("string-iterate", t_iterate, n);
+        report("string-steal-first", t_steal, (uint64_t) arg_iterations * arg_entries);
+
+        for (i = 0; i < arg_entries; i++) {
+                free(names[i]);
+                free(misses[i]);
+        }
+        free(names);
+        free(misses);
+}
+
+static void run_pids(void) {
+        Hashmap *h;
+        usec_t t;
+        unsigned i, j;
+
+        /* Like watch_pids: a moving window of PIDs, each added once
+         * and removed again later */
+        h = hashmap_new(trivial_hash_func, trivial_compare_func);
+        assert_se(h);
+
+        t = now(CLOCK_MONOTONIC);
+        for (j = 0; j < arg_iterations; j++)
+                for (i = 0; i < arg_entries; i++) {
+                        unsigned pid = j * arg_entries + i + 2;
+
+                        assert_se(hashmap_put(h, UINT_TO_PTR(pid), UINT_TO_PTR(pid)) == 1);
+
+                        if (pid >= 1000 + 2)
+                                assert_se(hashmap_remove(h, UINT_TO_PTR(pid - 1000)));
+                }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        report("pid-churn", t, (uint64_t) arg_iterations * arg_entries);
+
+        hashmap_free(h);
+}
+
+static void run_worst_put(void) {
+        Hashmap *h;
+        usec_t worst = 0;
+        unsigned i, n;
+
+        /* The slowest single insertion, which is where growing the
+         * table would show */
+        n = arg_entries * arg_iterations;
+
+        h = hashmap_new(trivial_hash_func, trivial_compare_func);
+        assert_se(h);
+
+        for (i = 1; i <= n; i++) {
+                usec_t t;
+
+                t = now(CLOCK_MONOTONIC);
+                assert_se(hashmap_put(h, UINT_TO_PTR(i), UINT_TO_PTR(i)) == 1);
+                t = now(CLOCK_MONOTONIC) - t;
+
+                worst = MAX(worst, t);
+        }
+
+        report("worst-put", worst, n);
+
+        hashmap_free(h);
+}
+
+static void run_small_sets(void) {
+        Set **sets;
+        usec_t t, t_fill = 0, t_check = 0, t_free = 0;
+        unsigned i, j, k;
+
+        /* Like the dependency sets of units, with a few entries
+         * each */
+        sets = new(Set*, arg_entries);
+        assert_se(sets);
+
+        for (j = 0; j < arg_iterations; j++) {
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_entries; i++) {
+                        sets[i] = set_new(trivial_hash_func, trivial_compare_func);
+                        assert_se(sets[i]);
+
+                        for (k = 0; k < 4; k++)
+                                assert_se(set_put(sets[i], UINT_TO_PTR((i + k) * 64 + 1)) == 1);
+                }
+                t_fill += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_entries; i++)
+                        for (k = 0; k < 8; k++)
+                                assert_se(set_contains(sets[i], UINT_TO_PTR((i + k) * 64 + 1)) == (k < 4));
+                t_check += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_entries; i++)
+                        set_free(sets[i]);
+                t_free += now(CLOCK_MONOTONIC) - t;
+        }
+
+        report("small-set-fill", t_fill, (uint64_t) arg_iterations * arg_entries);
+        report("small-set-contains", t_check, (uint64_t) arg_iterations * arg_entries * 8);
+        report("small-set-free", t_free, (uint64_t) arg_iterations * arg_entries);
+
+        free(sets);
+}
+
+int main(int argc, char *argv[]) {
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                goto finish;
+
+        run_strings();
+        run_pids();
+        run_worst_put();
+        run_small_sets();
+
+        r = 0;
+
+finish:
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
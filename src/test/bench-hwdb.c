@@ -0,0 +1,219 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <glob.h>
+
+#include "libudev.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "strv.h"
+#include "fileio.h"
+
+/* Replays modalias lookups against /etc/udev/hwdb.bin, like the hwdb
+ * builtin does them for every device during coldplug.
+ *
+ * The modaliases are read from files holding one per line, in the
+ * order they are to be looked up. Without files the modaliases of all
+ * devices in /sys/bus are replayed, with the ones of USB devices
+ * composed as the builtin does. Results are printed as one JSON object
+ * per line, like bench-hashmap. */
+
+static unsigned arg_iterations = 10;
+
+static int help(void) {
+
+        printf("%s [OPTIONS...] [FILE...]\n\n"
+               "Benchmark hardware database lookups of recorded modaliases.\n\n"
+               "  -h --help               Show this help\n"
+               "     --iterations=N       How often to repeat (default: 10)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_ITERATIONS = 0x100
+        };
+
+        static const struct option options[] = {
+                { "help",       no_argument,       NULL, 'h'            },
+                { "iterations", required_argument, NULL, ARG_ITERATIONS },
+                { NULL,         0,                 NULL, 0              }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_ITERATIONS:
+                        r = safe_atou(optarg, &arg_iterations);
+                        if (r < 0 || arg_iterations <= 0) {
+                                log_error("Failed to parse number of iterations: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+static void load_sys(char ***modaliases) {
+        glob_t g = {};
+        unsigned i;
+
+        if (glob("/sys/bus/*/devices/*/modalias", 0, NULL, &g) == 0) {
+                for (i = 0; i < g.gl_pathc; i++) {
+                        char *m;
+
+                        if (read_one_line_file(g.gl_pathv[i], &m) < 0)
+                                continue;
+                        assert_se(strv_push(modaliases, m) >= 0);
+                }
+                globfree(&g);
+        }
+
+        /* the usb_device does not have a modalias */
+        if (glob("/sys/bus/usb/devices/*/idVendor", 0, NULL, &g) == 0) {
+                for (i = 0; i < g.gl_pathc; i++) {
+                        _cleanup_free_ char *v = NULL, *p = NULL, *fn = NULL;
+                        char *m;
+
+                        if (read_one_line_file(g.gl_pathv[i], &v) < 0)
+                                continue;
+                        fn = strdup(g.gl_pathv[i]);
+                        assert_se(fn);
+                        strcpy(strrchr(fn, '/'), "/idProduct");
+                        if (read_one_line_file(fn, &p) < 0)
+                                continue;
+
+                        assert_se(asprintf(&m, "usb:v%04lXp%04lX*", strtoul(v, NULL, 16), strtoul(p, NULL, 16)) >= 0);
+                        assert_se(strv_push(modaliases, m) >= 0);
+                }
+                globfree(&g);
+        }
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_strv_free_ char **modaliases = NULL;
+        struct udev *udev;
+        struct udev_hwdb *hwdb;
+        uint64_t n = 0, properties = 0;
+        usec_t t, t_lookup = 0;
+        unsigned i, j;
+        char **m;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        if (optind < argc) {
+                for (i = optind; i < (unsigned) argc; i++) {
+                        _cleanup_fclose_ FILE *f = NULL;
+                        char line[LINE_MAX];
+
+                        f = fopen(argv[i], "re");
+                        if (!f) {
+                                log_error("Failed to open %s: %m", argv[i]);
+                                return EXIT_FAILURE;
+                        }
+
+                        FOREACH_LINE(line, f, break) {
+                                truncate_nl(line);
+                                if (line[0] == '\0')
+                                        continue;
+                                assert_se(strv_extend(&modaliases, line) >= 0);
+                        }
+                }
+        } else
+                load_sys(&modaliases);
+
+        if (strv_isempty(modaliases)) {
+                log_error("Found no modaliases, nothing to do.");
+                return EXIT_FAILURE;
+        }
+
+        udev = udev_new();
+        assert_se(udev);
+
+        hwdb = udev_hwdb_new(udev);
+        if (!hwdb) {
+                log_error("Failed to open /etc/udev/hwdb.bin.");
+                udev_unref(udev);
+                return EXIT_FAILURE;
+        }
+
+        for (j = 0; j < arg_iterations; j++) {
+                uint64_t p = 0;
+
+                t = now(CLOCK_MONOTONIC);
+                STRV_FOREACH(m, modaliases) {
+                        struct udev_list_entry *entry;
+
+                        udev_list_entry_foreach(entry, udev_hwdb_get_properties_list_entry(hwdb, *m, 0))
+                                p++;
+                        n++;
+                }
+                t_lookup += now(CLOCK_MONOTONIC) - t;
+
+                properties = p;
+        }
+
+        log_info("%u modaliases, %llu properties per replay",
+                 strv_length(modaliases), (unsigned long long) properties);
+
+        report("hwdb", t_lookup, n);
+
+        udev_hwdb_unref(hwdb);
+        udev_unref(udev);
+
+        return EXIT_SUCCESS;
+}
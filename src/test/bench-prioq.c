@@ -0,0 +1,321 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "prioq.h"
+
+/* Exercises Prioq with the access patterns of its users: timers that
+ * are added, popped and rescheduled, and the journal's merge heap,
+ * where the top item is advanced and shuffled down on every
+ * step. Each workload is run for the heap arities given, to pick the
+ * layout from. Results are printed as one JSON object per line, like
+ * bench-hashmap. */
+
+static unsigned arg_entries = 10000;
+static unsigned arg_iterations = 20;
+static unsigned arg_arity = 0;
+
+struct item {
+        uint64_t key;
+        unsigned idx;
+};
+
+static int item_compare(const void *a, const void *b) {
+        const struct item *x = a, *y = b;
+
+        if (x->key < y->key)
+                return -1;
+        if (x->key > y->key)
+                return 1;
+
+        return 0;
+}
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Benchmark the priority queue implementation.\n\n"
+               "  -h --help               Show this help\n"
+               "     --entries=N          Items per queue (default: 10000)\n"
+               "     --iterations=N       How often to repeat (default: 20)\n"
+               "     --arity=N            Only run this heap arity (default: 2, 4 and 8)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_ENTRIES = 0x100,
+                ARG_ITERATIONS,
+                ARG_ARITY
+        };
+
+        static const struct option options[] = {
+                { "help",       no_argument,       NULL, 'h'            },
+                { "entries",    required_argument, NULL, ARG_ENTRIES    },
+                { "iterations", required_argument, NULL, ARG_ITERATIONS },
+                { "arity",      required_argument, NULL, ARG_ARITY      },
+                { NULL,         0,                 NULL, 0              }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_ENTRIES:
+                        r = safe_atou(optarg, &arg_entries);
+                        if (r < 0 || arg_entries <= 0) {
+                                log_error("Failed to parse number of entries: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_ITERATIONS:
+                        r = safe_atou(optarg, &arg_iterations);
+                        if (r < 0 || arg_iterations <= 0) {
+                                log_error("Failed to parse number of iterations: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_ARITY:
+                        r = safe_atou(optarg, &arg_arity);
+                        if (r < 0 || arg_arity < 2 || arg_arity > 16) {
+                                log_error("Failed to parse arity: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        if (optind < argc) {
+                log_error("This program takes no arguments.");
+                return -EINVAL;
+        }
+
+        return 1;
+}
+
+static void report(const char *name, unsigned arity, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"arity\" : %u, \"usec\" : %llu, \"count\" : %llu }\n",
+               name, arity, (unsigned long long) t, (unsigned long long) n);
+}
+
+static void fill_random(struct item *items, unsigned n) {
+        unsigned i;
+
+        for (i = 0; i < n; i++)
+                items[i].key = ((uint64_t) rand() << 31) | (uint64_t) rand();
+}
+
+static void run_put_pop(unsigned arity, struct item *items) {
+        usec_t t, t_put = 0, t_pop = 0;
+        unsigned i, j;
+
+        for (j = 0; j < arg_iterations; j++) {
+                Prioq *q;
+
+                q = prioq_new_arity(item_compare, arity);
+                assert_se(q);
+
+                fill_random(items, arg_entries);
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_entries; i++)
+                        assert_se(prioq_put(q, items + i, &items[i].idx) >= 0);
+                t_put += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                while (prioq_pop(q))
+                        ;
+                t_pop += now(CLOCK_MONOTONIC) - t;
+
+                prioq_free(q);
+        }
+
+        report("put", arity, t_put, (uint64_t) arg_iterations * arg_entries);
+        report("pop", arity, t_pop, (uint64_t) arg_iterations * arg_entries);
+}
+
+static void run_put_many(unsigned arity, struct item *items) {
+        void **data;
+        unsigned **idx;
+        usec_t t, t_many = 0;
+        unsigned i, j;
+
+        data = new(void*, arg_entries);
+        idx = new(unsigned*, arg_entries);
+        assert_se(data && idx);
+
+        for (i = 0; i < arg_entries; i++) {
+                data[i] = items + i;
+                idx[i] = &items[i].idx;
+        }
+
+        for (j = 0; j < arg_iterations; j++) {
+                Prioq *q;
+
+                q = prioq_new_arity(item_compare, arity);
+                assert_se(q);
+
+                fill_random(items, arg_entries);
+
+                t = now(CLOCK_MONOTONIC);
+                assert_se(prioq_put_many(q, data, idx, arg_entries) >= 0);
+                t_many += now(CLOCK_MONOTONIC) - t;
+
+                prioq_free(q);
+        }
+
+        report("put-many", arity, t_many, (uint64_t) arg_iterations * arg_entries);
+
+        free(data);
+        free(idx);
+}
+
+static void run_timers(unsigned arity, struct item *items) {
+        Prioq *q;
+        usec_t t;
+        uint64_t n, k;
+        unsigned i;
+
+        /* Like the manager's timer queues: the earliest timer elapses
+         * and is rescheduled, and in between random other timers are
+         * moved around */
+        q = prioq_new_arity(item_compare, arity);
+        assert_se(q);
+
+        fill_random(items, arg_entries);
+        for (i = 0; i < arg_entries; i++)
+                assert_se(prioq_put(q, items + i, &items[i].idx) >= 0);
+
+        n = (uint64_t) arg_iterations * arg_entries;
+
+        t = now(CLOCK_MONOTONIC);
+        for (k = 0; k < n; k++) {
+                struct item *e;
+
+                e = prioq_peek(q);
+                e->key += (uint64_t) rand();
+                assert_se(prioq_reshuffle(q, e, &e->idx) > 0);
+
+                e = items + (rand() % arg_entries);
+                e->key = e->key / 2 + (uint64_t) rand();
+                assert_se(prioq_reshuffle(q, e, &e->idx) > 0);
+        }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        report("timers", arity, t, n);
+
+        prioq_free(q);
+}
+
+static void run_merge(unsigned arity, struct item *items) {
+        Prioq *q;
+        usec_t t;
+        uint64_t n, k;
+        unsigned i;
+
+        /* Like sd-journal merging its files: the top item moves on by
+         * a small step, and is shuffled down again */
+        q = prioq_new_arity(item_compare, arity);
+        assert_se(q);
+
+        for (i = 0; i < arg_entries; i++) {
+                items[i].key = i;
+                assert_se(prioq_put(q, items + i, &items[i].idx) >= 0);
+        }
+
+        n = (uint64_t) arg_iterations * arg_entries;
+
+        t = now(CLOCK_MONOTONIC);
+        for (k = 0; k < n; k++) {
+                struct item *e;
+
+                e = prioq_peek(q);
+                e->key += 1 + rand() % (2 * arg_entries);
+                assert_se(prioq_reshuffle(q, e, &e->idx) > 0);
+        }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        report("merge", arity, t, n);
+
+        prioq_free(q);
+}
+
+int main(int argc, char *argv[]) {
+        static const unsigned arities[] = { 2, 4, 8 };
+        struct item *items = NULL;
+        unsigned i;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                goto finish;
+
+        items = new0(struct item, arg_entries);
+        assert_se(items);
+
+        for (i = 0; i < ELEMENTSOF(arities); i++) {
+                unsigned arity = arg_arity > 0 ? arg_arity : arities[i];
+
+                srand(0);
+
+                run_put_pop(arity, items);
+                run_put_many(arity, items);
+                run_timers(arity, items);
+                run_merge(arity, items);
+
+                if (arg_arity > 0)
+                        break;
+        }
+
+        r = 0;
+
+finish:
+        free(items);
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "serialize.h"
+
+/* Writes and reads back state shaped like what the manager passes on
+ * across daemon-reload, once in the text and once in the binary
+ * format. Results are printed as one JSON object per line, like
+ * bench-journal-read. */
+
+static unsigned arg_units = 2000;
+static unsigned arg_items = 20;
+static unsigned arg_iterations = 20;
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Benchmark the serialization used for reloading and reexecution.\n\n"
+               "  -h --help               Show this help\n"
+               "     --units=N            Units to serialize (default: 2000)\n"
+               "     --items=N            Items per unit (default: 20)\n"
+               "     --iterations=N       How often to repeat (default: 20)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_UNITS = 0x100,
+                ARG_ITEMS,
+                ARG_ITERATIONS
+        };
+
+        static const struct option options[] = {
+                { "help",       no_argument,       NULL, 'h'            },
+                { "units",      required_argument, NULL, ARG_UNITS      },
+                { "items",      required_argument, NULL, ARG_ITEMS      },
+                { "iterations", required_argument, NULL, ARG_ITERATIONS },
+                { NULL,         0,                 NULL, 0              }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_UNITS:
+                        r = safe_atou(optarg, &arg_units);
+                        if (r < 0 || arg_units <= 0) {
+                                log_error("Failed to parse number of units: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_ITEMS:
+                        r = safe_atou(optarg, &arg_items);
+                        if (r < 0 || arg_items <= 0) {
+                                log_error("Failed to parse number of items: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_ITERATIONS:
+                        r = safe_atou(optarg, &arg_iterations);
+                        if (r < 0 || arg_iterations <= 0) {
+                                log_error("Failed to parse number of iterations: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        if (optind < argc) {
+                log_error("This program takes no arguments.");
+                return -EINVAL;
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+static void write_state(FILE *f, bool binary) {
+        dual_timestamp ts;
+        unsigned i, j;
+
+        dual_timestamp_get(&ts);
+
+        serialize_header(f, binary);
+        serialize_item_format(f, binary, "current-job-id", "%i", 4711);
+        serialize_end(f, binary);
+
+        for (i = 0; i < arg_units; i++) {
+                char name[32];
+
+                snprintf(name, sizeof(name), "unit-%u.service", i);
+                serialize_item(f, binary, name, NULL);
+
+                for (j = 0; j < arg_items; j++) {
+                        switch (j % 3) {
+                        case 0:
+                                serialize_item(f, binary, "state", "running");
+                                break;
+                        case 1:
+                                serialize_item_format(f, binary, "main-pid", "%u", i * arg_items + j);
+                                break;
+                        default:
+                                serialize_dual_timestamp(f, binary, "active-enter-timestamp", &ts);
+                        }
+                }
+
+                serialize_end(f, binary);
+        }
+}
+
+static uint64_t read_state(FILE *f) {
+        _cleanup_free_ char *buffer = NULL;
+        size_t allocated = 0;
+        uint64_t n = 0;
+        char *k, *v;
+        bool binary;
+        int r;
+
+        assert_se(deserialize_header(f, &binary) >= 0);
+
+        while (deserialize_item(f, binary, &buffer, &allocated, &k, &v) > 0)
+                n++;
+
+        for (;;) {
+                r = deserialize_item(f, binary, &buffer, &allocated, &k, &v);
+                assert_se(r >= 0);
+                if (r == 0) {
+                        if (feof(f))
+                                break;
+                        continue;
+                }
+
+                /* Start marker, then the unit's items */
+                n++;
+                while (deserialize_item(f, binary, &buffer, &allocated, &k, &v) > 0)
+                        n++;
+        }
+
+        return n;
+}
+
+static void run(bool binary) {
+        uint64_t n = 0;
+        usec_t t, t_write = 0, t_read = 0;
+        unsigned i;
+        long size = 0;
+
+        for (i = 0; i < arg_iterations; i++) {
+                FILE *f;
+
+                f = tmpfile();
+                assert_se(f);
+
+                t = now(CLOCK_MONOTONIC);
+                write_state(f, binary);
+                assert_se(fflush(f) == 0);
+                t_write += now(CLOCK_MONOTONIC) - t;
+
+                size = ftell(f);
+                rewind(f);
+
+                t = now(CLOCK_MONOTONIC);
+                n += read_state(f);
+                t_read += now(CLOCK_MONOTONIC) - t;
+
+                fclose(f);
+        }
+
+        report(binary ? "binary-write" : "text-write", t_write, (uint64_t) arg_iterations * arg_units);
+        report(binary ? "binary-read" : "text-read", t_read, n);
+        report(binary ? "binary-size" : "text-size", 0, (uint64_t) size);
+}
+
+int main(int argc, char *argv[]) {
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                goto finish;
+
+        run(false);
+        run(true);
+
+        r = 0;
+
+finish:
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
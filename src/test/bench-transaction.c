@@ -0,0 +1,271 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "fileio.h"
+#include "manager.h"
+
+/* Builds transactions for a generated set of units and times how long
+ * it takes to activate them. "wide" is one target pulling in all units
+ * ordered in a chain, "cycles" adds a fixable ordering cycle per unit
+ * and "conflicts" a pair of conflicting jobs per unit. Results are
+ * printed as one JSON object per line, like bench-journal-read. */
+
+typedef enum Shape {
+        SHAPE_WIDE,
+        SHAPE_CYCLES,
+        SHAPE_CONFLICTS,
+        _SHAPE_MAX
+} Shape;
+
+static const char* const shape_table[_SHAPE_MAX] = {
+        [SHAPE_WIDE] = "wide",
+        [SHAPE_CYCLES] = "cycles",
+        [SHAPE_CONFLICTS] = "conflicts"
+};
+
+static unsigned arg_units = 2000;
+static unsigned arg_iterations = 10;
+static Shape arg_shape = SHAPE_WIDE;
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Benchmark building and activating transactions.\n\n"
+               "  -h --help               Show this help\n"
+               "     --units=N            Units to generate (default: 2000)\n"
+               "     --shape=SHAPE        One of wide, cycles, conflicts (default: wide)\n"
+               "     --iterations=N       How often to repeat (default: 10)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_UNITS = 0x100,
+                ARG_SHAPE,
+                ARG_ITERATIONS
+        };
+
+        static const struct option options[] = {
+                { "help",       no_argument,       NULL, 'h'            },
+                { "units",      required_argument, NULL, ARG_UNITS      },
+                { "shape",      required_argument, NULL, ARG_SHAPE      },
+                { "iterations", required_argument, NULL, ARG_ITERATIONS },
+                { NULL,         0,                 NULL, 0              }
+        };
+
+        int c, r;
+        unsigned i;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_UNITS:
+                        r = safe_atou(optarg, &arg_units);
+                        if (r < 0 || arg_units <= 0) {
+                                log_error("Failed to parse number of units: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_SHAPE:
+                        for (i = 0; i < _SHAPE_MAX; i++)
+                                if (streq(optarg, shape_table[i]))
+                                        break;
+
+                        if (i >= _SHAPE_MAX) {
+                                log_error("Unknown shape: %s", optarg);
+                                return -EINVAL;
+                        }
+
+                        arg_shape = i;
+                        break;
+
+                case ARG_ITERATIONS:
+                        r = safe_atou(optarg, &arg_iterations);
+                        if (r < 0 || arg_iterations <= 0) {
+                                log_error("Failed to parse number of iterations: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        if (optind < argc) {
+                log_error("This program takes no arguments.");
+                return -EINVAL;
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+static void write_unit(const char *dir, const char *name, const char *body) {
+        _cleanup_free_ char *p = NULL, *s = NULL;
+
+        p = strjoin(dir, "/", name, NULL);
+        s = strjoin("[Unit]\nDefaultDependencies=no\n", body, NULL);
+        assert_se(p && s);
+
+        assert_se(write_string_file(p, s) >= 0);
+}
+
+static void write_units(const char *dir) {
+        _cleanup_free_ char *p = NULL;
+        FILE *f;
+        unsigned i;
+
+        p = strappend(dir, "/anchor.target");
+        assert_se(p);
+
+        f = fopen(p, "we");
+        assert_se(f);
+
+        fputs("[Unit]\nDefaultDependencies=no\n", f);
+
+        for (i = 0; i < arg_units; i++) {
+                char a[32], b[32], body[128];
+
+                switch (arg_shape) {
+
+                case SHAPE_WIDE:
+                        snprintf(a, sizeof(a), "u%u.target", i);
+                        if (i > 0)
+                                snprintf(body, sizeof(body), "After=u%u.target\n", i - 1);
+                        else
+                                body[0] = 0;
+                        write_unit(dir, a, body);
+
+                        fprintf(f, "Wants=%s\n", a);
+                        break;
+
+                case SHAPE_CYCLES:
+                        snprintf(a, sizeof(a), "a%u.target", i);
+                        snprintf(b, sizeof(b), "b%u.target", i);
+
+                        snprintf(body, sizeof(body), "Wants=%s\nAfter=%s\n", b, b);
+                        write_unit(dir, a, body);
+                        snprintf(body, sizeof(body), "After=%s\n", a);
+                        write_unit(dir, b, body);
+
+                        fprintf(f, "Requires=%s\n", a);
+                        break;
+
+                case SHAPE_CONFLICTS:
+                        snprintf(a, sizeof(a), "x%u.target", i);
+                        snprintf(b, sizeof(b), "y%u.target", i);
+
+                        write_unit(dir, a, "");
+                        snprintf(body, sizeof(body), "Conflicts=%s\n", a);
+                        write_unit(dir, b, body);
+
+                        fprintf(f, "Wants=%s\nWants=%s\n", a, b);
+                        break;
+
+                default:
+                        assert_not_reached("Unknown shape");
+                }
+        }
+
+        assert_se(fflush(f) == 0 && !ferror(f));
+        fclose(f);
+}
+
+int main(int argc, char *argv[]) {
+        char dir[] = "/tmp/bench-transaction.XXXXXX";
+        Manager *m = NULL;
+        Unit *anchor = NULL;
+        usec_t t, t_total = 0;
+        bool created = false;
+        unsigned i;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                goto finish;
+
+        assert_se(mkdtemp(dir));
+        created = true;
+        write_units(dir);
+
+        assert_se(set_unit_path(dir) >= 0);
+        assert_se(manager_new(SYSTEMD_SYSTEM, &m) >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+        assert_se(manager_load_unit(m, "anchor.target", NULL, NULL, &anchor) >= 0);
+
+        for (i = 0; i < arg_iterations; i++) {
+                Job *j;
+
+                t = now(CLOCK_MONOTONIC);
+                r = manager_add_job(m, JOB_START, anchor, JOB_REPLACE, false, NULL, &j);
+                t_total += now(CLOCK_MONOTONIC) - t;
+
+                if (r < 0) {
+                        log_error("Failed to activate transaction: %s", strerror(-r));
+                        goto finish;
+                }
+
+                manager_clear_jobs(m);
+        }
+
+        report(shape_table[arg_shape], t_total, (uint64_t) arg_iterations * arg_units);
+
+        r = 0;
+
+finish:
+        if (m)
+                manager_free(m);
+
+        if (created)
+                rm_rf_dangerous(dir, false, true, false);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
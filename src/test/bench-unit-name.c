@@ -0,0 +1,206 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "strv.h"
+#include "unit-name.h"
+
+/* Runs the unit name helpers on names shaped like those udev and the
+ * mount table produce, i.e. device paths by id, path and label, and
+ * mount points. Results are printed as one JSON object per line,
+ * like bench-hashmap. */
+
+static unsigned arg_names = 10000;
+static unsigned arg_iterations = 20;
+
+static int help(void) {
+
+        printf("%s [OPTIONS...]\n\n"
+               "Benchmark the unit name helpers.\n\n"
+               "  -h --help               Show this help\n"
+               "     --names=N            Paths to convert (default: 10000)\n"
+               "     --iterations=N       How often to repeat (default: 20)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_NAMES = 0x100,
+                ARG_ITERATIONS
+        };
+
+        static const struct option options[] = {
+                { "help",       no_argument,       NULL, 'h'            },
+                { "names",      required_argument, NULL, ARG_NAMES      },
+                { "iterations", required_argument, NULL, ARG_ITERATIONS },
+                { NULL,         0,                 NULL, 0              }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_NAMES:
+                        r = safe_atou(optarg, &arg_names);
+                        if (r < 0 || arg_names <= 0) {
+                                log_error("Failed to parse number of names: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_ITERATIONS:
+                        r = safe_atou(optarg, &arg_iterations);
+                        if (r < 0 || arg_iterations <= 0) {
+                                log_error("Failed to parse number of iterations: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        if (optind < argc) {
+                log_error("This program takes no arguments.");
+                return -EINVAL;
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+static char **make_paths(unsigned n) {
+        char **l;
+        unsigned i;
+
+        l = new0(char*, n + 1);
+        assert_se(l);
+
+        for (i = 0; i < n; i++) {
+                int r;
+
+                switch (i % 4) {
+
+                case 0:
+                        r = asprintf(l + i, "/dev/disk/by-id/scsi-3600508b1001c%08x-part%u", i, i % 16);
+                        break;
+
+                case 1:
+                        r = asprintf(l + i, "/dev/disk/by-path/pci-0000:%02x:00.0-sas-0x5000c500%08x-lun-0", i % 256, i);
+                        break;
+
+                case 2:
+                        r = asprintf(l + i, "/sys/devices/virtual/net/veth%u", i);
+                        break;
+
+                default:
+                        r = asprintf(l + i, "/var/lib/containers/storage/overlay/%08x/merged", i);
+                        break;
+                }
+
+                assert_se(r >= 0);
+        }
+
+        return l;
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_strv_free_ char **paths = NULL, **names = NULL;
+        usec_t t, t_from = 0, t_valid = 0, t_to = 0, t_escape = 0;
+        unsigned i, j;
+        uint64_t n;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        paths = make_paths(arg_names);
+        names = new0(char*, arg_names + 1);
+        assert_se(names);
+
+        for (j = 0; j < arg_iterations; j++) {
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_names; i++) {
+                        names[i] = unit_name_from_path(paths[i], i % 4 == 3 ? ".mount" : ".device");
+                        assert_se(names[i]);
+                }
+                t_from += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_names; i++)
+                        assert_se(unit_name_is_valid(names[i], false));
+                t_valid += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_names; i++)
+                        free(unit_name_to_path(names[i]));
+                t_to += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                for (i = 0; i < arg_names; i++)
+                        free(unit_name_escape(paths[i]));
+                t_escape += now(CLOCK_MONOTONIC) - t;
+
+                for (i = 0; i < arg_names; i++) {
+                        free(names[i]);
+                        names[i] = NULL;
+                }
+        }
+
+        n = (uint64_t) arg_iterations * arg_names;
+
+        report("from-path", t_from, n);
+        report("is-valid", t_valid, n);
+        report("to-path", t_to, n);
+        report("escape", t_escape, n);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,206 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "strv.h"
+#include "utf8.h"
+
+/* Replays log messages through the checks journald and the journal
+ * readers run on every field: utf8_is_printable_n() and
+ * utf8_is_valid().
+ *
+ * Messages are read from files holding one per line, for example the
+ * output of "journalctl -o cat". Without files a mix of plain ASCII
+ * lines and lines with multi-byte characters is synthesized. Results
+ * are printed as one JSON object per line, like bench-hashmap. */
+
+static unsigned arg_iterations = 1000;
+
+static int help(void) {
+
+        printf("%s [OPTIONS...] [FILE...]\n\n"
+               "Benchmark UTF-8 checks of recorded log messages.\n\n"
+               "  -h --help               Show this help\n"
+               "     --iterations=N       How often to repeat (default: 1000)\n",
+               program_invocation_short_name);
+
+        return 0;
+}
+
+static int parse_argv(int argc, char *argv[]) {
+
+        enum {
+                ARG_ITERATIONS = 0x100
+        };
+
+        static const struct option options[] = {
+                { "help",       no_argument,       NULL, 'h'            },
+                { "iterations", required_argument, NULL, ARG_ITERATIONS },
+                { NULL,         0,                 NULL, 0              }
+        };
+
+        int c, r;
+
+        assert(argc >= 0);
+        assert(argv);
+
+        while ((c = getopt_long(argc, argv, "h", options, NULL)) >= 0) {
+
+                switch (c) {
+
+                case 'h':
+                        help();
+                        return 0;
+
+                case ARG_ITERATIONS:
+                        r = safe_atou(optarg, &arg_iterations);
+                        if (r < 0 || arg_iterations <= 0) {
+                                log_error("Failed to parse number of iterations: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case '?':
+                        return -EINVAL;
+
+                default:
+                        log_error("Unknown option code %c", c);
+                        return -EINVAL;
+                }
+        }
+
+        return 1;
+}
+
+static void report(const char *name, usec_t t, uint64_t n) {
+        printf("{ \"benchmark\" : \"%s\", \"usec\" : %llu, \"count\" : %llu }\n",
+               name, (unsigned long long) t, (unsigned long long) n);
+}
+
+static void synthesize(char ***messages) {
+        static const char * const words[] = {
+                "Started", "Stopping", "Reached", "target", "Mounted", "/dev/sda1",
+                "systemd-journald.service", "pid=4711", "Grüße", "naïve", "Straße",
+                "λόγος", "日本語", "failed:", "No such file or directory", "—",
+        };
+        unsigned i, j;
+
+        for (i = 0; i < 4096; i++) {
+                char *m = NULL;
+                /* Three quarters of the messages are plain ASCII */
+                bool ascii = i % 4 != 0;
+
+                for (j = 0; j < 4 + i % 24; j++) {
+                        const char *w;
+                        char *t;
+
+                        w = words[(i * 7 + j * 13) % ELEMENTSOF(words)];
+                        if (ascii && !ascii_is_valid(w))
+                                continue;
+
+                        t = strjoin(m ? m : "", m ? " " : "", w, NULL);
+                        assert_se(t);
+                        free(m);
+                        m = t;
+                }
+
+                assert_se(strv_push(messages, m) >= 0);
+        }
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_strv_free_ char **messages = NULL;
+        uint64_t n = 0, bytes = 0, printable = 0, valid = 0;
+        usec_t t, t_printable = 0, t_valid = 0;
+        unsigned i, j;
+        char **m;
+        int r;
+
+        log_parse_environment();
+        log_open();
+
+        r = parse_argv(argc, argv);
+        if (r <= 0)
+                return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        if (optind < argc) {
+                for (i = optind; i < (unsigned) argc; i++) {
+                        _cleanup_fclose_ FILE *f = NULL;
+                        char line[LINE_MAX];
+
+                        f = fopen(argv[i], "re");
+                        if (!f) {
+                                log_error("Failed to open %s: %m", argv[i]);
+                                return EXIT_FAILURE;
+                        }
+
+                        FOREACH_LINE(line, f, break) {
+                                truncate_nl(line);
+                                if (line[0] == '\0')
+                                        continue;
+                                assert_se(strv_extend(&messages, line) >= 0);
+                        }
+                }
+        } else
+                synthesize(&messages);
+
+        if (strv_isempty(messages)) {
+                log_error("Found no messages, nothing to do.");
+                return EXIT_FAILURE;
+        }
+
+        STRV_FOREACH(m, messages)
+                bytes += strlen(*m);
+
+        for (j = 0; j < arg_iterations; j++) {
+                uint64_t p = 0, v = 0;
+
+                t = now(CLOCK_MONOTONIC);
+                STRV_FOREACH(m, messages)
+                        if (utf8_is_printable_n(*m, strlen(*m)))
+                                p++;
+                t_printable += now(CLOCK_MONOTONIC) - t;
+
+                t = now(CLOCK_MONOTONIC);
+                STRV_FOREACH(m, messages)
+                        if (utf8_is_valid(*m))
+                                v++;
+                t_valid += now(CLOCK_MONOTONIC) - t;
+
+                n += strv_length(messages);
+                printable = p;
+                valid = v;
+        }
+
+        log_info("%u messages of %llu bytes, %llu printable, %llu valid",
+                 strv_length(messages), (unsigned long long) bytes,
+                 (unsigned long long) printable, (unsigned long long) valid);
+
+        report("utf8-is-printable", t_printable, n);
+        report("utf8-is-valid", t_valid, n);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <string.h>
+
+#include "util.h"
+#include "arena.h"
+
+static void test_small(void) {
+        Arena a = {};
+        char *p[1000];
+        unsigned i;
+
+        for (i = 0; i < ELEMENTSOF(p); i++) {
+                char buf[DECIMAL_STR_MAX(unsigned)];
+
+                snprintf(buf, sizeof(buf), "%u", i);
+                p[i] = arena_strdup(&a, buf);
+                assert_se(p[i]);
+                assert_se(((uintptr_t) p[i] % sizeof(void*)) == 0);
+        }
+
+        /* Nothing got overwritten by later allocations */
+        for (i = 0; i < ELEMENTSOF(p); i++) {
+                char buf[DECIMAL_STR_MAX(unsigned)];
+
+                snprintf(buf, sizeof(buf), "%u", i);
+                assert_se(streq(p[i], buf));
+        }
+
+        arena_free(&a);
+        assert_se(!a.chunks);
+}
+
+static void test_large(void) {
+        Arena a = {};
+        char *s, *t, *u;
+
+        s = arena_strdup(&a, "before");
+        t = arena_alloc(&a, 1024*1024);
+        assert_se(s && t);
+        memset(t, 'x', 1024*1024);
+
+        /* The current chunk is still used after a large allocation */
+        u = arena_strdup(&a, "after");
+        assert_se(u);
+        assert_se(u > s && u < s + 4096);
+
+        assert_se(streq(s, "before"));
+        assert_se(streq(u, "after"));
+
+        assert_se(streq(arena_strndup(&a, "abcdef", 3), "abc"));
+        assert_se(streq(arena_strndup(&a, "ab", 3), "ab"));
+
+        arena_free(&a);
+
+        /* A large first allocation works too */
+        t = arena_alloc(&a, 1024*1024);
+        assert_se(t);
+        memset(t, 'x', 1024*1024);
+        assert_se(arena_strdup(&a, "next"));
+
+        arena_free(&a);
+}
+
+int main(int argc, char *argv[]) {
+        test_small();
+        test_large();
+
+        return 0;
+}
@@ -19,6 +19,7 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "calendarspec.h"
@@ -50,6 +51,38 @@ static void test_one(const char *input, const char *output) {
         assert_se(streq(q, p));
 }
 
+static void test_next(const char *input, const char *new_tz, usec_t after, usec_t expect) {
+        CalendarSpec *c;
+        usec_t u;
+        char *old_tz;
+        char buf[FORMAT_TIMESTAMP_MAX];
+        int r;
+
+        old_tz = getenv("TZ");
+        if (old_tz)
+                old_tz = strdupa(old_tz);
+
+        assert_se(setenv("TZ", new_tz, 1) >= 0);
+        tzset();
+
+        assert_se(calendar_spec_from_string(input, &c) >= 0);
+
+        r = calendar_spec_next_usec(c, after, &u);
+        printf("\"%s\" in %s → %s\n", input, new_tz, r < 0 ? strerror(-r) : format_timestamp(buf, sizeof(buf), u));
+        if (expect == (usec_t) -1)
+                assert_se(r == -ENOENT);
+        else
+                assert_se(r >= 0 && u == expect);
+
+        calendar_spec_free(c);
+
+        if (old_tz)
+                assert_se(setenv("TZ", old_tz, 1) >= 0);
+        else
+                assert_se(unsetenv("TZ") >= 0);
+        tzset();
+}
+
 int main(int argc, char* argv[]) {
         CalendarSpec *c;
 
@@ -79,6 +112,21 @@ int main(int argc, char* argv[]) {
         test_one("weekly", "Mon *-*-* 00:00:00");
         test_one("*:2/3", "*-*-* *:02/3:00");
 
+        test_next("Mon *-02-29", "UTC", 1388534400000000ULL, 1456704000000000ULL);
+        test_next("*-02-30", "UTC", 1388534400000000ULL, (usec_t) -1);
+        test_next("2012-*-*", "UTC", 1388534400000000ULL, (usec_t) -1);
+
+        /* The clock is put forward from 02:00 to 03:00 */
+        test_next("*-*-* 02:30:00", "Europe/Berlin", 1396134000000000ULL, 1396225800000000ULL);
+        test_next("*-*-* *:30:00", "Europe/Berlin", 1396140300000000ULL, 1396143000000000ULL);
+
+        /* … and back from 03:00 to 02:00 */
+        test_next("*-*-* 02:15:00", "Europe/Berlin", 1414278000000000ULL, 1414282500000000ULL);
+        test_next("*-*-* 02:15:00", "Europe/Berlin", 1414282800000000ULL, 1414286100000000ULL);
+
+        /* Forward by half an hour only, from 02:00 to 02:30 */
+        test_next("*-*-* 02:*:00", "Australia/Lord_Howe", 1412429400000000ULL, 1412436600000000ULL);
+
         assert_se(calendar_spec_from_string("test", &c) < 0);
         assert_se(calendar_spec_from_string("", &c) < 0);
         assert_se(calendar_spec_from_string("7", &c) < 0);
@@ -0,0 +1,159 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "strv.h"
+#include "conf-parser.h"
+
+static char *one = NULL;
+static char **two = NULL;
+static unsigned three = 0;
+
+static const ConfigTableItem items[] = {
+        { "Foo", "One",   config_parse_string,   0, &one   },
+        { "Foo", "Two",   config_parse_strv,     0, &two   },
+        { "Bar", "Three", config_parse_unsigned, 0, &three },
+        {}
+};
+
+static void write_file(char *t, const char *contents) {
+        int fd;
+        FILE *f;
+
+        fd = mkostemp(t, O_CLOEXEC);
+        assert_se(fd >= 0);
+
+        f = fdopen(fd, "w");
+        assert_se(f);
+        fputs(contents, f);
+        fclose(f);
+}
+
+static void test_config_file_read(void) {
+        char t[] = "/tmp/test-conf-parser-XXXXXX";
+        ConfigFile *c;
+
+        write_file(t,
+                   "[Foo]\n"
+                   "# comment\n"
+                   "  ; comment\n"
+                   "\n"
+                   "  One =  one  \n"
+                   "Two=a \\\n"
+                   "  b\n"
+                   "no assignment\n"
+                   "[Bar]\n"
+                   "Three=3=3\n");
+
+        assert_se(config_file_read(t, NULL, &c) >= 0);
+        unlink(t);
+
+        assert_se(streq(c->filename, t));
+        assert_se(c->n_lines == 6);
+
+        assert_se(c->lines[0].line == 1);
+        assert_se(streq(c->lines[0].lvalue, "[Foo]"));
+        assert_se(!c->lines[0].rvalue);
+
+        assert_se(c->lines[1].line == 5);
+        assert_se(streq(c->lines[1].lvalue, "One"));
+        assert_se(streq(c->lines[1].rvalue, "one"));
+
+        /* Continuation lines count as one */
+        assert_se(c->lines[2].line == 6);
+        assert_se(streq(c->lines[2].lvalue, "Two"));
+        assert_se(streq(c->lines[2].rvalue, "a    b"));
+
+        assert_se(c->lines[3].line == 7);
+        assert_se(streq(c->lines[3].lvalue, "no assignment"));
+        assert_se(!c->lines[3].rvalue);
+
+        assert_se(streq(c->lines[5].lvalue, "Three"));
+        assert_se(streq(c->lines[5].rvalue, "3=3"));
+
+        config_file_free(c);
+
+        assert_se(config_file_read("/nonexistent/file", NULL, &c) == -ENOENT);
+}
+
+static void test_config_file_apply(void) {
+        char t[] = "/tmp/test-conf-parser-XXXXXX";
+        ConfigFile *c;
+
+        write_file(t,
+                   "Outside=1\n"
+                   "[Foo]\n"
+                   "One=one\n"
+                   "Two=a b\n"
+                   "[Unknown]\n"
+                   "Three=1\n"
+                   "[Bar]\n"
+                   "Three=3\n"
+                   "Unknown=x\n");
+
+        assert_se(config_file_read(t, NULL, &c) >= 0);
+
+        /* The same file may be applied more than once */
+        assert_se(config_file_apply(NULL, c, "Foo\0Bar\0", config_item_table_lookup, (void*) items, false, NULL) >= 0);
+        assert_se(streq(one, "one"));
+        assert_se(strv_length(two) == 2);
+        assert_se(streq(two[0], "a"));
+        assert_se(streq(two[1], "b"));
+        assert_se(three == 3);
+
+        three = 0;
+        assert_se(config_file_apply(NULL, c, "Foo\0Bar\0", config_item_table_lookup, (void*) items, false, NULL) >= 0);
+        assert_se(three == 3);
+        assert_se(strv_length(two) == 4);
+
+        config_file_free(c);
+
+        /* And config_parse() does the same in one go */
+        three = 0;
+        assert_se(config_parse(NULL, t, NULL, "Foo\0Bar\0", config_item_table_lookup, (void*) items, false, NULL) >= 0);
+        assert_se(three == 3);
+
+        unlink(t);
+
+        free(one);
+        strv_free(two);
+}
+
+static void test_config_file_invalid(void) {
+        char t[] = "/tmp/test-conf-parser-XXXXXX";
+
+        write_file(t,
+                   "[Foo]\n"
+                   "One\n");
+
+        assert_se(config_parse(NULL, t, NULL, "Foo\0", config_item_table_lookup, (void*) items, false, NULL) == -EBADMSG);
+        unlink(t);
+}
+
+int main(int argc, char *argv[]) {
+        test_config_file_read();
+        test_config_file_apply();
+        test_config_file_invalid();
+
+        return 0;
+}
@@ -75,6 +75,24 @@ static void test_strv_env_set(void) {
         assert_se(strv_length(r) == 4);
 }
 
+static void test_strv_env_replace(void) {
+        _cleanup_strv_free_ char **l = NULL;
+
+        l = strv_new("PIEP", "SCHLUMPF=SMURFF", "NANANANA=YES", NULL);
+        assert_se(l);
+
+        assert_se(strv_env_replace(&l, strdup("WALDO=WALDO")) >= 0);
+        assert_se(strv_env_replace(&l, strdup("SCHLUMPF=")) >= 0);
+        assert_se(strv_env_replace(&l, strdup("PIEP=PIEP")) >= 0);
+
+        assert_se(streq(l[0], "PIEP"));
+        assert_se(streq(l[1], "SCHLUMPF="));
+        assert_se(streq(l[2], "NANANANA=YES"));
+        assert_se(streq(l[3], "WALDO=WALDO"));
+        assert_se(streq(l[4], "PIEP=PIEP"));
+        assert_se(strv_length(l) == 5);
+}
+
 static void test_strv_env_merge(void) {
         _cleanup_strv_free_ char **a = NULL, **b = NULL, **r = NULL;
 
@@ -208,6 +226,7 @@ int main(int argc, char *argv[]) {
         test_strv_env_delete();
         test_strv_env_unset();
         test_strv_env_set();
+        test_strv_env_replace();
         test_strv_env_merge();
         test_replace_env_arg();
         test_normalize_env_assignment();
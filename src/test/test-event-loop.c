@@ -0,0 +1,237 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "util.h"
+#include "macro.h"
+#include "event-loop.h"
+
+static int got_io, got_time, got_signal, got_child, got_defer;
+static EventSource *io_source, *other_io_source, *time_source, *defer_source;
+
+static int io_handler(EventSource *s, int fd, uint32_t revents, void *userdata) {
+        char c;
+
+        assert_se(s == io_source);
+        assert_se(PTR_TO_INT(userdata) == 'a');
+        assert_se(revents & EPOLLIN);
+        assert_se(read(fd, &c, 1) == 1);
+        assert_se(c == 'x');
+
+        got_io++;
+
+        /* The other source is pending in the same iteration, and
+         * must not be called after it has been freed */
+        event_source_free(other_io_source);
+        other_io_source = NULL;
+
+        return 0;
+}
+
+static int other_io_handler(EventSource *s, int fd, uint32_t revents, void *userdata) {
+        char c;
+
+        assert_se(s == other_io_source);
+        assert_se(read(fd, &c, 1) == 1);
+
+        got_io++;
+
+        event_source_free(io_source);
+        io_source = NULL;
+
+        return 0;
+}
+
+static int time_handler(EventSource *s, usec_t usec, void *userdata) {
+        assert_se(s == time_source);
+        assert_se(!event_source_get_enabled(s));
+        assert_se(now(CLOCK_MONOTONIC) >= usec);
+
+        got_time++;
+
+        /* Rearming for the past fires in the next iteration, not
+         * right away */
+        if (got_time < 3)
+                assert_se(event_source_set_enabled(s, true) >= 0);
+
+        return 0;
+}
+
+static int signal_handler(EventSource *s, const struct signalfd_siginfo *si, void *userdata) {
+        assert_se(si->ssi_signo == SIGUSR1);
+
+        got_signal++;
+
+        return 0;
+}
+
+static int child_handler(EventSource *s, const siginfo_t *si, void *userdata) {
+        EventLoop *e = event_source_get_loop(s);
+
+        assert_se(si->si_code == CLD_EXITED);
+        assert_se(si->si_status == 7);
+        assert_se(!event_source_get_enabled(s));
+
+        got_child++;
+
+        event_source_free(s);
+        return event_loop_exit(e, 42);
+}
+
+static int defer_handler(EventSource *s, void *userdata) {
+        assert_se(s == defer_source);
+
+        got_defer++;
+
+        return -EIO;
+}
+
+static void test_io(EventLoop *e) {
+        int a[2], b[2], i;
+
+        assert_se(pipe2(a, O_CLOEXEC|O_NONBLOCK) >= 0);
+        assert_se(pipe2(b, O_CLOEXEC|O_NONBLOCK) >= 0);
+
+        assert_se(event_add_io(e, a[0], EPOLLIN, io_handler, INT_TO_PTR('a'), &io_source) >= 0);
+        assert_se(event_add_io(e, a[0], EPOLLIN, io_handler, NULL, NULL) == -EEXIST);
+        assert_se(event_add_io(e, b[0], EPOLLIN, other_io_handler, INT_TO_PTR('b'), &other_io_source) >= 0);
+
+        /* Toggling back and forth between iterations ends up as no
+         * change at all */
+        for (i = 0; i < 100; i++) {
+                assert_se(event_source_set_enabled(io_source, false) >= 0);
+                assert_se(event_source_set_io_events(io_source, EPOLLIN|EPOLLOUT) >= 0);
+                assert_se(event_source_set_io_events(io_source, EPOLLIN) >= 0);
+                assert_se(event_source_set_enabled(io_source, true) >= 0);
+        }
+
+        assert_se(event_loop_run(e, 0) == 0);
+
+        assert_se(write(a[1], "x", 1) == 1);
+        assert_se(write(b[1], "y", 1) == 1);
+
+        /* Whichever comes first frees the other one */
+        assert_se(event_loop_run(e, (usec_t) -1) > 0);
+        assert_se(got_io == 1);
+        assert_se(!io_source != !other_io_source);
+
+        event_source_free(io_source);
+        event_source_free(other_io_source);
+        io_source = other_io_source = NULL;
+
+        /* Disabled sources are not dispatched */
+        assert_se(event_add_io(e, a[0], EPOLLIN, io_handler, INT_TO_PTR('a'), &io_source) >= 0);
+        assert_se(event_source_set_enabled(io_source, false) >= 0);
+        assert_se(write(a[1], "x", 1) == 1);
+        assert_se(event_loop_run(e, 0) == 0);
+        assert_se(event_source_set_enabled(io_source, true) >= 0);
+        assert_se(event_loop_run(e, 0) > 0);
+        assert_se(got_io == 2);
+        event_source_free(io_source);
+        io_source = NULL;
+
+        close_pipe(a);
+        close_pipe(b);
+}
+
+static void test_time(EventLoop *e) {
+        assert_se(event_add_time(e, now(CLOCK_MONOTONIC) + 10 * USEC_PER_MSEC, time_handler, NULL, &time_source) >= 0);
+
+        assert_se(event_loop_run(e, 0) == 0);
+        assert_se(got_time == 0);
+
+        assert_se(event_loop_run(e, (usec_t) -1) > 0);
+        assert_se(got_time == 1);
+
+        assert_se(event_loop_run(e, (usec_t) -1) > 0);
+        assert_se(got_time == 2);
+        assert_se(event_loop_run(e, (usec_t) -1) > 0);
+        assert_se(got_time == 3);
+
+        assert_se(event_loop_run(e, 0) == 0);
+        assert_se(got_time == 3);
+
+        event_source_free(time_source);
+        time_source = NULL;
+}
+
+static void test_defer(EventLoop *e) {
+        assert_se(event_add_defer(e, defer_handler, NULL, &defer_source) >= 0);
+
+        assert_se(event_loop_run(e, (usec_t) -1) > 0);
+        assert_se(got_defer == 1);
+        assert_se(!event_source_get_enabled(defer_source));
+
+        assert_se(event_loop_run(e, 0) == 0);
+        assert_se(got_defer == 1);
+
+        event_source_free(defer_source);
+        defer_source = NULL;
+}
+
+static void test_signal_child(EventLoop *e) {
+        EventSource *s;
+        sigset_t ss;
+        pid_t pid;
+
+        assert_se(sigemptyset(&ss) >= 0);
+        assert_se(sigaddset(&ss, SIGUSR1) >= 0);
+        assert_se(sigaddset(&ss, SIGCHLD) >= 0);
+        assert_se(sigprocmask(SIG_BLOCK, &ss, NULL) >= 0);
+
+        assert_se(event_add_signal(e, SIGUSR1, signal_handler, NULL, &s) >= 0);
+        assert_se(event_add_signal(e, SIGUSR1, signal_handler, NULL, NULL) == -EBUSY);
+
+        assert_se(raise(SIGUSR1) >= 0);
+        assert_se(event_loop_run(e, (usec_t) -1) > 0);
+        assert_se(got_signal == 1);
+
+        event_source_free(s);
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0)
+                _exit(7);
+
+        assert_se(event_add_child(e, pid, WEXITED, child_handler, NULL, NULL) >= 0);
+
+        assert_se(event_loop_loop(e) == 42);
+        assert_se(got_child == 1);
+}
+
+int main(int argc, char *argv[]) {
+        EventLoop *e;
+
+        assert_se(event_loop_new(&e) >= 0);
+        assert_se(event_loop_get_fd(e) >= 0);
+
+        test_io(e);
+        test_time(e);
+        test_defer(e);
+        test_signal_child(e);
+
+        event_loop_free(e);
+
+        return 0;
+}
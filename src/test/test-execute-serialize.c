@@ -0,0 +1,175 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+#include "strv.h"
+#include "cgroup.h"
+#include "syscall-list.h"
+#include "execute-serialize.h"
+
+static bool strv_same(char **a, char **b) {
+        for (; a && *a; a++, b++)
+                if (!b || !*b || !streq(*a, *b))
+                        return false;
+
+        return !b || !*b;
+}
+
+static void test_roundtrip(void) {
+        ExecCommand command = {}, command2 = {};
+        ExecContext c = {}, c2 = {};
+        ExecParameters p, p2 = {};
+        CGroupBonding b = {
+                .controller = (char*) "name=systemd",
+                .path = (char*) "/system/foo bar.service",
+                .essential = true,
+                .realized = true,
+        };
+        struct rlimit nofile = { 1024, 4096 };
+        char *argv[] = { (char*) "foo", (char*) "line one\nline two", (char*) "", NULL };
+        char *env[] = { (char*) "A=a", (char*) "B=b c", NULL };
+        int fds[] = { 3, 7 }, idle_pipe[] = { 9, -1 };
+        unsigned n;
+        FILE *f;
+
+        exec_context_init(&c);
+        exec_context_init(&c2);
+
+        assert_se(exec_command_set(&command, "/bin/foo", "bar", NULL) >= 0);
+
+        assert_se(strv_extend(&c.environment, "X=y z") >= 0);
+        assert_se(strv_extend(&c.read_only_dirs, "/usr") >= 0);
+        assert_se(strv_extend(&c.read_only_dirs, "/etc") >= 0);
+        c.rlimit[RLIMIT_NOFILE] = &nofile;
+        c.working_directory = (char*) "/var/lib/foo";
+        c.umask = 0077;
+        c.nice = -5;
+        c.nice_set = true;
+        c.std_output = EXEC_OUTPUT_JOURNAL;
+        c.std_error = EXEC_OUTPUT_INHERIT;
+        c.user = (char*) "nobody";
+        c.capability_bounding_set_drop = 1ULL << 40;
+        c.private_tmp = true;
+        c.tmp_dir = (char*) "/tmp/systemd-foo.service-abc/tmp";
+        c.control_group_persistent = 1;
+
+        n = (syscall_max() + 31) >> 4;
+        c.syscall_filter = new0(uint32_t, n);
+        assert_se(c.syscall_filter);
+        c.syscall_filter[0] = 0xDEADBEEF;
+        c.syscall_filter[n-1] = 0x1;
+
+        p = (ExecParameters) {
+                .argv = argv,
+                .environment = env,
+                .fds = fds,
+                .n_fds = ELEMENTSOF(fds),
+                .socket_fd = -1,
+                .idle_pipe = idle_pipe,
+                .apply_permissions = true,
+                .confirm_spawn = true,
+                .cgroup_bondings = &b,
+                .unit_id = "foo.service",
+        };
+
+        f = tmpfile();
+        assert_se(f);
+        assert_se(exec_spawn_serialize(f, &command, &c, &p) >= 0);
+        rewind(f);
+        assert_se(exec_spawn_deserialize(f, &command2, &c2, &p2) >= 0);
+        fclose(f);
+
+        assert_se(streq(command2.path, "/bin/foo"));
+        assert_se(strv_same(p2.argv, argv));
+        assert_se(strv_same(p2.environment, env));
+        assert_se(!p2.files_env);
+        assert_se(p2.n_fds == 2 && p2.fds[0] == 3 && p2.fds[1] == 7);
+        assert_se(p2.socket_fd == -1);
+        assert_se(p2.idle_pipe[0] == 9 && p2.idle_pipe[1] == -1);
+        assert_se(p2.apply_permissions && !p2.apply_chroot && !p2.apply_tty_stdin && p2.confirm_spawn);
+        assert_se(p2.cgroup_bondings && !p2.cgroup_bondings->by_unit_next);
+        assert_se(streq(p2.cgroup_bondings->controller, "name=systemd"));
+        assert_se(streq(p2.cgroup_bondings->path, "/system/foo bar.service"));
+        assert_se(p2.cgroup_bondings->essential && p2.cgroup_bondings->realized);
+        assert_se(!p2.cgroup_suffix);
+        assert_se(streq(p2.unit_id, "foo.service"));
+
+        assert_se(strv_same(c2.environment, c.environment));
+        assert_se(strv_same(c2.read_only_dirs, c.read_only_dirs));
+        assert_se(!c2.read_write_dirs);
+        assert_se(c2.rlimit[RLIMIT_NOFILE]->rlim_cur == 1024 && c2.rlimit[RLIMIT_NOFILE]->rlim_max == 4096);
+        assert_se(!c2.rlimit[RLIMIT_CORE]);
+        assert_se(streq(c2.working_directory, "/var/lib/foo"));
+        assert_se(!c2.root_directory);
+        assert_se(c2.umask == 0077);
+        assert_se(c2.nice_set && c2.nice == -5);
+        assert_se(!c2.oom_score_adjust_set && !c2.ioprio_set && !c2.cpu_sched_set);
+        assert_se(c2.std_input == EXEC_INPUT_NULL);
+        assert_se(c2.std_output == EXEC_OUTPUT_JOURNAL);
+        assert_se(c2.std_error == EXEC_OUTPUT_INHERIT);
+        assert_se(c2.timer_slack_nsec == (nsec_t) -1);
+        assert_se(streq(c2.user, "nobody"));
+        assert_se(c2.capability_bounding_set_drop == 1ULL << 40);
+        assert_se(!c2.capabilities);
+        assert_se(c2.private_tmp && streq(c2.tmp_dir, c.tmp_dir) && !c2.var_tmp_dir);
+        assert_se(c2.control_group_persistent == 1);
+        assert_se(c2.ignore_sigpipe && c2.syslog_level_prefix);
+        assert_se(memcmp(c2.syscall_filter, c.syscall_filter, n * sizeof(uint32_t)) == 0);
+
+        free(c.syscall_filter);
+        strv_free(c.environment);
+        strv_free(c.read_only_dirs);
+        exec_command_done(&command);
+
+        free(c2.tmp_dir);
+        exec_context_done(&c2, true);
+        exec_command_done(&command2);
+        exec_parameters_done(&p2);
+}
+
+static void test_bad(void) {
+        ExecCommand command = {};
+        ExecContext c = {};
+        ExecParameters p = {};
+        FILE *f;
+
+        exec_context_init(&c);
+
+        /* Without a command there is nothing to execute */
+        f = tmpfile();
+        assert_se(f);
+        fwrite("\0SDSTATE\1\0\0\0", 12, 1, f);
+        rewind(f);
+        assert_se(exec_spawn_deserialize(f, &command, &c, &p) == -EBADMSG);
+        fclose(f);
+
+        exec_context_done(&c, true);
+        exec_command_done(&command);
+        exec_parameters_done(&p);
+}
+
+int main(int argc, char *argv[]) {
+        test_roundtrip();
+        test_bad();
+
+        return 0;
+}
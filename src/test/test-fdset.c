@@ -0,0 +1,118 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "fdset.h"
+
+static void test_fdset_put_remove(void) {
+        FDSet *s;
+        Iterator i;
+        int fd, n = 0, last = -1;
+
+        assert_se(fdset_size(NULL) == 0);
+
+        s = fdset_new();
+        assert_se(s);
+
+        assert_se(fdset_size(s) == 0);
+        assert_se(!fdset_contains(s, 0));
+        assert_se(!fdset_contains(s, 4711));
+        assert_se(fdset_remove(s, 4711) == -ENOENT);
+
+        assert_se(fdset_put(s, 63) == 0);
+        assert_se(fdset_put(s, 64) == 0);
+        assert_se(fdset_put(s, 0) == 0);
+        assert_se(fdset_put(s, 10000) == 0);
+        assert_se(fdset_put(s, 64) == -EEXIST);
+        assert_se(fdset_size(s) == 4);
+
+        assert_se(fdset_contains(s, 0));
+        assert_se(fdset_contains(s, 63));
+        assert_se(fdset_contains(s, 64));
+        assert_se(fdset_contains(s, 10000));
+        assert_se(!fdset_contains(s, 65));
+        assert_se(!fdset_contains(s, 9999));
+
+        FDSET_FOREACH(fd, s, i) {
+                assert_se(fd > last);
+                assert_se(fdset_contains(s, fd));
+                last = fd;
+                n++;
+
+                /* Removing the current entry must not upset the
+                 * iteration */
+                if (fd == 63)
+                        assert_se(fdset_remove(s, 63) == 63);
+        }
+
+        assert_se(n == 4);
+        assert_se(last == 10000);
+        assert_se(fdset_size(s) == 3);
+        assert_se(!fdset_contains(s, 63));
+
+        assert_se(fdset_remove(s, 0) == 0);
+        assert_se(fdset_remove(s, 64) == 64);
+        assert_se(fdset_remove(s, 10000) == 10000);
+        assert_se(fdset_size(s) == 0);
+
+        FDSET_FOREACH(fd, s, i)
+                assert_not_reached("empty set");
+
+        fdset_free(s);
+}
+
+static void test_fdset_close_others(void) {
+        _cleanup_close_ int keep = -1;
+        int drop, copy;
+        FDSet *s;
+
+        keep = open("/dev/null", O_RDONLY|O_CLOEXEC);
+        drop = open("/dev/null", O_RDONLY|O_CLOEXEC);
+        assert_se(keep >= 0 && drop >= 0);
+
+        s = fdset_new();
+        assert_se(s);
+
+        assert_se(fdset_put(s, keep) == 0);
+        copy = fdset_put_dup(s, keep);
+        assert_se(copy >= 3);
+        assert_se(fdset_contains(s, copy));
+
+        assert_se(fdset_close_others(s) >= 0);
+
+        assert_se(fcntl(keep, F_GETFD) >= 0);
+        assert_se(fcntl(copy, F_GETFD) >= 0);
+        assert_se(fcntl(drop, F_GETFD) < 0 && errno == EBADF);
+
+        assert_se(fdset_remove(s, keep) == keep);
+
+        /* Closes copy, which is still in the set */
+        fdset_free(s);
+        assert_se(fcntl(copy, F_GETFD) < 0 && errno == EBADF);
+}
+
+int main(int argc, char *argv[]) {
+        test_fdset_put_remove();
+        test_fdset_close_others();
+
+        return 0;
+}
@@ -0,0 +1,115 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fnmatch.h>
+#include <string.h>
+
+#include "util.h"
+#include "glob-match.h"
+
+static void test_glob_match_one(const char *pattern, const char *s) {
+        bool a, b;
+
+        a = glob_match(pattern, strlen(pattern), s);
+        b = fnmatch(pattern, s, 0) == 0;
+
+        if (a != b)
+                log_error("\"%s\" vs. \"%s\": %s, fnmatch() says %s",
+                          pattern, s, yes_no(a), yes_no(b));
+        assert_se(a == b);
+}
+
+static void test_glob_match(void) {
+        test_glob_match_one("sd*", "sda1");
+        test_glob_match_one("sd*", "sr0");
+        test_glob_match_one("*[0-9]", "loop7");
+        test_glob_match_one("*[0-9]", "loop");
+        test_glob_match_one("tty[A-Z]*[0-9]", "ttyUSB0");
+        test_glob_match_one("hd[!a-c]", "hdd");
+        test_glob_match_one("hd[^a-c]", "hdb");
+        test_glob_match_one("[]a]", "]");
+        test_glob_match_one("[!]]", "]");
+        test_glob_match_one("[a-]", "-");
+        test_glob_match_one("[abc", "[abc");
+        test_glob_match_one("a*b*c", "aXbYbZc");
+        test_glob_match_one("a*b*c", "aXbYbZ");
+        test_glob_match_one("**", "");
+        test_glob_match_one("?", "");
+        test_glob_match_one("*/*", "block/sda");
+        test_glob_match_one(".*", ".hidden");
+}
+
+/* Compares against fnmatch() on all short patterns and strings made of
+ * the characters which are special to either */
+static void test_glob_match_exhaustive(void) {
+        static const char pattern_chars[] = "a*?[]!^-";
+        static const char string_chars[] = "ab]-!";
+        char pattern[5], s[4];
+        unsigned pi, si;
+
+        for (pi = 0; pi < 1 + 8 + 8*8 + 8*8*8 + 8*8*8*8; pi++) {
+                unsigned n, k, x = pi;
+
+                for (n = 0, k = 1; x >= k; n++, x -= k, k *= 8)
+                        ;
+                for (k = 0; k < n; k++, x /= 8)
+                        pattern[k] = pattern_chars[x % 8];
+                pattern[n] = 0;
+
+                if (!glob_simple(pattern, n))
+                        continue;
+
+                for (si = 0; si < 1 + 5 + 5*5 + 5*5*5; si++) {
+                        unsigned m, j, y = si;
+
+                        for (m = 0, j = 1; y >= j; m++, y -= j, j *= 5)
+                                ;
+                        for (j = 0; j < m; j++, y /= 5)
+                                s[j] = string_chars[y % 5];
+                        s[m] = 0;
+
+                        test_glob_match_one(pattern, s);
+                }
+        }
+}
+
+static void test_glob_match_length(void) {
+        const char *l = "sd*|hd*|vd[a-c]";
+
+        assert_se(glob_match(l, 3, "sdb"));
+        assert_se(!glob_match(l, 3, "hda"));
+        assert_se(glob_match(l + 8, 7, "vdb"));
+        assert_se(!glob_match(l + 4, 3, "sdb"));
+}
+
+static void test_glob_simple(void) {
+        assert_se(glob_simple("sd[a-z]*", 8));
+        assert_se(!glob_simple("a\\*", 3));
+        assert_se(!glob_simple("[[:digit:]]", 11));
+        assert_se(glob_simple("[[:digit:]]", 1));
+}
+
+int main(int argc, char *argv[]) {
+        test_glob_match();
+        test_glob_match_exhaustive();
+        test_glob_match_length();
+        test_glob_simple();
+
+        return 0;
+}
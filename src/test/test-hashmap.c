@@ -0,0 +1,426 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "util.h"
+#include "hashmap.h"
+#include "set.h"
+#include "strv.h"
+
+#define N_ENTRIES 20000
+
+static void test_basic(void) {
+        Hashmap *h;
+        void *k;
+
+        h = hashmap_new(string_hash_func, string_compare_func);
+        assert_se(h);
+
+        assert_se(hashmap_isempty(h));
+        assert_se(hashmap_get(h, "foo") == NULL);
+
+        assert_se(hashmap_put(h, "foo", (void*) "1") == 1);
+        assert_se(hashmap_put(h, "foo", (void*) "1") == 0);
+        assert_se(hashmap_put(h, "foo", (void*) "2") == -EEXIST);
+        assert_se(hashmap_put(h, "bar", (void*) "3") == 1);
+
+        assert_se(hashmap_size(h) == 2);
+        assert_se(streq(hashmap_get(h, "foo"), "1"));
+        assert_se(streq(hashmap_get2(h, "bar", &k), "3"));
+        assert_se(streq(k, "bar"));
+        assert_se(hashmap_contains(h, "foo"));
+        assert_se(!hashmap_contains(h, "baz"));
+
+        assert_se(hashmap_update(h, "foo", (void*) "4") == 0);
+        assert_se(hashmap_update(h, "baz", (void*) "4") == -ENOENT);
+        assert_se(hashmap_replace(h, "baz", (void*) "5") == 1);
+        assert_se(hashmap_replace(h, "baz", (void*) "6") == 0);
+        assert_se(streq(hashmap_get(h, "foo"), "4"));
+        assert_se(streq(hashmap_get(h, "baz"), "6"));
+
+        assert_se(hashmap_remove_value(h, "baz", (void*) "5") == NULL);
+        assert_se(streq(hashmap_remove(h, "baz"), "6"));
+        assert_se(hashmap_remove(h, "baz") == NULL);
+        assert_se(hashmap_size(h) == 2);
+
+        hashmap_clear(h);
+        assert_se(hashmap_isempty(h));
+        assert_se(hashmap_first(h) == NULL);
+
+        assert_se(hashmap_put(h, "foo", (void*) "1") == 1);
+        assert_se(streq(hashmap_first(h), "1"));
+
+        hashmap_free(h);
+
+        /* A NULL hashmap is an empty one */
+        assert_se(hashmap_get(NULL, "foo") == NULL);
+        assert_se(hashmap_size(NULL) == 0);
+        assert_se(hashmap_steal_first(NULL) == NULL);
+}
+
+static void test_many(void) {
+        Hashmap *h;
+        unsigned i;
+
+        /* Pointers to integers all have the same low bits, and
+         * growing must not lose any of them */
+        h = hashmap_new(trivial_hash_func, trivial_compare_func);
+        assert_se(h);
+
+        for (i = 1; i <= N_ENTRIES; i++)
+                assert_se(hashmap_put(h, UINT_TO_PTR(i * 16), UINT_TO_PTR(i)) == 1);
+
+        assert_se(hashmap_size(h) == N_ENTRIES);
+
+        for (i = 1; i <= N_ENTRIES; i++)
+                assert_se(PTR_TO_UINT(hashmap_get(h, UINT_TO_PTR(i * 16))) == i);
+
+        assert_se(!hashmap_get(h, UINT_TO_PTR(8)));
+
+        /* Remove every other one, the rest must still be found */
+        for (i = 1; i <= N_ENTRIES; i += 2)
+                assert_se(PTR_TO_UINT(hashmap_remove(h, UINT_TO_PTR(i * 16))) == i);
+
+        assert_se(hashmap_size(h) == N_ENTRIES / 2);
+
+        for (i = 1; i <= N_ENTRIES; i++)
+                assert_se(PTR_TO_UINT(hashmap_get(h, UINT_TO_PTR(i * 16))) == (i % 2 ? 0 : i));
+
+        hashmap_free(h);
+}
+
+static void test_grow(void) {
+        Hashmap *h;
+        Iterator it;
+        unsigned i, n;
+        void *v;
+
+        /* Large tables move their entries to the new buckets while
+         * being changed further, everything must be found all
+         * along */
+        h = hashmap_new(trivial_hash_func, trivial_compare_func);
+        assert_se(h);
+
+        for (i = 1; i <= 5 * N_ENTRIES; i++) {
+                assert_se(hashmap_put(h, UINT_TO_PTR(i), UINT_TO_PTR(i)) == 1);
+
+                if (i % 3 == 0)
+                        assert_se(PTR_TO_UINT(hashmap_remove(h, UINT_TO_PTR(i - 1))) == i - 1);
+
+                if (i % 7 == 0)
+                        assert_se(PTR_TO_UINT(hashmap_get(h, UINT_TO_PTR(i / 2 + 1))) ==
+                                  ((i / 2 + 1) % 3 == 2 ? 0 : i / 2 + 1));
+        }
+
+        for (i = 1; i <= 5 * N_ENTRIES; i++)
+                assert_se(PTR_TO_UINT(hashmap_get(h, UINT_TO_PTR(i))) == (i % 3 == 2 ? 0 : i));
+
+        n = 0;
+        HASHMAP_FOREACH(v, h, it) {
+                assert_se(PTR_TO_UINT(v) % 3 != 2);
+                n++;
+        }
+        assert_se(n == hashmap_size(h));
+
+        hashmap_free(h);
+
+        /* Reserving up front makes room without changing anything */
+        h = hashmap_new(string_hash_func, string_compare_func);
+        assert_se(h);
+
+        assert_se(hashmap_reserve(h, N_ENTRIES) == 0);
+        assert_se(hashmap_isempty(h));
+        assert_se(hashmap_put(h, "foo", (void*) "bar") == 1);
+        assert_se(hashmap_reserve(h, 0) == 0);
+        assert_se(hashmap_reserve(h, (unsigned) -1) == -ENOMEM);
+        assert_se(streq(hashmap_get(h, "foo"), "bar"));
+
+        hashmap_free(h);
+}
+
+static void test_order(void) {
+        Hashmap *h;
+        Iterator i;
+        unsigned j, n;
+        void *v;
+        const void *k;
+
+        h = hashmap_new(trivial_hash_func, trivial_compare_func);
+        assert_se(h);
+
+        for (j = 1; j <= 100; j++)
+                assert_se(hashmap_put(h, UINT_TO_PTR(j), UINT_TO_PTR(j)) == 1);
+
+        /* Iteration follows insertion order, also when entries are
+         * removed and added back in between */
+        for (j = 1; j <= 100; j += 3)
+                assert_se(hashmap_remove(h, UINT_TO_PTR(j)));
+        for (j = 1; j <= 100; j += 3)
+                assert_se(hashmap_put(h, UINT_TO_PTR(j), UINT_TO_PTR(j)) == 1);
+
+        n = 0;
+        HASHMAP_FOREACH_KEY(v, k, h, i) {
+                assert_se(k == v);
+                n++;
+
+                if (n <= 66)
+                        assert_se(PTR_TO_UINT(v) % 3 != 1);
+                else
+                        assert_se(PTR_TO_UINT(v) % 3 == 1);
+        }
+        assert_se(n == 100);
+
+        HASHMAP_FOREACH_BACKWARDS(v, h, i) {
+                n--;
+
+                if (n >= 66)
+                        assert_se(PTR_TO_UINT(v) % 3 == 1);
+        }
+        assert_se(n == 0);
+
+        assert_se(PTR_TO_UINT(hashmap_first(h)) == 2);
+        assert_se(PTR_TO_UINT(hashmap_first_key(h)) == 2);
+        assert_se(PTR_TO_UINT(hashmap_last(h)) == 100);
+        assert_se(PTR_TO_UINT(hashmap_next(h, UINT_TO_PTR(2))) == 3);
+        assert_se(hashmap_next(h, UINT_TO_PTR(100)) == NULL);
+
+        /* Skipping continues from the given entry */
+        assert_se(PTR_TO_UINT(hashmap_iterate_skip(h, UINT_TO_PTR(99), &i)) == 99);
+        assert_se(PTR_TO_UINT(hashmap_iterate(h, &i, NULL)) == 99);
+        assert_se(PTR_TO_UINT(hashmap_iterate(h, &i, NULL)) == 1);
+
+        /* Renaming moves to the end */
+        assert_se(hashmap_remove_and_put(h, UINT_TO_PTR(2), UINT_TO_PTR(1000), UINT_TO_PTR(1000)) == 0);
+        assert_se(hashmap_remove_and_put(h, UINT_TO_PTR(2), UINT_TO_PTR(1001), NULL) == -ENOENT);
+        assert_se(hashmap_remove_and_put(h, UINT_TO_PTR(3), UINT_TO_PTR(1000), NULL) == -EEXIST);
+        assert_se(PTR_TO_UINT(hashmap_first(h)) == 3);
+        assert_se(PTR_TO_UINT(hashmap_last(h)) == 1000);
+
+        assert_se(hashmap_remove_and_replace(h, UINT_TO_PTR(3), UINT_TO_PTR(1000), UINT_TO_PTR(2000)) == 0);
+        assert_se(!hashmap_get(h, UINT_TO_PTR(3)));
+        assert_se(PTR_TO_UINT(hashmap_get(h, UINT_TO_PTR(1000))) == 2000);
+        assert_se(hashmap_size(h) == 99);
+
+        /* Stealing is first in, first out */
+        assert_se(PTR_TO_UINT(hashmap_steal_first(h)) == 5);
+        assert_se(PTR_TO_UINT(hashmap_steal_first_key(h)) == 6);
+        assert_se(hashmap_size(h) == 97);
+
+        hashmap_free(h);
+}
+
+static void test_iterate_and_modify(void) {
+        Hashmap *h;
+        Iterator i;
+        unsigned n;
+        void *v;
+
+        h = hashmap_new(trivial_hash_func, trivial_compare_func);
+        assert_se(h);
+
+        for (n = 1; n <= 10; n++)
+                assert_se(hashmap_put(h, UINT_TO_PTR(n), UINT_TO_PTR(n)) == 1);
+
+        /* Removing the entry just returned is fine, and entries
+         * added meanwhile are seen too, even if that makes the
+         * hashmap grow */
+        n = 0;
+        HASHMAP_FOREACH(v, h, i) {
+                unsigned u = PTR_TO_UINT(v);
+
+                n++;
+
+                if (u % 2 == 0)
+                        assert_se(hashmap_remove(h, v) == v);
+
+                if (u <= 10)
+                        assert_se(hashmap_put(h, UINT_TO_PTR(u + 100), UINT_TO_PTR(u + 100)) == 1);
+        }
+
+        assert_se(n == 20);
+        assert_se(hashmap_size(h) == 10);
+
+        hashmap_free(h);
+}
+
+static void test_move(void) {
+        Hashmap *a, *b, *c;
+
+        a = hashmap_new(string_hash_func, string_compare_func);
+        b = hashmap_new(string_hash_func, string_compare_func);
+        assert_se(a && b);
+
+        assert_se(hashmap_put(a, "a", (void*) "1") == 1);
+        assert_se(hashmap_put(b, "a", (void*) "2") == 1);
+        assert_se(hashmap_put(b, "b", (void*) "3") == 1);
+        assert_se(hashmap_put(b, "c", (void*) "4") == 1);
+
+        assert_se(hashmap_move_one(a, b, "a") == -EEXIST);
+        assert_se(hashmap_move_one(a, b, "x") == -ENOENT);
+        assert_se(hashmap_move_one(a, b, "b") == 0);
+        assert_se(streq(hashmap_get(a, "b"), "3"));
+        assert_se(!hashmap_get(b, "b"));
+
+        c = hashmap_copy(b);
+        assert_se(c);
+        assert_se(hashmap_size(c) == 2);
+
+        /* Entries already present stay where they were */
+        assert_se(hashmap_move(a, b) == 0);
+        assert_se(hashmap_size(a) == 3);
+        assert_se(hashmap_size(b) == 1);
+        assert_se(streq(hashmap_get(a, "a"), "1"));
+        assert_se(streq(hashmap_get(b, "a"), "2"));
+        assert_se(streq(hashmap_get(a, "c"), "4"));
+
+        assert_se(hashmap_merge(a, c) == 0);
+        assert_se(hashmap_size(a) == 3);
+        assert_se(hashmap_size(c) == 2);
+
+        hashmap_free(a);
+        hashmap_free(b);
+        hashmap_free(c);
+}
+
+static void test_free_free(void) {
+        Hashmap *h;
+        Set *s;
+        char **l;
+        unsigned i;
+
+        h = hashmap_new(string_hash_func, string_compare_func);
+        assert_se(h);
+
+        for (i = 0; i < 100; i++) {
+                char *k, *v;
+
+                assert_se(asprintf(&k, "key-%u", i) >= 0);
+                assert_se(asprintf(&v, "value-%u", i) >= 0);
+                assert_se(hashmap_put(h, k, v) == 1);
+        }
+
+        l = hashmap_get_strv(h);
+        assert_se(l);
+        assert_se(strv_length(l) == 100);
+        assert_se(streq(l[0], "value-0"));
+        assert_se(streq(l[99], "value-99"));
+        free(l);
+
+        hashmap_free_free_free(h);
+
+        s = set_new(string_hash_func, string_compare_func);
+        assert_se(s);
+
+        for (i = 0; i < 100; i++) {
+                char *v;
+
+                assert_se(asprintf(&v, "value-%u", i) >= 0);
+                assert_se(set_put(s, v) == 1);
+        }
+
+        set_clear_free(s);
+        assert_se(set_isempty(s));
+        set_free(s);
+}
+
+static void test_random(void) {
+        Hashmap *h;
+        unsigned *present, i;
+
+        /* Checked against a plain array */
+        present = new0(unsigned, 4096);
+        assert_se(present);
+
+        h = hashmap_new(trivial_hash_func, trivial_compare_func);
+        assert_se(h);
+
+        srand(0);
+
+        for (i = 0; i < 200000; i++) {
+                unsigned k = rand() % 4096;
+
+                if (rand() % 3 == 0) {
+                        assert_se(PTR_TO_UINT(hashmap_remove(h, UINT_TO_PTR(k + 1))) == present[k]);
+                        present[k] = 0;
+                } else if (!present[k]) {
+                        present[k] = i + 1;
+                        assert_se(hashmap_put(h, UINT_TO_PTR(k + 1), UINT_TO_PTR(i + 1)) == 1);
+                } else
+                        assert_se(PTR_TO_UINT(hashmap_get(h, UINT_TO_PTR(k + 1))) == present[k]);
+        }
+
+        for (i = 0; i < 4096; i++)
+                assert_se(PTR_TO_UINT(hashmap_get(h, UINT_TO_PTR(i + 1))) == present[i]);
+
+        hashmap_free(h);
+        free(present);
+}
+
+static void test_memory_usage(void) {
+        HashmapPoolStats before, after;
+        Hashmap *h;
+        size_t empty;
+        unsigned i;
+
+        assert_se(hashmap_memory_usage(NULL) == 0);
+
+        hashmap_get_pool_stats(&before);
+
+        h = hashmap_new(trivial_hash_func, trivial_compare_func);
+        assert_se(h);
+
+        empty = hashmap_memory_usage(h);
+        assert_se(empty > 0);
+
+        for (i = 1; i <= 1000; i++)
+                assert_se(hashmap_put(h, UINT_TO_PTR(i), UINT_TO_PTR(i)) == 1);
+
+        assert_se(hashmap_memory_usage(h) > empty + 1000 * 2 * sizeof(void*));
+
+        hashmap_get_pool_stats(&after);
+        assert_se(after.n_pools >= 1);
+        assert_se(after.tile_size > 0);
+        assert_se(after.size >= after.n_tiles * after.tile_size);
+        assert_se(after.n_used - after.n_free == before.n_used - before.n_free + 1);
+
+        hashmap_clear(h);
+        assert_se(hashmap_memory_usage(h) == empty);
+
+        hashmap_free(h);
+
+        hashmap_get_pool_stats(&after);
+        assert_se(after.n_used - after.n_free == before.n_used - before.n_free);
+}
+
+int main(int argc, char *argv[]) {
+        test_basic();
+        test_many();
+        test_grow();
+        test_order();
+        test_iterate_and_modify();
+        test_move();
+        test_free_free();
+        test_random();
+        test_memory_usage();
+
+        return 0;
+}
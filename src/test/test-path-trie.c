@@ -0,0 +1,191 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+
+#include "util.h"
+#include "set.h"
+#include "strv.h"
+#include "path-util.h"
+#include "path-trie.h"
+
+static const char* const paths[] = {
+        "/",
+        "/var",
+        "/var/lib",
+        "/var/lib/machines",
+        "//var//lib/docker/",
+        "/var/log",
+        "/home",
+        "/varnish",
+};
+
+static void check_above(PathTrie *t, const char *path) {
+        _cleanup_set_free_ Set *s = NULL;
+        unsigned i, n = 0;
+
+        s = set_new(trivial_hash_func, trivial_compare_func);
+        assert_se(s);
+
+        assert_se(path_trie_find_above(t, path, s) >= 0);
+
+        /* Must return exactly what path_startswith() would match */
+        for (i = 0; i < ELEMENTSOF(paths); i++) {
+                bool found = set_get(s, (void*) paths[i]);
+
+                assert_se(found == !!path_startswith(path, paths[i]));
+                n += found;
+        }
+
+        assert_se(set_size(s) == n);
+}
+
+static void check_below(PathTrie *t, const char *path) {
+        _cleanup_set_free_ Set *s = NULL;
+        unsigned i, n = 0;
+
+        s = set_new(trivial_hash_func, trivial_compare_func);
+        assert_se(s);
+
+        assert_se(path_trie_find_below(t, path, s) >= 0);
+
+        for (i = 0; i < ELEMENTSOF(paths); i++) {
+                bool found = set_get(s, (void*) paths[i]);
+
+                assert_se(found == !!path_startswith(paths[i], path));
+                n += found;
+        }
+
+        assert_se(set_size(s) == n);
+}
+
+static void test_find(void) {
+        PathTrie *t;
+        unsigned i;
+
+        t = path_trie_new();
+        assert_se(t);
+
+        for (i = 0; i < ELEMENTSOF(paths); i++)
+                assert_se(path_trie_add(t, paths[i], (void*) paths[i]) >= 0);
+
+        /* Adding twice is fine, and relative paths are ignored */
+        assert_se(path_trie_add(t, "/var", (void*) paths[1]) >= 0);
+        assert_se(path_trie_add(t, "var", (void*) "var") >= 0);
+
+        check_above(t, "/");
+        check_above(t, "/var");
+        check_above(t, "/var/lib/docker/overlay");
+        check_above(t, "/var/lib//machines");
+        check_above(t, "/varnish/cache");
+        check_above(t, "/tmp");
+
+        check_below(t, "/");
+        check_below(t, "/var");
+        check_below(t, "/var/lib/");
+        check_below(t, "/var/lib/docker/overlay");
+        check_below(t, "/va");
+        check_below(t, "/tmp");
+
+        path_trie_free(t);
+}
+
+static void test_remove(void) {
+        _cleanup_set_free_ Set *s = NULL;
+        PathTrie *t;
+        int a, b;
+
+        t = path_trie_new();
+        assert_se(t);
+
+        s = set_new(trivial_hash_func, trivial_compare_func);
+        assert_se(s);
+
+        assert_se(path_trie_add(t, "/a/b/c", &a) >= 0);
+        assert_se(path_trie_add(t, "/a/b/c", &b) >= 0);
+        assert_se(path_trie_add(t, "/a", &b) >= 0);
+
+        path_trie_remove(t, "/a/b/c", &a);
+        path_trie_remove(t, "/a/b/x", &a);
+        path_trie_remove(t, "/nope", &b);
+
+        assert_se(path_trie_find_below(t, "/", s) >= 0);
+        assert_se(set_size(s) == 1);
+        assert_se(set_get(s, &b));
+
+        path_trie_remove(t, "/a/b/c", &b);
+        path_trie_remove(t, "/a", &b);
+
+        set_clear(s);
+        assert_se(path_trie_find_below(t, "/", s) >= 0);
+        assert_se(set_isempty(s));
+
+        /* Works again after the nodes were pruned */
+        assert_se(path_trie_add(t, "/a/b", &a) >= 0);
+        assert_se(path_trie_find_above(t, "/a/b/c", s) >= 0);
+        assert_se(set_size(s) == 1);
+
+        path_trie_free(t);
+}
+
+static void check_children(PathTrie *t, const char *path, const char *expected) {
+        _cleanup_strv_free_ char **l = NULL;
+        _cleanup_free_ char *j = NULL;
+
+        assert_se(path_trie_list_children(t, path, &l) >= 0);
+
+        strv_sort(l);
+        j = strv_join(l, " ");
+        assert_se(j);
+        assert_se(streq(j, expected));
+}
+
+static void test_list_children(void) {
+        PathTrie *t;
+        int a;
+
+        t = path_trie_new();
+        assert_se(t);
+
+        assert_se(path_trie_add(t, "/org/freedesktop/systemd1/unit/a", &a) >= 0);
+        assert_se(path_trie_add(t, "/org/freedesktop/systemd1/unit/b/c", &a) >= 0);
+        assert_se(path_trie_add(t, "/org/freedesktop/systemd1", &a) >= 0);
+        assert_se(path_trie_add(t, "/org/freedesktop/login1", &a) >= 0);
+
+        check_children(t, "/", "org");
+        check_children(t, "/org/freedesktop", "login1 systemd1");
+        /* Intermediate nodes count, even though nothing was added
+         * there directly */
+        check_children(t, "/org/freedesktop/systemd1/unit", "a b");
+        check_children(t, "/org/freedesktop/systemd1/unit/a", "");
+        check_children(t, "/nope", "");
+
+        path_trie_remove(t, "/org/freedesktop/login1", &a);
+        check_children(t, "/org/freedesktop", "systemd1");
+
+        path_trie_free(t);
+}
+
+int main(int argc, char *argv[]) {
+        test_find();
+        test_remove();
+        test_list_children();
+
+        return 0;
+}
@@ -39,13 +39,13 @@ static int unsigned_compare(const void *a, const void *b) {
         return 0;
 }
 
-static void test_unsigned(void) {
+static void test_unsigned(unsigned arity) {
         unsigned buffer[SET_SIZE], i;
         Prioq *q;
 
         srand(0);
 
-        q = prioq_new(trivial_compare_func);
+        q = prioq_new_arity(trivial_compare_func, arity);
         assert_se(q);
 
         for (i = 0; i < ELEMENTSOF(buffer); i++) {
@@ -94,7 +94,7 @@ static unsigned test_hash(const void *a) {
         return x->value;
 }
 
-static void test_struct(void) {
+static void test_struct(unsigned arity) {
         Prioq *q;
         Set *s;
         unsigned previous = 0, i;
@@ -102,7 +102,7 @@ static void test_struct(void) {
 
         srand(0);
 
-        q = prioq_new(test_compare);
+        q = prioq_new_arity(test_compare, arity);
         assert_se(q);
 
         s = set_new(test_hash, test_compare);
@@ -157,10 +157,66 @@ static void test_struct(void) {
         set_free(s);
 }
 
-int main(int argc, char* argv[]) {
+static void test_put_many(unsigned arity, unsigned n_before) {
+        struct test *t;
+        void *data[SET_SIZE];
+        unsigned *idx[SET_SIZE];
+        unsigned previous = 0, i;
+        Prioq *q;
+
+        srand(0);
+
+        q = prioq_new_arity(test_compare, arity);
+        assert_se(q);
+
+        t = new0(struct test, SET_SIZE + n_before);
+        assert_se(t);
+
+        for (i = 0; i < n_before; i++) {
+                t[SET_SIZE + i].value = (unsigned) rand();
+                assert_se(prioq_put(q, t + SET_SIZE + i, &t[SET_SIZE + i].idx) >= 0);
+        }
+
+        for (i = 0; i < SET_SIZE; i++) {
+                t[i].value = (unsigned) rand();
+                data[i] = t + i;
+                idx[i] = &t[i].idx;
+        }
 
-        test_unsigned();
-        test_struct();
+        assert_se(prioq_put_many(q, data, idx, SET_SIZE) >= 0);
+        assert_se(prioq_size(q) == SET_SIZE + n_before);
+
+        /* The indexes must be usable right away */
+        for (i = 0; i < SET_SIZE; i += 3)
+                assert_se(prioq_remove(q, t + i, &t[i].idx) > 0);
+
+        for (i = 1; i < SET_SIZE; i += 3) {
+                t[i].value /= 2;
+                assert_se(prioq_reshuffle(q, t + i, &t[i].idx) > 0);
+        }
+
+        while (!prioq_isempty(q)) {
+                struct test *u;
+
+                u = prioq_pop(q);
+                assert_se(previous <= u->value);
+                previous = u->value;
+        }
+
+        prioq_free(q);
+        free(t);
+}
+
+int main(int argc, char* argv[]) {
+        unsigned arity;
+
+        for (arity = 2; arity <= 5; arity++) {
+                test_unsigned(arity);
+                test_struct(arity);
+                test_put_many(arity, 0);
+                test_put_many(arity, 3);
+                test_put_many(arity, SET_SIZE * 2);
+        }
 
         return 0;
 }
@@ -0,0 +1,66 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include "util.h"
+#include "macro.h"
+#include "profile.h"
+
+static void test_profile_add(void) {
+        ProfileCounter *c = &profile_counters[PROFILE_SPAWN];
+        usec_t begin;
+
+        assert_se(c->n == 0);
+        assert_se(c->total == 0);
+
+        begin = now(CLOCK_MONOTONIC);
+        usleep(10 * USEC_PER_MSEC);
+        profile_add(PROFILE_SPAWN, begin);
+
+        assert_se(c->n == 1);
+        assert_se(c->total >= 10 * USEC_PER_MSEC);
+        assert_se(c->max == c->total);
+
+        profile_add(PROFILE_SPAWN, now(CLOCK_MONOTONIC));
+
+        assert_se(c->n == 2);
+        assert_se(c->max >= 10 * USEC_PER_MSEC);
+        assert_se(c->total >= c->max);
+
+        assert_se(profile_counters[PROFILE_CGROUP].n == 0);
+}
+
+static void test_profile_point_names(void) {
+        ProfilePoint p;
+
+        for (p = 0; p < _PROFILE_POINT_MAX; p++) {
+                assert_se(profile_point_to_string(p));
+                assert_se(profile_point_from_string(profile_point_to_string(p)) == p);
+        }
+
+        assert_se(profile_point_from_string("foobar") == _PROFILE_POINT_INVALID);
+}
+
+int main(int argc, char* argv[]) {
+
+        test_profile_add();
+        test_profile_point_names();
+
+        return 0;
+}
@@ -0,0 +1,97 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "util.h"
+#include "ratelimit.h"
+
+static void test_ratelimit(void) {
+        RATELIMIT_DEFINE(rl, USEC_PER_HOUR, 3);
+        unsigned i;
+
+        for (i = 0; i < 3; i++)
+                assert_se(ratelimit_test(&rl));
+
+        assert_se(!ratelimit_test(&rl));
+
+        RATELIMIT_RESET(rl);
+        assert_se(ratelimit_test(&rl));
+}
+
+static void test_ratelimit_map(void) {
+        RateLimitMap *m;
+        unsigned i, suppressed;
+
+        m = ratelimit_map_new(USEC_PER_HOUR, 2, 3);
+        assert_se(m);
+
+        /* Each key has its own budget */
+        assert_se(ratelimit_map_test(m, "a", &suppressed) && suppressed == 0);
+        assert_se(ratelimit_map_test(m, "a", &suppressed) && suppressed == 0);
+        assert_se(!ratelimit_map_test(m, "a", &suppressed));
+        assert_se(!ratelimit_map_test(m, "a", NULL));
+
+        assert_se(ratelimit_map_test(m, "b", &suppressed) && suppressed == 0);
+        assert_se(ratelimit_map_test(m, "c", &suppressed) && suppressed == 0);
+
+        /* Using a again makes b the least recently used key, which
+         * is forgotten when d comes along */
+        assert_se(!ratelimit_map_test(m, "a", NULL));
+        assert_se(ratelimit_map_test(m, "d", &suppressed) && suppressed == 0);
+
+        assert_se(ratelimit_map_test(m, "b", &suppressed) && suppressed == 0);
+        assert_se(ratelimit_map_test(m, "b", &suppressed) && suppressed == 0);
+        assert_se(!ratelimit_map_test(m, "b", NULL));
+
+        /* And now c went, but a is still limited */
+        assert_se(!ratelimit_map_test(m, "a", NULL));
+
+        for (i = 0; i < 100; i++) {
+                char k[DECIMAL_STR_MAX(unsigned)];
+
+                snprintf(k, sizeof(k), "%u", i);
+                assert_se(ratelimit_map_test(m, k, NULL));
+        }
+
+        /* Everything got evicted, hence a starts over */
+        assert_se(ratelimit_map_test(m, "a", &suppressed) && suppressed == 0);
+
+        ratelimit_map_free(m);
+
+        /* Once the interval passed, we learn what was held back */
+        m = ratelimit_map_new(USEC_PER_MSEC, 1, 16);
+        assert_se(m);
+
+        assert_se(ratelimit_map_test(m, "x", &suppressed) && suppressed == 0);
+        assert_se(!ratelimit_map_test(m, "x", NULL));
+        assert_se(!ratelimit_map_test(m, "x", NULL));
+
+        usleep(2 * USEC_PER_MSEC);
+
+        assert_se(ratelimit_map_test(m, "x", &suppressed) && suppressed == 2);
+        assert_se(!ratelimit_map_test(m, "x", NULL));
+
+        ratelimit_map_free(m);
+}
+
+int main(int argc, char *argv[]) {
+        test_ratelimit();
+        test_ratelimit_map();
+
+        return 0;
+}
@@ -0,0 +1,162 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+#include "serialize.h"
+
+static void test_roundtrip(bool binary) {
+        _cleanup_free_ char *buffer = NULL;
+        size_t allocated = 0;
+        dual_timestamp t = { 1234, 5678 }, unset = {}, parsed = {};
+        char *k, *v;
+        bool b;
+        FILE *f;
+
+        f = tmpfile();
+        assert_se(f);
+
+        assert_se(serialize_header(f, binary) >= 0);
+        serialize_item(f, binary, "foo", "bar");
+        serialize_item_format(f, binary, "number", "%i", 42);
+        serialize_item(f, binary, "empty", "");
+        serialize_dual_timestamp(f, binary, "timestamp", &t);
+        serialize_dual_timestamp(f, binary, "unset", &unset);
+        serialize_end(f, binary);
+        serialize_item(f, binary, "marker.service", NULL);
+        serialize_end(f, binary);
+        assert_se(!ferror(f));
+
+        rewind(f);
+
+        assert_se(deserialize_header(f, &b) >= 0);
+        assert_se(b == binary);
+
+        assert_se(deserialize_item(f, b, &buffer, &allocated, &k, &v) == 1);
+        assert_se(streq(k, "foo") && streq(v, "bar"));
+        assert_se(deserialize_item(f, b, &buffer, &allocated, &k, &v) == 1);
+        assert_se(streq(k, "number") && streq(v, "42"));
+        assert_se(deserialize_item(f, b, &buffer, &allocated, &k, &v) == 1);
+        assert_se(streq(k, "empty") && streq(v, ""));
+        assert_se(deserialize_item(f, b, &buffer, &allocated, &k, &v) == 1);
+        assert_se(streq(k, "timestamp"));
+        dual_timestamp_deserialize(v, &parsed);
+        assert_se(parsed.realtime == t.realtime && parsed.monotonic == t.monotonic);
+
+        /* Unset timestamps are not written, so next is the end marker */
+        assert_se(deserialize_item(f, b, &buffer, &allocated, &k, &v) == 0);
+        assert_se(!feof(f));
+
+        assert_se(deserialize_item(f, b, &buffer, &allocated, &k, &v) == 1);
+        assert_se(streq(k, "marker.service") && streq(v, ""));
+        assert_se(deserialize_item(f, b, &buffer, &allocated, &k, &v) == 0);
+
+        assert_se(deserialize_item(f, b, &buffer, &allocated, &k, &v) == 0);
+        assert_se(feof(f));
+
+        fclose(f);
+}
+
+static void test_binary_value(void) {
+        _cleanup_free_ char *buffer = NULL;
+        size_t allocated = 0;
+        const char *value = "line one\nline two=with\\backslash  ";
+        char *k, *v;
+        bool b;
+        FILE *f;
+
+        /* The binary format does not need to escape anything */
+        f = tmpfile();
+        assert_se(f);
+
+        assert_se(serialize_header(f, true) >= 0);
+        serialize_item(f, true, "env", value);
+
+        rewind(f);
+
+        assert_se(deserialize_header(f, &b) >= 0);
+        assert_se(b);
+        assert_se(deserialize_item(f, b, &buffer, &allocated, &k, &v) == 1);
+        assert_se(streq(k, "env") && streq(v, value));
+
+        fclose(f);
+}
+
+static void test_bad_header(void) {
+        bool b;
+        FILE *f;
+
+        f = tmpfile();
+        assert_se(f);
+        fwrite("\0SDSTATF\1\0\0\0", 12, 1, f);
+        rewind(f);
+        assert_se(deserialize_header(f, &b) == -EBADMSG);
+        fclose(f);
+
+        f = tmpfile();
+        assert_se(f);
+        fwrite("\0SDSTATE\377\0\0\0", 12, 1, f);
+        rewind(f);
+        assert_se(deserialize_header(f, &b) == -EPROTONOSUPPORT);
+        fclose(f);
+
+        /* Empty input is text without any items */
+        f = tmpfile();
+        assert_se(f);
+        assert_se(deserialize_header(f, &b) == 0);
+        assert_se(!b);
+        fclose(f);
+}
+
+static void test_truncated(void) {
+        _cleanup_free_ char *buffer = NULL;
+        size_t allocated = 0;
+        char *k, *v;
+        bool b;
+        FILE *f;
+        long l;
+
+        f = tmpfile();
+        assert_se(f);
+
+        assert_se(serialize_header(f, true) >= 0);
+        serialize_item(f, true, "foo", "barbarbar");
+        assert_se(fflush(f) == 0);
+        l = ftell(f);
+        assert_se(ftruncate(fileno(f), l - 3) >= 0);
+
+        rewind(f);
+
+        assert_se(deserialize_header(f, &b) >= 0);
+        assert_se(deserialize_item(f, b, &buffer, &allocated, &k, &v) == -EBADMSG);
+
+        fclose(f);
+}
+
+int main(int argc, char *argv[]) {
+        test_roundtrip(false);
+        test_roundtrip(true);
+        test_binary_value();
+        test_bad_header();
+        test_truncated();
+
+        return 0;
+}
@@ -0,0 +1,69 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "util.h"
+#include "siphash24.h"
+
+static void test_vectors(void) {
+        uint8_t key[16], in[64];
+        unsigned i;
+
+        for (i = 0; i < ELEMENTSOF(key); i++)
+                key[i] = i;
+        for (i = 0; i < ELEMENTSOF(in); i++)
+                in[i] = i;
+
+        /* From the reference implementation and the paper */
+        assert_se(siphash24(in, 0, key) == UINT64_C(0x726fdb47dd0e0e31));
+        assert_se(siphash24(in, 15, key) == UINT64_C(0xa129ca6149be45e5));
+}
+
+static void test_tail(void) {
+        uint8_t key[16] = {}, in[16] = {};
+        uint64_t seen[ELEMENTSOF(in) + 1];
+        unsigned i, j;
+
+        /* Inputs only differing in length must still hash
+         * differently, however many bytes spill over the last full
+         * word */
+        for (i = 0; i <= ELEMENTSOF(in); i++) {
+                seen[i] = siphash24(in, i, key);
+
+                for (j = 0; j < i; j++)
+                        assert_se(seen[i] != seen[j]);
+        }
+}
+
+static void test_key(void) {
+        uint8_t k0[16] = {}, k1[16] = {};
+        const char *s = "app-tenant-12345@instance.service";
+
+        k1[15] = 1;
+
+        assert_se(siphash24(s, strlen(s), k0) == siphash24(s, strlen(s), k0));
+        assert_se(siphash24(s, strlen(s), k0) != siphash24(s, strlen(s), k1));
+}
+
+int main(int argc, char *argv[]) {
+        test_vectors();
+        test_tail();
+        test_key();
+
+        return 0;
+}
@@ -0,0 +1,134 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <stdio.h>
+
+#include "util.h"
+#include "macro.h"
+#include "serialize.h"
+#include "start-latency.h"
+
+static void test_start_latency_phases(void) {
+        StartLatency l = {};
+        usec_t d;
+
+        start_latency_begin(&l, 1000);
+        start_latency_mark(&l, START_TIMESTAMP_DISPATCHED, 1050);
+        start_latency_mark(&l, START_TIMESTAMP_DISPATCHED, 1060);
+        start_latency_mark(&l, START_TIMESTAMP_RUNNABLE, 3000);
+        start_latency_mark(&l, START_TIMESTAMP_SPAWN_BEGIN, 3100);
+        start_latency_mark(&l, START_TIMESTAMP_SPAWN_END, 4100);
+        start_latency_mark(&l, START_TIMESTAMP_MAIN_PID, 4100);
+        start_latency_finish(&l, 2 * USEC_PER_SEC);
+
+        assert_se(start_latency_phase(&l, START_PHASE_QUEUE, &d) && d == 50);
+        assert_se(start_latency_phase(&l, START_PHASE_ORDERING, &d) && d == 1950);
+        assert_se(!start_latency_phase(&l, START_PHASE_START_PRE, &d));
+        assert_se(start_latency_phase(&l, START_PHASE_SPAWN, &d) && d == 1000);
+        assert_se(start_latency_phase(&l, START_PHASE_MAIN_PID, &d) && d == 0);
+        assert_se(start_latency_phase(&l, START_PHASE_READY, &d) && d == 2 * USEC_PER_SEC - 4100);
+        assert_se(start_latency_phase(&l, START_PHASE_TOTAL, &d) && d == 2 * USEC_PER_SEC - 1000);
+
+        assert_se(l.histogram[START_PHASE_QUEUE][0] == 1);
+        assert_se(l.histogram[START_PHASE_ORDERING][2] == 1);
+        assert_se(l.histogram[START_PHASE_START_PRE][0] == 0);
+        assert_se(l.histogram[START_PHASE_SPAWN][2] == 1);
+        assert_se(l.histogram[START_PHASE_TOTAL][5] == 1);
+
+        /* Nothing changes once the start completed */
+        start_latency_mark(&l, START_TIMESTAMP_START_PRE, 5000);
+        start_latency_finish(&l, 3 * USEC_PER_SEC);
+        assert_se(!start_latency_phase(&l, START_PHASE_START_PRE, &d));
+        assert_se(l.histogram[START_PHASE_TOTAL][5] == 1);
+
+        /* Units without processes become ready after they could run */
+        start_latency_begin(&l, 10000);
+        start_latency_mark(&l, START_TIMESTAMP_DISPATCHED, 10000);
+        start_latency_mark(&l, START_TIMESTAMP_RUNNABLE, 10010);
+        start_latency_finish(&l, 10020);
+        assert_se(start_latency_phase(&l, START_PHASE_READY, &d) && d == 10);
+        assert_se(!start_latency_phase(&l, START_PHASE_SPAWN, &d));
+        assert_se(l.histogram[START_PHASE_TOTAL][0] == 1);
+        assert_se(l.histogram[START_PHASE_TOTAL][5] == 1);
+        assert_se(l.histogram[START_PHASE_SPAWN][2] == 1);
+}
+
+static void test_start_latency_bucket(void) {
+        assert_se(start_latency_bucket(0) == 0);
+        assert_se(start_latency_bucket(99) == 0);
+        assert_se(start_latency_bucket(100) == 1);
+        assert_se(start_latency_bucket(USEC_PER_MSEC) == 2);
+        assert_se(start_latency_bucket(USEC_PER_SEC - 1) == 4);
+        assert_se(start_latency_bucket(9 * USEC_PER_SEC) == 5);
+        assert_se(start_latency_bucket(10 * USEC_PER_SEC) == 6);
+        assert_se(start_latency_bucket((usec_t) -1) == START_LATENCY_BUCKETS - 1);
+}
+
+static void test_start_latency_serialize(void) {
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *buffer = NULL;
+        size_t allocated = 0;
+        StartLatency l = {}, k = {};
+        char *key, *value;
+
+        start_latency_begin(&l, 1000);
+        start_latency_mark(&l, START_TIMESTAMP_DISPATCHED, 2000);
+        start_latency_finish(&l, 3000);
+        start_latency_begin(&l, 5000);
+        start_latency_mark(&l, START_TIMESTAMP_START_PRE, 6000);
+
+        f = tmpfile();
+        assert_se(f);
+
+        start_latency_serialize(&l, f, false);
+        serialize_end(f, false);
+        rewind(f);
+
+        while (deserialize_item(f, false, &buffer, &allocated, &key, &value) > 0)
+                assert_se(start_latency_deserialize_item(&k, key, value) >= 0);
+
+        assert_se(memcmp(&k, &l, sizeof(StartLatency)) == 0);
+
+        assert_se(start_latency_deserialize_item(&k, "start-latency-timestamp", "foobar 1") < 0);
+        assert_se(start_latency_deserialize_item(&k, "start-latency-histogram", "total 1 2 3") < 0);
+}
+
+static void test_start_latency_names(void) {
+        StartTimestamp t;
+        StartPhase p;
+
+        for (t = 0; t < _START_TIMESTAMP_MAX; t++)
+                assert_se(start_timestamp_from_string(start_timestamp_to_string(t)) == t);
+
+        for (p = 0; p < _START_PHASE_MAX; p++)
+                assert_se(start_phase_from_string(start_phase_to_string(p)) == p);
+
+        assert_se(start_phase_from_string("foobar") == _START_PHASE_INVALID);
+}
+
+int main(int argc, char* argv[]) {
+
+        test_start_latency_phases();
+        test_start_latency_bucket();
+        test_start_latency_serialize();
+        test_start_latency_names();
+
+        return 0;
+}
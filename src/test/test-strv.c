@@ -233,6 +233,51 @@ static void test_strv_append(void) {
         assert_se(streq(c[0], "test3"));
 }
 
+static void test_strv_builder(void) {
+        _cleanup_strv_builder_free_ StrvBuilder b = {};
+        _cleanup_strv_free_ char **a = NULL, **l = NULL;
+        unsigned i;
+
+        a = strv_new("abc", "def", NULL);
+        assert_se(a);
+
+        l = strv_builder_steal(&b);
+        assert_se(l);
+        assert_se(strv_isempty(l));
+        strv_free(l);
+
+        assert_se(strv_builder_extend(&b, "first") >= 0);
+        assert_se(strv_builder_extend(&b, NULL) >= 0);
+        assert_se(strv_builder_extend_strv(&b, a, NULL) >= 0);
+        assert_se(strv_builder_extend_strv(&b, a, "_suffix") >= 0);
+        assert_se(strv_builder_extend_strv(&b, NULL, "_suffix") >= 0);
+
+        for (i = 0; i < 1000; i++) {
+                char *s;
+
+                assert_se(asprintf(&s, "x%u", i) >= 0);
+                assert_se(strv_builder_push(&b, s) >= 0);
+        }
+
+        assert_se(b.n == 1005);
+
+        l = strv_builder_steal(&b);
+        assert_se(l);
+        assert_se(!b.l && b.n == 0);
+
+        assert_se(strv_length(l) == 1005);
+        assert_se(streq(l[0], "first"));
+        assert_se(streq(l[1], "abc"));
+        assert_se(streq(l[2], "def"));
+        assert_se(streq(l[3], "abc_suffix"));
+        assert_se(streq(l[4], "def_suffix"));
+        assert_se(streq(l[5], "x0"));
+        assert_se(streq(l[1004], "x999"));
+
+        /* Whatever is left over gets freed */
+        assert_se(strv_builder_extend(&b, "leftover") >= 0);
+}
+
 static void test_strv_foreach_pair(void) {
         _cleanup_strv_free_ char **a = NULL;
         char **x, **y;
@@ -260,6 +305,7 @@ int main(int argc, char *argv[]) {
         test_strv_merge();
         test_strv_merge_concat();
         test_strv_append();
+        test_strv_builder();
 
         return 0;
 }
@@ -0,0 +1,232 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macro.h"
+#include "util.h"
+#include "fileio.h"
+#include "manager.h"
+
+#define N_CYCLES 64
+
+static void write_unit(const char *dir, const char *name, const char *body) {
+        _cleanup_free_ char *p = NULL, *s = NULL;
+
+        p = strjoin(dir, "/", name, NULL);
+        s = strjoin("[Unit]\nDefaultDependencies=no\n", body, NULL);
+        assert_se(p && s);
+
+        assert_se(write_string_file(p, s) >= 0);
+}
+
+static void write_units(const char *dir) {
+        _cleanup_free_ char *many = NULL;
+        unsigned i;
+
+        /* Ordering cycle that can be broken by dropping the job of
+         * the unit that is only wanted */
+        write_unit(dir, "cycle-a.target", "Wants=cycle-b.target\nAfter=cycle-b.target\n");
+        write_unit(dir, "cycle-b.target", "After=cycle-a.target\nWants=cycle-c.target\n");
+        write_unit(dir, "cycle-c.target", "");
+
+        /* Ordering cycle between required units, cannot be broken */
+        write_unit(dir, "loop-a.target", "Requires=loop-b.target\nAfter=loop-b.target\n");
+        write_unit(dir, "loop-b.target", "After=loop-a.target\n");
+
+        /* Many fixable cycles below one anchor */
+        many = strdup("");
+        assert_se(many);
+
+        for (i = 0; i < N_CYCLES; i++) {
+                char a[32], b[32], body[128];
+                char *t;
+
+                snprintf(a, sizeof(a), "many-a%u.target", i);
+                snprintf(b, sizeof(b), "many-b%u.target", i);
+
+                snprintf(body, sizeof(body), "Wants=%s\nAfter=%s\n", b, b);
+                write_unit(dir, a, body);
+                snprintf(body, sizeof(body), "After=%s\n", a);
+                write_unit(dir, b, body);
+
+                t = strjoin(many, "Requires=", a, "\n", NULL);
+                assert_se(t);
+                free(many);
+                many = t;
+        }
+
+        write_unit(dir, "many.target", many);
+
+        /* Start and verify-active jobs for the same unit merge */
+        write_unit(dir, "merge.target", "Requires=merge-x.target\nRequisite=merge-x.target\n");
+        write_unit(dir, "merge-x.target", "");
+
+        /* Stopping a unit that is not running is redundant */
+        write_unit(dir, "redundant.target", "Conflicts=redundant-x.target\n");
+        write_unit(dir, "redundant-x.target", "");
+
+        /* Start and stop jobs for the same unit, the start job is
+         * dropped since the stop job is caused by a conflict, and
+         * the stop job is then redundant */
+        write_unit(dir, "conflict.target", "Wants=conflict-x.target conflict-y.target\n");
+        write_unit(dir, "conflict-x.target", "");
+        write_unit(dir, "conflict-y.target", "Conflicts=conflict-x.target\n");
+}
+
+static Unit *load(Manager *m, const char *name) {
+        Unit *u = NULL;
+
+        assert_se(manager_load_unit(m, name, NULL, NULL, &u) >= 0);
+        assert_se(u->load_state == UNIT_LOADED);
+
+        return u;
+}
+
+static int start(Manager *m, const char *name, JobMode mode) {
+        return manager_add_job(m, JOB_START, load(m, name), mode, false, NULL, NULL);
+}
+
+static void test_cycle(Manager *m) {
+        Unit *a, *b, *c;
+
+        assert_se(start(m, "cycle-a.target", JOB_REPLACE) == 0);
+
+        a = load(m, "cycle-a.target");
+        b = load(m, "cycle-b.target");
+        c = load(m, "cycle-c.target");
+
+        /* The cycle is broken by deleting the job for b, and c is
+         * then garbage collected since nothing pulls it in anymore */
+        assert_se(a->job && a->job->type == JOB_START);
+        assert_se(!b->job);
+        assert_se(!c->job);
+        assert_se(hashmap_size(m->jobs) == 1);
+
+        /* Merging the same transaction into the installed jobs again
+         * must not fail */
+        assert_se(start(m, "cycle-a.target", JOB_FAIL) == 0);
+        assert_se(hashmap_size(m->jobs) == 1);
+
+        manager_clear_jobs(m);
+}
+
+static void test_loop(Manager *m) {
+        assert_se(start(m, "loop-a.target", JOB_REPLACE) == -ENOEXEC);
+        assert_se(hashmap_size(m->jobs) == 0);
+}
+
+static void test_many(Manager *m) {
+        unsigned i;
+
+        assert_se(start(m, "many.target", JOB_REPLACE) == 0);
+
+        for (i = 0; i < N_CYCLES; i++) {
+                char a[32], b[32];
+
+                snprintf(a, sizeof(a), "many-a%u.target", i);
+                snprintf(b, sizeof(b), "many-b%u.target", i);
+
+                assert_se(load(m, a)->job);
+                assert_se(!load(m, b)->job);
+        }
+
+        assert_se(hashmap_size(m->jobs) == N_CYCLES + 1);
+
+        manager_clear_jobs(m);
+}
+
+static void test_merge(Manager *m) {
+        Unit *x;
+
+        assert_se(start(m, "merge.target", JOB_REPLACE) == 0);
+
+        x = load(m, "merge-x.target");
+        assert_se(x->job && x->job->type == JOB_START);
+        assert_se(hashmap_size(m->jobs) == 2);
+
+        manager_clear_jobs(m);
+}
+
+static void test_redundant(Manager *m) {
+        Unit *x;
+
+        assert_se(start(m, "redundant.target", JOB_REPLACE) == 0);
+
+        x = load(m, "redundant-x.target");
+        assert_se(!x->job);
+        assert_se(hashmap_size(m->jobs) == 1);
+
+        manager_clear_jobs(m);
+}
+
+static void test_conflict(Manager *m) {
+        Unit *x, *y;
+
+        assert_se(start(m, "conflict.target", JOB_REPLACE) == 0);
+
+        x = load(m, "conflict-x.target");
+        y = load(m, "conflict-y.target");
+        assert_se(!x->job);
+        assert_se(y->job && y->job->type == JOB_START);
+        assert_se(hashmap_size(m->jobs) == 2);
+
+        manager_clear_jobs(m);
+
+        /* An installed start job is not replaced in fail mode */
+        assert_se(manager_add_job(m, JOB_START, x, JOB_FAIL, false, NULL, NULL) == 0);
+        assert_se(start(m, "conflict-y.target", JOB_FAIL) == -EEXIST);
+        assert_se(x->job && x->job->type == JOB_START);
+        assert_se(!y->job);
+
+        manager_clear_jobs(m);
+}
+
+int main(int argc, char *argv[]) {
+        char dir[] = "/tmp/test-transaction.XXXXXX";
+        Manager *m = NULL;
+        int r;
+
+        assert_se(mkdtemp(dir));
+        write_units(dir);
+
+        assert_se(set_unit_path(dir) >= 0);
+        r = manager_new(SYSTEMD_USER, &m);
+        if (r == -EPERM) {
+                puts("manager_new: Permission denied. Skipping test.");
+                rm_rf_dangerous(dir, false, true, false);
+                return EXIT_TEST_SKIP;
+        }
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        test_cycle(m);
+        test_loop(m);
+        test_many(m);
+        test_merge(m);
+        test_redundant(m);
+        test_conflict(m);
+
+        manager_free(m);
+        rm_rf_dangerous(dir, false, true, false);
+
+        return 0;
+}
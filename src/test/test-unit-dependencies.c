@@ -0,0 +1,290 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macro.h"
+#include "util.h"
+#include "manager.h"
+#include "unit.h"
+
+/* Enough units that some of them have more dependencies than are
+ * searched linearly, so that the index is used too */
+#define N_UNITS 40
+#define N_ROUNDS 20
+#define N_PER_ROUND 100
+
+static const UnitDependency inverse_table[_UNIT_DEPENDENCY_MAX] = {
+        [UNIT_REQUIRES] = UNIT_REQUIRED_BY,
+        [UNIT_REQUIRES_OVERRIDABLE] = UNIT_REQUIRED_BY_OVERRIDABLE,
+        [UNIT_WANTS] = UNIT_WANTED_BY,
+        [UNIT_REQUISITE] = UNIT_REQUIRED_BY,
+        [UNIT_REQUISITE_OVERRIDABLE] = UNIT_REQUIRED_BY_OVERRIDABLE,
+        [UNIT_BINDS_TO] = UNIT_BOUND_BY,
+        [UNIT_PART_OF] = UNIT_CONSISTS_OF,
+        [UNIT_REQUIRED_BY] = _UNIT_DEPENDENCY_INVALID,
+        [UNIT_REQUIRED_BY_OVERRIDABLE] = _UNIT_DEPENDENCY_INVALID,
+        [UNIT_WANTED_BY] = _UNIT_DEPENDENCY_INVALID,
+        [UNIT_BOUND_BY] = UNIT_BINDS_TO,
+        [UNIT_CONSISTS_OF] = UNIT_PART_OF,
+        [UNIT_CONFLICTS] = UNIT_CONFLICTED_BY,
+        [UNIT_CONFLICTED_BY] = UNIT_CONFLICTS,
+        [UNIT_BEFORE] = UNIT_AFTER,
+        [UNIT_AFTER] = UNIT_BEFORE,
+        [UNIT_ON_FAILURE] = _UNIT_DEPENDENCY_INVALID,
+        [UNIT_REFERENCES] = UNIT_REFERENCED_BY,
+        [UNIT_REFERENCED_BY] = UNIT_REFERENCES,
+        [UNIT_TRIGGERS] = UNIT_TRIGGERED_BY,
+        [UNIT_TRIGGERED_BY] = UNIT_TRIGGERS,
+        [UNIT_PROPAGATES_RELOAD_TO] = UNIT_RELOAD_PROPAGATED_FROM,
+        [UNIT_RELOAD_PROPAGATED_FROM] = UNIT_PROPAGATES_RELOAD_TO,
+};
+
+/* The expected state: the dependency mask of each pair of units, and
+ * for each unit the other units in the order they were first added */
+static Unit *units[N_UNITS];
+static uint32_t masks[N_UNITS][N_UNITS];
+static unsigned order[N_UNITS][N_UNITS];
+static unsigned n_order[N_UNITS];
+static bool freed[N_UNITS];
+
+static Unit *stub(Manager *m, const char *name) {
+        Unit *u = NULL;
+
+        assert_se(manager_load_unit_prepare(m, name, NULL, NULL, &u) >= 0);
+        assert_se(u->load_state == UNIT_STUB);
+
+        return u;
+}
+
+static void expect_add(unsigned a, UnitDependency d, unsigned b) {
+        if (masks[a][b] == 0)
+                order[a][n_order[a]++] = b;
+
+        masks[a][b] |= UNIT_DEPENDENCY_MASK(d);
+}
+
+static void expect_drop(unsigned a, unsigned b) {
+        unsigned k;
+
+        if (masks[a][b] == 0)
+                return;
+
+        masks[a][b] = 0;
+
+        for (k = 0; k < n_order[a]; k++)
+                if (order[a][k] == b)
+                        break;
+
+        assert_se(k < n_order[a]);
+        memmove(order[a] + k, order[a] + k + 1, (n_order[a] - k - 1) * sizeof(unsigned));
+        n_order[a]--;
+}
+
+static void check_unit(unsigned a) {
+        UnitDependency d;
+        Unit *u = units[a];
+        unsigned b, k;
+
+        assert_se(u->n_dependencies == n_order[a]);
+        /* The index is built once a unit has more than 16 entries,
+         * and stays around when entries are dropped again */
+        if (u->n_dependencies > 16)
+                assert_se(u->dependencies_index);
+
+        for (k = 0; k < n_order[a]; k++) {
+                assert_se(u->dependencies[k].other == units[order[a][k]]);
+                assert_se(u->dependencies[k].mask == masks[a][order[a][k]]);
+        }
+
+        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++) {
+                Unit *other, *first = NULL;
+                unsigned i, n = 0;
+
+                k = 0;
+                UNIT_FOREACH_DEPENDENCY(other, u, d, i) {
+                        /* Advance to the next expected unit with
+                         * this dependency type */
+                        while (k < n_order[a] && !(masks[a][order[a][k]] & UNIT_DEPENDENCY_MASK(d)))
+                                k++;
+
+                        assert_se(k < n_order[a]);
+                        assert_se(other == units[order[a][k]]);
+                        k++;
+
+                        if (!first)
+                                first = other;
+                        n++;
+                }
+
+                while (k < n_order[a])
+                        assert_se(!(masks[a][order[a][k++]] & UNIT_DEPENDENCY_MASK(d)));
+
+                assert_se(unit_dependency_count(u, d) == n);
+                assert_se(unit_first_dependency(u, d) == first);
+
+                for (b = 0; b < N_UNITS; b++)
+                        if (!freed[b])
+                                assert_se(unit_has_dependency(u, d, units[b]) ==
+                                          !!(masks[a][b] & UNIT_DEPENDENCY_MASK(d)));
+        }
+}
+
+static void check_all(void) {
+        unsigned a;
+
+        for (a = 0; a < N_UNITS; a++)
+                if (!freed[a])
+                        check_unit(a);
+}
+
+static void test_random(Manager *m, const char *prefix, bool with_free) {
+        unsigned a, b, i, j;
+
+        zero(masks);
+        zero(n_order);
+        zero(freed);
+
+        for (a = 0; a < N_UNITS; a++) {
+                char name[32];
+
+                snprintf(name, sizeof(name), "%s%u.target", prefix, a);
+                units[a] = stub(m, name);
+        }
+
+        srand(0);
+
+        for (i = 0; i < N_ROUNDS; i++) {
+                for (j = 0; j < N_PER_ROUND; j++) {
+                        UnitDependency d;
+                        bool ref;
+
+                        /* Prefer a few units, so that both short and
+                         * long dependency lists show up */
+                        a = rand() % (rand() % 2 ? 4 : N_UNITS);
+                        b = rand() % N_UNITS;
+                        ref = rand() % 2;
+
+                        /* A unit is only dropped from the units it
+                         * has a dependency on, so when freeing stick
+                         * to dependencies with an inverse */
+                        do
+                                d = rand() % _UNIT_DEPENDENCY_MAX;
+                        while (with_free && inverse_table[d] == _UNIT_DEPENDENCY_INVALID);
+
+                        assert_se(unit_add_dependency(units[a], d, units[b], ref) == 0);
+
+                        /* Dependencies on ourselves are ignored */
+                        if (a == b)
+                                continue;
+
+                        expect_add(a, d, b);
+                        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID)
+                                expect_add(b, inverse_table[d], a);
+
+                        if (ref) {
+                                expect_add(a, UNIT_REFERENCES, b);
+                                expect_add(b, UNIT_REFERENCED_BY, a);
+                        }
+                }
+
+                check_all();
+        }
+
+        if (!with_free)
+                return;
+
+        /* Freeing a unit drops it from everybody else */
+        for (b = 0; b < N_UNITS; b += 3) {
+                unit_free(units[b]);
+                freed[b] = true;
+
+                for (a = 0; a < N_UNITS; a++)
+                        expect_drop(a, b);
+
+                check_all();
+        }
+}
+
+static void test_merge(Manager *m) {
+        Unit *a, *b, *x, *y;
+
+        a = stub(m, "merge-a.target");
+        b = stub(m, "merge-b.target");
+        x = stub(m, "merge-x.target");
+        y = stub(m, "merge-y.target");
+
+        assert_se(unit_add_dependency(a, UNIT_REQUIRES, b, true) == 0);
+        assert_se(unit_add_dependency(b, UNIT_BEFORE, a, false) == 0);
+        assert_se(unit_add_dependency(b, UNIT_WANTS, x, false) == 0);
+        assert_se(unit_add_dependency(y, UNIT_AFTER, b, false) == 0);
+        assert_se(unit_add_dependency(a, UNIT_AFTER, y, false) == 0);
+
+        assert_se(unit_merge(a, b) == 0);
+        assert_se(b->load_state == UNIT_MERGED);
+        assert_se(b->n_dependencies == 0);
+        assert_se(!b->dependencies_index);
+
+        /* Dependencies between the two merged units are gone, the
+         * ones on other units moved over */
+        assert_se(!unit_has_dependency(a, UNIT_REQUIRES, a));
+        assert_se(!unit_has_dependency(a, UNIT_BEFORE, a));
+        assert_se(unit_has_dependency(a, UNIT_WANTS, x));
+        assert_se(unit_has_dependency(x, UNIT_WANTED_BY, a));
+        assert_se(!unit_has_dependency(x, UNIT_WANTED_BY, b));
+        assert_se(x->n_dependencies == 1);
+
+        /* Both y deps on b and a ended up in the same entry */
+        assert_se(unit_has_dependency(y, UNIT_AFTER, a));
+        assert_se(unit_has_dependency(y, UNIT_BEFORE, a));
+        assert_se(y->n_dependencies == 1);
+        assert_se(unit_has_dependency(a, UNIT_AFTER, y));
+        assert_se(unit_has_dependency(a, UNIT_BEFORE, y));
+
+        assert_se(a->n_dependencies == 2);
+
+        /* Adding dependencies to the merged unit ends up on the one
+         * it was merged into */
+        assert_se(unit_add_dependency(b, UNIT_CONFLICTS, x, false) == 0);
+        assert_se(unit_has_dependency(a, UNIT_CONFLICTS, x));
+        assert_se(unit_has_dependency(x, UNIT_CONFLICTED_BY, a));
+        assert_se(b->n_dependencies == 0);
+}
+
+int main(int argc, char *argv[]) {
+        Manager *m = NULL;
+        int r;
+
+        r = manager_new(SYSTEMD_USER, &m);
+        if (r == -EPERM) {
+                puts("manager_new: Permission denied. Skipping test.");
+                return EXIT_TEST_SKIP;
+        }
+        assert_se(r >= 0);
+
+        test_random(m, "dep", false);
+        test_random(m, "free", true);
+        test_merge(m);
+
+        manager_free(m);
+
+        return 0;
+}
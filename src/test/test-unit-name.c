@@ -70,6 +70,10 @@ static void test_replacements(void) {
         expect("/waldo/quuix/", ".mount", "/waldo/quuix");
         expect("/", ".mount", NULL);
         expect("///", ".mount", "/");
+        expect("//waldo///quuix//", ".mount", "/waldo/quuix");
+        expect("/waldo/.quuix", ".mount", NULL);
+        expect("/dev/disk/by-path/pci-0000:00:1f.2", ".device", NULL);
+        expect("/waldo\\x2f", ".mount", NULL);
 
         puts("-------------------------------------------------");
 #undef expect
@@ -0,0 +1,120 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+
+#include <string.h>
+
+#include "util.h"
+#include "utf8.h"
+
+static void test_printable(void) {
+        assert_se(utf8_is_printable_n("", 0));
+        assert_se(utf8_is_printable_n("foo\tbar", 7));
+        assert_se(utf8_is_printable_n("gr\303\274\303\237e", 7));
+        assert_se(!utf8_is_printable_n("foo\nbar", 7));
+        assert_se(!utf8_is_printable_n("foo\177", 4));
+        assert_se(!utf8_is_printable_n("\302\205", 2));
+
+        /* Truncated sequences must not be read beyond the length */
+        assert_se(!utf8_is_printable_n("\303", 1));
+        assert_se(!utf8_is_printable_n("\342\202", 2));
+        assert_se(!utf8_is_printable_n("\360\237\230", 3));
+}
+
+static void test_printable_offsets(void) {
+        char buf[80];
+        size_t l, i;
+
+        /* A bad byte at every position of strings of every length,
+         * so that all chunk boundaries are covered */
+        for (l = 1; l < sizeof(buf); l++) {
+                memset(buf, 'a', l);
+                assert_se(utf8_is_printable_n(buf, l));
+
+                for (i = 0; i < l; i++) {
+                        buf[i] = '\n';
+                        assert_se(!utf8_is_printable_n(buf, l));
+                        buf[i] = '\t';
+                        assert_se(utf8_is_printable_n(buf, l));
+                        buf[i] = '\177';
+                        assert_se(!utf8_is_printable_n(buf, l));
+                        buf[i] = '\200';
+                        assert_se(!utf8_is_printable_n(buf, l));
+                        buf[i] = 'a';
+                }
+
+                /* A valid multi-byte character everywhere */
+                for (i = 0; i + 2 <= l; i++) {
+                        memcpy(buf + i, "\303\274", 2);
+                        assert_se(utf8_is_printable_n(buf, l));
+                        memset(buf + i, 'a', 2);
+                }
+        }
+}
+
+static void test_valid(void) {
+        char buf[80];
+        size_t l, i;
+
+        assert_se(utf8_is_valid(""));
+        assert_se(utf8_is_valid("foo\nbar"));
+        assert_se(utf8_is_valid("gr\303\274\303\237e"));
+        assert_se(!utf8_is_valid("\303"));
+        assert_se(!utf8_is_valid("\355\240\200"));
+
+        for (l = 1; l < sizeof(buf); l++) {
+                memset(buf, 'a', l);
+                buf[l] = 0;
+                assert_se(utf8_is_valid(buf));
+
+                for (i = 0; i < l; i++) {
+                        _cleanup_free_ char *f = NULL;
+
+                        buf[i] = '\377';
+                        assert_se(!utf8_is_valid(buf));
+
+                        f = utf8_filter(buf);
+                        assert_se(f);
+                        assert_se(strlen(f) == l);
+                        assert_se(f[i] == '_');
+                        assert_se(strspn(f, "a_") == l);
+
+                        buf[i] = 'a';
+                }
+        }
+}
+
+static void test_filter(void) {
+        _cleanup_free_ char *a = NULL, *b = NULL;
+
+        a = utf8_filter("gr\303\274\303\237e and some more ASCII text \377 behind it");
+        assert_se(streq(a, "gr\303\274\303\237e and some more ASCII text _ behind it"));
+
+        b = utf8_filter("\303x");
+        assert_se(streq(b, "_x"));
+}
+
+int main(int argc, char *argv[]) {
+        test_printable();
+        test_printable_offsets();
+        test_valid();
+        test_filter();
+
+        return 0;
+}
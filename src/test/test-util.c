@@ -23,8 +23,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 #include "util.h"
+#include "fileio.h"
 
 static void test_streq_ptr(void) {
         assert_se(streq_ptr(NULL, NULL));
@@ -348,6 +350,41 @@ static void test_u64log2(void) {
         assert(u64log2(1024*1024+5) == 20);
 }
 
+static void test_execute_directory_full(void) {
+        char dir[] = "/tmp/test-execute-directory.XXXXXX";
+        _cleanup_free_ char *fast = NULL, *slow = NULL;
+        ExecuteTiming *t = NULL;
+        unsigned n = 0, i;
+
+        assert_se(mkdtemp(dir));
+
+        fast = strappend(dir, "/fast");
+        slow = strappend(dir, "/slow");
+        assert_se(fast && slow);
+
+        assert_se(write_string_file(fast, "#!/bin/sh\nexit 3") >= 0);
+        assert_se(write_string_file(slow, "#!/bin/sh\nsleep 10") >= 0);
+        assert_se(chmod(fast, 0755) >= 0);
+        assert_se(chmod(slow, 0755) >= 0);
+
+        assert_se(execute_directory_full(dir, NULL, NULL, USEC_PER_SEC, &t, &n) >= 0);
+        assert_se(n == 2);
+
+        for (i = 0; i < n; i++)
+                if (streq(t[i].name, "fast")) {
+                        assert_se(!t[i].timed_out);
+                        assert_se(t[i].code == CLD_EXITED && t[i].status == 3);
+                        assert_se(t[i].usec < USEC_PER_SEC);
+                } else {
+                        assert_se(streq(t[i].name, "slow"));
+                        assert_se(t[i].timed_out);
+                        assert_se(t[i].usec >= USEC_PER_SEC / 2);
+                }
+
+        execute_timings_free(t, n);
+        rm_rf(dir, false, true, false);
+}
+
 int main(int argc, char *argv[]) {
         test_streq_ptr();
         test_first_word();
@@ -374,6 +411,7 @@ int main(int argc, char *argv[]) {
         test_bus_path_escape();
         test_hostname_is_valid();
         test_u64log2();
+        test_execute_directory_full();
 
         return 0;
 }
@@ -39,6 +39,7 @@
 #include <glob.h>
 #include <fnmatch.h>
 #include <sys/capability.h>
+#include <pthread.h>
 
 #include "log.h"
 #include "util.h"
@@ -51,6 +52,7 @@
 #include "set.h"
 #include "conf-files.h"
 #include "capability.h"
+#include "selinux-util.h"
 
 /* This reads all files listed in /etc/tmpfiles.d/?*.conf and creates
  * them in the file system. This is intended to be used to create
@@ -107,6 +109,9 @@ static bool arg_remove = false;
 
 static const char *arg_prefix = NULL;
 
+static unsigned arg_threads = 0;
+static unsigned arg_max_rate = 0;
+
 static const char conf_file_dirs[] =
         "/etc/tmpfiles.d\0"
         "/run/tmpfiles.d\0"
@@ -119,6 +124,9 @@ static const char conf_file_dirs[] =
 
 #define MAX_DEPTH 256
 
+/* What makes glob() do more than look at a path, with GLOB_BRACE */
+#define GLOB_CHARS "*?[{\\"
+
 static bool needs_glob(ItemType t) {
         return t == IGNORE_PATH || t == IGNORE_DIRECTORY_PATH || t == REMOVE_PATH || t == RECURSIVE_REMOVE_PATH || t == RELABEL_PATH || t == RECURSIVE_RELABEL_PATH;
 }
@@ -250,6 +258,85 @@ static int dir_is_mount_point(DIR *d, const char *subdir) {
         return r;
 }
 
+/* Directories are read in large chunks, rather than the few dozen
+ * entries readdir() fetches per system call */
+#define DIRENT_BUFFER_SIZE (256*1024)
+
+#define THREADS_MAX 16
+
+typedef struct CleanupJob {
+        char *name;
+        char *sub_path;
+        struct stat st;
+        int r;
+} CleanupJob;
+
+/* The subdirectories of a directory being cleaned up, to be walked in
+ * parallel by a number of threads */
+typedef struct CleanupJobs {
+        Item *item;
+        const char *path;
+        int dfd;
+        usec_t cutoff;
+        dev_t rootdev;
+        int maxdepth;
+        bool keep_this_level;
+
+        CleanupJob *jobs;
+        unsigned n_jobs;
+        size_t n_allocated;
+        unsigned next;
+} CleanupJobs;
+
+static pthread_mutex_t rate_lock = PTHREAD_MUTEX_INITIALIZER;
+static usec_t rate_next = 0;
+
+static void rate_limit(void) {
+        usec_t n, t;
+
+        if (arg_max_rate <= 0)
+                return;
+
+        /* Hand out slots of 1/N s to whichever thread comes next */
+        pthread_mutex_lock(&rate_lock);
+        n = now(CLOCK_MONOTONIC);
+        t = MAX(rate_next, n);
+        rate_next = t + USEC_PER_SEC / arg_max_rate;
+        pthread_mutex_unlock(&rate_lock);
+
+        if (t > n)
+                usleep(t - n);
+}
+
+static bool dir_created_after(int dfd, const char *name, const struct stat *s, usec_t cutoff) {
+        static bool broken = false;
+        struct statx sx;
+        usec_t btime;
+
+        /* Nothing can be created in a directory before the directory
+         * itself, and creating, linking or renaming an entry all bump
+         * its ctime. Hence a directory created after the cutoff
+         * cannot contain anything old enough to be removed, at any
+         * depth. The creation time is not earlier than the mtime, so
+         * only look it up for the recently modified directories. */
+
+        if (broken || timespec_load(&s->st_mtim) < cutoff)
+                return false;
+
+        if (statx(dfd, name, AT_SYMLINK_NOFOLLOW, STATX_BTIME, &sx) < 0) {
+                if (errno == ENOSYS)
+                        broken = true;
+                return false;
+        }
+
+        if (!(sx.stx_mask & STATX_BTIME) || sx.stx_btime.tv_sec <= 0)
+                return false;
+
+        btime = (usec_t) sx.stx_btime.tv_sec * USEC_PER_SEC + sx.stx_btime.tv_nsec / NSEC_PER_USEC;
+
+        return btime >= cutoff;
+}
+
 static int dir_cleanup(
                 Item *i,
                 const char *p,
@@ -259,169 +346,354 @@ static int dir_cleanup(
                 dev_t rootdev,
                 bool mountpoint,
                 int maxdepth,
+                bool keep_this_level,
+                bool parallel);
+
+static int dir_cleanup_subdir(
+                Item *i,
+                const char *p,
+                int dfd,
+                const char *name,
+                const char *sub_path,
+                const struct stat *s,
+                usec_t cutoff,
+                dev_t rootdev,
+                int maxdepth,
                 bool keep_this_level)
 {
-        struct dirent *dent;
-        struct timespec times[2];
-        bool deleted = false;
+        usec_t age;
         int r = 0;
 
-        while ((dent = readdir(d))) {
-                struct stat s;
-                usec_t age;
-                char _cleanup_free_ *sub_path = NULL;
+        if (maxdepth <= 0)
+                log_warning("Reached max depth on %s.", sub_path);
+        else {
+                DIR _cleanup_closedir_ *sub_dir;
+                int q;
+
+                sub_dir = xopendirat(dfd, name, O_NOFOLLOW|O_NOATIME);
+                if (sub_dir == NULL) {
+                        if (errno != ENOENT) {
+                                log_error("opendir(%s/%s) failed: %m", p, name);
+                                r = -errno;
+                        }
 
-                if (streq(dent->d_name, ".") ||
-                    streq(dent->d_name, ".."))
-                        continue;
+                        return r;
+                }
 
-                if (fstatat(dirfd(d), dent->d_name, &s, AT_SYMLINK_NOFOLLOW) < 0) {
-                        if (errno == ENOENT)
-                                continue;
+                q = dir_cleanup(i, sub_path, sub_dir, s, cutoff, rootdev, false, maxdepth-1, false, false);
 
-                        /* FUSE, NFS mounts, SELinux might return EACCES */
-                        if (errno == EACCES)
-                                log_debug("stat(%s/%s) failed: %m", p, dent->d_name);
-                        else
-                                log_error("stat(%s/%s) failed: %m", p, dent->d_name);
-                        r = -errno;
-                        continue;
+                if (q < 0)
+                        r = q;
+        }
+
+        /* Note: if you are wondering why we don't
+         * support the sticky bit for excluding
+         * directories from cleaning like we do it for
+         * other file system objects: well, the sticky
+         * bit already has a meaning for directories,
+         * so we don't want to overload that. */
+
+        if (keep_this_level)
+                return r;
+
+        /* Ignore ctime, we change it when deleting */
+        age = MAX(timespec_load(&s->st_mtim),
+                  timespec_load(&s->st_atim));
+        if (age >= cutoff)
+                return r;
+
+        if (i->type != IGNORE_DIRECTORY_PATH || !streq(name, p)) {
+                log_debug("rmdir '%s'\n", sub_path);
+
+                if (unlinkat(dfd, name, AT_REMOVEDIR) < 0) {
+                        if (errno != ENOENT && errno != ENOTEMPTY) {
+                                log_error("rmdir(%s): %m", sub_path);
+                                r = -errno;
+                        }
                 }
+        }
 
-                /* Stay on the same filesystem */
-                if (s.st_dev != rootdev)
-                        continue;
+        return r;
+}
 
-                /* Try to detect bind mounts of the same filesystem instance; they
-                 * do not differ in device major/minors. This type of query is not
-                 * supported on all kernels or filesystem types though. */
-                if (S_ISDIR(s.st_mode) && dir_is_mount_point(d, dent->d_name) > 0)
-                        continue;
+static void *cleanup_thread(void *userdata) {
+        CleanupJobs *j = userdata;
 
-                /* Do not delete read-only files owned by root */
-                if (s.st_uid == 0 && !(s.st_mode & S_IWUSR))
-                        continue;
+        for (;;) {
+                CleanupJob *job;
+                unsigned k;
 
-                if (asprintf(&sub_path, "%s/%s", p, dent->d_name) < 0) {
-                        r = log_oom();
-                        goto finish;
+                k = __sync_fetch_and_add(&j->next, 1);
+                if (k >= j->n_jobs)
+                        return NULL;
+
+                job = j->jobs + k;
+                job->r = dir_cleanup_subdir(j->item, j->path, j->dfd, job->name, job->sub_path, &job->st,
+                                            j->cutoff, j->rootdev, j->maxdepth, j->keep_this_level);
+        }
+}
+
+static int cleanup_jobs_run(CleanupJobs *j) {
+        pthread_t threads[THREADS_MAX];
+        pthread_attr_t attr;
+        unsigned n_threads, k;
+        int r = 0;
+
+        if (j->n_jobs <= 0)
+                return 0;
+
+        /* Learn about the sockets in use before anybody needs them */
+        load_unix_sockets();
+
+        n_threads = MIN(arg_threads, j->n_jobs);
+
+        assert_se(pthread_attr_init(&attr) == 0);
+        assert_se(pthread_attr_setstacksize(&attr, 256*1024) == 0);
+
+        /* We are one of the threads ourselves */
+        for (k = 0; k + 1 < n_threads; k++)
+                if (pthread_create(threads + k, &attr, cleanup_thread, j) != 0) {
+                        log_debug("Failed to start thread, continuing with %u.", k + 1);
+                        break;
                 }
+        n_threads = k;
 
-                /* Is there an item configured for this path? */
-                if (hashmap_get(items, sub_path))
-                        continue;
+        pthread_attr_destroy(&attr);
 
-                if (find_glob(globs, sub_path))
-                        continue;
+        cleanup_thread(j);
 
-                if (S_ISDIR(s.st_mode)) {
+        for (k = 0; k < n_threads; k++)
+                pthread_join(threads[k], NULL);
 
-                        if (mountpoint &&
-                            streq(dent->d_name, "lost+found") &&
-                            s.st_uid == 0)
-                                continue;
+        for (k = 0; k < j->n_jobs; k++)
+                if (j->jobs[k].r < 0)
+                        r = j->jobs[k].r;
 
-                        if (maxdepth <= 0)
-                                log_warning("Reached max depth on %s.", sub_path);
-                        else {
-                                DIR _cleanup_closedir_ *sub_dir;
-                                int q;
+        return r;
+}
 
-                                sub_dir = xopendirat(dirfd(d), dent->d_name, O_NOFOLLOW|O_NOATIME);
-                                if (sub_dir == NULL) {
-                                        if (errno != ENOENT) {
-                                                log_error("opendir(%s/%s) failed: %m", p, dent->d_name);
-                                                r = -errno;
-                                        }
+static void cleanup_jobs_free(CleanupJobs *j) {
+        unsigned k;
 
-                                        continue;
-                                }
+        for (k = 0; k < j->n_jobs; k++) {
+                free(j->jobs[k].name);
+                free(j->jobs[k].sub_path);
+        }
 
-                                q = dir_cleanup(i, sub_path, sub_dir, &s, cutoff, rootdev, false, maxdepth-1, false);
+        free(j->jobs);
+}
 
-                                if (q < 0)
-                                        r = q;
-                        }
+static int dir_cleanup_entry(
+                Item *i,
+                const char *p,
+                DIR *d,
+                const char *name,
+                usec_t cutoff,
+                dev_t rootdev,
+                bool mountpoint,
+                int maxdepth,
+                bool keep_this_level,
+                CleanupJobs *jobs,
+                bool *deleted)
+{
+        struct stat s;
+        usec_t age;
+        char _cleanup_free_ *sub_path = NULL;
+        int r = 0;
 
-                        /* Note: if you are wondering why we don't
-                         * support the sticky bit for excluding
-                         * directories from cleaning like we do it for
-                         * other file system objects: well, the sticky
-                         * bit already has a meaning for directories,
-                         * so we don't want to overload that. */
+        if (streq(name, ".") ||
+            streq(name, ".."))
+                return 0;
 
-                        if (keep_this_level)
-                                continue;
+        rate_limit();
 
-                        /* Ignore ctime, we change it when deleting */
-                        age = MAX(timespec_load(&s.st_mtim),
-                                  timespec_load(&s.st_atim));
-                        if (age >= cutoff)
-                                continue;
+        if (fstatat(dirfd(d), name, &s, AT_SYMLINK_NOFOLLOW) < 0) {
+                if (errno == ENOENT)
+                        return 0;
+
+                /* FUSE, NFS mounts, SELinux might return EACCES */
+                if (errno == EACCES)
+                        log_debug("stat(%s/%s) failed: %m", p, name);
+                else
+                        log_error("stat(%s/%s) failed: %m", p, name);
+                return -errno;
+        }
 
-                        if (i->type != IGNORE_DIRECTORY_PATH || !streq(dent->d_name, p)) {
-                                log_debug("rmdir '%s'\n", sub_path);
+        /* Stay on the same filesystem */
+        if (s.st_dev != rootdev)
+                return 0;
 
-                                if (unlinkat(dirfd(d), dent->d_name, AT_REMOVEDIR) < 0) {
-                                        if (errno != ENOENT && errno != ENOTEMPTY) {
-                                                log_error("rmdir(%s): %m", sub_path);
-                                                r = -errno;
-                                        }
-                                }
-                        }
+        /* Try to detect bind mounts of the same filesystem instance; they
+         * do not differ in device major/minors. This type of query is not
+         * supported on all kernels or filesystem types though. */
+        if (S_ISDIR(s.st_mode) && dir_is_mount_point(d, name) > 0)
+                return 0;
 
-                } else {
-                        /* Skip files for which the sticky bit is
-                         * set. These are semantics we define, and are
-                         * unknown elsewhere. See XDG_RUNTIME_DIR
-                         * specification for details. */
-                        if (s.st_mode & S_ISVTX)
-                                continue;
+        /* Do not delete read-only files owned by root */
+        if (s.st_uid == 0 && !(s.st_mode & S_IWUSR))
+                return 0;
 
-                        if (mountpoint && S_ISREG(s.st_mode)) {
-                                if (streq(dent->d_name, ".journal") &&
-                                    s.st_uid == 0)
-                                        continue;
+        if (asprintf(&sub_path, "%s/%s", p, name) < 0)
+                return log_oom();
 
-                                if (streq(dent->d_name, "aquota.user") ||
-                                    streq(dent->d_name, "aquota.group"))
-                                        continue;
-                        }
+        /* Is there an item configured for this path? */
+        if (hashmap_get(items, sub_path))
+                return 0;
 
-                        /* Ignore sockets that are listed in /proc/net/unix */
-                        if (S_ISSOCK(s.st_mode) && unix_socket_alive(sub_path))
-                                continue;
+        if (find_glob(globs, sub_path))
+                return 0;
 
-                        /* Ignore device nodes */
-                        if (S_ISCHR(s.st_mode) || S_ISBLK(s.st_mode))
-                                continue;
+        if (S_ISDIR(s.st_mode)) {
 
-                        /* Keep files on this level around if this is
-                         * requested */
-                        if (keep_this_level)
-                                continue;
+                if (mountpoint &&
+                    streq(name, "lost+found") &&
+                    s.st_uid == 0)
+                        return 0;
 
-                        age = MAX3(timespec_load(&s.st_mtim),
-                                   timespec_load(&s.st_atim),
-                                   timespec_load(&s.st_ctim));
+                if (dir_created_after(dirfd(d), name, &s, cutoff)) {
+                        log_debug("Skipping '%s', created after the cutoff.", sub_path);
+                        return 0;
+                }
 
-                        if (age >= cutoff)
-                                continue;
+                if (jobs) {
+                        CleanupJob *job;
 
-                        log_debug("unlink '%s'\n", sub_path);
+                        if (!GREEDY_REALLOC(jobs->jobs, jobs->n_allocated, jobs->n_jobs + 1))
+                                return log_oom();
 
-                        if (unlinkat(dirfd(d), dent->d_name, 0) < 0) {
-                                if (errno != ENOENT) {
-                                        log_error("unlink(%s): %m", sub_path);
-                                        r = -errno;
-                                }
-                        }
+                        job = jobs->jobs + jobs->n_jobs;
+                        zero(*job);
+                        job->st = s;
+                        job->sub_path = sub_path;
+                        job->name = strdup(name);
+                        if (!job->name)
+                                return log_oom();
 
-                        deleted = true;
+                        sub_path = NULL;
+                        jobs->n_jobs++;
+
+                        return 0;
                 }
+
+                return dir_cleanup_subdir(i, p, dirfd(d), name, sub_path, &s, cutoff, rootdev, maxdepth, keep_this_level);
         }
 
+        /* Skip files for which the sticky bit is
+         * set. These are semantics we define, and are
+         * unknown elsewhere. See XDG_RUNTIME_DIR
+         * specification for details. */
+        if (s.st_mode & S_ISVTX)
+                return 0;
+
+        if (mountpoint && S_ISREG(s.st_mode)) {
+                if (streq(name, ".journal") &&
+                    s.st_uid == 0)
+                        return 0;
+
+                if (streq(name, "aquota.user") ||
+                    streq(name, "aquota.group"))
+                        return 0;
+        }
+
+        /* Ignore sockets that are listed in /proc/net/unix */
+        if (S_ISSOCK(s.st_mode) && unix_socket_alive(sub_path))
+                return 0;
+
+        /* Ignore device nodes */
+        if (S_ISCHR(s.st_mode) || S_ISBLK(s.st_mode))
+                return 0;
+
+        /* Keep files on this level around if this is
+         * requested */
+        if (keep_this_level)
+                return 0;
+
+        age = MAX3(timespec_load(&s.st_mtim),
+                   timespec_load(&s.st_atim),
+                   timespec_load(&s.st_ctim));
+
+        if (age >= cutoff)
+                return 0;
+
+        log_debug("unlink '%s'\n", sub_path);
+
+        if (unlinkat(dirfd(d), name, 0) < 0) {
+                if (errno != ENOENT) {
+                        log_error("unlink(%s): %m", sub_path);
+                        r = -errno;
+                }
+        }
+
+        *deleted = true;
+
+        return r;
+}
+
+static int dir_cleanup(
+                Item *i,
+                const char *p,
+                DIR *d,
+                const struct stat *ds,
+                usec_t cutoff,
+                dev_t rootdev,
+                bool mountpoint,
+                int maxdepth,
+                bool keep_this_level,
+                bool parallel)
+{
+        _cleanup_free_ uint8_t *buf = NULL;
+        CleanupJobs jobs = {
+                .item = i,
+                .path = p,
+                .dfd = dirfd(d),
+                .cutoff = cutoff,
+                .rootdev = rootdev,
+                .maxdepth = maxdepth,
+                .keep_this_level = keep_this_level,
+        };
+        struct timespec times[2];
+        bool deleted = false;
+        int r = 0, q;
+
+        buf = malloc(DIRENT_BUFFER_SIZE);
+        if (!buf)
+                return log_oom();
+
+        for (;;) {
+                ssize_t n, k;
+
+                n = getdents64(dirfd(d), buf, DIRENT_BUFFER_SIZE);
+                if (n < 0) {
+                        log_error("Failed to read directory %s: %m", p);
+                        r = -errno;
+                        break;
+                }
+
+                if (n == 0)
+                        break;
+
+                for (k = 0; k < n; k += ((struct dirent64*) (buf + k))->d_reclen) {
+                        struct dirent64 *dent = (struct dirent64*) (buf + k);
+
+                        q = dir_cleanup_entry(i, p, d, dent->d_name, cutoff, rootdev, mountpoint,
+                                              maxdepth, keep_this_level, parallel ? &jobs : NULL, &deleted);
+                        if (q == -ENOMEM) {
+                                r = q;
+                                goto finish;
+                        }
+                        if (q < 0)
+                                r = q;
+                }
+        }
+
+        /* Walk the subdirectories we came across in parallel */
+        q = cleanup_jobs_run(&jobs);
+        if (q < 0)
+                r = q;
+
 finish:
+        cleanup_jobs_free(&jobs);
+
         if (deleted) {
                 /* Restore original directory timestamps */
                 times[0] = ds->st_atim;
@@ -434,15 +706,29 @@ finish:
         return r;
 }
 
-static int item_set_perms(Item *i, const char *path) {
+static int item_set_perms_full(Item *i, const char *path, const struct stat *st) {
+        struct stat buf;
+
+        /* Most of the time everything is set up as configured
+         * already, so do not touch what does not need to change */
+        if (!st && (i->mode_set || i->uid_set || i->gid_set)) {
+                if (stat(path, &buf) < 0) {
+                        log_error("stat(%s) failed: %m", path);
+                        return -errno;
+                }
+
+                st = &buf;
+        }
+
         /* not using i->path directly because it may be a glob */
-        if (i->mode_set)
+        if (i->mode_set && (st->st_mode & 07777) != i->mode)
                 if (chmod(path, i->mode) < 0) {
                         log_error("chmod(%s) failed: %m", path);
                         return -errno;
                 }
 
-        if (i->uid_set || i->gid_set)
+        if ((i->uid_set && st->st_uid != i->uid) ||
+            (i->gid_set && st->st_gid != i->gid))
                 if (chown(path,
                           i->uid_set ? i->uid : (uid_t) -1,
                           i->gid_set ? i->gid : (gid_t) -1) < 0) {
@@ -454,6 +740,10 @@ static int item_set_perms(Item *i, const char *path) {
         return label_fix(path, false, false);
 }
 
+static int item_set_perms(Item *i, const char *path) {
+        return item_set_perms_full(i, path, NULL);
+}
+
 static int write_one_file(Item *i, const char *path) {
         int r, e, fd, flags;
         struct stat st;
@@ -510,7 +800,7 @@ static int write_one_file(Item *i, const char *path) {
                 return -EEXIST;
         }
 
-        r = item_set_perms(i, path);
+        r = item_set_perms_full(i, path, &st);
         if (r < 0)
                 return r;
 
@@ -589,13 +879,14 @@ static int recursive_relabel(Item *i, const char *path) {
         int r;
         struct stat st;
 
-        r = item_set_perms(i, path);
-        if (r < 0)
-                return r;
-
         if (lstat(path, &st) < 0)
                 return -errno;
 
+        /* chmod() and chown() follow symlinks */
+        r = item_set_perms_full(i, path, S_ISLNK(st.st_mode) ? NULL : &st);
+        if (r < 0)
+                return r;
+
         if (S_ISDIR(st.st_mode))
                 r = recursive_relabel_children(i, path);
 
@@ -607,6 +898,17 @@ static int glob_item(Item *i, int (*action)(Item *, const char *)) {
         glob_t _cleanup_globfree_ g = {};
         char **fn;
 
+        /* Most paths are plain ones, for which glob() would not do
+         * more than check that they exist */
+        if (!strpbrk(i->path, GLOB_CHARS)) {
+                struct stat st;
+
+                if (lstat(i->path, &st) < 0)
+                        return 0;
+
+                return action(i, i->path);
+        }
+
         errno = 0;
         k = glob(i->path, GLOB_NOSORT|GLOB_BRACE, NULL, &g);
         if (k != 0)
@@ -677,7 +979,7 @@ static int create_item(Item *i) {
                         return -EEXIST;
                 }
 
-                r = item_set_perms(i, i->path);
+                r = item_set_perms_full(i, i->path, &st);
                 if (r < 0)
                         return r;
 
@@ -704,7 +1006,7 @@ static int create_item(Item *i) {
                         return -EEXIST;
                 }
 
-                r = item_set_perms(i, i->path);
+                r = item_set_perms_full(i, i->path, &st);
                 if (r < 0)
                         return r;
 
@@ -779,7 +1081,7 @@ static int create_item(Item *i) {
                         return -EEXIST;
                 }
 
-                r = item_set_perms(i, i->path);
+                r = item_set_perms_full(i, i->path, &st);
                 if (r < 0)
                         return r;
 
@@ -927,7 +1229,7 @@ static int clean_item_instance(Item *i, const char* instance) {
                      (s.st_dev == ps.st_dev && s.st_ino == ps.st_ino);
 
         r = dir_cleanup(i, instance, d, &s, cutoff, s.st_dev, mountpoint,
-                        MAX_DEPTH, i->keep_first_level);
+                        MAX_DEPTH, i->keep_first_level, arg_threads > 1);
         return r;
 }
 
@@ -970,6 +1272,121 @@ static int process_item(Item *i) {
         return p;
 }
 
+/* Sorts '/' before any other character, so that all paths below a
+ * directory directly follow it */
+static int item_path_compare(const void *a, const void *b) {
+        const char *x = (*(Item* const*) a)->path, *y = (*(Item* const*) b)->path;
+
+        for (; *x && *x == *y; x++, y++)
+                ;
+
+        if (*x == *y)
+                return 0;
+        if (*x == 0 || *y == 0)
+                return *x == 0 ? -1 : 1;
+        if (*x == '/' || *y == '/')
+                return *x == '/' ? -1 : 1;
+
+        return (unsigned char) *x - (unsigned char) *y;
+}
+
+/* Items below the same path form a group, which is processed in order
+ * by a single thread, parents first */
+typedef struct ItemGroups {
+        Item **items;
+        unsigned *groups;
+        unsigned n_items, n_groups;
+        unsigned next;
+} ItemGroups;
+
+static void *process_thread(void *userdata) {
+        ItemGroups *g = userdata;
+
+        for (;;) {
+                unsigned k, j, end;
+
+                k = __sync_fetch_and_add(&g->next, 1);
+                if (k >= g->n_groups)
+                        return NULL;
+
+                end = k + 1 < g->n_groups ? g->groups[k + 1] : g->n_items;
+                for (j = g->groups[k]; j < end; j++)
+                        process_item(g->items[j]);
+        }
+}
+
+static int process_items_parallel(Hashmap *h) {
+        _cleanup_free_ Item **sorted = NULL;
+        _cleanup_free_ unsigned *groups = NULL;
+        pthread_t threads[THREADS_MAX];
+        ItemGroups g = {};
+        Iterator iterator;
+        unsigned n_threads, k;
+        mode_t old_umask;
+        Item *i;
+
+        sorted = new(Item*, hashmap_size(h));
+        groups = new(unsigned, hashmap_size(h));
+        if (!sorted || !groups)
+                return log_oom();
+
+        HASHMAP_FOREACH(i, h, iterator)
+                sorted[g.n_items++] = i;
+
+        qsort(sorted, g.n_items, sizeof(Item*), item_path_compare);
+
+        for (k = 0; k < g.n_items; k++)
+                if (g.n_groups <= 0 ||
+                    !path_startswith(sorted[k]->path, sorted[groups[g.n_groups - 1]]->path))
+                        groups[g.n_groups++] = k;
+
+        g.items = sorted;
+        g.groups = groups;
+
+        /* Everything is created with an umask of 0 anyway, but the
+         * threads must not restore each other's umask while at it */
+        old_umask = umask(0000);
+
+        n_threads = MIN(arg_threads, g.n_groups);
+        for (k = 0; k + 1 < n_threads; k++)
+                if (pthread_create(threads + k, NULL, process_thread, &g) != 0) {
+                        log_debug("Failed to start thread, continuing with %u.", k + 1);
+                        break;
+                }
+        n_threads = k;
+
+        process_thread(&g);
+
+        for (k = 0; k < n_threads; k++)
+                pthread_join(threads[k], NULL);
+
+        umask(old_umask);
+
+        return 0;
+}
+
+static void process_items(Hashmap *h) {
+        Iterator iterator;
+        bool parallel;
+        Item *i;
+
+        /* Items of unrelated paths do not depend on each other, and
+         * may be applied in parallel. Not when cleaning up, which is
+         * parallel already, and not with SELinux, whose label lookups
+         * are not safe to make from several threads. */
+        parallel = arg_threads > 1 && !arg_clean && hashmap_size(h) > 1;
+#ifdef HAVE_SELINUX
+        if (use_selinux())
+                parallel = false;
+#endif
+
+        if (parallel && process_items_parallel(h) >= 0)
+                return;
+
+        HASHMAP_FOREACH(i, h, iterator)
+                process_item(i);
+}
+
 static void item_free(Item *i) {
         assert(i);
 
@@ -1209,7 +1626,9 @@ static int help(void) {
                "     --create           Create marked files/directories\n"
                "     --clean            Clean up marked directories\n"
                "     --remove           Remove marked files/directories\n"
-               "     --prefix=PATH      Only apply rules that apply to paths with the specified prefix\n",
+               "     --prefix=PATH      Only apply rules that apply to paths with the specified prefix\n"
+               "     --threads=N        Create and clean up with N threads\n"
+               "     --max-rate=N       Look at no more than N files per second when cleaning up\n",
                program_invocation_short_name);
 
         return 0;
@@ -1221,7 +1640,9 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_CREATE,
                 ARG_CLEAN,
                 ARG_REMOVE,
-                ARG_PREFIX
+                ARG_PREFIX,
+                ARG_THREADS,
+                ARG_MAX_RATE
         };
 
         static const struct option options[] = {
@@ -1230,10 +1651,12 @@ static int parse_argv(int argc, char *argv[]) {
                 { "clean",     no_argument,       NULL, ARG_CLEAN     },
                 { "remove",    no_argument,       NULL, ARG_REMOVE    },
                 { "prefix",    required_argument, NULL, ARG_PREFIX    },
+                { "threads",   required_argument, NULL, ARG_THREADS   },
+                { "max-rate",  required_argument, NULL, ARG_MAX_RATE  },
                 { NULL,        0,                 NULL, 0             }
         };
 
-        int c;
+        int c, r;
 
         assert(argc >= 0);
         assert(argv);
@@ -1262,6 +1685,22 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_prefix = optarg;
                         break;
 
+                case ARG_THREADS:
+                        r = safe_atou(optarg, &arg_threads);
+                        if (r < 0 || arg_threads <= 0 || arg_threads > THREADS_MAX) {
+                                log_error("Failed to parse number of threads: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
+                case ARG_MAX_RATE:
+                        r = safe_atou(optarg, &arg_max_rate);
+                        if (r < 0) {
+                                log_error("Failed to parse maximum rate: %s", optarg);
+                                return -EINVAL;
+                        }
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -1276,6 +1715,16 @@ static int parse_argv(int argc, char *argv[]) {
                 return -EINVAL;
         }
 
+        /* Unrelated subtrees are best walked in parallel, even on
+         * rotating media, which can order the requests better the
+         * more of them there are */
+        if (arg_threads <= 0) {
+                long n;
+
+                n = sysconf(_SC_NPROCESSORS_ONLN);
+                arg_threads = CLAMP(n, 1, 8);
+        }
+
         return 1;
 }
 
@@ -1408,11 +1857,11 @@ int main(int argc, char *argv[]) {
                 }
         }
 
+        /* Globs may match anything, hence are applied one by one */
         HASHMAP_FOREACH(i, globs, iterator)
                 process_item(i);
 
-        HASHMAP_FOREACH(i, items, iterator)
-                process_item(i);
+        process_items(items);
 
 finish:
         while ((i = hashmap_steal_first(items)))
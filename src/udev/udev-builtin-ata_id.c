@@ -0,0 +1,72 @@
+/*
+ * ata_id - reads product/serial number from ATA drives
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "udev.h"
+#include "ata_id/ata-identify.h"
+
+struct ata_id_import {
+        struct udev_device *dev;
+        bool test;
+};
+
+static void add_property(void *userdata, const char *key, const char *value)
+{
+        struct ata_id_import *import = userdata;
+
+        udev_builtin_add_property(import->dev, import->test, key, value);
+}
+
+/*
+ * The same as IMPORT{program}="ata_id --export $devnode", without
+ * running a program for every disk.
+ */
+static int builtin_ata_id(struct udev_device *dev, int argc, char *argv[], bool test)
+{
+        struct ata_id_import import = {
+                .dev = dev,
+                .test = test,
+        };
+        const char *node;
+        int fd;
+        int r;
+
+        node = udev_device_get_devnode(dev);
+        if (node == NULL)
+                return EXIT_FAILURE;
+
+        fd = open(node, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+        if (fd < 0) {
+                log_debug("unable to open '%s': %m\n", node);
+                return EXIT_FAILURE;
+        }
+
+        r = ata_id_identify(udev_device_get_udev(dev), fd, node, add_property, &import);
+        close(fd);
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+const struct udev_builtin udev_builtin_ata_id = {
+        .name = "ata_id",
+        .cmd = builtin_ata_id,
+        .help = "ATA disk identification",
+};
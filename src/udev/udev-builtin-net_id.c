@@ -123,10 +123,10 @@ static int dev_pci_onboard(struct udev_device *dev, struct netnames *names) {
         int idx;
 
         /* ACPI _DSM  -- device specific method for naming a PCI or PCI Express device */
-        index = udev_device_get_sysattr_value(names->pcidev, "acpi_index");
+        index = udev_builtin_cache_sysattr(names->pcidev, "acpi_index");
         /* SMBIOS type 41 -- Onboard Devices Extended Information */
         if (!index)
-                index = udev_device_get_sysattr_value(names->pcidev, "index");
+                index = udev_builtin_cache_sysattr(names->pcidev, "index");
         if (!index)
                 return -ENOENT;
         idx = strtoul(index, NULL, 0);
@@ -134,7 +134,7 @@ static int dev_pci_onboard(struct udev_device *dev, struct netnames *names) {
                 return -EINVAL;
         snprintf(names->pci_onboard, sizeof(names->pci_onboard), "o%d", idx);
 
-        names->pci_onboard_label = udev_device_get_sysattr_value(names->pcidev, "label");
+        names->pci_onboard_label = udev_builtin_cache_sysattr(names->pcidev, "label");
         return 0;
 }
 
@@ -144,8 +144,12 @@ static bool is_pci_multifunction(struct udev_device *dev) {
         FILE *f = NULL;
         char config[64];
         bool multi = false;
+        const char *cached;
 
         snprintf(filename, sizeof(filename), "%s/config", udev_device_get_syspath(dev));
+        if (udev_builtin_cache_get(filename, &cached) > 0)
+                return cached != NULL;
+
         f = fopen(filename, "re");
         if (!f)
                 goto out;
@@ -155,6 +159,7 @@ static bool is_pci_multifunction(struct udev_device *dev) {
         /* bit 0-6 header type, bit 7 multi/single function device */
         if ((config[PCI_HEADER_TYPE] & 0x80) != 0)
                 multi = true;
+        udev_builtin_cache_put(filename, multi ? "1" : NULL);
 out:
         if(f)
                 fclose(f);
@@ -176,6 +181,7 @@ static int dev_pci_slot(struct udev_device *dev, struct netnames *names) {
         struct dirent *dent;
         char str[256];
         int hotplug_slot = 0;
+        const char *cached;
         int err = 0;
 
         if (sscanf(udev_device_get_sysname(names->pcidev), "0000:%x:%x.%d", &bus, &slot, &func) != 3)
@@ -203,6 +209,15 @@ static int dev_pci_slot(struct udev_device *dev, struct netnames *names) {
                 goto out;
         }
         snprintf(slots, sizeof(slots), "%s/slots", udev_device_get_syspath(pci));
+
+        /* the functions of a device share the scan of the slots */
+        snprintf(str, sizeof(str), "%s/%s", slots, udev_device_get_sysname(names->pcidev));
+        if (udev_builtin_cache_get(str, &cached) > 0) {
+                if (cached != NULL)
+                        hotplug_slot = atoi(cached);
+                goto found;
+        }
+
         dir = opendir(slots);
         if (!dir) {
                 err = -errno;
@@ -234,6 +249,16 @@ static int dev_pci_slot(struct udev_device *dev, struct netnames *names) {
         }
         closedir(dir);
 
+        snprintf(str, sizeof(str), "%s/%s", slots, udev_device_get_sysname(names->pcidev));
+        if (hotplug_slot > 0) {
+                char num[DECIMAL_STR_MAX(int)];
+
+                snprintf(num, sizeof(num), "%d", hotplug_slot);
+                udev_builtin_cache_put(str, num);
+        } else
+                udev_builtin_cache_put(str, NULL);
+found:
+
         if (hotplug_slot > 0) {
                 s = names->pci_slot;
                 l = strpcpyf(&s, sizeof(names->pci_slot), "s%d", hotplug_slot);
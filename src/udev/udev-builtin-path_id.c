@@ -106,7 +106,7 @@ static struct udev_device *handle_scsi_fibre_channel(struct udev_device *parent,
         fcdev = udev_device_new_from_subsystem_sysname(udev, "fc_transport", udev_device_get_sysname(targetdev));
         if (fcdev == NULL)
                 return NULL;
-        port = udev_device_get_sysattr_value(fcdev, "port_name");
+        port = udev_builtin_cache_sysattr(fcdev, "port_name");
         if (port == NULL) {
                 parent = NULL;
                 goto out;
@@ -143,7 +143,7 @@ static struct udev_device *handle_scsi_sas(struct udev_device *parent, char **pa
         if (sasdev == NULL)
                 return NULL;
 
-        sas_address = udev_device_get_sysattr_value(sasdev, "sas_address");
+        sas_address = udev_builtin_cache_sysattr(sasdev, "sas_address");
         if (sas_address == NULL) {
                 parent = NULL;
                 goto out;
@@ -184,7 +184,7 @@ static struct udev_device *handle_scsi_iscsi(struct udev_device *parent, char **
         sessiondev = udev_device_new_from_subsystem_sysname(udev, "iscsi_session", udev_device_get_sysname(transportdev));
         if (sessiondev == NULL)
                 return NULL;
-        target = udev_device_get_sysattr_value(sessiondev, "targetname");
+        target = udev_builtin_cache_sysattr(sessiondev, "targetname");
         if (target == NULL) {
                 parent = NULL;
                 goto out;
@@ -200,8 +200,8 @@ static struct udev_device *handle_scsi_iscsi(struct udev_device *parent, char **
                 parent = NULL;
                 goto out;
         }
-        addr = udev_device_get_sysattr_value(conndev, "persistent_address");
-        port = udev_device_get_sysattr_value(conndev, "persistent_port");
+        addr = udev_builtin_cache_sysattr(conndev, "persistent_address");
+        port = udev_builtin_cache_sysattr(conndev, "persistent_port");
         if (addr == NULL || port == NULL) {
                 parent = NULL;
                 goto out;
@@ -227,6 +227,9 @@ static struct udev_device *handle_scsi_default(struct udev_device *parent, char
         DIR *dir;
         struct dirent *dent;
         int basenum;
+        char key[UTIL_PATH_SIZE];
+        const char *cached;
+        char num[DECIMAL_STR_MAX(int)];
 
         hostdev = udev_device_get_parent_with_subsystem_devtype(parent, "scsi", "scsi_host");
         if (hostdev == NULL)
@@ -263,6 +266,14 @@ static struct udev_device *handle_scsi_default(struct udev_device *parent, char
                 goto out;
         }
         pos[0] = '\0';
+
+        /* the hosts of an adapter share the scan of its directory */
+        strscpyl(key, sizeof(key), base, "/host*", NULL);
+        if (udev_builtin_cache_get(key, &cached) > 0 && cached != NULL) {
+                basenum = atoi(cached);
+                goto found;
+        }
+
         dir = opendir(base);
         if (dir == NULL) {
                 parent = NULL;
@@ -294,6 +305,9 @@ static struct udev_device *handle_scsi_default(struct udev_device *parent, char
                 parent = NULL;
                 goto out;
         }
+        snprintf(num, sizeof(num), "%d", basenum);
+        udev_builtin_cache_put(key, num);
+found:
         host -= basenum;
 
         path_prepend(path, "scsi-%u:%u:%u:%u", host, bus, target, lun);
@@ -318,7 +332,7 @@ static struct udev_device *handle_scsi_hyperv(struct udev_device *parent, char *
         if (!vmbusdev)
                 return NULL;
 
-        guid_str = udev_device_get_sysattr_value(vmbusdev, "device_id");
+        guid_str = udev_builtin_cache_sysattr(vmbusdev, "device_id");
         if (!guid_str)
                 return NULL;
 
@@ -349,7 +363,7 @@ static struct udev_device *handle_scsi(struct udev_device *parent, char **path)
                 return parent;
 
         /* firewire */
-        id = udev_device_get_sysattr_value(parent, "ieee1394_id");
+        id = udev_builtin_cache_sysattr(parent, "ieee1394_id");
         if (id != NULL) {
                 parent = skip_subsystem(parent, "scsi");
                 path_prepend(path, "ieee1394-0x%s", id);
@@ -462,9 +476,9 @@ static struct udev_device *handle_ccw(struct udev_device *parent, struct udev_de
                 const char *lun;
                 const char *hba_id;
 
-                hba_id = udev_device_get_sysattr_value(scsi_dev, "hba_id");
-                wwpn = udev_device_get_sysattr_value(scsi_dev, "wwpn");
-                lun = udev_device_get_sysattr_value(scsi_dev, "fcp_lun");
+                hba_id = udev_builtin_cache_sysattr(scsi_dev, "hba_id");
+                wwpn = udev_builtin_cache_sysattr(scsi_dev, "wwpn");
+                lun = udev_builtin_cache_sysattr(scsi_dev, "fcp_lun");
                 if (hba_id != NULL && lun != NULL && wwpn != NULL) {
                         path_prepend(path, "ccw-%s-zfcp-%s:%s", hba_id, wwpn, lun);
                         goto out;
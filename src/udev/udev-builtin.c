@@ -26,10 +26,25 @@
 #include <getopt.h>
 
 #include "udev.h"
+#include "hashmap.h"
 
 static bool initialized;
 
+/*
+ * Values the builtins derive from the parents of the event device,
+ * like their attributes, kept by a worker across events. Siblings
+ * below the same host adapter or bridge are then handled without
+ * walking sysfs again. The cache is only enabled in the workers,
+ * and flushed as soon as an event other than "add" was dispatched
+ * by the main daemon, which might have changed a parent.
+ */
+#define CACHE_ENTRIES_MAX 4096
+static Hashmap *cache;
+static bool cache_enabled;
+static unsigned long long int cache_seqnum;
+
 static const struct udev_builtin *builtins[] = {
+        [UDEV_BUILTIN_ATA_ID] = &udev_builtin_ata_id,
 #ifdef HAVE_BLKID
         [UDEV_BUILTIN_BLKID] = &udev_builtin_blkid,
 #endif
@@ -75,9 +90,89 @@ void udev_builtin_exit(struct udev *udev)
                 if (builtins[i]->exit)
                         builtins[i]->exit(udev);
 
+        hashmap_free_free_free(cache);
+        cache = NULL;
+        cache_enabled = false;
+
         initialized = false;
 }
 
+/* called before every event with the seqnum of the last event which was not an "add" */
+void udev_builtin_cache_validate(unsigned long long int seqnum)
+{
+        if (cache_enabled && cache_seqnum == seqnum && hashmap_size(cache) < CACHE_ENTRIES_MAX)
+                return;
+
+        hashmap_clear_free_free(cache);
+        cache_enabled = true;
+        cache_seqnum = seqnum;
+}
+
+/* returns 1 and the value, which might be NULL, if the key is cached */
+int udev_builtin_cache_get(const char *key, const char **value)
+{
+        void *k = NULL;
+        const char *v;
+
+        if (!cache_enabled)
+                return 0;
+
+        v = hashmap_get2(cache, key, &k);
+        if (k == NULL)
+                return 0;
+
+        *value = v;
+        return 1;
+}
+
+void udev_builtin_cache_put(const char *key, const char *value)
+{
+        char *k, *v = NULL;
+
+        if (!cache_enabled)
+                return;
+
+        if (cache == NULL) {
+                cache = hashmap_new(string_hash_func, string_compare_func);
+                if (cache == NULL)
+                        return;
+        }
+
+        k = strdup(key);
+        if (k == NULL)
+                return;
+        if (value != NULL) {
+                v = strdup(value);
+                if (v == NULL) {
+                        free(k);
+                        return;
+                }
+        }
+
+        if (hashmap_put(cache, k, v) < 0) {
+                free(k);
+                free(v);
+        }
+}
+
+/* like udev_device_get_sysattr_value(), for attributes of parent devices */
+const char *udev_builtin_cache_sysattr(struct udev_device *dev, const char *sysattr)
+{
+        char key[UTIL_PATH_SIZE];
+        const char *value;
+
+        if (!cache_enabled)
+                return udev_device_get_sysattr_value(dev, sysattr);
+
+        strscpyl(key, sizeof(key), udev_device_get_syspath(dev), "/", sysattr, NULL);
+        if (udev_builtin_cache_get(key, &value) > 0)
+                return value;
+
+        value = udev_device_get_sysattr_value(dev, sysattr);
+        udev_builtin_cache_put(key, value);
+        return value;
+}
+
 bool udev_builtin_validate(struct udev *udev)
 {
         unsigned int i;
@@ -35,6 +35,8 @@ enum udev_ctrl_msg_type {
         UDEV_CTRL_SET_CHILDREN_MAX,
         UDEV_CTRL_PING,
         UDEV_CTRL_EXIT,
+        UDEV_CTRL_LOG_STATS,
+        UDEV_CTRL_GET_STATS,
 };
 
 struct udev_ctrl_msg_wire {
@@ -336,6 +338,30 @@ int udev_ctrl_send_exit(struct udev_ctrl *uctrl, int timeout)
         return ctrl_send(uctrl, UDEV_CTRL_EXIT, 0, NULL, timeout);
 }
 
+int udev_ctrl_send_log_stats(struct udev_ctrl *uctrl, int timeout)
+{
+        return ctrl_send(uctrl, UDEV_CTRL_LOG_STATS, 0, NULL, timeout);
+}
+
+/* the daemon replies with the counters, and closes the connection like after every message */
+int udev_ctrl_send_get_stats(struct udev_ctrl *uctrl, struct udev_ctrl_stats *stats, int timeout)
+{
+        ssize_t size;
+        int err;
+
+        err = ctrl_send(uctrl, UDEV_CTRL_GET_STATS, 0, NULL, timeout);
+        if (err < 0)
+                return err;
+
+        size = recv(uctrl->sock, stats, sizeof(struct udev_ctrl_stats), MSG_DONTWAIT);
+        if (size < 0)
+                return -errno;
+        /* a daemon not knowing the message just disconnects */
+        if (size != sizeof(struct udev_ctrl_stats))
+                return -EPROTO;
+        return 0;
+}
+
 struct udev_ctrl_msg *udev_ctrl_receive_msg(struct udev_ctrl_connection *conn)
 {
         struct udev_ctrl_msg *uctrl_msg;
@@ -490,3 +516,24 @@ int udev_ctrl_get_exit(struct udev_ctrl_msg *ctrl_msg)
                 return 1;
         return -1;
 }
+
+int udev_ctrl_get_stats(struct udev_ctrl_msg *ctrl_msg)
+{
+        if (ctrl_msg->ctrl_msg_wire.type == UDEV_CTRL_GET_STATS)
+                return 1;
+        return -1;
+}
+
+int udev_ctrl_reply_stats(struct udev_ctrl_msg *ctrl_msg, const struct udev_ctrl_stats *stats)
+{
+        if (send(ctrl_msg->conn->sock, stats, sizeof(struct udev_ctrl_stats), MSG_NOSIGNAL) < 0)
+                return -errno;
+        return 0;
+}
+
+int udev_ctrl_get_log_stats(struct udev_ctrl_msg *ctrl_msg)
+{
+        if (ctrl_msg->ctrl_msg_wire.type == UDEV_CTRL_LOG_STATS)
+                return 1;
+        return -1;
+}
@@ -47,6 +47,7 @@ struct udev_event *udev_event_new(struct udev_device *dev)
         event->dev = dev;
         event->udev = udev;
         udev_list_init(udev, &event->run_list, false);
+        udev_list_init(udev, &event->timing_list, false);
         event->fd_signal = -1;
         event->birth_usec = now(CLOCK_MONOTONIC);
         event->timeout_usec = 30 * 1000 * 1000;
@@ -58,6 +59,7 @@ void udev_event_unref(struct udev_event *event)
         if (event == NULL)
                 return;
         udev_list_cleanup(&event->run_list);
+        udev_list_cleanup(&event->timing_list);
         free(event->program_result);
         free(event->name);
         free(event);
@@ -932,18 +934,21 @@ int udev_event_execute_rules(struct udev_event *event, struct udev_rules *rules,
         return err;
 }
 
-void udev_event_execute_run(struct udev_event *event, const sigset_t *sigmask)
+void udev_event_execute_run(struct udev_event *event, struct udev_rules *rules, const sigset_t *sigmask)
 {
         struct udev_list_entry *list_entry;
 
         udev_list_entry_foreach(list_entry, udev_list_get_entry(&event->run_list)) {
                 const char *cmd = udev_list_entry_get_name(list_entry);
-                enum udev_builtin_cmd builtin_cmd = udev_list_entry_get_num(list_entry);
+                unsigned int token = udev_list_entry_get_num(list_entry);
+                enum udev_builtin_cmd builtin_cmd = udev_rules_get_run_builtin(rules, token);
+                usec_t usec;
 
                 if (builtin_cmd < UDEV_BUILTIN_MAX) {
                         char command[UTIL_PATH_SIZE];
 
                         udev_event_apply_format(event, cmd, command, sizeof(command));
+                        usec = now(CLOCK_MONOTONIC);
                         udev_builtin_run(event->dev, builtin_cmd, command, false);
                 } else {
                         char program[UTIL_PATH_SIZE];
@@ -956,7 +961,9 @@ void udev_event_execute_run(struct udev_event *event, const sigset_t *sigmask)
 
                         udev_event_apply_format(event, cmd, program, sizeof(program));
                         envp = udev_device_get_properties_envp(event->dev);
+                        usec = now(CLOCK_MONOTONIC);
                         udev_event_spawn(event, program, envp, sigmask, NULL, 0);
                 }
+                udev_rules_account(rules, token, now(CLOCK_MONOTONIC) - usec);
         }
 }
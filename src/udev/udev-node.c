@@ -124,6 +124,52 @@ exit:
         return err;
 }
 
+/*
+ * The claims on a link are kept as symlinks in /run/udev/links/<link>/,
+ * named by the device id and pointing to "<priority>:<devnode>", so the
+ * stack can be resolved without loading the claiming devices.
+ */
+static int link_claim_read(int dfd, const char *name, int *priority, char *devnode, size_t size)
+{
+        char buf[UTIL_PATH_SIZE];
+        ssize_t len;
+        char *colon;
+
+        len = readlinkat(dfd, name, buf, sizeof(buf));
+        if (len < 0)
+                return -errno;
+        if (len == (ssize_t)sizeof(buf))
+                return -EINVAL;
+        buf[len] = '\0';
+
+        colon = strchr(buf, ':');
+        if (colon == NULL || colon[1] != '/')
+                return -EINVAL;
+        colon[0] = '\0';
+        if (safe_atoi(buf, priority) < 0)
+                return -EINVAL;
+        strscpy(devnode, size, &colon[1]);
+        return 0;
+}
+
+/* read a claim of the empty files written by earlier versions, from the device itself */
+static int link_claim_read_device(struct udev *udev, const char *id, int *priority, char *devnode, size_t size)
+{
+        struct udev_device *dev_db;
+        int r = -ENODEV;
+
+        dev_db = udev_device_new_from_device_id(udev, (char *) id);
+        if (dev_db == NULL)
+                return r;
+        if (udev_device_get_devnode(dev_db) != NULL) {
+                *priority = udev_device_get_devlink_priority(dev_db);
+                strscpy(devnode, size, udev_device_get_devnode(dev_db));
+                r = 0;
+        }
+        udev_device_unref(dev_db);
+        return r;
+}
+
 /* find device node of device with highest priority */
 static const char *link_find_prioritized(struct udev_device *dev, bool add, const char *stackdir, char *buf, size_t bufsize)
 {
@@ -142,14 +188,18 @@ static const char *link_find_prioritized(struct udev_device *dev, bool add, cons
         if (dir == NULL)
                 return target;
         for (;;) {
-                struct udev_device *dev_db;
+                char devnode[UTIL_PATH_SIZE];
                 struct dirent *dent;
+                int prio;
+                int r;
 
                 dent = readdir(dir);
                 if (dent == NULL || dent->d_name[0] == '\0')
                         break;
                 if (dent->d_name[0] == '.')
                         continue;
+                if (endswith(dent->d_name, ".tmp"))
+                        continue;
 
                 log_debug("found '%s' claiming '%s'\n", dent->d_name, stackdir);
 
@@ -157,27 +207,97 @@ static const char *link_find_prioritized(struct udev_device *dev, bool add, cons
                 if (streq(dent->d_name, udev_device_get_id_filename(dev)))
                         continue;
 
-                dev_db = udev_device_new_from_device_id(udev, dent->d_name);
-                if (dev_db != NULL) {
-                        const char *devnode;
-
-                        devnode = udev_device_get_devnode(dev_db);
-                        if (devnode != NULL) {
-                                if (target == NULL || udev_device_get_devlink_priority(dev_db) > priority) {
-                                        log_debug("'%s' claims priority %i for '%s'\n",
-                                                  udev_device_get_syspath(dev_db), udev_device_get_devlink_priority(dev_db), stackdir);
-                                        priority = udev_device_get_devlink_priority(dev_db);
-                                        strscpy(buf, bufsize, devnode);
-                                        target = buf;
-                                }
-                        }
-                        udev_device_unref(dev_db);
+                r = link_claim_read(dirfd(dir), dent->d_name, &prio, devnode, sizeof(devnode));
+                if (r == -EINVAL)
+                        r = link_claim_read_device(udev, dent->d_name, &prio, devnode, sizeof(devnode));
+                if (r < 0)
+                        continue;
+
+                if (target == NULL || prio > priority) {
+                        log_debug("'%s' claims priority %i for '%s'\n", dent->d_name, prio, stackdir);
+                        priority = prio;
+                        strscpy(buf, bufsize, devnode);
+                        target = buf;
                 }
         }
         closedir(dir);
         return target;
 }
 
+/*
+ * The current link points to the device with the highest priority of all
+ * other claims. Adding a claim only needs to compare with that one, and
+ * removing one of another device does not change it at all. This keeps
+ * coldplugging many devices claiming the same link linear. Returns NULL
+ * if the current state is not known.
+ */
+static const char *link_find_prioritized_current(struct udev_device *dev, bool add, const char *slink,
+                                                 const char *stackdir, char *buf, size_t bufsize)
+{
+        char id[64];
+        struct stat stats;
+        int fd;
+        int priority;
+        int r;
+
+        if (stat(slink, &stats) < 0)
+                return NULL;
+        if (!S_ISBLK(stats.st_mode) && !S_ISCHR(stats.st_mode))
+                return NULL;
+        snprintf(id, sizeof(id), "%c%u:%u", S_ISBLK(stats.st_mode) ? 'b' : 'c',
+                 major(stats.st_rdev), minor(stats.st_rdev));
+
+        /* our own priority might have changed, or we are going away */
+        if (streq(id, udev_device_get_id_filename(dev)))
+                return NULL;
+
+        fd = open(stackdir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0)
+                return NULL;
+        r = link_claim_read(fd, id, &priority, buf, bufsize);
+        close(fd);
+        if (r < 0)
+                return NULL;
+
+        if (!add || priority > udev_device_get_devlink_priority(dev)) {
+                log_debug("'%s' keeps priority %i for '%s'\n", id, priority, stackdir);
+                return buf;
+        }
+
+        strscpy(buf, bufsize, udev_device_get_devnode(dev));
+        return buf;
+}
+
+static int link_claim_write(struct udev_device *dev, const char *filename)
+{
+        char claim[UTIL_PATH_SIZE];
+        char filename_tmp[UTIL_PATH_SIZE * 2];
+        int err;
+
+        snprintf(claim, sizeof(claim), "%i:%s",
+                 udev_device_get_devlink_priority(dev), udev_device_get_devnode(dev));
+        strscpyl(filename_tmp, sizeof(filename_tmp), filename, ".tmp", NULL);
+        unlink(filename_tmp);
+
+        do {
+                err = mkdir_parents(filename_tmp, 0755);
+                if (err != 0 && err != -ENOENT)
+                        break;
+                err = symlink(claim, filename_tmp);
+                if (err != 0)
+                        err = -errno;
+        } while (err == -ENOENT);
+        if (err != 0)
+                return err;
+
+        /* replaces the claim of an earlier event, or an empty file of an earlier version */
+        if (rename(filename_tmp, filename) < 0) {
+                err = -errno;
+                unlink(filename_tmp);
+        }
+        return err;
+}
+
 /* manage "stack of names" with possibly specified device priorities */
 static void link_update(struct udev_device *dev, const char *slink, bool add)
 {
@@ -195,7 +315,9 @@ static void link_update(struct udev_device *dev, const char *slink, bool add)
         if (!add && unlink(filename) == 0)
                 rmdir(dirname);
 
-        target = link_find_prioritized(dev, add, dirname, buf, sizeof(buf));
+        target = link_find_prioritized_current(dev, add, slink, dirname, buf, sizeof(buf));
+        if (target == NULL)
+                target = link_find_prioritized(dev, add, dirname, buf, sizeof(buf));
         if (target == NULL) {
                 log_debug("no reference left, remove '%s'\n", slink);
                 if (unlink(slink) == 0)
@@ -205,22 +327,8 @@ static void link_update(struct udev_device *dev, const char *slink, bool add)
                 node_symlink(dev, target, slink);
         }
 
-        if (add) {
-                int err;
-
-                do {
-                        int fd;
-
-                        err = mkdir_parents(filename, 0755);
-                        if (err != 0 && err != -ENOENT)
-                                break;
-                        fd = open(filename, O_WRONLY|O_CREAT|O_CLOEXEC|O_TRUNC|O_NOFOLLOW, 0444);
-                        if (fd >= 0)
-                                close(fd);
-                        else
-                                err = -errno;
-                } while (err == -ENOENT);
-        }
+        if (add)
+                link_claim_write(dev, filename);
 }
 
 void udev_node_update_old_links(struct udev_device *dev, struct udev_device *dev_old)
@@ -28,14 +28,20 @@
 #include <dirent.h>
 #include <fnmatch.h>
 #include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "udev.h"
 #include "path-util.h"
 #include "conf-files.h"
 #include "strbuf.h"
+#include "glob-match.h"
 
 #define PREALLOC_TOKEN          2048
 
+#define RULES_CACHE             "/run/udev/rules.cache"
+#define RULES_CACHE_SIG         { 'U', 'D', 'E', 'V', 'R', 'U', 'L', 'E' }
+
 struct uid_gid {
         unsigned int name_off;
         union {
@@ -44,6 +50,29 @@ struct uid_gid {
         };
 };
 
+/* a range of index_rules, the rules which require one value of a key */
+struct rule_index_key {
+        unsigned int value_off;
+        unsigned int first;
+        unsigned int count;
+};
+
+/* a file the rules were compiled from, as it was when it was read */
+struct rules_cache_source {
+        uint64_t mtime_usec;
+        uint64_t size;
+        uint64_t ino;
+        uint32_t path_off;
+        uint32_t unused;
+};
+
+/* time spent in a program or builtin */
+struct rule_stats {
+        unsigned long long int count;
+        usec_t usec;
+        usec_t usec_max;
+};
+
 struct udev_rules {
         struct udev *udev;
         char **dirs;
@@ -58,6 +87,34 @@ struct udev_rules {
         /* all key strings are copied and de-duplicated in a single continous string buffer */
         struct strbuf *strbuf;
 
+        /*
+         * offsets of the rules in the token list, grouped by the SUBSYSTEM or ACTION
+         * value they require, and the rules requiring neither; an event only visits
+         * the rules which may match it
+         */
+        unsigned int *index_rules;
+        unsigned int index_rules_cur;
+        struct rule_index_key *index_subsystems;
+        unsigned int index_subsystems_cur;
+        struct rule_index_key *index_actions;
+        unsigned int index_actions_cur;
+        struct rule_index_key index_any;
+
+        /* the files the rules are compiled from, to tell whether a cache of them is current */
+        struct rules_cache_source *sources;
+        unsigned int sources_cur;
+
+        /* when loaded from the cache, the arrays above point into its mapping */
+        void *cache_map;
+        size_t cache_size;
+
+        /*
+         * one entry per token, followed by one per builtin, shared with the
+         * workers, which account the keys running programs and builtins
+         */
+        struct rule_stats *stats;
+        size_t stats_size;
+
         /* during rule parsing, uid/gid lookup results are cached */
         struct uid_gid *uids;
         unsigned int uids_cur;
@@ -92,8 +149,12 @@ enum string_glob_type {
         GL_UNSET,
         GL_PLAIN,                       /* no special chars */
         GL_GLOB,                        /* shell globs ?,*,[] */
+        GL_PREFIX,                      /* glob with a single trailing "*" */
+        GL_SUFFIX,                      /* glob with a single leading "*" */
+        GL_FNMATCH,                     /* glob with escapes or character classes */
         GL_SPLIT,                       /* multi-value A|B */
         GL_SPLIT_GLOB,                  /* multi-value with glob A*|B* */
+        GL_SPLIT_FNMATCH,               /* multi-value with escapes or character classes */
         GL_SOMETHING,                   /* commonly used "?*" */
 };
 
@@ -232,8 +293,12 @@ static const char *string_glob_str(enum string_glob_type type)
                 [GL_UNSET] =            "UNSET",
                 [GL_PLAIN] =            "plain",
                 [GL_GLOB] =             "glob",
+                [GL_PREFIX] =           "prefix",
+                [GL_SUFFIX] =           "suffix",
+                [GL_FNMATCH] =          "fnmatch",
                 [GL_SPLIT] =            "split",
                 [GL_SPLIT_GLOB] =       "split-glob",
+                [GL_SPLIT_FNMATCH] =    "split-fnmatch",
                 [GL_SOMETHING] =        "split-glob",
         };
 
@@ -957,20 +1022,34 @@ static int rule_add_key(struct rule_tmp *rule_tmp, enum token_type type,
         }
 
         if (value != NULL && type < TK_M_MAX) {
-                /* check if we need to split or call fnmatch() while matching rules */
+                /*
+                 * check if we need to split or match a glob while matching rules, and
+                 * pick the cheapest way to match the glob; only patterns with escapes
+                 * or character classes still need fnmatch()
+                 */
                 enum string_glob_type glob;
                 int has_split;
                 int has_glob;
+                size_t len;
+                bool simple;
 
+                len = strlen(value);
+                simple = glob_simple(value, len);
                 has_split = (strchr(value, '|') != NULL);
                 has_glob = (strchr(value, '*') != NULL || strchr(value, '?') != NULL || strchr(value, '[') != NULL);
                 if (has_split && has_glob) {
-                        glob = GL_SPLIT_GLOB;
+                        glob = simple ? GL_SPLIT_GLOB : GL_SPLIT_FNMATCH;
                 } else if (has_split) {
                         glob = GL_SPLIT;
                 } else if (has_glob) {
                         if (streq(value, "?*"))
                                 glob = GL_SOMETHING;
+                        else if (!simple)
+                                glob = GL_FNMATCH;
+                        else if (value[len-1] == '*' && strcspn(value, "*?[") == len-1)
+                                glob = GL_PREFIX;
+                        else if (value[0] == '*' && strcspn(&value[1], "*?[") == len-1)
+                                glob = GL_SUFFIX;
                         else
                                 glob = GL_GLOB;
                 } else {
@@ -1575,6 +1654,518 @@ static int parse_file(struct udev_rules *rules, const char *filename)
         return 0;
 }
 
+struct rule_index_tmp {
+        enum token_type type;
+        unsigned int value_off;
+        unsigned int rule;
+};
+
+static int rule_index_tmp_cmp(const void *a, const void *b, void *data)
+{
+        struct udev_rules *rules = data;
+        const struct rule_index_tmp *x = a;
+        const struct rule_index_tmp *y = b;
+
+        if (x->type != y->type)
+                return x->type < y->type ? -1 : 1;
+        if (x->type != TK_UNSET) {
+                int r;
+
+                r = strcmp(rules_str(rules, x->value_off), rules_str(rules, y->value_off));
+                if (r != 0)
+                        return r;
+        }
+        if (x->rule != y->rule)
+                return x->rule < y->rule ? -1 : 1;
+        return 0;
+}
+
+/*
+ * The key a rule is indexed by: a SUBSYSTEM or ACTION match against plain
+ * values. Both are checked before anything with side effects, and never
+ * change while processing an event, so skipping the rule for an event
+ * with other values is the same as failing on the key.
+ */
+static struct token *rule_index_token(struct udev_rules *rules, unsigned int rule)
+{
+        struct token *action = NULL;
+        unsigned int i;
+
+        for (i = rule+1; i < rule + rules->tokens[rule].rule.token_count; i++) {
+                struct token *key = &rules->tokens[i];
+
+                if (key->key.op != OP_MATCH)
+                        continue;
+                if (key->key.glob != GL_PLAIN && key->key.glob != GL_SPLIT)
+                        continue;
+                if (key->type == TK_M_SUBSYSTEM)
+                        return key;
+                if (key->type == TK_M_ACTION && action == NULL)
+                        action = key;
+        }
+        return action;
+}
+
+static int rule_index_tmp_add(struct rule_index_tmp **tmp, unsigned int *tmp_cur, unsigned int *tmp_max,
+                              enum token_type type, unsigned int value_off, unsigned int rule)
+{
+        if (*tmp_cur >= *tmp_max) {
+                struct rule_index_tmp *t;
+                unsigned int add;
+
+                add = *tmp_max;
+                if (add < 64)
+                        add = 64;
+
+                t = realloc(*tmp, (*tmp_max + add) * sizeof(struct rule_index_tmp));
+                if (t == NULL)
+                        return -1;
+                *tmp = t;
+                *tmp_max += add;
+        }
+        (*tmp)[*tmp_cur].type = type;
+        (*tmp)[*tmp_cur].value_off = value_off;
+        (*tmp)[*tmp_cur].rule = rule;
+        (*tmp_cur)++;
+        return 0;
+}
+
+static int index_rules(struct udev_rules *rules)
+{
+        struct rule_index_tmp *tmp = NULL;
+        unsigned int tmp_cur = 0;
+        unsigned int tmp_max = 0;
+        unsigned int n_subsystems = 0;
+        unsigned int n_actions = 0;
+        unsigned int n = 0;
+        unsigned int i;
+        int err = -1;
+
+        for (i = 0; i < rules->token_cur && rules->tokens[i].type == TK_RULE; i += rules->tokens[i].rule.token_count) {
+                struct token *key;
+                char value[UTIL_PATH_SIZE];
+                char *s, *next;
+
+                key = rule_index_token(rules, i);
+                if (key == NULL) {
+                        if (rule_index_tmp_add(&tmp, &tmp_cur, &tmp_max, TK_UNSET, 0, i) != 0)
+                                goto out;
+                        continue;
+                }
+
+                if (key->key.glob == GL_PLAIN) {
+                        if (rule_index_tmp_add(&tmp, &tmp_cur, &tmp_max, key->type, key->key.value_off, i) != 0)
+                                goto out;
+                        continue;
+                }
+
+                /* file the rule under every alternative value */
+                strscpy(value, sizeof(value), rules_str(rules, key->key.value_off));
+                for (s = value; s != NULL; s = next) {
+                        ssize_t off;
+
+                        next = strchr(s, '|');
+                        if (next != NULL) {
+                                next[0] = '\0';
+                                next++;
+                        }
+
+                        off = strbuf_add_string(rules->strbuf, s, strlen(s));
+                        if (off < 0)
+                                goto out;
+                        if (rule_index_tmp_add(&tmp, &tmp_cur, &tmp_max, key->type, off, i) != 0)
+                                goto out;
+                }
+        }
+
+        if (tmp_cur == 0) {
+                err = 0;
+                goto out;
+        }
+
+        /* group by key and value, keep the order of the rules within each group */
+        qsort_r(tmp, tmp_cur, sizeof(struct rule_index_tmp), rule_index_tmp_cmp, rules);
+
+        rules->index_rules = malloc(tmp_cur * sizeof(unsigned int));
+        rules->index_subsystems = malloc(tmp_cur * sizeof(struct rule_index_key));
+        rules->index_actions = malloc(tmp_cur * sizeof(struct rule_index_key));
+        if (rules->index_rules == NULL || rules->index_subsystems == NULL || rules->index_actions == NULL)
+                goto out;
+
+        for (i = 0; i < tmp_cur; i++) {
+                struct rule_index_key *key;
+                bool new_value;
+
+                /* a rule listing the same value twice */
+                if (i > 0 && rule_index_tmp_cmp(&tmp[i], &tmp[i-1], rules) == 0)
+                        continue;
+
+                new_value = i == 0 || tmp[i].type != tmp[i-1].type ||
+                            !streq(rules_str(rules, tmp[i].value_off), rules_str(rules, tmp[i-1].value_off));
+
+                switch (tmp[i].type) {
+                case TK_M_SUBSYSTEM:
+                        if (new_value)
+                                n_subsystems++;
+                        key = &rules->index_subsystems[n_subsystems-1];
+                        break;
+                case TK_M_ACTION:
+                        if (new_value)
+                                n_actions++;
+                        key = &rules->index_actions[n_actions-1];
+                        break;
+                default:
+                        key = &rules->index_any;
+                        new_value = i == 0 || tmp[i].type != tmp[i-1].type;
+                        break;
+                }
+
+                if (new_value) {
+                        key->value_off = tmp[i].value_off;
+                        key->first = n;
+                        key->count = 0;
+                }
+                rules->index_rules[n++] = tmp[i].rule;
+                key->count++;
+        }
+        rules->index_rules_cur = n;
+        rules->index_subsystems_cur = n_subsystems;
+        rules->index_actions_cur = n_actions;
+        err = 0;
+out:
+        if (err != 0) {
+                free(rules->index_rules);
+                rules->index_rules = NULL;
+                free(rules->index_subsystems);
+                rules->index_subsystems = NULL;
+                free(rules->index_actions);
+                rules->index_actions = NULL;
+        }
+        free(tmp);
+        return err;
+}
+
+/*
+ * The compiled rules are kept in RULES_CACHE, to not parse all rules files again
+ * on every start of udevd or udevadm test as long as none of them changed. The
+ * token array, string buffer and index are stored as they are in memory, so the
+ * cache is only valid for the build which wrote it.
+ */
+struct rules_cache_header {
+        uint8_t signature[8];
+        uint64_t tool_version;
+        uint64_t file_size;
+
+        /* layout of the build which wrote the cache */
+        uint64_t header_size;
+        uint64_t token_size;
+        uint64_t source_size;
+        uint64_t token_types;
+        uint64_t builtins;
+
+        int64_t resolve_names;
+
+        uint64_t sources_off;
+        uint64_t sources_count;
+        uint64_t tokens_off;
+        uint64_t tokens_count;
+        uint64_t strings_off;
+        uint64_t strings_len;
+        uint64_t index_rules_off;
+        uint64_t index_rules_count;
+        uint64_t index_subsystems_off;
+        uint64_t index_subsystems_count;
+        uint64_t index_actions_off;
+        uint64_t index_actions_count;
+        struct rule_index_key index_any;
+        uint32_t unused;
+};
+
+static void rules_add_source(struct udev_rules *rules, const char *path)
+{
+        struct rules_cache_source *source = &rules->sources[rules->sources_cur++];
+        struct stat st;
+
+        /* a missing file is recorded as such */
+        source->path_off = rules_add_string(rules, path);
+        if (stat(path, &st) < 0)
+                return;
+        source->mtime_usec = timespec_load(&st.st_mtim);
+        source->size = st.st_size;
+        source->ino = st.st_ino;
+}
+
+static bool rules_cache_section_valid(uint64_t off, uint64_t count, size_t size, size_t file_size)
+{
+        return off % 8 == 0 && off <= file_size && count <= (file_size - off) / size;
+}
+
+static bool rules_cache_key_valid(const struct rules_cache_header *h, const struct rule_index_key *key)
+{
+        return key->value_off < h->strings_len &&
+               key->first <= h->index_rules_count &&
+               key->count <= h->index_rules_count - key->first;
+}
+
+/* check that the cache was written by us, from the current rules files, and is consistent */
+static bool rules_cache_valid(struct udev_rules *rules, const uint8_t *map, size_t size)
+{
+        const char sig[] = RULES_CACHE_SIG;
+        const struct rules_cache_header *h = (const struct rules_cache_header *)map;
+        const struct rules_cache_source *sources;
+        const struct token *tokens;
+        const char *strings;
+        const unsigned int *index_rules;
+        const struct rule_index_key *keys;
+        uint64_t i;
+
+        if (memcmp(h->signature, sig, sizeof(h->signature)) != 0 ||
+            h->tool_version != (uint64_t) atoi(VERSION) ||
+            h->file_size != size ||
+            h->header_size != sizeof(struct rules_cache_header) ||
+            h->token_size != sizeof(struct token) ||
+            h->source_size != sizeof(struct rules_cache_source) ||
+            h->token_types != TK_END ||
+            h->builtins != UDEV_BUILTIN_MAX ||
+            h->resolve_names != rules->resolve_names)
+                return false;
+
+        if (!rules_cache_section_valid(h->sources_off, h->sources_count, sizeof(struct rules_cache_source), size) ||
+            !rules_cache_section_valid(h->tokens_off, h->tokens_count, sizeof(struct token), size) ||
+            !rules_cache_section_valid(h->strings_off, h->strings_len, 1, size) ||
+            !rules_cache_section_valid(h->index_rules_off, h->index_rules_count, sizeof(unsigned int), size) ||
+            !rules_cache_section_valid(h->index_subsystems_off, h->index_subsystems_count, sizeof(struct rule_index_key), size) ||
+            !rules_cache_section_valid(h->index_actions_off, h->index_actions_count, sizeof(struct rule_index_key), size))
+                return false;
+
+        if (h->tokens_count == 0 || h->tokens_count >= UINT_MAX || h->strings_len == 0 || h->strings_len >= UINT_MAX)
+                return false;
+
+        strings = (const char *)map + h->strings_off;
+        if (strings[h->strings_len-1] != '\0')
+                return false;
+
+        /* the same files, unchanged */
+        sources = (const struct rules_cache_source *)(map + h->sources_off);
+        if (h->sources_count != rules->sources_cur)
+                return false;
+        for (i = 0; i < h->sources_count; i++) {
+                if (sources[i].path_off >= h->strings_len ||
+                    !streq(strings + sources[i].path_off, rules_str(rules, rules->sources[i].path_off)) ||
+                    sources[i].mtime_usec != rules->sources[i].mtime_usec ||
+                    sources[i].size != rules->sources[i].size ||
+                    sources[i].ino != rules->sources[i].ino)
+                        return false;
+        }
+
+        /* a list of rules up to the end token, which only refer to strings and rules in the cache */
+        tokens = (const struct token *)(map + h->tokens_off);
+        if (tokens[h->tokens_count-1].type != TK_END)
+                return false;
+        i = 0;
+        while (tokens[i].type == TK_RULE) {
+                uint64_t n = tokens[i].rule.token_count;
+                uint64_t j;
+
+                if (n == 0 || n > h->tokens_count-1 - i)
+                        return false;
+                if (tokens[i].rule.label_off >= h->strings_len || tokens[i].rule.filename_off >= h->strings_len)
+                        return false;
+
+                for (j = i+1; j < i+n; j++) {
+                        const struct token *key = &tokens[j];
+
+                        if (key->type <= TK_RULE || key->type >= TK_END)
+                                return false;
+                        if (key->key.value_off >= h->strings_len)
+                                return false;
+
+                        switch (key->type) {
+                        case TK_M_ENV:
+                        case TK_M_ATTR:
+                        case TK_M_ATTRS:
+                        case TK_A_ATTR:
+                        case TK_A_ENV:
+                                if (key->key.attr_off >= h->strings_len)
+                                        return false;
+                                break;
+                        case TK_A_GOTO:
+                                /* only ever forward */
+                                if (key->key.rule_goto != 0 &&
+                                    (key->key.rule_goto <= j || key->key.rule_goto >= h->tokens_count ||
+                                     tokens[key->key.rule_goto].type != TK_RULE))
+                                        return false;
+                                break;
+                        default:
+                                break;
+                        }
+                }
+                i += n;
+        }
+        if (i != h->tokens_count-1)
+                return false;
+
+        index_rules = (const unsigned int *)(map + h->index_rules_off);
+        for (i = 0; i < h->index_rules_count; i++)
+                if (index_rules[i] >= h->tokens_count || tokens[index_rules[i]].type != TK_RULE)
+                        return false;
+
+        keys = (const struct rule_index_key *)(map + h->index_subsystems_off);
+        for (i = 0; i < h->index_subsystems_count; i++)
+                if (!rules_cache_key_valid(h, &keys[i]))
+                        return false;
+        keys = (const struct rule_index_key *)(map + h->index_actions_off);
+        for (i = 0; i < h->index_actions_count; i++)
+                if (!rules_cache_key_valid(h, &keys[i]))
+                        return false;
+        if (!rules_cache_key_valid(h, &h->index_any))
+                return false;
+
+        return true;
+}
+
+static int rules_cache_load(struct udev_rules *rules)
+{
+        const struct rules_cache_header *h;
+        struct strbuf *strbuf;
+        uint8_t *map;
+        struct stat st;
+        int fd;
+
+        if (rules->sources == NULL)
+                return -1;
+
+        fd = open(RULES_CACHE, O_RDONLY|O_CLOEXEC);
+        if (fd < 0)
+                return -1;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct rules_cache_header)) {
+                close(fd);
+                return -1;
+        }
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+                return -1;
+
+        h = (const struct rules_cache_header *)map;
+        if (!rules_cache_valid(rules, map, st.st_size)) {
+                log_debug("rules cache '%s' is out of date\n", RULES_CACHE);
+                munmap(map, st.st_size);
+                return -1;
+        }
+
+        strbuf = calloc(1, sizeof(struct strbuf));
+        if (strbuf == NULL) {
+                munmap(map, st.st_size);
+                return -1;
+        }
+        strbuf->buf = (char *)map + h->strings_off;
+        strbuf->len = h->strings_len;
+
+        /* drop what was collected to check the cache */
+        free(rules->tokens);
+        strbuf_cleanup(rules->strbuf);
+        free(rules->sources);
+
+        rules->tokens = (struct token *)(map + h->tokens_off);
+        rules->token_cur = h->tokens_count;
+        rules->token_max = h->tokens_count;
+        rules->strbuf = strbuf;
+        rules->sources = (struct rules_cache_source *)(map + h->sources_off);
+        rules->sources_cur = h->sources_count;
+        if (h->index_rules_count > 0) {
+                rules->index_rules = (unsigned int *)(map + h->index_rules_off);
+                rules->index_rules_cur = h->index_rules_count;
+                rules->index_subsystems = (struct rule_index_key *)(map + h->index_subsystems_off);
+                rules->index_subsystems_cur = h->index_subsystems_count;
+                rules->index_actions = (struct rule_index_key *)(map + h->index_actions_off);
+                rules->index_actions_cur = h->index_actions_count;
+                rules->index_any = h->index_any;
+        }
+        rules->cache_map = map;
+        rules->cache_size = st.st_size;
+        return 0;
+}
+
+static void rules_cache_write_section(FILE *f, uint64_t off, const void *p, size_t size)
+{
+        if (size == 0)
+                return;
+        fseeko(f, off, SEEK_SET);
+        fwrite(p, size, 1, f);
+}
+
+int udev_rules_write_cache(struct udev_rules *rules)
+{
+        struct rules_cache_header h = {
+                .signature = RULES_CACHE_SIG,
+                .tool_version = atoi(VERSION),
+                .header_size = sizeof(struct rules_cache_header),
+                .token_size = sizeof(struct token),
+                .source_size = sizeof(struct rules_cache_source),
+                .token_types = TK_END,
+                .builtins = UDEV_BUILTIN_MAX,
+        };
+        FILE *f;
+        char *filename_tmp;
+        int err;
+
+        /* nothing new to store */
+        if (rules->cache_map != NULL)
+                return 0;
+        if (rules->sources == NULL)
+                return -ENOMEM;
+
+        h.resolve_names = rules->resolve_names;
+        h.sources_off = ALIGN_TO(sizeof(struct rules_cache_header), 8);
+        h.sources_count = rules->sources_cur;
+        h.tokens_off = ALIGN_TO(h.sources_off + h.sources_count * sizeof(struct rules_cache_source), 8);
+        h.tokens_count = rules->token_cur;
+        h.strings_off = ALIGN_TO(h.tokens_off + h.tokens_count * sizeof(struct token), 8);
+        h.strings_len = rules->strbuf->len;
+        h.index_rules_off = ALIGN_TO(h.strings_off + h.strings_len, 8);
+        h.index_subsystems_off = h.index_rules_off;
+        h.index_actions_off = h.index_rules_off;
+        if (rules->index_rules != NULL) {
+                h.index_rules_count = rules->index_rules_cur;
+                h.index_subsystems_off = ALIGN_TO(h.index_rules_off + h.index_rules_count * sizeof(unsigned int), 8);
+                h.index_subsystems_count = rules->index_subsystems_cur;
+                h.index_actions_off = ALIGN_TO(h.index_subsystems_off + h.index_subsystems_count * sizeof(struct rule_index_key), 8);
+                h.index_actions_count = rules->index_actions_cur;
+                h.index_any = rules->index_any;
+        }
+        h.file_size = h.index_actions_off + h.index_actions_count * sizeof(struct rule_index_key);
+
+        err = fopen_temporary(RULES_CACHE, &f, &filename_tmp);
+        if (err < 0) {
+                log_debug("failed to write rules cache '%s': %s\n", RULES_CACHE, strerror(-err));
+                return err;
+        }
+        fchmod(fileno(f), 0644);
+
+        rules_cache_write_section(f, h.sources_off, rules->sources, h.sources_count * sizeof(struct rules_cache_source));
+        rules_cache_write_section(f, h.tokens_off, rules->tokens, h.tokens_count * sizeof(struct token));
+        rules_cache_write_section(f, h.strings_off, rules->strbuf->buf, h.strings_len);
+        rules_cache_write_section(f, h.index_rules_off, rules->index_rules, h.index_rules_count * sizeof(unsigned int));
+        rules_cache_write_section(f, h.index_subsystems_off, rules->index_subsystems,
+                                  h.index_subsystems_count * sizeof(struct rule_index_key));
+        rules_cache_write_section(f, h.index_actions_off, rules->index_actions,
+                                  h.index_actions_count * sizeof(struct rule_index_key));
+        rules_cache_write_section(f, 0, &h, sizeof(struct rules_cache_header));
+
+        fflush(f);
+        err = ferror(f) ? -EIO : 0;
+        fclose(f);
+        if (err == 0 && rename(filename_tmp, RULES_CACHE) < 0)
+                err = -errno;
+        if (err < 0) {
+                log_debug("failed to write rules cache '%s': %s\n", RULES_CACHE, strerror(-err));
+                unlink(filename_tmp);
+        }
+        free(filename_tmp);
+        return err;
+}
+
 struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names)
 {
         struct udev_rules *rules;
@@ -1628,9 +2219,29 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names)
         /*
          * The offset value in the rules strct is limited; add all
          * rules file names to the beginning of the string buffer.
+         * Look at them before parsing, so that changes while they are
+         * parsed invalidate the cache written from the result.
          */
-        STRV_FOREACH(f, files)
-                rules_add_string(rules, *f);
+        rules->sources = calloc(strv_length(files) + 2, sizeof(struct rules_cache_source));
+        STRV_FOREACH(f, files) {
+                if (rules->sources != NULL)
+                        rules_add_source(rules, *f);
+                else
+                        rules_add_string(rules, *f);
+        }
+
+        /* users and groups are resolved while parsing */
+        if (rules->sources != NULL && resolve_names > 0) {
+                rules_add_source(rules, "/etc/passwd");
+                rules_add_source(rules, "/etc/group");
+        }
+
+        if (rules_cache_load(rules) == 0) {
+                log_debug("rules loaded from '%s'\n", RULES_CACHE);
+                strv_free(files);
+                dump_rules(rules);
+                return rules;
+        }
 
         STRV_FOREACH(f, files)
                 parse_file(rules, *f);
@@ -1643,6 +2254,12 @@ struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names)
         log_debug("rules contain %zu bytes tokens (%u * %zu bytes), %zu bytes strings\n",
                   rules->token_max * sizeof(struct token), rules->token_max, sizeof(struct token), rules->strbuf->len);
 
+        if (index_rules(rules) != 0)
+                log_error("failed to index rules, matching all of them against every event\n");
+        else
+                log_debug("rules indexed by %u subsystems and %u actions, %u rules match any event\n",
+                          rules->index_subsystems_cur, rules->index_actions_cur, rules->index_any.count);
+
         /* cleanup temporary strbuf data */
         log_debug("%zu strings (%zu bytes), %zu de-duplicated (%zu bytes), %zu trie nodes used\n",
                   rules->strbuf->in_count, rules->strbuf->in_len,
@@ -1667,8 +2284,20 @@ struct udev_rules *udev_rules_unref(struct udev_rules *rules)
 {
         if (rules == NULL)
                 return NULL;
-        free(rules->tokens);
-        strbuf_cleanup(rules->strbuf);
+        if (rules->stats != NULL)
+                munmap(rules->stats, rules->stats_size);
+        if (rules->cache_map != NULL) {
+                /* the arrays and strings are part of the mapping */
+                munmap(rules->cache_map, rules->cache_size);
+                free(rules->strbuf);
+        } else {
+                free(rules->tokens);
+                free(rules->index_rules);
+                free(rules->index_subsystems);
+                free(rules->index_actions);
+                free(rules->sources);
+                strbuf_cleanup(rules->strbuf);
+        }
         free(rules->uids);
         free(rules->gids);
         strv_free(rules->dirs);
@@ -1721,6 +2350,15 @@ static int match_key(struct udev_rules *rules, struct token *token, const char *
                 match = (streq(key_value, val));
                 break;
         case GL_GLOB:
+                match = glob_match(key_value, strlen(key_value), val);
+                break;
+        case GL_PREFIX:
+                match = strneq(val, key_value, strlen(key_value)-1);
+                break;
+        case GL_SUFFIX:
+                match = (endswith(val, &key_value[1]) != NULL);
+                break;
+        case GL_FNMATCH:
                 match = (fnmatch(key_value, val, 0) == 0);
                 break;
         case GL_SPLIT:
@@ -1749,6 +2387,23 @@ static int match_key(struct udev_rules *rules, struct token *token, const char *
                         break;
                 }
         case GL_SPLIT_GLOB:
+                {
+                        const char *s;
+
+                        /* match the alternatives in place */
+                        s = key_value;
+                        for (;;) {
+                                const char *next;
+
+                                next = strchr(s, '|');
+                                match = glob_match(s, next != NULL ? (size_t)(next - s) : strlen(s), val);
+                                if (match || next == NULL)
+                                        break;
+                                s = &next[1];
+                        }
+                        break;
+                }
+        case GL_SPLIT_FNMATCH:
                 {
                         char value[UTIL_PATH_SIZE];
 
@@ -1830,18 +2485,241 @@ static int match_attr(struct udev_rules *rules, struct udev_device *dev, struct
         return match_key(rules, cur, value);
 }
 
+/* rules of one index key not visited yet */
+struct rule_cursor {
+        const unsigned int *rules;
+        unsigned int count;
+};
+
+static const struct rule_index_key *rule_index_find(struct udev_rules *rules,
+                                                    const struct rule_index_key *keys, unsigned int n,
+                                                    const char *value)
+{
+        unsigned int lo = 0;
+        unsigned int hi = n;
+
+        if (value == NULL)
+                value = "";
+
+        while (lo < hi) {
+                unsigned int mid = (lo + hi) / 2;
+                int r;
+
+                r = strcmp(value, rules_str(rules, keys[mid].value_off));
+                if (r == 0)
+                        return &keys[mid];
+                if (r < 0)
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+        return NULL;
+}
+
+static void rule_cursor_add(struct udev_rules *rules, struct rule_cursor *cursors, unsigned int *n,
+                            const struct rule_index_key *key)
+{
+        if (key == NULL || key->count == 0)
+                return;
+        cursors[*n].rules = &rules->index_rules[key->first];
+        cursors[*n].count = key->count;
+        (*n)++;
+}
+
+/* the first rule at or after the token offset "from" of any cursor, UINT_MAX if none is left */
+static unsigned int rule_cursor_next(struct rule_cursor *cursors, unsigned int n, unsigned int from)
+{
+        unsigned int next = UINT_MAX;
+        unsigned int i;
+
+        for (i = 0; i < n; i++) {
+                while (cursors[i].count > 0 && cursors[i].rules[0] < from) {
+                        cursors[i].rules++;
+                        cursors[i].count--;
+                }
+                if (cursors[i].count > 0 && cursors[i].rules[0] < next)
+                        next = cursors[i].rules[0];
+        }
+        return next;
+}
+
 enum escape_type {
         ESCAPE_UNSET,
         ESCAPE_NONE,
         ESCAPE_REPLACE,
 };
 
+static void stats_add(struct rule_stats *stats, usec_t usec)
+{
+        usec_t max;
+
+        __sync_fetch_and_add(&stats->count, 1);
+        __sync_fetch_and_add(&stats->usec, usec);
+        max = stats->usec_max;
+        while (usec > max && !__sync_bool_compare_and_swap(&stats->usec_max, max, usec))
+                max = stats->usec_max;
+}
+
+/* the counters are mapped before the workers are forked, which then all update them */
+int udev_rules_enable_stats(struct udev_rules *rules)
+{
+        size_t size;
+        void *p;
+
+        if (rules->stats != NULL)
+                return 0;
+
+        size = PAGE_ALIGN((rules->token_cur + UDEV_BUILTIN_MAX) * sizeof(struct rule_stats));
+        p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+                return -1;
+
+        rules->stats = p;
+        rules->stats_size = size;
+        return 0;
+}
+
+/* the builtin to run for a RUN key, or UDEV_BUILTIN_MAX for a program */
+enum udev_builtin_cmd udev_rules_get_run_builtin(struct udev_rules *rules, unsigned int token)
+{
+        return rules->tokens[token].key.builtin_cmd;
+}
+
+void udev_rules_account(struct udev_rules *rules, unsigned int token, usec_t usec)
+{
+        struct token *cur;
+
+        if (rules->stats == NULL || token >= rules->token_cur)
+                return;
+
+        stats_add(&rules->stats[token], usec);
+
+        cur = &rules->tokens[token];
+        if ((cur->type == TK_M_IMPORT_BUILTIN || cur->type == TK_A_RUN_BUILTIN) &&
+            cur->key.builtin_cmd < UDEV_BUILTIN_MAX)
+                stats_add(&rules->stats[rules->token_cur + cur->key.builtin_cmd], usec);
+}
+
+struct rule_stats_entry {
+        unsigned int rule;
+        unsigned int key;
+        usec_t usec;
+};
+
+static int rule_stats_entry_compare(const void *a, const void *b)
+{
+        const struct rule_stats_entry *x = a, *y = b;
+
+        if (x->usec > y->usec)
+                return -1;
+        if (x->usec < y->usec)
+                return 1;
+        return 0;
+}
+
+static const char *stats_key_str(enum token_type type)
+{
+        switch (type) {
+        case TK_M_PROGRAM:
+                return "PROGRAM";
+        case TK_M_IMPORT_PROG:
+                return "IMPORT{program}";
+        case TK_M_IMPORT_BUILTIN:
+                return "IMPORT{builtin}";
+        case TK_A_RUN_BUILTIN:
+                return "RUN{builtin}";
+        default:
+                return "RUN{program}";
+        }
+}
+
+/* log the keys which took the most time so far, and how long each builtin took */
+void udev_rules_log_stats(struct udev_rules *rules, unsigned int max)
+{
+        struct rule_stats_entry *entries;
+        unsigned int n = 0;
+        unsigned int rule = 0;
+        unsigned int i;
+
+        if (rules->stats == NULL)
+                return;
+
+        entries = new(struct rule_stats_entry, rules->token_cur);
+        if (entries == NULL)
+                return;
+
+        for (i = 0; i < rules->token_cur; i++) {
+                if (rules->tokens[i].type == TK_RULE) {
+                        rule = i;
+                        continue;
+                }
+                if (rules->stats[i].count == 0)
+                        continue;
+                entries[n].rule = rule;
+                entries[n].key = i;
+                entries[n].usec = rules->stats[i].usec;
+                n++;
+        }
+        qsort(entries, n, sizeof(struct rule_stats_entry), rule_stats_entry_compare);
+
+        if (n > 0)
+                log_info("%u keys ran programs or builtins, the %u taking the most time:\n", n, MIN(n, max));
+        for (i = 0; i < n && i < max; i++) {
+                struct token *r = &rules->tokens[entries[i].rule];
+                struct token *key = &rules->tokens[entries[i].key];
+                struct rule_stats *stats = &rules->stats[entries[i].key];
+
+                log_info("%s:%u %s '%s': %llu runs, total %llu avg %llu max %llu usec\n",
+                         rules_str(rules, r->rule.filename_off), r->rule.filename_line,
+                         stats_key_str(key->type), rules_str(rules, key->key.value_off),
+                         stats->count, (unsigned long long) stats->usec,
+                         (unsigned long long) (stats->usec / stats->count),
+                         (unsigned long long) stats->usec_max);
+        }
+        free(entries);
+
+        for (i = 0; i < UDEV_BUILTIN_MAX; i++) {
+                struct rule_stats *stats = &rules->stats[rules->token_cur + i];
+
+                if (stats->count == 0)
+                        continue;
+                log_info("builtin '%s': %llu runs, total %llu avg %llu max %llu usec\n",
+                         udev_builtin_name(i),
+                         stats->count, (unsigned long long) stats->usec,
+                         (unsigned long long) (stats->usec / stats->count),
+                         (unsigned long long) stats->usec_max);
+        }
+}
+
+/* remember how long a program or builtin of a rule took, for udevadm test */
+static void rule_timing(struct udev_event *event, struct udev_rules *rules, struct token *rule,
+                        struct token *cur, const char *key, const char *cmd, usec_t start)
+{
+        char name[UTIL_PATH_SIZE];
+        char usec[DECIMAL_STR_MAX(usec_t)];
+        usec_t t;
+
+        t = now(CLOCK_MONOTONIC) - start;
+        log_debug("%s '%s' took %llu usec\n", key, cmd, (unsigned long long) t);
+        udev_rules_account(rules, cur - rules->tokens, t);
+
+        if (!event->timing)
+                return;
+
+        snprintf(name, sizeof(name), "%s:%u %s '%s'",
+                 rules_str(rules, rule->rule.filename_off), rule->rule.filename_line, key, cmd);
+        snprintf(usec, sizeof(usec), "%llu", (unsigned long long) t);
+        udev_list_entry_add(&event->timing_list, name, usec);
+}
+
 int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event, const sigset_t *sigmask)
 {
         struct token *cur;
         struct token *rule;
         enum escape_type esc = ESCAPE_UNSET;
         bool can_set_name;
+        struct rule_cursor cursors[3];
+        unsigned int cursors_cur = 0;
 
         if (rules->tokens == NULL)
                 return -1;
@@ -1850,6 +2728,17 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                         (major(udev_device_get_devnum(event->dev)) > 0 ||
                          udev_device_get_ifindex(event->dev) > 0));
 
+        /* only rules filed under the subsystem and action of the event, or under none, can match */
+        if (rules->index_rules != NULL) {
+                rule_cursor_add(rules, cursors, &cursors_cur, &rules->index_any);
+                rule_cursor_add(rules, cursors, &cursors_cur,
+                                rule_index_find(rules, rules->index_subsystems, rules->index_subsystems_cur,
+                                                udev_device_get_subsystem(event->dev)));
+                rule_cursor_add(rules, cursors, &cursors_cur,
+                                rule_index_find(rules, rules->index_actions, rules->index_actions_cur,
+                                                udev_device_get_action(event->dev)));
+        }
+
         /* loop through token list, match, run actions or forward to next rule */
         cur = &rules->tokens[0];
         rule = cur;
@@ -1857,6 +2746,19 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                 dump_token(rules, cur);
                 switch (cur->type) {
                 case TK_RULE:
+                        /* fast-forward to the next rule which may match */
+                        if (rules->index_rules != NULL) {
+                                unsigned int next;
+
+                                next = rule_cursor_next(cursors, cursors_cur, cur - rules->tokens);
+                                if (next == UINT_MAX)
+                                        return 0;
+                                if (next != (unsigned int) (cur - rules->tokens)) {
+                                        cur = &rules->tokens[next];
+                                        continue;
+                                }
+                        }
+
                         /* current rule */
                         rule = cur;
                         /* possibly skip rules which want to set NAME, SYMLINK, OWNER, GROUP, MODE */
@@ -2039,6 +2941,8 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                         char program[UTIL_PATH_SIZE];
                         char **envp;
                         char result[UTIL_PATH_SIZE];
+                        usec_t usec;
+                        int r;
 
                         free(event->program_result);
                         event->program_result = NULL;
@@ -2049,7 +2953,10 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                   rules_str(rules, rule->rule.filename_off),
                                   rule->rule.filename_line);
 
-                        if (udev_event_spawn(event, program, envp, sigmask, result, sizeof(result)) < 0) {
+                        usec = now(CLOCK_MONOTONIC);
+                        r = udev_event_spawn(event, program, envp, sigmask, result, sizeof(result));
+                        rule_timing(event, rules, rule, cur, "PROGRAM", program, usec);
+                        if (r < 0) {
                                 if (cur->key.op != OP_NOMATCH)
                                         goto nomatch;
                         } else {
@@ -2078,6 +2985,8 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                 }
                 case TK_M_IMPORT_PROG: {
                         char import[UTIL_PATH_SIZE];
+                        usec_t usec;
+                        int r;
 
                         udev_event_apply_format(event, rules_str(rules, cur->key.value_off), import, sizeof(import));
                         log_debug("IMPORT '%s' %s:%u\n",
@@ -2085,13 +2994,18 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                   rules_str(rules, rule->rule.filename_off),
                                   rule->rule.filename_line);
 
-                        if (import_program_into_properties(event, import, sigmask) != 0)
+                        usec = now(CLOCK_MONOTONIC);
+                        r = import_program_into_properties(event, import, sigmask);
+                        rule_timing(event, rules, rule, cur, "IMPORT{program}", import, usec);
+                        if (r != 0)
                                 if (cur->key.op != OP_NOMATCH)
                                         goto nomatch;
                         break;
                 }
                 case TK_M_IMPORT_BUILTIN: {
                         char command[UTIL_PATH_SIZE];
+                        usec_t usec;
+                        int r;
 
                         if (udev_builtin_run_once(cur->key.builtin_cmd)) {
                                 /* check if we ran already */
@@ -2116,7 +3030,10 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                   rules_str(rules, rule->rule.filename_off),
                                   rule->rule.filename_line);
 
-                        if (udev_builtin_run(event->dev, cur->key.builtin_cmd, command, false) != 0) {
+                        usec = now(CLOCK_MONOTONIC);
+                        r = udev_builtin_run(event->dev, cur->key.builtin_cmd, command, false);
+                        rule_timing(event, rules, rule, cur, "IMPORT{builtin}", command, usec);
+                        if (r != 0) {
                                 /* remember failure */
                                 log_debug("IMPORT builtin '%s' returned non-zero\n",
                                           udev_builtin_name(cur->key.builtin_cmd));
@@ -2469,7 +3386,7 @@ int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event
                                   rules_str(rules, rule->rule.filename_off),
                                   rule->rule.filename_line);
                         entry = udev_list_entry_add(&event->run_list, rules_str(rules, cur->key.value_off), NULL);
-                        udev_list_entry_set_num(entry, cur->key.builtin_cmd);
+                        udev_list_entry_set_num(entry, cur - rules->tokens);
                         break;
                 }
                 case TK_A_GOTO:
@@ -29,9 +29,40 @@
 #include <sys/inotify.h>
 
 #include "udev.h"
+#include "hashmap.h"
 
 static int inotify_fd = -1;
 
+/* the device ids of the watch descriptors, to not read the links in
+ * /run/udev/watch/ again for every inotify event; the workers add the
+ * watches, the main daemon learns about them on their first event */
+static Hashmap *watches;
+
+static void watch_remember(int wd, const char *id)
+{
+        char *s;
+
+        if (watches == NULL) {
+                watches = hashmap_new(trivial_hash_func, trivial_compare_func);
+                if (watches == NULL)
+                        return;
+        }
+
+        s = strdup(id);
+        if (s == NULL)
+                return;
+
+        free(hashmap_remove(watches, INT_TO_PTR(wd)));
+        if (hashmap_put(watches, INT_TO_PTR(wd), s) < 0)
+                free(s);
+}
+
+/* forget the device of a watch descriptor, the kernel may hand it out again */
+void udev_watch_invalidate(int wd)
+{
+        free(hashmap_remove(watches, INT_TO_PTR(wd)));
+}
+
 /* inotify descriptor, will be shared with rules directory;
  * set to cloexec since we need our children to be able to add
  * watches for us
@@ -117,6 +148,7 @@ void udev_watch_begin(struct udev *udev, struct udev_device *dev)
         r = symlink(udev_device_get_id_filename(dev), filename);
         if (r < 0)
                 log_error("Failed to create symlink: %m");
+        watch_remember(wd, udev_device_get_id_filename(dev));
 
         udev_device_set_watch_handle(dev, wd);
 }
@@ -138,6 +170,7 @@ void udev_watch_end(struct udev *udev, struct udev_device *dev)
 
         snprintf(filename, sizeof(filename), "/run/udev/watch/%d", wd);
         unlink(filename);
+        udev_watch_invalidate(wd);
 
         udev_device_set_watch_handle(dev, -1);
 }
@@ -146,16 +179,22 @@ struct udev_device *udev_watch_lookup(struct udev *udev, int wd)
 {
         char filename[UTIL_PATH_SIZE];
         char device[UTIL_NAME_SIZE];
+        char *id;
         ssize_t len;
 
         if (inotify_fd < 0 || wd < 0)
                 return NULL;
 
+        id = hashmap_get(watches, INT_TO_PTR(wd));
+        if (id != NULL)
+                return udev_device_new_from_device_id(udev, id);
+
         snprintf(filename, sizeof(filename), "/run/udev/watch/%d", wd);
         len = readlink(filename, device, sizeof(device));
         if (len <= 0 || (size_t)len == sizeof(device))
                 return NULL;
         device[len] = '\0';
+        watch_remember(wd, device);
 
         return udev_device_new_from_device_id(udev, device);
 }
@@ -40,6 +40,7 @@ struct udev_event {
         uid_t uid;
         gid_t gid;
         struct udev_list run_list;
+        struct udev_list timing_list;
         int exec_delay;
         usec_t birth_usec;
         usec_t timeout_usec;
@@ -58,6 +59,7 @@ struct udev_event {
         bool name_final;
         bool devlink_final;
         bool run_final;
+        bool timing;
 };
 
 struct udev_watch {
@@ -71,8 +73,13 @@ struct udev_rules;
 struct udev_rules *udev_rules_new(struct udev *udev, int resolve_names);
 struct udev_rules *udev_rules_unref(struct udev_rules *rules);
 bool udev_rules_check_timestamp(struct udev_rules *rules);
+int udev_rules_write_cache(struct udev_rules *rules);
 int udev_rules_apply_to_event(struct udev_rules *rules, struct udev_event *event, const sigset_t *sigmask);
 void udev_rules_apply_static_dev_perms(struct udev_rules *rules);
+int udev_rules_enable_stats(struct udev_rules *rules);
+enum udev_builtin_cmd udev_rules_get_run_builtin(struct udev_rules *rules, unsigned int token);
+void udev_rules_account(struct udev_rules *rules, unsigned int token, usec_t usec);
+void udev_rules_log_stats(struct udev_rules *rules, unsigned int max);
 
 /* udev-event.c */
 struct udev_event *udev_event_new(struct udev_device *dev);
@@ -84,7 +91,7 @@ int udev_event_spawn(struct udev_event *event,
                      const char *cmd, char **envp, const sigset_t *sigmask,
                      char *result, size_t ressize);
 int udev_event_execute_rules(struct udev_event *event, struct udev_rules *rules, const sigset_t *sigset);
-void udev_event_execute_run(struct udev_event *event, const sigset_t *sigset);
+void udev_event_execute_run(struct udev_event *event, struct udev_rules *rules, const sigset_t *sigset);
 int udev_build_argv(struct udev *udev, char *cmd, int *argc, char *argv[]);
 
 /* udev-watch.c */
@@ -93,6 +100,7 @@ void udev_watch_restore(struct udev *udev);
 void udev_watch_begin(struct udev *udev, struct udev_device *dev);
 void udev_watch_end(struct udev *udev, struct udev_device *dev);
 struct udev_device *udev_watch_lookup(struct udev *udev, int wd);
+void udev_watch_invalidate(int wd);
 
 /* udev-node.c */
 void udev_node_add(struct udev_device *dev, bool apply, mode_t mode, uid_t uid, gid_t gid);
@@ -101,6 +109,28 @@ void udev_node_update_old_links(struct udev_device *dev, struct udev_device *dev
 
 /* udev-ctrl.c */
 struct udev_ctrl;
+
+/* the counters of the daemon, returned for "udevadm control --stats" */
+struct udev_ctrl_stats {
+        unsigned long long int events;
+        unsigned long long int queue_usec_avg;
+        unsigned long long int queue_usec_max;
+        unsigned long long int run_usec_avg;
+        unsigned long long int run_usec_max;
+        /* the oldest event waiting in the queue, and for how long */
+        unsigned long long int oldest_seqnum;
+        unsigned long long int oldest_usec;
+        unsigned int events_queued;
+        unsigned int events_running;
+        unsigned int workers_running;
+        unsigned int workers_idle;
+        int children_min;
+        int children_max;
+        unsigned int forked;
+        unsigned int idle_killed;
+        bool exec_queue_stopped;
+};
+
 struct udev_ctrl *udev_ctrl_new(struct udev *udev);
 struct udev_ctrl *udev_ctrl_new_from_fd(struct udev *udev, int fd);
 int udev_ctrl_enable_receiving(struct udev_ctrl *uctrl);
@@ -115,6 +145,8 @@ int udev_ctrl_send_start_exec_queue(struct udev_ctrl *uctrl, int timeout);
 int udev_ctrl_send_reload(struct udev_ctrl *uctrl, int timeout);
 int udev_ctrl_send_ping(struct udev_ctrl *uctrl, int timeout);
 int udev_ctrl_send_exit(struct udev_ctrl *uctrl, int timeout);
+int udev_ctrl_send_log_stats(struct udev_ctrl *uctrl, int timeout);
+int udev_ctrl_send_get_stats(struct udev_ctrl *uctrl, struct udev_ctrl_stats *stats, int timeout);
 int udev_ctrl_send_set_env(struct udev_ctrl *uctrl, const char *key, int timeout);
 int udev_ctrl_send_set_children_max(struct udev_ctrl *uctrl, int count, int timeout);
 struct udev_ctrl_connection;
@@ -131,11 +163,15 @@ int udev_ctrl_get_start_exec_queue(struct udev_ctrl_msg *ctrl_msg);
 int udev_ctrl_get_reload(struct udev_ctrl_msg *ctrl_msg);
 int udev_ctrl_get_ping(struct udev_ctrl_msg *ctrl_msg);
 int udev_ctrl_get_exit(struct udev_ctrl_msg *ctrl_msg);
+int udev_ctrl_get_log_stats(struct udev_ctrl_msg *ctrl_msg);
+int udev_ctrl_get_stats(struct udev_ctrl_msg *ctrl_msg);
+int udev_ctrl_reply_stats(struct udev_ctrl_msg *ctrl_msg, const struct udev_ctrl_stats *stats);
 const char *udev_ctrl_get_set_env(struct udev_ctrl_msg *ctrl_msg);
 int udev_ctrl_get_set_children_max(struct udev_ctrl_msg *ctrl_msg);
 
 /* built-in commands */
 enum udev_builtin_cmd {
+        UDEV_BUILTIN_ATA_ID,
 #ifdef HAVE_BLKID
         UDEV_BUILTIN_BLKID,
 #endif
@@ -165,6 +201,7 @@ struct udev_builtin {
         bool (*validate)(struct udev *udev);
         bool run_once;
 };
+extern const struct udev_builtin udev_builtin_ata_id;
 #ifdef HAVE_BLKID
 extern const struct udev_builtin udev_builtin_blkid;
 #endif
@@ -191,6 +228,10 @@ void udev_builtin_list(struct udev *udev);
 bool udev_builtin_validate(struct udev *udev);
 int udev_builtin_add_property(struct udev_device *dev, bool test, const char *key, const char *val);
 int udev_builtin_hwdb_lookup(struct udev_device *dev, const char *modalias, bool test);
+void udev_builtin_cache_validate(unsigned long long int seqnum);
+int udev_builtin_cache_get(const char *key, const char **value);
+void udev_builtin_cache_put(const char *key, const char *value);
+const char *udev_builtin_cache_sysattr(struct udev_device *dev, const char *sysattr);
 
 /* udev logging */
 void udev_main_log(struct udev *udev, int priority,
@@ -37,10 +37,41 @@ static void print_help(void)
                 "  --reload                 reload rules and databases\n"
                 "  --property=<KEY>=<value> set a global property for all events\n"
                 "  --children-max=<N>       maximum number of children\n"
+                "  --stats                  print event and worker statistics\n"
+                "  --dump-stats             log event, worker and rule statistics\n"
                 "  --timeout=<seconds>      maximum time to block for a reply\n"
                 "  --help                   print this help text\n\n");
 }
 
+/* one counter per line, to be read by scripts */
+static void print_stats(const struct udev_ctrl_stats *stats)
+{
+        printf("EVENTS=%llu\n"
+               "EVENTS_QUEUED=%u\n"
+               "EVENTS_RUNNING=%u\n"
+               "QUEUE_USEC_AVG=%llu\n"
+               "QUEUE_USEC_MAX=%llu\n"
+               "RUN_USEC_AVG=%llu\n"
+               "RUN_USEC_MAX=%llu\n"
+               "OLDEST_SEQNUM=%llu\n"
+               "OLDEST_USEC=%llu\n"
+               "WORKERS_RUNNING=%u\n"
+               "WORKERS_IDLE=%u\n"
+               "CHILDREN_MIN=%i\n"
+               "CHILDREN_MAX=%i\n"
+               "WORKERS_FORKED=%u\n"
+               "WORKERS_IDLE_STOPPED=%u\n"
+               "EXEC_QUEUE_STOPPED=%i\n",
+               stats->events, stats->events_queued, stats->events_running,
+               stats->queue_usec_avg, stats->queue_usec_max,
+               stats->run_usec_avg, stats->run_usec_max,
+               stats->oldest_seqnum, stats->oldest_usec,
+               stats->workers_running, stats->workers_idle,
+               stats->children_min, stats->children_max,
+               stats->forked, stats->idle_killed,
+               stats->exec_queue_stopped);
+}
+
 static int adm_control(struct udev *udev, int argc, char *argv[])
 {
         struct udev_ctrl *uctrl = NULL;
@@ -57,6 +88,8 @@ static int adm_control(struct udev *udev, int argc, char *argv[])
                 { "property", required_argument, NULL, 'p' },
                 { "env", required_argument, NULL, 'p' },
                 { "children-max", required_argument, NULL, 'm' },
+                { "stats", no_argument, NULL, 'T' },
+                { "dump-stats", no_argument, NULL, 'D' },
                 { "timeout", required_argument, NULL, 't' },
                 { "help", no_argument, NULL, 'h' },
                 {}
@@ -74,7 +107,7 @@ static int adm_control(struct udev *udev, int argc, char *argv[])
         for (;;) {
                 int option;
 
-                option = getopt_long(argc, argv, "el:sSRp:m:h", options, NULL);
+                option = getopt_long(argc, argv, "el:sSRp:m:Th", options, NULL);
                 if (option == -1)
                         break;
 
@@ -142,6 +175,23 @@ static int adm_control(struct udev *udev, int argc, char *argv[])
                                 rc = 0;
                         break;
                 }
+                case 'T': {
+                        struct udev_ctrl_stats stats;
+
+                        if (udev_ctrl_send_get_stats(uctrl, &stats, timeout) < 0) {
+                                rc = 2;
+                                break;
+                        }
+                        print_stats(&stats);
+                        rc = 0;
+                        break;
+                }
+                case 'D':
+                        if (udev_ctrl_send_log_stats(uctrl, timeout) < 0)
+                                rc = 2;
+                        else
+                                rc = 0;
+                        break;
                 case 't': {
                         int seconds;
 
@@ -61,6 +61,9 @@ struct trie_node {
         /* sorted array of key/value pairs */
         struct trie_value_entry *values;
         size_t values_count;
+
+        /* offset in the file, assigned before writing */
+        uint64_t off;
 };
 
 /* children array item with char (0-255) index */
@@ -262,76 +265,132 @@ struct trie_f {
         struct trie *trie;
         uint64_t strings_off;
 
+        /* all nodes, in the order they are stored */
+        struct trie_node **nodes;
+        unsigned *depths;
+        size_t nodes_n;
+
         uint64_t nodes_count;
         uint64_t children_count;
         uint64_t values_count;
+
+        /* nodes passed on the way to a node with values */
+        unsigned depth_max;
+        uint64_t depth_sum;
+        uint64_t depth_count;
 };
 
-/* calculate the storage space for the nodes, children arrays, value arrays */
-static void trie_store_nodes_size(struct trie_f *trie, struct trie_node *node) {
-        uint64_t i;
+/*
+ * The levels of the trie which most lookups pass are stored together at
+ * the start of the file, breadth-first. Below them, every subtree is
+ * stored depth-first, each node before its children, so a lookup which
+ * descends into one finds its nodes close to each other.
+ */
+#define TRIE_LEVELS_TOP 3
 
-        for (i = 0; i < node->children_count; i++)
-                trie_store_nodes_size(trie, node->children[i].child);
+static void trie_store_nodes_add(struct trie_f *trie, struct trie_node *node, unsigned depth) {
+        assert(trie->nodes_n < trie->trie->nodes_count);
 
-        trie->strings_off += sizeof(struct trie_node_f);
-        for (i = 0; i < node->children_count; i++)
-                trie->strings_off += sizeof(struct trie_child_entry_f);
-        for (i = 0; i < node->values_count; i++)
-                trie->strings_off += sizeof(struct trie_value_entry_f);
+        trie->nodes[trie->nodes_n] = node;
+        trie->depths[trie->nodes_n] = depth;
+        trie->nodes_n++;
 }
 
-static int64_t trie_store_nodes(struct trie_f *trie, struct trie_node *node) {
+static void trie_store_nodes_subtree(struct trie_f *trie, struct trie_node *node, unsigned depth) {
         uint64_t i;
-        struct trie_node_f n = {
-                .prefix_off = htole64(trie->strings_off + node->prefix_off),
-                .children_count = node->children_count,
-                .values_count = htole64(node->values_count),
-        };
-        struct trie_child_entry_f *children = NULL;
-        int64_t node_off;
 
-        if (node->children_count) {
-                children = new0(struct trie_child_entry_f, node->children_count);
-                if (!children)
-                        return -ENOMEM;
+        trie_store_nodes_add(trie, node, depth);
+        for (i = 0; i < node->children_count; i++)
+                trie_store_nodes_subtree(trie, node->children[i].child, depth + 1);
+}
+
+/* order the nodes, and calculate their offsets and the start of the strings */
+static int trie_store_nodes_layout(struct trie_f *trie, struct trie_node *root) {
+        size_t q, top;
+
+        trie->nodes = new(struct trie_node *, trie->trie->nodes_count);
+        trie->depths = new(unsigned, trie->trie->nodes_count);
+        if (!trie->nodes || !trie->depths)
+                return -ENOMEM;
+
+        trie_store_nodes_add(trie, root, 1);
+        for (q = 0; q < trie->nodes_n && trie->depths[q] < TRIE_LEVELS_TOP; q++) {
+                struct trie_node *node = trie->nodes[q];
+                uint64_t i;
+
+                for (i = 0; i < node->children_count; i++)
+                        trie_store_nodes_add(trie, node->children[i].child, trie->depths[q] + 1);
         }
 
-        /* post-order recursion */
-        for (i = 0; i < node->children_count; i++) {
-                int64_t child_off;
+        top = trie->nodes_n;
+        for (; q < top; q++) {
+                struct trie_node *node = trie->nodes[q];
+                uint64_t i;
 
-                child_off = trie_store_nodes(trie, node->children[i].child);
-                if (child_off < 0)
-                        return child_off;
-                children[i].c = node->children[i].c;
-                children[i].child_off = htole64(child_off);
+                for (i = 0; i < node->children_count; i++)
+                        trie_store_nodes_subtree(trie, node->children[i].child, trie->depths[q] + 1);
         }
 
-        /* write node */
-        node_off = ftello(trie->f);
-        fwrite(&n, sizeof(struct trie_node_f), 1, trie->f);
-        trie->nodes_count++;
+        for (q = 0; q < trie->nodes_n; q++) {
+                struct trie_node *node = trie->nodes[q];
 
-        /* append children array */
-        if (node->children_count) {
-                fwrite(children, sizeof(struct trie_child_entry_f), node->children_count, trie->f);
-                trie->children_count += node->children_count;
-                free(children);
+                node->off = trie->strings_off;
+                trie->strings_off += sizeof(struct trie_node_f);
+                trie->strings_off += node->children_count * sizeof(struct trie_child_entry_f);
+                trie->strings_off += node->values_count * sizeof(struct trie_value_entry_f);
+
+                if (node->values_count > 0) {
+                        trie->depth_max = MAX(trie->depth_max, trie->depths[q]);
+                        trie->depth_sum += trie->depths[q];
+                        trie->depth_count++;
+                }
         }
 
-        /* append values array */
-        for (i = 0; i < node->values_count; i++) {
-                struct trie_value_entry_f v = {
-                        .key_off = htole64(trie->strings_off + node->values[i].key_off),
-                        .value_off = htole64(trie->strings_off + node->values[i].value_off),
+        return 0;
+}
+
+static int trie_store_nodes(struct trie_f *trie) {
+        size_t q;
+
+        for (q = 0; q < trie->nodes_n; q++) {
+                struct trie_node *node = trie->nodes[q];
+                struct trie_node_f n = {
+                        .prefix_off = htole64(trie->strings_off + node->prefix_off),
+                        .children_count = node->children_count,
+                        .values_count = htole64(node->values_count),
                 };
+                uint64_t i;
+
+                assert((uint64_t) ftello(trie->f) == node->off);
+
+                /* write node */
+                fwrite(&n, sizeof(struct trie_node_f), 1, trie->f);
+                trie->nodes_count++;
 
-                fwrite(&v, sizeof(struct trie_value_entry_f), 1, trie->f);
-                trie->values_count++;
+                /* append children array */
+                for (i = 0; i < node->children_count; i++) {
+                        struct trie_child_entry_f c = {
+                                .c = node->children[i].c,
+                                .child_off = htole64(node->children[i].child->off),
+                        };
+
+                        fwrite(&c, sizeof(struct trie_child_entry_f), 1, trie->f);
+                        trie->children_count++;
+                }
+
+                /* append values array */
+                for (i = 0; i < node->values_count; i++) {
+                        struct trie_value_entry_f v = {
+                                .key_off = htole64(trie->strings_off + node->values[i].key_off),
+                                .value_off = htole64(trie->strings_off + node->values[i].value_off),
+                        };
+
+                        fwrite(&v, sizeof(struct trie_value_entry_f), 1, trie->f);
+                        trie->values_count++;
+                }
         }
 
-        return node_off;
+        return 0;
 }
 
 static int trie_store(struct trie *trie, const char *filename) {
@@ -340,7 +399,6 @@ static int trie_store(struct trie *trie, const char *filename) {
         };
         char *filename_tmp;
         int64_t pos;
-        int64_t root_off;
         int64_t size;
         struct trie_header_f h = {
                 .signature = HWDB_SIG,
@@ -354,17 +412,19 @@ static int trie_store(struct trie *trie, const char *filename) {
 
         /* calculate size of header, nodes, children entries, value entries */
         t.strings_off = sizeof(struct trie_header_f);
-        trie_store_nodes_size(&t, trie->root);
+        err = trie_store_nodes_layout(&t, trie->root);
+        if (err < 0)
+                goto out_nodes;
 
         err = fopen_temporary(filename , &t.f, &filename_tmp);
         if (err < 0)
-                return err;
+                goto out_nodes;
         fchmod(fileno(t.f), 0444);
 
         /* write nodes */
         fseeko(t.f, sizeof(struct trie_header_f), SEEK_SET);
-        root_off = trie_store_nodes(&t, trie->root);
-        h.nodes_root_off = htole64(root_off);
+        trie_store_nodes(&t);
+        h.nodes_root_off = htole64(trie->root->off);
         pos = ftello(t.f);
         h.nodes_len = htole64(pos - sizeof(struct trie_header_f));
 
@@ -397,8 +457,16 @@ static int trie_store(struct trie *trie, const char *filename) {
                   (unsigned long long)t.values_count * sizeof(struct trie_value_entry_f), (unsigned long long)t.values_count);
         log_debug("string store:     %8llu bytes\n", (unsigned long long)trie->strings->len);
         log_debug("strings start:    %8llu\n", (unsigned long long) t.strings_off);
+
+        log_info("%s: %llu bytes, %llu nodes, %llu values, lookup depth %.1f average, %u maximum",
+                 filename, (unsigned long long) size,
+                 (unsigned long long) t.nodes_count, (unsigned long long) t.values_count,
+                 t.depth_count > 0 ? (double) t.depth_sum / t.depth_count : 0.0, t.depth_max);
 out:
         free(filename_tmp);
+out_nodes:
+        free(t.nodes);
+        free(t.depths);
         return err;
 }
 
@@ -233,6 +233,10 @@ static void cleanup_db(struct udev *udev)
 
         unlink("/run/udev/queue.bin");
 
+        /* readers might still have it mapped */
+        udev_db_invalidate_snapshot(udev);
+        unlink("/run/udev/data.bin");
+
         dir = opendir("/run/udev/data");
         if (dir != NULL) {
                 cleanup_dir(dir, S_ISVTX, 1);
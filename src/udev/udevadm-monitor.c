@@ -64,6 +64,37 @@ static void print_device(struct udev_device *device, const char *source, int pro
         }
 }
 
+/* ask the daemon for its counters, a new connection every time */
+static void print_stats(struct udev *udev)
+{
+        struct udev_ctrl *uctrl;
+        struct udev_ctrl_stats stats;
+        struct timespec ts;
+        int r = -ENOMEM;
+
+        uctrl = udev_ctrl_new(udev);
+        if (uctrl != NULL) {
+                r = udev_ctrl_send_get_stats(uctrl, &stats, 1);
+                udev_ctrl_unref(uctrl);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        if (r < 0) {
+                printf("%-6s[%llu.%06u] unavailable: %s\n",
+                       "STATS",
+                       (unsigned long long) ts.tv_sec, (unsigned int) ts.tv_nsec/1000,
+                       strerror(-r));
+                return;
+        }
+
+        printf("%-6s[%llu.%06u] %llu events, %u queued, %u running, oldest waiting %llu usec, "
+               "%u workers running, %u idle\n",
+               "STATS",
+               (unsigned long long) ts.tv_sec, (unsigned int) ts.tv_nsec/1000,
+               stats.events, stats.events_queued, stats.events_running, stats.oldest_usec,
+               stats.workers_running, stats.workers_idle);
+}
+
 static int adm_monitor(struct udev *udev, int argc, char *argv[])
 {
         struct sigaction act;
@@ -72,6 +103,8 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[])
         bool prop = false;
         bool print_kernel = false;
         bool print_udev = false;
+        bool print_stats_every_sec = false;
+        usec_t stats_usec = 0;
         struct udev_list subsystem_match_list;
         struct udev_list tag_match_list;
         struct udev_monitor *udev_monitor = NULL;
@@ -88,6 +121,7 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[])
                 { "udev", no_argument, NULL, 'u' },
                 { "subsystem-match", required_argument, NULL, 's' },
                 { "tag-match", required_argument, NULL, 't' },
+                { "stats", no_argument, NULL, 'S' },
                 { "help", no_argument, NULL, 'h' },
                 {}
         };
@@ -96,7 +130,7 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[])
         udev_list_init(udev, &tag_match_list, true);
 
         for (;;) {
-                option = getopt_long(argc, argv, "pekus:t:h", options, NULL);
+                option = getopt_long(argc, argv, "pekus:t:Sh", options, NULL);
                 if (option == -1)
                         break;
 
@@ -128,13 +162,17 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[])
                 case 't':
                         udev_list_entry_add(&tag_match_list, optarg, NULL);
                         break;
+                case 'S':
+                        print_stats_every_sec = true;
+                        break;
                 case 'h':
-                        printf("Usage: udevadm monitor [--property] [--kernel] [--udev] [--help]\n"
+                        printf("Usage: udevadm monitor [--property] [--kernel] [--udev] [--stats] [--help]\n"
                                "  --property                              print the event properties\n"
                                "  --kernel                                print kernel uevents\n"
                                "  --udev                                  print udev events\n"
                                "  --subsystem-match=<subsystem[/devtype]> filter events by subsystem\n"
                                "  --tag-match=<tag>                       filter events by tag\n"
+                               "  --stats                                 print the counters of the daemon every second\n"
                                "  --help\n\n");
                         goto out;
                 default:
@@ -143,7 +181,7 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[])
                 }
         }
 
-        if (!print_kernel && !print_udev) {
+        if (!print_kernel && !print_udev && !print_stats_every_sec) {
                 print_kernel = true;
                 print_udev = true;
         }
@@ -246,14 +284,28 @@ static int adm_monitor(struct udev *udev, int argc, char *argv[])
 
                 printf("KERNEL - the kernel uevent\n");
         }
+        if (print_stats_every_sec)
+                printf("STATS  - the counters of the daemon\n");
         printf("\n");
 
         while (!udev_exit) {
                 int fdcount;
                 struct epoll_event ev[4];
                 int i;
+                int timeout = -1;
+
+                if (print_stats_every_sec) {
+                        usec_t usec = now(CLOCK_MONOTONIC);
+
+                        if (usec >= stats_usec) {
+                                print_stats(udev);
+                                fflush(stdout);
+                                stats_usec = usec + USEC_PER_SEC;
+                        }
+                        timeout = (stats_usec - usec) / USEC_PER_MSEC + 1;
+                }
 
-                fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev), -1);
+                fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev), timeout);
                 if (fdcount < 0) {
                         if (errno != EINTR)
                                 fprintf(stderr, "error receiving uevent message: %m\n");
@@ -36,6 +36,62 @@
 
 #include "udev.h"
 
+/* read all pending inotify events, returns true if the queue file was replaced */
+static bool queue_flush_events(int fd)
+{
+        bool rebuilt = false;
+
+        for (;;) {
+                char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+                ssize_t len;
+                char *p;
+
+                len = read(fd, buf, sizeof(buf));
+                if (len <= 0)
+                        break;
+
+                for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *) p)->len) {
+                        struct inotify_event *e = (struct inotify_event *) p;
+
+                        if (e->mask & IN_MOVED_TO)
+                                rebuilt = true;
+                }
+        }
+
+        return rebuilt;
+}
+
+/*
+ * Wait for a change of the queue file. udevd rebuilds the file whenever
+ * the last queued event finished, so that is reported right away. Other
+ * changes, an event appended to the queue or marked as finished, are
+ * coalesced, to not re-read a large queue file for every single event.
+ */
+static void queue_wait(int fd, int delay, usec_t coalesce_usec)
+{
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        usec_t until;
+
+        if (poll(&pfd, 1, delay) <= 0 || !(pfd.revents & POLLIN))
+                return;
+        if (queue_flush_events(fd))
+                return;
+
+        until = now(CLOCK_MONOTONIC) + coalesce_usec;
+        for (;;) {
+                usec_t n;
+
+                n = now(CLOCK_MONOTONIC);
+                if (n >= until)
+                        return;
+
+                if (poll(&pfd, 1, (until - n + USEC_PER_MSEC - 1) / USEC_PER_MSEC) <= 0)
+                        return;
+                if (queue_flush_events(fd))
+                        return;
+        }
+}
+
 static int adm_settle(struct udev *udev, int argc, char *argv[])
 {
         static const struct option options[] = {
@@ -148,11 +204,11 @@ static int adm_settle(struct udev *udev, int argc, char *argv[])
         }
 
         pfd[0].events = POLLIN;
-        pfd[0].fd = inotify_init1(IN_CLOEXEC);
+        pfd[0].fd = inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
         if (pfd[0].fd < 0) {
                 log_error("inotify_init failed: %m\n");
         } else {
-                if (inotify_add_watch(pfd[0].fd, "/run/udev" , IN_MOVED_TO) < 0) {
+                if (inotify_add_watch(pfd[0].fd, "/run/udev" , IN_MOVED_TO|IN_MODIFY) < 0) {
                         log_error("watching /run/udev failed\n");
                         close(pfd[0].fd);
                         pfd[0].fd = -1;
@@ -184,16 +240,12 @@ static int adm_settle(struct udev *udev, int argc, char *argv[])
                 if (pfd[0].fd >= 0) {
                         int delay;
 
-                        if (exists != NULL || start > 0)
+                        /* the queue file is watched, poll only for the file to exist */
+                        if (exists != NULL)
                                 delay = 100;
                         else
                                 delay = 1000;
-                        /* wake up after delay, or immediately after the queue is rebuilt */
-                        if (poll(pfd, 1, delay) > 0 && pfd[0].revents & POLLIN) {
-                                char buf[sizeof(struct inotify_event) + PATH_MAX];
-
-                                read(pfd[0].fd, buf, sizeof(buf));
-                        }
+                        queue_wait(pfd[0].fd, delay, 10 * USEC_PER_MSEC);
                 } else {
                         sleep(1);
                 }
@@ -131,6 +131,7 @@ static int adm_test(struct udev *udev, int argc, char *argv[])
 
         udev_device_set_action(dev, action);
         event = udev_event_new(dev);
+        event->timing = true;
 
         sigfillset(&mask);
         sigprocmask(SIG_SETMASK, &mask, &sigmask_orig);
@@ -154,6 +155,9 @@ static int adm_test(struct udev *udev, int argc, char *argv[])
                         printf("run: '%s'\n", program);
                 }
         }
+
+        udev_list_entry_foreach(entry, udev_list_get_entry(&event->timing_list))
+                printf("time: %s usec %s\n", udev_list_entry_get_value(entry), udev_list_entry_get_name(entry));
 out:
         if (event != NULL && event->fd_signal >= 0)
                 close(event->fd_signal);
@@ -30,32 +30,269 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/poll.h>
+#include <sys/inotify.h>
 
 #include "udev.h"
+#include "hashmap.h"
 
 static int verbose;
 static int dry_run;
+static unsigned int queue_max;
+static unsigned int parallel = 1;
 
-static void exec_list(struct udev_enumerate *udev_enumerate, const char *action)
+struct trigger_subsystem {
+        char *name;
+        unsigned int depth;
+        unsigned int first;
+};
+
+struct trigger_device {
+        const char *syspath;
+        struct trigger_subsystem *subsystem;
+        unsigned int idx;
+};
+
+static void trigger_device(const char *syspath, const char *action)
+{
+        char filename[UTIL_PATH_SIZE];
+        int fd;
+
+        if (verbose)
+                printf("%s\n", syspath);
+        if (dry_run)
+                return;
+        strscpyl(filename, sizeof(filename), syspath, "/uevent", NULL);
+        fd = open(filename, O_WRONLY);
+        if (fd < 0)
+                return;
+        if (write(fd, action, strlen(action)) < 0)
+                log_debug("error writing '%s' to '%s': %m\n", action, filename);
+        close(fd);
+}
+
+/* events sent by the kernel, which udevd did not finish yet */
+static unsigned int queue_outstanding(struct udev_queue *udev_queue)
+{
+        unsigned long long int seqnum_kernel;
+        unsigned long long int seqnum_udev = 0;
+        unsigned int n;
+        int queued;
+
+        seqnum_kernel = udev_queue_get_kernel_seqnum(udev_queue);
+        queued = udev_queue_count_queued(udev_queue, &seqnum_udev);
+        if (queued < 0)
+                return 0;
+
+        n = queued;
+        if (seqnum_kernel > seqnum_udev)
+                n += seqnum_kernel - seqnum_udev;
+
+        return n;
+}
+
+/* wait until less than max events are outstanding, returns how many may be sent */
+static unsigned int queue_wait(struct udev_queue *udev_queue, int fd_inotify, unsigned int max)
+{
+        usec_t start_usec = now(CLOCK_MONOTONIC);
+
+        for (;;) {
+                struct pollfd pfd = { .fd = fd_inotify, .events = POLLIN };
+                unsigned int n;
+
+                n = queue_outstanding(udev_queue);
+                if (n < max)
+                        return max - n;
+
+                /* do not wait forever for a stuck or stopped queue */
+                if (now(CLOCK_MONOTONIC) - start_usec > 30 * USEC_PER_SEC) {
+                        log_debug("timeout waiting for %u queued events\n", n);
+                        return max;
+                }
+
+                /* wake up after a while, or immediately after the queue file changed */
+                if (fd_inotify < 0) {
+                        usleep(100 * 1000);
+                } else if (poll(&pfd, 1, 100) > 0 && pfd.revents & POLLIN) {
+                        char buf[sizeof(struct inotify_event) + PATH_MAX];
+
+                        read(fd_inotify, buf, sizeof(buf));
+                }
+        }
+}
+
+static void exec_devices(struct udev *udev, struct trigger_device *devices, unsigned int n,
+                         unsigned int first, unsigned int step, unsigned int max, const char *action)
+{
+        struct udev_queue *udev_queue = NULL;
+        int fd_inotify = -1;
+        unsigned int budget = 0;
+        unsigned int i;
+
+        if (max > 0 && !dry_run) {
+                udev_queue = udev_queue_new(udev);
+                if (udev_queue != NULL && !udev_queue_get_udev_is_active(udev_queue)) {
+                        log_debug("udevd is not running, not limiting the queue\n");
+                        udev_queue = udev_queue_unref(udev_queue);
+                }
+        }
+
+        if (udev_queue != NULL) {
+                fd_inotify = inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+                if (fd_inotify >= 0 && inotify_add_watch(fd_inotify, "/run/udev", IN_MODIFY|IN_MOVED_TO) < 0) {
+                        close(fd_inotify);
+                        fd_inotify = -1;
+                }
+        }
+
+        for (i = first; i < n; i += step) {
+                if (udev_queue != NULL) {
+                        if (budget == 0)
+                                budget = queue_wait(udev_queue, fd_inotify, max);
+                        budget--;
+                }
+
+                trigger_device(devices[i].syspath, action);
+        }
+
+        if (fd_inotify >= 0)
+                close(fd_inotify);
+        udev_queue_unref(udev_queue);
+}
+
+static int trigger_device_compare(const void *a, const void *b)
+{
+        const struct trigger_device *x = a, *y = b;
+
+        /* subsystems with devices closer to the root first, then in enumeration order */
+        if (x->subsystem->depth != y->subsystem->depth)
+                return x->subsystem->depth < y->subsystem->depth ? -1 : 1;
+        if (x->subsystem->first != y->subsystem->first)
+                return x->subsystem->first < y->subsystem->first ? -1 : 1;
+        return x->idx < y->idx ? -1 : (x->idx > y->idx ? 1 : 0);
+}
+
+/*
+ * Order the devices by subsystem, so that the subsystems of parent devices, like buses
+ * and controllers, come before the subsystems of the devices below them. Each subsystem
+ * is ranked by the devpath depth of its topmost device.
+ */
+static int order_subsystems(struct udev *udev, struct trigger_device *devices, unsigned int n)
+{
+        Hashmap *subsystems;
+        struct trigger_subsystem *subsystem;
+        unsigned int i;
+        int r = -ENOMEM;
+
+        subsystems = hashmap_new(string_hash_func, string_compare_func);
+        if (subsystems == NULL)
+                return -ENOMEM;
+
+        for (i = 0; i < n; i++) {
+                char name[UTIL_NAME_SIZE];
+                unsigned int depth = 0;
+                const char *s;
+
+                if (util_get_sys_core_link_value(udev, "subsystem", devices[i].syspath, name, sizeof(name)) < 0)
+                        name[0] = '\0';
+
+                for (s = devices[i].syspath; *s != '\0'; s++)
+                        if (*s == '/')
+                                depth++;
+
+                subsystem = hashmap_get(subsystems, name);
+                if (subsystem == NULL) {
+                        subsystem = new0(struct trigger_subsystem, 1);
+                        if (subsystem == NULL)
+                                goto out;
+                        subsystem->name = strdup(name);
+                        if (subsystem->name == NULL) {
+                                free(subsystem);
+                                goto out;
+                        }
+                        subsystem->depth = depth;
+                        subsystem->first = i;
+                        if (hashmap_put(subsystems, subsystem->name, subsystem) < 0) {
+                                free(subsystem->name);
+                                free(subsystem);
+                                goto out;
+                        }
+                } else if (depth < subsystem->depth) {
+                        subsystem->depth = depth;
+                }
+
+                devices[i].subsystem = subsystem;
+        }
+
+        qsort(devices, n, sizeof(struct trigger_device), trigger_device_compare);
+        r = 0;
+out:
+        while ((subsystem = hashmap_steal_first(subsystems)) != NULL) {
+                free(subsystem->name);
+                free(subsystem);
+        }
+        hashmap_free(subsystems);
+        return r;
+}
+
+static int exec_list(struct udev *udev, struct udev_enumerate *udev_enumerate, const char *action, bool order)
 {
         struct udev_list_entry *entry;
+        struct trigger_device *devices;
+        unsigned int n = 0;
+        unsigned int i;
+        int rc = 0;
+
+        udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(udev_enumerate))
+                n++;
 
+        devices = new0(struct trigger_device, MAX(n, 1U));
+        if (devices == NULL)
+                return 1;
+
+        i = 0;
         udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(udev_enumerate)) {
-                char filename[UTIL_PATH_SIZE];
-                int fd;
-
-                if (verbose)
-                        printf("%s\n", udev_list_entry_get_name(entry));
-                if (dry_run)
-                        continue;
-                strscpyl(filename, sizeof(filename), udev_list_entry_get_name(entry), "/uevent", NULL);
-                fd = open(filename, O_WRONLY);
-                if (fd < 0)
-                        continue;
-                if (write(fd, action, strlen(action)) < 0)
-                        log_debug("error writing '%s' to '%s': %m\n", action, filename);
-                close(fd);
+                devices[i].syspath = udev_list_entry_get_name(entry);
+                devices[i].idx = i;
+                i++;
+        }
+
+        if (order && queue_max > 0 && order_subsystems(udev, devices, n) < 0)
+                log_error("unable to order devices by subsystem\n");
+
+        if (parallel <= 1 || dry_run) {
+                exec_devices(udev, devices, n, 0, 1, queue_max, action);
+                goto out;
+        }
+
+        /* split the list between the writers, each keeping its share of the queue limit */
+        fflush(stdout);
+        for (i = 0; i < parallel; i++) {
+                pid_t pid;
+
+                pid = fork();
+                if (pid < 0) {
+                        log_error("fork failed: %m\n");
+                        rc = 1;
+                        break;
+                }
+                if (pid == 0) {
+                        exec_devices(udev, devices, n, i, parallel, queue_max > 0 ? MAX(queue_max / parallel, 1U) : 0, action);
+                        fflush(stdout);
+                        _exit(EXIT_SUCCESS);
+                }
         }
+
+        /* finish the share of the writers which could not be started */
+        for (; i < parallel; i++)
+                exec_devices(udev, devices, n, i, parallel, queue_max > 0 ? MAX(queue_max / parallel, 1U) : 0, action);
+
+        while (waitpid(-1, NULL, 0) > 0 || errno == EINTR)
+                ;
+out:
+        free(devices);
+        return rc;
 }
 
 static const char *keyval(const char *str, const char **val, char *buf, size_t size)
@@ -87,6 +324,8 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[])
                 { "tag-match", required_argument, NULL, 'g' },
                 { "sysname-match", required_argument, NULL, 'y' },
                 { "parent-match", required_argument, NULL, 'b' },
+                { "queue-max", required_argument, NULL, 'q' },
+                { "parallel", required_argument, NULL, 'P' },
                 { "help", no_argument, NULL, 'h' },
                 {}
         };
@@ -110,7 +349,7 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[])
                 const char *val;
                 char buf[UTIL_PATH_SIZE];
 
-                option = getopt_long(argc, argv, "vng:o:t:hc:p:s:S:a:A:y:b:", options, NULL);
+                option = getopt_long(argc, argv, "vng:o:t:hc:p:s:S:a:A:y:b:q:P:", options, NULL);
                 if (option == -1)
                         break;
 
@@ -180,6 +419,23 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[])
                         udev_device_unref(dev);
                         break;
                 }
+                case 'q':
+                case 'P': {
+                        char *endp;
+                        unsigned long int i;
+
+                        i = strtoul(optarg, &endp, 0);
+                        if (endp[0] != '\0' || (option == 'P' && i < 1) || i > INT_MAX) {
+                                log_error("invalid number '%s'\n", optarg);
+                                rc = 2;
+                                goto exit;
+                        }
+                        if (option == 'q')
+                                queue_max = i;
+                        else
+                                parallel = i;
+                        break;
+                }
                 case 'h':
                         printf("Usage: udevadm trigger OPTIONS\n"
                                "  --verbose                       print the list of devices while running\n"
@@ -196,6 +452,8 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[])
                                "  --tag-match=<key>=<value>       trigger devices with a matching property\n"
                                "  --sysname-match=<name>          trigger devices with a matching name\n"
                                "  --parent-match=<name>           trigger devices with that parent device\n"
+                               "  --queue-max=<N>                 keep at most N events queued, order devices by subsystem\n"
+                               "  --parallel=<N>                  trigger events from N processes\n"
                                "  --help\n\n");
                         goto exit;
                 default:
@@ -207,11 +465,11 @@ static int adm_trigger(struct udev *udev, int argc, char *argv[])
         switch (device_type) {
         case TYPE_SUBSYSTEMS:
                 udev_enumerate_scan_subsystems(udev_enumerate);
-                exec_list(udev_enumerate, action);
+                rc = exec_list(udev, udev_enumerate, action, false);
                 goto exit;
         case TYPE_DEVICES:
                 udev_enumerate_scan_devices(udev_enumerate);
-                exec_list(udev_enumerate, action);
+                rc = exec_list(udev, udev_enumerate, action, true);
                 goto exit;
         default:
                 assert_not_reached("device_type");
@@ -43,12 +43,16 @@
 #include <sys/ioctl.h>
 #include <sys/inotify.h>
 #include <sys/utsname.h>
+#include <sys/mman.h>
 
 #include "udev.h"
 #include "sd-daemon.h"
 #include "cgroup-util.h"
+#include "hashmap.h"
+#include "set.h"
 #include "dev-setup.h"
 #include "fileio.h"
+#include "trace.h"
 
 static bool debug;
 
@@ -71,13 +75,68 @@ static bool stop_exec_queue;
 static bool reload;
 static int children;
 static int children_max;
+static int children_min = -1;
 static int exec_delay;
+static usec_t watch_delay_usec;
 static sigset_t sigmask_orig;
 static UDEV_LIST(event_list);
 static UDEV_LIST(worker_list);
+static Hashmap *event_devpaths;
+static Hashmap *event_parents;
+static Hashmap *event_devnums[2];
+static Hashmap *event_ifindexes;
 char *udev_cgroup;
 static bool udev_exit;
 
+/* the snapshot of the database for readers, rewritten when idle */
+#define DB_SNAPSHOT_INTERVAL_USEC (5 * USEC_PER_SEC)
+static bool db_snapshot_valid;
+static usec_t db_snapshot_usec;
+
+/* the seqnum of the last dispatched event which was not an "add", shared
+ * with the workers, which cache parent devices and their attributes */
+static volatile unsigned long long int *worker_cache_seqnum;
+
+/* logged on request by "udevadm control --stats" */
+static struct {
+        unsigned long long int events;
+        usec_t queue_usec;
+        usec_t queue_usec_max;
+        usec_t run_usec;
+        usec_t run_usec_max;
+        unsigned int forked;
+        unsigned int idle_killed;
+} stats;
+
+/*
+ * histograms of the time events of a subsystem waited in the queue and
+ * ran, in buckets from below 100 usec to 10 sec and more, each ten times
+ * the previous
+ */
+#define STATS_BUCKETS 7
+
+struct subsystem_stats {
+        unsigned int queue[STATS_BUCKETS];
+        unsigned int run[STATS_BUCKETS];
+        char subsystem[];
+};
+
+static Hashmap *stats_subsystems;
+
+/*
+ * the "change" events synthesized for watched devices, by syspath; more
+ * writes to a device are folded into its change not handled yet
+ */
+#define WATCH_CHANGE_TIMEOUT_USEC (30 * USEC_PER_SEC)
+
+struct watch_change {
+        usec_t due_usec;
+        usec_t written_usec;
+        char syspath[];
+};
+
+static Hashmap *watch_changes;
+
 enum event_state {
         EVENT_UNDEF,
         EVENT_QUEUED,
@@ -90,17 +149,40 @@ struct event {
         struct udev_device *dev;
         enum event_state state;
         int exitcode;
-        unsigned long long int delaying_seqnum;
         unsigned long long int seqnum;
         const char *devpath;
         size_t devpath_len;
         const char *devpath_old;
         dev_t devnum;
         int ifindex;
+        usec_t queued_usec;
         bool is_block;
 #ifdef HAVE_FIRMWARE
         bool nodelay;
 #endif
+        struct event_link *links;
+        unsigned int links_count;
+};
+
+/*
+ * The queued and running events, looked up by their devpath, by the
+ * devpath of each of their parents, and by their device number and
+ * interface index. Each slot links the events sharing a key in the
+ * order they were queued, which is the order of their seqnums, so
+ * the first one tells whether an earlier event holds the key.
+ */
+struct event_slot {
+        Hashmap *index;
+        const void *key;
+        struct udev_list_node links;
+        uint64_t devnum;
+        char devpath[];
+};
+
+struct event_link {
+        struct udev_list_node node;
+        struct event *event;
+        struct event_slot *slot;
 };
 
 static inline struct event *node_to_event(struct udev_list_node *node)
@@ -108,6 +190,11 @@ static inline struct event *node_to_event(struct udev_list_node *node)
         return container_of(node, struct event, node);
 }
 
+static inline struct event_link *node_to_event_link(struct udev_list_node *node)
+{
+        return container_of(node, struct event_link, node);
+}
+
 static void event_queue_cleanup(struct udev *udev, enum event_state type);
 
 enum worker_state {
@@ -126,6 +213,7 @@ struct worker {
         enum worker_state state;
         struct event *event;
         usec_t event_start_usec;
+        usec_t idle_start_usec;
 };
 
 /* passed from worker to main process */
@@ -139,9 +227,158 @@ static inline struct worker *node_to_worker(struct udev_list_node *node)
         return container_of(node, struct worker, node);
 }
 
+static int event_index_add(struct event_link *link, Hashmap **index, hash_func_t hash_func, compare_func_t compare_func,
+                           const char *devpath, size_t devpath_len, dev_t devnum, int ifindex)
+{
+        struct event_slot *slot;
+        uint64_t devnum64 = devnum;
+        const void *key;
+
+        if (devpath != NULL)
+                key = devpath;
+        else if (ifindex != 0)
+                key = INT_TO_PTR(ifindex);
+        else
+                key = &devnum64;
+
+        if (hashmap_ensure_allocated(index, hash_func, compare_func) < 0)
+                return -1;
+
+        slot = hashmap_get(*index, key);
+        if (slot == NULL) {
+                slot = calloc(1, sizeof(struct event_slot) + devpath_len + 1);
+                if (slot == NULL)
+                        return -1;
+                slot->index = *index;
+                udev_list_node_init(&slot->links);
+                if (devpath != NULL) {
+                        memcpy(slot->devpath, devpath, devpath_len);
+                        slot->key = slot->devpath;
+                } else if (ifindex != 0) {
+                        slot->key = key;
+                } else {
+                        slot->devnum = devnum64;
+                        slot->key = &slot->devnum;
+                }
+                if (hashmap_put(*index, slot->key, slot) < 0) {
+                        free(slot);
+                        return -1;
+                }
+        }
+
+        link->slot = slot;
+        udev_list_node_append(&link->node, &slot->links);
+        return 0;
+}
+
+static void event_index_remove(struct event_link *link)
+{
+        struct event_slot *slot = link->slot;
+
+        if (slot == NULL)
+                return;
+
+        udev_list_node_remove(&link->node);
+        link->slot = NULL;
+        if (udev_list_node_is_empty(&slot->links)) {
+                hashmap_remove(slot->index, slot->key);
+                free(slot);
+        }
+}
+
+/* whether an event queued before the given one holds the key */
+static bool event_index_busy(Hashmap *index, const void *key, struct event *event)
+{
+        struct event_slot *slot;
+        struct event_link *first;
+
+        slot = hashmap_get(index, key);
+        if (slot == NULL)
+                return false;
+
+        first = node_to_event_link(slot->links.next);
+        return first->event->seqnum < event->seqnum;
+}
+
+static int event_index(struct event *event)
+{
+        char *path, *s;
+        unsigned int n;
+
+        /* the devpath, the device number, the ifindex, and every parent devpath */
+        n = 3;
+        for (s = (char *) event->devpath + 1; *s != '\0'; s++)
+                if (*s == '/')
+                        n++;
+
+        event->links = calloc(n, sizeof(struct event_link));
+        if (event->links == NULL)
+                return -1;
+        event->links_count = n;
+        for (n = 0; n < event->links_count; n++)
+                event->links[n].event = event;
+
+        n = 0;
+        if (event_index_add(&event->links[n++], &event_devpaths, string_hash_func, string_compare_func,
+                            event->devpath, event->devpath_len, 0, 0) < 0)
+                return -1;
+
+        if (major(event->devnum) != 0 &&
+            event_index_add(&event->links[n++], &event_devnums[event->is_block], uint64_hash_func, uint64_compare_func,
+                            NULL, 0, event->devnum, 0) < 0)
+                return -1;
+
+        if (event->ifindex != 0 &&
+            event_index_add(&event->links[n++], &event_ifindexes, trivial_hash_func, trivial_compare_func,
+                            NULL, 0, 0, event->ifindex) < 0)
+                return -1;
+
+        path = strdupa(event->devpath);
+        for (s = path + 1; *s != '\0'; s++) {
+                int r;
+
+                if (*s != '/')
+                        continue;
+                *s = '\0';
+                r = event_index_add(&event->links[n++], &event_parents, string_hash_func, string_compare_func,
+                                    path, s - path, 0, 0);
+                *s = '/';
+                if (r < 0)
+                        return -1;
+        }
+
+        return 0;
+}
+
+static void event_unindex(struct event *event)
+{
+        unsigned int i;
+
+        for (i = 0; i < event->links_count; i++)
+                event_index_remove(&event->links[i]);
+        free(event->links);
+        event->links = NULL;
+        event->links_count = 0;
+}
+
+static void event_index_free(void)
+{
+        hashmap_free(event_devpaths);
+        event_devpaths = NULL;
+        hashmap_free(event_parents);
+        event_parents = NULL;
+        hashmap_free(event_devnums[0]);
+        event_devnums[0] = NULL;
+        hashmap_free(event_devnums[1]);
+        event_devnums[1] = NULL;
+        hashmap_free(event_ifindexes);
+        event_ifindexes = NULL;
+}
+
 static void event_queue_delete(struct event *event, bool export)
 {
         udev_list_node_remove(&event->node);
+        event_unindex(event);
 
         if (export) {
                 udev_queue_export_device_finished(udev_queue_export, event->dev);
@@ -185,9 +422,102 @@ static void worker_list_cleanup(struct udev *udev)
         }
 }
 
-static void worker_new(struct event *event)
+static unsigned int stats_bucket(usec_t usec)
+{
+        usec_t limit = 100;
+        unsigned int i;
+
+        for (i = 0; i < STATS_BUCKETS - 1; i++) {
+                if (usec < limit)
+                        break;
+                limit *= 10;
+        }
+        return i;
+}
+
+static struct subsystem_stats *subsystem_stats_get(struct udev_device *dev)
+{
+        const char *subsystem;
+        struct subsystem_stats *s;
+
+        subsystem = udev_device_get_subsystem(dev);
+        if (subsystem == NULL)
+                subsystem = "";
+
+        if (stats_subsystems == NULL) {
+                stats_subsystems = hashmap_new(string_hash_func, string_compare_func);
+                if (stats_subsystems == NULL)
+                        return NULL;
+        }
+
+        s = hashmap_get(stats_subsystems, subsystem);
+        if (s != NULL)
+                return s;
+
+        s = calloc(1, sizeof(struct subsystem_stats) + strlen(subsystem) + 1);
+        if (s == NULL)
+                return NULL;
+        strcpy(s->subsystem, subsystem);
+        if (hashmap_put(stats_subsystems, s->subsystem, s) < 0) {
+                free(s);
+                return NULL;
+        }
+        return s;
+}
+
+static void event_account_start(struct event *event, usec_t usec)
+{
+        struct subsystem_stats *s;
+        usec_t latency;
+
+        latency = usec - event->queued_usec;
+        stats.events++;
+        stats.queue_usec += latency;
+        if (latency > stats.queue_usec_max)
+                stats.queue_usec_max = latency;
+
+        s = subsystem_stats_get(event->dev);
+        if (s != NULL)
+                s->queue[stats_bucket(latency)]++;
+}
+
+static void event_account_finish(struct event *event, usec_t usec)
+{
+        struct subsystem_stats *s;
+
+        stats.run_usec += usec;
+        if (usec > stats.run_usec_max)
+                stats.run_usec_max = usec;
+
+        s = subsystem_stats_get(event->dev);
+        if (s != NULL)
+                s->run[stats_bucket(usec)]++;
+}
+
+/* the change of a watched device is handled from now on, later writes need another one */
+static void watch_change_started(struct event *event)
+{
+        struct watch_change *c;
+        const char *action;
+
+        c = hashmap_get(watch_changes, udev_device_get_syspath(event->dev));
+        if (c == NULL)
+                return;
+
+        action = udev_device_get_action(event->dev);
+        if (streq_ptr(action, "change")) {
+                if (c->written_usec == 0)
+                        return;
+        } else if (!streq_ptr(action, "remove"))
+                return;
+
+        hashmap_remove(watch_changes, c->syspath);
+        free(c);
+}
+
+/* fork a worker, with an initial event to handle, or idle until one is sent */
+static int worker_new(struct udev *udev, struct event *event)
 {
-        struct udev *udev = event->udev;
         struct worker *worker;
         struct udev_monitor *worker_monitor;
         pid_t pid;
@@ -195,7 +525,7 @@ static void worker_new(struct event *event)
         /* listen for new events */
         worker_monitor = udev_monitor_new_from_netlink(udev, NULL);
         if (worker_monitor == NULL)
-                return;
+                return -1;
         /* allow the main daemon netlink address to send devices to the worker */
         udev_monitor_allow_unicast_sender(worker_monitor, monitor);
         udev_monitor_enable_receiving(worker_monitor);
@@ -203,10 +533,10 @@ static void worker_new(struct event *event)
         worker = calloc(1, sizeof(struct worker));
         if (worker == NULL) {
                 udev_monitor_unref(worker_monitor);
-                return;
+                return -1;
         }
         /* worker + event reference */
-        worker->refcount = 2;
+        worker->refcount = event != NULL ? 2 : 1;
         worker->udev = udev;
 
         pid = fork();
@@ -219,12 +549,15 @@ static void worker_new(struct event *event)
                 int rc = EXIT_SUCCESS;
 
                 /* take initial device from queue */
-                dev = event->dev;
-                event->dev = NULL;
+                if (event != NULL) {
+                        dev = event->dev;
+                        event->dev = NULL;
+                }
 
                 free(worker);
                 worker_list_cleanup(udev);
                 event_queue_cleanup(udev, EVENT_UNDEF);
+                event_index_free();
                 udev_queue_export_unref(udev_queue_export);
                 udev_monitor_unref(monitor);
                 udev_ctrl_unref(udev_ctrl);
@@ -274,7 +607,44 @@ static void worker_new(struct event *event)
                         struct worker_message msg;
                         int err;
 
+                        /* wait for the next device message from main udevd, or term signal */
+                        while (dev == NULL) {
+                                struct epoll_event ev[4];
+                                int fdcount;
+                                int i;
+
+                                fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev), -1);
+                                if (fdcount < 0) {
+                                        if (errno == EINTR)
+                                                continue;
+                                        log_error("failed to poll: %m\n");
+                                        goto out;
+                                }
+
+                                for (i = 0; i < fdcount; i++) {
+                                        if (ev[i].data.fd == fd_monitor && ev[i].events & EPOLLIN) {
+                                                dev = udev_monitor_receive_device(worker_monitor);
+                                                break;
+                                        } else if (ev[i].data.fd == fd_signal && ev[i].events & EPOLLIN) {
+                                                struct signalfd_siginfo fdsi;
+                                                ssize_t size;
+
+                                                size = read(fd_signal, &fdsi, sizeof(struct signalfd_siginfo));
+                                                if (size != sizeof(struct signalfd_siginfo))
+                                                        continue;
+                                                switch (fdsi.ssi_signo) {
+                                                case SIGTERM:
+                                                        goto out;
+                                                }
+                                        }
+                                }
+                        }
+
                         log_debug("seq %llu running\n", udev_device_get_seqnum(dev));
+                        if (worker_cache_seqnum != NULL) {
+                                udev_builtin_cache_validate(*worker_cache_seqnum);
+                                udev_device_cache_validate(udev, *worker_cache_seqnum);
+                        }
                         udev_event = udev_event_new(dev);
                         if (udev_event == NULL) {
                                 rc = 5;
@@ -291,7 +661,7 @@ static void worker_new(struct event *event)
                         err = udev_event_execute_rules(udev_event, rules, &sigmask_orig);
 
                         if (err == 0)
-                                udev_event_execute_run(udev_event, &sigmask_orig);
+                                udev_event_execute_run(udev_event, rules, &sigmask_orig);
 
                         /* apply/restore inotify watch */
                         if (err == 0 && udev_event->inotify_watch) {
@@ -320,39 +690,6 @@ static void worker_new(struct event *event)
                         }
 
                         udev_event_unref(udev_event);
-
-                        /* wait for more device messages from main udevd, or term signal */
-                        while (dev == NULL) {
-                                struct epoll_event ev[4];
-                                int fdcount;
-                                int i;
-
-                                fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev), -1);
-                                if (fdcount < 0) {
-                                        if (errno == EINTR)
-                                                continue;
-                                        log_error("failed to poll: %m\n");
-                                        goto out;
-                                }
-
-                                for (i = 0; i < fdcount; i++) {
-                                        if (ev[i].data.fd == fd_monitor && ev[i].events & EPOLLIN) {
-                                                dev = udev_monitor_receive_device(worker_monitor);
-                                                break;
-                                        } else if (ev[i].data.fd == fd_signal && ev[i].events & EPOLLIN) {
-                                                struct signalfd_siginfo fdsi;
-                                                ssize_t size;
-
-                                                size = read(fd_signal, &fdsi, sizeof(struct signalfd_siginfo));
-                                                if (size != sizeof(struct signalfd_siginfo))
-                                                        continue;
-                                                switch (fdsi.ssi_signo) {
-                                                case SIGTERM:
-                                                        goto out;
-                                                }
-                                        }
-                                }
-                        }
                 }
 out:
                 udev_device_unref(dev);
@@ -370,31 +707,49 @@ out:
                 exit(rc);
         }
         case -1:
+                log_error("fork of child failed: %m\n");
                 udev_monitor_unref(worker_monitor);
-                event->state = EVENT_QUEUED;
+                if (event != NULL)
+                        event->state = EVENT_QUEUED;
                 free(worker);
-                log_error("fork of child failed: %m\n");
-                break;
+                return -1;
         default:
                 /* close monitor, but keep address around */
                 udev_monitor_disconnect(worker_monitor);
                 worker->monitor = worker_monitor;
                 worker->pid = pid;
-                worker->state = WORKER_RUNNING;
-                worker->event_start_usec = now(CLOCK_MONOTONIC);
-                worker->event = event;
-                event->state = EVENT_RUNNING;
+                if (event != NULL) {
+                        worker->state = WORKER_RUNNING;
+                        worker->event_start_usec = now(CLOCK_MONOTONIC);
+                        worker->event = event;
+                        event->state = EVENT_RUNNING;
+                        event_account_start(event, worker->event_start_usec);
+                        watch_change_started(event);
+                        log_debug("seq %llu forked new worker [%u]\n", udev_device_get_seqnum(event->dev), pid);
+                } else {
+                        worker->state = WORKER_IDLE;
+                        worker->idle_start_usec = now(CLOCK_MONOTONIC);
+                        log_debug("forked idle worker [%u]\n", pid);
+                }
                 udev_list_node_append(&worker->node, &worker_list);
                 children++;
-                log_debug("seq %llu forked new worker [%u]\n", udev_device_get_seqnum(event->dev), pid);
+                stats.forked++;
                 break;
         }
+
+        return 0;
 }
 
 static void event_run(struct event *event)
 {
         struct udev_list_node *loop;
 
+        TRACE2(udev_event_run, event->seqnum, event->devpath);
+
+        /* the event might change the parents of devices handled later */
+        if (worker_cache_seqnum != NULL && !streq_ptr(udev_device_get_action(event->dev), "add"))
+                *worker_cache_seqnum = event->seqnum;
+
         udev_list_node_foreach(loop, &worker_list) {
                 struct worker *worker = node_to_worker(loop);
                 ssize_t count;
@@ -414,6 +769,8 @@ static void event_run(struct event *event)
                 worker->state = WORKER_RUNNING;
                 worker->event_start_usec = now(CLOCK_MONOTONIC);
                 event->state = EVENT_RUNNING;
+                event_account_start(event, worker->event_start_usec);
+                watch_change_started(event);
                 return;
         }
 
@@ -424,7 +781,7 @@ static void event_run(struct event *event)
         }
 
         /* start new worker and pass initial device */
-        worker_new(event);
+        worker_new(event->udev, event);
 }
 
 static int event_queue_insert(struct udev_device *dev)
@@ -444,6 +801,12 @@ static int event_queue_insert(struct udev_device *dev)
         event->devnum = udev_device_get_devnum(dev);
         event->is_block = streq("block", udev_device_get_subsystem(dev));
         event->ifindex = udev_device_get_ifindex(dev);
+        event->queued_usec = now(CLOCK_MONOTONIC);
+        if (event_index(event) < 0) {
+                event_unindex(event);
+                free(event);
+                return -1;
+        }
 #ifdef HAVE_FIRMWARE
         if (streq(udev_device_get_subsystem(dev), "firmware"))
                 event->nodelay = true;
@@ -455,6 +818,7 @@ static int event_queue_insert(struct udev_device *dev)
 
         event->state = EVENT_QUEUED;
         udev_list_node_append(&event->node, &event_list);
+        TRACE3(udev_event_queue, event->seqnum, event->devpath, udev_device_get_action(dev));
         return 0;
 }
 
@@ -473,83 +837,244 @@ static void worker_kill(struct udev *udev)
         }
 }
 
-/* lookup event for identical, parent, child device */
-static bool is_devpath_busy(struct event *event)
+/*
+ * Keep children_min idle workers forked ahead of time, so that the
+ * first events of a burst do not wait for fork() and for the worker
+ * to set itself up. More workers are forked on demand while events
+ * queue up, up to children_max.
+ */
+static void worker_pool_fill(struct udev *udev)
 {
         struct udev_list_node *loop;
-        size_t common;
+        int alive = 0;
+        int idle = 0;
 
-        /* check if queue contains events we depend on */
-        udev_list_node_foreach(loop, &event_list) {
-                struct event *loop_event = node_to_event(loop);
+        udev_list_node_foreach(loop, &worker_list) {
+                struct worker *worker = node_to_worker(loop);
 
-                /* we already found a later event, earlier can not block us, no need to check again */
-                if (loop_event->seqnum < event->delaying_seqnum)
+                if (worker->state == WORKER_KILLED)
                         continue;
+                alive++;
+                if (worker->state == WORKER_IDLE)
+                        idle++;
+        }
 
-                /* event we checked earlier still exists, no need to check again */
-                if (loop_event->seqnum == event->delaying_seqnum)
-                        return true;
-
-                /* found ourself, no later event can block us */
-                if (loop_event->seqnum >= event->seqnum)
+        while (idle < children_min && alive < children_max) {
+                if (worker_new(udev, NULL) < 0)
                         break;
+                idle++;
+                alive++;
+        }
+}
 
-                /* check major/minor */
-                if (major(event->devnum) != 0 && event->devnum == loop_event->devnum && event->is_block == loop_event->is_block)
-                        return true;
+/* stop the workers which idled for a while beyond the size of the pool */
+static void worker_pool_trim(struct udev *udev)
+{
+        struct udev_list_node *loop;
+        usec_t usec;
+        int idle = 0;
 
-                /* check network device ifindex */
-                if (event->ifindex != 0 && event->ifindex == loop_event->ifindex)
-                        return true;
+        usec = now(CLOCK_MONOTONIC);
+        udev_list_node_foreach(loop, &worker_list) {
+                struct worker *worker = node_to_worker(loop);
 
-                /* check our old name */
-                if (event->devpath_old != NULL && streq(loop_event->devpath, event->devpath_old)) {
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
+                if (worker->state != WORKER_IDLE)
+                        continue;
 
-                /* compare devpath */
-                common = MIN(loop_event->devpath_len, event->devpath_len);
+                idle++;
+                if (idle <= children_min)
+                        continue;
 
-                /* one devpath is contained in the other? */
-                if (memcmp(loop_event->devpath, event->devpath, common) != 0)
+                if ((usec - worker->idle_start_usec) < 3 * 1000 * 1000)
                         continue;
 
-                /* identical device event found */
-                if (loop_event->devpath_len == event->devpath_len) {
-                        /* devices names might have changed/swapped in the meantime */
-                        if (major(event->devnum) != 0 && (event->devnum != loop_event->devnum || event->is_block != loop_event->is_block))
-                                continue;
-                        if (event->ifindex != 0 && event->ifindex != loop_event->ifindex)
-                                continue;
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
+                log_debug("worker [%u] idle, stop it\n", worker->pid);
+                worker->state = WORKER_KILLED;
+                kill(worker->pid, SIGTERM);
+                stats.idle_killed++;
+        }
+}
+
+/* whether there is nothing to wait for but new events */
+static bool worker_pool_idle(void)
+{
+        struct udev_list_node *loop;
+
+        if (!udev_list_node_is_empty(&event_list))
+                return false;
+
+        if (children > children_min)
+                return false;
+
+        udev_list_node_foreach(loop, &worker_list) {
+                struct worker *worker = node_to_worker(loop);
+
+                if (worker->state != WORKER_IDLE)
+                        return false;
+        }
+
+        return true;
+}
+
+/* cleanup possible left-over processes in our cgroup, but spare the idle workers */
+static void cgroup_cleanup(void)
+{
+        struct udev_list_node *loop;
+        Set *s;
+
+        s = set_new(trivial_hash_func, trivial_compare_func);
+        if (s == NULL)
+                return;
+
+        udev_list_node_foreach(loop, &worker_list) {
+                struct worker *worker = node_to_worker(loop);
+
+                if (set_put(s, LONG_TO_PTR(worker->pid)) < 0)
+                        goto out;
+        }
+
+        cg_kill(SYSTEMD_CGROUP_CONTROLLER, udev_cgroup, SIGKILL, false, true, s);
+out:
+        set_free(s);
+}
+
+static void stats_collect(struct udev_ctrl_stats *s)
+{
+        struct udev_list_node *loop;
+        unsigned long long int events;
+        usec_t usec;
+
+        memset(s, 0, sizeof(struct udev_ctrl_stats));
+
+        udev_list_node_foreach(loop, &worker_list) {
+                struct worker *worker = node_to_worker(loop);
+
+                if (worker->state == WORKER_RUNNING)
+                        s->workers_running++;
+                else if (worker->state == WORKER_IDLE)
+                        s->workers_idle++;
+        }
+
+        /* the queue is ordered by seqnum */
+        usec = now(CLOCK_MONOTONIC);
+        udev_list_node_foreach(loop, &event_list) {
+                struct event *event = node_to_event(loop);
+
+                if (event->state == EVENT_RUNNING) {
+                        s->events_running++;
+                        continue;
+                }
+                if (event->state != EVENT_QUEUED)
+                        continue;
+                if (s->events_queued == 0) {
+                        s->oldest_seqnum = event->seqnum;
+                        s->oldest_usec = usec - event->queued_usec;
                 }
+                s->events_queued++;
+        }
+
+        events = MAX(stats.events, 1ULL);
+        s->events = stats.events;
+        s->queue_usec_avg = stats.queue_usec / events;
+        s->queue_usec_max = stats.queue_usec_max;
+        s->run_usec_avg = stats.run_usec / events;
+        s->run_usec_max = stats.run_usec_max;
+        s->children_min = children_min;
+        s->children_max = children_max;
+        s->forked = stats.forked;
+        s->idle_killed = stats.idle_killed;
+        s->exec_queue_stopped = stop_exec_queue;
+}
+
+static void log_stats(void)
+{
+        struct udev_ctrl_stats counters;
+
+        stats_collect(&counters);
+        log_info("%llu events started, %u queued; queue latency avg %llu max %llu usec, "
+                 "run time avg %llu max %llu usec; %u workers running, %u idle (pool %i-%i), "
+                 "%u forked, %u stopped after idling\n",
+                 counters.events, counters.events_queued,
+                 counters.queue_usec_avg, counters.queue_usec_max,
+                 counters.run_usec_avg, counters.run_usec_max,
+                 counters.workers_running, counters.workers_idle, counters.children_min, counters.children_max,
+                 counters.forked, counters.idle_killed);
+        if (counters.events_queued > 0)
+                log_info("oldest queued event seq %llu, waiting for %llu usec\n",
+                         counters.oldest_seqnum, counters.oldest_usec);
+
+        if (!hashmap_isempty(stats_subsystems)) {
+                struct subsystem_stats *s;
+                Iterator i;
+
+                log_info("events per subsystem waiting in the queue, and running, "
+                         "for <100us/<1ms/<10ms/<100ms/<1s/<10s/more:\n");
+                HASHMAP_FOREACH(s, stats_subsystems, i)
+                        log_info("%s: queue %u/%u/%u/%u/%u/%u/%u, run %u/%u/%u/%u/%u/%u/%u\n",
+                                 s->subsystem[0] != '\0' ? s->subsystem : "(none)",
+                                 s->queue[0], s->queue[1], s->queue[2], s->queue[3],
+                                 s->queue[4], s->queue[5], s->queue[6],
+                                 s->run[0], s->run[1], s->run[2], s->run[3],
+                                 s->run[4], s->run[5], s->run[6]);
+        }
+
+        /* the time spent in the programs and builtins of the current rules */
+        if (rules != NULL)
+                udev_rules_log_stats(rules, 20);
+}
+
+/* lookup event for identical, parent, child device */
+static bool is_devpath_busy(struct event *event)
+{
+        char *path, *s;
+
+        /* check major/minor */
+        if (major(event->devnum) != 0) {
+                uint64_t devnum = event->devnum;
+
+                if (event_index_busy(event_devnums[event->is_block], &devnum, event))
+                        return true;
+        }
+
+        /* check network device ifindex */
+        if (event->ifindex != 0 && event_index_busy(event_ifindexes, INT_TO_PTR(event->ifindex), event))
+                return true;
+
+        /* check our old name */
+        if (event->devpath_old != NULL && event_index_busy(event_devpaths, event->devpath_old, event))
+                return true;
+
+        /*
+         * identical device event found; devices names might have changed/swapped in
+         * the meantime, so if we have a device number or ifindex, only an event with
+         * the same one blocks us, which is checked above
+         */
+        if (major(event->devnum) == 0 && event->ifindex == 0 &&
+            event_index_busy(event_devpaths, event->devpath, event))
+                return true;
 
 #ifdef HAVE_FIRMWARE
-                /* allow to bypass the dependency tracking */
-                if (event->nodelay)
-                        continue;
+        /* allow to bypass the dependency tracking */
+        if (event->nodelay)
+                return false;
 #endif
 
-                /* parent device event found */
-                if (event->devpath[common] == '/') {
-                        event->delaying_seqnum = loop_event->seqnum;
-                        return true;
-                }
+        /* parent device event found */
+        path = strdupa(event->devpath);
+        for (s = path + 1; *s != '\0'; s++) {
+                bool busy;
 
-                /* child device event found */
-                if (loop_event->devpath[common] == '/') {
-                        event->delaying_seqnum = loop_event->seqnum;
+                if (*s != '/')
+                        continue;
+                *s = '\0';
+                busy = event_index_busy(event_devpaths, path, event);
+                *s = '/';
+                if (busy)
                         return true;
-                }
-
-                /* no matching device */
-                continue;
         }
 
-        return false;
+        /* child device event found */
+        return event_index_busy(event_parents, event->devpath, event);
 }
 
 static void event_queue_start(struct udev *udev)
@@ -604,12 +1129,20 @@ static void worker_returned(int fd_worker)
 
                         /* worker returned */
                         if (worker->event) {
+                                usec_t usec;
+
+                                usec = now(CLOCK_MONOTONIC) - worker->event_start_usec;
+                                event_account_finish(worker->event, usec);
+
                                 worker->event->exitcode = msg.exitcode;
+                                TRACE3(udev_event_finish, worker->event->seqnum, worker->event->devpath, msg.exitcode);
                                 event_queue_delete(worker->event, true);
                                 worker->event = NULL;
                         }
-                        if (worker->state != WORKER_KILLED)
+                        if (worker->state != WORKER_KILLED) {
                                 worker->state = WORKER_IDLE;
+                                worker->idle_start_usec = now(CLOCK_MONOTONIC);
+                        }
                         worker_unref(worker);
                         break;
                 }
@@ -692,6 +1225,20 @@ static struct udev_ctrl_connection *handle_ctrl_msg(struct udev_ctrl *uctrl)
         if (udev_ctrl_get_ping(ctrl_msg) > 0)
                 log_debug("udevd message (SYNC) received\n");
 
+        if (udev_ctrl_get_log_stats(ctrl_msg) > 0) {
+                log_debug("udevd message (LOG_STATS) received\n");
+                log_stats();
+        }
+
+        if (udev_ctrl_get_stats(ctrl_msg) > 0) {
+                struct udev_ctrl_stats stats_reply;
+
+                log_debug("udevd message (GET_STATS) received\n");
+                stats_collect(&stats_reply);
+                if (udev_ctrl_reply_stats(ctrl_msg, &stats_reply) < 0)
+                        log_debug("unable to send stats: %m\n");
+        }
+
         if (udev_ctrl_get_exit(ctrl_msg) > 0) {
                 log_debug("udevd message (EXIT) received\n");
                 udev_exit = true;
@@ -703,6 +1250,91 @@ out:
         return udev_ctrl_connection_unref(ctrl_conn);
 }
 
+static void watch_change_write(struct watch_change *c, usec_t usec)
+{
+        char filename[UTIL_PATH_SIZE];
+        int fd;
+
+        strscpyl(filename, sizeof(filename), c->syspath, "/uevent", NULL);
+        fd = open(filename, O_WRONLY|O_CLOEXEC);
+        if (fd >= 0) {
+                if (write(fd, "change", 6) < 0)
+                        log_debug("error writing uevent: %m\n");
+                close(fd);
+        }
+        c->written_usec = usec;
+}
+
+static void watch_change_request(struct udev_device *dev)
+{
+        struct watch_change *c;
+        const char *syspath;
+        usec_t usec;
+
+        usec = now(CLOCK_MONOTONIC);
+        syspath = udev_device_get_syspath(dev);
+
+        c = hashmap_get(watch_changes, syspath);
+        if (c != NULL) {
+                /* the change did not make it into the queue, write it again */
+                if (c->written_usec > 0 && usec - c->written_usec > WATCH_CHANGE_TIMEOUT_USEC) {
+                        watch_change_write(c, usec);
+                        return;
+                }
+                log_debug("'change' of %s not handled yet, not synthesising another one\n", syspath);
+                return;
+        }
+
+        if (watch_changes == NULL) {
+                watch_changes = hashmap_new(string_hash_func, string_compare_func);
+                if (watch_changes == NULL)
+                        return;
+        }
+
+        c = calloc(1, sizeof(struct watch_change) + strlen(syspath) + 1);
+        if (c == NULL)
+                return;
+        strcpy(c->syspath, syspath);
+        if (hashmap_put(watch_changes, c->syspath, c) < 0) {
+                free(c);
+                return;
+        }
+
+        c->due_usec = usec + watch_delay_usec;
+        if (watch_delay_usec == 0)
+                watch_change_write(c, usec);
+}
+
+/* write the changes which were delayed long enough, return the time until the next one is due */
+static int watch_changes_flush(void)
+{
+        struct watch_change *c;
+        Iterator i;
+        usec_t usec;
+        int timeout = -1;
+
+        if (hashmap_isempty(watch_changes))
+                return -1;
+
+        usec = now(CLOCK_MONOTONIC);
+        HASHMAP_FOREACH(c, watch_changes, i) {
+                int t;
+
+                if (c->written_usec > 0)
+                        continue;
+
+                if (c->due_usec <= usec) {
+                        watch_change_write(c, usec);
+                        continue;
+                }
+
+                t = (c->due_usec - usec) / USEC_PER_MSEC + 1;
+                if (timeout < 0 || t < timeout)
+                        timeout = t;
+        }
+        return timeout;
+}
+
 /* read inotify messages */
 static int handle_inotify(struct udev *udev)
 {
@@ -726,20 +1358,13 @@ static int handle_inotify(struct udev *udev)
 
                 ev = (struct inotify_event *)(buf + pos);
                 dev = udev_watch_lookup(udev, ev->wd);
+                if (ev->mask & IN_IGNORED)
+                        udev_watch_invalidate(ev->wd);
                 if (dev != NULL) {
                         log_debug("inotify event: %x for %s\n", ev->mask, udev_device_get_devnode(dev));
                         if (ev->mask & IN_CLOSE_WRITE) {
-                                char filename[UTIL_PATH_SIZE];
-                                int fd;
-
                                 log_debug("device %s closed, synthesising 'change'\n", udev_device_get_devnode(dev));
-                                strscpyl(filename, sizeof(filename), udev_device_get_syspath(dev), "/uevent", NULL);
-                                fd = open(filename, O_WRONLY);
-                                if (fd >= 0) {
-                                        if (write(fd, "change", 6) < 0)
-                                                log_debug("error writing uevent: %m\n");
-                                        close(fd);
-                                }
+                                watch_change_request(dev);
                         }
                         if (ev->mask & IN_IGNORED)
                                 udev_watch_end(udev, dev);
@@ -923,7 +1548,9 @@ static int systemd_fds(struct udev *udev, int *rctrl, int *rnetlink)
  * read the kernel commandline, in case we need to get into debug mode
  *   udev.log-priority=<level>              syslog priority
  *   udev.children-max=<number of workers>  events are fully serialized if set to 1
+ *   udev.children-min=<number of workers>  idle workers to keep around
  *   udev.exec-delay=<number of seconds>    delay execution of every executed program
+ *   udev.watch-delay=<number of msec>      delay the "change" of a watched device after writes
  */
 static void kernel_cmdline_options(struct udev *udev)
 {
@@ -954,8 +1581,12 @@ static void kernel_cmdline_options(struct udev *udev)
                         udev_set_log_priority(udev, prio);
                 } else if (startswith(opt, "udev.children-max=")) {
                         children_max = strtoul(opt + 18, NULL, 0);
+                } else if (startswith(opt, "udev.children-min=")) {
+                        children_min = strtoul(opt + 18, NULL, 0);
                 } else if (startswith(opt, "udev.exec-delay=")) {
                         exec_delay = strtoul(opt + 16, NULL, 0);
+                } else if (startswith(opt, "udev.watch-delay=")) {
+                        watch_delay_usec = strtoul(opt + 17, NULL, 0) * USEC_PER_MSEC;
                 }
 
                 free(s);
@@ -974,7 +1605,9 @@ int main(int argc, char *argv[])
                 { "daemon", no_argument, NULL, 'd' },
                 { "debug", no_argument, NULL, 'D' },
                 { "children-max", required_argument, NULL, 'c' },
+                { "children-min", required_argument, NULL, 'm' },
                 { "exec-delay", required_argument, NULL, 'e' },
+                { "watch-delay", required_argument, NULL, 'w' },
                 { "resolve-names", required_argument, NULL, 'N' },
                 { "help", no_argument, NULL, 'h' },
                 { "version", no_argument, NULL, 'V' },
@@ -994,6 +1627,7 @@ int main(int argc, char *argv[])
         log_set_target(LOG_TARGET_AUTO);
         log_parse_environment();
         log_open();
+        log_set_queue(true);
         udev_set_log_fn(udev, udev_main_log);
         log_debug("version %s\n", VERSION);
         label_init("/dev");
@@ -1001,7 +1635,7 @@ int main(int argc, char *argv[])
         for (;;) {
                 int option;
 
-                option = getopt_long(argc, argv, "c:de:DtN:hV", options, NULL);
+                option = getopt_long(argc, argv, "c:m:de:w:DtN:hV", options, NULL);
                 if (option == -1)
                         break;
 
@@ -1012,9 +1646,15 @@ int main(int argc, char *argv[])
                 case 'c':
                         children_max = strtoul(optarg, NULL, 0);
                         break;
+                case 'm':
+                        children_min = strtoul(optarg, NULL, 0);
+                        break;
                 case 'e':
                         exec_delay = strtoul(optarg, NULL, 0);
                         break;
+                case 'w':
+                        watch_delay_usec = strtoul(optarg, NULL, 0) * USEC_PER_MSEC;
+                        break;
                 case 'D':
                         debug = true;
                         log_set_max_level(LOG_DEBUG);
@@ -1038,7 +1678,9 @@ int main(int argc, char *argv[])
                                "  --daemon\n"
                                "  --debug\n"
                                "  --children-max=<maximum number of workers>\n"
+                               "  --children-min=<number of idle workers to keep around>\n"
                                "  --exec-delay=<seconds to wait before executing RUN=>\n"
+                               "  --watch-delay=<msec to collect writes to watched devices>\n"
                                "  --resolve-names=early|late|never\n"
                                "  --version\n"
                                "  --help\n"
@@ -1150,6 +1792,9 @@ int main(int argc, char *argv[])
                 goto exit;
         }
 
+        /* we do not know what happened to the database since it was written */
+        udev_db_invalidate_snapshot(udev);
+
         if (daemonize) {
                 pid_t pid;
 
@@ -1216,6 +1861,12 @@ int main(int argc, char *argv[])
         }
         fd_worker = worker_watch[READ_END];
 
+        /* without it, the workers do not cache anything across events */
+        worker_cache_seqnum = mmap(NULL, sizeof(unsigned long long int), PROT_READ|PROT_WRITE,
+                                   MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+        if (worker_cache_seqnum == MAP_FAILED)
+                worker_cache_seqnum = NULL;
+
         udev_builtin_init(udev);
 
         rules = udev_rules_new(udev, resolve_names);
@@ -1223,6 +1874,8 @@ int main(int argc, char *argv[])
                 log_error("error reading rules\n");
                 goto exit;
         }
+        udev_rules_enable_stats(rules);
+        udev_rules_write_cache(rules);
 
         memset(&ep_ctrl, 0, sizeof(struct epoll_event));
         ep_ctrl.events = EPOLLIN;
@@ -1269,6 +1922,18 @@ int main(int argc, char *argv[])
         }
         log_debug("set children_max to %u\n", children_max);
 
+        if (children_min < 0) {
+                cpu_set_t cpu_set;
+
+                children_min = 1;
+
+                if (sched_getaffinity(0, sizeof (cpu_set), &cpu_set) == 0)
+                        children_min = CPU_COUNT(&cpu_set);
+        }
+        if (children_min > children_max)
+                children_min = children_max;
+        log_debug("set children_min to %u\n", children_min);
+
         udev_rules_apply_static_dev_perms(rules);
 
         udev_list_node_init(&event_list);
@@ -1309,17 +1974,38 @@ int main(int argc, char *argv[])
 
                         /* timeout at exit for workers to finish */
                         timeout = 30 * 1000;
-                } else if (udev_list_node_is_empty(&event_list) && !children) {
+                } else if (worker_pool_idle()) {
                         /* we are idle */
                         timeout = -1;
 
-                        /* cleanup possible left-over processes in our cgroup */
                         if (udev_cgroup)
-                                cg_kill(SYSTEMD_CGROUP_CONTROLLER, udev_cgroup, SIGKILL, false, true, NULL);
+                                cgroup_cleanup();
+
+                        /* publish the database once things settled down */
+                        if (!db_snapshot_valid) {
+                                usec_t usec = now(CLOCK_MONOTONIC);
+
+                                if (usec - db_snapshot_usec >= DB_SNAPSHOT_INTERVAL_USEC) {
+                                        if (udev_db_write_snapshot(udev) >= 0)
+                                                db_snapshot_valid = true;
+                                        db_snapshot_usec = usec;
+                                } else
+                                        timeout = (DB_SNAPSHOT_INTERVAL_USEC - (usec - db_snapshot_usec)) / USEC_PER_MSEC + 1;
+                        }
                 } else {
                         /* kill idle or hanging workers */
                         timeout = 3 * 1000;
                 }
+                if (log_flush() < 0 && (timeout < 0 || timeout > LOG_FLUSH_RETRY_MSEC))
+                        timeout = LOG_FLUSH_RETRY_MSEC;
+                if (!udev_exit) {
+                        int t;
+
+                        /* synthesize the delayed changes of watched devices */
+                        t = watch_changes_flush();
+                        if (t >= 0 && (timeout < 0 || t < timeout))
+                                timeout = t;
+                }
                 fdcount = epoll_wait(fd_ep, ev, ELEMENTSOF(ev), timeout);
                 if (fdcount < 0)
                         continue;
@@ -1333,11 +2019,9 @@ int main(int argc, char *argv[])
                                 break;
                         }
 
-                        /* kill idle workers */
-                        if (udev_list_node_is_empty(&event_list)) {
-                                log_debug("cleanup idle workers\n");
-                                worker_kill(udev);
-                        }
+                        /* kill idle workers beyond the pool */
+                        if (udev_list_node_is_empty(&event_list))
+                                worker_pool_trim(udev);
 
                         /* check for hanging events */
                         udev_list_node_foreach(loop, &worker_list) {
@@ -1414,13 +2098,28 @@ int main(int argc, char *argv[])
 
                 /* start new events */
                 if (!udev_list_node_is_empty(&event_list) && !udev_exit && !stop_exec_queue) {
+                        /* events change the database, readers have to use the files */
+                        if (db_snapshot_valid) {
+                                udev_db_invalidate_snapshot(udev);
+                                db_snapshot_valid = false;
+                        }
+
                         udev_builtin_init(udev);
-                        if (rules == NULL)
+                        if (rules == NULL) {
                                 rules = udev_rules_new(udev, resolve_names);
+                                if (rules != NULL) {
+                                        udev_rules_write_cache(rules);
+                                        udev_rules_enable_stats(rules);
+                                }
+                        }
                         if (rules != NULL)
                                 event_queue_start(udev);
                 }
 
+                /* refill the pool of idle workers */
+                if (rules != NULL && !udev_exit)
+                        worker_pool_fill(udev);
+
                 if (is_signal) {
                         struct signalfd_siginfo fdsi;
                         ssize_t size;
@@ -1460,6 +2159,9 @@ exit_daemonize:
                 close(fd_ep);
         worker_list_cleanup(udev);
         event_queue_cleanup(udev, EVENT_UNDEF);
+        event_index_free();
+        hashmap_free_free(stats_subsystems);
+        hashmap_free_free(watch_changes);
         udev_rules_unref(rules);
         udev_builtin_exit(udev);
         if (fd_signal >= 0)